@@ -0,0 +1,185 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of ACK aggregation for --ack_aggregation; see
+ * ack_aggregation.h.
+ */
+
+#include "ack_aggregation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+#include "tcp_options_iterator.h"
+
+struct ack_aggregator {
+	struct ack_profile profile;
+	struct ack_entry *held;		/* ACKs held back, oldest first */
+	int num_held;
+	int max_held;
+	struct ack_entry *out;		/* entries to hand back this call */
+	int num_out;
+	int max_out;
+};
+
+int parse_ack_profile(const char *arg, struct ack_profile *profile,
+		      char **error)
+{
+	const char *count = strchr(arg, ':');
+	char *end = NULL;
+	long value;
+
+	memset(profile, 0, sizeof(*profile));
+	if (count != NULL && count - arg == strlen("stretch") &&
+	    strncmp(arg, "stretch", count - arg) == 0) {
+		profile->mode = ACK_AGGREGATION_STRETCH;
+	} else if (count != NULL && count - arg == strlen("burst") &&
+		   strncmp(arg, "burst", count - arg) == 0) {
+		profile->mode = ACK_AGGREGATION_BURST;
+	} else {
+		asprintf(error, "expected stretch:<count> or burst:<count>");
+		return STATUS_ERR;
+	}
+	value = strtol(count + 1, &end, 10);
+	if (end == count + 1 || *end != '\0' ||
+	    value < 2 || value > ACK_AGGREGATION_MAX_COUNT) {
+		asprintf(error, "count must be 2 to %d",
+			 ACK_AGGREGATION_MAX_COUNT);
+		return STATUS_ERR;
+	}
+	profile->count = value;
+	return STATUS_OK;
+}
+
+struct ack_aggregator *ack_aggregator_new(const struct ack_profile *profile)
+{
+	struct ack_aggregator *aggregator = calloc(1, sizeof(*aggregator));
+
+	aggregator->profile = *profile;
+	return aggregator;
+}
+
+void ack_aggregator_free(struct ack_aggregator *aggregator)
+{
+	int i;
+
+	if (aggregator == NULL)
+		return;
+	for (i = 0; i < aggregator->num_held; ++i)
+		packet_free(aggregator->held[i].packet);
+	free(aggregator->held);
+	free(aggregator->out);
+	free(aggregator);
+}
+
+bool is_pure_ack(struct packet *packet)
+{
+	struct tcp_option *dss;
+	u8 subtype;
+
+	if (packet->tcp == NULL || !packet->tcp->ack || packet->tcp->syn ||
+	    packet->tcp->fin || packet->tcp->rst ||
+	    packet_payload_len(packet) != 0)
+		return false;
+
+	/* A DSS option may only carry a data ACK; any other MPTCP option
+	 * (e.g. the MP_CAPABLE or MP_JOIN third ACK) is signalling we
+	 * should not delay.
+	 */
+	dss = get_mptcp_option(packet, DSS_SUBTYPE);
+	if (dss != NULL && (dss->data.dss.flag_M || dss->data.dss.flag_F))
+		return false;
+	for (subtype = MP_CAPABLE_SUBTYPE; subtype <= MP_FASTCLOSE_SUBTYPE;
+	     ++subtype) {
+		if (subtype != DSS_SUBTYPE &&
+		    get_mptcp_option(packet, subtype) != NULL)
+			return false;
+	}
+	return true;
+}
+
+static void append_entry(struct ack_entry **entries, int *num_entries,
+			 int *max_entries, const struct ack_entry *entry)
+{
+	if (*num_entries == *max_entries) {
+		*max_entries = *max_entries ? 2 * *max_entries : 16;
+		*entries = realloc(*entries,
+				   *max_entries * sizeof((*entries)[0]));
+	}
+	(*entries)[(*num_entries)++] = *entry;
+}
+
+/* Move the ACKs held on the socket, oldest first, to the output. In
+ * stretch mode only the newest is injected: it acks all the others do.
+ */
+static void release_held(struct ack_aggregator *aggregator,
+			 const struct socket *socket)
+{
+	int num_on_socket = 0, released = 0, kept = 0, i;
+
+	for (i = 0; i < aggregator->num_held; ++i)
+		if (aggregator->held[i].socket == socket)
+			++num_on_socket;
+
+	for (i = 0; i < aggregator->num_held; ++i) {
+		struct ack_entry entry = aggregator->held[i];
+
+		if (entry.socket != socket) {
+			aggregator->held[kept++] = entry;
+			continue;
+		}
+		++released;
+		entry.inject =
+			(aggregator->profile.mode == ACK_AGGREGATION_BURST ||
+			 released == num_on_socket);
+		append_entry(&aggregator->out, &aggregator->num_out,
+			     &aggregator->max_out, &entry);
+	}
+	aggregator->num_held = kept;
+}
+
+int ack_aggregate(struct ack_aggregator *aggregator,
+		  const struct ack_entry *in, int num_in,
+		  struct ack_entry **out)
+{
+	int i, j, num_on_socket;
+
+	aggregator->num_out = 0;
+	for (i = 0; i < num_in; ++i) {
+		struct ack_entry entry = in[i];
+
+		entry.inject = true;
+		if (!is_pure_ack(entry.packet)) {
+			release_held(aggregator, entry.socket);
+			append_entry(&aggregator->out, &aggregator->num_out,
+				     &aggregator->max_out, &entry);
+			continue;
+		}
+
+		append_entry(&aggregator->held, &aggregator->num_held,
+			     &aggregator->max_held, &entry);
+		num_on_socket = 0;
+		for (j = 0; j < aggregator->num_held; ++j)
+			if (aggregator->held[j].socket == entry.socket)
+				++num_on_socket;
+		if (num_on_socket == aggregator->profile.count)
+			release_held(aggregator, entry.socket);
+	}
+	*out = aggregator->out;
+	return aggregator->num_out;
+}
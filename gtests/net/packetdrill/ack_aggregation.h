@@ -0,0 +1,101 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * For --ack_aggregation, emulation of a receiver whose ACKs reach the
+ * sender aggregated, as they do behind GRO/LRO or a Wi-Fi link that
+ * sends block ACKs, so sender-side tests see the ACK compression of
+ * real paths without the script having to spell it out.
+ *
+ * Pure ACKs the script injects (no data, SYN, FIN or RST, and for
+ * MPTCP no DSS mapping or DATA_FIN, so DSS data ACKs count) are held
+ * back per socket until the profile's count of them has arrived, and
+ * then handed on:
+ *
+ *   stretch:N  only the last of each N is injected: one stretch ACK
+ *              that covers all the data the N acked, as GRO makes;
+ *   burst:N    all N are injected back to back, as a Wi-Fi block ACK
+ *              or an ACK-compressing queue releases them.
+ *
+ * Any other inbound packet on the socket releases the ACKs held on it
+ * first, so packets on a socket are never reordered. ACKs still held
+ * when the script ends are never injected.
+ */
+
+#ifndef __ACK_AGGREGATION_H__
+#define __ACK_AGGREGATION_H__
+
+#include "types.h"
+
+#include "packet.h"
+
+/* Most ACKs a profile can aggregate at once. */
+#define ACK_AGGREGATION_MAX_COUNT	64
+
+enum ack_aggregation_mode {
+	ACK_AGGREGATION_NONE = 0,	/* inject ACKs as the script says */
+	ACK_AGGREGATION_STRETCH,	/* inject the last of every N */
+	ACK_AGGREGATION_BURST,		/* inject every N together */
+};
+
+struct ack_profile {
+	enum ack_aggregation_mode mode;
+	int count;			/* N: ACKs aggregated at once */
+};
+
+struct event;
+struct socket;
+
+/* An inbound live packet passing through the aggregator: the socket
+ * it is for, and the script event it came from.
+ */
+struct ack_entry {
+	struct packet *packet;
+	struct socket *socket;
+	struct event *event;
+	bool inject;		/* false if a later ACK stretches over it */
+};
+
+struct ack_aggregator;
+
+/* Parse a profile for --ack_aggregation, "stretch:<N>" or "burst:<N>".
+ * Returns STATUS_OK on success; on failure returns STATUS_ERR and sets
+ * error message.
+ */
+extern int parse_ack_profile(const char *arg, struct ack_profile *profile,
+			     char **error);
+
+extern struct ack_aggregator *ack_aggregator_new(
+	const struct ack_profile *profile);
+
+/* Free the aggregator, and the packets of any ACKs it still holds. */
+extern void ack_aggregator_free(struct ack_aggregator *aggregator);
+
+/* Return true iff the packet is a pure ACK the profile applies to. */
+extern bool is_pure_ack(struct packet *packet);
+
+/* Pass a batch of inbound packets, in the order the script injects
+ * them, through the aggregator. Sets *out to the entries to handle now,
+ * in order, and returns how many: those with inject set are to be
+ * injected, and the others were stretched over and are only to be
+ * freed. The aggregator keeps the entries it holds back, and owns the
+ * *out array, which is good until the next call.
+ */
+extern int ack_aggregate(struct ack_aggregator *aggregator,
+			 const struct ack_entry *in, int num_in,
+			 struct ack_entry **out);
+
+#endif /* __ACK_AGGREGATION_H__ */
@@ -0,0 +1,152 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for ack_aggregation.c: pure ACKs are held per socket until
+ * the profile's count arrive, then stretched or burst, and any other
+ * packet releases the ACKs held on its socket ahead of it.
+ */
+
+#include "ack_aggregation.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "tcp_packet.h"
+
+static struct socket *socket_a = (struct socket *)0x1000;
+static struct socket *socket_b = (struct socket *)0x2000;
+
+static struct ack_entry new_entry(struct socket *socket, const char *flags,
+				  u16 payload_bytes, u32 ack)
+{
+	struct ack_entry entry;
+	char *error = NULL;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.packet = new_tcp_packet(3, AF_INET, DIRECTION_INBOUND,
+				      ECN_NONE, flags, 1, payload_bytes, ack,
+				      1000, NULL, &error);
+	assert(entry.packet != NULL);
+	entry.socket = socket;
+	return entry;
+}
+
+static u32 ack_of(const struct ack_entry *entry)
+{
+	return ntohl(entry->packet->tcp->ack_seq);
+}
+
+static void free_out(struct ack_entry *out, int num_out)
+{
+	int i;
+
+	for (i = 0; i < num_out; ++i)
+		packet_free(out[i].packet);
+}
+
+static void test_parse(void)
+{
+	struct ack_profile profile;
+	char *error = NULL;
+
+	assert(parse_ack_profile("stretch:4", &profile, &error) == STATUS_OK);
+	assert(profile.mode == ACK_AGGREGATION_STRETCH);
+	assert(profile.count == 4);
+	assert(parse_ack_profile("burst:2", &profile, &error) == STATUS_OK);
+	assert(profile.mode == ACK_AGGREGATION_BURST);
+	assert(profile.count == 2);
+	assert(parse_ack_profile("burst:1", &profile, &error) == STATUS_ERR);
+	free(error);
+	assert(parse_ack_profile("gro:4", &profile, &error) == STATUS_ERR);
+	free(error);
+	assert(parse_ack_profile("stretch", &profile, &error) == STATUS_ERR);
+	free(error);
+}
+
+static void test_pure_ack(void)
+{
+	struct ack_entry entry = new_entry(socket_a, ".", 0, 100);
+
+	assert(is_pure_ack(entry.packet));
+	packet_free(entry.packet);
+	entry = new_entry(socket_a, ".", 1000, 100);
+	assert(!is_pure_ack(entry.packet));
+	packet_free(entry.packet);
+	entry = new_entry(socket_a, "F.", 0, 100);
+	assert(!is_pure_ack(entry.packet));
+	packet_free(entry.packet);
+}
+
+/* Of three ACKs with a count of 3, only the last goes in, and then
+ * only once the third has arrived.
+ */
+static void test_stretch(void)
+{
+	struct ack_profile profile = { ACK_AGGREGATION_STRETCH, 3 };
+	struct ack_aggregator *aggregator = ack_aggregator_new(&profile);
+	struct ack_entry in[2], *out = NULL;
+	int num_out;
+
+	in[0] = new_entry(socket_a, ".", 0, 100);
+	in[1] = new_entry(socket_a, ".", 0, 200);
+	num_out = ack_aggregate(aggregator, in, 2, &out);
+	assert(num_out == 0);
+
+	in[0] = new_entry(socket_a, ".", 0, 300);
+	num_out = ack_aggregate(aggregator, in, 1, &out);
+	assert(num_out == 3);
+	assert(!out[0].inject && ack_of(&out[0]) == 100);
+	assert(!out[1].inject && ack_of(&out[1]) == 200);
+	assert(out[2].inject && ack_of(&out[2]) == 300);
+	free_out(out, num_out);
+	ack_aggregator_free(aggregator);
+}
+
+/* In burst mode all the held ACKs go in, and a data packet on a socket
+ * releases its held ACKs first, leaving those of another socket held.
+ */
+static void test_burst(void)
+{
+	struct ack_profile profile = { ACK_AGGREGATION_BURST, 4 };
+	struct ack_aggregator *aggregator = ack_aggregator_new(&profile);
+	struct ack_entry in[4], *out = NULL;
+	int num_out;
+
+	in[0] = new_entry(socket_a, ".", 0, 100);
+	in[1] = new_entry(socket_b, ".", 0, 500);
+	in[2] = new_entry(socket_a, ".", 0, 200);
+	in[3] = new_entry(socket_a, "P.", 1000, 200);
+	num_out = ack_aggregate(aggregator, in, 4, &out);
+	assert(num_out == 3);
+	assert(out[0].inject && ack_of(&out[0]) == 100);
+	assert(out[1].inject && ack_of(&out[1]) == 200);
+	assert(out[2].inject && packet_payload_len(out[2].packet) == 1000);
+	free_out(out, num_out);
+
+	/* The ACK on socket_b is still held, and freed with us. */
+	ack_aggregator_free(aggregator);
+}
+
+int main(void)
+{
+	test_parse();
+	test_pure_ack();
+	test_stretch();
+	test_burst();
+	return 0;
+}
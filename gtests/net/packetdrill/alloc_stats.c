@@ -0,0 +1,230 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the counting allocator; see alloc_stats.h.
+ */
+
+#include "alloc_stats.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* What precedes each block. Its 16 bytes keep the block as aligned as
+ * malloc() made the header.
+ */
+struct alloc_header {
+	u32 tag;		/* enum alloc_tag_t */
+	u32 counted;		/* was counting on when we allocated it? */
+	u64 bytes;		/* bytes asked for, not counting the header */
+};
+
+static const char *const tag_names[NUM_ALLOC_TAGS] = {
+	[ALLOC_PACKET]		= "packet",
+	[ALLOC_SCRIPT]		= "script",
+	[ALLOC_HASH_MAP]	= "hash_map",
+	[ALLOC_MPTCP]		= "mptcp",
+	[ALLOC_QUEUE]		= "queue",
+};
+
+static bool counting;
+static struct alloc_stats counters[NUM_ALLOC_TAGS];
+
+void alloc_stats_enable(void)
+{
+	counting = true;
+}
+
+bool alloc_stats_enabled(void)
+{
+	return counting;
+}
+
+static inline struct alloc_header *header_of(void *p)
+{
+	return (struct alloc_header *)p - 1;
+}
+
+/* Raise the peak to live if it is below it, racing other threads. */
+static void raise_peak(u64 *peak, u64 live)
+{
+	u64 old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+	while (old < live &&
+	       !__atomic_compare_exchange_n(peak, &old, live, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static void count_bytes(enum alloc_tag_t tag, u64 bytes)
+{
+	u64 live = __atomic_add_fetch(&counters[tag].live_bytes, bytes,
+				      __ATOMIC_RELAXED);
+
+	raise_peak(&counters[tag].peak_bytes, live);
+}
+
+static void uncount_bytes(enum alloc_tag_t tag, u64 bytes)
+{
+	__atomic_sub_fetch(&counters[tag].live_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/* Fill in the header of a new block and return the block after it. */
+static void *start_block(struct alloc_header *header, enum alloc_tag_t tag,
+			 size_t bytes)
+{
+	if (header == NULL)
+		return NULL;
+	assert(tag < NUM_ALLOC_TAGS);
+	header->tag = tag;
+	header->counted = counting;
+	header->bytes = bytes;
+	if (counting) {
+		__atomic_add_fetch(&counters[tag].allocs, 1, __ATOMIC_RELAXED);
+		count_bytes(tag, bytes);
+	}
+	return header + 1;
+}
+
+void *tagged_malloc(enum alloc_tag_t tag, size_t bytes)
+{
+	if (bytes > SIZE_MAX - sizeof(struct alloc_header))
+		return NULL;
+	return start_block(malloc(sizeof(struct alloc_header) + bytes),
+			   tag, bytes);
+}
+
+void *tagged_calloc(enum alloc_tag_t tag, size_t count, size_t bytes)
+{
+	void *p = NULL;
+
+	if (bytes != 0 && count > SIZE_MAX / bytes)
+		return NULL;
+	p = tagged_malloc(tag, count * bytes);
+	if (p != NULL)
+		memset(p, 0, count * bytes);
+	return p;
+}
+
+void *tagged_realloc(enum alloc_tag_t tag, void *p, size_t bytes)
+{
+	struct alloc_header *header = NULL;
+	u64 old_bytes;
+	bool counted;
+
+	if (p == NULL)
+		return tagged_malloc(tag, bytes);
+	if (bytes > SIZE_MAX - sizeof(struct alloc_header))
+		return NULL;
+	header = header_of(p);
+	assert(header->tag == tag);
+	old_bytes = header->bytes;
+	counted = header->counted;
+	header = realloc(header, sizeof(struct alloc_header) + bytes);
+	if (header == NULL)
+		return NULL;
+	header->bytes = bytes;
+	if (counted) {
+		uncount_bytes(tag, old_bytes);
+		count_bytes(tag, bytes);
+	}
+	return header + 1;
+}
+
+char *tagged_strdup(enum alloc_tag_t tag, const char *s)
+{
+	size_t bytes = strlen(s) + 1;
+	char *copy = tagged_malloc(tag, bytes);
+
+	if (copy != NULL)
+		memcpy(copy, s, bytes);
+	return copy;
+}
+
+void tagged_free(void *p)
+{
+	struct alloc_header *header = NULL;
+
+	if (p == NULL)
+		return;
+	header = header_of(p);
+	assert(header->tag < NUM_ALLOC_TAGS);
+	if (header->counted) {
+		__atomic_add_fetch(&counters[header->tag].frees, 1,
+				   __ATOMIC_RELAXED);
+		uncount_bytes(header->tag, header->bytes);
+	}
+	free(header);
+}
+
+const char *alloc_tag_name(enum alloc_tag_t tag)
+{
+	assert(tag < NUM_ALLOC_TAGS);
+	return tag_names[tag];
+}
+
+void alloc_stats_get(enum alloc_tag_t tag, struct alloc_stats *stats)
+{
+	assert(tag < NUM_ALLOC_TAGS);
+	stats->live_bytes = __atomic_load_n(&counters[tag].live_bytes,
+					    __ATOMIC_RELAXED);
+	stats->peak_bytes = __atomic_load_n(&counters[tag].peak_bytes,
+					    __ATOMIC_RELAXED);
+	stats->allocs = __atomic_load_n(&counters[tag].allocs,
+					__ATOMIC_RELAXED);
+	stats->frees = __atomic_load_n(&counters[tag].frees,
+				       __ATOMIC_RELAXED);
+}
+
+void alloc_stats_write_json(FILE *out)
+{
+	struct alloc_stats stats;
+	int i;
+
+	fprintf(out, "{");
+	for (i = 0; i < NUM_ALLOC_TAGS; i++) {
+		alloc_stats_get(i, &stats);
+		fprintf(out, "%s\"%s\": {\"live_bytes\": %llu, "
+			"\"peak_bytes\": %llu, \"allocs\": %llu, "
+			"\"frees\": %llu}",
+			i > 0 ? ", " : "", tag_names[i],
+			(unsigned long long)stats.live_bytes,
+			(unsigned long long)stats.peak_bytes,
+			(unsigned long long)stats.allocs,
+			(unsigned long long)stats.frees);
+	}
+	fprintf(out, "}");
+}
+
+void alloc_stats_print(FILE *out)
+{
+	struct alloc_stats stats;
+	int i;
+
+	fprintf(out, "%-10s %12s %12s %10s %10s\n",
+		"alloc", "live_bytes", "peak_bytes", "allocs", "frees");
+	for (i = 0; i < NUM_ALLOC_TAGS; i++) {
+		alloc_stats_get(i, &stats);
+		fprintf(out, "%-10s %12llu %12llu %10llu %10llu\n",
+			tag_names[i],
+			(unsigned long long)stats.live_bytes,
+			(unsigned long long)stats.peak_bytes,
+			(unsigned long long)stats.allocs,
+			(unsigned long long)stats.frees);
+	}
+}
@@ -0,0 +1,86 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * A counting allocator, for --alloc_stats: a thin layer over malloc()
+ * that keeps, for each subsystem that allocates through it, how many
+ * bytes it holds now, the most it held at once, and how many blocks it
+ * allocated and freed.
+ *
+ * Each block carries a small header with its tag and size, so a block
+ * from tagged_malloc() and friends must be freed with tagged_free(),
+ * and only with it. The header is always there; the counting is done
+ * only once alloc_stats_enable() is called, and the counters are
+ * updated atomically, since the queues allocate in one thread and free
+ * in another.
+ */
+
+#ifndef __ALLOC_STATS_H__
+#define __ALLOC_STATS_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+enum alloc_tag_t {
+	ALLOC_PACKET = 0,	/* packets, packet pools, encap templates */
+	ALLOC_SCRIPT,		/* arenas holding the parsed script */
+	ALLOC_HASH_MAP,		/* hash_map.c tables */
+	ALLOC_MPTCP,		/* MPTCP connections, subflows and vars */
+	ALLOC_QUEUE,		/* queue segments and string chunks */
+	NUM_ALLOC_TAGS,
+};
+
+/* What one subsystem has allocated while counting was on. */
+struct alloc_stats {
+	u64 live_bytes;		/* bytes allocated and not yet freed */
+	u64 peak_bytes;		/* the most live_bytes has been */
+	u64 allocs;		/* blocks allocated */
+	u64 frees;		/* blocks freed */
+};
+
+/* Start counting. Call once, before starting any threads. Blocks
+ * allocated before this are not counted when freed either.
+ */
+extern void alloc_stats_enable(void);
+
+/* Is counting on? */
+extern bool alloc_stats_enabled(void);
+
+/* Like malloc(), calloc(), realloc() and strdup(), charging the block
+ * to the given subsystem. Return NULL if out of memory.
+ */
+extern void *tagged_malloc(enum alloc_tag_t tag, size_t bytes);
+extern void *tagged_calloc(enum alloc_tag_t tag, size_t count, size_t bytes);
+extern void *tagged_realloc(enum alloc_tag_t tag, void *p, size_t bytes);
+extern char *tagged_strdup(enum alloc_tag_t tag, const char *s);
+
+/* Free a block from one of the above; NULL is ignored. */
+extern void tagged_free(void *p);
+
+/* Return the name of the given subsystem, e.g. "packet". */
+extern const char *alloc_tag_name(enum alloc_tag_t tag);
+
+/* Fill in the given subsystem's counts so far. */
+extern void alloc_stats_get(enum alloc_tag_t tag, struct alloc_stats *stats);
+
+/* Write the counts of every subsystem as a JSON object keyed by name. */
+extern void alloc_stats_write_json(FILE *out);
+
+/* Write the counts of every subsystem as a table, for the end of a run. */
+extern void alloc_stats_print(FILE *out);
+
+#endif /* __ALLOC_STATS_H__ */
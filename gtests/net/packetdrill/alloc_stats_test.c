@@ -0,0 +1,123 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for alloc_stats.c: blocks are charged to their subsystem
+ * while counting is on, and the subsystems that allocate through it
+ * give back everything they take.
+ */
+
+#include "alloc_stats.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash_map.h"
+#include "packet.h"
+
+static void test_counts(void)
+{
+	struct alloc_stats stats;
+	char *early, *s;
+	u8 *p;
+	int i;
+
+	/* Blocks from before counting started are not counted. */
+	early = tagged_malloc(ALLOC_QUEUE, 100);
+	alloc_stats_enable();
+	assert(alloc_stats_enabled());
+	tagged_free(early);
+	alloc_stats_get(ALLOC_QUEUE, &stats);
+	assert(stats.live_bytes == 0 && stats.frees == 0);
+
+	p = tagged_calloc(ALLOC_QUEUE, 10, 10);
+	for (i = 0; i < 100; ++i)
+		assert(p[i] == 0);
+	s = tagged_strdup(ALLOC_QUEUE, "hello");
+	assert(strcmp(s, "hello") == 0);
+	alloc_stats_get(ALLOC_QUEUE, &stats);
+	assert(stats.live_bytes == 106);
+	assert(stats.peak_bytes == 106);
+	assert(stats.allocs == 2);
+
+	p = tagged_realloc(ALLOC_QUEUE, p, 1000);
+	alloc_stats_get(ALLOC_QUEUE, &stats);
+	assert(stats.live_bytes == 1006);
+	p = tagged_realloc(ALLOC_QUEUE, p, 50);
+	alloc_stats_get(ALLOC_QUEUE, &stats);
+	assert(stats.live_bytes == 56);
+	assert(stats.peak_bytes == 1006);
+
+	tagged_free(p);
+	tagged_free(s);
+	tagged_free(NULL);
+	alloc_stats_get(ALLOC_QUEUE, &stats);
+	assert(stats.live_bytes == 0);
+	assert(stats.peak_bytes == 1006);
+	assert(stats.allocs == 2 && stats.frees == 2);
+}
+
+/* Packets, pools and hash maps return to zero live bytes once freed. */
+static void test_subsystems(void)
+{
+	struct alloc_stats stats;
+	struct packet_pool *pool;
+	struct hash_map *map;
+	struct packet *packet;
+	u32 key;
+
+	pool = packet_pool_new(1500, 4);
+	packet = packet_pool_get(pool, 1500);
+	packet_free(packet);
+	packet_free(packet_new(9000));
+	packet_pool_free(pool);
+	alloc_stats_get(ALLOC_PACKET, &stats);
+	assert(stats.live_bytes == 0);
+	assert(stats.peak_bytes > 9000);
+	assert(stats.allocs == stats.frees);
+
+	map = hash_map_new(1);
+	for (key = 0; key < 1000; ++key)
+		hash_map_set(map, key, key);
+	hash_map_free(map);
+	alloc_stats_get(ALLOC_HASH_MAP, &stats);
+	assert(stats.live_bytes == 0);
+	assert(stats.allocs > 2 && stats.allocs == stats.frees);
+}
+
+static void test_json(void)
+{
+	char *json = NULL;
+	size_t bytes = 0;
+	FILE *out = open_memstream(&json, &bytes);
+
+	assert(out != NULL);
+	alloc_stats_write_json(out);
+	fclose(out);
+	assert(json[0] == '{');
+	assert(strstr(json, "\"queue\": {\"live_bytes\": 0, "
+		      "\"peak_bytes\": 1006, \"allocs\": 2, \"frees\": 2}"));
+	assert(strstr(json, "\"mptcp\": {") != NULL);
+	free(json);
+}
+
+int main(void)
+{
+	test_counts();
+	test_subsystems();
+	test_json();
+	return 0;
+}
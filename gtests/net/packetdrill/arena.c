@@ -0,0 +1,140 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation for a simple arena ("bump") allocator.
+ */
+
+#include "arena.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "alloc_stats.h"
+#include "logging.h"
+
+/* Most allocations are carved out of chunks of this size. */
+#define ARENA_CHUNK_BYTES	(64 * 1024)
+
+/* Every allocation is rounded up to a multiple of this. */
+#define ARENA_ALIGN		(sizeof(max_align_t))
+
+struct arena_chunk {
+	struct arena_chunk *next;	/* older chunk, or NULL */
+	size_t used;			/* bytes used in data */
+	size_t size;			/* bytes allocated in data */
+	max_align_t data[];
+};
+
+struct arena {
+	struct arena_chunk *chunks;	/* newest chunk first */
+};
+
+static struct arena_chunk *arena_chunk_new(size_t size)
+{
+	struct arena_chunk *chunk = tagged_calloc(ALLOC_SCRIPT, 1,
+						  sizeof(*chunk) + size);
+
+	if (chunk == NULL)
+		die("out of memory allocating %zu byte arena chunk\n", size);
+	chunk->size = size;
+	return chunk;
+}
+
+struct arena *arena_new(void)
+{
+	struct arena *arena = tagged_calloc(ALLOC_SCRIPT, 1,
+					    sizeof(struct arena));
+
+	if (arena == NULL)
+		die("out of memory allocating arena\n");
+	return arena;
+}
+
+void *arena_alloc(struct arena *arena, size_t bytes)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	void *p = NULL;
+
+	bytes = (bytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (bytes > ARENA_CHUNK_BYTES / 4) {
+		/* Big requests get a chunk of their own, placed behind
+		 * the current one so that we keep filling that.
+		 */
+		struct arena_chunk *big = arena_chunk_new(bytes);
+
+		big->used = bytes;
+		if (chunk != NULL) {
+			big->next = chunk->next;
+			chunk->next = big;
+		} else {
+			arena->chunks = big;
+		}
+		return big->data;
+	}
+
+	if (chunk == NULL || chunk->size - chunk->used < bytes) {
+		chunk = arena_chunk_new(ARENA_CHUNK_BYTES);
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+	/* Chunks are calloc()ed and never reused, so this is zeroed. */
+	p = (char *)chunk->data + chunk->used;
+	chunk->used += bytes;
+	return p;
+}
+
+char *arena_strndup(struct arena *arena, const char *s, size_t n)
+{
+	size_t len = strnlen(s, n);
+	char *copy = arena_alloc(arena, len + 1);
+
+	memcpy(copy, s, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+char *arena_strdup(struct arena *arena, const char *s)
+{
+	return arena_strndup(arena, s, strlen(s));
+}
+
+void arena_for_each_chunk(const struct arena *arena,
+			  arena_chunk_fn_t fn, void *arg)
+{
+	const struct arena_chunk *chunk = NULL;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next)
+		fn(arg, chunk, sizeof(*chunk) + chunk->used);
+}
+
+void arena_free(struct arena *arena)
+{
+	struct arena_chunk *chunk = NULL, *next = NULL;
+
+	if (arena == NULL)
+		return;
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		tagged_free(chunk);
+	}
+	memset(arena, 0, sizeof(*arena));  /* paranoia to help catch bugs */
+	tagged_free(arena);
+}
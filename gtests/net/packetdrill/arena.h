@@ -0,0 +1,59 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for a simple arena ("bump") allocator. Allocations are
+ * carved out of large chunks and are never freed one at a time;
+ * instead the whole arena is released at once with arena_free().
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "types.h"
+
+struct arena;
+
+/* Allocate and return a new, empty arena. */
+extern struct arena *arena_new(void);
+
+/* Return a pointer to 'bytes' bytes of zeroed memory, suitably aligned
+ * for any type, that lasts until the arena is freed. Dies if we are
+ * out of memory.
+ */
+extern void *arena_alloc(struct arena *arena, size_t bytes);
+
+/* Return a copy of the given string, allocated in the arena. */
+extern char *arena_strdup(struct arena *arena, const char *s);
+
+/* Return a copy of at most n bytes of the given string, allocated in
+ * the arena.
+ */
+extern char *arena_strndup(struct arena *arena, const char *s, size_t n);
+
+/* Call fn on the used part of each of the arena's chunks, newest
+ * first, e.g. to lock the arena's memory into RAM.
+ */
+typedef void (*arena_chunk_fn_t)(void *arg, const void *data, size_t bytes);
+extern void arena_for_each_chunk(const struct arena *arena,
+				 arena_chunk_fn_t fn, void *arg);
+
+/* Release the arena and everything allocated in it. */
+extern void arena_free(struct arena *arena);
+
+#endif /* __ARENA_H__ */
@@ -0,0 +1,73 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Helpers for the small eBPF programs we assemble by hand (the AF_XDP
+ * redirect program of wire servers, and the tracepoint programs of
+ * --kernel_timeline), so packetdrill needs no compiler for BPF and no
+ * libbpf. Include only where <linux/bpf.h> is available.
+ */
+
+#ifndef __BPF_INSN_H__
+#define __BPF_INSN_H__
+
+#include "types.h"
+
+#include <linux/bpf.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Macros for eBPF instructions, as in the kernel's filter.h. */
+#define BPF_INSN(CODE, DST, SRC, OFF, IMM)				\
+	((struct bpf_insn) { .code = (CODE), .dst_reg = (DST),		\
+			     .src_reg = (SRC), .off = (OFF), .imm = (IMM) })
+#define BPF_MOV64_REG(DST, SRC)						\
+	BPF_INSN(BPF_ALU64 | BPF_MOV | BPF_X, DST, SRC, 0, 0)
+#define BPF_MOV64_IMM(DST, IMM)						\
+	BPF_INSN(BPF_ALU64 | BPF_MOV | BPF_K, DST, 0, 0, IMM)
+#define BPF_ADD64_IMM(DST, IMM)						\
+	BPF_INSN(BPF_ALU64 | BPF_ADD | BPF_K, DST, 0, 0, IMM)
+#define BPF_LDX_MEM(SIZE, DST, SRC, OFF)				\
+	BPF_INSN(BPF_LDX | BPF_MEM | (SIZE), DST, SRC, OFF, 0)
+#define BPF_STX_MEM(SIZE, DST, SRC, OFF)				\
+	BPF_INSN(BPF_STX | BPF_MEM | (SIZE), DST, SRC, OFF, 0)
+#define BPF_ST_MEM(SIZE, DST, OFF, IMM)					\
+	BPF_INSN(BPF_ST | BPF_MEM | (SIZE), DST, 0, OFF, IMM)
+#define BPF_JGT_REG(DST, SRC, OFF)					\
+	BPF_INSN(BPF_JMP | BPF_JGT | BPF_X, DST, SRC, OFF, 0)
+#define BPF_JEQ_IMM(DST, IMM, OFF)					\
+	BPF_INSN(BPF_JMP | BPF_JEQ | BPF_K, DST, 0, OFF, IMM)
+#define BPF_JNE32_IMM(DST, IMM, OFF)					\
+	BPF_INSN(BPF_JMP32 | BPF_JNE | BPF_K, DST, 0, OFF, IMM)
+#define BPF_EMIT_CALL(FUNC)						\
+	BPF_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, FUNC)
+#define BPF_EXIT_INSN()						\
+	BPF_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+/* The first half of loading a map's address; the second half, the
+ * upper 32 bits of the 64-bit immediate, is BPF_INSN(0, 0, 0, 0, 0).
+ */
+#define BPF_LD_MAP_FD(DST, MAP_FD)					\
+	BPF_INSN(BPF_LD | BPF_DW | BPF_IMM, DST, BPF_PSEUDO_MAP_FD, 0,	\
+		 MAP_FD)
+
+static inline int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+#endif /* __BPF_INSN_H__ */
@@ -25,12 +25,21 @@
 #include "checksum.h"
 
 #include <assert.h>
+#include <pthread.h>
+#include <string.h>
 
-/* Add bytes in buffer to a running checksum. Returns the new
- * intermediate checksum. Use ip_checksum_fold() to convert the
- * intermediate checksum to final form.
- */
-static u64 ip_checksum_partial(const void *p, size_t len, u64 sum)
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_CHECKSUM_X86 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_CHECKSUM_NEON 1
+#endif
+
+/* Portable C backend. Vector backends use it for their tail bytes. */
+static u64 ip_checksum_partial_generic(const void *p, size_t len, u64 sum)
 {
 	/* Main loop: 32 bits at a time.
 	 * We take advantage of intel's ability to do unaligned memory
@@ -55,6 +64,202 @@ static u64 ip_checksum_partial(const void *p, size_t len, u64 sum)
 	return sum;
 }
 
+static bool checksum_generic_available(void)
+{
+	return true;
+}
+
+static const struct checksum_backend checksum_generic = {
+	.name		= "generic",
+	.available	= checksum_generic_available,
+	.partial	= ip_checksum_partial_generic,
+};
+
+/* The vector backends add 32-bit words into 64-bit lanes, which cannot
+ * overflow for any packet, and add the lanes up at the end. Since
+ * 2^16 == 1 modulo 0xffff, any such regrouping of 32-bit words gives
+ * the same folded ones' complement sum as the scalar loop.
+ */
+
+#ifdef HAVE_CHECKSUM_X86
+
+__attribute__((target("sse2")))
+static u64 ip_checksum_partial_sse2(const void *p, size_t len, u64 sum)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero;
+	const u8 *p8 = p;
+	u64 lanes[2];
+
+	for (; len >= 32; len -= 32, p8 += 32) {
+		__m128i a = _mm_loadu_si128((const __m128i *)p8);
+		__m128i b = _mm_loadu_si128((const __m128i *)(p8 + 16));
+
+		acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+		acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+	}
+	_mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+	sum += lanes[0] + lanes[1];
+
+	return ip_checksum_partial_generic(p8, len, sum);
+}
+
+static bool checksum_sse2_available(void)
+{
+	return __builtin_cpu_supports("sse2") != 0;
+}
+
+static const struct checksum_backend checksum_sse2 = {
+	.name		= "sse2",
+	.available	= checksum_sse2_available,
+	.partial	= ip_checksum_partial_sse2,
+};
+
+__attribute__((target("avx2")))
+static u64 ip_checksum_partial_avx2(const void *p, size_t len, u64 sum)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc0 = zero, acc1 = zero;
+	const u8 *p8 = p;
+	u64 lanes[4];
+
+	for (; len >= 64; len -= 64, p8 += 64) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)p8);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(p8 + 32));
+
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+	}
+	_mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+	sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+	return ip_checksum_partial_generic(p8, len, sum);
+}
+
+static bool checksum_avx2_available(void)
+{
+	return __builtin_cpu_supports("avx2") != 0;
+}
+
+static const struct checksum_backend checksum_avx2 = {
+	.name		= "avx2",
+	.available	= checksum_avx2_available,
+	.partial	= ip_checksum_partial_avx2,
+};
+
+#endif /* HAVE_CHECKSUM_X86 */
+
+#ifdef HAVE_CHECKSUM_NEON
+
+static u64 ip_checksum_partial_neon(const void *p, size_t len, u64 sum)
+{
+	uint64x2_t acc0 = vdupq_n_u64(0), acc1 = vdupq_n_u64(0);
+	const u8 *p8 = p;
+
+	for (; len >= 32; len -= 32, p8 += 32) {
+		/* Pairwise add the 32-bit words into the 64-bit lanes. */
+		acc0 = vpadalq_u32(acc0, vreinterpretq_u32_u8(vld1q_u8(p8)));
+		acc1 = vpadalq_u32(acc1,
+				   vreinterpretq_u32_u8(vld1q_u8(p8 + 16)));
+	}
+	acc0 = vaddq_u64(acc0, acc1);
+	sum += vgetq_lane_u64(acc0, 0) + vgetq_lane_u64(acc0, 1);
+
+	return ip_checksum_partial_generic(p8, len, sum);
+}
+
+/* NEON is mandatory on arm64. */
+static bool checksum_neon_available(void)
+{
+	return true;
+}
+
+static const struct checksum_backend checksum_neon = {
+	.name		= "neon",
+	.available	= checksum_neon_available,
+	.partial	= ip_checksum_partial_neon,
+};
+
+#endif /* HAVE_CHECKSUM_NEON */
+
+const struct checksum_backend *checksum_backends[] = {
+#ifdef HAVE_CHECKSUM_X86
+	&checksum_avx2,
+	&checksum_sse2,
+#endif
+#ifdef HAVE_CHECKSUM_NEON
+	&checksum_neon,
+#endif
+	&checksum_generic,
+	NULL,
+};
+
+/* Backend selection; as for SHA-1, the automatic pick is done under
+ * pthread_once() since the wire server checksums from many threads.
+ */
+static const struct checksum_backend *checksum_current;
+static pthread_once_t checksum_auto_once = PTHREAD_ONCE_INIT;
+
+static const struct checksum_backend *checksum_backend_auto(void)
+{
+	int i;
+
+	for (i = 0; checksum_backends[i] != NULL; i++) {
+		if (checksum_backends[i]->available())
+			return checksum_backends[i];
+	}
+	return &checksum_generic;
+}
+
+static void checksum_backend_auto_init(void)
+{
+	if (checksum_current == NULL)
+		checksum_current = checksum_backend_auto();
+}
+
+const struct checksum_backend *checksum_backend_get(void)
+{
+	pthread_once(&checksum_auto_once, checksum_backend_auto_init);
+	return checksum_current;
+}
+
+int checksum_backend_set(const char *name, char **error)
+{
+	int i;
+
+	if (strcmp(name, "auto") == 0) {
+		checksum_current = checksum_backend_auto();
+		return STATUS_OK;
+	}
+	for (i = 0; checksum_backends[i] != NULL; i++) {
+		if (strcmp(name, checksum_backends[i]->name) != 0)
+			continue;
+		if (!checksum_backends[i]->available()) {
+			asprintf(error,
+				 "checksum backend %s not supported by CPU",
+				 name);
+			return STATUS_ERR;
+		}
+		checksum_current = checksum_backends[i];
+		return STATUS_OK;
+	}
+	asprintf(error, "unknown checksum backend: %s", name);
+	return STATUS_ERR;
+}
+
+/* Add bytes in buffer to a running checksum. Returns the new
+ * intermediate checksum. Use ip_checksum_fold() to convert the
+ * intermediate checksum to final form.
+ */
+static u64 ip_checksum_partial(const void *p, size_t len, u64 sum)
+{
+	return checksum_backend_get()->partial(p, len, sum);
+}
+
 static __be16 ip_checksum_fold(u64 sum)
 {
 	while (sum & ~0xffffffffULL)
@@ -103,6 +308,84 @@ __be16 tcp_udp_v4_checksum(struct in_addr src_ip, struct in_addr dst_ip,
 	return ip_checksum_fold(sum);
 }
 
+__be16 tcp_udp_v4_pseudo_checksum(struct in_addr src_ip,
+				  struct in_addr dst_ip, u8 protocol, u16 len)
+{
+	return (__be16)~ip_checksum_fold(tcp_udp_v4_header_checksum_partial(
+		src_ip, dst_ip, protocol, len));
+}
+
+__be16 checksum_update(__be16 check, const void *old_bytes,
+		       const void *new_bytes, size_t len)
+{
+	const u16 *old_words = old_bytes;
+	const u16 *new_words = new_bytes;
+	u64 sum = (u16)~check;
+	size_t i;
+
+	assert(len % 2 == 0);
+	/* HC' = ~(~HC + ~m + m'), one 16-bit word m at a time. */
+	for (i = 0; i < len / 2; ++i)
+		sum += (u16)~old_words[i] + (u64)new_words[i];
+	return ip_checksum_fold(sum);
+}
+
+u64 checksum_partial(const void *p, size_t len, u64 sum)
+{
+	return ip_checksum_partial(p, len, sum);
+}
+
+/* Fold a running checksum to 32 bits, so that two of them can be added
+ * without overflow. As 2^32 == 1 modulo 0xffff, this keeps its value.
+ */
+static u64 checksum_fold32(u64 sum)
+{
+	while (sum & ~0xffffffffULL)
+		sum = (sum >> 32) + (sum & 0xffffffffULL);
+	return sum;
+}
+
+u64 checksum_combine(u64 sum, u64 other)
+{
+	return checksum_fold32(sum) + checksum_fold32(other);
+}
+
+__be16 checksum_fold(u64 sum)
+{
+	return ip_checksum_fold(sum);
+}
+
+__be16 checksum_append(__be16 check, const void *p, size_t len)
+{
+	return ip_checksum_fold(ip_checksum_partial(p, len, (u16)~check));
+}
+
+u64 mptcp_dss_header_checksum_partial(u64 dsn, u32 ssn, u16 dll)
+{
+	struct {
+		__be64 dsn;
+		__be32 ssn;
+		__be16 dll;
+		__be16 zeros;
+	} __packed pseudo_header;
+	assert(sizeof(pseudo_header) == 16);
+
+	pseudo_header.dsn = htobe64(dsn);
+	pseudo_header.ssn = htonl(ssn);
+	pseudo_header.dll = htons(dll);
+	pseudo_header.zeros = 0;
+	return ip_checksum_partial(&pseudo_header, sizeof(pseudo_header), 0);
+}
+
+__be16 mptcp_dss_checksum(u64 dsn, u32 ssn, u16 dll,
+			  const void *data, size_t len)
+{
+	u64 sum = mptcp_dss_header_checksum_partial(dsn, ssn, dll);
+
+	sum = ip_checksum_partial(data, len, sum);
+	return ip_checksum_fold(sum);
+}
+
 /* Calculates and returns IPv4 header checksum. */
 __be16 ipv4_checksum(void *ip_header, size_t ip_header_bytes)
 {
@@ -151,6 +434,14 @@ __be16 tcp_udp_v6_checksum(const struct in6_addr *src_ip,
 	return ip_checksum_fold(sum);
 }
 
+__be16 tcp_udp_v6_pseudo_checksum(const struct in6_addr *src_ip,
+				  const struct in6_addr *dst_ip,
+				  u8 protocol, u32 len)
+{
+	return (__be16)~ip_checksum_fold(tcp_udp_v6_header_checksum_partial(
+		src_ip, dst_ip, protocol, len));
+}
+
 #define CRC32C(c, d) (c = (c>>8) ^ crc_c[(c^(d))&0xFF])
 
 static u32 crc_c[256] = {
@@ -30,6 +30,31 @@
 #include <netinet/in.h>
 #include <sys/types.h>
 
+/* An implementation of the 16-bit ones' complement sum (RFC 1071). At
+ * first use the fastest one the CPU supports is picked: AVX2 or SSE2 on
+ * x86, NEON on arm64, else portable C.
+ */
+struct checksum_backend {
+	const char *name;
+
+	/* Can this backend run on this CPU? */
+	bool (*available)(void);
+
+	/* Add the bytes of p to a running, unfolded checksum. */
+	u64 (*partial)(const void *p, size_t len, u64 sum);
+};
+
+/* All compiled-in backends, fastest first, NULL-terminated. */
+extern const struct checksum_backend *checksum_backends[];
+
+/* Return the backend in use, picking one on first use. */
+extern const struct checksum_backend *checksum_backend_get(void);
+
+/* Select the backend with the given name, or the fastest available
+ * one for "auto". On failure returns STATUS_ERR and fills in *error.
+ */
+extern int checksum_backend_set(const char *name, char **error);
+
 /* IPv4 ... */
 
 /* Calculates and returns IPv4 header checksum (in network byte order). */
@@ -39,6 +64,15 @@ extern __be16 ipv4_checksum(void *ip_header, size_t ip_header_bytes);
 extern __be16 tcp_udp_v4_checksum(struct in_addr src_ip, struct in_addr dst_ip,
 				  u8 protocol, const void *payload, u16 len);
 
+/* Returns the folded sum of just the pseudo-header of a TCP or UDP
+ * packet of len bytes for IPv4, uncomplemented: what goes in the
+ * checksum field of a packet whose checksum is left for the kernel or
+ * the NIC to finish (in network byte order).
+ */
+extern __be16 tcp_udp_v4_pseudo_checksum(struct in_addr src_ip,
+					 struct in_addr dst_ip,
+					 u8 protocol, u16 len);
+
 /* IPv6 ... */
 
 /* Calculates TCP, UDP, or ICMP checksum for IPv6 (in network byte order). */
@@ -46,6 +80,57 @@ extern __be16 tcp_udp_v6_checksum(const struct in6_addr *src_ip,
 				  const struct in6_addr *dst_ip,
 				  u8 protocol, const void *payload, u32 len);
 
+/* As tcp_udp_v4_pseudo_checksum(), for IPv6. */
+extern __be16 tcp_udp_v6_pseudo_checksum(const struct in6_addr *src_ip,
+					 const struct in6_addr *dst_ip,
+					 u8 protocol, u32 len);
+
+/* Incremental updates ... */
+
+/* Given a checksum 'check' (in network byte order) covering some data,
+ * return the checksum after the 'len' bytes at old_bytes in that data
+ * are replaced by the 'len' bytes at new_bytes, without re-summing the
+ * rest of the data (RFC 1624, eqn. 3). The bytes must start at an even
+ * offset within the checksummed data, and len must be even.
+ */
+extern __be16 checksum_update(__be16 check, const void *old_bytes,
+			      const void *new_bytes, size_t len);
+
+/* Partial sums ... */
+
+/* Add the len bytes at p, which start at an even offset within the
+ * checksummed data, to a running, unfolded checksum. The running sums
+ * of separate pieces of the data can be kept, say across
+ * retransmissions of the same payload, and added with
+ * checksum_combine().
+ */
+extern u64 checksum_partial(const void *p, size_t len, u64 sum);
+
+/* Return the running checksum of two pieces of data, given theirs. */
+extern u64 checksum_combine(u64 sum, u64 other);
+
+/* Return the final checksum (in network byte order) for a running one. */
+extern __be16 checksum_fold(u64 sum);
+
+/* Given a checksum 'check' (in network byte order) covering some data
+ * of even length, return the checksum after the 'len' bytes at p are
+ * appended to that data.
+ */
+extern __be16 checksum_append(__be16 check, const void *p, size_t len);
+
+/* MPTCP ... */
+
+/* Return the running checksum of the pseudo-header that the DSS
+ * checksum of a mapping covers (RFC 8684, Section 3.3.1).
+ */
+extern u64 mptcp_dss_header_checksum_partial(u64 dsn, u32 ssn, u16 dll);
+
+/* Calculates the DSS checksum of a mapping over its len bytes of data
+ * (in network byte order).
+ */
+extern __be16 mptcp_dss_checksum(u64 dsn, u32 ssn, u16 dll,
+				 const void *data, size_t len);
+
 /* SCTP ... */
 
 /* Calculates the CRC32C checksum used by SCTP (in network byte order). */
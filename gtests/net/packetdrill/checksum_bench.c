@@ -0,0 +1,87 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Throughput benchmark of the checksum backends in checksum.c, on an
+ * MSS-sized segment and on a 64KB TSO-sized segment.
+ *
+ * Usage: checksum_bench [iterations]
+ */
+
+#include "checksum.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TSO_BYTES	65535
+#define MSS_BYTES	1460
+
+static s64 now_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Checksum len bytes iterations times; print ns/op and GB/s. */
+static void bench(const struct checksum_backend *backend, const char *op_name,
+		  const u8 *data, size_t len, long iterations)
+{
+	volatile u64 sink = 0;
+	s64 start, nsecs;
+	long i;
+
+	start = now_nsecs();
+	for (i = 0; i < iterations; i++)
+		sink += backend->partial(data, len, 0);
+	nsecs = now_nsecs() - start;
+	printf("%-10s %-8s %10.1f ns/op %8.2f GB/s\n", backend->name, op_name,
+	       (double)nsecs / iterations,
+	       (double)len * iterations / (nsecs ? nsecs : 1));
+}
+
+int main(int argc, char *argv[])
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 100000;
+	u8 *data;
+	int i;
+
+	if (iterations <= 0) {
+		fprintf(stderr, "usage: checksum_bench [iterations]\n");
+		return EXIT_FAILURE;
+	}
+
+	data = malloc(TSO_BYTES);
+	for (i = 0; i < TSO_BYTES; i++)
+		data[i] = random();
+
+	for (i = 0; checksum_backends[i] != NULL; i++) {
+		const struct checksum_backend *backend = checksum_backends[i];
+
+		if (!backend->available()) {
+			printf("%-10s not supported by this CPU\n",
+			       backend->name);
+			continue;
+		}
+		bench(backend, "mss", data, MSS_BYTES, iterations * 10);
+		bench(backend, "tso_64k", data, TSO_BYTES, iterations / 10 + 1);
+	}
+
+	free(data);
+	return 0;
+}
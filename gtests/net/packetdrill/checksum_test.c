@@ -26,6 +26,8 @@
 
 #include <arpa/inet.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include "ip.h"
 #include "ipv6.h"
 #include "sctp.h"
@@ -113,6 +115,38 @@ static void test_ipv4_checksum(void)
 	assert(checksum == 0xf910);
 }
 
+/* Rewriting header words and patching the checksum incrementally must
+ * leave a header that still checksums to zero.
+ */
+static void test_checksum_update(void)
+{
+	u8 data[] = {
+		0x45, 0x00, 0x00, 0x3c, 0x00, 0x00, 0x00, 0x00,
+		0xff, 0x06, 0xf9, 0x10, 0x01, 0x01, 0x01, 0x01,
+		0xc0, 0xa8, 0x00, 0x01,
+	};
+	struct ipv4 *ip = (struct ipv4 *) data;
+	u8 old_addr[4], new_addr[4] = { 0xff, 0xff, 0x00, 0x00 };
+	u8 old_ttl[2];
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		memcpy(old_addr, &ip->src_ip, sizeof(old_addr));
+		memcpy(&ip->src_ip, new_addr, sizeof(new_addr));
+		ip->check = checksum_update(ip->check, old_addr, new_addr,
+					    sizeof(new_addr));
+		assert(ipv4_checksum(data, sizeof(data)) == 0);
+
+		memcpy(old_ttl, &ip->ttl, sizeof(old_ttl));
+		ip->ttl = random();
+		ip->check = checksum_update(ip->check, old_ttl, &ip->ttl,
+					    sizeof(old_ttl));
+		assert(ipv4_checksum(data, sizeof(data)) == 0);
+
+		new_addr[i % 4] = random();
+	}
+}
+
 static void test_sctp_crc32c(void)
 {
 	u8 data[] = {
@@ -130,11 +164,123 @@ static void test_sctp_crc32c(void)
 	assert(crc32c == 0xdad73774);
 }
 
+/* The DSS checksum summed 16 bits at a time, as RFC 8684 lays it out. */
+static u16 dss_checksum_reference(u64 dsn, u32 ssn, u16 dll,
+				  const u8 *data, size_t len)
+{
+	u64 sum = 0;
+	size_t i;
+
+	sum += (dsn >> 48) + ((dsn >> 32) & 0xffff) +
+	       ((dsn >> 16) & 0xffff) + (dsn & 0xffff);
+	sum += (ssn >> 16) + (ssn & 0xffff) + dll;
+	for (i = 0; i < len; i += 2)
+		sum += (data[i] << 8) | (i + 1 < len ? data[i + 1] : 0);
+	while (sum >> 16)
+		sum = (sum >> 16) + (sum & 0xffff);
+	return ~sum;
+}
+
+static void test_mptcp_dss_checksum(void)
+{
+	const u64 dsn = 0x0123456789abcdefULL;
+	const u32 ssn = 0xfedcba98;
+	u8 data[1500];
+	size_t len, split;
+
+	for (len = 0; len < sizeof(data); len++)
+		data[len] = random();
+
+	for (len = 0; len <= sizeof(data); len += len < 64 ? 1 : 61) {
+		u16 dll = len;
+		__be16 check = mptcp_dss_checksum(dsn, ssn, dll, data, len);
+		u64 header = mptcp_dss_header_checksum_partial(dsn, ssn, dll);
+
+		assert(ntohs(check) ==
+		       dss_checksum_reference(dsn, ssn, dll, data, len));
+
+		/* The header and data sums can be taken apart. */
+		assert(checksum_fold(checksum_combine(
+			header, checksum_partial(data, len, 0))) == check);
+
+		/* So can pieces of the data, split at an even offset. */
+		split = len / 4 * 2;
+		assert(checksum_append(
+			mptcp_dss_checksum(dsn, ssn, dll, data, split),
+			data + split, len - split) == check);
+	}
+
+	/* Running sums near overflow still combine. */
+	assert(checksum_fold(checksum_combine(~0ULL, ~0ULL)) ==
+	       checksum_fold(checksum_combine(0xffffffffULL,
+					      0xffffffffULL)));
+}
+
+/* Every backend must agree with the generic one, for all lengths and
+ * alignments, including buffers of all 0xff bytes (worst-case carries).
+ */
+static void test_checksum_backends(void)
+{
+	const int max_len = 65535 + 8;
+	u8 *data = malloc(max_len);
+	struct in_addr src_ip, dst_ip;
+	struct in6_addr src_ip6, dst_ip6;
+	char *error = NULL;
+	int i, len, offset, fill;
+
+	assert(inet_pton(AF_INET, "192.0.2.1", &src_ip) == 1);
+	assert(inet_pton(AF_INET, "192.168.0.1", &dst_ip) == 1);
+	assert(inet_pton(AF_INET6, "2001:db8::1", &src_ip6) == 1);
+	assert(inet_pton(AF_INET6, "fd3d:fa7b:d17d::1", &dst_ip6) == 1);
+
+	for (fill = 0; fill < 2; fill++) {
+		for (i = 0; i < max_len; i++)
+			data[i] = fill ? 0xff : random();
+
+		for (len = 0; len <= 65535; len += len < 300 ? 1 : 997) {
+			for (offset = 0; offset < 4; offset++) {
+				__be16 v4, v6;
+
+				assert(checksum_backend_set("generic",
+							    &error) == STATUS_OK);
+				v4 = tcp_udp_v4_checksum(src_ip, dst_ip,
+							 IPPROTO_TCP,
+							 data + offset, len);
+				v6 = tcp_udp_v6_checksum(&src_ip6, &dst_ip6,
+							 IPPROTO_TCP,
+							 data + offset, len);
+				for (i = 0; checksum_backends[i]; i++) {
+					const char *name =
+						checksum_backends[i]->name;
+
+					if (!checksum_backends[i]->available())
+						continue;
+					assert(checksum_backend_set(
+						name, &error) == STATUS_OK);
+					assert(tcp_udp_v4_checksum(
+						src_ip, dst_ip, IPPROTO_TCP,
+						data + offset, len) == v4);
+					assert(tcp_udp_v6_checksum(
+						&src_ip6, &dst_ip6, IPPROTO_TCP,
+						data + offset, len) == v6);
+				}
+			}
+		}
+	}
+	assert(checksum_backend_set("auto", &error) == STATUS_OK);
+	assert(checksum_backend_set("no-such-backend", &error) == STATUS_ERR);
+	free(error);
+	free(data);
+}
+
 int main(void)
 {
 	test_tcp_udp_v4_checksum();
 	test_tcp_udp_v6_checksum();
 	test_ipv4_checksum();
+	test_checksum_update();
 	test_sctp_crc32c();
+	test_mptcp_dss_checksum();
+	test_checksum_backends();
 	return 0;
 }
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of remote clock offset and drift estimation.
+ */
+
+#include "clock_sync.h"
+
+#include <string.h>
+
+void clock_sync_init(struct clock_sync *sync)
+{
+	memset(sync, 0, sizeof(*sync));
+	sync->min_delay_usecs = -1;
+}
+
+void clock_sync_add_probe(struct clock_sync *sync,
+			  s64 t1, s64 t2, s64 t3, s64 t4)
+{
+	s64 delay_usecs = (t4 - t1) - (t3 - t2);
+
+	sync->num_probes++;
+	if (delay_usecs < 0)
+		delay_usecs = 0;	/* clock steps; take it anyway */
+	if (sync->min_delay_usecs >= 0 && delay_usecs >= sync->min_delay_usecs)
+		return;
+
+	/* A better sample: start over from it, drift and all. */
+	sync->min_delay_usecs = delay_usecs;
+	sync->offset_usecs = ((t2 - t1) + (t3 - t4)) / 2;
+	sync->base_usecs = t4;
+	sync->drift = 0;
+	sync->num_drift_samples = 0;
+}
+
+void clock_sync_add_one_way(struct clock_sync *sync,
+			    s64 remote_send_usecs,
+			    s64 local_receive_usecs)
+{
+	s64 span_usecs = local_receive_usecs - sync->base_usecs;
+	s64 offset_usecs;
+	double drift;
+
+	if (sync->min_delay_usecs < 0)
+		return;
+	sync->num_one_way++;
+	if (span_usecs < CLOCK_SYNC_MIN_SPAN_USECS)
+		return;
+
+	offset_usecs = remote_send_usecs - local_receive_usecs +
+		sync->min_delay_usecs / 2;
+	drift = (double)(offset_usecs - sync->offset_usecs) / span_usecs;
+	if (drift > CLOCK_SYNC_MAX_DRIFT)
+		drift = CLOCK_SYNC_MAX_DRIFT;
+	else if (drift < -CLOCK_SYNC_MAX_DRIFT)
+		drift = -CLOCK_SYNC_MAX_DRIFT;
+
+	/* Every sample is a lower bound, so the steepest one wins. */
+	if (sync->num_drift_samples == 0 || drift > sync->drift)
+		sync->drift = drift;
+	sync->num_drift_samples++;
+}
+
+s64 clock_sync_offset_at(const struct clock_sync *sync, s64 local_usecs)
+{
+	return sync->offset_usecs +
+		(s64)(sync->drift * (local_usecs - sync->base_usecs));
+}
+
+s64 clock_sync_remote_to_local(const struct clock_sync *sync,
+			       s64 remote_usecs)
+{
+	/* The offset changes so slowly that evaluating it at our first
+	 * guess at the local time is plenty.
+	 */
+	s64 local_usecs = remote_usecs - sync->offset_usecs;
+
+	return remote_usecs - clock_sync_offset_at(sync, local_usecs);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for estimating the offset and drift between our clock and
+ * a remote machine's, NTP-style, for remote on-the-wire testing.
+ *
+ * Round-trip probes give the offset as NTP does: with local send time
+ * t1, remote receive and send times t2 and t3, and local receive time
+ * t4, the remote clock is ahead by ((t2 - t1) + (t3 - t4)) / 2, give or
+ * take half the round trip delay (t4 - t1) - (t3 - t2) less the
+ * remote's turnaround. We keep the probe with the least delay, whose
+ * estimate is the tightest.
+ *
+ * After that, one-way messages from the remote side with its send time
+ * refine the drift. A message that left at remote time r and arrived
+ * at local time l says the offset is at least r - l plus the one-way
+ * delay, which we take as half the least round trip delay. Queueing can
+ * only delay messages, so such samples only ever under-estimate, and
+ * we take the steepest drift they allow.
+ */
+
+#ifndef __CLOCK_SYNC_H__
+#define __CLOCK_SYNC_H__
+
+#include "types.h"
+
+/* Drift we believe, at most, in remote usecs gained per local usec. */
+#define CLOCK_SYNC_MAX_DRIFT		0.0005
+
+/* Local usecs one-way samples must span before we estimate drift. */
+#define CLOCK_SYNC_MIN_SPAN_USECS	1000000
+
+struct clock_sync {
+	s64 offset_usecs;	/* remote clock minus local at base_usecs */
+	s64 base_usecs;		/* local time of offset_usecs estimate */
+	s64 min_delay_usecs;	/* least round trip delay, or -1 */
+	double drift;		/* remote usecs gained per local usec */
+	int num_probes;		/* round-trip samples taken */
+	int num_one_way;	/* one-way samples taken */
+	int num_drift_samples;	/* one-way samples far enough from base */
+};
+
+/* Start with no estimate: remote clock equals local. */
+extern void clock_sync_init(struct clock_sync *sync);
+
+/* Take a round-trip sample: we sent at t1 and got the reply at t4,
+ * local time; the remote side got our probe at t2 and replied at t3,
+ * remote time.
+ */
+extern void clock_sync_add_probe(struct clock_sync *sync,
+				 s64 t1, s64 t2, s64 t3, s64 t4);
+
+/* Take a one-way sample: the remote side sent a message at the given
+ * remote time, which arrived at the given local time. Ignored until we
+ * have a round-trip sample.
+ */
+extern void clock_sync_add_one_way(struct clock_sync *sync,
+				   s64 remote_send_usecs,
+				   s64 local_receive_usecs);
+
+/* Return our estimate of how far the remote clock is ahead of ours at
+ * the given local time.
+ */
+extern s64 clock_sync_offset_at(const struct clock_sync *sync,
+				s64 local_usecs);
+
+/* Return the local time at which the remote clock reads the given time. */
+extern s64 clock_sync_remote_to_local(const struct clock_sync *sync,
+				      s64 remote_usecs);
+
+#endif /* __CLOCK_SYNC_H__ */
@@ -0,0 +1,107 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for clock_sync.c: offset and drift estimates between clocks.
+ */
+
+#include "clock_sync.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+/* A remote clock 5 seconds ahead of ours that gains 100 ppm. */
+static const s64 true_offset_usecs = 5000000;
+static const double true_drift = 0.0001;
+
+static s64 remote_time(s64 local_usecs)
+{
+	return local_usecs + true_offset_usecs +
+		(s64)(true_drift * local_usecs);
+}
+
+static void test_probes(void)
+{
+	struct clock_sync sync;
+
+	clock_sync_init(&sync);
+	assert(clock_sync_remote_to_local(&sync, 1234) == 1234);
+
+	/* A slow, lopsided probe: 900us out, 100us back. */
+	clock_sync_add_probe(&sync, 0, remote_time(900), remote_time(910),
+			     1010);
+	assert(sync.min_delay_usecs == 1000);
+	assert(llabs(sync.offset_usecs - true_offset_usecs) <= 400);
+
+	/* A quick, even one wins: 50us each way. */
+	clock_sync_add_probe(&sync, 2000, remote_time(2050),
+			     remote_time(2060), 2110);
+	assert(sync.min_delay_usecs == 100);
+	assert(llabs(sync.offset_usecs - true_offset_usecs) <= 1);
+
+	/* A slower one after that changes nothing. */
+	clock_sync_add_probe(&sync, 3000, remote_time(3300),
+			     remote_time(3310), 3410);
+	assert(sync.min_delay_usecs == 100);
+	assert(sync.num_probes == 3);
+
+	assert(llabs(clock_sync_remote_to_local(&sync, remote_time(2110)) -
+		     2110) <= 1);
+}
+
+static void test_drift(void)
+{
+	struct clock_sync sync;
+	s64 local_usecs;
+	int i;
+
+	clock_sync_init(&sync);
+
+	/* One-way samples before any probe are ignored. */
+	clock_sync_add_one_way(&sync, remote_time(0), 50);
+	assert(sync.num_one_way == 0);
+
+	clock_sync_add_probe(&sync, 0, remote_time(50), remote_time(60),
+			     110);
+
+	/* Ten seconds of one-way samples, 50us in flight, some of them
+	 * queued for up to 2ms on the way.
+	 */
+	for (i = 1; i <= 100; i++) {
+		local_usecs = i * 100000;
+		clock_sync_add_one_way(&sync,
+				       remote_time(local_usecs - 50 -
+						   (i % 3) * 1000),
+				       local_usecs);
+	}
+	assert(sync.num_one_way == 100);
+	assert(sync.num_drift_samples == 90);
+	assert(sync.drift > true_drift * 0.99);
+	assert(sync.drift < true_drift * 1.01);
+
+	/* So a minute out we are within a few usecs, not 6ms. */
+	local_usecs = 60 * 1000000;
+	assert(llabs(clock_sync_remote_to_local(&sync,
+						remote_time(local_usecs)) -
+		     local_usecs) <= 10);
+}
+
+int main(void)
+{
+	test_probes();
+	test_drift();
+	return 0;
+}
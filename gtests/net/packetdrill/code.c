@@ -35,6 +35,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include "code_assert.h"
 #include "run.h"
 #include "tcp.h"
 
@@ -99,23 +100,47 @@ static void emit_var_end(struct code_state *code)
 	fprintf(code->file, "\n");
 }
 
-/* Write out a formatted representation of useful symbolic names. */
-static void write_symbols(struct code_state *code)
+/* A named value for the post-processing code to use. */
+struct code_var {
+	const char *name;
+	s64 value;
+};
+
+/* Enough room for the symbols and tcp_info fields below. */
+#define MAX_CODE_VARS	64
+
+/* The variables for a snippet of code. */
+struct code_vars {
+	struct code_var vars[MAX_CODE_VARS];
+	int num_vars;
+};
+
+/* Append a variable to the given set. */
+static void add_var(struct code_vars *vars, const char *name, s64 value)
+{
+	assert(vars->num_vars < MAX_CODE_VARS);
+	vars->vars[vars->num_vars].name = name;
+	vars->vars[vars->num_vars].value = value;
+	vars->num_vars++;
+}
+
+/* Add useful symbolic names. */
+static void get_symbols(struct code_vars *vars)
 {
 #ifdef linux
-	/* Emit symbolic names for tcpi_ca_state values. */
-	emit_var(code, "TCP_CA_Open",		TCP_CA_Open);
-	emit_var(code, "TCP_CA_Disorder",	TCP_CA_Disorder);
-	emit_var(code, "TCP_CA_CWR",		TCP_CA_CWR);
-	emit_var(code, "TCP_CA_Recovery",	TCP_CA_Recovery);
-	emit_var(code, "TCP_CA_Loss",		TCP_CA_Loss);
+	/* Symbolic names for tcpi_ca_state values. */
+	add_var(vars, "TCP_CA_Open",		TCP_CA_Open);
+	add_var(vars, "TCP_CA_Disorder",	TCP_CA_Disorder);
+	add_var(vars, "TCP_CA_CWR",		TCP_CA_CWR);
+	add_var(vars, "TCP_CA_Recovery",	TCP_CA_Recovery);
+	add_var(vars, "TCP_CA_Loss",		TCP_CA_Loss);
 #endif  /* linux */
 
 	/* tcpi_options flags */
 #ifdef linux
-	emit_var(code, "TCPI_OPT_TIMESTAMPS",	TCPI_OPT_TIMESTAMPS);
-	emit_var(code, "TCPI_OPT_WSCALE",	TCPI_OPT_WSCALE);
-	emit_var(code, "TCPI_OPT_ECN",		TCPI_OPT_ECN);
+	add_var(vars, "TCPI_OPT_TIMESTAMPS",	TCPI_OPT_TIMESTAMPS);
+	add_var(vars, "TCPI_OPT_WSCALE",	TCPI_OPT_WSCALE);
+	add_var(vars, "TCPI_OPT_ECN",		TCPI_OPT_ECN);
 #endif  /* linux */
 }
 
@@ -123,95 +148,147 @@ static void write_symbols(struct code_state *code)
 
 #ifdef linux
 
-/* Write out a formatted representation of the given tcp_info buffer. */
-static void write_tcp_info(struct code_state *code,
-				   const struct _tcp_info *info,
-				   int len)
+/* Set up the symbols and the values of the tcpi_foo fields of the
+ * given tcp_info buffer as variables.
+ */
+static void get_tcp_info_vars(const struct _tcp_info *info, int len,
+			      struct code_vars *vars)
 {
 	assert(len >= sizeof(struct _tcp_info));
 
-	write_symbols(code);
-
-	/* Emit the recorded values of tcpi_foo values. */
-	emit_var(code, "tcpi_state",		info->tcpi_state);
-	emit_var(code, "tcpi_ca_state",		info->tcpi_ca_state);
-	emit_var(code, "tcpi_retransmits",	info->tcpi_retransmits);
-	emit_var(code, "tcpi_probes",		info->tcpi_probes);
-	emit_var(code, "tcpi_backoff",		info->tcpi_backoff);
-	emit_var(code, "tcpi_options",		info->tcpi_options);
-	emit_var(code, "tcpi_snd_wscale",	info->tcpi_snd_wscale);
-	emit_var(code, "tcpi_rcv_wscale",	info->tcpi_rcv_wscale);
-	emit_var(code, "tcpi_rto",		info->tcpi_rto);
-	emit_var(code, "tcpi_ato",		info->tcpi_ato);
-	emit_var(code, "tcpi_snd_mss",		info->tcpi_snd_mss);
-	emit_var(code, "tcpi_rcv_mss",		info->tcpi_rcv_mss);
-	emit_var(code, "tcpi_unacked",		info->tcpi_unacked);
-	emit_var(code, "tcpi_sacked",		info->tcpi_sacked);
-	emit_var(code, "tcpi_lost",		info->tcpi_lost);
-	emit_var(code, "tcpi_retrans",		info->tcpi_retrans);
-	emit_var(code, "tcpi_fackets",		info->tcpi_fackets);
-	emit_var(code, "tcpi_last_data_sent",	info->tcpi_last_data_sent);
-	emit_var(code, "tcpi_last_ack_sent",	info->tcpi_last_ack_sent);
-	emit_var(code, "tcpi_last_data_recv",	info->tcpi_last_data_recv);
-	emit_var(code, "tcpi_last_ack_recv",	info->tcpi_last_ack_recv);
-	emit_var(code, "tcpi_pmtu",		info->tcpi_pmtu);
-	emit_var(code, "tcpi_rcv_ssthresh",	info->tcpi_rcv_ssthresh);
-	emit_var(code, "tcpi_rtt",		info->tcpi_rtt);
-	emit_var(code, "tcpi_rttvar",		info->tcpi_rttvar);
-	emit_var(code, "tcpi_snd_ssthresh",	info->tcpi_snd_ssthresh);
-	emit_var(code, "tcpi_snd_cwnd",		info->tcpi_snd_cwnd);
-	emit_var(code, "tcpi_advmss",		info->tcpi_advmss);
-	emit_var(code, "tcpi_reordering",	info->tcpi_reordering);
-	emit_var(code, "tcpi_total_retrans",	info->tcpi_total_retrans);
-
-	emit_var(code, "tcpi_rcv_rtt",		info->tcpi_rcv_rtt);
-	emit_var(code, "tcpi_rcv_space",	info->tcpi_rcv_space);
-
-	emit_var_end(code);
+	vars->num_vars = 0;
+	get_symbols(vars);
+
+	/* The recorded values of tcpi_foo fields. */
+	add_var(vars, "tcpi_state",		info->tcpi_state);
+	add_var(vars, "tcpi_ca_state",		info->tcpi_ca_state);
+	add_var(vars, "tcpi_retransmits",	info->tcpi_retransmits);
+	add_var(vars, "tcpi_probes",		info->tcpi_probes);
+	add_var(vars, "tcpi_backoff",		info->tcpi_backoff);
+	add_var(vars, "tcpi_options",		info->tcpi_options);
+	add_var(vars, "tcpi_snd_wscale",	info->tcpi_snd_wscale);
+	add_var(vars, "tcpi_rcv_wscale",	info->tcpi_rcv_wscale);
+	add_var(vars, "tcpi_rto",		info->tcpi_rto);
+	add_var(vars, "tcpi_ato",		info->tcpi_ato);
+	add_var(vars, "tcpi_snd_mss",		info->tcpi_snd_mss);
+	add_var(vars, "tcpi_rcv_mss",		info->tcpi_rcv_mss);
+	add_var(vars, "tcpi_unacked",		info->tcpi_unacked);
+	add_var(vars, "tcpi_sacked",		info->tcpi_sacked);
+	add_var(vars, "tcpi_lost",		info->tcpi_lost);
+	add_var(vars, "tcpi_retrans",		info->tcpi_retrans);
+	add_var(vars, "tcpi_fackets",		info->tcpi_fackets);
+	add_var(vars, "tcpi_last_data_sent",	info->tcpi_last_data_sent);
+	add_var(vars, "tcpi_last_ack_sent",	info->tcpi_last_ack_sent);
+	add_var(vars, "tcpi_last_data_recv",	info->tcpi_last_data_recv);
+	add_var(vars, "tcpi_last_ack_recv",	info->tcpi_last_ack_recv);
+	add_var(vars, "tcpi_pmtu",		info->tcpi_pmtu);
+	add_var(vars, "tcpi_rcv_ssthresh",	info->tcpi_rcv_ssthresh);
+	add_var(vars, "tcpi_rtt",		info->tcpi_rtt);
+	add_var(vars, "tcpi_rttvar",		info->tcpi_rttvar);
+	add_var(vars, "tcpi_snd_ssthresh",	info->tcpi_snd_ssthresh);
+	add_var(vars, "tcpi_snd_cwnd",		info->tcpi_snd_cwnd);
+	add_var(vars, "tcpi_advmss",		info->tcpi_advmss);
+	add_var(vars, "tcpi_reordering",	info->tcpi_reordering);
+	add_var(vars, "tcpi_total_retrans",	info->tcpi_total_retrans);
+
+	add_var(vars, "tcpi_rcv_rtt",		info->tcpi_rcv_rtt);
+	add_var(vars, "tcpi_rcv_space",		info->tcpi_rcv_space);
 }
 
 #endif  /* linux */
 
 #if defined(__FreeBSD__)
 
-/* Write out a formatted representation of the given tcp_info buffer. */
-static void write_tcp_info(struct code_state *code,
-				   const struct _tcp_info *info,
-				   int len)
+/* Set up the symbols and the values of the tcpi_foo fields of the
+ * given tcp_info buffer as variables.
+ */
+static void get_tcp_info_vars(const struct _tcp_info *info, int len,
+			      struct code_vars *vars)
 {
 	assert(len >= sizeof(struct _tcp_info));
 
-	write_symbols(code);
-
-	/* Emit the recorded values of tcpi_foo values. */
-	emit_var(code, "tcpi_state",		info->tcpi_state);
-	emit_var(code, "tcpi_options",		info->tcpi_options);
-	emit_var(code, "tcpi_snd_wscale",	info->tcpi_snd_wscale);
-	emit_var(code, "tcpi_rcv_wscale",	info->tcpi_rcv_wscale);
-	emit_var(code, "tcpi_rto",		info->tcpi_rto);
-	emit_var(code, "tcpi_snd_mss",		info->tcpi_snd_mss);
-	emit_var(code, "tcpi_rcv_mss",		info->tcpi_rcv_mss);
-	emit_var(code, "tcpi_last_data_recv",	info->tcpi_last_data_recv);
-	emit_var(code, "tcpi_rtt",		info->tcpi_rtt);
-	emit_var(code, "tcpi_rttvar",		info->tcpi_rttvar);
-	emit_var(code, "tcpi_snd_ssthresh",	info->tcpi_snd_ssthresh);
-	emit_var(code, "tcpi_snd_cwnd",		info->tcpi_snd_cwnd);
-	emit_var(code, "tcpi_rcv_space",	info->tcpi_rcv_space);
+	vars->num_vars = 0;
+	get_symbols(vars);
+
+	/* The recorded values of tcpi_foo fields. */
+	add_var(vars, "tcpi_state",		info->tcpi_state);
+	add_var(vars, "tcpi_options",		info->tcpi_options);
+	add_var(vars, "tcpi_snd_wscale",	info->tcpi_snd_wscale);
+	add_var(vars, "tcpi_rcv_wscale",	info->tcpi_rcv_wscale);
+	add_var(vars, "tcpi_rto",		info->tcpi_rto);
+	add_var(vars, "tcpi_snd_mss",		info->tcpi_snd_mss);
+	add_var(vars, "tcpi_rcv_mss",		info->tcpi_rcv_mss);
+	add_var(vars, "tcpi_last_data_recv",	info->tcpi_last_data_recv);
+	add_var(vars, "tcpi_rtt",		info->tcpi_rtt);
+	add_var(vars, "tcpi_rttvar",		info->tcpi_rttvar);
+	add_var(vars, "tcpi_snd_ssthresh",	info->tcpi_snd_ssthresh);
+	add_var(vars, "tcpi_snd_cwnd",		info->tcpi_snd_cwnd);
+	add_var(vars, "tcpi_rcv_space",		info->tcpi_rcv_space);
 
 	/* FreeBSD extensions to tcp_info. */
-	emit_var(code, "tcpi_snd_wnd",		info->tcpi_snd_wnd);
-	emit_var(code, "tcpi_snd_bwnd",		info->tcpi_snd_bwnd);
-	emit_var(code, "tcpi_snd_nxt",		info->tcpi_snd_nxt);
-	emit_var(code, "tcpi_rcv_nxt",		info->tcpi_rcv_nxt);
-	emit_var(code, "tcpi_toe_tid",		info->tcpi_toe_tid);
-	emit_var(code, "tcpi_snd_rexmitpack",	info->tcpi_snd_rexmitpack);
-	emit_var(code, "tcpi_rcv_ooopack",	info->tcpi_rcv_ooopack);
-	emit_var(code, "tcpi_snd_zerowin",	info->tcpi_snd_zerowin);
+	add_var(vars, "tcpi_snd_wnd",		info->tcpi_snd_wnd);
+	add_var(vars, "tcpi_snd_bwnd",		info->tcpi_snd_bwnd);
+	add_var(vars, "tcpi_snd_nxt",		info->tcpi_snd_nxt);
+	add_var(vars, "tcpi_rcv_nxt",		info->tcpi_rcv_nxt);
+	add_var(vars, "tcpi_toe_tid",		info->tcpi_toe_tid);
+	add_var(vars, "tcpi_snd_rexmitpack",	info->tcpi_snd_rexmitpack);
+	add_var(vars, "tcpi_rcv_ooopack",	info->tcpi_rcv_ooopack);
+	add_var(vars, "tcpi_snd_zerowin",	info->tcpi_snd_zerowin);
+}
+
+#endif  /* __FreeBSD__ */
+
+#if HAVE_TCP_INFO
+
+/* Write out a formatted representation of the given tcp_info buffer. */
+static void write_tcp_info(struct code_state *code,
+			   const struct _tcp_info *info,
+			   int len)
+{
+	struct code_vars vars;
+	int i;
 
+	get_tcp_info_vars(info, len, &vars);
+	for (i = 0; i < vars.num_vars; i++)
+		emit_var(code, vars.vars[i].name, vars.vars[i].value);
 	emit_var_end(code);
 }
 
-#endif  /* __FreeBSD__ */
+static bool lookup_var(void *arg, const char *name, int len, s64 *value)
+{
+	const struct code_vars *vars = arg;
+	int i;
+
+	for (i = 0; i < vars->num_vars; i++) {
+		if (strncmp(vars->vars[i].name, name, len) == 0 &&
+		    vars->vars[i].name[len] == '\0') {
+			*value = vars->vars[i].value;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* If the snippet is simple enough, check it against the tcp_info we
+ * just got, right away and without the interpreter; if so return
+ * true. If an assertion fails, fill in *error.
+ */
+static bool run_native_code(struct code_state *code, const char *text,
+			    const struct _tcp_info *info, int len,
+			    char **error)
+{
+	struct code_vars vars;
+
+	if (code->format != FORMAT_PYTHON)
+		return false;
+	get_tcp_info_vars(info, len, &vars);
+	if (!code_assert_supported(text, lookup_var, &vars))
+		return false;
+	code_assert_run(text, lookup_var, &vars, error);
+	return true;
+}
+
+#endif  /* HAVE_TCP_INFO */
 
 /* Allocate a new empty struct code_text struct. */
 static struct code_text *text_new(void)
@@ -617,6 +694,17 @@ void run_code_event(struct state *state, struct event *event,
 	assert(code->data_type != DATA_NONE);
 	assert(data != NULL);
 
+#if HAVE_TCP_INFO
+	if (code->data_type == DATA_TCP_INFO &&
+	    run_native_code(code, text, data, data_len, &error)) {
+		free(data);
+		if (error != NULL)
+			goto error_out;
+		DEBUGP("%d: code checked in-process\n", event->line_number);
+		return;
+	}
+#endif  /* HAVE_TCP_INFO */
+
 	append_data(code, code->data_type, data, data_len);
 	append_text(code, state->config->script_path, event->line_number,
 		    strdup(text));
@@ -98,9 +98,11 @@ extern struct code_state *code_new(struct config *config);
 extern void code_free(struct code_state *code);
 
 /* Run the TCP_INFO getsockopt on the current socket under test to
- * get a snapshot of socket state, and stash the resulting data and
- * code snippet so that at the end of the test we can emit the data
- * and the code snippet, and then execute both.
+ * get a snapshot of socket state. If the snippet is only simple
+ * assertions (see code_assert.h), check them against the snapshot
+ * right away, and die if one fails. Otherwise stash the resulting
+ * data and code snippet so that at the end of the test we can emit
+ * the data and the code snippet, and then execute both.
  */
 struct state;
 extern void run_code_event(struct state *state,
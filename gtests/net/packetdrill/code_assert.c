@@ -0,0 +1,686 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the in-process evaluator for simple assertion
+ * snippets. It is a recursive descent parser over the text that
+ * computes values as it goes. The same code checks whether a snippet
+ * is supported, by parsing it with evaluation turned off; that is
+ * also how 'and', 'or' and comparison chains skip their operands.
+ */
+
+#include "code_assert.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+
+enum token_t {
+	TOKEN_END,		/* end of the snippet */
+	TOKEN_SEPARATOR,	/* newline or ';' between statements */
+	TOKEN_NUMBER,
+	TOKEN_NAME,
+	TOKEN_STRING,
+	TOKEN_OPERATOR,
+};
+
+enum operator_t {
+	OP_LPAREN, OP_RPAREN, OP_COMMA,
+	OP_PLUS, OP_MINUS, OP_TIMES, OP_FLOOR_DIV, OP_MOD,
+	OP_INVERT, OP_LSHIFT, OP_RSHIFT, OP_BIT_AND, OP_BIT_XOR, OP_BIT_OR,
+	OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE,
+};
+
+/* Operators, longest first so that "<=" is not read as "<". */
+static const struct {
+	const char *text;
+	enum operator_t op;
+} operators[] = {
+	{ "//", OP_FLOOR_DIV }, { "<<", OP_LSHIFT }, { ">>", OP_RSHIFT },
+	{ "==", OP_EQ }, { "!=", OP_NE }, { "<=", OP_LE }, { ">=", OP_GE },
+	{ "(", OP_LPAREN }, { ")", OP_RPAREN }, { ",", OP_COMMA },
+	{ "+", OP_PLUS }, { "-", OP_MINUS }, { "*", OP_TIMES },
+	{ "%", OP_MOD }, { "~", OP_INVERT }, { "&", OP_BIT_AND },
+	{ "^", OP_BIT_XOR }, { "|", OP_BIT_OR }, { "<", OP_LT },
+	{ ">", OP_GT },
+};
+
+/* Python keywords that may not be used as variable names. */
+static const char *keywords[] = {
+	"and", "as", "assert", "async", "await", "break", "class",
+	"continue", "def", "del", "elif", "else", "except", "exec",
+	"finally", "for", "from", "global", "if", "import", "in", "is",
+	"lambda", "None", "nonlocal", "not", "or", "pass", "print",
+	"raise", "return", "try", "while", "with", "yield", NULL,
+};
+
+/* The most variables whose values we show for a failed assertion. */
+#define MAX_SHOWN_VARS	16
+
+struct shown_var {
+	const char *name;
+	int len;
+	s64 value;
+};
+
+struct parser {
+	const char *p;			/* next character to scan */
+	int depth;			/* parentheses open */
+	code_lookup_t lookup;
+	void *lookup_arg;
+	bool unsupported;		/* something only Python can do */
+	const char *runtime_error;	/* e.g. division by zero */
+
+	/* The current token. */
+	enum token_t token;
+	enum operator_t op;		/* for TOKEN_OPERATOR */
+	s64 number;			/* for TOKEN_NUMBER */
+	const char *start;		/* text of the token */
+	int len;
+
+	/* Variables used by the current statement. */
+	struct shown_var vars[MAX_SHOWN_VARS];
+	int num_vars;
+};
+
+/* Note that the snippet needs the real interpreter, and stop. */
+static void unsupported(struct parser *parser)
+{
+	parser->unsupported = true;
+	parser->token = TOKEN_END;
+}
+
+static bool is_name_char(char c)
+{
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+/* Scan an integer literal in Python syntax. */
+static void scan_number(struct parser *parser)
+{
+	const char *p = parser->p;
+	int base = 10;
+	u64 value = 0;
+	int digits = 0;
+
+	if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+		base = 16;
+		p += 2;
+	} else if (p[0] == '0' && (p[1] == 'o' || p[1] == 'O')) {
+		base = 8;
+		p += 2;
+	} else if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) {
+		base = 2;
+		p += 2;
+	} else if (p[0] == '0' && isdigit((unsigned char)p[1])) {
+		/* Octal in Python 2, an error in Python 3. */
+		unsupported(parser);
+		return;
+	}
+	for (;; p++, digits++) {
+		int digit;
+
+		if (isdigit((unsigned char)*p))
+			digit = *p - '0';
+		else if (isxdigit((unsigned char)*p))
+			digit = tolower((unsigned char)*p) - 'a' + 10;
+		else
+			break;
+		if (digit >= base)
+			break;
+		if (value > (u64)(LLONG_MAX - digit) / base) {
+			unsupported(parser);	/* a Python long */
+			return;
+		}
+		value = value * base + digit;
+	}
+	/* Floats, complex numbers, 'L' suffixes and so on. */
+	if (digits == 0 || is_name_char(*p) || *p == '.') {
+		unsupported(parser);
+		return;
+	}
+	parser->token = TOKEN_NUMBER;
+	parser->number = value;
+	parser->p = p;
+}
+
+/* Scan a string literal; we only take the plainest kind. */
+static void scan_string(struct parser *parser)
+{
+	const char quote = *parser->p;
+	const char *p = parser->p + 1;
+
+	if (p[0] == quote && p[1] == quote) {
+		unsupported(parser);	/* triple-quoted */
+		return;
+	}
+	for (; *p != quote; p++) {
+		if (*p == '\0' || *p == '\n' || *p == '\\') {
+			unsupported(parser);
+			return;
+		}
+	}
+	parser->token = TOKEN_STRING;
+	parser->start = parser->p + 1;
+	parser->len = p - parser->start;
+	parser->p = p + 1;
+}
+
+/* Move on to the next token. */
+static void next_token(struct parser *parser)
+{
+	int i;
+
+	if (parser->unsupported)
+		return;
+	for (;;) {
+		char c = *parser->p;
+
+		if (c == ' ' || c == '\t' || c == '\r' ||
+		    (c == '\n' && parser->depth > 0)) {
+			parser->p++;
+		} else if (c == '#') {
+			while (*parser->p != '\0' && *parser->p != '\n')
+				parser->p++;
+		} else {
+			break;
+		}
+	}
+
+	parser->start = parser->p;
+	parser->len = 0;
+	if (*parser->p == '\0') {
+		parser->token = TOKEN_END;
+	} else if (*parser->p == '\n' || *parser->p == ';') {
+		if (parser->depth > 0) {
+			unsupported(parser);
+			return;
+		}
+		parser->token = TOKEN_SEPARATOR;
+		parser->p++;
+	} else if (isdigit((unsigned char)*parser->p)) {
+		scan_number(parser);
+	} else if (is_name_char(*parser->p)) {
+		while (is_name_char(*parser->p))
+			parser->p++;
+		parser->token = TOKEN_NAME;
+		parser->len = parser->p - parser->start;
+	} else if (*parser->p == '"' || *parser->p == '\'') {
+		scan_string(parser);
+	} else {
+		for (i = 0; i < ARRAY_SIZE(operators); i++) {
+			int len = strlen(operators[i].text);
+
+			if (strncmp(parser->p, operators[i].text, len) == 0)
+				break;
+		}
+		/* Python also has '/', '**', '=', '.', '[', ... */
+		if (i == ARRAY_SIZE(operators) ||
+		    (operators[i].op == OP_TIMES && parser->p[1] == '*')) {
+			unsupported(parser);
+			return;
+		}
+		parser->token = TOKEN_OPERATOR;
+		parser->op = operators[i].op;
+		parser->p += strlen(operators[i].text);
+		parser->len = parser->p - parser->start;
+		if (parser->op == OP_LPAREN)
+			parser->depth++;
+		else if (parser->op == OP_RPAREN)
+			parser->depth--;
+	}
+}
+
+static bool is_operator(struct parser *parser, enum operator_t op)
+{
+	return parser->token == TOKEN_OPERATOR && parser->op == op;
+}
+
+static bool is_name(struct parser *parser, const char *name)
+{
+	return parser->token == TOKEN_NAME &&
+		parser->len == strlen(name) &&
+		strncmp(parser->start, name, parser->len) == 0;
+}
+
+static bool is_keyword(struct parser *parser)
+{
+	int i;
+
+	for (i = 0; keywords[i] != NULL; i++) {
+		if (is_name(parser, keywords[i]))
+			return true;
+	}
+	return false;
+}
+
+/* Remember the value of a variable, to show if the assertion fails. */
+static void show_var(struct parser *parser, s64 value)
+{
+	int i;
+
+	for (i = 0; i < parser->num_vars; i++) {
+		if (parser->vars[i].len == parser->len &&
+		    strncmp(parser->vars[i].name, parser->start,
+			    parser->len) == 0)
+			return;
+	}
+	if (parser->num_vars < MAX_SHOWN_VARS) {
+		parser->vars[parser->num_vars].name = parser->start;
+		parser->vars[parser->num_vars].len = parser->len;
+		parser->vars[parser->num_vars].value = value;
+		parser->num_vars++;
+	}
+}
+
+static s64 parse_or_test(struct parser *parser, bool live);
+
+/* In all the parse_*() routines, 'live' says whether to compute the
+ * value; when it is false we only check the syntax.
+ */
+static s64 parse_atom(struct parser *parser, bool live)
+{
+	s64 value = 0;
+
+	if (parser->token == TOKEN_NUMBER) {
+		value = parser->number;
+		next_token(parser);
+	} else if (is_name(parser, "True") || is_name(parser, "False")) {
+		value = is_name(parser, "True");
+		next_token(parser);
+	} else if (parser->token == TOKEN_NAME && !is_keyword(parser)) {
+		if (!parser->lookup(parser->lookup_arg, parser->start,
+				    parser->len, &value)) {
+			unsupported(parser);	/* maybe a Python variable */
+			return 0;
+		}
+		if (live)
+			show_var(parser, value);
+		next_token(parser);
+		if (is_operator(parser, OP_LPAREN))
+			unsupported(parser);	/* a call */
+	} else if (is_operator(parser, OP_LPAREN)) {
+		next_token(parser);
+		value = parse_or_test(parser, live);
+		if (!is_operator(parser, OP_RPAREN)) {
+			unsupported(parser);	/* a tuple, or a syntax error */
+			return 0;
+		}
+		next_token(parser);
+	} else {
+		unsupported(parser);
+	}
+	return value;
+}
+
+static s64 parse_unary(struct parser *parser, bool live)
+{
+	if (is_operator(parser, OP_MINUS)) {
+		next_token(parser);
+		return -(u64)parse_unary(parser, live);
+	} else if (is_operator(parser, OP_PLUS)) {
+		next_token(parser);
+		return parse_unary(parser, live);
+	} else if (is_operator(parser, OP_INVERT)) {
+		next_token(parser);
+		return ~parse_unary(parser, live);
+	}
+	return parse_atom(parser, live);
+}
+
+/* Python's floor division and modulo, which round towards -infinity. */
+static s64 floor_div(s64 a, s64 b)
+{
+	s64 q = a / b;
+
+	if ((a % b != 0) && ((a < 0) != (b < 0)))
+		q--;
+	return q;
+}
+
+static s64 floor_mod(s64 a, s64 b)
+{
+	s64 r = a % b;
+
+	if (r != 0 && ((r < 0) != (b < 0)))
+		r += b;
+	return r;
+}
+
+static s64 parse_term(struct parser *parser, bool live)
+{
+	s64 value = parse_unary(parser, live);
+
+	while (is_operator(parser, OP_TIMES) ||
+	       is_operator(parser, OP_FLOOR_DIV) ||
+	       is_operator(parser, OP_MOD)) {
+		enum operator_t op = parser->op;
+		s64 rhs;
+
+		next_token(parser);
+		rhs = parse_unary(parser, live);
+		if (!live)
+			continue;
+		if (op == OP_TIMES) {
+			value = (u64)value * (u64)rhs;
+		} else if (rhs == 0) {
+			if (parser->runtime_error == NULL)
+				parser->runtime_error = "division by zero";
+			value = 0;
+		} else if (op == OP_FLOOR_DIV) {
+			value = floor_div(value, rhs);
+		} else {
+			value = floor_mod(value, rhs);
+		}
+	}
+	return value;
+}
+
+static s64 parse_sum(struct parser *parser, bool live)
+{
+	s64 value = parse_term(parser, live);
+
+	while (is_operator(parser, OP_PLUS) || is_operator(parser, OP_MINUS)) {
+		enum operator_t op = parser->op;
+		s64 rhs;
+
+		next_token(parser);
+		rhs = parse_term(parser, live);
+		if (op == OP_PLUS)
+			value = (u64)value + (u64)rhs;
+		else
+			value = (u64)value - (u64)rhs;
+	}
+	return value;
+}
+
+static s64 parse_shift(struct parser *parser, bool live)
+{
+	s64 value = parse_sum(parser, live);
+
+	while (is_operator(parser, OP_LSHIFT) ||
+	       is_operator(parser, OP_RSHIFT)) {
+		enum operator_t op = parser->op;
+		s64 rhs;
+
+		next_token(parser);
+		rhs = parse_sum(parser, live);
+		if (!live)
+			continue;
+		if (rhs < 0 || rhs > 62) {
+			if (parser->runtime_error == NULL)
+				parser->runtime_error = "shift out of range";
+			value = 0;
+		} else if (op == OP_LSHIFT) {
+			value = (u64)value << rhs;
+		} else {
+			value = value >> rhs;
+		}
+	}
+	return value;
+}
+
+static s64 parse_bit_and(struct parser *parser, bool live)
+{
+	s64 value = parse_shift(parser, live);
+
+	while (is_operator(parser, OP_BIT_AND)) {
+		next_token(parser);
+		value &= parse_shift(parser, live);
+	}
+	return value;
+}
+
+static s64 parse_bit_xor(struct parser *parser, bool live)
+{
+	s64 value = parse_bit_and(parser, live);
+
+	while (is_operator(parser, OP_BIT_XOR)) {
+		next_token(parser);
+		value ^= parse_bit_and(parser, live);
+	}
+	return value;
+}
+
+static s64 parse_bit_or(struct parser *parser, bool live)
+{
+	s64 value = parse_bit_xor(parser, live);
+
+	while (is_operator(parser, OP_BIT_OR)) {
+		next_token(parser);
+		value |= parse_bit_xor(parser, live);
+	}
+	return value;
+}
+
+static bool is_comparison(struct parser *parser)
+{
+	return parser->token == TOKEN_OPERATOR &&
+		parser->op >= OP_EQ && parser->op <= OP_GE;
+}
+
+static bool compare(enum operator_t op, s64 lhs, s64 rhs)
+{
+	switch (op) {
+	case OP_EQ:	return lhs == rhs;
+	case OP_NE:	return lhs != rhs;
+	case OP_LT:	return lhs < rhs;
+	case OP_LE:	return lhs <= rhs;
+	case OP_GT:	return lhs > rhs;
+	case OP_GE:	return lhs >= rhs;
+	default:	break;
+	}
+	return false;
+}
+
+/* A chain like a < b <= c means a < b and b <= c, stopping at the
+ * first comparison that is false.
+ */
+static s64 parse_comparison(struct parser *parser, bool live)
+{
+	s64 lhs = parse_bit_or(parser, live);
+	bool result = true;
+
+	if (!is_comparison(parser))
+		return lhs;
+	while (is_comparison(parser)) {
+		enum operator_t op = parser->op;
+		s64 rhs;
+
+		next_token(parser);
+		rhs = parse_bit_or(parser, live && result);
+		if (live && result)
+			result = compare(op, lhs, rhs);
+		lhs = rhs;
+	}
+	return result;
+}
+
+static s64 parse_not_test(struct parser *parser, bool live)
+{
+	if (is_name(parser, "not")) {
+		next_token(parser);
+		return !parse_not_test(parser, live);
+	}
+	return parse_comparison(parser, live);
+}
+
+/* 'and' and 'or' yield the last operand they evaluated, as in Python. */
+static s64 parse_and_test(struct parser *parser, bool live)
+{
+	s64 value = parse_not_test(parser, live);
+
+	while (is_name(parser, "and")) {
+		bool evaluate = live && value != 0;
+		s64 rhs;
+
+		next_token(parser);
+		rhs = parse_not_test(parser, evaluate);
+		if (evaluate)
+			value = rhs;
+	}
+	return value;
+}
+
+static s64 parse_or_test(struct parser *parser, bool live)
+{
+	s64 value = parse_and_test(parser, live);
+
+	while (is_name(parser, "or")) {
+		bool evaluate = live && value == 0;
+		s64 rhs;
+
+		next_token(parser);
+		rhs = parse_and_test(parser, evaluate);
+		if (evaluate)
+			value = rhs;
+	}
+	return value;
+}
+
+/* Describe the failed assertion whose text runs from start to end. */
+static void assertion_error(struct parser *parser, const char *start,
+			    const char *end, const char *message,
+			    int message_len, char **error)
+{
+	char *text = NULL;
+	size_t bytes = 0;
+	FILE *out;
+	int i;
+
+	while (end > start && isspace((unsigned char)end[-1]))
+		end--;
+	out = open_memstream(&text, &bytes);
+	if (out == NULL)
+		die_perror("open_memstream");
+	if (parser->runtime_error != NULL)
+		fprintf(out, "%s in: %.*s", parser->runtime_error,
+			(int)(end - start), start);
+	else
+		fprintf(out, "assertion failed: %.*s",
+			(int)(end - start), start);
+	if (message != NULL)
+		fprintf(out, ": %.*s", message_len, message);
+	for (i = 0; i < parser->num_vars; i++) {
+		fprintf(out, "%s%.*s = %lld", i == 0 ? " (" : ", ",
+			parser->vars[i].len, parser->vars[i].name,
+			parser->vars[i].value);
+	}
+	if (parser->num_vars > 0)
+		fprintf(out, ")");
+	fclose(out);
+	*error = text;
+}
+
+/* Parse, and if live evaluate, all the statements in the snippet.
+ * Returns STATUS_ERR if the snippet is unsupported or, when live, if
+ * an assertion failed.
+ */
+static int parse_snippet(struct parser *parser, bool live, char **error)
+{
+	next_token(parser);
+	while (parser->token != TOKEN_END) {
+		const char *start, *end;
+		const char *message = NULL;
+		char number[32];
+		int message_len = 0;
+		s64 value;
+
+		if (parser->token == TOKEN_SEPARATOR) {
+			next_token(parser);
+			continue;
+		}
+		if (!is_name(parser, "assert")) {
+			unsupported(parser);
+			break;
+		}
+		parser->num_vars = 0;
+		parser->runtime_error = NULL;
+		next_token(parser);
+		start = parser->start;
+		value = parse_or_test(parser, live);
+		end = parser->start;
+		if (is_operator(parser, OP_COMMA)) {
+			next_token(parser);
+			if (parser->token == TOKEN_STRING) {
+				message = parser->start;
+				message_len = parser->len;
+				next_token(parser);
+			} else {
+				s64 shown;
+				int num_vars = parser->num_vars;
+
+				/* Python only evaluates this on failure. */
+				shown = parse_or_test(parser,
+						      live && value == 0);
+				parser->num_vars = num_vars;
+				snprintf(number, sizeof(number), "%lld",
+					 shown);
+				message = number;
+				message_len = strlen(number);
+			}
+		}
+		if (parser->token != TOKEN_SEPARATOR &&
+		    parser->token != TOKEN_END)
+			unsupported(parser);
+		if (parser->unsupported)
+			break;
+		if (live && (value == 0 || parser->runtime_error != NULL)) {
+			assertion_error(parser, start, end, message,
+					message_len, error);
+			return STATUS_ERR;
+		}
+	}
+	if (parser->depth != 0)
+		unsupported(parser);
+	return parser->unsupported ? STATUS_ERR : STATUS_OK;
+}
+
+static void parser_init(struct parser *parser, const char *text,
+			code_lookup_t lookup, void *arg)
+{
+	memset(parser, 0, sizeof(*parser));
+	parser->p = text;
+	parser->lookup = lookup;
+	parser->lookup_arg = arg;
+}
+
+bool code_assert_supported(const char *text, code_lookup_t lookup,
+			   void *arg)
+{
+	struct parser parser;
+
+	parser_init(&parser, text, lookup, arg);
+	return parse_snippet(&parser, false, NULL) == STATUS_OK;
+}
+
+int code_assert_run(const char *text, code_lookup_t lookup, void *arg,
+		    char **error)
+{
+	struct parser parser;
+
+	parser_init(&parser, text, lookup, arg);
+	if (parse_snippet(&parser, true, error) == STATUS_OK)
+		return STATUS_OK;
+	if (parser.unsupported)
+		asprintf(error, "code not supported by native evaluator");
+	return STATUS_ERR;
+}
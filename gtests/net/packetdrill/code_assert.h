@@ -0,0 +1,65 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for evaluating simple post-processing code snippets in
+ * process, at the time of their event, instead of writing them out
+ * for the post-processing interpreter to run after the test.
+ *
+ * The snippets we handle are Python made of nothing but assert
+ * statements over integer variables, such as
+ *
+ *   assert tcpi_snd_cwnd == 10
+ *   assert tcpi_rcv_rtt >= 95*1000 and tcpi_rcv_rtt <= 105*1000
+ *
+ * separated by newlines or ';'. Expressions can use integers, the
+ * variables the caller looks up, True and False, parentheses, unary
+ * - + ~ and not, * // % + - << >> & ^ |, chained comparisons, and
+ * 'and' and 'or', all with Python's precedence and semantics. An
+ * assert can have a message after a comma. Anything else (known
+ * only to Python, like '/', '**', calls, assignments or unknown
+ * names) leaves the snippet to the interpreter.
+ */
+
+#ifndef __CODE_ASSERT_H__
+#define __CODE_ASSERT_H__
+
+#include "types.h"
+
+/* Look up the variable with the given name, which is len bytes long
+ * and not NUL-terminated. Return true and fill in *value if there is
+ * such a variable; otherwise return false.
+ */
+typedef bool (*code_lookup_t)(void *arg, const char *name, int len,
+			      s64 *value);
+
+/* Return true if the given snippet is one we can evaluate with
+ * code_assert_run(), using the given variables.
+ */
+extern bool code_assert_supported(const char *text,
+				  code_lookup_t lookup, void *arg);
+
+/* Evaluate the assertions in a snippet that code_assert_supported()
+ * accepted. Returns STATUS_OK if they all hold. Otherwise returns
+ * STATUS_ERR and fills in *error with the first one that failed and
+ * the values of the variables it used.
+ */
+extern int code_assert_run(const char *text, code_lookup_t lookup,
+			   void *arg, char **error);
+
+#endif /* __CODE_ASSERT_H__ */
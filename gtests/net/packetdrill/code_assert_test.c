@@ -0,0 +1,133 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for code_assert.c: the snippets we take follow Python's
+ * semantics, and the ones we cannot handle are left to Python.
+ */
+
+#include "code_assert.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+	const char *name;
+	s64 value;
+} vars[] = {
+	{ "tcpi_snd_cwnd",	10 },
+	{ "tcpi_unacked",	7 },
+	{ "tcpi_rcv_rtt",	100000 },
+	{ "tcpi_ca_state",	3 },
+	{ "TCP_CA_Recovery",	3 },
+	{ "zero",		0 },
+};
+
+static bool lookup(void *arg, const char *name, int len, s64 *value)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(vars); i++) {
+		if (strlen(vars[i].name) == len &&
+		    strncmp(vars[i].name, name, len) == 0) {
+			*value = vars[i].value;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Check that the snippet is supported and holds. */
+static void test_pass(const char *text)
+{
+	char *error = NULL;
+
+	assert(code_assert_supported(text, lookup, NULL));
+	assert(code_assert_run(text, lookup, NULL, &error) == STATUS_OK);
+	assert(error == NULL);
+}
+
+/* Check that the snippet is supported and fails with the given error. */
+static void test_fail(const char *text, const char *expected_error)
+{
+	char *error = NULL;
+
+	assert(code_assert_supported(text, lookup, NULL));
+	assert(code_assert_run(text, lookup, NULL, &error) == STATUS_ERR);
+	assert(error != NULL);
+	assert(strcmp(error, expected_error) == 0);
+	free(error);
+}
+
+static void test_unsupported(const char *text)
+{
+	assert(!code_assert_supported(text, lookup, NULL));
+}
+
+int main(void)
+{
+	/* The forms used in the test scripts. */
+	test_pass("assert tcpi_snd_cwnd == 10");
+	test_pass("\nassert tcpi_snd_cwnd == 10\nassert tcpi_unacked == 7\n");
+	test_pass(" assert tcpi_snd_cwnd == 10; assert tcpi_unacked == 7 ");
+	test_pass("assert tcpi_rcv_rtt >= 95*1000 and "
+		  "tcpi_rcv_rtt <= 105*1000");
+	test_pass("assert tcpi_ca_state == TCP_CA_Recovery, tcpi_ca_state");
+	test_pass("# just a comment\n\n");
+
+	/* Precedence and Python semantics. */
+	test_pass("assert 2 + 3 * 4 == 14");
+	test_pass("assert -7 // 2 == -4 and -7 % 2 == 1 and 7 % -2 == -1");
+	test_pass("assert 1 | 2 ^ 3 & 6 == 1 | (2 ^ (3 & 6))");
+	test_pass("assert 1 << 4 >> 2 == 4 and ~0 == -1");
+	test_pass("assert 0 < tcpi_unacked < tcpi_snd_cwnd <= 10");
+	test_pass("assert not 2 < 1 < zero // zero");
+	test_pass("assert (zero or 5) == 5 and (3 and 4) == 4");
+	test_pass("assert not zero and True and not False");
+	test_pass("assert 0x10 == 16 and 0b11 == 3 and 0o17 == 15");
+	test_pass("assert (tcpi_snd_cwnd +\n 1) == 11");
+
+	/* Failures show the assertion and the values it used. */
+	test_fail("assert tcpi_snd_cwnd == 10\nassert tcpi_unacked > 7\n",
+		  "assertion failed: tcpi_unacked > 7 (tcpi_unacked = 7)");
+	test_fail("assert tcpi_snd_cwnd < tcpi_unacked, 'cwnd too small'",
+		  "assertion failed: tcpi_snd_cwnd < tcpi_unacked: "
+		  "cwnd too small (tcpi_snd_cwnd = 10, tcpi_unacked = 7)");
+	test_fail("assert zero, tcpi_snd_cwnd * 2",
+		  "assertion failed: zero: 20 (zero = 0)");
+	test_fail("assert tcpi_snd_cwnd // zero",
+		  "division by zero in: tcpi_snd_cwnd // zero "
+		  "(tcpi_snd_cwnd = 10, zero = 0)");
+
+	/* Things we leave to Python. */
+	test_unsupported("assert tcpi_snd_cwnd / 2 == 5");
+	test_unsupported("assert tcpi_snd_cwnd ** 2 == 100");
+	test_unsupported("x = tcpi_snd_cwnd");
+	test_unsupported("assert tcpi_snd_cwnd == x");
+	test_unsupported("assert abs(tcpi_snd_cwnd) == 10");
+	test_unsupported("print(tcpi_snd_cwnd)");
+	test_unsupported("assert (tcpi_snd_cwnd, 1)");
+	test_unsupported("assert tcpi_snd_cwnd == 1.0");
+	test_unsupported("assert tcpi_snd_cwnd in [10]");
+	test_unsupported("if tcpi_snd_cwnd:\n  assert 1");
+	test_unsupported("assert tcpi_snd_cwnd == 010");
+	test_unsupported("assert (tcpi_snd_cwnd == 10");
+	test_unsupported("assert tcpi_snd_cwnd == 10 \\\n and 1");
+	test_unsupported("assert 99999999999999999999 > 0");
+
+	return 0;
+}
@@ -0,0 +1,694 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of --compare; see compare.h.
+ */
+
+#include "compare.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "logging.h"
+
+/* Deepest nesting of JSON arrays and objects we take. */
+#define JSON_MAX_DEPTH	32
+
+/* We read back reports with a small parser of our own, building a tree
+ * of values, since a report is one short line and we only look at a
+ * few of its members.
+ */
+enum json_type_t {
+	JSON_NULL = 0,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT,
+};
+
+struct json {
+	enum json_type_t type;
+	double number;			/* for JSON_NUMBER and JSON_BOOL */
+	char *string;			/* for JSON_STRING */
+	char *key;			/* for members of an object */
+	struct json *items;		/* for JSON_ARRAY and JSON_OBJECT */
+	int num_items;
+};
+
+struct json_parser {
+	const char *p;			/* next character to parse */
+	char **error;
+};
+
+/* What we know about one metric of one script, or of one line of it.
+ * Entries with line 0 are about the script as a whole.
+ */
+struct compare_entry {
+	char *script;
+	int line;
+	char metric[32];		/* e.g. "kernel latency" */
+	struct compare_sample sample;
+};
+
+struct compare_set {
+	struct compare_entry *entries;
+	int num_entries;
+	int max_entries;
+	bool pooled;			/* sorted, with one entry per key? */
+};
+
+/* A significant change from one set to the other. */
+struct compare_change {
+	const struct compare_entry *baseline;
+	const struct compare_entry *candidate;
+	double p;
+};
+
+static void json_free(struct json *value)
+{
+	int i;
+
+	for (i = 0; i < value->num_items; i++)
+		json_free(&value->items[i]);
+	free(value->items);
+	free(value->string);
+	free(value->key);
+}
+
+static void skip_space(struct json_parser *parser)
+{
+	while (isspace((unsigned char)*parser->p))
+		parser->p++;
+}
+
+static int json_fail(struct json_parser *parser, const char *what)
+{
+	asprintf(parser->error, "bad JSON: %s at \"%.20s\"",
+		 what, parser->p);
+	return STATUS_ERR;
+}
+
+/* Parse the string at the opening quote. We never write non-ASCII
+ * characters as \u escapes, so we turn any we see into '?'.
+ */
+static int parse_json_string(struct json_parser *parser, char **string)
+{
+	const char *p = parser->p + 1;
+	char *out = malloc(strlen(p) + 1);
+	size_t len = 0;
+	unsigned int c;
+	int i;
+
+	while (*p != '"') {
+		if (*p == '\0') {
+			free(out);
+			return json_fail(parser, "unterminated string");
+		}
+		if (*p != '\\') {
+			out[len++] = *p++;
+			continue;
+		}
+		switch (*++p) {
+		case 'b':	out[len++] = '\b';	break;
+		case 'f':	out[len++] = '\f';	break;
+		case 'n':	out[len++] = '\n';	break;
+		case 'r':	out[len++] = '\r';	break;
+		case 't':	out[len++] = '\t';	break;
+		case 'u':
+			for (i = 1; i <= 4; i++) {
+				if (!isxdigit((unsigned char)p[i])) {
+					free(out);
+					return json_fail(parser,
+							 "bad \\u escape");
+				}
+			}
+			sscanf(p + 1, "%4x", &c);
+			out[len++] = c < 0x80 ? c : '?';
+			p += 4;
+			break;
+		case '\0':
+			free(out);
+			return json_fail(parser, "unterminated string");
+		default:	/* '"', '\\' or '/' */
+			out[len++] = *p;
+			break;
+		}
+		p++;
+	}
+	out[len] = '\0';
+	parser->p = p + 1;
+	*string = out;
+	return STATUS_OK;
+}
+
+static int parse_json_value(struct json_parser *parser, struct json *value,
+			    int depth);
+
+/* Parse the items of the array or object at its opening bracket. On
+ * failure, the items parsed so far are left in value to be freed.
+ */
+static int parse_json_items(struct json_parser *parser, struct json *value,
+			    int depth)
+{
+	bool is_object = *parser->p == '{';
+	char close = is_object ? '}' : ']';
+	int max_items = 0;
+
+	value->type = is_object ? JSON_OBJECT : JSON_ARRAY;
+	parser->p++;
+	skip_space(parser);
+	if (*parser->p == close) {
+		parser->p++;
+		return STATUS_OK;
+	}
+	for (;;) {
+		struct json item;
+
+		memset(&item, 0, sizeof(item));
+		if (is_object) {
+			skip_space(parser);
+			if (*parser->p != '"')
+				return json_fail(parser,
+						 "expected member name");
+			if (parse_json_string(parser, &item.key))
+				return STATUS_ERR;
+			skip_space(parser);
+			if (*parser->p != ':') {
+				free(item.key);
+				return json_fail(parser, "expected ':'");
+			}
+			parser->p++;
+		}
+		if (parse_json_value(parser, &item, depth + 1)) {
+			json_free(&item);
+			return STATUS_ERR;
+		}
+		if (value->num_items == max_items) {
+			max_items = max_items ? 2 * max_items : 8;
+			value->items = realloc(value->items,
+					       max_items * sizeof(item));
+		}
+		value->items[value->num_items++] = item;
+
+		skip_space(parser);
+		if (*parser->p == ',') {
+			parser->p++;
+			continue;
+		}
+		if (*parser->p == close) {
+			parser->p++;
+			return STATUS_OK;
+		}
+		return json_fail(parser, is_object ? "expected ',' or '}'" :
+				 "expected ',' or ']'");
+	}
+}
+
+/* Parse a value into the given zeroed one. On failure, whatever was
+ * parsed is left in value to be freed.
+ */
+static int parse_json_value(struct json_parser *parser, struct json *value,
+			    int depth)
+{
+	char *end;
+
+	skip_space(parser);
+	if (depth > JSON_MAX_DEPTH)
+		return json_fail(parser, "nested too deeply");
+	if (*parser->p == '"') {
+		value->type = JSON_STRING;
+		return parse_json_string(parser, &value->string);
+	}
+	if (*parser->p == '[' || *parser->p == '{')
+		return parse_json_items(parser, value, depth);
+	if (strncmp(parser->p, "true", 4) == 0) {
+		value->type = JSON_BOOL;
+		value->number = 1;
+		parser->p += 4;
+	} else if (strncmp(parser->p, "false", 5) == 0) {
+		value->type = JSON_BOOL;
+		parser->p += 5;
+	} else if (strncmp(parser->p, "null", 4) == 0) {
+		value->type = JSON_NULL;
+		parser->p += 4;
+	} else {
+		value->number = strtod(parser->p, &end);
+		if (end == parser->p)
+			return json_fail(parser, "expected a value");
+		value->type = JSON_NUMBER;
+		parser->p = end;
+	}
+	return STATUS_OK;
+}
+
+static const struct json *json_member(const struct json *object,
+				      const char *key)
+{
+	int i;
+
+	if (object == NULL || object->type != JSON_OBJECT)
+		return NULL;
+	for (i = 0; i < object->num_items; i++) {
+		if (strcmp(object->items[i].key, key) == 0)
+			return &object->items[i];
+	}
+	return NULL;
+}
+
+static bool json_number(const struct json *object, const char *key,
+			double *number)
+{
+	const struct json *member = json_member(object, key);
+
+	if (member == NULL || member->type != JSON_NUMBER)
+		return false;
+	*number = member->number;
+	return true;
+}
+
+/* Read a sample summarized by "count" and the given mean and standard
+ * deviation members. Reports from before we wrote those lack them.
+ */
+static bool json_sample(const struct json *object, const char *mean_key,
+			const char *stddev_key, struct compare_sample *sample)
+{
+	double count;
+
+	if (!json_number(object, "count", &count) || count < 1 ||
+	    !json_number(object, mean_key, &sample->mean) ||
+	    !json_number(object, stddev_key, &sample->stddev))
+		return false;
+	sample->count = count;
+	return true;
+}
+
+void compare_sample_pool(struct compare_sample *total,
+			 const struct compare_sample *more)
+{
+	u64 count = total->count + more->count;
+	double delta = more->mean - total->mean;
+	double squares;
+
+	if (more->count == 0)
+		return;
+	if (total->count == 0) {
+		*total = *more;
+		return;
+	}
+	/* Add up the sums of squared deviations from each mean, and the
+	 * deviation of each mean from the pooled one.
+	 */
+	squares = total->stddev * total->stddev * (total->count - 1) +
+		more->stddev * more->stddev * (more->count - 1) +
+		delta * delta * total->count * more->count / count;
+	total->mean += delta * more->count / count;
+	total->stddev = sqrt(squares / (count - 1));
+	total->count = count;
+}
+
+/* Keep the terms of the continued fraction away from zero. */
+static double not_zero(double value)
+{
+	return fabs(value) < 1e-300 ? 1e-300 : value;
+}
+
+/* The continued fraction for the incomplete beta function, evaluated
+ * by the modified Lentz method.
+ */
+static double beta_fraction(double a, double b, double x)
+{
+	double c = 1, d = 1 / not_zero(1 - (a + b) * x / (a + 1));
+	double fraction = d, term;
+	int m;
+
+	for (m = 1; m <= 300; m++) {
+		term = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+		d = 1 / not_zero(1 + term * d);
+		c = not_zero(1 + term / c);
+		fraction *= d * c;
+
+		term = -(a + m) * (a + b + m) * x /
+			((a + 2 * m) * (a + 2 * m + 1));
+		d = 1 / not_zero(1 + term * d);
+		c = not_zero(1 + term / c);
+		fraction *= d * c;
+		if (fabs(d * c - 1) < 1e-12)
+			break;
+	}
+	return fraction;
+}
+
+/* The regularized incomplete beta function I_x(a, b). The fraction
+ * converges quickly only below (a + 1) / (a + b + 2), so above that we
+ * use I_x(a, b) = 1 - I_(1-x)(b, a).
+ */
+static double incomplete_beta(double a, double b, double x)
+{
+	double front;
+
+	if (x <= 0)
+		return 0;
+	if (x >= 1)
+		return 1;
+	front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+		    a * log(x) + b * log1p(-x));
+	if (x < (a + 1) / (a + b + 2))
+		return front * beta_fraction(a, b, x) / a;
+	return 1 - front * beta_fraction(b, a, 1 - x) / b;
+}
+
+double compare_welch_p(const struct compare_sample *a,
+		       const struct compare_sample *b)
+{
+	double var_a, var_b, t, df;
+
+	if (a->count < 2 || b->count < 2)
+		return -1;
+	var_a = a->stddev * a->stddev / a->count;
+	var_b = b->stddev * b->stddev / b->count;
+	if (var_a + var_b == 0)
+		return a->mean == b->mean ? 1 : 0;
+	t = (b->mean - a->mean) / sqrt(var_a + var_b);
+	df = (var_a + var_b) * (var_a + var_b) /
+		(var_a * var_a / (a->count - 1) +
+		 var_b * var_b / (b->count - 1));
+	/* P(|T| > |t|) for Student's t with df degrees of freedom. */
+	return incomplete_beta(df / 2, 0.5, df / (df + t * t));
+}
+
+struct compare_set *compare_set_new(void)
+{
+	return calloc(1, sizeof(struct compare_set));
+}
+
+void compare_set_free(struct compare_set *set)
+{
+	int i;
+
+	if (set == NULL)
+		return;
+	for (i = 0; i < set->num_entries; i++)
+		free(set->entries[i].script);
+	free(set->entries);
+	free(set);
+}
+
+static void add_entry(struct compare_set *set, const char *script,
+		      int line, const char *metric,
+		      const struct compare_sample *sample)
+{
+	struct compare_entry *entry;
+
+	if (set->num_entries == set->max_entries) {
+		set->max_entries = set->max_entries ?
+			2 * set->max_entries : 64;
+		set->entries = realloc(set->entries, set->max_entries *
+				       sizeof(set->entries[0]));
+	}
+	entry = &set->entries[set->num_entries++];
+	entry->script = strdup(script);
+	entry->line = line;
+	snprintf(entry->metric, sizeof(entry->metric), "%s", metric);
+	entry->sample = *sample;
+	set->pooled = false;
+}
+
+/* Add an entry with the given metric for each line in the given array
+ * of per-line stats, and return all their values pooled.
+ */
+static void add_lines(struct compare_set *set, const char *script,
+		      const struct json *lines, const char *metric,
+		      const char *mean_key, const char *stddev_key,
+		      struct compare_sample *total)
+{
+	struct compare_sample sample;
+	double line;
+	int i;
+
+	memset(total, 0, sizeof(*total));
+	if (lines == NULL || lines->type != JSON_ARRAY)
+		return;
+	for (i = 0; i < lines->num_items; i++) {
+		if (!json_number(&lines->items[i], "line", &line) ||
+		    !json_sample(&lines->items[i], mean_key, stddev_key,
+				 &sample))
+			continue;
+		add_entry(set, script, line, metric, &sample);
+		compare_sample_pool(total, &sample);
+	}
+}
+
+int compare_set_add_report(struct compare_set *set, const char *json,
+			   char **error)
+{
+	struct json_parser parser = { .p = json, .error = error };
+	const struct json *script, *events, *passed;
+	struct compare_sample sample, total;
+	struct json report;
+	char metric[64];
+	int i;
+
+	memset(&report, 0, sizeof(report));
+	if (parse_json_value(&parser, &report, 0)) {
+		json_free(&report);
+		return STATUS_ERR;
+	}
+	skip_space(&parser);
+	if (*parser.p != '\0') {
+		json_free(&report);
+		return json_fail(&parser, "expected end of report");
+	}
+	script = json_member(&report, "script");
+	if (script == NULL || script->type != JSON_STRING) {
+		json_free(&report);
+		asprintf(error, "report has no script");
+		return STATUS_ERR;
+	}
+
+	/* The timing error of each kind of event. */
+	events = json_member(&report, "events");
+	for (i = 0; events != NULL && events->type == JSON_OBJECT &&
+		     i < events->num_items; i++) {
+		snprintf(metric, sizeof(metric), "%s timing error",
+			 events->items[i].key);
+		if (json_sample(&events->items[i], "mean_abs_usecs",
+				"stddev_abs_usecs", &sample))
+			add_entry(set, script->string, 0, metric, &sample);
+	}
+
+	/* A failed run stops early, so only a pass says how long the
+	 * script takes.
+	 */
+	passed = json_member(&report, "passed");
+	if (passed != NULL && passed->type == JSON_BOOL && passed->number &&
+	    json_number(&report, "duration_usecs", &sample.mean)) {
+		sample.count = 1;
+		sample.stddev = 0;
+		add_entry(set, script->string, 0, "duration", &sample);
+	}
+
+	add_lines(set, script->string, json_member(&report, "lines"),
+		  "timing error", "mean_abs_usecs", "stddev_abs_usecs",
+		  &total);
+	add_lines(set, script->string, json_member(&report, "kernel_latency"),
+		  "kernel latency", "mean_usecs", "stddev_usecs", &total);
+	if (total.count > 0)
+		add_entry(set, script->string, 0, "kernel latency", &total);
+
+	json_free(&report);
+	return STATUS_OK;
+}
+
+int compare_set_read(struct compare_set *set, const char *path,
+		     char **error)
+{
+	FILE *in = fopen(path, "r");
+	char *line = NULL, *line_error = NULL;
+	int line_number = 0, result = STATUS_OK;
+	size_t size = 0;
+
+	if (in == NULL) {
+		asprintf(error, "cannot open %s: %s", path, strerror(errno));
+		return STATUS_ERR;
+	}
+	while (getline(&line, &size, in) > 0) {
+		line_number++;
+		if (line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+		if (compare_set_add_report(set, line, &line_error)) {
+			asprintf(error, "%s:%d: %s", path, line_number,
+				 line_error);
+			free(line_error);
+			result = STATUS_ERR;
+			break;
+		}
+	}
+	free(line);
+	fclose(in);
+	return result;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	const struct compare_entry *x = a, *y = b;
+	int diff = strcmp(x->script, y->script);
+
+	if (diff != 0)
+		return diff;
+	if (x->line != y->line)
+		return x->line < y->line ? -1 : 1;
+	return strcmp(x->metric, y->metric);
+}
+
+/* Sort the entries, and pool those from repeated runs of a script. */
+static void pool_entries(struct compare_set *set)
+{
+	int i, kept = 0;
+
+	if (set->pooled)
+		return;
+	qsort(set->entries, set->num_entries, sizeof(set->entries[0]),
+	      compare_entries);
+	for (i = 0; i < set->num_entries; i++) {
+		if (kept > 0 && compare_entries(&set->entries[kept - 1],
+						&set->entries[i]) == 0) {
+			compare_sample_pool(&set->entries[kept - 1].sample,
+					    &set->entries[i].sample);
+			free(set->entries[i].script);
+		} else {
+			set->entries[kept++] = set->entries[i];
+		}
+	}
+	set->num_entries = kept;
+	set->pooled = true;
+}
+
+static double slowdown_usecs(const struct compare_change *change)
+{
+	return change->candidate->sample.mean - change->baseline->sample.mean;
+}
+
+/* Biggest slowdown first. */
+static int compare_slowdowns(const void *a, const void *b)
+{
+	double x = slowdown_usecs(a), y = slowdown_usecs(b);
+
+	return (x < y) - (x > y);
+}
+
+static void print_change(const struct compare_change *change, FILE *out)
+{
+	const struct compare_entry *a = change->baseline;
+	const struct compare_entry *b = change->candidate;
+	double slowdown = slowdown_usecs(change);
+
+	fprintf(out, "  %+10.1f usecs ", slowdown);
+	if (a->sample.mean > 0)
+		fprintf(out, "%+8.1f%%", 100 * slowdown / a->sample.mean);
+	else
+		fprintf(out, "%9s", "");
+	fprintf(out, "  p=%.1e  %s", change->p, a->script);
+	if (a->line > 0)
+		fprintf(out, ":%d", a->line);
+	fprintf(out, " %s (%.1f -> %.1f usecs, n=%llu/%llu)\n",
+		a->metric, a->sample.mean, b->sample.mean,
+		a->sample.count, b->sample.count);
+}
+
+int compare_sets(struct compare_set *baseline,
+		 struct compare_set *candidate, double alpha, FILE *out)
+{
+	struct compare_change *regressions;
+	int num_regressions = 0, improvements = 0, unchanged = 0;
+	int not_compared = 0, i = 0, j = 0, order;
+	const struct compare_entry *a, *b;
+	double p;
+
+	pool_entries(baseline);
+	pool_entries(candidate);
+	regressions = calloc(candidate->num_entries + 1,
+			     sizeof(regressions[0]));
+
+	/* Walk both sorted sets together, matching up their entries. */
+	while (i < baseline->num_entries || j < candidate->num_entries) {
+		a = i < baseline->num_entries ? &baseline->entries[i] : NULL;
+		b = j < candidate->num_entries ? &candidate->entries[j] : NULL;
+		order = a == NULL ? 1 : b == NULL ? -1 :
+			compare_entries(a, b);
+		if (order != 0) {
+			not_compared++;
+			if (order < 0)
+				i++;
+			else
+				j++;
+			continue;
+		}
+		i++;
+		j++;
+
+		p = compare_welch_p(&a->sample, &b->sample);
+		if (p < 0) {
+			not_compared++;
+		} else if (p >= alpha || b->sample.mean == a->sample.mean) {
+			unchanged++;
+		} else if (b->sample.mean < a->sample.mean) {
+			improvements++;
+		} else {
+			regressions[num_regressions].baseline = a;
+			regressions[num_regressions].candidate = b;
+			regressions[num_regressions].p = p;
+			num_regressions++;
+		}
+	}
+
+	qsort(regressions, num_regressions, sizeof(regressions[0]),
+	      compare_slowdowns);
+	if (num_regressions > 0)
+		fprintf(out, "regressions at p < %g, worst first:\n", alpha);
+	for (i = 0; i < num_regressions; i++)
+		print_change(&regressions[i], out);
+	fprintf(out, "compare: %d regressions, %d improvements, "
+		"%d unchanged, %d not compared\n", num_regressions,
+		improvements, unchanged, not_compared);
+	free(regressions);
+	return num_regressions;
+}
+
+int run_compare(const struct config *config, char **paths)
+{
+	struct compare_set *baseline, *candidate;
+	char *error = NULL;
+	int regressions;
+
+	if (paths[0] == NULL || paths[1] == NULL || paths[2] != NULL)
+		die("--compare takes a baseline and a candidate report\n");
+
+	baseline = compare_set_new();
+	candidate = compare_set_new();
+	if (compare_set_read(baseline, paths[0], &error) ||
+	    compare_set_read(candidate, paths[1], &error))
+		die("--compare: %s\n", error);
+	regressions = compare_sets(baseline, candidate,
+				   config->compare_alpha, stdout);
+	compare_set_free(baseline);
+	compare_set_free(candidate);
+	return regressions > 0 ? STATUS_ERR : STATUS_OK;
+}
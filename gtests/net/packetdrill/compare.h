@@ -0,0 +1,96 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * For --compare, what changed between two sets of --timing_report
+ * results, say from running a suite on a baseline kernel and on a
+ * candidate kernel:
+ *
+ *   packetdrill --compare baseline.json candidate.json
+ *
+ * Each report line is one run of one script. For each script we pool
+ * all its runs in a set and compare, with Welch's t-test, the mean
+ * magnitude of the timing error of each kind of event, of each script
+ * line, the kernel's latency (from --kernel_latency) at each line and
+ * over the whole script, and how long the script took, which stands
+ * in for its throughput. Changes significant at --compare_alpha are
+ * listed as regressions, worst first, or counted as improvements.
+ * A script's duration varies only between runs, so comparing it
+ * needs a few runs of the script in each set.
+ */
+
+#ifndef __COMPARE_H__
+#define __COMPARE_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+struct config;
+
+/* A summary of a sample of values: enough to pool it with others and
+ * test it against another.
+ */
+struct compare_sample {
+	u64 count;
+	double mean;
+	double stddev;			/* sample standard deviation */
+};
+
+/* The results read from one set of reports. */
+struct compare_set;
+
+/* Pool the values in more into total. */
+extern void compare_sample_pool(struct compare_sample *total,
+				const struct compare_sample *more);
+
+/* Return the two-sided p-value of Welch's t-test of whether the two
+ * samples have the same mean, or -1 if either has fewer than two
+ * values.
+ */
+extern double compare_welch_p(const struct compare_sample *a,
+			      const struct compare_sample *b);
+
+extern struct compare_set *compare_set_new(void);
+extern void compare_set_free(struct compare_set *set);
+
+/* Add the results of the report on one line of a --timing_report file.
+ * Returns STATUS_OK on success; on failure returns STATUS_ERR and sets
+ * error message.
+ */
+extern int compare_set_add_report(struct compare_set *set,
+				  const char *json, char **error);
+
+/* Add every report in the given --timing_report file. Returns STATUS_OK
+ * on success; on failure returns STATUS_ERR and sets error message.
+ */
+extern int compare_set_read(struct compare_set *set, const char *path,
+			    char **error);
+
+/* Compare the candidate set to the baseline, print the regressions
+ * significant at the given level, worst first, and a summary, and
+ * return the number of regressions.
+ */
+extern int compare_sets(struct compare_set *baseline,
+			struct compare_set *candidate, double alpha,
+			FILE *out);
+
+/* Run --compare on the two report files named in paths. Returns
+ * STATUS_OK if there are no regressions, or STATUS_ERR if there are.
+ */
+extern int run_compare(const struct config *config, char **paths);
+
+#endif /* __COMPARE_H__ */
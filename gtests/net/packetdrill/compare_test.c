@@ -0,0 +1,153 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for compare.c: pooling and testing samples, and finding
+ * and ranking the regressions between two sets of reports.
+ */
+
+#include "compare.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void test_pool(void)
+{
+	/* {0, 2} and {4, 6} pool to {0, 2, 4, 6}. */
+	struct compare_sample total = { 2, 1, sqrt(2) };
+	struct compare_sample more = { 2, 5, sqrt(2) };
+	struct compare_sample empty = { 0, 0, 0 };
+
+	compare_sample_pool(&total, &more);
+	assert(total.count == 4);
+	assert(total.mean == 3);
+	assert(fabs(total.stddev - sqrt(20.0 / 3)) < 1e-9);
+
+	compare_sample_pool(&total, &empty);
+	assert(total.count == 4);
+	compare_sample_pool(&empty, &total);
+	assert(empty.count == 4 && empty.mean == 3);
+}
+
+static void test_welch(void)
+{
+	struct compare_sample a = { 2, 0, 1 }, b = { 2, 1, 1 };
+	struct compare_sample one = { 1, 5, 0 };
+	double p;
+
+	/* t = 1 with 2 degrees of freedom: p = 1 - 1 / sqrt(3). */
+	p = compare_welch_p(&a, &b);
+	assert(fabs(p - (1 - 1 / sqrt(3))) < 1e-9);
+	assert(fabs(compare_welch_p(&b, &a) - p) < 1e-9);
+
+	/* A large sample makes a small change significant. */
+	a = (struct compare_sample) { 1000, 100, 10 };
+	b = (struct compare_sample) { 1000, 103, 10 };
+	assert(compare_welch_p(&a, &b) < 1e-9);
+	b.mean = 100.1;
+	assert(compare_welch_p(&a, &b) > 0.5);
+	b.mean = 100;
+	assert(compare_welch_p(&a, &b) == 1);
+
+	/* No spread at all. */
+	a.stddev = b.stddev = 0;
+	assert(compare_welch_p(&a, &b) == 1);
+	b.mean = 101;
+	assert(compare_welch_p(&a, &b) == 0);
+
+	assert(compare_welch_p(&a, &one) == -1);
+}
+
+static void add_report(struct compare_set *set, const char *script,
+		       double line_12_latency)
+{
+	char *json = NULL, *error = NULL;
+
+	asprintf(&json,
+		 "{\"script\": \"%s\", \"passed\": true, "
+		 "\"tolerance_usecs\": 4000, \"events\": {\"inbound_packet\": "
+		 "{\"count\": 100, \"over_tolerance\": 0, "
+		 "\"mean_abs_usecs\": 10.0, \"stddev_abs_usecs\": 2.0, "
+		 "\"buckets\": [[10, 100]]}}, "
+		 "\"lines\": [{\"line\": 12, \"count\": 100, "
+		 "\"mean_abs_usecs\": 10.0, \"stddev_abs_usecs\": 2.0}], "
+		 "\"duration_usecs\": 1000000, \"error\": \"a \\\"b\\\"\\n\", "
+		 "\"kernel_latency\": [{\"line\": 12, \"count\": 100, "
+		 "\"mean_usecs\": %.1f, \"stddev_usecs\": 3.0}, "
+		 "{\"line\": 14, \"count\": 100, "
+		 "\"mean_usecs\": 20.0, \"stddev_usecs\": 3.0}]}\n",
+		 script, line_12_latency);
+	assert(compare_set_add_report(set, json, &error) == STATUS_OK);
+	free(json);
+}
+
+static void test_sets(void)
+{
+	struct compare_set *baseline = compare_set_new();
+	struct compare_set *candidate = compare_set_new();
+	char *output = NULL, *error = NULL, *worst, *next;
+	size_t bytes = 0;
+	FILE *out;
+
+	/* Two runs in each set; the candidate kernel is slower to answer
+	 * at line 12, and so over the whole script too, but by less.
+	 */
+	add_report(baseline, "tcp/a.pkt", 20);
+	add_report(baseline, "tcp/a.pkt", 20);
+	add_report(candidate, "tcp/a.pkt", 40);
+	add_report(candidate, "tcp/a.pkt", 40);
+	add_report(candidate, "tcp/b.pkt", 20);
+
+	out = open_memstream(&output, &bytes);
+	assert(compare_sets(baseline, candidate, 0.01, out) == 2);
+	fclose(out);
+	worst = strstr(output, "tcp/a.pkt:12 kernel latency "
+		       "(20.0 -> 40.0 usecs, n=200/200)");
+	next = strstr(output, "tcp/a.pkt kernel latency "
+		      "(20.0 -> 30.0 usecs, n=400/400)");
+	assert(worst != NULL && next != NULL && worst < next);
+	assert(strstr(output, "+20.0 usecs   +100.0%") != NULL);
+	/* b.pkt is not in the baseline, so none of its six entries are
+	 * compared.
+	 */
+	assert(strstr(output, "compare: 2 regressions, 0 improvements, "
+		      "4 unchanged, 6 not compared\n") != NULL);
+	free(output);
+
+	assert(compare_set_add_report(baseline, "{\"script\": ",
+				      &error) == STATUS_ERR);
+	free(error);
+	assert(compare_set_add_report(baseline, "{\"passed\": true}",
+				      &error) == STATUS_ERR);
+	free(error);
+	assert(compare_set_add_report(baseline, "[1, 2] 3",
+				      &error) == STATUS_ERR);
+	free(error);
+
+	compare_set_free(baseline);
+	compare_set_free(candidate);
+}
+
+int main(void)
+{
+	test_pool();
+	test_welch();
+	test_sets();
+	return 0;
+}
@@ -22,6 +22,8 @@
  * Helper functions for configuration information for a test run.
  */
 
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -29,7 +31,12 @@
 
 #include "config.h"
 #include "logging.h"
+#include "cpu_affinity.h"
 #include "ip_prefix.h"
+#include "placement.h"
+#include "sha1.h"
+#include "sha256.h"
+#include "utils.h"
 
 /* For the sake of clarity, we require long option names, e.g. --foo,
  * for all options except -v.
@@ -46,7 +53,12 @@ enum option_codes {
 	OPT_GATEWAY_IP,
 	OPT_NETMASK_IP,
 	OPT_SPEED,
+	OPT_SERIALIZE_INBOUND,
+	OPT_ACK_AGGREGATION,
 	OPT_MTU,
+	OPT_VNET_HDR,
+	OPT_VERIFY_CHECKSUMS,
+	OPT_TUN_QUEUES,
 	OPT_INIT_SCRIPTS,
 	OPT_TOLERANCE_USECS,
 	OPT_WIRE_CLIENT,
@@ -55,9 +67,84 @@ enum option_codes {
 	OPT_WIRE_SERVER_PORT,
 	OPT_WIRE_CLIENT_DEV,
 	OPT_WIRE_SERVER_DEV,
+	OPT_WIRE_SERVER_SHARED_SNIFFER,
+	OPT_WIRE_SERVER_XDP_QUEUE,
+	OPT_WIRE_PIPELINE,
+	OPT_WIRE_CLOCK_SYNC,
+	OPT_WIRE_COMPRESS,
+	OPT_HW_TIMESTAMPS,
+	OPT_DAEMON,
+	OPT_DAEMON_CLIENT,
+	OPT_DAEMON_SOCKET,
+	OPT_DAEMON_PORT,
+	OPT_DAEMON_WORKERS,
 	OPT_TCP_TS_TICK_USECS,
 	OPT_NON_FATAL,
+	OPT_SHA1_BACKEND,
+	OPT_SHA256_BACKEND,
+	OPT_MPTCP_VERSION,
+	OPT_SCHEDULER,
+	OPT_SCHEDULER_SLACK_USECS,
+	OPT_CLOCK,
+	OPT_JOBS,
+	OPT_FORK_SERVER,
 	OPT_DRY_RUN,
+	OPT_STREAM_WINDOW,
+	OPT_SCRIPT_CACHE,
+	OPT_RESULTS_DB,
+	OPT_JUNIT_REPORT,
+	OPT_SEED,
+	OPT_LOG_LEVEL,
+	OPT_LOG_ASYNC,
+	OPT_FLIGHT_RECORDER,
+	OPT_FLIGHT_RECORDER_PACKETS,
+	OPT_TIMING_REPORT,
+	OPT_PERF_COUNTERS,
+	OPT_KERNEL_LATENCY,
+	OPT_KERNEL_LATENCY_LIMITS,
+	OPT_KERNEL_TIMELINE,
+	OPT_LINE_PROFILE,
+	OPT_TCP_INFO_LOG,
+	OPT_TCP_INFO_INTERVAL_USECS,
+	OPT_QUEUE_STATS,
+	OPT_DSN_COVERAGE,
+	OPT_SELF_STALL,
+	OPT_ALLOC_STATS,
+	OPT_COMPARE,
+	OPT_COMPARE_ALPHA,
+	OPT_MAIN_CPUS,
+	OPT_SYSCALL_CPUS,
+	OPT_HELPER_CPUS,
+	OPT_RPS_CPUS,
+	OPT_REQUIRE_ISOLATED_CPUS,
+	OPT_MLOCK,
+	OPT_MLOCK_BUDGET_BYTES,
+	OPT_HUGEPAGES,
+	OPT_REPLAY_PCAP,
+	OPT_REPLAY_SPEED,
+	OPT_REPLAY_OUTBOUND,
+	OPT_REPLAY_KERNEL_IP,
+	OPT_FUZZ,
+	OPT_FUZZ_BATCH,
+	OPT_FUZZ_OUTPUT,
+	OPT_FUZZ_CORPUS,
+	OPT_STRESS,
+	OPT_STRESS_STAGGER,
+	OPT_CONCURRENT,
+	OPT_NUMA_SPREAD,
+	OPT_AVOID_IRQ_CPUS,
+	OPT_WORKER_CGROUP,
+	OPT_WORKER_CGROUP_LIMITS,
+	OPT_PATH,
+	OPT_TIME_SCALE,
+	OPT_TIME_SCALE_MIN_GAP,
+	OPT_RESET_KERNEL_STATE,
+	OPT_SKIP_TEARDOWN,
+	OPT_MIB_PER_EVENT,
+	OPT_PAYLOAD_PATTERN,
+	OPT_ADDRESS_POOL,
+	OPT_TOLERANCES,
+	OPT_TOLERANCE_FILE,
 	OPT_VERBOSE = 'v',	/* our only single-letter option */
 };
 
@@ -74,18 +161,109 @@ struct option options[] = {
 	{ "gateway_ip",		.has_arg = true,  NULL, OPT_GATEWAY_IP },
 	{ "netmask_ip",		.has_arg = true,  NULL, OPT_NETMASK_IP },
 	{ "speed",		.has_arg = true,  NULL, OPT_SPEED },
+	{ "serialize_inbound",	.has_arg = false, NULL, OPT_SERIALIZE_INBOUND },
+	{ "ack_aggregation",	.has_arg = true,  NULL, OPT_ACK_AGGREGATION },
 	{ "mtu",		.has_arg = true,  NULL, OPT_MTU },
+	{ "vnet_hdr",		.has_arg = false, NULL, OPT_VNET_HDR },
+	{ "verify_checksums",	.has_arg = true,  NULL, OPT_VERIFY_CHECKSUMS },
+	{ "tun_queues",		.has_arg = true,  NULL, OPT_TUN_QUEUES },
 	{ "init_scripts",	.has_arg = true,  NULL, OPT_INIT_SCRIPTS },
 	{ "tolerance_usecs",	.has_arg = true,  NULL, OPT_TOLERANCE_USECS },
+	{ "tolerances",		.has_arg = true,  NULL, OPT_TOLERANCES },
+	{ "tolerance_file",	.has_arg = true,  NULL, OPT_TOLERANCE_FILE },
 	{ "wire_client",	.has_arg = false, NULL, OPT_WIRE_CLIENT },
 	{ "wire_server",	.has_arg = false, NULL, OPT_WIRE_SERVER },
 	{ "wire_server_ip",	.has_arg = true,  NULL, OPT_WIRE_SERVER_IP },
 	{ "wire_server_port",	.has_arg = true,  NULL, OPT_WIRE_SERVER_PORT },
 	{ "wire_client_dev",	.has_arg = true,  NULL, OPT_WIRE_CLIENT_DEV },
 	{ "wire_server_dev",	.has_arg = true,  NULL, OPT_WIRE_SERVER_DEV },
+	{ "wire_server_shared_sniffer", .has_arg = false, NULL,
+	  OPT_WIRE_SERVER_SHARED_SNIFFER },
+	{ "wire_server_xdp_queue", .has_arg = true, NULL,
+	  OPT_WIRE_SERVER_XDP_QUEUE },
+	{ "wire_pipeline",	.has_arg = false, NULL, OPT_WIRE_PIPELINE },
+	{ "wire_clock_sync",	.has_arg = false, NULL, OPT_WIRE_CLOCK_SYNC },
+	{ "wire_compress",	.has_arg = false, NULL, OPT_WIRE_COMPRESS },
+	{ "hw_timestamps",	.has_arg = false, NULL, OPT_HW_TIMESTAMPS },
+	{ "daemon",		.has_arg = false, NULL, OPT_DAEMON },
+	{ "daemon_client",	.has_arg = false, NULL, OPT_DAEMON_CLIENT },
+	{ "daemon_socket",	.has_arg = true,  NULL, OPT_DAEMON_SOCKET },
+	{ "daemon_port",	.has_arg = true,  NULL, OPT_DAEMON_PORT },
+	{ "daemon_workers",	.has_arg = true,  NULL, OPT_DAEMON_WORKERS },
 	{ "tcp_ts_tick_usecs",	.has_arg = true,  NULL, OPT_TCP_TS_TICK_USECS },
 	{ "non_fatal",		.has_arg = true,  NULL, OPT_NON_FATAL },
+	{ "sha1_backend",	.has_arg = true,  NULL, OPT_SHA1_BACKEND },
+	{ "sha256_backend",	.has_arg = true,  NULL, OPT_SHA256_BACKEND },
+	{ "mptcp_version",	.has_arg = true,  NULL, OPT_MPTCP_VERSION },
+	{ "scheduler",		.has_arg = true,  NULL, OPT_SCHEDULER },
+	{ "scheduler_slack_usecs", .has_arg = true, NULL,
+	  OPT_SCHEDULER_SLACK_USECS },
+	{ "clock",		.has_arg = true,  NULL, OPT_CLOCK },
+	{ "jobs",		.has_arg = true,  NULL, OPT_JOBS },
+	{ "fork_server",	.has_arg = false, NULL, OPT_FORK_SERVER },
 	{ "dry_run",		.has_arg = false, NULL, OPT_DRY_RUN },
+	{ "stream_window",	.has_arg = true,  NULL, OPT_STREAM_WINDOW },
+	{ "script_cache",	.has_arg = true,  NULL, OPT_SCRIPT_CACHE },
+	{ "results_db",		.has_arg = true,  NULL, OPT_RESULTS_DB },
+	{ "junit_report",	.has_arg = true,  NULL, OPT_JUNIT_REPORT },
+	{ "seed",		.has_arg = true,  NULL, OPT_SEED },
+	{ "log_level",		.has_arg = true,  NULL, OPT_LOG_LEVEL },
+	{ "log_async",		.has_arg = false, NULL, OPT_LOG_ASYNC },
+	{ "flight_recorder",	.has_arg = true,  NULL, OPT_FLIGHT_RECORDER },
+	{ "flight_recorder_packets", .has_arg = true, NULL,
+	  OPT_FLIGHT_RECORDER_PACKETS },
+	{ "timing_report",	.has_arg = true,  NULL, OPT_TIMING_REPORT },
+	{ "perf_counters",	.has_arg = false, NULL, OPT_PERF_COUNTERS },
+	{ "kernel_latency",	.has_arg = false, NULL, OPT_KERNEL_LATENCY },
+	{ "kernel_latency_limits", .has_arg = true, NULL,
+	  OPT_KERNEL_LATENCY_LIMITS },
+	{ "kernel_timeline",	.has_arg = true,  NULL, OPT_KERNEL_TIMELINE },
+	{ "line_profile",	.has_arg = true,  NULL, OPT_LINE_PROFILE },
+	{ "tcp_info_log",	.has_arg = true,  NULL, OPT_TCP_INFO_LOG },
+	{ "tcp_info_interval_usecs", .has_arg = true, NULL,
+	  OPT_TCP_INFO_INTERVAL_USECS },
+	{ "queue_stats",	.has_arg = true,  NULL, OPT_QUEUE_STATS },
+	{ "dsn_coverage",	.has_arg = true,  NULL, OPT_DSN_COVERAGE },
+	{ "self_stall",		.has_arg = false, NULL, OPT_SELF_STALL },
+	{ "alloc_stats",	.has_arg = false, NULL, OPT_ALLOC_STATS },
+	{ "compare",		.has_arg = false, NULL, OPT_COMPARE },
+	{ "compare_alpha",	.has_arg = true,  NULL, OPT_COMPARE_ALPHA },
+	{ "main_cpus",		.has_arg = true,  NULL, OPT_MAIN_CPUS },
+	{ "syscall_cpus",	.has_arg = true,  NULL, OPT_SYSCALL_CPUS },
+	{ "helper_cpus",	.has_arg = true,  NULL, OPT_HELPER_CPUS },
+	{ "rps_cpus",		.has_arg = true,  NULL, OPT_RPS_CPUS },
+	{ "require_isolated_cpus", .has_arg = false, NULL,
+	  OPT_REQUIRE_ISOLATED_CPUS },
+	{ "mlock",		.has_arg = true,  NULL, OPT_MLOCK },
+	{ "mlock_budget_bytes",	.has_arg = true,  NULL,
+	  OPT_MLOCK_BUDGET_BYTES },
+	{ "hugepages",		.has_arg = true,  NULL, OPT_HUGEPAGES },
+	{ "replay_pcap",	.has_arg = true,  NULL, OPT_REPLAY_PCAP },
+	{ "replay_speed",	.has_arg = true,  NULL, OPT_REPLAY_SPEED },
+	{ "replay_outbound",	.has_arg = true,  NULL, OPT_REPLAY_OUTBOUND },
+	{ "replay_kernel_ip",	.has_arg = true,  NULL, OPT_REPLAY_KERNEL_IP },
+	{ "fuzz",		.has_arg = true,  NULL, OPT_FUZZ },
+	{ "fuzz_batch",		.has_arg = true,  NULL, OPT_FUZZ_BATCH },
+	{ "fuzz_output",	.has_arg = true,  NULL, OPT_FUZZ_OUTPUT },
+	{ "fuzz_corpus",	.has_arg = true,  NULL, OPT_FUZZ_CORPUS },
+	{ "stress",		.has_arg = true,  NULL, OPT_STRESS },
+	{ "stress_stagger",	.has_arg = true,  NULL, OPT_STRESS_STAGGER },
+	{ "concurrent",		.has_arg = true,  NULL, OPT_CONCURRENT },
+	{ "numa_spread",	.has_arg = false, NULL, OPT_NUMA_SPREAD },
+	{ "avoid_irq_cpus",	.has_arg = true,  NULL, OPT_AVOID_IRQ_CPUS },
+	{ "worker_cgroup",	.has_arg = true,  NULL, OPT_WORKER_CGROUP },
+	{ "worker_cgroup_limits", .has_arg = true, NULL,
+	  OPT_WORKER_CGROUP_LIMITS },
+	{ "path",		.has_arg = true,  NULL, OPT_PATH },
+	{ "time_scale",		.has_arg = true,  NULL, OPT_TIME_SCALE },
+	{ "time_scale_min_gap",	.has_arg = true,  NULL,
+	  OPT_TIME_SCALE_MIN_GAP },
+	{ "reset_kernel_state",	.has_arg = false, NULL,
+	  OPT_RESET_KERNEL_STATE },
+	{ "skip_teardown",	.has_arg = false, NULL, OPT_SKIP_TEARDOWN },
+	{ "mib_per_event",	.has_arg = false, NULL, OPT_MIB_PER_EVENT },
+	{ "payload_pattern",	.has_arg = false, NULL, OPT_PAYLOAD_PATTERN },
+	{ "address_pool",	.has_arg = true,  NULL, OPT_ADDRESS_POOL },
 	{ "verbose",		.has_arg = false, NULL, OPT_VERBOSE },
 	{ NULL },
 };
@@ -105,17 +283,99 @@ void show_usage(void)
 		"\t[--netmask_ip=netmask_ip]\n"
 		"\t[--init_scripts=<comma separated filenames>]\n"
 		"\t[--speed=<speed in Mbps>]\n"
+		"\t[--serialize_inbound]\n"
+		"\t[--ack_aggregation=stretch:<count>|burst:<count>]\n"
 		"\t[--mtu=<MTU in bytes>]\n"
+		"\t[--vnet_hdr]\n"
+		"\t[--verify_checksums=none|full|sampled:<count>|offload]\n"
+		"\t[--tun_queues=<number of tun device queues>]\n"
 		"\t[--tolerance_usecs=tolerance_usecs]\n"
+		"\t[--tolerances=<event kind>=<usecs>,...]\n"
+		"\t[--tolerance_file=<file from script_bench --calibrate>]\n"
 		"\t[--tcp_ts_tick_usecs=<microseconds per TCP TS val tick>]\n"
 		"\t[--non_fatal=<comma separated types: packet,syscall>]\n"
+		"\t[--sha1_backend=[auto,generic,sha-ni,armv8]]\n"
+		"\t[--sha256_backend=[auto,generic,sha-ni,armv8]]\n"
+		"\t[--mptcp_version=[0,1]]\n"
+		"\t[--scheduler=[spin,timer,epoll]]\n"
+		"\t[--scheduler_slack_usecs=<usecs to spin before events>]\n"
+		"\t[--clock=[realtime,monotonic_raw,tsc]]\n"
 		"\t[--wire_client]\n"
 		"\t[--wire_server]\n"
 		"\t[--wire_server_ip=<server_ipv4_address>]\n"
 		"\t[--wire_server_port=<server_port>]\n"
 		"\t[--wire_client_dev=<eth_dev_name>]\n"
 		"\t[--wire_server_dev=<eth_dev_name>]\n"
+		"\t[--wire_server_shared_sniffer]\n"
+		"\t[--wire_server_xdp_queue=<rx_queue>]\n"
+		"\t[--wire_pipeline]\n"
+		"\t[--wire_clock_sync]\n"
+		"\t[--wire_compress]\n"
+		"\t[--hw_timestamps]\n"
+		"\t[--daemon]\n"
+		"\t[--daemon_client]\n"
+		"\t[--daemon_socket=<unix_socket_path>]\n"
+		"\t[--daemon_port=<tcp port for the daemon to listen on>]\n"
+		"\t[--daemon_workers=<ip:port,... of daemons to run on>]\n"
+		"\t[--jobs=<number of scripts to run in parallel>]\n"
+		"\t[--fork_server]\n"
 		"\t[--dry_run]\n"
+		"\t[--stream_window=<events to parse ahead while running>]\n"
+		"\t[--script_cache=<dir for cached parsed scripts>]\n"
+		"\t[--results_db=<dir of past --jobs results>]\n"
+		"\t[--junit_report=<file to write a JUnit XML report to>]\n"
+		"\t[--seed=<seed for random keys, numbers and ports>]\n"
+		"\t[--log_level=[error,warning,info,debug]]\n"
+		"\t[--log_async]\n"
+		"\t[--flight_recorder=<pcapng file for last packets on failure>]\n"
+		"\t[--flight_recorder_packets=<number of packets to keep>]\n"
+		"\t[--timing_report=<file to append JSON result records to>]\n"
+		"\t[--perf_counters]\n"
+		"\t[--kernel_latency]\n"
+		"\t[--kernel_latency_limits=<percentile>=<usecs>,...]\n"
+		"\t[--kernel_timeline=<file for TCP tracepoints by line>]\n"
+		"\t[--line_profile=<file for folded stacks of time by line>]\n"
+		"\t[--tcp_info_log=<file for a time series of TCP_INFO>]\n"
+		"\t[--tcp_info_interval_usecs=<usecs between samples>]\n"
+		"\t[--queue_stats=<usecs between qdisc and tun samples>]\n"
+		"\t[--dsn_coverage=<usecs per interval of subflow shares>]\n"
+		"\t[--self_stall]\n"
+		"\t[--alloc_stats]\n"
+		"\t[--compare <baseline report> <candidate report>]\n"
+		"\t[--compare_alpha=<significance level for --compare>]\n"
+		"\t[--main_cpus=<CPU list for the interpreter thread>]\n"
+		"\t[--syscall_cpus=<CPU list for blocking syscall threads>]\n"
+		"\t[--helper_cpus=<CPU list for the other threads>]\n"
+		"\t[--rps_cpus=<CPU list for tun receive processing>]\n"
+		"\t[--require_isolated_cpus]\n"
+		"\t[--mlock=[all,hot,none]]\n"
+		"\t[--mlock_budget_bytes=<most bytes --mlock=hot locks>]\n"
+		"\t[--hugepages=[none,thp,hugetlb]]\n"
+		"\t[--replay_pcap=<capture to replay after the script>]\n"
+		"\t[--replay_speed=<factor to speed up replayed packets by>]\n"
+		"\t[--replay_outbound=[check,loose,skip]]\n"
+		"\t[--replay_kernel_ip=<kernel address in the capture>]\n"
+		"\t[--fuzz=<mutated packets to inject after the script>]\n"
+		"\t[--fuzz_batch=<packets to inject between kernel checks>]\n"
+		"\t[--fuzz_output=<pcapng file for a failing case>]\n"
+		"\t[--fuzz_corpus=<dir for .pkt variants reaching new code>]\n"
+		"\t[--stress=<copies of the script to run at once>]\n"
+		"\t[--stress_stagger=<usecs between starts of the copies>]\n"
+		"\t[--concurrent=<scripts to run at once on one netdev>]\n"
+		"\t[--numa_spread]\n"
+		"\t[--avoid_irq_cpus=<device whose IRQ CPUs workers avoid>]\n"
+		"\t[--worker_cgroup=<cgroup v2 dir to make worker cgroups in>]\n"
+		"\t[--worker_cgroup_limits=cpu=<CPUs>,memory=<bytes>]\n"
+		"\t[--path=ip=<addr>,port=<port>,delay=<usecs>,jitter=<usecs>,"
+		"rate=<kbit/s>,loss=<percent>]\n"
+		"\t[--time_scale=<factor to shorten long idle gaps by>]\n"
+		"\t[--time_scale_min_gap=<usecs of the shortest gap to shorten>]\n"
+		"\t[--reset_kernel_state]\n"
+		"\t[--skip_teardown]\n"
+		"\t[--mib_per_event]\n"
+		"\t[--payload_pattern]\n"
+		"\t[--address_pool=<local_ip>,<remote_ip>/<prefixlen>"
+		"[,<gateway_ip>]]\n"
 		"\t[--verbose|-v]\n"
 		"\tscript_path ...\n");
 }
@@ -197,8 +457,23 @@ void set_default_config(struct config *config)
 	config->default_live_bind_port	= 8080;
 	config->default_live_connect_port	= 8080;
 	config->tolerance_usecs		= 4000;
+	config->scheduler		= SCHEDULER_SPIN;
+	config->time_source		= TIME_SOURCE_REALTIME;
 	config->speed			= TUN_DRIVER_SPEED_CUR;
 	config->mtu			= TUN_DRIVER_DEFAULT_MTU;
+	config->tun_queues		= 1;
+	config->flight_recorder_packets	= 1000;
+	config->tcp_info_interval_usecs	= 1000;
+	config->mlock			= MLOCK_ALL;
+	config->mlock_budget_bytes	= 32 * 1024 * 1024;
+	config->replay_speed		= 1.0;
+	config->compare_alpha		= 0.01;
+	config->time_scale		= 1.0;
+	config->time_scale_min_gap_usecs = 100000;
+	config->replay_outbound		= REPLAY_OUTBOUND_CHECK;
+	config->fuzz_batch		= 64;
+	config->stress_stagger_usecs	= 1000;
+	config->mptcp_version		= MPTCP_V0;
 
 	/* For now, by default we disable checks of outbound TS val
 	 * values, since there are timestamp val bugs in the tests and
@@ -218,6 +493,9 @@ void set_default_config(struct config *config)
 	config->wire_server_port	= 8081;
 	config->wire_client_device	= "eth0";
 	config->wire_server_device	= "eth0";
+	config->wire_server_xdp_queue	= -1;
+
+	config->daemon_socket		= "/tmp/packetdrill.sock";
 }
 
 static void set_remote_ip_and_prefix(struct config *config)
@@ -300,6 +578,78 @@ static void finalize_ipv6_config(struct config *config)
 	config->wire_protocol	= AF_INET6;
 }
 
+/* Parse the addresses of each --address_pool, now that we know the
+ * wire protocol. A pool without a gateway of its own uses the default
+ * one, which is on the tun device's subnet.
+ */
+static void finalize_address_pools(struct config *config)
+{
+	int i;
+
+	if (config->num_address_pools > 0 &&
+	    (config->is_wire_client || config->is_wire_server))
+		die("--address_pool needs a local tun device\n");
+	for (i = 0; i < config->num_address_pools; ++i) {
+		struct address_pool *pool = &config->address_pools[i];
+
+		if (config->wire_protocol == AF_INET) {
+			pool->local_ip = ipv4_parse(pool->local_ip_string);
+			pool->remote_prefix =
+				ipv4_prefix_parse(pool->remote_ip_string);
+		} else {
+			pool->local_ip = ipv6_parse(pool->local_ip_string);
+			pool->remote_prefix =
+				ipv6_prefix_parse(pool->remote_ip_string);
+		}
+		pool->remote_ip = pool->remote_prefix.ip;
+		ip_prefix_normalize(&pool->remote_prefix);
+
+		if (strlen(pool->gateway_ip_string) == 0)
+			pool->gateway_ip = config->live_gateway_ip;
+		else if (config->wire_protocol == AF_INET)
+			pool->gateway_ip = ipv4_parse(pool->gateway_ip_string);
+		else
+			pool->gateway_ip = ipv6_parse(pool->gateway_ip_string);
+	}
+}
+
+void config_pool_addresses(const struct config *config, int pool,
+			   struct ip_address *local_ip,
+			   struct ip_address *remote_ip)
+{
+	pool %= config->num_address_pools + 1;
+	if (pool == 0) {
+		*local_ip = config->live_local_ip;
+		*remote_ip = config->live_remote_ip;
+	} else {
+		*local_ip = config->address_pools[pool - 1].local_ip;
+		*remote_ip = config->address_pools[pool - 1].remote_ip;
+	}
+}
+
+/* For --serialize_inbound, add a last path, taken by the packets no
+ * --path matches, that serializes the packets we inject at --speed.
+ */
+static void finalize_link_path(struct config *config)
+{
+	struct path_spec *path = NULL;
+
+	if (!config->serialize_inbound ||
+	    (config->num_paths > 0 &&
+	     config->paths[config->num_paths - 1].inbound_only))
+		return;		/* not asked for, or added already */
+	if (config->speed == TUN_DRIVER_SPEED_CUR)
+		die("--serialize_inbound needs --speed\n");
+	if (config->num_paths >= MAX_PATHS)
+		die("too many --path options for --serialize_inbound\n");
+
+	path = &config->paths[config->num_paths++];
+	memset(path, 0, sizeof(*path));
+	ip_reset(&path->ip);
+	path->rate_kbps = (u64)config->speed * 1000;
+	path->inbound_only = true;
+}
+
 void finalize_config(struct config *config)
 {
 	assert(config->ip_version >= IP_VERSION_4);
@@ -316,6 +666,17 @@ void finalize_config(struct config *config)
 		break;
 		/* omitting default so compiler will catch missing cases */
 	}
+	finalize_address_pools(config);
+	finalize_link_path(config);
+	if (config->verify_checksums.mode == CHECKSUM_VERIFY_OFFLOAD &&
+	    !config->vnet_hdr)
+		die("--verify_checksums=offload needs --vnet_hdr\n");
+
+	/* Calibrate the clock now, before any thread reads it, but not
+	 * just to parse a script.
+	 */
+	if (!config->dry_run)
+		time_source_select(config->time_source);
 }
 
 /* Expect that arg is comma-delimited, allowing for spaces. */
@@ -339,6 +700,98 @@ void parse_non_fatal_arg(char *arg, struct config *config)
 	free(argdup);
 }
 
+/* Split the argument of an --address_pool option into its address
+ * strings; finalize_address_pools() parses them.
+ */
+static void parse_address_pool_arg(const char *arg, struct address_pool *pool,
+				   const char *where)
+{
+	char *argdup = strdup(arg), *saveptr = NULL;
+	char *fields[4] = { NULL };
+	int num_fields = 0;
+	char *token;
+	int i;
+
+	memset(pool, 0, sizeof(*pool));
+	for (token = strtok_r(argdup, ",", &saveptr);
+	     token != NULL && num_fields < 4;
+	     token = strtok_r(NULL, ",", &saveptr))
+		fields[num_fields++] = token;
+	if (num_fields < 2 || num_fields > 3)
+		die("%s: bad --address_pool: %s\n", where, arg);
+	for (i = 0; i < num_fields; ++i) {
+		if (strlen(fields[i]) >= ADDR_STR_LEN)
+			die("%s: bad --address_pool address: %s\n",
+			    where, fields[i]);
+	}
+	if (strchr(fields[1], '/') == NULL)
+		die("%s: --address_pool remote needs a prefix length: %s\n",
+		    where, fields[1]);
+
+	strcpy(pool->local_ip_string, fields[0]);
+	strcpy(pool->remote_ip_string, fields[1]);
+	if (fields[2] != NULL)
+		strcpy(pool->gateway_ip_string, fields[2]);
+	free(argdup);
+}
+
+/* Parse a comma-separated list of <event kind>=<usecs> tolerances,
+ * with the kinds named as in --timing_report, e.g.
+ * "inbound_packet=300,syscall_end=2000".
+ */
+static void parse_tolerances_arg(const char *arg, struct config *config,
+				 const char *where)
+{
+	char *argdup = strdup(arg), *saveptr = NULL;
+	char *token, *value, *end;
+	long usecs;
+	int i;
+
+	for (token = strtok_r(argdup, ", \t\n", &saveptr); token != NULL;
+	     token = strtok_r(NULL, ", \t\n", &saveptr)) {
+		value = strchr(token, '=');
+		if (value == NULL)
+			die("%s: bad --tolerances entry: %s\n", where, token);
+		*value++ = '\0';
+		for (i = 0; i < NUM_TIMING_EVENTS; ++i) {
+			if (strcmp(token, timing_event_name(i)) == 0)
+				break;
+		}
+		if (i == NUM_TIMING_EVENTS)
+			die("%s: unknown --tolerances event kind: %s\n",
+			    where, token);
+		usecs = strtol(value, &end, 10);
+		if (end == value || *end != '\0' || usecs <= 0 ||
+		    usecs > INT_MAX)
+			die("%s: bad --tolerances value for %s: %s\n",
+			    where, token, value);
+		config->tolerances_usecs[i] = usecs;
+	}
+	free(argdup);
+}
+
+/* Read tolerances from a file in --tolerances syntax, one or more
+ * lines of them, skipping blank lines and '#' comments, as written by
+ * script_bench --calibrate.
+ */
+static void read_tolerance_file(const char *path, struct config *config,
+				const char *where)
+{
+	char line[1024];
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL)
+		die("%s: cannot open --tolerance_file %s: %s\n",
+		    where, path, strerror(errno));
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *p = line + strspn(line, " \t\n");
+
+		if (*p == '\0' || *p == '#')
+			continue;
+		parse_tolerances_arg(p, config, where);
+	}
+	fclose(f);
+}
 
 /* Process a command line option */
 static void process_option(int opt, char *optarg, struct config *config,
@@ -347,6 +800,7 @@ static void process_option(int opt, char *optarg, struct config *config,
 	int port = 0;
 	char *end = NULL;
 	unsigned long speed = 0;
+	char *error = NULL;
 
 	DEBUGP("process_option %d ('%c') = %s\n",
 	       opt, (char)opt, optarg);
@@ -397,6 +851,20 @@ static void process_option(int opt, char *optarg, struct config *config,
 		if (config->mtu < 0)
 			die("%s: bad --mtu: %s\n", where, optarg);
 		break;
+	case OPT_VNET_HDR:
+		config->vnet_hdr = true;
+		break;
+	case OPT_VERIFY_CHECKSUMS:
+		if (parse_checksum_policy(optarg, &config->verify_checksums,
+					  &error))
+			die("%s: bad --verify_checksums: %s\n", where, error);
+		break;
+	case OPT_TUN_QUEUES:
+		config->tun_queues = atoi(optarg);
+		if (config->tun_queues < 1 ||
+		    config->tun_queues > TUN_MAX_QUEUES)
+			die("%s: bad --tun_queues: %s\n", where, optarg);
+		break;
 	case OPT_NETMASK_IP:
 		strncpy(config->live_netmask_ip_string, optarg,	ADDR_STR_LEN-1);
 		break;
@@ -406,17 +874,68 @@ static void process_option(int opt, char *optarg, struct config *config,
 	case OPT_NON_FATAL:
 		parse_non_fatal_arg(optarg, config);
 		break;
+	case OPT_SCHEDULER:
+		if (strcmp(optarg, "spin") == 0)
+			config->scheduler = SCHEDULER_SPIN;
+		else if (strcmp(optarg, "timer") == 0)
+			config->scheduler = SCHEDULER_TIMER;
+		else if (strcmp(optarg, "epoll") == 0)
+			config->scheduler = SCHEDULER_EPOLL;
+		else
+			die("%s: bad --scheduler: %s\n", where, optarg);
+		break;
+	case OPT_SCHEDULER_SLACK_USECS:
+		config->scheduler_slack_usecs = atoi(optarg);
+		if (config->scheduler_slack_usecs < 0)
+			die("%s: bad --scheduler_slack_usecs: %s\n",
+			    where, optarg);
+		break;
+	case OPT_CLOCK:
+		if (parse_time_source(optarg, &config->time_source) !=
+		    STATUS_OK)
+			die("%s: bad --clock: %s\n", where, optarg);
+		break;
+	case OPT_SHA1_BACKEND:
+		if (sha1_backend_set(optarg, &error))
+			die("%s: bad --sha1_backend: %s\n", where, error);
+		break;
+	case OPT_SHA256_BACKEND:
+		if (sha256_backend_set(optarg, &error))
+			die("%s: bad --sha256_backend: %s\n", where, error);
+		break;
+	case OPT_MPTCP_VERSION:
+		if (strcmp(optarg, "0") == 0)
+			config->mptcp_version = MPTCP_V0;
+		else if (strcmp(optarg, "1") == 0)
+			config->mptcp_version = MPTCP_V1;
+		else
+			die("%s: bad --mptcp_version: %s\n", where, optarg);
+		break;
 	case OPT_SPEED:
 		speed = strtoul(optarg, &end, 10);
 		if (end == optarg || *end || !is_valid_u32(speed))
 			die("%s: bad --speed: %s\n", where, optarg);
 		config->speed = speed;
 		break;
+	case OPT_SERIALIZE_INBOUND:
+		config->serialize_inbound = true;
+		break;
+	case OPT_ACK_AGGREGATION:
+		if (parse_ack_profile(optarg, &config->ack_aggregation,
+				      &error))
+			die("%s: bad --ack_aggregation: %s\n", where, error);
+		break;
 	case OPT_TOLERANCE_USECS:
 		config->tolerance_usecs = atoi(optarg);
 		if (config->tolerance_usecs <= 0)
 			die("%s: bad --tolerance_usecs: %s\n", where, optarg);
 		break;
+	case OPT_TOLERANCES:
+		parse_tolerances_arg(optarg, config, where);
+		break;
+	case OPT_TOLERANCE_FILE:
+		read_tolerance_file(optarg, config, where);
+		break;
 	case OPT_TCP_TS_TICK_USECS:
 		config->tcp_ts_tick_usecs = atoi(optarg);
 		if (config->tcp_ts_tick_usecs < 0 ||
@@ -446,9 +965,302 @@ static void process_option(int opt, char *optarg, struct config *config,
 	case OPT_WIRE_SERVER_DEV:
 		config->wire_server_device = strdup(optarg);
 		break;
+	case OPT_WIRE_SERVER_SHARED_SNIFFER:
+		config->wire_server_shared_sniffer = true;
+		break;
+	case OPT_WIRE_SERVER_XDP_QUEUE:
+		config->wire_server_xdp_queue = atoi(optarg);
+		if (config->wire_server_xdp_queue < 0)
+			die("%s: bad --wire_server_xdp_queue: %s\n",
+			    where, optarg);
+		break;
+	case OPT_WIRE_PIPELINE:
+		config->wire_pipeline = true;
+		break;
+	case OPT_WIRE_CLOCK_SYNC:
+		config->wire_clock_sync = true;
+		break;
+	case OPT_WIRE_COMPRESS:
+		config->wire_compress = true;
+		break;
+	case OPT_HW_TIMESTAMPS:
+		config->hw_timestamps = true;
+		break;
+	case OPT_JOBS:
+		config->jobs = atoi(optarg);
+		if (config->jobs <= 0)
+			die("%s: bad --jobs: %s\n", where, optarg);
+		break;
+	case OPT_FORK_SERVER:
+		config->fork_server = true;
+		break;
+	case OPT_DAEMON:
+		config->is_daemon = true;
+		break;
+	case OPT_DAEMON_CLIENT:
+		config->is_daemon_client = true;
+		break;
+	case OPT_DAEMON_SOCKET:
+		config->daemon_socket = strdup(optarg);
+		break;
+	case OPT_DAEMON_PORT:
+		port = atoi(optarg);
+		if (port <= 0 || port > 0xffff)
+			die("%s: bad --daemon_port: %s\n", where, optarg);
+		config->daemon_port = port;
+		break;
+	case OPT_DAEMON_WORKERS:
+		config->daemon_workers = strdup(optarg);
+		break;
 	case OPT_DRY_RUN:
 		config->dry_run = true;
 		break;
+	case OPT_STREAM_WINDOW:
+		config->stream_window = atoi(optarg);
+		if (config->stream_window <= 0)
+			die("%s: bad --stream_window: %s\n", where, optarg);
+		break;
+	case OPT_SCRIPT_CACHE:
+		config->script_cache = strdup(optarg);
+		break;
+	case OPT_RESULTS_DB:
+		config->results_db = strdup(optarg);
+		break;
+	case OPT_JUNIT_REPORT:
+		config->junit_report = strdup(optarg);
+		break;
+	case OPT_SEED:
+		errno = 0;
+		config->seed = strtoull(optarg, &end, 0);
+		if (end == optarg || *end || errno)
+			die("%s: bad --seed: %s\n", where, optarg);
+		config->seed_set = true;
+		break;
+	case OPT_LOG_LEVEL:
+		if (log_set_level(optarg, &error))
+			die("%s: bad --log_level: %s\n", where, error);
+		break;
+	case OPT_LOG_ASYNC:
+		log_set_async(true);
+		break;
+	case OPT_FLIGHT_RECORDER:
+		config->flight_recorder = strdup(optarg);
+		break;
+	case OPT_TIMING_REPORT:
+		config->timing_report = strdup(optarg);
+		break;
+	case OPT_PERF_COUNTERS:
+		config->perf_counters = true;
+		break;
+	case OPT_KERNEL_LATENCY:
+		config->kernel_latency = true;
+		break;
+	case OPT_KERNEL_TIMELINE:
+		config->kernel_timeline = strdup(optarg);
+		break;
+	case OPT_LINE_PROFILE:
+		config->line_profile = strdup(optarg);
+		break;
+	case OPT_KERNEL_LATENCY_LIMITS:
+		if (parse_kernel_latency_limits(
+			    optarg, config->kernel_latency_limits,
+			    &config->num_kernel_latency_limits, &error))
+			die("%s: bad --kernel_latency_limits: %s\n",
+			    where, error);
+		config->kernel_latency = true;
+		break;
+	case OPT_TCP_INFO_LOG:
+		config->tcp_info_log = strdup(optarg);
+		break;
+	case OPT_TCP_INFO_INTERVAL_USECS:
+		config->tcp_info_interval_usecs = atoi(optarg);
+		if (config->tcp_info_interval_usecs <= 0)
+			die("%s: bad --tcp_info_interval_usecs: %s\n",
+			    where, optarg);
+		break;
+	case OPT_QUEUE_STATS:
+		config->queue_stats_usecs = atoi(optarg);
+		if (config->queue_stats_usecs <= 0)
+			die("%s: bad --queue_stats: %s\n", where, optarg);
+		break;
+	case OPT_DSN_COVERAGE:
+		config->dsn_coverage_usecs = atoi(optarg);
+		if (config->dsn_coverage_usecs <= 0)
+			die("%s: bad --dsn_coverage: %s\n", where, optarg);
+		break;
+	case OPT_SELF_STALL:
+		config->self_stall = true;
+		break;
+	case OPT_ALLOC_STATS:
+		config->alloc_stats = true;
+		break;
+	case OPT_COMPARE:
+		config->compare = true;
+		break;
+	case OPT_COMPARE_ALPHA:
+		config->compare_alpha = strtod(optarg, &end);
+		if (end == optarg || *end || !(config->compare_alpha > 0) ||
+		    !(config->compare_alpha < 1))
+			die("%s: bad --compare_alpha: %s\n", where, optarg);
+		break;
+	case OPT_MAIN_CPUS:
+		if (cpu_affinity_set(CPU_ROLE_MAIN, optarg, &error))
+			die("%s: bad --main_cpus: %s\n", where, error);
+		break;
+	case OPT_SYSCALL_CPUS:
+		if (cpu_affinity_set(CPU_ROLE_SYSCALL, optarg, &error))
+			die("%s: bad --syscall_cpus: %s\n", where, error);
+		break;
+	case OPT_HELPER_CPUS:
+		if (cpu_affinity_set(CPU_ROLE_HELPER, optarg, &error))
+			die("%s: bad --helper_cpus: %s\n", where, error);
+		break;
+	case OPT_RPS_CPUS:
+		if (cpu_affinity_set_rps(optarg, &error))
+			die("%s: bad --rps_cpus: %s\n", where, error);
+		break;
+	case OPT_REQUIRE_ISOLATED_CPUS:
+		cpu_affinity_require_isolated(true);
+		break;
+	case OPT_MLOCK:
+		if (strcmp(optarg, "all") == 0)
+			config->mlock = MLOCK_ALL;
+		else if (strcmp(optarg, "hot") == 0)
+			config->mlock = MLOCK_HOT;
+		else if (strcmp(optarg, "none") == 0)
+			config->mlock = MLOCK_NONE;
+		else
+			die("%s: bad --mlock: %s\n", where, optarg);
+		break;
+	case OPT_MLOCK_BUDGET_BYTES:
+		errno = 0;
+		config->mlock_budget_bytes = strtoull(optarg, &end, 0);
+		if (end == optarg || *end || errno ||
+		    config->mlock_budget_bytes == 0)
+			die("%s: bad --mlock_budget_bytes: %s\n",
+			    where, optarg);
+		break;
+	case OPT_HUGEPAGES:
+		if (parse_hugepages(optarg, &config->hugepages))
+			die("%s: bad --hugepages: %s\n", where, optarg);
+		break;
+	case OPT_REPLAY_PCAP:
+		config->replay_pcap = strdup(optarg);
+		break;
+	case OPT_REPLAY_SPEED:
+		config->replay_speed = strtod(optarg, &end);
+		if (end == optarg || *end || !(config->replay_speed > 0))
+			die("%s: bad --replay_speed: %s\n", where, optarg);
+		break;
+	case OPT_REPLAY_OUTBOUND:
+		if (strcmp(optarg, "check") == 0)
+			config->replay_outbound = REPLAY_OUTBOUND_CHECK;
+		else if (strcmp(optarg, "loose") == 0)
+			config->replay_outbound = REPLAY_OUTBOUND_LOOSE;
+		else if (strcmp(optarg, "skip") == 0)
+			config->replay_outbound = REPLAY_OUTBOUND_SKIP;
+		else
+			die("%s: bad --replay_outbound: %s\n", where, optarg);
+		break;
+	case OPT_REPLAY_KERNEL_IP:
+		if (strchr(optarg, ':') != NULL)
+			config->replay_kernel_ip = ipv6_parse(optarg);
+		else
+			config->replay_kernel_ip = ipv4_parse(optarg);
+		break;
+	case OPT_FUZZ:
+		config->fuzz_variants = atoi(optarg);
+		if (config->fuzz_variants <= 0)
+			die("%s: bad --fuzz: %s\n", where, optarg);
+		break;
+	case OPT_FUZZ_BATCH:
+		config->fuzz_batch = atoi(optarg);
+		if (config->fuzz_batch <= 0)
+			die("%s: bad --fuzz_batch: %s\n", where, optarg);
+		break;
+	case OPT_FUZZ_OUTPUT:
+		config->fuzz_output = strdup(optarg);
+		break;
+	case OPT_FUZZ_CORPUS:
+		config->fuzz_corpus = strdup(optarg);
+		break;
+	case OPT_STRESS:
+		config->stress_instances = atoi(optarg);
+		if (config->stress_instances <= 0 ||
+		    config->stress_instances > STRESS_MAX_INSTANCES)
+			die("%s: bad --stress: %s\n", where, optarg);
+		break;
+	case OPT_STRESS_STAGGER:
+		config->stress_stagger_usecs = atoi(optarg);
+		if (config->stress_stagger_usecs < 0)
+			die("%s: bad --stress_stagger: %s\n", where, optarg);
+		break;
+	case OPT_CONCURRENT:
+		config->concurrent_scripts = atoi(optarg);
+		if (config->concurrent_scripts <= 0 ||
+		    config->concurrent_scripts > STRESS_MAX_INSTANCES)
+			die("%s: bad --concurrent: %s\n", where, optarg);
+		break;
+	case OPT_NUMA_SPREAD:
+		config->numa_spread = true;
+		break;
+	case OPT_AVOID_IRQ_CPUS:
+		config->avoid_irq_device = strdup(optarg);
+		break;
+	case OPT_WORKER_CGROUP:
+		config->worker_cgroup = strdup(optarg);
+		break;
+	case OPT_WORKER_CGROUP_LIMITS:
+		if (parse_cgroup_limits(optarg, &config->worker_cgroup_cpus,
+					&config->worker_cgroup_memory_bytes,
+					&error))
+			die("%s: bad --worker_cgroup_limits: %s\n",
+			    where, error);
+		break;
+	case OPT_PATH:
+		if (config->num_paths >= MAX_PATHS)
+			die("%s: too many --path options\n", where);
+		if (path_spec_parse(optarg, &config->paths[config->num_paths],
+				    &error))
+			die("%s: %s\n", where, error);
+		++config->num_paths;
+		break;
+	case OPT_TIME_SCALE:
+		config->time_scale = strtod(optarg, &end);
+		if (end == optarg || *end || !(config->time_scale >= 1))
+			die("%s: bad --time_scale: %s\n", where, optarg);
+		break;
+	case OPT_TIME_SCALE_MIN_GAP:
+		config->time_scale_min_gap_usecs = atoi(optarg);
+		if (config->time_scale_min_gap_usecs <= 0)
+			die("%s: bad --time_scale_min_gap: %s\n", where, optarg);
+		break;
+	case OPT_RESET_KERNEL_STATE:
+		config->reset_kernel_state = true;
+		break;
+	case OPT_SKIP_TEARDOWN:
+		config->skip_teardown = true;
+		break;
+	case OPT_MIB_PER_EVENT:
+		config->mib_per_event = true;
+		break;
+	case OPT_ADDRESS_POOL:
+		if (config->num_address_pools >= MAX_ADDRESS_POOLS)
+			die("%s: too many --address_pool options\n", where);
+		parse_address_pool_arg(
+			optarg, &config->address_pools[config->num_address_pools],
+			where);
+		++config->num_address_pools;
+		break;
+	case OPT_PAYLOAD_PATTERN:
+		config->payload_pattern = true;
+		break;
+	case OPT_FLIGHT_RECORDER_PACKETS:
+		config->flight_recorder_packets = atoi(optarg);
+		if (config->flight_recorder_packets <= 0)
+			die("%s: bad --flight_recorder_packets: %s\n",
+			    where, optarg);
+		break;
 	case OPT_VERBOSE:
 		config->verbose = true;
 		break;
@@ -31,20 +31,70 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <getopt.h>
+#include "ack_aggregation.h"
 #include "ip_address.h"
 #include "ip_prefix.h"
+#include "hugepage.h"
+#include "kernel_latency.h"
+#include "packet_checksum.h"
+#include "path_emulation.h"
 #include "script.h"
+#include "time_source.h"
+#include "timing_stats.h"
 
 #define TUN_DRIVER_SPEED_CUR	0	/* don't change current speed */
 #define TUN_DRIVER_DEFAULT_MTU 1500	/* default MTU for tun device */
+#define TUN_MAX_QUEUES 16		/* most queues we give a tun device */
+#define STRESS_MAX_INSTANCES 1024	/* most copies of a script --stress
+					 * runs at once
+					 */
+#define MAX_ADDRESS_POOLS	16	/* most --address_pool options we take */
 
 extern struct option options[];
 
+/* How wait_for_event() waits for the start time of the next event. */
+enum scheduler_t {
+	SCHEDULER_SPIN,		/* usleep() most of the way, then busy-wait */
+	SCHEDULER_TIMER,	/* sleep on an absolute CLOCK_MONOTONIC timer */
+	SCHEDULER_EPOLL,	/* wait in an epoll loop on a timerfd, and on
+				 * an eventfd for syscall completions
+				 */
+};
+
+/* What memory we lock into RAM while running a test. */
+enum mlock_t {
+	MLOCK_ALL,		/* mlockall(MCL_CURRENT | MCL_FUTURE) */
+	MLOCK_HOT,		/* the hot working set, up to a budget */
+	MLOCK_NONE,		/* nothing */
+};
+
+/* What we expect of the kernel's packets in a --replay_pcap capture. */
+enum replay_outbound_t {
+	REPLAY_OUTBOUND_CHECK,	/* expect them as a script packet would */
+	REPLAY_OUTBOUND_LOOSE,	/* ...but don't check window, options, ECN */
+	REPLAY_OUTBOUND_SKIP,	/* only expect SYNs; inject the rest blind */
+};
+
 struct ports {
 	unsigned live_local;
 	unsigned live_remote;
 };
 
+/* An extra local address and remote prefix (--address_pool), with a
+ * route of its own, for subflows that should not share the default
+ * local and remote addresses.
+ */
+struct address_pool {
+	struct ip_address local_ip;		/* added to the tun device */
+	struct ip_address remote_ip;		/* first address of prefix */
+	struct ip_prefix remote_prefix;		/* routed to the tun device */
+	struct ip_address gateway_ip;		/* route's next hop */
+
+	char local_ip_string[ADDR_STR_LEN];	/* as given */
+	char remote_ip_string[ADDR_STR_LEN];	/* <addr>/<prefixlen> */
+	char gateway_ip_string[ADDR_STR_LEN];	/* or "" for --gateway_ip */
+};
+
 struct config {
 	const char **argv;			/* a copy of process argv */
 
@@ -75,19 +125,228 @@ struct config {
 
 	int live_prefix_len;		/* IPv4/IPv6 interface prefix len */
 
+	struct address_pool address_pools[MAX_ADDRESS_POOLS];
+	int num_address_pools;		/* number of --address_pool options */
+
 	int tolerance_usecs;		/* tolerance for time divergence */
+	int tolerances_usecs[NUM_TIMING_EVENTS];	/* per kind of timed
+							 * event, from
+							 * --tolerances; if 0,
+							 * tolerance_usecs
+							 */
+
+	enum scheduler_t scheduler;	/* how to wait for events */
+	int scheduler_slack_usecs;	/* for SCHEDULER_TIMER and
+					 * SCHEDULER_EPOLL: wake up this early
+					 * and spin the rest of the way
+					 */
+	enum time_source_t time_source;	/* clock to schedule and time by */
 	int tcp_ts_tick_usecs;		/* microseconds per TS val tick */
 
+	u8 mptcp_version;		/* MPTCP version our MP_CAPABLE
+					 * options carry: MPTCP_V0 or MPTCP_V1
+					 */
+
+	enum mlock_t mlock;		/* what memory to lock into RAM */
+	u64 mlock_budget_bytes;		/* for MLOCK_HOT: most bytes to lock */
+	enum hugepages_t hugepages;	/* what pages to put the packet pool
+					 * and AF_XDP UMEM on
+					 */
+
 	u32 speed;			/* speed reported by tun driver;
 					 * may require special tun driver
 					 */
+	bool serialize_inbound;		/* inject packets no faster than
+					 * speed, as a link would carry them
+					 */
+	struct ack_profile ack_aggregation;	/* how to aggregate the pure
+						 * ACKs we inject, as GRO or
+						 * Wi-Fi would
+						 */
 	int mtu;			/* MTU of tun device */
+	int tun_queues;			/* queues of tun device; if > 1,
+					 * IFF_MULTI_QUEUE
+					 */
+	bool vnet_hdr;			/* tun and packet socket carry
+					 * virtio_net_hdr GSO metadata?
+					 */
+	struct checksum_policy verify_checksums;	/* which layer 4
+							 * checksums of
+							 * sniffed packets
+							 * to verify
+							 */
 
 	bool non_fatal_packet;		/* treat packet asserts as non-fatal */
 	bool non_fatal_syscall;		/* treat syscall asserts as non-fatal */
 
+	int jobs;			/* if > 0, run scripts in this many
+					 * parallel worker processes
+					 */
+	bool fork_server;		/* with --jobs, fork each script from
+					 * a template process per worker that
+					 * has its tun device set up?
+					 */
+
 	bool dry_run;			/* parse script but don't execute? */
 
+	int stream_window;		/* if > 0, parse events while running,
+					 * this many ahead of the current one
+					 */
+
+	char *script_cache;		/* dir of cached parsed scripts, from
+					 * the command line only
+					 */
+
+	char *results_db;		/* dir of past --jobs results, or NULL */
+	char *junit_report;		/* file for a JUnit XML report of a
+					 * --jobs or coordinator run, or NULL
+					 */
+
+	u64 seed;			/* seed for random numbers; picked
+					 * anew for each run unless seed_set
+					 */
+	bool seed_set;			/* was --seed given? */
+
+	char *flight_recorder;		/* if non-NULL, write the last packets
+					 * to this pcapng file on failure
+					 */
+	int flight_recorder_packets;	/* how many packets it keeps */
+
+	char *timing_report;		/* if non-NULL, append a JSON report
+					 * of each run's result, failing line
+					 * and error, and event timing errors
+					 * to this file
+					 */
+	bool perf_counters;		/* count cycles, instructions, cache
+					 * misses and context switches of our
+					 * threads per event type and step of
+					 * handling packets, and print them
+					 * at the end?
+					 */
+	bool kernel_latency;		/* measure how long the kernel takes
+					 * to answer each injected packet, by
+					 * line and socket, and print it?
+					 */
+	struct latency_limit kernel_latency_limits[KERNEL_LATENCY_MAX_LIMITS];
+					/* fail if those latencies exceed
+					 * these (--kernel_latency_limits)
+					 */
+	int num_kernel_latency_limits;
+	char *kernel_timeline;		/* if non-NULL, write the kernel's TCP
+					 * and MPTCP tracepoints, by script
+					 * line, to this file
+					 */
+	char *line_profile;		/* if non-NULL, profile where the
+					 * run's time goes by script line,
+					 * and append it to this file
+					 */
+
+	char *tcp_info_log;		/* if non-NULL, sample TCP_INFO of
+					 * live sockets into this file
+					 */
+	int tcp_info_interval_usecs;	/* how often to sample TCP_INFO */
+	int queue_stats_usecs;		/* if positive, sample the tun
+					 * device's qdisc and ring this often
+					 */
+	int dsn_coverage_usecs;		/* if positive, track where in each
+					 * MPTCP data stream the kernel sent
+					 * data and on which subflow, giving
+					 * shares per interval this long
+					 */
+	bool self_stall;		/* watch how long our own main thread
+					 * is kept from running, to label
+					 * timing errors it explains as
+					 * host-induced?
+					 */
+	bool alloc_stats;		/* count the memory each subsystem
+					 * allocates, for the timing report
+					 * and a table at exit?
+					 */
+	bool compare;			/* compare two --timing_report files
+					 * instead of running scripts?
+					 */
+	double compare_alpha;		/* significance level at which
+					 * --compare reports a change
+					 */
+
+	char *replay_pcap;		/* if non-NULL, append the packets of
+					 * this capture to the script's events
+					 */
+	double replay_speed;		/* divide gaps in the capture by this */
+	enum replay_outbound_t replay_outbound;	/* what to expect of the
+						 * kernel's replayed packets
+						 */
+	struct ip_address replay_kernel_ip;	/* kernel's address in the
+						 * capture, if not AF_UNSPEC
+						 */
+
+	int fuzz_variants;		/* if > 0, inject this many mutated
+					 * packets after the script's events
+					 */
+	int fuzz_batch;			/* packets to inject between checks
+					 * of the kernel's health
+					 */
+	char *fuzz_output;		/* if non-NULL, write a failing case
+					 * here as pcapng
+					 */
+	char *fuzz_corpus;		/* if non-NULL, steer by KCOV and
+					 * write variants that reach new
+					 * code here as .pkt scripts
+					 */
+
+	int stress_instances;		/* if > 0, run this many copies of
+					 * the script at once in one process
+					 */
+	int stress_stagger_usecs;	/* delay between the starts of the
+					 * copies
+					 */
+	u16 live_port_offset;		/* added to ports the script binds,
+					 * so that copies don't collide
+					 */
+	int concurrent_scripts;		/* if > 0, run this many of the
+					 * scripts at once on one netdev, each
+					 * with its own remote address
+					 */
+
+	bool numa_spread;		/* spread workers over NUMA nodes,
+					 * each with memory bound locally?
+					 */
+	char *avoid_irq_device;		/* if non-NULL, keep workers off the
+					 * CPUs servicing this device's IRQs
+					 */
+	char *worker_cgroup;		/* if non-NULL, run each worker in a
+					 * cgroup of its own under this one
+					 */
+	double worker_cgroup_cpus;	/* CPU limit of those, if > 0 */
+	u64 worker_cgroup_memory_bytes;	/* memory limit of those, if > 0 */
+
+	struct path_spec paths[MAX_PATHS];	/* emulated paths (--path) */
+	int num_paths;			/* number of --path options */
+
+	double time_scale;		/* divide long idle gaps before
+					 * events we start by this
+					 */
+	int time_scale_min_gap_usecs;	/* shortest gap --time_scale
+					 * shortens
+					 */
+
+	bool reset_kernel_state;	/* flush TCP metrics before the test,
+					 * and restore sysctls and MPTCP
+					 * endpoints after it?
+					 */
+	bool skip_teardown;		/* don't reset connections left open
+					 * at the end, as their network
+					 * namespace is about to go away?
+					 */
+	bool mib_per_event;		/* note which MIB counters each event
+					 * changed, for --timing_report?
+					 */
+	bool payload_pattern;		/* send a pattern rather than zeros
+					 * over TCP, keyed by stream offset
+					 * (by DSN for MPTCP), and check the
+					 * data we receive and sniff against it?
+					 */
+
 	bool verbose;			/* print detailed debug info? */
 	char *script_path;		/* pathname of script file */
 
@@ -111,6 +370,21 @@ struct config {
 	struct ip_address wire_server_ip;  /* IP of on-the-wire server */
 	char *wire_server_ip_string;	   /* malloc-ed server IP string */
 	u16 wire_server_port;		   /* the port the server listens on */
+	bool wire_server_shared_sniffer;   /* one packet socket for clients? */
+	int wire_server_xdp_queue;	   /* AF_XDP on this rx queue, or -1 */
+	bool wire_pipeline;		   /* don't wait for server to ack? */
+	bool wire_clock_sync;		   /* map client clock to server's? */
+	bool wire_compress;		   /* compress big wire messages? */
+	bool hw_timestamps;		   /* server: NIC RX/TX timestamps? */
+
+	/* For running many scripts on a long-lived local tun device. */
+	bool is_daemon;			   /* set up netdev once, serve scripts? */
+	bool is_daemon_client;		   /* send our scripts to a daemon? */
+	char *daemon_socket;		   /* path of daemon's UNIX socket */
+	u16 daemon_port;		   /* if non-zero, daemon's TCP port */
+	char *daemon_workers;		   /* "ip:port,..." of daemons for a
+					    * coordinating client, or NULL
+					    */
 };
 
 /* Top-level info about the invocation of a test script */
@@ -121,6 +395,16 @@ struct invocation {
 	struct script *script;		/* parse tree of the script to run */
 };
 
+/* Return the tolerance for time divergence of the given kind of timed
+ * event.
+ */
+static inline int config_tolerance_usecs(const struct config *config,
+					 enum timing_event_t timing)
+{
+	return config->tolerances_usecs[timing] > 0 ?
+		config->tolerances_usecs[timing] : config->tolerance_usecs;
+}
+
 /* Set default configuration */
 extern void set_default_config(struct config *config);
 
@@ -145,6 +429,14 @@ extern void show_usage(void);
 extern char **parse_command_line_options(int argc, char *argv[],
 					 struct config *config);
 
+/* Return the local and remote addresses of the given address pool,
+ * counting the default addresses as pool 0 and wrapping around after
+ * the last --address_pool.
+ */
+extern void config_pool_addresses(const struct config *config, int pool,
+				  struct ip_address *local_ip,
+				  struct ip_address *remote_ip);
+
 /* The parser calls this function to finalize processing of config info. */
 extern void parse_and_finalize_config(struct invocation *invocation);
 
@@ -0,0 +1,349 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of pinning packetdrill's threads to chosen CPUs.
+ */
+
+#include "cpu_affinity.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+
+#ifdef linux
+
+/* Where the kernel lists the CPUs isolated with isolcpus=. */
+static const char *isolated_path = "/sys/devices/system/cpu/isolated";
+
+/* The configuration, set from the command line before any threads. */
+static struct {
+	bool has_cpus[NUM_CPU_ROLES];	/* do we pin this role? */
+	cpu_set_t cpus[NUM_CPU_ROLES];	/* where we pin each role */
+	bool has_rps_cpus;		/* do we steer packet processing? */
+	cpu_set_t rps_cpus;		/* where we steer it */
+	bool require_isolated;		/* must all those CPUs be isolated? */
+	bool has_allowed;		/* have we saved the CPUs below? */
+	cpu_set_t allowed;		/* where we could run before pinning */
+} affinity;
+
+static const char *role_name(enum cpu_role_t role)
+{
+	switch (role) {
+	case CPU_ROLE_MAIN:	return "main";
+	case CPU_ROLE_SYSCALL:	return "syscall";
+	case CPU_ROLE_HELPER:	return "helper";
+	case NUM_CPU_ROLES:	break;
+	/* missing default case so compiler catches missing cases */
+	}
+	return "invalid";
+}
+
+/* Parse a CPU number at *p, advancing *p past it. */
+static int parse_cpu(const char **p, int *cpu, char **error)
+{
+	char *end = NULL;
+	unsigned long value;
+
+	if (**p < '0' || **p > '9') {
+		asprintf(error, "expected a CPU number at '%s'", *p);
+		return STATUS_ERR;
+	}
+	errno = 0;
+	value = strtoul(*p, &end, 10);
+	if (errno != 0 || value >= CPU_SETSIZE) {
+		asprintf(error, "CPU number too large at '%s'", *p);
+		return STATUS_ERR;
+	}
+	*p = end;
+	*cpu = value;
+	return STATUS_OK;
+}
+
+int cpu_list_parse(const char *list, cpu_set_t *cpus, char **error)
+{
+	const char *p = list;
+
+	CPU_ZERO(cpus);
+	if (*p == '\0' || *p == '\n') {
+		asprintf(error, "empty CPU list");
+		return STATUS_ERR;
+	}
+	for (;;) {
+		int first, last, cpu;
+
+		if (parse_cpu(&p, &first, error))
+			return STATUS_ERR;
+		last = first;
+		if (*p == '-') {
+			++p;
+			if (parse_cpu(&p, &last, error))
+				return STATUS_ERR;
+			if (last < first) {
+				asprintf(error, "bad CPU range %d-%d",
+					 first, last);
+				return STATUS_ERR;
+			}
+		}
+		for (cpu = first; cpu <= last; cpu++)
+			CPU_SET(cpu, cpus);
+
+		/* Lists from /sys end in a newline. */
+		if (*p == '\0' || (p[0] == '\n' && p[1] == '\0'))
+			return STATUS_OK;
+		if (*p != ',') {
+			asprintf(error, "unexpected '%c' in CPU list", *p);
+			return STATUS_ERR;
+		}
+		++p;
+	}
+}
+
+int cpu_affinity_set(enum cpu_role_t role, const char *list, char **error)
+{
+	if (cpu_list_parse(list, &affinity.cpus[role], error))
+		return STATUS_ERR;
+	affinity.has_cpus[role] = true;
+	return STATUS_OK;
+}
+
+int cpu_affinity_set_rps(const char *list, char **error)
+{
+	if (cpu_list_parse(list, &affinity.rps_cpus, error))
+		return STATUS_ERR;
+	affinity.has_rps_cpus = true;
+	return STATUS_OK;
+}
+
+void cpu_affinity_require_isolated(bool require)
+{
+	affinity.require_isolated = require;
+}
+
+/* Read the CPUs isolated from the scheduler into *isolated. */
+static int read_isolated_cpus(cpu_set_t *isolated, char **error)
+{
+	char list[8192];
+	FILE *file;
+
+	CPU_ZERO(isolated);
+	file = fopen(isolated_path, "r");
+	if (file == NULL) {
+		asprintf(error, "cannot open %s: %s",
+			 isolated_path, strerror(errno));
+		return STATUS_ERR;
+	}
+	if (fgets(list, sizeof(list), file) == NULL)
+		list[0] = '\0';
+	fclose(file);
+
+	/* An empty list means no CPUs are isolated. */
+	if (list[0] == '\0' || list[0] == '\n')
+		return STATUS_OK;
+	return cpu_list_parse(list, isolated, error);
+}
+
+/* Check that each CPU in cpus is one we may run on and, if required,
+ * is isolated. The description says what we want the CPUs for.
+ */
+static int check_cpus(const cpu_set_t *cpus, const char *description,
+		      const cpu_set_t *allowed, const cpu_set_t *isolated,
+		      char **error)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, cpus))
+			continue;
+		if (!CPU_ISSET(cpu, allowed)) {
+			asprintf(error, "CPU %d for %s is offline or "
+				 "not in our cpuset", cpu, description);
+			return STATUS_ERR;
+		}
+		if (isolated != NULL && !CPU_ISSET(cpu, isolated)) {
+			asprintf(error, "CPU %d for %s is not isolated "
+				 "(see %s)", cpu, description, isolated_path);
+			return STATUS_ERR;
+		}
+	}
+	return STATUS_OK;
+}
+
+/* Format cpus as the hex bitmask that rps_cpus files take: 32-bit
+ * words, most significant first, separated by commas.
+ */
+static void cpu_mask_to_string(const cpu_set_t *cpus, char *mask,
+			       size_t mask_bytes)
+{
+	int words = 1, word, cpu;
+	size_t used = 0;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, cpus))
+			words = cpu / 32 + 1;
+	}
+	for (word = words - 1; word >= 0; word--) {
+		u32 bits = 0;
+
+		for (cpu = 0; cpu < 32; cpu++) {
+			if (CPU_ISSET(word * 32 + cpu, cpus))
+				bits |= 1U << cpu;
+		}
+		used += snprintf(mask + used, mask_bytes - used, "%s%08x",
+				 word == words - 1 ? "" : ",", bits);
+	}
+}
+
+/* Write the RPS CPU mask to each receive queue of the given device. */
+static int steer_rps(const char *device, char **error)
+{
+	char mask[CPU_SETSIZE / 4 + CPU_SETSIZE / 32 + 1];
+	char path[512];
+	struct dirent *entry;
+	int num_queues = 0;
+	DIR *dir;
+
+	cpu_mask_to_string(&affinity.rps_cpus, mask, sizeof(mask));
+	snprintf(path, sizeof(path), "/sys/class/net/%s/queues", device);
+	dir = opendir(path);
+	if (dir == NULL) {
+		asprintf(error, "cannot open %s: %s", path, strerror(errno));
+		return STATUS_ERR;
+	}
+	while ((entry = readdir(dir)) != NULL) {
+		FILE *file;
+
+		if (strncmp(entry->d_name, "rx-", 3) != 0)
+			continue;
+		snprintf(path, sizeof(path),
+			 "/sys/class/net/%s/queues/%s/rps_cpus",
+			 device, entry->d_name);
+		file = fopen(path, "w");
+		if (file == NULL || fputs(mask, file) < 0 ||
+		    fclose(file) != 0) {
+			asprintf(error, "cannot write %s: %s",
+				 path, strerror(errno));
+			closedir(dir);
+			return STATUS_ERR;
+		}
+		++num_queues;
+	}
+	closedir(dir);
+	if (num_queues == 0) {
+		asprintf(error, "%s has no receive queues", device);
+		return STATUS_ERR;
+	}
+	DEBUGP("steered RPS of %d %s queues to %s\n",
+	       num_queues, device, mask);
+	return STATUS_OK;
+}
+
+int cpu_affinity_check(const char *device, char **error)
+{
+	cpu_set_t allowed, isolated;
+	char *description = NULL;
+	int role, result;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+		die_perror("sched_getaffinity");
+	if (!affinity.has_allowed) {
+		affinity.allowed = allowed;
+		affinity.has_allowed = true;
+	}
+	if (affinity.require_isolated &&
+	    read_isolated_cpus(&isolated, error))
+		return STATUS_ERR;
+
+	for (role = 0; role < NUM_CPU_ROLES; role++) {
+		if (!affinity.has_cpus[role])
+			continue;
+		asprintf(&description, "%s threads", role_name(role));
+		result = check_cpus(&affinity.cpus[role], description,
+				    &allowed,
+				    affinity.require_isolated ?
+				    &isolated : NULL, error);
+		free(description);
+		if (result)
+			return STATUS_ERR;
+	}
+
+	if (!affinity.has_rps_cpus)
+		return STATUS_OK;
+	if (check_cpus(&affinity.rps_cpus, "RPS", &allowed,
+		       affinity.require_isolated ? &isolated : NULL, error))
+		return STATUS_ERR;
+	if (device != NULL && steer_rps(device, error))
+		return STATUS_ERR;
+	return STATUS_OK;
+}
+
+void cpu_affinity_pin(enum cpu_role_t role)
+{
+	const cpu_set_t *cpus = NULL;
+	int result;
+
+	/* Threads the main thread starts inherit its CPUs, so put those
+	 * with no CPUs of their own back where they could run before.
+	 */
+	if (affinity.has_cpus[role])
+		cpus = &affinity.cpus[role];
+	else if (role != CPU_ROLE_MAIN && affinity.has_cpus[CPU_ROLE_MAIN] &&
+		 affinity.has_allowed)
+		cpus = &affinity.allowed;
+	else
+		return;
+	result = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+					cpus);
+	if (result != 0) {
+		errno = result;
+		die_perror("pthread_setaffinity_np");
+	}
+}
+
+#else  /* !linux */
+
+int cpu_affinity_set(enum cpu_role_t role, const char *list, char **error)
+{
+	asprintf(error, "CPU pinning is only supported on Linux");
+	return STATUS_ERR;
+}
+
+int cpu_affinity_set_rps(const char *list, char **error)
+{
+	asprintf(error, "RPS steering is only supported on Linux");
+	return STATUS_ERR;
+}
+
+void cpu_affinity_require_isolated(bool require)
+{
+}
+
+int cpu_affinity_check(const char *device, char **error)
+{
+	return STATUS_OK;
+}
+
+void cpu_affinity_pin(enum cpu_role_t role)
+{
+}
+
+#endif  /* linux */
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for pinning packetdrill's threads to chosen CPUs.
+ *
+ * Each kind of thread has a role, and each role can be given a CPU
+ * list, in the format of the kernel's cpuset lists ("0-3,5"). Each
+ * thread pins itself with cpu_affinity_pin() when it starts, so the
+ * lists must be set before the test starts its threads. Roles with no
+ * list are left to the kernel. Pinning is only supported on Linux.
+ */
+
+#ifndef __CPU_AFFINITY_H__
+#define __CPU_AFFINITY_H__
+
+#include "types.h"
+
+#ifdef linux
+#include <sched.h>
+#endif
+
+/* The kinds of threads we can pin. */
+enum cpu_role_t {
+	CPU_ROLE_MAIN,		/* the interpreter thread */
+	CPU_ROLE_SYSCALL,	/* the threads running blocking system calls */
+	CPU_ROLE_HELPER,	/* the sniffer, sampler and log writer threads */
+	NUM_CPU_ROLES,
+};
+
+#ifdef linux
+/* Parse a CPU list like "0-3,5" into *cpus. Returns STATUS_OK on
+ * success; on failure returns STATUS_ERR and sets error message.
+ */
+extern int cpu_list_parse(const char *list, cpu_set_t *cpus, char **error);
+#endif
+
+/* Pin threads with the given role to the CPUs in the given list.
+ * Returns STATUS_OK on success; on failure returns STATUS_ERR and sets
+ * error message.
+ */
+extern int cpu_affinity_set(enum cpu_role_t role, const char *list,
+			    char **error);
+
+/* Steer packet receive processing of the test's network device (RPS)
+ * to the CPUs in the given list.
+ */
+extern int cpu_affinity_set_rps(const char *list, char **error);
+
+/* If require is true, cpu_affinity_check() fails unless all the CPUs
+ * we pin threads or steer packets to are isolated from the scheduler.
+ */
+extern void cpu_affinity_require_isolated(bool require);
+
+/* Check the configured CPUs are online and, if required, isolated, and
+ * steer packet processing of the given device as configured. Returns
+ * STATUS_OK on success; on failure returns STATUS_ERR and sets error
+ * message.
+ */
+extern int cpu_affinity_check(const char *device, char **error);
+
+/* Pin the calling thread to the CPUs for its role, if there are any.
+ * A thread whose role has none, started by a pinned main thread, goes
+ * back to the CPUs the process could use before cpu_affinity_check().
+ */
+extern void cpu_affinity_pin(enum cpu_role_t role);
+
+#endif /* __CPU_AFFINITY_H__ */
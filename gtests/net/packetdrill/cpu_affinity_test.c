@@ -0,0 +1,110 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for parsing the CPU lists of cpu_affinity.c.
+ */
+
+#include "cpu_affinity.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef linux
+
+/* Check that the given list parses, to a set of num_cpus CPUs
+ * including first and last.
+ */
+static void check_list(const char *list, int num_cpus, int first, int last)
+{
+	cpu_set_t cpus;
+	char *error = NULL;
+
+	assert(cpu_list_parse(list, &cpus, &error) == STATUS_OK);
+	assert(CPU_COUNT(&cpus) == num_cpus);
+	assert(CPU_ISSET(first, &cpus));
+	assert(CPU_ISSET(last, &cpus));
+}
+
+static void check_bad_list(const char *list)
+{
+	cpu_set_t cpus;
+	char *error = NULL;
+
+	assert(cpu_list_parse(list, &cpus, &error) == STATUS_ERR);
+	assert(error != NULL);
+	free(error);
+}
+
+static void test_cpu_list_parse(void)
+{
+	check_list("0", 1, 0, 0);
+	check_list("3", 1, 3, 3);
+	check_list("0-3", 4, 0, 3);
+	check_list("1,3,5", 3, 1, 5);
+	check_list("0-1,4-7", 6, 0, 7);
+	check_list("2-2", 1, 2, 2);
+	check_list("2-5\n", 4, 2, 5);	/* as read from /sys */
+
+	check_bad_list("");
+	check_bad_list("\n");
+	check_bad_list("a");
+	check_bad_list("1,");
+	check_bad_list(",1");
+	check_bad_list("1,,2");
+	check_bad_list("3-1");
+	check_bad_list("1-");
+	check_bad_list("-1");
+	check_bad_list("1 2");
+	check_bad_list("99999");
+}
+
+static void test_set(void)
+{
+	char *error = NULL;
+
+	assert(cpu_affinity_set(CPU_ROLE_SYSCALL, "0", &error) ==
+	       STATUS_OK);
+	assert(cpu_affinity_set(CPU_ROLE_HELPER, "x", &error) == STATUS_ERR);
+	free(error);
+
+	/* CPU 0 is always there, so pinning a thread to it works. */
+	assert(cpu_affinity_set(CPU_ROLE_MAIN, "0", &error) == STATUS_OK);
+	error = NULL;
+	if (cpu_affinity_check(NULL, &error) == STATUS_OK) {
+		cpu_set_t cpus;
+
+		cpu_affinity_pin(CPU_ROLE_MAIN);
+		assert(sched_getaffinity(0, sizeof(cpus), &cpus) == 0);
+		assert(CPU_COUNT(&cpus) == 1 && CPU_ISSET(0, &cpus));
+	} else {
+		/* Our cpuset may not include CPU 0. */
+		printf("skipping pinning check: %s\n", error);
+		free(error);
+	}
+}
+
+#endif  /* linux */
+
+int main(void)
+{
+#ifdef linux
+	test_cpu_list_parse();
+	test_set();
+#endif
+	return 0;
+}
@@ -0,0 +1,806 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the long-lived local test daemon and its client.
+ */
+
+#include "daemon.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "logging.h"
+#include "netdev.h"
+#include "parse.h"
+#include "prelude.h"
+#include "results_db.h"
+#include "run.h"
+#include "run_jobs.h"
+#include "script.h"
+#include "timing_stats.h"
+#include "wire_conn.h"
+
+/* A command line received from a client. */
+struct daemon_args {
+	int argc;
+	char **argv;
+};
+
+static void daemon_args_free(struct daemon_args *args)
+{
+	int i;
+
+	for (i = 0; i < args->argc; ++i)
+		free(args->argv[i]);
+	free(args->argv);
+	memset(args, 0, sizeof(*args));
+}
+
+/* Return how many args starting at argv[i] make up one of our daemon
+ * options, as named in config.c's getopt table: 1 for "--daemon" or
+ * "--daemon_socket=PATH", 2 for "--daemon_socket PATH", or 0 if
+ * argv[i] is not a daemon option.
+ */
+static int daemon_option_args(const char **argv, int i)
+{
+	const char *arg = argv[i];
+	const struct option *option;
+	size_t len;
+
+	if (strncmp(arg, "--daemon", strlen("--daemon")) != 0)
+		return 0;
+	for (option = options; option->name != NULL; ++option) {
+		if (strncmp(option->name, "daemon", strlen("daemon")) != 0)
+			continue;
+		len = strlen(option->name);
+		if (strncmp(arg + 2, option->name, len) != 0)
+			continue;
+		if (arg[2 + len] == '=')
+			return 1;
+		if (arg[2 + len] == '\0')
+			return (option->has_arg && argv[i + 1] != NULL) ? 2 : 1;
+	}
+	return 0;
+}
+
+/* Serialize argv into a single string with '\0' characters between
+ * args, leaving out our daemon options and their values, which the
+ * daemon should not act on. Args after "--" are all kept.
+ */
+static void serialize_argv(const char **argv, char **args_ptr,
+			   int *args_len_ptr)
+{
+	const char **kept = NULL;
+	char *args = NULL, *end;
+	bool options_done = false;
+	int argc = 0, num_kept = 0, args_len = 0;
+	int i;
+
+	while (argv[argc] != NULL)
+		++argc;
+	kept = calloc(argc, sizeof(char *));
+	for (i = 0; i < argc; ) {
+		int skip = options_done ? 0 : daemon_option_args(argv, i);
+
+		if (skip > 0) {
+			i += skip;
+			continue;
+		}
+		if (strcmp(argv[i], "--") == 0)
+			options_done = true;
+		kept[num_kept++] = argv[i++];
+	}
+
+	for (i = 0; i < num_kept; ++i)
+		args_len += strlen(kept[i]) + 1;	/* + 1 for '\0' */
+
+	args = calloc(args_len, 1);
+	end = args;
+	for (i = 0; i < num_kept; ++i) {
+		int len = strlen(kept[i]) + 1;
+
+		memcpy(end, kept[i], len);
+		end += len;
+	}
+	assert(end == args + args_len);
+	free(kept);
+
+	*args_ptr = args;
+	*args_len_ptr = args_len;
+}
+
+static void unserialize_argv(struct daemon_args *args,
+			     const char *buf, int buf_len)
+{
+	const char *end = buf;
+	int i;
+
+	args->argc = 0;
+	for (i = 0; i < buf_len; ++i) {
+		if (buf[i] == '\0')
+			++args->argc;
+	}
+	args->argv = calloc(args->argc + 1, sizeof(char *));
+	for (i = 0; i < args->argc; ++i) {
+		args->argv[i] = strdup(end);
+		end += strlen(end) + 1;	/* + 1 for '\0' */
+	}
+}
+
+/* Read a message, checking it has the op we expect. */
+static int read_message(struct wire_conn *conn, enum wire_op_t expected_op,
+			void **buf, int *buf_len)
+{
+	enum wire_op_t op = WIRE_INVALID;
+
+	if (wire_conn_read(conn, &op, buf, buf_len))
+		return STATUS_ERR;
+	if (op != expected_op) {
+		fprintf(stderr, "bad daemon peer: expected %s, got %s\n",
+			wire_op_to_string(expected_op), wire_op_to_string(op));
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* Read a script's result from a daemon, and the --timing_report
+ * record the daemon sends just before it, if any, into a malloc-ed
+ * *report (or NULL).
+ */
+static int read_script_result(struct wire_conn *conn, void **buf,
+			      int *buf_len, char **report, int *report_len)
+{
+	enum wire_op_t op = WIRE_INVALID;
+
+	*report = NULL;
+	*report_len = 0;
+	if (wire_conn_read(conn, &op, buf, buf_len))
+		return STATUS_ERR;
+	if (op == WIRE_TIMING_REPORT) {
+		*report = malloc(*buf_len);
+		memcpy(*report, *buf, *buf_len);
+		*report_len = *buf_len;
+		if (wire_conn_read(conn, &op, buf, buf_len))
+			goto error;
+	}
+	if (op != WIRE_SCRIPT_RESULT) {
+		fprintf(stderr, "bad daemon peer: expected %s, got %s\n",
+			wire_op_to_string(WIRE_SCRIPT_RESULT),
+			wire_op_to_string(op));
+		goto error;
+	}
+	return STATUS_OK;
+
+error:
+	free(*report);
+	*report = NULL;
+	*report_len = 0;
+	return STATUS_ERR;
+}
+
+/* Append a --timing_report record a daemon sent to our own report. */
+static void append_timing_report(const struct config *config,
+				 const char *report, int report_len)
+{
+	char *error = NULL;
+
+	if (config->timing_report == NULL || report_len == 0)
+		return;
+	if (timing_report_write(config->timing_report, report, report_len,
+				&error)) {
+		fprintf(stderr, "timing report: %s\n", error);
+		free(error);
+	}
+}
+
+/* Body of the child running one script. Test failures call die(), so
+ * reaching the end means the script passed. Any --timing_report goes
+ * to the file at timing_path, for the daemon to send to the client.
+ */
+static void daemon_child(const struct daemon_args *args,
+			 struct netdev *netdev,
+			 const char *script_path, const char *script_buffer,
+			 const char *timing_path)
+{
+	struct config config;
+	struct script script;
+
+	if (parse_script_and_set_config(args->argc, args->argv, &config,
+					&script, script_path, script_buffer))
+		exit(EXIT_FAILURE);
+	if (config.timing_report != NULL) {
+		free(config.timing_report);
+		config.timing_report = strdup(timing_path);
+	}
+
+	/* Memory locks are not inherited across fork(). */
+	lock_memory(&config);
+	if (config.is_wire_client || config.is_wire_server)
+		die("%s: wire mode is not supported by the daemon\n",
+		    script_path);
+
+	if (!config.dry_run) {
+		run_init_scripts(&config);
+		local_netdev_reset(netdev, &config);
+		run_script_on_netdev(&config, &script, netdev);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+/* Read and remove the file at the given path, returning its contents
+ * malloc-ed in *contents.
+ */
+static void slurp_file(const char *path, char **contents, int *len)
+{
+	FILE *f = fopen(path, "r");
+	long bytes = 0;
+
+	*contents = NULL;
+	*len = 0;
+	if (f != NULL && fseek(f, 0, SEEK_END) == 0 &&
+	    (bytes = ftell(f)) > 0) {
+		*contents = malloc(bytes);
+		rewind(f);
+		*len = fread(*contents, 1, bytes, f);
+	}
+	if (f != NULL)
+		fclose(f);
+	unlink(path);
+}
+
+/* Run one script in a child, capturing its output. Returns STATUS_OK
+ * iff the script passed, and fills in the malloc-ed *output and, if
+ * the client asked for a --timing_report, the malloc-ed *report.
+ */
+static int daemon_run_script(const struct daemon_args *args,
+			     struct netdev *netdev,
+			     const char *script_path,
+			     const char *script_buffer,
+			     char **output, int *output_len,
+			     char **report, int *report_len)
+{
+	char timing_path[] = "/tmp/packetdrill_timing.XXXXXX";
+	FILE *capture = tmpfile();
+	int status = 0, fd;
+	long len;
+	pid_t pid;
+
+	if (capture == NULL)
+		die_perror("tmpfile");
+	fd = mkstemp(timing_path);
+	if (fd < 0)
+		die_perror("mkstemp");
+	close(fd);
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid < 0)
+		die_perror("fork");
+	if (pid == 0) {
+		if (dup2(fileno(capture), STDOUT_FILENO) < 0 ||
+		    dup2(fileno(capture), STDERR_FILENO) < 0)
+			die_perror("dup2");
+		daemon_child(args, netdev, script_path, script_buffer,
+			     timing_path);
+	}
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			die_perror("waitpid");
+	}
+	if (WIFSIGNALED(status))
+		fprintf(capture, "%s: killed by signal %d\n",
+			script_path, WTERMSIG(status));
+
+	fflush(capture);
+	len = ftell(capture);
+	rewind(capture);
+	*output = malloc(len + 1);
+	*output_len = fread(*output, 1, len, capture);
+	fclose(capture);
+	slurp_file(timing_path, report, report_len);
+
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ?
+		STATUS_OK : STATUS_ERR;
+}
+
+/* Serve one client until it disconnects. */
+static void daemon_serve(struct wire_conn *conn, struct netdev *netdev)
+{
+	struct daemon_args args;
+	void *buf = NULL;
+	int buf_len = -1;
+
+	if (read_message(conn, WIRE_COMMAND_LINE_ARGS, &buf, &buf_len))
+		return;
+	unserialize_argv(&args, buf, buf_len);
+
+	while (1) {
+		struct wire_script_result *result;
+		char *script_path, *script_buffer, *output = NULL;
+		char *report = NULL;
+		int output_len = 0, report_len = 0, status;
+
+		if (read_message(conn, WIRE_SCRIPT_PATH, &buf, &buf_len))
+			break;
+		script_path = strndup(buf, buf_len);
+		if (read_message(conn, WIRE_SCRIPT, &buf, &buf_len)) {
+			free(script_path);
+			break;
+		}
+		script_buffer = buf_len > 0 ? strndup(buf, buf_len) : NULL;
+
+		status = daemon_run_script(&args, netdev, script_path,
+					   script_buffer, &output,
+					   &output_len, &report, &report_len);
+
+		/* The client keeps the --timing_report, not us. */
+		if (report_len > 0)
+			wire_conn_queue(conn, WIRE_TIMING_REPORT,
+					report, report_len);
+		result = malloc(sizeof(*result) + output_len);
+		result->result = htonl(status);
+		memcpy(result->output, output, output_len);
+		status = wire_conn_write(conn, WIRE_SCRIPT_RESULT, result,
+					 sizeof(*result) + output_len);
+		free(result);
+		free(report);
+		free(output);
+		free(script_buffer);
+		free(script_path);
+		if (status)
+			break;
+	}
+
+	daemon_args_free(&args);
+}
+
+static void unix_address(const char *path, struct sockaddr_un *sun)
+{
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sun->sun_path))
+		die("daemon socket path too long: %s\n", path);
+	strcpy(sun->sun_path, path);
+}
+
+void run_daemon(struct config *config)
+{
+	struct sockaddr_un sun;
+	struct netdev *netdev;
+	int listen_fd;
+
+	finalize_config(config);
+
+	set_scheduling_priority();
+	lock_memory(config);
+	set_timer_slack(config);
+	signal(SIGPIPE, SIG_IGN);	/* clients may go away at any time */
+
+	netdev = local_netdev_new(config);
+	set_cpu_affinity(local_netdev_name(netdev));
+
+	/* Parse the prelude once, for every script's child to inherit. */
+	if (config->init_scripts != NULL)
+		prelude_get(config->init_scripts);
+
+	if (config->daemon_port != 0) {
+		/* Serve a coordinator on another host (see
+		 * run_daemon_coordinator()) over TCP.
+		 */
+		struct wire_conn *listen_conn = wire_conn_new();
+
+		wire_conn_bind_listen(listen_conn, config->daemon_port);
+		listen_fd = listen_conn->fd;
+		DEBUGP("daemon listening on port %d\n", config->daemon_port);
+	} else {
+		listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listen_fd < 0)
+			die_perror("socket(AF_UNIX)");
+		unix_address(config->daemon_socket, &sun);
+		unlink(config->daemon_socket);
+		if (bind(listen_fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+			die_perror("bind daemon socket");
+		if (listen(listen_fd, 16) < 0)
+			die_perror("listen");
+		DEBUGP("daemon listening on %s\n", config->daemon_socket);
+	}
+
+	while (1) {
+		struct wire_conn *conn;
+		int fd = accept(listen_fd, NULL, NULL);
+		int one = 1;
+
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			die_perror("accept");
+		}
+		if (config->daemon_port != 0)
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+				   &one, sizeof(one));
+		conn = wire_conn_new();
+		conn->fd = fd;
+		daemon_serve(conn, netdev);
+		wire_conn_free(conn);
+	}
+}
+
+int run_daemon_client(const struct config *config, char **paths)
+{
+	struct wire_conn *conn = wire_conn_new();
+	struct sockaddr_un sun;
+	char *args = NULL;
+	int args_len = 0, failed = 0;
+
+	conn->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (conn->fd < 0)
+		die_perror("socket(AF_UNIX)");
+	unix_address(config->daemon_socket, &sun);
+	if (connect(conn->fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+		die_perror(config->daemon_socket);
+
+	serialize_argv(config->argv, &args, &args_len);
+	if (wire_conn_write(conn, WIRE_COMMAND_LINE_ARGS, args, args_len))
+		die("error sending WIRE_COMMAND_LINE_ARGS\n");
+	free(args);
+
+	for (; *paths != NULL; ++paths) {
+		struct wire_script_result *result;
+		struct script script;
+		char *report = NULL;
+		void *buf = NULL;
+		int buf_len = -1, report_len = 0;
+
+		init_script(&script);
+		read_script(*paths, &script);
+		if (wire_conn_write(conn, WIRE_SCRIPT_PATH,
+				    *paths, strlen(*paths)) ||
+		    wire_conn_write(conn, WIRE_SCRIPT,
+				    script.buffer, script.length))
+			die("error sending script to daemon\n");
+		free(script.buffer);
+
+		if (read_script_result(conn, &buf, &buf_len,
+				       &report, &report_len) ||
+		    buf_len < sizeof(*result))
+			die("error reading result from daemon\n");
+		append_timing_report(config, report, report_len);
+		free(report);
+		result = buf;
+		fwrite(result->output, 1, buf_len - sizeof(*result), stdout);
+		fflush(stdout);
+		if (ntohl(result->result) != STATUS_OK)
+			++failed;
+	}
+
+	wire_conn_free(conn);
+	return failed;
+}
+
+/* A daemon on another host, serving a coordinator. */
+struct coordinator_worker {
+	char *name;			/* "ip:port", as given */
+	struct wire_conn *conn;		/* NULL once it has gone away */
+	int script;			/* index of script it runs, or -1 */
+	s64 start_usecs;		/* when it was sent the script */
+};
+
+/* A script for the coordinator to run. */
+struct coordinator_script {
+	char *path;
+	double history_secs;		/* last run time, or -1 if unknown */
+	int failed_on;			/* worker it failed on, or -1 */
+	u8 results_key[SHA1_DIGEST_BYTES];
+};
+
+/* Connect to the daemon at "ip:port" or "[ipv6]:port". */
+static struct wire_conn *connect_worker(const char *name)
+{
+	struct wire_conn *conn = wire_conn_new();
+	struct ip_address ip;
+	char *host = strdup(name), *colon = strrchr(host, ':');
+	int port;
+
+	if (colon == NULL || (port = atoi(colon + 1)) <= 0 || port > 65535)
+		die("bad --daemon_workers entry: %s\n", name);
+	*colon = '\0';
+	if (host[0] == '[' && colon[-1] == ']') {
+		colon[-1] = '\0';
+		ip = ipv6_parse(host + 1);
+	} else {
+		ip = ipv4_parse(host);
+	}
+	wire_conn_connect(conn, &ip, port);
+	free(host);
+	return conn;
+}
+
+/* Longest first, by past run time, so the long ones do not end up
+ * last on one worker; scripts with no history go first of all, since
+ * they may be long. Ties keep the path order.
+ */
+static int compare_scripts(const void *a, const void *b)
+{
+	const struct coordinator_script *x = a, *y = b;
+	double x_secs = x->history_secs < 0 ? 1e9 : x->history_secs;
+	double y_secs = y->history_secs < 0 ? 1e9 : y->history_secs;
+
+	if (x_secs != y_secs)
+		return x_secs > y_secs ? -1 : 1;
+	return strcmp(x->path, y->path);
+}
+
+/* Send a script to an idle worker. Returns STATUS_ERR if the worker
+ * has gone away.
+ */
+static int send_script(struct coordinator_worker *worker,
+		       struct coordinator_script *scripts, int index)
+{
+	struct script script;
+	int result;
+
+	init_script(&script);
+	read_script(scripts[index].path, &script);
+	wire_conn_queue(worker->conn, WIRE_SCRIPT_PATH,
+			scripts[index].path, strlen(scripts[index].path));
+	result = wire_conn_write(worker->conn, WIRE_SCRIPT,
+				 script.buffer, script.length);
+	free(script.buffer);
+	if (result)
+		return STATUS_ERR;
+	worker->script = index;
+	worker->start_usecs = now_usecs();
+	return STATUS_OK;
+}
+
+/* Take the next script a worker should run off the queue: the first
+ * one that did not fail on that worker, unless no other worker is
+ * left to retry it on. Returns -1 if there is none.
+ */
+static int next_script(int *queue, int *num_queued,
+		       struct coordinator_script *scripts, int worker,
+		       int num_alive)
+{
+	int i, index;
+
+	for (i = 0; i < *num_queued; ++i) {
+		if (scripts[queue[i]].failed_on != worker || num_alive == 1)
+			break;
+	}
+	if (i == *num_queued)
+		return -1;
+	index = queue[i];
+	memmove(&queue[i], &queue[i + 1], (*num_queued - i - 1) *
+		sizeof(queue[0]));
+	--*num_queued;
+	return index;
+}
+
+int run_daemon_coordinator(int argc, char *argv[], struct config *config,
+			   char **paths)
+{
+	struct coordinator_worker *workers = NULL;
+	struct coordinator_script *scripts = NULL;
+	struct results_db *db = NULL;
+	struct junit_report *junit = NULL;
+	struct pollfd *fds = NULL;
+	char **script_paths = NULL, *names, *name, *save = NULL, *args = NULL;
+	int num_workers = 0, num_alive, num_scripts, num_queued;
+	int args_len = 0, done = 0, failed = 0, flaky = 0, i;
+	int *queue;
+
+	if (config->results_db != NULL)
+		db = open_results_db(argc, argv, config, paths);
+	if (config->junit_report != NULL)
+		junit = junit_report_new();
+	num_scripts = find_script_paths(paths, &script_paths);
+	if (num_scripts == 0)
+		die("error: no *.pkt scripts found\n");
+
+	scripts = calloc(num_scripts, sizeof(*scripts));
+	for (i = 0; i < num_scripts; ++i) {
+		scripts[i].path = script_paths[i];
+		scripts[i].history_secs =
+			db ? results_db_secs(db, script_paths[i]) : -1;
+		scripts[i].failed_on = -1;
+		if (db != NULL)
+			results_db_key(db, script_paths[i],
+				       scripts[i].results_key);
+	}
+	qsort(scripts, num_scripts, sizeof(*scripts), compare_scripts);
+	queue = calloc(num_scripts, sizeof(*queue));
+	for (i = 0; i < num_scripts; ++i)
+		queue[i] = i;
+	num_queued = num_scripts;
+
+	signal(SIGPIPE, SIG_IGN);	/* workers may go away at any time */
+	serialize_argv(config->argv, &args, &args_len);
+	names = strdup(config->daemon_workers);
+	for (name = strtok_r(names, ",", &save); name != NULL;
+	     name = strtok_r(NULL, ",", &save)) {
+		struct coordinator_worker *worker;
+
+		workers = realloc(workers, (num_workers + 1) *
+				  sizeof(*workers));
+		worker = &workers[num_workers++];
+		worker->name = strdup(name);
+		worker->conn = connect_worker(name);
+		worker->script = -1;
+		if (wire_conn_write(worker->conn, WIRE_COMMAND_LINE_ARGS,
+				    args, args_len))
+			die("error sending WIRE_COMMAND_LINE_ARGS to %s\n",
+			    name);
+	}
+	free(names);
+	free(args);
+	num_alive = num_workers;
+	fds = calloc(num_workers, sizeof(*fds));
+
+	while (done < num_scripts) {
+		int num_fds = 0;
+
+		if (num_alive == 0)
+			die("error: all --daemon_workers went away\n");
+
+		/* Hand each idle worker the next script for it. */
+		for (i = 0; i < num_workers; ++i) {
+			struct coordinator_worker *worker = &workers[i];
+			int index;
+
+			while (worker->conn != NULL && worker->script < 0 &&
+			       (index = next_script(queue, &num_queued,
+						    scripts, i,
+						    num_alive)) >= 0) {
+				if (send_script(worker, scripts,
+						index) == STATUS_OK)
+					break;
+				fprintf(stderr, "worker %s went away\n",
+					worker->name);
+				wire_conn_free(worker->conn);
+				worker->conn = NULL;
+				--num_alive;
+				queue[num_queued++] = index;
+			}
+		}
+
+		for (i = 0; i < num_workers; ++i) {
+			fds[i].fd = (workers[i].script >= 0) ?
+				workers[i].conn->fd : -1;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+			if (fds[i].fd >= 0)
+				++num_fds;
+		}
+		if (num_fds == 0)
+			continue;
+		if (poll(fds, num_workers, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die_perror("poll");
+		}
+
+		for (i = 0; i < num_workers; ++i) {
+			struct coordinator_worker *worker = &workers[i];
+			struct wire_script_result *result;
+			struct coordinator_script *script;
+			char *report = NULL;
+			void *buf = NULL;
+			int buf_len = -1, report_len = 0;
+			bool passed;
+			double secs;
+
+			if (fds[i].revents == 0)
+				continue;
+			script = &scripts[worker->script];
+			worker->script = -1;
+			if (read_script_result(worker->conn, &buf, &buf_len,
+					       &report, &report_len) ||
+			    buf_len < sizeof(*result)) {
+				/* Not the script's fault: run it elsewhere. */
+				fprintf(stderr, "worker %s went away\n",
+					worker->name);
+				wire_conn_free(worker->conn);
+				worker->conn = NULL;
+				--num_alive;
+				queue[num_queued++] = script - scripts;
+				continue;
+			}
+			result = buf;
+			passed = (ntohl(result->result) == STATUS_OK);
+			secs = (now_usecs() - worker->start_usecs) / 1000000.0;
+
+			/* Give a failure one more try, on another worker. */
+			if (!passed && script->failed_on < 0 &&
+			    num_alive > 1) {
+				printf("RETRY %s (failed on %s)\n",
+				       script->path, worker->name);
+				script->failed_on = i;
+				queue[num_queued++] = script - scripts;
+				free(report);
+				continue;
+			}
+
+			++done;
+			if (passed && script->failed_on >= 0) {
+				printf("FLAKY %s (%.3f sec on %s, failed on "
+				       "%s)\n", script->path, secs,
+				       worker->name,
+				       workers[script->failed_on].name);
+				++flaky;
+			} else if (passed) {
+				printf("PASS %s (%.3f sec on %s)\n",
+				       script->path, secs, worker->name);
+			} else {
+				printf("FAIL %s (%.3f sec on %s)\n",
+				       script->path, secs, worker->name);
+				++failed;
+			}
+			if (!passed || config->verbose)
+				fwrite(result->output, 1,
+				       buf_len - sizeof(*result), stdout);
+			fflush(stdout);
+			if (db != NULL)
+				results_db_record(db, script->path,
+						  script->results_key,
+						  passed, secs);
+			/* Keep the record of the run we report. */
+			append_timing_report(config, report, report_len);
+			free(report);
+			if (junit != NULL)
+				junit_report_add(junit, script->path,
+						 passed ? JUNIT_PASSED :
+						 JUNIT_FAILED, secs,
+						 result->output,
+						 buf_len - sizeof(*result));
+		}
+	}
+
+	printf("%d scripts, %d passed (%d flaky), %d failed, on %d workers\n",
+	       num_scripts, num_scripts - failed, flaky, failed, num_workers);
+
+	for (i = 0; i < num_workers; ++i) {
+		if (workers[i].conn != NULL)
+			wire_conn_free(workers[i].conn);
+		free(workers[i].name);
+	}
+	for (i = 0; i < num_scripts; ++i)
+		free(scripts[i].path);
+	free(script_paths);
+	free(scripts);
+	free(workers);
+	free(queue);
+	free(fds);
+	if (db != NULL)
+		results_db_free(db);
+	if (junit != NULL) {
+		write_junit_report(junit, config->junit_report);
+		junit_report_free(junit);
+	}
+	return failed;
+}
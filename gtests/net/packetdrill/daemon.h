@@ -0,0 +1,67 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for the long-lived local test daemon (--daemon) and its
+ * client (--daemon_client).
+ *
+ * The daemon does the expensive per-process setup once: scheduling
+ * priority, memory locking, and creating and configuring the tun
+ * device. It then accepts connections on a UNIX socket. A client
+ * sends its command line (WIRE_COMMAND_LINE_ARGS) and then, for each
+ * script, its path (WIRE_SCRIPT_PATH) and contents (WIRE_SCRIPT; if
+ * empty, the daemon reads the path itself). The daemon runs each
+ * script in a forked child on the shared tun device and replies with
+ * a WIRE_SCRIPT_RESULT carrying the outcome and the script's output.
+ * If the client's command line asks for a --timing_report, the
+ * script's record goes first in a WIRE_TIMING_REPORT, and the client
+ * appends it to its own report file.
+ * Clients are served one at a time, since they share one device.
+ *
+ * To spread a suite over several hosts or VMs, each runs a daemon
+ * listening on a TCP port (--daemon_port) and a coordinator
+ * (--daemon_client --daemon_workers=ip:port,...) deals the scripts out
+ * over the same protocol: longest first by their run times in
+ * --results_db, each to the next worker free, and a failing script
+ * once more to a different worker, to tell flaky scripts from broken
+ * ones.
+ */
+
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include "types.h"
+
+#include "config.h"
+
+/* Set up and serve scripts forever. */
+extern void run_daemon(struct config *config);
+
+/* Send the given NULL-terminated list of scripts to the daemon, one
+ * after another, printing each one's output. Returns the number of
+ * scripts that failed.
+ */
+extern int run_daemon_client(const struct config *config, char **paths);
+
+/* Run the given NULL-terminated list of script paths, expanded as by
+ * run_jobs(), on the daemons listed in config->daemon_workers, printing
+ * each one's result. argc/argv are our command line. Returns the number
+ * of scripts that failed on every worker they ran on.
+ */
+extern int run_daemon_coordinator(int argc, char *argv[],
+				  struct config *config, char **paths);
+
+#endif /* __DAEMON_H__ */
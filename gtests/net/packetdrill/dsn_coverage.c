@@ -0,0 +1,579 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * The data stream coverage of MPTCP connections; see dsn_coverage.h.
+ */
+
+#include "dsn_coverage.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "hash_map.h"
+#include "logging.h"
+#include "prng.h"
+
+/* Most sends of a run we tell apart; runs sent more often count as
+ * sent this many times, which keeps merging them.
+ */
+#define MAX_SENDS	0xffff
+
+/* A run [start, end) of a connection's data stream, in offsets from
+ * its first byte, first sent on one subflow and sent as many times as
+ * every other byte of the run.
+ */
+struct dsn_run {
+	u64 start;
+	u64 end;
+	u32 priority;		/* heap order of the treap: above children */
+	u16 subflow;		/* index of the subflow that sent it first */
+	u16 sends;		/* times sent */
+	struct dsn_run *left;	/* runs before this one */
+	struct dsn_run *right;	/* runs after this one */
+};
+
+/* Bytes one subflow sent in one interval. */
+struct dsn_share {
+	s64 interval;		/* intervals since the connection's first */
+	u16 subflow;
+	u64 bytes;
+};
+
+/* One subflow of a connection. */
+struct dsn_subflow {
+	u32 id;
+	char *name;
+	u64 sent_bytes;
+	u64 new_bytes;
+	u64 redundant_bytes;
+	u64 reinjected_bytes;
+};
+
+/* One connection. */
+struct dsn_conn {
+	u32 id;
+	u64 idsn;
+	s64 start_usecs;		/* time of the first data sent */
+	struct dsn_run *root;
+	struct dsn_coverage_stats stats; /* all but holes and runs */
+	struct dsn_subflow *subflows;	/* few, so we search them in turn */
+	int num_subflows;
+	struct dsn_share *shares;	/* in order of interval */
+	int num_shares;
+	int max_shares;
+};
+
+/* A growable list of runs. */
+struct run_list {
+	struct dsn_run **runs;
+	int num;
+	int max;
+};
+
+struct dsn_coverage {
+	s64 interval_usecs;
+	struct prng prng;		/* for the priorities of runs */
+	struct hash_map *index;		/* connection id to index in conns */
+	struct dsn_conn **conns;
+	int num_conns;
+	int max_conns;
+	struct run_list within;		/* runs a send covers, in order */
+	struct run_list merged;		/* the same, once sent again */
+};
+
+struct dsn_coverage *dsn_coverage_new(s64 interval_usecs)
+{
+	struct dsn_coverage *coverage = calloc(1, sizeof(*coverage));
+
+	assert(interval_usecs > 0);
+	coverage->interval_usecs = interval_usecs;
+	prng_seed(&coverage->prng, 1);
+	coverage->index = hash_map_new(16);
+	return coverage;
+}
+
+static void free_runs(struct dsn_run *run)
+{
+	if (run == NULL)
+		return;
+	free_runs(run->left);
+	free_runs(run->right);
+	free(run);
+}
+
+void dsn_coverage_free(struct dsn_coverage *coverage)
+{
+	int i, j;
+
+	if (coverage == NULL)
+		return;
+	for (i = 0; i < coverage->num_conns; ++i) {
+		struct dsn_conn *conn = coverage->conns[i];
+
+		free_runs(conn->root);
+		for (j = 0; j < conn->num_subflows; ++j)
+			free(conn->subflows[j].name);
+		free(conn->subflows);
+		free(conn->shares);
+		free(conn);
+	}
+	free(coverage->conns);
+	free(coverage->within.runs);
+	free(coverage->merged.runs);
+	hash_map_free(coverage->index);
+	free(coverage);
+}
+
+static struct dsn_conn *find_conn(struct dsn_coverage *coverage, u32 id)
+{
+	u32 i;
+
+	if (hash_map_get(coverage->index, id, &i))
+		return coverage->conns[i];
+	return NULL;
+}
+
+static struct dsn_conn *add_conn(struct dsn_coverage *coverage, u32 id,
+				 u64 idsn, s64 usecs)
+{
+	struct dsn_conn *conn = NULL;
+
+	if (coverage->num_conns == coverage->max_conns) {
+		coverage->max_conns = coverage->max_conns ?
+			2 * coverage->max_conns : 4;
+		coverage->conns = realloc(coverage->conns,
+					  coverage->max_conns *
+					  sizeof(coverage->conns[0]));
+	}
+	conn = calloc(1, sizeof(*conn));
+	conn->id = id;
+	conn->idsn = idsn;
+	conn->start_usecs = usecs;
+	hash_map_set(coverage->index, id, coverage->num_conns);
+	coverage->conns[coverage->num_conns++] = conn;
+	return conn;
+}
+
+static u16 find_subflow(struct dsn_conn *conn, u32 id, const char *name)
+{
+	int i;
+
+	for (i = 0; i < conn->num_subflows; ++i)
+		if (conn->subflows[i].id == id)
+			return i;
+	assert(conn->num_subflows < 0xffff);
+	conn->subflows = realloc(conn->subflows,
+				 (conn->num_subflows + 1) *
+				 sizeof(conn->subflows[0]));
+	memset(&conn->subflows[i], 0, sizeof(conn->subflows[i]));
+	conn->subflows[i].id = id;
+	conn->subflows[i].name = strdup(name);
+	return conn->num_subflows++;
+}
+
+static struct dsn_run *new_run(struct dsn_coverage *coverage, u64 start,
+			       u64 end, u16 subflow, u16 sends)
+{
+	struct dsn_run *run = calloc(1, sizeof(*run));
+
+	run->start = start;
+	run->end = end;
+	run->priority = prng_next_u32(&coverage->prng);
+	run->subflow = subflow;
+	run->sends = sends;
+	return run;
+}
+
+/* Split a treap into the runs that start before key and the rest. */
+static void split_runs(struct dsn_run *run, u64 key,
+		       struct dsn_run **before, struct dsn_run **after)
+{
+	if (run == NULL) {
+		*before = *after = NULL;
+	} else if (run->start < key) {
+		split_runs(run->right, key, &run->right, after);
+		*before = run;
+	} else {
+		split_runs(run->left, key, before, &run->left);
+		*after = run;
+	}
+}
+
+/* Join two treaps, all of whose first's runs come before the second's. */
+static struct dsn_run *join_runs(struct dsn_run *a, struct dsn_run *b)
+{
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+	if (a->priority > b->priority) {
+		a->right = join_runs(a->right, b);
+		return a;
+	}
+	b->left = join_runs(a, b->left);
+	return b;
+}
+
+static struct dsn_run *first_run(struct dsn_run *run)
+{
+	while (run != NULL && run->left != NULL)
+		run = run->left;
+	return run;
+}
+
+static struct dsn_run *last_run(struct dsn_run *run)
+{
+	while (run != NULL && run->right != NULL)
+		run = run->right;
+	return run;
+}
+
+/* Remove and free the first run of a non-empty treap. */
+static struct dsn_run *drop_first_run(struct dsn_run *run)
+{
+	struct dsn_run *right = NULL;
+
+	if (run->left != NULL) {
+		run->left = drop_first_run(run->left);
+		return run;
+	}
+	right = run->right;
+	free(run);
+	return right;
+}
+
+/* If the last run of a treap goes on past offset, cut it in two there,
+ * and return the part from offset on.
+ */
+static struct dsn_run *cut_last_run(struct dsn_coverage *coverage,
+				    struct dsn_run *runs, u64 offset)
+{
+	struct dsn_run *last = last_run(runs), *tail = NULL;
+
+	if (last == NULL || last->end <= offset)
+		return NULL;
+	tail = new_run(coverage, offset, last->end, last->subflow,
+		       last->sends);
+	last->end = offset;
+	return tail;
+}
+
+static bool runs_agree(const struct dsn_run *a, const struct dsn_run *b)
+{
+	return a->end == b->start && a->subflow == b->subflow &&
+		a->sends == b->sends;
+}
+
+/* Add a run to the end of a list. */
+static void push_run(struct run_list *list, struct dsn_run *run)
+{
+	if (list->num == list->max) {
+		list->max = list->max ? 2 * list->max : 64;
+		list->runs = realloc(list->runs,
+				     list->max * sizeof(list->runs[0]));
+	}
+	list->runs[list->num++] = run;
+}
+
+/* Add the runs of a treap, in order, to the end of a list. */
+static void list_runs(struct run_list *list, struct dsn_run *run)
+{
+	if (run == NULL)
+		return;
+	list_runs(list, run->left);
+	push_run(list, run);
+	list_runs(list, run->right);
+}
+
+/* Add a run to the end of a list of runs in order, merging it into the
+ * last one if they agree.
+ */
+static void merge_run(struct run_list *list, struct dsn_run *run)
+{
+	struct dsn_run *last = list->num > 0 ? list->runs[list->num - 1] :
+			       NULL;
+
+	run->left = run->right = NULL;
+	if (last != NULL && runs_agree(last, run)) {
+		last->end = run->end;
+		free(run);
+		return;
+	}
+	push_run(list, run);
+}
+
+static void count_send(struct dsn_conn *conn, u16 subflow, u16 first,
+		       bool is_new, u64 bytes)
+{
+	struct dsn_subflow *s = &conn->subflows[subflow];
+
+	s->sent_bytes += bytes;
+	conn->stats.sent_bytes += bytes;
+	if (is_new) {
+		s->new_bytes += bytes;
+		conn->stats.new_bytes += bytes;
+		return;
+	}
+	s->redundant_bytes += bytes;
+	conn->stats.redundant_bytes += bytes;
+	if (first != subflow) {
+		s->reinjected_bytes += bytes;
+		conn->stats.reinjected_bytes += bytes;
+	}
+}
+
+/* Mark [start, end) of the connection's stream as sent once more, by
+ * the given subflow.
+ */
+static void cover(struct dsn_coverage *coverage, struct dsn_conn *conn,
+		  u16 subflow, u64 start, u64 end)
+{
+	struct run_list *within_list = &coverage->within;
+	struct run_list *merged = &coverage->merged;
+	struct dsn_run *before = NULL, *within = NULL, *after = NULL;
+	struct dsn_run *tail = NULL, *last = NULL, *first = NULL;
+	u64 pos = start;
+	int i, skip = 0;
+
+	/* Split the treap into the runs before, within and after the
+	 * range, cutting in two the runs that straddle its ends.
+	 */
+	split_runs(conn->root, start, &before, &within);
+	tail = cut_last_run(coverage, before, start);
+	if (tail != NULL)
+		within = join_runs(tail, within);
+	split_runs(within, end, &within, &after);
+	tail = cut_last_run(coverage, within, end);
+	if (tail != NULL)
+		after = join_runs(tail, after);
+
+	/* Count each run within as sent again, and fill the gaps between
+	 * them with runs of new data.
+	 */
+	within_list->num = 0;
+	list_runs(within_list, within);
+	merged->num = 0;
+	for (i = 0; i < within_list->num; ++i) {
+		struct dsn_run *run = within_list->runs[i];
+
+		if (run->start > pos) {
+			count_send(conn, subflow, subflow, true,
+				   run->start - pos);
+			merge_run(merged, new_run(coverage, pos, run->start,
+						  subflow, 1));
+		}
+		count_send(conn, subflow, run->subflow, false,
+			   run->end - run->start);
+		if (run->sends < MAX_SENDS)
+			++run->sends;
+		pos = run->end;
+		merge_run(merged, run);
+	}
+	if (pos < end) {
+		count_send(conn, subflow, subflow, true, end - pos);
+		merge_run(merged, new_run(coverage, pos, end, subflow, 1));
+	}
+
+	/* Merge the range's runs into their neighbours where they agree. */
+	last = last_run(before);
+	if (last != NULL && runs_agree(last, merged->runs[0])) {
+		last->end = merged->runs[0]->end;
+		free(merged->runs[0]);
+		skip = 1;
+	}
+	first = first_run(after);
+	if (first != NULL && skip < merged->num &&
+	    runs_agree(merged->runs[merged->num - 1], first)) {
+		first->start = merged->runs[merged->num - 1]->start;
+		free(merged->runs[--merged->num]);
+	} else if (first != NULL && skip == merged->num && last != NULL &&
+		   runs_agree(last, first)) {
+		last->end = first->end;
+		after = drop_first_run(after);
+	}
+
+	within = NULL;
+	for (i = skip; i < merged->num; ++i)
+		within = join_runs(within, merged->runs[i]);
+	conn->root = join_runs(join_runs(before, within), after);
+}
+
+/* Add bytes a subflow sent at the given time to its share. Sends
+ * stamped before the last interval we have count in that interval.
+ */
+static void add_share(struct dsn_coverage *coverage, struct dsn_conn *conn,
+		      u16 subflow, u64 bytes, s64 usecs)
+{
+	s64 interval = (usecs - conn->start_usecs) / coverage->interval_usecs;
+	struct dsn_share *share = NULL;
+	int i;
+
+	if (conn->num_shares > 0 &&
+	    interval < conn->shares[conn->num_shares - 1].interval)
+		interval = conn->shares[conn->num_shares - 1].interval;
+	for (i = conn->num_shares - 1;
+	     i >= 0 && conn->shares[i].interval == interval; --i) {
+		if (conn->shares[i].subflow == subflow) {
+			conn->shares[i].bytes += bytes;
+			return;
+		}
+	}
+	if (conn->num_shares == conn->max_shares) {
+		conn->max_shares = conn->max_shares ?
+			2 * conn->max_shares : 64;
+		conn->shares = realloc(conn->shares,
+				       conn->max_shares *
+				       sizeof(conn->shares[0]));
+	}
+	share = &conn->shares[conn->num_shares++];
+	share->interval = interval;
+	share->subflow = subflow;
+	share->bytes = bytes;
+}
+
+void dsn_coverage_record(struct dsn_coverage *coverage,
+			 u32 conn_id, u64 idsn, u32 subflow_id,
+			 const char *subflow_name, u32 dsn, u32 len,
+			 s64 usecs)
+{
+	struct dsn_conn *conn = find_conn(coverage, conn_id);
+	u64 base, end_dsn, offset;
+	u16 subflow;
+
+	if (len == 0)
+		return;
+	if (conn == NULL)
+		conn = add_conn(coverage, conn_id, idsn, usecs);
+
+	/* Widen the DSN to 64 bits next to the highest data so far. The
+	 * stream starts at the byte after the IDSN.
+	 */
+	base = conn->idsn + 1;
+	end_dsn = base + conn->stats.end;
+	offset = end_dsn + (s32)(dsn - (u32)end_dsn) - base;
+	if ((s64)offset < 0)
+		return;		/* before the stream: not a mapping of ours */
+
+	subflow = find_subflow(conn, subflow_id, subflow_name);
+	cover(coverage, conn, subflow, offset, offset + len);
+	if (offset + len > conn->stats.end)
+		conn->stats.end = offset + len;
+	add_share(coverage, conn, subflow, len, usecs);
+}
+
+/* Count the runs and the holes between them, in order. */
+static void walk_runs(const struct dsn_run *run, u64 *pos,
+		      struct dsn_coverage_stats *stats)
+{
+	if (run == NULL)
+		return;
+	walk_runs(run->left, pos, stats);
+	if (run->start > *pos) {
+		++stats->num_holes;
+		stats->hole_bytes += run->start - *pos;
+	}
+	++stats->num_runs;
+	*pos = run->end;
+	walk_runs(run->right, pos, stats);
+}
+
+static void conn_stats(const struct dsn_conn *conn,
+		       struct dsn_coverage_stats *stats)
+{
+	u64 pos = 0;
+
+	*stats = conn->stats;
+	stats->num_holes = 0;
+	stats->hole_bytes = 0;
+	stats->num_runs = 0;
+	walk_runs(conn->root, &pos, stats);
+}
+
+bool dsn_coverage_get_stats(struct dsn_coverage *coverage, u32 conn_id,
+			    struct dsn_coverage_stats *stats)
+{
+	struct dsn_conn *conn = find_conn(coverage, conn_id);
+
+	if (conn == NULL)
+		return false;
+	conn_stats(conn, stats);
+	return true;
+}
+
+static double percent(u64 part, u64 whole)
+{
+	return whole ? 100.0 * part / whole : 0;
+}
+
+/* Print each interval's split of the bytes sent among the subflows. */
+static void report_shares(const struct dsn_coverage *coverage,
+			  const struct dsn_conn *conn, FILE *out)
+{
+	int i, j;
+
+	fprintf(out, "  share of bytes sent per %.3f sec:\n",
+		coverage->interval_usecs / 1.0e6);
+	for (i = 0; i < conn->num_shares; i = j) {
+		u64 total = 0;
+
+		for (j = i; j < conn->num_shares &&
+		     conn->shares[j].interval == conn->shares[i].interval;
+		     ++j)
+			total += conn->shares[j].bytes;
+		fprintf(out, "    %8.3f",
+			conn->shares[i].interval *
+			coverage->interval_usecs / 1.0e6);
+		for (j = i; j < conn->num_shares &&
+		     conn->shares[j].interval == conn->shares[i].interval;
+		     ++j)
+			fprintf(out, "  %s %.1f%%",
+				conn->subflows[conn->shares[j].subflow].name,
+				percent(conn->shares[j].bytes, total));
+		fprintf(out, "\n");
+	}
+}
+
+void dsn_coverage_report(struct dsn_coverage *coverage, FILE *out)
+{
+	struct dsn_coverage_stats stats;
+	int i, j;
+
+	for (i = 0; i < coverage->num_conns; ++i) {
+		const struct dsn_conn *conn = coverage->conns[i];
+
+		conn_stats(conn, &stats);
+		fprintf(out, "dsn coverage of MPTCP connection %08x:\n"
+			"  %llu bytes sent, %llu new, %llu redundant "
+			"(%.1f%%), %llu reinjected; %u holes of %llu bytes; "
+			"%u runs\n", conn->id, stats.sent_bytes,
+			stats.new_bytes, stats.redundant_bytes,
+			percent(stats.redundant_bytes, stats.sent_bytes),
+			stats.reinjected_bytes, stats.num_holes,
+			stats.hole_bytes, stats.num_runs);
+		fprintf(out, "  %-24s %12s %12s %12s %12s %8s\n", "subflow",
+			"sent", "new", "redundant", "reinjected", "share");
+		for (j = 0; j < conn->num_subflows; ++j) {
+			const struct dsn_subflow *s = &conn->subflows[j];
+
+			fprintf(out, "  %-24s %12llu %12llu %12llu %12llu "
+				"%7.1f%%\n", s->name, s->sent_bytes,
+				s->new_bytes, s->redundant_bytes,
+				s->reinjected_bytes,
+				percent(s->sent_bytes, stats.sent_bytes));
+		}
+		report_shares(coverage, conn, out);
+	}
+}
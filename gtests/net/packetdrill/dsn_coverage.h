@@ -0,0 +1,83 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * For --dsn_coverage, where in each MPTCP connection's data stream the
+ * kernel sent data, and on which subflow, built from the DSS mappings
+ * of the outbound packets we sniff. It shows how well the scheduler
+ * spends the subflows:
+ * - how many bytes it sent more than once (redundant);
+ * - how many of those went on a subflow other than the first one
+ *   (reinjected);
+ * - what holes in the data stream are left;
+ * - each subflow's share of the bytes sent over time.
+ *
+ * Each connection's coverage is a set of runs of the data stream that
+ * were first sent on the same subflow and sent the same number of
+ * times. The runs are kept in a treap keyed by where they start, so
+ * each packet costs O(log runs). Neighbouring runs that come to agree
+ * merge, so an in-order transfer costs a run per switch of subflow,
+ * however long it is.
+ */
+
+#ifndef __DSN_COVERAGE_H__
+#define __DSN_COVERAGE_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+struct dsn_coverage;
+
+/* What was sent on one connection, in bytes of its data stream. */
+struct dsn_coverage_stats {
+	u64 sent_bytes;		/* everything sent, resent data included */
+	u64 new_bytes;		/* data sent for the first time */
+	u64 redundant_bytes;	/* data sent again, on any subflow */
+	u64 reinjected_bytes;	/* data sent again on another subflow */
+	u64 end;		/* stream offset just past the highest data */
+	u32 num_holes;		/* gaps below end never sent */
+	u64 hole_bytes;
+	u32 num_runs;		/* runs in the treap */
+};
+
+/* Return a new tracker that splits each subflow's share into intervals
+ * of the given length.
+ */
+extern struct dsn_coverage *dsn_coverage_new(s64 interval_usecs);
+extern void dsn_coverage_free(struct dsn_coverage *coverage);
+
+/* Record that at the given time the kernel sent len bytes from the
+ * given low 32 bits of a DSN, on the subflow with the given id and
+ * name (e.g. "8080>49152") of the connection with the given id, whose
+ * data stream starts after idsn.
+ */
+extern void dsn_coverage_record(struct dsn_coverage *coverage,
+				u32 conn_id, u64 idsn, u32 subflow_id,
+				const char *subflow_name, u32 dsn, u32 len,
+				s64 usecs);
+
+/* Fill in what was sent on the connection with the given id. Returns
+ * false if nothing was.
+ */
+extern bool dsn_coverage_get_stats(struct dsn_coverage *coverage,
+				   u32 conn_id,
+				   struct dsn_coverage_stats *stats);
+
+/* Print each connection's stats, and each subflow's share of it. */
+extern void dsn_coverage_report(struct dsn_coverage *coverage, FILE *out);
+
+#endif /* __DSN_COVERAGE_H__ */
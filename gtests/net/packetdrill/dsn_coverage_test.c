@@ -0,0 +1,173 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for dsn_coverage.c: the stats of random sends match those
+ * counted byte by byte, and in-order data stays a few runs.
+ */
+
+#include "dsn_coverage.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "prng.h"
+
+#define CONN		0x1234
+#define IDSN		1000ULL
+
+static void test_in_order(void)
+{
+	struct dsn_coverage *coverage = dsn_coverage_new(100000);
+	struct dsn_coverage_stats stats;
+	u32 dsn = IDSN + 1;
+	int i;
+
+	/* A long transfer on one subflow, then on two in turn. */
+	for (i = 0; i < 100000; ++i, dsn += 1000)
+		dsn_coverage_record(coverage, CONN, IDSN, 1, "a", dsn, 1000,
+				    i * 10);
+	for (i = 0; i < 10; ++i, dsn += 1000)
+		dsn_coverage_record(coverage, CONN, IDSN, 1 + (i % 2),
+				    i % 2 ? "b" : "a", dsn, 1000,
+				    1000000 + i * 10);
+	assert(dsn_coverage_get_stats(coverage, CONN, &stats));
+	assert(stats.sent_bytes == 100010000ULL);
+	assert(stats.new_bytes == stats.sent_bytes);
+	assert(stats.redundant_bytes == 0);
+	assert(stats.num_holes == 0);
+	assert(stats.end == 100010000ULL);
+	assert(stats.num_runs == 10);
+	assert(!dsn_coverage_get_stats(coverage, CONN + 1, &stats));
+	dsn_coverage_free(coverage);
+}
+
+static void test_reinject_and_holes(void)
+{
+	struct dsn_coverage *coverage = dsn_coverage_new(100000);
+	struct dsn_coverage_stats stats;
+
+	dsn_coverage_record(coverage, CONN, IDSN, 1, "a", IDSN + 1, 1000, 0);
+	dsn_coverage_record(coverage, CONN, IDSN, 1, "a", IDSN + 2001, 1000,
+			    0);
+	assert(dsn_coverage_get_stats(coverage, CONN, &stats));
+	assert(stats.num_holes == 1 && stats.hole_bytes == 1000);
+
+	/* The same subflow resends some; another reinjects some. */
+	dsn_coverage_record(coverage, CONN, IDSN, 1, "a", IDSN + 501, 500, 0);
+	dsn_coverage_record(coverage, CONN, IDSN, 2, "b", IDSN + 801, 1400,
+			    0);
+	assert(dsn_coverage_get_stats(coverage, CONN, &stats));
+	assert(stats.redundant_bytes == 500 + 200 + 200);
+	assert(stats.reinjected_bytes == 200 + 200);
+	assert(stats.new_bytes == 3000);
+	assert(stats.num_holes == 0);
+
+	/* Sent once more, the whole range ends up as a few runs again. */
+	dsn_coverage_record(coverage, CONN, IDSN, 1, "a", IDSN + 1, 3000, 0);
+	assert(dsn_coverage_get_stats(coverage, CONN, &stats));
+	assert(stats.sent_bytes == 2000 + 500 + 1400 + 3000);
+	dsn_coverage_free(coverage);
+}
+
+/* DSNs go past 2^32 and wrap; the stream stays contiguous. */
+static void test_wrap(void)
+{
+	struct dsn_coverage *coverage = dsn_coverage_new(100000);
+	struct dsn_coverage_stats stats;
+	u64 idsn = 0xfffff000ULL;
+	u32 dsn = idsn + 1;
+	int i;
+
+	for (i = 0; i < 10; ++i, dsn += 1000)
+		dsn_coverage_record(coverage, CONN, idsn, 1, "a", dsn, 1000,
+				    0);
+	assert(dsn_coverage_get_stats(coverage, CONN, &stats));
+	assert(stats.end == 10000 && stats.num_runs == 1);
+	assert(stats.num_holes == 0);
+	dsn_coverage_free(coverage);
+}
+
+/* Random sends on three subflows, against counts kept per byte. */
+static void test_random(void)
+{
+	enum { STREAM = 20000, SENDS = 3000 };
+	struct dsn_coverage *coverage = dsn_coverage_new(1000);
+	struct dsn_coverage_stats stats;
+	static u16 sends[STREAM];
+	static u8 first[STREAM];
+	static const char *names[] = { "a", "b", "c" };
+	u64 sent = 0, redundant = 0, reinjected = 0, hole_bytes = 0;
+	u32 holes = 0, end = 0;
+	struct prng prng;
+	char *text = NULL;
+	size_t text_len = 0;
+	FILE *out = NULL;
+	int i, j;
+
+	prng_seed(&prng, 42);
+	for (i = 0; i < SENDS; ++i) {
+		u32 start = prng_below(&prng, STREAM - 1);
+		u32 len = 1 + prng_below(&prng, min(1500U, STREAM - start));
+		u8 subflow = prng_below(&prng, 3);
+
+		dsn_coverage_record(coverage, CONN, IDSN, subflow,
+				    names[subflow], IDSN + 1 + start, len,
+				    i * 100);
+		for (j = start; j < start + len; ++j) {
+			++sent;
+			if (sends[j]++ == 0) {
+				first[j] = subflow;
+				continue;
+			}
+			++redundant;
+			if (first[j] != subflow)
+				++reinjected;
+		}
+		end = max(end, start + len);
+	}
+	for (j = 0; j < end; ++j)
+		if (sends[j] == 0) {
+			hole_bytes++;
+			if (j == 0 || sends[j - 1] != 0)
+				++holes;
+		}
+
+	assert(dsn_coverage_get_stats(coverage, CONN, &stats));
+	assert(stats.sent_bytes == sent);
+	assert(stats.redundant_bytes == redundant);
+	assert(stats.reinjected_bytes == reinjected);
+	assert(stats.new_bytes == sent - redundant);
+	assert(stats.end == end);
+	assert(stats.num_holes == holes);
+	assert(stats.hole_bytes == hole_bytes);
+	out = open_memstream(&text, &text_len);
+	dsn_coverage_report(coverage, out);
+	fclose(out);
+	assert(strstr(text, "dsn coverage of MPTCP connection 00001234:"));
+	assert(strstr(text, "share of bytes sent per 0.001 sec:"));
+	free(text);
+	dsn_coverage_free(coverage);
+}
+
+int main(void)
+{
+	test_in_order();
+	test_reinject_and_holes();
+	test_wrap();
+	test_random();
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation for the epoll loop of --scheduler=epoll.
+ */
+
+#include "event_loop.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+#include "time_source.h"
+
+#ifdef linux
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+struct event_loop {
+	int epoll_fd;
+	int timer_fd;		/* CLOCK_MONOTONIC */
+	int completion_fd;	/* eventfd counting completions */
+};
+
+static void add_fd(struct event_loop *loop, int fd)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+		die_perror("epoll_ctl");
+}
+
+struct event_loop *event_loop_new(void)
+{
+	struct event_loop *loop = calloc(1, sizeof(struct event_loop));
+
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0)
+		die_perror("epoll_create1");
+	loop->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					TFD_NONBLOCK | TFD_CLOEXEC);
+	if (loop->timer_fd < 0)
+		die_perror("timerfd_create");
+	loop->completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (loop->completion_fd < 0)
+		die_perror("eventfd");
+	add_fd(loop, loop->timer_fd);
+	add_fd(loop, loop->completion_fd);
+	return loop;
+}
+
+void event_loop_free(struct event_loop *loop)
+{
+	close(loop->completion_fd);
+	close(loop->timer_fd);
+	close(loop->epoll_fd);
+	memset(loop, 0, sizeof(*loop));  /* paranoia to help catch bugs */
+	free(loop);
+}
+
+void event_loop_complete(struct event_loop *loop)
+{
+	u64 one = 1;
+
+	if (write(loop->completion_fd, &one, sizeof(one)) < 0 &&
+	    errno != EAGAIN)
+		die_perror("eventfd write");
+}
+
+/* Arm the timer for the given time of the --clock clock, which need
+ * not be one a timerfd can use, as the same moment of CLOCK_MONOTONIC.
+ */
+static void arm_timer(struct event_loop *loop, s64 deadline_usecs)
+{
+	struct itimerspec timer;
+	struct timespec now;
+	s64 delay_nsecs = deadline_usecs * 1000 - time_now_nsecs();
+	s64 deadline_nsecs;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+		die_perror("clock_gettime");
+	deadline_nsecs = timespec_to_nsecs(&now) + max(delay_nsecs, 1);
+
+	memset(&timer, 0, sizeof(timer));
+	timer.it_value.tv_sec = deadline_nsecs / 1000000000LL;
+	timer.it_value.tv_nsec = deadline_nsecs % 1000000000LL;
+	if (timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME,
+			    &timer, NULL) < 0)
+		die_perror("timerfd_settime");
+}
+
+/* Consume the count of the given nonblocking timer or event fd.
+ * Returns true if it was nonzero.
+ */
+static bool drain_fd(int fd)
+{
+	u64 count = 0;
+
+	if (read(fd, &count, sizeof(count)) < 0) {
+		if (errno == EAGAIN)
+			return false;
+		die_perror("event loop read");
+	}
+	return count > 0;
+}
+
+enum event_loop_wakeup_t event_loop_wait(struct event_loop *loop,
+					 s64 deadline_usecs)
+{
+	struct epoll_event events[2];
+	bool completed = false, expired = false;
+	int i, n;
+
+	arm_timer(loop, deadline_usecs);
+	while (!completed && !expired) {
+		n = epoll_wait(loop->epoll_fd, events, 2, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			die_perror("epoll_wait");
+		}
+		for (i = 0; i < n; ++i) {
+			if (events[i].data.fd == loop->completion_fd)
+				completed |= drain_fd(loop->completion_fd);
+			else if (events[i].data.fd == loop->timer_fd)
+				expired |= drain_fd(loop->timer_fd);
+		}
+	}
+	return completed ? EVENT_LOOP_COMPLETION : EVENT_LOOP_DEADLINE;
+}
+
+#else  /* !linux */
+
+struct event_loop *event_loop_new(void)
+{
+	die("--scheduler=epoll is only supported on Linux\n");
+	return NULL;
+}
+
+void event_loop_free(struct event_loop *loop)
+{
+}
+
+void event_loop_complete(struct event_loop *loop)
+{
+}
+
+enum event_loop_wakeup_t event_loop_wait(struct event_loop *loop,
+					 s64 deadline_usecs)
+{
+	return EVENT_LOOP_DEADLINE;
+}
+
+#endif  /* linux */
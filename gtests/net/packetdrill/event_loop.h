@@ -0,0 +1,65 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for the epoll loop the interpreter thread waits in with
+ * --scheduler=epoll.
+ *
+ * The loop waits on a timerfd armed for a deadline (the time of the
+ * next event, or the end of a wait for a system call thread) and on
+ * an eventfd that system call threads signal when a blocking call
+ * completes. So every wait the interpreter thread does, for time to
+ * pass or for a call to return, is one epoll_wait() that costs no CPU,
+ * and a completion wakes it at once rather than when a condition
+ * variable's waiter gets scheduled.
+ *
+ * Linux only; elsewhere, event_loop_new() dies.
+ */
+
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include "types.h"
+
+struct event_loop;
+
+/* What ended a call to event_loop_wait(). */
+enum event_loop_wakeup_t {
+	EVENT_LOOP_DEADLINE,	/* the deadline passed */
+	EVENT_LOOP_COMPLETION,	/* event_loop_complete() was called */
+};
+
+/* Allocate a loop with its epoll, timer and event fds. */
+extern struct event_loop *event_loop_new(void);
+
+/* Close the loop's fds and free it. */
+extern void event_loop_free(struct event_loop *loop);
+
+/* Wake the thread waiting in the loop, or the next one to wait, to say
+ * that some work it may be waiting for is done. Any thread may call
+ * this.
+ */
+extern void event_loop_complete(struct event_loop *loop);
+
+/* Block until the given time in microseconds (as from
+ * now_usecs()) or until the next completion, whichever comes first.
+ * Completions signaled before the call also end it, so none are lost
+ * between a caller's check of what it waits for and its wait.
+ */
+extern enum event_loop_wakeup_t event_loop_wait(struct event_loop *loop,
+						s64 deadline_usecs);
+
+#endif /* __EVENT_LOOP_H__ */
@@ -1,7 +1,6 @@
 #!/bin/bash
 for f in `find . -name "*.pkt" | sort`; do
   echo "Running $f ..."
-  ip tcp_metrics flush all > /dev/null 2>&1
-  ../../packetdrill $f --tolerance_usecs 10000
+  ../../packetdrill --reset_kernel_state $f --tolerance_usecs 10000
 done
 
@@ -0,0 +1,979 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of fuzzing the kernel under test with mutated copies
+ * of the TCP and MPTCP packets a script injected.
+ */
+
+#include "fuzz.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "hash.h"
+#include "logging.h"
+#include "mptcp.h"
+#include "packet_checksum.h"
+#include "packet_trace.h"
+#include "tcp.h"
+#include "tcp_options_iterator.h"
+#include "tcp_packet.h"
+
+/* Most options of one packet we look at when picking one to mutate. */
+#define MAX_OPTIONS	20
+
+/* Lengths a DSS, MP_JOIN or ADD_ADDR option may legally have, so that
+ * a mutated length is often one the kernel parses as another format.
+ */
+static const u8 dss_lengths[] = {
+	TCPOLEN_DSS_DACK4, TCPOLEN_DSS_DACK8, TCPOLEN_DSS_DSN4,
+	TCPOLEN_DSS_DSN4_WOCS, TCPOLEN_DSS_DSN8, TCPOLEN_DSS_DSN8_WOCS,
+	TCPOLEN_DSS_DACK4_DSN4, TCPOLEN_DSS_DACK4_DSN8,
+	TCPOLEN_DSS_DACK8_DSN8, TCPOLEN_DSS_DACK4_DSN4_WOCS,
+	TCPOLEN_DSS_DACK4_DSN8_WOCS, TCPOLEN_DSS_DACK8_DSN8_WOCS,
+};
+static const u8 mp_join_lengths[] = {
+	TCPOLEN_MP_JOIN_SYN, TCPOLEN_MP_JOIN_SYN_ACK, TCPOLEN_MP_JOIN_ACK,
+};
+static const u8 add_addr_lengths[] = {
+	TCPOLEN_ADD_ADDR_V4, TCPOLEN_ADD_ADDR_V4_PORT,
+	TCPOLEN_ADD_ADDR_V6, TCPOLEN_ADD_ADDR_V6_PORT,
+	TCPOLEN_ADD_ADDR_V4_HMAC, TCPOLEN_ADD_ADDR_V4_PORT_HMAC,
+	TCPOLEN_ADD_ADDR_V6_HMAC, TCPOLEN_ADD_ADDR_V6_PORT_HMAC,
+};
+static const u8 mp_fail_lengths[] = { TCPOLEN_MP_FAIL };
+static const u8 mp_fastclose_lengths[] = { TCPOLEN_MP_FASTCLOSE };
+
+/* Values at the edges of 32-bit sequence and mapping arithmetic. */
+static const u32 edge_values[] = {
+	0, 1, 0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff,
+};
+
+/* Kernel log messages that mean the kernel crashed or locked up. */
+static const char *const crash_messages[] = {
+	"BUG:", "WARNING:", "Oops", "general protection fault",
+	"KASAN:", "UBSAN:", "Kernel panic",
+};
+static const char *const lockup_messages[] = {
+	"soft lockup", "hard LOCKUP", "self-detected stall",
+	"blocked for more than",
+};
+
+struct fuzzer *fuzzer_new(struct prng *prng)
+{
+	struct fuzzer *fuzzer = calloc(1, sizeof(struct fuzzer));
+
+	fuzzer->prng = prng;
+	fuzzer->kmsg_fd = -1;
+	fuzzer->probe_fd = -1;
+	return fuzzer;
+}
+
+void fuzzer_free(struct fuzzer *fuzzer)
+{
+	int i;
+
+	for (i = 0; i < fuzzer->num_seeds; ++i)
+		packet_free(fuzzer->seeds[i].packet);
+	for (i = 0; i < fuzzer->num_corpus; ++i)
+		packet_free(fuzzer->corpus[i].packet);
+	free(fuzzer->corpus);
+	kcov_free(fuzzer->kcov);
+	if (fuzzer->kmsg_fd >= 0)
+		close(fuzzer->kmsg_fd);
+	memset(fuzzer, 0, sizeof(*fuzzer));  /* paranoia to help catch bugs */
+	free(fuzzer);
+}
+
+void fuzzer_add_seed(struct fuzzer *fuzzer, const struct packet *live_packet,
+		     u32 seq_offset, u32 ack_offset)
+{
+	struct fuzz_seed *seed = &fuzzer->seeds[fuzzer->next_seed];
+
+	if (live_packet->tcp == NULL)
+		return;
+
+	if (fuzzer->num_seeds < FUZZ_MAX_SEEDS)
+		++fuzzer->num_seeds;
+	else
+		packet_free(seed->packet);
+	/* Our copy must not outlive the pool of the live packet. */
+	seed->packet = packet_pool_copy(NULL, (struct packet *)live_packet);
+	seed->seq_offset = seq_offset;
+	seed->ack_offset = ack_offset;
+	fuzzer->next_seed = (fuzzer->next_seed + 1) % FUZZ_MAX_SEEDS;
+}
+
+void fuzzer_set_script(struct fuzzer *fuzzer, const char *script,
+		       int script_length)
+{
+	fuzzer->script = script;
+	fuzzer->script_length = script_length;
+}
+
+/* Return the seed we added last. */
+static const struct packet *newest_seed(const struct fuzzer *fuzzer)
+{
+	assert(fuzzer->num_seeds > 0);
+	return fuzzer->seeds[(fuzzer->next_seed + FUZZ_MAX_SEEDS - 1) %
+			     FUZZ_MAX_SEEDS].packet;
+}
+
+/* Choose one of the mutators from first to last, each in proportion
+ * to one more than the number of times it found new kernel code, and
+ * note that the variant used it. Without coverage, this is uniform.
+ */
+static enum fuzz_mutator_t pick_mutator(struct fuzzer *fuzzer,
+					enum fuzz_mutator_t first,
+					enum fuzz_mutator_t last)
+{
+	u32 total = 0, r;
+	int m;
+
+	for (m = first; m <= last; ++m)
+		total += 1 + fuzzer->hits[m];
+	r = prng_below(fuzzer->prng, total);
+	for (m = first; m < last; ++m) {
+		if (r < 1 + fuzzer->hits[m])
+			break;
+		r -= 1 + fuzzer->hits[m];
+	}
+	fuzzer->last_mutators |= 1U << m;
+	return m;
+}
+
+/* Return a random entry of a table of bytes. */
+#define PICK(prng, table)	((table)[prng_below((prng), ARRAY_SIZE(table))])
+
+/* Return a 32-bit value near the given one, or at an edge. */
+static u32 near_value(struct prng *prng, u32 value)
+{
+	u32 delta;
+
+	if (prng_below(prng, 8) == 0)
+		return PICK(prng, edge_values);
+	delta = prng_below(prng, 1U << prng_below(prng, 21));
+	return prng_below(prng, 2) ? value + delta : value - delta;
+}
+
+/* Overwrite a random run of up to 4 bytes in [start, end) of buf. */
+static void scribble(struct prng *prng, u8 *buf, int start, int end)
+{
+	u32 value = prng_next_u32(prng);
+	int offset, bytes;
+
+	if (end <= start)
+		return;
+	offset = start + prng_below(prng, end - start);
+	bytes = min(4, end - offset);
+	memcpy(buf + offset, &value, bytes);
+}
+
+static void mutate_tcp_header(struct fuzzer *fuzzer, struct packet *packet)
+{
+	struct prng *prng = fuzzer->prng;
+	const struct tcp *newest = newest_seed(fuzzer)->tcp;
+	struct tcp *tcp = packet->tcp;
+
+	switch (pick_mutator(fuzzer, MUTATE_TCP_FLAGS, MUTATE_TCP_SEQ_ACK)) {
+	case MUTATE_TCP_FLAGS:
+		/* flip one of FIN, SYN, RST, PSH, ACK, URG, ECE, CWR */
+		((u8 *)tcp)[13] ^= 1 << prng_below(prng, 8);
+		break;
+	case MUTATE_TCP_WINDOW:
+		tcp->window = htons(near_value(prng, ntohs(tcp->window)));
+		break;
+	case MUTATE_TCP_URG_PTR:
+		tcp->urg_ptr = htons(prng_next_u32(prng));
+		break;
+	case MUTATE_TCP_SEQ_ACK:
+		/* land near where the connection is now */
+		tcp->seq = htonl(near_value(prng, ntohl(newest->seq)));
+		tcp->ack_seq = htonl(near_value(prng, ntohl(newest->ack_seq)));
+		break;
+	default:
+		assert(!"bad TCP header mutator");
+	}
+}
+
+/* Return a length for an option with room bytes to its end of options:
+ * usually a legal length of its kind, sometimes any length that fits.
+ */
+static u8 mutated_length(struct prng *prng, const u8 *lengths,
+			 int num_lengths, int room)
+{
+	u8 length = lengths[prng_below(prng, num_lengths)];
+
+	if (length > room || prng_below(prng, 4) == 0)
+		length = prng_below(prng, room + 1);
+	return length;
+}
+
+/* Mutate one MPTCP option, with room bytes from its start to the end
+ * of the TCP options, in place. We write bytes rather than fields,
+ * since what we write need not be a well-formed option of any kind.
+ */
+static void mutate_mptcp_option(struct fuzzer *fuzzer, u8 *option, int room)
+{
+	struct prng *prng = fuzzer->prng;
+	int subtype = option[2] >> 4;
+	int end = min(option[1], room);
+	enum fuzz_mutator_t mutator;
+
+	if (prng_below(prng, 8) == 0) {
+		/* Make it an option of another subtype. */
+		fuzzer->last_mutators |= 1U << MUTATE_MPTCP_SUBTYPE;
+		option[2] = (prng_below(prng, 16) << 4) | (option[2] & 0xf);
+		return;
+	}
+	switch (subtype) {
+	case DSS_SUBTYPE:
+		mutator = pick_mutator(fuzzer, MUTATE_DSS_FLAGS,
+				       MUTATE_DSS_FIELDS);
+		break;
+	case MP_JOIN_SUBTYPE:
+		mutator = pick_mutator(fuzzer, MUTATE_JOIN_BACKUP,
+				       MUTATE_JOIN_FIELDS);
+		break;
+	case ADD_ADDR_SUBTYPE:
+		mutator = pick_mutator(fuzzer, MUTATE_ADD_ADDR_VERSION,
+				       MUTATE_ADD_ADDR_FIELDS);
+		break;
+	case MP_FAIL_SUBTYPE:
+		mutator = pick_mutator(fuzzer, MUTATE_MP_FAIL_LENGTH,
+				       MUTATE_MP_FAIL_DSN);
+		break;
+	case MP_FASTCLOSE_SUBTYPE:
+		mutator = pick_mutator(fuzzer, MUTATE_FASTCLOSE_LENGTH,
+				       MUTATE_FASTCLOSE_KEY);
+		break;
+	default:
+		mutator = pick_mutator(fuzzer, MUTATE_MPTCP_OTHER,
+				       MUTATE_MPTCP_OTHER);
+		break;
+	}
+
+	switch (mutator) {
+	case MUTATE_DSS_FLAGS:
+		/* flip one of the A, a, M, m and F flags */
+		option[3] ^= 1 << prng_below(prng, 5);
+		break;
+	case MUTATE_DSS_LENGTH:
+		option[1] = mutated_length(prng, dss_lengths,
+					   ARRAY_SIZE(dss_lengths), room);
+		break;
+	case MUTATE_DSS_FIELDS:
+		/* data ACK, DSN, subflow sequence or length */
+		scribble(prng, option, 4, end);
+		break;
+	case MUTATE_JOIN_BACKUP:
+		option[2] ^= 1;
+		break;
+	case MUTATE_JOIN_ADDRESS_ID:
+		option[3] = prng_next_u32(prng);
+		break;
+	case MUTATE_JOIN_LENGTH:
+		option[1] = mutated_length(prng, mp_join_lengths,
+					   ARRAY_SIZE(mp_join_lengths), room);
+		break;
+	case MUTATE_JOIN_FIELDS:
+		/* the token, nonce or HMAC */
+		scribble(prng, option, 4, end);
+		break;
+	case MUTATE_ADD_ADDR_VERSION:
+		/* the IP version, or the echo flag of later versions */
+		option[2] = (option[2] & 0xf0) | prng_below(prng, 16);
+		break;
+	case MUTATE_ADD_ADDR_ADDRESS_ID:
+		option[3] = prng_next_u32(prng);
+		break;
+	case MUTATE_ADD_ADDR_LENGTH:
+		option[1] = mutated_length(prng, add_addr_lengths,
+					   ARRAY_SIZE(add_addr_lengths), room);
+		break;
+	case MUTATE_ADD_ADDR_FIELDS:
+		/* the address, port or HMAC */
+		scribble(prng, option, 4, end);
+		break;
+	case MUTATE_MP_FAIL_LENGTH:
+		option[1] = mutated_length(prng, mp_fail_lengths,
+					   ARRAY_SIZE(mp_fail_lengths), room);
+		break;
+	case MUTATE_FASTCLOSE_LENGTH:
+		option[1] = mutated_length(prng, mp_fastclose_lengths,
+					   ARRAY_SIZE(mp_fastclose_lengths),
+					   room);
+		break;
+	case MUTATE_MP_FAIL_DSN:
+	case MUTATE_FASTCLOSE_KEY:
+		/* the 64-bit DSN or key, often at an edge of its low half */
+		if (end >= 12 && prng_below(prng, 2) == 0) {
+			u32 value = htonl(PICK(prng, edge_values));
+
+			memcpy(option + 8, &value, sizeof(value));
+		} else {
+			scribble(prng, option, 4, end);
+		}
+		break;
+	case MUTATE_MPTCP_OTHER:
+		scribble(prng, option, 2, end);
+		break;
+	default:
+		assert(!"bad MPTCP option mutator");
+	}
+}
+
+/* Mutate one of the packet's TCP options, or some option byte. Return
+ * false if the packet has no options.
+ */
+static bool mutate_tcp_options(struct fuzzer *fuzzer, struct packet *packet)
+{
+	struct prng *prng = fuzzer->prng;
+	struct tcp_options_iterator iter;
+	struct tcp_option *option = NULL;
+	u8 *options[MAX_OPTIONS];
+	u8 *start = (u8 *)(packet->tcp + 1);
+	u8 *end = (u8 *)packet->tcp + packet->tcp->doff * sizeof(u32);
+	int num_options = 0, num_mptcp = 0, i;
+	char *error = NULL;
+
+	if (end <= start)
+		return false;
+
+	/* Find the MPTCP options, putting them first. */
+	for (option = tcp_options_begin(packet, &iter);
+	     option != NULL && num_options < MAX_OPTIONS;
+	     option = tcp_options_next(&iter, &error)) {
+		u8 *bytes = (u8 *)option;
+
+		if (option->kind != TCPOPT_MPTCP || end - bytes < 4)
+			continue;
+		options[num_options++] = bytes;
+		++num_mptcp;
+	}
+	free(error);	/* a mutated option may stop the walk early */
+
+	if (num_mptcp > 0 && prng_below(prng, 4) != 0) {
+		i = prng_below(prng, num_mptcp);
+		mutate_mptcp_option(fuzzer, options[i], end - options[i]);
+	} else {
+		/* Flip a bit of any option byte. */
+		fuzzer->last_mutators |= 1U << MUTATE_OPTION_BIT;
+		start[prng_below(prng, end - start)] ^=
+			1 << prng_below(prng, 8);
+	}
+	return true;
+}
+
+struct packet *fuzzer_mutate(struct fuzzer *fuzzer, const struct packet *seed)
+{
+	struct prng *prng = fuzzer->prng;
+	struct packet *packet = packet_pool_copy(NULL, (struct packet *)seed);
+	int num_mutations = 1 + prng_below(prng, 3);
+	int i;
+
+	assert(packet->tcp != NULL);
+	fuzzer->last_mutators = 0;
+	for (i = 0; i < num_mutations; ++i) {
+		/* Mostly go after the options, where MPTCP lives. */
+		if (prng_below(prng, 3) == 0 ||
+		    !mutate_tcp_options(fuzzer, packet))
+			mutate_tcp_header(fuzzer, packet);
+	}
+
+	/* The options may no longer be where the index says. */
+	packet->tcp_options_indexed = false;
+	packet->tcp_ts_val = NULL;
+	packet->tcp_ts_ecr = NULL;
+	checksum_packet(packet);
+	return packet;
+}
+
+/* Try the given trial as the case; if it fails, make it the case. */
+static bool try_case(struct packet **packets, int num_packets,
+		     struct packet **trial, int num_trial,
+		     fuzz_fails_t fails, void *arg)
+{
+	if (!fails(trial, num_trial, arg))
+		return false;
+	memcpy(packets, trial, num_packets * sizeof(*packets));
+	return true;
+}
+
+int fuzz_minimize(struct packet **packets, int num_packets,
+		  fuzz_fails_t fails, void *arg)
+{
+	struct packet **trial = calloc(num_packets, sizeof(*trial));
+	int granularity = 2;
+
+	/* This is Zeller's ddmin: split the case into granularity chunks
+	 * and try each chunk, then each complement of a chunk; on
+	 * failure keep that, else split finer. Each trial holds the
+	 * packets it tries first, in order, and then the rest, so that
+	 * the caller can still free all of them.
+	 */
+	while (num_packets >= 2) {
+		int chunk = (num_packets + granularity - 1) / granularity;
+		bool reduced = false;
+		int start;
+
+		for (start = 0; start < num_packets && !reduced;
+		     start += chunk) {
+			int end = min(start + chunk, num_packets);
+			int n = end - start;
+
+			memcpy(trial, packets + start, n * sizeof(*trial));
+			memcpy(trial + n, packets, start * sizeof(*trial));
+			memcpy(trial + n + start, packets + end,
+			       (num_packets - end) * sizeof(*trial));
+			if (try_case(packets, num_packets, trial, n,
+				     fails, arg)) {
+				num_packets = n;
+				granularity = 2;
+				reduced = true;
+			}
+		}
+		for (start = 0; start < num_packets && !reduced &&
+			     granularity > 2; start += chunk) {
+			int end = min(start + chunk, num_packets);
+			int n = num_packets - (end - start);
+
+			memcpy(trial, packets, start * sizeof(*trial));
+			memcpy(trial + start, packets + end,
+			       (num_packets - end) * sizeof(*trial));
+			memcpy(trial + n, packets + start,
+			       (end - start) * sizeof(*trial));
+			if (try_case(packets, num_packets, trial, n,
+				     fails, arg)) {
+				num_packets = n;
+				granularity = max(granularity - 1, 2);
+				reduced = true;
+			}
+		}
+		if (!reduced) {
+			if (granularity >= num_packets)
+				break;
+			granularity = min(granularity * 2, num_packets);
+		}
+	}
+
+	free(trial);
+	return num_packets;
+}
+
+int fuzz_write_case(struct packet **packets, int num_packets,
+		    const char *path, char **error)
+{
+	struct packet_trace *trace = NULL;
+	struct packet_trace_info info;
+	u32 bytes = 4096;
+	int i, result;
+
+	for (i = 0; i < num_packets; ++i)
+		bytes += packets[i]->ip_bytes + 128;
+	trace = packet_trace_new(bytes);
+
+	memset(&info, 0, sizeof(info));
+	info.type = "fuzz inbound";
+	info.direction = DIRECTION_INBOUND;
+	for (i = 0; i < num_packets; ++i) {
+		info.script_usecs = i;
+		info.live_nsecs = i * 1000LL;
+		info.line_number = i + 1;
+		packet_trace_add(trace, &info, packets[i]);
+	}
+	result = packet_trace_write_pcapng(trace, path, error);
+	packet_trace_free(trace);
+	return result;
+}
+
+int fuzz_write_script_case(const char *script, int script_length,
+			   struct packet *packet, u32 seq_offset,
+			   u32 ack_offset, const char *path, char **error)
+{
+	const struct tcp *tcp = packet->tcp;
+	const u8 *options = (const u8 *)(tcp + 1);
+	int option_bytes = tcp->doff * sizeof(u32) - sizeof(struct tcp);
+	int payload_bytes = packet_payload_len(packet);
+	char flags[10], *f = flags;
+	u32 seq, ack;
+	FILE *file = NULL;
+	int i;
+
+	/* Script sequence and ACK numbers of a SYN are absolute. */
+	if (tcp->syn)
+		seq_offset = ack_offset = 0;
+	seq = ntohl(tcp->seq) - seq_offset;
+	ack = ntohl(tcp->ack_seq) - ack_offset;
+	if ((u64)seq + payload_bytes > 0xffffffffULL) {
+		asprintf(error, "segment wraps the script's sequence space");
+		return STATUS_ERR;
+	}
+
+	if (tcp->fin)
+		*f++ = 'F';
+	if (tcp->syn)
+		*f++ = 'S';
+	if (tcp->rst)
+		*f++ = 'R';
+	if (tcp->psh)
+		*f++ = 'P';
+	if (tcp->urg)
+		*f++ = 'U';
+	if (tcp->ece)
+		*f++ = 'E';
+	if (tcp->cwr)
+		*f++ = 'W';
+	if (tcp->ack)
+		*f++ = '.';
+	if (f == flags)
+		*f++ = '-';
+	*f = '\0';
+
+	file = fopen(path, "w");
+	if (file == NULL) {
+		asprintf(error, "cannot write %s: %s", path, strerror(errno));
+		return STATUS_ERR;
+	}
+	fwrite(script, 1, script_length, file);
+	if (script_length > 0 && script[script_length - 1] != '\n')
+		fputc('\n', file);
+	fprintf(file, "\n// A --fuzz variant that reached new kernel code.\n"
+		"+0 < %s %u:%llu(%d) ack %u win %u", flags, seq,
+		(u64)seq + payload_bytes, payload_bytes, ack,
+		ntohs(tcp->window));
+	if (option_bytes > 0) {
+		fprintf(file, " <raw \"");
+		for (i = 0; i < option_bytes; ++i)
+			fprintf(file, "%02x", options[i]);
+		fprintf(file, "\">");
+	}
+	if (packet->socket_script_fd != SOCKET_FD_NOT_DEFINED)
+		fprintf(file, " sock(%d)", packet->socket_script_fd);
+	fprintf(file, "\n");
+	if (fclose(file) != 0) {
+		asprintf(error, "cannot write %s: %s", path, strerror(errno));
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+void fuzzer_start(struct fuzzer *fuzzer, int probe_fd)
+{
+	fuzzer->probe_fd = probe_fd;
+	fuzzer->kmsg_fd = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fuzzer->kmsg_fd < 0) {
+		fprintf(stderr, "fuzz: cannot read /dev/kmsg (%s); "
+			"only probing for lockups\n", strerror(errno));
+		return;
+	}
+	/* We only care about what the kernel logs from now on. */
+	lseek(fuzzer->kmsg_fd, 0, SEEK_END);
+}
+
+/* Return true if the message contains one of the given strings. */
+static bool has_any(const char *message, const char *const *strings,
+		    int num_strings)
+{
+	int i;
+
+	for (i = 0; i < num_strings; ++i) {
+		if (strstr(message, strings[i]) != NULL)
+			return true;
+	}
+	return false;
+}
+
+/* Read the kernel log records since the last call, each of which looks
+ * like "priority,sequence,usecs,flags;message\n", and look for trouble.
+ */
+static enum fuzz_verdict_t check_kmsg(struct fuzzer *fuzzer)
+{
+	enum fuzz_verdict_t verdict = FUZZ_HEALTHY;
+	char record[8192];
+	ssize_t bytes;
+
+	if (fuzzer->kmsg_fd < 0)
+		return FUZZ_HEALTHY;
+	while (1) {
+		char *message = NULL, *newline = NULL;
+
+		bytes = read(fuzzer->kmsg_fd, record, sizeof(record) - 1);
+		if (bytes < 0 && errno == EPIPE)
+			continue;	/* records overwritten; keep reading */
+		if (bytes <= 0)
+			break;		/* EAGAIN: nothing more for now */
+		record[bytes] = '\0';
+		message = strchr(record, ';');
+		message = (message != NULL) ? message + 1 : record;
+		newline = strchr(message, '\n');
+		if (newline != NULL)
+			*newline = '\0';
+
+		if (verdict == FUZZ_HEALTHY &&
+		    (has_any(message, lockup_messages,
+			     ARRAY_SIZE(lockup_messages)) ||
+		     has_any(message, crash_messages,
+			     ARRAY_SIZE(crash_messages)))) {
+			verdict = has_any(message, lockup_messages,
+					  ARRAY_SIZE(lockup_messages)) ?
+				FUZZ_LOCKUP : FUZZ_CRASH;
+			strncpy(fuzzer->report, message,
+				sizeof(fuzzer->report) - 1);
+		}
+	}
+	return verdict;
+}
+
+/* A probe of the live socket, run by its own thread so that we can
+ * give up on it if the kernel never answers.
+ */
+struct probe {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int fd;
+	bool done;
+};
+
+static void *probe_thread(void *arg)
+{
+	struct probe *probe = arg;
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+
+	/* This takes the socket lock, so it waits on a stuck socket. */
+	getsockopt(probe->fd, IPPROTO_TCP, TCP_INFO, &info, &len);
+
+	pthread_mutex_lock(&probe->mutex);
+	probe->done = true;
+	pthread_cond_signal(&probe->cond);
+	pthread_mutex_unlock(&probe->mutex);
+	return NULL;
+}
+
+/* Return whether the kernel answered a probe of the live socket in
+ * FUZZ_LOCKUP_SECS.
+ */
+static bool probe_answered(struct fuzzer *fuzzer)
+{
+	struct probe *probe = calloc(1, sizeof(struct probe));
+	struct timespec deadline;
+	pthread_attr_t attr;
+	pthread_t thread;
+	bool done;
+
+	pthread_mutex_init(&probe->mutex, NULL);
+	pthread_cond_init(&probe->cond, NULL);
+	probe->fd = fuzzer->probe_fd;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, probe_thread, probe) != 0)
+		die_perror("pthread_create");
+	pthread_attr_destroy(&attr);
+
+	if (clock_gettime(CLOCK_REALTIME, &deadline) != 0)
+		die_perror("clock_gettime");
+	deadline.tv_sec += FUZZ_LOCKUP_SECS;
+	pthread_mutex_lock(&probe->mutex);
+	while (!probe->done &&
+	       pthread_cond_timedwait(&probe->cond, &probe->mutex,
+				      &deadline) != ETIMEDOUT)
+		;
+	done = probe->done;
+	pthread_mutex_unlock(&probe->mutex);
+
+	/* A thread stuck in the kernel still owns its probe. */
+	if (done) {
+		pthread_cond_destroy(&probe->cond);
+		pthread_mutex_destroy(&probe->mutex);
+		free(probe);
+	}
+	return done;
+}
+
+enum fuzz_verdict_t fuzzer_check(struct fuzzer *fuzzer)
+{
+	enum fuzz_verdict_t verdict = FUZZ_HEALTHY, logged;
+
+	/* Probe first, so that the kernel is done with the packets
+	 * before we read what it logged about them.
+	 */
+	if (fuzzer->probe_fd >= 0 && !probe_answered(fuzzer)) {
+		verdict = FUZZ_LOCKUP;
+		snprintf(fuzzer->report, sizeof(fuzzer->report),
+			 "no answer to TCP_INFO probe in %d seconds",
+			 FUZZ_LOCKUP_SECS);
+	}
+	/* What the kernel said, if anything, tells us more. */
+	logged = check_kmsg(fuzzer);
+	if (logged != FUZZ_HEALTHY)
+		verdict = logged;
+	return verdict;
+}
+
+/* For minimizing: inject a trial case and see if it breaks the kernel. */
+static bool case_fails(struct packet **packets, int num_packets, void *arg)
+{
+	struct fuzzer *fuzzer = arg;
+	struct netdev *netdev = fuzzer->netdev;
+
+	if (netdev_send_batch(netdev, packets, num_packets))
+		return false;
+	return fuzzer_check(fuzzer) != FUZZ_HEALTHY;
+}
+
+/* Report a batch that broke the kernel: minimize it if the kernel is
+ * still with us, and write it out if asked.
+ */
+static void report_failure(struct fuzzer *fuzzer, struct config *config,
+			   enum fuzz_verdict_t verdict,
+			   struct packet **batch, int num_packets,
+			   char **error)
+{
+	char *report = strdup(fuzzer->report);
+	char *write_error = NULL;
+	int num_case = num_packets;
+
+	/* A kernel that locked up will not tell us anything more. */
+	if (verdict == FUZZ_CRASH)
+		num_case = fuzz_minimize(batch, num_packets, case_fails,
+					 fuzzer);
+
+	if (config->fuzz_output != NULL &&
+	    fuzz_write_case(batch, num_case, config->fuzz_output,
+			    &write_error)) {
+		fprintf(stderr, "fuzz: %s\n", write_error);
+		free(write_error);
+	}
+	asprintf(error, "fuzzing found a kernel %s after %llu variants: "
+		 "%s; %d packet%s%s%s",
+		 verdict == FUZZ_LOCKUP ? "lockup" : "crash",
+		 fuzzer->num_variants, report, num_case,
+		 num_case == 1 ? "" : "s",
+		 config->fuzz_output != NULL ? " in " : " to reproduce",
+		 config->fuzz_output != NULL ? config->fuzz_output : "");
+	free(report);
+}
+
+/* A variant reached new kernel code: credit the mutators that made
+ * it, keep it as a seed, and write it to the corpus directory, named
+ * by a hash of its bytes.
+ */
+static void keep_variant(struct fuzzer *fuzzer, struct config *config,
+			 struct packet *variant, u32 mutators,
+			 const struct fuzz_seed *origin)
+{
+	struct fuzz_seed *entry = NULL;
+	char *path = NULL, *error = NULL;
+	u32 hash;
+	int m;
+
+	for (m = 0; m < FUZZ_NUM_MUTATORS; ++m) {
+		if (mutators & (1U << m))
+			++fuzzer->hits[m];
+	}
+
+	if (fuzzer->num_corpus < FUZZ_MAX_CORPUS) {
+		entry = &fuzzer->corpus[fuzzer->num_corpus++];
+	} else {
+		entry = &fuzzer->corpus[prng_below(fuzzer->prng,
+						   FUZZ_MAX_CORPUS)];
+		packet_free(entry->packet);
+	}
+	entry->packet = packet_pool_copy(NULL, variant);
+	entry->seq_offset = origin->seq_offset;
+	entry->ack_offset = origin->ack_offset;
+
+	MurmurHash3_x86_32(packet_start(variant), variant->ip_bytes, 0, &hash);
+	asprintf(&path, "%s/%08x.pkt", config->fuzz_corpus, hash);
+	if (fuzz_write_script_case(fuzzer->script, fuzzer->script_length,
+				   variant, origin->seq_offset,
+				   origin->ack_offset, path, &error)) {
+		fprintf(stderr, "fuzz: %s\n", error);
+		free(error);
+	}
+	free(path);
+}
+
+/* Pick a seed to mutate: with coverage, half the time one of the
+ * variants that found new code.
+ */
+static const struct fuzz_seed *pick_seed(struct fuzzer *fuzzer)
+{
+	struct prng *prng = fuzzer->prng;
+
+	if (fuzzer->num_corpus > 0 && prng_below(prng, 2) == 0)
+		return &fuzzer->corpus[prng_below(prng, fuzzer->num_corpus)];
+	return &fuzzer->seeds[prng_below(prng, fuzzer->num_seeds)];
+}
+
+/* For --fuzz_corpus: open KCOV for this thread, which injects, and
+ * make sure there is somewhere to write the corpus.
+ */
+static int start_coverage(struct fuzzer *fuzzer, struct config *config,
+			  char **error)
+{
+	char *kcov_error = NULL;
+
+	if (fuzzer->script == NULL) {
+		asprintf(error, "--fuzz_corpus needs the text of the script");
+		return STATUS_ERR;
+	}
+	if (mkdir(config->fuzz_corpus, 0755) != 0 && errno != EEXIST) {
+		asprintf(error, "cannot create --fuzz_corpus %s: %s",
+			 config->fuzz_corpus, strerror(errno));
+		return STATUS_ERR;
+	}
+	fuzzer->kcov = kcov_new(&kcov_error);
+	if (fuzzer->kcov == NULL) {
+		asprintf(error, "--fuzz_corpus: %s", kcov_error);
+		free(kcov_error);
+		return STATUS_ERR;
+	}
+	fuzzer->corpus = calloc(FUZZ_MAX_CORPUS, sizeof(*fuzzer->corpus));
+	return STATUS_OK;
+}
+
+/* Inject the variants one at a time, so that the coverage we read
+ * is that of each one.
+ */
+static int inject_with_coverage(struct fuzzer *fuzzer, struct config *config,
+				struct packet **batch,
+				const struct fuzz_seed **origins,
+				const u32 *mutators, int num_packets)
+{
+	int i, sent, new_edges;
+
+	for (i = 0; i < num_packets; ++i) {
+		kcov_begin(fuzzer->kcov);
+		sent = netdev_send_batch(fuzzer->netdev, &batch[i], 1);
+		new_edges = kcov_end(fuzzer->kcov);
+		if (sent != STATUS_OK)
+			return STATUS_ERR;
+		if (new_edges > 0)
+			keep_variant(fuzzer, config, batch[i], mutators[i],
+				     origins[i]);
+	}
+	return STATUS_OK;
+}
+
+int fuzzer_run(struct fuzzer *fuzzer, struct config *config,
+	       struct netdev *netdev, char **error)
+{
+	struct packet **batch = NULL;
+	const struct fuzz_seed **origins = NULL;
+	u32 *mutators = NULL;
+	enum fuzz_verdict_t verdict = FUZZ_HEALTHY;
+	struct timespec start, end;
+	int result = STATUS_OK;
+	int i, n = 0;
+
+	if (fuzzer->num_seeds == 0) {
+		asprintf(error, "--fuzz needs a script that injects "
+			 "TCP packets to mutate");
+		return STATUS_ERR;
+	}
+
+	fuzzer->netdev = netdev;
+	if (config->fuzz_corpus != NULL &&
+	    start_coverage(fuzzer, config, error))
+		return STATUS_ERR;
+	batch = calloc(config->fuzz_batch, sizeof(*batch));
+	origins = calloc(config->fuzz_batch, sizeof(*origins));
+	mutators = calloc(config->fuzz_batch, sizeof(*mutators));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (fuzzer->num_variants < (u64)config->fuzz_variants) {
+		char *write_error = NULL;
+
+		n = min(config->fuzz_batch,
+			config->fuzz_variants - (s64)fuzzer->num_variants);
+		for (i = 0; i < n; ++i) {
+			origins[i] = pick_seed(fuzzer);
+			batch[i] = fuzzer_mutate(fuzzer, origins[i]->packet);
+			mutators[i] = fuzzer->last_mutators;
+		}
+
+		/* If the kernel panics, this batch is all we have left. */
+		if (config->fuzz_output != NULL &&
+		    fuzz_write_case(batch, n, config->fuzz_output,
+				    &write_error)) {
+			asprintf(error, "fuzz: %s", write_error);
+			free(write_error);
+			result = STATUS_ERR;
+			break;
+		}
+
+		if (fuzzer->kcov != NULL ?
+		    inject_with_coverage(fuzzer, config, batch, origins,
+					 mutators, n) :
+		    netdev_send_batch(netdev, batch, n)) {
+			asprintf(error, "error injecting fuzzed packets");
+			result = STATUS_ERR;
+			break;
+		}
+		fuzzer->num_variants += n;
+		++fuzzer->num_batches;
+
+		verdict = fuzzer_check(fuzzer);
+		if (verdict != FUZZ_HEALTHY) {
+			report_failure(fuzzer, config, verdict, batch, n,
+				       error);
+			result = STATUS_ERR;
+			break;
+		}
+		for (i = 0; i < n; ++i)
+			packet_free(batch[i]);
+		n = 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (i = 0; i < n; ++i)
+		packet_free(batch[i]);
+	free(batch);
+	free(origins);
+	free(mutators);
+
+	/* No failure, so no case to keep. */
+	if (result == STATUS_OK && config->fuzz_output != NULL)
+		unlink(config->fuzz_output);
+
+	if (config->verbose) {
+		double secs = (end.tv_sec - start.tv_sec) +
+			(end.tv_nsec - start.tv_nsec) / 1e9;
+
+		printf("fuzz: %llu variants in %llu batches, %.0f per second\n",
+		       fuzzer->num_variants, fuzzer->num_batches,
+		       secs > 0 ? fuzzer->num_variants / secs : 0.0);
+		if (fuzzer->kcov != NULL)
+			printf("fuzz: %u kernel edges, %d variants in corpus\n",
+			       fuzzer->kcov->num_edges, fuzzer->num_corpus);
+	}
+	return result;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for fuzzing the kernel under test from inside packetdrill:
+ * once the script's events are done, we mutate the inbound packets the
+ * script injected (their TCP headers and MPTCP options) and inject the
+ * variants at a high rate through the same netdev, checking between
+ * batches that the kernel has neither crashed nor locked up, and
+ * minimizing any batch that broke it.
+ *
+ * With --fuzz_corpus, we also read the kernel's coverage through KCOV
+ * for each variant we inject, keep the variants that reach new code as
+ * seeds of their own, and favor the mutations that found them. Each
+ * such variant is written to the corpus directory as a .pkt script:
+ * the script under test with the variant injected at its end, so that
+ * running it with --fuzz picks up the search where it left off.
+ */
+
+#ifndef __FUZZ_H__
+#define __FUZZ_H__
+
+#include "types.h"
+
+#include "config.h"
+#include "kcov.h"
+#include "netdev.h"
+#include "packet.h"
+#include "prng.h"
+
+/* How many of the latest injected packets we keep to mutate. */
+#define FUZZ_MAX_SEEDS		64
+
+/* How many variants that reached new kernel code we keep to mutate. */
+#define FUZZ_MAX_CORPUS		1024
+
+/* How long the kernel may take to answer a probe of the connection
+ * before we call it locked up.
+ */
+#define FUZZ_LOCKUP_SECS	5
+
+/* What we found out about the kernel after injecting some packets. */
+enum fuzz_verdict_t {
+	FUZZ_HEALTHY,		/* no sign of trouble */
+	FUZZ_CRASH,		/* the kernel logged a BUG, oops or warning */
+	FUZZ_LOCKUP,		/* the kernel stopped answering a probe */
+};
+
+/* The mutations we choose between. With coverage, we count the ones
+ * that led to new kernel code, and choose those more often.
+ */
+enum fuzz_mutator_t {
+	MUTATE_TCP_FLAGS = 0,
+	MUTATE_TCP_WINDOW,
+	MUTATE_TCP_URG_PTR,
+	MUTATE_TCP_SEQ_ACK,
+	MUTATE_OPTION_BIT,		/* flip a bit of any option byte */
+	MUTATE_MPTCP_SUBTYPE,
+	MUTATE_DSS_FLAGS,
+	MUTATE_DSS_LENGTH,
+	MUTATE_DSS_FIELDS,
+	MUTATE_JOIN_BACKUP,
+	MUTATE_JOIN_ADDRESS_ID,
+	MUTATE_JOIN_LENGTH,
+	MUTATE_JOIN_FIELDS,
+	MUTATE_ADD_ADDR_VERSION,
+	MUTATE_ADD_ADDR_ADDRESS_ID,
+	MUTATE_ADD_ADDR_LENGTH,
+	MUTATE_ADD_ADDR_FIELDS,
+	MUTATE_MP_FAIL_LENGTH,
+	MUTATE_MP_FAIL_DSN,
+	MUTATE_FASTCLOSE_LENGTH,
+	MUTATE_FASTCLOSE_KEY,
+	MUTATE_MPTCP_OTHER,		/* bytes of any other subtype */
+	FUZZ_NUM_MUTATORS,
+};
+
+/* A packet to mutate, with the offsets that map its connection's
+ * script sequence and ACK numbers (of packets without SYN) to live
+ * ones, so that we can write a variant of it back as a script line.
+ */
+struct fuzz_seed {
+	struct packet *packet;
+	u32 seq_offset;
+	u32 ack_offset;
+};
+
+struct fuzzer {
+	struct prng *prng;		/* for choosing mutations */
+	struct fuzz_seed seeds[FUZZ_MAX_SEEDS];	/* ring of live packets */
+	int num_seeds;			/* packets in the ring */
+	int next_seed;			/* where the next seed goes */
+	struct fuzz_seed *corpus;	/* variants that found new code */
+	int num_corpus;			/* variants in the corpus */
+	struct kcov *kcov;		/* for --fuzz_corpus, or NULL */
+	u32 hits[FUZZ_NUM_MUTATORS];	/* new code found by each mutator */
+	u32 last_mutators;		/* mask of mutators of last variant */
+	const char *script;		/* text of the script under test */
+	int script_length;
+	int kmsg_fd;			/* /dev/kmsg, or -1 if unreadable */
+	int probe_fd;			/* live socket to probe, or -1 */
+	struct netdev *netdev;		/* where we inject variants */
+	char report[256];		/* what told us the kernel broke */
+	u64 num_variants;		/* variants injected so far */
+	u64 num_batches;		/* batches injected so far */
+};
+
+/* Allocate a fuzzer that takes its randomness from the given generator. */
+extern struct fuzzer *fuzzer_new(struct prng *prng);
+
+/* Free the fuzzer and its seeds. */
+extern void fuzzer_free(struct fuzzer *fuzzer);
+
+/* Keep a copy of a live TCP packet we injected, with its live
+ * addresses, sequence numbers and checksums, as a seed to mutate,
+ * along with the script-to-live sequence and ACK offsets of its
+ * connection. Once the ring is full, the newest seed replaces the
+ * oldest.
+ */
+extern void fuzzer_add_seed(struct fuzzer *fuzzer,
+			    const struct packet *live_packet,
+			    u32 seq_offset, u32 ack_offset);
+
+/* Give the text of the script under test, for --fuzz_corpus. */
+extern void fuzzer_set_script(struct fuzzer *fuzzer,
+			      const char *script, int script_length);
+
+/* Return a new packet that is a copy of the given seed with a few
+ * random mutations: TCP flags, window, urgent pointer, sequence and
+ * ACK numbers near those of the newest seed, DSS flags, lengths and
+ * mappings, MP_JOIN tokens, nonces, address IDs and backup flags,
+ * ADD_ADDR address IDs, IP versions and lengths, MP_FAIL DSNs,
+ * MP_FASTCLOSE keys, and raw option bytes. The variant keeps the
+ * seed's size, and its checksums are filled in. The mutators used are
+ * left in fuzzer->last_mutators.
+ */
+extern struct packet *fuzzer_mutate(struct fuzzer *fuzzer,
+				    const struct packet *seed);
+
+/* Return true if injecting the given packets breaks the kernel. */
+typedef bool (*fuzz_fails_t)(struct packet **packets, int num_packets,
+			     void *arg);
+
+/* Shrink the given failing case, with delta debugging, to a smaller
+ * set of its packets in their original order that still fails, moving
+ * them to the front of the array, and return their number. If no
+ * smaller set fails, keep the whole case.
+ */
+extern int fuzz_minimize(struct packet **packets, int num_packets,
+			 fuzz_fails_t fails, void *arg);
+
+/* Write the given packets, inbound and in order, to a pcapng file. */
+extern int fuzz_write_case(struct packet **packets, int num_packets,
+			   const char *path, char **error);
+
+/* Write the given script text, followed by a line that injects the
+ * given live packet with its TCP options as raw bytes, to a .pkt file,
+ * mapping its sequence and ACK numbers back to script values with the
+ * given offsets.
+ */
+extern int fuzz_write_script_case(const char *script, int script_length,
+				  struct packet *packet, u32 seq_offset,
+				  u32 ack_offset, const char *path,
+				  char **error);
+
+/* Start watching the kernel log and, if probe_fd >= 0, probing the
+ * given live socket.
+ */
+extern void fuzzer_start(struct fuzzer *fuzzer, int probe_fd);
+
+/* Check what the kernel logged and how it answers a probe since the
+ * last check, and say whether the packets in between broke it.
+ */
+extern enum fuzz_verdict_t fuzzer_check(struct fuzzer *fuzzer);
+
+/* Inject config->fuzz_variants variants of our seeds through the
+ * netdev, in batches of config->fuzz_batch, checking the kernel after
+ * each batch. If a batch breaks the kernel, minimize it, write it to
+ * config->fuzz_output if given, and return STATUS_ERR with a
+ * description in *error. With config->fuzz_corpus, inject the variants
+ * one by one under KCOV, and keep and write out those that reach new
+ * kernel code.
+ */
+extern int fuzzer_run(struct fuzzer *fuzzer, struct config *config,
+		      struct netdev *netdev, char **error);
+
+#endif /* __FUZZ_H__ */
@@ -0,0 +1,175 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * A stand-in for libFuzzer, so that the fuzz targets build and run
+ * with any compiler: run each input file named on the command line,
+ * or each file in a named directory, through the target, and with
+ * --runs=<n>, also n random mutations of those inputs (or of random
+ * bytes, if none are given), for a quick smoke test under a sanitizer.
+ *
+ * Usage: <target>_fuzz [--runs=<n>] [--seed=<n>] [file or directory ...]
+ */
+
+#include "fuzz_target.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "prng.h"
+
+#define MAX_INPUT_BYTES		(64 * 1024)
+#define MAX_INPUTS		4096
+
+struct input {
+	u8 *data;
+	size_t size;
+};
+
+static struct input inputs[MAX_INPUTS];
+static int num_inputs;
+
+/* Run the target on a copy of the bytes, sized exactly to them. */
+static void run_one(const u8 *data, size_t size)
+{
+	u8 *copy = malloc(size > 0 ? size : 1);
+
+	memcpy(copy, data, size);
+	LLVMFuzzerTestOneInput(copy, size);
+	free(copy);
+}
+
+static void add_file(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	struct input *input = NULL;
+
+	if (f == NULL) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if (num_inputs == MAX_INPUTS) {
+		fprintf(stderr, "more than %d inputs\n", MAX_INPUTS);
+		exit(EXIT_FAILURE);
+	}
+	input = &inputs[num_inputs++];
+	input->data = malloc(MAX_INPUT_BYTES);
+	input->size = fread(input->data, 1, MAX_INPUT_BYTES, f);
+	fclose(f);
+}
+
+static void add_path(const char *path)
+{
+	struct dirent *entry = NULL;
+	struct stat st;
+	DIR *dir = NULL;
+
+	if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		add_file(path);
+		return;
+	}
+	dir = opendir(path);
+	while ((entry = readdir(dir)) != NULL) {
+		char *file = NULL;
+
+		if (entry->d_name[0] == '.')
+			continue;
+		asprintf(&file, "%s/%s", path, entry->d_name);
+		add_file(file);
+		free(file);
+	}
+	closedir(dir);
+}
+
+/* Run a random mutation of a random input: flip bits, set bytes to
+ * random or edge values, and grow or cut the input.
+ */
+static void run_mutation(struct prng *prng)
+{
+	static u8 data[MAX_INPUT_BYTES];
+	static const u8 edges[] = { 0, 1, 2, 0x7f, 0x80, 0xfe, 0xff };
+	size_t size = 0;
+	int i, num_mutations;
+
+	if (num_inputs > 0) {
+		const struct input *input =
+			&inputs[prng_below(prng, num_inputs)];
+
+		size = input->size;
+		memcpy(data, input->data, size);
+	} else {
+		size = prng_below(prng, 64);
+		for (i = 0; i < size; ++i)
+			data[i] = prng_next_u32(prng);
+	}
+
+	num_mutations = 1 + prng_below(prng, 8);
+	for (i = 0; i < num_mutations; ++i) {
+		switch (prng_below(prng, 4)) {
+		case 0:
+			if (size > 0)
+				data[prng_below(prng, size)] ^=
+					1 << prng_below(prng, 8);
+			break;
+		case 1:
+			if (size > 0)
+				data[prng_below(prng, size)] =
+					edges[prng_below(prng,
+							 ARRAY_SIZE(edges))];
+			break;
+		case 2:
+			if (size < 128)
+				data[size++] = prng_next_u32(prng);
+			break;
+		case 3:
+			if (size > 0)
+				size = prng_below(prng, size);
+			break;
+		}
+	}
+	run_one(data, size);
+}
+
+int main(int argc, char *argv[])
+{
+	struct prng prng;
+	long runs = 0;
+	u64 seed = 1;
+	int i;
+
+	for (i = 1; i < argc; ++i) {
+		if (strncmp(argv[i], "--runs=", 7) == 0)
+			runs = atol(argv[i] + 7);
+		else if (strncmp(argv[i], "--seed=", 7) == 0)
+			seed = strtoull(argv[i] + 7, NULL, 0);
+		else
+			add_path(argv[i]);
+	}
+
+	for (i = 0; i < num_inputs; ++i)
+		run_one(inputs[i].data, inputs[i].size);
+
+	prng_seed(&prng, seed);
+	for (; runs > 0; --runs)
+		run_mutation(&prng);
+
+	printf("%s: ran %d inputs and their mutations\n", argv[0],
+	       num_inputs);
+	return 0;
+}
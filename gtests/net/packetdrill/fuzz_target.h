@@ -0,0 +1,93 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Shared declarations for the in-memory fuzz targets (*_fuzz.c). Each
+ * target defines LLVMFuzzerTestOneInput(), so that it can be linked
+ * either with libFuzzer or with fuzz_driver.o, which runs the inputs
+ * named on its command line and mutated copies of them. Targets copy
+ * their input to a buffer of exactly its size, so a sanitizer catches
+ * any read past the end of the packet bytes.
+ */
+
+#ifndef __FUZZ_TARGET_H__
+#define __FUZZ_TARGET_H__
+
+#include "types.h"
+
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checksum.h"
+#include "ip.h"
+#include "packet.h"
+#include "packet_parser.h"
+#include "tcp.h"
+#include "tcp_options.h"
+
+/* Run one input through the code under test. Always returns 0. */
+extern int LLVMFuzzerTestOneInput(const u8 *data, size_t size);
+
+/* Return a parsed IPv4/TCP packet with the given TCP flags byte whose
+ * options are the given bytes, padded with EOL to a multiple of 4
+ * bytes and cut at MAX_TCP_OPTION_BYTES, and with no payload, so that
+ * the options end where the packet buffer does.
+ */
+static inline struct packet *fuzz_tcp_packet(u8 tcp_flags, const u8 *options,
+					     size_t option_bytes)
+{
+	size_t padded = 0, bytes = 0;
+	struct packet *packet = NULL;
+	struct ipv4 *ipv4 = NULL;
+	struct tcp *tcp = NULL;
+	char *error = NULL;
+
+	if (option_bytes > MAX_TCP_OPTION_BYTES)
+		option_bytes = MAX_TCP_OPTION_BYTES;
+	padded = (option_bytes + 3) & ~3;
+	bytes = sizeof(*ipv4) + sizeof(*tcp) + padded;
+	packet = packet_new(bytes);
+	memset(packet->buffer, 0, bytes);
+
+	ipv4 = (struct ipv4 *)packet->buffer;
+	ipv4->version = 4;
+	ipv4->ihl = sizeof(*ipv4) / 4;
+	ipv4->tot_len = htons(bytes);
+	ipv4->ttl = 64;
+	ipv4->protocol = IPPROTO_TCP;
+	ipv4->src_ip.s_addr = htonl(0xc0000201);
+	ipv4->dst_ip.s_addr = htonl(0xc0a80001);
+	ipv4->check = ipv4_checksum(ipv4, sizeof(*ipv4));
+
+	tcp = (struct tcp *)(ipv4 + 1);
+	tcp->src_port = htons(8080);
+	tcp->dst_port = htons(40000);
+	tcp->doff = (sizeof(*tcp) + padded) / 4;
+	((u8 *)tcp)[13] = tcp_flags;
+	tcp->window = htons(1000);
+	memcpy(tcp + 1, options, option_bytes);
+
+	if (parse_packet(packet, bytes, PACKET_LAYER_3_IP, &error) !=
+	    PACKET_OK) {
+		free(error);
+		packet_free(packet);
+		return NULL;
+	}
+	return packet;
+}
+
+#endif /* __FUZZ_TARGET_H__ */
@@ -0,0 +1,334 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for fuzz.c: mutated packets keep their size, addresses and
+ * valid checksums while their TCP headers and MPTCP options change,
+ * mutators that found new code are chosen more often, minimizing a
+ * failing case keeps just the packets that make it fail, and corpus
+ * variants are written as script lines.
+ */
+
+#include "fuzz.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checksum.h"
+#include "ip.h"
+#include "mptcp.h"
+#include "packet_checksum.h"
+#include "packet_parser.h"
+#include "tcp.h"
+#include "tcp_packet.h"
+
+#define NUM_VARIANTS	2000
+
+/* Return a parsed IPv4/TCP packet carrying the given options. */
+static struct packet *new_seed(u32 seq, const u8 *options, int option_bytes)
+{
+	int bytes = sizeof(struct ipv4) + sizeof(struct tcp) + option_bytes;
+	struct packet *packet = packet_new(bytes);
+	struct ipv4 *ipv4 = (struct ipv4 *)packet->buffer;
+	struct tcp *tcp = (struct tcp *)(ipv4 + 1);
+	char *error = NULL;
+
+	memset(packet->buffer, 0, bytes);
+	ipv4->version = 4;
+	ipv4->ihl = sizeof(*ipv4) / 4;
+	ipv4->tot_len = htons(bytes);
+	ipv4->ttl = 64;
+	ipv4->protocol = IPPROTO_TCP;
+	ipv4->src_ip.s_addr = htonl(0xc0000201);
+	ipv4->dst_ip.s_addr = htonl(0xc0a80001);
+	tcp->src_port = htons(8080);
+	tcp->dst_port = htons(40000);
+	tcp->seq = htonl(seq);
+	tcp->ack_seq = htonl(5000);
+	tcp->doff = (sizeof(*tcp) + option_bytes) / 4;
+	tcp->ack = 1;
+	tcp->window = htons(1000);
+	memcpy(tcp + 1, options, option_bytes);
+	packet->socket_script_fd = SOCKET_FD_NOT_DEFINED;
+	ipv4->check = ipv4_checksum(ipv4, sizeof(*ipv4));
+	assert(parse_packet(packet, bytes, PACKET_LAYER_3_IP, &error) ==
+	       PACKET_OK);
+	checksum_packet(packet);
+	return packet;
+}
+
+/* DSS with a 4-byte data ACK and a 4-byte mapping with checksum. */
+static const u8 dss[TCPOLEN_DSS_DACK4_DSN4] = {
+	TCPOPT_MPTCP, TCPOLEN_DSS_DACK4_DSN4, DSS_SUBTYPE << 4, 0x05,
+	0, 0, 0, 1,  0, 0, 0, 1,  0, 0, 0, 1,  0, 10,  0, 0,
+};
+
+/* MP_JOIN SYN, and ADD_ADDR for IPv4, padded with NOPs. */
+static const u8 join_add_addr[TCPOLEN_MP_JOIN_SYN + TCPOLEN_ADD_ADDR_V4] = {
+	TCPOPT_MPTCP, TCPOLEN_MP_JOIN_SYN, MP_JOIN_SUBTYPE << 4, 1,
+	1, 2, 3, 4,  5, 6, 7, 8,
+	TCPOPT_MPTCP, TCPOLEN_ADD_ADDR_V4, (ADD_ADDR_SUBTYPE << 4) | 4, 2,
+	192, 0, 2, 2,
+};
+
+static void test_mutate(void)
+{
+	struct prng prng;
+	struct fuzzer *fuzzer = fuzzer_new(&prng);
+	struct packet *seeds[2];
+	int changed_header = 0, changed_options = 0, changed_dss_flags = 0;
+	int changed_join = 0, changed_add_addr = 0;
+	int i;
+
+	prng_seed(&prng, 42);
+	seeds[0] = new_seed(1000, dss, sizeof(dss));
+	seeds[1] = new_seed(2000, join_add_addr, sizeof(join_add_addr));
+	fuzzer_add_seed(fuzzer, seeds[0], 0, 0);
+	fuzzer_add_seed(fuzzer, seeds[1], 0, 0);
+	assert(fuzzer->num_seeds == 2);
+
+	for (i = 0; i < NUM_VARIANTS; ++i) {
+		struct packet *seed = seeds[i % 2];
+		struct packet *variant = fuzzer_mutate(fuzzer, seed);
+		const u8 *options = (const u8 *)(variant->tcp + 1);
+		struct packet *copy = NULL;
+
+		/* Same size and connection, and checksums that hold. */
+		assert(variant->ip_bytes == seed->ip_bytes);
+		assert(variant->tcp->doff == seed->tcp->doff);
+		assert(memcmp(variant->ipv4, seed->ipv4, 12) == 0);
+		assert(variant->tcp->src_port == seed->tcp->src_port);
+		assert(variant->tcp->dst_port == seed->tcp->dst_port);
+		copy = packet_copy(variant);
+		checksum_packet(copy);
+		assert(memcmp(copy->buffer, variant->buffer,
+			      variant->ip_bytes) == 0);
+		packet_free(copy);
+
+		if (memcmp(variant->tcp, seed->tcp, sizeof(struct tcp)))
+			++changed_header;
+		if (memcmp(options, seed->tcp + 1,
+			   variant->ip_bytes - sizeof(struct ipv4) -
+			   sizeof(struct tcp)))
+			++changed_options;
+		if (seed == seeds[0]) {
+			if (options[3] != dss[3])
+				++changed_dss_flags;
+		} else {
+			if (memcmp(options + 4, join_add_addr + 4, 8))
+				++changed_join;
+			if (options[15] != join_add_addr[15] ||
+			    options[13] != join_add_addr[13])
+				++changed_add_addr;
+		}
+		packet_free(variant);
+	}
+	assert(changed_header > NUM_VARIANTS / 10);
+	assert(changed_options > NUM_VARIANTS / 2);
+	assert(changed_dss_flags > 0);
+	assert(changed_join > 0);
+	assert(changed_add_addr > 0);
+
+	/* The ring keeps the newest seeds. */
+	for (i = 0; i < FUZZ_MAX_SEEDS + 10; ++i) {
+		struct packet *seed = new_seed(i, dss, sizeof(dss));
+
+		fuzzer_add_seed(fuzzer, seed, 0, 0);
+		packet_free(seed);
+	}
+	assert(fuzzer->num_seeds == FUZZ_MAX_SEEDS);
+	for (i = 0; i < FUZZ_MAX_SEEDS; ++i)
+		assert(ntohl(fuzzer->seeds[i].packet->tcp->seq) >= 10);
+
+	packet_free(seeds[0]);
+	packet_free(seeds[1]);
+	fuzzer_free(fuzzer);
+}
+
+/* Once a mutator has found new code, it is the one mostly chosen. */
+static void test_steering(void)
+{
+	struct prng prng;
+	struct fuzzer *fuzzer = fuzzer_new(&prng);
+	struct packet *seed = new_seed(1000, dss, sizeof(dss));
+	int flags = 0, lengths = 0, i;
+
+	prng_seed(&prng, 7);
+	fuzzer_add_seed(fuzzer, seed, 0, 0);
+	fuzzer->hits[MUTATE_DSS_FLAGS] = 100;
+	for (i = 0; i < NUM_VARIANTS; ++i) {
+		struct packet *variant = fuzzer_mutate(fuzzer, seed);
+
+		assert(fuzzer->last_mutators != 0);
+		if (fuzzer->last_mutators & (1U << MUTATE_DSS_FLAGS))
+			++flags;
+		if (fuzzer->last_mutators & (1U << MUTATE_DSS_LENGTH))
+			++lengths;
+		packet_free(variant);
+	}
+	assert(flags > 10 * lengths);
+
+	packet_free(seed);
+	fuzzer_free(fuzzer);
+}
+
+/* A case fails if it holds all the packets whose seq is in the set. */
+struct culprits {
+	u32 seqs[4];
+	int num_seqs;
+	int num_trials;
+};
+
+static bool fails(struct packet **packets, int num_packets, void *arg)
+{
+	struct culprits *culprits = arg;
+	int i, j, found = 0;
+
+	++culprits->num_trials;
+	for (i = 0; i < culprits->num_seqs; ++i) {
+		for (j = 0; j < num_packets; ++j) {
+			if (ntohl(packets[j]->tcp->seq) == culprits->seqs[i]) {
+				++found;
+				break;
+			}
+		}
+	}
+	return found == culprits->num_seqs;
+}
+
+static void check_minimize(struct culprits *culprits, int expected)
+{
+	struct packet *packets[16];
+	bool seen[16];
+	int i, num;
+
+	for (i = 0; i < 16; ++i)
+		packets[i] = new_seed(i, dss, sizeof(dss));
+	num = fuzz_minimize(packets, 16, fails, culprits);
+	assert(num == expected);
+	assert(fails(packets, num, culprits));
+
+	/* The case keeps its order, and all packets are still there. */
+	for (i = 1; i < num; ++i)
+		assert(ntohl(packets[i - 1]->tcp->seq) <
+		       ntohl(packets[i]->tcp->seq));
+	memset(seen, 0, sizeof(seen));
+	for (i = 0; i < 16; ++i) {
+		u32 seq = ntohl(packets[i]->tcp->seq);
+
+		assert(seq < 16 && !seen[seq]);
+		seen[seq] = true;
+		packet_free(packets[i]);
+	}
+}
+
+static void test_minimize(void)
+{
+	struct culprits one = { .seqs = { 5 }, .num_seqs = 1 };
+	struct culprits two = { .seqs = { 3, 11 }, .num_seqs = 2 };
+	struct culprits three = { .seqs = { 0, 7, 15 }, .num_seqs = 3 };
+
+	check_minimize(&one, 1);
+	check_minimize(&two, 2);
+	check_minimize(&three, 3);
+}
+
+static void test_write_case(void)
+{
+	char path[] = "/tmp/fuzz_test.XXXXXX";
+	struct packet *packets[3];
+	char *error = NULL;
+	u8 magic[4];
+	FILE *f = NULL;
+	int fd, i;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	for (i = 0; i < 3; ++i)
+		packets[i] = new_seed(i, dss, sizeof(dss));
+	assert(fuzz_write_case(packets, 3, path, &error) == STATUS_OK);
+
+	/* A pcapng file starts with a section header block. */
+	f = fopen(path, "r");
+	assert(f != NULL);
+	assert(fread(magic, 1, sizeof(magic), f) == sizeof(magic));
+	assert(memcmp(magic, "\n\r\r\n", 4) == 0);
+	fclose(f);
+
+	unlink(path);
+	for (i = 0; i < 3; ++i)
+		packet_free(packets[i]);
+}
+
+/* A variant is written as the script plus a line with its options in
+ * raw hex and its sequence and ACK numbers back in script space.
+ */
+static void test_write_script_case(void)
+{
+	const char script[] = "0 socket(...) = 3\n+0 < S 0:0(0) win 1000";
+	char path[] = "/tmp/fuzz_test.XXXXXX";
+	struct packet *packet = new_seed(101000, dss, sizeof(dss));
+	char *error = NULL, *text = NULL;
+	size_t text_bytes = 0;
+	FILE *f = NULL;
+	int fd;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	packet->tcp->psh = 1;
+	assert(fuzz_write_script_case(script, strlen(script), packet,
+				      100000, 4000, path, &error) == STATUS_OK);
+
+	f = fopen(path, "r");
+	assert(f != NULL);
+	text = calloc(1, 4096);
+	text_bytes = fread(text, 1, 4095, f);
+	fclose(f);
+	assert(text_bytes > strlen(script));
+	assert(strncmp(text, script, strlen(script)) == 0);
+	assert(strstr(text, "\n+0 < P. 1000:1000(0) ack 1000 win 1000 "
+		      "<raw \"1e1420050000000100000001000000010"
+		      "00a0000\">\n") != NULL);
+	free(text);
+
+	/* A SYN's numbers are absolute. */
+	packet->tcp->syn = 1;
+	assert(fuzz_write_script_case(script, strlen(script), packet,
+				      100000, 4000, path, &error) == STATUS_OK);
+	f = fopen(path, "r");
+	text = calloc(1, 4096);
+	assert(fread(text, 1, 4095, f) > 0);
+	fclose(f);
+	assert(strstr(text, "+0 < SP. 101000:101000(0) ack 5000") != NULL);
+	free(text);
+
+	unlink(path);
+	packet_free(packet);
+}
+
+int main(void)
+{
+	test_mutate();
+	test_steering();
+	test_minimize();
+	test_write_case();
+	test_write_script_case();
+	return 0;
+}
@@ -26,9 +26,11 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "alloc_stats.h"
 #include "hash.h"
 
-static const size_t MAX_BUCKETS = 1ULL << 30;	/* max 1B buckets */
+static const size_t MAX_SLOTS = 1ULL << 30;	/* max 1B slots */
+static const size_t MIN_SLOTS = 8;
 
 /* Hash a key. We use the fast, public-domain MurmurHash3.*/
 static inline size_t hash_key(u32 key)
@@ -38,125 +40,211 @@ static inline size_t hash_key(u32 key)
 	return hash;
 }
 
-/* Find the bucket number for a key. */
-static inline size_t hash_bucket_num(const struct hash_map *map, u32 key)
+/* Find the home slot number for a key. */
+static inline size_t hash_slot_num(const struct hash_map *map, u32 key)
 {
-	size_t bucket_num = hash_key(key) & map->bucket_mask;
-	return bucket_num;
+	size_t slot_num = hash_key(key) & map->slot_mask;
+	return slot_num;
 }
 
-/* Try to find the smallest bucket count that is a power of 2 and is
- * greater than the given number of keys.
+/* Return whether the map is too full to add a key without growing.
+ * Robin Hood probing copes well with high loads; we keep it at 7/8.
  */
-static inline size_t hash_map_pick_bucket_count(size_t num_keys)
+static inline bool hash_map_is_full(const struct hash_map *map)
 {
-	size_t buckets = 1;
-	while ((buckets < num_keys) && (buckets < MAX_BUCKETS))
-		buckets <<= 1;
-	return buckets;
+	return ((map->num_keys + 1) * 8 > map->num_slots * 7) &&
+		(map->num_slots < MAX_SLOTS);
+}
+
+/* Try to find the smallest slot count that is a power of 2 and holds
+ * the given number of keys without growing.
+ */
+static inline size_t hash_map_pick_slot_count(size_t num_keys)
+{
+	size_t slots = MIN_SLOTS;
+	while ((num_keys * 8 > slots * 7) && (slots < MAX_SLOTS))
+		slots <<= 1;
+	return slots;
+}
+
+static void hash_map_alloc_slots(struct hash_map *map, size_t num_slots)
+{
+	map->num_slots = num_slots;
+	map->slot_mask = map->num_slots - 1;
+	map->slots = tagged_calloc(ALLOC_HASH_MAP, map->num_slots,
+				   sizeof(struct hash_entry));
 }
 
 struct hash_map *hash_map_new(size_t num_keys)
 {
-	struct hash_map *map = calloc(1, sizeof(struct hash_map));
-	map->num_buckets = hash_map_pick_bucket_count(num_keys);
-	map->bucket_mask = map->num_buckets - 1;
-	map->buckets = calloc(map->num_buckets, sizeof(struct hash_node *));
+	struct hash_map *map = tagged_calloc(ALLOC_HASH_MAP, 1,
+					       sizeof(struct hash_map));
+	hash_map_alloc_slots(map, hash_map_pick_slot_count(num_keys));
+	return map;
+}
+
+struct hash_map *hash_map_new_window(size_t window)
+{
+	struct hash_map *map = hash_map_new(1);
+	map->window = window;
 	return map;
 }
 
 void hash_map_free(struct hash_map *map)
 {
-	/* Walk through the buckets and free nodes. */
-	int bucket_num;
-	for (bucket_num = 0; bucket_num < map->num_buckets; ++bucket_num) {
-		struct hash_node *node = NULL;
-		struct hash_node *next = NULL;
-		for (node = map->buckets[bucket_num]; node != NULL;
-		     node = next) {
-			next = node->next;
-			free(node);
+	tagged_free(map->slots);
+	tagged_free(map->order);
+	memset(map, 0, sizeof(*map));	/* paranoia to help catch bugs */
+	tagged_free(map);
+}
+
+/* Put the entry in its place, moving richer entries down the line. The
+ * key must not be in the map already.
+ */
+static void hash_map_place(struct hash_map *map, struct hash_entry entry)
+{
+	size_t slot_num = hash_slot_num(map, entry.key);
+
+	entry.probe = 1;
+	for (;;) {
+		struct hash_entry *slot = &map->slots[slot_num];
+
+		if (slot->probe == 0) {
+			*slot = entry;
+			return;
+		}
+		if (slot->probe < entry.probe) {
+			struct hash_entry richer = *slot;
+			*slot = entry;
+			entry = richer;
 		}
+		++entry.probe;
+		slot_num = (slot_num + 1) & map->slot_mask;
 	}
+}
 
-	free(map->buckets);
-	memset(map, 0, sizeof(*map));	/* paranoia to help catch bugs */
-	free(map);
+/* Create a new array of slots that's twice the size of the current
+ * array. Then walk through the old slots and place all the entries in
+ * the new slots.
+ */
+static void hash_map_grow(struct hash_map *map)
+{
+	const size_t old_num_slots = map->num_slots;
+	struct hash_entry *old_slots = map->slots;
+	size_t old_slot_num = 0;
+
+	hash_map_alloc_slots(map, map->num_slots * 2);
+	for (old_slot_num = 0; old_slot_num < old_num_slots;
+	     ++old_slot_num) {
+		if (old_slots[old_slot_num].probe != 0)
+			hash_map_place(map, old_slots[old_slot_num]);
+	}
+
+	tagged_free(old_slots);
 }
 
-/* Link the given node into the correct bucket linked list in the hash map. */
-static void hash_map_link(struct hash_map *map,
-				  struct hash_node *node)
+/* Find the slot number holding the key. Since entries further from
+ * home come first, we can stop at the first entry closer to its home
+ * than the key would be.
+ */
+static bool hash_map_find(const struct hash_map *map, u32 key,
+			  size_t *slot_num)
 {
-	const size_t bucket_num = hash_bucket_num(map, node->key);
-	node->next = map->buckets[bucket_num];
-	map->buckets[bucket_num] = node;
+	size_t i = hash_slot_num(map, key);
+	u32 probe = 1;
+
+	for (; map->slots[i].probe >= probe; ++probe) {
+		if (map->slots[i].key == key) {
+			*slot_num = i;
+			return true;
+		}
+		i = (i + 1) & map->slot_mask;
+	}
+	return false;
 }
 
-/* Create a new array of buckets that's twice the size of the current
- * array. Then Walk through the old buckets and move all the nodes to
- * the new buckets.
+/* Remove the entry in the given slot, shifting the entries after it
+ * back towards their home slots.
  */
-static void hash_map_grow(struct hash_map *map)
+static void hash_map_remove_slot(struct hash_map *map, size_t slot_num)
 {
-	const size_t old_num_buckets = map->num_buckets;
-	map->num_buckets *= 2;
-	map->bucket_mask = map->num_buckets - 1;
-	struct hash_node **old_buckets = map->buckets;
-	map->buckets = calloc(map->num_buckets, sizeof(struct hash_node *));
-
-	size_t old_bucket_num = 0;
-	for (old_bucket_num = 0; old_bucket_num < old_num_buckets;
-	     ++old_bucket_num) {
-		struct hash_node *node = NULL;
-		struct hash_node *next = NULL;
-		for (node = old_buckets[old_bucket_num]; node != NULL;
-		     node = next) {
-			next = node->next;
-			hash_map_link(map, node);
+	for (;;) {
+		size_t next = (slot_num + 1) & map->slot_mask;
+
+		if (map->slots[next].probe <= 1) {
+			memset(&map->slots[slot_num], 0,
+			       sizeof(struct hash_entry));
+			break;
 		}
+		map->slots[slot_num] = map->slots[next];
+		--map->slots[slot_num].probe;
+		slot_num = next;
 	}
+	--map->num_keys;
+}
 
-	free(old_buckets);
+/* Remember that the key is the newest in a windowed map, first removing
+ * the oldest key if the window is full.
+ */
+static void hash_map_window_add(struct hash_map *map, u32 key)
+{
+	size_t slot_num = 0;
+
+	if (map->num_keys == map->window) {
+		u32 oldest = map->order[map->order_head];
+
+		if (hash_map_find(map, oldest, &slot_num))
+			hash_map_remove_slot(map, slot_num);
+		map->order_head = (map->order_head + 1) % map->order_size;
+	} else if (map->num_keys == map->order_size) {
+		/* Grow the ring, keeping its keys oldest first. */
+		size_t size = min(max(map->order_size * 2, MIN_SLOTS),
+				  map->window);
+		u32 *order = tagged_calloc(ALLOC_HASH_MAP, size, sizeof(u32));
+		size_t i;
+
+		for (i = 0; i < map->num_keys; ++i)
+			order[i] = map->order[(map->order_head + i) %
+					      map->order_size];
+		tagged_free(map->order);
+		map->order = order;
+		map->order_size = size;
+		map->order_head = 0;
+	}
+	map->order[(map->order_head + map->num_keys) % map->order_size] = key;
 }
 
-/* Insert a new node in the hash map, first growing the map if needed. */
+/* Insert a new entry in the hash map, first growing the map if needed. */
 static void hash_map_insert(struct hash_map *map, u32 key, u32 value)
 {
-	/* To keep things simple, we target a load factor of 1.0. */
-	if ((map->num_keys >= map->num_buckets) &&
-	    (map->num_buckets < MAX_BUCKETS)) {
+	struct hash_entry entry = { .key = key, .value = value };
+
+	if (map->window > 0)
+		hash_map_window_add(map, key);
+	if (hash_map_is_full(map))
 		hash_map_grow(map);
-	}
 	++map->num_keys;
-	struct hash_node *node = calloc(1, sizeof(struct hash_node));
-	node->key = key;
-	node->value = value;
-	hash_map_link(map, node);
+	hash_map_place(map, entry);
 }
 
 void hash_map_set(struct hash_map *map, u32 key, u32 value)
 {
-	const size_t bucket_num = hash_bucket_num(map, key);
-	struct hash_node *node = NULL;
-	for (node = map->buckets[bucket_num]; node != NULL; node = node->next) {
-		if (node->key == key) {
-			node->value = value;
-			return;
-		}
+	size_t slot_num = 0;
+
+	if (hash_map_find(map, key, &slot_num)) {
+		map->slots[slot_num].value = value;
+		return;
 	}
 	hash_map_insert(map, key, value);
 }
 
 bool hash_map_get(const struct hash_map *map, u32 key, u32 *value)
 {
-	const size_t bucket_num = hash_bucket_num(map, key);
-	struct hash_node *node = NULL;
-	for (node = map->buckets[bucket_num]; node != NULL; node = node->next) {
-		if (node->key == key) {
-			*value = node->value;
-			return true;
-		}
+	size_t slot_num = 0;
+
+	if (hash_map_find(map, key, &slot_num)) {
+		*value = map->slots[slot_num].value;
+		return true;
 	}
 	return false;
 }
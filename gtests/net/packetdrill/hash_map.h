@@ -28,23 +28,39 @@
 
 #include "types.h"
 
-/* Node for hash table buckets; maps u32 key to u32 value. */
-struct hash_node {
+/* Slot of the hash table; maps u32 key to u32 value. */
+struct hash_entry {
 	u32 key;
 	u32 value;
-	struct hash_node *next;
+	u32 probe;		/* 1 + slots from its home slot; 0 if empty */
 };
 
-/* Hash map mapping u32 to u32. */
+/* Hash map mapping u32 to u32. It uses open addressing with Robin Hood
+ * probing: an entry that is further from its home slot than the one
+ * in its way takes that slot, so all probe sequences stay short and a
+ * lookup scans a few adjacent slots instead of chasing pointers.
+ *
+ * A map made with hash_map_new_window() keeps only the newest keys:
+ * when adding a key would make it hold more than 'window' keys, the
+ * key that was added first goes away.
+ */
 struct hash_map {
 	size_t num_keys;		/* number of keys */
-	size_t num_buckets;		/* number of buckets (a power of 2) */
-	size_t bucket_mask;		/* bit mask to find bucket number */
-	struct hash_node **buckets;	/* array of hash buckets */
+	size_t num_slots;		/* number of slots (a power of 2) */
+	size_t slot_mask;		/* bit mask to find slot number */
+	struct hash_entry *slots;	/* array of slots */
+
+	size_t window;			/* if > 0, most keys we keep */
+	u32 *order;			/* ring of keys, oldest first */
+	size_t order_size;		/* slots in the ring */
+	size_t order_head;		/* index of oldest key in the ring */
 };
 
 extern struct hash_map *hash_map_new(size_t num_keys);
 
+/* Return a new map that keeps at most the 'window' newest keys. */
+extern struct hash_map *hash_map_new_window(size_t window);
+
 extern void hash_map_free(struct hash_map *map);
 
 extern void hash_map_set(struct hash_map *map,
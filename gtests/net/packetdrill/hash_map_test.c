@@ -0,0 +1,143 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for hash_map.c: keys map to their values across growth,
+ * agreeing with a plain array, and windowed maps keep only their
+ * newest keys.
+ */
+
+#include "hash_map.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_KEYS	100000
+
+static void test_basic(void)
+{
+	struct hash_map *map = hash_map_new(1);
+	u32 value = 0;
+
+	assert(!hash_map_get(map, 7, &value));
+	hash_map_set(map, 7, 70);
+	hash_map_set(map, 0, 1);
+	assert(hash_map_get(map, 7, &value) && value == 70);
+	assert(hash_map_get(map, 0, &value) && value == 1);
+	hash_map_set(map, 7, 71);
+	assert(hash_map_get(map, 7, &value) && value == 71);
+	assert(map->num_keys == 2);
+	hash_map_free(map);
+}
+
+/* Keys that are timestamps a few apart, as for ts_val_map. */
+static void test_grow(void)
+{
+	struct hash_map *map = hash_map_new(1);
+	u32 value = 0;
+	int i;
+
+	for (i = 0; i < NUM_KEYS; ++i)
+		hash_map_set(map, 1000000 + i * 3, i);
+	assert(map->num_keys == NUM_KEYS);
+	assert(map->num_keys * 8 <= map->num_slots * 7);
+	for (i = 0; i < NUM_KEYS; ++i) {
+		assert(hash_map_get(map, 1000000 + i * 3, &value));
+		assert(value == i);
+		assert(!hash_map_get(map, 1000000 + i * 3 + 1, &value));
+	}
+	hash_map_free(map);
+}
+
+/* A windowed map keeps the newest keys, in the order they were first
+ * set, and updating a key does not make it newer.
+ */
+static void test_window(void)
+{
+	const int window = 100;
+	struct hash_map *map = hash_map_new_window(window);
+	u32 value = 0;
+	int i;
+
+	for (i = 0; i < NUM_KEYS; ++i) {
+		hash_map_set(map, i, i + 1);
+		if (i > 0)
+			hash_map_set(map, i - 1, i);
+		assert(map->num_keys == min(i + 1, window));
+	}
+	for (i = 0; i < NUM_KEYS; ++i) {
+		bool found = hash_map_get(map, i, &value);
+
+		assert(found == (i >= NUM_KEYS - window));
+		assert(!found || value == i + 1);
+	}
+	hash_map_free(map);
+}
+
+/* Random keys, some repeating, with a window, checked against a
+ * simple model of the window: a FIFO of keys in the order they were
+ * added.
+ */
+static void test_random_window(void)
+{
+	const int window = 1000, range = 4 * window;
+	struct hash_map *map = hash_map_new_window(window);
+	bool *present = calloc(range, sizeof(bool));
+	u32 *values = calloc(range, sizeof(u32));
+	u32 *fifo = calloc(window, sizeof(u32));
+	int head = 0, count = 0;
+	u32 seed = 1, key, value = 0;
+	int i, k;
+
+	for (i = 0; i < NUM_KEYS; ++i) {
+		seed = seed * 1103515245 + 12345;
+		key = (seed >> 8) % range;
+		hash_map_set(map, key, i);
+
+		if (!present[key]) {
+			if (count == window) {
+				present[fifo[head]] = false;
+				head = (head + 1) % window;
+				--count;
+			}
+			fifo[(head + count++) % window] = key;
+			present[key] = true;
+		}
+		values[key] = i;
+
+		if (i % 1000 != 0)
+			continue;
+		assert(map->num_keys == count);
+		for (k = 0; k < range; ++k) {
+			assert(hash_map_get(map, k, &value) == present[k]);
+			assert(!present[k] || value == values[k]);
+		}
+	}
+	free(present);
+	free(values);
+	free(fifo);
+	hash_map_free(map);
+}
+
+int main(void)
+{
+	test_basic();
+	test_grow();
+	test_window();
+	test_random_window();
+	return 0;
+}
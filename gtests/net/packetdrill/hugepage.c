@@ -0,0 +1,145 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of huge page backed regions; see hugepage.h.
+ */
+
+#include "hugepage.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "logging.h"
+
+int parse_hugepages(const char *name, enum hugepages_t *hugepages)
+{
+	if (strcmp(name, "none") == 0)
+		*hugepages = HUGEPAGES_NONE;
+	else if (strcmp(name, "thp") == 0)
+		*hugepages = HUGEPAGES_THP;
+	else if (strcmp(name, "hugetlb") == 0)
+		*hugepages = HUGEPAGES_HUGETLB;
+	else
+		return STATUS_ERR;
+	return STATUS_OK;
+}
+
+const char *hugepages_name(enum hugepages_t hugepages)
+{
+	switch (hugepages) {
+	case HUGEPAGES_NONE:	return "none";
+	case HUGEPAGES_THP:	return "thp";
+	case HUGEPAGES_HUGETLB:	return "hugetlb";
+	/* missing default case so compiler catches missing cases */
+	}
+	return "invalid";
+}
+
+static size_t round_up(size_t bytes, size_t unit)
+{
+	return (bytes + unit - 1) / unit * unit;
+}
+
+static void *map_anonymous(size_t bytes, int flags)
+{
+	return mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANON | flags, -1, 0);
+}
+
+/* Map a region aligned to a huge page, and hint that we want it on
+ * huge pages: mapping one huge page more than we need and trimming the
+ * ends is the usual way to get the alignment.
+ */
+static void *map_thp(size_t bytes)
+{
+	u8 *map = map_anonymous(bytes + HUGEPAGE_BYTES, 0);
+	u8 *start;
+
+	if (map == MAP_FAILED)
+		return MAP_FAILED;
+	start = (u8 *)round_up((uintptr_t)map, HUGEPAGE_BYTES);
+	if (start > map)
+		munmap(map, start - map);
+	munmap(start + bytes, map + HUGEPAGE_BYTES - start);
+#ifdef MADV_HUGEPAGE
+	if (madvise(start, bytes, MADV_HUGEPAGE) != 0)
+		DEBUGP("madvise MADV_HUGEPAGE: %s\n", strerror(errno));
+#endif
+	return start;
+}
+
+int hugepage_map(size_t bytes, enum hugepages_t hugepages, bool populate,
+		 struct hugepage_region *region, char **error)
+{
+	int flags = 0;
+
+	memset(region, 0, sizeof(*region));
+#ifdef MAP_POPULATE
+	if (populate)
+		flags |= MAP_POPULATE;
+#endif
+
+#ifdef MAP_HUGETLB
+	if (hugepages == HUGEPAGES_HUGETLB) {
+		region->bytes = round_up(bytes, HUGEPAGE_BYTES);
+		region->start = map_anonymous(region->bytes,
+					      flags | MAP_HUGETLB);
+		if (region->start != MAP_FAILED) {
+			region->backing = HUGEPAGES_HUGETLB;
+			return STATUS_OK;
+		}
+		DEBUGP("MAP_HUGETLB of %zu bytes: %s\n", region->bytes,
+		       strerror(errno));
+	}
+#endif
+
+#ifdef MADV_HUGEPAGE
+	if (hugepages != HUGEPAGES_NONE) {
+		region->bytes = round_up(bytes, HUGEPAGE_BYTES);
+		region->start = map_thp(region->bytes);
+		if (region->start != MAP_FAILED) {
+			region->backing = HUGEPAGES_THP;
+			/* Fault in after the hint, so we fault in huge
+			 * pages.
+			 */
+			if (populate)
+				memset(region->start, 0, region->bytes);
+			return STATUS_OK;
+		}
+	}
+#endif
+
+	region->bytes = round_up(bytes, getpagesize());
+	region->start = map_anonymous(region->bytes, flags);
+	if (region->start == MAP_FAILED) {
+		asprintf(error, "cannot map %zu bytes: %s", region->bytes,
+			 strerror(errno));
+		memset(region, 0, sizeof(*region));
+		return STATUS_ERR;
+	}
+	region->backing = HUGEPAGES_NONE;
+	return STATUS_OK;
+}
+
+void hugepage_unmap(struct hugepage_region *region)
+{
+	if (region->start != NULL)
+		munmap(region->start, region->bytes);
+	memset(region, 0, sizeof(*region));
+}
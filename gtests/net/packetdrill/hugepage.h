@@ -0,0 +1,74 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Mapping memory we touch on every packet, the packet pool and the
+ * AF_XDP UMEM, on 2MB huge pages, as selected with --hugepages.
+ *
+ * With --hugepages=hugetlb we ask for pages from the host's reserved
+ * pool with MAP_HUGETLB; if none are free, or with --hugepages=thp, we
+ * align the region to 2MB and madvise(MADV_HUGEPAGE) for transparent
+ * huge pages, which is only a hint; and where neither is supported we
+ * use ordinary pages. So a region always maps, and says how it ended
+ * up backed. One huge page covers what would be 512 TLB entries, and
+ * a region locked with --mlock=hot is charged in one piece.
+ */
+
+#ifndef __HUGEPAGE_H__
+#define __HUGEPAGE_H__
+
+#include "types.h"
+
+#include <stddef.h>
+
+/* The size of the huge pages we ask for. */
+#define HUGEPAGE_BYTES		(2 * 1024 * 1024)
+
+enum hugepages_t {
+	HUGEPAGES_NONE = 0,	/* ordinary pages; the default */
+	HUGEPAGES_THP,		/* transparent huge pages, if we can */
+	HUGEPAGES_HUGETLB,	/* reserved huge pages, else as THP */
+};
+
+/* A region mapped by hugepage_map(). */
+struct hugepage_region {
+	void *start;
+	size_t bytes;			/* as mapped, rounded up */
+	enum hugepages_t backing;	/* what we actually got */
+};
+
+/* Parse the argument of --hugepages: "none", "thp" or "hugetlb".
+ * Returns STATUS_OK on success, or STATUS_ERR if there is no such
+ * setting.
+ */
+extern int parse_hugepages(const char *name, enum hugepages_t *hugepages);
+
+/* Return the name of the given setting, as --hugepages takes it. */
+extern const char *hugepages_name(enum hugepages_t hugepages);
+
+/* Map a zeroed region of at least the given number of bytes, backed as
+ * well as the host allows of what was asked for, faulting in every page
+ * now if populate is set. Returns STATUS_OK on success; on failure
+ * returns STATUS_ERR and sets error message.
+ */
+extern int hugepage_map(size_t bytes, enum hugepages_t hugepages,
+			bool populate, struct hugepage_region *region,
+			char **error);
+
+/* Unmap a region from hugepage_map(), if it is mapped. */
+extern void hugepage_unmap(struct hugepage_region *region);
+
+#endif /* __HUGEPAGE_H__ */
@@ -0,0 +1,118 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for hugepage.c: every setting maps a usable region whatever
+ * the host has, and a packet pool on a slab keeps the slab's packets.
+ */
+
+#include "hugepage.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "packet.h"
+
+static void test_parse(void)
+{
+	enum hugepages_t hugepages;
+
+	assert(parse_hugepages("none", &hugepages) == STATUS_OK);
+	assert(hugepages == HUGEPAGES_NONE);
+	assert(parse_hugepages("thp", &hugepages) == STATUS_OK);
+	assert(hugepages == HUGEPAGES_THP);
+	assert(parse_hugepages("hugetlb", &hugepages) == STATUS_OK);
+	assert(hugepages == HUGEPAGES_HUGETLB);
+	assert(strcmp(hugepages_name(hugepages), "hugetlb") == 0);
+	assert(parse_hugepages("1g", &hugepages) == STATUS_ERR);
+}
+
+/* Whatever the host gives us, we get a zeroed, writable region, on no
+ * better pages than we asked for, and aligned for huge ones if on them.
+ */
+static void test_map(enum hugepages_t hugepages)
+{
+	struct hugepage_region region;
+	char *error = NULL;
+	size_t bytes = 3 * 1024 * 1024 + 1;
+	u8 *p;
+	size_t i;
+
+	assert(hugepage_map(bytes, hugepages, true, &region,
+			    &error) == STATUS_OK);
+	assert(region.start != NULL);
+	assert(region.bytes >= bytes);
+	assert(region.backing <= hugepages);
+	if (region.backing != HUGEPAGES_NONE) {
+		assert((uintptr_t)region.start % HUGEPAGE_BYTES == 0);
+		assert(region.bytes % HUGEPAGE_BYTES == 0);
+	}
+	p = region.start;
+	for (i = 0; i < region.bytes; i += 4096) {
+		assert(p[i] == 0);
+		p[i] = 1;
+	}
+	p[region.bytes - 1] = 1;
+	hugepage_unmap(&region);
+	assert(region.start == NULL);
+	hugepage_unmap(&region);
+}
+
+static void test_pool(void)
+{
+	struct packet_pool *pool = packet_pool_new(2048, 4);
+	struct packet *packets[6];
+	char *error = NULL;
+	int i;
+
+	packet_pool_fill(pool, 2);
+	assert(packet_pool_map(pool, HUGEPAGES_THP, &error) == STATUS_OK);
+	assert(pool->num_free == 4);
+
+	/* Two more than the slab holds come from malloc(). */
+	for (i = 0; i < 6; i++) {
+		packets[i] = packet_pool_get(pool, 1500);
+		memset(packets[i]->buffer, 0xff, 1500);
+	}
+	assert(pool->num_free == 0);
+
+	/* The two from malloc() come back first, but the slab's packets
+	 * take their places.
+	 */
+	for (i = 5; i >= 0; i--)
+		packet_free(packets[i]);
+	assert(pool->num_free == 4);
+	for (i = 0; i < 4; i++) {
+		u8 *packet = (u8 *)pool->free_packets[i];
+
+		assert(packet >= (u8 *)pool->slab.start &&
+		       packet < (u8 *)pool->slab.start + pool->slab.bytes);
+		assert(pool->free_packets[i]->buffer ==
+		       (u8 *)(pool->free_packets[i] + 1));
+	}
+	packet_pool_free(pool);
+}
+
+int main(void)
+{
+	test_parse();
+	test_map(HUGEPAGES_NONE);
+	test_map(HUGEPAGES_THP);
+	test_map(HUGEPAGES_HUGETLB);
+	test_pool();
+	return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the JUnit XML report; see junit_report.h.
+ */
+
+#include "junit_report.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct junit_report *junit_report_new(void)
+{
+	return calloc(1, sizeof(struct junit_report));
+}
+
+void junit_report_free(struct junit_report *report)
+{
+	int i;
+
+	for (i = 0; i < report->num_cases; ++i) {
+		free(report->cases[i].script_path);
+		free(report->cases[i].output);
+	}
+	free(report->cases);
+	free(report);
+}
+
+void junit_report_add(struct junit_report *report, const char *script_path,
+		      enum junit_status_t status, double secs,
+		      const char *output, size_t output_len)
+{
+	struct junit_case *c;
+
+	if (report->num_cases == report->max_cases) {
+		report->max_cases = report->max_cases ?
+			2 * report->max_cases : 64;
+		report->cases = realloc(report->cases, report->max_cases *
+					sizeof(report->cases[0]));
+	}
+	c = &report->cases[report->num_cases++];
+	c->script_path = strdup(script_path);
+	c->status = status;
+	c->secs = secs;
+	c->output = (status == JUNIT_FAILED && output != NULL) ?
+		strndup(output, output_len) : NULL;
+}
+
+/* Write the string with XML's special characters escaped, leaving out
+ * the control characters XML 1.0 does not allow at all.
+ */
+static void write_xml_string(const char *string, FILE *out)
+{
+	const unsigned char *p;
+
+	for (p = (const unsigned char *)string; *p != '\0'; p++) {
+		switch (*p) {
+		case '<':  fputs("&lt;", out);   break;
+		case '>':  fputs("&gt;", out);   break;
+		case '&':  fputs("&amp;", out);  break;
+		case '"':  fputs("&quot;", out); break;
+		default:
+			if (*p >= 0x20 || *p == '\n' || *p == '\t')
+				fputc(*p, out);
+			break;
+		}
+	}
+}
+
+/* Name a case after its file, and its class after its directory, as
+ * JUnit viewers group cases by class.
+ */
+static void write_case(const struct junit_case *c, FILE *out)
+{
+	const char *slash = strrchr(c->script_path, '/');
+	char *dir = slash ? strndup(c->script_path, slash - c->script_path) :
+		strdup(".");
+
+	fputs("  <testcase classname=\"", out);
+	write_xml_string(dir, out);
+	fputs("\" name=\"", out);
+	write_xml_string(slash ? slash + 1 : c->script_path, out);
+	fprintf(out, "\" time=\"%.3f\"", c->secs);
+	free(dir);
+
+	switch (c->status) {
+	case JUNIT_PASSED:
+		fputs("/>\n", out);
+		break;
+	case JUNIT_SKIPPED:
+		fputs(">\n    <skipped/>\n  </testcase>\n", out);
+		break;
+	case JUNIT_FAILED: {
+		const char *output = c->output ? c->output : "";
+		const char *newline = strchr(output, '\n');
+		char *message = newline ? strndup(output, newline - output) :
+			strdup(output);
+
+		fputs(">\n    <failure message=\"", out);
+		write_xml_string(message, out);
+		fputs("\">", out);
+		write_xml_string(output, out);
+		fputs("</failure>\n  </testcase>\n", out);
+		free(message);
+		break;
+	}
+	}
+}
+
+int junit_report_write(const struct junit_report *report, const char *path,
+		       char **error)
+{
+	int failures = 0, skipped = 0, i;
+	double secs = 0;
+	FILE *out = fopen(path, "w");
+
+	if (out == NULL) {
+		asprintf(error, "cannot open %s: %s", path, strerror(errno));
+		return STATUS_ERR;
+	}
+	for (i = 0; i < report->num_cases; ++i) {
+		failures += (report->cases[i].status == JUNIT_FAILED);
+		skipped += (report->cases[i].status == JUNIT_SKIPPED);
+		secs += report->cases[i].secs;
+	}
+	fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<testsuite name=\"packetdrill\" tests=\"%d\" "
+		"failures=\"%d\" skipped=\"%d\" time=\"%.3f\">\n",
+		report->num_cases, failures, skipped, secs);
+	for (i = 0; i < report->num_cases; ++i)
+		write_case(&report->cases[i], out);
+	fputs("</testsuite>\n", out);
+	if (fclose(out) != 0) {
+		asprintf(error, "error writing %s", path);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
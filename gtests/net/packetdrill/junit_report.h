@@ -0,0 +1,69 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * A JUnit XML report of a suite run (--junit_report=<file>), for CI
+ * systems and dashboards that read that format. The --jobs runner and
+ * the daemon coordinator add each script as it finishes, and write the
+ * report at the end; per-event detail streams out as JSON lines through
+ * --timing_report as each script runs.
+ */
+
+#ifndef __JUNIT_REPORT_H__
+#define __JUNIT_REPORT_H__
+
+#include "types.h"
+
+enum junit_status_t {
+	JUNIT_PASSED,
+	JUNIT_FAILED,
+	JUNIT_SKIPPED,
+};
+
+struct junit_case {
+	char *script_path;
+	enum junit_status_t status;
+	double secs;
+	char *output;		/* what a failing script printed, or NULL */
+};
+
+struct junit_report {
+	struct junit_case *cases;
+	int num_cases;
+	int max_cases;
+};
+
+/* Allocate an empty report. */
+extern struct junit_report *junit_report_new(void);
+
+/* Free a report. */
+extern void junit_report_free(struct junit_report *report);
+
+/* Add a script's result; output (output_len bytes, not necessarily
+ * terminated) is what it printed, kept only for failures.
+ */
+extern void junit_report_add(struct junit_report *report,
+			     const char *script_path,
+			     enum junit_status_t status, double secs,
+			     const char *output, size_t output_len);
+
+/* Write the report to the given path. On success, returns STATUS_OK;
+ * on failure, returns STATUS_ERR and fills in *error.
+ */
+extern int junit_report_write(const struct junit_report *report,
+			      const char *path, char **error);
+
+#endif /* __JUNIT_REPORT_H__ */
@@ -0,0 +1,76 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for junit_report.c.
+ */
+
+#include "junit_report.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char *read_file(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char *text = calloc(1, 4096);
+
+	assert(f != NULL);
+	assert(fread(text, 1, 4095, f) > 0);
+	fclose(f);
+	return text;
+}
+
+int main(void)
+{
+	char path[] = "/tmp/junit_report_test.XXXXXX";
+	const char output[] = "a/b.pkt:7: error handling packet: "
+			      "bad value <3> & \"more\"\n\x01more output\n";
+	struct junit_report *report = junit_report_new();
+	char *error = NULL, *xml;
+	int fd = mkstemp(path);
+
+	assert(fd >= 0);
+	close(fd);
+
+	junit_report_add(report, "a/b.pkt", JUNIT_FAILED, 1.5,
+			 output, strlen(output));
+	junit_report_add(report, "a/c.pkt", JUNIT_PASSED, 0.25,
+			 "ignored", 7);
+	junit_report_add(report, "d.pkt", JUNIT_SKIPPED, 0, NULL, 0);
+	assert(junit_report_write(report, path, &error) == STATUS_OK);
+	junit_report_free(report);
+
+	xml = read_file(path);
+	assert(strstr(xml, "<testsuite name=\"packetdrill\" tests=\"3\" "
+		      "failures=\"1\" skipped=\"1\" time=\"1.750\">"));
+	assert(strstr(xml, "<testcase classname=\"a\" name=\"b.pkt\" "
+		      "time=\"1.500\">"));
+	assert(strstr(xml, "<failure message=\"a/b.pkt:7: error handling "
+		      "packet: bad value &lt;3&gt; &amp; &quot;more&quot;\">"));
+	assert(strstr(xml, "\nmore output\n</failure>"));
+	assert(strstr(xml, "<testcase classname=\"a\" name=\"c.pkt\" "
+		      "time=\"0.250\"/>"));
+	assert(strstr(xml, "<testcase classname=\".\" name=\"d.pkt\" "
+		      "time=\"0.000\">\n    <skipped/>"));
+	assert(strstr(xml, "ignored") == NULL);
+	free(xml);
+	unlink(path);
+	return 0;
+}
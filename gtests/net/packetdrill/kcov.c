@@ -0,0 +1,161 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of kernel coverage for the fuzzer; see kcov.h.
+ */
+
+#include "kcov.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "platforms.h"
+
+#ifdef HAVE_KCOV
+#include <linux/kcov.h>
+#endif
+
+/* Mix the bits of a PC, so that nearby PCs land far apart. */
+static inline u32 pc_hash(unsigned long pc)
+{
+	u64 x = pc;
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return (u32)x;
+}
+
+int kcov_map_merge(u8 *map, const unsigned long *pcs, int num_pcs)
+{
+	u32 prev = 0;
+	int new_edges = 0;
+	int i;
+
+	for (i = 0; i < num_pcs; ++i) {
+		u32 cur = pc_hash(pcs[i]);
+		u32 edge = (cur ^ (prev >> 1)) & (KCOV_MAP_BITS - 1);
+		u8 bit = 1 << (edge & 7);
+
+		if (!(map[edge / 8] & bit)) {
+			map[edge / 8] |= bit;
+			++new_edges;
+		}
+		prev = cur;
+	}
+	return new_edges;
+}
+
+#ifdef HAVE_KCOV
+
+struct kcov *kcov_new(char **error)
+{
+	struct kcov *kcov = calloc(1, sizeof(struct kcov));
+	size_t bytes = (KCOV_MAX_PCS + 1) * sizeof(unsigned long);
+
+	kcov->fd = open("/sys/kernel/debug/kcov", O_RDWR | O_CLOEXEC);
+	if (kcov->fd < 0) {
+		asprintf(error, "cannot open /sys/kernel/debug/kcov: %s "
+			 "(is the kernel built with CONFIG_KCOV and "
+			 "debugfs mounted?)", strerror(errno));
+		goto fail;
+	}
+	if (ioctl(kcov->fd, KCOV_INIT_TRACE, KCOV_MAX_PCS + 1) != 0) {
+		asprintf(error, "KCOV_INIT_TRACE: %s", strerror(errno));
+		goto fail;
+	}
+	kcov->cover = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   kcov->fd, 0);
+	if (kcov->cover == MAP_FAILED) {
+		kcov->cover = NULL;
+		asprintf(error, "mmap of KCOV buffer: %s", strerror(errno));
+		goto fail;
+	}
+	if (ioctl(kcov->fd, KCOV_ENABLE, KCOV_TRACE_PC) != 0) {
+		asprintf(error, "KCOV_ENABLE: %s", strerror(errno));
+		goto fail;
+	}
+	return kcov;
+
+fail:
+	if (kcov->cover != NULL)
+		munmap(kcov->cover, bytes);
+	if (kcov->fd >= 0)
+		close(kcov->fd);
+	free(kcov);
+	return NULL;
+}
+
+void kcov_free(struct kcov *kcov)
+{
+	if (kcov == NULL)
+		return;
+	ioctl(kcov->fd, KCOV_DISABLE, 0);
+	munmap(kcov->cover, (KCOV_MAX_PCS + 1) * sizeof(unsigned long));
+	close(kcov->fd);
+	memset(kcov, 0, sizeof(*kcov));  /* paranoia to help catch bugs */
+	free(kcov);
+}
+
+/* The kernel appends to the buffer and bumps the count in cover[0]
+ * as the thread runs, so we only ever reset and read the count.
+ */
+void kcov_begin(struct kcov *kcov)
+{
+	__atomic_store_n(&kcov->cover[0], 0, __ATOMIC_RELAXED);
+}
+
+int kcov_end(struct kcov *kcov)
+{
+	unsigned long num_pcs = __atomic_load_n(&kcov->cover[0],
+						__ATOMIC_RELAXED);
+	int new_edges;
+
+	if (num_pcs > KCOV_MAX_PCS)
+		num_pcs = KCOV_MAX_PCS;
+	new_edges = kcov_map_merge(kcov->map, kcov->cover + 1, num_pcs);
+	kcov->num_edges += new_edges;
+	return new_edges;
+}
+
+#else  /* !HAVE_KCOV */
+
+struct kcov *kcov_new(char **error)
+{
+	asprintf(error, "no KCOV on this platform");
+	return NULL;
+}
+
+void kcov_free(struct kcov *kcov)
+{
+}
+
+void kcov_begin(struct kcov *kcov)
+{
+}
+
+int kcov_end(struct kcov *kcov)
+{
+	return 0;
+}
+
+#endif  /* HAVE_KCOV */
@@ -0,0 +1,75 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Kernel coverage, for steering --fuzz towards packets that reach new
+ * code. We read it from /sys/kernel/debug/kcov, which a kernel built
+ * with CONFIG_KCOV offers: once enabled for a thread, the kernel
+ * records the PC of every basic block that thread runs in a buffer we
+ * share with it.
+ *
+ * Writing a packet to the tun device hands it to the stack within the
+ * write, in the writing thread with bottom halves disabled, which KCOV
+ * still counts as the thread's own. So wrapping each injected packet
+ * in kcov_begin() and kcov_end() gives us the TCP and MPTCP code that
+ * packet ran. We fold those PCs, pairwise, into a bitmap of edges, as
+ * AFL does, and a packet is interesting if it sets a bit no packet
+ * before it did.
+ */
+
+#ifndef __KCOV_H__
+#define __KCOV_H__
+
+#include "types.h"
+
+/* Most PCs one packet may record; the kernel drops any beyond this. */
+#define KCOV_MAX_PCS		(1 << 18)
+
+/* Bits in the edge bitmap; a power of 2. */
+#define KCOV_MAP_BITS		(1 << 16)
+
+struct kcov {
+	int fd;				/* /sys/kernel/debug/kcov */
+	unsigned long *cover;		/* count, then PCs, shared */
+	u8 map[KCOV_MAP_BITS / 8];	/* edges seen so far */
+	u32 num_edges;			/* bits set in map */
+};
+
+/* Open KCOV and enable it for the calling thread, which must be the
+ * one that injects the packets. Returns NULL and sets an error message
+ * if the kernel has no KCOV or we may not use it.
+ */
+extern struct kcov *kcov_new(char **error);
+
+/* Disable KCOV for the calling thread and free everything. */
+extern void kcov_free(struct kcov *kcov);
+
+/* Start recording the PCs the calling thread runs in the kernel. */
+extern void kcov_begin(struct kcov *kcov);
+
+/* Stop recording, fold what was recorded since kcov_begin() into the
+ * edge bitmap, and return the number of edges that were new.
+ */
+extern int kcov_end(struct kcov *kcov);
+
+/* Fold the given run of PCs into the given edge bitmap of
+ * KCOV_MAP_BITS bits, and return the number of edges that were new.
+ * An edge is a pair of consecutive PCs, so the same blocks run in
+ * another order count as new.
+ */
+extern int kcov_map_merge(u8 *map, const unsigned long *pcs, int num_pcs);
+
+#endif /* __KCOV_H__ */
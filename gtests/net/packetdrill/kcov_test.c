@@ -0,0 +1,80 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for kcov.c: folding PCs into the edge bitmap. Reading
+ * coverage from the kernel needs a CONFIG_KCOV kernel, so we only
+ * check that it either works or says why not.
+ */
+
+#include "kcov.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void test_merge(void)
+{
+	static u8 map[KCOV_MAP_BITS / 8];
+	unsigned long run[] = {
+		0xffffffff81001000UL, 0xffffffff81001040UL,
+		0xffffffff81002000UL, 0xffffffff81003000UL,
+	};
+	unsigned long swapped[] = {
+		0xffffffff81001000UL, 0xffffffff81002000UL,
+		0xffffffff81001040UL, 0xffffffff81003000UL,
+	};
+	int new_edges;
+
+	memset(map, 0, sizeof(map));
+	assert(kcov_map_merge(map, run, 0) == 0);
+
+	/* Every edge of a first run is new; none are the second time. */
+	new_edges = kcov_map_merge(map, run, 4);
+	assert(new_edges >= 3 && new_edges <= 4);
+	assert(kcov_map_merge(map, run, 4) == 0);
+	assert(kcov_map_merge(map, run, 2) == 0);
+
+	/* The same blocks in another order are new edges. */
+	assert(kcov_map_merge(map, swapped, 4) > 0);
+	assert(kcov_map_merge(map, swapped, 4) == 0);
+}
+
+static void test_kernel(void)
+{
+	struct kcov *kcov = NULL;
+	char *error = NULL;
+
+	kcov = kcov_new(&error);
+	if (kcov == NULL) {
+		assert(error != NULL && strlen(error) > 0);
+		free(error);
+		return;
+	}
+	kcov_begin(kcov);
+	assert(getpid() > 0);
+	kcov_end(kcov);
+	assert(kcov->num_edges > 0);
+	kcov_free(kcov);
+}
+
+int main(void)
+{
+	test_merge();
+	test_kernel();
+	return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Histograms of the kernel's latency in answering our packets; see
+ * kernel_latency.h.
+ */
+
+#include "kernel_latency.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "hash_map.h"
+#include "logging.h"
+#include "timing_stats.h"
+
+/* Keys of socket groups in the map; line groups are keyed by line. */
+#define SOCKET_KEY_BIT		0x80000000U
+
+/* The latencies of one script line or one socket. */
+struct latency_group {
+	bool is_socket;
+	u32 id;				/* line number or socket id */
+	char *name;			/* socket name, or NULL */
+	struct timing_histogram histogram;
+};
+
+struct kernel_latency {
+	struct hash_map *index;		/* key to index in groups */
+	struct latency_group **groups;
+	int num_groups;
+	int max_groups;
+};
+
+int parse_kernel_latency_limits(const char *arg,
+				struct latency_limit *limits,
+				int *num_limits, char **error)
+{
+	char *argdup = strdup(arg), *saveptr = NULL;
+	char *token, *value, *end;
+	int result = STATUS_ERR;
+
+	*num_limits = 0;
+	for (token = strtok_r(argdup, ",", &saveptr); token != NULL;
+	     token = strtok_r(NULL, ",", &saveptr)) {
+		struct latency_limit *limit = &limits[*num_limits];
+		const char *digits;
+
+		value = strchr(token, '=');
+		if (value == NULL) {
+			asprintf(error, "bad limit: %s", token);
+			goto out;
+		}
+		*value++ = '\0';
+		if (*num_limits == KERNEL_LATENCY_MAX_LIMITS) {
+			asprintf(error, "more than %d limits",
+				 KERNEL_LATENCY_MAX_LIMITS);
+			goto out;
+		}
+		if (strcmp(token, "max") == 0) {
+			limit->fraction = 1.0;
+		} else if (token[0] == 'p' && strlen(token) >= 3 &&
+			   strlen(token) <= 6 &&
+			   strspn(token + 1, "0123456789") ==
+			   strlen(token + 1)) {
+			/* "p99" is 0.99 and "p999" is 0.999. */
+			limit->fraction = 0;
+			for (digits = token + strlen(token) - 1;
+			     digits > token; --digits)
+				limit->fraction =
+					(limit->fraction + (*digits - '0')) /
+					10;
+		} else {
+			asprintf(error, "bad percentile: %s", token);
+			goto out;
+		}
+		limit->max_usecs = strtoll(value, &end, 10);
+		if (end == value || *end != '\0' || limit->max_usecs < 0) {
+			asprintf(error, "bad usecs for %s: %s", token, value);
+			goto out;
+		}
+		strcpy(limit->name, token);
+		(*num_limits)++;
+	}
+	if (*num_limits == 0) {
+		asprintf(error, "no limits");
+		goto out;
+	}
+	result = STATUS_OK;
+out:
+	free(argdup);
+	return result;
+}
+
+struct kernel_latency *kernel_latency_new(void)
+{
+	struct kernel_latency *latency = calloc(1, sizeof(*latency));
+
+	latency->index = hash_map_new(64);
+	return latency;
+}
+
+void kernel_latency_free(struct kernel_latency *latency)
+{
+	int i;
+
+	if (latency == NULL)
+		return;
+	for (i = 0; i < latency->num_groups; ++i) {
+		free(latency->groups[i]->name);
+		free(latency->groups[i]);
+	}
+	free(latency->groups);
+	hash_map_free(latency->index);
+	free(latency);
+}
+
+static struct latency_group *find_group(struct kernel_latency *latency,
+					bool is_socket, u32 id,
+					const char *name)
+{
+	u32 key = is_socket ? (id | SOCKET_KEY_BIT) : id;
+	struct latency_group *group;
+	u32 i;
+
+	if (hash_map_get(latency->index, key, &i))
+		return latency->groups[i];
+
+	if (latency->num_groups == latency->max_groups) {
+		latency->max_groups = latency->max_groups ?
+			2 * latency->max_groups : 16;
+		latency->groups = realloc(latency->groups,
+					  latency->max_groups *
+					  sizeof(latency->groups[0]));
+	}
+	group = calloc(1, sizeof(*group));
+	group->is_socket = is_socket;
+	group->id = id;
+	if (name != NULL)
+		group->name = strdup(name);
+	hash_map_set(latency->index, key, latency->num_groups);
+	latency->groups[latency->num_groups++] = group;
+	return group;
+}
+
+void kernel_latency_record(struct kernel_latency *latency,
+			   int line_number, u32 socket_id,
+			   const char *socket_name, s64 usecs)
+{
+	timing_record(&find_group(latency, false, line_number,
+				  NULL)->histogram, usecs, false);
+	timing_record(&find_group(latency, true, socket_id,
+				  socket_name)->histogram, usecs, false);
+}
+
+/* Lines in script order, then sockets in the order they were made. */
+static int compare_groups(const void *a, const void *b)
+{
+	const struct latency_group *x = *(const struct latency_group **)a;
+	const struct latency_group *y = *(const struct latency_group **)b;
+
+	if (x->is_socket != y->is_socket)
+		return x->is_socket ? 1 : -1;
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+static struct latency_group **sorted_groups(
+	const struct kernel_latency *latency)
+{
+	struct latency_group **groups =
+		malloc((latency->num_groups + 1) * sizeof(groups[0]));
+
+	memcpy(groups, latency->groups,
+	       latency->num_groups * sizeof(groups[0]));
+	qsort(groups, latency->num_groups, sizeof(groups[0]),
+	      compare_groups);
+	return groups;
+}
+
+static void group_label(const struct latency_group *group, char *label,
+			size_t size)
+{
+	if (group->is_socket)
+		snprintf(label, size, "socket %s", group->name);
+	else
+		snprintf(label, size, "line %u", group->id);
+}
+
+void kernel_latency_report(const struct kernel_latency *latency,
+			   FILE *out)
+{
+	struct latency_group **groups = sorted_groups(latency);
+	char label[64];
+	int i;
+
+	fprintf(out, "kernel latency (usecs):\n  %-24s %8s %8s %8s %8s %8s "
+		"%8s\n", "", "count", "min", "p50", "p90", "p99", "max");
+	for (i = 0; i < latency->num_groups; ++i) {
+		const struct timing_histogram *h = &groups[i]->histogram;
+
+		group_label(groups[i], label, sizeof(label));
+		fprintf(out, "  %-24s %8llu %8lld %8lld %8lld %8lld %8lld\n",
+			label, h->count, h->min_usecs,
+			timing_percentile(h, 0.5), timing_percentile(h, 0.9),
+			timing_percentile(h, 0.99), h->max_usecs);
+	}
+	free(groups);
+}
+
+void kernel_latency_write_json(const struct kernel_latency *latency,
+			       FILE *out)
+{
+	struct latency_group **groups = sorted_groups(latency);
+	const char *sep = "";
+	int i;
+
+	fprintf(out, "[");
+	for (i = 0; i < latency->num_groups; ++i) {
+		const struct timing_histogram *h = &groups[i]->histogram;
+
+		if (groups[i]->is_socket)
+			continue;
+		fprintf(out, "%s{\"line\": %u, \"count\": %llu, "
+			"\"mean_usecs\": %.1f, \"stddev_usecs\": %.1f, "
+			"\"p50_usecs\": %lld, \"p99_usecs\": %lld, "
+			"\"max_usecs\": %lld}",
+			sep, groups[i]->id, h->count,
+			timing_mean_magnitude(h), timing_stddev_magnitude(h),
+			timing_percentile(h, 0.5), timing_percentile(h, 0.99),
+			h->max_usecs);
+		sep = ", ";
+	}
+	fprintf(out, "]");
+	free(groups);
+}
+
+int kernel_latency_check(const struct kernel_latency *latency,
+			 const struct latency_limit *limits,
+			 int num_limits, char **error)
+{
+	struct latency_group **groups = sorted_groups(latency);
+	int result = STATUS_OK;
+	char label[64];
+	int i, j;
+
+	for (i = 0; i < latency->num_groups && result == STATUS_OK; ++i) {
+		const struct timing_histogram *h = &groups[i]->histogram;
+
+		for (j = 0; j < num_limits; ++j) {
+			s64 usecs = timing_percentile(h, limits[j].fraction);
+
+			if (usecs <= limits[j].max_usecs)
+				continue;
+			group_label(groups[i], label, sizeof(label));
+			asprintf(error, "kernel latency %s of %s is %lld "
+				 "usecs, over the limit of %lld usecs",
+				 limits[j].name, label, usecs,
+				 limits[j].max_usecs);
+			result = STATUS_ERR;
+			break;
+		}
+	}
+	free(groups);
+	return result;
+}
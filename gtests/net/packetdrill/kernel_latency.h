@@ -0,0 +1,88 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * For --kernel_latency, how long the kernel under test takes to answer
+ * our packets: the time from when we inject an inbound packet on a
+ * socket to the sniff time stamp of the next outbound packet the
+ * kernel sends on that socket, be it an ACK, data or a SYN/ACK.
+ *
+ * We keep a histogram of these times for each script line of an
+ * outbound packet, and for each socket (each MPTCP subflow is a socket
+ * of its own), and can check percentiles of each against limits given
+ * with --kernel_latency_limits, e.g. "p99=50,max=200", so a script run
+ * in a loop doubles as a benchmark of the stack's latency.
+ */
+
+#ifndef __KERNEL_LATENCY_H__
+#define __KERNEL_LATENCY_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+/* Most limits --kernel_latency_limits takes. */
+#define KERNEL_LATENCY_MAX_LIMITS	8
+
+/* Latency at the given percentile must be at most max_usecs. */
+struct latency_limit {
+	double fraction;		/* 0.99 for p99; 1 for max */
+	s64 max_usecs;
+	char name[8];			/* e.g. "p99", for messages */
+};
+
+struct kernel_latency;
+
+/* Parse a comma-separated list of <percentile>=<usecs> limits, with
+ * percentiles like "p50", "p99", "p999" or "max" (so "p05", not "p5",
+ * is the 5th percentile). Returns STATUS_OK on
+ * success; on failure returns STATUS_ERR and sets error message.
+ */
+extern int parse_kernel_latency_limits(const char *arg,
+				       struct latency_limit *limits,
+				       int *num_limits, char **error);
+
+extern struct kernel_latency *kernel_latency_new(void);
+extern void kernel_latency_free(struct kernel_latency *latency);
+
+/* Record one latency, of an outbound packet at the given script line,
+ * on the socket with the given id and name (e.g. "8080>49152").
+ */
+extern void kernel_latency_record(struct kernel_latency *latency,
+				  int line_number, u32 socket_id,
+				  const char *socket_name, s64 usecs);
+
+/* Print the latency percentiles of each line and each socket. */
+extern void kernel_latency_report(const struct kernel_latency *latency,
+				  FILE *out);
+
+/* Write the latencies of each line as a JSON array of objects, e.g.
+ * [{"line": 12, "count": 3, "mean_usecs": 21.0, ...}], to the given
+ * stream. Sockets are left out: their names hold ephemeral ports, so
+ * they would not match up across runs.
+ */
+extern void kernel_latency_write_json(const struct kernel_latency *latency,
+				      FILE *out);
+
+/* Check every line's and every socket's latencies against the limits.
+ * Returns STATUS_OK if all are within them; otherwise returns
+ * STATUS_ERR and sets error message to say which is not.
+ */
+extern int kernel_latency_check(const struct kernel_latency *latency,
+				const struct latency_limit *limits,
+				int num_limits, char **error);
+
+#endif /* __KERNEL_LATENCY_H__ */
@@ -0,0 +1,129 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for kernel_latency.c: parsing limits, and keeping and
+ * checking latencies per line and per socket.
+ */
+
+#include "kernel_latency.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void test_parse(void)
+{
+	struct latency_limit limits[KERNEL_LATENCY_MAX_LIMITS];
+	char *error = NULL;
+	int num = 0;
+
+	assert(parse_kernel_latency_limits("p99=50,p999=80,max=200,p05=1",
+					   limits, &num, &error) == STATUS_OK);
+	assert(num == 4);
+	assert(limits[0].fraction > 0.989 && limits[0].fraction < 0.991);
+	assert(limits[0].max_usecs == 50);
+	assert(strcmp(limits[0].name, "p99") == 0);
+	assert(limits[1].fraction > 0.9989 && limits[1].fraction < 0.9991);
+	assert(limits[2].fraction == 1.0);
+	assert(limits[2].max_usecs == 200);
+	assert(limits[3].fraction > 0.049 && limits[3].fraction < 0.051);
+
+	assert(parse_kernel_latency_limits("p5=10", limits, &num,
+					   &error) == STATUS_ERR);
+	free(error);
+	assert(parse_kernel_latency_limits("p99", limits, &num,
+					   &error) == STATUS_ERR);
+	free(error);
+	assert(parse_kernel_latency_limits("p99=x", limits, &num,
+					   &error) == STATUS_ERR);
+	free(error);
+	assert(parse_kernel_latency_limits("", limits, &num,
+					   &error) == STATUS_ERR);
+	free(error);
+}
+
+static void test_check(void)
+{
+	struct kernel_latency *latency = kernel_latency_new();
+	struct latency_limit limits[KERNEL_LATENCY_MAX_LIMITS];
+	char *error = NULL;
+	int num = 0, i;
+
+	/* Line 10 on socket 1 is quick; line 20 on socket 2 has one slow
+	 * answer in a hundred.
+	 */
+	for (i = 0; i < 100; ++i) {
+		kernel_latency_record(latency, 10, 1, "8080>49152", 10);
+		kernel_latency_record(latency, 20, 2, "8080>49153",
+				      i == 0 ? 500 : 20);
+	}
+
+	assert(parse_kernel_latency_limits("p99=30", limits, &num,
+					   &error) == STATUS_OK);
+	assert(kernel_latency_check(latency, limits, num, &error) ==
+	       STATUS_OK);
+
+	assert(parse_kernel_latency_limits("max=100", limits, &num,
+					   &error) == STATUS_OK);
+	assert(kernel_latency_check(latency, limits, num, &error) ==
+	       STATUS_ERR);
+	assert(strstr(error, "max of line 20 is 500 usecs") != NULL);
+	free(error);
+
+	assert(parse_kernel_latency_limits("p50=15", limits, &num,
+					   &error) == STATUS_OK);
+	assert(kernel_latency_check(latency, limits, num, &error) ==
+	       STATUS_ERR);
+	assert(strstr(error, "line 20") != NULL);
+	free(error);
+
+	kernel_latency_report(latency, stdout);
+	kernel_latency_free(latency);
+}
+
+static void test_json(void)
+{
+	struct kernel_latency *latency = kernel_latency_new();
+	char *json = NULL;
+	size_t bytes = 0;
+	FILE *out;
+
+	kernel_latency_record(latency, 20, 1, "8080>49152", 30);
+	kernel_latency_record(latency, 10, 1, "8080>49152", 10);
+	kernel_latency_record(latency, 10, 1, "8080>49152", 20);
+
+	out = open_memstream(&json, &bytes);
+	kernel_latency_write_json(latency, out);
+	fclose(out);
+	/* Lines in order, and no sockets. */
+	assert(strstr(json, "[{\"line\": 10, \"count\": 2, "
+		      "\"mean_usecs\": 15.0, \"stddev_usecs\": 7.1, ") ==
+	       json);
+	assert(strstr(json, "{\"line\": 20, \"count\": 1, ") != NULL);
+	assert(strstr(json, "8080") == NULL);
+	free(json);
+	kernel_latency_free(latency);
+}
+
+int main(void)
+{
+	test_parse();
+	test_check();
+	test_json();
+	return 0;
+}
@@ -0,0 +1,258 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Saving and restoring kernel state around a test.
+ */
+
+#include "kernel_state.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+#include "netlink.h"
+
+#ifdef linux
+
+#define MAX_SAVED_SYSCTLS	64
+#define SYSCTL_VALUE_BYTES	256
+
+/* The net.ipv4 sysctls scripts commonly set. */
+static const char *tcp_sysctls[] = {
+	"net/ipv4/tcp_autocorking",
+	"net/ipv4/tcp_congestion_control",
+	"net/ipv4/tcp_early_retrans",
+	"net/ipv4/tcp_ecn",
+	"net/ipv4/tcp_fastopen",
+	"net/ipv4/tcp_min_tso_segs",
+	"net/ipv4/tcp_mtu_probing",
+	"net/ipv4/tcp_no_metrics_save",
+	"net/ipv4/tcp_recovery",
+	"net/ipv4/tcp_rmem",
+	"net/ipv4/tcp_sack",
+	"net/ipv4/tcp_syncookies",
+	"net/ipv4/tcp_timestamps",
+	"net/ipv4/tcp_window_scaling",
+	"net/ipv4/tcp_wmem",
+};
+
+/* All of these we save. */
+#define MPTCP_SYSCTL_DIR	"net/mptcp"
+
+struct saved_sysctl {
+	char *path;			/* under /proc/sys */
+	char value[SYSCTL_VALUE_BYTES];
+	int len;
+};
+
+struct kernel_state {
+	struct saved_sysctl sysctls[MAX_SAVED_SYSCTLS];
+	int num_sysctls;
+	bool has_mptcp_pm;		/* does the kernel have one? */
+	struct mptcp_pm_config mptcp_pm;
+};
+
+/* The state to restore if we exit before the test is done. */
+static struct kernel_state *exit_kernel_state;
+
+/* Read the sysctl at the given path under /proc/sys. Returns the
+ * number of bytes read, or -1 with errno set.
+ */
+static int read_sysctl(const char *path, char *value, int size)
+{
+	char full_path[256];
+	int fd, len;
+
+	snprintf(full_path, sizeof(full_path), "/proc/sys/%s", path);
+	fd = open(full_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	len = read(fd, value, size);
+	close(fd);
+	return len;
+}
+
+static int write_sysctl(const char *path, const char *value, int len)
+{
+	char full_path[256];
+	int fd, written;
+
+	snprintf(full_path, sizeof(full_path), "/proc/sys/%s", path);
+	fd = open(full_path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	written = write(fd, value, len);
+	close(fd);
+	return written == len ? 0 : -1;
+}
+
+/* Save the sysctl, if the kernel has it and we have room. */
+static void save_sysctl(struct kernel_state *kernel_state, const char *path)
+{
+	struct saved_sysctl *saved;
+
+	if (kernel_state->num_sysctls == MAX_SAVED_SYSCTLS)
+		return;
+	saved = &kernel_state->sysctls[kernel_state->num_sysctls];
+	saved->len = read_sysctl(path, saved->value, sizeof(saved->value));
+	if (saved->len <= 0 || saved->len == sizeof(saved->value))
+		return;		/* missing, write-only or too long */
+	saved->path = strdup(path);
+	kernel_state->num_sysctls++;
+}
+
+static void save_mptcp_sysctls(struct kernel_state *kernel_state)
+{
+	DIR *dir = opendir("/proc/sys/" MPTCP_SYSCTL_DIR);
+	struct dirent *entry;
+
+	if (dir == NULL)
+		return;		/* no MPTCP in this kernel */
+	while ((entry = readdir(dir)) != NULL) {
+		char path[sizeof(MPTCP_SYSCTL_DIR) + sizeof(entry->d_name)];
+
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), MPTCP_SYSCTL_DIR "/%s",
+			 entry->d_name);
+		save_sysctl(kernel_state, path);
+	}
+	closedir(dir);
+}
+
+/* Put back the sysctls whose values changed. */
+static int restore_sysctls(const struct kernel_state *kernel_state,
+			   char **error)
+{
+	int i;
+
+	for (i = 0; i < kernel_state->num_sysctls; i++) {
+		const struct saved_sysctl *saved = &kernel_state->sysctls[i];
+		char value[SYSCTL_VALUE_BYTES];
+		int len = read_sysctl(saved->path, value, sizeof(value));
+
+		if (len == saved->len &&
+		    memcmp(value, saved->value, len) == 0)
+			continue;
+		if (write_sysctl(saved->path, saved->value, saved->len) < 0) {
+			asprintf(error, "cannot restore /proc/sys/%s: %s",
+				 saved->path, strerror(errno));
+			return STATUS_ERR;
+		}
+	}
+	return STATUS_OK;
+}
+
+/* Put back the MPTCP path manager's configuration, if it changed. */
+static int restore_mptcp_pm(const struct kernel_state *kernel_state,
+			    char **error)
+{
+	struct mptcp_pm_config now;
+
+	if (!kernel_state->has_mptcp_pm)
+		return STATUS_OK;
+	if (netlink_get_mptcp_pm(&now, error))
+		return STATUS_ERR;
+	if (memcmp(&now, &kernel_state->mptcp_pm, sizeof(now)) == 0)
+		return STATUS_OK;
+	return netlink_set_mptcp_pm(&kernel_state->mptcp_pm, error);
+}
+
+static void kernel_state_free(struct kernel_state *kernel_state)
+{
+	int i;
+
+	for (i = 0; i < kernel_state->num_sysctls; i++)
+		free(kernel_state->sysctls[i].path);
+	free(kernel_state);
+}
+
+/* If a test dies, put the kernel back anyway. */
+static void restore_exit_kernel_state(void)
+{
+	char *error = NULL;
+
+	if (exit_kernel_state == NULL)
+		return;
+	if (kernel_state_restore(exit_kernel_state, &error)) {
+		fprintf(stderr, "--reset_kernel_state: %s\n", error);
+		free(error);
+	}
+}
+
+struct kernel_state *kernel_state_new(char **error)
+{
+	static bool registered;
+	struct kernel_state *kernel_state;
+	char *pm_error = NULL;
+	int i;
+
+	if (netlink_flush_tcp_metrics(error))
+		return NULL;
+
+	kernel_state = calloc(1, sizeof(*kernel_state));
+	for (i = 0; i < ARRAY_SIZE(tcp_sysctls); i++)
+		save_sysctl(kernel_state, tcp_sysctls[i]);
+	save_mptcp_sysctls(kernel_state);
+
+	/* Without MPTCP there is no path manager to restore. */
+	kernel_state->has_mptcp_pm =
+		(netlink_get_mptcp_pm(&kernel_state->mptcp_pm,
+				      &pm_error) == STATUS_OK);
+	if (!kernel_state->has_mptcp_pm) {
+		DEBUGP("not saving MPTCP path manager: %s\n", pm_error);
+		free(pm_error);
+	}
+
+	exit_kernel_state = kernel_state;
+	if (!registered) {
+		atexit(restore_exit_kernel_state);
+		registered = true;
+	}
+	return kernel_state;
+}
+
+int kernel_state_restore(struct kernel_state *kernel_state, char **error)
+{
+	int result;
+
+	exit_kernel_state = NULL;
+	result = restore_sysctls(kernel_state, error);
+	if (result == STATUS_OK)
+		result = restore_mptcp_pm(kernel_state, error);
+	kernel_state_free(kernel_state);
+	return result;
+}
+
+#else  /* !linux */
+
+struct kernel_state *kernel_state_new(char **error)
+{
+	asprintf(error, "--reset_kernel_state is only supported on Linux");
+	return NULL;
+}
+
+int kernel_state_restore(struct kernel_state *kernel_state, char **error)
+{
+	return STATUS_OK;
+}
+
+#endif  /* linux */
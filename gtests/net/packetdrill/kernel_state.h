@@ -0,0 +1,46 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for --reset_kernel_state: start each test from a clean
+ * kernel, and leave the kernel as we found it, without running ip(8)
+ * or sysctl(8).
+ *
+ * Before a test we flush the TCP metrics cache, and note the sysctls
+ * scripts tend to change (all of net.mptcp and a list of net.ipv4 TCP
+ * ones) and the MPTCP path manager's endpoints and limits. After the
+ * test, even one that fails, we put back whatever changed.
+ */
+
+#ifndef __KERNEL_STATE_H__
+#define __KERNEL_STATE_H__
+
+#include "types.h"
+
+struct kernel_state;
+
+/* Save the kernel state and flush the TCP metrics cache. Returns NULL
+ * and sets error message on failure.
+ */
+extern struct kernel_state *kernel_state_new(char **error);
+
+/* Restore the saved kernel state, and free it. Returns STATUS_OK on
+ * success; on failure returns STATUS_ERR and sets error message.
+ */
+extern int kernel_state_restore(struct kernel_state *kernel_state,
+				char **error);
+
+#endif /* __KERNEL_STATE_H__ */
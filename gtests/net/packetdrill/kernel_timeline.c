@@ -0,0 +1,647 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Kernel-side timeline from BPF programs on tracepoints; see
+ * kernel_timeline.h.
+ */
+
+#include "kernel_timeline.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "logging.h"
+
+int tracepoint_format_parse(const char *text,
+			    struct tracepoint_format *format, char **error)
+{
+	const char *line;
+
+	memset(format, 0, sizeof(*format));
+	format->id = -1;
+	for (line = text; line != NULL && *line != '\0';
+	     line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+		struct tracepoint_field *field;
+		const char *decl, *semi, *name, *p;
+		int offset, size, is_signed;
+		bool is_array;
+
+		if (sscanf(line, "name: %63s", format->name) == 1 ||
+		    sscanf(line, "ID: %d", &format->id) == 1)
+			continue;
+		decl = strstr(line, "field:");
+		if (decl == NULL || strchr(line, '\n') < decl)
+			continue;
+		decl += strlen("field:");
+		semi = strchr(decl, ';');
+		p = strstr(decl, "offset:");
+		if (semi == NULL || p == NULL ||
+		    sscanf(p, "offset:%d; size:%d; signed:%d;",
+			   &offset, &size, &is_signed) != 3) {
+			asprintf(error, "bad field in tracepoint format: %.*s",
+				 (int)strcspn(line, "\n"), line);
+			return STATUS_ERR;
+		}
+		if (format->num_fields == TRACEPOINT_MAX_FIELDS)
+			continue;
+
+		/* The name is the last word of the declaration, less
+		 * the size if it is an array.
+		 */
+		name = semi;
+		is_array = (name > decl && name[-1] == ']');
+		while (is_array && name > decl && *name != '[')
+			--name;
+		while (name > decl && name[-1] == ' ')
+			--name;
+		p = name;
+		while (p > decl && p[-1] != ' ' && p[-1] != '*')
+			--p;
+
+		field = &format->fields[format->num_fields++];
+		snprintf(field->name, sizeof(field->name), "%.*s",
+			 (int)(name - p), p);
+		field->offset = offset;
+		field->size = size;
+		field->is_signed = is_signed;
+		field->is_scalar = (!is_array &&
+				    memmem(decl, semi - decl, "__data_loc",
+					   10) == NULL &&
+				    (size == 1 || size == 2 || size == 4 ||
+				     size == 8));
+		if (offset + size > format->record_bytes)
+			format->record_bytes = offset + size;
+	}
+	if (format->id < 0 || format->num_fields == 0) {
+		asprintf(error, "tracepoint format has no ID or fields");
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+const struct tracepoint_field *tracepoint_format_field(
+	const struct tracepoint_format *format, const char *name)
+{
+	int i;
+
+	for (i = 0; i < format->num_fields; ++i) {
+		if (strcmp(format->fields[i].name, name) == 0)
+			return &format->fields[i];
+	}
+	return NULL;
+}
+
+void tracepoint_format_print(const struct tracepoint_format *format,
+			     const u8 *record, int record_bytes, FILE *out)
+{
+	const char *sep = "";
+	int i;
+
+	for (i = 0; i < format->num_fields; ++i) {
+		const struct tracepoint_field *field = &format->fields[i];
+		u64 value = 0;
+
+		if (!field->is_scalar ||
+		    strncmp(field->name, "common_", 7) == 0 ||
+		    field->offset + field->size > record_bytes)
+			continue;
+		memcpy(&value, record + field->offset, field->size);
+		if (field->is_signed) {
+			int shift = 64 - 8 * field->size;
+
+			fprintf(out, "%s%s=%lld", sep, field->name,
+				(long long)((s64)(value << shift) >> shift));
+		} else {
+			fprintf(out, "%s%s=%llu", sep, field->name,
+				(unsigned long long)value);
+		}
+		sep = " ";
+	}
+}
+
+#ifdef HAVE_BPF
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "bpf_insn.h"
+
+/* The tracepoints we follow, where the kernel has them. */
+static const char *tracepoints[] = {
+	"tcp/tcp_probe",
+	"tcp/tcp_retransmit_skb",
+	"mptcp/mptcp_subflow_get_send",
+};
+#define NUM_TRACEPOINTS	(sizeof(tracepoints) / sizeof(tracepoints[0]))
+
+/* Bytes of the ring buffer; a power of 2 pages. */
+#define RING_BYTES		(1 << 20)
+
+/* Most bytes of a tracepoint record we copy. */
+#define MAX_RECORD_BYTES	256
+
+/* Most instructions in a program. */
+#define MAX_PROGRAM_INSNS	48
+
+/* Most perf events we attach to: tracepoints on each CPU. */
+#define MAX_ATTACHMENTS		(NUM_TRACEPOINTS * 1024)
+
+/* What the programs put in the ring buffer, then the record. */
+struct timeline_record {
+	u64 nsecs;			/* CLOCK_MONOTONIC */
+	u32 line_number;
+	u32 tracepoint;			/* index in formats */
+};
+
+struct kernel_timeline {
+	FILE *out;
+	s64 start_nsecs;		/* CLOCK_MONOTONIC at start */
+
+	struct tracepoint_format formats[NUM_TRACEPOINTS];
+	int num_formats;
+	int prog_fds[NUM_TRACEPOINTS];
+	int *event_fds;			/* perf events we attached to */
+	int num_event_fds;
+
+	int line_map_fd;		/* array of the current line */
+	volatile u32 *line;		/* its one entry, mmap-ed */
+	int port_map_fd;		/* hash of ports to follow */
+	u64 ports_added[65536 / 64];	/* ports already in it */
+
+	int ring_fd;
+	u64 *consumer_pos;		/* page we tell the kernel in */
+	void *producer_map;		/* producer page and data, twice */
+	const u64 *producer_pos;
+	const u8 *data;
+};
+
+static s64 monotonic_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return timespec_to_nsecs(&ts);
+}
+
+/* Read the format file of a tracepoint from tracefs, wherever it is
+ * mounted.
+ */
+static int read_format(const char *tracepoint,
+		       struct tracepoint_format *format, char **error)
+{
+	static const char *roots[] = {
+		"/sys/kernel/tracing/events",
+		"/sys/kernel/debug/tracing/events",
+	};
+	char path[256], text[8192];
+	ssize_t len = -1;
+	int i, fd;
+
+	for (i = 0; i < 2 && len < 0; ++i) {
+		snprintf(path, sizeof(path), "%s/%s/format", roots[i],
+			 tracepoint);
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			continue;
+		len = read(fd, text, sizeof(text) - 1);
+		close(fd);
+	}
+	if (len < 0) {
+		asprintf(error, "no tracepoint %s", tracepoint);
+		return STATUS_ERR;
+	}
+	text[len] = '\0';
+	return tracepoint_format_parse(text, format, error);
+}
+
+static int create_map(u32 type, u32 key_size, u32 value_size,
+		      u32 max_entries, u32 flags, char **error)
+{
+	union bpf_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = type;
+	attr.key_size = key_size;
+	attr.value_size = value_size;
+	attr.max_entries = max_entries;
+	attr.map_flags = flags;
+	fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (fd < 0)
+		asprintf(error, "cannot create BPF map: %s", strerror(errno));
+	return fd;
+}
+
+/* Assemble the program for the given tracepoint:
+ *
+ *	if (port_offset >= 0 &&
+ *	    !map_lookup_elem(port_map, (u16 *)(ctx + port_offset)))
+ *		return 0;
+ *	record.nsecs = ktime_get_ns();
+ *	line = map_lookup_elem(line_map, 0);
+ *	record.line_number = line ? *line : 0;
+ *	record.tracepoint = index;
+ *	probe_read_kernel(record + 1, record_bytes, ctx);
+ *	ringbuf_output(ring, &record, sizeof(record) + record_bytes, 0);
+ *	return 0;
+ *
+ * with the record on the stack and the key below it.
+ */
+static int assemble_program(const struct kernel_timeline *timeline,
+			    int index, int port_offset, int record_bytes,
+			    struct bpf_insn *insns)
+{
+	int total = sizeof(struct timeline_record) + record_bytes;
+	int record = -((total + 7) & ~7);
+	int key = record - 8;
+	int n = 0, skip;
+
+	insns[n++] = BPF_MOV64_REG(BPF_REG_6, BPF_REG_1);
+	if (port_offset >= 0) {
+		insns[n++] = BPF_LDX_MEM(BPF_H, BPF_REG_2, BPF_REG_6,
+					 port_offset);
+		insns[n++] = BPF_STX_MEM(BPF_H, BPF_REG_10, BPF_REG_2, key);
+		insns[n++] = BPF_LD_MAP_FD(BPF_REG_1, timeline->port_map_fd);
+		insns[n++] = BPF_INSN(0, 0, 0, 0, 0);
+		insns[n++] = BPF_MOV64_REG(BPF_REG_2, BPF_REG_10);
+		insns[n++] = BPF_ADD64_IMM(BPF_REG_2, key);
+		insns[n++] = BPF_EMIT_CALL(BPF_FUNC_map_lookup_elem);
+		skip = n++;	/* if (r0 == 0) goto out; filled in below */
+	} else {
+		skip = -1;
+	}
+
+	insns[n++] = BPF_EMIT_CALL(BPF_FUNC_ktime_get_ns);
+	insns[n++] = BPF_STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_0, record);
+
+	insns[n++] = BPF_ST_MEM(BPF_W, BPF_REG_10, key, 0);
+	insns[n++] = BPF_LD_MAP_FD(BPF_REG_1, timeline->line_map_fd);
+	insns[n++] = BPF_INSN(0, 0, 0, 0, 0);
+	insns[n++] = BPF_MOV64_REG(BPF_REG_2, BPF_REG_10);
+	insns[n++] = BPF_ADD64_IMM(BPF_REG_2, key);
+	insns[n++] = BPF_EMIT_CALL(BPF_FUNC_map_lookup_elem);
+	insns[n++] = BPF_MOV64_IMM(BPF_REG_1, 0);
+	insns[n++] = BPF_JEQ_IMM(BPF_REG_0, 0, 1);
+	insns[n++] = BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_0, 0);
+	insns[n++] = BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_1,
+				 record + offsetof(struct timeline_record,
+						   line_number));
+	insns[n++] = BPF_ST_MEM(BPF_W, BPF_REG_10,
+				record + offsetof(struct timeline_record,
+						  tracepoint), index);
+
+	insns[n++] = BPF_MOV64_REG(BPF_REG_1, BPF_REG_10);
+	insns[n++] = BPF_ADD64_IMM(BPF_REG_1,
+				   record + sizeof(struct timeline_record));
+	insns[n++] = BPF_MOV64_IMM(BPF_REG_2, record_bytes);
+	insns[n++] = BPF_MOV64_REG(BPF_REG_3, BPF_REG_6);
+	insns[n++] = BPF_EMIT_CALL(BPF_FUNC_probe_read_kernel);
+
+	insns[n++] = BPF_LD_MAP_FD(BPF_REG_1, timeline->ring_fd);
+	insns[n++] = BPF_INSN(0, 0, 0, 0, 0);
+	insns[n++] = BPF_MOV64_REG(BPF_REG_2, BPF_REG_10);
+	insns[n++] = BPF_ADD64_IMM(BPF_REG_2, record);
+	insns[n++] = BPF_MOV64_IMM(BPF_REG_3, total);
+	insns[n++] = BPF_MOV64_IMM(BPF_REG_4, 0);
+	insns[n++] = BPF_EMIT_CALL(BPF_FUNC_ringbuf_output);
+
+	/* out: return 0; */
+	if (skip >= 0)
+		insns[skip] = BPF_JEQ_IMM(BPF_REG_0, 0, n - skip - 1);
+	insns[n++] = BPF_MOV64_IMM(BPF_REG_0, 0);
+	insns[n++] = BPF_EXIT_INSN();
+	assert(n <= MAX_PROGRAM_INSNS);
+	return n;
+}
+
+static int load_program(struct kernel_timeline *timeline, int index,
+			char **error)
+{
+	static char log[4096];
+	const struct tracepoint_format *format = &timeline->formats[index];
+	const struct tracepoint_field *port =
+		tracepoint_format_field(format, "dport");
+	struct bpf_insn insns[MAX_PROGRAM_INSNS];
+	union bpf_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_TRACEPOINT;
+	attr.insns = (uintptr_t)insns;
+	attr.insn_cnt = assemble_program(
+		timeline, index,
+		port != NULL && port->size == 2 ? port->offset : -1,
+		format->record_bytes < MAX_RECORD_BYTES ?
+		format->record_bytes : MAX_RECORD_BYTES, insns);
+	attr.license = (uintptr_t)"GPL";
+	attr.log_buf = (uintptr_t)log;
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+	log[0] = '\0';
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd < 0) {
+		asprintf(error, "cannot load BPF program for %s: %s\n%s",
+			 format->name, strerror(errno), log);
+		return STATUS_ERR;
+	}
+	timeline->prog_fds[index] = fd;
+	return STATUS_OK;
+}
+
+/* Tracepoint perf events count on one CPU each, so attach the program
+ * to one on every CPU.
+ */
+static int attach_program(struct kernel_timeline *timeline, int index,
+			  char **error)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	struct perf_event_attr attr;
+	int cpu, fd, attached = 0;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.config = timeline->formats[index].id;
+	attr.sample_period = 1;
+	attr.wakeup_events = 1;
+	for (cpu = 0; cpu < cpus &&
+		     timeline->num_event_fds < MAX_ATTACHMENTS; ++cpu) {
+		fd = syscall(__NR_perf_event_open, &attr, -1, cpu, -1,
+			     PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0)
+			continue;	/* e.g. the CPU is offline */
+		if (ioctl(fd, PERF_EVENT_IOC_SET_BPF,
+			  timeline->prog_fds[index]) < 0 ||
+		    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+			asprintf(error, "cannot attach BPF program to %s: %s",
+				 timeline->formats[index].name,
+				 strerror(errno));
+			close(fd);
+			return STATUS_ERR;
+		}
+		timeline->event_fds[timeline->num_event_fds++] = fd;
+		attached++;
+	}
+	if (attached == 0) {
+		asprintf(error, "cannot open tracepoint %s: %s",
+			 timeline->formats[index].name, strerror(errno));
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+static int map_ring(struct kernel_timeline *timeline, char **error)
+{
+	long page = sysconf(_SC_PAGESIZE);
+
+	timeline->consumer_pos = mmap(NULL, page, PROT_READ | PROT_WRITE,
+				      MAP_SHARED, timeline->ring_fd, 0);
+	/* The data is mapped twice over, so records can wrap. */
+	timeline->producer_map = mmap(NULL, page + 2 * RING_BYTES,
+				      PROT_READ, MAP_SHARED,
+				      timeline->ring_fd, page);
+	if (timeline->consumer_pos == MAP_FAILED ||
+	    timeline->producer_map == MAP_FAILED) {
+		asprintf(error, "cannot map BPF ring buffer: %s",
+			 strerror(errno));
+		return STATUS_ERR;
+	}
+	timeline->producer_pos = timeline->producer_map;
+	timeline->data = (const u8 *)timeline->producer_map + page;
+	return STATUS_OK;
+}
+
+static int set_up(struct kernel_timeline *timeline, char **error)
+{
+	char *tracepoint_error = NULL;
+	u32 i;
+
+	timeline->line_map_fd = create_map(BPF_MAP_TYPE_ARRAY, sizeof(u32),
+					   sizeof(u32), 1, BPF_F_MMAPABLE,
+					   error);
+	timeline->port_map_fd = create_map(BPF_MAP_TYPE_HASH, sizeof(u16),
+					   sizeof(u8), 1024, 0, error);
+	timeline->ring_fd = create_map(BPF_MAP_TYPE_RINGBUF, 0, 0,
+				       RING_BYTES, 0, error);
+	if (timeline->line_map_fd < 0 || timeline->port_map_fd < 0 ||
+	    timeline->ring_fd < 0)
+		return STATUS_ERR;
+	timeline->line = mmap(NULL, sysconf(_SC_PAGESIZE),
+			      PROT_READ | PROT_WRITE, MAP_SHARED,
+			      timeline->line_map_fd, 0);
+	if (timeline->line == MAP_FAILED) {
+		timeline->line = NULL;
+		asprintf(error, "cannot map BPF array: %s", strerror(errno));
+		return STATUS_ERR;
+	}
+	if (map_ring(timeline, error))
+		return STATUS_ERR;
+
+	/* Follow what tracepoints this kernel has. */
+	timeline->event_fds = calloc(MAX_ATTACHMENTS, sizeof(int));
+	for (i = 0; i < NUM_TRACEPOINTS; ++i) {
+		int index = timeline->num_formats;
+
+		if (read_format(tracepoints[i], &timeline->formats[index],
+				&tracepoint_error)) {
+			DEBUGP("kernel timeline: %s\n", tracepoint_error);
+			free(tracepoint_error);
+			tracepoint_error = NULL;
+			continue;
+		}
+		timeline->num_formats++;
+		if (load_program(timeline, index, error) ||
+		    attach_program(timeline, index, error))
+			return STATUS_ERR;
+	}
+	if (timeline->num_formats == 0) {
+		asprintf(error, "no TCP tracepoints found in tracefs");
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+struct kernel_timeline *kernel_timeline_new(const char *path, char **error)
+{
+	struct kernel_timeline *timeline = calloc(1, sizeof(*timeline));
+	u32 i;
+
+	timeline->line_map_fd = -1;
+	timeline->port_map_fd = -1;
+	timeline->ring_fd = -1;
+	for (i = 0; i < NUM_TRACEPOINTS; ++i)
+		timeline->prog_fds[i] = -1;
+	timeline->consumer_pos = MAP_FAILED;
+	timeline->producer_map = MAP_FAILED;
+
+	timeline->out = fopen(path, "w");
+	if (timeline->out == NULL) {
+		asprintf(error, "cannot open %s: %s", path, strerror(errno));
+		kernel_timeline_free(timeline);
+		return NULL;
+	}
+	if (set_up(timeline, error)) {
+		kernel_timeline_free(timeline);
+		return NULL;
+	}
+	timeline->start_nsecs = monotonic_nsecs();
+	return timeline;
+}
+
+void kernel_timeline_add_ports(struct kernel_timeline *timeline,
+			       const __be16 *ports, int num_ports)
+{
+	union bpf_attr attr;
+	u8 value = 1;
+	u16 port;
+	int i;
+
+	for (i = 0; i < num_ports; ++i) {
+		/* Tracepoints have ports in host order. */
+		port = ntohs(ports[i]);
+		if (timeline->ports_added[port / 64] & (1ULL << (port % 64)))
+			continue;
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = timeline->port_map_fd;
+		attr.key = (uintptr_t)&port;
+		attr.value = (uintptr_t)&value;
+		attr.flags = BPF_ANY;
+		if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+			DEBUGP("kernel timeline: cannot add port %u: %s\n",
+			       port, strerror(errno));
+			continue;
+		}
+		timeline->ports_added[port / 64] |= 1ULL << (port % 64);
+	}
+}
+
+/* Write out the records in the ring buffer, as consumers of BPF ring
+ * buffers do: each has an 8-byte header with its length, and flags
+ * saying whether it is still being written or was discarded.
+ */
+static void drain(struct kernel_timeline *timeline)
+{
+	u64 consumer = *timeline->consumer_pos;
+	u64 producer = __atomic_load_n(timeline->producer_pos,
+				       __ATOMIC_ACQUIRE);
+
+	while (consumer < producer) {
+		const u8 *header = timeline->data +
+			(consumer & (RING_BYTES - 1));
+		u32 len = __atomic_load_n((const u32 *)header,
+					  __ATOMIC_ACQUIRE);
+		const struct timeline_record *record =
+			(const void *)(header + BPF_RINGBUF_HDR_SZ);
+		u32 bytes = len & ~(BPF_RINGBUF_BUSY_BIT |
+				    BPF_RINGBUF_DISCARD_BIT);
+
+		if (len & BPF_RINGBUF_BUSY_BIT)
+			break;
+		if (!(len & BPF_RINGBUF_DISCARD_BIT) &&
+		    bytes >= sizeof(*record) &&
+		    record->tracepoint < (u32)timeline->num_formats) {
+			const struct tracepoint_format *format =
+				&timeline->formats[record->tracepoint];
+
+			fprintf(timeline->out, "%.6f line %u %s: ",
+				((s64)record->nsecs -
+				 timeline->start_nsecs) / 1e9,
+				record->line_number, format->name);
+			tracepoint_format_print(format, (const u8 *)(record + 1),
+						bytes - sizeof(*record),
+						timeline->out);
+			fputc('\n', timeline->out);
+		}
+		consumer += (bytes + BPF_RINGBUF_HDR_SZ + 7) & ~7ULL;
+		__atomic_store_n(timeline->consumer_pos, consumer,
+				 __ATOMIC_RELEASE);
+	}
+}
+
+void kernel_timeline_event(struct kernel_timeline *timeline,
+			   int line_number, const char *description)
+{
+	drain(timeline);
+	fprintf(timeline->out, "%.6f line %d event: %s\n",
+		(monotonic_nsecs() - timeline->start_nsecs) / 1e9,
+		line_number, description);
+	*timeline->line = line_number;
+}
+
+void kernel_timeline_free(struct kernel_timeline *timeline)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	int i;
+
+	if (timeline == NULL)
+		return;
+	for (i = 0; i < timeline->num_event_fds; ++i)
+		close(timeline->event_fds[i]);
+	free(timeline->event_fds);
+	if (timeline->out != NULL && timeline->producer_map != MAP_FAILED &&
+	    timeline->consumer_pos != MAP_FAILED)
+		drain(timeline);
+	for (i = 0; i < (int)NUM_TRACEPOINTS; ++i) {
+		if (timeline->prog_fds[i] >= 0)
+			close(timeline->prog_fds[i]);
+	}
+	if (timeline->producer_map != MAP_FAILED)
+		munmap(timeline->producer_map, page + 2 * RING_BYTES);
+	if (timeline->consumer_pos != MAP_FAILED)
+		munmap(timeline->consumer_pos, page);
+	if (timeline->line != NULL)
+		munmap((void *)timeline->line, page);
+	if (timeline->ring_fd >= 0)
+		close(timeline->ring_fd);
+	if (timeline->port_map_fd >= 0)
+		close(timeline->port_map_fd);
+	if (timeline->line_map_fd >= 0)
+		close(timeline->line_map_fd);
+	if (timeline->out != NULL)
+		fclose(timeline->out);
+	free(timeline);
+}
+
+#else  /* !HAVE_BPF */
+
+struct kernel_timeline *kernel_timeline_new(const char *path, char **error)
+{
+	asprintf(error, "no BPF on this platform");
+	return NULL;
+}
+
+void kernel_timeline_add_ports(struct kernel_timeline *timeline,
+			       const __be16 *ports, int num_ports)
+{
+}
+
+void kernel_timeline_event(struct kernel_timeline *timeline,
+			   int line_number, const char *description)
+{
+}
+
+void kernel_timeline_free(struct kernel_timeline *timeline)
+{
+}
+
+#endif  /* HAVE_BPF */
@@ -0,0 +1,110 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * For --kernel_timeline, a timeline of what the kernel's TCP and MPTCP
+ * stacks decided while a script ran, merged with the script's events.
+ *
+ * We load a small BPF program on each of a few tracepoints (tcp_probe,
+ * tcp_retransmit_skb and mptcp_subflow_get_send, where the kernel has
+ * them). Each copies the tracepoint's record, the time, and the line
+ * of the script event running at the time, into a BPF ring buffer;
+ * ones with a destination port only do so for the remote ports of the
+ * test's sockets. The line is in a map we share with the programs by
+ * mmap(), so setting it is a store, not a system call. Before each
+ * script event we drain the ring buffer into the timeline file, and
+ * then write the event, so the file reads in time order:
+ *
+ *   0.010021 line 12 event: outbound packet
+ *   0.010137 line 12 tcp_probe: sport=8080 dport=49152 ... snd_cwnd=10
+ *
+ * Records are decoded with the field layout of each tracepoint's format
+ * file in tracefs, so they show whatever fields the kernel has.
+ */
+
+#ifndef __KERNEL_TIMELINE_H__
+#define __KERNEL_TIMELINE_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+/* Most fields of a tracepoint we keep track of. */
+#define TRACEPOINT_MAX_FIELDS	64
+
+/* One field of a tracepoint's record. */
+struct tracepoint_field {
+	char name[32];
+	int offset;
+	int size;
+	bool is_signed;
+	bool is_scalar;			/* not an array or dynamic string */
+};
+
+/* A tracepoint's id and record layout, from its format file. */
+struct tracepoint_format {
+	char name[64];
+	int id;
+	struct tracepoint_field fields[TRACEPOINT_MAX_FIELDS];
+	int num_fields;
+	int record_bytes;		/* size of the fixed part of records */
+};
+
+struct kernel_timeline;
+
+/* Parse the text of a tracepoint format file. Returns STATUS_OK on
+ * success; on failure returns STATUS_ERR and sets error message.
+ */
+extern int tracepoint_format_parse(const char *text,
+				   struct tracepoint_format *format,
+				   char **error);
+
+/* Return the field of the given name, or NULL if there is none. */
+extern const struct tracepoint_field *tracepoint_format_field(
+	const struct tracepoint_format *format, const char *name);
+
+/* Print the scalar fields, other than the common ones, of a record of
+ * the tracepoint as "name=value" pairs separated by spaces.
+ */
+extern void tracepoint_format_print(const struct tracepoint_format *format,
+				    const u8 *record, int record_bytes,
+				    FILE *out);
+
+/* Load and attach the programs, and open the timeline file at the
+ * given path. Returns NULL and sets error message on failure.
+ */
+extern struct kernel_timeline *kernel_timeline_new(const char *path,
+						   char **error);
+
+/* Only record events of the tracepoints with ports on sockets with
+ * these (remote) ports, in network order. Ports stay on once given.
+ */
+extern void kernel_timeline_add_ports(struct kernel_timeline *timeline,
+				      const __be16 *ports, int num_ports);
+
+/* Write what the kernel did since the last event, and then the start
+ * of the event at the given line; kernel records from now on are
+ * tagged with that line.
+ */
+extern void kernel_timeline_event(struct kernel_timeline *timeline,
+				  int line_number, const char *description);
+
+/* Write the last of the kernel's records, detach the programs and
+ * close the file.
+ */
+extern void kernel_timeline_free(struct kernel_timeline *timeline);
+
+#endif /* __KERNEL_TIMELINE_H__ */
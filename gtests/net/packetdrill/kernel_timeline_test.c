@@ -0,0 +1,126 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for kernel_timeline.c: parsing tracepoint format files and
+ * printing records with them. Loading the BPF programs needs root and
+ * tracefs, so scripts test that.
+ */
+
+#include "kernel_timeline.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* An abridged tcp_probe format file, as Linux 6.x has it. */
+static const char tcp_probe_format[] =
+	"name: tcp_probe\n"
+	"ID: 1465\n"
+	"format:\n"
+	"\tfield:unsigned short common_type;\toffset:0;\tsize:2;\t"
+	"signed:0;\n"
+	"\tfield:unsigned char common_flags;\toffset:2;\tsize:1;\t"
+	"signed:0;\n"
+	"\tfield:int common_pid;\toffset:4;\tsize:4;\tsigned:1;\n"
+	"\n"
+	"\tfield:__u8 saddr[sizeof(struct sockaddr_in6)];\toffset:8;\t"
+	"size:28;\tsigned:0;\n"
+	"\tfield:__u16 sport;\toffset:36;\tsize:2;\tsigned:0;\n"
+	"\tfield:__u16 dport;\toffset:38;\tsize:2;\tsigned:0;\n"
+	"\tfield:__u32 snd_cwnd;\toffset:40;\tsize:4;\tsigned:0;\n"
+	"\tfield:int delta;\toffset:44;\tsize:4;\tsigned:1;\n"
+	"\tfield:const void * skaddr;\toffset:48;\tsize:8;\tsigned:0;\n"
+	"\tfield:__data_loc char[] name;\toffset:56;\tsize:4;\t"
+	"signed:0;\n"
+	"\n"
+	"print fmt: \"src=%pISpc\", REC->saddr\n";
+
+static void test_parse(void)
+{
+	struct tracepoint_format format;
+	const struct tracepoint_field *field;
+	char *error = NULL;
+
+	assert(tracepoint_format_parse(tcp_probe_format, &format,
+				       &error) == STATUS_OK);
+	assert(strcmp(format.name, "tcp_probe") == 0);
+	assert(format.id == 1465);
+	assert(format.num_fields == 10);
+	assert(format.record_bytes == 60);
+
+	field = tracepoint_format_field(&format, "saddr");
+	assert(field != NULL && field->offset == 8 && field->size == 28);
+	assert(!field->is_scalar);
+	field = tracepoint_format_field(&format, "dport");
+	assert(field != NULL && field->offset == 38 && field->size == 2);
+	assert(field->is_scalar && !field->is_signed);
+	field = tracepoint_format_field(&format, "delta");
+	assert(field != NULL && field->is_signed);
+	field = tracepoint_format_field(&format, "skaddr");
+	assert(field != NULL && field->offset == 48 && field->is_scalar);
+	field = tracepoint_format_field(&format, "name");
+	assert(field != NULL && !field->is_scalar);
+	assert(tracepoint_format_field(&format, "nonesuch") == NULL);
+
+	assert(tracepoint_format_parse("name: x\n", &format,
+				       &error) == STATUS_ERR);
+	free(error);
+}
+
+static void test_print(void)
+{
+	struct tracepoint_format format;
+	u8 record[60];
+	u16 sport = 8080, dport = 49152;
+	u32 cwnd = 10;
+	s32 delta = -3;
+	u64 skaddr = 0x1234;
+	char *error = NULL, *text = NULL;
+	size_t text_len = 0;
+	FILE *out;
+
+	assert(tracepoint_format_parse(tcp_probe_format, &format,
+				       &error) == STATUS_OK);
+	memset(record, 0xff, sizeof(record));
+	memcpy(record + 36, &sport, 2);
+	memcpy(record + 38, &dport, 2);
+	memcpy(record + 40, &cwnd, 4);
+	memcpy(record + 44, &delta, 4);
+	memcpy(record + 48, &skaddr, 8);
+
+	out = open_memstream(&text, &text_len);
+	tracepoint_format_print(&format, record, sizeof(record), out);
+	fclose(out);
+	assert(strcmp(text, "sport=8080 dport=49152 snd_cwnd=10 delta=-3 "
+		      "skaddr=4660") == 0);
+	free(text);
+
+	/* Fields past a short record are left out. */
+	out = open_memstream(&text, &text_len);
+	tracepoint_format_print(&format, record, 42, out);
+	fclose(out);
+	assert(strcmp(text, "sport=8080 dport=49152") == 0);
+	free(text);
+}
+
+int main(void)
+{
+	test_parse();
+	test_print();
+	return 0;
+}
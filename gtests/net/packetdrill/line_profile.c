@@ -0,0 +1,249 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the per-line profile for --line_profile; see
+ * line_profile.h.
+ */
+
+#include "line_profile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "logging.h"
+
+bool line_profile_on;
+
+static const char *phase_names[PROFILE_NUM_PHASES] = {
+	[PROFILE_OTHER]		= "interpreter",
+	[PROFILE_WAIT]		= "wait",
+	[PROFILE_INJECT]	= "inject",
+	[PROFILE_SNIFF]		= "sniff",
+	[PROFILE_VERIFY]	= "verify",
+	[PROFILE_SYSCALL]	= "syscall",
+};
+
+/* Where the time of one script line went. */
+struct line_totals {
+	int line_number;
+	u64 num_events;			/* times its event started */
+	s64 wall_nsecs[PROFILE_NUM_PHASES];
+	s64 cpu_nsecs[PROFILE_NUM_PHASES];
+};
+
+static struct {
+	const char *script_path;
+	struct line_totals *lines;	/* indexed by line number */
+	int max_lines;
+	int line_number;		/* line counting now; 0: none */
+	enum profile_phase_t phase;	/* phase counting now */
+	s64 last_wall_nsecs;		/* times we last counted up to */
+	s64 last_cpu_nsecs;
+} profile;
+
+/* Is this the thread we profile? */
+static __thread bool profiled_thread;
+
+static s64 clock_nsecs(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts) != 0)
+		die_perror("clock_gettime");
+	return timespec_to_nsecs(&ts);
+}
+
+/* Count the time since we last did toward the current line and phase. */
+static void count_time(void)
+{
+	s64 wall_nsecs = clock_nsecs(CLOCK_MONOTONIC);
+	s64 cpu_nsecs = clock_nsecs(CLOCK_THREAD_CPUTIME_ID);
+	struct line_totals *totals;
+
+	if (profile.line_number > 0) {
+		totals = &profile.lines[profile.line_number];
+		totals->wall_nsecs[profile.phase] +=
+			wall_nsecs - profile.last_wall_nsecs;
+		totals->cpu_nsecs[profile.phase] +=
+			cpu_nsecs - profile.last_cpu_nsecs;
+	}
+	profile.last_wall_nsecs = wall_nsecs;
+	profile.last_cpu_nsecs = cpu_nsecs;
+}
+
+void line_profile_enable(const char *script_path)
+{
+	free(profile.lines);
+	memset(&profile, 0, sizeof(profile));
+	profile.script_path = script_path;
+	profiled_thread = true;
+	line_profile_on = true;
+	count_time();
+}
+
+void line_profile_disable(void)
+{
+	if (!line_profile_on)
+		return;
+	count_time();
+	line_profile_on = false;
+	profiled_thread = false;
+}
+
+void line_profile_line(int line_number)
+{
+	if (!profiled_thread || line_number <= 0)
+		return;
+	count_time();
+	if (line_number >= profile.max_lines) {
+		int old_max = profile.max_lines;
+
+		profile.max_lines = 2 * line_number + 64;
+		profile.lines = realloc(profile.lines, profile.max_lines *
+					sizeof(profile.lines[0]));
+		memset(profile.lines + old_max, 0,
+		       (profile.max_lines - old_max) *
+		       sizeof(profile.lines[0]));
+	}
+	profile.line_number = line_number;
+	profile.lines[line_number].line_number = line_number;
+	++profile.lines[line_number].num_events;
+	profile.phase = PROFILE_OTHER;
+}
+
+enum profile_phase_t line_profile_switch(enum profile_phase_t phase)
+{
+	enum profile_phase_t previous = profile.phase;
+
+	if (!profiled_thread)
+		return PROFILE_OTHER;
+	count_time();
+	profile.phase = phase;
+	return previous;
+}
+
+static s64 sum(const s64 *nsecs)
+{
+	s64 total = 0;
+	int i;
+
+	for (i = 0; i < PROFILE_NUM_PHASES; ++i)
+		total += nsecs[i];
+	return total;
+}
+
+static int compare_wall_desc(const void *a, const void *b)
+{
+	const struct line_totals *x = *(const struct line_totals **)a;
+	const struct line_totals *y = *(const struct line_totals **)b;
+	s64 x_nsecs = sum(x->wall_nsecs), y_nsecs = sum(y->wall_nsecs);
+
+	if (x_nsecs != y_nsecs)
+		return x_nsecs > y_nsecs ? -1 : 1;
+	return x->line_number - y->line_number;
+}
+
+/* Return the profiled lines, slowest first, and their number. */
+static struct line_totals **sorted_lines(int *num_lines)
+{
+	struct line_totals **lines;
+	int i;
+
+	lines = calloc(profile.max_lines + 1, sizeof(lines[0]));
+	*num_lines = 0;
+	for (i = 1; i < profile.max_lines; ++i)
+		if (profile.lines[i].num_events > 0)
+			lines[(*num_lines)++] = &profile.lines[i];
+	qsort(lines, *num_lines, sizeof(lines[0]), compare_wall_desc);
+	return lines;
+}
+
+void line_profile_report(FILE *out)
+{
+	int num_lines, i, phase;
+	struct line_totals **lines = sorted_lines(&num_lines);
+
+	fprintf(out, "line profile (usecs):\n  %-8s %6s %10s %10s",
+		"line", "events", "wall", "cpu");
+	for (phase = 0; phase < PROFILE_NUM_PHASES; ++phase)
+		fprintf(out, " %11s", phase_names[phase]);
+	fprintf(out, "\n");
+	for (i = 0; i < num_lines; ++i) {
+		fprintf(out, "  %-8d %6llu %10lld %10lld",
+			lines[i]->line_number, lines[i]->num_events,
+			sum(lines[i]->wall_nsecs) / 1000,
+			sum(lines[i]->cpu_nsecs) / 1000);
+		for (phase = 0; phase < PROFILE_NUM_PHASES; ++phase)
+			fprintf(out, " %11lld",
+				lines[i]->wall_nsecs[phase] / 1000);
+		fprintf(out, "\n");
+	}
+	free(lines);
+}
+
+/* Append the lines and phases that took at least a microsecond to the
+ * file at the given path, in one write, so the runs of --jobs workers
+ * appending to one file do not interleave their lines.
+ */
+static int append_folded(const char *path, bool cpu, char **error)
+{
+	char *buffer = NULL;
+	size_t length = 0;
+	FILE *s = open_memstream(&buffer, &length);
+	int line, phase, fd, result = STATUS_OK;
+
+	for (line = 1; line < profile.max_lines; ++line) {
+		const struct line_totals *totals = &profile.lines[line];
+
+		for (phase = 0; phase < PROFILE_NUM_PHASES; ++phase) {
+			s64 usecs = (cpu ? totals->cpu_nsecs[phase] :
+				     totals->wall_nsecs[phase]) / 1000;
+
+			if (usecs > 0)
+				fprintf(s, "%s:%d;%s %lld\n",
+					profile.script_path, line,
+					phase_names[phase], usecs);
+		}
+	}
+	fclose(s);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0 || write(fd, buffer, length) != (ssize_t)length) {
+		asprintf(error, "%s: %s", path, strerror(errno));
+		result = STATUS_ERR;
+	}
+	if (fd >= 0)
+		close(fd);
+	free(buffer);
+	return result;
+}
+
+int line_profile_write_folded(const char *path, char **error)
+{
+	char *cpu_path = NULL;
+	int result;
+
+	if (append_folded(path, false, error))
+		return STATUS_ERR;
+	asprintf(&cpu_path, "%s.cpu", path);
+	result = append_folded(cpu_path, true, error);
+	free(cpu_path);
+	return result;
+}
@@ -0,0 +1,104 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * For --line_profile, a profile of where a script's run spends its
+ * time, line by line: the wall clock time and the CPU time of our main
+ * thread, split by what the interpreter was doing for the line at the
+ * time (waiting for its time to come, injecting, sniffing, verifying,
+ * in a system call, or anything else, which is our own overhead).
+ *
+ * The interpreter calls line_profile_line() as it starts each event,
+ * and brackets the steps above with profile_phase_begin() and
+ * profile_phase_end(). Phases nest (a system call waits for its time,
+ * say), and time counts only toward the innermost phase, so the phases
+ * of a line add up to its total. Only the thread that turned profiling
+ * on is profiled; the brackets do nothing in other threads, and with
+ * --line_profile off cost a test of one global.
+ *
+ * At the end of a run we print the lines sorted by wall time, and
+ * append the profile in the "folded stacks" format flamegraph.pl reads,
+ * one "<script>:<line>;<phase> <usecs>" line per line and phase, to the
+ * --line_profile file (wall time) and to that file with ".cpu" added
+ * (CPU time). Appending lets the runs of a whole suite share the files,
+ * so a flame graph of them shows which scripts and lines are slow.
+ */
+
+#ifndef __LINE_PROFILE_H__
+#define __LINE_PROFILE_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+enum profile_phase_t {
+	PROFILE_OTHER = 0,		/* interpreter work not below */
+	PROFILE_WAIT,			/* waiting for an event's time */
+	PROFILE_INJECT,			/* writing inbound packets */
+	PROFILE_SNIFF,			/* waiting for a packet */
+	PROFILE_VERIFY,			/* checking a sniffed packet */
+	PROFILE_SYSCALL,		/* running a system call event */
+	PROFILE_NUM_PHASES,		/* must be last */
+};
+
+/* Is profiling on? Only line_profile_enable() and
+ * line_profile_disable() change this.
+ */
+extern bool line_profile_on;
+
+/* Zero the profile, and start profiling the calling thread as it runs
+ * the script at the given path.
+ */
+extern void line_profile_enable(const char *script_path);
+
+/* Stop profiling. The profile is kept for the report. */
+extern void line_profile_disable(void);
+
+/* Count the time from now toward the given script line, as it starts
+ * an event.
+ */
+extern void line_profile_line(int line_number);
+
+/* Count the time so far toward the current phase, and make the given
+ * phase current. Returns the phase that was current.
+ */
+extern enum profile_phase_t line_profile_switch(enum profile_phase_t phase);
+
+/* Print the profiled lines, slowest first. */
+extern void line_profile_report(FILE *out);
+
+/* Append the profile in folded stacks format, wall time to the file at
+ * the given path and CPU time to it with ".cpu" added. Returns
+ * STATUS_OK on success; on failure returns STATUS_ERR and sets error
+ * message.
+ */
+extern int line_profile_write_folded(const char *path, char **error);
+
+static inline enum profile_phase_t profile_phase_begin(
+	enum profile_phase_t phase)
+{
+	if (line_profile_on)
+		return line_profile_switch(phase);
+	return PROFILE_OTHER;
+}
+
+static inline void profile_phase_end(enum profile_phase_t previous)
+{
+	if (line_profile_on)
+		line_profile_switch(previous);
+}
+
+#endif /* __LINE_PROFILE_H__ */
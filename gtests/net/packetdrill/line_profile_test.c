@@ -0,0 +1,112 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for line_profile.c: time counts toward the line and the
+ * innermost phase current at the time, and the folded stacks files
+ * get one line per line and phase.
+ */
+
+#include "line_profile.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static void sleep_usecs(long usecs)
+{
+	struct timespec pause = { .tv_sec = 0, .tv_nsec = usecs * 1000 };
+
+	nanosleep(&pause, NULL);
+}
+
+/* Return the value of the given stack in a folded stacks file, or -1. */
+static long long folded_value(const char *path, const char *stack)
+{
+	char line[256];
+	long long value = -1;
+	FILE *f = fopen(path, "r");
+
+	assert(f != NULL);
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, stack, strlen(stack)) == 0 &&
+		    line[strlen(stack)] == ' ')
+			value = atoll(line + strlen(stack) + 1);
+	}
+	fclose(f);
+	return value;
+}
+
+int main(void)
+{
+	char path[] = "/tmp/line_profile_test.XXXXXX";
+	char *cpu_path = NULL, *report = NULL, *error = NULL;
+	size_t report_len = 0;
+	enum profile_phase_t outer, inner;
+	FILE *out;
+	int fd;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	asprintf(&cpu_path, "%s.cpu", path);
+
+	/* Phases do nothing until profiling is on. */
+	assert(profile_phase_begin(PROFILE_WAIT) == PROFILE_OTHER);
+
+	line_profile_enable("a.pkt");
+	line_profile_line(3);
+	sleep_usecs(20000);		/* interpreter */
+	line_profile_line(7);
+	outer = profile_phase_begin(PROFILE_SYSCALL);
+	sleep_usecs(10000);		/* syscall */
+	inner = profile_phase_begin(PROFILE_WAIT);
+	assert(inner == PROFILE_SYSCALL);
+	sleep_usecs(30000);		/* wait, inside the syscall */
+	profile_phase_end(inner);
+	profile_phase_end(outer);
+	assert(outer == PROFILE_OTHER);
+	line_profile_disable();
+
+	assert(line_profile_write_folded(path, &error) == STATUS_OK);
+	assert(folded_value(path, "a.pkt:3;interpreter") >= 20000);
+	assert(folded_value(path, "a.pkt:3;interpreter") < 30000);
+	assert(folded_value(path, "a.pkt:7;syscall") >= 10000);
+	assert(folded_value(path, "a.pkt:7;syscall") < 20000);
+	assert(folded_value(path, "a.pkt:7;wait") >= 30000);
+	assert(folded_value(path, "a.pkt:7;wait") < 40000);
+	assert(folded_value(path, "a.pkt:3;wait") == -1);
+	/* Sleeping takes next to no CPU. */
+	assert(folded_value(cpu_path, "a.pkt:7;wait") < 10000);
+
+	/* Runs append to the file. */
+	assert(line_profile_write_folded(path, &error) == STATUS_OK);
+
+	/* Line 7 took the most time, so it comes first. */
+	out = open_memstream(&report, &report_len);
+	line_profile_report(out);
+	fclose(out);
+	assert(strstr(report, "  7 ") != NULL);
+	assert(strstr(report, "  7 ") < strstr(report, "  3 "));
+
+	free(report);
+	unlink(path);
+	unlink(cpu_path);
+	free(cpu_path);
+	return 0;
+}
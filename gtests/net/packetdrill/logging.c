@@ -24,13 +24,233 @@
 
 #include "logging.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
+#include "cpu_affinity.h"
+
+enum log_level_t log_level = LOG_LEVEL_WARNING;
+
+/* Bytes of messages the async sink buffers before it drops them. */
+#define LOG_BUFFER_BYTES	(1 << 20)
+
+/* The async sink. Loggers append to 'pending' under the mutex; the
+ * writer thread swaps it for its own empty buffer and writes that out
+ * without holding the mutex.
+ */
+struct log_sink {
+	pthread_mutex_t mutex;
+	pthread_cond_t wake;		/* writer: there are messages */
+	pthread_cond_t written;		/* log_flush(): writer is idle */
+	bool async;			/* buffer messages? */
+	bool started;			/* writer thread running? */
+	bool writing;			/* writer has a buffer out? */
+	char *pending;			/* messages not yet written */
+	size_t pending_bytes;		/* bytes used in pending */
+	char *spare;			/* writer's buffer */
+	u64 dropped;			/* messages that did not fit */
+};
+
+static struct log_sink sink = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.written = PTHREAD_COND_INITIALIZER,
+};
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+
+static void *log_writer(void *arg)
+{
+	char *buffer;
+	size_t bytes;
+	u64 dropped;
+
+	cpu_affinity_pin(CPU_ROLE_HELPER);
+	pthread_mutex_lock(&sink.mutex);
+	for (;;) {
+		while (sink.pending_bytes == 0 && sink.dropped == 0) {
+			sink.writing = false;
+			pthread_cond_broadcast(&sink.written);
+			pthread_cond_wait(&sink.wake, &sink.mutex);
+		}
+		sink.writing = true;
+		buffer = sink.pending;
+		bytes = sink.pending_bytes;
+		dropped = sink.dropped;
+		sink.pending = sink.spare;
+		sink.pending_bytes = 0;
+		sink.dropped = 0;
+		pthread_mutex_unlock(&sink.mutex);
+
+		fwrite(buffer, 1, bytes, stdout);
+		if (dropped > 0)
+			fprintf(stdout, "log: dropped %llu messages\n", dropped);
+		fflush(stdout);
+
+		pthread_mutex_lock(&sink.mutex);
+		sink.spare = buffer;
+	}
+	return NULL;
+}
+
+/* Keep the sink usable in a forked child, which has no writer thread;
+ * the parent still writes out what was pending at the fork.
+ */
+static void log_atfork_prepare(void)
+{
+	pthread_mutex_lock(&sink.mutex);
+}
+
+static void log_atfork_parent(void)
+{
+	pthread_mutex_unlock(&sink.mutex);
+}
+
+static void log_alloc_buffers(void)
+{
+	sink.pending = malloc(LOG_BUFFER_BYTES);
+	sink.spare = malloc(LOG_BUFFER_BYTES);
+	if (sink.pending == NULL || sink.spare == NULL)
+		die("out of memory for log buffers\n");
+}
+
+static void log_atfork_child(void)
+{
+	pthread_mutex_init(&sink.mutex, NULL);
+	pthread_cond_init(&sink.wake, NULL);
+	pthread_cond_init(&sink.written, NULL);
+	sink.started = false;
+	sink.writing = false;
+	sink.pending_bytes = 0;
+	sink.dropped = 0;
+
+	/* If the parent's writer was out writing a buffer, 'spare' is
+	 * that buffer, or the same as 'pending', so take new ones. Our
+	 * copies of the old ones are never touched, so cost nothing.
+	 */
+	log_alloc_buffers();
+}
+
+/* Set up the sink's buffers and fork and exit handlers, once. This runs
+ * without sink.mutex held, since die() takes it to flush the log.
+ */
+static void log_init(void)
+{
+	log_alloc_buffers();
+	if (pthread_atfork(log_atfork_prepare, log_atfork_parent,
+			   log_atfork_child) != 0)
+		die("pthread_atfork failed\n");
+	atexit(log_flush);
+}
+
+/* Start the writer thread, with sink.mutex held. Returns 0 or the
+ * pthread_create() error; the caller must drop the mutex to die.
+ */
+static int log_start_writer(void)
+{
+	pthread_t thread;
+	int err;
+
+	err = pthread_create(&thread, NULL, log_writer, NULL);
+	if (err != 0)
+		return err;
+	pthread_detach(thread);
+	sink.started = true;
+	return 0;
+}
+
+void log_printf(const char *format, ...)
+{
+	va_list ap;
+	int len;
+
+	if (!sink.async) {
+		va_start(ap, format);
+		vfprintf(stdout, format, ap);
+		va_end(ap);
+		fflush(stdout);
+		return;
+	}
+
+	pthread_once(&log_once, log_init);
+	pthread_mutex_lock(&sink.mutex);
+	if (!sink.started) {
+		int err = log_start_writer();
+
+		if (err != 0) {
+			pthread_mutex_unlock(&sink.mutex);
+			errno = err;
+			die_perror("pthread_create for log writer");
+		}
+	}
+	va_start(ap, format);
+	len = vsnprintf(sink.pending + sink.pending_bytes,
+			LOG_BUFFER_BYTES - sink.pending_bytes, format, ap);
+	va_end(ap);
+	if (len >= 0 && (size_t)len < LOG_BUFFER_BYTES - sink.pending_bytes)
+		sink.pending_bytes += len;
+	else
+		sink.dropped++;
+	pthread_cond_signal(&sink.wake);
+	pthread_mutex_unlock(&sink.mutex);
+}
+
+int log_set_level(const char *name, char **error)
+{
+	static const char *names[] = {
+		[LOG_LEVEL_ERROR]	= "error",
+		[LOG_LEVEL_WARNING]	= "warning",
+		[LOG_LEVEL_INFO]	= "info",
+		[LOG_LEVEL_DEBUG]	= "debug",
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		if (strcmp(name, names[i]) == 0) {
+			log_level = i;
+			return STATUS_OK;
+		}
+	}
+	asprintf(error, "unknown log level: %s", name);
+	return STATUS_ERR;
+}
+
+void log_set_async(bool async)
+{
+	log_flush();
+	sink.async = async;
+}
+
+void log_flush(void)
+{
+	pthread_mutex_lock(&sink.mutex);
+	while (sink.started &&
+	       (sink.writing || sink.pending_bytes > 0 || sink.dropped > 0))
+		pthread_cond_wait(&sink.written, &sink.mutex);
+	pthread_mutex_unlock(&sink.mutex);
+}
+
+/* The message of the die() we are exiting with, for the exit handlers
+ * that write reports.
+ */
+static char fatal_error[1024];
+
+const char *log_fatal_error(void)
+{
+	return fatal_error[0] != '\0' ? fatal_error : NULL;
+}
 
 extern void die(char *format, ...)
 {
 	va_list ap;
 
+	log_flush();
+	va_start(ap, format);
+	vsnprintf(fatal_error, sizeof(fatal_error), format, ap);
+	va_end(ap);
+
+	/* Print it in full, even if it was too long to keep whole. */
 	va_start(ap, format);
 	vfprintf(stderr, format, ap);
 	va_end(ap);
@@ -40,6 +260,12 @@ extern void die(char *format, ...)
 
 void die_perror(char *message)
 {
+	int saved_errno = errno;
+
+	log_flush();
+	snprintf(fatal_error, sizeof(fatal_error), "%s: %s\n",
+		 message, strerror(saved_errno));
+	errno = saved_errno;
 	perror(message);
 
 	exit(EXIT_FAILURE);
@@ -37,9 +37,66 @@
 		fflush(stdout);			\
 	}
 
+/* Levels of log messages, from most to least important. */
+enum log_level_t {
+	LOG_LEVEL_ERROR = 0,
+	LOG_LEVEL_WARNING,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_DEBUG,
+};
+
+/* Messages less important than this are compiled out entirely. Build
+ * with -DLOG_LEVEL_MAX=LOG_LEVEL_DEBUG to be able to see debug
+ * messages at all.
+ */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX LOG_LEVEL_INFO
+#endif
+
+/* Messages less important than this are skipped at run time; set with
+ * --log_level. Defaults to LOG_LEVEL_WARNING.
+ */
+extern enum log_level_t log_level;
+
+/* Log a message at the given level, if it is enabled. The arguments
+ * are not evaluated for disabled levels, and a level above
+ * LOG_LEVEL_MAX costs nothing at all.
+ */
+#define LOGP(level, ...)					\
+	do {							\
+		if ((level) <= LOG_LEVEL_MAX &&			\
+		    (level) <= log_level)			\
+			log_printf(__VA_ARGS__);		\
+	} while (0)
+
+/* Write a message to the log sink, whatever the log level. */
+extern void log_printf(const char *format, ...)
+	__attribute__((format(printf, 1, 2)));
+
+/* Set log_level from a name: error, warning, info, or debug. On
+ * failure, return STATUS_ERR and fill in *error.
+ */
+extern int log_set_level(const char *name, char **error);
+
+/* By default log messages are written to stdout as they are logged.
+ * With an async sink, log_printf() only copies the message into a
+ * buffer, and a background thread does the blocking writes, so that
+ * logging does not perturb the timing of the test. Messages that do
+ * not fit in the buffer are dropped, and counted.
+ */
+extern void log_set_async(bool async);
+
+/* Wait until all messages logged so far have been written. */
+extern void log_flush(void);
+
 /* Log the message to stderr and then exit with a failure status code. */
 extern void die(char *format, ...);
 
+/* Return the message (at most 1KB of it) of the die() or die_perror()
+ * we are exiting with, or NULL; for exit handlers writing reports.
+ */
+extern const char *log_fatal_error(void);
+
 /* Call perror() with message and then exit with a failure status code. */
 extern void die_perror(char *message);
 
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of locking a bounded set of memory regions into RAM.
+ */
+
+#include "memlock.h"
+
+#include <alloca.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "logging.h"
+
+struct memlock *memlock_new(u64 budget_bytes)
+{
+	struct memlock *memlock = calloc(1, sizeof(struct memlock));
+
+	memlock->budget_bytes = budget_bytes;
+	return memlock;
+}
+
+void memlock_free(struct memlock *memlock)
+{
+	int i;
+
+	for (i = 0; i < memlock->num_ranges; i++) {
+		const struct memlock_range *range = &memlock->ranges[i];
+
+		munlock((void *)range->start, range->end - range->start);
+	}
+	free(memlock->ranges);
+	memset(memlock, 0, sizeof(*memlock));  /* paranoia to help catch bugs */
+	free(memlock);
+}
+
+bool memlock_region(struct memlock *memlock, const void *start, size_t bytes)
+{
+	const uintptr_t page_bytes = sysconf(_SC_PAGESIZE);
+	uintptr_t first = (uintptr_t)start & ~(page_bytes - 1);
+	uintptr_t end = ((uintptr_t)start + bytes + page_bytes - 1) &
+			~(page_bytes - 1);
+	struct memlock_range *last = NULL;
+	u64 charge;
+
+	if (bytes == 0)
+		return true;
+
+	/* Don't charge again for pages the last region locked. */
+	if (memlock->num_ranges > 0)
+		last = &memlock->ranges[memlock->num_ranges - 1];
+	if (last != NULL && first < last->end && end > last->start) {
+		if (first >= last->start && end <= last->end)
+			return true;
+		if (first >= last->start)
+			first = last->end;
+		else if (end <= last->end)
+			end = last->start;
+	}
+
+	charge = end - first;
+	if (memlock->locked_bytes + charge > memlock->budget_bytes) {
+		memlock->over_budget_bytes += charge;
+		return false;
+	}
+	/* mlock() faults in the pages before it returns. */
+	if (mlock((void *)first, end - first) < 0) {
+		memlock->failed_bytes += charge;
+		memlock->failed_errno = errno;
+		return false;
+	}
+	memlock->locked_bytes += charge;
+
+	if (memlock->num_ranges == memlock->max_ranges) {
+		memlock->max_ranges = memlock->max_ranges * 2 + 16;
+		memlock->ranges = realloc(memlock->ranges,
+					  memlock->max_ranges *
+					  sizeof(struct memlock_range));
+		if (memlock->ranges == NULL)
+			die("out of memory for locked ranges\n");
+	}
+	memlock->ranges[memlock->num_ranges].start = first;
+	memlock->ranges[memlock->num_ranges].end = end;
+	memlock->num_ranges++;
+	return true;
+}
+
+/* Not inlined, so that the stack we fault in lies below our caller's
+ * frame, and so is free for the calls our caller makes later.
+ */
+bool __attribute__((noinline)) memlock_stack(struct memlock *memlock,
+					     size_t bytes)
+{
+	volatile char *stack = alloca(bytes);
+
+	/* Touch the pages first, since mlock() fails on parts of the
+	 * stack the kernel has not yet grown into.
+	 */
+	memset((char *)stack, 0, bytes);
+	return memlock_region(memlock, (const void *)stack, bytes);
+}
+
+void memlock_report(const struct memlock *memlock, FILE *out)
+{
+	fprintf(out, "locked memory: %llu of %llu budget bytes in %d ranges",
+		memlock->locked_bytes, memlock->budget_bytes,
+		memlock->num_ranges);
+	if (memlock->over_budget_bytes > 0)
+		fprintf(out, ", %llu bytes over budget",
+			memlock->over_budget_bytes);
+	if (memlock->failed_bytes > 0)
+		fprintf(out, ", %llu bytes failed (%s)",
+			memlock->failed_bytes, strerror(memlock->failed_errno));
+	fprintf(out, "\n");
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for locking a bounded set of memory regions into RAM.
+ *
+ * Instead of mlockall(MCL_CURRENT | MCL_FUTURE), which pins every
+ * page the process ever touches, --mlock=hot locks just the memory on
+ * the timing-critical path (the packet pool, the stack and the parsed
+ * events), up to a byte budget, so that many packetdrill instances
+ * can share a host without hitting RLIMIT_MEMLOCK.
+ */
+
+#ifndef __MEMLOCK_H__
+#define __MEMLOCK_H__
+
+#include "types.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* A page-aligned range of memory we locked. */
+struct memlock_range {
+	uintptr_t start;
+	uintptr_t end;
+};
+
+/* A budget of locked memory and what we have locked so far. */
+struct memlock {
+	u64 budget_bytes;	/* most bytes we will lock */
+	u64 locked_bytes;	/* bytes we have locked */
+	u64 over_budget_bytes;	/* bytes we skipped as over budget */
+	u64 failed_bytes;	/* bytes mlock() refused to lock */
+	int failed_errno;	/* errno of the last mlock() failure */
+	struct memlock_range *ranges;	/* what we locked, to unlock it */
+	int num_ranges;			/* number of ranges we locked */
+	int max_ranges;			/* allocated size of ranges */
+};
+
+/* Allocate a memlock with the given budget. */
+extern struct memlock *memlock_new(u64 budget_bytes);
+
+/* Unlock everything we locked and free the memlock. */
+extern void memlock_free(struct memlock *memlock);
+
+/* Fault in and lock the pages holding the given bytes, if they fit in
+ * the budget. Pages that the previous region already locked are not
+ * charged again, so locking many small neighbouring objects costs only
+ * the pages they span. Returns true if the region is now locked.
+ */
+extern bool memlock_region(struct memlock *memlock,
+			   const void *start, size_t bytes);
+
+/* Fault in and lock the given number of bytes of the calling thread's
+ * stack, below the current stack frame.
+ */
+extern bool memlock_stack(struct memlock *memlock, size_t bytes);
+
+/* Print a one-line summary of what we locked. */
+extern void memlock_report(const struct memlock *memlock, FILE *out);
+
+#endif /* __MEMLOCK_H__ */
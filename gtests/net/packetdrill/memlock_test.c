@@ -0,0 +1,85 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for memlock.c: budget accounting for locked memory.
+ */
+
+#include "memlock.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void test_budget(void)
+{
+	const long page_bytes = sysconf(_SC_PAGESIZE);
+	char *buffer = NULL;
+	struct memlock *memlock = memlock_new(4 * page_bytes);
+
+	assert(posix_memalign((void **)&buffer, page_bytes,
+			      8 * page_bytes) == 0);
+
+	/* Two pages, whether mlock() lets us or not. */
+	assert(memlock_region(memlock, buffer, 2 * page_bytes) ==
+	       (memlock->failed_bytes == 0));
+	assert(memlock->locked_bytes + memlock->failed_bytes ==
+	       2 * page_bytes);
+
+	if (memlock->failed_bytes == 0) {
+		/* Objects on pages we just locked cost nothing more. */
+		assert(memlock_region(memlock, buffer + 10, 100));
+		assert(memlock_region(memlock, buffer + page_bytes, 8));
+		assert(memlock->locked_bytes == 2 * page_bytes);
+		assert(memlock->num_ranges == 1);
+
+		/* One straddling the last page costs the new page. */
+		assert(memlock_region(memlock, buffer + 2 * page_bytes - 8,
+				      16));
+		assert(memlock->locked_bytes == 3 * page_bytes);
+		assert(memlock->num_ranges == 2);
+
+		/* Two more pages would go over the budget of four. */
+		assert(!memlock_region(memlock, buffer + 5 * page_bytes,
+				       2 * page_bytes));
+		assert(memlock->over_budget_bytes == 2 * page_bytes);
+		assert(memlock->locked_bytes == 3 * page_bytes);
+
+		/* But one more fits exactly. */
+		assert(memlock_region(memlock, buffer + 5 * page_bytes, 1));
+		assert(memlock->locked_bytes == 4 * page_bytes);
+	}
+	assert(memlock_region(memlock, buffer, 0));
+
+	memlock_free(memlock);
+	free(buffer);
+}
+
+static void test_stack(void)
+{
+	struct memlock *memlock = memlock_new(1024 * 1024);
+
+	memlock_stack(memlock, 64 * 1024);
+	assert(memlock->locked_bytes + memlock->failed_bytes >= 64 * 1024);
+	memlock_free(memlock);
+}
+
+int main(void)
+{
+	test_budget();
+	test_stack();
+	return 0;
+}
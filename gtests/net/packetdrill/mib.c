@@ -0,0 +1,322 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Snapshots of the kernel's MIB counters.
+ */
+
+#include "mib.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+
+/* The files we read, in order. The first two have pairs of lines like
+ * "TcpExt: SyncookiesSent ..." and "TcpExt: 0 ..."; snmp6 has lines
+ * like "Ip6InReceives  3".
+ */
+static const char *mib_files[] = {
+	"/proc/net/snmp",
+	"/proc/net/netstat",
+	"/proc/net/snmp6",
+};
+#define MIB_NUM_FILES	ARRAY_SIZE(mib_files)
+
+struct mib {
+	int fds[MIB_NUM_FILES];		/* kept open; -1 if missing */
+	int num_counters;
+	char *names[MIB_MAX_COUNTERS];	/* nstat names */
+	s64 start[MIB_MAX_COUNTERS];	/* values at mib_start() */
+	s64 last[MIB_MAX_COUNTERS];	/* values at the last event */
+	FILE *events;			/* JSON of per-event deltas, or NULL */
+	char *events_json;		/* ...and its buffer */
+	size_t events_bytes;
+	int num_events;
+};
+
+/* A snapshot being read. */
+struct mib_read {
+	struct mib *mib;
+	s64 *values;
+	int num_values;
+	bool learn;			/* note the names too? */
+};
+
+struct mib *mib_new(char **error)
+{
+	struct mib *mib = calloc(1, sizeof(*mib));
+	bool any = false;
+	int i;
+
+	for (i = 0; i < MIB_NUM_FILES; i++) {
+		mib->fds[i] = open(mib_files[i], O_RDONLY | O_CLOEXEC);
+		if (mib->fds[i] >= 0)
+			any = true;
+	}
+	if (!any) {
+		asprintf(error, "cannot open %s: %s", mib_files[0],
+			 strerror(errno));
+		mib_free(mib);
+		return NULL;
+	}
+	return mib;
+}
+
+void mib_free(struct mib *mib)
+{
+	int i;
+
+	for (i = 0; i < MIB_NUM_FILES; i++) {
+		if (mib->fds[i] >= 0)
+			close(mib->fds[i]);
+	}
+	for (i = 0; i < mib->num_counters; i++)
+		free(mib->names[i]);
+	if (mib->events != NULL)
+		fclose(mib->events);
+	free(mib->events_json);
+	free(mib);
+}
+
+/* Read the whole file from the start into *buffer, which we grow as
+ * needed. Returns the length, or -1 with errno set.
+ */
+static ssize_t read_file(int fd, char **buffer, size_t *size)
+{
+	size_t len = 0;
+
+	for (;;) {
+		ssize_t bytes;
+
+		if (len + 1 >= *size) {
+			*size = *size ? *size * 2 : 16384;
+			*buffer = realloc(*buffer, *size);
+		}
+		bytes = pread(fd, *buffer + len, *size - len - 1, len);
+		if (bytes < 0)
+			return -1;
+		if (bytes == 0)
+			break;
+		len += bytes;
+	}
+	(*buffer)[len] = '\0';
+	return len;
+}
+
+/* Store the next counter of the snapshot. */
+static int add_counter(struct mib_read *read, const char *prefix,
+		       int prefix_len, const char *name, const char *value,
+		       char **error)
+{
+	struct mib *mib = read->mib;
+	int i = read->num_values;
+
+	if (i == MIB_MAX_COUNTERS) {
+		asprintf(error, "more than %d MIB counters", MIB_MAX_COUNTERS);
+		return STATUS_ERR;
+	}
+	if (read->learn) {
+		asprintf(&mib->names[i], "%.*s%s", prefix_len, prefix, name);
+		mib->num_counters = i + 1;
+	}
+	read->values[i] = strtoll(value, NULL, 10);
+	read->num_values++;
+	return STATUS_OK;
+}
+
+/* Parse one file: pairs of "Prefix: names" and "Prefix: values" lines,
+ * or "name value" lines.
+ */
+static int parse_counters(struct mib_read *read, char *text, char **error)
+{
+	char *line = text;
+
+	while (*line != '\0') {
+		char *eol = strchr(line, '\n');
+		char *colon = strchr(line, ':');
+
+		if (eol == NULL)
+			break;
+		*eol = '\0';
+		if (colon != NULL && colon < eol) {
+			int prefix_len = colon - line;
+			char *values = eol + 1;
+			char *values_eol = strchr(values, '\n');
+			char *name_save = NULL, *value_save = NULL;
+			char *name, *value;
+
+			if (values_eol == NULL ||
+			    strncmp(values, line, prefix_len + 1) != 0) {
+				asprintf(error, "bad MIB line: %s", line);
+				return STATUS_ERR;
+			}
+			*values_eol = '\0';
+			name = strtok_r(colon + 1, " ", &name_save);
+			value = strtok_r(values + prefix_len + 1, " ",
+					 &value_save);
+			while (name != NULL && value != NULL) {
+				if (add_counter(read, line, prefix_len,
+						name, value, error))
+					return STATUS_ERR;
+				name = strtok_r(NULL, " ", &name_save);
+				value = strtok_r(NULL, " ", &value_save);
+			}
+			line = values_eol + 1;
+		} else {
+			char *name_end = strpbrk(line, " \t");
+
+			if (name_end != NULL) {
+				*name_end = '\0';
+				if (add_counter(read, "", 0, line,
+						name_end + 1 +
+						strspn(name_end + 1, " \t"),
+						error))
+					return STATUS_ERR;
+			}
+			line = eol + 1;
+		}
+	}
+	return STATUS_OK;
+}
+
+/* Take a snapshot into values, noting the counters' names if learn. */
+static int mib_snapshot(struct mib *mib, s64 *values, bool learn,
+			char **error)
+{
+	struct mib_read read = {
+		.mib = mib, .values = values, .num_values = 0, .learn = learn,
+	};
+	char *buffer = NULL;
+	size_t size = 0;
+	int i, result = STATUS_OK;
+
+	for (i = 0; i < MIB_NUM_FILES && result == STATUS_OK; i++) {
+		if (mib->fds[i] < 0)
+			continue;
+		if (read_file(mib->fds[i], &buffer, &size) < 0) {
+			asprintf(error, "cannot read %s: %s", mib_files[i],
+				 strerror(errno));
+			result = STATUS_ERR;
+		} else {
+			result = parse_counters(&read, buffer, error);
+		}
+	}
+	free(buffer);
+	if (result == STATUS_OK && read.num_values != mib->num_counters) {
+		asprintf(error, "MIB counters changed during the test");
+		result = STATUS_ERR;
+	}
+	return result;
+}
+
+int mib_start(struct mib *mib, char **error)
+{
+	int i;
+
+	for (i = 0; i < mib->num_counters; i++)
+		free(mib->names[i]);
+	mib->num_counters = 0;
+	if (mib_snapshot(mib, mib->start, true, error))
+		return STATUS_ERR;
+	memcpy(mib->last, mib->start, sizeof(mib->last));
+	return STATUS_OK;
+}
+
+int mib_delta(struct mib *mib, const char *name, s64 *delta, char **error)
+{
+	s64 *now;
+	int i;
+
+	for (i = 0; i < mib->num_counters; i++) {
+		if (strcmp(mib->names[i], name) == 0)
+			break;
+	}
+	if (i == mib->num_counters) {
+		asprintf(error, "unknown MIB counter: %s", name);
+		return STATUS_ERR;
+	}
+	now = malloc(sizeof(mib->start));
+	if (mib_snapshot(mib, now, false, error)) {
+		free(now);
+		return STATUS_ERR;
+	}
+	*delta = now[i] - mib->start[i];
+	free(now);
+	return STATUS_OK;
+}
+
+/* Write the counters that changed from before to after as a JSON
+ * object.
+ */
+static void write_deltas(const struct mib *mib, const s64 *before,
+			 const s64 *after, FILE *out)
+{
+	const char *sep = "";
+	int i;
+
+	fputc('{', out);
+	for (i = 0; i < mib->num_counters; i++) {
+		if (after[i] == before[i])
+			continue;
+		fprintf(out, "%s\"%s\": %lld", sep, mib->names[i],
+			after[i] - before[i]);
+		sep = ", ";
+	}
+	fputc('}', out);
+}
+
+int mib_record_event(struct mib *mib, int line_number, char **error)
+{
+	s64 now[MIB_MAX_COUNTERS];
+
+	if (mib_snapshot(mib, now, false, error))
+		return STATUS_ERR;
+	if (memcmp(now, mib->last, mib->num_counters * sizeof(s64)) == 0)
+		return STATUS_OK;
+
+	if (mib->events == NULL) {
+		mib->events = open_memstream(&mib->events_json,
+					     &mib->events_bytes);
+		if (mib->events == NULL)
+			die_perror("open_memstream");
+	}
+	fprintf(mib->events, "%s{\"line\": %d, \"deltas\": ",
+		mib->num_events > 0 ? ", " : "", line_number);
+	write_deltas(mib, mib->last, now, mib->events);
+	fputc('}', mib->events);
+	mib->num_events++;
+	memcpy(mib->last, now, mib->num_counters * sizeof(s64));
+	return STATUS_OK;
+}
+
+int mib_write_json(struct mib *mib, FILE *out, char **error)
+{
+	s64 now[MIB_MAX_COUNTERS];
+
+	if (mib_snapshot(mib, now, false, error))
+		return STATUS_ERR;
+	fprintf(out, "\"mib_deltas\": ");
+	write_deltas(mib, mib->start, now, out);
+	if (mib->events != NULL) {
+		fflush(mib->events);
+		fprintf(out, ", \"mib_events\": [%.*s]",
+			(int)mib->events_bytes, mib->events_json);
+	}
+	return STATUS_OK;
+}
@@ -0,0 +1,70 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for following the kernel's SNMP and netstat MIB counters
+ * (Tcp, TcpExt, MPTcpExt, Ip6, ...) over a test, as nstat(8) does.
+ *
+ * We keep /proc/net/snmp, /proc/net/netstat and /proc/net/snmp6 open
+ * and re-read them with pread(), so a snapshot costs no open() and no
+ * fork. Counters are named as nstat names them, e.g.
+ * "TcpExtTCPLossProbes" or "MPTcpExtMPJoinSynRx".
+ */
+
+#ifndef __MIB_H__
+#define __MIB_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+#define MIB_MAX_COUNTERS	1024	/* most counters we follow */
+
+struct mib;
+
+/* Open the counter files. Returns NULL and sets error message if the
+ * kernel has none.
+ */
+extern struct mib *mib_new(char **error);
+
+extern void mib_free(struct mib *mib);
+
+/* Take the snapshot that deltas are relative to, at the start of the
+ * test. Returns STATUS_OK on success; on failure returns STATUS_ERR and
+ * sets error message.
+ */
+extern int mib_start(struct mib *mib, char **error);
+
+/* Fill in how much the named counter changed since mib_start(). This
+ * is safe to call from any thread. Returns STATUS_OK on success; on
+ * failure returns STATUS_ERR and sets error message.
+ */
+extern int mib_delta(struct mib *mib, const char *name, s64 *delta,
+		     char **error);
+
+/* Note which counters changed since the last call (or mib_start()),
+ * for the event at the given script line.
+ */
+extern int mib_record_event(struct mib *mib, int line_number, char **error);
+
+/* Write the counters that changed since mib_start(), and those that
+ * each recorded event changed, if any, as members of a JSON object:
+ * "mib_deltas": {"TcpExtTCPLossProbes": 1, ...},
+ * "mib_events": [{"line": 12, "deltas": {...}}, ...]
+ */
+extern int mib_write_json(struct mib *mib, FILE *out, char **error);
+
+#endif /* __MIB_H__ */
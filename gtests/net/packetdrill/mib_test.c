@@ -0,0 +1,101 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for mib.c: counter deltas over a loopback connection. Skipped
+ * where there is no /proc/net.
+ */
+
+#include "mib.h"
+
+#include <assert.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Open and close one TCP connection over loopback. */
+static void connect_once(void)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int listener, client, server;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	assert(listener >= 0);
+	assert(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	assert(getsockname(listener, (struct sockaddr *)&addr, &len) == 0);
+	assert(listen(listener, 1) == 0);
+	client = socket(AF_INET, SOCK_STREAM, 0);
+	assert(connect(client, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	server = accept(listener, NULL, NULL);
+	assert(server >= 0);
+	close(server);
+	close(client);
+	close(listener);
+}
+
+int main(void)
+{
+	struct mib *mib;
+	char *error = NULL;
+	char *json = NULL;
+	size_t bytes = 0;
+	FILE *out;
+	s64 delta;
+
+	mib = mib_new(&error);
+	if (mib == NULL) {
+		printf("skipping MIB test: %s\n", error);
+		free(error);
+		return 0;
+	}
+	assert(mib_start(mib, &error) == STATUS_OK);
+
+	assert(mib_delta(mib, "NoSuchCounter", &delta, &error) ==
+	       STATUS_ERR);
+	assert(strstr(error, "NoSuchCounter") != NULL);
+	free(error);
+	error = NULL;
+
+	assert(mib_record_event(mib, 3, &error) == STATUS_OK);
+	connect_once();
+	assert(mib_record_event(mib, 7, &error) == STATUS_OK);
+
+	/* Other processes may connect too, so we can only bound it. */
+	assert(mib_delta(mib, "TcpActiveOpens", &delta, &error) ==
+	       STATUS_OK);
+	assert(delta >= 1);
+	assert(mib_delta(mib, "TcpPassiveOpens", &delta, &error) ==
+	       STATUS_OK);
+	assert(delta >= 1);
+
+	out = open_memstream(&json, &bytes);
+	assert(mib_write_json(mib, out, &error) == STATUS_OK);
+	fclose(out);
+	assert(strncmp(json, "\"mib_deltas\": {", 15) == 0);
+	assert(strstr(json, "\"TcpActiveOpens\": ") != NULL);
+	assert(strstr(json, "\"mib_events\": [") != NULL);
+	assert(strstr(json, "{\"line\": 7, \"deltas\": {") != NULL);
+	free(json);
+
+	mib_free(mib);
+	return 0;
+}
@@ -3,6 +3,9 @@
  */
 
 #include "mptcp.h"
+#include "alloc_stats.h"
+#include "checksum.h"
+#include "logging.h"
 #include "packet_to_string.h"
 
 //#include "mptcp_sha1.h"
@@ -10,23 +13,29 @@
 
 void init_mp_state()
 {
-	mp_state.packetdrill_key_set = false;
-	mp_state.kernel_key_set = false;
 	queue_init(&mp_state.vars_queue);
 	queue_init_val(&mp_state.vals_queue);
 	queue_init_val(&mp_state.script_only_vals_queue);
 	mp_state.vars = NULL; //Init hashmap
-	mp_state.last_packetdrill_addr_id = 0;
-	mp_state.idsn = UNDEFINED;
-	mp_state.remote_idsn = UNDEFINED;
-	mp_state.remote_ssn = 0;
-	mp_state.remote_last_pkt_length = 0;
+	mp_state.var_slots = NULL;
+	mp_state.num_var_slots = 0;
+	mp_state.max_var_slots = 0;
+	mp_state.exprs = NULL;
+	mp_state.num_exprs = 0;
+	mp_state.max_exprs = 0;
+	mp_state.connections = NULL;
+	mp_state.conns_by_ports = NULL;
+	mp_state.conns_by_packetdrill_token = NULL;
+	mp_state.conns_by_kernel_token = NULL;
+	mp_state.subflows_by_tuple = NULL;
+	mp_state.version = MPTCP_V0;
 }
 
 void free_mp_state(){
 	free_var_queue();
 	free_val_queue();
 	free_vars();
+	free_exprs();
 	free_flows();
 }
 
@@ -34,51 +43,293 @@ void free_mp_state(){
  * Remember mptcp connection key generated by packetdrill. This key is needed
  * during the entire mptcp connection and is common among all mptcp subflows.
  */
-void set_packetdrill_key(u64 sender_key)
+void set_packetdrill_key(struct mp_connection *conn, u64 sender_key)
 {
-	mp_state.packetdrill_key = sender_key;
-	mp_state.packetdrill_key_set = true;
+	struct mp_connection *found, *replaced;
+
+	//Drop the index entry of the previous key, if it is still ours
+	if(conn->packetdrill_key_set){
+		HASH_FIND(hh_packetdrill_token, mp_state.conns_by_packetdrill_token,
+				&conn->packetdrill_token, sizeof(u32), found);
+		if(found == conn)
+			HASH_DELETE(hh_packetdrill_token,
+					mp_state.conns_by_packetdrill_token, conn);
+	}
+	conn->packetdrill_key = sender_key;
+	conn->packetdrill_key_set = true;
+	mptcp_token_and_idsn(conn->version, sender_key, &conn->packetdrill_token,
+			&conn->packetdrill_idsn);
+	HASH_REPLACE(hh_packetdrill_token, mp_state.conns_by_packetdrill_token,
+			packetdrill_token, sizeof(u32), conn, replaced);
 }
 
 /**
  * Remember mptcp connection key generated by kernel. This key is needed
  * during the entire mptcp connection and is common among all mptcp subflows.
  */
-void set_kernel_key(u64 receiver_key)
+void set_kernel_key(struct mp_connection *conn, u64 receiver_key)
+{
+	struct mp_connection *found, *replaced;
+
+	if(conn->kernel_key_set){
+		HASH_FIND(hh_kernel_token, mp_state.conns_by_kernel_token,
+				&conn->kernel_token, sizeof(u32), found);
+		if(found == conn)
+			HASH_DELETE(hh_kernel_token, mp_state.conns_by_kernel_token,
+					conn);
+	}
+	conn->kernel_key = receiver_key;
+	conn->kernel_key_set = true;
+	mptcp_token_and_idsn(conn->version, receiver_key, &conn->kernel_token,
+			&conn->kernel_idsn);
+	HASH_REPLACE(hh_kernel_token, mp_state.conns_by_kernel_token,
+			kernel_token, sizeof(u32), conn, replaced);
+}
+
+/* connections functions */
+
+/**
+ * Return the ports index key of the given packet, packetdrill side port
+ * first.
+ */
+static u32 packet_ports_key(struct packet *packet, unsigned direction)
+{
+	if(direction == DIRECTION_INBOUND)
+		return mp_ports_key(ntohs(packet->tcp->src_port),
+				ntohs(packet->tcp->dst_port));
+	return mp_ports_key(ntohs(packet->tcp->dst_port),
+			ntohs(packet->tcp->src_port));
+}
+
+static void mp_subflow_key_init(struct mp_subflow_key *key,
+		const struct ip_address *packetdrill_ip, u16 packetdrill_port,
+		const struct ip_address *kernel_ip, u16 kernel_port)
+{
+	memset(key, 0, sizeof(*key));
+	key->packetdrill_ip = *packetdrill_ip;
+	key->kernel_ip = *kernel_ip;
+	key->packetdrill_port = packetdrill_port;
+	key->kernel_port = kernel_port;
+}
+
+/**
+ * Fill in the subflows index key of the given packet. Returns STATUS_ERR if
+ * it is not a TCP/IP packet.
+ */
+static int packet_subflow_key(struct packet *packet, unsigned direction,
+		struct mp_subflow_key *key)
+{
+	struct ip_address src_ip, dst_ip;
+
+	if(!packet->tcp)
+		return STATUS_ERR;
+	if(packet->ipv4){
+		ip_from_ipv4(&packet->ipv4->src_ip, &src_ip);
+		ip_from_ipv4(&packet->ipv4->dst_ip, &dst_ip);
+	}else if(packet->ipv6){
+		ip_from_ipv6(&packet->ipv6->src_ip, &src_ip);
+		ip_from_ipv6(&packet->ipv6->dst_ip, &dst_ip);
+	}else{
+		return STATUS_ERR;
+	}
+
+	if(direction == DIRECTION_INBOUND)
+		mp_subflow_key_init(key, &src_ip, ntohs(packet->tcp->src_port),
+				&dst_ip, ntohs(packet->tcp->dst_port));
+	else
+		mp_subflow_key_init(key, &dst_ip, ntohs(packet->tcp->dst_port),
+				&src_ip, ntohs(packet->tcp->src_port));
+	return STATUS_OK;
+}
+
+/**
+ * Look up the newest subflow with the given 4-tuple.
+ */
+static struct mp_subflow *find_subflow_by_key(const struct mp_subflow_key *key)
+{
+	struct mp_subflow *subflow;
+	HASH_FIND(hh, mp_state.subflows_by_tuple, key,
+			sizeof(struct mp_subflow_key), subflow);
+	return subflow;
+}
+
+/**
+ * Create a new mptcp connection for the given packet, which should be the
+ * first packet of a mp_capable three-way handshake, and make it the default
+ * connection. A previous connection on the same ports is shadowed in the
+ * ports index.
+ */
+struct mp_connection *new_connection(struct packet *packet, unsigned direction)
+{
+	struct mp_connection *conn, *replaced;
+
+	conn = tagged_calloc(ALLOC_MPTCP, 1, sizeof(struct mp_connection));
+	conn->version = mp_state.version;
+	conn->idsn = UNDEFINED;
+	conn->remote_idsn = UNDEFINED;
+	conn->sum_ssn = 1; // first subflow has already one packet sent
+	conn->ports_key = packet_ports_key(packet, direction);
+	HASH_REPLACE(hh_ports, mp_state.conns_by_ports, ports_key, sizeof(u32),
+			conn, replaced);
+	conn->next = mp_state.connections;
+	mp_state.connections = conn;
+	return conn;
+}
+
+struct mp_connection *find_connection_matching_packet(struct packet *packet,
+		unsigned direction)
+{
+	u32 key = packet_ports_key(packet, direction);
+	struct mp_subflow_key subflow_key;
+	struct mp_subflow *subflow = NULL;
+	struct mp_connection *conn;
+
+	if(packet_subflow_key(packet, direction, &subflow_key) == STATUS_OK)
+		subflow = find_subflow_by_key(&subflow_key);
+	if(subflow)
+		return subflow->conn;
+	HASH_FIND(hh_ports, mp_state.conns_by_ports, &key, sizeof(u32), conn);
+	return conn;
+}
+
+struct mp_connection *find_connection_for_packet(struct packet *packet,
+		unsigned direction)
+{
+	struct mp_connection *conn =
+			find_connection_matching_packet(packet, direction);
+	return conn ? conn : mp_state.connections;
+}
+
+struct mp_connection *find_connection_by_packetdrill_token(u32 token)
 {
-    mp_state.kernel_key = receiver_key;
-    mp_state.kernel_key_set = true;
+	struct mp_connection *conn;
+	HASH_FIND(hh_packetdrill_token, mp_state.conns_by_packetdrill_token,
+			&token, sizeof(u32), conn);
+	return conn;
+}
+
+struct mp_connection *find_connection_by_kernel_token(u32 token)
+{
+	struct mp_connection *conn;
+	HASH_FIND(hh_kernel_token, mp_state.conns_by_kernel_token,
+			&token, sizeof(u32), conn);
+	return conn;
 }
 
 /* var_queue functions */
 
+bool mp_var_queued(const void *element, struct mp_var **var)
+{
+	uintptr_t bits = (uintptr_t)element;
+
+	if(!(bits & 1))
+		return false;
+	*var = mp_var_slot(bits >> 1);
+	return *var != NULL;
+}
+
 /**
- * Insert a COPY of name char* in mp_state.vars_queue.
- * Error is returned if queue is full.
+ * Intern name and insert its slot in mp_state.vars_queue.
+ * Error is returned if we are out of memory.
  *
  */
 int enqueue_var(char *name)
 {
-	unsigned name_length = strlen(name);
-	char *new_el = malloc(sizeof(char)*name_length+1);
-	memcpy(new_el, name, name_length);
-	new_el[name_length] = '\0';
-	int full_err = queue_enqueue(&mp_state.vars_queue, new_el);
-	return full_err;
+	return queue_enqueue(&mp_state.vars_queue,
+			mp_var_queue_element(mp_var_intern(name)));
 }
 
-//Caller should free
-int dequeue_var(char **name){
-	int empty_err = queue_dequeue(&mp_state.vars_queue, (void**)name);
-	return empty_err;
+//Error if the queue is empty or its front is not a variable
+int dequeue_var(struct mp_var **var){
+	void *element;
+	if(queue_dequeue(&mp_state.vars_queue, &element) ||
+			!mp_var_queued(element, var))
+		return STATUS_ERR;
+	return STATUS_OK;
 }
 
-//Free all variables names (char*) in vars_queue
+//Free vars_queue; mp_join_info elements are not freed
 void free_var_queue()
 {
 	queue_free(&mp_state.vars_queue);
 }
 
+/* compiled expression functions */
+
+bool mp_expr_queued(const void *element, struct mp_value_expr **expr)
+{
+	uintptr_t bits = (uintptr_t)element;
+
+	if((bits & 3) != 2 || (bits >> 2) >= mp_state.num_exprs)
+		return false;
+	*expr = &mp_state.exprs[bits >> 2];
+	return true;
+}
+
+u32 mp_expr_add(const struct mp_value_expr *expr)
+{
+	if(mp_state.num_exprs == mp_state.max_exprs){
+		u32 max = mp_state.max_exprs ? 2*mp_state.max_exprs : 16;
+		mp_state.exprs = tagged_realloc(ALLOC_MPTCP, mp_state.exprs,
+				max*sizeof(struct mp_value_expr));
+		mp_state.max_exprs = max;
+	}
+	mp_state.exprs[mp_state.num_exprs] = *expr;
+	return mp_state.num_exprs++;
+}
+
+/* (Re)compute expr from the key var holds now, if it changed. */
+static void mp_expr_eval(struct mp_value_expr *expr, struct mp_var *var,
+		u8 version)
+{
+	u64 key = *(u64*)var->value;
+	if(expr->valid && expr->key == key && expr->version == version)
+		return;
+	expr->value = mp_var_key_hash(var, version)->idsn + expr->addend;
+	expr->key = key;
+	expr->version = version;
+	expr->valid = true;
+}
+
+int enqueue_idsn_expr(const char *name, u64 addend, u8 version)
+{
+	struct mp_value_expr expr = {
+		.var = mp_var_intern(name),
+		.addend = addend,
+	};
+	struct mp_var *var = mp_var_slot(expr.var);
+
+	if(var->mp_capable_info.script_defined)
+		mp_expr_eval(&expr, var, version);
+	return queue_enqueue(&mp_state.vars_queue,
+			mp_expr_queue_element(mp_expr_add(&expr)));
+}
+
+int find_next_idsn_expr(u8 version, u64 *value)
+{
+	struct mp_value_expr *expr;
+	struct mp_var *var;
+	void *element;
+
+	if(queue_dequeue(&mp_state.vars_queue, &element) ||
+			!mp_expr_queued(element, &expr))
+		return STATUS_ERR;
+	var = mp_var_slot(expr->var);
+	if(!var || !var->value)
+		return STATUS_ERR;
+	mp_expr_eval(expr, var, version);
+	*value = expr->value;
+	return STATUS_OK;
+}
+
+void free_exprs()
+{
+	tagged_free(mp_state.exprs);
+	mp_state.exprs = NULL;
+	mp_state.num_exprs = 0;
+	mp_state.max_exprs = 0;
+}
+
 //Free all added values in vals_queue
 void free_val_queue()
 {
@@ -87,59 +338,67 @@ void free_val_queue()
 
 /* hashmap functions */
 
-void save_mp_var_name(char *name, struct mp_var *var)
+u32 mp_var_intern(const char *name)
 {
-	unsigned name_length = strlen(name);
-	var->name = malloc(sizeof(char)*(name_length+1));
-	memcpy(var->name, name, (name_length+1)); //+1 to copy '/0' too
+	struct mp_var *var;
+
+	HASH_FIND_STR(mp_state.vars, name, var);
+	if(var)
+		return var->slot;
+
+	if(mp_state.num_var_slots == mp_state.max_var_slots){
+		u32 max = mp_state.max_var_slots ? 2*mp_state.max_var_slots : 16;
+		mp_state.var_slots = tagged_realloc(ALLOC_MPTCP,
+				mp_state.var_slots,
+				max*sizeof(struct mp_var *));
+		mp_state.max_var_slots = max;
+	}
+	var = tagged_calloc(ALLOC_MPTCP, 1, sizeof(struct mp_var));
+	var->name = tagged_strdup(ALLOC_MPTCP, name);
+	var->slot = mp_state.num_var_slots++;
+	var->mptcp_subtype = MP_CAPABLE_SUBTYPE;
+	var->mp_capable_info.script_defined = false;
+	mp_state.var_slots[var->slot] = var;
+	HASH_ADD_KEYPTR(hh, mp_state.vars, var->name, strlen(var->name), var);
+	return var->slot;
 }
 
 /**
- *
- * Save a variable <name, value> in variables hashmap.
- * Where value is of u64 type key.
- *
- * Key memory location should stay valid, name is copied.
+ * Make var refer to the given key, unless the script gave it a value.
+ * Key memory location should stay valid. If the variable refers to the
+ * key of a previous connection, it now refers to the new key.
  *
  */
-void add_mp_var_key(char *name, u64 *key)
+void add_mp_var_key(struct mp_var *var, u64 *key)
 {
-	struct mp_var *var = malloc(sizeof(struct mp_var));
-	save_mp_var_name(name, var);
+	if(var->mptcp_subtype != MP_CAPABLE_SUBTYPE ||
+			var->mp_capable_info.script_defined)
+		return;
 	var->value = key;
-	var->mptcp_subtype = MP_CAPABLE_SUBTYPE;
-	var->mp_capable_info.script_defined = false;
-	add_mp_var(var);
+	mp_var_key_hash(var, mp_state.version);
 }
 
 /**
- * Save a variable <name, value> in variables hashmap.
+ * Give the variable of the given name a value from the script.
  * Value is copied in a newly allocated pointer and will be freed when
  * free_vars function will be executed.
  *
  */
 void add_mp_var_script_defined(char *name, void *value, u32 length)
 {
-	struct mp_var *var = malloc(sizeof(struct mp_var));
-	save_mp_var_name(name, var);
-	var->value = malloc(length);
+	struct mp_var *var = mp_var_slot(mp_var_intern(name));
+
+	if(var->mp_capable_info.script_defined)
+		tagged_free(var->value);
+	var->value = tagged_malloc(ALLOC_MPTCP, length);
 	memcpy(var->value, value, length);
 	var->mptcp_subtype = MP_CAPABLE_SUBTYPE;
 	var->mp_capable_info.script_defined = true;
-	add_mp_var(var);
-}
-
-/**
- * Add var to the variable hashmap.
- */
-void add_mp_var(struct mp_var *var)
-{
-	HASH_ADD_KEYPTR(hh, mp_state.vars, var->name, strlen(var->name), var);
+	var->key_hash.valid = false;
 }
 
 /**
- * Search in the hashmap for the value of the variable of name "name" and
- * return both variable - value (mp_var struct).
+ * Search in the hashmap for the variable of name "name".
  * NULL is returned if not found
  */
 struct mp_var *find_mp_var(char *name)
@@ -154,39 +413,55 @@ struct mp_var *find_mp_var(char *name)
  * the packets.
  */
 u64 *find_next_key(){
-	char *var_name;
-	if(dequeue_var(&var_name) || !var_name){
+	struct mp_var *var;
+	if(dequeue_var(&var)){
 		return NULL;
 	}
-
-	struct mp_var *var = find_mp_var(var_name);
-	free(var_name);
-/*
-	if(!var || var->mptcp_subtype != MP_CAPABLE_SUBTYPE){
-		return NULL;
-	}*/
 	return (u64*)var->value;
 }
 
 /**
- * Iterate through hashmap, free mp_var structs and mp_var->name.
+ * Return the token and idsn of the key held by a mptcp key variable, derived
+ * with the hash of the given MPTCP version. They are computed once per key
+ * value: the key a variable refers to may be updated in place, so the cache
+ * is checked against it.
+ */
+struct mp_key_hash *mp_var_key_hash(struct mp_var *var, u8 version)
+{
+	u64 key = *(u64*)var->value;
+	if(!var->key_hash.valid || var->key_hash.key != key ||
+			var->key_hash.version != version){
+		var->key_hash.key = key;
+		var->key_hash.version = version;
+		mptcp_token_and_idsn(version, key, &var->key_hash.token,
+				&var->key_hash.idsn);
+		var->key_hash.valid = true;
+	}
+	return &var->key_hash;
+}
+
+/**
+ * Iterate through the slots, free mp_var structs and mp_var->name.
  * Value is not freed for KEY type, since values come from stack.
  */
 void free_vars()
 {
-	struct mp_var *next, *var;
-	var = mp_state.vars;
+	u32 i;
 
-	while(var){
-		next = var->hh.next;
-		free(var->name);
+	for(i = 0; i < mp_state.num_var_slots; i++){
+		struct mp_var *var = mp_state.var_slots[i];
+		tagged_free(var->name);
 		if(var->mptcp_subtype == MP_CAPABLE_SUBTYPE){
 			if(var->mp_capable_info.script_defined)
-				free(var->value);
+				tagged_free(var->value);
 		}
-		free(var);
-		var = next;
+		tagged_free(var);
 	}
+	tagged_free(mp_state.var_slots);
+	mp_state.var_slots = NULL;
+	mp_state.num_var_slots = 0;
+	mp_state.max_var_slots = 0;
+	mp_state.vars = NULL;
 }
 
 /**
@@ -199,6 +474,25 @@ u64 find_next_value(){
 	return val;
 }
 
+/**
+ * Attach subflow to conn and index it by 4-tuple. A previous subflow with
+ * the same 4-tuple is shadowed in the index, as the newest subflow always
+ * matched first. A new subflow has ssn 1, so conn->sum_ssn is unchanged.
+ */
+static void add_subflow(struct mp_connection *conn, struct mp_subflow *subflow)
+{
+	struct mp_subflow *replaced;
+
+	subflow->conn = conn;
+	mp_subflow_key_init(&subflow->key, &subflow->src_ip, subflow->src_port,
+			&subflow->dst_ip, subflow->dst_port);
+	HASH_REPLACE(hh, mp_state.subflows_by_tuple, key,
+			sizeof(struct mp_subflow_key), subflow, replaced);
+	mp_state.subflows_generation++;
+	subflow->next = conn->subflows;
+	conn->subflows = subflow;
+}
+
 /**
  * @pre inbound packet should be the first packet of a three-way handshake
  * mp_join initiated by packetdrill (thus an inbound mp_join syn packet).
@@ -209,12 +503,14 @@ u64 find_next_value(){
  * packetdrill_addr_id). kernel_addr_id and kernel_rand_nbr should be set when
  * receiving syn+ack with mp_join mptcp option from kernel.
  *
- * - last_packetdrill_addr_id is incremented.
+ * - last_packetdrill_addr_id of the connection is incremented.
  */
-struct mp_subflow *new_subflow_inbound(struct packet *inbound_packet)
+struct mp_subflow *new_subflow_inbound(struct mp_connection *conn,
+		struct packet *inbound_packet)
 {
 
-	struct mp_subflow *subflow = malloc(sizeof(struct mp_subflow));
+	struct mp_subflow *subflow =
+		tagged_calloc(ALLOC_MPTCP, 1, sizeof(struct mp_subflow));
 
 	if(inbound_packet->ipv4){
 		ip_from_ipv4(&inbound_packet->ipv4->src_ip, &subflow->src_ip);
@@ -227,33 +523,37 @@ struct mp_subflow *new_subflow_inbound(struct packet *inbound_packet)
 	}
 
 	else{
+		tagged_free(subflow);
 		return NULL;
 	}
 
 	subflow->src_port =	ntohs(inbound_packet->tcp->src_port);
 	subflow->dst_port = ntohs(inbound_packet->tcp->dst_port);
 	subflow->packetdrill_rand_nbr =	42;
-	subflow->packetdrill_addr_id = mp_state.last_packetdrill_addr_id;
-	mp_state.last_packetdrill_addr_id++;
+	subflow->packetdrill_addr_id = conn->last_packetdrill_addr_id;
+	conn->last_packetdrill_addr_id++;
 	subflow->ssn = 1; // =1 because the code assumes it is being set with the third ack,
 			  // although that is not the case anymore (new_subflow_inbound is also
 			  // called at syn time)
 //	subflow->state = UNDEFINED;  // TODO to define it and change the state after
-	subflow->next = mp_state.subflows;
-	mp_state.subflows = subflow;
+	add_subflow(conn, subflow);
 
 	return subflow;
 }
 
-struct mp_subflow *new_subflow_outbound(struct packet *outbound_packet)
+struct mp_subflow *new_subflow_outbound(struct mp_connection *conn,
+		struct packet *outbound_packet)
 {
 
-	struct mp_subflow *subflow = malloc(sizeof(struct mp_subflow));
+	struct mp_subflow *subflow =
+		tagged_calloc(ALLOC_MPTCP, 1, sizeof(struct mp_subflow));
 	struct tcp_option *mp_join_syn =
 			get_mptcp_option(outbound_packet, MP_CAPABLE_SUBTYPE); //TCPOPT_MPTCP);
 
-	if(!mp_join_syn)
+	if(!mp_join_syn){
+		tagged_free(subflow);
 		return NULL;
+	}
 
 	if(outbound_packet->ipv4){
 		ip_from_ipv4(&outbound_packet->ipv4->dst_ip, &subflow->src_ip);
@@ -266,6 +566,7 @@ struct mp_subflow *new_subflow_outbound(struct packet *outbound_packet)
 	}
 
 	else{
+		tagged_free(subflow);
 		return NULL;
 	}
 
@@ -276,75 +577,93 @@ struct mp_subflow *new_subflow_outbound(struct packet *outbound_packet)
 	subflow->kernel_addr_id =
 			mp_join_syn->data.mp_join.syn.address_id;
 	subflow->ssn = 1;
-	subflow->next = mp_state.subflows;
-	mp_state.subflows = subflow;
+	add_subflow(conn, subflow);
 	return subflow;
 }
 
-/**
- * Return the first subflow S of mp_state.subflows for which match(packet, S)
- * returns true.
- */
-struct mp_subflow *find_matching_subflow(struct packet *packet,
-		bool (*match)(struct mp_subflow*, struct packet*))
-{
-	struct mp_subflow *subflow = mp_state.subflows;
-	while(subflow){
-		if((*match)(subflow, packet)){
-			return subflow;
-		}
-		subflow = subflow->next;
-	}
-	return NULL;
-}
-
-static bool does_subflow_match_outbound_packet(struct mp_subflow *subflow,
-		struct packet *outbound_packet){
-	return subflow->dst_port == ntohs(outbound_packet->tcp->src_port) &&
-			subflow->src_port == ntohs(outbound_packet->tcp->dst_port);
-}
-
 struct mp_subflow *find_subflow_matching_outbound_packet(
 		struct packet *outbound_packet)
 {
-	return find_matching_subflow(outbound_packet, does_subflow_match_outbound_packet);
-}
+	struct mp_subflow_key key;
 
-static bool does_subflow_match_inbound_packet(struct mp_subflow *subflow,
-		struct packet *inbound_packet){
-	return subflow->dst_port == ntohs(inbound_packet->tcp->dst_port) &&
-			subflow->src_port == ntohs(inbound_packet->tcp->src_port);
+	if(packet_subflow_key(outbound_packet, DIRECTION_OUTBOUND, &key))
+		return NULL;
+	return find_subflow_by_key(&key);
 }
 
 struct mp_subflow *find_subflow_matching_inbound_packet(
 		struct packet *inbound_packet)
 {
-	return find_matching_subflow(inbound_packet, does_subflow_match_inbound_packet);
+	struct mp_subflow_key key;
+
+	if(packet_subflow_key(inbound_packet, DIRECTION_INBOUND, &key))
+		return NULL;
+	return find_subflow_by_key(&key);
 }
 
+/**
+ * The live socket is the kernel side of the subflow, and its remote end is
+ * packetdrill.
+ */
 struct mp_subflow *find_subflow_matching_socket(struct socket *socket){
-	struct mp_subflow *subflow = mp_state.subflows;
-	while(subflow){
-		if(subflow->dst_port == socket->live.remote.port &&
-				subflow->src_port == socket->live.local.port){
-			return subflow;
-		}
-		subflow = subflow->next;
+	struct mp_subflow_key key;
+	struct mp_subflow *subflow;
+
+	if(socket->mp_subflow &&
+	   socket->mp_subflow_generation == mp_state.subflows_generation)
+		return socket->mp_subflow;
+	mp_subflow_key_init(&key, &socket->live.remote.ip,
+			ntohs(socket->live.remote.port),
+			&socket->live.local.ip, ntohs(socket->live.local.port));
+	subflow = find_subflow_by_key(&key);
+	// Only cache a hit: the socket may not have its live 4-tuple yet.
+	if(subflow){
+		socket->mp_subflow = subflow;
+		socket->mp_subflow_generation = mp_state.subflows_generation;
 	}
-	return NULL;
+	return subflow;
 }
 
 /**
- * Free all mptcp subflows struct being a member of mp_state.subflows list.
+ * Free all mptcp connections, their subflows and the indexes over them.
  */
 void free_flows(){
-	struct mp_subflow *subflow = mp_state.subflows;
-	struct mp_subflow *temp;
-	while(subflow){
-		temp = subflow->next;
-		free(subflow);
-		subflow = temp;
+	struct mp_connection *conn = mp_state.connections;
+	struct mp_connection *next_conn;
+	struct mp_subflow *subflow, *temp;
+
+	HASH_CLEAR(hh, mp_state.subflows_by_tuple);
+	mp_state.subflows_generation++;
+	HASH_CLEAR(hh_ports, mp_state.conns_by_ports);
+	HASH_CLEAR(hh_packetdrill_token, mp_state.conns_by_packetdrill_token);
+	HASH_CLEAR(hh_kernel_token, mp_state.conns_by_kernel_token);
+	while(conn){
+		next_conn = conn->next;
+		subflow = conn->subflows;
+		while(subflow){
+			temp = subflow->next;
+			tagged_free(subflow);
+			subflow = temp;
+		}
+		tagged_free(conn);
+		conn = next_conn;
 	}
+	mp_state.connections = NULL;
+}
+
+/**
+ * Peek at the variable at the front of vars_queue, without dequeuing it.
+ * *var is NULL if the front element is a mp_join_info; error if the queue is
+ * empty.
+ */
+static int front_var(struct mp_var **var)
+{
+	void *element;
+	if(queue_front(&mp_state.vars_queue, &element))
+		return STATUS_ERR;
+	if(!mp_var_queued(element, var))
+		*var = NULL;
+	return STATUS_OK;
 }
 
 /**
@@ -352,29 +671,27 @@ void free_flows(){
  * the script.
  *
  */
-int mptcp_gen_key()
+int mptcp_gen_key(struct mp_connection *conn)
 {
 
-	//Retrieve variable name parsed by bison.
-	char *snd_var_name;
-	if(queue_front(&mp_state.vars_queue, (void**)&snd_var_name))
+	//Retrieve variable parsed by bison.
+	struct mp_var *snd_var;
+	if(front_var(&snd_var))
 		return STATUS_ERR;
 
 	//Is that var has already a value assigned in the script by user, or should
 	//we generate a mptcp key ourselves?
-	struct mp_var *snd_var = find_mp_var(snd_var_name);
-
 	if(snd_var && snd_var->mptcp_subtype == MP_CAPABLE_SUBTYPE &&
 			snd_var->mp_capable_info.script_defined)
-		set_packetdrill_key(*(u64*)snd_var->value);
+		set_packetdrill_key(conn, *(u64*)snd_var->value);
 
 	//First inbound mp_capable, generate new key
 	//and save corresponding variable
-	if(!mp_state.packetdrill_key_set){
-		seed_generator();
-		u64 key = rand_64();
-		set_packetdrill_key(key);
-		add_mp_var_key(snd_var_name, &mp_state.packetdrill_key);
+	if(!conn->packetdrill_key_set){
+		u64 key = rand_64(mp_state.prng);
+		set_packetdrill_key(conn, key);
+		if(snd_var)
+			add_mp_var_key(snd_var, &conn->packetdrill_key);
 	}
 
 	return STATUS_OK;
@@ -416,7 +733,7 @@ int mptcp_set_mp_cap_keys(struct tcp_option *tcp_opt)
  * Extract mptcp connection informations from mptcp packets sent by kernel.
  * (For example kernel mptcp key).
  */
-static int extract_and_set_kernel_key(
+static int extract_and_set_kernel_key(struct mp_connection *conn,
 		struct packet *live_packet)
 {
 
@@ -427,29 +744,66 @@ static int extract_and_set_kernel_key(
 		return STATUS_ERR;
 
 	//Check if kernel key hasn't been specified by user in script
-	char *var_name;
-	if(!queue_front(&mp_state.vars_queue, (void**)&var_name)){
-		struct mp_var *var = find_mp_var(var_name);
-		if(var && var->mptcp_subtype == MP_CAPABLE_SUBTYPE &&
-				var->mp_capable_info.script_defined)
-			set_kernel_key(*(u64*)var->value);
-	}
+	struct mp_var *var;
+	int err = front_var(&var);
+	if(!err && var && var->mptcp_subtype == MP_CAPABLE_SUBTYPE &&
+			var->mp_capable_info.script_defined)
+		set_kernel_key(conn, *(u64*)var->value);
 
-	if(!mp_state.kernel_key_set){
+	if(!conn->kernel_key_set){
 
 		//Set found kernel key
-		set_kernel_key(mpcap_opt->data.mp_capable.syn.key);
-		//Set front queue variable name to refer to kernel key
-		char *var_name;
-		if(queue_front(&mp_state.vars_queue, (void**)&var_name)){
+		set_kernel_key(conn, mpcap_opt->data.mp_capable.syn.key);
+		//Set front queue variable to refer to kernel key
+		if(err)
 			return STATUS_ERR;
-		}
-		add_mp_var_key(var_name, &mp_state.kernel_key);
+		if(var)
+			add_mp_var_key(var, &conn->kernel_key);
 	}
 
 	return STATUS_OK;
 }
 
+/**
+ * Return the connection of the mp_capable handshake the live packet belongs
+ * to, creating it for the first packet of the handshake.
+ */
+static struct mp_connection *mp_capable_connection(struct packet *live_packet,
+		unsigned direction)
+{
+	struct mp_connection *conn =
+			find_connection_matching_packet(live_packet, direction);
+	if(!conn)
+		conn = new_connection(live_packet, direction);
+	return conn;
+}
+
+/**
+ * Take the MPTCP version of a connection from a syn or syn_ack mp_capable
+ * option: the script one for packets we send, the live one for packets the
+ * kernel sends. Tokens and idsns of keys already known are derived again
+ * if the version changes.
+ */
+static void mp_capable_version(struct mp_connection *conn,
+		struct tcp_option *tcp_opt_to_modify,
+		struct packet *live_packet,
+		unsigned direction)
+{
+	struct tcp_option *opt = tcp_opt_to_modify;
+	if(direction == DIRECTION_OUTBOUND){
+		opt = get_mptcp_option(live_packet, MP_CAPABLE_SUBTYPE);
+		if(!opt)
+			return;
+	}
+	if(opt->data.mp_capable.version == conn->version)
+		return;
+	conn->version = opt->data.mp_capable.version;
+	if(conn->packetdrill_key_set)
+		set_packetdrill_key(conn, conn->packetdrill_key);
+	if(conn->kernel_key_set)
+		set_kernel_key(conn, conn->kernel_key);
+}
+
 /**
  * Insert appropriate key in mp_capable mptcp option.
  */
@@ -459,39 +813,67 @@ int mptcp_subtype_mp_capable(struct packet *packet_to_modify,
 		unsigned direction)
 {
 	int error;
+	struct mp_connection *conn;
+	// Version 1 Syn packet, either way: no key until the syn_ack
+	if(tcp_opt_to_modify->length == TCPOLEN_MP_CAPABLE_V1_SYN &&
+			!packet_to_modify->tcp->ack){
+		conn = mp_capable_connection(live_packet, direction);
+		mp_capable_version(conn, tcp_opt_to_modify, live_packet, direction);
+		error = STATUS_OK;
+		if(direction == DIRECTION_INBOUND)
+			new_subflow_inbound(conn, packet_to_modify);
+		else
+			conn->remote_ssn++;
+	}
 	// Syn packet, packetdril -> kernel
-	if(tcp_opt_to_modify->length == TCPOLEN_MP_CAPABLE_SYN &&
+	else if(tcp_opt_to_modify->length == TCPOLEN_MP_CAPABLE_SYN &&
 			direction == DIRECTION_INBOUND &&
 			!packet_to_modify->tcp->ack){
-		error = mptcp_gen_key();
+		conn = mp_capable_connection(live_packet, direction);
+		mp_capable_version(conn, tcp_opt_to_modify, live_packet, direction);
+		error = mptcp_gen_key(conn);
 		error = mptcp_set_mp_cap_syn_key(tcp_opt_to_modify) || error;
 		// For inbound flow, initialise flow at syn,
 		// For outbound flow, initialise at third ack.
-		new_subflow_inbound(packet_to_modify);
+		new_subflow_inbound(conn, packet_to_modify);
 	}
 	// Syn and Syn_ack kernel->packetdrill
 	else if(tcp_opt_to_modify->length == TCPOLEN_MP_CAPABLE_SYN &&
 			direction == DIRECTION_OUTBOUND){
-		error = extract_and_set_kernel_key(live_packet);
+		conn = mp_capable_connection(live_packet, direction);
+		mp_capable_version(conn, tcp_opt_to_modify, live_packet, direction);
+		error = extract_and_set_kernel_key(conn, live_packet);
 		error = mptcp_set_mp_cap_syn_key(tcp_opt_to_modify);
-		mp_state.remote_ssn++;
+		conn->remote_ssn++;
 	}
 	// Third (ack) packet in three-hand shake
 	else if(tcp_opt_to_modify->length == TCPOLEN_MP_CAPABLE ){
-		error = mptcp_set_mp_cap_keys(tcp_opt_to_modify);
+		conn = find_connection_for_packet(live_packet, direction);
+		if(!conn)
+			return STATUS_ERR;
+		// In version 1, the key of the side that sent the syn is first
+		// sent here. The sender key comes first, as in a syn.
+		error = STATUS_OK;
+		if(direction == DIRECTION_INBOUND && !conn->packetdrill_key_set)
+			error = mptcp_gen_key(conn);
+		else if(direction == DIRECTION_OUTBOUND && !conn->kernel_key_set)
+			error = extract_and_set_kernel_key(conn, live_packet);
+		error = mptcp_set_mp_cap_keys(tcp_opt_to_modify) || error;
 		// Automatically put the idsn tokens
-		mp_state.idsn = sha1_least_64bits(mp_state.packetdrill_key);
-		mp_state.remote_idsn = sha1_least_64bits(mp_state.kernel_key);
+		conn->idsn = conn->packetdrill_idsn;
+		conn->remote_idsn = conn->kernel_idsn;
 		// If this is done at syn packet time as for inbound, key comparisons fail
 		// due to, I guess, key set too early as it complains key is not 0
 		if(direction == DIRECTION_OUTBOUND)
-			new_subflow_outbound(live_packet);
+			new_subflow_outbound(conn, live_packet);
 	}
 	// SYN_ACK, packetdrill->kernel
 	else if(tcp_opt_to_modify->length == TCPOLEN_MP_CAPABLE_SYN &&
 			direction == DIRECTION_INBOUND &&
 			packet_to_modify->tcp->ack){
-		error = mptcp_gen_key();
+		conn = mp_capable_connection(live_packet, direction);
+		mp_capable_version(conn, tcp_opt_to_modify, live_packet, direction);
+		error = mptcp_gen_key(conn);
 		error = mptcp_set_mp_cap_syn_key(tcp_opt_to_modify) || error;
 	}
 
@@ -505,16 +887,17 @@ int mptcp_subtype_mp_capable(struct packet *packet_to_modify,
  * Set appropriate receiver token value in tcp_option.
  *
  */
-static void mp_join_syn_rcv_token(struct tcp_option *tcp_opt_to_modify,
+static void mp_join_syn_rcv_token(struct mp_connection *conn,
+		struct tcp_option *tcp_opt_to_modify,
 		struct mp_join_info *mp_join_script_info,
 		unsigned direction)
 {
 	if(mp_join_script_info->syn_or_syn_ack.is_script_defined){
 
 		if(mp_join_script_info->syn_or_syn_ack.is_var){
-			struct mp_var *var = find_mp_var(mp_join_script_info->syn_or_syn_ack.var);
+			struct mp_var *var = mp_var_slot(mp_join_script_info->syn_or_syn_ack.var);
 			tcp_opt_to_modify->data.mp_join.syn.no_ack.receiver_token =
-					htonl(sha1_least_32bits(*(u64*)var->value));
+					htonl(mp_var_key_hash(var, conn->version)->token);
 		}
 		else{
 			tcp_opt_to_modify->data.mp_join.syn.no_ack.receiver_token =
@@ -523,12 +906,47 @@ static void mp_join_syn_rcv_token(struct tcp_option *tcp_opt_to_modify,
 	}
 	else if(direction == DIRECTION_INBOUND){
 		tcp_opt_to_modify->data.mp_join.syn.no_ack.receiver_token =
-				htonl(sha1_least_32bits(mp_state.kernel_key));
+				htonl(conn->kernel_token);
 	}
 	else if(direction == DIRECTION_OUTBOUND){
 		tcp_opt_to_modify->data.mp_join.syn.no_ack.receiver_token =
-				htonl(sha1_least_32bits(mp_state.packetdrill_key));
+				htonl(conn->packetdrill_token);
+	}
+}
+
+/**
+ * Return the connection a mp_join syn joins: the one whose token is the
+ * receiver token, falling back to the default connection.
+ */
+static struct mp_connection *mp_join_syn_connection(struct packet *live_packet,
+		struct mp_join_info *mp_join_script_info,
+		unsigned direction)
+{
+	struct mp_connection *conn = NULL;
+
+	if(direction == DIRECTION_INBOUND){
+		if(mp_join_script_info->syn_or_syn_ack.is_script_defined){
+			u32 token;
+			if(mp_join_script_info->syn_or_syn_ack.is_var){
+				struct mp_var *var =
+						mp_var_slot(mp_join_script_info->syn_or_syn_ack.var);
+				token = var && var->value ? mp_var_key_hash(var,
+						mp_state.version)->token : 0;
+			}
+			else{
+				token = mp_join_script_info->syn_or_syn_ack.hash;
+			}
+			conn = find_connection_by_kernel_token(token);
+		}
+	}
+	else if(direction == DIRECTION_OUTBOUND){
+		struct tcp_option *live_mp_join =
+				get_tcp_option(live_packet, TCPOPT_MPTCP);
+		if(live_mp_join)
+			conn = find_connection_by_packetdrill_token(ntohl(
+					live_mp_join->data.mp_join.syn.no_ack.receiver_token));
 	}
+	return conn ? conn : mp_state.connections;
 }
 
 static void mp_join_syn_address_id(struct tcp_option *tcp_opt_to_modify,
@@ -586,15 +1004,20 @@ static int mp_join_syn(struct packet *packet_to_modify,
 		struct mp_join_info *mp_join_script_info,
 		unsigned direction)
 {
-	struct mp_subflow *subflow;
+	struct mp_subflow *subflow = NULL;
+	struct mp_connection *conn =
+			mp_join_syn_connection(live_packet, mp_join_script_info, direction);
+	if(!conn)
+		return STATUS_ERR;
 	if(direction == DIRECTION_INBOUND)
-		subflow = new_subflow_inbound(packet_to_modify);
+		subflow = new_subflow_inbound(conn, packet_to_modify);
 	else if(direction == DIRECTION_OUTBOUND)
-		subflow = new_subflow_outbound(live_packet);
+		subflow = new_subflow_outbound(conn, live_packet);
 	if(!subflow)
 		return STATUS_ERR;
 
-	mp_join_syn_rcv_token(tcp_opt_to_modify, mp_join_script_info, direction);
+	mp_join_syn_rcv_token(conn, tcp_opt_to_modify, mp_join_script_info,
+			direction);
 	mp_join_syn_rand(tcp_opt_to_modify,
 			mp_join_script_info,
 			subflow,
@@ -607,25 +1030,79 @@ static int mp_join_syn(struct packet *packet_to_modify,
 	return STATUS_OK;
 }
 
+/**
+ * Put the truncated HMAC of an MP_JOIN SYN/ACK packetdrill sends in the
+ * option: for version 1, its leftmost 64 bits as they come; for version 0,
+ * as a big endian number.
+ */
+static void mp_join_syn_ack_put_hmac(struct tcp_option *tcp_opt_to_modify,
+		u8 version, const u8 *hmac)
+{
+	u64 truncated;
+
+	memcpy(&truncated, hmac, sizeof(truncated));
+	if(version == MPTCP_V0)
+		truncated = htobe64(truncated);
+	tcp_opt_to_modify->data.mp_join.syn.ack.sender_hmac = truncated;
+}
+
 void mp_join_syn_ack_sender_hmac(struct tcp_option *tcp_opt_to_modify,
-		u64 key1, u64 key2, u32 msg1, u32 msg2)
+		u8 version, u64 key1, u64 key2, u32 msg1, u32 msg2)
+{
+	u8 hmac[MPTCP_HMAC_MAX_BYTES];
+
+	mptcp_hmac(version, (u8*)&key1, (u8*)&key2, (u8*)&msg1, (u8*)&msg2,
+			hmac);
+	mp_join_syn_ack_put_hmac(tcp_opt_to_modify, version, hmac);
+}
+
+/**
+ * Make the connection's HMAC keys, if its keys or version changed since
+ * they were made.
+ */
+static const struct mp_hmac_keys *mp_hmac_keys(struct mp_connection *conn)
+{
+	struct mp_hmac_keys *keys = &conn->hmac_keys;
+
+	if(keys->valid && keys->packetdrill_key == conn->packetdrill_key &&
+			keys->kernel_key == conn->kernel_key &&
+			keys->version == conn->version)
+		return keys;
+	keys->packetdrill_key = conn->packetdrill_key;
+	keys->kernel_key = conn->kernel_key;
+	keys->version = conn->version;
+	mptcp_hmac_key_init(&keys->packetdrill, conn->version,
+			conn->packetdrill_key, conn->kernel_key);
+	mptcp_hmac_key_init(&keys->kernel, conn->version,
+			conn->kernel_key, conn->packetdrill_key);
+	keys->valid = true;
+	return keys;
+}
+
+const struct mp_join_hmacs *mp_join_hmacs(struct mp_subflow *subflow)
 {
-	//Build key for HMAC-SHA1
-	unsigned char hmac_key[16];
-	unsigned long *key_a = (unsigned long*)hmac_key;
-	unsigned long *key_b = (unsigned long*)&(hmac_key[8]);
-	*key_a = key1;
-	*key_b = key2;
-
-	//Build message for HMAC-SHA1
-	u32 msg[2];
-	msg[0] = msg1;
-	msg[1] = msg2;
-	tcp_opt_to_modify->data.mp_join.syn.ack.sender_hmac =
-			htobe64(hmac_sha1_truncat_64(hmac_key,
-					16,
-					(char*)msg,
-					8));
+	struct mp_connection *conn = subflow->conn;
+	struct mp_join_hmacs *hmacs = &subflow->join_hmacs;
+	const struct mp_hmac_keys *keys;
+
+	if(hmacs->valid && hmacs->packetdrill_key == conn->packetdrill_key &&
+			hmacs->kernel_key == conn->kernel_key &&
+			hmacs->version == conn->version &&
+			hmacs->packetdrill_rand_nbr == subflow->packetdrill_rand_nbr &&
+			hmacs->kernel_rand_nbr == subflow->kernel_rand_nbr)
+		return hmacs;
+	keys = mp_hmac_keys(conn);
+	hmacs->packetdrill_key = conn->packetdrill_key;
+	hmacs->kernel_key = conn->kernel_key;
+	hmacs->version = conn->version;
+	hmacs->packetdrill_rand_nbr = subflow->packetdrill_rand_nbr;
+	hmacs->kernel_rand_nbr = subflow->kernel_rand_nbr;
+	mptcp_hmac_keyed(&keys->packetdrill, subflow->packetdrill_rand_nbr,
+			subflow->kernel_rand_nbr, hmacs->packetdrill);
+	mptcp_hmac_keyed(&keys->kernel, subflow->kernel_rand_nbr,
+			subflow->packetdrill_rand_nbr, hmacs->kernel);
+	hmacs->valid = true;
+	return hmacs;
 }
 
 static int mp_join_syn_ack(struct packet *packet_to_modify,
@@ -641,13 +1118,13 @@ static int mp_join_syn_ack(struct packet *packet_to_modify,
 		if(!subflow)
 			return STATUS_ERR;
 
-		subflow->packetdrill_rand_nbr = generate_32();
+		subflow->packetdrill_rand_nbr = generate_32(mp_state.prng);
 
 		mp_join_syn_address_id(tcp_opt_to_modify,
 				mp_join_script_info,
 				subflow,
 				direction);
-		mp_state.last_packetdrill_addr_id++;
+		subflow->conn->last_packetdrill_addr_id++;
 
 		if(mp_join_script_info->syn_or_syn_ack.rand_script_defined)
 			subflow->packetdrill_rand_nbr =
@@ -659,10 +1136,11 @@ static int mp_join_syn_ack(struct packet *packet_to_modify,
 		if(mp_join_script_info->syn_or_syn_ack.is_script_defined){
 			if(mp_join_script_info->syn_or_syn_ack.is_var){
 				struct mp_var *var =
-						find_mp_var(mp_join_script_info->syn_or_syn_ack.var);
+						mp_var_slot(mp_join_script_info->syn_or_syn_ack.var);
 				struct mp_var *var2 =
-						find_mp_var(mp_join_script_info->syn_or_syn_ack.var2);
+						mp_var_slot(mp_join_script_info->syn_or_syn_ack.var2);
 				mp_join_syn_ack_sender_hmac(tcp_opt_to_modify,
+									subflow->conn->version,
 									*(u64*)var->value,
 									*(u64*)var2->value,
 									subflow->packetdrill_rand_nbr,
@@ -671,11 +1149,9 @@ static int mp_join_syn_ack(struct packet *packet_to_modify,
 			}
 		}
 		else{
-			mp_join_syn_ack_sender_hmac(tcp_opt_to_modify,
-					mp_state.packetdrill_key,
-					mp_state.kernel_key,
-					subflow->packetdrill_rand_nbr,
-					subflow->kernel_rand_nbr);
+			mp_join_syn_ack_put_hmac(tcp_opt_to_modify,
+					subflow->conn->version,
+					mp_join_hmacs(subflow)->packetdrill);
 		}
 	}
 
@@ -698,8 +1174,8 @@ static int mp_join_syn_ack(struct packet *packet_to_modify,
 		unsigned char hmac_key[16];
 		unsigned long *key_b = (unsigned long*)hmac_key;
 		unsigned long *key_a = (unsigned long*)&(hmac_key[8]);
-		*key_b = mp_state.kernel_key;
-		*key_a = mp_state.packetdrill_key;
+		*key_b = subflow->conn->kernel_key;
+		*key_a = subflow->conn->packetdrill_key;
 
 		//Build message for HMAC-SHA1
 		unsigned msg[2];
@@ -766,25 +1242,9 @@ int mptcp_subtype_mp_join(struct packet *packet_to_modify,
 		tcp_opt_to_modify->data.mp_join.syn.ack.sender_random_number =
 				live_mp_join->data.mp_join.syn.ack.sender_random_number;
 
-		//Build key for HMAC-SHA1
-		u64 loc_key = mp_state.packetdrill_key;
-		u64 rem_key = mp_state.kernel_key;
-		u32 loc_nonce = subflow->packetdrill_rand_nbr;
-		u32 rem_nonce = live_mp_join->data.mp_join.syn.ack.sender_random_number;
-
-		// return value
-		u8 mptcp_hash_mac[20];
-		mptcp_hmac_sha1(
-				(u8*)&rem_key,
-				(u8*)&loc_key,
-				(u8*)&rem_nonce,
-				(u8*)&loc_nonce,
-				(u32*)mptcp_hash_mac );
-
-//		u64 live_hmac = live_mp_join->data.mp_join.syn.ack.sender_hmac;
-//		printf("822: %llu == %llu\n", live_hmac, *(u64*)mptcp_hash_mac );
-
-		tcp_opt_to_modify->data.mp_join.syn.ack.sender_hmac = *(u64*)mptcp_hash_mac;
+		//The HMAC the kernel should send, keyed with its key first
+		memcpy(&tcp_opt_to_modify->data.mp_join.syn.ack.sender_hmac,
+				mp_join_hmacs(subflow)->kernel, sizeof(u64));
 	}
 	//mp_join ack XXX
 	else if(direction == DIRECTION_INBOUND &&
@@ -796,44 +1256,26 @@ int mptcp_subtype_mp_join(struct packet *packet_to_modify,
 			return STATUS_ERR;
 
 		if(mp_join_script_info->ack.is_var){
-			//Build key for HMAC-SHA1
-			u64 loc_key = mp_state.packetdrill_key;
-			u64 rem_key = mp_state.kernel_key;
-			u32 loc_nonce = subflow->packetdrill_rand_nbr;
-			u32 rem_nonce = subflow->kernel_rand_nbr;
-
-			// return value
-			u8 mptcp_hash_mac[20];
-			mptcp_hmac_sha1(
-					(u8*)&loc_key,
-					(u8*)&rem_key,
-					(u8*)&loc_nonce,
-					(u8*)&rem_nonce,
-					(u32*)mptcp_hash_mac );
-
 			memcpy(tcp_opt_to_modify->data.mp_join.no_syn.sender_hmac,
-					mptcp_hash_mac,
+					mp_join_hmacs(subflow)->packetdrill,
 					20);
 		}else if(mp_join_script_info->ack.is_script_defined){
-			char *key_1 = mp_join_script_info->ack.var;
-			char *key_2 = mp_join_script_info->ack.var2;
-
-			struct mp_var *var1 = find_mp_var(key_1);
-			struct mp_var *var2 = find_mp_var(key_2);
-			if(var1==NULL || var2==NULL)
+			struct mp_var *var1 = mp_var_slot(mp_join_script_info->ack.var);
+			struct mp_var *var2 = mp_var_slot(mp_join_script_info->ack.var2);
+			if(var1==NULL || var2==NULL || !var1->value || !var2->value)
 				return STATUS_ERR;
 			u64 loc_key = *(u64*)var1->value;
 			u64 rem_key = *(u64*)var2->value;
 			u32 loc_nonce = subflow->packetdrill_rand_nbr;
 			u32 rem_nonce = subflow->kernel_rand_nbr;
 			// return value
-			u8 mptcp_hash_mac[20];
-			mptcp_hmac_sha1(
+			u8 mptcp_hash_mac[MPTCP_HMAC_MAX_BYTES];
+			mptcp_hmac(subflow->conn->version,
 					(u8*)&loc_key,
 					(u8*)&rem_key,
 					(u8*)&loc_nonce,
 					(u8*)&rem_nonce,
-					(u32*)mptcp_hash_mac );
+					mptcp_hash_mac);
 
 			memcpy(tcp_opt_to_modify->data.mp_join.no_syn.sender_hmac,
 					mptcp_hash_mac,
@@ -878,23 +1320,8 @@ int mptcp_subtype_mp_join(struct packet *packet_to_modify,
 		if(!subflow)
 			return STATUS_ERR;
 
-		//Build key for HMAC-SHA1
-		u64 loc_key = mp_state.packetdrill_key;
-		u64 rem_key = mp_state.kernel_key;
-		u32 loc_nonce = subflow->packetdrill_rand_nbr;
-		u32 rem_nonce = subflow->kernel_rand_nbr;
-
-		// return value
-		u8 mptcp_hash_mac[20];
-		mptcp_hmac_sha1(
-				(u8*)&rem_key,
-				(u8*)&loc_key,
-				(u8*)&rem_nonce,
-				(u8*)&loc_nonce,
-				(u32*)mptcp_hash_mac );
-
 		memcpy(tcp_opt_to_modify->data.mp_join.no_syn.sender_hmac,
-				mptcp_hash_mac, 20);
+				mp_join_hmacs(subflow)->kernel, 20);
 	}
 	else{
 		return STATUS_ERR;
@@ -911,14 +1338,21 @@ u16 get_tcp_payload_size(struct packet *packet){
 	return (packet_total_length-ip_header_length-
 			(tcp_header_length-tcp_header_wo_options));
 }
-u32 get_sum_ssn(){
-	struct mp_subflow *mp_sub = mp_state.subflows;
-	u32 total_length = 1; // first subflow has already one packet sent
-	while(mp_sub != NULL){
-		total_length += mp_sub->ssn -1;
-		mp_sub = mp_sub->next;
-	}
-	return total_length;
+/**
+ * Return 1 + the sum of (ssn - 1) over the subflows of conn, which is kept
+ * as a running total rather than summed for every DSS packet.
+ */
+u32 get_sum_ssn(struct mp_connection *conn){
+	return conn->sum_ssn;
+}
+
+/**
+ * Advance the subflow sequence number of a subflow, and the total over
+ * its connection with it.
+ */
+static void subflow_advance_ssn(struct mp_subflow *subflow, u32 bytes){
+	subflow->ssn += bytes;
+	subflow->conn->sum_ssn += bytes;
 }
 
 u16 get_tcp_header_length(struct packet *packet){
@@ -934,9 +1368,11 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 		struct tcp_option *dss_opt_script){
 	struct mp_subflow *subflow = find_subflow_matching_inbound_packet(packet_to_modify);
 	if(!subflow){
-		printf("May-be not a MPTCP connection : no subflow found --- \n");
+		LOGP(LOG_LEVEL_WARNING,
+		     "May-be not a MPTCP connection : no subflow found --- \n");
 		return STATUS_ERR;
 	}
+	struct mp_connection *conn = subflow->conn;
 
 	u16 tcp_payload_length = (u16)packet_payload_len(packet_to_modify);
 
@@ -950,7 +1386,7 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 	// if a packet is going from packetdrill with DSN and DACK to kernel
 	if(dss_opt_script->data.dss.flag_M && dss_opt_script->data.dss.flag_A){
 
-		u32 bytes_sent_on_all_ssn = get_sum_ssn();
+		u32 bytes_sent_on_all_ssn = get_sum_ssn(conn);
 		// if dsn4 and dack4
 		if(!dss_opt_script->data.dss.flag_m && !dss_opt_script->data.dss.flag_a){
 
@@ -962,30 +1398,28 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 
 			// put information in script packet automatically
 			if(dss_opt_script->data.dss.dack_dsn.dack.dack4 == UNDEFINED)
-				dack_live->dack4 = htonl(mp_state.remote_idsn + mp_state.remote_ssn + mp_state.remote_last_pkt_length);
+				dack_live->dack4 = htonl(conn->remote_idsn + conn->remote_ssn + conn->remote_last_pkt_length);
 			else if(dss_opt_script->data.dss.dack_dsn.dack.dack4 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dack_live->dack4 = htonl(sha1_least_64bits(*key)+ additional_val);
+				dack_live->dack4 = htonl(value);
 			}else{
 				if(dack_script->dack4>0)
-					dack_live->dack4 = htonl(sha1_least_64bits(mp_state.kernel_key) + dack_script->dack4);
+					dack_live->dack4 = htonl(conn->kernel_idsn + dack_script->dack4);
 			}
 
 
 			if(dsn_script->dsn4 == UNDEFINED){
-				dsn_live->dsn4 = htonl(mp_state.idsn + bytes_sent_on_all_ssn); //subflow->ssn);
+				dsn_live->dsn4 = htonl(conn->idsn + bytes_sent_on_all_ssn); //subflow->ssn);
 			}else if(dsn_script->dsn4 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dsn_live->dsn4 = htonl(sha1_least_64bits(*key) + additional_val);
+				dsn_live->dsn4 = htonl(value);
 			}else{
 				if(dsn_script->dsn4>0)
-					dsn_live->dsn4 = htonl(sha1_least_64bits(mp_state.packetdrill_key) + dsn_script->dsn4);
+					dsn_live->dsn4 = htonl(conn->packetdrill_idsn + dsn_script->dsn4);
 			}
 
 			if(dss_opt_script->length == TCPOLEN_DSS_DACK4_DSN4){
@@ -1003,15 +1437,15 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 				u16 *dll_first = (u16*)(w_cs+1);// w_cs + 1 == dll & chk
 				*dll_first = (s16)*(dll_first) == UNDEFINED ? htons(tcp_payload_length): htons(*(dll_first));
 
-				//buff_chk.dsn = mp_state.idsn + bytes_sent_on_all_ssn;
-				buff_chk.dsn = ((mp_state.idsn >>32)<<32) + ntohl(dsn_live->dsn4);
+				//buff_chk.dsn = conn->idsn + bytes_sent_on_all_ssn;
+				buff_chk.dsn = ((conn->idsn >>32)<<32) + ntohl(dsn_live->dsn4);
 				buff_chk.ssn = ntohl(*w_cs); //subflow->ssn;
 				buff_chk.dll = ntohs(*dll_first); //(u16)tcp_payload_length;
 				buff_chk.zeros = (u16)0;
 
 				// checksum
-				*(dll_first+1) = (s16)*(dll_first+1) == UNDEFINED ? htons(checksum_dss((u16*)&buff_chk, sizeof(buff_chk))): *(dll_first+1); // dll_first+1 = checksum
-				//	printf("dsn: %llu==%llu, ssn:%u, dll:%u ==> %u\n", buff_chk.dsn, mp_state.idsn + bytes_sent_on_all_ssn, buff_chk.ssn, buff_chk.dll, *(dll_first+1));
+				*(dll_first+1) = (s16)*(dll_first+1) == UNDEFINED ? mptcp_dss_checksum(buff_chk.dsn, buff_chk.ssn, buff_chk.dll, packet_payload(packet_to_modify), packet_payload_len(packet_to_modify)): *(dll_first+1); // dll_first+1 = checksum
+				//	printf("dsn: %llu==%llu, ssn:%u, dll:%u ==> %u\n", buff_chk.dsn, conn->idsn + bytes_sent_on_all_ssn, buff_chk.ssn, buff_chk.dll, *(dll_first+1));
 			}else{
 				u32* w_cs = (u32*)dsn_live+1;	// w_cs == ssn (== dsn_live + 1 )
 				// ssn
@@ -1031,29 +1465,27 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 
 			// put information in script packet
 			if(dss_opt_script->data.dss.dack_dsn.dack.dack8 == UNDEFINED)
-				dack_live->dack8 = htonll(mp_state.remote_idsn + mp_state.remote_ssn);
+				dack_live->dack8 = htonll(conn->remote_idsn + conn->remote_ssn);
 			else if(dss_opt_script->data.dss.dack_dsn.dack.dack8 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dack_live->dack8 = htonll(sha1_least_64bits(*key) + additional_val);
+				dack_live->dack8 = htonll(value);
 			}else{
 				if(dack_script->dack8>0)
-					dack_live->dack8 = htonll(sha1_least_64bits(mp_state.kernel_key) + dack_script->dack8);
+					dack_live->dack8 = htonll(conn->kernel_idsn + dack_script->dack8);
 			}
 
 			if(dsn_script->dsn4 == UNDEFINED)
-				dsn_live->dsn4 = htonl( mp_state.idsn + bytes_sent_on_all_ssn); //subflow->ssn);
+				dsn_live->dsn4 = htonl( conn->idsn + bytes_sent_on_all_ssn); //subflow->ssn);
 			else if(dsn_script->dsn4 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dsn_live->dsn4 = htonl(sha1_least_64bits(*key)+ additional_val);
+				dsn_live->dsn4 = htonl(value);
 			}else{
 				if(dsn_script->dsn4>0)
-					dsn_live->dsn4 = htonl(sha1_least_64bits(mp_state.packetdrill_key) + dsn_script->dsn4);
+					dsn_live->dsn4 = htonl(conn->packetdrill_idsn + dsn_script->dsn4);
 			}
 
 			if(dss_opt_script->length == TCPOLEN_DSS_DACK4_DSN4){
@@ -1071,13 +1503,13 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 				u16 *dll_first = (u16*)(w_cs+1);// w_cs + 1 == dll & chk
 				*dll_first = (s16)*(dll_first) == UNDEFINED ? htons(tcp_payload_length): htons(*(dll_first));
 
-				//buff_chk.dsn = mp_state.idsn + bytes_sent_on_all_ssn;
-				buff_chk.dsn = ((mp_state.idsn >>32)<<32) + ntohl(dsn_live->dsn4);
+				//buff_chk.dsn = conn->idsn + bytes_sent_on_all_ssn;
+				buff_chk.dsn = ((conn->idsn >>32)<<32) + ntohl(dsn_live->dsn4);
 				buff_chk.ssn = ntohl(*w_cs); //subflow->ssn;
 				buff_chk.dll = ntohs(*dll_first); //(u16)tcp_payload_length;
 				buff_chk.zeros = (u16)0;
 				// checksum
-				*(dll_first+1) = (s16)*(dll_first+1) == UNDEFINED ? htons(checksum_dss((u16*)&buff_chk, sizeof(buff_chk))): *(dll_first+1); // dll_first+1 = checksum
+				*(dll_first+1) = (s16)*(dll_first+1) == UNDEFINED ? mptcp_dss_checksum(buff_chk.dsn, buff_chk.ssn, buff_chk.dll, packet_payload(packet_to_modify), packet_payload_len(packet_to_modify)): *(dll_first+1); // dll_first+1 = checksum
 			}else{
 				u32* w_cs = (u32*)dsn_live+1;	// w_cs == ssn (== dsn_live + 1 )
 				// ssn
@@ -1098,29 +1530,27 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 
 			// put information in script packet
 			if(dss_opt_script->data.dss.dack_dsn.dack.dack4 == UNDEFINED)
-				dack_live->dack4 = htobe32(mp_state.remote_idsn + mp_state.remote_ssn);
+				dack_live->dack4 = htobe32(conn->remote_idsn + conn->remote_ssn);
 			else if(dss_opt_script->data.dss.dack_dsn.dack.dack4 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dack_live->dack4 = htonl(sha1_least_64bits(*key) + additional_val);
+				dack_live->dack4 = htonl(value);
 			}else{
 				if(dack_script->dack4>0)
-					dack_live->dack4 = htonl(sha1_least_64bits(mp_state.kernel_key) + dack_script->dack4);
+					dack_live->dack4 = htonl(conn->kernel_idsn + dack_script->dack4);
 			}
 
 			if(dss_opt_script->data.dss.dack_dsn.dsn.dsn8 == UNDEFINED)
-				dsn_live->dsn8 = htonll(mp_state.idsn + bytes_sent_on_all_ssn); //subflow->ssn);
+				dsn_live->dsn8 = htonll(conn->idsn + bytes_sent_on_all_ssn); //subflow->ssn);
 			else if(dss_opt_script->data.dss.dack_dsn.dsn.dsn8 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dsn_live->dsn8 = htonll(sha1_least_64bits(*key) + additional_val);
+				dsn_live->dsn8 = htonll(value);
 			}else{
 				if(dsn_script->dsn8>0)
-					dsn_live->dsn8 = htonl(sha1_least_64bits(mp_state.packetdrill_key) + dsn_script->dsn8);
+					dsn_live->dsn8 = htonl(conn->packetdrill_idsn + dsn_script->dsn8);
 			}
 
 			if(dss_opt_script->length == TCPOLEN_DSS_DACK4_DSN4){
@@ -1138,13 +1568,13 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 				u16 *dll_first = (u16*)(w_cs+1);// w_cs + 1 == dll & chk
 				*dll_first = (s16)*(dll_first) == UNDEFINED ? htons(tcp_payload_length): htons(*(dll_first));
 
-				//buff_chk.dsn = mp_state.idsn + bytes_sent_on_all_ssn;
-				buff_chk.dsn = dsn_live->dsn8;
+				//buff_chk.dsn = conn->idsn + bytes_sent_on_all_ssn;
+				buff_chk.dsn = ntohll(dsn_live->dsn8);
 				buff_chk.ssn = ntohl(*w_cs); //subflow->ssn;
 				buff_chk.dll = ntohs(*dll_first); //(u16)tcp_payload_length;
 				buff_chk.zeros = (u16)0;
 				// checksum
-				*(dll_first+1) = (s16)*(dll_first+1) == UNDEFINED ? htons(checksum_dss((u16*)&buff_chk, sizeof(buff_chk))): *(dll_first+1); // dll_first+1 = checksum
+				*(dll_first+1) = (s16)*(dll_first+1) == UNDEFINED ? mptcp_dss_checksum(buff_chk.dsn, buff_chk.ssn, buff_chk.dll, packet_payload(packet_to_modify), packet_payload_len(packet_to_modify)): *(dll_first+1); // dll_first+1 = checksum
 			}else{
 				u32* w_cs = (u32*)dsn_live+2;	// w_cs == ssn (== dsn_live + 1 )
 				// ssn
@@ -1163,29 +1593,27 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 
 			// put information in script packet
 			if(dss_opt_script->data.dss.dack_dsn.dack.dack8 == UNDEFINED)
-				dack_live->dack8 = htonll(mp_state.remote_idsn + mp_state.remote_ssn);
+				dack_live->dack8 = htonll(conn->remote_idsn + conn->remote_ssn);
 			else if(dss_opt_script->data.dss.dack_dsn.dack.dack8 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dack_live->dack8 = htonll(sha1_least_64bits(*key) + additional_val);
+				dack_live->dack8 = htonll(value);
 			}else{
 				if(dack_script->dack8>0)
-					dack_live->dack8 = htonl(sha1_least_64bits(mp_state.kernel_key) + dack_script->dack8);
+					dack_live->dack8 = htonl(conn->kernel_idsn + dack_script->dack8);
 			}
 
 			if(dss_opt_script->data.dss.dack_dsn.dsn.dsn8 == UNDEFINED)
-				dsn_live->dsn8 = htonll(mp_state.idsn + bytes_sent_on_all_ssn); //subflow->ssn);
+				dsn_live->dsn8 = htonll(conn->idsn + bytes_sent_on_all_ssn); //subflow->ssn);
 			else if(dss_opt_script->data.dss.dack_dsn.dsn.dsn8 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dsn_live->dsn8 = htonll(sha1_least_64bits(*key) + additional_val);
+				dsn_live->dsn8 = htonll(value);
 			}else{
 				if(dsn_script->dsn8>0)
-					dsn_live->dsn8 = htonl(sha1_least_64bits(mp_state.packetdrill_key) + dsn_script->dsn8);
+					dsn_live->dsn8 = htonl(conn->packetdrill_idsn + dsn_script->dsn8);
 			}
 
 			if(dss_opt_script->length == TCPOLEN_DSS_DACK4_DSN4){
@@ -1203,13 +1631,13 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 				u16 *dll_first = (u16*)(w_cs+1);// w_cs + 1 == dll & chk
 				*dll_first = (s16)*(dll_first) == UNDEFINED ? htons(tcp_payload_length): htons(*(dll_first));
 
-				//buff_chk.dsn = mp_state.idsn + bytes_sent_on_all_ssn;
-				buff_chk.dsn = dsn_live->dsn8;
+				//buff_chk.dsn = conn->idsn + bytes_sent_on_all_ssn;
+				buff_chk.dsn = ntohll(dsn_live->dsn8);
 				buff_chk.ssn = ntohl(*w_cs); //subflow->ssn;
 				buff_chk.dll = ntohs(*dll_first); //(u16)tcp_payload_length;
 				buff_chk.zeros = (u16)0;
 				// checksum
-				*(dll_first+1) = (s16)*(dll_first+1) == UNDEFINED ? htons(checksum_dss((u16*)&buff_chk, sizeof(buff_chk))): *(dll_first+1); // dll_first+1 = checksum
+				*(dll_first+1) = (s16)*(dll_first+1) == UNDEFINED ? mptcp_dss_checksum(buff_chk.dsn, buff_chk.ssn, buff_chk.dll, packet_payload(packet_to_modify), packet_payload_len(packet_to_modify)): *(dll_first+1); // dll_first+1 = checksum
 			}else{
 				u32* w_cs = (u32*)dsn_live+2;	// w_cs == ssn (== dsn_live + 1 )
 				// ssn
@@ -1224,22 +1652,21 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 		struct dsn *dsn_live 	= (struct dsn*)((u32*)dss_opt_live+1);
 		struct dsn *dsn_script	= (struct dsn*)((u32*)dss_opt_script+1);
 
-		u32 bytes_sent_on_all_ssn = get_sum_ssn();
+		u32 bytes_sent_on_all_ssn = get_sum_ssn(conn);
 		//DSN4
 		if(!dss_opt_script->data.dss.flag_m){
 			// get original information from live_packet
 
 			if(dss_opt_script->data.dss.dsn.dsn4 == UNDEFINED)
-				dsn_live->dsn4 = htonl(mp_state.idsn + bytes_sent_on_all_ssn); //subflow->ssn);
+				dsn_live->dsn4 = htonl(conn->idsn + bytes_sent_on_all_ssn); //subflow->ssn);
 			else if(dss_opt_script->data.dss.dsn.dsn4 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dsn_live->dsn4 = htobe32(sha1_least_64bits(*key) + additional_val);
+				dsn_live->dsn4 = htobe32(value);
 			}else{
 				if(dsn_script->dsn4>0)
-					dsn_live->dsn4 = htonl(sha1_least_64bits(mp_state.packetdrill_key) + dsn_script->dsn4);
+					dsn_live->dsn4 = htonl(conn->packetdrill_idsn + dsn_script->dsn4);
 			}
 
 			if(dss_opt_script->length == TCPOLEN_DSS_DACK4_DSN4){
@@ -1257,12 +1684,12 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 				u16 *dll_first = (u16*)(w_cs+1);// w_cs + 1 == dll & chk
 				*dll_first = (s16)*(dll_first) == UNDEFINED ? htons(tcp_payload_length): htons(*(dll_first));
 
-				buff_chk.dsn = ((mp_state.idsn >>32)<<32) + ntohl(dsn_live->dsn4);
+				buff_chk.dsn = ((conn->idsn >>32)<<32) + ntohl(dsn_live->dsn4);
 				buff_chk.ssn = ntohl(*w_cs); //subflow->ssn;
 				buff_chk.dll = ntohs(*dll_first); //(u16)tcp_payload_length;
 				buff_chk.zeros = (u16)0;
 				// checksum
-				*(dll_first+1) = (s16)*(dll_first+1) == UNDEFINED ? htons(checksum_dss((u16*)&buff_chk, sizeof(buff_chk))): *(dll_first+1); // dll_first+1 = checksum
+				*(dll_first+1) = (s16)*(dll_first+1) == UNDEFINED ? mptcp_dss_checksum(buff_chk.dsn, buff_chk.ssn, buff_chk.dll, packet_payload(packet_to_modify), packet_payload_len(packet_to_modify)): *(dll_first+1); // dll_first+1 = checksum
 			}else{
 				u32* w_cs = (u32*)dsn_live+1;	// w_cs == ssn (== dsn_live + 1 )
 				// ssn
@@ -1275,16 +1702,15 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 		//DSN8
 		}else{
 			if(dss_opt_script->data.dss.dsn.dsn8 == UNDEFINED)
-				dsn_live->dsn8 = htonll(mp_state.idsn + bytes_sent_on_all_ssn); //subflow->ssn);
+				dsn_live->dsn8 = htonll(conn->idsn + bytes_sent_on_all_ssn); //subflow->ssn);
 			else if(dss_opt_script->data.dss.dsn.dsn8 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dsn_live->dsn8 = htonll(sha1_least_64bits(*key) + additional_val);
+				dsn_live->dsn8 = htonll(value);
 			}else{
 				if(dsn_script->dsn8>0)
-					dsn_live->dsn8 = htonll(sha1_least_64bits(mp_state.packetdrill_key) + dsn_script->dsn8);
+					dsn_live->dsn8 = htonll(conn->packetdrill_idsn + dsn_script->dsn8);
 			}
 
 			if(dss_opt_script->length == TCPOLEN_DSS_DACK4_DSN4){
@@ -1302,12 +1728,12 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 				u16 *dll_first = (u16*)(w_cs+1);// w_cs + 1 == dll & chk
 				*dll_first = (s16)*(dll_first) == UNDEFINED ? htons(tcp_payload_length): htons(*(dll_first));
 
-				buff_chk.dsn = dsn_live->dsn8;
+				buff_chk.dsn = ntohll(dsn_live->dsn8);
 				buff_chk.ssn = ntohl(*w_cs); //subflow->ssn;
 				buff_chk.dll = ntohs(*dll_first); //(u16)tcp_payload_length;
 				buff_chk.zeros = (u16)0;
 				// checksum
-				*(dll_first+1) = (s16)*(dll_first+1) == UNDEFINED ? htons(checksum_dss((u16*)&buff_chk, sizeof(buff_chk))): *(dll_first+1); // dll_first+1 = checksum
+				*(dll_first+1) = (s16)*(dll_first+1) == UNDEFINED ? mptcp_dss_checksum(buff_chk.dsn, buff_chk.ssn, buff_chk.dll, packet_payload(packet_to_modify), packet_payload_len(packet_to_modify)): *(dll_first+1); // dll_first+1 = checksum
 			}else{
 				u32* w_cs = (u32*)dsn_live+2;	// w_cs == ssn (== dsn_live + 1 )
 				// ssn
@@ -1324,23 +1750,22 @@ int dss_inbound_parser(struct packet *packet_to_modify,
 		// dack4
 		if(!dss_opt_script->data.dss.flag_a){
 			if(dss_opt_script->data.dss.dack.dack4==UNDEFINED){
-				dss_opt_script->data.dss.dack.dack4 = ntohl((u32)(mp_state.remote_idsn + mp_state.remote_ssn + mp_state.remote_last_pkt_length));
+				dss_opt_script->data.dss.dack.dack4 = ntohl((u32)(conn->remote_idsn + conn->remote_ssn + conn->remote_last_pkt_length));
 			}else if(dss_opt_script->data.dss.dack.dack4==SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dss_opt_script->data.dss.dack.dack4 = htonl(sha1_least_64bits(*key) + additional_val);
+				dss_opt_script->data.dss.dack.dack4 = htonl(value);
 			}else{
 				if(dss_opt_script->data.dss.dack.dack4>0)
-					dss_opt_live->data.dss.dack.dack4 = htonl(sha1_least_64bits(mp_state.kernel_key) + dss_opt_script->data.dss.dack.dack4);
+					dss_opt_live->data.dss.dack.dack4 = htonl(conn->kernel_idsn + dss_opt_script->data.dss.dack.dack4);
 				else
 					return STATUS_ERR;
 			}
 
 		}
 	}
-	subflow->ssn += tcp_payload_length;
+	subflow_advance_ssn(subflow, tcp_payload_length);
 	return STATUS_OK;
 }
 
@@ -1351,6 +1776,10 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 	struct tcp_option* dss_opt_live = get_mptcp_option(live_packet, DSS_SUBTYPE);
 	if(!dss_opt_live)
 		return STATUS_ERR;
+	struct mp_connection *conn =
+			find_connection_for_packet(live_packet, DIRECTION_OUTBOUND);
+	if(!conn)
+		return STATUS_ERR;
 
 	// if a packet is coming from kernel with DSN and DACK
 	if(dss_opt_script->data.dss.flag_M && dss_opt_script->data.dss.flag_A){
@@ -1381,14 +1810,13 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			if(*dack_script == UNDEFINED){
 				*dack_script = *dack_live;
 			}else if(*dack_script == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				*dack_script = htonl(sha1_least_64bits(*key) + additional_val);
+				*dack_script = htonl(value);
 			}else{
 				if(*dack_script>0){
-					*dack_script = htonl(sha1_least_64bits(mp_state.packetdrill_key) + *dack_script);
+					*dack_script = htonl(conn->packetdrill_idsn + *dack_script);
 				}
 			}
 
@@ -1396,14 +1824,13 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			if(*dsn_script == UNDEFINED){
 				*dsn_script 		= *dsn_live;
 			}else if(*dsn_script == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key 			= find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				*dsn_script = htonl(sha1_least_64bits(*key) + additional_val);
+				*dsn_script = htonl(value);
 			}else{
 				if(*dsn_script>0){
-					*dsn_script = htonl(sha1_least_64bits(mp_state.kernel_key) + *dsn_script);
+					*dsn_script = htonl(conn->kernel_idsn + *dsn_script);
 				}
 			}
 
@@ -1425,10 +1852,10 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			else
 				*chk_script = htons(*chk_script);
 
-			mp_state.remote_last_pkt_length = ntohs(*dll_script);
+			conn->remote_last_pkt_length = ntohs(*dll_script);
 			if(dss_opt_live->data.dss.flag_F)
-				mp_state.remote_last_pkt_length++;
-			mp_state.remote_ssn = ntohl(*ssn_script);
+				conn->remote_last_pkt_length++;
+			conn->remote_ssn = ntohl(*ssn_script);
 
 			// DSN4 & DACK8
 		}else if(!dss_opt_script->data.dss.flag_m && dss_opt_script->data.dss.flag_a){
@@ -1449,14 +1876,13 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			if(*dack_script == UNDEFINED){
 				*dack_script = *dack_live;
 			}else if(*dack_script == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				*dack_script = htonll(sha1_least_64bits(*key) + additional_val);
+				*dack_script = htonll(value);
 			}else{
 				if(*dack_script>0){
-					*dack_script = htonll(sha1_least_64bits(mp_state.packetdrill_key) + *dack_script);
+					*dack_script = htonll(conn->packetdrill_idsn + *dack_script);
 				}
 			}
 
@@ -1464,14 +1890,13 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			if(*dsn_script == UNDEFINED){
 				*dsn_script 		= *dsn_live;
 			}else if(*dsn_script == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key 			= find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				*dsn_script = htonl(sha1_least_64bits(*key) + additional_val);
+				*dsn_script = htonl(value);
 			}else{
 				if(*dsn_script>0){
-					*dsn_script = htonl(sha1_least_64bits(mp_state.kernel_key) + *dsn_script);
+					*dsn_script = htonl(conn->kernel_idsn + *dsn_script);
 				}
 			}
 
@@ -1493,10 +1918,10 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			else
 				*chk_script = htons(*chk_script);
 
-			mp_state.remote_last_pkt_length = ntohs(*dll_script);
+			conn->remote_last_pkt_length = ntohs(*dll_script);
 			if(dss_opt_live->data.dss.flag_F)
-				mp_state.remote_last_pkt_length++;
-			mp_state.remote_ssn = ntohl(*ssn_script);
+				conn->remote_last_pkt_length++;
+			conn->remote_ssn = ntohl(*ssn_script);
 
 			// DSN8 & DACK4
 		}else if(dss_opt_script->data.dss.flag_m && !dss_opt_script->data.dss.flag_a){
@@ -1518,14 +1943,13 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			if(*dack_script == UNDEFINED){
 				*dack_script = *dack_live;
 			}else if(*dack_script == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				*dack_script = htonl(sha1_least_64bits(*key) + additional_val);
+				*dack_script = htonl(value);
 			}else{
 				if(*dack_script>0){
-					*dack_script = htonl(sha1_least_64bits(mp_state.packetdrill_key) + *dack_script);
+					*dack_script = htonl(conn->packetdrill_idsn + *dack_script);
 				}
 			}
 
@@ -1533,14 +1957,13 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			if(*dsn_script == UNDEFINED){
 				*dsn_script 		= *dsn_live;
 			}else if(*dsn_script == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key 			= find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				*dsn_script = htonll(sha1_least_64bits(*key) + additional_val);
+				*dsn_script = htonll(value);
 			}else{
 				if(*dsn_script>0){
-					*dsn_script = htonll(sha1_least_64bits(mp_state.kernel_key) + *dsn_script);
+					*dsn_script = htonll(conn->kernel_idsn + *dsn_script);
 				}
 			}
 
@@ -1562,10 +1985,10 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			else
 				*chk_script = htons(*chk_script);
 
-			mp_state.remote_last_pkt_length = ntohs(*dll_script);
+			conn->remote_last_pkt_length = ntohs(*dll_script);
 			if(dss_opt_live->data.dss.flag_F)
-				mp_state.remote_last_pkt_length++;
-			mp_state.remote_ssn = ntohl(*ssn_script);
+				conn->remote_last_pkt_length++;
+			conn->remote_ssn = ntohl(*ssn_script);
 
 		// DSN8 & DACK8
 		}else if(dss_opt_script->data.dss.flag_m && dss_opt_script->data.dss.flag_a){
@@ -1587,14 +2010,13 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			if(*dack_script == UNDEFINED){
 				*dack_script = *dack_live;
 			}else if(*dack_script == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				*dack_script = htonll(sha1_least_64bits(*key) + additional_val);
+				*dack_script = htonll(value);
 			}else{
 				if(*dack_script>0){
-					*dack_script = htonll(sha1_least_64bits(mp_state.packetdrill_key) + *dack_script);
+					*dack_script = htonll(conn->packetdrill_idsn + *dack_script);
 				}
 			}
 
@@ -1602,14 +2024,13 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			if(*dsn_script == UNDEFINED){
 				*dsn_script 		= *dsn_live;
 			}else if(*dsn_script == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key 			= find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				*dsn_script = htonll(sha1_least_64bits(*key) + additional_val);
+				*dsn_script = htonll(value);
 			}else{
 				if(*dsn_script>0){
-					*dsn_script = htonll(sha1_least_64bits(mp_state.kernel_key) + *dsn_script);
+					*dsn_script = htonll(conn->kernel_idsn + *dsn_script);
 				}
 			}
 
@@ -1631,10 +2052,10 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			else
 				*chk_script = htons(*chk_script);
 
-			mp_state.remote_last_pkt_length = ntohs(*dll_script);
+			conn->remote_last_pkt_length = ntohs(*dll_script);
 			if(dss_opt_live->data.dss.flag_F)
-				mp_state.remote_last_pkt_length++;
-			mp_state.remote_ssn = ntohl(*ssn_script);
+				conn->remote_last_pkt_length++;
+			conn->remote_ssn = ntohl(*ssn_script);
 
 		}else{
 			// It means we have a difference of flags about what we waited for
@@ -1662,14 +2083,13 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			if(dss_opt_script->data.dss.dsn.dsn8 == UNDEFINED)
 				dss_opt_script->data.dss.dsn.dsn8 = dsn_live->dsn8; //htobe64
 			else if(dss_opt_script->data.dss.dsn.dsn8 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dss_opt_script->data.dss.dsn.dsn8 = htonll(sha1_least_64bits(*key) + additional_val);
+				dss_opt_script->data.dss.dsn.dsn8 = htonll(value);
 			}else{
 				if(dss_opt_script->data.dss.dsn.dsn8>0){
-					dss_opt_script->data.dss.dsn.dsn8  = htonll(sha1_least_64bits(mp_state.kernel_key) + dss_opt_script->data.dss.dsn.dsn8 );
+					dss_opt_script->data.dss.dsn.dsn8  = htonll(conn->kernel_idsn + dss_opt_script->data.dss.dsn.dsn8 );
 				}
 			}
 
@@ -1681,10 +2101,10 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 				dss_opt_script->data.dss.dsn.wo_cs.dll =	dll;
 				dss_opt_script->data.dss.dsn.wo_cs.ssn = ssn;
 			} WOCS*/
-			mp_state.remote_last_pkt_length = ntohs(dll);
+			conn->remote_last_pkt_length = ntohs(dll);
 			if(dss_opt_live->data.dss.flag_F)
-				mp_state.remote_last_pkt_length++;
-			mp_state.remote_ssn = ntohl(ssn);
+				conn->remote_last_pkt_length++;
+			conn->remote_ssn = ntohl(ssn);
 		}
 		// if DSN is 4 octets
 		else {
@@ -1698,14 +2118,13 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			if(dss_opt_script->data.dss.dsn.dsn4 == UNDEFINED)
 				dss_opt_script->data.dss.dsn.dsn4 = dsn_live->dsn4;
 			else if(dss_opt_script->data.dss.dsn.dsn4 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dss_opt_script->data.dss.dsn.dsn4 = htobe32(sha1_least_64bits(*key) + additional_val);
+				dss_opt_script->data.dss.dsn.dsn4 = htobe32(value);
 			}else{
 				if(dss_opt_script->data.dss.dsn.dsn4>0){
-					dss_opt_script->data.dss.dsn.dsn4  = htonll(sha1_least_64bits(mp_state.kernel_key) + dss_opt_script->data.dss.dsn.dsn4 );
+					dss_opt_script->data.dss.dsn.dsn4  = htonll(conn->kernel_idsn + dss_opt_script->data.dss.dsn.dsn4 );
 				}
 			}
 			u32 *script_dsn4 	= (u32*)dss_opt_script+3;
@@ -1714,10 +2133,10 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			*script_ssn 			= ssn;
 			u32 *script_dll_chk 	= script_ssn + 1;
 			*script_dll_chk 		= dll_chk;
-			mp_state.remote_last_pkt_length = ntohs(dll);
+			conn->remote_last_pkt_length = ntohs(dll);
 			if(dss_opt_live->data.dss.flag_F)
-				mp_state.remote_last_pkt_length++;
-			mp_state.remote_ssn = ntohl(ssn);
+				conn->remote_last_pkt_length++;
+			conn->remote_ssn = ntohl(ssn);
 		}
 
 	// if it's DACK only from kernel, need to save it
@@ -1735,14 +2154,13 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 			if(dss_opt_script->data.dss.dack.dack8 == UNDEFINED)
 				dss_opt_script->data.dss.dack.dack8 = dack_live->dack8;
 			else if(dss_opt_script->data.dss.dack.dack8 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dss_opt_script->data.dss.dack.dack8 = htonll(sha1_least_64bits(*key) + additional_val);
+				dss_opt_script->data.dss.dack.dack8 = htonll(value);
 			}else{
 				if(dss_opt_script->data.dss.dack.dack8>0){
-					dss_opt_script->data.dss.dack.dack8 = htonll(sha1_least_64bits(mp_state.packetdrill_key) + dss_opt_script->data.dss.dack.dack8);
+					dss_opt_script->data.dss.dack.dack8 = htonll(conn->packetdrill_idsn + dss_opt_script->data.dss.dack.dack8);
 				}
 			}
 		}
@@ -1757,14 +2175,13 @@ int dss_outbound_parser(struct packet *packet_to_modify,
 					return STATUS_ERR;
 				dss_opt_script->data.dss.dack.dack4 = htobe32((u32)*key);
 			}else if(dss_opt_script->data.dss.dack.dack4 == SCRIPT_DEFINED_TO_HASH_LSB){
-				u64 additional_val 	= find_next_value();
-				u64 *key = find_next_key();
-				if(!key || additional_val==STATUS_ERR)
+				u64 value;
+				if(find_next_idsn_expr(conn->version, &value))
 					return STATUS_ERR;
-				dss_opt_script->data.dss.dack.dack4 = htonl(sha1_least_64bits(*key) + additional_val);
+				dss_opt_script->data.dss.dack.dack4 = htonl(value);
 			}else{
 				if(dss_opt_script->data.dss.dack.dack4>0){
-					dss_opt_script->data.dss.dack.dack4 = htonl(sha1_least_64bits(mp_state.packetdrill_key) + dss_opt_script->data.dss.dack.dack4);
+					dss_opt_script->data.dss.dack.dack4 = htonl(conn->packetdrill_idsn + dss_opt_script->data.dss.dack.dack4);
 				}
 			}
 		}
@@ -1792,6 +2209,32 @@ int mptcp_subtype_dss(struct packet *packet_to_modify,
 	return STATUS_OK;
 }
 
+/**
+ * Fill in the HMAC that ends a version 1 ADD_ADDR option: the rightmost 64
+ * bits of HMAC-SHA256 keyed with the sender key then the receiver key, over
+ * the address id, the address and the port (zero if there is none).
+ */
+static void add_addr_set_hmac(struct tcp_option *opt, u64 sender_key,
+		u64 receiver_key)
+{
+	u8 msg[1 + sizeof(struct in6_addr) + sizeof(u16)];
+	u8 *addr = (u8*)&opt->data.add_addr.ipv4;
+	u8 len = add_addr_length(opt);
+	u8 addr_len = (len >= TCPOLEN_ADD_ADDR_V6) ?
+			sizeof(struct in6_addr) : sizeof(struct in_addr);
+	u64 hmac;
+
+	msg[0] = opt->data.add_addr.address_id;
+	memcpy(&msg[1], addr, addr_len);
+	if(len == TCPOLEN_ADD_ADDR_V4_PORT || len == TCPOLEN_ADD_ADDR_V6_PORT)
+		memcpy(&msg[1 + addr_len], addr + addr_len, sizeof(u16));
+	else
+		memset(&msg[1 + addr_len], 0, sizeof(u16));
+	hmac = mptcp_add_addr_hmac(sender_key, receiver_key, msg,
+			1 + addr_len + sizeof(u16));
+	memcpy(add_addr_hmac(opt), &hmac, sizeof(hmac));
+}
+
 int mptcp_subtype_add_address(struct packet *packet_to_modify,
 		struct packet *live_packet,
 		struct tcp_option *dss_opt_script,
@@ -1812,43 +2255,46 @@ int mptcp_subtype_add_address(struct packet *packet_to_modify,
 		if((s8)dss_opt_script->data.add_addr.address_id == UNDEFINED)
 			dss_opt_live->data.add_addr.address_id = subflow->packetdrill_addr_id;
 
-		if(dss_opt_live->length == TCPOLEN_ADD_ADDR_V4){
+		if(add_addr_length(dss_opt_live) == TCPOLEN_ADD_ADDR_V4){
 			if(!memcmp(&dss_opt_script->data.add_addr.ipv4, &adr4_zero, sizeof(struct in_addr)))
 				dss_opt_live->data.add_addr.ipv4 = subflow->src_ip.ip.v4;
 			else{
 				dss_opt_live->data.add_addr.ipv4 = dss_opt_script->data.add_addr.ipv4;
 			}
-		}else if(dss_opt_live->length == TCPOLEN_ADD_ADDR_V4_PORT){
+		}else if(add_addr_length(dss_opt_live) == TCPOLEN_ADD_ADDR_V4_PORT){
 			if(!memcmp(&dss_opt_script->data.add_addr.ipv4_w_port.ipv4, &adr4_zero, sizeof(struct in_addr)))
 				dss_opt_live->data.add_addr.ipv4_w_port.ipv4 = subflow->src_ip.ip.v4;
 			if(dss_opt_script->data.add_addr.ipv4_w_port.port == UNDEFINED)
 				dss_opt_live->data.add_addr.ipv4_w_port.port= subflow->src_port;
-		}else if(dss_opt_live->length == TCPOLEN_ADD_ADDR_V6){
+		}else if(add_addr_length(dss_opt_live) == TCPOLEN_ADD_ADDR_V6){
 			if(!memcmp(&dss_opt_script->data.add_addr.ipv6, &adr6_zero, sizeof(struct in6_addr)))
 				dss_opt_live->data.add_addr.ipv6 = subflow->src_ip.ip.v6;
-		}else if(dss_opt_live->length == TCPOLEN_ADD_ADDR_V6_PORT){
+		}else if(add_addr_length(dss_opt_live) == TCPOLEN_ADD_ADDR_V6_PORT){
 			if(!memcmp(&dss_opt_script->data.add_addr.ipv6_w_port.ipv6, &adr6_zero, sizeof(struct in6_addr)))
 				dss_opt_script->data.add_addr.ipv6_w_port.ipv6 = subflow->src_ip.ip.v6;
 			if(dss_opt_script->data.add_addr.ipv6_w_port.port == UNDEFINED)
 				dss_opt_live->data.add_addr.ipv6_w_port.port = subflow->src_port;
 		}else
 			return STATUS_ERR;
+		if(add_addr_has_hmac(dss_opt_live))
+			add_addr_set_hmac(dss_opt_live, subflow->conn->packetdrill_key,
+					subflow->conn->kernel_key);
 	}else if(direction == DIRECTION_OUTBOUND){
 		if((s8)dss_opt_script->data.add_addr.address_id == UNDEFINED)
 			dss_opt_script->data.add_addr.address_id = dss_opt_live->data.add_addr.address_id;
 
-		if(dss_opt_script->length == TCPOLEN_ADD_ADDR_V4){
+		if(add_addr_length(dss_opt_script) == TCPOLEN_ADD_ADDR_V4){
 			if(!memcmp(&dss_opt_script->data.add_addr.ipv4, &adr4_zero, sizeof(struct in_addr)))
 				dss_opt_script->data.add_addr.ipv4 = dss_opt_live->data.add_addr.ipv4;
-		}else if(dss_opt_script->length == TCPOLEN_ADD_ADDR_V4_PORT){
+		}else if(add_addr_length(dss_opt_script) == TCPOLEN_ADD_ADDR_V4_PORT){
 			if(!memcmp(&dss_opt_script->data.add_addr.ipv4_w_port.ipv4, &adr4_zero, sizeof(struct in_addr)))
 				dss_opt_script->data.add_addr.ipv4_w_port.ipv4 = dss_opt_live->data.add_addr.ipv4_w_port.ipv4 ;
 			if(dss_opt_script->data.add_addr.ipv4_w_port.port == UNDEFINED)
 				dss_opt_script->data.add_addr.ipv4_w_port.port = dss_opt_live->data.add_addr.ipv4_w_port.port;
-		}else if(dss_opt_script->length == TCPOLEN_ADD_ADDR_V6){
+		}else if(add_addr_length(dss_opt_script) == TCPOLEN_ADD_ADDR_V6){
 			if(!memcmp(&dss_opt_script->data.add_addr.ipv6, &adr6_zero, sizeof(struct in6_addr)))
 				dss_opt_script->data.add_addr.ipv6 = dss_opt_live->data.add_addr.ipv6 ;
-		}else if(dss_opt_script->length == TCPOLEN_ADD_ADDR_V6_PORT){
+		}else if(add_addr_length(dss_opt_script) == TCPOLEN_ADD_ADDR_V6_PORT){
 			if(!memcmp(&dss_opt_script->data.add_addr.ipv6_w_port.ipv6, &adr6_zero, sizeof(struct in6_addr)))
 				dss_opt_script->data.add_addr.ipv6_w_port.ipv6 = dss_opt_live->data.add_addr.ipv6_w_port.ipv6;
 			if(dss_opt_script->data.add_addr.ipv6_w_port.port == UNDEFINED)
@@ -1856,6 +2302,14 @@ int mptcp_subtype_add_address(struct packet *packet_to_modify,
 		}else{
 			return STATUS_ERR;
 		}
+		if(add_addr_has_hmac(dss_opt_script)){
+			struct mp_connection *conn =
+					find_connection_for_packet(live_packet, direction);
+			if(!conn)
+				return STATUS_ERR;
+			add_addr_set_hmac(dss_opt_script, conn->kernel_key,
+					conn->packetdrill_key);
+		}
 	}else{
 		return STATUS_ERR;
 	}
@@ -1896,25 +2350,28 @@ int mptcp_subtype_mp_fail(struct packet *packet_to_modify,
 	struct tcp_option* dss_opt_live = get_tcp_option(live_packet, TCPOPT_MPTCP);
 	if(!dss_opt_live)
 		return STATUS_ERR;
+	struct mp_connection *conn = find_connection_for_packet(live_packet,
+			direction);
+	if(!conn)
+		return STATUS_ERR;
 
 	// TODO(redward): verify if it really converts correctly the dsn8
 
 	if(direction == DIRECTION_INBOUND){
-		u32 bytes_sent_on_all_ssn = get_sum_ssn();
+		u32 bytes_sent_on_all_ssn = get_sum_ssn(conn);
 
 		//Set dsn being value specified in script
 		if(dss_opt_script->data.dss.dsn.dsn8 == UNDEFINED)
-			dss_opt_script->data.dss.dsn.dsn8 = htonll(mp_state.idsn + bytes_sent_on_all_ssn); //subflow->ssn);
+			dss_opt_script->data.dss.dsn.dsn8 = htonll(conn->idsn + bytes_sent_on_all_ssn); //subflow->ssn);
 		else if(dss_opt_script->data.dss.dsn.dsn8 == SCRIPT_DEFINED_TO_HASH_LSB){
-			u64 additional_val 	= find_next_value();
-			u64 *key = find_next_key();
-			if(!key || additional_val==STATUS_ERR)
+			u64 value;
+			if(find_next_idsn_expr(conn->version, &value))
 				return STATUS_ERR;
-			dss_opt_script->data.dss.dsn.dsn8 = htonll(sha1_least_64bits(*key) + additional_val);
+			dss_opt_script->data.dss.dsn.dsn8 = htonll(value);
 		}else{
 			// this is to get the relative numbers from script
 			if(dss_opt_script->data.dss.dsn.dsn8>0)
-				dss_opt_script->data.dss.dsn.dsn8 = htonll(sha1_least_64bits(mp_state.packetdrill_key) +
+				dss_opt_script->data.dss.dsn.dsn8 = htonll(conn->packetdrill_idsn +
 						dss_opt_script->data.dss.dsn.dsn8 );
 		}
 	}else if(direction == DIRECTION_OUTBOUND){
@@ -1922,15 +2379,14 @@ int mptcp_subtype_mp_fail(struct packet *packet_to_modify,
 		if(dss_opt_script->data.mp_fail.dsn8 == UNDEFINED){
 			dss_opt_script->data.mp_fail.dsn8 		= dss_opt_live->data.mp_fail.dsn8;
 		}else if(dss_opt_script->data.dss.dsn.dsn8  == SCRIPT_DEFINED_TO_HASH_LSB){
-			u64 additional_val 	= find_next_value();
-			u64 *key 			= find_next_key();
-			if(!key || additional_val==STATUS_ERR)
+			u64 value;
+			if(find_next_idsn_expr(conn->version, &value))
 				return STATUS_ERR;
-			dss_opt_script->data.dss.dsn.dsn8  = htonll(sha1_least_64bits(*key) + additional_val);
+			dss_opt_script->data.dss.dsn.dsn8  = htonll(value);
 		}else{
 			// this is to get the relative numbers from script
 			if(dss_opt_script->data.dss.dsn.dsn8 >0){
-				dss_opt_script->data.dss.dsn.dsn8  = htonll(sha1_least_64bits(mp_state.kernel_key) +
+				dss_opt_script->data.dss.dsn.dsn8  = htonll(conn->kernel_idsn +
 						dss_opt_script->data.dss.dsn.dsn8 );
 			}
 		}
@@ -1951,8 +2407,10 @@ int mptcp_subtype_mp_fastclose(struct packet *packet_to_modify,
 		return STATUS_ERR;
 
 	if(dss_opt_script->data.mp_fastclose.receiver_key == UNDEFINED){ // <mp_fastclose>
-		if(direction == DIRECTION_INBOUND)
-			dss_opt_script->data.mp_fastclose.receiver_key = htonll(mp_state.kernel_key);
+		struct mp_connection *conn = find_connection_for_packet(live_packet,
+				direction);
+		if(direction == DIRECTION_INBOUND && conn)
+			dss_opt_script->data.mp_fastclose.receiver_key = htonll(conn->kernel_key);
 		else if(direction == DIRECTION_OUTBOUND)
 			dss_opt_script->data.mp_fastclose.receiver_key = dss_opt_live->data.mp_fastclose.receiver_key;
 		else
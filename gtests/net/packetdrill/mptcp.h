@@ -33,8 +33,6 @@
 #endif
 
 
-#define MPTCP_VERSION 0
-
 //MPTCP options subtypes
 #define MP_CAPABLE_SUBTYPE 0
 #define MP_JOIN_SUBTYPE 1
@@ -49,6 +47,7 @@
 /* MPTCP options subtypes length */
 //MP_CAPABLE
 #define TCPOLEN_MP_CAPABLE_SYN 12 /* Size of the first and second steps of the three way handshake. */
+#define TCPOLEN_MP_CAPABLE_V1_SYN 4 /* Version 1 SYN, which carries no key. */
 #define TCPOLEN_MP_CAPABLE 20 /* Size of the third step of the three way handshake. */
 #define TCPOLEN_MP_CAPABLE_DACK 28 /* Third packet with first DSS packet */
 //MP_JOIN
@@ -75,6 +74,12 @@
 #define TCPOLEN_ADD_ADDR_V4_PORT 10
 #define TCPOLEN_ADD_ADDR_V6 20
 #define TCPOLEN_ADD_ADDR_V6_PORT 22
+// Version 1 ADD_ADDR ends with a truncated HMAC, unless it is an echo
+#define TCPOLEN_ADD_ADDR_HMAC 8
+#define TCPOLEN_ADD_ADDR_V4_HMAC 16
+#define TCPOLEN_ADD_ADDR_V4_PORT_HMAC 18
+#define TCPOLEN_ADD_ADDR_V6_HMAC 28
+#define TCPOLEN_ADD_ADDR_V6_PORT_HMAC 30
 // REMOVE_ADDR
 #define TCPOLEN_REMOVE_ADDR 3 // the rest is the number of address_id's added
 // MP_PRIO
@@ -90,6 +95,7 @@
 #define MP_JOIN_SYN_FLAGS_BACKUP 1
 #define MP_JOIN_SYN_FLAGS_NO_BACKUP 0
 #define ZERO_RESERVED 0
+#define ADD_ADDR_FLAG_ECHO 1 // version 1 ADD_ADDR, in place of ipver
 
 //SUBFLOW states
 #define ESTABLISHED 1 //for Subflow state
@@ -110,8 +116,8 @@ struct mp_join_info {
 			u8 address_id;
 			bool is_script_defined;
 			bool is_var;
-			char var[255];
-			char var2[255]; //TODO warning to input length
+			u32 var;	// slots of the variables, as interned
+			u32 var2;	// by mp_var_intern()
 			u64 hash;
 			bool rand_script_defined;
 			u32 rand;
@@ -119,8 +125,8 @@ struct mp_join_info {
 		struct {
 			bool is_script_defined;
 			bool is_var;
-			char var[255];
-			char var2[255];
+			u32 var;	// slots of the variables, as interned
+			u32 var2;	// by mp_var_intern()
 			u32 hash[5];
 		} ack;
 	};
@@ -128,10 +134,24 @@ struct mp_join_info {
 
 
 
+//Values derived from a mptcp key by SHA-1 (version 0) or SHA-256
+//(version 1), cached as hashing is costly.
+struct mp_key_hash {
+	u64 key;	// key the values below were computed from
+	u8 version;	// MPTCP version they were computed for
+	u32 token;	// most significant 32 bits of Hash(key)
+	u64 idsn;	// least significant 64 bits of Hash(key)
+	bool valid;
+};
+
 //A script mptcp variable bring additional information from user script to
-//mptcp.c.
+//mptcp.c. The parser interns each variable name once, into a slot of
+//mp_state.var_slots; from then on the variable is known by its slot, and
+//running the script never looks a name up. value is NULL until the script
+//or a packet gives the variable one.
 struct mp_var {
 	char *name;
+	u32 slot;	// index in mp_state.var_slots
 	void *value;
 	u8 mptcp_subtype;
 	union {
@@ -139,9 +159,69 @@ struct mp_var {
 			bool script_defined;
 		} mp_capable_info;
 	};
+	struct mp_key_hash key_hash; // for MP_CAPABLE_SUBTYPE keys
 	UT_hash_handle hh;
 };
 
+//A DSS field written TRUNC_R64_HMAC(var) + n in the script: the idsn of the
+//key held by var, plus n. The parser compiles each such field into one
+//expression in mp_state.exprs. When the script gave var its key, the value
+//is folded then and there; otherwise it waits for the key, such as the
+//kernel's, and is computed the first time a packet needs it. Either way it
+//is kept for as long as the key and MPTCP version stay the same.
+struct mp_value_expr {
+	u32 var;	// slot of the key variable
+	u64 addend;	// n
+	u64 value;	// idsn of key for version, plus addend, if valid
+	u64 key;	// key value was computed from
+	u8 version;	// MPTCP version value was computed for
+	bool valid;
+};
+
+/**
+ * MP_JOIN HMAC keys of a connection, made once from its two keys: one with
+ * packetdrill's key first, for HMACs packetdrill sends, one with the kernel's
+ * key first, for HMACs the kernel sends.
+ */
+struct mp_hmac_keys {
+	u64 packetdrill_key;	// keys and version these were made from
+	u64 kernel_key;
+	u8 version;
+	bool valid;
+	struct mptcp_hmac_key packetdrill;
+	struct mptcp_hmac_key kernel;
+};
+
+/**
+ * MP_JOIN HMACs of a subflow, computed once both random numbers are known.
+ * A retransmitted SYN/ACK, or checking what the kernel sent, then costs no
+ * hashing; a new random number or key computes them again.
+ */
+struct mp_join_hmacs {
+	u64 packetdrill_key;	// inputs these were computed from
+	u64 kernel_key;
+	u32 packetdrill_rand_nbr;
+	u32 kernel_rand_nbr;
+	u8 version;
+	bool valid;
+	u8 packetdrill[MPTCP_HMAC_MAX_BYTES];	// the HMAC packetdrill sends
+	u8 kernel[MPTCP_HMAC_MAX_BYTES];	// the HMAC the kernel sends
+};
+
+struct mp_connection;
+
+/**
+ * The 4-tuple of a subflow, packetdrill side first, as the key of the
+ * subflows index. Filled in by mp_subflow_key_init(), so that padding and
+ * unused address bytes are zero and the key can be hashed as bytes.
+ */
+struct mp_subflow_key {
+	struct ip_address packetdrill_ip;
+	struct ip_address kernel_ip;
+	u16 packetdrill_port; // host order
+	u16 kernel_port;      // host order
+};
+
 /**
  * Keep all info specific to a mptcp subflow
  */
@@ -155,19 +235,58 @@ struct mp_subflow {
 	unsigned kernel_rand_nbr;
 	unsigned packetdrill_rand_nbr;
 	u32 ssn;
+	struct mp_join_hmacs join_hmacs; // see mp_join_hmacs()
 //	u8 state; // undefined, pre_established or established
-	struct mp_subflow *next;
+	struct mp_connection *conn; // mptcp connection owning this subflow
+	struct mp_subflow_key key; // key in mp_state.subflows_by_tuple
+	UT_hash_handle hh; // mp_state.subflows_by_tuple
+	struct mp_subflow *next; // next subflow of the same connection
 };
 
 /**
- * Global state for multipath TCP
+ * Keep all info specific to a mptcp connection: its keys, data sequence
+ * numbers state and subflows. A script can drive several mptcp connections
+ * at once; each of them is looked up through the hash indexes in mp_state.
  */
-struct mp_state_s {
+struct mp_connection {
+    u8 version; // MPTCP version of the mp_capable handshake, MPTCP_V0 or V1
     u64 packetdrill_key; //packetdrill side key
     u64 kernel_key; //mptcp stack side key
-    //Should be a single key for a mptcp session.
     bool packetdrill_key_set;
     bool kernel_key_set;
+    u32 packetdrill_token; // token derived from packetdrill_key
+    u32 kernel_token;      // token derived from kernel_key
+    u64 packetdrill_idsn;  // least 64 bits of Hash(packetdrill_key)
+    u64 kernel_idsn;       // least 64 bits of Hash(kernel_key)
+    struct mp_hmac_keys hmac_keys; // see mp_join_hmacs()
+
+    struct mp_subflow *subflows;
+    // 1 + the sum of (ssn - 1) over all subflows: the data sequence space
+    // used so far, kept up to date by subflow_advance_ssn().
+    u32 sum_ssn;
+
+    unsigned last_packetdrill_addr_id;
+
+    u64 remote_idsn; 	// least 64 bits of Hash(kernel_key)
+    u64 idsn;			// least 64 bits of Hash(packetdrill_key)
+    u32 remote_ssn;		// number of packets received from kernel
+//    u64 last_dsn_rcvd;  // last dsn received from kernel
+    u64 remote_last_pkt_length;
+
+    // Ports of the first subflow, packetdrill side first. Used to find the
+    // connection during the mp_capable handshake, before the first subflow
+    // exists in all directions.
+    u32 ports_key;
+    UT_hash_handle hh_ports;             // mp_state.conns_by_ports
+    UT_hash_handle hh_packetdrill_token; // mp_state.conns_by_packetdrill_token
+    UT_hash_handle hh_kernel_token;      // mp_state.conns_by_kernel_token
+    struct mp_connection *next; // next connection in mp_state.connections
+};
+
+/**
+ * Global state for multipath TCP
+ */
+struct mp_state_s {
 
     /*
      * FIFO queue to track variables use. Once parser encounter a mptcp
@@ -181,17 +300,37 @@ struct mp_state_s {
     queue_t 	vars_queue;
     queue_t_val vals_queue; // this is used to pass values from scipt to packetdrill
     queue_t_val script_only_vals_queue; // used to queu and dequeue in script file
-    //hashmap, contains <key:variable_name, value: variable_value>
+    //hashmap, contains <key:variable_name, value: variable_value>, to intern
+    //names while parsing
     struct mp_var *vars;
-    struct mp_subflow *subflows;
-
-    unsigned last_packetdrill_addr_id;
-
-    u64 remote_idsn; 	// least 64 bits of Hash(kernel_key)
-    u64 idsn;			// least 64 bits of Hash(packetdrill_key)
-    u32 remote_ssn;		// number of packets received from kernel
-//    u64 last_dsn_rcvd;  // last dsn received from kernel
-    u64 remote_last_pkt_length;
+    //All variables by slot, in the order they were interned
+    struct mp_var **var_slots;
+    u32 num_var_slots;
+    u32 max_var_slots; // allocated length of var_slots
+    //Compiled DSS field expressions, in the order they were parsed
+    struct mp_value_expr *exprs;
+    u32 num_exprs;
+    u32 max_exprs; // allocated length of exprs
+
+    // All mptcp connections, newest first. The newest one is the default
+    // connection for packets we cannot map to a connection otherwise.
+    struct mp_connection *connections;
+    // Hash indexes over connections and subflows.
+    struct mp_connection *conns_by_ports;
+    struct mp_connection *conns_by_packetdrill_token;
+    struct mp_connection *conns_by_kernel_token;
+    struct mp_subflow *subflows_by_tuple;
+    // Bumped whenever subflows_by_tuple changes, so that sockets can cache
+    // the subflow they belong to until then.
+    u32 subflows_generation;
+
+    // Generator for keys and random numbers, owned by the struct state
+    // of the running test.
+    struct prng *prng;
+
+    // MPTCP version of the script (--mptcp_version), used for connections
+    // until their mp_capable option says otherwise.
+    u8 version;
 };
 
 typedef struct mp_state_s mp_state_t;
@@ -206,44 +345,175 @@ void free_mp_state();
  * Remember mptcp connection key generated by packetdrill. This key is needed
  * during the entire mptcp connection and is common among all mptcp subflows.
  */
-void set_packetdrill_key(u64 packetdrill_key);
+void set_packetdrill_key(struct mp_connection *conn, u64 packetdrill_key);
 
 /**
  * Remember mptcp connection key generated by kernel. This key is needed
  * during the entire mptcp connection and is common among all mptcp subflows.
  */
-void set_kernel_key(u64 kernel_key);
+void set_kernel_key(struct mp_connection *conn, u64 kernel_key);
+
+/**
+ * Does the given ADD_ADDR option end with the HMAC of version 1?
+ */
+static inline bool add_addr_has_hmac(const struct tcp_option *opt)
+{
+	switch(opt->length){
+	case TCPOLEN_ADD_ADDR_V4_HMAC:
+	case TCPOLEN_ADD_ADDR_V4_PORT_HMAC:
+	case TCPOLEN_ADD_ADDR_V6_HMAC:
+	case TCPOLEN_ADD_ADDR_V6_PORT_HMAC:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Return the length of the given ADD_ADDR option without its HMAC, if any:
+ * one of TCPOLEN_ADD_ADDR_V4, _V4_PORT, _V6 or _V6_PORT for a valid option.
+ */
+static inline u8 add_addr_length(const struct tcp_option *opt)
+{
+	return add_addr_has_hmac(opt) ?
+			opt->length - TCPOLEN_ADD_ADDR_HMAC : opt->length;
+}
+
+/**
+ * Return the HMAC that ends a version 1 ADD_ADDR option.
+ */
+static inline u8 *add_addr_hmac(struct tcp_option *opt)
+{
+	return (u8*)opt + opt->length - TCPOLEN_ADD_ADDR_HMAC;
+}
+
+/* connections management */
+
+/**
+ * Return the key used in the ports indexes for a subflow or connection
+ * with the given packetdrill side and kernel side ports (host order).
+ */
+static inline u32 mp_ports_key(u16 packetdrill_port, u16 kernel_port)
+{
+	return ((u32)packetdrill_port << 16) | kernel_port;
+}
+
+/**
+ * Create a new mptcp connection for the given packet, which should be the
+ * first packet of a mp_capable three-way handshake, and make it the default
+ * connection.
+ */
+struct mp_connection *new_connection(struct packet *packet, unsigned direction);
+
+/**
+ * Return the mptcp connection the given packet belongs to: the connection of
+ * the subflow with the packet ports, or of the handshake with the packet
+ * ports. NULL is returned if there is none.
+ */
+struct mp_connection *find_connection_matching_packet(struct packet *packet,
+		unsigned direction);
+
+/**
+ * Same as find_connection_matching_packet, but fall back to the default
+ * (newest) connection if the packet ports are unknown.
+ */
+struct mp_connection *find_connection_for_packet(struct packet *packet,
+		unsigned direction);
+
+/**
+ * Return the connection whose packetdrill (resp. kernel) key has the given
+ * token, or NULL.
+ */
+struct mp_connection *find_connection_by_packetdrill_token(u32 token);
+struct mp_connection *find_connection_by_kernel_token(u32 token);
 
 
 /* mp_var_queue functions */
 
 /**
- * Insert a COPY of name char* in mp_state.vars_queue.
- * Error is returned if queue is full.
+ * mp_state.vars_queue holds struct mp_join_info pointers, variable slots and
+ * indexes of compiled expressions. A slot goes in as an odd pointer-sized
+ * value, (slot << 1) | 1, and an expression index as (index << 2) | 2,
+ * neither of which a malloc'd mp_join_info can be.
+ */
+static inline void *mp_var_queue_element(u32 slot)
+{
+	return (void *)(((uintptr_t)slot << 1) | 1);
+}
+
+static inline void *mp_expr_queue_element(u32 index)
+{
+	return (void *)(((uintptr_t)index << 2) | 2);
+}
+
+/**
+ * If the vars_queue element is an expression index, set *expr to its
+ * expression and return true.
+ */
+bool mp_expr_queued(const void *element, struct mp_value_expr **expr);
+
+/**
+ * If the vars_queue element is a variable slot, set *var to its variable and
+ * return true.
+ */
+bool mp_var_queued(const void *element, struct mp_var **var);
+
+/**
+ * Intern name and insert its slot in mp_state.vars_queue. Error is returned
+ * if we are out of memory.
  *
  */
 int enqueue_var(char *name);
-//caller should free "name"
-int dequeue_var(char **name);
-//Free all variables names (char*) in vars_queue
+//Take the variable of the slot at the front of vars_queue
+int dequeue_var(struct mp_var **var);
+//Free vars_queue; mp_join_info elements are not freed
 void free_var_queue();
+
+/**
+ * Append a copy of expr to mp_state.exprs and return its index.
+ */
+u32 mp_expr_add(const struct mp_value_expr *expr);
+
+/**
+ * Compile TRUNC_R64_HMAC(name) + addend, folding it if the variable already
+ * has a key from the script, and insert it in mp_state.vars_queue. Error is
+ * returned if we are out of memory.
+ */
+int enqueue_idsn_expr(const char *name, u64 addend, u8 version);
+
+/**
+ * Take the expression at the front of vars_queue and give its value for the
+ * given MPTCP version, computing it only if its key changed since last time.
+ * Error if the front is not an expression or its key is not known yet.
+ */
+int find_next_idsn_expr(u8 version, u64 *value);
 //Free all values added in vals_queue
 void free_val_queue();
 
 /* hashmap functions */
 
 /**
- *
- * Save a variable <name, value> in variables hashmap.
- * Where value is of u64 type key.
- *
- * Key memory location should stay valid, name is copied.
- *
+ * Return the slot of the variable of the given name, adding a variable
+ * without a value if there is none yet. Name is copied.
+ */
+u32 mp_var_intern(const char *name);
+
+/**
+ * Return the variable in the given slot, or NULL if there is no such slot.
  */
-void add_mp_var_key(char *name, u64 *key);
+static inline struct mp_var *mp_var_slot(u32 slot)
+{
+	return slot < mp_state.num_var_slots ? mp_state.var_slots[slot] : NULL;
+}
 
 /**
- * Save a variable <name, value> in variables hashmap.
+ * Make var refer to the given key, unless the script gave it a value.
+ * Key memory location should stay valid.
+ */
+void add_mp_var_key(struct mp_var *var, u64 *key);
+
+/**
+ * Give the variable of the given name a value from the script.
  * Value is copied in a newly allocated pointer and will be freed when
  * free_vars function will be executed.
  *
@@ -251,14 +521,9 @@ void add_mp_var_key(char *name, u64 *key);
 void add_mp_var_script_defined(char *name, void *value, u32 length);
 
 /**
- * Add var to the variable hashmap.
- */
-void add_mp_var(struct mp_var *var);
-
-/**
- * Search in the hashmap for the value of the variable of name "name" and
- * return both variable - value (mp_var struct).
- * NULL is returned if not found
+ * Search in the hashmap for the variable of name "name", defined or not.
+ * NULL is returned if not found. For parsing and tests; at run time,
+ * variables are known by slot.
  */
 struct mp_var *find_mp_var(char *name);
 
@@ -268,6 +533,12 @@ struct mp_var *find_mp_var(char *name);
  */
 u64 *find_next_key();
 
+/**
+ * Return the cached token and idsn of the key held by var, for the given
+ * MPTCP version.
+ */
+struct mp_key_hash *mp_var_key_hash(struct mp_var *var, u8 version);
+
 /**
  * Returns the next value entered in script (enqueud)
  */
@@ -279,6 +550,9 @@ u64 find_next_value();
  */
 void free_vars();
 
+//Free the compiled expressions of mp_state.exprs
+void free_exprs();
+
 /* subflows management */
 
 /**
@@ -293,20 +567,31 @@ void free_vars();
  *
  * - last_packetdrill_addr_id is incremented.
  */
-struct mp_subflow *new_subflow_inbound(struct packet *packet);
-struct mp_subflow *new_subflow_outbound(struct packet *outbound_packet);
+struct mp_subflow *new_subflow_inbound(struct mp_connection *conn,
+		struct packet *packet);
+struct mp_subflow *new_subflow_outbound(struct mp_connection *conn,
+		struct packet *outbound_packet);
 /**
- * Return the first subflow S of mp_state.subflows for which match(packet, S)
- * returns true.
+ * Return the newest subflow with the 4-tuple of the given packet, looked up
+ * in mp_state.subflows_by_tuple.
  */
-struct mp_subflow *find_matching_subflow(struct packet *packet,
-		bool (*match)(struct mp_subflow*, struct packet*));
 struct mp_subflow *find_subflow_matching_outbound_packet(struct packet *outbound_packet);
+/**
+ * Return the subflow whose kernel side is the given live socket. The answer
+ * is cached in the socket until the subflows index next changes, so this
+ * costs a hash lookup only after a subflow comes or goes.
+ */
 struct mp_subflow *find_subflow_matching_socket(struct socket *socket);
 struct mp_subflow *find_subflow_matching_inbound_packet(
 		struct packet *inbound_packet);
 /**
- * Free all mptcp subflows struct being a member of mp_state.subflows list.
+ * Return the MP_JOIN HMACs of subflow for its connection's keys and the
+ * random numbers it has now, computing them only if any of those changed
+ * since last time.
+ */
+const struct mp_join_hmacs *mp_join_hmacs(struct mp_subflow *subflow);
+/**
+ * Free all mptcp connections and their subflows.
  */
 void free_flows();
 
@@ -314,7 +599,7 @@ void free_flows();
  * Generate a mptcp packetdrill side key and save it for later reference in
  * the script.
  */
-int mptcp_gen_key();
+int mptcp_gen_key(struct mp_connection *conn);
 
 /**
  * Insert key field value of mp_capable_syn mptcp option according to variable
@@ -0,0 +1,73 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Fuzz target for same_mptcp_opt(), which compares an MPTCP option the
+ * kernel sent with the one the script expects. The first input byte is
+ * the TCP flags of the kernel's packet, the second says how many of the
+ * following bytes are its options, and the rest are the options of the
+ * script's packet. As the verification code does, we compare each MPTCP
+ * option of the kernel's packet with the script's option of the same
+ * subtype, and also with itself, so that we reach every field of the
+ * kernel's option even where the script has no option to compare.
+ */
+
+#include "fuzz_target.h"
+
+#include <assert.h>
+#include "run_packet.h"
+#include "tcp_options_iterator.h"
+
+int LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+	struct packet *live = NULL, *script = NULL;
+	struct tcp_options_iterator iter;
+	struct tcp_option *option = NULL;
+	char *error = NULL;
+	size_t live_bytes;
+
+	if (size < 2)
+		return 0;
+	live_bytes = data[1];
+	if (live_bytes > size - 2)
+		live_bytes = size - 2;
+	live = fuzz_tcp_packet(data[0], data + 2, live_bytes);
+	script = fuzz_tcp_packet(data[0], data + 2 + live_bytes,
+				 size - 2 - live_bytes);
+	if (live == NULL || script == NULL)
+		goto out;
+
+	for (option = tcp_options_begin(live, &iter); option != NULL;
+	     option = tcp_options_next(&iter, &error)) {
+		struct tcp_option *expected = NULL;
+
+		if (option->kind != TCPOPT_MPTCP)
+			continue;
+		expected = get_mptcp_option(script,
+					    option->data.mp_capable.subtype);
+		if (expected != NULL)
+			same_mptcp_opt(option, expected, live);
+		same_mptcp_opt(option, option, live);
+	}
+	free(error);
+
+out:
+	if (live != NULL)
+		packet_free(live);
+	if (script != NULL)
+		packet_free(script);
+	return 0;
+}
@@ -29,7 +29,30 @@
 #include <unistd.h>
 
 #include "logging.h"
+#include "netlink.h"
 
+#ifdef linux
+/* Add or delete an address over rtnetlink. Like the ip(8) commands
+ * this replaced, failures are only logged.
+ */
+static void net_change_address(bool add, const char *dev_name,
+			       const struct ip_address *ip,
+			       int prefix_len)
+{
+	char *error = NULL;
+	int ifindex = if_nametoindex(dev_name);
+
+	if (ifindex == 0 ||
+	    netlink_change_address(add, ifindex, ip, prefix_len, &error)) {
+		DEBUGP("error %s address on %s: %s\n",
+		       add ? "adding" : "deleting", dev_name,
+		       error ? error : "no such device");
+	}
+	free(error);
+}
+#endif
+
+#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
 static void verbose_system(const char *command)
 {
 	int result;
@@ -40,28 +63,28 @@ static void verbose_system(const char *command)
 	if (result != 0)
 		DEBUGP("error executing command '%s'\n", command);
 }
+#endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
 
 /* Configure a local IPv4 address and netmask for the device */
 static void net_add_ipv4_address(const char *dev_name,
 				 const struct ip_address *ip,
 				 int prefix_len)
 {
+#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
 	char *command = NULL;
 	char ip_string[ADDR_STR_LEN];
-
-	ip_to_string(ip, ip_string);
+#endif
 
 #ifdef linux
-	asprintf(&command, "ip addr add %s/%d dev %s > /dev/null 2>&1",
-		 ip_string, prefix_len, dev_name);
+	net_change_address(true, dev_name, ip, prefix_len);
 #endif
 #if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+	ip_to_string(ip, ip_string);
 	asprintf(&command, "/sbin/ifconfig %s %s/%d alias",
 		 dev_name, ip_string, prefix_len);
-#endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
-
 	verbose_system(command);
 	free(command);
+#endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
 }
 
 /* Configure a local IPv6 address and prefix length for the device */
@@ -69,22 +92,21 @@ static void net_add_ipv6_address(const char *dev_name,
 				 const struct ip_address *ip,
 				 int prefix_len)
 {
+#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
 	char *command = NULL;
 	char ip_string[ADDR_STR_LEN];
-
-	ip_to_string(ip, ip_string);
+#endif
 
 #ifdef linux
-
-	asprintf(&command, "ip addr add %s/%d dev %s > /dev/null 2>&1",
-		 ip_string, prefix_len, dev_name);
+	/* Added with IFA_F_NODAD, so there is no need to wait for
+	 * duplicate address detection before using the address.
+	 */
+	net_change_address(true, dev_name, ip, prefix_len);
 #endif
 #if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
-
+	ip_to_string(ip, ip_string);
 	asprintf(&command, "/sbin/ifconfig %s inet6 %s/%d",
 		 dev_name, ip_string, prefix_len);
-#endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
-
 	verbose_system(command);
 	free(command);
 
@@ -93,13 +115,8 @@ static void net_add_ipv6_address(const char *dev_name,
 	 * e.g. "ip addr show" shows:
 	 * inet6 fd3d:fa7b:d17d::36/48 scope global tentative
 	 */
-#ifdef linux
-	if (!strstr(dev_name, "tun"))
-		sleep(2);
-#endif
-#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
 	sleep(3);
-#endif
+#endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
 }
 
 void net_add_dev_address(const char *dev_name,
@@ -123,24 +140,23 @@ void net_del_dev_address(const char *dev_name,
 			 const struct ip_address *ip,
 			 int prefix_len)
 {
+#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
 	char *command = NULL;
 	char ip_string[ADDR_STR_LEN];
-
-	ip_to_string(ip, ip_string);
+#endif
 
 #ifdef linux
-	asprintf(&command, "ip addr del %s/%d dev %s > /dev/null 2>&1",
-		 ip_string, prefix_len, dev_name);
+	net_change_address(false, dev_name, ip, prefix_len);
 #endif
 #if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+	ip_to_string(ip, ip_string);
 	asprintf(&command, "/sbin/ifconfig %s %s %s/%d -alias",
 		 dev_name,
 		 ip->address_family ==  AF_INET6 ? "inet6" : "",
 		 ip_string, prefix_len);
-#endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
-
 	verbose_system(command);
 	free(command);
+#endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
 }
 
 /* In general we want to avoid configuring a new IP address on an
@@ -41,17 +41,27 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#ifdef linux
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+#endif
+
 #if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
 #include <net/if_tun.h>
 #endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
 
+#include "checksum.h"
+#include "hash.h"
 #include "ip.h"
 #include "ipv6.h"
 #include "logging.h"
 #include "net_utils.h"
+#include "netlink.h"
 #include "packet.h"
 #include "packet_parser.h"
 #include "packet_socket.h"
+#include "queue_stats.h"
+#include "sniffer.h"
 #include "tcp.h"
 #include "tun.h"
 
@@ -61,10 +71,17 @@ struct local_netdev {
 
 	char *name;		/* malloc-ed copy of interface name (owned) */
 	int tun_fd;		/* tun for sending/receiving packets */
+	int queue_fds[TUN_MAX_QUEUES];	/* fd per tun queue; [0] is tun_fd */
+	int num_queues;		/* number of tun queues */
 	int ipv4_control_fd;	/* fd for IPv4 configuration of tun interface */
 	int ipv6_control_fd;	/* fd for IPv6 configuration of tun interface */
 	int index;		/* interface index from if_nametoindex */
+	u32 speed;		/* speed we last set, or TUN_DRIVER_SPEED_CUR */
+	int mtu;		/* MTU we last set */
+	bool vnet_hdr;		/* tun packets carry a virtio_net_hdr? */
 	struct packet_socket *psock;	/* for sniffing packets (owned) */
+	struct sniffer *sniffer;	/* thread sniffing psock (owned) */
+	struct queue_sampler *queue_sampler;	/* for --queue_stats (owned) */
 };
 
 struct netdev_ops local_netdev_ops;
@@ -102,21 +119,110 @@ static void cleanup_old_device(struct config *config,
 static void check_remote_address(struct config *config,
 				 struct local_netdev *netdev)
 {
+	int i;
+
 	if (is_ip_local(&config->live_remote_ip)) {
 		die("error: live_remote_ip %s is not remote\n",
 		    config->live_remote_ip_string);
 	}
+	for (i = 0; i < config->num_address_pools; ++i) {
+		const struct address_pool *pool = &config->address_pools[i];
+
+		if (is_ip_local(&pool->remote_ip)) {
+			die("error: --address_pool remote %s is not remote\n",
+			    pool->remote_ip_string);
+		}
+	}
+}
+
+#ifdef linux
+/* Set the link speed the tun driver reports, as "ethtool -s dev speed
+ * N autoneg off" would. This needs a tun driver that supports it, so
+ * like ethtool we just warn if it does not.
+ */
+static void set_device_speed(struct local_netdev *netdev, u32 speed)
+{
+	struct ethtool_cmd cmd;
+	struct ifreq ifr;
+	char *error = NULL;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, netdev->name, IFNAMSIZ - 1);
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.cmd = ETHTOOL_GSET;
+	ifr.ifr_data = (void *)&cmd;
+	if (ioctl(netdev->ipv4_control_fd, SIOCETHTOOL, &ifr) == 0) {
+		ethtool_cmd_speed_set(&cmd, speed);
+		cmd.autoneg = AUTONEG_DISABLE;
+		cmd.cmd = ETHTOOL_SSET;
+	}
+	if (cmd.cmd != ETHTOOL_SSET ||
+	    ioctl(netdev->ipv4_control_fd, SIOCETHTOOL, &ifr) < 0) {
+		fprintf(stderr, "warning: cannot set speed of %s: %s\n",
+			netdev->name, strerror(errno));
+	}
+
+	/* Need to bring interface down and up so the interface speed
+	 * will be copied to the link_speed field. This field is
+	 * used by TCP's cwnd bound. Over rtnetlink both steps are
+	 * synchronous, so unlike ifconfig there is nothing to wait for.
+	 */
+	if (netlink_set_link_up(netdev->index, false, &error) ||
+	    netlink_set_link_up(netdev->index, true, &error))
+		die("error restarting %s: %s\n", netdev->name, error);
+}
+
+static void set_device_mtu(struct local_netdev *netdev, int mtu)
+{
+	char *error = NULL;
+
+	if (netlink_set_link_mtu(netdev->index, mtu, &error))
+		die("error setting MTU of %s to %d: %s\n",
+		    netdev->name, mtu, error);
+}
+#else
+static void set_device_speed(struct local_netdev *netdev, u32 speed)
+{
+	char *command;
+	asprintf(&command, "ethtool -s %s speed %u autoneg off",
+		 netdev->name, speed);
+	if (system(command) < 0)
+		die("Error executing %s\n", command);
+	free(command);
+
+	/* Need to bring interface down and up so the interface speed
+	 * will be copied to the link_speed field. This field is
+	 * used by TCP's cwnd bound. */
+	asprintf(&command, "ifconfig %s down; sleep 1; ifconfig %s up; "
+		 "sleep 1", netdev->name, netdev->name);
+	if (system(command) < 0)
+		die("Error executing %s\n", command);
+	free(command);
+}
+
+static void set_device_mtu(struct local_netdev *netdev, int mtu)
+{
+	char *command;
+	asprintf(&command, "ifconfig %s mtu %d", netdev->name, mtu);
+	if (system(command) < 0)
+		die("Error executing %s\n", command);
+	free(command);
 }
+#endif /* linux */
 
 /* Create a tun device for the lifetime of this test. */
 static void create_device(struct config *config, struct local_netdev *netdev)
 {
-	/* Open the tun device, which "clones" it for our purposes. */
-	int tun_fd = open(TUN_PATH, O_RDWR);
+	/* Open the tun device, which "clones" it for our purposes. Reads
+	 * are non-blocking, as we only ever drain what is queued there.
+	 */
+	int tun_fd = open(TUN_PATH, O_RDWR | O_NONBLOCK);
 	if (tun_fd < 0)
 		die_perror("open tun device");
 
 	netdev->tun_fd = tun_fd;
+	netdev->queue_fds[0] = tun_fd;
+	netdev->num_queues = 1;
 
 #ifdef linux
 	/* Create the device. Since we do not specify a device name, the
@@ -126,18 +232,52 @@ static void create_device(struct config *config, struct local_netdev *netdev)
 	struct ifreq ifr;
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+	if (config->vnet_hdr)
+		ifr.ifr_flags |= IFF_VNET_HDR;
+	if (config->tun_queues > 1)
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
 	int status = ioctl(netdev->tun_fd, TUNSETIFF, (void *)&ifr);
 	if (status < 0)
 		die_perror("TUNSETIFF");
+	netdev->vnet_hdr = config->vnet_hdr;
 
 	netdev->name = strdup(ifr.ifr_name);
+
+	/* Attach a file for each further queue, by naming the device. As
+	 * with a multi-queue NIC, the kernel then spreads the flows it
+	 * sends across the queues, and records the queue each injected
+	 * packet came in on, so RPS/RFS steering can act on it.
+	 */
+	while (netdev->num_queues < config->tun_queues) {
+		int queue_fd = open(TUN_PATH, O_RDWR | O_NONBLOCK);
+
+		if (queue_fd < 0)
+			die_perror("open tun device");
+		if (ioctl(queue_fd, TUNSETIFF, (void *)&ifr) < 0)
+			die_perror("TUNSETIFF IFF_MULTI_QUEUE");
+		netdev->queue_fds[netdev->num_queues++] = queue_fd;
+	}
+	DEBUGP("tun queues: %d\n", netdev->num_queues);
 #endif
 
 #if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+	if (config->vnet_hdr)
+		die("--vnet_hdr is only supported on Linux\n");
+	if (config->tun_queues > 1)
+		die("--tun_queues is only supported on Linux\n");
+
 	const int mode = IFF_BROADCAST | IFF_MULTICAST;
 	if (ioctl(netdev->tun_fd, TUNSIFMODE, &mode, sizeof(mode)) < 0)
 		die_perror("TUNSIFMODE");
 
+	/* NetBSD's tun ignores the O_NONBLOCK we opened it with, and
+	 * only stops reads blocking once told so with FIONBIO; without
+	 * it, drain_device() would wait for a packet that never comes.
+	 */
+	const int nonblocking = 1;
+	if (ioctl(netdev->tun_fd, FIONBIO, &nonblocking) < 0)
+		die_perror("FIONBIO");
+
 	netdev->name = strdup(TUN_DEV);
 #endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
 
@@ -159,33 +299,6 @@ static void create_device(struct config *config, struct local_netdev *netdev)
 
 	DEBUGP("tun index: '%d'\n", netdev->index);
 
-	if (config->speed != TUN_DRIVER_SPEED_CUR) {
-		char *command;
-		asprintf(&command, "ethtool -s %s speed %u autoneg off",
-			 netdev->name, config->speed);
-		if (system(command) < 0)
-			die("Error executing %s\n", command);
-		free(command);
-
-		/* Need to bring interface down and up so the interface speed
-		 * will be copied to the link_speed field. This field is
-		 * used by TCP's cwnd bound. */
-		asprintf(&command, "ifconfig %s down; sleep 1; ifconfig %s up; "
-			      "sleep 1", netdev->name, netdev->name);
-		if (system(command) < 0)
-			die("Error executing %s\n", command);
-		free(command);
-	}
-
-	if (config->mtu != TUN_DRIVER_DEFAULT_MTU) {
-		char *command;
-		asprintf(&command, "ifconfig %s mtu %d",
-			 netdev->name, config->mtu);
-		if (system(command) < 0)
-			die("Error executing %s\n", command);
-		free(command);
-	}
-
 	/* Open a socket we can use to configure the tun interface.
 	 * We only open up an AF_INET6 socket on-demand as needed,
 	 * so that we can run IPv4 tests on a machine without IPv6.
@@ -195,15 +308,34 @@ static void create_device(struct config *config, struct local_netdev *netdev)
 	netdev->ipv4_control_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
 	if (netdev->ipv4_control_fd < 0)
 		die_perror("opening AF_INET, SOCK_DGRAM, IPPROTO_IP socket");
+
+	netdev->speed = TUN_DRIVER_SPEED_CUR;
+	if (config->speed != TUN_DRIVER_SPEED_CUR) {
+		set_device_speed(netdev, config->speed);
+		netdev->speed = config->speed;
+	}
+
+	netdev->mtu = TUN_DRIVER_DEFAULT_MTU;
+	if (config->mtu != TUN_DRIVER_DEFAULT_MTU) {
+		set_device_mtu(netdev, config->mtu);
+		netdev->mtu = config->mtu;
+	}
 }
 
-/* Set the offload flags to be like a typical ethernet device */
+/* Set the offload flags to be like a typical ethernet device. We also
+ * ask for UDP segmentation offload, so that UDP GSO sends reach the
+ * sniffer whole, but kernels before 6.2 do not know it.
+ */
 static void set_device_offload_flags(struct local_netdev *netdev)
 {
 #ifdef linux
 	const u32 offload =
 	    TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN | TUN_F_UFO;
-	if (ioctl(netdev->tun_fd, TUNSETOFFLOAD, offload) != 0)
+	if (ioctl(netdev->tun_fd, TUNSETOFFLOAD,
+		  offload | TUN_F_USO4 | TUN_F_USO6) == 0)
+		return;
+	if (errno != EINVAL ||
+	    ioctl(netdev->tun_fd, TUNSETOFFLOAD, offload) != 0)
 		die_perror("TUNSETOFFLOAD");
 #endif
 }
@@ -221,28 +353,34 @@ static void bring_up_device(struct local_netdev *netdev)
 		die_perror("SIOCSIFFLAGS");
 }
 
-/* Route traffic destined for our remote IP through this device */
-static void route_traffic_to_device(struct config *config,
-				    struct local_netdev *netdev)
+/* Route traffic destined for the given prefix through this device */
+static void route_prefix_to_device(struct config *config,
+				   struct local_netdev *netdev,
+				   const struct ip_prefix *prefix,
+				   const struct ip_address *gateway)
 {
-	char *route_command = NULL;
+	char prefix_string[ADDR_STR_LEN];
+	char gateway_string[ADDR_STR_LEN];
+	struct ip_prefix prefix_copy = *prefix;
+
+	ip_prefix_to_string(&prefix_copy, prefix_string);
+	ip_to_string(gateway, gateway_string);
 #ifdef linux
-	asprintf(&route_command,
-		 "ip route del %s > /dev/null 2>&1 ; "
-		 "ip route add %s dev %s via %s > /dev/null 2>&1",
-		 config->live_remote_prefix_string,
-		 config->live_remote_prefix_string,
-		 netdev->name,
-		 config->live_gateway_ip_string);
+	char *error = NULL;
+
+	if (netlink_replace_route(netdev->index, prefix, gateway, &error)) {
+		die("error adding route to %s via %s: %s\n",
+		    prefix_string, gateway_string, error);
+	}
 #endif
 #if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+	char *route_command = NULL;
+
 	if (config->wire_protocol == AF_INET) {
 		asprintf(&route_command,
 			 "route delete %s > /dev/null 2>&1 ; "
 			 "route add %s %s > /dev/null",
-			 config->live_remote_prefix_string,
-			 config->live_remote_prefix_string,
-			 config->live_gateway_ip_string);
+			 prefix_string, prefix_string, gateway_string);
 	} else if (config->wire_protocol == AF_INET6) {
 		asprintf(&route_command,
 			 "route delete -inet6 %s > /dev/null 2>&1 ; "
@@ -251,19 +389,53 @@ static void route_traffic_to_device(struct config *config,
 #elif defined(__OpenBSD__) || defined(__NetBSD__)
 			 "route add -inet6 %s %s > /dev/null",
 #endif
-			 config->live_remote_prefix_string,
-			 config->live_remote_prefix_string,
-			 config->live_gateway_ip_string);
+			 prefix_string, prefix_string, gateway_string);
 	} else {
 		assert(!"bad wire protocol");
 	}
-#endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
 	int result = system(route_command);
 	if ((result == -1) || (WEXITSTATUS(result) != 0)) {
 		die("error executing route command '%s'\n",
 		    route_command);
 	}
 	free(route_command);
+#endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
+}
+
+/* Route traffic destined for our remote IP, and for the remote prefix
+ * of each address pool, through this device.
+ */
+static void route_traffic_to_device(struct config *config,
+				    struct local_netdev *netdev)
+{
+	int i;
+
+	route_prefix_to_device(config, netdev, &config->live_remote_prefix,
+			       &config->live_gateway_ip);
+	for (i = 0; i < config->num_address_pools; ++i) {
+		const struct address_pool *pool = &config->address_pools[i];
+
+		route_prefix_to_device(config, netdev, &pool->remote_prefix,
+				       &pool->gateway_ip);
+	}
+}
+
+/* Put our local IP, and the local address of each address pool, on
+ * this device.
+ */
+static void set_up_device_addresses(struct config *config,
+				    struct local_netdev *netdev)
+{
+	int i;
+
+	net_setup_dev_address(netdev->name,
+			      &config->live_local_ip,
+			      config->live_prefix_len);
+	for (i = 0; i < config->num_address_pools; ++i) {
+		net_setup_dev_address(netdev->name,
+				      &config->address_pools[i].local_ip,
+				      config->live_prefix_len);
+	}
 }
 
 struct netdev *local_netdev_new(struct config *config)
@@ -279,22 +451,107 @@ struct netdev *local_netdev_new(struct config *config)
 	set_device_offload_flags(netdev);
 	bring_up_device(netdev);
 
-	net_setup_dev_address(netdev->name,
-			      &config->live_local_ip,
-			      config->live_prefix_len);
-
+	set_up_device_addresses(config, netdev);
 	route_traffic_to_device(config, netdev);
-	netdev->psock = packet_socket_new(netdev->name);
+	netdev->psock = packet_socket_new(netdev->name, netdev->vnet_hdr);
+	if (config->queue_stats_usecs > 0)
+		netdev->queue_sampler = queue_sampler_new(
+			netdev->index, config->queue_stats_usecs);
 
 	return (struct netdev *)netdev;
 }
 
+/* Read and discard any packets the kernel has queued on the tun
+ * device. We read packets while sniffing so that the kernel can
+ * exercise its normal code paths for packet transmit completion, since
+ * this code path may feed back to TCP behavior; e.g., see the Linux
+ * patch "tcp: avoid retransmits of TCP packets hanging in host
+ * queues". We don't actually need the packet contents, but on
+ * Linux we need to read at least 1 byte of packet data to consume the
+ * packet. We drain the whole queue rather than one packet per sniffed
+ * one, since the packet socket filter may hide some of them from us.
+ * On reset this also drops e.g. retransmits or FINs from connections
+ * of a previous script.
+ */
+static void drain_device(struct local_netdev *netdev)
+{
+	/* With IFF_VNET_HDR, tun fails reads too short for the header.
+	 * BSD tun devices drop whatever of the packet does not fit.
+	 */
+	char buf[sizeof(struct virtio_net_hdr)];
+	int i;
+
+	for (i = 0; i < netdev->num_queues; ++i) {
+		while (read(netdev->queue_fds[i], buf, sizeof(buf)) >= 0 ||
+		       errno == EINTR)
+			;
+		if (errno != EAGAIN)
+			die_perror("tun read()");
+	}
+}
+
+const char *local_netdev_name(struct netdev *a_netdev)
+{
+	return to_local_netdev(a_netdev)->name;
+}
+
+void local_netdev_reset(struct netdev *a_netdev, struct config *config)
+{
+	struct local_netdev *netdev = to_local_netdev(a_netdev);
+
+	check_remote_address(config, netdev);
+	if (config->vnet_hdr != netdev->vnet_hdr)
+		die("--vnet_hdr must match the tun device's setup\n");
+	if (config->tun_queues != netdev->num_queues)
+		die("--tun_queues must match the tun device's setup\n");
+	drain_device(netdev);
+
+	if (config->speed != TUN_DRIVER_SPEED_CUR &&
+	    config->speed != netdev->speed) {
+		set_device_speed(netdev, config->speed);
+		netdev->speed = config->speed;
+	}
+	if (config->mtu != netdev->mtu) {
+		set_device_mtu(netdev, config->mtu);
+		netdev->mtu = config->mtu;
+	}
+
+	/* Both are no-ops if the script uses the same addresses as the
+	 * last one, as is typical.
+	 */
+	set_up_device_addresses(config, netdev);
+	route_traffic_to_device(config, netdev);
+
+	/* A fresh packet socket, so we start with no stale packets and
+	 * with our own (not an ancestor process's) view of its ring.
+	 */
+	if (netdev->sniffer != NULL) {
+		sniffer_free(netdev->sniffer);
+		netdev->sniffer = NULL;
+	}
+	packet_socket_free(netdev->psock);
+	netdev->psock = packet_socket_new(netdev->name, netdev->vnet_hdr);
+
+	if (netdev->queue_sampler != NULL)
+		queue_sampler_reset(netdev->queue_sampler);
+	else if (config->queue_stats_usecs > 0)
+		netdev->queue_sampler = queue_sampler_new(
+			netdev->index, config->queue_stats_usecs);
+}
+
 static void local_netdev_free(struct netdev *a_netdev)
 {
 	struct local_netdev *netdev = to_local_netdev(a_netdev);
+	int i;
 
+	if (netdev->queue_sampler)
+		queue_sampler_free(netdev->queue_sampler);
+	if (netdev->sniffer)
+		sniffer_free(netdev->sniffer);
 	if (netdev->psock)
 		packet_socket_free(netdev->psock);
+	for (i = 1; i < netdev->num_queues; ++i)
+		close(netdev->queue_fds[i]);
 	if (netdev->tun_fd >= 0)
 		close(netdev->tun_fd);
 	if (netdev->ipv4_control_fd >= 0)
@@ -328,14 +585,143 @@ static void bsd_tun_write(struct local_netdev *netdev,
 	if (writev(netdev->tun_fd, vector, ARRAY_SIZE(vector)) < 0)
 		die_perror("BSD tun write()");
 }
+
+/* How many packets of a train bsd_tun_write_batch() sets up at once. */
+#define BSD_TUN_BATCH	64
+
+/* A BSD tun device also takes one packet per write(), so for a train
+ * we set up the tunnel headers and iovecs of a whole chunk of it
+ * first, and then the writes go back to back with nothing else
+ * between them.
+ */
+static void bsd_tun_write_batch(struct local_netdev *netdev,
+				struct packet **packets, int num_packets)
+{
+	int address_families[BSD_TUN_BATCH];
+	struct iovec vectors[BSD_TUN_BATCH][2];
+	int i, chunk;
+
+	while (num_packets > 0) {
+		chunk = min(num_packets, BSD_TUN_BATCH);
+		for (i = 0; i < chunk; ++i) {
+			address_families[i] =
+				htonl(packet_address_family(packets[i]));
+			vectors[i][0].iov_base = &address_families[i];
+			vectors[i][0].iov_len = sizeof(address_families[i]);
+			vectors[i][1].iov_base = packet_start(packets[i]);
+			vectors[i][1].iov_len = packets[i]->ip_bytes;
+		}
+		for (i = 0; i < chunk; ++i) {
+			if (writev(netdev->tun_fd, vectors[i],
+				   ARRAY_SIZE(vectors[i])) < 0)
+				die_perror("BSD tun write()");
+		}
+		packets += chunk;
+		num_packets -= chunk;
+	}
+}
 #endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
 
 #ifdef linux
+/* Return the tun queue on which to inject the given packet. Like a
+ * NIC's RSS, we hash the TCP/UDP ports, so each flow (e.g. each MPTCP
+ * subflow) keeps to one queue.
+ */
+static int tun_queue_fd(struct local_netdev *netdev,
+			const struct packet *packet)
+{
+	u32 ports = 0, hash = 0;
+
+	if (netdev->num_queues == 1)
+		return netdev->tun_fd;
+	if (packet->tcp != NULL)
+		ports = ((u32)packet->tcp->src_port << 16) |
+			packet->tcp->dst_port;
+	else if (packet->udp != NULL)
+		ports = ((u32)packet->udp->src_port << 16) |
+			packet->udp->dst_port;
+	MurmurHash3_x86_32(&ports, sizeof(ports), 0, &hash);
+	return netdev->queue_fds[hash % netdev->num_queues];
+}
+
+/* The kernel only takes a UDP GSO super-packet with its checksum left
+ * for it to finish, segment by segment, so we write a copy of the
+ * packet's headers whose UDP checksum field holds just the sum of the
+ * pseudo-header, and point the vnet header at that field. Returns the
+ * bytes of headers copied.
+ */
+static int udp_gso_headers(struct packet *packet,
+			   struct virtio_net_hdr *vnet, u8 *headers)
+{
+	u8 *start = packet_start(packet);
+	int udp_offset = (u8 *)packet->udp - start;
+	u16 udp_len = ntohs(packet->udp->len);
+	struct udp *udp = (struct udp *)(headers + udp_offset);
+
+	memcpy(headers, start, udp_offset + sizeof(struct udp));
+	if (packet->ipv4 != NULL)
+		udp->check = tcp_udp_v4_pseudo_checksum(packet->ipv4->src_ip,
+							packet->ipv4->dst_ip,
+							IPPROTO_UDP, udp_len);
+	else
+		udp->check = tcp_udp_v6_pseudo_checksum(&packet->ipv6->src_ip,
+							&packet->ipv6->dst_ip,
+							IPPROTO_UDP, udp_len);
+	vnet->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+	vnet->gso_type = VIRTIO_NET_HDR_GSO_UDP_L4;
+	vnet->csum_start = udp_offset;
+	vnet->csum_offset = offsetof(struct udp, check);
+	return udp_offset + sizeof(struct udp);
+}
+
+/* With IFF_VNET_HDR, each packet we write starts with a virtio_net_hdr
+ * saying whether it is a GSO super-packet, i.e. a GRO-style aggregate
+ * of segments with gso_size bytes of payload each. TCP checksums are
+ * already complete, so we never ask the kernel to fill them in.
+ */
 static void linux_tun_write(struct local_netdev *netdev,
 			    struct packet *packet)
 {
-	if (write(netdev->tun_fd, packet_start(packet), packet->ip_bytes) < 0)
-		die_perror("Linux tun write()");
+	int fd = tun_queue_fd(netdev, packet);
+	struct virtio_net_hdr vnet;
+	u8 headers[PACKET_MAX_HEADER_BYTES];
+	struct iovec vector[3] = {
+		{ &vnet, sizeof(vnet) },
+		{ packet_start(packet), packet->ip_bytes },
+		{ NULL, 0 }
+	};
+	int num_vectors = 2, header_bytes = 0;
+
+	if (!netdev->vnet_hdr) {
+		if (packet->gso_size != 0)
+			die("GSO packets need --vnet_hdr\n");
+		if (write(fd, packet_start(packet), packet->ip_bytes) < 0)
+			die_perror("Linux tun write()");
+		return;
+	}
+
+	memset(&vnet, 0, sizeof(vnet));
+	vnet.gso_type = VIRTIO_NET_HDR_GSO_NONE;
+	if (packet->gso_size != 0 && packet->udp != NULL) {
+		header_bytes = udp_gso_headers(packet, &vnet, headers);
+		vnet.gso_size = packet->gso_size;
+		vnet.hdr_len = header_bytes;
+		vector[1].iov_base = headers;
+		vector[1].iov_len = header_bytes;
+		vector[2].iov_base = packet_start(packet) + header_bytes;
+		vector[2].iov_len = packet->ip_bytes - header_bytes;
+		num_vectors = 3;
+	} else if (packet->gso_size != 0) {
+		assert(packet->tcp != NULL);
+		vnet.gso_type = (packet->ipv4 != NULL) ?
+			VIRTIO_NET_HDR_GSO_TCPV4 : VIRTIO_NET_HDR_GSO_TCPV6;
+		if (packet->tcp->cwr)
+			vnet.gso_type |= VIRTIO_NET_HDR_GSO_ECN;
+		vnet.gso_size = packet->gso_size;
+		vnet.hdr_len = packet_payload(packet) - packet_start(packet);
+	}
+	if (writev(fd, vector, num_vectors) < 0)
+		die_perror("Linux tun writev()");
 }
 #endif  /* linux */
 
@@ -363,34 +749,34 @@ static int local_netdev_send(struct netdev *a_netdev,
 	return STATUS_OK;
 }
 
-/* Read the given number of packets out of the tun device. We read
- * these packets so that the kernel can exercise its normal code paths
- * for packet transmit completion, since this code path may feed back
- * to TCP behavior; e.g., see the Linux patch "tcp: avoid retransmits
- * of TCP packets hanging in host queues".  We don't need to actually
- * need the packet contents, but on Linux we need to read at least 1
- * byte of packet data to consume the packet.
+/* Write a train of packets with nothing but the writes in between, so
+ * the kernel sees them arrive as close to back to back as a tun device
+ * allows: it only takes one packet per write(), so we cannot do
+ * better than one system call each.
  */
-static void local_netdev_read_queue(struct local_netdev *netdev,
-				    int num_packets)
+static int local_netdev_send_batch(struct netdev *a_netdev,
+				   struct packet **packets, int num_packets)
 {
-	char buf[1];
-	int i = 0, in_bytes = 0;
+	struct local_netdev *netdev = to_local_netdev(a_netdev);
+#ifdef linux
+	int i;
+#endif  /* linux */
 
-	for (i = 0; i < num_packets; ++i) {
-		in_bytes = read(netdev->tun_fd, buf, sizeof(buf));
-		assert(in_bytes <= (int)sizeof(buf));
+	DEBUGP("local_netdev_send_batch: %d packets\n", num_packets);
 
-		if (in_bytes < 0) {
-			if (errno == EINTR)
-				continue;
-			else
-				die_perror("tun read()");
-		}
-       }
+#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+	bsd_tun_write_batch(netdev, packets, num_packets);
+#endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
+
+#ifdef linux
+	for (i = 0; i < num_packets; ++i)
+		linux_tun_write(netdev, packets[i]);
+#endif  /* linux */
+	return STATUS_OK;
 }
 
 static int local_netdev_receive(struct netdev *a_netdev,
+				struct packet_pool *pool,
 				struct packet **packet, char **error)
 {
 	struct local_netdev *netdev = to_local_netdev(a_netdev);
@@ -399,41 +785,123 @@ static int local_netdev_receive(struct netdev *a_netdev,
 
 	DEBUGP("local_netdev_receive\n");
 
-	status = netdev_receive_loop(netdev->psock, PACKET_LAYER_3_IP,
-				     DIRECTION_OUTBOUND, packet, &num_packets,
-				     error);
-	local_netdev_read_queue(netdev, num_packets);
+	/* Start sniffing ahead on first use, in the process that runs the
+	 * script, rather than in local_netdev_new(): a daemon parent that
+	 * forks script runners never receives, so never gets a thread.
+	 */
+	if (netdev->sniffer == NULL)
+		netdev->sniffer = sniffer_new(netdev->psock, PACKET_LAYER_3_IP,
+					      DIRECTION_OUTBOUND);
+
+	status = sniffer_receive(netdev->sniffer, packet, &num_packets, error);
+	drain_device(netdev);
+	return status;
+}
+
+static int local_netdev_receive_until(struct netdev *a_netdev,
+				      struct packet_pool *pool,
+				      s64 deadline_usecs,
+				      struct packet **packet, char **error)
+{
+	struct local_netdev *netdev = to_local_netdev(a_netdev);
+	int status = STATUS_ERR;
+	int num_packets = 0;
+
+	DEBUGP("local_netdev_receive_until\n");
+
+	if (netdev->sniffer == NULL)
+		netdev->sniffer = sniffer_new(netdev->psock, PACKET_LAYER_3_IP,
+					      DIRECTION_OUTBOUND);
+
+	status = sniffer_receive_until(netdev->sniffer,
+				       deadline_usecs * 1000, packet,
+				       &num_packets, error);
+	drain_device(netdev);
 	return status;
 }
 
+static void local_netdev_set_sniff_ports(struct netdev *a_netdev,
+					 const __be16 *ports, int num_ports)
+{
+	struct local_netdev *netdev = to_local_netdev(a_netdev);
+
+	packet_socket_set_port_filter(netdev->psock, ports, num_ports);
+}
+
+/* Make the given read packet ready to read the next packet into. */
+static void reset_read_packet(struct packet *packet)
+{
+	u8 *buffer = packet->buffer;
+	u32 buffer_bytes = packet->buffer_bytes;
+
+	memset(packet, 0, sizeof(*packet));
+	packet->buffer = buffer;
+	packet->buffer_bytes = buffer_bytes;
+}
+
+int netdev_receive_until(struct netdev *netdev, struct packet_pool *pool,
+			 s64 deadline_usecs, struct packet **packet,
+			 char **error)
+{
+	if (netdev->ops->receive_until == NULL) {
+		asprintf(error, "this netdev cannot sniff with a timeout");
+		return STATUS_ERR;
+	}
+	return netdev->ops->receive_until(netdev, pool, deadline_usecs,
+					  packet, error);
+}
+
+/* Frames are read into the packet socket's PACKET_READ_BYTES read
+ * packet, or with a ring are parsed in the ring frame the socket lends
+ * it, and only those we return are copied, into a buffer the size of
+ * the frame (or the pool's, if it fits), since most are pure ACKs and
+ * pinning 64KB apiece under --mlock would be a waste.
+ */
 int netdev_receive_loop(struct packet_socket *psock,
+			struct packet_pool *pool,
 			enum packet_layer_t layer,
 			enum direction_t direction,
 			struct packet **packet,
 			int *num_packets,
 			char **error)
 {
+	struct packet *read_packet = packet_socket_read_packet(psock);
+
 	assert(*packet == NULL);	/* should be no packet yet */
 
 	*num_packets = 0;
 	while (1) {
 		int in_bytes = 0;
 		enum packet_parse_result_t result;
+		struct packet_ports ports;
 
-		*packet = packet_new(PACKET_READ_BYTES);
+		packet_socket_return_frame(psock, read_packet);
+		reset_read_packet(read_packet);
 
 		/* Sniff the next outbound packet from the kernel under test. */
-		if (packet_socket_receive(psock, direction, *packet, &in_bytes))
-			continue;
+		if (packet_socket_receive(psock, direction, read_packet,
+					  &in_bytes))
+			continue;	/* retry, reusing the same packet */
 
 		++*num_packets;
-		result = parse_packet(*packet, in_bytes, layer, error);
+
+		/* Past NETDEV_MAX_SNIFF_PORTS the kernel hands us every
+		 * packet, so look at just enough of the headers to drop those
+		 * to ports we have no socket for before the full parse.
+		 */
+		if (peek_packet_ports(read_packet->buffer, in_bytes, layer,
+				      &ports) &&
+		    !packet_socket_wants_port(psock, ports.dst_port))
+			continue;
+
+		result = parse_packet(read_packet, in_bytes, layer, error);
 
 		if (result == PACKET_OK)
-			return STATUS_OK;
+			*packet = packet_pool_copy(pool, read_packet);
+		packet_socket_return_frame(psock, read_packet);
 
-		packet_free(*packet);
-		*packet = NULL;
+		if (result == PACKET_OK)
+			return STATUS_OK;
 
 		if (result == PACKET_BAD)
 			return STATUS_ERR;
@@ -446,8 +914,25 @@ int netdev_receive_loop(struct packet_socket *psock,
 	return STATUS_ERR;	/* not reached */
 }
 
+static int local_netdev_queue_summary(struct netdev *a_netdev,
+				      s64 start_usecs, s64 end_usecs,
+				      struct queue_summary *summary)
+{
+	struct local_netdev *netdev = to_local_netdev(a_netdev);
+
+	if (netdev->queue_sampler == NULL)
+		return STATUS_ERR;
+	queue_sampler_summary(netdev->queue_sampler, start_usecs, end_usecs,
+			      summary);
+	return STATUS_OK;
+}
+
 struct netdev_ops local_netdev_ops = {
 	.free = local_netdev_free,
 	.send = local_netdev_send,
+	.send_batch = local_netdev_send_batch,
 	.receive = local_netdev_receive,
+	.receive_until = local_netdev_receive_until,
+	.set_sniff_ports = local_netdev_set_sniff_ports,
+	.queue_summary = local_netdev_queue_summary,
 };
@@ -32,6 +32,7 @@
 #include "packet.h"
 #include "packet_parser.h"
 #include "packet_socket.h"
+#include "queue_stats.h"
 
 struct netdev_ops;
 
@@ -48,14 +49,48 @@ struct netdev_ops {
 	int (*send)(struct netdev *netdev,
 		    struct packet *packet);
 
+	/* Optional: send the given packets back to back, as one train.
+	 * Return STATUS_OK on success or STATUS_ERR on failure.
+	 */
+	int (*send_batch)(struct netdev *netdev,
+			  struct packet **packets, int num_packets);
+
 	/* Sniff the next TCP/IP packet leaving the kernel and return a
-	 * pointer to the newly-allocated packet. Caller must free the packet
-	 * with packet_free().
+	 * pointer to a packet newly allocated from the given pool. Caller
+	 * must free the packet with packet_free().
 	 */
-	int (*receive)(struct netdev *netdev,
+	int (*receive)(struct netdev *netdev, struct packet_pool *pool,
 		       struct packet **packet, char **error);
+
+	/* Optional: like receive, but give up at deadline_usecs on the
+	 * now_usecs() clock, returning STATUS_OK with *packet left NULL
+	 * if no packet came by then.
+	 */
+	int (*receive_until)(struct netdev *netdev, struct packet_pool *pool,
+			     s64 deadline_usecs, struct packet **packet,
+			     char **error);
+
+	/* Optional: drop sniffed TCP and UDP packets whose destination
+	 * port (in network byte order) is not one of the given ones, or
+	 * stop dropping any if num_ports is negative. The kernel does the
+	 * dropping for up to NETDEV_MAX_SNIFF_PORTS ports, and user space,
+	 * before parsing the packet, for more.
+	 */
+	void (*set_sniff_ports)(struct netdev *netdev,
+				const __be16 *ports, int num_ports);
+
+	/* Optional: summarize the queues in front of the device between
+	 * the given now_usecs() times, if they are being sampled.
+	 * Return STATUS_OK on success or STATUS_ERR if not.
+	 */
+	int (*queue_summary)(struct netdev *netdev,
+			     s64 start_usecs, s64 end_usecs,
+			     struct queue_summary *summary);
 };
 
+/* Most ports netdevs have the kernel filter sniffed packets on. */
+#define NETDEV_MAX_SNIFF_PORTS	64
+
 
 /* Tear down a netdev and free up the resources it has allocated. */
 static inline void netdev_free(struct netdev *netdev)
@@ -70,23 +105,79 @@ static inline int netdev_send(struct netdev *netdev,
 	return netdev->ops->send(netdev, packet);
 }
 
+/* Send the given packets to the kernel under test as close together
+ * as the netdev can manage; by default, one netdev_send() at a time.
+ * Return STATUS_OK on success or STATUS_ERR on failure.
+ */
+static inline int netdev_send_batch(struct netdev *netdev,
+				    struct packet **packets, int num_packets)
+{
+	int i;
+
+	if (netdev->ops->send_batch != NULL)
+		return netdev->ops->send_batch(netdev, packets, num_packets);
+	for (i = 0; i < num_packets; ++i) {
+		if (netdev_send(netdev, packets[i]))
+			return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
 /* Sniff the next TCP/IP packet leaving the kernel and return a
- * pointer to the newly-allocated packet. Caller must free the packet
- * with packet_free().
+ * pointer to a packet newly allocated from the given pool. Caller
+ * must free the packet with packet_free().
  */
 static inline int netdev_receive(struct netdev *netdev,
+				 struct packet_pool *pool,
 				 struct packet **packet,
 				 char **error)
 {
-	return netdev->ops->receive(netdev, packet, error);
+	return netdev->ops->receive(netdev, pool, packet, error);
+}
+
+/* Sniff the next TCP/IP packet leaving the kernel, as with
+ * netdev_receive(), if one comes by deadline_usecs on the now_usecs()
+ * clock; if none does, return STATUS_OK with *packet left NULL. Return
+ * STATUS_ERR and fill in *error if the netdev cannot give up waiting.
+ */
+extern int netdev_receive_until(struct netdev *netdev,
+				struct packet_pool *pool,
+				s64 deadline_usecs,
+				struct packet **packet,
+				char **error);
+
+/* Restrict sniffed TCP and UDP packets to the given destination ports,
+ * if the netdev supports that.
+ */
+static inline void netdev_set_sniff_ports(struct netdev *netdev,
+					  const __be16 *ports, int num_ports)
+{
+	if (netdev->ops->set_sniff_ports != NULL)
+		netdev->ops->set_sniff_ports(netdev, ports, num_ports);
+}
+
+/* Summarize the queues in front of the device between the given
+ * now_usecs() times. Return STATUS_OK on success, or STATUS_ERR if the
+ * netdev does not sample its queues (see --queue_stats).
+ */
+static inline int netdev_queue_summary(struct netdev *netdev,
+				       s64 start_usecs, s64 end_usecs,
+				       struct queue_summary *summary)
+{
+	if (netdev->ops->queue_summary == NULL)
+		return STATUS_ERR;
+	return netdev->ops->queue_summary(netdev, start_usecs, end_usecs,
+					  summary);
 }
 
 
 /* Keep sniffing packets leaving the kernel until we see one we know
- * about and can parse. Return a pointer to the newly-allocated
- * packet. Caller must free the packet with packet_free().
+ * about and can parse. Return a pointer to a packet newly allocated
+ * from the given pool, or with packet_new() if pool is NULL. Caller
+ * must free the packet with packet_free().
  */
 extern int netdev_receive_loop(struct packet_socket *psock,
+			       struct packet_pool *pool,
 			       enum packet_layer_t layer,
 			       enum direction_t direction,
 			       struct packet **packet,
@@ -96,4 +187,14 @@ extern int netdev_receive_loop(struct packet_socket *psock,
 /* Allocate and return a new netdev for purely local tests. */
 extern struct netdev *local_netdev_new(struct config *config);
 
+/* Prepare a netdev from local_netdev_new() to run another script with
+ * the given config: drop queued packets, apply the script's speed,
+ * MTU, local address and route if they differ, and reopen the packet
+ * socket. Much cheaper than creating a new device.
+ */
+extern void local_netdev_reset(struct netdev *netdev, struct config *config);
+
+/* Return the interface name of a netdev from local_netdev_new(). */
+extern const char *local_netdev_name(struct netdev *netdev);
+
 #endif /* __PACKET_NETDEV_H__ */
@@ -0,0 +1,545 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation for configuring links, addresses and routes over
+ * rtnetlink.
+ */
+
+#include "netlink.h"
+
+#ifdef linux
+
+#include <assert.h>
+#include <errno.h>
+#include <linux/gen_stats.h>
+#include <linux/genetlink.h>
+#include <linux/mptcp.h>
+#include <linux/netlink.h>
+#include <linux/pkt_sched.h>
+#include <linux/rtnetlink.h>
+#include <linux/tcp_metrics.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "logging.h"
+
+/* A request message: header, family-specific body, then attributes. */
+struct netlink_request {
+	struct nlmsghdr hdr;
+	union {
+		struct ifinfomsg ifi;
+		struct ifaddrmsg ifa;
+		struct rtmsg rtm;
+		struct tcmsg tcm;
+		struct genlmsghdr genl;
+	};
+	char attributes[256];
+};
+
+static void netlink_request_init(struct netlink_request *req, u16 type,
+				 u16 flags, size_t body_len)
+{
+	memset(req, 0, sizeof(*req));
+	req->hdr.nlmsg_len = NLMSG_LENGTH(body_len);
+	req->hdr.nlmsg_type = type;
+	req->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	req->hdr.nlmsg_seq = 1;
+}
+
+/* Append an attribute to the request. */
+static void add_attribute(struct netlink_request *req, u16 type,
+			  const void *data, int len)
+{
+	struct rtattr *rta;
+	int new_len = NLMSG_ALIGN(req->hdr.nlmsg_len) + RTA_SPACE(len);
+
+	assert(new_len <= sizeof(*req));
+	rta = (struct rtattr *)((char *)req + NLMSG_ALIGN(req->hdr.nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+	req->hdr.nlmsg_len = new_len;
+}
+
+/* Handles a reply message to a request, before its ACK. */
+typedef void (*netlink_reply_fn)(const struct nlmsghdr *hdr, void *arg);
+
+/* Send the request on a socket of the given netlink protocol, pass any
+ * replies to on_reply (if non-NULL), and wait for the kernel's ACK or
+ * error.
+ */
+static int netlink_talk_protocol(int protocol, struct netlink_request *req,
+				 netlink_reply_fn on_reply, void *arg,
+				 char **error)
+{
+	struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+	char reply[4096];
+	int fd, result = STATUS_ERR;
+	ssize_t len;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+	if (fd < 0) {
+		asprintf(error, "netlink socket: %s", strerror(errno));
+		return STATUS_ERR;
+	}
+
+	if (sendto(fd, req, req->hdr.nlmsg_len, 0,
+		   (struct sockaddr *)&kernel, sizeof(kernel)) < 0) {
+		asprintf(error, "netlink sendto: %s", strerror(errno));
+		goto out;
+	}
+
+	for (;;) {
+		struct nlmsghdr *hdr;
+
+		len = recv(fd, reply, sizeof(reply), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			asprintf(error, "netlink recv: %s", strerror(errno));
+			goto out;
+		}
+		for (hdr = (struct nlmsghdr *)reply; NLMSG_OK(hdr, len);
+		     hdr = NLMSG_NEXT(hdr, len)) {
+			struct nlmsgerr *err;
+
+			if (hdr->nlmsg_seq != req->hdr.nlmsg_seq)
+				continue;
+			if (hdr->nlmsg_type == NLMSG_DONE) {
+				result = STATUS_OK;	/* end of a dump */
+				goto out;
+			}
+			if (hdr->nlmsg_type != NLMSG_ERROR) {
+				if (on_reply != NULL)
+					on_reply(hdr, arg);
+				continue;
+			}
+			err = NLMSG_DATA(hdr);
+			if (err->error == 0)
+				result = STATUS_OK;
+			else
+				asprintf(error, "%s", strerror(-err->error));
+			goto out;
+		}
+	}
+
+out:
+	close(fd);
+	return result;
+}
+
+/* Send the rtnetlink request and wait for the kernel's ACK or error. */
+static int netlink_talk(struct netlink_request *req, char **error)
+{
+	return netlink_talk_protocol(NETLINK_ROUTE, req, NULL, NULL, error);
+}
+
+static int netlink_set_link(int ifindex, u32 flags, u32 change, int mtu,
+			    char **error)
+{
+	struct netlink_request req;
+
+	netlink_request_init(&req, RTM_NEWLINK, 0, sizeof(req.ifi));
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifindex;
+	req.ifi.ifi_flags = flags;
+	req.ifi.ifi_change = change;
+	if (mtu > 0)
+		add_attribute(&req, IFLA_MTU, &mtu, sizeof(mtu));
+	return netlink_talk(&req, error);
+}
+
+int netlink_set_link_up(int ifindex, bool up, char **error)
+{
+	return netlink_set_link(ifindex, up ? IFF_UP : 0, IFF_UP, 0, error);
+}
+
+int netlink_set_link_mtu(int ifindex, int mtu, char **error)
+{
+	return netlink_set_link(ifindex, 0, 0, mtu, error);
+}
+
+int netlink_set_link_xdp(int ifindex, int prog_fd, char **error)
+{
+	struct netlink_request req;
+	struct {
+		struct rtattr fd_rta;
+		int fd;
+		struct rtattr flags_rta;
+		u32 flags;
+	} xdp;
+
+	/* The IFLA_XDP attribute nests the fd and flags attributes. */
+	memset(&xdp, 0, sizeof(xdp));
+	xdp.fd_rta.rta_type = IFLA_XDP_FD;
+	xdp.fd_rta.rta_len = RTA_LENGTH(sizeof(xdp.fd));
+	xdp.fd = prog_fd;
+	xdp.flags_rta.rta_type = IFLA_XDP_FLAGS;
+	xdp.flags_rta.rta_len = RTA_LENGTH(sizeof(xdp.flags));
+	xdp.flags = (prog_fd >= 0) ? XDP_FLAGS_UPDATE_IF_NOEXIST : 0;
+
+	netlink_request_init(&req, RTM_NEWLINK, 0, sizeof(req.ifi));
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifindex;
+	add_attribute(&req, IFLA_XDP | NLA_F_NESTED, &xdp, sizeof(xdp));
+	return netlink_talk(&req, error);
+}
+
+int netlink_change_address(bool add, int ifindex,
+			   const struct ip_address *ip, int prefix_len,
+			   char **error)
+{
+	struct netlink_request req;
+	int len = ip_address_length(ip->address_family);
+
+	netlink_request_init(&req, add ? RTM_NEWADDR : RTM_DELADDR,
+			     add ? NLM_F_CREATE | NLM_F_EXCL : 0,
+			     sizeof(req.ifa));
+	req.ifa.ifa_family = ip->address_family;
+	req.ifa.ifa_prefixlen = prefix_len;
+	req.ifa.ifa_index = ifindex;
+	if (ip->address_family == AF_INET6)
+		req.ifa.ifa_flags = IFA_F_NODAD;
+	add_attribute(&req, IFA_LOCAL, &ip->ip, len);
+	add_attribute(&req, IFA_ADDRESS, &ip->ip, len);
+	return netlink_talk(&req, error);
+}
+
+int netlink_replace_route(int ifindex, const struct ip_prefix *prefix,
+			  const struct ip_address *gateway, char **error)
+{
+	struct netlink_request req;
+	int len = ip_address_length(prefix->ip.address_family);
+
+	netlink_request_init(&req, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE,
+			     sizeof(req.rtm));
+	req.rtm.rtm_family = prefix->ip.address_family;
+	req.rtm.rtm_dst_len = prefix->prefix_len;
+	req.rtm.rtm_table = RT_TABLE_MAIN;
+	req.rtm.rtm_protocol = RTPROT_BOOT;
+	req.rtm.rtm_scope = RT_SCOPE_UNIVERSE;
+	req.rtm.rtm_type = RTN_UNICAST;
+	add_attribute(&req, RTA_DST, &prefix->ip.ip, len);
+	add_attribute(&req, RTA_OIF, &ifindex, sizeof(ifindex));
+	if (gateway->address_family == prefix->ip.address_family)
+		add_attribute(&req, RTA_GATEWAY, &gateway->ip, len);
+	return netlink_talk(&req, error);
+}
+
+/* A generic netlink family, whose id we look up on first use. */
+struct genl_family {
+	const char *name;
+	u8 version;
+	int id;			/* 0 until we know it */
+};
+
+static struct genl_family tcp_metrics_family = {
+	TCP_METRICS_GENL_NAME, TCP_METRICS_GENL_VERSION, 0
+};
+static struct genl_family mptcp_pm_family = {
+	MPTCP_PM_NAME, MPTCP_PM_VER, 0
+};
+
+/* For netlink_get_queue_stats(): the link whose root qdisc we want,
+ * and where to put what we find.
+ */
+struct queue_stats_request {
+	int ifindex;
+	struct netlink_queue_stats *stats;
+};
+
+/* Pick the counters of the link's root qdisc out of a qdisc dump,
+ * which may hold the qdiscs of every link.
+ */
+static void on_qdisc_reply(const struct nlmsghdr *hdr, void *arg)
+{
+	const struct queue_stats_request *request = arg;
+	struct netlink_queue_stats *stats = request->stats;
+	const struct tcmsg *tcm = NLMSG_DATA(hdr);
+	const struct rtattr *rta, *nested;
+	int len = hdr->nlmsg_len - NLMSG_LENGTH(sizeof(*tcm));
+	int nested_len;
+
+	if (hdr->nlmsg_type != RTM_NEWQDISC ||
+	    tcm->tcm_ifindex != request->ifindex ||
+	    tcm->tcm_parent != TC_H_ROOT)
+		return;
+	for (rta = TCA_RTA(tcm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == TCA_KIND) {
+			snprintf(stats->qdisc_kind, sizeof(stats->qdisc_kind),
+				 "%.*s", (int)RTA_PAYLOAD(rta),
+				 (const char *)RTA_DATA(rta));
+			continue;
+		}
+		if (rta->rta_type != TCA_STATS2)
+			continue;
+		nested_len = RTA_PAYLOAD(rta);
+		for (nested = RTA_DATA(rta); RTA_OK(nested, nested_len);
+		     nested = RTA_NEXT(nested, nested_len)) {
+			if (nested->rta_type == TCA_STATS_BASIC) {
+				struct gnet_stats_basic basic;
+
+				memset(&basic, 0, sizeof(basic));
+				memcpy(&basic, RTA_DATA(nested),
+				       min(RTA_PAYLOAD(nested), sizeof(basic)));
+				stats->qdisc_sent_packets = basic.packets;
+			} else if (nested->rta_type == TCA_STATS_QUEUE) {
+				struct gnet_stats_queue queue;
+
+				memset(&queue, 0, sizeof(queue));
+				memcpy(&queue, RTA_DATA(nested),
+				       min(RTA_PAYLOAD(nested), sizeof(queue)));
+				stats->qdisc_packets = queue.qlen;
+				stats->qdisc_bytes = queue.backlog;
+				stats->qdisc_drops = queue.drops;
+				stats->qdisc_requeues = queue.requeues;
+				stats->qdisc_overlimits = queue.overlimits;
+			}
+		}
+	}
+}
+
+/* Pick the transmit counters out of an RTM_GETLINK reply. */
+static void on_link_stats_reply(const struct nlmsghdr *hdr, void *arg)
+{
+	struct netlink_queue_stats *stats = arg;
+	const struct ifinfomsg *ifi = NLMSG_DATA(hdr);
+	const struct rtattr *rta;
+	int len = hdr->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+
+	if (hdr->nlmsg_type != RTM_NEWLINK)
+		return;
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_TXQLEN) {
+			stats->txqlen = *(const u32 *)RTA_DATA(rta);
+		} else if (rta->rta_type == IFLA_STATS64) {
+			struct rtnl_link_stats64 link;
+
+			memset(&link, 0, sizeof(link));
+			memcpy(&link, RTA_DATA(rta),
+			       min(RTA_PAYLOAD(rta), sizeof(link)));
+			stats->tx_packets = link.tx_packets;
+			stats->tx_dropped = link.tx_dropped;
+		}
+	}
+}
+
+int netlink_get_queue_stats(int ifindex, struct netlink_queue_stats *stats,
+			    char **error)
+{
+	struct queue_stats_request request = { ifindex, stats };
+	struct netlink_request req;
+
+	memset(stats, 0, sizeof(*stats));
+	netlink_request_init(&req, RTM_GETQDISC, NLM_F_DUMP, sizeof(req.tcm));
+	req.tcm.tcm_family = AF_UNSPEC;
+	req.tcm.tcm_ifindex = ifindex;
+	if (netlink_talk_protocol(NETLINK_ROUTE, &req, on_qdisc_reply,
+				  &request, error))
+		return STATUS_ERR;
+
+	netlink_request_init(&req, RTM_GETLINK, 0, sizeof(req.ifi));
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifindex;
+	return netlink_talk_protocol(NETLINK_ROUTE, &req, on_link_stats_reply,
+				     stats, error);
+}
+
+/* Return the first attribute of a generic netlink reply, and set *len
+ * to the bytes of attributes.
+ */
+static const struct rtattr *genl_attributes(const struct nlmsghdr *hdr,
+					    int *len)
+{
+	*len = hdr->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	return (const struct rtattr *)((const char *)NLMSG_DATA(hdr) +
+				       GENL_HDRLEN);
+}
+
+/* Pick the family id out of a CTRL_CMD_GETFAMILY reply. */
+static void on_family_reply(const struct nlmsghdr *hdr, void *arg)
+{
+	const struct rtattr *rta;
+	int *id = arg;
+	int len;
+
+	for (rta = genl_attributes(hdr, &len);
+	     RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == CTRL_ATTR_FAMILY_ID)
+			*id = *(const u16 *)RTA_DATA(rta);
+	}
+}
+
+/* Look up the id of the family, unless we already have. The id is
+ * fixed while the family's module stays loaded, so we keep it.
+ */
+static int genl_family_id(struct genl_family *family, char **error)
+{
+	struct netlink_request req;
+	int id = 0;
+
+	if (family->id != 0)
+		return STATUS_OK;
+
+	netlink_request_init(&req, GENL_ID_CTRL, 0, GENL_HDRLEN);
+	req.genl.cmd = CTRL_CMD_GETFAMILY;
+	req.genl.version = 1;
+	add_attribute(&req, CTRL_ATTR_FAMILY_NAME, family->name,
+		      strlen(family->name) + 1);
+	if (netlink_talk_protocol(NETLINK_GENERIC, &req, on_family_reply,
+				  &id, error))
+		return STATUS_ERR;
+	if (id == 0) {
+		asprintf(error, "no id for generic netlink family %s",
+			 family->name);
+		return STATUS_ERR;
+	}
+	family->id = id;
+	return STATUS_OK;
+}
+
+/* Start a request with the given command and flags to the family. */
+static int genl_request_init(struct netlink_request *req,
+			     struct genl_family *family, u8 cmd, u16 flags,
+			     char **error)
+{
+	if (genl_family_id(family, error))
+		return STATUS_ERR;
+	netlink_request_init(req, family->id, flags, GENL_HDRLEN);
+	req->genl.cmd = cmd;
+	req->genl.version = family->version;
+	return STATUS_OK;
+}
+
+/* Send the family a command that has no attributes. */
+static int genl_command(struct genl_family *family, u8 cmd, char **error)
+{
+	struct netlink_request req;
+
+	if (genl_request_init(&req, family, cmd, 0, error))
+		return STATUS_ERR;
+	return netlink_talk_protocol(NETLINK_GENERIC, &req, NULL, NULL,
+				     error);
+}
+
+int netlink_flush_tcp_metrics(char **error)
+{
+	/* A delete that names no address flushes the whole cache. */
+	return genl_command(&tcp_metrics_family, TCP_METRICS_CMD_DEL, error);
+}
+
+int netlink_flush_mptcp_endpoints(char **error)
+{
+	return genl_command(&mptcp_pm_family, MPTCP_PM_CMD_FLUSH_ADDRS, error);
+}
+
+/* Pick the limits out of an MPTCP_PM_CMD_GET_LIMITS reply. */
+static void on_mptcp_limits_reply(const struct nlmsghdr *hdr, void *arg)
+{
+	struct mptcp_pm_config *pm = arg;
+	const struct rtattr *rta;
+	int len;
+
+	for (rta = genl_attributes(hdr, &len);
+	     RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == MPTCP_PM_ATTR_SUBFLOWS)
+			pm->subflows = *(const u32 *)RTA_DATA(rta);
+		else if (rta->rta_type == MPTCP_PM_ATTR_RCV_ADD_ADDRS)
+			pm->rcv_add_addrs = *(const u32 *)RTA_DATA(rta);
+	}
+}
+
+/* Keep the nested address attribute of each MPTCP_PM_CMD_GET_ADDR
+ * reply as it is, to hand back to MPTCP_PM_CMD_ADD_ADDR later.
+ */
+static void on_mptcp_endpoint_reply(const struct nlmsghdr *hdr, void *arg)
+{
+	struct mptcp_pm_config *pm = arg;
+	const struct rtattr *rta;
+	int len;
+
+	for (rta = genl_attributes(hdr, &len);
+	     RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		int attr_len = RTA_PAYLOAD(rta);
+
+		if ((rta->rta_type & NLA_TYPE_MASK) != MPTCP_PM_ATTR_ADDR)
+			continue;
+		if (pm->num_endpoints == MPTCP_PM_MAX_ENDPOINTS ||
+		    attr_len > MPTCP_PM_ENDPOINT_BYTES) {
+			pm->truncated = true;
+			continue;
+		}
+		pm->endpoints[pm->num_endpoints].len = attr_len;
+		memcpy(pm->endpoints[pm->num_endpoints].attr, RTA_DATA(rta),
+		       attr_len);
+		pm->num_endpoints++;
+	}
+}
+
+int netlink_get_mptcp_pm(struct mptcp_pm_config *pm, char **error)
+{
+	struct netlink_request req;
+
+	memset(pm, 0, sizeof(*pm));
+	if (genl_request_init(&req, &mptcp_pm_family,
+			      MPTCP_PM_CMD_GET_LIMITS, 0, error) ||
+	    netlink_talk_protocol(NETLINK_GENERIC, &req,
+				  on_mptcp_limits_reply, pm, error))
+		return STATUS_ERR;
+	if (genl_request_init(&req, &mptcp_pm_family,
+			      MPTCP_PM_CMD_GET_ADDR, NLM_F_DUMP, error) ||
+	    netlink_talk_protocol(NETLINK_GENERIC, &req,
+				  on_mptcp_endpoint_reply, pm, error))
+		return STATUS_ERR;
+	if (pm->truncated) {
+		asprintf(error, "more MPTCP endpoints than we can save");
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+int netlink_set_mptcp_pm(const struct mptcp_pm_config *pm, char **error)
+{
+	struct netlink_request req;
+	int i;
+
+	if (netlink_flush_mptcp_endpoints(error))
+		return STATUS_ERR;
+	for (i = 0; i < pm->num_endpoints; i++) {
+		if (genl_request_init(&req, &mptcp_pm_family,
+				      MPTCP_PM_CMD_ADD_ADDR, 0, error))
+			return STATUS_ERR;
+		add_attribute(&req, MPTCP_PM_ATTR_ADDR | NLA_F_NESTED,
+			      pm->endpoints[i].attr, pm->endpoints[i].len);
+		if (netlink_talk_protocol(NETLINK_GENERIC, &req, NULL, NULL,
+					  error))
+			return STATUS_ERR;
+	}
+	if (genl_request_init(&req, &mptcp_pm_family,
+			      MPTCP_PM_CMD_SET_LIMITS, 0, error))
+		return STATUS_ERR;
+	add_attribute(&req, MPTCP_PM_ATTR_RCV_ADD_ADDRS, &pm->rcv_add_addrs,
+		      sizeof(pm->rcv_add_addrs));
+	add_attribute(&req, MPTCP_PM_ATTR_SUBFLOWS, &pm->subflows,
+		      sizeof(pm->subflows));
+	return netlink_talk_protocol(NETLINK_GENERIC, &req, NULL, NULL,
+				     error);
+}
+
+#endif /* linux */
@@ -0,0 +1,126 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for configuring links, addresses and routes directly over
+ * Linux rtnetlink, and for a few generic netlink operations, rather than
+ * by running ip(8) or ifconfig(8).
+ *
+ * Each call is a synchronous request/ACK exchange on a private
+ * NETLINK_ROUTE socket, so calls are safe from multiple threads. All
+ * calls return STATUS_OK on success, or STATUS_ERR and fill in *error.
+ */
+
+#ifndef __NETLINK_H__
+#define __NETLINK_H__
+
+#include "types.h"
+
+#ifdef linux
+
+#include "ip_address.h"
+#include "ip_prefix.h"
+
+#define MPTCP_PM_MAX_ENDPOINTS	16	/* most endpoints we save */
+#define MPTCP_PM_ENDPOINT_BYTES	64	/* most bytes of one's attributes */
+
+/* The configuration of the in-kernel MPTCP path manager. */
+struct mptcp_pm_config {
+	u32 subflows;			/* most extra subflows */
+	u32 rcv_add_addrs;		/* most ADD_ADDRs accepted */
+	int num_endpoints;
+	struct {
+		int len;
+		u8 attr[MPTCP_PM_ENDPOINT_BYTES];	/* MPTCP_PM_ADDR_ATTR_*
+							 * attributes
+							 */
+	} endpoints[MPTCP_PM_MAX_ENDPOINTS];
+	bool truncated;			/* were there too many to keep? */
+};
+
+/* The transmit queues of a link: its root qdisc, as "tc -s qdisc"
+ * shows it, and the link's own counters. For a tun device, packets
+ * count as transmitted once we read them, and as dropped if its ring
+ * of txqlen packets is full.
+ */
+struct netlink_queue_stats {
+	char qdisc_kind[16];		/* e.g. "fq_codel"; "" for none */
+	u32 qdisc_sent_packets;		/* packets handed to the device */
+	u32 qdisc_packets;		/* packets queued in the qdisc */
+	u32 qdisc_bytes;		/* bytes queued in the qdisc */
+	u32 qdisc_drops;
+	u32 qdisc_requeues;
+	u32 qdisc_overlimits;
+	u64 tx_packets;			/* packets the device sent */
+	u64 tx_dropped;			/* packets the device dropped */
+	u32 txqlen;			/* device queue length */
+};
+
+/* Read the queue statistics of the link with the given index. */
+extern int netlink_get_queue_stats(int ifindex,
+				   struct netlink_queue_stats *stats,
+				   char **error);
+
+/* Set the link with the given index administratively up or down. */
+extern int netlink_set_link_up(int ifindex, bool up, char **error);
+
+/* Set the MTU of the link with the given index. */
+extern int netlink_set_link_mtu(int ifindex, int mtu, char **error);
+
+/* Add (if add is true) or delete the given address and prefix length
+ * on the link with the given index. IPv6 addresses are added with
+ * IFA_F_NODAD, so they are usable at once rather than "tentative".
+ */
+extern int netlink_change_address(bool add, int ifindex,
+				  const struct ip_address *ip,
+				  int prefix_len, char **error);
+
+/* Install a route for the given prefix out the link with the given
+ * index via the given gateway, replacing any existing route for it.
+ */
+extern int netlink_replace_route(int ifindex,
+				 const struct ip_prefix *prefix,
+				 const struct ip_address *gateway,
+				 char **error);
+
+/* Attach the XDP program with the given fd to the link with the given
+ * index, unless it has one already, or detach its program if prog_fd
+ * is -1.
+ */
+extern int netlink_set_link_xdp(int ifindex, int prog_fd, char **error);
+
+/* Flush the kernel's cache of TCP metrics, as "ip tcp_metrics flush"
+ * does, over generic netlink.
+ */
+extern int netlink_flush_tcp_metrics(char **error);
+
+/* Flush the endpoints of the in-kernel MPTCP path manager, as
+ * "ip mptcp endpoint flush" does, over generic netlink.
+ */
+extern int netlink_flush_mptcp_endpoints(char **error);
+
+/* Read the MPTCP path manager's limits and endpoints. */
+extern int netlink_get_mptcp_pm(struct mptcp_pm_config *pm, char **error);
+
+/* Replace the MPTCP path manager's endpoints and limits with those
+ * netlink_get_mptcp_pm() read.
+ */
+extern int netlink_set_mptcp_pm(const struct mptcp_pm_config *pm,
+				char **error);
+
+#endif /* linux */
+
+#endif /* __NETLINK_H__ */
@@ -28,10 +28,13 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include "alloc_stats.h"
+#include "checksum.h"
 #include "ethernet.h"
 #include "gre_packet.h"
 #include "ip_packet.h"
 #include "mpls_packet.h"
+#include "verify_plan.h"
 
 
 /* Info for all types of header we support. */
@@ -47,19 +50,172 @@ struct header_type_info header_types[HEADER_NUM_TYPES] = {
 	{ "ICMPV6", IPPROTO_ICMPV6,	0,		NULL },
 };
 
+/* Allocate a packet and its buffer in one block, the buffer right
+ * after the struct, so the two cost one malloc() and are adjacent in
+ * memory. Only the struct is zeroed.
+ */
+static struct packet *packet_alloc(u32 buffer_bytes)
+{
+	struct packet *packet =
+		tagged_malloc(ALLOC_PACKET, sizeof(*packet) + buffer_bytes);
+
+	memset(packet, 0, sizeof(*packet));
+	packet->buffer = (u8 *)(packet + 1);
+	return packet;
+}
+
 struct packet *packet_new(u32 buffer_bytes)
 {
-	struct packet *packet = calloc(1, sizeof(struct packet));
-	packet->buffer = malloc(buffer_bytes);
+	struct packet *packet = packet_alloc(buffer_bytes);
+
 	packet->buffer_bytes = buffer_bytes;
 	return packet;
 }
 
+/* Bytes each packet of a pool's slab takes, in whole cache lines. */
+static size_t slab_packet_bytes(const struct packet_pool *pool)
+{
+	return (sizeof(struct packet) + pool->buffer_bytes + 63) & ~(size_t)63;
+}
+
+static bool packet_in_slab(const struct packet_pool *pool,
+			   const struct packet *packet)
+{
+	const u8 *start = pool->slab.start;
+
+	return start != NULL && (const u8 *)packet >= start &&
+		(const u8 *)packet < start + pool->slab.bytes;
+}
+
+/* Put a packet allocated from the given pool back on its free list,
+ * or really free it if the free list is full. The slab holds only
+ * max_free packets, so a full list always has one from malloc() that
+ * a packet of the slab can take the place of.
+ */
+static void packet_pool_put(struct packet_pool *pool, struct packet *packet)
+{
+	u8 *buffer = packet->buffer;
+	struct packet *spare;
+	int i;
+
+	assert(pool->in_use > 0);
+	--pool->in_use;
+
+	verify_plan_put(packet->verify_plan);
+	memset(packet, 0, sizeof(*packet));  /* paranoia to help catch bugs */
+	packet->buffer = buffer;
+	if (pool->num_free == pool->max_free) {
+		if (packet_in_slab(pool, packet)) {
+			for (i = 0; packet_in_slab(pool,
+						   pool->free_packets[i]); ++i)
+				;
+			spare = pool->free_packets[i];
+			pool->free_packets[i] = packet;
+			packet = spare;
+		}
+		tagged_free(packet);
+		return;
+	}
+	pool->free_packets[pool->num_free++] = packet;
+}
+
 void packet_free(struct packet *packet)
 {
-	free(packet->buffer);
+	if (packet->release != NULL) {
+		packet->release(packet);
+		return;
+	}
+	if (packet->pool != NULL) {
+		packet_pool_put(packet->pool, packet);
+		return;
+	}
+	verify_plan_put(packet->verify_plan);
 	memset(packet, 0, sizeof(*packet));  /* paranoia to help catch bugs */
-	free(packet);
+	tagged_free(packet);
+}
+
+struct packet_pool *packet_pool_new(u32 buffer_bytes, int max_free)
+{
+	struct packet_pool *pool =
+		tagged_calloc(ALLOC_PACKET, 1, sizeof(struct packet_pool));
+
+	pool->buffer_bytes = buffer_bytes;
+	pool->max_free = max_free;
+	pool->free_packets = tagged_calloc(ALLOC_PACKET, max_free,
+					   sizeof(struct packet *));
+	return pool;
+}
+
+void packet_pool_fill(struct packet_pool *pool, int num_packets)
+{
+	if (num_packets > pool->max_free)
+		num_packets = pool->max_free;
+	while (pool->num_free < num_packets) {
+		struct packet *packet = packet_alloc(pool->buffer_bytes);
+
+		pool->free_packets[pool->num_free++] = packet;
+	}
+}
+
+int packet_pool_map(struct packet_pool *pool, enum hugepages_t hugepages,
+		    char **error)
+{
+	size_t packet_bytes = slab_packet_bytes(pool);
+	struct packet *packet;
+	int i;
+
+	assert(pool->slab.start == NULL);
+	if (hugepage_map(pool->max_free * packet_bytes, hugepages, true,
+			 &pool->slab, error))
+		return STATUS_ERR;
+
+	for (i = 0; i < pool->num_free; ++i)
+		tagged_free(pool->free_packets[i]);
+	for (i = 0; i < pool->max_free; ++i) {
+		packet = (struct packet *)((u8 *)pool->slab.start +
+					   i * packet_bytes);
+		packet->buffer = (u8 *)(packet + 1);
+		pool->free_packets[i] = packet;
+	}
+	pool->num_free = pool->max_free;
+	return STATUS_OK;
+}
+
+void packet_pool_free(struct packet_pool *pool)
+{
+	int i;
+
+	assert(pool->in_use == 0);
+	for (i = 0; i < pool->num_free; ++i) {
+		if (!packet_in_slab(pool, pool->free_packets[i]))
+			tagged_free(pool->free_packets[i]);
+	}
+	hugepage_unmap(&pool->slab);
+	tagged_free(pool->free_packets);
+	memset(pool, 0, sizeof(*pool));  /* paranoia to help catch bugs */
+	tagged_free(pool);
+}
+
+struct packet *packet_pool_get(struct packet_pool *pool, u32 buffer_bytes)
+{
+	struct packet *packet = NULL;
+
+	++pool->num_gets;
+	if (buffer_bytes > pool->buffer_bytes)
+		return packet_new(buffer_bytes);
+
+	if (pool->num_free > 0) {
+		packet = pool->free_packets[--pool->num_free];
+		++pool->num_hits;
+	} else {
+		packet = packet_alloc(pool->buffer_bytes);
+	}
+	packet->buffer_bytes = buffer_bytes;
+	packet->pool = pool;
+
+	if (++pool->in_use > pool->peak_in_use)
+		pool->peak_in_use = pool->in_use;
+	return packet;
 }
 
 int packet_header_count(const struct packet *packet)
@@ -133,16 +289,20 @@ static void *offset_ptr(u8 *old_base, u8* new_base, void *old_ptr)
 /* Make a copy of the given old packet, but in the new copy reserve the
  * given number of bytes of headroom at the start of the packet->buffer.
  * This empty headroom can later be filled with outer packet headers.
+ * The copy is allocated from the given pool, if it is non-NULL.
  * A slow but simple model.
  */
-static struct packet *packet_copy_with_headroom(struct packet *old_packet,
+static struct packet *packet_copy_with_headroom(struct packet_pool *pool,
+						struct packet *old_packet,
 						int bytes_headroom)
 {
 	/* Allocate a new packet and copy link layer header and IP datagram. */
 	const int bytes_used = packet_end(old_packet) - old_packet->buffer;
 	assert(bytes_used >= 0);
 	assert(bytes_used <= 128*1024);
-	struct packet *packet = packet_new(bytes_headroom + bytes_used);
+	struct packet *packet = (pool != NULL) ?
+		packet_pool_get(pool, bytes_headroom + bytes_used) :
+		packet_new(bytes_headroom + bytes_used);
 	u8 *old_base = old_packet->buffer;
 	u8 *new_base = packet->buffer + bytes_headroom;
 
@@ -151,8 +311,12 @@ static struct packet *packet_copy_with_headroom(struct packet *old_packet,
 	packet->ip_bytes	= old_packet->ip_bytes;
 	packet->direction	= old_packet->direction;
 	packet->time_usecs	= old_packet->time_usecs;
+	packet->time_nsecs	= old_packet->time_nsecs;
 	packet->flags		= old_packet->flags;
 	packet->ecn		= old_packet->ecn;
+	packet->gso_size	= old_packet->gso_size;
+	packet->csum_start	= old_packet->csum_start + bytes_headroom;
+	packet->csum_offset	= old_packet->csum_offset;
 	packet->socket_script_fd = old_packet->socket_script_fd;
 
 	packet_copy_headers(packet, old_packet, bytes_headroom);
@@ -170,22 +334,46 @@ static struct packet *packet_copy_with_headroom(struct packet *old_packet,
 	packet->tcp_ts_ecr	= offset_ptr(old_base, new_base,
 					     old_packet->tcp_ts_ecr);
 
+	packet->tcp_options_indexed = old_packet->tcp_options_indexed;
+	memcpy(packet->tcp_option_offset, old_packet->tcp_option_offset,
+	       sizeof(packet->tcp_option_offset));
+	memcpy(packet->mptcp_option_offset, old_packet->mptcp_option_offset,
+	       sizeof(packet->mptcp_option_offset));
+
+	/* A plan holds offsets from the start of the packet, so it only
+	 * fits copies without headroom.
+	 */
+	if (bytes_headroom == 0)
+		packet->verify_plan = verify_plan_get(old_packet->verify_plan);
+	else
+		packet->flags &= ~FLAG_VERIFY_PLANNED;
+
 	return packet;
 }
 
 struct packet *packet_copy(struct packet *old_packet)
 {
-	return packet_copy_with_headroom(old_packet, 0);
+	return packet_copy_with_headroom(old_packet->pool, old_packet, 0);
 }
 
-/* Finalize all the headers once we know what's inside inner layers. */
-static void packet_finish_encapsulation_headers(struct packet *packet)
+struct packet *packet_pool_copy(struct packet_pool *pool,
+				struct packet *old_packet)
+{
+	return packet_copy_with_headroom(pool, old_packet, 0);
+}
+
+/* Finalize the headers from the given layer inward once we know what's
+ * inside inner layers.
+ */
+static void packet_finish_encapsulation_headers(struct packet *packet,
+						int first)
 {
 	int i;
 	struct header *header = NULL, *next = NULL;
 
 	/* Proceed from inner to outer. */
-	for (i = ARRAY_SIZE(packet->headers) - 1; i >= 0; --i, next = header) {
+	for (i = ARRAY_SIZE(packet->headers) - 1; i >= first;
+	     --i, next = header) {
 		struct header_type_info *type_info = NULL;
 
 		header = &packet->headers[i];
@@ -207,7 +395,7 @@ struct packet *packet_encapsulate(struct packet *outer, struct packet *inner)
 	assert(outer_headers + inner_headers <= PACKET_MAX_HEADERS);
 
 	/* Copy the inner packet bits and header metadata. */
-	packet = packet_copy_with_headroom(inner, outer->ip_bytes);
+	packet = packet_copy_with_headroom(NULL, inner, outer->ip_bytes);
 
 	/* Copy over the bits in the outer headers. */
 	memcpy(packet->buffer, outer->buffer, outer->ip_bytes);
@@ -221,13 +409,152 @@ struct packet *packet_encapsulate(struct packet *outer, struct packet *inner)
 
 	assert(packet_header_count(packet) == outer_headers + inner_headers);
 
-	packet_finish_encapsulation_headers(packet);
+	packet_finish_encapsulation_headers(packet, 0);
 
 	packet->ip_bytes = outer->ip_bytes + inner->ip_bytes;
 
 	return packet;
 }
 
+/* Do the template's outer headers, once finished around the given
+ * inner packet, come out as encapsulating it in outer would?
+ */
+static bool encap_template_matches(const struct packet_encap_template *t,
+				   const struct packet *outer,
+				   const struct packet *inner)
+{
+	int i;
+
+	if (outer->ip_bytes != t->ip_bytes ||
+	    packet_header_count(outer) != t->num_headers ||
+	    inner->headers[0].type != t->inner_type)
+		return false;
+	for (i = 0; i < t->num_headers; ++i) {
+		if (outer->headers[i].type != t->headers[i].type ||
+		    outer->headers[i].header_bytes != t->headers[i].header_bytes)
+			return false;
+	}
+	return memcmp(outer->buffer, t->outer, t->ip_bytes) == 0;
+}
+
+/* Record the finished outer headers of a packet that packet_encapsulate()
+ * built from the given outer packet.
+ */
+static struct packet_encap_template *encap_template_new(
+	const struct packet *outer, const struct packet *packet)
+{
+	struct packet_encap_template *t =
+		tagged_calloc(ALLOC_PACKET, 1, sizeof(*t));
+	int i;
+
+	t->ip_bytes = outer->ip_bytes;
+	t->num_headers = packet_header_count(outer);
+	memcpy(t->outer, outer->buffer, outer->ip_bytes);
+	memcpy(t->bytes, packet->buffer, outer->ip_bytes);
+	for (i = 0; i < t->num_headers; ++i) {
+		t->headers[i] = packet->headers[i];
+		t->offsets[i] = packet->headers[i].h.ptr - packet->buffer;
+	}
+	t->inner_type = packet->headers[t->num_headers].type;
+	t->inner_bytes = packet->headers[t->num_headers].total_bytes;
+	return t;
+}
+
+/* Fix up the length field of a finished outer header copied from a
+ * template, and for IPv4 patch its checksum for the new length.
+ */
+static void encap_header_set_length(struct header *header)
+{
+	if (header->type == HEADER_IPV4) {
+		struct ipv4 *ipv4 = header->h.ipv4;
+		__be16 tot_len = htons(header->total_bytes);
+
+		ipv4->check = checksum_update(ipv4->check, &ipv4->tot_len,
+					      &tot_len, sizeof(tot_len));
+		ipv4->tot_len = tot_len;
+	} else if (header->type == HEADER_IPV6) {
+		assert(header->total_bytes - sizeof(struct ipv6) <= 0xffff);
+		header->h.ipv6->payload_len =
+			htons(header->total_bytes - sizeof(struct ipv6));
+	}
+}
+
+/* Encapsulate inner in the template's outer headers: copy them in and
+ * patch their lengths, instead of finishing them anew.
+ */
+static struct packet *encap_template_apply(
+	const struct packet_encap_template *t, struct packet *inner)
+{
+	const int inner_headers = packet_header_count(inner);
+	struct packet *packet = NULL;
+	int delta, i;
+
+	assert(t->num_headers + inner_headers <= PACKET_MAX_HEADERS);
+
+	packet = packet_copy_with_headroom(NULL, inner, t->ip_bytes);
+	memcpy(packet->buffer, t->bytes, t->ip_bytes);
+	memmove(packet->headers + t->num_headers, packet->headers + 0,
+		inner_headers * sizeof(struct header));
+	packet_finish_encapsulation_headers(packet, t->num_headers);
+
+	/* Each outer header grows or shrinks with what it wraps. */
+	delta = packet->headers[t->num_headers].total_bytes - t->inner_bytes;
+	for (i = 0; i < t->num_headers; ++i) {
+		struct header *header = &packet->headers[i];
+
+		*header = t->headers[i];
+		header->h.ptr = packet->buffer + t->offsets[i];
+		header->total_bytes += delta;
+		if (delta != 0)
+			encap_header_set_length(header);
+	}
+
+	packet->ip_bytes = t->ip_bytes + inner->ip_bytes;
+
+	return packet;
+}
+
+struct packet *packet_encapsulate_templated(
+	struct packet_encap_templates *templates,
+	struct packet *outer, struct packet *inner)
+{
+	struct packet *packet = NULL;
+	int i;
+
+	if (packet_header_count(outer) == 0)
+		return packet_encapsulate(outer, inner);
+
+	for (i = 0; i < templates->count; ++i) {
+		if (encap_template_matches(templates->templates[i],
+					   outer, inner))
+			return encap_template_apply(templates->templates[i],
+						    inner);
+	}
+
+	/* A new kind of tunnel: build it the slow way, and remember it,
+	 * evicting the oldest template if we have too many.
+	 */
+	packet = packet_encapsulate(outer, inner);
+	if (templates->count < ARRAY_SIZE(templates->templates)) {
+		i = templates->count++;
+	} else {
+		i = templates->next;
+		templates->next = (i + 1) % ARRAY_SIZE(templates->templates);
+		tagged_free(templates->templates[i]);
+	}
+	templates->templates[i] = encap_template_new(outer, packet);
+	return packet;
+}
+
+void packet_encap_templates_clear(struct packet_encap_templates *templates)
+{
+	int i;
+
+	for (i = 0; i < templates->count; ++i)
+		tagged_free(templates->templates[i]);
+	memset(templates, 0, sizeof(*templates));
+}
+
 struct header_type_info *header_type_info(enum header_t header_type)
 {
 	assert(header_type > HEADER_NONE);
@@ -32,6 +32,7 @@
 #include <sys/time.h>
 #include "gre.h"
 #include "header.h"
+#include "hugepage.h"
 #include "icmp.h"
 #include "icmpv6.h"
 #include "ip.h"
@@ -45,6 +46,9 @@
  */
 #define MAX_TCP_HEADER_BYTES (15*4)
 
+/* Likewise the IPv4 IHL field is 4 bits, in 32-bit words. */
+#define MAX_IPV4_HEADER_BYTES (15*4)
+
 #define MAX_TCP_DATAGRAM_BYTES (64*1024)	/* for sanity-checking */
 #define MAX_UDP_DATAGRAM_BYTES (64*1024)	/* for sanity-checking */
 
@@ -54,31 +58,56 @@
  */
 static const int PACKET_READ_BYTES = 64 * 1024;
 
+/* Bytes of buffer in each pooled packet: enough for a frame of a
+ * 1500-byte MTU, and the headroom to encapsulate it. Bigger packets
+ * get buffers of their own size.
+ */
+static const int PACKET_POOL_BUFFER_BYTES = 2048;
+
 /* Maximum number of headers. */
 #define PACKET_MAX_HEADERS	6
 
 /* Maximum number of bytes of headers. */
 #define PACKET_MAX_HEADER_BYTES	256
 
+/* TCP option kinds and MPTCP option subtypes covered by the option
+ * index in struct packet. Kinds beyond this are found by a linear scan.
+ */
+#define TCP_OPTION_INDEX_KINDS		32
+#define MPTCP_OPTION_INDEX_SUBTYPES	16
+
 /* TCP/UDP/IPv4 packet, including IPv4 header, TCP/UDP header, and data. There
  * may also be a link layer header between the 'buffer' and 'ip'
  * pointers, but we typically ignore that. The 'buffer_bytes' field
  * gives the total space in the buffer, which may be bigger than the
  * actual amount occupied by the packet data.
+ *
+ * The fields the send, sniff and verify paths touch for every packet
+ * come first, so they share the first two cache lines; the header
+ * array, option index and ownership details, used less often, follow.
+ * Unless it is lent to us (see 'release'), the buffer is allocated in
+ * the same block, right after the struct.
  */
 struct packet {
 	u8 *buffer;		/* data buffer: full contents of packet */
 	u32 buffer_bytes;	/* bytes of space in data buffer */
 	u32 l2_header_bytes;	/* bytes in outer hardware/layer-2 header */
 	u32 ip_bytes;		/* bytes in outermost IP hdrs/payload */
-	enum direction_t direction;	/* direction packet is traveling */
-	int socket_script_fd; /* script fd of socket used /to use to send / receive this packet */
 
-	/* Metadata about all the headers in the packet, including all
-	 * layers of encapsulation, from outer to inner, starting from
-	 * the outermost IP header at headers[0].
-	 */
-	struct header headers[PACKET_MAX_HEADERS];
+	u32 flags;		/* various meta-flags */
+#define FLAG_WIN_NOCHECK	0x1  /* don't check TCP receive window */
+#define FLAG_OPTIONS_NOCHECK	0x2  /* don't check TCP options */
+#define FLAG_CHECKSUMMED	0x4  /* checksum_packet() filled checksums */
+#define FLAG_TRAIN		0x8  /* outbound: match the segments that
+				      * together cover this packet's data
+				      */
+#define FLAG_VERIFY_PLANNED	0x10 /* verify_plan compiled, maybe NULL */
+#define FLAG_OPTIONS_RAW	0x20 /* inbound: inject TCP options as given,
+				      * with no mapping to live values
+				      */
+#define FLAG_CSUM_PARTIAL	0x40 /* sniffed: kernel left the layer 4
+				      * checksum for the device to finish
+				      */
 
 	/* The following pointers point into the 'buffer' area. Each
 	 * pointer may be NULL if there is no header of that type
@@ -97,27 +126,131 @@ struct packet {
 	struct icmpv4 *icmpv4;	/* start of ICMPv4 header, if present */
 	struct icmpv6 *icmpv6;	/* start of ICMPv6 header, if present */
 
-	s64 time_usecs;		/* wall time of receive/send if non-zero */
+	__be32 *tcp_ts_val;	/* location of TCP timestamp val, or NULL */
+	__be32 *tcp_ts_ecr;	/* location of TCP timestamp ecr, or NULL */
 
-	u32 flags;		/* various meta-flags */
-#define FLAG_WIN_NOCHECK	0x1  /* don't check TCP receive window */
-#define FLAG_OPTIONS_NOCHECK	0x2  /* don't check TCP options */
+	s64 time_usecs;		/* wall time of receive/send if non-zero */
+	s64 time_nsecs;		/* the same in nanoseconds, if the kernel
+				 * or NIC gave us those; see
+				 * packet_time_nsecs()
+				 */
 
+	enum direction_t direction;	/* direction packet is traveling */
 	enum ip_ecn_t ecn;	/* IPv4/IPv6 ECN treatment for packet */
+	int socket_script_fd; /* script fd of socket used /to use to send / receive this packet */
 
-	__be32 *tcp_ts_val;	/* location of TCP timestamp val, or NULL */
-	__be32 *tcp_ts_ecr;	/* location of TCP timestamp ecr, or NULL */
+	/* For a TCP GSO/GRO super-packet, the payload bytes per segment,
+	 * as carried by the virtio_net_hdr of a tun device or packet
+	 * socket with vnet headers; 0 for an ordinary packet.
+	 */
+	u16 gso_size;
+
+	/* For a sniffed packet with FLAG_CSUM_PARTIAL, where its vnet
+	 * header says the device should start summing, as an offset from
+	 * the start of the buffer, and where from there to put the sum.
+	 */
+	u16 csum_start;
+	u16 csum_offset;
+
+	/* Index of the TCP options, filled in by tcp_options_index():
+	 * offsets from the start of the TCP header to the first option
+	 * of each kind and the first MPTCP option of each subtype, or 0
+	 * if there is none. Being offsets, they stay valid in copies.
+	 */
+	bool tcp_options_indexed;
+	u8 tcp_option_offset[TCP_OPTION_INDEX_KINDS];
+	u8 mptcp_option_offset[MPTCP_OPTION_INDEX_SUBTYPES];
+
+	/* For an outbound script packet, its precompiled verification
+	 * plan (see verify_plan.h), shared by its copies; NULL if it has
+	 * none or it is not compiled yet.
+	 */
+	struct verify_plan *verify_plan;
+
+	struct packet_pool *pool;	/* pool that owns packet, or NULL */
+
+	/* Metadata about all the headers in the packet, including all
+	 * layers of encapsulation, from outer to inner, starting from
+	 * the outermost IP header at headers[0].
+	 */
+	struct header headers[PACKET_MAX_HEADERS];
+
+	/* For a packet whose buffer is lent to us, such as a frame in an
+	 * AF_XDP UMEM: packet_free() calls this to hand the buffer back
+	 * and free the packet, instead of freeing the buffer itself.
+	 */
+	void (*release)(struct packet *packet);
+	void *release_arg;		/* for the release function */
+};
+
+/* A free list of packets with fixed-size buffers, so that hot paths
+ * (sniffing packets, and copying script packets to inject them) can
+ * recycle packets instead of calling malloc and free for each one.
+ * A packet allocated from a pool remembers its pool, and
+ * packet_free() puts it back on the pool's free list.
+ *
+ * With packet_pool_map(), the pool's spare packets live side by side in
+ * one mapped slab, which can be backed by huge pages.
+ */
+struct packet_pool {
+	u32 buffer_bytes;	/* bytes of space in each pooled buffer */
+	int max_free;		/* max number of packets on free list */
+	int num_free;		/* number of packets on free list */
+	struct packet **free_packets;	/* array of max_free entries */
+	struct hugepage_region slab;	/* max_free packets, if mapped */
+
+	int in_use;		/* pooled packets not yet freed */
+	int peak_in_use;	/* high-water mark of in_use */
+	u64 num_gets;		/* number of packet_pool_get() calls */
+	u64 num_hits;		/* gets satisfied from the free list */
 };
 
 /* Allocate and initialize a packet. */
 extern struct packet *packet_new(u32 buffer_length);
 
-/* Free all the memory used by the packet. */
+/* Free all the memory used by the packet, or return it to its pool. */
 extern void packet_free(struct packet *packet);
 
-/* Create a packet that is a copy of the contents of the given packet. */
+/* Create a packet that is a copy of the contents of the given packet.
+ * If the given packet came from a pool, the copy comes from that pool.
+ */
 extern struct packet *packet_copy(struct packet *old_packet);
 
+/* Allocate a pool that keeps up to max_free spare packets, each with
+ * buffer_bytes of buffer space.
+ */
+extern struct packet_pool *packet_pool_new(u32 buffer_bytes, int max_free);
+
+/* Put fresh packets on the pool's free list until it holds
+ * num_packets (or max_free) of them, so that later gets need no
+ * allocation and the packets can be locked in RAM in advance.
+ */
+extern void packet_pool_fill(struct packet_pool *pool, int num_packets);
+
+/* Replace the packets on the pool's free list with a full list of
+ * packets from a slab mapped as the given --hugepages setting asks,
+ * and keep those in preference to others when packets come back.
+ * Returns STATUS_OK on success; on failure returns STATUS_ERR, sets
+ * error message and leaves the pool as it was.
+ */
+extern int packet_pool_map(struct packet_pool *pool,
+			   enum hugepages_t hugepages, char **error);
+
+/* Free the pool and all packets on its free list. All packets
+ * allocated from the pool must have been freed already.
+ */
+extern void packet_pool_free(struct packet_pool *pool);
+
+/* Allocate and initialize a packet from the given pool. Packets needing
+ * more than pool->buffer_bytes of buffer space fall back to packet_new().
+ */
+extern struct packet *packet_pool_get(struct packet_pool *pool,
+				      u32 buffer_length);
+
+/* Like packet_copy(), but allocate the copy from the given pool. */
+extern struct packet *packet_pool_copy(struct packet_pool *pool,
+				       struct packet *old_packet);
+
 /* Return the number of headers in the given packet. */
 extern int packet_header_count(const struct packet *packet);
 
@@ -154,6 +287,42 @@ static inline struct packet *packet_encapsulate_and_free(struct packet *outer,
 	return packet;
 }
 
+/* The outer headers of a kind of tunnel, finished once around some
+ * inner packet, so that encapsulating further inner packets the same
+ * way is a copy of the headers plus a patch of their lengths and IPv4
+ * header checksums.
+ */
+struct packet_encap_template {
+	u8 outer[PACKET_MAX_HEADER_BYTES];	/* outer headers as parsed */
+	u8 bytes[PACKET_MAX_HEADER_BYTES];	/* ...and as finished */
+	u32 ip_bytes;				/* bytes of outer headers */
+	struct header headers[PACKET_MAX_HEADERS];	/* finished metadata */
+	u32 offsets[PACKET_MAX_HEADERS];	/* where each header starts */
+	int num_headers;			/* number of outer headers */
+	enum header_t inner_type;	/* type of the header they wrap */
+	u32 inner_bytes;		/* total_bytes of what they wrapped */
+};
+
+#define PACKET_ENCAP_TEMPLATES	8
+
+/* The tunnel templates of a script. Zeroed, it is empty. */
+struct packet_encap_templates {
+	struct packet_encap_template *templates[PACKET_ENCAP_TEMPLATES];
+	int count;			/* templates in use */
+	int next;			/* which to evict when full */
+};
+
+/* Like packet_encapsulate(), but reuse the outer headers of a template
+ * for an earlier packet encapsulated the same way, or add one.
+ */
+extern struct packet *packet_encapsulate_templated(
+	struct packet_encap_templates *templates,
+	struct packet *outer, struct packet *inner);
+
+/* Free all the templates. */
+extern void packet_encap_templates_clear(
+	struct packet_encap_templates *templates);
+
 /* Return the direction in which the given packet is traveling. */
 static inline enum direction_t packet_direction(const struct packet *packet)
 {
@@ -172,6 +341,26 @@ static inline int packet_address_family(const struct packet *packet)
 	return AF_UNSPEC;
 }
 
+/* Set the wall time of a packet's receive or send from a timestamp in
+ * nanoseconds.
+ */
+static inline void packet_set_time_nsecs(struct packet *packet, s64 nsecs)
+{
+	packet->time_usecs = nsecs / 1000;
+	packet->time_nsecs = nsecs;
+}
+
+/* Return the wall time of a packet's receive or send in nanoseconds,
+ * or in microseconds times 1000 if we only know those, say because
+ * time_usecs was set (or moved, by path emulation) on its own.
+ */
+static inline s64 packet_time_nsecs(const struct packet *packet)
+{
+	if (packet->time_nsecs / 1000 == packet->time_usecs)
+		return packet->time_nsecs;
+	return packet->time_usecs * 1000;
+}
+
 /* Return a pointer to the first byte of the outermost IP header. */
 static inline u8 *packet_start(struct packet *packet)
 {
@@ -0,0 +1,214 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Microbenchmarks of the per-packet work in packetdrill: parsing,
+ * checksums, TCP option iteration, MPTCP option comparison, MPTCP
+ * HMACs and key hashes, and packet copies. Each prints ns/op and the
+ * packets/s that rate would allow.
+ *
+ * Usage: packet_bench [iterations]
+ */
+
+#include "types.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "checksum.h"
+#include "packet.h"
+#include "packet_parser.h"
+#include "run_packet.h"
+#include "tcp_options_iterator.h"
+#include "utils.h"
+
+#define PAYLOAD_BYTES	1400
+#define OPTION_BYTES	20	/* one MPTCP DSS option */
+#define TCP_BYTES	(sizeof(struct tcp) + OPTION_BYTES)
+#define IP_BYTES	(sizeof(struct ipv4) + TCP_BYTES + PAYLOAD_BYTES)
+
+static struct packet *bench_packet;
+static u8 bench_bytes[IP_BYTES];
+static volatile u64 sink;
+
+static s64 now_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Fill in an IPv4/TCP data segment carrying a DSS option with a data
+ * ACK and a DSN mapping, the common case for MPTCP traffic.
+ */
+static void build_packet_bytes(u8 *bytes)
+{
+	struct ipv4 *ipv4 = (struct ipv4 *)bytes;
+	struct tcp *tcp = (struct tcp *)(ipv4 + 1);
+	u8 *option = (u8 *)(tcp + 1);
+	int i;
+
+	memset(bytes, 0, IP_BYTES);
+	ipv4->version = 4;
+	ipv4->ihl = sizeof(struct ipv4) / 4;
+	ipv4->tot_len = htons(IP_BYTES);
+	ipv4->ttl = 64;
+	ipv4->protocol = IPPROTO_TCP;
+	ipv4->src_ip.s_addr = htonl(0xc0000201);	/* 192.0.2.1 */
+	ipv4->dst_ip.s_addr = htonl(0xc0a80001);	/* 192.168.0.1 */
+	ipv4->check = ipv4_checksum(ipv4, sizeof(struct ipv4));
+
+	tcp->src_port = htons(53000);
+	tcp->dst_port = htons(8080);
+	tcp->seq = htonl(1);
+	tcp->ack_seq = htonl(1);
+	tcp->doff = TCP_BYTES / 4;
+	tcp->ack = 1;
+	tcp->window = htons(257);
+
+	option[0] = TCPOPT_MPTCP;
+	option[1] = OPTION_BYTES;
+	option[2] = DSS_SUBTYPE << 4;
+	option[3] = 0x05;		/* M and A: DSN4 and DACK4 */
+	for (i = 4; i < OPTION_BYTES; i++)
+		option[i] = i;
+
+	for (i = 0; i < PAYLOAD_BYTES; i++)
+		bytes[sizeof(struct ipv4) + TCP_BYTES + i] = i;
+}
+
+static void op_parse_packet(void)
+{
+	struct packet *packet = packet_new(IP_BYTES);
+	char *error = NULL;
+
+	memcpy(packet->buffer, bench_bytes, IP_BYTES);
+	if (parse_packet(packet, IP_BYTES, PACKET_LAYER_3_IP, &error) !=
+	    PACKET_OK) {
+		fprintf(stderr, "parse_packet: %s\n", error);
+		exit(EXIT_FAILURE);
+	}
+	packet_free(packet);
+}
+
+static void op_v4_checksum(void)
+{
+	struct ipv4 *ipv4 = bench_packet->ipv4;
+
+	sink += tcp_udp_v4_checksum(ipv4->src_ip, ipv4->dst_ip, IPPROTO_TCP,
+				    bench_packet->tcp, TCP_BYTES + PAYLOAD_BYTES);
+}
+
+static void op_v6_checksum(void)
+{
+	static const struct in6_addr src = {
+		.s6_addr = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 } };
+	static const struct in6_addr dst = {
+		.s6_addr = { 0xfd, 0x3d, 0xfa, 0x7b, [15] = 1 } };
+
+	sink += tcp_udp_v6_checksum(&src, &dst, IPPROTO_TCP,
+				    bench_packet->tcp, TCP_BYTES + PAYLOAD_BYTES);
+}
+
+static void op_tcp_options(void)
+{
+	struct tcp_options_iterator iter;
+	struct tcp_option *option;
+	char *error = NULL;
+
+	for (option = tcp_options_begin(bench_packet, &iter);
+	     option != NULL; option = tcp_options_next(&iter, &error))
+		sink += option->kind;
+}
+
+static void op_same_mptcp_opt(void)
+{
+	struct tcp_option *option = (struct tcp_option *)(bench_packet->tcp + 1);
+
+	sink += same_mptcp_opt(option, option, bench_packet);
+}
+
+static void op_mptcp_hmac_sha1(void)
+{
+	u8 key_1[8] = "key one", key_2[8] = "key two";
+	u8 rand_1[4] = { 1, 2, 3, 4 }, rand_2[4] = { 5, 6, 7, 8 };
+	u32 hash[5];
+
+	mptcp_hmac_sha1(key_1, key_2, rand_1, rand_2, hash);
+	sink += hash[0];
+}
+
+static void op_sha1_least_64bits(void)
+{
+	sink += sha1_least_64bits(0x0123456789abcdefULL + sink);
+}
+
+static void op_packet_copy(void)
+{
+	packet_free(packet_copy(bench_packet));
+}
+
+/* Run op iterations times; print ns/op and packets/s. */
+static void bench(const char *op_name, void (*op)(void), long iterations)
+{
+	s64 start, nsecs;
+	long i;
+
+	op();
+	start = now_nsecs();
+	for (i = 0; i < iterations; i++)
+		op();
+	nsecs = now_nsecs() - start;
+	if (nsecs == 0)
+		nsecs = 1;
+	printf("%-20s %10.1f ns/op %12.0f packets/s\n", op_name,
+	       (double)nsecs / iterations, 1e9 * iterations / nsecs);
+}
+
+int main(int argc, char *argv[])
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+	char *error = NULL;
+
+	if (iterations <= 0) {
+		fprintf(stderr, "usage: packet_bench [iterations]\n");
+		return EXIT_FAILURE;
+	}
+
+	build_packet_bytes(bench_bytes);
+	bench_packet = packet_new(IP_BYTES);
+	memcpy(bench_packet->buffer, bench_bytes, IP_BYTES);
+	if (parse_packet(bench_packet, IP_BYTES, PACKET_LAYER_3_IP, &error) !=
+	    PACKET_OK) {
+		fprintf(stderr, "parse_packet: %s\n", error);
+		return EXIT_FAILURE;
+	}
+
+	bench("parse_packet", op_parse_packet, iterations);
+	bench("tcp_udp_v4_checksum", op_v4_checksum, iterations);
+	bench("tcp_udp_v6_checksum", op_v6_checksum, iterations);
+	bench("tcp_options", op_tcp_options, iterations);
+	bench("same_mptcp_opt", op_same_mptcp_opt, iterations);
+	bench("mptcp_hmac_sha1", op_mptcp_hmac_sha1, iterations);
+	bench("sha1_least_64bits", op_sha1_least_64bits, iterations);
+	bench("packet_copy", op_packet_copy, iterations);
+
+	packet_free(bench_packet);
+	return 0;
+}
@@ -24,6 +24,10 @@
 
 #include "packet_checksum.h"
 
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "checksum.h"
 #include "icmp.h"
 #include "icmpv6.h"
@@ -107,6 +111,7 @@ static void checksum_ipv6_packet(struct packet *packet)
 void checksum_packet(struct packet *packet)
 {
 	int address_family = packet_address_family(packet);
+	packet->flags |= FLAG_CHECKSUMMED;
 	if (address_family == AF_INET)
 		return checksum_ipv4_packet(packet);
 	else if (address_family == AF_INET6)
@@ -114,3 +119,270 @@ void checksum_packet(struct packet *packet)
 	else
 		assert(!"bad ip version");
 }
+
+/* Return the number of bytes of innermost IP header in front of the
+ * TCP header of the given packet, or -1 if we can't update its
+ * checksums incrementally: it's not TCP, it has IPv6 extension headers,
+ * or its checksums were never filled in. Outer headers of encapsulated
+ * packets are left alone, as mapping a packet only rewrites the inner
+ * ones.
+ */
+static int incremental_ip_header_bytes(struct packet *packet)
+{
+	int ip_header_bytes;
+
+	if (packet->tcp == NULL || !(packet->flags & FLAG_CHECKSUMMED))
+		return -1;
+	ip_header_bytes = (u8 *)packet->tcp - ip_start(packet);
+	if (packet->ipv4 != NULL &&
+	    ip_header_bytes == ipv4_header_len(packet->ipv4))
+		return ip_header_bytes;
+	if (packet->ipv6 != NULL && ip_header_bytes == sizeof(struct ipv6))
+		return ip_header_bytes;
+	return -1;
+}
+
+void packet_checksum_snapshot(struct packet *packet,
+			      struct packet_checksum_snapshot *snapshot)
+{
+	int ip_header_bytes = incremental_ip_header_bytes(packet);
+
+	snapshot->valid = false;
+	if (ip_header_bytes < 0)
+		return;
+	snapshot->ip_header_bytes = ip_header_bytes;
+	snapshot->tcp_header_bytes = packet_tcp_header_len(packet);
+	memcpy(snapshot->headers, ip_start(packet),
+	       ip_header_bytes + snapshot->tcp_header_bytes);
+	snapshot->valid = true;
+}
+
+/* Is the 16-bit word at the given offset in the IP header part of the
+ * source or destination address, and thus of the TCP pseudo-header?
+ */
+static bool is_ip_address_word(const struct packet *packet, int offset)
+{
+	if (packet->ipv4 != NULL)
+		return offset >= offsetof(struct ipv4, src_ip) &&
+		       offset < offsetof(struct ipv4, dst_ip) +
+				sizeof(packet->ipv4->dst_ip);
+	else
+		return offset >= offsetof(struct ipv6, src_ip) &&
+		       offset < offsetof(struct ipv6, dst_ip) +
+				sizeof(packet->ipv6->dst_ip);
+}
+
+void checksum_packet_incremental(
+	struct packet *packet,
+	const struct packet_checksum_snapshot *snapshot)
+{
+	const int ip_check_offset = offsetof(struct ipv4, check);
+	const int tcp_check_offset = offsetof(struct tcp, check);
+	const u8 *old_ip = snapshot->headers, *old_tcp;
+	u8 *ip, *tcp;
+	int i;
+
+	/* Rewriting lengths changes the words we'd sum to a different
+	 * set of words, so then just start over.
+	 */
+	if (!snapshot->valid ||
+	    incremental_ip_header_bytes(packet) != snapshot->ip_header_bytes ||
+	    packet_tcp_header_len(packet) != snapshot->tcp_header_bytes ||
+	    (packet->ipv4 != NULL &&
+	     packet->ipv4->tot_len != ((struct ipv4 *)old_ip)->tot_len) ||
+	    (packet->ipv6 != NULL &&
+	     packet->ipv6->payload_len != ((struct ipv6 *)old_ip)->payload_len)) {
+		checksum_packet(packet);
+		return;
+	}
+
+	ip = ip_start(packet);
+	for (i = 0; i < snapshot->ip_header_bytes; i += sizeof(u16)) {
+		if (memcmp(old_ip + i, ip + i, sizeof(u16)) == 0)
+			continue;
+		if (packet->ipv4 != NULL && i != ip_check_offset)
+			packet->ipv4->check =
+				checksum_update(packet->ipv4->check,
+						old_ip + i, ip + i,
+						sizeof(u16));
+		if (is_ip_address_word(packet, i))
+			packet->tcp->check =
+				checksum_update(packet->tcp->check,
+						old_ip + i, ip + i,
+						sizeof(u16));
+	}
+
+	old_tcp = old_ip + snapshot->ip_header_bytes;
+	tcp = (u8 *)packet->tcp;
+	for (i = 0; i < snapshot->tcp_header_bytes; i += sizeof(u16)) {
+		if (i == tcp_check_offset ||
+		    memcmp(old_tcp + i, tcp + i, sizeof(u16)) == 0)
+			continue;
+		packet->tcp->check = checksum_update(packet->tcp->check,
+						     old_tcp + i, tcp + i,
+						     sizeof(u16));
+	}
+}
+
+int parse_checksum_policy(const char *arg, struct checksum_policy *policy,
+			  char **error)
+{
+	const char *sampled = "sampled:";
+	char *end = NULL;
+	long value;
+
+	memset(policy, 0, sizeof(*policy));
+	if (strcmp(arg, "none") == 0) {
+		policy->mode = CHECKSUM_VERIFY_NONE;
+	} else if (strcmp(arg, "full") == 0) {
+		policy->mode = CHECKSUM_VERIFY_FULL;
+	} else if (strcmp(arg, "offload") == 0) {
+		policy->mode = CHECKSUM_VERIFY_OFFLOAD;
+	} else if (strncmp(arg, sampled, strlen(sampled)) == 0) {
+		policy->mode = CHECKSUM_VERIFY_SAMPLED;
+		value = strtol(arg + strlen(sampled), &end, 10);
+		if (end == arg + strlen(sampled) || *end != '\0' ||
+		    value < 1 || value > 1000000) {
+			asprintf(error, "sample every 1 to 1000000 packets");
+			return STATUS_ERR;
+		}
+		policy->sample_every = value;
+	} else {
+		asprintf(error,
+			 "expected none, full, sampled:<count> or offload");
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* The innermost layer 4 header of a packet and what its checksum
+ * covers.
+ */
+struct l4_checksum {
+	const char *name;	/* protocol, for error messages */
+	u8 protocol;		/* for the pseudo-header, or 0 if none */
+	u8 *header;		/* start of layer 4 header */
+	__sum16 *check;		/* checksum field */
+	int bytes;		/* bytes of header and payload */
+};
+
+/* Find the innermost layer 4 header of the packet. Returns false if it
+ * has none we know the checksum of, or the packet is cut short.
+ */
+static bool find_l4_checksum(struct packet *packet, struct l4_checksum *l4)
+{
+	u8 *ip_end;
+
+	if (packet->ipv4 != NULL)
+		ip_end = (u8 *)packet->ipv4 + ntohs(packet->ipv4->tot_len);
+	else if (packet->ipv6 != NULL)
+		ip_end = (u8 *)packet->ipv6 + sizeof(struct ipv6) +
+			ntohs(packet->ipv6->payload_len);
+	else
+		return false;
+
+	memset(l4, 0, sizeof(*l4));
+	if (packet->tcp != NULL) {
+		l4->name = "TCP";
+		l4->protocol = IPPROTO_TCP;
+		l4->header = (u8 *)packet->tcp;
+		l4->check = &packet->tcp->check;
+	} else if (packet->udp != NULL) {
+		l4->name = "UDP";
+		l4->protocol = IPPROTO_UDP;
+		l4->header = (u8 *)packet->udp;
+		l4->check = &packet->udp->check;
+	} else if (packet->icmpv4 != NULL) {
+		l4->name = "ICMP";
+		l4->header = (u8 *)packet->icmpv4;
+		l4->check = &packet->icmpv4->checksum;
+	} else if (packet->icmpv6 != NULL) {
+		l4->name = "ICMPv6";
+		l4->protocol = IPPROTO_ICMPV6;
+		l4->header = (u8 *)packet->icmpv6;
+		l4->check = &packet->icmpv6->checksum;
+	} else {
+		return false;
+	}
+	l4->bytes = ip_end - l4->header;
+
+	/* A jumbogram's IPv6 payload length is 0, and the sniffer may
+	 * have cut off the end of the packet.
+	 */
+	return l4->bytes > 0 && ip_end <= packet_end(packet);
+}
+
+/* Return the sum of the pseudo-header alone, as the kernel leaves it
+ * in the checksum field of a packet for the device to finish.
+ */
+static __be16 l4_pseudo_checksum(struct packet *packet,
+				 const struct l4_checksum *l4)
+{
+	if (packet->ipv4 != NULL)
+		return tcp_udp_v4_pseudo_checksum(packet->ipv4->src_ip,
+						  packet->ipv4->dst_ip,
+						  l4->protocol, l4->bytes);
+	return tcp_udp_v6_pseudo_checksum(&packet->ipv6->src_ip,
+					  &packet->ipv6->dst_ip,
+					  l4->protocol, l4->bytes);
+}
+
+/* Return the checksum of the whole packet, check field and all, which
+ * is 0 if the check field is right.
+ */
+static __be16 l4_full_checksum(struct packet *packet,
+			       const struct l4_checksum *l4)
+{
+	if (l4->protocol == 0)
+		return ipv4_checksum(l4->header, l4->bytes);
+	if (packet->ipv4 != NULL)
+		return tcp_udp_v4_checksum(packet->ipv4->src_ip,
+					   packet->ipv4->dst_ip,
+					   l4->protocol, l4->header,
+					   l4->bytes);
+	return tcp_udp_v6_checksum(&packet->ipv6->src_ip,
+				   &packet->ipv6->dst_ip,
+				   l4->protocol, l4->header, l4->bytes);
+}
+
+int verify_packet_l4_checksum(struct packet *packet, bool vnet_known,
+			      char **error)
+{
+	struct l4_checksum l4;
+	bool partial = false;
+
+	if (!find_l4_checksum(packet, &l4))
+		return STATUS_OK;
+
+	/* A UDP over IPv4 checksum of 0 means there is none. */
+	if (packet->udp != NULL && packet->ipv4 != NULL && *l4.check == 0)
+		return STATUS_OK;
+
+	if (vnet_known && (packet->flags & FLAG_CSUM_PARTIAL)) {
+		if (l4.protocol == 0 || l4.protocol == IPPROTO_ICMPV6 ||
+		    packet->csum_start != l4.header - packet->buffer ||
+		    packet->csum_offset != (u8 *)l4.check - l4.header) {
+			asprintf(error, "outbound %s checksum left partial "
+				 "at start %u offset %u, not %u %u",
+				 l4.name, packet->csum_start,
+				 packet->csum_offset,
+				 (u32)(l4.header - packet->buffer),
+				 (u32)((u8 *)l4.check - l4.header));
+			return STATUS_ERR;
+		}
+		partial = true;
+	} else if (l4_full_checksum(packet, &l4) == 0) {
+		return STATUS_OK;
+	} else if (vnet_known || l4.protocol == 0 ||
+		   l4.protocol == IPPROTO_ICMPV6) {
+		asprintf(error, "bad outbound %s checksum", l4.name);
+		return STATUS_ERR;
+	}
+
+	/* It is partial, or may be: it should hold the pseudo-header sum. */
+	if (*l4.check == l4_pseudo_checksum(packet, &l4))
+		return STATUS_OK;
+	asprintf(error, "bad outbound %s checksum%s", l4.name,
+		 partial ? " (partial)" : "");
+	return STATUS_ERR;
+}
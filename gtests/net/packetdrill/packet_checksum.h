@@ -30,4 +30,75 @@
 /* Fill in layer 3 and layer 4 checksums for the given input 'packet'. */
 extern void checksum_packet(struct packet *packet);
 
+/* A copy of the IP and TCP headers of a packet whose checksums are
+ * already filled in, taken before rewriting some of its fields, so
+ * that afterward the checksums can be patched for just the 16-bit
+ * words that changed instead of re-summing the whole packet.
+ */
+struct packet_checksum_snapshot {
+	bool valid;		/* false if we must recompute from scratch */
+	int ip_header_bytes;	/* bytes of IP header before the TCP header */
+	int tcp_header_bytes;	/* bytes of TCP header, including options */
+	u8 headers[MAX_IPV4_HEADER_BYTES + MAX_TCP_HEADER_BYTES];
+};
+
+/* Save the headers of the given packet, which should have gone through
+ * checksum_packet(), before its fields are rewritten.
+ */
+extern void packet_checksum_snapshot(struct packet *packet,
+				     struct packet_checksum_snapshot *snapshot);
+
+/* Fill in layer 3 and layer 4 checksums for the given input 'packet',
+ * updating them incrementally (RFC 1624) from the given snapshot when
+ * only fields of its innermost TCP/IP headers changed, and falling back
+ * to checksum_packet() otherwise, e.g. if any lengths changed.
+ */
+extern void checksum_packet_incremental(
+	struct packet *packet,
+	const struct packet_checksum_snapshot *snapshot);
+
+/* How much of the layer 4 checksums of sniffed outbound packets to
+ * verify, set with --verify_checksums. Summing every byte of every
+ * 64KB GSO super-packet is not cheap, and most tests are not about
+ * checksums, so by default we check only IPv4 header checksums.
+ */
+enum checksum_verify_t {
+	CHECKSUM_VERIFY_NONE = 0,	/* IPv4 header checksums only */
+	CHECKSUM_VERIFY_FULL,		/* every packet */
+	CHECKSUM_VERIFY_SAMPLED,	/* one packet in sample_every */
+	CHECKSUM_VERIFY_OFFLOAD,	/* every packet, by its vnet header */
+};
+
+struct checksum_policy {
+	enum checksum_verify_t mode;
+	u32 sample_every;	/* for CHECKSUM_VERIFY_SAMPLED */
+};
+
+/* Parse the argument of --verify_checksums: "none", "full",
+ * "sampled:<N>" or "offload". On failure returns STATUS_ERR and fills
+ * in *error.
+ */
+extern int parse_checksum_policy(const char *arg,
+				 struct checksum_policy *policy,
+				 char **error);
+
+/* Verify the innermost layer 4 checksum of a sniffed packet.
+ *
+ * With TUN_F_CSUM set on the tun device, the kernel may leave the
+ * checksum of a TCP or UDP packet partial, for the device to finish:
+ * the checksum field then holds just the sum of the pseudo-header,
+ * and the packet's vnet header says where to start summing and where
+ * to put the result. If vnet_known, the packet came with a vnet
+ * header, so we know which packets are partial (FLAG_CSUM_PARTIAL);
+ * for those we check the offsets and the pseudo-header sum without
+ * summing the payload at all, and insist the rest are complete.
+ * Otherwise we sum the whole packet, and take a checksum field
+ * holding the pseudo-header sum as a partial checksum.
+ *
+ * Returns STATUS_OK if the checksum is right, or if the packet is cut
+ * short so we can't tell; else returns STATUS_ERR and fills in *error.
+ */
+extern int verify_packet_l4_checksum(struct packet *packet, bool vnet_known,
+				     char **error);
+
 #endif /* __PACKET_CHECKSUM_H__ */
@@ -0,0 +1,145 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for verifying the checksums of sniffed packets in
+ * packet_checksum.c, complete and left partial for the device.
+ */
+
+#include "packet_checksum.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checksum.h"
+#include "ip.h"
+#include "packet_parser.h"
+
+static struct packet *new_tcp_packet(void)
+{
+	/* 192.0.2.1:53055 > 192.168.0.1:8080 . 1:11(10) ack 1 win 257 */
+	u8 data[] = {
+		0x45, 0x00, 0x00, 0x32, 0x00, 0x00, 0x00, 0x00,
+		0xff, 0x06, 0x00, 0x00, 0xc0, 0x00, 0x02, 0x01,
+		0xc0, 0xa8, 0x00, 0x01, 0xcf, 0x3f, 0x1f, 0x90,
+		0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+		0x50, 0x10, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00,
+		'0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
+	};
+	struct packet *packet = packet_new(sizeof(data));
+	__be16 ip_check = ipv4_checksum(data, sizeof(struct ipv4));
+	char *error = NULL;
+
+	memcpy(data + offsetof(struct ipv4, check), &ip_check,
+	       sizeof(ip_check));
+	memcpy(packet->buffer, data, sizeof(data));
+	assert(parse_packet(packet, sizeof(data), PACKET_LAYER_3_IP,
+			    &error) == PACKET_OK);
+	checksum_packet(packet);
+	packet->flags = 0;
+	return packet;
+}
+
+static void test_parse(void)
+{
+	struct checksum_policy policy;
+	char *error = NULL;
+
+	assert(parse_checksum_policy("none", &policy, &error) == STATUS_OK);
+	assert(policy.mode == CHECKSUM_VERIFY_NONE);
+	assert(parse_checksum_policy("offload", &policy, &error) ==
+	       STATUS_OK);
+	assert(policy.mode == CHECKSUM_VERIFY_OFFLOAD);
+	assert(parse_checksum_policy("sampled:16", &policy, &error) ==
+	       STATUS_OK);
+	assert(policy.mode == CHECKSUM_VERIFY_SAMPLED);
+	assert(policy.sample_every == 16);
+	assert(parse_checksum_policy("sampled:0", &policy, &error) ==
+	       STATUS_ERR);
+	free(error);
+	error = NULL;
+	assert(parse_checksum_policy("some", &policy, &error) == STATUS_ERR);
+	free(error);
+}
+
+static void test_complete(void)
+{
+	struct packet *packet = new_tcp_packet();
+	char *error = NULL;
+
+	assert(verify_packet_l4_checksum(packet, false, &error) == STATUS_OK);
+	assert(verify_packet_l4_checksum(packet, true, &error) == STATUS_OK);
+
+	/* A flipped payload bit is caught, with or without vnet headers. */
+	packet_payload(packet)[3] ^= 0x10;
+	assert(verify_packet_l4_checksum(packet, false, &error) ==
+	       STATUS_ERR);
+	assert(strcmp(error, "bad outbound TCP checksum") == 0);
+	free(error);
+	error = NULL;
+	assert(verify_packet_l4_checksum(packet, true, &error) == STATUS_ERR);
+	free(error);
+	packet_free(packet);
+}
+
+static void test_partial(void)
+{
+	struct packet *packet = new_tcp_packet();
+	struct tcp *tcp = packet->tcp;
+	char *error = NULL;
+
+	/* What the kernel leaves for a device with checksum offload. */
+	tcp->check = tcp_udp_v4_pseudo_checksum(packet->ipv4->src_ip,
+						packet->ipv4->dst_ip,
+						IPPROTO_TCP, 30);
+
+	/* Without vnet headers we take the pseudo-header sum as partial. */
+	assert(verify_packet_l4_checksum(packet, false, &error) == STATUS_OK);
+
+	/* With them, the packet must say so, and where to finish it. */
+	assert(verify_packet_l4_checksum(packet, true, &error) == STATUS_ERR);
+	free(error);
+	error = NULL;
+	packet->flags |= FLAG_CSUM_PARTIAL;
+	packet->csum_start = 20;
+	packet->csum_offset = 16;
+	assert(verify_packet_l4_checksum(packet, true, &error) == STATUS_OK);
+
+	/* A partial checksum is not summed over the payload... */
+	packet_payload(packet)[3] ^= 0x10;
+	assert(verify_packet_l4_checksum(packet, true, &error) == STATUS_OK);
+
+	/* ...but the pseudo-header sum and the offsets are checked. */
+	packet->csum_offset = 6;
+	assert(verify_packet_l4_checksum(packet, true, &error) == STATUS_ERR);
+	free(error);
+	error = NULL;
+	packet->csum_offset = 16;
+	tcp->check ^= htons(1);
+	assert(verify_packet_l4_checksum(packet, true, &error) == STATUS_ERR);
+	assert(strcmp(error, "bad outbound TCP checksum (partial)") == 0);
+	free(error);
+	packet_free(packet);
+}
+
+int main(void)
+{
+	test_parse();
+	test_complete();
+	test_partial();
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for packet_encapsulate_templated(): packets encapsulated
+ * from a template come out byte for byte as packet_encapsulate() would
+ * build them, whatever the size of what they wrap, and encapsulated
+ * packets can have their checksums updated incrementally.
+ */
+
+#include "packet.h"
+
+#include <assert.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "checksum.h"
+#include "gre_packet.h"
+#include "ip_packet.h"
+#include "mpls_packet.h"
+#include "packet_checksum.h"
+#include "tcp_packet.h"
+
+/* An inbound IPv4 + GRE or IPv6 + GRE + MPLS tunnel. */
+static struct packet *new_outer(int address_family)
+{
+	struct packet *outer = packet_new(PACKET_MAX_HEADER_BYTES);
+	struct mpls_stack *stack = NULL;
+	struct mpls mpls;
+	char *error = NULL;
+
+	outer->direction = DIRECTION_INBOUND;
+	if (address_family == AF_INET) {
+		assert(ipv4_header_append(outer, "192.0.2.1", "192.0.2.2",
+					  &error) == STATUS_OK);
+		assert(gre_header_append(outer, &error) == STATUS_OK);
+		return outer;
+	}
+	assert(ipv6_header_append(outer, "2001:db8::1", "2001:db8::2",
+				  &error) == STATUS_OK);
+	assert(gre_header_append(outer, &error) == STATUS_OK);
+	stack = mpls_stack_new();
+	assert(new_mpls_stack_entry(1000, 0, true, 64, &mpls,
+				    &error) == STATUS_OK);
+	assert(mpls_stack_append(stack, mpls) == STATUS_OK);
+	assert(mpls_header_append(outer, stack, &error) == STATUS_OK);
+	free(stack);
+	return outer;
+}
+
+static struct packet *new_inner(int address_family, u16 payload_bytes)
+{
+	char *error = NULL;
+	struct packet *packet =
+		new_tcp_packet(3, address_family, DIRECTION_INBOUND, ECN_NONE,
+			       ".", 1, payload_bytes, 1, 257, NULL, &error);
+
+	assert(packet != NULL);
+	return packet;
+}
+
+static void assert_same_packet(struct packet *a, struct packet *b)
+{
+	int i;
+
+	assert(a->ip_bytes == b->ip_bytes);
+	assert(memcmp(a->buffer, b->buffer, a->ip_bytes) == 0);
+	for (i = 0; i < PACKET_MAX_HEADERS; ++i) {
+		assert(a->headers[i].type == b->headers[i].type);
+		if (a->headers[i].type == HEADER_NONE)
+			break;
+		assert(a->headers[i].header_bytes == b->headers[i].header_bytes);
+		assert(a->headers[i].total_bytes == b->headers[i].total_bytes);
+		assert(a->headers[i].h.ptr - a->buffer ==
+		       b->headers[i].h.ptr - b->buffer);
+	}
+	assert((u8 *)a->tcp - a->buffer == (u8 *)b->tcp - b->buffer);
+}
+
+static void test_templates(int outer_family, int inner_family)
+{
+	static const u16 payloads[] = { 0, 1000, 1, 0, 1400 };
+	struct packet_encap_templates templates;
+	int i;
+
+	memset(&templates, 0, sizeof(templates));
+	for (i = 0; i < ARRAY_SIZE(payloads); ++i) {
+		struct packet *outer = new_outer(outer_family);
+		struct packet *inner = new_inner(inner_family, payloads[i]);
+		struct packet *expected = packet_encapsulate(outer, inner);
+		struct packet *actual =
+			packet_encapsulate_templated(&templates, outer, inner);
+
+		/* The first packet adds the template; the rest use it. */
+		assert(templates.count == 1);
+		assert_same_packet(expected, actual);
+		if (outer_family == AF_INET)
+			assert(ipv4_checksum(actual->buffer,
+					     sizeof(struct ipv4)) == 0);
+		packet_free(expected);
+		packet_free(actual);
+		packet_free(outer);
+		packet_free(inner);
+	}
+	packet_encap_templates_clear(&templates);
+	assert(templates.count == 0);
+}
+
+/* A different tunnel gets its own template, and once there are too
+ * many, the oldest makes way.
+ */
+static void test_eviction(void)
+{
+	struct packet_encap_templates templates;
+	char *error = NULL;
+	int i;
+
+	memset(&templates, 0, sizeof(templates));
+	for (i = 0; i < PACKET_ENCAP_TEMPLATES + 2; ++i) {
+		struct packet *outer = packet_new(PACKET_MAX_HEADER_BYTES);
+		struct packet *inner = new_inner(AF_INET, 100);
+		struct packet *expected = NULL, *actual = NULL;
+		char src[32];
+
+		snprintf(src, sizeof(src), "192.0.2.%d", 10 + i);
+		outer->direction = DIRECTION_INBOUND;
+		assert(ipv4_header_append(outer, src, "192.0.2.2",
+					  &error) == STATUS_OK);
+		assert(gre_header_append(outer, &error) == STATUS_OK);
+		expected = packet_encapsulate(outer, inner);
+		actual = packet_encapsulate_templated(&templates, outer, inner);
+		assert_same_packet(expected, actual);
+		packet_free(expected);
+		packet_free(actual);
+		packet_free(outer);
+		packet_free(inner);
+	}
+	assert(templates.count == PACKET_ENCAP_TEMPLATES);
+	assert(templates.next == 2);
+	packet_encap_templates_clear(&templates);
+}
+
+/* Rewriting the inner ports of a tunnelled packet updates its TCP
+ * checksum incrementally, as a full recompute would.
+ */
+static void test_incremental_checksum(void)
+{
+	struct packet *outer = new_outer(AF_INET);
+	struct packet *inner = new_inner(AF_INET, 100);
+	struct packet *packet = packet_encapsulate_and_free(outer, inner);
+	struct packet_checksum_snapshot snapshot;
+	__be16 check;
+
+	checksum_packet(packet);
+	packet_checksum_snapshot(packet, &snapshot);
+	assert(snapshot.valid);
+	packet->tcp->src_port = htons(4242);
+	packet->ipv4->src_ip.s_addr = htonl(0x0a000001);
+	checksum_packet_incremental(packet, &snapshot);
+	check = packet->tcp->check;
+	checksum_packet(packet);
+	assert(check == packet->tcp->check);
+	packet_free(packet);
+}
+
+int main(void)
+{
+	test_templates(AF_INET, AF_INET);
+	test_templates(AF_INET, AF_INET6);
+	test_templates(AF_INET6, AF_INET);
+	test_templates(AF_INET6, AF_INET6);
+	test_eviction();
+	test_incremental_checksum();
+	return 0;
+}
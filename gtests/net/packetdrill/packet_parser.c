@@ -43,6 +43,7 @@
 #include "logging.h"
 #include "packet.h"
 #include "tcp.h"
+#include "tcp_options_iterator.h"
 
 static int parse_ipv4(struct packet *packet, u8 *header_start, u8 *packet_end,
 		      char **error);
@@ -195,6 +196,59 @@ int parse_packet(struct packet *packet, int in_bytes,
 	return PACKET_BAD;
 }
 
+bool peek_packet_ports(const u8 *buffer, int in_bytes,
+		       enum packet_layer_t layer, struct packet_ports *ports)
+{
+	const u8 *p = buffer;
+	const u8 *packet_end = buffer + in_bytes;
+	int ip_header_bytes;
+	u8 protocol;
+
+	if (layer == PACKET_LAYER_2_ETHERNET) {
+		const struct ether_header *ether =
+			(const struct ether_header *)p;
+		u16 ether_type;
+
+		if (p + sizeof(*ether) > packet_end)
+			return false;
+		ether_type = ntohs(ether->ether_type);
+		if (ether_type != ETHERTYPE_IP && ether_type != ETHERTYPE_IPV6)
+			return false;
+		p += sizeof(*ether);
+	}
+
+	if (p + sizeof(struct ipv4) > packet_end)
+		return false;
+	if ((p[0] >> 4) == 4) {
+		const struct ipv4 *ipv4 = (const struct ipv4 *)p;
+
+		if (ntohs(ipv4->frag_off) & (IP_MF | IP_OFFMASK))
+			return false;
+		ip_header_bytes = ipv4_header_len(ipv4);
+		if (ip_header_bytes < sizeof(*ipv4))
+			return false;
+		protocol = ipv4->protocol;
+	} else if ((p[0] >> 4) == 6) {
+		const struct ipv6 *ipv6 = (const struct ipv6 *)p;
+
+		ip_header_bytes = sizeof(*ipv6);
+		protocol = ipv6->next_header;
+	} else {
+		return false;
+	}
+	if (protocol != IPPROTO_TCP && protocol != IPPROTO_UDP)
+		return false;
+
+	/* Both TCP and UDP start with the source and destination port. */
+	p += ip_header_bytes;
+	if (p + 2 * sizeof(__be16) > packet_end)
+		return false;
+	ports->protocol = protocol;
+	memcpy(&ports->src_port, p, sizeof(ports->src_port));
+	memcpy(&ports->dst_port, p + sizeof(__be16), sizeof(ports->dst_port));
+	return true;
+}
+
 /* Parse the IPv4 header and the TCP header inside. Return a
  * packet_parse_result_t.
  * Note that packet_end points to the byte beyond the end of packet.
@@ -385,6 +439,11 @@ static int parse_tcp(struct packet *packet, u8 *layer4_start, int layer4_bytes,
 	}
 	tcp_header->total_bytes = layer4_bytes;
 
+	/* Index the options now, to spare later lookups from rescanning
+	 * them. Malformed options are left for those lookups to report.
+	 */
+	tcp_options_index(packet, NULL);
+
 	p += layer4_bytes;
 	assert(p <= packet_end);
 
@@ -50,4 +50,24 @@ enum packet_parse_result_t {
 int parse_packet(struct packet *packet, int in_bytes,
 		 enum packet_layer_t layer, char **error);
 
+/* The transport protocol and ports of a frame, as found by
+ * peek_packet_ports().
+ */
+struct packet_ports {
+	u8 protocol;		/* IPPROTO_TCP or IPPROTO_UDP */
+	__be16 src_port;	/* network order */
+	__be16 dst_port;	/* network order */
+};
+
+/* The first, cheap stage of parsing a sniffed frame: find just the
+ * ports of a plain, unfragmented TCP or UDP over IPv4 or IPv6 frame,
+ * with no checks beyond staying inside its in_bytes, so the caller
+ * can tell whether the frame is worth a full parse_packet(). Returns
+ * true if it found them, or false if the frame is anything else
+ * (encapsulated, fragmented, another protocol, or truncated), which
+ * only a full parse can classify.
+ */
+bool peek_packet_ports(const u8 *buffer, int in_bytes,
+		       enum packet_layer_t layer, struct packet_ports *ports);
+
 #endif /* __PACKET_PARSER_H__ */
@@ -0,0 +1,70 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Fuzz target for parse_packet(): the input is the IP bytes of a packet
+ * as the kernel might emit it. A packet that parses is then walked the
+ * way the verification code walks it: its TCP options, their index,
+ * and a copy of the whole packet.
+ */
+
+#include "fuzz_target.h"
+
+#include "tcp_options_iterator.h"
+
+/* Walk the options of a parsed TCP packet. */
+static void walk_tcp_options(struct packet *packet)
+{
+	struct tcp_options_iterator iter;
+	struct tcp_option *option = NULL;
+	char *error = NULL;
+	int i;
+
+	for (option = tcp_options_begin(packet, &iter); option != NULL;
+	     option = tcp_options_next(&iter, &error))
+		;
+	free(error);
+
+	for (i = 0; i < TCP_OPTION_INDEX_KINDS; ++i)
+		get_tcp_option(packet, i);
+	for (i = 0; i < MPTCP_OPTION_INDEX_SUBTYPES; ++i)
+		get_mptcp_option(packet, i);
+}
+
+int LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+	struct packet *packet = packet_new(size);
+	struct packet *copy = NULL;
+	char *error = NULL;
+
+	memcpy(packet->buffer, data, size);
+	if (parse_packet(packet, size, PACKET_LAYER_3_IP, &error) !=
+	    PACKET_OK) {
+		free(error);
+		packet_free(packet);
+		return 0;
+	}
+
+	if (packet->tcp != NULL)
+		walk_tcp_options(packet);
+	copy = packet_copy(packet);
+	if (copy->tcp != NULL)
+		walk_tcp_options(copy);
+
+	packet_free(copy);
+	packet_free(packet);
+	return 0;
+}
@@ -27,6 +27,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include "tcp_options_iterator.h"
 
 static void test_parse_tcp_ipv4_packet(void)
 {
@@ -72,6 +73,15 @@ static void test_parse_tcp_ipv4_packet(void)
 	assert(packet->flags		== 0);
 	assert(packet->ecn		== 0);
 
+	/* The options were indexed while parsing. */
+	assert(packet->tcp_options_indexed);
+	assert(get_tcp_option(packet, TCPOPT_SACK) ==
+	       (struct tcp_option *)((u8 *)expected_tcp + 20));
+	assert(get_tcp_option(packet, TCPOPT_TIMESTAMP) ==
+	       (struct tcp_option *)((u8 *)expected_tcp + 30));
+	assert(get_tcp_option(packet, TCPOPT_MAXSEG) == NULL);
+	assert(get_mptcp_option(packet, DSS_SUBTYPE) == NULL);
+
 	packet_free(packet);
 }
 
@@ -477,6 +487,57 @@ static void test_parse_icmpv6_packet(void)
 	packet_free(packet);
 }
 
+/* peek_packet_ports() finds the ports of plain TCP and UDP packets,
+ * and leaves anything else, or anything truncated, to the full parse.
+ */
+static void test_peek_packet_ports(void)
+{
+	/* 192.0.2.1:53055 > 192.168.0.1:8080 TCP, as above. */
+	u8 tcp_ipv4[] = {
+		0x45, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x00,
+		0xff, 0x06, 0x39, 0x25, 0xc0, 0x00, 0x02, 0x01,
+		0xc0, 0xa8, 0x00, 0x01, 0xcf, 0x3f, 0x1f, 0x90,
+		0x00, 0x00, 0x00, 0x01, 0x83, 0x4d, 0xa5, 0x5b,
+		0x50, 0x10, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00,
+	};
+	/* 2001:db8::1.8080 > fd3d:fa7b:d17d::1.51557 UDP, as above. */
+	u8 udp_ipv6[] = {
+		0x60, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x11, 0xff,
+		0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+		0xfd, 0x3d, 0xfa, 0x7b, 0xd1, 0x7d, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+		0x1f, 0x90, 0xc9, 0x65, 0x00, 0x0c, 0x1f, 0xee,
+		0x00, 0x00, 0x00, 0x00,
+	};
+	/* An ICMPv4 echo request, as above. */
+	u8 icmpv4[] = {
+		0x45, 0x00, 0x00, 0x1c, 0x00, 0x00, 0x40, 0x00,
+		0x40, 0x01, 0xb6, 0xc4, 0xc0, 0xa8, 0x01, 0x65,
+		0xc0, 0xa8, 0x01, 0x67, 0x08, 0x00, 0xcd, 0x2e,
+		0x2a, 0xd0, 0x00, 0x01,
+	};
+	struct packet_ports ports;
+
+	assert(peek_packet_ports(tcp_ipv4, sizeof(tcp_ipv4),
+				 PACKET_LAYER_3_IP, &ports));
+	assert(ports.protocol == IPPROTO_TCP);
+	assert(ports.src_port == htons(53055));
+	assert(ports.dst_port == htons(8080));
+
+	assert(peek_packet_ports(udp_ipv6, sizeof(udp_ipv6),
+				 PACKET_LAYER_3_IP, &ports));
+	assert(ports.protocol == IPPROTO_UDP);
+	assert(ports.src_port == htons(8080));
+	assert(ports.dst_port == htons(51557));
+
+	assert(!peek_packet_ports(icmpv4, sizeof(icmpv4),
+				  PACKET_LAYER_3_IP, &ports));
+	assert(!peek_packet_ports(tcp_ipv4, 22, PACKET_LAYER_3_IP, &ports));
+	assert(!peek_packet_ports(tcp_ipv4, sizeof(tcp_ipv4),
+				  PACKET_LAYER_2_ETHERNET, &ports));
+}
+
 int main(void)
 {
 	test_parse_tcp_ipv4_packet();
@@ -487,5 +548,6 @@ int main(void)
 	test_parse_ipv4_gre_mpls_ipv4_tcp_packet();
 	test_parse_icmpv4_packet();
 	test_parse_icmpv6_packet();
+	test_peek_packet_ports();
 	return 0;
 }
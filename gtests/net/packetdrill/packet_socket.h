@@ -37,8 +37,60 @@
 
 struct packet_socket;
 
-/* Allocate and initialize a packet socket. */
-extern struct packet_socket *packet_socket_new(const char *device_name);
+/* The destination ports a port filter keeps, as a bitmap indexed by
+ * port number, for checking in user space the frames the kernel's
+ * filter lets through: those to more ports than it takes, or with
+ * headers it does not follow. The thread setting the filter updates
+ * it while a sniffer thread reads it, so an update never clears, even
+ * for a moment, a port that stays wanted.
+ */
+struct port_set {
+	bool filtering;			/* if false, every port is kept */
+	u64 bits[65536 / 64];		/* kept ports */
+};
+
+/* Is the given destination port (in network byte order) kept? */
+static inline bool port_set_has(const struct port_set *set, __be16 port)
+{
+	u16 index = ntohs(port);
+
+	if (!__atomic_load_n(&set->filtering, __ATOMIC_ACQUIRE))
+		return true;
+	return (__atomic_load_n(&set->bits[index / 64], __ATOMIC_RELAXED) >>
+		(index % 64)) & 1;
+}
+
+/* Keep just the given ports, or every port if num_ports is negative. */
+static inline void port_set_update(struct port_set *set,
+				   const __be16 *ports, int num_ports)
+{
+	u64 bits[ARRAY_SIZE(set->bits)];
+	int i;
+
+	if (num_ports < 0) {
+		__atomic_store_n(&set->filtering, false, __ATOMIC_RELEASE);
+		return;
+	}
+	memset(bits, 0, sizeof(bits));
+	for (i = 0; i < num_ports; ++i) {
+		u16 index = ntohs(ports[i]);
+
+		bits[index / 64] |= 1ULL << (index % 64);
+	}
+	/* Add the new ports before dropping the old ones. */
+	for (i = 0; i < ARRAY_SIZE(bits); ++i)
+		__atomic_fetch_or(&set->bits[i], bits[i], __ATOMIC_RELAXED);
+	__atomic_store_n(&set->filtering, true, __ATOMIC_RELEASE);
+	for (i = 0; i < ARRAY_SIZE(bits); ++i)
+		__atomic_fetch_and(&set->bits[i], bits[i], __ATOMIC_RELAXED);
+}
+
+/* Allocate and initialize a packet socket. With vnet_hdr, ask the
+ * kernel for the virtio_net_hdr of each sniffed packet, to find the
+ * gso_size of GSO super-packets (Linux only).
+ */
+extern struct packet_socket *packet_socket_new(const char *device_name,
+					       bool vnet_hdr);
 
 /* Free all the memory used by the packet socket. */
 extern void packet_socket_free(struct packet_socket *packet_socket);
@@ -49,12 +101,37 @@ extern void packet_socket_set_filter(
 	const struct ether_addr *client_ether_addr,
 	const struct ip_address *client_live_ip);
 
+/* Replace any filter with one that drops TCP and UDP packets whose
+ * destination port (in network byte order) is not one of the given
+ * ones, but keeps all other packets; or, if num_ports is negative,
+ * one that keeps everything. The kernel does the dropping where it
+ * can, for up to NETDEV_MAX_SNIFF_PORTS ports; past that, and for
+ * frames its filter does not follow, the ports are left for
+ * packet_socket_wants_port() to check in user space.
+ */
+extern void packet_socket_set_port_filter(struct packet_socket *psock,
+					  const __be16 *ports, int num_ports);
+
+/* Does the port filter keep frames to the given destination port? */
+extern bool packet_socket_wants_port(struct packet_socket *psock,
+				     __be16 port);
+
 /* Send the given packet using writev. Return STATUS_OK on success,
  * or STATUS_ERR if writev returns an error.
  */
 extern int packet_socket_writev(struct packet_socket *psock,
 				const struct iovec *iov, int iovcnt);
 
+/* Send a train of num_frames frames, each made of iov_per_frame
+ * consecutive entries of iov, as close to back to back as we can:
+ * on Linux, queued in a memory-mapped TX ring and handed to the kernel
+ * with a single system call. Return STATUS_OK on success, or
+ * STATUS_ERR on error.
+ */
+extern int packet_socket_writev_batch(struct packet_socket *psock,
+				      const struct iovec *iov,
+				      int iov_per_frame, int num_frames);
+
 /* Do a blocking sniff of the next packet going over the given device
  * in the given direction, fill in the given packet with the sniffed
  * packet info, and return the number of bytes in the packet in
@@ -66,4 +143,35 @@ extern int packet_socket_receive(struct packet_socket *psock,
 				 enum direction_t direction,
 				 struct packet *packet, int *in_bytes);
 
+/* A packet socket with a memory-mapped ring may receive a packet by
+ * lending it the ring frame as its buffer rather than copying it. Hand
+ * any such frame back, and give the packet its own buffer again; the
+ * next receive, or packet_free(), does this too.
+ */
+extern void packet_socket_return_frame(struct packet_socket *psock,
+				       struct packet *packet);
+
+/* Return the packet, with PACKET_READ_BYTES of buffer, that sniffs on
+ * the given packet socket read into before keeping a right-sized copy
+ * of each packet they want. Only one thread may sniff on the socket.
+ */
+extern struct packet *packet_socket_read_packet(struct packet_socket *psock);
+
+/* Have the NIC timestamp the packets we sniff and send, so that the
+ * times of sniffed packets, and packet_socket_tx_timestamp_nsecs(),
+ * are the NIC's. These are times on the NIC's clock, so they are
+ * only useful if that is synced to the system clock (e.g. with
+ * phc2sys). Returns STATUS_OK on success; on failure, say if the NIC
+ * cannot timestamp, returns STATUS_ERR and sets error message.
+ */
+extern int packet_socket_enable_hw_timestamps(struct packet_socket *psock,
+					      char **error);
+
+/* After packet_socket_enable_hw_timestamps(), return the time in
+ * nanoseconds at which the last packet we sent with
+ * packet_socket_writev() left, preferring the NIC's timestamp to the
+ * kernel's, or 0 if it does not come back in time.
+ */
+extern s64 packet_socket_tx_timestamp_nsecs(struct packet_socket *psock);
+
 #endif /* __PACKET_SOCKET_H__ */
@@ -27,27 +27,122 @@
 #include <assert.h>
 #include <errno.h>
 #include <net/if.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
 #ifdef linux
 
-#include <netpacket/packet.h>
 #include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
 
 #include "ethernet.h"
 #include "logging.h"
+#include "netdev.h"
+#include "time_source.h"
+#include "tun.h"
 
 /* Number of bytes to buffer in the packet socket we use for sniffing. */
 static const int PACKET_SOCKET_RCVBUF_BYTES = 2*1024*1024;
 
+/* Geometry of the TPACKET_V3 receive ring. Each block must be able
+ * to hold the largest packet we sniff (PACKET_READ_BYTES) plus the
+ * per-frame headers, and the whole ring is sized like the old
+ * receive buffer. The kernel only hands a block over to us when it
+ * is full or when it has been open for PACKET_RING_BLOCK_TIMEOUT_MS,
+ * so we use the smallest timeout the kernel supports; this bounds
+ * how late we notice a packet, while the kernel timestamp we report
+ * for the packet is unaffected.
+ */
+static const int PACKET_RING_BLOCK_BYTES = 128*1024;
+static const int PACKET_RING_BLOCK_COUNT = 16;
+static const int PACKET_RING_FRAME_BYTES = 2048;
+static const int PACKET_RING_BLOCK_TIMEOUT_MS = 1;
+
+/* Geometry of the TPACKET_V2 transmit ring we queue trains of frames
+ * in, to send them all with one system call. Frames too big for a
+ * slot go out with writev() instead.
+ */
+static const int PACKET_TX_RING_BLOCK_BYTES = 64*1024;
+static const int PACKET_TX_RING_BLOCK_COUNT = 8;
+static const int PACKET_TX_RING_FRAME_BYTES = 2048;
+
+/* Without a ring, the most frames we pull from the socket with one
+ * recvmmsg() call. Each frame buffer holds PACKET_READ_BYTES.
+ */
+#define PACKET_BATCH_FRAMES 16
+
+/* One frame of a recvmmsg() batch, with its address and timestamp. */
+struct packet_batch_frame {
+	struct sockaddr_ll from;
+	struct virtio_net_hdr vnet;	/* read only with vnet_hdr */
+	struct iovec iov[2];		/* vnet (if used), then frame */
+	char control[CMSG_SPACE(sizeof(struct timespec)) +
+		     CMSG_SPACE(3 * sizeof(struct timespec))];
+};
+
+/* How long we wait for the kernel to hand back the TX timestamp of a
+ * packet we sent, which a NIC may take a little while to report.
+ */
+#define PACKET_TX_TIMESTAMP_WAIT_MS 1
+
 struct packet_socket {
 	int packet_fd;	/* socket for sending, sniffing timestamped packets */
+	struct packet *read_packet;	/* see packet_socket_read_packet() */
+	struct port_set ports;	/* see packet_socket_wants_port() */
 	char *name;	/* malloc-allocated copy of interface name */
 	int index;	/* interface index from if_nametoindex */
+	bool vnet_hdr;	/* sniffed frames come after a virtio_net_hdr? */
+
+	/* TPACKET_V3 RX ring state; ring is NULL if the kernel did
+	 * not let us set up a ring, in which case we fall back to
+	 * recvmmsg() batches below.
+	 */
+	u8 *ring;		/* mmap-ed ring of ring_block_count blocks */
+	int ring_bytes;		/* total size of the mapping */
+	int ring_block_bytes;	/* size of each block */
+	int ring_block_count;	/* number of blocks in the ring */
+	int ring_block;		/* index of block we are reading */
+	u8 *ring_frame;		/* next frame to read in current block */
+	int ring_frames_left;	/* unread frames in current block */
+	struct packet *ring_lent;	/* packet lent ring_frame, or NULL */
+	u8 *ring_lent_buffer;		/* its own buffer, while lent */
+	u32 ring_lent_buffer_bytes;	/* bytes of space in that buffer */
+
+	/* recvmmsg() batch state, used when there is no ring; batch is
+	 * NULL if there is no ring and the kernel would not give us
+	 * SO_TIMESTAMPNS control messages either, in which case we fall
+	 * back to recvfrom() and SIOCGSTAMP.
+	 */
+	u8 *batch;		/* PACKET_BATCH_FRAMES frame buffers */
+	struct mmsghdr batch_msgs[PACKET_BATCH_FRAMES];
+	struct packet_batch_frame batch_frames[PACKET_BATCH_FRAMES];
+	int batch_count;	/* frames received by last recvmmsg() */
+	int batch_next;		/* index of next frame to read */
+
+	/* TPACKET_V2 TX ring state, set up on the first batch we send.
+	 * The ring has a socket of its own, bound to receive nothing,
+	 * since the kernel will not add a TX ring to a socket whose RX
+	 * ring is already mapped. tx_ring is NULL if the kernel did not
+	 * let us set up the ring, in which case batches go out with a
+	 * writev() per frame.
+	 */
+	bool tx_ring_tried;	/* have we tried setting up the ring? */
+	int tx_fd;		/* socket for the TX ring, or -1 */
+	u8 *tx_ring;		/* mmap-ed ring of tx_frame_count frames */
+	int tx_ring_bytes;	/* total size of the mapping */
+	int tx_frame_bytes;	/* size of each frame slot */
+	int tx_frame_count;	/* number of frame slots in the ring */
+	int tx_frame;		/* index of next slot to fill */
+
+	bool hw_timestamps;	/* SO_TIMESTAMPING with NIC timestamps? */
 };
 
 /* Set the receive buffer for a socket to the given size in bytes. */
@@ -70,6 +165,87 @@ static void bind_to_interface(int fd, int interface_index)
 		die_perror("bind packet socket");
 }
 
+/* Try to set up a memory-mapped TPACKET_V3 receive ring for the
+ * packet socket, so that we can sniff packets and their timestamps
+ * without making two system calls per packet. If the kernel does not
+ * support this, leave psock->ring NULL and sniff with recvfrom().
+ */
+static void packet_ring_setup(struct packet_socket *psock)
+{
+	struct tpacket_req3 req;
+	int version = TPACKET_V3;
+	void *ring = NULL;
+
+	if (setsockopt(psock->packet_fd, SOL_PACKET, PACKET_VERSION,
+		       &version, sizeof(version)) < 0) {
+		DEBUGP("TPACKET_V3 not supported: %s\n", strerror(errno));
+		return;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size	= PACKET_RING_BLOCK_BYTES;
+	req.tp_block_nr		= PACKET_RING_BLOCK_COUNT;
+	req.tp_frame_size	= PACKET_RING_FRAME_BYTES;
+	req.tp_frame_nr		= ((PACKET_RING_BLOCK_BYTES /
+				    PACKET_RING_FRAME_BYTES) *
+				   PACKET_RING_BLOCK_COUNT);
+	req.tp_retire_blk_tov	= PACKET_RING_BLOCK_TIMEOUT_MS;
+
+	if (setsockopt(psock->packet_fd, SOL_PACKET, PACKET_RX_RING,
+		       &req, sizeof(req)) < 0) {
+		DEBUGP("PACKET_RX_RING failed: %s\n", strerror(errno));
+		return;
+	}
+
+	ring = mmap(NULL, req.tp_block_size * req.tp_block_nr,
+		    PROT_READ | PROT_WRITE, MAP_SHARED,
+		    psock->packet_fd, 0);
+	if (ring == MAP_FAILED)
+		die_perror("mmap packet socket RX ring");
+
+	psock->ring		= ring;
+	psock->ring_bytes	= req.tp_block_size * req.tp_block_nr;
+	psock->ring_block_bytes	= req.tp_block_size;
+	psock->ring_block_count	= req.tp_block_nr;
+	psock->ring_block	= 0;
+	psock->ring_frame	= NULL;
+	psock->ring_frames_left	= 0;
+	DEBUGP("packet socket RX ring: %d blocks of %d bytes\n",
+	       psock->ring_block_count, psock->ring_block_bytes);
+}
+
+/* Without a ring, try to get timestamps as control messages, so that
+ * we can sniff a burst of packets and their timestamps with a single
+ * recvmmsg() rather than a recvfrom() and SIOCGSTAMP per packet. If
+ * the kernel does not support this, leave psock->batch NULL.
+ */
+static void packet_batch_setup(struct packet_socket *psock)
+{
+	int on = 1;
+	int i;
+
+	if (setsockopt(psock->packet_fd, SOL_SOCKET, SO_TIMESTAMPNS,
+		       &on, sizeof(on)) < 0) {
+		DEBUGP("SO_TIMESTAMPNS not supported: %s\n", strerror(errno));
+		return;
+	}
+
+	psock->batch = malloc(PACKET_BATCH_FRAMES * PACKET_READ_BYTES);
+	if (psock->batch == NULL)
+		die_perror("malloc packet socket batch");
+	for (i = 0; i < PACKET_BATCH_FRAMES; ++i) {
+		struct packet_batch_frame *frame = &psock->batch_frames[i];
+
+		frame->iov[0].iov_base = &frame->vnet;
+		frame->iov[0].iov_len = sizeof(frame->vnet);
+		frame->iov[1].iov_base = psock->batch + i * PACKET_READ_BYTES;
+		frame->iov[1].iov_len = PACKET_READ_BYTES;
+	}
+	psock->batch_count = 0;
+	psock->batch_next = 0;
+	DEBUGP("packet socket batches: %d frames\n", PACKET_BATCH_FRAMES);
+}
+
 /* Allocate and configure a packet socket just like the one tcpdump
  * uses. We do this so we can get timestamps on the outbound packets
  * the kernel sends, to verify the correct timing (tun devices do not
@@ -79,6 +255,8 @@ static void bind_to_interface(int fd, int interface_index)
  */
 static void packet_socket_setup(struct packet_socket *psock)
 {
+	int on = 1;
+
 	psock->packet_fd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
 	if (psock->packet_fd < 0)
 		die_perror("socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL))");
@@ -91,6 +269,16 @@ static void packet_socket_setup(struct packet_socket *psock)
 	bind_to_interface(psock->packet_fd, psock->index);
 
 	set_receive_buffer_size(psock->packet_fd, PACKET_SOCKET_RCVBUF_BYTES);
+
+	/* This must come before we set up any ring. */
+	if (psock->vnet_hdr &&
+	    setsockopt(psock->packet_fd, SOL_PACKET, PACKET_VNET_HDR,
+		       &on, sizeof(on)) < 0)
+		die_perror("setsockopt SOL_PACKET, PACKET_VNET_HDR");
+
+	packet_ring_setup(psock);
+	if (psock->ring == NULL)
+		packet_batch_setup(psock);
 }
 
 /* Add a filter so we only sniff packets we want. */
@@ -180,12 +368,95 @@ void packet_socket_set_filter(struct packet_socket *psock,
 	}
 }
 
-struct packet_socket *packet_socket_new(const char *device_name)
+void packet_socket_set_port_filter(struct packet_socket *psock,
+				   const __be16 *ports, int num_ports)
+{
+	/* All loads are relative to the network header (SKF_NET_OFF), so
+	 * the program works whatever the link layer. The port checks
+	 * start at PORTS, followed by the final "drop" and "keep"
+	 * instructions; J(from, to) is the jump offset between the two.
+	 */
+	enum { V6 = 11, PORTS = 16 };
+	const int drop = PORTS + (num_ports > 0 ? num_ports : 0);
+	const int keep = drop + 1;
+#define J(from, to)	((to) - (from) - 1)
+	struct sock_filter prefix[PORTS] = {
+		/* 0-2: IPv4? Else go check for IPv6. */
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 0),
+		BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xf0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x40, 0, J(2, V6)),
+		/* 3-5: keep anything but TCP and UDP. */
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 9),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 1, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP,
+			 0, J(5, keep)),
+		/* 6-7: keep non-first fragments, which have no ports. */
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_NET_OFF + 6),
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, J(7, keep), 0),
+		/* 8-10: load the destination port after the IPv4 header. */
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, SKF_NET_OFF + 0),
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, SKF_NET_OFF + 2),
+		BPF_STMT(BPF_JMP | BPF_JA, J(10, PORTS)),
+		/* 11-15: likewise for IPv6 without extension headers. */
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x60, 0, J(V6, keep)),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 6),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 1, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP,
+			 0, J(14, keep)),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_NET_OFF + 40 + 2),
+	};
+	struct sock_filter filter[PORTS + NETDEV_MAX_SNIFF_PORTS + 2];
+	struct sock_fprog bpfcode;
+	int n = 0, i;
+
+	/* Past what our BPF program takes, leave it to user space. */
+	port_set_update(&psock->ports, ports, num_ports);
+	if (num_ports > NETDEV_MAX_SNIFF_PORTS)
+		num_ports = -1;
+
+	if (num_ports < 0) {
+		filter[n++] = (struct sock_filter)
+			BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	} else {
+		assert(num_ports <= NETDEV_MAX_SNIFF_PORTS);
+		memcpy(filter, prefix, sizeof(prefix));
+		/* Keep packets to one of our ports, and drop the rest. */
+		for (i = 0; i < num_ports; ++i) {
+			struct sock_filter check = BPF_JUMP(
+				BPF_JMP | BPF_JEQ | BPF_K, ntohs(ports[i]),
+				J(PORTS + i, keep), 0);
+			filter[PORTS + i] = check;
+		}
+		filter[drop] = (struct sock_filter)
+			BPF_STMT(BPF_RET | BPF_K, 0);
+		filter[keep] = (struct sock_filter)
+			BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+		n = keep + 1;
+	}
+#undef J
+
+	bpfcode.len	= n;
+	bpfcode.filter	= filter;
+	DEBUGP("setting BPF port filter: %d ports\n", num_ports);
+	if (setsockopt(psock->packet_fd, SOL_SOCKET, SO_ATTACH_FILTER,
+		       &bpfcode, sizeof(bpfcode)) < 0)
+		die_perror("setsockopt SOL_SOCKET, SO_ATTACH_FILTER");
+}
+
+bool packet_socket_wants_port(struct packet_socket *psock, __be16 port)
+{
+	return port_set_has(&psock->ports, port);
+}
+
+struct packet_socket *packet_socket_new(const char *device_name,
+				       bool vnet_hdr)
 {
 	struct packet_socket *psock = calloc(1, sizeof(struct packet_socket));
 
 	psock->name = strdup(device_name);
 	psock->packet_fd = -1;
+	psock->tx_fd = -1;
+	psock->vnet_hdr = vnet_hdr;
 
 	packet_socket_setup(psock);
 
@@ -194,16 +465,35 @@ struct packet_socket *packet_socket_new(const char *device_name)
 
 void packet_socket_free(struct packet_socket *psock)
 {
+	if (psock->ring_lent != NULL)
+		packet_socket_return_frame(psock, psock->ring_lent);
+	if (psock->ring != NULL)
+		munmap(psock->ring, psock->ring_bytes);
+	free(psock->batch);
+	if (psock->tx_ring != NULL)
+		munmap(psock->tx_ring, psock->tx_ring_bytes);
+	if (psock->tx_fd >= 0)
+		close(psock->tx_fd);
+
 	if (psock->packet_fd >= 0)
 		close(psock->packet_fd);
 
 	if (psock->name != NULL)
 		free(psock->name);
+	if (psock->read_packet != NULL)
+		packet_free(psock->read_packet);
 
 	memset(psock, 0, sizeof(*psock));	/* paranoia to catch bugs*/
 	free(psock);
 }
 
+struct packet *packet_socket_read_packet(struct packet_socket *psock)
+{
+	if (psock->read_packet == NULL)
+		psock->read_packet = packet_new(PACKET_READ_BYTES);
+	return psock->read_packet;
+}
+
 int packet_socket_writev(struct packet_socket *psock,
 			 const struct iovec *iov, int iovcnt)
 {
@@ -214,38 +504,228 @@ int packet_socket_writev(struct packet_socket *psock,
 	return STATUS_OK;
 }
 
-int packet_socket_receive(struct packet_socket *psock,
-			  enum direction_t direction,
-			  struct packet *packet, int *in_bytes)
+/* Try to set up the TX ring for sending trains; see struct
+ * packet_socket. If the kernel does not support it, leave
+ * psock->tx_ring NULL.
+ */
+static void packet_tx_ring_setup(struct packet_socket *psock)
 {
-	struct sockaddr_ll from;
-	memset(&from, 0, sizeof(from));
-	socklen_t from_len = sizeof(from);
+	struct sockaddr_ll sll;
+	struct tpacket_req req;
+	int version = TPACKET_V2;
+	void *ring = NULL;
 
-	/* Read the packet out of our kernel packet socket buffer. */
-	*in_bytes = recvfrom(psock->packet_fd,
-			     packet->buffer, packet->buffer_bytes, 0,
-			     (struct sockaddr *)&from, &from_len);
-	assert(*in_bytes <= packet->buffer_bytes);
-	if (*in_bytes < 0) {
-		if (errno == EINTR) {
-			DEBUGP("EINTR\n");
+	psock->tx_ring_tried = true;
+
+	/* Protocol 0: this socket only sends. */
+	psock->tx_fd = socket(PF_PACKET, SOCK_RAW, 0);
+	if (psock->tx_fd < 0) {
+		DEBUGP("TX ring socket failed: %s\n", strerror(errno));
+		return;
+	}
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family		= AF_PACKET;
+	sll.sll_ifindex		= psock->index;
+	sll.sll_protocol	= 0;
+	if (bind(psock->tx_fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+		die_perror("bind packet socket TX ring");
+
+	if (setsockopt(psock->tx_fd, SOL_PACKET, PACKET_VERSION,
+		       &version, sizeof(version)) < 0) {
+		DEBUGP("TPACKET_V2 not supported: %s\n", strerror(errno));
+		goto no_ring;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size	= PACKET_TX_RING_BLOCK_BYTES;
+	req.tp_block_nr		= PACKET_TX_RING_BLOCK_COUNT;
+	req.tp_frame_size	= PACKET_TX_RING_FRAME_BYTES;
+	req.tp_frame_nr		= ((PACKET_TX_RING_BLOCK_BYTES /
+				    PACKET_TX_RING_FRAME_BYTES) *
+				   PACKET_TX_RING_BLOCK_COUNT);
+	if (setsockopt(psock->tx_fd, SOL_PACKET, PACKET_TX_RING,
+		       &req, sizeof(req)) < 0) {
+		DEBUGP("PACKET_TX_RING failed: %s\n", strerror(errno));
+		goto no_ring;
+	}
+
+	ring = mmap(NULL, req.tp_block_size * req.tp_block_nr,
+		    PROT_READ | PROT_WRITE, MAP_SHARED, psock->tx_fd, 0);
+	if (ring == MAP_FAILED)
+		die_perror("mmap packet socket TX ring");
+
+	psock->tx_ring		= ring;
+	psock->tx_ring_bytes	= req.tp_block_size * req.tp_block_nr;
+	psock->tx_frame_bytes	= req.tp_frame_size;
+	psock->tx_frame_count	= req.tp_frame_nr;
+	psock->tx_frame		= 0;
+	DEBUGP("packet socket TX ring: %d frames of %d bytes\n",
+	       psock->tx_frame_count, psock->tx_frame_bytes);
+	return;
+
+no_ring:
+	close(psock->tx_fd);
+	psock->tx_fd = -1;
+}
+
+/* Return the header of the TX ring slot with the given index. */
+static struct tpacket2_hdr *packet_tx_slot(struct packet_socket *psock,
+					   int index)
+{
+	return (struct tpacket2_hdr *)
+		(psock->tx_ring + index * psock->tx_frame_bytes);
+}
+
+/* Offset of frame data from the start of a TPACKET_V2 TX slot. */
+#define PACKET_TX_DATA_OFFSET \
+	(TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+/* Hand every queued TX ring slot to the kernel and wait for it to
+ * send them all.
+ */
+static int packet_tx_ring_kick(struct packet_socket *psock)
+{
+	while (sendto(psock->tx_fd, NULL, 0, 0, NULL, 0) < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == ENOBUFS)
+			continue;
+		perror("sendto packet socket TX ring");
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* Wait until the given TX ring slot is free for us to fill. The kernel
+ * frees slots as the device finishes with their frames, so after a
+ * kick this is normally immediate.
+ */
+static int packet_tx_slot_wait(struct packet_socket *psock,
+			       struct tpacket2_hdr *slot)
+{
+	while (1) {
+		struct pollfd pfd = { .fd = psock->tx_fd, .events = POLLOUT };
+		u32 status = __atomic_load_n(&slot->tp_status,
+					     __ATOMIC_ACQUIRE);
+
+		if (status == TP_STATUS_AVAILABLE)
+			return STATUS_OK;
+		if (status & TP_STATUS_WRONG_FORMAT) {
+			fprintf(stderr, "packet socket TX ring: kernel "
+				"rejected a frame\n");
+			__atomic_store_n(&slot->tp_status, TP_STATUS_AVAILABLE,
+					 __ATOMIC_RELEASE);
 			return STATUS_ERR;
-		} else {
-			die_perror("packet socket recvfrom()");
 		}
+		if (status & TP_STATUS_SEND_REQUEST) {
+			/* Queued by us but not yet kicked. */
+			if (packet_tx_ring_kick(psock))
+				return STATUS_ERR;
+			continue;
+		}
+		if (poll(&pfd, 1, 1) < 0 && errno != EINTR)
+			die_perror("poll packet socket TX ring");
 	}
+}
+
+int packet_socket_writev_batch(struct packet_socket *psock,
+			       const struct iovec *iov, int iov_per_frame,
+			       int num_frames)
+{
+	int queued = 0;
+	int i, j;
+
+	if (!psock->tx_ring_tried)
+		packet_tx_ring_setup(psock);
+
+	for (i = 0; i < num_frames; ++i) {
+		const struct iovec *frame_iov = iov + i * iov_per_frame;
+		struct tpacket2_hdr *slot = NULL;
+		int frame_bytes = 0;
+		u8 *data = NULL;
+
+		for (j = 0; j < iov_per_frame; ++j)
+			frame_bytes += frame_iov[j].iov_len;
+
+		if (psock->tx_ring == NULL ||
+		    frame_bytes > psock->tx_frame_bytes -
+				  PACKET_TX_DATA_OFFSET) {
+			/* Keep the train in order around frames that
+			 * do not fit in the ring.
+			 */
+			if (queued > 0 && packet_tx_ring_kick(psock))
+				return STATUS_ERR;
+			queued = 0;
+			if (packet_socket_writev(psock, frame_iov,
+						 iov_per_frame))
+				return STATUS_ERR;
+			continue;
+		}
+
+		slot = packet_tx_slot(psock, psock->tx_frame);
+		if (packet_tx_slot_wait(psock, slot))
+			return STATUS_ERR;
+		data = (u8 *)slot + PACKET_TX_DATA_OFFSET;
+		for (j = 0; j < iov_per_frame; ++j) {
+			memcpy(data, frame_iov[j].iov_base,
+			       frame_iov[j].iov_len);
+			data += frame_iov[j].iov_len;
+		}
+		slot->tp_len = frame_bytes;
+		__atomic_store_n(&slot->tp_status, TP_STATUS_SEND_REQUEST,
+				 __ATOMIC_RELEASE);
+		psock->tx_frame = (psock->tx_frame + 1) % psock->tx_frame_count;
+		++queued;
+	}
+
+	if (queued > 0 && packet_tx_ring_kick(psock))
+		return STATUS_ERR;
+	return STATUS_OK;
+}
+
+/* Record what the kernel reported for a sniffed packet in its vnet
+ * header: the GSO segment size, if it is a TCP or UDP GSO
+ * super-packet, and where the device is to finish its checksum, if
+ * the kernel left that partial.
+ */
+static void packet_set_vnet(struct packet *packet,
+			    const struct virtio_net_hdr *vnet)
+{
+	u8 gso_type = vnet->gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+
+	if (gso_type == VIRTIO_NET_HDR_GSO_TCPV4 ||
+	    gso_type == VIRTIO_NET_HDR_GSO_TCPV6 ||
+	    gso_type == VIRTIO_NET_HDR_GSO_UDP_L4)
+		packet->gso_size = vnet->gso_size;
+	else
+		packet->gso_size = 0;
+
+	if (vnet->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+		packet->flags |= FLAG_CSUM_PARTIAL;
+		packet->csum_start = vnet->csum_start;
+		packet->csum_offset = vnet->csum_offset;
+	} else {
+		packet->flags &= ~FLAG_CSUM_PARTIAL;
+		packet->csum_start = 0;
+		packet->csum_offset = 0;
+	}
+}
 
+/* Return true if the kernel tells us (in *from) that it sniffed the
+ * packet on our device and in the direction we want.
+ */
+static bool is_wanted_packet(struct packet_socket *psock,
+			     enum direction_t direction,
+			     const struct sockaddr_ll *from)
+{
 	/* We only want packets our kernel is sending out. */
 	if (direction == DIRECTION_OUTBOUND &&
-	    from.sll_pkttype != PACKET_OUTGOING) {
+	    from->sll_pkttype != PACKET_OUTGOING) {
 		DEBUGP("not outbound\n");
-		return STATUS_ERR;
+		return false;
 	}
 	if (direction == DIRECTION_INBOUND &&
-	    from.sll_pkttype != PACKET_HOST) {
+	    from->sll_pkttype != PACKET_HOST) {
 		DEBUGP("not inbound\n");
-		return STATUS_ERR;
+		return false;
 	}
 
 	/* We only want packets on our tun device. The kernel
@@ -253,21 +733,412 @@ int packet_socket_receive(struct packet_socket *psock,
 	 * buffer before we bind the packet socket to the tun
 	 * device.
 	 */
-	if (from.sll_ifindex != psock->index) {
+	if (from->sll_ifindex != psock->index) {
 		DEBUGP("not correct index\n");
-		return STATUS_ERR;
+		return false;
+	}
+
+	return true;
+}
+
+/* Return the ring block we are currently reading. */
+static struct tpacket_block_desc *ring_current_block(
+	struct packet_socket *psock)
+{
+	return (struct tpacket_block_desc *)
+		(psock->ring + psock->ring_block * psock->ring_block_bytes);
+}
+
+/* Hand the block we have finished reading back to the kernel. */
+static void ring_release_block(struct packet_socket *psock)
+{
+	struct tpacket_block_desc *block = ring_current_block(psock);
+
+	__sync_synchronize();	/* finish reading before kernel reuses it */
+	block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	psock->ring_block = (psock->ring_block + 1) % psock->ring_block_count;
+	psock->ring_frame = NULL;
+}
+
+/* Move past the frame we have just read, handing its block back to
+ * the kernel if that was the last frame in it.
+ */
+static void ring_next_frame(struct packet_socket *psock)
+{
+	struct tpacket3_hdr *frame = (struct tpacket3_hdr *)psock->ring_frame;
+
+	if (--psock->ring_frames_left > 0)
+		psock->ring_frame += frame->tp_next_offset;
+	else
+		ring_release_block(psock);
+}
+
+void packet_socket_return_frame(struct packet_socket *psock,
+				struct packet *packet)
+{
+	if (packet == NULL || packet != psock->ring_lent)
+		return;
+
+	packet->buffer = psock->ring_lent_buffer;
+	packet->buffer_bytes = psock->ring_lent_buffer_bytes;
+	packet->release = NULL;
+	packet->release_arg = NULL;
+	psock->ring_lent = NULL;
+	ring_next_frame(psock);
+}
+
+/* Give a lent ring frame back to the kernel, when its packet is freed. */
+static void release_ring_frame(struct packet *packet)
+{
+	packet_socket_return_frame(packet->release_arg, packet);
+	packet_free(packet);
+}
+
+/* Sniff the next packet from the RX ring. We look at the
+ * sockaddr_ll the kernel stores with each frame in place, in the
+ * ring, and skip packets we do not want without copying them or
+ * making any system calls. A wanted packet is not copied either: the
+ * frame is lent to the packet as its buffer, with its timestamp taken
+ * from the frame header, until packet_socket_return_frame(), the next
+ * receive, or packet_free() hands it back.
+ */
+static int packet_ring_receive(struct packet_socket *psock,
+			       enum direction_t direction,
+			       struct packet *packet, int *in_bytes)
+{
+	if (psock->ring_lent != NULL)
+		packet_socket_return_frame(psock, psock->ring_lent);
+
+	while (1) {
+		struct tpacket_block_desc *block = ring_current_block(psock);
+		struct tpacket3_hdr *frame = NULL;
+		const struct sockaddr_ll *from = NULL;
+		bool wanted = false;
+
+		if (psock->ring_frame == NULL) {
+			struct pollfd pfd;
+
+			if (block->hdr.bh1.block_status & TP_STATUS_USER) {
+				__sync_synchronize();
+				psock->ring_frame = (u8 *)block +
+				    block->hdr.bh1.offset_to_first_pkt;
+				psock->ring_frames_left =
+				    block->hdr.bh1.num_pkts;
+				if (psock->ring_frames_left == 0)
+					ring_release_block(psock);
+				continue;
+			}
+
+			/* Block until the kernel hands us a block. */
+			memset(&pfd, 0, sizeof(pfd));
+			pfd.fd = psock->packet_fd;
+			pfd.events = POLLIN | POLLERR;
+			if (poll(&pfd, 1, -1) < 0) {
+				if (errno == EINTR) {
+					DEBUGP("EINTR\n");
+					return STATUS_ERR;
+				} else {
+					die_perror("packet socket poll()");
+				}
+			}
+			continue;
+		}
+
+		frame = (struct tpacket3_hdr *)psock->ring_frame;
+		from = (const struct sockaddr_ll *)
+			((u8 *)frame + TPACKET_ALIGN(sizeof(*frame)));
+
+		wanted = is_wanted_packet(psock, direction, from);
+		if (wanted) {
+			psock->ring_lent = packet;
+			psock->ring_lent_buffer = packet->buffer;
+			psock->ring_lent_buffer_bytes = packet->buffer_bytes;
+			packet->buffer = (u8 *)frame + frame->tp_mac;
+			packet->buffer_bytes = frame->tp_snaplen;
+			packet->release = release_ring_frame;
+			packet->release_arg = psock;
+			*in_bytes = frame->tp_snaplen;
+			/* The kernel puts any vnet header just before. */
+			if (psock->vnet_hdr)
+				packet_set_vnet(
+					packet,
+					(struct virtio_net_hdr *)
+					((u8 *)frame + frame->tp_mac -
+					 sizeof(struct virtio_net_hdr)));
+			packet_set_time_nsecs(packet,
+					      time_from_realtime_nsecs(
+						      ((s64)frame->tp_sec) *
+						      1000000000LL +
+						      frame->tp_nsec));
+			DEBUGP("sniffed packet sent at %u.%09u = %lld\n",
+			       frame->tp_sec, frame->tp_nsec,
+			       packet->time_usecs);
+			return STATUS_OK;
+		}
+
+		ring_next_frame(psock);
+	}
+
+	assert(!"should not be reached");
+	return STATUS_ERR;	/* not reached */
+}
+
+/* Refill the batch with as many frames as the socket has queued,
+ * blocking until there is at least one.
+ */
+static int packet_batch_refill(struct packet_socket *psock)
+{
+	int i, count;
+
+	for (i = 0; i < PACKET_BATCH_FRAMES; ++i) {
+		struct packet_batch_frame *frame = &psock->batch_frames[i];
+		struct msghdr *msg = &psock->batch_msgs[i].msg_hdr;
+
+		memset(msg, 0, sizeof(*msg));
+		msg->msg_name		= &frame->from;
+		msg->msg_namelen	= sizeof(frame->from);
+		msg->msg_iov		= psock->vnet_hdr ?
+					  frame->iov : frame->iov + 1;
+		msg->msg_iovlen		= psock->vnet_hdr ? 2 : 1;
+		msg->msg_control	= frame->control;
+		msg->msg_controllen	= sizeof(frame->control);
+	}
+
+	count = recvmmsg(psock->packet_fd, psock->batch_msgs,
+			 PACKET_BATCH_FRAMES, MSG_WAITFORONE, NULL);
+	if (count < 0) {
+		if (errno == EINTR) {
+			DEBUGP("EINTR\n");
+			return STATUS_ERR;
+		} else {
+			die_perror("packet socket recvmmsg()");
+		}
 	}
+	psock->batch_count = count;
+	psock->batch_next = 0;
+	return STATUS_OK;
+}
+
+/* Return the timestamp of an SCM_TIMESTAMPING control message: the
+ * NIC's if it took one, else the kernel's, or 0 if it has neither.
+ */
+static s64 timestamping_nsecs(struct cmsghdr *cmsg)
+{
+	struct timespec ts[3];	/* software, legacy, raw hardware */
+
+	memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+	if (ts[2].tv_sec != 0 || ts[2].tv_nsec != 0)
+		return timespec_to_nsecs(&ts[2]);
+	return timespec_to_nsecs(&ts[0]);
+}
+
+/* Return the timestamp of the given batch message in nanoseconds,
+ * preferring a NIC timestamp when we asked for those.
+ */
+static s64 packet_batch_timestamp(struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	s64 nsecs = 0, hw_nsecs = 0;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+		if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec ts;
+
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			nsecs = timespec_to_nsecs(&ts);
+		} else if (cmsg->cmsg_type == SCM_TIMESTAMPING) {
+			hw_nsecs = timestamping_nsecs(cmsg);
+		}
+	}
+	if (hw_nsecs != 0)
+		return hw_nsecs;
+	if (nsecs == 0)
+		die("packet socket: no SCM_TIMESTAMPNS for sniffed packet\n");
+	return nsecs;
+}
+
+/* Sniff the next packet from the current recvmmsg() batch, pulling in
+ * a new batch when this one is used up.
+ */
+static int packet_batch_receive(struct packet_socket *psock,
+				enum direction_t direction,
+				struct packet *packet, int *in_bytes)
+{
+	while (1) {
+		struct mmsghdr *mmsg = NULL;
+		struct packet_batch_frame *frame = NULL;
+
+		if (psock->batch_next == psock->batch_count &&
+		    packet_batch_refill(psock))
+			return STATUS_ERR;
+
+		mmsg = &psock->batch_msgs[psock->batch_next];
+		frame = &psock->batch_frames[psock->batch_next];
+		++psock->batch_next;
+
+		if (!is_wanted_packet(psock, direction, &frame->from))
+			continue;
+
+		*in_bytes = mmsg->msg_len;
+		if (psock->vnet_hdr) {
+			*in_bytes -= sizeof(frame->vnet);
+			packet_set_vnet(packet, &frame->vnet);
+		}
+		*in_bytes = min(*in_bytes, packet->buffer_bytes);
+		memcpy(packet->buffer, frame->iov[1].iov_base, *in_bytes);
+		packet_set_time_nsecs(packet,
+				      time_from_realtime_nsecs(
+					      packet_batch_timestamp(
+						      &mmsg->msg_hdr)));
+		DEBUGP("sniffed packet sent at %lld\n", packet->time_usecs);
+		return STATUS_OK;
+	}
+
+	assert(!"should not be reached");
+	return STATUS_ERR;	/* not reached */
+}
+
+int packet_socket_receive(struct packet_socket *psock,
+			  enum direction_t direction,
+			  struct packet *packet, int *in_bytes)
+{
+	if (psock->ring != NULL)
+		return packet_ring_receive(psock, direction, packet, in_bytes);
+	if (psock->batch != NULL)
+		return packet_batch_receive(psock, direction, packet, in_bytes);
+
+	struct sockaddr_ll from;
+	memset(&from, 0, sizeof(from));
+	struct virtio_net_hdr vnet;
+	struct iovec iov[2] = {
+		{ &vnet, sizeof(vnet) },
+		{ packet->buffer, packet->buffer_bytes }
+	};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name	= &from;
+	msg.msg_namelen	= sizeof(from);
+	msg.msg_iov	= psock->vnet_hdr ? iov : iov + 1;
+	msg.msg_iovlen	= psock->vnet_hdr ? 2 : 1;
+
+	/* Read the packet out of our kernel packet socket buffer. */
+	*in_bytes = recvmsg(psock->packet_fd, &msg, 0);
+	if (*in_bytes < 0) {
+		if (errno == EINTR) {
+			DEBUGP("EINTR\n");
+			return STATUS_ERR;
+		} else {
+			die_perror("packet socket recvmsg()");
+		}
+	}
+	if (psock->vnet_hdr) {
+		*in_bytes -= sizeof(vnet);
+		packet_set_vnet(packet, &vnet);
+	}
+	assert(*in_bytes <= packet->buffer_bytes);
+
+	if (!is_wanted_packet(psock, direction, &from))
+		return STATUS_ERR;
 
 	/* Get the time at which the kernel sniffed the packet. */
-	struct timeval tv;
-	if (ioctl(psock->packet_fd, SIOCGSTAMP, &tv) < 0)
-		die_perror("SIOCGSTAMP");
-	packet->time_usecs = timeval_to_usecs(&tv);
-	DEBUGP("sniffed packet sent at %u.%u = %lld\n",
-	       (u32)tv.tv_sec, (u32)tv.tv_usec,
+	struct timespec ts;
+	if (ioctl(psock->packet_fd, SIOCGSTAMPNS, &ts) < 0)
+		die_perror("SIOCGSTAMPNS");
+	packet_set_time_nsecs(packet,
+			      time_from_realtime_nsecs(timespec_to_nsecs(&ts)));
+	DEBUGP("sniffed packet sent at %u.%09u = %lld\n",
+	       (u32)ts.tv_sec, (u32)ts.tv_nsec,
 	       packet->time_usecs);
 
 	return STATUS_OK;
 }
 
+int packet_socket_enable_hw_timestamps(struct packet_socket *psock,
+				       char **error)
+{
+	struct hwtstamp_config hwconfig;
+	struct ifreq ifr;
+	int flags = (SOF_TIMESTAMPING_RX_HARDWARE |
+		     SOF_TIMESTAMPING_TX_HARDWARE |
+		     SOF_TIMESTAMPING_RAW_HARDWARE |
+		     SOF_TIMESTAMPING_RX_SOFTWARE |
+		     SOF_TIMESTAMPING_TX_SOFTWARE |
+		     SOF_TIMESTAMPING_SOFTWARE |
+		     SOF_TIMESTAMPING_OPT_TSONLY);
+	int ring_flags = SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	if (psock->hw_timestamps)
+		return STATUS_OK;
+
+	/* Have the NIC stamp every packet it sends and receives. */
+	memset(&hwconfig, 0, sizeof(hwconfig));
+	hwconfig.tx_type = HWTSTAMP_TX_ON;
+	hwconfig.rx_filter = HWTSTAMP_FILTER_ALL;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, psock->name, IFNAMSIZ - 1);
+	ifr.ifr_data = (void *)&hwconfig;
+	if (ioctl(psock->packet_fd, SIOCSHWTSTAMP, &ifr) < 0) {
+		asprintf(error, "SIOCSHWTSTAMP on %s: %s",
+			 psock->name, strerror(errno));
+		return STATUS_ERR;
+	}
+
+	/* The RX ring takes its timestamps from PACKET_TIMESTAMP,
+	 * and everything else from SO_TIMESTAMPING.
+	 */
+	if (psock->ring != NULL &&
+	    setsockopt(psock->packet_fd, SOL_PACKET, PACKET_TIMESTAMP,
+		       &ring_flags, sizeof(ring_flags)) < 0) {
+		asprintf(error, "PACKET_TIMESTAMP: %s", strerror(errno));
+		return STATUS_ERR;
+	}
+	if (setsockopt(psock->packet_fd, SOL_SOCKET, SO_TIMESTAMPING,
+		       &flags, sizeof(flags)) < 0) {
+		asprintf(error, "SO_TIMESTAMPING: %s", strerror(errno));
+		return STATUS_ERR;
+	}
+	psock->hw_timestamps = true;
+	return STATUS_OK;
+}
+
+s64 packet_socket_tx_timestamp_nsecs(struct packet_socket *psock)
+{
+	char control[CMSG_SPACE(3 * sizeof(struct timespec)) + 256];
+	struct pollfd pfd = { .fd = psock->packet_fd, .events = 0 };
+	s64 nsecs = 0;
+
+	if (!psock->hw_timestamps)
+		return 0;
+
+	/* The timestamp comes back on the socket's error queue, which
+	 * poll() reports as POLLERR whatever events we ask for.
+	 */
+	if (poll(&pfd, 1, PACKET_TX_TIMESTAMP_WAIT_MS) <= 0 ||
+	    !(pfd.revents & POLLERR))
+		return 0;
+
+	/* Drain the queue, keeping the newest timestamp. */
+	while (1) {
+		struct msghdr msg;
+		struct cmsghdr *cmsg;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(psock->packet_fd, &msg,
+			    MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SCM_TIMESTAMPING)
+				nsecs = timestamping_nsecs(cmsg);
+		}
+	}
+	return nsecs != 0 ? time_from_realtime_nsecs(nsecs) : 0;
+}
+
 #endif  /* linux */
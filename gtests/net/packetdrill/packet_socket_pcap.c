@@ -26,16 +26,20 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <net/if.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
 #ifdef USE_LIBPCAP
 
 #if defined(__FreeBSD__)
+#include <net/bpf.h>	/* before pcap.h, for the zero-copy BPF API */
 #include <pcap/pcap.h>
 #elif defined(__OpenBSD__) || defined(__NetBSD__)
 #include <pcap.h>
@@ -43,15 +47,42 @@
 
 #include "ethernet.h"
 #include "logging.h"
+#include "time_source.h"
 
 struct packet_socket {
 	char *name;	/* malloc-allocated copy of interface name */
+	struct packet *read_packet;	/* see packet_socket_read_packet() */
+	struct port_set ports;	/* see packet_socket_wants_port() */
 
 	pcap_t *pcap;	/* handle for sending, sniffing timestamped packets */
 	char pcap_error[PCAP_ERRBUF_SIZE];	/* for libpcap errors */
 	int pcap_offset;  /* offset of packet data in pcap buffer */
+
+#ifdef HAVE_BPF_ZBUF
+	/* With zero-copy BPF, we sniff with a BPF device of our own, whose
+	 * two buffers the kernel fills in place and hands over to us in
+	 * turn; pcap is then just for injecting. We read all the frames
+	 * of a buffer before handing it back.
+	 */
+	int zbuf_fd;		/* our own BPF device, or -1 if none */
+	u8 *zbufs[2];		/* the two buffers we share with the kernel */
+	size_t zbuf_bytes;	/* size of each buffer */
+	struct bpf_zbuf_header *zbuf;	/* buffer we are reading, or NULL */
+	u8 *zbuf_next;		/* next frame record in it */
+	u8 *zbuf_end;		/* end of its frame records */
+#endif
 };
 
+#ifdef HAVE_BPF_ZBUF
+/* Most bytes we want in each zero-copy buffer; the kernel may allow
+ * fewer (BIOCGETZMAX).
+ */
+#define ZBUF_MAX_BYTES		(1024 * 1024)
+
+/* How long we wait for the kernel to hand us a buffer. */
+#define ZBUF_POLL_MSECS		1
+#endif
+
 #if defined(__OpenBSD__)
 #include <net/bpf.h>
 /* Convert a bpf_timeval to microseconds. */
@@ -69,6 +100,137 @@ extern void die_pcap_perror(pcap_t *pcap, char *message)
 	exit(EXIT_FAILURE);
 }
 
+#ifdef HAVE_BPF_ZBUF
+/* Close our zero-copy BPF device and free its buffers. */
+static void zbuf_close(struct packet_socket *psock)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(psock->zbufs); ++i) {
+		if (psock->zbufs[i] != NULL)
+			munmap(psock->zbufs[i], psock->zbuf_bytes);
+		psock->zbufs[i] = NULL;
+	}
+	if (psock->zbuf_fd >= 0)
+		close(psock->zbuf_fd);
+	psock->zbuf_fd = -1;
+	psock->zbuf = NULL;
+}
+
+/* Open a BPF device on our interface in zero-copy buffer mode, if the
+ * kernel lets us (it needs sysctl net.bpf.zerocopy_enable=1); if not,
+ * we read through pcap as usual. Then stop pcap's own BPF device from
+ * sniffing anything, so the kernel copies each frame just once.
+ */
+static void zbuf_setup(struct packet_socket *psock, int pcap_fd)
+{
+	struct bpf_insn reject_all = BPF_STMT(BPF_RET | BPF_K, 0);
+	struct bpf_program reject_program = { 1, &reject_all };
+	struct bpf_zbuf zbuf;
+	struct ifreq ifr;
+	size_t zmax = 0;
+	int i, mode = BPF_BUFMODE_ZBUF, val = 1;
+
+	psock->zbuf_fd = open("/dev/bpf", O_RDWR);
+	if (psock->zbuf_fd < 0 ||
+	    ioctl(psock->zbuf_fd, BIOCSETBUFMODE, &mode) < 0 ||
+	    ioctl(psock->zbuf_fd, BIOCGETZMAX, &zmax) < 0) {
+		DEBUGP("no zero-copy BPF: %s\n", strerror(errno));
+		zbuf_close(psock);
+		return;
+	}
+
+	psock->zbuf_bytes = min(zmax, ZBUF_MAX_BYTES);
+	psock->zbuf_bytes -= psock->zbuf_bytes % getpagesize();
+	for (i = 0; i < ARRAY_SIZE(psock->zbufs); ++i) {
+		psock->zbufs[i] = mmap(NULL, psock->zbuf_bytes,
+				       PROT_READ | PROT_WRITE, MAP_ANON,
+				       -1, 0);
+		if (psock->zbufs[i] == MAP_FAILED)
+			die_perror("mmap zero-copy BPF buffer");
+	}
+
+	memset(&zbuf, 0, sizeof(zbuf));
+	zbuf.bz_bufa = psock->zbufs[0];
+	zbuf.bz_bufb = psock->zbufs[1];
+	zbuf.bz_buflen = psock->zbuf_bytes;
+	if (ioctl(psock->zbuf_fd, BIOCSETZBUF, &zbuf) < 0)
+		die_perror("ioctl BIOCSETZBUF on bpf fd");
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, psock->name, sizeof(ifr.ifr_name));
+	if (ioctl(psock->zbuf_fd, BIOCSETIF, &ifr) < 0)
+		die_perror("ioctl BIOCSETIF on bpf fd");
+
+	/* As for pcap's device below, so the store buffer can be handed
+	 * over as soon as it has a frame.
+	 */
+	if (ioctl(psock->zbuf_fd, BIOCIMMEDIATE, &val) < 0)
+		die_perror("ioctl BIOCIMMEDIATE on bpf fd");
+
+	if (ioctl(pcap_fd, BIOCSETF, &reject_program) < 0)
+		die_perror("ioctl BIOCSETF on pcap bpf fd");
+
+	DEBUGP("zero-copy BPF with 2 buffers of %zu bytes\n",
+	       psock->zbuf_bytes);
+}
+
+/* Return a buffer the kernel has handed over to us, or NULL if none. */
+static struct bpf_zbuf_header *zbuf_ready(struct packet_socket *psock)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(psock->zbufs); ++i) {
+		struct bpf_zbuf_header *header =
+			(struct bpf_zbuf_header *)psock->zbufs[i];
+
+		if (__atomic_load_n(&header->bzh_kernel_gen,
+				    __ATOMIC_ACQUIRE) != header->bzh_user_gen)
+			return header;
+	}
+	return NULL;
+}
+
+/* Hand the buffer we have read back to the kernel. */
+static void zbuf_release(struct packet_socket *psock)
+{
+	struct bpf_zbuf_header *header = psock->zbuf;
+
+	__atomic_store_n(&header->bzh_user_gen, header->bzh_kernel_gen,
+			 __ATOMIC_RELEASE);
+	psock->zbuf = NULL;
+}
+
+/* Start reading the next buffer of frames. If the kernel has none
+ * ready, wait a little for frames, then ask it to hand over the buffer
+ * it is filling. Return STATUS_ERR if there are no frames yet.
+ */
+static int zbuf_next_buffer(struct packet_socket *psock)
+{
+	struct bpf_zbuf_header *header = zbuf_ready(psock);
+
+	if (header == NULL) {
+		struct pollfd pfd = { .fd = psock->zbuf_fd, .events = POLLIN };
+		struct bpf_zbuf zbuf;
+
+		if (poll(&pfd, 1, ZBUF_POLL_MSECS) < 0 && errno != EINTR)
+			die_perror("poll on bpf fd");
+		header = zbuf_ready(psock);
+		if (header == NULL &&
+		    ioctl(psock->zbuf_fd, BIOCROTZBUF, &zbuf) < 0)
+			die_perror("ioctl BIOCROTZBUF on bpf fd");
+		header = zbuf_ready(psock);
+		if (header == NULL)
+			return STATUS_ERR;
+	}
+
+	psock->zbuf = header;
+	psock->zbuf_next = (u8 *)(header + 1);
+	psock->zbuf_end = psock->zbuf_next + header->bzh_kernel_len;
+	return STATUS_OK;
+}
+#endif  /* HAVE_BPF_ZBUF */
+
 static void packet_socket_setup(struct packet_socket *psock)
 {
 	int data_link = -1, bpf_fd = -1, val = -1;
@@ -100,6 +262,10 @@ static void packet_socket_setup(struct packet_socket *psock)
 	if (ioctl(bpf_fd, BIOCIMMEDIATE, &val) < 0)
 		die_perror("ioctl BIOCIMMEDIATE on bpf fd");
 
+#ifdef HAVE_BPF_ZBUF
+	zbuf_setup(psock, bpf_fd);
+#endif
+
 	/* Find data link type. */
 	data_link = pcap_datalink(psock->pcap);
 	DEBUGP("data_link: %d\n", data_link);
@@ -125,13 +291,39 @@ static void packet_socket_setup(struct packet_socket *psock)
 	}
 }
 
+/* Compile the given pcap filter expression and sniff with it. */
+static void set_filter_string(struct packet_socket *psock,
+			      const char *filter_str)
+{
+	struct bpf_program bpf_code;
+
+	DEBUGP("setting BPF filter: %s\n", filter_str);
+
+	if (pcap_compile(psock->pcap, &bpf_code, filter_str, 1, 0) != 0)
+		die_pcap_perror(psock->pcap, "pcap_compile");
+
+#ifdef HAVE_BPF_ZBUF
+	/* Filter our own device instead; pcap's keeps sniffing nothing. */
+	if (psock->zbuf_fd >= 0) {
+		if (ioctl(psock->zbuf_fd, BIOCSETF, &bpf_code) < 0)
+			die_perror("ioctl BIOCSETF on bpf fd");
+		pcap_freecode(&bpf_code);
+		return;
+	}
+#endif
+
+	if (pcap_setfilter(psock->pcap, &bpf_code) != 0)
+		die_pcap_perror(psock->pcap, "pcap_setfilter");
+
+	pcap_freecode(&bpf_code);
+}
+
 /* Add a filter so we only sniff packets we want. */
 void packet_socket_set_filter(struct packet_socket *psock,
 			      const struct ether_addr *client_ether_addr,
 			      const struct ip_address *client_live_ip)
 {
 	const u8 *client_ether = client_ether_addr->ether_addr_octet;
-	struct bpf_program bpf_code;
 	char *filter_str = NULL;
 	char client_live_ip_string[ADDR_STR_LEN];
 
@@ -148,23 +340,58 @@ void packet_socket_set_filter(struct packet_socket *psock,
 		 client_live_ip->address_family == AF_INET6 ? "ip6" : "ip",
 		 client_live_ip_string);
 
-	DEBUGP("setting BPF filter: %s\n", filter_str);
-
-	if (pcap_compile(psock->pcap, &bpf_code, filter_str, 1, 0) != 0)
-		die_pcap_perror(psock->pcap, "pcap_compile");
+	set_filter_string(psock, filter_str);
+	free(filter_str);
+}
 
-	if (pcap_setfilter(psock->pcap, &bpf_code) != 0)
-		die_pcap_perror(psock->pcap, "pcap_setfilter");
+void packet_socket_set_port_filter(struct packet_socket *psock,
+				   const __be16 *ports, int num_ports)
+{
+	char *filter_str = NULL, *ports_str = NULL;
+	int i;
+
+	/* Past NETDEV_MAX_SNIFF_PORTS, leave it to user space. */
+	port_set_update(&psock->ports, ports, num_ports);
+	if (num_ports > NETDEV_MAX_SNIFF_PORTS)
+		num_ports = -1;
+
+	if (num_ports < 0) {
+		filter_str = strdup("");
+	} else {
+		ports_str = strdup("");
+		for (i = 0; i < num_ports; ++i) {
+			char *old = ports_str;
+
+			asprintf(&ports_str, "%s or dst port %u", old,
+				 ntohs(ports[i]));
+			free(old);
+		}
+		asprintf(&filter_str, "not (tcp or udp) or ip[6:2] & 0x1fff != 0"
+			 "%s", ports_str);
+		free(ports_str);
+	}
 
-	pcap_freecode(&bpf_code);
+	set_filter_string(psock, filter_str);
 	free(filter_str);
 }
 
-struct packet_socket *packet_socket_new(const char *device_name)
+bool packet_socket_wants_port(struct packet_socket *psock, __be16 port)
+{
+	return port_set_has(&psock->ports, port);
+}
+
+struct packet_socket *packet_socket_new(const char *device_name,
+				       bool vnet_hdr)
 {
 	struct packet_socket *psock = calloc(1, sizeof(struct packet_socket));
 
+	if (vnet_hdr)
+		die("packet socket vnet headers are only supported on Linux\n");
+
 	psock->name = strdup(device_name);
+#ifdef HAVE_BPF_ZBUF
+	psock->zbuf_fd = -1;
+#endif
 
 	packet_socket_setup(psock);
 
@@ -175,13 +402,31 @@ void packet_socket_free(struct packet_socket *psock)
 {
 	if (psock->name != NULL)
 		free(psock->name);
+	if (psock->read_packet != NULL)
+		packet_free(psock->read_packet);
 
+#ifdef HAVE_BPF_ZBUF
+	zbuf_close(psock);
+#endif
 	pcap_close(psock->pcap);
 
 	memset(psock, 0, sizeof(*psock));	/* paranoia to catch bugs*/
 	free(psock);
 }
 
+struct packet *packet_socket_read_packet(struct packet_socket *psock)
+{
+	if (psock->read_packet == NULL)
+		psock->read_packet = packet_new(PACKET_READ_BYTES);
+	return psock->read_packet;
+}
+
+void packet_socket_return_frame(struct packet_socket *psock,
+				struct packet *packet)
+{
+	/* We always copy from libpcap's buffer, so nothing is lent. */
+}
+
 int packet_socket_writev(struct packet_socket *psock,
 			 const struct iovec *iov, int iovcnt)
 {
@@ -214,6 +459,68 @@ int packet_socket_writev(struct packet_socket *psock,
 	return STATUS_OK;
 }
 
+/* The pcap API has no way to queue several frames, so just send them
+ * one at a time.
+ */
+int packet_socket_writev_batch(struct packet_socket *psock,
+			       const struct iovec *iov, int iov_per_frame,
+			       int num_frames)
+{
+	int i;
+
+	for (i = 0; i < num_frames; ++i) {
+		if (packet_socket_writev(psock, iov + i * iov_per_frame,
+					 iov_per_frame))
+			return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+#ifdef HAVE_BPF_ZBUF
+/* Copy the next frame out of our zero-copy buffer, handing the buffer
+ * back to the kernel once we have read its last frame.
+ */
+static int zbuf_receive(struct packet_socket *psock,
+			struct packet *packet, int *in_bytes)
+{
+	const struct bpf_hdr *bpf_header = NULL;
+	const u8 *data = NULL;
+
+	if (psock->zbuf == NULL && zbuf_next_buffer(psock))
+		return STATUS_ERR;	/* no packet yet */
+	if (psock->zbuf_next >= psock->zbuf_end) {
+		zbuf_release(psock);	/* the kernel handed over no frames */
+		return STATUS_ERR;
+	}
+
+	bpf_header = (const struct bpf_hdr *)psock->zbuf_next;
+	data = psock->zbuf_next + bpf_header->bh_hdrlen;
+	psock->zbuf_next += BPF_WORDALIGN(bpf_header->bh_hdrlen +
+					  bpf_header->bh_caplen);
+
+	packet->time_usecs = time_from_realtime_nsecs(
+		timeval_to_usecs(&bpf_header->bh_tstamp) * 1000) / 1000;
+	DEBUGP("zbuf: time_usecs= %llu caplen:%u len:%u offset:%d\n",
+	       packet->time_usecs, bpf_header->bh_caplen,
+	       bpf_header->bh_datalen, psock->pcap_offset);
+
+	if (bpf_header->bh_caplen != bpf_header->bh_datalen) {
+		die("BPF unable to capture full packet: "
+		    "caplen %u != len %u\n",
+		    bpf_header->bh_caplen, bpf_header->bh_datalen);
+	}
+	assert(bpf_header->bh_datalen <= packet->buffer_bytes);
+
+	assert(bpf_header->bh_datalen > psock->pcap_offset);
+	*in_bytes = bpf_header->bh_datalen - psock->pcap_offset;
+	memcpy(packet->buffer, data + psock->pcap_offset, *in_bytes);
+
+	if (psock->zbuf_next >= psock->zbuf_end)
+		zbuf_release(psock);
+	return STATUS_OK;
+}
+#endif  /* HAVE_BPF_ZBUF */
+
 int packet_socket_receive(struct packet_socket *psock,
 			  enum direction_t direction,
 			  struct packet *packet, int *in_bytes)
@@ -222,6 +529,11 @@ int packet_socket_receive(struct packet_socket *psock,
 	struct pcap_pkthdr *pkt_header = NULL;
 	const u8 *pkt_data = NULL;
 
+#ifdef HAVE_BPF_ZBUF
+	if (psock->zbuf_fd >= 0)
+		return zbuf_receive(psock, packet, in_bytes);
+#endif
+
 	DEBUGP("calling pcap_next_ex()\n");
 
 	/* Something about the way we're doing BIOCIMMEDIATE
@@ -259,6 +571,8 @@ int packet_socket_receive(struct packet_socket *psock,
 #else
 	packet->time_usecs = implement_me("implement me for your platform");
 #endif  /* defined(__OpenBSD__) */
+	packet->time_usecs =
+		time_from_realtime_nsecs(packet->time_usecs * 1000) / 1000;
 
 	DEBUGP("time_usecs= %llu\n", packet->time_usecs);
 
@@ -287,4 +601,16 @@ int packet_socket_receive(struct packet_socket *psock,
 	return STATUS_OK;
 }
 
+int packet_socket_enable_hw_timestamps(struct packet_socket *psock,
+				       char **error)
+{
+	asprintf(error, "NIC timestamps need a Linux packet socket");
+	return STATUS_ERR;
+}
+
+s64 packet_socket_tx_timestamp_nsecs(struct packet_socket *psock)
+{
+	return 0;
+}
+
 #endif  /* USE_LIBPCAP */
@@ -170,6 +170,12 @@ static int tcp_packet_to_string(FILE *s, struct packet *packet,
 		free(tcp_options);
 	}
 
+	if (packet->gso_size != 0)
+		fprintf(s, " gso %u", packet->gso_size);
+
+	if (packet->flags & FLAG_TRAIN)
+		fprintf(s, " train");
+
 	if (format == DUMP_VERBOSE)
 		packet_buffer_to_string(s, packet);
 
@@ -187,6 +193,8 @@ static int udp_packet_to_string(FILE *s, struct packet *packet,
 	}
 
 	fprintf(s, "udp (%u)", packet_payload_len(packet));
+	if (packet->gso_size != 0)
+		fprintf(s, " gso %u", packet->gso_size);
 
 	if (format == DUMP_VERBOSE)
 		packet_buffer_to_string(s, packet);
@@ -0,0 +1,355 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of a ring of raw packet records, rendered to text
+ * or pcapng only when printed or written.
+ */
+
+#include "packet_trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+#include "packet_parser.h"
+#include "packet_to_string.h"
+
+/* A record in the ring; the packet's IP bytes follow, and then the
+ * comment, padded so that the next record is aligned.
+ */
+struct packet_record {
+	struct packet_trace_info info;	/* info->comment is not valid */
+	u32 ip_bytes;		/* bytes of packet that follow */
+	u32 comment_bytes;	/* bytes of comment after that, or 0 */
+};
+
+static u32 record_bytes(const struct packet_record *record)
+{
+	u32 bytes = sizeof(struct packet_record) + record->ip_bytes +
+		record->comment_bytes;
+
+	return (bytes + sizeof(s64) - 1) & ~(sizeof(s64) - 1);
+}
+
+static u8 *record_packet(struct packet_record *record)
+{
+	return (u8 *)(record + 1);
+}
+
+static char *record_comment(struct packet_record *record)
+{
+	return (char *)record_packet(record) + record->ip_bytes;
+}
+
+struct packet_trace *packet_trace_new(u32 buffer_bytes)
+{
+	struct packet_trace *trace = calloc(1, sizeof(struct packet_trace));
+
+	if (pthread_mutex_init(&trace->mutex, NULL) != 0)
+		die_perror("pthread_mutex_init");
+	trace->buffer_bytes = buffer_bytes & ~(sizeof(s64) - 1);
+	trace->buffer = malloc(trace->buffer_bytes);
+	if (trace->buffer == NULL)
+		die("out of memory for packet trace\n");
+	return trace;
+}
+
+void packet_trace_free(struct packet_trace *trace)
+{
+	if (trace == NULL)
+		return;
+	pthread_mutex_destroy(&trace->mutex);
+	free(trace->buffer);
+	memset(trace, 0, sizeof(*trace));  /* paranoia to help catch bugs */
+	free(trace);
+}
+
+static void reset_trace(struct packet_trace *trace)
+{
+	trace->head = 0;
+	trace->tail = 0;
+	trace->wrap = 0;
+	trace->wrapped = false;
+	trace->num_records = 0;
+}
+
+/* Drop the oldest record to make room. */
+static void drop_oldest(struct packet_trace *trace)
+{
+	struct packet_record *record =
+		(struct packet_record *)(trace->buffer + trace->head);
+
+	trace->head += record_bytes(record);
+	trace->num_records--;
+	trace->num_dropped++;
+	if (trace->wrapped && trace->head == trace->wrap) {
+		trace->wrapped = false;
+		trace->head = 0;
+	}
+	if (trace->num_records == 0)
+		reset_trace(trace);
+}
+
+/* Return the offset at which to put a record of the given size, making
+ * room for it by dropping old records as needed.
+ */
+static u32 make_room(struct packet_trace *trace, u32 bytes)
+{
+	while (trace->max_records > 0 &&
+	       trace->num_records >= trace->max_records)
+		drop_oldest(trace);
+	for (;;) {
+		if (!trace->wrapped) {
+			if (trace->buffer_bytes - trace->tail >= bytes)
+				return trace->tail;
+			if (trace->num_records == 0) {
+				reset_trace(trace);
+				continue;
+			}
+			/* Continue at the start of the ring. */
+			trace->wrap = trace->tail;
+			trace->wrapped = true;
+			trace->tail = 0;
+		}
+		if (trace->head - trace->tail >= bytes)
+			return trace->tail;
+		drop_oldest(trace);
+	}
+}
+
+void packet_trace_add(struct packet_trace *trace,
+		      const struct packet_trace_info *info,
+		      const struct packet *packet)
+{
+	struct packet_record header, *record;
+	u32 bytes, offset;
+
+	header.info = *info;
+	header.info.comment = NULL;
+	header.ip_bytes = packet->ip_bytes;
+	header.comment_bytes = info->comment ? strlen(info->comment) + 1 : 0;
+	bytes = record_bytes(&header);
+
+	pthread_mutex_lock(&trace->mutex);
+	if (bytes > trace->buffer_bytes) {
+		trace->num_dropped++;
+		goto out;
+	}
+	offset = make_room(trace, bytes);
+	record = (struct packet_record *)(trace->buffer + offset);
+	*record = header;
+	memcpy(record_packet(record), packet_start((struct packet *)packet),
+	       packet->ip_bytes);
+	if (info->comment)
+		memcpy(record_comment(record), info->comment,
+		       record->comment_bytes);
+	trace->tail = offset + bytes;
+	trace->num_records++;
+out:
+	pthread_mutex_unlock(&trace->mutex);
+}
+
+static void print_record(struct packet_record *record)
+{
+	struct packet *packet = packet_new(record->ip_bytes);
+	char *dump = NULL, *dump_error = NULL;
+
+	memcpy(packet->buffer, record_packet(record), record->ip_bytes);
+	if (parse_packet(packet, record->ip_bytes, PACKET_LAYER_3_IP,
+			 &dump_error) == PACKET_OK)
+		packet_to_string(packet, DUMP_SHORT, &dump, &dump_error);
+
+	log_printf("%s packet: %9.6f %s%s%s\n",
+		   record->info.type, usecs_to_secs(record->info.script_usecs),
+		   dump ? dump : "",
+		   dump_error ? "\n" : "",
+		   dump_error ? dump_error : "");
+
+	free(dump);
+	free(dump_error);
+	packet_free(packet);
+}
+
+/* Return the record after the one at *offset, oldest first. */
+static struct packet_record *next_record(struct packet_trace *trace,
+					 u32 *offset)
+{
+	struct packet_record *record;
+
+	if (trace->wrapped && *offset == trace->wrap)
+		*offset = 0;
+	record = (struct packet_record *)(trace->buffer + *offset);
+	*offset += record_bytes(record);
+	return record;
+}
+
+void packet_trace_print(struct packet_trace *trace)
+{
+	u32 offset;
+	int i;
+
+	pthread_mutex_lock(&trace->mutex);
+	if (trace->num_dropped > 0)
+		log_printf("(%llu earlier packets not shown)\n",
+			   trace->num_dropped);
+	offset = trace->head;
+	for (i = 0; i < trace->num_records; i++)
+		print_record(next_record(trace, &offset));
+	reset_trace(trace);
+	trace->num_dropped = 0;
+	pthread_mutex_unlock(&trace->mutex);
+	log_flush();
+}
+
+/* pcapng block types, option codes and the like, from
+ * draft-ietf-opsawg-pcapng.
+ */
+#define PCAPNG_SECTION_HEADER_BLOCK	0x0A0D0D0A
+#define PCAPNG_INTERFACE_BLOCK		0x00000001
+#define PCAPNG_ENHANCED_PACKET_BLOCK	0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC		0x1A2B3C4D
+#define PCAPNG_OPT_ENDOFOPT		0
+#define PCAPNG_OPT_COMMENT		1
+#define PCAPNG_OPT_IF_TSRESOL		9
+#define PCAPNG_OPT_EPB_FLAGS		2
+#define PCAPNG_EPB_INBOUND		0x1
+#define PCAPNG_EPB_OUTBOUND		0x2
+#define PCAPNG_LINKTYPE_RAW		101	/* packets start at IP */
+
+static u32 pad4(u32 bytes)
+{
+	return (bytes + 3) & ~3;
+}
+
+static void put_u16(FILE *f, u16 value)
+{
+	fwrite(&value, sizeof(value), 1, f);
+}
+
+static void put_u32(FILE *f, u32 value)
+{
+	fwrite(&value, sizeof(value), 1, f);
+}
+
+/* Write the bytes, padded with zeros to a multiple of 4. */
+static void put_padded(FILE *f, const void *data, u32 bytes)
+{
+	static const u8 zeros[4];
+
+	fwrite(data, 1, bytes, f);
+	fwrite(zeros, 1, pad4(bytes) - bytes, f);
+}
+
+static void put_option(FILE *f, u16 code, const void *data, u16 bytes)
+{
+	put_u16(f, code);
+	put_u16(f, bytes);
+	put_padded(f, data, bytes);
+}
+
+static void write_pcapng_headers(FILE *f)
+{
+	const u8 tsresol = 9;		/* timestamps in nanoseconds */
+	u64 section_bytes = -1ULL;	/* not specified */
+	u32 bytes;
+
+	/* Section header block. */
+	bytes = 28;
+	put_u32(f, PCAPNG_SECTION_HEADER_BLOCK);
+	put_u32(f, bytes);
+	put_u32(f, PCAPNG_BYTE_ORDER_MAGIC);
+	put_u16(f, 1);			/* major version */
+	put_u16(f, 0);			/* minor version */
+	fwrite(&section_bytes, sizeof(section_bytes), 1, f);
+	put_u32(f, bytes);
+
+	/* Interface description block. */
+	bytes = 20 + 8 + 4;
+	put_u32(f, PCAPNG_INTERFACE_BLOCK);
+	put_u32(f, bytes);
+	put_u16(f, PCAPNG_LINKTYPE_RAW);
+	put_u16(f, 0);			/* reserved */
+	put_u32(f, 0);			/* no snap length */
+	put_option(f, PCAPNG_OPT_IF_TSRESOL, &tsresol, sizeof(tsresol));
+	put_option(f, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+	put_u32(f, bytes);
+}
+
+static void write_pcapng_record(FILE *f, struct packet_record *record)
+{
+	char *comment = NULL;
+	u64 nsecs = record->info.live_nsecs;
+	u32 flags = (record->info.direction == DIRECTION_INBOUND) ?
+		PCAPNG_EPB_INBOUND : PCAPNG_EPB_OUTBOUND;
+	u32 comment_bytes, bytes;
+
+	asprintf(&comment, "line %d: %s at %.6f%s%s",
+		 record->info.line_number, record->info.type,
+		 usecs_to_secs(record->info.script_usecs),
+		 record->comment_bytes ? "\n" : "",
+		 record->comment_bytes ? record_comment(record) : "");
+	comment_bytes = strlen(comment);
+	if (comment_bytes > 0xffff)
+		comment_bytes = 0xffff;
+
+	bytes = 28 + pad4(record->ip_bytes) +
+		4 + pad4(comment_bytes) + 4 + 4 + 4 + 4;
+	put_u32(f, PCAPNG_ENHANCED_PACKET_BLOCK);
+	put_u32(f, bytes);
+	put_u32(f, 0);			/* interface ID */
+	put_u32(f, nsecs >> 32);
+	put_u32(f, nsecs);
+	put_u32(f, record->ip_bytes);	/* captured length */
+	put_u32(f, record->ip_bytes);	/* original length */
+	put_padded(f, record_packet(record), record->ip_bytes);
+	put_option(f, PCAPNG_OPT_COMMENT, comment, comment_bytes);
+	put_option(f, PCAPNG_OPT_EPB_FLAGS, &flags, sizeof(flags));
+	put_option(f, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+	put_u32(f, bytes);
+
+	free(comment);
+}
+
+int packet_trace_write_pcapng(struct packet_trace *trace,
+			      const char *path, char **error)
+{
+	u32 offset;
+	FILE *f;
+	int i;
+
+	f = fopen(path, "w");
+	if (f == NULL) {
+		asprintf(error, "cannot open %s: %s", path, strerror(errno));
+		return STATUS_ERR;
+	}
+
+	pthread_mutex_lock(&trace->mutex);
+	write_pcapng_headers(f);
+	offset = trace->head;
+	for (i = 0; i < trace->num_records; i++)
+		write_pcapng_record(f, next_record(trace, &offset));
+	pthread_mutex_unlock(&trace->mutex);
+
+	if (ferror(f) | fclose(f)) {
+		asprintf(error, "error writing %s", path);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
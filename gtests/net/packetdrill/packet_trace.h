@@ -0,0 +1,91 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for a packet trace: a ring of compact raw records of the
+ * packets a test sends and receives, for --verbose output and for the
+ * --flight_recorder. Adding a record only copies the packet's bytes
+ * and a few fields; records are rendered to text or pcapng only when
+ * the trace is printed or written, at the end of the test or when it
+ * fails. When the ring is full the oldest records make room for new
+ * ones, so a long test keeps its most recent packets.
+ */
+
+#ifndef __PACKET_TRACE_H__
+#define __PACKET_TRACE_H__
+
+#include "types.h"
+
+#include <pthread.h>
+#include "packet.h"
+
+/* Bytes in the ring of a packet trace by default. */
+#define PACKET_TRACE_BYTES	(4 * 1024 * 1024)
+
+/* What we know about a packet we record, besides its bytes. */
+struct packet_trace_info {
+	const char *type;	/* string literal, e.g. "outbound sniffed" */
+	enum direction_t direction;	/* inbound or outbound */
+	s64 script_usecs;	/* script time of send or receive */
+	s64 live_nsecs;		/* wall time of send or receive */
+	int line_number;	/* script line of the packet event */
+	const char *comment;	/* e.g. how it differed from the script */
+};
+
+struct packet_trace {
+	pthread_mutex_t mutex;	/* for adding records and printing */
+	u8 *buffer;		/* ring of records */
+	u32 buffer_bytes;	/* bytes in buffer */
+	int max_records;	/* if > 0, keep at most this many */
+	u32 head;		/* offset of oldest record */
+	u32 tail;		/* offset where next record goes */
+	u32 wrap;		/* if wrapped, end of records before 0 */
+	bool wrapped;		/* do records continue at offset 0? */
+	int num_records;	/* records in the ring */
+	u64 num_dropped;	/* records dropped to make room */
+};
+
+/* Allocate and return a new, empty trace with a ring of the given
+ * number of bytes.
+ */
+extern struct packet_trace *packet_trace_new(u32 buffer_bytes);
+
+/* Free the trace and all its records, without printing them. */
+extern void packet_trace_free(struct packet_trace *trace);
+
+/* Record the IP bytes of the given packet, along with a copy of the
+ * given info; info->type is kept as a pointer.
+ */
+extern void packet_trace_add(struct packet_trace *trace,
+			     const struct packet_trace_info *info,
+			     const struct packet *packet);
+
+/* Print a short dump of each record, oldest first, through the log
+ * sink, and then empty the trace.
+ */
+extern void packet_trace_print(struct packet_trace *trace);
+
+/* Write the records, oldest first, to the given file as pcapng, with
+ * nanosecond timestamps, and their script line and comment in a
+ * comment on each packet. The trace keeps its records. On success,
+ * return STATUS_OK; on failure, return STATUS_ERR and fill in *error.
+ */
+extern int packet_trace_write_pcapng(struct packet_trace *trace,
+				     const char *path, char **error);
+
+#endif /* __PACKET_TRACE_H__ */
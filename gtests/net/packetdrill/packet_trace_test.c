@@ -0,0 +1,203 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for packet_trace.c: the ring keeps the newest records in
+ * order as it wraps, prints them as packet dumps, and writes them as
+ * well-formed pcapng.
+ */
+
+#include "packet_trace.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "packet_parser.h"
+
+#define NUM_PACKETS	20
+
+static struct packet *new_test_packet(void)
+{
+	/* An IPv4/GRE/IPv4/TCP packet. */
+	u8 data[] = {
+		/* IPv4: */
+		0x45, 0x00, 0x00, 0x54, 0x00, 0x00, 0x00, 0x00,
+		0xff, 0x2f, 0xb5, 0x75, 0x02, 0x02, 0x02, 0x02,
+		0x01, 0x01, 0x01, 0x01,
+		/* GRE: */
+		0x00, 0x00, 0x08, 0x00,
+		/* IPv4, TCP: */
+		0x45, 0x00, 0x00, 0x3c, 0x00, 0x00, 0x00, 0x00,
+		0xff, 0x06, 0x39, 0x11, 0xc0, 0x00, 0x02, 0x01,
+		0xc0, 0xa8, 0x00, 0x01, 0xcf, 0x3f, 0x1f, 0x90,
+		0x00, 0x00, 0x00, 0x01, 0x83, 0x4d, 0xa5, 0x5b,
+		0xa0, 0x10, 0x01, 0x01, 0xdb, 0x2d, 0x00, 0x00,
+		0x05, 0x0a, 0x83, 0x4d, 0xab, 0x03, 0x83, 0x4d,
+		0xb0, 0xab, 0x08, 0x0a, 0x00, 0x00, 0x01, 0x2c,
+		0x60, 0xc2, 0x18, 0x20
+	};
+	struct packet *packet = packet_new(sizeof(data));
+	char *error = NULL;
+
+	memcpy(packet->buffer, data, sizeof(data));
+	assert(parse_packet(packet, sizeof(data), PACKET_LAYER_3_IP,
+			    &error) == PACKET_OK);
+	return packet;
+}
+
+static void add_packets(struct packet_trace *trace, struct packet *packet)
+{
+	struct packet_trace_info info;
+	int i;
+
+	memset(&info, 0, sizeof(info));
+	info.type = "inbound injected";
+	info.direction = DIRECTION_INBOUND;
+	for (i = 0; i < NUM_PACKETS; i++) {
+		info.script_usecs = i * 1000000LL;
+		info.live_nsecs = 1400000000000000000LL + i;
+		info.line_number = 100 + i;
+		info.comment = (i % 2) ? "bad ack" : NULL;
+		packet_trace_add(trace, &info, packet);
+	}
+}
+
+static void test_wrap_and_print(void)
+{
+	struct packet *packet = new_test_packet();
+	struct packet_trace *trace = packet_trace_new(1000);
+	char path[] = "/tmp/packet_trace_test.XXXXXX";
+	char line[256], expected[256];
+	int fd, saved_stdout, i, first;
+	FILE *out;
+
+	add_packets(trace, packet);
+	assert(trace->num_records >= 6);
+	assert(trace->num_records + trace->num_dropped == NUM_PACKETS);
+	first = NUM_PACKETS - trace->num_records;
+
+	/* Print to a file, and check we get the newest packets, in order. */
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	fflush(stdout);
+	saved_stdout = dup(STDOUT_FILENO);
+	assert(dup2(fd, STDOUT_FILENO) >= 0);
+	packet_trace_print(trace);
+	fflush(stdout);
+	assert(dup2(saved_stdout, STDOUT_FILENO) >= 0);
+	close(saved_stdout);
+	assert(trace->num_records == 0);
+
+	out = fopen(path, "r");
+	assert(out != NULL);
+	assert(fgets(line, sizeof(line), out) != NULL);
+	snprintf(expected, sizeof(expected),
+		 "(%d earlier packets not shown)\n", first);
+	assert(strcmp(line, expected) == 0);
+	for (i = first; i < NUM_PACKETS; i++) {
+		assert(fgets(line, sizeof(line), out) != NULL);
+		snprintf(expected, sizeof(expected),
+			 "inbound injected packet: %9.6f "
+			 "ipv4 2.2.2.2 > 1.1.1.1: gre: "
+			 ". 1:1(0) ack 2202903899 win 257 "
+			 "<sack 2202905347:2202906795,"
+			 "TS val 300 ecr 1623332896>\n", (double)i);
+		assert(strcmp(line, expected) == 0);
+	}
+	assert(fgets(line, sizeof(line), out) == NULL);
+	fclose(out);
+	close(fd);
+	unlink(path);
+
+	packet_trace_free(trace);
+	packet_free(packet);
+}
+
+static u32 get_u32(const u8 *p)
+{
+	u32 value;
+
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static void test_pcapng(void)
+{
+	struct packet *packet = new_test_packet();
+	struct packet_trace *trace = packet_trace_new(PACKET_TRACE_BYTES);
+	char path[] = "/tmp/packet_trace_test.XXXXXX";
+	const char *comment = "line 119: inbound injected at 19.000000\nbad ack";
+	char *error = NULL;
+	u8 file[64 * 1024];
+	size_t bytes, offset;
+	int fd, num_packets = 0;
+	FILE *in;
+
+	trace->max_records = 5;
+	add_packets(trace, packet);
+	assert(trace->num_records == 5);
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	assert(packet_trace_write_pcapng(trace, path, &error) == STATUS_OK);
+	in = fopen(path, "r");
+	assert(in != NULL);
+	bytes = fread(file, 1, sizeof(file), in);
+	fclose(in);
+	unlink(path);
+
+	/* Walk the blocks, checking each one's leading and trailing
+	 * lengths agree.
+	 */
+	assert(get_u32(file) == 0x0A0D0D0A);
+	assert(get_u32(file + 8) == 0x1A2B3C4D);
+	for (offset = 0; offset < bytes; offset += get_u32(file + offset + 4)) {
+		u32 block_bytes = get_u32(file + offset + 4);
+
+		assert(block_bytes % 4 == 0);
+		assert(offset + block_bytes <= bytes);
+		assert(get_u32(file + offset + block_bytes - 4) ==
+		       block_bytes);
+		if (get_u32(file + offset) == 6) {
+			u32 ip_bytes = get_u32(file + offset + 20);
+			u64 nsecs = ((u64)get_u32(file + offset + 12) << 32) |
+				get_u32(file + offset + 16);
+
+			assert(ip_bytes == packet->ip_bytes);
+			assert(nsecs == 1400000000000000000ULL +
+			       NUM_PACKETS - 5 + num_packets);
+			assert(memcmp(file + offset + 28, packet_start(packet),
+				      ip_bytes) == 0);
+			num_packets++;
+		}
+	}
+	assert(offset == bytes);
+	assert(num_packets == 5);
+	assert(memmem(file, bytes, comment, strlen(comment)) != NULL);
+
+	packet_trace_free(trace);
+	packet_free(packet);
+}
+
+int main(void)
+{
+	test_wrap_and_print();
+	test_pcapng();
+	return 0;
+}
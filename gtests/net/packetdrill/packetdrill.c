@@ -30,35 +30,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "alloc_stats.h"
+#include "compare.h"
 #include "config.h"
+#include "daemon.h"
 #include "parse.h"
+#include "placement.h"
 #include "run.h"
+#include "run_jobs.h"
 #include "script.h"
+#include "stress.h"
 #include "system.h"
 #include "wire_server.h"
 
-static void run_init_scripts(struct config *config)
+static void print_alloc_stats(void)
 {
-	char *cp1, *cp2, *scripts, *error;
-
-	if (config->init_scripts == NULL)
-		return;
-
-	cp1 = scripts = strdup(config->init_scripts);
-	while (*cp1 != 0) {
-		cp2 = strstr(cp1, ",");
-		if (cp2 != NULL)
-			*cp2 = 0;
-		if (safe_system(cp1, &error)) {
-			die("%s: error executing init script '%s': %s\n",
-			    config->script_path, cp1, error);
-		}
-		if (cp2 == NULL)
-			break;
-		else
-			cp1 = cp2 + 1;
-	}
-	free(scripts);
+	alloc_stats_print(stderr);
 }
 
 int main(int argc, char *argv[])
@@ -68,6 +55,12 @@ int main(int argc, char *argv[])
 	/* Get command line options and list of test scripts. */
 	char **arg = parse_command_line_options(argc, argv, &config);
 
+	/* Count allocations from here on, before any threads start. */
+	if (config.alloc_stats) {
+		alloc_stats_enable();
+		atexit(print_alloc_stats);
+	}
+
 	/* If we're running as a server, just listen for connections forever. */
 	if (config.is_wire_server) {
 		if (*arg != NULL) {
@@ -82,6 +75,24 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 
+	/* A daemon gets its scripts from daemon clients. */
+	if (config.is_daemon) {
+		if (*arg != NULL) {
+			fprintf(stderr,
+				"error: do not pass script paths to "
+				"the daemon on command line\n");
+			show_usage();
+			exit(EXIT_FAILURE);
+		}
+
+		run_daemon(&config);
+		return 0;
+	}
+
+	/* With --compare, the arguments are reports, not scripts. */
+	if (config.compare)
+		return run_compare(&config, arg) ? EXIT_FAILURE : 0;
+
 	/* Ensure that there is at least one script path, to avoid
 	 * confusion between the lack of output caused by "all tests
 	 * passing" and "no tests listed on command line".
@@ -92,6 +103,54 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (config.is_daemon_client && config.daemon_workers != NULL)
+		return run_daemon_coordinator(argc, argv, &config, arg) ?
+			EXIT_FAILURE : 0;
+	if (config.is_daemon_client)
+		return run_daemon_client(&config, arg) ? EXIT_FAILURE : 0;
+
+	if (config.fork_server && config.jobs == 0) {
+		fprintf(stderr, "error: --fork_server needs --jobs\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* With --dry_run, check a whole suite in parallel workers. */
+	if (config.dry_run && (config.jobs > 0 || is_script_suite(arg)))
+		return run_jobs(argc, argv, &config, arg) ?
+			EXIT_FAILURE : 0;
+
+	/* With --jobs, run each script in its own isolated worker. */
+	if (config.jobs > 0) {
+		if (config.is_wire_client) {
+			fprintf(stderr,
+				"error: --jobs is not supported with "
+				"--wire_client\n");
+			exit(EXIT_FAILURE);
+		}
+		return run_jobs(argc, argv, &config, arg) ?
+			EXIT_FAILURE : 0;
+	}
+
+	/* --stress and --concurrent run everything in this process, so
+	 * place it as one worker.
+	 */
+	if ((config.concurrent_scripts > 0 || config.stress_instances > 0) &&
+	    placement_wanted(&config))
+		placement_enter_process(&config);
+
+	/* With --concurrent, run several scripts at once on one netdev. */
+	if (config.concurrent_scripts > 0) {
+		run_concurrent(argc, argv, &config, arg);
+		return 0;
+	}
+
+	/* With --stress, run many copies of each script at once. */
+	if (config.stress_instances > 0) {
+		for (; *arg != NULL; ++arg)
+			run_stress(argc, argv, &config, *arg);
+		return 0;
+	}
+
 	/* Parse and run each script on the command line. */
 	for (; *arg != NULL; ++arg) {
 		struct script script;
@@ -102,11 +161,11 @@ int main(int argc, char *argv[])
 			exit(EXIT_FAILURE);
 
 		/* If --dry_run, then don't actually execute the script. */
-		if (config.dry_run)
-			continue;
-
-		run_init_scripts(&config);
-		run_script(&config, &script);
+		if (!config.dry_run) {
+			run_init_scripts(&config);
+			run_script(&config, &script);
+		}
+		free_script(&script);
 	}
 
 	return 0;
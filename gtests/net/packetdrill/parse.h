@@ -48,6 +48,10 @@ extern void read_script(const char *script_path,
  * parse_and_finalize_config() after parsing all in-script
  * options.
  *
+ * With --stream_window (in local mode, and not a dry run) this returns
+ * once the first event is parsed, with script->streaming set and the
+ * parser still locked; parse_script_next_event() then parses the rest.
+ *
  * Returns STATUS_OK on success; on failure returns STATUS_ERR. The
  * implementation for this function is in the bison parser file
  * parser.y.
@@ -56,4 +60,23 @@ extern int parse_script(const struct config *config,
 			struct script *script,
 			struct invocation *callback_invocation);
 
+/* Parse the next event of a script that is still being parsed, and
+ * append it to the script's event list. At the end of the script this
+ * clears script->parsing and unlocks the parser. Returns STATUS_OK on
+ * success; on failure returns STATUS_ERR.
+ */
+extern int parse_script_next_event(struct script *script);
+
+/* Allocators for the parser and lexer. While parsing a script these
+ * allocate from the script's arena (see arena.h), and parse_free() does
+ * nothing, since the arena is released as a whole by free_script(). If
+ * events are freed as we go (--stream_window in local mode) the events
+ * are allocated from the heap instead, to be freed by free_event().
+ * Memory from parse_alloc() is zeroed.
+ */
+extern void *parse_alloc(size_t bytes);
+extern char *parse_strdup(const char *s);
+extern char *parse_strndup(const char *s, size_t n);
+extern void parse_free(void *p);
+
 #endif /* __PARSER_H__ */
@@ -84,12 +84,14 @@
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include "arena.h"
 #include "gre_packet.h"
 #include "ip.h"
 #include "ip_packet.h"
@@ -97,8 +99,10 @@
 #include "logging.h"
 #include "mpls.h"
 #include "mpls_packet.h"
+#include "packet_checksum.h"
 #include "tcp_packet.h"
 #include "udp_packet.h"
+#include "verify_plan.h"
 #include "parse.h"
 #include "script.h"
 #include "tcp.h"
@@ -121,6 +125,7 @@ extern FILE *yyin;
 extern int yylineno;
 extern char *yytext;
 extern int yylex(void);
+extern int yychar;
 extern int yyparse(void);
 extern int yywrap(void);
 
@@ -143,6 +148,23 @@ static int current_script_line = -1;
  */
 static const struct config *in_config = NULL;
 
+/* The outer headers of the tunnels the script's packets go through,
+ * so that each encapsulation after the first of a kind only patches
+ * lengths and checksums.
+ */
+static struct packet_encap_templates encap_templates;
+
+/* Encapsulate a packet and free the original outer and inner packets. */
+static struct packet *encapsulate_and_free(struct packet *outer,
+					   struct packet *inner)
+{
+	struct packet *packet =
+		packet_encapsulate_templated(&encap_templates, outer, inner);
+	packet_free(outer);
+	packet_free(inner);
+	return packet;
+}
+
 /* The output of the parser: an output script containing
  * 1) a linked list of options
  * 2) a linked list of events
@@ -217,6 +239,116 @@ void read_script(const char *script_path, struct script *script)
 }
 
 
+/* Where we allocate what we parse: usually the script's arena, so that
+ * the whole parsed script is released at once, but the heap (NULL) once
+ * we know that events will be freed one at a time as we go.
+ */
+static struct arena *parse_arena = NULL;
+
+/* Do we free each event once we are done with it, instead of holding
+ * the whole parsed script until the end?
+ */
+static bool parse_frees_events(const struct config *config)
+{
+	return config->stream_window > 0 &&
+		!config->is_wire_client && !config->is_wire_server;
+}
+
+void *parse_alloc(size_t bytes)
+{
+	void *p = NULL;
+
+	if (parse_arena != NULL)
+		return arena_alloc(parse_arena, bytes);
+	p = calloc(1, bytes);
+	if (p == NULL)
+		die("out of memory parsing script\n");
+	return p;
+}
+
+char *parse_strndup(const char *s, size_t n)
+{
+	char *copy = NULL;
+
+	if (parse_arena != NULL)
+		return arena_strndup(parse_arena, s, n);
+	copy = strndup(s, n);
+	if (copy == NULL)
+		die("out of memory parsing script\n");
+	return copy;
+}
+
+char *parse_strdup(const char *s)
+{
+	return parse_strndup(s, strlen(s));
+}
+
+void parse_free(void *p)
+{
+	if (parse_arena == NULL)
+		free(p);
+}
+
+/* Return a newly parse_alloc()ed string formatted like sprintf(). */
+static char *parse_asprintf(const char *format, ...)
+{
+	char *heap = NULL, *copy = NULL;
+	va_list ap;
+
+	va_start(ap, format);
+	if (vasprintf(&heap, format, ap) < 0)
+		die("out of memory parsing script\n");
+	va_end(ap);
+	if (parse_arena == NULL)
+		return heap;
+	copy = parse_strdup(heap);
+	free(heap);
+	return copy;
+}
+
+/* The push parser state while we parse a script. The parse holds
+ * parser_mutex until it reaches the end of the script.
+ */
+static yypstate *parser_state = NULL;
+
+/* Finish parsing the current script: release the input and the lock. */
+static void parse_script_end(struct script *script)
+{
+	yypstate_delete(parser_state);
+	parser_state = NULL;
+	parse_arena = NULL;
+	current_script_path = NULL;
+	packet_encap_templates_clear(&encap_templates);
+	script->parsing = false;
+
+	if (fclose(yyin))
+		die_perror("fclose: error closing script buffer");
+
+	/* Unlock parser. */
+	if (pthread_mutex_unlock(&parser_mutex) != 0)
+		die_perror("pthread_mutex_unlock");
+}
+
+/* Push tokens to the parser until it has parsed one more event, or
+ * the end of the script.
+ */
+static int parse_event(struct script *script)
+{
+	int num_events = script->num_events;
+	int status;
+
+	do {
+		yychar = yylex();	/* yypush_parse() takes the token here */
+		status = yypush_parse(parser_state);
+	} while (status == YYPUSH_MORE && script->num_events == num_events);
+
+	if (status == YYPUSH_MORE)
+		return STATUS_OK;
+
+	parse_script_end(script);
+	return status ? STATUS_ERR : STATUS_OK;
+}
+
 /* The public entry point for the script parser. Parses the
  * text script file with the given path name and fills in the script
  * object with the parsed representation.
@@ -225,6 +357,8 @@ int parse_script(const struct config *config,
 			 struct script *script,
 			 struct invocation *callback_invocation)
 {
+	int result;
+
 	/* This bison-generated parser is not multi-thread safe, so we
 	 * have a lock to prevent more than one thread using the
 	 * parser at the same time. This is useful in the wire server
@@ -253,16 +387,51 @@ int parse_script(const struct config *config,
 	 */
 	yylineno = 1;
 
-	int result = yyparse();		/* invoke bison-generated parser */
-	current_script_path = NULL;
+	parser_state = yypstate_new();
+	if (parser_state == NULL)
+		die("yypstate_new: out of memory\n");
+	script->parsing = true;
 
-	if (fclose(yyin))
-		die_perror("fclose: error closing script buffer");
+	/* The options always go in the arena; the events too, unless
+	 * the options say we free them as we go.
+	 */
+	script->arena = arena_new();
+	parse_arena = script->arena;
 
-	/* Unlock parser. */
-	if (pthread_mutex_unlock(&parser_mutex) != 0)
-		die_perror("pthread_mutex_unlock");
-	return result ? STATUS_ERR : STATUS_OK;
+	/* The options come first, so once we have parsed the first
+	 * event the config is final and we know whether to stream.
+	 */
+	result = parse_event(script);
+	script->arena_events = !parse_frees_events(config);
+	if (result == STATUS_OK && script->parsing &&
+	    parse_frees_events(config) && !config->dry_run) {
+		script->streaming = true;
+		return STATUS_OK;	/* parse_script_next_event() does the rest */
+	}
+
+	while (result == STATUS_OK && script->parsing) {
+		result = parse_event(script);
+
+		/* A --stream_window dry run only checks the script, so
+		 * keep just the tail event, to append the next one to.
+		 */
+		while (!script->arena_events &&
+		       script->event_list != NULL &&
+		       script->event_list->next != NULL) {
+			struct event *dead = script->event_list;
+
+			script->event_list = dead->next;
+			free_event(dead);
+		}
+	}
+	return result;
+}
+
+int parse_script_next_event(struct script *script)
+{
+	assert(script->parsing);
+	assert(script == out_script);
+	return parse_event(script);
 }
 
 /* Bison emits code to call this method when there's a parse-time error.
@@ -296,7 +465,7 @@ int yywrap(void)
 /* Create and initalize a new expression. */
 static struct expression *new_expression(enum expression_t type)
 {
-	struct expression *expression = calloc(1, sizeof(struct expression));
+	struct expression *expression = parse_alloc(sizeof(struct expression));
 	expression->type = type;
 	return expression;
 }
@@ -317,7 +486,7 @@ static struct expression_list *new_expression_list(
 	struct expression *expression)
 {
 	struct expression_list *list;
-	list = calloc(1, sizeof(struct expression_list));
+	list = parse_alloc(sizeof(struct expression_list));
 	list->expression = expression;
 	list->next = NULL;
 	return list;
@@ -336,7 +505,7 @@ static void expression_list_append(struct expression_list *list,
 /* Create and initialize a new option. */
 static struct option_list *new_option(char *name, char *value)
 {
-	struct option_list *opt = calloc(1, sizeof(struct option_list));
+	struct option_list *opt = parse_alloc(sizeof(struct option_list));
 	opt->name = name;
 	opt->value = value;
 	return opt;
@@ -345,13 +514,287 @@ static struct option_list *new_option(char *name, char *value)
 /* Create and initialize a new event. */
 static struct event *new_event(enum event_t type)
 {
-	struct event *e = calloc(1, sizeof(struct event));
+	struct event *e = parse_alloc(sizeof(struct event));
 	e->type = type;
 	e->time_usecs_end = NO_TIME_RANGE;
 	e->offset_usecs = NO_TIME_RANGE;
 	return e;
 }
 
+/* Return the meter metric with the given name. */
+static enum meter_metric_t meter_metric(const char *name)
+{
+	if (strcmp(name, "bytes") == 0)
+		return METER_BYTES;
+	if (strcmp(name, "packets") == 0)
+		return METER_PACKETS;
+	if (strcmp(name, "kbps") == 0)
+		return METER_KBPS;
+	if (strcmp(name, "dsn_share") == 0)
+		return METER_DSN_SHARE;
+	if (strcmp(name, "gap_p50_usecs") == 0)
+		return METER_GAP_P50;
+	if (strcmp(name, "gap_p90_usecs") == 0)
+		return METER_GAP_P90;
+	if (strcmp(name, "pacing_kbps") == 0)
+		return METER_PACING_KBPS;
+	if (strcmp(name, "pacing_pct") == 0)
+		return METER_PACING_PCT;
+	semantic_error("unknown meter metric; expected bytes, packets, "
+		       "kbps, dsn_share, gap_p50_usecs, gap_p90_usecs, "
+		       "pacing_kbps or pacing_pct");
+	return NUM_METER_METRICS;
+}
+
+/* Return a peer spec with the default settings: ACK every other
+ * segment or after 40ms, as Linux does, with SACK and no losses.
+ */
+static struct peer_spec *new_peer_spec(void)
+{
+	struct peer_spec *spec = parse_alloc(sizeof(struct peer_spec));
+
+	spec->ack_every = 2;
+	spec->ack_delay_usecs = 40000;
+	spec->sack_blocks = 3;
+	return spec;
+}
+
+/* Apply the peer setting name=value. */
+static void peer_setting(struct peer_spec *spec, char *name, double value)
+{
+	if (strcmp(name, "ack_every") == 0) {
+		if (value < 1 || value != (int)value)
+			semantic_error("peer ack_every must be a positive "
+				       "integer");
+		spec->ack_every = value;
+	} else if (strcmp(name, "ack_delay") == 0) {
+		if (value < 0)
+			semantic_error("negative peer ack_delay");
+		spec->ack_delay_usecs = (s64)(value * 1.0e6);
+	} else if (strcmp(name, "loss") == 0) {
+		if (value < 0 || value > 100)
+			semantic_error("peer loss must be a percent");
+		spec->loss_pct = value;
+	} else if (strcmp(name, "drop_every") == 0) {
+		if (value < 0 || value != (int)value)
+			semantic_error("peer drop_every must be an integer");
+		spec->drop_every = value;
+	} else if (strcmp(name, "sack_blocks") == 0) {
+		if (value < 0 || value > 3 || value != (int)value)
+			semantic_error("peer sack_blocks must be 0 to 3");
+		spec->sack_blocks = value;
+	} else {
+		semantic_error("unknown peer setting; expected ack_every, "
+			       "ack_delay, loss, drop_every or sack_blocks");
+	}
+	parse_free(name);
+}
+
+/* Add the peer check name >= bound, or name <= bound. */
+static void peer_check(struct peer_spec *spec, char *name, bool at_least,
+		       double bound)
+{
+	static const char *names[NUM_PEER_METRICS] = {
+		[PEER_ACKED]		= "acked",
+		[PEER_DATA_ACKED]	= "data_acked",
+		[PEER_KBPS]		= "kbps",
+		[PEER_SEGMENTS]		= "segments",
+		[PEER_RETRANSMITS]	= "retransmits",
+		[PEER_DROPS]		= "drops",
+		[PEER_ACKS]		= "acks",
+	};
+	struct peer_check *check = NULL;
+	int i;
+
+	if (spec->num_checks == MAX_PEER_CHECKS)
+		semantic_error("too many checks on one peer");
+	check = &spec->checks[spec->num_checks++];
+	for (i = 0; i < NUM_PEER_METRICS; ++i) {
+		if (strcmp(name, names[i]) == 0)
+			break;
+	}
+	if (i == NUM_PEER_METRICS)
+		semantic_error("unknown peer metric; expected acked, "
+			       "data_acked, kbps, segments, retransmits, "
+			       "drops or acks");
+	check->metric = i;
+	check->at_least = at_least;
+	check->bound = bound;
+	parse_free(name);
+}
+
+/* Return a syn_flood spec with the default settings: 1000 SYNs a
+ * second, of which no handshake is completed.
+ */
+static struct syn_flood_spec *new_syn_flood_spec(void)
+{
+	struct syn_flood_spec *spec =
+		parse_alloc(sizeof(struct syn_flood_spec));
+
+	spec->rate = 1000;
+	return spec;
+}
+
+/* Apply the syn_flood setting name=value. */
+static void syn_flood_setting(struct syn_flood_spec *spec, char *name,
+			      double value)
+{
+	if (strcmp(name, "rate") == 0) {
+		if (value <= 0 || value > 10000000)
+			semantic_error("syn_flood rate must be from 0 to "
+				       "10000000 SYNs a second");
+		spec->rate = value;
+	} else if (strcmp(name, "complete") == 0) {
+		if (value < 0 || value > 100)
+			semantic_error("syn_flood complete must be a percent");
+		spec->complete_pct = value;
+	} else if (strcmp(name, "mptcp") == 0) {
+		if (value != 0 && value != 1)
+			semantic_error("syn_flood mptcp must be 0 or 1");
+		spec->mptcp = (value == 1);
+	} else {
+		semantic_error("unknown syn_flood setting; expected rate, "
+			       "complete or mptcp");
+	}
+	parse_free(name);
+}
+
+/* Add the syn_flood check name >= bound, or name <= bound. */
+static void syn_flood_check(struct syn_flood_spec *spec, char *name,
+			    bool at_least, double bound)
+{
+	static const char *names[NUM_SYN_FLOOD_METRICS] = {
+		[SYN_FLOOD_SYNS]	= "syns",
+		[SYN_FLOOD_SYNACKS]	= "synacks",
+		[SYN_FLOOD_SYNACK_P50]	= "synack_p50_usecs",
+		[SYN_FLOOD_SYNACK_P99]	= "synack_p99_usecs",
+		[SYN_FLOOD_REFUSED]	= "refused",
+		[SYN_FLOOD_COOKIES]	= "cookies",
+		[SYN_FLOOD_OVERFLOWS]	= "overflows",
+		[SYN_FLOOD_ACCEPTS]	= "accepts",
+		[SYN_FLOOD_ACCEPT_RATE]	= "accept_rate",
+	};
+	struct syn_flood_check *check = NULL;
+	int i;
+
+	if (spec->num_checks == MAX_SYN_FLOOD_CHECKS)
+		semantic_error("too many checks on one syn_flood");
+	check = &spec->checks[spec->num_checks++];
+	for (i = 0; i < NUM_SYN_FLOOD_METRICS; ++i) {
+		if (strcmp(name, names[i]) == 0)
+			break;
+	}
+	if (i == NUM_SYN_FLOOD_METRICS)
+		semantic_error("unknown syn_flood metric; expected syns, "
+			       "synacks, synack_p50_usecs, synack_p99_usecs, "
+			       "refused, cookies, overflows, accepts or "
+			       "accept_rate");
+	check->metric = i;
+	check->at_least = at_least;
+	check->bound = bound;
+	parse_free(name);
+}
+
+/* Return how many MPTCP variables and values are queued for packets. */
+static int mptcp_queued_count(void)
+{
+	return queue_size(&mp_state.vars_queue) +
+		queue_size_val(&mp_state.vals_queue);
+}
+
+/* Create an event for a block of events to run 'count' times. The
+ * events must use relative times, so that each run follows the last.
+ */
+static struct event *new_repeat_event(s64 count, struct event *events)
+{
+	struct event *event = new_event(REPEAT_EVENT);
+	struct repeat_spec *repeat = parse_alloc(sizeof(struct repeat_spec));
+	struct event *e = NULL;
+	int i = 0;
+
+	if (count < 1 || count > UINT_MAX)
+		semantic_error("repeat count out of range");
+
+	event->event.repeat = repeat;
+	event->time_type = RELATIVE_TIME;
+	repeat->count = count;
+	repeat->events = events;
+
+	for (e = events; e != NULL; e = e->next) {
+		current_script_line = e->line_number;
+		if (e->type == REPEAT_EVENT)
+			semantic_error("repeat blocks cannot be nested");
+		if (e->type == INTERLEAVE_EVENT)
+			semantic_error("interleave blocks cannot be in a "
+				       "repeat block");
+		if (e->time_type != RELATIVE_TIME &&
+		    e->time_type != RELATIVE_RANGE_TIME &&
+		    e->time_type != ANY_TIME)
+			semantic_error("events in a repeat block must use "
+				       "relative times");
+		repeat->duration_usecs += e->time_usecs;
+		if (e->type == PACKET_EVENT)
+			++repeat->num_packets;
+	}
+
+	repeat->packets = parse_alloc(repeat->num_packets *
+				      sizeof(struct packet *));
+	for (e = events; e != NULL; e = e->next) {
+		struct packet *packet = NULL;
+		u32 seq_bytes = 0;
+
+		if (e->type != PACKET_EVENT)
+			continue;
+		packet = e->event.packet;
+		repeat->packets[i++] = packet_copy(packet);
+		if (packet->tcp == NULL)
+			continue;
+
+		seq_bytes = packet_payload_len(packet) +
+			packet->tcp->syn + packet->tcp->fin;
+		if (packet_direction(packet) == DIRECTION_INBOUND)
+			repeat->inbound_seq_bytes += seq_bytes;
+		else
+			repeat->outbound_seq_bytes += seq_bytes;
+	}
+	return event;
+}
+
+/* Create an event for a block of outbound packets whose streams, one per
+ * socket, may be interleaved. Trains cover a run of segments on one
+ * socket, which is already a stream of its own, so they stay outside.
+ */
+static struct event *new_interleave_event(struct event *events)
+{
+	struct event *event = new_event(INTERLEAVE_EVENT);
+	struct interleave_spec *interleave =
+		parse_alloc(sizeof(struct interleave_spec));
+	struct event *e = NULL;
+
+	event->event.interleave = interleave;
+	interleave->events = events;
+
+	for (e = events; e != NULL; e = e->next) {
+		current_script_line = e->line_number;
+		if (e->type != PACKET_EVENT ||
+		    packet_direction(e->event.packet) != DIRECTION_OUTBOUND ||
+		    (e->event.packet->tcp == NULL &&
+		     e->event.packet->udp == NULL))
+			semantic_error("interleave blocks can only hold "
+				       "outbound TCP or UDP packets");
+		if (e->event.packet->flags & FLAG_TRAIN)
+			semantic_error("trains cannot be in an interleave "
+				       "block");
+		if (e->time_type != RELATIVE_TIME &&
+		    e->time_type != RELATIVE_RANGE_TIME &&
+		    e->time_type != ANY_TIME)
+			semantic_error("packets in an interleave block must "
+				       "use relative times");
+		++interleave->num_packets;
+	}
+	return event;
+}
+
 static int parse_hex_byte(const char *hex, u8 *byte)
 {
 	if (!isxdigit((int)hex[0]) || !isxdigit((int)hex[1])) {
@@ -429,6 +872,16 @@ static struct tcp_option *new_tcp_fast_open_option(const char *cookie_string,
 	return option;
 }
 
+/* Return the flags byte of a mp_capable option from the mp_capable_flags
+ * of the script, which are -1 for the default ones.
+ */
+static u8 mp_capable_flags(bool no_cs, s64 flags)
+{
+	if (flags >= 0)
+		return flags;
+	return no_cs ? MP_CAPABLE_FLAGS : MP_CAPABLE_FLAGS_CS;
+}
+
 struct tcp_option *mp_join_do_syn(bool is_backup,
 		int address_id,
 		bool auto_conf,
@@ -466,17 +919,7 @@ struct tcp_option *mp_join_do_syn(bool is_backup,
 		if(is_integer)
 			mp_join_script_info->syn_or_syn_ack.hash = hash;
 		else{
-			u32 var_length = strlen(str);
-			if(var_length>253) //TODO REFACTOR
-				semantic_error("Too big token variable name, mptcp - mp_join");
-			memcpy(mp_join_script_info->syn_or_syn_ack.var, str, var_length+1);
-			/*if(is_syn_ack){
-				u32 var2_length = strlen(str2);
-				if(var2_length>253)
-					semantic_error("Too big token variable name, mptcp - mp_join");
-				memcpy(mp_join_script_info->syn_or_syn_ack.var2, str2, var2_length+1);
-			}*/
-
+			mp_join_script_info->syn_or_syn_ack.var = mp_var_intern(str);
 		}
 	}
 
@@ -527,17 +970,8 @@ struct tcp_option *mp_join_do_syn_ack(bool is_backup,
 		if(is_integer)
 			mp_join_script_info->syn_or_syn_ack.hash = hash;
 		else{
-			u32 var_length = strlen(str);
-			if(var_length>253) //TODO REFACTOR
-				semantic_error("Too big token variable name, mptcp - mp_join");
-			memcpy(mp_join_script_info->syn_or_syn_ack.var, str, var_length+1);
-		//	if(is_syn_ack){
-				u32 var2_length = strlen(str2);
-				if(var2_length>253)
-					semantic_error("Too big token variable name, mptcp - mp_join");
-				memcpy(mp_join_script_info->syn_or_syn_ack.var2, str2, var2_length+1);
-		//	}
-
+			mp_join_script_info->syn_or_syn_ack.var = mp_var_intern(str);
+			mp_join_script_info->syn_or_syn_ack.var2 = mp_var_intern(str2);
 		}
 	}
 
@@ -561,15 +995,8 @@ struct tcp_option *mp_join_do_ack(char *str, char *str2, bool automatic){
 	struct mp_join_info *mp_join_script_info = malloc(sizeof(struct mp_join_info));
 
 	if(!automatic){
-		u32 var_length = strlen(str);
-		if(var_length>253) //TODO REFACTOR
-			semantic_error("Too big token variable name, mptcp - mp_join");
-		memcpy(mp_join_script_info->ack.var, str, var_length+1);
-
-		u32 var2_length = strlen(str2);
-		if(var2_length>253)
-			semantic_error("Too big token variable name, mptcp - mp_join");
-		memcpy(mp_join_script_info->ack.var2, str2, var2_length+1);
+		mp_join_script_info->ack.var = mp_var_intern(str);
+		mp_join_script_info->ack.var2 = mp_var_intern(str2);
 		mp_join_script_info->ack.is_script_defined = true;
 
 	}else
@@ -701,6 +1128,7 @@ struct tcp_option *dss_do_dsn_dack( int dack_type, int dack_val,
 %}
 
 %locations
+%define api.push-pull both
 %expect 1  /* we expect a shift/reduce conflict for the | binary expression */
 /* The %union section specifies the set of possible types for values
  * for all nonterminal and terminal symbols in the grammar.
@@ -759,6 +1187,11 @@ struct tcp_option *dss_do_dsn_dack( int dack_type, int dack_val,
 	struct syscall_spec *syscall;
 	struct command_spec *command;
 	struct code_spec *code;
+	struct meter_spec *meter;
+	struct meter_check meter_check;
+	struct mp_join_storm_spec *mp_join_storm;
+	struct peer_spec *peer;
+	struct syn_flood_spec *syn_flood;
 	struct tcp_option *tcp_option;
 	struct tcp_options *tcp_options;
 	struct expression *expression;
@@ -772,19 +1205,22 @@ struct tcp_option *dss_do_dsn_dack( int dack_type, int dack_val,
  */
 %token ELLIPSIS
 %token <reserved> SA_FAMILY SIN_PORT SIN_ADDR _HTONS_ INET_ADDR
-%token <reserved> MSG_NAME MSG_IOV MSG_FLAGS
+%token <reserved> MSG_NAME MSG_IOV MSG_FLAGS MSG_HDR MSG_LEN
+%token <reserved> MSG_CONTROL CMSG_LEVEL CMSG_TYPE CMSG_DATA
 %token <reserved> FD EVENTS REVENTS ONOFF LINGER
 %token <reserved> ACK ECR EOL MSS NOP SACK SACKOK TIMESTAMP VAL WIN WSCALE PRO SOCK
 %token <reserved> MP_CAPABLE MP_CAPABLE_NO_CS MP_FASTCLOSE FLAG_A FLAG_B FLAG_C FLAG_D FLAG_E FLAG_F FLAG_G FLAG_H NO_FLAGS
 %token <reserved> MP_JOIN_SYN MP_JOIN_SYN_BACKUP MP_JOIN_SYN_ACK_BACKUP MP_JOIN_ACK MP_JOIN_SYN_ACK
 %token <reserved> DSS DACK4 DSN4 DACK8 DSN8 FIN SSN DLL NOCS CKSUM ADDRESS_ID BACKUP TOKEN AUTO RAND TRUNC_R64_HMAC
 %token <reserved> SENDER_HMAC TRUNC_L64_HMAC FULL_160_HMAC SHA1_32
-%token <reserved> ADD_ADDRESS ADD_ADDR_IPV4 ADD_ADDR_IPV6 PORT MP_FAIL
+%token <reserved> ADD_ADDRESS ADD_ADDRESS_ECHO ADD_ADDR_IPV4 ADD_ADDR_IPV6 PORT MP_FAIL
 %token <reserved> REMOVE_ADDRESS ADDRESSES_ID LIST_ID
 %token <reserved> MP_PRIO
 %token <reserved> FAST_OPEN
 %token <reserved> ECT0 ECT1 CE ECT01 NO_ECN
-%token <reserved> IPV4 IPV6 ICMP UDP GRE MTU
+%token <reserved> IPV4 IPV6 ICMP UDP GRE MTU GSO
+%token <reserved> REPEAT METER TRAIN MP_JOIN_STORM STAGGER PEER SYN_FLOOD
+%token <reserved> INTERLEAVE
 %token <reserved> MPLS LABEL TC TTL
 %token <reserved> OPTION
 %token <floating> FLOAT
@@ -794,18 +1230,25 @@ struct tcp_option *dss_do_dsn_dack( int dack_type, int dack_val,
 %type <ip_ecn> opt_ip_info
 %type <ip_ecn> ip_ecn
 %type <option> option options opt_options
-%type <event> event events event_time action
-%type <time_usecs> time opt_end_time
+%type <event> event events event_time action block_events
+%type <time_usecs> time opt_end_time opt_stagger
 %type <packet> packet_spec tcp_packet_spec udp_packet_spec icmp_packet_spec
 %type <packet> packet_prefix
 %type <syscall> syscall_spec
 %type <command> command_spec
 %type <code> code_spec
+%type <meter> meter_spec meter_checks
+%type <meter_check> meter_check
+%type <floating> meter_bound
+%type <mp_join_storm> mp_join_storm_spec
+%type <peer> peer_spec opt_peer_items peer_items
+%type <syn_flood> syn_flood_spec opt_syn_flood_items syn_flood_items
 %type <mpls_stack> mpls_stack
 %type <mpls_stack_entry> mpls_stack_entry
 %type <integer> opt_mpls_stack_bottom
-%type <integer> opt_icmp_mtu socket_fd_spec fin ssn dll dss_checksum
-%type <integer> mp_capable_no_cs is_backup address_id rand port
+%type <integer> opt_icmp_mtu opt_gso opt_train socket_fd_spec fin ssn dll dss_checksum
+%type <integer> mp_capable_no_cs is_backup address_id rand port add_address
+%type <integer> mp_capable_flags
 %type <integer> flag_a flag_b flag_c flag_d flag_e flag_f flag_g flag_h no_flags
 %type <string> icmp_type opt_icmp_code flags
 %type <string> opt_tcp_fast_open_cookie tcp_fast_open_cookie
@@ -826,6 +1269,7 @@ struct tcp_option *dss_do_dsn_dack( int dack_type, int dack_val,
 %type <expression> expression binary_expression array
 %type <expression> decimal_integer hex_integer
 %type <expression> inaddr sockaddr msghdr iovec pollfd opt_revents linger
+%type <expression> epollev mmsghdr cmsghdr opt_msg_control
 %type <errno_info> opt_errno
 
 %%  /* The grammar follows. */
@@ -840,10 +1284,14 @@ opt_options
 :		{
 	$$ = NULL;
 	parse_and_finalize_config(invocation);
+	if (parse_frees_events(in_config))
+		parse_arena = NULL;
 }
 | options	{
 	$$ = $1;
 	parse_and_finalize_config(invocation);
+	if (parse_frees_events(in_config))
+		parse_arena = NULL;
 }
 ;
 
@@ -868,13 +1316,13 @@ option_flag
 ;
 
 option_value
-: INTEGER	{ $$ = strdup(yytext); }
+: INTEGER	{ $$ = parse_strdup(yytext); }
 | WORD		{ $$ = $1; }
 | STRING	{ $$ = $1; }
 | IPV4_ADDR	{ $$ = $1; }
 | IPV6_ADDR	{ $$ = $1; }
-| IPV4		{ $$ = strdup("ipv4"); }
-| IPV6		{ $$ = strdup("ipv6"); }
+| IPV4		{ $$ = parse_strdup("ipv4"); }
+| IPV6		{ $$ = parse_strdup("ipv6"); }
 ;
 
 opt_init_command
@@ -890,10 +1338,12 @@ events
 : event        {
 	out_script->event_list = $1;  /* save pointer to event list as output
 				       * of parser */
+	++out_script->num_events;
 	$$ = $1;          /* return the tail so that we can append to it */
 }
 | events event {
 	$1->next = $2;    /* link new event to the end of the existing list */
+	++out_script->num_events;
 	$$ = $2;          /* return the tail so that we can append to it */
 }
 ;
@@ -923,7 +1373,32 @@ event
 		semantic_error("event time range can only be used with "
 			       "outbound packets");
 	}
-	free($1);
+	/* Compile how to verify the packets the kernel should send. */
+	if ($$->type == PACKET_EVENT &&
+	    packet_direction($$->event.packet) == DIRECTION_OUTBOUND)
+		packet_verify_plan($$->event.packet);
+	parse_free($1);
+}
+| REPEAT INTEGER '{' { $<integer>$ = mptcp_queued_count(); }
+  block_events '}' {
+	/* Packets in a repeat block run more than once, but each
+	 * queued MPTCP variable or value is only used once.
+	 */
+	if (mptcp_queued_count() != $<integer>4) {
+		current_script_line = @1.first_line;
+		semantic_error("MPTCP variables and values cannot be used "
+			       "in a repeat block");
+	}
+	$$ = new_repeat_event($2, $5);
+	$$->line_number = @1.first_line;
+}
+;
+
+block_events
+: event                 { $$ = $1; }
+| event block_events    {
+	$1->next = $2;    /* link in front of the rest of the block */
+	$$ = $1;          /* return the head of the block */
 }
 ;
 
@@ -981,6 +1456,27 @@ action
 | syscall_spec { $$ = new_event(SYSCALL_EVENT); $$->event.syscall = $1; }
 | command_spec { $$ = new_event(COMMAND_EVENT); $$->event.command = $1; }
 | code_spec    { $$ = new_event(CODE_EVENT);    $$->event.code    = $1; }
+| meter_spec   { $$ = new_event(METER_EVENT);   $$->event.meter   = $1; }
+| peer_spec    { $$ = new_event(PEER_EVENT);    $$->event.peer    = $1; }
+| mp_join_storm_spec {
+	$$ = new_event(MP_JOIN_STORM_EVENT);
+	$$->event.mp_join_storm = $1;
+}
+| syn_flood_spec {
+	$$ = new_event(SYN_FLOOD_EVENT);
+	$$->event.syn_flood = $1;
+}
+| INTERLEAVE '{' { $<integer>$ = mptcp_queued_count(); } block_events '}' {
+	/* The block's packets are matched in no set order, so they
+	 * cannot take queued MPTCP variables or values in order.
+	 */
+	if (mptcp_queued_count() != $<integer>3) {
+		current_script_line = @1.first_line;
+		semantic_error("MPTCP variables and values cannot be used "
+			       "in an interleave block");
+	}
+	$$ = new_interleave_event($4);
+}
 ;
 
 packet_spec
@@ -995,7 +1491,7 @@ socket_fd_spec
 ;
 
 tcp_packet_spec
-: packet_prefix opt_ip_info flags seq opt_ack opt_window opt_tcp_options socket_fd_spec {
+: packet_prefix opt_ip_info flags seq opt_ack opt_window opt_tcp_options opt_gso socket_fd_spec opt_train {
 	char *error = NULL;
 	struct packet *outer = $1, *inner = NULL;
 	enum direction_t direction = outer->direction;
@@ -1005,25 +1501,52 @@ tcp_packet_spec
 		semantic_error("<...> for TCP options can only be used with "
 			       "outbound packets");
 	}
+	if (($7 != NULL) && $7->raw && (direction != DIRECTION_INBOUND)) {
+		yylineno = @7.first_line;
+		semantic_error("raw TCP options can only be used with "
+			       "inbound packets");
+	}
 
-	inner = new_tcp_packet($8, in_config->wire_protocol,
+	inner = new_tcp_packet($9, in_config->wire_protocol,
 			       direction, $2, $3,
 			       $4.start_sequence, $4.payload_bytes,
 			       $5, $6, $7, &error);
-	free($3);
-	free($7);
+	parse_free($3);
+	parse_free($7);
 	if (inner == NULL) {
 		assert(error != NULL);
 		semantic_error(error);
 		free(error);
 	}
 
-	$$ = packet_encapsulate_and_free(outer, inner);
+	if ($8 != 0 && packet_header_count(outer) > 0) {
+		yylineno = @8.first_line;
+		semantic_error("gso is not supported for encapsulated packets");
+	}
+	inner->gso_size = $8;
+
+	if ($10) {
+		yylineno = @10.first_line;
+		if (direction != DIRECTION_OUTBOUND)
+			semantic_error("train can only be used with outbound "
+				       "packets");
+		if ($4.payload_bytes == 0 || inner->tcp->syn || $8 != 0)
+			semantic_error("train needs a data packet without SYN "
+				       "or gso");
+		inner->flags |= FLAG_TRAIN;
+	}
+	$$ = encapsulate_and_free(outer, inner);
+
+	/* Sum inbound packets now, so that injecting them only needs
+	 * incremental updates for the fields mapped to live values.
+	 */
+	if (direction == DIRECTION_INBOUND)
+		checksum_packet($$);
 }
 ;
 
 udp_packet_spec
-: packet_prefix UDP '(' INTEGER ')' {
+: packet_prefix UDP '(' INTEGER ')' opt_gso {
 	char *error = NULL;
 	struct packet *outer = $1, *inner = NULL;
 	enum direction_t direction = outer->direction;
@@ -1039,7 +1562,21 @@ udp_packet_spec
 		free(error);
 	}
 
-	$$ = packet_encapsulate_and_free(outer, inner);
+	/* A UDP GSO packet stands for the datagrams of gso_size bytes
+	 * (the last maybe shorter) that its payload is cut into.
+	 */
+	if ($6 != 0) {
+		yylineno = @6.first_line;
+		if (packet_header_count(outer) > 0)
+			semantic_error("gso is not supported for encapsulated "
+				       "packets");
+		if ($6 >= $4)
+			semantic_error("UDP gso needs a payload of more than "
+				       "one segment");
+	}
+	inner->gso_size = $6;
+
+	$$ = encapsulate_and_free(outer, inner);
 }
 ;
 
@@ -1052,14 +1589,14 @@ icmp_packet_spec
 	inner = new_icmp_packet($7, in_config->wire_protocol, direction, $4, $5,
 				$2.protocol, $2.start_sequence,
 				$2.payload_bytes, $6, &error);
-	free($4);
-	free($5);
+	parse_free($4);
+	parse_free($5);
 	if (inner == NULL) {
 		semantic_error(error);
 		free(error);
 	}
 
-	$$ = packet_encapsulate_and_free(outer, inner);
+	$$ = encapsulate_and_free(outer, inner);
 }
 ;
 
@@ -1076,8 +1613,8 @@ packet_prefix
 	char *ip_dst = $5;
 	if (ipv4_header_append(packet, ip_src, ip_dst, &error))
 		semantic_error(error);
-	free(ip_src);
-	free(ip_dst);
+	parse_free(ip_src);
+	parse_free(ip_dst);
 	$$ = packet;
 }
 | packet_prefix IPV6 IPV6_ADDR '>' IPV6_ADDR ':' {
@@ -1087,8 +1624,8 @@ packet_prefix
 	char *ip_dst = $5;
 	if (ipv6_header_append(packet, ip_src, ip_dst, &error))
 		semantic_error(error);
-	free(ip_src);
-	free(ip_dst);
+	parse_free(ip_src);
+	parse_free(ip_dst);
 	$$ = packet;
 }
 | packet_prefix GRE ':' {
@@ -1143,7 +1680,7 @@ opt_mpls_stack_bottom
 | '[' WORD ']' ','	{
 	if (strcmp($2, "S") != 0)
 		semantic_error("expected [S] for MPLS label stack bottom");
-	free($2);
+	parse_free($2);
 	$$ = 1;
 }
 ;
@@ -1199,9 +1736,9 @@ ip_ecn
 
 flags
 : WORD         { $$ = $1; }
-| '.'          { $$ = strdup("."); }
-| WORD '.'     { asprintf(&($$), "%s.", $1); free($1); }
-| '-'          { $$ = strdup(""); }  /* no TCP flags set in segment */
+| '.'          { $$ = parse_strdup("."); }
+| WORD '.'     { $$ = parse_asprintf("%s.", $1); parse_free($1); }
+| '-'          { $$ = parse_strdup(""); }  /* no TCP flags set in segment */
 ;
 
 seq
@@ -1245,10 +1782,43 @@ opt_window
 }
 ;
 
+opt_train
+:		{ $$ = 0; }
+| TRAIN		{ $$ = 1; }
+;
+
+opt_gso
+:		{ $$ = 0; }
+| GSO INTEGER	{
+	if (!is_valid_u16($2) || $2 == 0) {
+		semantic_error("GSO segment size out of range");
+	}
+	$$ = $2;
+}
+;
+
 opt_tcp_options
 :                             { $$ = tcp_options_new(); }
 | '<' tcp_option_list '>'     { $$ = $2; }
 | '<' ELLIPSIS '>'            { $$ = NULL; /* FLAG_OPTIONS_NOCHECK */ }
+| '<' WORD STRING '>'         {
+	/* Option bytes in hex, such as --fuzz_corpus writes, that
+	 * need not be well-formed options.
+	 */
+	int bytes = 0;
+
+	if (strcmp($2, "raw") != 0)
+		semantic_error("expected <raw \"<hex bytes>\"> for raw TCP "
+			       "options");
+	$$ = tcp_options_new();
+	if (parse_hex_string($3, $$->data, sizeof($$->data), &bytes))
+		semantic_error("raw TCP options are not a valid hex string "
+			       "of at most 40 bytes");
+	$$->length = bytes;
+	$$->raw = true;
+	parse_free($2);
+	parse_free($3);
+}
 ;
 
 tcp_option_list
@@ -1267,13 +1837,13 @@ tcp_option_list
 ;
 
 opt_tcp_fast_open_cookie
-:			{ $$ = strdup(""); }
+:			{ $$ = parse_strdup(""); }
 | tcp_fast_open_cookie	{ $$ = $1; }
 ;
 
 tcp_fast_open_cookie
-: WORD    { $$ = strdup(yytext); }
-| INTEGER { $$ = strdup(yytext); }
+: WORD    { $$ = parse_strdup(yytext); }
+| INTEGER { $$ = parse_strdup(yytext); }
 ;
 
 add_to_var
@@ -1289,15 +1859,14 @@ dsn
 	if(!is_valid_u32($5))
 		semantic_error("this is not a valid 32 unsigned integer.");
 	$$.type = 4;
-	$$.val = sha1_least_64bits($5);
+	$$.val = mptcp_idsn(in_config->mptcp_version, $5);
 }
 | DSN4 '=' TRUNC_R64_HMAC '('  WORD ')' add_to_var {
 	$$.type = 4;
 	$$.val = SCRIPT_DEFINED_TO_HASH_LSB; // to be added using the variable name
-	if(queue_enqueue(&mp_state.vars_queue, $5)==STATUS_ERR)
+	if(enqueue_idsn_expr($5, $7.additional_val, in_config->mptcp_version))
 		semantic_error("Too many variables are used in script");
-	if(queue_enqueue_val(&mp_state.vals_queue, $7.additional_val ))
-		semantic_error("Too many values are enqueued in script");
+	parse_free($5);
 }
 | DSN8 '=' INTEGER 	{	$$.type = 8;	$$.val = $3;}
 | DSN8 				{	$$.type = 8;	$$.val = UNDEFINED;}
@@ -1305,15 +1874,14 @@ dsn
 	if(!is_valid_u64($5))
 		semantic_error("mptcp trunc_r64_hmac is not a valid u64.");
 	$$.type = 8;
-	$$.val = sha1_least_64bits($5);
+	$$.val = mptcp_idsn(in_config->mptcp_version, $5);
 }
 | DSN8 '=' TRUNC_R64_HMAC '('  WORD ')' add_to_var	{
 	$$.type = 8;
 	$$.val = SCRIPT_DEFINED_TO_HASH_LSB; // to be added using the variable name
-	if(queue_enqueue(&mp_state.vars_queue, $5)==STATUS_ERR)
+	if(enqueue_idsn_expr($5, $7.additional_val, in_config->mptcp_version))
 		semantic_error("Too many variables are used in script");
-	if(queue_enqueue_val(&mp_state.vals_queue, $7.additional_val ))
-		semantic_error("Too many values are enqueued in script");
+	parse_free($5);
 }
 ;
 
@@ -1343,15 +1911,14 @@ dack
 	if(!is_valid_u32($5))
 		semantic_error("mptcp trunc_r64_hmac is not a valid u64. ");
 	$$.type = 4;
-	$$.dack = sha1_least_64bits($5);
+	$$.dack = mptcp_idsn(in_config->mptcp_version, $5);
 }
 | DACK4 '=' TRUNC_R64_HMAC '('  WORD ')' add_to_var	{
 	$$.type = 4;
 	$$.dack = SCRIPT_DEFINED_TO_HASH_LSB; // to be added using the variable name
-	if(queue_enqueue(&mp_state.vars_queue, $5)==STATUS_ERR)
+	if(enqueue_idsn_expr($5, $7.additional_val, in_config->mptcp_version))
 		semantic_error("Too many variables are used in script");
-	if(queue_enqueue_val(&mp_state.vals_queue, $7.additional_val ))
-		semantic_error("Too many values are enqueued in script");
+	parse_free($5);
 }
 | DACK8 '=' INTEGER {	$$.type = 8;	$$.dack = $3;}
 | DACK8  			{	$$.type = 8;	$$.dack = UNDEFINED;}
@@ -1359,16 +1926,15 @@ dack
 	if(!is_valid_u64($5))
 		semantic_error("mptcp trunc_r64_hmac is not a valid u64. ");
 	$$.type = 8;
-	$$.dack = sha1_least_64bits($5);
+	$$.dack = mptcp_idsn(in_config->mptcp_version, $5);
 }
 | DACK8 '=' TRUNC_R64_HMAC '('  WORD ')' add_to_var	{
 
 	$$.type = 8;
 	$$.dack = SCRIPT_DEFINED_TO_HASH_LSB; // to be added using the variable name
-	if(queue_enqueue(&mp_state.vars_queue, $5)==STATUS_ERR)
+	if(enqueue_idsn_expr($5, $7.additional_val, in_config->mptcp_version))
 		semantic_error("Too many variables are used in script");
-	if(queue_enqueue_val(&mp_state.vals_queue, $7.additional_val ))
-		semantic_error("Too many values are enqueued in script");
+	parse_free($5);
 }
 ;
 
@@ -1397,6 +1963,43 @@ MP_CAPABLE {$$ = false;}
 | MP_CAPABLE_NO_CS {$$ = true;}
 ;
 
+/* The flags byte of a mp_capable option, or -1 for the default flags. */
+mp_capable_flags
+: flag_a flag_b flag_c flag_d flag_e flag_f flag_g flag_h no_flags {
+	u32 flags = ZERO_RESERVED;
+
+	if($1) // A
+		flags += 128;
+	if($2) // B
+		flags += 64;
+	if($3>0) // C
+		flags += 32;
+	if($4>0) // D
+		flags += 16;
+	if($5>0) // E
+		flags += 8;
+	if($6>0) // F
+		flags += 4;
+	if($7>0) //G
+		flags += 2;
+	if($8>0) //H
+		flags += 1;
+
+	if($9>0)
+		$$ = 0;
+	else if(flags==0)
+		$$ = -1;
+	else
+		$$ = flags;
+}
+;
+
+add_address
+:
+ADD_ADDRESS {$$ = false;}
+| ADD_ADDRESS_ECHO {$$ = true;}
+;
+
 
 flag_a : {$$ = 0;}
 | FLAG_A {$$ = 1;};
@@ -1601,7 +2204,7 @@ tcp_option
 | FAST_OPEN opt_tcp_fast_open_cookie  {
 	char *error = NULL;
 	$$ = new_tcp_fast_open_option($2, &error);
-	free($2);
+	parse_free($2);
 	if ($$ == NULL) {
 		assert(error != NULL);
 		semantic_error(error);
@@ -1609,7 +2212,7 @@ tcp_option
 	}
 }
 
-| mp_capable_no_cs mptcp_var mptcp_var_or_empty flag_a flag_b flag_c flag_d flag_e flag_f flag_g flag_h no_flags{
+| mp_capable_no_cs mptcp_var mptcp_var_or_empty mp_capable_flags {
 
 	unsigned mp_capable_length = TCPOLEN_MP_CAPABLE_SYN;
 
@@ -1622,6 +2225,7 @@ tcp_option
 		//	semantic_error("Value assigned to first mptcp variable is not a valid u64.");
 		add_mp_var_script_defined($2.name, &$2.value, 8);
 	}
+	parse_free($2.name);
 
 	if($3.exist){
 		mp_capable_length = TCPOLEN_MP_CAPABLE;
@@ -1635,40 +2239,22 @@ tcp_option
 		//		semantic_error("Value assigned to second mptcp variable is not a valid u64.");
 			add_mp_var_script_defined($3.name, &$3.value, 8);
 		}
+		parse_free($3.name);
 	}
 
 	$$ = tcp_option_new(TCPOPT_MPTCP, mp_capable_length);
-	$$->data.mp_capable.version = MPTCP_VERSION;
+	$$->data.mp_capable.version = in_config->mptcp_version;
 	$$->data.mp_capable.subtype = MP_CAPABLE_SUBTYPE;
-	u32 flags = ZERO_RESERVED;
-
-	if($4) // A
-		flags += 128;
-	if($5) // B
-		flags += 64;
-	if($6>0) // C
-		flags += 32;
-	if($7>0) // D
-		flags += 16;
-	if($8>0) // E
-		flags += 8;
-	if($9>0) // F
-		flags += 4;
-	if($10>0) //G
-		flags += 2;
-	if($11>0) //H
-		flags += 1;
-
-	if($12>0)
-		flags = 0;
-	else if(flags==0){
-		if($1)
-			flags = MP_CAPABLE_FLAGS;
-		else
-			flags = MP_CAPABLE_FLAGS_CS;
-	}
-
-	$$->data.mp_capable.flags = flags;
+	$$->data.mp_capable.flags = mp_capable_flags($1, $4);
+}
+| mp_capable_no_cs mp_capable_flags {
+	// A version 1 syn, which carries no key
+	if(in_config->mptcp_version == MPTCP_V0)
+		semantic_error("mp_capable without a key needs --mptcp_version=1");
+	$$ = tcp_option_new(TCPOPT_MPTCP, TCPOLEN_MP_CAPABLE_V1_SYN);
+	$$->data.mp_capable.version = in_config->mptcp_version;
+	$$->data.mp_capable.subtype = MP_CAPABLE_SUBTYPE;
+	$$->data.mp_capable.flags = mp_capable_flags($1, $2);
 }
 
 | MP_JOIN_SYN is_backup address_id mptcp_token rand {
@@ -1697,7 +2283,7 @@ tcp_option
 		$$ = dss_do_dsn_dack($2.type, $2.dack, $3.type, $3.val, $4, $5, $6, $7); // $2=dsn, $3=dack, $4:ssn, $5:dll, $6=0|1, $7=0|1 XXX
 
 }
-| ADD_ADDRESS address_id add_addr_ip port { // address_id = $2, add_addr_ip = $3, port = $4
+| add_address address_id add_addr_ip port { // address_id = $2, add_addr_ip = $3, port = $4
 	// default = ipv4
 	if($3.type == UNDEFINED){
 		struct in_addr adr4_zero = ipv4_parse("0.0.0.0").ip.v4;
@@ -1739,6 +2325,15 @@ tcp_option
 	}
 	$$->data.add_addr.address_id = $2;
 	$$->data.mp_capable.subtype = ADD_ADDR_SUBTYPE;
+	if(in_config->mptcp_version != MPTCP_V0){
+		// Version 1 has an echo flag in place of ipver, and an HMAC
+		// unless it is an echo; the address length gives the family.
+		$$->data.add_addr.ipver = $1 ? ADD_ADDR_FLAG_ECHO : 0;
+		if(!$1)
+			$$->length += TCPOLEN_ADD_ADDR_HMAC;
+	}else if($1){
+		semantic_error("add_address_echo needs --mptcp_version=1");
+	}
 }
 | REMOVE_ADDRESS addresses_id{
 
@@ -1802,11 +2397,12 @@ tcp_option
 					semantic_error("Too many values are enqueued in script");
 				$$->data.mp_fastclose.receiver_key = KEY; // <mp_fastclose b + 123>
 			}else{
-				if(queue_enqueue(&mp_state.vars_queue, $2.name)==STATUS_ERR)
+				if(enqueue_var($2.name))
 					semantic_error("Too many variables are used in script");
 				$$->data.mp_fastclose.receiver_key = SCRIPT_DEFINED; //<mp_fastclose b>
 			}
 		}
+		parse_free($2.name);
 	}else{
 		$$->data.mp_fastclose.receiver_key = UNDEFINED; // <mp_fastclose>
 	}
@@ -1852,7 +2448,7 @@ sack_block
 syscall_spec
 : opt_end_time function_name function_arguments '='
   expression opt_errno opt_note  {
-	$$ = calloc(1, sizeof(struct syscall_spec));
+	$$ = parse_alloc(sizeof(struct syscall_spec));
 	$$->end_usecs	= $1;
 	$$->name	= $2;
 	$$->arguments	= $3;
@@ -1890,6 +2486,7 @@ expression
 | WORD              {
 	$$ = new_expression(EXPR_WORD);
 	$$->value.string = $1;
+	$$->symbol = find_int_symbol($1);
 }
 | STRING            {
 	$$ = new_expression(EXPR_STRING);
@@ -1922,6 +2519,15 @@ expression
 | pollfd            {
 	$$ = $1;
 }
+| epollev           {
+	$$ = $1;
+}
+| mmsghdr           {
+	$$ = $1;
+}
+| cmsghdr           {
+	$$ = $1;
+}
 | linger            {
 	$$ = $1;
 }
@@ -1943,8 +2549,8 @@ binary_expression
 : expression '|' expression {       /* bitwise OR */
 	$$ = new_expression(EXPR_BINARY);
 	struct binary_expression *binary =
-			  malloc(sizeof(struct binary_expression));
-	binary->op = strdup("|");
+			  parse_alloc(sizeof(struct binary_expression));
+	binary->op = parse_strdup("|");
 	binary->lhs = $1;
 	binary->rhs = $3;
 	$$->value.binary = binary;
@@ -1974,27 +2580,27 @@ sockaddr
 	SIN_PORT '=' _HTONS_ '(' INTEGER ')' ','
 	SIN_ADDR '=' INET_ADDR '(' STRING ')' '}' {
 	if (strcmp($4, "AF_INET") == 0) {
-		struct sockaddr_in *ipv4 = malloc(sizeof(struct sockaddr_in));
-		memset(ipv4, 0, sizeof(*ipv4));
+		struct sockaddr_in *ipv4 =
+			parse_alloc(sizeof(struct sockaddr_in));
 		ipv4->sin_family = AF_INET;
 		ipv4->sin_port = htons($10);
 		if (inet_pton(AF_INET, $17, &ipv4->sin_addr) == 1) {
 			$$ = new_expression(EXPR_SOCKET_ADDRESS_IPV4);
 			$$->value.socket_address_ipv4 = ipv4;
 		} else {
-			free(ipv4);
+			parse_free(ipv4);
 			semantic_error("invalid IPv4 address");
 		}
 	} else if (strcmp($4, "AF_INET6") == 0) {
-		struct sockaddr_in6 *ipv6 = malloc(sizeof(struct sockaddr_in6));
-		memset(ipv6, 0, sizeof(*ipv6));
+		struct sockaddr_in6 *ipv6 =
+			parse_alloc(sizeof(struct sockaddr_in6));
 		ipv6->sin6_family = AF_INET6;
 		ipv6->sin6_port = htons($10);
 		if (inet_pton(AF_INET6, $17, &ipv6->sin6_addr) == 1) {
 			$$ = new_expression(EXPR_SOCKET_ADDRESS_IPV6);
 			$$->value.socket_address_ipv6 = ipv6;
 		} else {
-			free(ipv6);
+			parse_free(ipv6);
 			semantic_error("invalid IPv6 ");
 		}
 	}
@@ -2004,8 +2610,8 @@ sockaddr
 msghdr
 : '{' MSG_NAME '(' ELLIPSIS ')' '=' ELLIPSIS ','
       MSG_IOV '(' decimal_integer ')' '=' array ','
-      MSG_FLAGS '=' expression '}' {
-	struct msghdr_expr *msg_expr = calloc(1, sizeof(struct msghdr_expr));
+      MSG_FLAGS '=' expression opt_msg_control '}' {
+	struct msghdr_expr *msg_expr = parse_alloc(sizeof(struct msghdr_expr));
 	$$ = new_expression(EXPR_MSGHDR);
 	$$->value.msghdr = msg_expr;
 	msg_expr->msg_name	= new_expression(EXPR_ELLIPSIS);
@@ -2013,13 +2619,34 @@ msghdr
 	msg_expr->msg_iov	= $14;
 	msg_expr->msg_iovlen	= $11;
 	msg_expr->msg_flags	= $18;
-	/* TODO(ncardwell): msg_control, msg_controllen */
+	msg_expr->msg_control	= $19;
+}
+;
+
+opt_msg_control
+:                                {
+	$$ = new_expression(EXPR_LIST);
+	$$->value.list = NULL;
+}
+| ',' MSG_CONTROL '=' array      { $$ = $4; }
+;
+
+cmsghdr
+: '{' CMSG_LEVEL '=' expression ',' CMSG_TYPE '=' expression ','
+      CMSG_DATA '=' expression '}' {
+	struct cmsghdr_expr *cmsg_expr =
+		parse_alloc(sizeof(struct cmsghdr_expr));
+	$$ = new_expression(EXPR_CMSGHDR);
+	$$->value.cmsghdr = cmsg_expr;
+	cmsg_expr->cmsg_level = $4;
+	cmsg_expr->cmsg_type = $8;
+	cmsg_expr->cmsg_data = $12;
 }
 ;
 
 iovec
 : '{' ELLIPSIS ',' decimal_integer '}' {
-	struct iovec_expr *iov_expr = calloc(1, sizeof(struct iovec_expr));
+	struct iovec_expr *iov_expr = parse_alloc(sizeof(struct iovec_expr));
 	$$ = new_expression(EXPR_IOVEC);
 	$$->value.iovec = iov_expr;
 	iov_expr->iov_base = new_expression(EXPR_ELLIPSIS);
@@ -2029,7 +2656,8 @@ iovec
 
 pollfd
 : '{' FD '=' expression ',' EVENTS '=' expression opt_revents '}' {
-	struct pollfd_expr *pollfd_expr = calloc(1, sizeof(struct pollfd_expr));
+	struct pollfd_expr *pollfd_expr =
+		parse_alloc(sizeof(struct pollfd_expr));
 	$$ = new_expression(EXPR_POLLFD);
 	$$->value.pollfd = pollfd_expr;
 	pollfd_expr->fd = $4;
@@ -2038,6 +2666,28 @@ pollfd
 }
 ;
 
+epollev
+: '{' EVENTS '=' expression ',' FD '=' expression '}' {
+	struct epollev_expr *epollev_expr =
+		parse_alloc(sizeof(struct epollev_expr));
+	$$ = new_expression(EXPR_EPOLLEV);
+	$$->value.epollev = epollev_expr;
+	epollev_expr->events = $4;
+	epollev_expr->fd = $8;
+}
+;
+
+mmsghdr
+: '{' MSG_HDR '=' msghdr ',' MSG_LEN '=' expression '}' {
+	struct mmsghdr_expr *mmsg_expr =
+		parse_alloc(sizeof(struct mmsghdr_expr));
+	$$ = new_expression(EXPR_MMSGHDR);
+	$$->value.mmsghdr = mmsg_expr;
+	mmsg_expr->msg_hdr = $4;
+	mmsg_expr->msg_len = $8;
+}
+;
+
 opt_revents
 :                                { $$ = new_integer_expression(0, "%ld"); }
 | ',' REVENTS '=' expression     { $$ = $4; }
@@ -2054,7 +2704,7 @@ linger
 opt_errno
 :                   { $$ = NULL; }
 | WORD note         {
-	$$ = malloc(sizeof(struct errno_spec));
+	$$ = parse_alloc(sizeof(struct errno_spec));
 	$$->errno_macro = $1;
 	$$->strerror    = $2;
 }
@@ -2071,12 +2721,16 @@ note
 
 word_list
 : WORD              { $$ = $1; }
-| word_list WORD    { asprintf(&($$), "%s %s", $1, $2); free($1); free($2); }
+| word_list WORD    {
+	$$ = parse_asprintf("%s %s", $1, $2);
+	parse_free($1);
+	parse_free($2);
+}
 ;
 
 command_spec
 : BACK_QUOTED       {
-	$$ = malloc(sizeof(struct command_spec));
+	$$ = parse_alloc(sizeof(struct command_spec));
 	$$->command_line = $1;
 	current_script_line = yylineno;
 }
@@ -2084,9 +2738,160 @@ command_spec
 
 code_spec
 : CODE              {
-	$$ = calloc(1, sizeof(struct code_spec));
+	$$ = parse_alloc(sizeof(struct code_spec));
 	$$->text = $1;
 	current_script_line = yylineno;
  }
 ;
 
+meter_spec
+: METER time socket_fd_spec meter_checks {
+	int i;
+
+	if ($2 == 0)
+		semantic_error("meter window must be longer than 0");
+	$$ = $4;
+	$$->window_usecs = $2;
+	$$->socket_fd = $3;
+	for (i = 0; i < $$->num_checks; ++i) {
+		if ($$->checks[i].metric >= METER_GAP_P50 &&
+		    $$->socket_fd == SOCKET_FD_NOT_DEFINED)
+			semantic_error("gap and pacing meter metrics need "
+				       "a sock(fd)");
+	}
+}
+;
+
+meter_checks
+: meter_check {
+	$$ = parse_alloc(sizeof(struct meter_spec));
+	$$->checks[$$->num_checks++] = $1;
+}
+| meter_checks ',' meter_check {
+	if ($1->num_checks == MAX_METER_CHECKS)
+		semantic_error("too many checks on one meter");
+	$$ = $1;
+	$$->checks[$$->num_checks++] = $3;
+}
+;
+
+meter_check
+: WORD '>' '=' meter_bound {
+	$$.metric = meter_metric($1);
+	$$.at_least = true;
+	$$.bound = $4;
+	parse_free($1);
+}
+| WORD '<' '=' meter_bound {
+	$$.metric = meter_metric($1);
+	$$.at_least = false;
+	$$.bound = $4;
+	parse_free($1);
+}
+;
+
+meter_bound
+: INTEGER	{ $$ = $1; }
+| FLOAT		{ $$ = $1; }
+;
+
+mp_join_storm_spec
+: MP_JOIN_STORM INTEGER socket_fd_spec opt_stagger {
+	if ($2 < 1 || $2 > MP_JOIN_STORM_MAX_SUBFLOWS)
+		semantic_error("mp_join_storm subflow count out of range");
+	$$ = parse_alloc(sizeof(struct mp_join_storm_spec));
+	$$->num_subflows = $2;
+	$$->socket_fd = $3;
+	$$->stagger_usecs = $4;
+}
+;
+
+opt_stagger
+:		{ $$ = 0; }
+| STAGGER time	{ $$ = $2; }
+;
+
+peer_spec
+: PEER time socket_fd_spec opt_peer_items {
+	if ($2 == 0)
+		semantic_error("peer window must be longer than 0");
+	$$ = $4;
+	$$->window_usecs = $2;
+	$$->socket_fd = $3;
+}
+;
+
+opt_peer_items
+:		{ $$ = new_peer_spec(); }
+| peer_items	{ $$ = $1; }
+;
+
+peer_items
+: WORD '=' meter_bound {
+	$$ = new_peer_spec();
+	peer_setting($$, $1, $3);
+}
+| WORD '>' '=' meter_bound {
+	$$ = new_peer_spec();
+	peer_check($$, $1, true, $4);
+}
+| WORD '<' '=' meter_bound {
+	$$ = new_peer_spec();
+	peer_check($$, $1, false, $4);
+}
+| peer_items ',' WORD '=' meter_bound {
+	$$ = $1;
+	peer_setting($$, $3, $5);
+}
+| peer_items ',' WORD '>' '=' meter_bound {
+	$$ = $1;
+	peer_check($$, $3, true, $6);
+}
+| peer_items ',' WORD '<' '=' meter_bound {
+	$$ = $1;
+	peer_check($$, $3, false, $6);
+}
+;
+
+syn_flood_spec
+: SYN_FLOOD time socket_fd_spec opt_syn_flood_items {
+	if ($2 == 0)
+		semantic_error("syn_flood must last longer than 0");
+	$$ = $4;
+	$$->duration_usecs = $2;
+	$$->socket_fd = $3;
+}
+;
+
+opt_syn_flood_items
+:			{ $$ = new_syn_flood_spec(); }
+| syn_flood_items	{ $$ = $1; }
+;
+
+syn_flood_items
+: WORD '=' meter_bound {
+	$$ = new_syn_flood_spec();
+	syn_flood_setting($$, $1, $3);
+}
+| WORD '>' '=' meter_bound {
+	$$ = new_syn_flood_spec();
+	syn_flood_check($$, $1, true, $4);
+}
+| WORD '<' '=' meter_bound {
+	$$ = new_syn_flood_spec();
+	syn_flood_check($$, $1, false, $4);
+}
+| syn_flood_items ',' WORD '=' meter_bound {
+	$$ = $1;
+	syn_flood_setting($$, $3, $5);
+}
+| syn_flood_items ',' WORD '>' '=' meter_bound {
+	$$ = $1;
+	syn_flood_check($$, $3, true, $6);
+}
+| syn_flood_items ',' WORD '<' '=' meter_bound {
+	$$ = $1;
+	syn_flood_check($$, $3, false, $6);
+}
+;
+
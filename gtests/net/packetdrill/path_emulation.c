@@ -0,0 +1,447 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation for emulating network paths.
+ */
+
+#include "path_emulation.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "logging.h"
+#include "netdev.h"
+#include "packet.h"
+#include "prng.h"
+#include "run.h"
+#include "socket.h"
+
+int path_spec_parse(const char *arg, struct path_spec *path, char **error)
+{
+	char *copy = strdup(arg);
+	char *field = NULL, *save = NULL;
+	int result = STATUS_ERR;
+
+	memset(path, 0, sizeof(*path));
+	ip_reset(&path->ip);
+	for (field = strtok_r(copy, ",", &save); field != NULL;
+	     field = strtok_r(NULL, ",", &save)) {
+		char *value = strchr(field, '=');
+		char *end = NULL;
+		double number;
+
+		if (value == NULL) {
+			asprintf(error, "bad --path field: %s", field);
+			goto out;
+		}
+		*value++ = '\0';
+		if (strcmp(field, "ip") == 0) {
+			path->ip = strchr(value, ':') != NULL ?
+				ipv6_parse(value) : ipv4_parse(value);
+			continue;
+		}
+		number = strtod(value, &end);
+		if (*value == '\0' || *end != '\0' || number < 0) {
+			asprintf(error, "bad --path %s: %s", field, value);
+			goto out;
+		}
+		if (strcmp(field, "port") == 0 && number <= 0xffff) {
+			path->port = number;
+		} else if (strcmp(field, "delay") == 0) {
+			path->delay_usecs = number;
+		} else if (strcmp(field, "jitter") == 0) {
+			path->jitter_usecs = number;
+		} else if (strcmp(field, "rate") == 0) {
+			path->rate_kbps = number;
+		} else if (strcmp(field, "loss") == 0 && number <= 100) {
+			path->loss_ppm = number * 10000;
+		} else {
+			asprintf(error, "bad --path %s: %s", field, value);
+			goto out;
+		}
+	}
+	if (path->jitter_usecs > path->delay_usecs) {
+		asprintf(error, "--path jitter is more than its delay");
+		goto out;
+	}
+	result = STATUS_OK;
+out:
+	free(copy);
+	return result;
+}
+
+struct path_spec *path_find(struct path_spec *paths, int num_paths,
+			    const struct packet *packet)
+{
+	struct tuple tuple;
+	int i;
+
+	if (packet->tcp == NULL && packet->udp == NULL)
+		return NULL;
+	get_packet_tuple(packet, &tuple);
+	for (i = 0; i < num_paths; ++i) {
+		struct path_spec *path = &paths[i];
+
+		if (path->ip.address_family != AF_UNSPEC &&
+		    !is_equal_ip(&path->ip, &tuple.src.ip) &&
+		    !is_equal_ip(&path->ip, &tuple.dst.ip))
+			continue;
+		if (path->port != 0 &&
+		    path->port != ntohs(tuple.src.port) &&
+		    path->port != ntohs(tuple.dst.port))
+			continue;
+		return path;
+	}
+	return NULL;
+}
+
+s64 path_link_cross(const struct path_spec *path, struct path_link *link,
+		    struct prng *prng, s64 now_usecs, int bytes)
+{
+	s64 arrival_usecs = now_usecs;
+
+	if (path->loss_ppm > 0 && prng_below(prng, 1000000) < path->loss_ppm) {
+		++link->num_lost;
+		return -1;
+	}
+	++link->num_packets;
+
+	/* The packet waits for the ones before it to be serialized. */
+	if (path->rate_kbps > 0) {
+		if (link->busy_until_usecs > arrival_usecs) {
+			s64 queued_usecs = link->busy_until_usecs -
+					   arrival_usecs;
+
+			link->queued_usecs += queued_usecs;
+			if (queued_usecs > link->max_queued_usecs)
+				link->max_queued_usecs = queued_usecs;
+			arrival_usecs = link->busy_until_usecs;
+		}
+		arrival_usecs += (s64)bytes * 8 * 1000 / path->rate_kbps;
+		link->busy_until_usecs = arrival_usecs;
+	}
+
+	arrival_usecs += path->delay_usecs;
+	if (path->jitter_usecs > 0)
+		arrival_usecs += (s64)prng_below(prng,
+						 2 * path->jitter_usecs + 1) -
+				 path->jitter_usecs;
+
+	/* Jitter never reorders packets on a path. */
+	if (arrival_usecs < link->last_arrival_usecs)
+		arrival_usecs = link->last_arrival_usecs;
+	link->last_arrival_usecs = arrival_usecs;
+	return arrival_usecs;
+}
+
+/* A packet on its way to the kernel. */
+struct delayed_packet {
+	struct packet *packet;
+	s64 arrival_usecs;
+	struct delayed_packet *next;
+};
+
+struct path_netdev {
+	struct netdev netdev;		/* "inherit" from netdev */
+	struct netdev *base;		/* netdev we wrap (owned) */
+	struct path_spec *paths;	/* paths, with their link state */
+	int num_paths;
+	struct prng *prng;		/* for loss and jitter (not owned) */
+	bool verbose;			/* print path statistics at the end? */
+
+	/* Packets waiting to reach the kernel, soonest first, and the
+	 * thread injecting them when they arrive.
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct delayed_packet *delayed;
+	pthread_t thread;
+	bool has_thread;
+	bool stopping;
+};
+
+static inline struct path_netdev *to_path_netdev(struct netdev *netdev)
+{
+	return (struct path_netdev *)netdev;
+}
+
+static void *path_thread(void *arg)
+{
+	struct path_netdev *netdev = arg;
+
+	pthread_mutex_lock(&netdev->mutex);
+	while (!netdev->stopping) {
+		struct delayed_packet *delayed = netdev->delayed;
+		struct timespec deadline;
+
+		if (delayed == NULL) {
+			pthread_cond_wait(&netdev->cond, &netdev->mutex);
+			continue;
+		}
+		if (delayed->arrival_usecs > now_usecs()) {
+			deadline.tv_sec = delayed->arrival_usecs / 1000000;
+			deadline.tv_nsec = (delayed->arrival_usecs % 1000000) *
+					   1000;
+			pthread_cond_timedwait(&netdev->cond, &netdev->mutex,
+					       &deadline);
+			continue;
+		}
+		netdev->delayed = delayed->next;
+		pthread_mutex_unlock(&netdev->mutex);
+
+		if (netdev_send(netdev->base, delayed->packet))
+			die("path emulation: error injecting packet\n");
+		packet_free(delayed->packet);
+		free(delayed);
+
+		pthread_mutex_lock(&netdev->mutex);
+	}
+	pthread_mutex_unlock(&netdev->mutex);
+	return NULL;
+}
+
+/* Queue a copy of the packet to reach the kernel at the given time. */
+static void delay_packet(struct path_netdev *netdev, struct packet *packet,
+			 s64 arrival_usecs)
+{
+	struct delayed_packet *delayed = calloc(1, sizeof(*delayed));
+	struct delayed_packet **link = NULL;
+
+	delayed->packet = packet_pool_copy(NULL, packet);
+	delayed->arrival_usecs = arrival_usecs;
+
+	pthread_mutex_lock(&netdev->mutex);
+	if (!netdev->has_thread) {
+		if (pthread_create(&netdev->thread, NULL, path_thread,
+				   netdev) != 0)
+			die_perror("pthread_create");
+		netdev->has_thread = true;
+	}
+	for (link = &netdev->delayed; *link != NULL; link = &(*link)->next) {
+		if ((*link)->arrival_usecs > arrival_usecs)
+			break;
+	}
+	delayed->next = *link;
+	*link = delayed;
+	pthread_cond_signal(&netdev->cond);
+	pthread_mutex_unlock(&netdev->mutex);
+}
+
+static void print_link(const char *name, const struct path_link *link)
+{
+	printf(" %s %llu packets, %llu lost", name, link->num_packets,
+	       link->num_lost);
+	if (link->max_queued_usecs > 0)
+		printf(", queued %lld usecs on average, %lld at most",
+		       link->queued_usecs / (s64)link->num_packets,
+		       link->max_queued_usecs);
+	printf(";");
+}
+
+static void path_netdev_free(struct netdev *a_netdev)
+{
+	struct path_netdev *netdev = to_path_netdev(a_netdev);
+	int i;
+
+	pthread_mutex_lock(&netdev->mutex);
+	netdev->stopping = true;
+	pthread_cond_signal(&netdev->cond);
+	pthread_mutex_unlock(&netdev->mutex);
+	if (netdev->has_thread && pthread_join(netdev->thread, NULL) != 0)
+		die_perror("pthread_join");
+
+	/* Packets still on their way are lost with the paths. */
+	while (netdev->delayed != NULL) {
+		struct delayed_packet *delayed = netdev->delayed;
+
+		netdev->delayed = delayed->next;
+		packet_free(delayed->packet);
+		free(delayed);
+	}
+
+	if (netdev->verbose) {
+		for (i = 0; i < netdev->num_paths; ++i) {
+			const struct path_spec *path = &netdev->paths[i];
+
+			if (path->inbound_only) {
+				printf("link:");
+				print_link("inbound", &path->inbound);
+				printf("\n");
+				continue;
+			}
+			printf("path %d:", i);
+			print_link("inbound", &path->inbound);
+			print_link("outbound", &path->outbound);
+			printf("\n");
+		}
+	}
+
+	pthread_cond_destroy(&netdev->cond);
+	pthread_mutex_destroy(&netdev->mutex);
+	netdev_free(netdev->base);
+	memset(netdev, 0, sizeof(*netdev));  /* paranoia to help catch bugs */
+	free(netdev);
+}
+
+static int path_netdev_send(struct netdev *a_netdev, struct packet *packet)
+{
+	struct path_netdev *netdev = to_path_netdev(a_netdev);
+	struct path_spec *path = path_find(netdev->paths, netdev->num_paths,
+					   packet);
+	s64 now = 0, arrival_usecs = 0;
+
+	if (path == NULL)
+		return netdev_send(netdev->base, packet);
+
+	now = now_usecs();
+	arrival_usecs = path_link_cross(path, &path->inbound, netdev->prng,
+					now, packet->ip_bytes);
+	if (arrival_usecs < 0)
+		return STATUS_OK;	/* lost */
+	if (arrival_usecs <= now)
+		return netdev_send(netdev->base, packet);
+	delay_packet(netdev, packet, arrival_usecs);
+	return STATUS_OK;
+}
+
+static int path_netdev_send_batch(struct netdev *a_netdev,
+				  struct packet **packets, int num_packets)
+{
+	struct path_netdev *netdev = to_path_netdev(a_netdev);
+	int i;
+
+	for (i = 0; i < num_packets; ++i) {
+		if (path_find(netdev->paths, netdev->num_paths,
+			      packets[i]) != NULL)
+			break;
+	}
+	if (i == num_packets)
+		return netdev_send_batch(netdev->base, packets, num_packets);
+
+	for (i = 0; i < num_packets; ++i) {
+		if (path_netdev_send(a_netdev, packets[i]))
+			return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* Return the next packet from the kernel that survives its path, once
+ * it has crossed it, as of when it arrives; or give up if the kernel
+ * sends nothing by deadline_usecs, or never if it is negative. A packet
+ * sent before the deadline is still returned when it arrives, even if
+ * that is after.
+ */
+static int path_netdev_receive_until(struct netdev *a_netdev,
+				     struct packet_pool *pool,
+				     s64 deadline_usecs,
+				     struct packet **packet, char **error)
+{
+	struct path_netdev *netdev = to_path_netdev(a_netdev);
+
+	while (1) {
+		struct path_spec *path = NULL;
+		s64 sent_usecs, arrival_usecs, wait_usecs;
+
+		if (deadline_usecs < 0) {
+			if (netdev_receive(netdev->base, pool, packet, error))
+				return STATUS_ERR;
+		} else {
+			if (netdev_receive_until(netdev->base, pool,
+						 deadline_usecs, packet,
+						 error))
+				return STATUS_ERR;
+			if (*packet == NULL)
+				return STATUS_OK;
+		}
+		path = path_find(netdev->paths, netdev->num_paths, *packet);
+		if (path == NULL || path->inbound_only)
+			return STATUS_OK;
+
+		sent_usecs = (*packet)->time_usecs ? (*packet)->time_usecs :
+			     now_usecs();
+		arrival_usecs = path_link_cross(path, &path->outbound,
+						netdev->prng, sent_usecs,
+						(*packet)->ip_bytes);
+		if (arrival_usecs < 0) {
+			packet_free(*packet);
+			*packet = NULL;
+			continue;
+		}
+		wait_usecs = arrival_usecs - now_usecs();
+		if (wait_usecs > 0)
+			usleep(wait_usecs);
+		(*packet)->time_usecs = arrival_usecs;
+		return STATUS_OK;
+	}
+}
+
+static int path_netdev_receive(struct netdev *a_netdev,
+			       struct packet_pool *pool,
+			       struct packet **packet, char **error)
+{
+	return path_netdev_receive_until(a_netdev, pool, -1, packet, error);
+}
+
+static void path_netdev_set_sniff_ports(struct netdev *a_netdev,
+					const __be16 *ports, int num_ports)
+{
+	struct path_netdev *netdev = to_path_netdev(a_netdev);
+
+	netdev_set_sniff_ports(netdev->base, ports, num_ports);
+}
+
+static int path_netdev_queue_summary(struct netdev *a_netdev,
+				     s64 start_usecs, s64 end_usecs,
+				     struct queue_summary *summary)
+{
+	struct path_netdev *netdev = to_path_netdev(a_netdev);
+
+	return netdev_queue_summary(netdev->base, start_usecs, end_usecs,
+				    summary);
+}
+
+static struct netdev_ops path_netdev_ops = {
+	.free = path_netdev_free,
+	.send = path_netdev_send,
+	.send_batch = path_netdev_send_batch,
+	.receive = path_netdev_receive,
+	.receive_until = path_netdev_receive_until,
+	.set_sniff_ports = path_netdev_set_sniff_ports,
+	.queue_summary = path_netdev_queue_summary,
+};
+
+struct netdev *path_netdev_new(struct netdev *base, struct path_spec *paths,
+			       int num_paths, struct prng *prng, bool verbose)
+{
+	struct path_netdev *netdev = calloc(1, sizeof(*netdev));
+
+	netdev->netdev.ops = &path_netdev_ops;
+	netdev->base = base;
+	netdev->paths = paths;
+	netdev->num_paths = num_paths;
+	netdev->prng = prng;
+	netdev->verbose = verbose;
+	if (pthread_mutex_init(&netdev->mutex, NULL) != 0)
+		die_perror("pthread_mutex_init");
+	if (pthread_cond_init(&netdev->cond, NULL) != 0)
+		die_perror("pthread_cond_init");
+	return &netdev->netdev;
+}
@@ -0,0 +1,101 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for emulating network paths with delay, jitter, a rate
+ * limit and loss (--path), so that the subflows of an MPTCP connection
+ * can see different paths although they share one tun device.
+ *
+ * Each --path names the packets it applies to by an IP address and/or
+ * a port at either end, e.g. the kernel's port of one subflow:
+ *
+ *   --path=port=13001,delay=20000,jitter=2000,rate=10000,loss=1
+ *
+ * Times are in microseconds, the rate in kbit/s and the loss in
+ * percent. The first matching path applies, in each direction on its
+ * own: packets we inject reach the kernel late, from a helper thread,
+ * and packets the kernel sends reach the script late, with their
+ * sniff time moved to when they arrive. Packets on a path keep their
+ * order.
+ *
+ * --serialize_inbound adds a last path, for packets no --path matches,
+ * that carries what we inject at the --speed of the tun device, so
+ * that a burst of inbound packets reaches the kernel spaced out as a
+ * bottleneck link would space it, rather than back to back.
+ */
+
+#ifndef __PATH_EMULATION_H__
+#define __PATH_EMULATION_H__
+
+#include "types.h"
+
+#include "ip_address.h"
+
+#define MAX_PATHS	16	/* most --path options we take */
+
+struct netdev;
+struct packet;
+struct prng;
+
+/* One direction of a path, as packets cross it. */
+struct path_link {
+	s64 busy_until_usecs;	/* end of the last packet's serialization */
+	s64 last_arrival_usecs;	/* arrival of the last packet */
+	u64 num_packets;	/* packets that crossed */
+	u64 num_lost;		/* packets lost */
+	s64 queued_usecs;	/* total time packets waited to be sent */
+	s64 max_queued_usecs;	/* longest time a packet waited */
+};
+
+/* A --path: which packets it applies to, and what it does to them. */
+struct path_spec {
+	struct ip_address ip;	/* address at either end; AF_UNSPEC: any */
+	u16 port;		/* port at either end, host order; 0: any */
+	s64 delay_usecs;	/* one-way delay */
+	s64 jitter_usecs;	/* delay varies by up to this much each way */
+	u64 rate_kbps;		/* rate limit in kbit/s; 0: none */
+	u32 loss_ppm;		/* loss in parts per million */
+	bool inbound_only;	/* from --serialize_inbound: inbound only */
+	struct path_link inbound;	/* towards the kernel */
+	struct path_link outbound;	/* from the kernel */
+};
+
+/* Parse the argument of a --path option. Returns STATUS_OK on
+ * success; on failure returns STATUS_ERR and sets error message.
+ */
+extern int path_spec_parse(const char *arg, struct path_spec *path,
+			   char **error);
+
+/* Return the first of the given paths the packet is on, or NULL. */
+extern struct path_spec *path_find(struct path_spec *paths, int num_paths,
+				   const struct packet *packet);
+
+/* Send a packet of the given size across the link at the given time.
+ * Returns the time it arrives, or -1 if it is lost.
+ */
+extern s64 path_link_cross(const struct path_spec *path,
+			   struct path_link *link, struct prng *prng,
+			   s64 now_usecs, int bytes);
+
+/* Wrap the given netdev, so that packets on the given paths cross
+ * them. The new netdev owns the given one, and uses the given random
+ * number generator from the thread that sends and receives.
+ */
+extern struct netdev *path_netdev_new(struct netdev *netdev,
+				      struct path_spec *paths, int num_paths,
+				      struct prng *prng, bool verbose);
+
+#endif /* __PATH_EMULATION_H__ */
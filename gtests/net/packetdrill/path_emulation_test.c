@@ -0,0 +1,132 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for path_emulation.c: parsing --path, and the delay,
+ * serialization, jitter and loss packets see crossing a path.
+ */
+
+#include "path_emulation.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "prng.h"
+
+static void test_parse(void)
+{
+	struct path_spec path;
+	char *error = NULL;
+
+	assert(path_spec_parse("ip=192.168.0.2,port=13001,delay=20000,"
+			       "jitter=2000,rate=10000,loss=1.5",
+			       &path, &error) == STATUS_OK);
+	assert(path.ip.address_family == AF_INET);
+	assert(path.port == 13001);
+	assert(path.delay_usecs == 20000);
+	assert(path.jitter_usecs == 2000);
+	assert(path.rate_kbps == 10000);
+	assert(path.loss_ppm == 15000);
+
+	assert(path_spec_parse("delay=5", &path, &error) == STATUS_OK);
+	assert(path.ip.address_family == AF_UNSPEC);
+	assert(path.port == 0);
+
+	assert(path_spec_parse("delay", &path, &error) == STATUS_ERR);
+	free(error);
+	assert(path_spec_parse("speed=3", &path, &error) == STATUS_ERR);
+	free(error);
+	assert(path_spec_parse("loss=101", &path, &error) == STATUS_ERR);
+	free(error);
+	assert(path_spec_parse("delay=1,jitter=2", &path, &error) ==
+	       STATUS_ERR);
+	free(error);
+}
+
+static void test_delay_and_rate(void)
+{
+	struct path_spec path;
+	struct prng prng;
+	char *error = NULL;
+
+	prng_seed(&prng, 1);
+	assert(path_spec_parse("delay=1000,rate=8000", &path, &error) ==
+	       STATUS_OK);
+
+	/* 1000 bytes take 1000 usecs at 8 Mbit/s. */
+	assert(path_link_cross(&path, &path.inbound, &prng, 0, 1000) ==
+	       2000);
+	assert(path.inbound.max_queued_usecs == 0);
+	/* The next packet queues behind the first. */
+	assert(path_link_cross(&path, &path.inbound, &prng, 0, 1000) ==
+	       3000);
+	assert(path.inbound.queued_usecs == 1000);
+	/* Once the link is idle, packets don't queue. */
+	assert(path_link_cross(&path, &path.inbound, &prng, 10000, 1000) ==
+	       12000);
+	assert(path.inbound.num_packets == 3);
+	assert(path.inbound.queued_usecs == 1000);
+	assert(path.inbound.max_queued_usecs == 1000);
+	assert(path.outbound.num_packets == 0);
+}
+
+static void test_jitter_keeps_order(void)
+{
+	struct path_spec path;
+	struct prng prng;
+	char *error = NULL;
+	s64 last = 0, arrival;
+	int i;
+
+	prng_seed(&prng, 2);
+	assert(path_spec_parse("delay=1000,jitter=1000", &path, &error) ==
+	       STATUS_OK);
+	for (i = 0; i < 1000; ++i) {
+		arrival = path_link_cross(&path, &path.outbound, &prng,
+					  i * 10, 100);
+		assert(arrival >= i * 10);
+		assert(arrival <= i * 10 + 2000);
+		assert(arrival >= last);
+		last = arrival;
+	}
+}
+
+static void test_loss(void)
+{
+	struct path_spec path;
+	struct prng prng;
+	char *error = NULL;
+	int i;
+
+	prng_seed(&prng, 3);
+	assert(path_spec_parse("loss=10", &path, &error) == STATUS_OK);
+	for (i = 0; i < 10000; ++i)
+		path_link_cross(&path, &path.inbound, &prng, i, 100);
+	assert(path.inbound.num_lost + path.inbound.num_packets == 10000);
+	assert(path.inbound.num_lost > 800 && path.inbound.num_lost < 1200);
+
+	assert(path_spec_parse("loss=100", &path, &error) == STATUS_OK);
+	assert(path_link_cross(&path, &path.inbound, &prng, 0, 100) == -1);
+}
+
+int main(void)
+{
+	test_parse();
+	test_delay_and_rate();
+	test_jitter_keeps_order();
+	test_loss();
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Shared buffers for the data that system calls send and receive.
+ */
+
+#include "payload.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "logging.h"
+
+/* Two periods of the pattern, so that the bytes for any offset, up to
+ * a period long, are contiguous.
+ */
+static u8 pattern[2 * PAYLOAD_PATTERN_PERIOD];
+static pthread_once_t pattern_once = PTHREAD_ONCE_INIT;
+
+/* The pattern byte at offset i of a period. Consecutive bytes differ,
+ * and so do bytes a multiple of 256 apart, so data that is shifted or
+ * misplaced in the stream shows up as a mismatch.
+ */
+static u8 pattern_byte(u32 i)
+{
+	return (u8)(i ^ ((i >> 8) * 0x5b));
+}
+
+static void pattern_init(void)
+{
+	u32 i;
+
+	for (i = 0; i < sizeof(pattern); ++i)
+		pattern[i] = pattern_byte(i % PAYLOAD_PATTERN_PERIOD);
+}
+
+/* Map len bytes of anonymous memory, asking for huge pages. */
+static u8 *payload_map(size_t len, int prot, char **error)
+{
+	void *buf = mmap(NULL, len, prot,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (buf == MAP_FAILED) {
+		asprintf(error, "mmap of %zu payload bytes: %s",
+			 len, strerror(errno));
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	/* Just a hint: without THP we make do with small pages. */
+	madvise(buf, len, MADV_HUGEPAGE);
+#endif
+	return buf;
+}
+
+static size_t payload_send_bytes(bool pattern)
+{
+	return PAYLOAD_BYTES + (pattern ? PAYLOAD_PATTERN_PERIOD : 0);
+}
+
+u8 *payload_send_new(bool pattern, char **error)
+{
+	const size_t len = payload_send_bytes(pattern);
+	u8 *payload = NULL;
+
+	/* Untouched pages of a private anonymous mapping are all the
+	 * kernel's zero page, so zeros cost next to nothing.
+	 */
+	if (!pattern)
+		return payload_map(len, PROT_READ, error);
+
+	payload = payload_map(len, PROT_READ | PROT_WRITE, error);
+	if (payload == NULL)
+		return NULL;
+	payload_pattern_fill(payload, 0, len);
+	if (mprotect(payload, len, PROT_READ) < 0)
+		die_perror("mprotect");
+	return payload;
+}
+
+void payload_send_free(u8 *payload, bool pattern)
+{
+	if (munmap(payload, payload_send_bytes(pattern)) < 0)
+		die_perror("munmap");
+}
+
+u8 *payload_scratch_new(char **error)
+{
+	return payload_map(PAYLOAD_BYTES, PROT_READ | PROT_WRITE, error);
+}
+
+void payload_scratch_free(u8 *scratch)
+{
+	if (munmap(scratch, PAYLOAD_BYTES) < 0)
+		die_perror("munmap");
+}
+
+void payload_pattern_fill(u8 *buf, u64 offset, size_t len)
+{
+	pthread_once(&pattern_once, pattern_init);
+	while (len > 0) {
+		u32 start = offset % PAYLOAD_PATTERN_PERIOD;
+		size_t chunk = len < PAYLOAD_PATTERN_PERIOD ?
+			len : PAYLOAD_PATTERN_PERIOD;
+
+		memcpy(buf, pattern + start, chunk);
+		buf += chunk;
+		offset += chunk;
+		len -= chunk;
+	}
+}
+
+size_t payload_pattern_mismatch(const u8 *buf, u64 offset, size_t len)
+{
+	size_t done = 0;
+
+	pthread_once(&pattern_once, pattern_init);
+	while (done < len) {
+		const u8 *expected = pattern + offset % PAYLOAD_PATTERN_PERIOD;
+		size_t chunk = len - done < PAYLOAD_PATTERN_PERIOD ?
+			len - done : PAYLOAD_PATTERN_PERIOD;
+
+		/* memcmp() is the vectorized compare; only a chunk that
+		 * differs is walked to find its first bad byte.
+		 */
+		if (memcmp(buf + done, expected, chunk) != 0) {
+			while (buf[done] == *expected) {
+				++done;
+				++expected;
+			}
+			return done;
+		}
+		done += chunk;
+		offset += chunk;
+	}
+	return len;
+}
+
+bool payload_pattern_matches(const u8 *buf, u64 offset, size_t len)
+{
+	return payload_pattern_mismatch(buf, offset, len) == len;
+}
@@ -0,0 +1,94 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Shared buffers for the data that system calls send and receive.
+ *
+ * Scripts only give the length of what they send or receive, so
+ * instead of each call allocating and clearing a buffer of its own,
+ * sends take their bytes from one read-only mapping that all calls
+ * share, and receives land in a scratch mapping that each thread
+ * reuses. We ask for transparent huge pages for both, so a call that
+ * moves megabytes touches a handful of TLB entries, not thousands.
+ *
+ * Sends carry zeros, unless --payload_pattern asks for a pattern: then
+ * each byte of a TCP stream is a function of its offset in the stream,
+ * and so of its sequence number. For MPTCP the stream is the data
+ * stream of the connection, and the offset follows from the DSN, so
+ * data that the receiver reassembles from its subflows in the wrong
+ * order shows up in what the app reads. The pattern repeats every
+ * PAYLOAD_PATTERN_PERIOD bytes, a power of two, so the bytes for any
+ * offset start somewhere in the first period of a patterned buffer,
+ * and checking data is a memcmp() against the pattern.
+ */
+
+#ifndef __PAYLOAD_H__
+#define __PAYLOAD_H__
+
+#include "types.h"
+
+/* The longest send that takes its payload from the shared mapping, and
+ * the longest receive that lands in a thread's scratch mapping.
+ */
+#define PAYLOAD_BYTES		(64 * 1024 * 1024)
+
+/* Bytes after which the pattern repeats. It divides 2^32, so the
+ * pattern follows sequence numbers across wraparound.
+ */
+#define PAYLOAD_PATTERN_PERIOD	4096
+
+/* Map a read-only buffer of PAYLOAD_BYTES to send: zeros, or if pattern
+ * is set, PAYLOAD_BYTES + PAYLOAD_PATTERN_PERIOD bytes of the pattern
+ * from offset 0. Returns NULL and sets error message on failure.
+ */
+extern u8 *payload_send_new(bool pattern, char **error);
+
+extern void payload_send_free(u8 *payload, bool pattern);
+
+/* Map a writable scratch buffer of PAYLOAD_BYTES for receives. Returns
+ * NULL and sets error message on failure.
+ */
+extern u8 *payload_scratch_new(char **error);
+
+extern void payload_scratch_free(u8 *scratch);
+
+/* Fill buf with the len bytes of the pattern from the given offset in
+ * the stream.
+ */
+extern void payload_pattern_fill(u8 *buf, u64 offset, size_t len);
+
+/* Are the len bytes at buf the pattern from the given offset in the
+ * stream?
+ */
+extern bool payload_pattern_matches(const u8 *buf, u64 offset, size_t len);
+
+/* Return how many of the len bytes at buf are the pattern from the
+ * given offset in the stream before the first that is not, or len if
+ * all of them are.
+ */
+extern size_t payload_pattern_mismatch(const u8 *buf, u64 offset,
+				       size_t len);
+
+/* Return the offset in a TCP stream of the first data byte of a
+ * segment with the given sequence number and SYN flag, given the ISN
+ * of the stream's sender.
+ */
+static inline u32 payload_stream_offset(u32 seq, bool syn, u32 isn)
+{
+	return seq + (syn ? 1 : 0) - (isn + 1);
+}
+
+#endif /* __PAYLOAD_H__ */
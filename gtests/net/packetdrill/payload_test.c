@@ -0,0 +1,120 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for payload.c: the shared send payload holds the pattern
+ * from any offset within its first period, data checks against the
+ * pattern catch shifted or changed bytes, and sequence numbers map to
+ * stream offsets across wraparound.
+ */
+
+#include "payload.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void test_send_payload(void)
+{
+	char *error = NULL;
+	u8 *zeros = payload_send_new(false, &error);
+	u8 *pattern = payload_send_new(true, &error);
+	u64 offset;
+
+	assert(zeros != NULL && pattern != NULL);
+	assert(zeros[0] == 0 && zeros[PAYLOAD_BYTES - 1] == 0);
+
+	/* Sending from pattern + (offset % period) sends the bytes for
+	 * that offset, all the way to PAYLOAD_BYTES.
+	 */
+	for (offset = 0; offset < 3 * PAYLOAD_PATTERN_PERIOD; offset += 1001) {
+		const u8 *start = pattern + offset % PAYLOAD_PATTERN_PERIOD;
+
+		assert(payload_pattern_matches(start, offset, 10000));
+		assert(payload_pattern_matches(start + PAYLOAD_BYTES - 100,
+					       offset + PAYLOAD_BYTES - 100,
+					       100));
+	}
+	payload_send_free(zeros, false);
+	payload_send_free(pattern, true);
+}
+
+static void test_mismatch(void)
+{
+	const size_t len = 3 * PAYLOAD_PATTERN_PERIOD + 17;
+	u8 *buf = malloc(len + 1);
+	size_t shift;
+
+	payload_pattern_fill(buf, 123456789, len + 1);
+	assert(payload_pattern_matches(buf, 123456789, len));
+
+	/* Data from elsewhere in the stream does not match. */
+	for (shift = 1; shift <= 512; shift *= 2)
+		assert(!payload_pattern_matches(buf, 123456789 + shift, len));
+	assert(!payload_pattern_matches(buf + 1, 123456789, len));
+
+	/* Nor does a changed byte, wherever it is. */
+	buf[len - 1] ^= 1;
+	assert(!payload_pattern_matches(buf, 123456789, len));
+	assert(payload_pattern_mismatch(buf, 123456789, len) == len - 1);
+	buf[len - 1] ^= 1;
+	buf[PAYLOAD_PATTERN_PERIOD] ^= 0x80;
+	assert(!payload_pattern_matches(buf, 123456789, len));
+	assert(payload_pattern_mismatch(buf, 123456789, len) ==
+	       PAYLOAD_PATTERN_PERIOD);
+	assert(payload_pattern_mismatch(buf, 123456789,
+					PAYLOAD_PATTERN_PERIOD) ==
+	       PAYLOAD_PATTERN_PERIOD);
+
+	/* Zeros are not the pattern. */
+	memset(buf, 0, len);
+	assert(!payload_pattern_matches(buf, 0, len));
+	free(buf);
+}
+
+static void test_stream_offset(void)
+{
+	u8 buf[100];
+
+	assert(payload_stream_offset(1001, false, 1000) == 0);
+	assert(payload_stream_offset(1000, true, 1000) == 0);
+	assert(payload_stream_offset(1501, false, 1000) == 500);
+	assert(payload_stream_offset(10, false, 0xfffffff0) == 25);
+
+	/* The pattern carries on across sequence wraparound. */
+	payload_pattern_fill(buf, 0x100000000ULL - 50, sizeof(buf));
+	assert(payload_pattern_matches(buf + 50, 0, 50));
+}
+
+static void test_scratch(void)
+{
+	char *error = NULL;
+	u8 *scratch = payload_scratch_new(&error);
+
+	assert(scratch != NULL);
+	memset(scratch, 0xaa, 4096);
+	scratch[PAYLOAD_BYTES - 1] = 1;
+	payload_scratch_free(scratch);
+}
+
+int main(void)
+{
+	test_send_payload();
+	test_mismatch();
+	test_stream_offset();
+	test_scratch();
+	return 0;
+}
@@ -0,0 +1,939 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of replaying the TCP packets of a pcap or pcapng
+ * capture as packet events of a script.
+ */
+
+#include "pcap_replay.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "ethernet.h"
+#include "logging.h"
+#include "mptcp.h"
+#include "packet_checksum.h"
+#include "packet_parser.h"
+#include "socket.h"
+#include "tcp_options_iterator.h"
+#include "tcp_packet.h"
+#include "utils.h"
+
+/* pcap file magic numbers, for microsecond and nanosecond timestamps. */
+#define PCAP_MAGIC_USECS		0xA1B2C3D4
+#define PCAP_MAGIC_NSECS		0xA1B23C4D
+
+/* pcapng block types, option codes and the like, from
+ * draft-ietf-opsawg-pcapng.
+ */
+#define PCAPNG_SECTION_HEADER_BLOCK	0x0A0D0D0A
+#define PCAPNG_INTERFACE_BLOCK		0x00000001
+#define PCAPNG_SIMPLE_PACKET_BLOCK	0x00000003
+#define PCAPNG_ENHANCED_PACKET_BLOCK	0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC		0x1A2B3C4D
+#define PCAPNG_OPT_ENDOFOPT		0
+#define PCAPNG_OPT_IF_TSRESOL		9
+#define PCAPNG_OPT_EPB_FLAGS		2
+#define PCAPNG_EPB_DIRECTION_MASK	0x3
+#define PCAPNG_EPB_INBOUND		0x1
+#define PCAPNG_EPB_OUTBOUND		0x2
+
+/* Link types we can find the IP header in, from tcpdump.org. */
+#define LINKTYPE_NULL			0	/* BSD loopback */
+#define LINKTYPE_ETHERNET		1
+#define LINKTYPE_RAW_OPENBSD		12
+#define LINKTYPE_RAW			101
+#define LINKTYPE_LINUX_SLL		113
+#define LINKTYPE_IPV4			228
+#define LINKTYPE_IPV6			229
+#define LINKTYPE_LINUX_SLL2		276
+
+#define ETHERTYPE_VLAN			0x8100	/* 802.1Q tag */
+
+/* Largest block or packet record we accept. */
+#define MAX_RECORD_BYTES		(256 * 1024)
+
+/* Names of the MPTCP key variables of a replayed connection. */
+#define PEER_KEY_VAR			"replay_peer_key"
+#define KERNEL_KEY_VAR			"replay_kernel_key"
+
+/* An interface of a pcapng section. */
+struct capture_interface {
+	u16 link_type;		/* LINKTYPE_* */
+	u64 ticks_per_sec;	/* timestamp resolution */
+};
+
+/* A pcap or pcapng file we are reading. */
+struct capture {
+	FILE *f;
+	const char *path;
+	bool pcapng;		/* pcapng, or classic pcap? */
+	bool swapped;		/* written in the other byte order? */
+	u16 link_type;		/* for pcap, the link type of all packets */
+	u64 ticks_per_sec;	/* for pcap, the timestamp resolution */
+	struct capture_interface *interfaces;	/* for pcapng */
+	int num_interfaces;
+	u8 *record;		/* buffer for the current block or record */
+	int num_records;	/* packet records read so far */
+};
+
+/* A packet record of a capture. */
+struct frame {
+	int number;		/* 1 for the first packet of the file */
+	s64 time_usecs;		/* timestamp, if has_time */
+	bool has_time;		/* false for pcapng simple packets */
+	u16 link_type;		/* LINKTYPE_* */
+	enum direction_t direction;	/* from pcapng flags, if known */
+	const u8 *data;		/* captured bytes */
+	u32 bytes;		/* captured bytes */
+	u32 wire_bytes;		/* bytes of the packet on the wire */
+};
+
+/* The two TCP endpoints of the replayed connection. */
+enum side_t {
+	SIDE_PEER,		/* the side packetdrill plays */
+	SIDE_KERNEL,		/* the kernel under test */
+	NUM_SIDES,
+};
+
+/* What we know about the replayed connection so far. */
+struct replay {
+	struct config *config;
+	struct script *script;
+	struct event **tail;	/* where the next event goes */
+	bool have_flow;		/* have we picked the connection yet? */
+	struct tuple flow;	/* its tuple from the peer to the kernel */
+	bool have_seq_base[NUM_SIDES];
+	u32 seq_base[NUM_SIDES];	/* TCP sequence a script calls 0 */
+	bool have_idsn[NUM_SIDES];
+	u64 idsn[NUM_SIDES];	/* MPTCP IDSN of each side's key */
+	bool have_time;		/* have we appended an event yet? */
+	s64 last_usecs;		/* capture time of the last event */
+	int num_events;		/* events appended */
+	int num_skipped;	/* packets not in the replayed connection */
+};
+
+static u16 swap16(u16 x)
+{
+	return (x >> 8) | (x << 8);
+}
+
+static u32 swap32(u32 x)
+{
+	return ((x >> 24) | ((x >> 8) & 0xff00) |
+		((x << 8) & 0xff0000) | (x << 24));
+}
+
+static u16 get_u16(const struct capture *c, const u8 *p)
+{
+	u16 x;
+
+	memcpy(&x, p, sizeof(x));
+	return c->swapped ? swap16(x) : x;
+}
+
+static u32 get_u32(const struct capture *c, const u8 *p)
+{
+	u32 x;
+
+	memcpy(&x, p, sizeof(x));
+	return c->swapped ? swap32(x) : x;
+}
+
+/* Read exactly 'bytes' bytes. Return STATUS_OK on success; fill in
+ * *error and return STATUS_ERR on a short read or error.
+ */
+static int read_bytes(struct capture *c, void *buf, u32 bytes, char **error)
+{
+	if (fread(buf, 1, bytes, c->f) == bytes)
+		return STATUS_OK;
+	if (ferror(c->f))
+		asprintf(error, "%s: read: %s", c->path, strerror(errno));
+	else
+		asprintf(error, "%s: truncated capture file", c->path);
+	return STATUS_ERR;
+}
+
+/* Read the pcap file header, whose magic number we have read already. */
+static int read_pcap_header(struct capture *c, u32 magic, char **error)
+{
+	u8 header[20];
+
+	c->ticks_per_sec = (magic == PCAP_MAGIC_NSECS) ? 1000000000ULL :
+		1000000ULL;
+	if (read_bytes(c, header, sizeof(header), error))
+		return STATUS_ERR;
+	/* We skip the version, time zone, accuracy and snap length. */
+	c->link_type = get_u32(c, header + 16);
+	return STATUS_OK;
+}
+
+/* Return the timestamp ticks per second given by an if_tsresol code. */
+static u64 tsresol_ticks_per_sec(u8 tsresol)
+{
+	u64 ticks = 1;
+	int i;
+
+	for (i = 0; i < (tsresol & 0x7f); ++i)
+		ticks *= (tsresol & 0x80) ? 2 : 10;
+	return ticks;
+}
+
+/* Read a pcapng interface description block. */
+static int read_pcapng_interface(struct capture *c, const u8 *body,
+				 u32 body_bytes, char **error)
+{
+	struct capture_interface *interface = NULL;
+	u32 offset = 8;
+
+	if (body_bytes < 8) {
+		asprintf(error, "%s: bad interface block", c->path);
+		return STATUS_ERR;
+	}
+	c->interfaces = realloc(c->interfaces, (c->num_interfaces + 1) *
+				sizeof(struct capture_interface));
+	interface = &c->interfaces[c->num_interfaces++];
+	interface->link_type = get_u16(c, body);
+	interface->ticks_per_sec = 1000000;
+
+	while (offset + 4 <= body_bytes) {
+		u16 code = get_u16(c, body + offset);
+		u16 bytes = get_u16(c, body + offset + 2);
+
+		offset += 4;
+		if (code == PCAPNG_OPT_ENDOFOPT || offset + bytes > body_bytes)
+			break;
+		if (code == PCAPNG_OPT_IF_TSRESOL && bytes >= 1)
+			interface->ticks_per_sec =
+				tsresol_ticks_per_sec(body[offset]);
+		offset += (bytes + 3) & ~3;
+	}
+	return STATUS_OK;
+}
+
+/* Return the direction given by the flags option of an enhanced packet
+ * block, if it has one, or DIRECTION_INVALID.
+ */
+static enum direction_t epb_direction(struct capture *c, const u8 *options,
+				      u32 options_bytes)
+{
+	u32 offset = 0;
+
+	while (offset + 4 <= options_bytes) {
+		u16 code = get_u16(c, options + offset);
+		u16 bytes = get_u16(c, options + offset + 2);
+
+		offset += 4;
+		if (code == PCAPNG_OPT_ENDOFOPT ||
+		    offset + bytes > options_bytes)
+			break;
+		if (code == PCAPNG_OPT_EPB_FLAGS && bytes == 4) {
+			u32 flags = get_u32(c, options + offset);
+
+			switch (flags & PCAPNG_EPB_DIRECTION_MASK) {
+			case PCAPNG_EPB_INBOUND:
+				return DIRECTION_INBOUND;
+			case PCAPNG_EPB_OUTBOUND:
+				return DIRECTION_OUTBOUND;
+			}
+		}
+		offset += (bytes + 3) & ~3;
+	}
+	return DIRECTION_INVALID;
+}
+
+/* Fill in the frame from a pcapng packet block, or leave frame->data
+ * NULL if the block is not a packet block.
+ */
+static int read_pcapng_packet(struct capture *c, u32 type, const u8 *body,
+			      u32 body_bytes, struct frame *frame,
+			      char **error)
+{
+	const struct capture_interface *interface = NULL;
+	u32 interface_id = 0, data_offset = 0;
+
+	if (type == PCAPNG_ENHANCED_PACKET_BLOCK) {
+		if (body_bytes < 20)
+			goto bad;
+		interface_id = get_u32(c, body);
+		frame->bytes = get_u32(c, body + 12);
+		frame->wire_bytes = get_u32(c, body + 16);
+		data_offset = 20;
+	} else if (type == PCAPNG_SIMPLE_PACKET_BLOCK) {
+		if (body_bytes < 4)
+			goto bad;
+		frame->wire_bytes = get_u32(c, body);
+		frame->bytes = min(frame->wire_bytes, body_bytes - 4);
+		data_offset = 4;
+	} else {
+		return STATUS_OK;
+	}
+	if (interface_id >= c->num_interfaces ||
+	    frame->bytes > body_bytes - data_offset)
+		goto bad;
+	interface = &c->interfaces[interface_id];
+
+	frame->link_type = interface->link_type;
+	frame->data = body + data_offset;
+	if (type == PCAPNG_ENHANCED_PACKET_BLOCK) {
+		u64 ticks = ((u64)get_u32(c, body + 4) << 32) |
+			get_u32(c, body + 8);
+		u32 end = data_offset + ((frame->bytes + 3) & ~3);
+
+		frame->has_time = true;
+		frame->time_usecs = ticks / interface->ticks_per_sec *
+			1000000ULL +
+			ticks % interface->ticks_per_sec * 1000000ULL /
+			interface->ticks_per_sec;
+		if (end < body_bytes)
+			frame->direction = epb_direction(c, body + end,
+							 body_bytes - end);
+	}
+	return STATUS_OK;
+
+bad:
+	asprintf(error, "%s: bad packet block", c->path);
+	return STATUS_ERR;
+}
+
+/* Read pcapng blocks until we find a packet, and fill in the frame. */
+static int read_pcapng_frame(struct capture *c, struct frame *frame,
+			     bool *done, char **error)
+{
+	u8 header[8];
+
+	while (frame->data == NULL) {
+		u32 type, bytes;
+		const u8 *body = NULL;
+		u32 body_bytes;
+
+		if (fread(header, 1, sizeof(header), c->f) == 0 &&
+		    feof(c->f)) {
+			*done = true;
+			return STATUS_OK;
+		}
+		type = get_u32(c, header);
+		if (type == PCAPNG_SECTION_HEADER_BLOCK) {
+			/* A new section, perhaps in the other byte order,
+			 * with its own interfaces.
+			 */
+			u32 magic;
+
+			if (read_bytes(c, &magic, sizeof(magic), error))
+				return STATUS_ERR;
+			c->swapped = (magic != PCAPNG_BYTE_ORDER_MAGIC);
+			c->num_interfaces = 0;
+			bytes = get_u32(c, header + 4);
+			if (bytes < 16 || bytes > MAX_RECORD_BYTES ||
+			    read_bytes(c, c->record, bytes - 12, error))
+				goto bad;
+			continue;
+		}
+		bytes = get_u32(c, header + 4);
+		if (bytes < 12 || (bytes & 3) || bytes > MAX_RECORD_BYTES)
+			goto bad;
+		if (read_bytes(c, c->record, bytes - 8, error))
+			return STATUS_ERR;
+		body = c->record;
+		body_bytes = bytes - 12;	/* less the trailing length */
+
+		if (type == PCAPNG_INTERFACE_BLOCK) {
+			if (read_pcapng_interface(c, body, body_bytes, error))
+				return STATUS_ERR;
+		} else if (read_pcapng_packet(c, type, body, body_bytes,
+					      frame, error)) {
+			return STATUS_ERR;
+		}
+	}
+	return STATUS_OK;
+
+bad:
+	if (*error == NULL)
+		asprintf(error, "%s: bad pcapng block", c->path);
+	return STATUS_ERR;
+}
+
+/* Read the next pcap packet record and fill in the frame. */
+static int read_pcap_frame(struct capture *c, struct frame *frame,
+			   bool *done, char **error)
+{
+	u8 header[16];
+	u32 ticks;
+
+	if (fread(header, 1, sizeof(header), c->f) == 0 && feof(c->f)) {
+		*done = true;
+		return STATUS_OK;
+	}
+	frame->bytes = get_u32(c, header + 8);
+	frame->wire_bytes = get_u32(c, header + 12);
+	if (frame->bytes > MAX_RECORD_BYTES) {
+		asprintf(error, "%s: bad packet record", c->path);
+		return STATUS_ERR;
+	}
+	if (read_bytes(c, c->record, frame->bytes, error))
+		return STATUS_ERR;
+	ticks = get_u32(c, header + 4);
+	frame->has_time = true;
+	frame->time_usecs = (s64)get_u32(c, header) * 1000000 +
+		(u64)ticks * 1000000 / c->ticks_per_sec;
+	frame->link_type = c->link_type;
+	frame->data = c->record;
+	return STATUS_OK;
+}
+
+/* Open the capture file and read its header. */
+static int capture_open(struct capture *c, const char *path, char **error)
+{
+	u32 magic;
+
+	memset(c, 0, sizeof(*c));
+	c->path = path;
+	c->f = fopen(path, "r");
+	if (c->f == NULL) {
+		asprintf(error, "%s: fopen: %s", path, strerror(errno));
+		return STATUS_ERR;
+	}
+	c->record = malloc(MAX_RECORD_BYTES);
+	if (read_bytes(c, &magic, sizeof(magic), error))
+		return STATUS_ERR;
+
+	if (magic == PCAPNG_SECTION_HEADER_BLOCK) {
+		c->pcapng = true;
+		rewind(c->f);
+		return STATUS_OK;
+	}
+	if (magic == PCAP_MAGIC_USECS || magic == PCAP_MAGIC_NSECS)
+		return read_pcap_header(c, magic, error);
+	c->swapped = true;
+	if (swap32(magic) == PCAP_MAGIC_USECS ||
+	    swap32(magic) == PCAP_MAGIC_NSECS)
+		return read_pcap_header(c, swap32(magic), error);
+	asprintf(error, "%s: not a pcap or pcapng file", path);
+	return STATUS_ERR;
+}
+
+/* Read the next packet record of the capture into *frame, which stays
+ * valid until the next call. At the end of the file, set *done.
+ */
+static int capture_next(struct capture *c, struct frame *frame,
+			bool *done, char **error)
+{
+	int result;
+
+	memset(frame, 0, sizeof(*frame));
+	frame->direction = DIRECTION_INVALID;
+	*done = false;
+	if (c->pcapng)
+		result = read_pcapng_frame(c, frame, done, error);
+	else
+		result = read_pcap_frame(c, frame, done, error);
+	if (result == STATUS_OK && !*done)
+		frame->number = ++c->num_records;
+	return result;
+}
+
+static void capture_close(struct capture *c)
+{
+	if (c->f != NULL)
+		fclose(c->f);
+	free(c->interfaces);
+	free(c->record);
+	memset(c, 0, sizeof(*c));	/* paranoia to help catch bugs */
+}
+
+/* Set *offset to the offset of the IP header in a frame of the given
+ * link type, and return true; or return false if the frame does not
+ * carry IP.
+ */
+static bool find_ip_header(const struct frame *frame, u32 *offset)
+{
+	const u8 *data = frame->data;
+	u16 ethertype;
+	u32 family;
+
+	switch (frame->link_type) {
+	case LINKTYPE_RAW:
+	case LINKTYPE_RAW_OPENBSD:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		*offset = 0;
+		return true;
+	case LINKTYPE_NULL:
+		/* The address family, in the byte order of the host that
+		 * wrote it; it is small, so either order will do.
+		 */
+		if (frame->bytes < 4)
+			return false;
+		memcpy(&family, data, sizeof(family));
+		if (family > 0xffff)
+			family = swap32(family);
+		*offset = 4;
+		return (family == AF_INET || family == AF_INET6 ||
+			family == 24 || family == 28 || family == 30);
+	case LINKTYPE_ETHERNET:
+		*offset = 12;
+		break;
+	case LINKTYPE_LINUX_SLL:
+		*offset = 14;
+		break;
+	case LINKTYPE_LINUX_SLL2:
+		*offset = 0;
+		break;
+	default:
+		return false;
+	}
+
+	/* The ethertype is at *offset, maybe behind some VLAN tags. */
+	for (;;) {
+		if (*offset + 2 > frame->bytes)
+			return false;
+		ethertype = (data[*offset] << 8) | data[*offset + 1];
+		if (ethertype != ETHERTYPE_VLAN)
+			break;
+		*offset += 4;
+	}
+	if (frame->link_type == LINKTYPE_LINUX_SLL2)
+		*offset = 20;
+	else
+		*offset += 2;
+	return (ethertype == ETHERTYPE_IP || ethertype == ETHERTYPE_IPV6);
+}
+
+/* Choose the connection to replay, given the first TCP packet we see
+ * that the config allows, and the side that sent it.
+ */
+static bool pick_flow(struct replay *replay, const struct tuple *tuple,
+		      enum direction_t direction)
+{
+	const struct ip_address *kernel_ip = &replay->config->replay_kernel_ip;
+
+	if (direction == DIRECTION_INVALID &&
+	    kernel_ip->address_family != AF_UNSPEC) {
+		if (memcmp(kernel_ip, &tuple->dst.ip, sizeof(*kernel_ip)) == 0)
+			direction = DIRECTION_INBOUND;
+		else if (memcmp(kernel_ip, &tuple->src.ip,
+				sizeof(*kernel_ip)) == 0)
+			direction = DIRECTION_OUTBOUND;
+		else
+			return false;
+	}
+
+	/* Otherwise the first packet is the peer's. */
+	if (direction == DIRECTION_OUTBOUND)
+		reverse_tuple(tuple, &replay->flow);
+	else
+		replay->flow = *tuple;
+	replay->have_flow = true;
+	return true;
+}
+
+/* Return the direction of a packet of the replayed connection with the
+ * given tuple, or DIRECTION_INVALID if it is not one.
+ */
+static enum direction_t flow_direction(struct replay *replay,
+				       const struct tuple *tuple)
+{
+	struct tuple reversed;
+
+	if (is_equal_tuple(tuple, &replay->flow))
+		return DIRECTION_INBOUND;
+	reverse_tuple(tuple, &reversed);
+	if (is_equal_tuple(&reversed, &replay->flow))
+		return DIRECTION_OUTBOUND;
+	return DIRECTION_INVALID;
+}
+
+static enum side_t sender(enum direction_t direction)
+{
+	return (direction == DIRECTION_INBOUND) ? SIDE_PEER : SIDE_KERNEL;
+}
+
+static enum side_t other_side(enum side_t side)
+{
+	return (side == SIDE_PEER) ? SIDE_KERNEL : SIDE_PEER;
+}
+
+/* Rewrite the sequence and ACK numbers of a packet from the given side
+ * to be relative to the ISN of their side, as in a script whose SYNs
+ * use sequence number 0. If we did not see the SYN of a side, we act
+ * as if its first byte was sequence number 1.
+ */
+static void rebase_tcp_sequence(struct replay *replay, struct tcp *tcp,
+				enum side_t side)
+{
+	const enum side_t other = other_side(side);
+	u32 seq = ntohl(tcp->seq), ack = ntohl(tcp->ack_seq);
+
+	if (!replay->have_seq_base[side]) {
+		replay->seq_base[side] = tcp->syn ? seq : seq - 1;
+		replay->have_seq_base[side] = true;
+	}
+	tcp->seq = htonl(seq - replay->seq_base[side]);
+
+	if (!tcp->ack)
+		return;
+	if (!replay->have_seq_base[other]) {
+		replay->seq_base[other] = ack - 1;
+		replay->have_seq_base[other] = true;
+	}
+	tcp->ack_seq = htonl(ack - replay->seq_base[other]);
+}
+
+/* Remember the IDSN of a side's MPTCP key, as carried on the wire. */
+static void learn_idsn(struct replay *replay, enum side_t side, u8 version,
+		       u64 key)
+{
+	u32 token;
+
+	mptcp_token_and_idsn(version, key, &token, &replay->idsn[side]);
+	replay->have_idsn[side] = true;
+}
+
+/* Queue up the key variables an MP_CAPABLE option uses, the way the
+ * parser does for "key[a]" or "key[a,b]", and learn the IDSNs the keys
+ * in the capture imply.
+ */
+static int replay_mp_capable(struct replay *replay,
+			     struct tcp_option *option, enum side_t side)
+{
+	static const char *var_names[NUM_SIDES] = {
+		[SIDE_PEER] = PEER_KEY_VAR,
+		[SIDE_KERNEL] = KERNEL_KEY_VAR,
+	};
+	const enum side_t other = other_side(side);
+
+	if (option->length == TCPOLEN_MP_CAPABLE_SYN) {
+		learn_idsn(replay, side, option->data.mp_capable.version,
+			   option->data.mp_capable.syn.key);
+		return enqueue_var((char *)var_names[side]);
+	}
+	if (option->length < TCPOLEN_MP_CAPABLE)
+		return STATUS_OK;
+	learn_idsn(replay, side, option->data.mp_capable.version,
+		   option->data.mp_capable.no_syn.sender_key);
+	learn_idsn(replay, other, option->data.mp_capable.version,
+		   option->data.mp_capable.no_syn.receiver_key);
+	if (enqueue_var((char *)var_names[side]) ||
+	    enqueue_var((char *)var_names[other]))
+		return STATUS_ERR;
+	return STATUS_OK;
+}
+
+/* Rewrite a 4 or 8 byte DSN or data ACK in the wire format to a value
+ * relative to the given IDSN, in host order, as the parser leaves a
+ * script value; or to UNDEFINED if we don't know the IDSN, so that it
+ * is filled in from the live connection.
+ */
+static void rebase_dss_field(u8 *field, int bytes, bool have_idsn, u64 idsn)
+{
+	u32 value4;
+	u64 value8;
+
+	if (bytes == 4) {
+		memcpy(&value4, field, sizeof(value4));
+		value4 = have_idsn ? ntohl(value4) - (u32)idsn : UNDEFINED;
+		memcpy(field, &value4, sizeof(value4));
+	} else {
+		memcpy(&value8, field, sizeof(value8));
+		value8 = have_idsn ? be64toh(value8) - idsn : UNDEFINED;
+		memcpy(field, &value8, sizeof(value8));
+	}
+}
+
+/* Rewrite the fields of a DSS option from the given side the way a
+ * script would write them: DSN relative to the sender's IDSN, data ACK
+ * relative to the receiver's, subflow sequence number and data-level
+ * length in host order, and checksum left to be computed.
+ */
+static void replay_dss(struct replay *replay, struct tcp_option *option,
+		       enum side_t side)
+{
+	const enum side_t other = other_side(side);
+	u8 *field = (u8 *)option + 4;
+	u8 *end = (u8 *)option + option->length;
+	int bytes;
+	u32 ssn;
+	u16 dll;
+
+	if (option->data.dss.flag_A) {
+		bytes = option->data.dss.flag_a ? 8 : 4;
+		if (field + bytes > end)
+			return;
+		rebase_dss_field(field, bytes, replay->have_idsn[other],
+				 replay->idsn[other]);
+		field += bytes;
+	}
+	if (option->data.dss.flag_M) {
+		bytes = option->data.dss.flag_m ? 8 : 4;
+		if (field + bytes + 6 > end)
+			return;
+		rebase_dss_field(field, bytes, replay->have_idsn[side],
+				 replay->idsn[side]);
+		field += bytes;
+		memcpy(&ssn, field, sizeof(ssn));
+		ssn = ntohl(ssn);
+		memcpy(field, &ssn, sizeof(ssn));
+		memcpy(&dll, field + 4, sizeof(dll));
+		dll = ntohs(dll);
+		memcpy(field + 4, &dll, sizeof(dll));
+		if (field + 8 <= end)
+			memset(field + 6, 0xff, 2);	/* UNDEFINED */
+	}
+}
+
+/* Rewrite the MPTCP options of a packet from the given side. */
+static int replay_mptcp_options(struct replay *replay, struct packet *packet,
+				enum side_t side, char **error)
+{
+	struct tcp_options_iterator iter;
+	struct tcp_option *option = tcp_options_begin(packet, &iter);
+
+	for (; option != NULL; option = tcp_options_next(&iter, error)) {
+		if (option->kind != TCPOPT_MPTCP)
+			continue;
+		switch (option->data.mp_capable.subtype) {
+		case MP_CAPABLE_SUBTYPE:
+			if (replay_mp_capable(replay, option, side)) {
+				asprintf(error, "too many MPTCP variables");
+				return STATUS_ERR;
+			}
+			break;
+		case DSS_SUBTYPE:
+			replay_dss(replay, option, side);
+			break;
+		}
+	}
+	return (*error == NULL) ? STATUS_OK : STATUS_ERR;
+}
+
+/* Return the ECN treatment that matches the ECN bits of a packet. */
+static enum ip_ecn_t packet_ecn(const struct packet *packet)
+{
+	u8 bits = packet->ipv4 ? (packet->ipv4->tos & IP_ECN_MASK) :
+		(packet->ipv6->traffic_class_lo & IP_ECN_MASK);
+
+	if (bits == IP_ECN_ECT0)
+		return ECN_ECT0;
+	else if (bits == IP_ECN_ECT1)
+		return ECN_ECT1;
+	else if (bits == IP_ECN_CE)
+		return ECN_CE;
+	else
+		return ECN_NONE;
+}
+
+/* Allocate an event the way the script allocates its events. */
+static struct event *new_event(struct script *script)
+{
+	struct event *event = NULL;
+
+	if (script->arena_events)
+		event = arena_alloc(script->arena, sizeof(*event));
+	else
+		event = calloc(1, sizeof(*event));
+	event->type = PACKET_EVENT;
+	event->time_usecs_end = NO_TIME_RANGE;
+	event->offset_usecs = NO_TIME_RANGE;
+	return event;
+}
+
+/* Append an event for the packet, captured at the given time. */
+static void append_event(struct replay *replay, struct packet *packet,
+			 const struct frame *frame)
+{
+	const struct config *config = replay->config;
+	struct event *event = new_event(replay->script);
+	s64 gap_usecs = 0;
+
+	if (replay->have_time && frame->has_time)
+		gap_usecs = max(frame->time_usecs - replay->last_usecs, 0);
+	if (frame->has_time) {
+		replay->last_usecs = frame->time_usecs;
+		replay->have_time = true;
+	}
+
+	event->line_number = frame->number;
+	event->time_type = RELATIVE_TIME;
+	event->time_usecs = gap_usecs / config->replay_speed;
+	/* At other than real speed we can't say when the kernel ought
+	 * to send its packets.
+	 */
+	if (packet->direction == DIRECTION_OUTBOUND &&
+	    config->replay_speed != 1.0) {
+		event->time_type = ANY_TIME;
+		event->time_usecs = 0;
+	}
+	event->event.packet = packet;
+
+	*replay->tail = event;
+	replay->tail = &event->next;
+	++replay->script->num_events;
+	++replay->num_events;
+}
+
+/* Turn a captured IP packet into a script packet and append its event;
+ * skip it if it is not a packet of the replayed connection.
+ */
+static int replay_packet(struct replay *replay, const struct frame *frame,
+			 const u8 *ip, u32 ip_bytes, char **error)
+{
+	const struct config *config = replay->config;
+	struct packet *packet = packet_new(ip_bytes);
+	enum direction_t direction;
+	struct tuple tuple;
+	char *parse_error = NULL;
+	enum side_t side;
+
+	memcpy(packet->buffer, ip, ip_bytes);
+	if (parse_packet(packet, ip_bytes, PACKET_LAYER_3_IP,
+			 &parse_error) != PACKET_OK ||
+	    packet->tcp == NULL || packet_header_count(packet) != 2) {
+		DEBUGP("replay: skipping packet %d: %s\n", frame->number,
+		       parse_error ? parse_error : "not TCP over IP");
+		free(parse_error);
+		goto skip;
+	}
+	get_packet_tuple(packet, &tuple);
+
+	if (!replay->have_flow &&
+	    !pick_flow(replay, &tuple, frame->direction))
+		goto skip;
+	direction = flow_direction(replay, &tuple);
+	if (direction == DIRECTION_INVALID)
+		goto skip;
+
+	if (packet_address_family(packet) != config->wire_protocol) {
+		asprintf(error, "%s: packet %d: capture and test use "
+			 "different IP versions; see --ip_version",
+			 config->replay_pcap, frame->number);
+		goto fail;
+	}
+	if (direction == DIRECTION_OUTBOUND &&
+	    config->replay_outbound == REPLAY_OUTBOUND_SKIP &&
+	    !packet->tcp->syn)
+		goto skip;
+
+	/* Make it look like a packet of the script's socket, whose
+	 * addresses and ports get filled in while the test runs.
+	 */
+	packet->direction = direction;
+	packet->socket_script_fd = SOCKET_FD_NOT_DEFINED;
+	packet->ecn = packet_ecn(packet);
+	if (packet->ipv4 != NULL) {
+		packet->ipv4->src_ip = packet->ipv4->dst_ip = in4addr_any;
+	} else {
+		packet->ipv6->src_ip = in6addr_any;
+		packet->ipv6->dst_ip = in6addr_any;
+	}
+	packet->tcp->src_port = packet->tcp->dst_port = htons(0);
+
+	side = sender(direction);
+	rebase_tcp_sequence(replay, packet->tcp, side);
+	if (replay_mptcp_options(replay, packet, side, error)) {
+		char *option_error = *error;
+
+		asprintf(error, "%s: packet %d: %s", config->replay_pcap,
+			 frame->number, option_error);
+		free(option_error);
+		goto fail;
+	}
+
+	if (direction == DIRECTION_INBOUND) {
+		checksum_packet(packet);
+	} else if (config->replay_outbound == REPLAY_OUTBOUND_LOOSE) {
+		packet->flags |= FLAG_WIN_NOCHECK | FLAG_OPTIONS_NOCHECK;
+		packet->ecn = ECN_NOCHECK;
+	}
+	append_event(replay, packet, frame);
+	return STATUS_OK;
+
+skip:
+	++replay->num_skipped;
+	packet_free(packet);
+	return STATUS_OK;
+
+fail:
+	packet_free(packet);
+	return STATUS_ERR;
+}
+
+int pcap_replay_append(struct config *config, struct script *script,
+		       char **error)
+{
+	struct replay replay;
+	struct capture capture;
+	struct frame frame;
+	struct event **tail = &script->event_list;
+	int result = STATUS_ERR;
+	bool done = false;
+
+	if (script->streaming) {
+		asprintf(error, "--replay_pcap cannot be used with "
+			 "--stream_window");
+		return STATUS_ERR;
+	}
+
+	memset(&replay, 0, sizeof(replay));
+	replay.config = config;
+	replay.script = script;
+	while (*tail != NULL)
+		tail = &(*tail)->next;
+	replay.tail = tail;
+
+	if (capture_open(&capture, config->replay_pcap, error))
+		goto out;
+	for (;;) {
+		u32 ip_offset = 0;
+
+		if (capture_next(&capture, &frame, &done, error))
+			goto out;
+		if (done)
+			break;
+		if (!find_ip_header(&frame, &ip_offset)) {
+			++replay.num_skipped;
+			continue;
+		}
+		if (frame.bytes < frame.wire_bytes) {
+			asprintf(error, "%s: packet %d: truncated to %u of "
+				 "%u bytes; capture with a larger snaplen",
+				 config->replay_pcap, frame.number,
+				 frame.bytes, frame.wire_bytes);
+			goto out;
+		}
+		if (replay_packet(&replay, &frame, frame.data + ip_offset,
+				  frame.bytes - ip_offset, error))
+			goto out;
+	}
+
+	if (replay.num_events == 0) {
+		asprintf(error, "%s: no TCP packets to replay",
+			 config->replay_pcap);
+		goto out;
+	}
+	DEBUGP("replay: %d packets from %s, %d skipped\n",
+	       replay.num_events, config->replay_pcap, replay.num_skipped);
+	result = STATUS_OK;
+
+out:
+	capture_close(&capture);
+	return result;
+}
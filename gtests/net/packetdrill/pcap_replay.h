@@ -0,0 +1,48 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for replaying a packet capture as part of a test: the TCP
+ * packets of one connection in a pcap or pcapng file become packet
+ * events appended after the events of the script, so that a trace of
+ * a real conversation can drive the kernel under test.
+ */
+
+#ifndef __PCAP_REPLAY_H__
+#define __PCAP_REPLAY_H__
+
+#include "types.h"
+
+#include "config.h"
+#include "script.h"
+
+/* Read the capture named by config->replay_pcap and append its packets
+ * to the script's events. Packets from the peer become inbound packets
+ * to inject, and packets from the kernel under test become outbound
+ * packets to expect, as --replay_outbound says. Each takes the
+ * ports and addresses of the script's socket, and its sequence numbers,
+ * DSNs and data ACKs are rebased the way a script would write them,
+ * relative to the ISN and IDSN of their sender or receiver. Events keep
+ * the gaps between packets in the capture, divided by
+ * config->replay_speed. On success, return STATUS_OK; on error, return
+ * STATUS_ERR and fill in *error.
+ */
+extern int pcap_replay_append(struct config *config, struct script *script,
+			      char **error);
+
+#endif /* __PCAP_REPLAY_H__ */
@@ -0,0 +1,358 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for pcap_replay.c: the packets of one connection in pcap
+ * and pcapng captures become script packet events with the right
+ * directions, times, sequence numbers and MPTCP fields.
+ */
+
+#include "pcap_replay.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checksum.h"
+#include "ip.h"
+#include "mptcp.h"
+#include "packet_parser.h"
+#include "packet_trace.h"
+#include "tcp.h"
+
+#define PEER_IP		0xc0000201	/* 192.0.2.1 */
+#define KERNEL_IP	0xc0a80001	/* 192.168.0.1 */
+#define PEER_ISN	1000
+#define KERNEL_ISN	5000000
+
+#define FLAG_SYN	0x1
+#define FLAG_ACK	0x2
+
+static char path[] = "/tmp/pcap_replay_test.XXXXXX";
+
+/* Fill in an IPv4/TCP packet and return its length. */
+static int make_tcp(u8 *buf, u32 src_ip, u32 dst_ip, u16 src_port,
+		    u16 dst_port, u32 seq, u32 ack, int flags,
+		    const u8 *options, int option_bytes, int payload_bytes)
+{
+	struct ipv4 *ipv4 = (struct ipv4 *)buf;
+	struct tcp *tcp = (struct tcp *)(ipv4 + 1);
+	int bytes = sizeof(*ipv4) + sizeof(*tcp) + option_bytes +
+		payload_bytes;
+
+	memset(buf, 0, bytes);
+	ipv4->version = 4;
+	ipv4->ihl = sizeof(*ipv4) / 4;
+	ipv4->tot_len = htons(bytes);
+	ipv4->ttl = 64;
+	ipv4->protocol = IPPROTO_TCP;
+	ipv4->src_ip.s_addr = htonl(src_ip);
+	ipv4->dst_ip.s_addr = htonl(dst_ip);
+	tcp->src_port = htons(src_port);
+	tcp->dst_port = htons(dst_port);
+	tcp->seq = htonl(seq);
+	tcp->ack_seq = htonl(ack);
+	tcp->doff = (sizeof(*tcp) + option_bytes) / 4;
+	tcp->syn = (flags & FLAG_SYN) != 0;
+	tcp->ack = (flags & FLAG_ACK) != 0;
+	tcp->window = htons(1000);
+	memcpy(tcp + 1, options, option_bytes);
+	ipv4->check = ipv4_checksum(ipv4, sizeof(*ipv4));
+	return bytes;
+}
+
+static void put(FILE *f, const void *data, size_t bytes)
+{
+	assert(fwrite(data, 1, bytes, f) == bytes);
+}
+
+static void put_u32(FILE *f, u32 value)
+{
+	put(f, &value, sizeof(value));
+}
+
+/* Start a pcap file of Ethernet frames with microsecond timestamps. */
+static FILE *pcap_start(void)
+{
+	const u16 version[2] = { 2, 4 };
+	FILE *f = fopen(path, "w");
+
+	assert(f != NULL);
+	put_u32(f, 0xa1b2c3d4);
+	put(f, version, sizeof(version));
+	put_u32(f, 0);			/* time zone */
+	put_u32(f, 0);			/* accuracy */
+	put_u32(f, 65535);		/* snap length */
+	put_u32(f, 1);			/* Ethernet */
+	return f;
+}
+
+static void pcap_add(FILE *f, u32 secs, u32 usecs, const u8 *ip, int bytes)
+{
+	const u8 ethernet[14] = {
+		1, 2, 3, 4, 5, 6, 6, 5, 4, 3, 2, 1, 0x08, 0x00,
+	};
+
+	put_u32(f, secs);
+	put_u32(f, usecs);
+	put_u32(f, sizeof(ethernet) + bytes);
+	put_u32(f, sizeof(ethernet) + bytes);
+	put(f, ethernet, sizeof(ethernet));
+	put(f, ip, bytes);
+}
+
+static void init_test(struct config *config, struct script *script)
+{
+	set_default_config(config);
+	config->wire_protocol = AF_INET;
+	config->replay_pcap = path;
+	init_script(script);
+	init_mp_state();
+}
+
+static struct event *nth_event(struct script *script, int n)
+{
+	struct event *event = script->event_list;
+
+	while (n-- > 0)
+		event = event->next;
+	return event;
+}
+
+/* A handshake in a pcap file, with a packet of another connection. */
+static void test_pcap(void)
+{
+	struct config config;
+	struct script script;
+	struct event *event = NULL;
+	struct packet *packet = NULL;
+	char *error = NULL;
+	u8 ip[100];
+	int bytes, fd;
+	FILE *f;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	f = pcap_start();
+	bytes = make_tcp(ip, PEER_IP, KERNEL_IP, 40000, 8080, PEER_ISN, 0,
+			 FLAG_SYN, NULL, 0, 0);
+	pcap_add(f, 100, 0, ip, bytes);
+	bytes = make_tcp(ip, PEER_IP, KERNEL_IP, 40001, 8080, 7, 0,
+			 FLAG_SYN, NULL, 0, 0);
+	pcap_add(f, 100, 500, ip, bytes);	/* another connection */
+	bytes = make_tcp(ip, KERNEL_IP, PEER_IP, 8080, 40000, KERNEL_ISN,
+			 PEER_ISN + 1, FLAG_SYN | FLAG_ACK, NULL, 0, 0);
+	pcap_add(f, 100, 1000, ip, bytes);
+	bytes = make_tcp(ip, PEER_IP, KERNEL_IP, 40000, 8080, PEER_ISN + 1,
+			 KERNEL_ISN + 1, FLAG_ACK, NULL, 0, 10);
+	pcap_add(f, 100, 3000, ip, bytes);
+	fclose(f);
+
+	init_test(&config, &script);
+	assert(pcap_replay_append(&config, &script, &error) == STATUS_OK);
+	assert(script.num_events == 3);
+
+	event = nth_event(&script, 0);
+	packet = event->event.packet;
+	assert(event->type == PACKET_EVENT);
+	assert(event->time_type == RELATIVE_TIME);
+	assert(event->time_usecs == 0);
+	assert(event->line_number == 1);
+	assert(packet->direction == DIRECTION_INBOUND);
+	assert(packet->socket_script_fd == SOCKET_FD_NOT_DEFINED);
+	assert(packet->ipv4->src_ip.s_addr == 0);
+	assert(packet->ipv4->dst_ip.s_addr == 0);
+	assert(packet->tcp->src_port == 0 && packet->tcp->dst_port == 0);
+	assert(ntohl(packet->tcp->seq) == 0);
+
+	event = nth_event(&script, 1);
+	packet = event->event.packet;
+	assert(event->time_usecs == 1000);
+	assert(event->line_number == 3);
+	assert(packet->direction == DIRECTION_OUTBOUND);
+	assert(ntohl(packet->tcp->seq) == 0);
+	assert(ntohl(packet->tcp->ack_seq) == 1);
+
+	event = nth_event(&script, 2);
+	packet = event->event.packet;
+	assert(event->time_usecs == 2000);
+	assert(packet->direction == DIRECTION_INBOUND);
+	assert(ntohl(packet->tcp->seq) == 1);
+	assert(ntohl(packet->tcp->ack_seq) == 1);
+	assert(packet_payload_len(packet) == 10);
+	free_script(&script);
+
+	/* The kernel's ACKs are left out with --replay_outbound=skip,
+	 * but not its SYNs; and --replay_kernel_ip picks the sides.
+	 */
+	init_test(&config, &script);
+	config.replay_outbound = REPLAY_OUTBOUND_SKIP;
+	config.replay_kernel_ip = ipv4_parse("192.0.2.1");
+	assert(pcap_replay_append(&config, &script, &error) == STATUS_OK);
+	assert(script.num_events == 2);
+	assert(nth_event(&script, 0)->event.packet->direction ==
+	       DIRECTION_OUTBOUND);
+	assert(nth_event(&script, 1)->event.packet->direction ==
+	       DIRECTION_INBOUND);
+	free_script(&script);
+
+	/* The capture and the test must agree on the IP version. */
+	init_test(&config, &script);
+	config.wire_protocol = AF_INET6;
+	assert(pcap_replay_append(&config, &script, &error) == STATUS_ERR);
+	assert(strstr(error, "--ip_version") != NULL);
+	free(error);
+	error = NULL;
+	free_script(&script);
+}
+
+static void add_trace(struct packet_trace *trace, const u8 *ip, int bytes,
+		      enum direction_t direction, s64 usecs)
+{
+	struct packet_trace_info info;
+	struct packet *packet = packet_new(bytes);
+	char *error = NULL;
+
+	memcpy(packet->buffer, ip, bytes);
+	assert(parse_packet(packet, bytes, PACKET_LAYER_3_IP,
+			    &error) == PACKET_OK);
+	memset(&info, 0, sizeof(info));
+	info.type = "test";
+	info.direction = direction;
+	info.live_nsecs = usecs * 1000;
+	packet_trace_add(trace, &info, packet);
+	packet_free(packet);
+}
+
+/* An MPTCP connection the kernel opens, in a pcapng file with packet
+ * directions, as the flight recorder writes.
+ */
+static void test_pcapng_mptcp(void)
+{
+	const u64 kernel_key = 0x0123456789abcdefULL;
+	const u64 peer_key = 0xfedcba9876543210ULL;
+	struct packet_trace *trace = packet_trace_new(PACKET_TRACE_BYTES);
+	struct config config;
+	struct script script;
+	struct event *event = NULL;
+	struct tcp_option *option = NULL;
+	u64 kernel_idsn, peer_idsn;
+	u32 token, value;
+	u16 dll;
+	char *error = NULL;
+	u8 ip[100], options[20];
+	int bytes;
+
+	sha1_token_and_idsn(kernel_key, &token, &kernel_idsn);
+	sha1_token_and_idsn(peer_key, &token, &peer_idsn);
+
+	/* SYN and SYN/ACK with MP_CAPABLE keys. */
+	memset(options, 0, sizeof(options));
+	options[0] = TCPOPT_MPTCP;
+	options[1] = TCPOLEN_MP_CAPABLE_SYN;
+	memcpy(options + 4, &kernel_key, sizeof(kernel_key));
+	bytes = make_tcp(ip, KERNEL_IP, PEER_IP, 8080, 40000, KERNEL_ISN, 0,
+			 FLAG_SYN, options, 12, 0);
+	add_trace(trace, ip, bytes, DIRECTION_OUTBOUND, 1000);
+	memcpy(options + 4, &peer_key, sizeof(peer_key));
+	bytes = make_tcp(ip, PEER_IP, KERNEL_IP, 40000, 8080, PEER_ISN,
+			 KERNEL_ISN + 1, FLAG_SYN | FLAG_ACK, options, 12, 0);
+	add_trace(trace, ip, bytes, DIRECTION_INBOUND, 1100);
+
+	/* Data from the peer, with a DSS: data ACK 4, DSN 4 and checksum. */
+	memset(options, 0, sizeof(options));
+	options[0] = TCPOPT_MPTCP;
+	options[1] = TCPOLEN_DSS_DACK4_DSN4;
+	options[2] = DSS_SUBTYPE << 4;
+	options[3] = 0x05;			/* flags M and A */
+	value = htonl((u32)kernel_idsn + 1);
+	memcpy(options + 4, &value, sizeof(value));
+	value = htonl((u32)peer_idsn + 1);
+	memcpy(options + 8, &value, sizeof(value));
+	value = htonl(1);
+	memcpy(options + 12, &value, sizeof(value));
+	dll = htons(10);
+	memcpy(options + 16, &dll, sizeof(dll));
+	options[18] = 0x12;
+	options[19] = 0x34;
+	bytes = make_tcp(ip, PEER_IP, KERNEL_IP, 40000, 8080, PEER_ISN + 1,
+			 KERNEL_ISN + 1, FLAG_ACK, options, 20, 10);
+	add_trace(trace, ip, bytes, DIRECTION_INBOUND, 1300);
+
+	assert(packet_trace_write_pcapng(trace, path, &error) == STATUS_OK);
+	packet_trace_free(trace);
+
+	init_test(&config, &script);
+	config.replay_speed = 2.0;
+	assert(pcap_replay_append(&config, &script, &error) == STATUS_OK);
+	assert(script.num_events == 3);
+	assert(queue_size(&mp_state.vars_queue) == 2);
+
+	/* The kernel's SYN comes first, so the capture says who is who. */
+	event = nth_event(&script, 0);
+	assert(event->event.packet->direction == DIRECTION_OUTBOUND);
+	assert(event->time_type == ANY_TIME);
+	event = nth_event(&script, 1);
+	assert(event->event.packet->direction == DIRECTION_INBOUND);
+	assert(event->time_usecs == 50);
+	event = nth_event(&script, 2);
+	assert(event->time_usecs == 100);
+
+	/* DSS values are relative to the IDSNs, in host order. */
+	option = get_mptcp_option(event->event.packet, DSS_SUBTYPE);
+	assert(option != NULL);
+	memcpy(&value, (u8 *)option + 4, sizeof(value));
+	assert(value == 1);			/* data ACK */
+	memcpy(&value, (u8 *)option + 8, sizeof(value));
+	assert(value == 1);			/* DSN */
+	memcpy(&value, (u8 *)option + 12, sizeof(value));
+	assert(value == 1);			/* subflow sequence number */
+	memcpy(&dll, (u8 *)option + 16, sizeof(dll));
+	assert(dll == 10);
+	memcpy(&dll, (u8 *)option + 18, sizeof(dll));
+	assert(dll == 0xffff);			/* checksum to compute */
+	free_script(&script);
+	unlink(path);
+}
+
+static void test_bad_file(void)
+{
+	struct config config;
+	struct script script;
+	char *error = NULL;
+	FILE *f;
+
+	f = fopen(path, "w");
+	assert(f != NULL);
+	put(f, "not a capture", 13);
+	fclose(f);
+	init_test(&config, &script);
+	assert(pcap_replay_append(&config, &script, &error) == STATUS_ERR);
+	assert(strstr(error, "not a pcap or pcapng file") != NULL);
+	free(error);
+	free_script(&script);
+	unlink(path);
+}
+
+int main(void)
+{
+	test_pcap();
+	test_pcapng_mptcp();
+	test_bad_file();
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the peer event's receiver; see peer.h.
+ */
+
+#include "peer.h"
+
+#include <string.h>
+
+void peer_receiver_init(struct peer_receiver *receiver, u64 rcv_nxt,
+			int ack_every, s64 ack_delay_usecs)
+{
+	memset(receiver, 0, sizeof(*receiver));
+	receiver->rcv_nxt = rcv_nxt;
+	receiver->high_seq = rcv_nxt;
+	receiver->ack_every = ack_every;
+	receiver->ack_delay_usecs = ack_delay_usecs;
+}
+
+/* Remove the block at the given index. */
+static void remove_block(struct peer_receiver *receiver, int i)
+{
+	memmove(&receiver->blocks[i], &receiver->blocks[i + 1],
+		(receiver->num_blocks - i - 1) * sizeof(struct peer_block));
+	--receiver->num_blocks;
+}
+
+/* Add [start, end) to the out-of-order blocks, merging it with those
+ * it overlaps or touches, and put the result first.
+ */
+static void add_block(struct peer_receiver *receiver, u64 start, u64 end)
+{
+	int i = 0;
+
+	while (i < receiver->num_blocks) {
+		struct peer_block *block = &receiver->blocks[i];
+
+		if (block->end < start || block->start > end) {
+			++i;
+			continue;
+		}
+		start = min(start, block->start);
+		end = max(end, block->end);
+		remove_block(receiver, i);
+	}
+	if (receiver->num_blocks == PEER_MAX_BLOCKS)
+		--receiver->num_blocks;
+	memmove(&receiver->blocks[1], &receiver->blocks[0],
+		receiver->num_blocks * sizeof(struct peer_block));
+	receiver->blocks[0].start = start;
+	receiver->blocks[0].end = end;
+	++receiver->num_blocks;
+}
+
+/* Advance rcv_nxt over the blocks it now reaches, and return true if
+ * it reached any.
+ */
+static bool pull_blocks(struct peer_receiver *receiver)
+{
+	bool pulled = false;
+	int i = 0;
+
+	while (i < receiver->num_blocks) {
+		struct peer_block *block = &receiver->blocks[i];
+
+		if (block->start > receiver->rcv_nxt) {
+			++i;
+			continue;
+		}
+		receiver->rcv_nxt = max(receiver->rcv_nxt, block->end);
+		remove_block(receiver, i);
+		pulled = true;
+		i = 0;		/* the new rcv_nxt may reach earlier ones */
+	}
+	return pulled;
+}
+
+bool peer_receiver_segment(struct peer_receiver *receiver,
+			   u64 seq, u32 len, s64 now_usecs)
+{
+	u64 end = seq + len;
+
+	++receiver->segments;
+	if (seq < receiver->high_seq)
+		++receiver->retransmits;
+	receiver->high_seq = max(receiver->high_seq, end);
+
+	/* Old data: the sender missed our ACK, so say it again. */
+	if (end <= receiver->rcv_nxt)
+		return true;
+
+	/* A hole before it: hold on to it, and say what we miss. */
+	if (seq > receiver->rcv_nxt) {
+		add_block(receiver, seq, end);
+		return true;
+	}
+
+	receiver->rcv_nxt = end;
+	if (pull_blocks(receiver) || receiver->num_blocks > 0)
+		return true;	/* filled a hole, or part of one */
+	if (receiver->unacked++ == 0)
+		receiver->unacked_usecs = now_usecs;
+	return receiver->unacked >= receiver->ack_every;
+}
+
+s64 peer_receiver_ack_due(const struct peer_receiver *receiver)
+{
+	if (receiver->unacked == 0)
+		return 0;
+	return receiver->unacked_usecs + receiver->ack_delay_usecs;
+}
+
+void peer_receiver_acked(struct peer_receiver *receiver)
+{
+	receiver->unacked = 0;
+	receiver->unacked_usecs = 0;
+	++receiver->acks;
+}
+
+int peer_receiver_sack(const struct peer_receiver *receiver,
+		       struct peer_block *blocks, int max_blocks)
+{
+	int n = min(max_blocks, receiver->num_blocks);
+
+	memcpy(blocks, receiver->blocks, n * sizeof(struct peer_block));
+	return n;
+}
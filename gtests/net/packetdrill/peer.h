@@ -0,0 +1,95 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * The receive side of the reactive remote endpoint run by peer events
+ * (see struct peer_spec): what a receiver has of a sequence space,
+ * and when it would acknowledge it.
+ *
+ * A receiver follows RFC 1122 and RFC 5681 in the simple form most
+ * stacks do: it ACKs every ack_every in-order segments, or once the
+ * oldest unacknowledged one is ack_delay_usecs old, and at once for a
+ * segment that is out of order, fills a hole, or is old. It keeps the
+ * out-of-order ranges it holds, most recently changed first, to
+ * report as SACK blocks (RFC 2018).
+ *
+ * Sequence numbers are 64 bits wide, so the same receiver serves a
+ * TCP subflow, whose 32-bit numbers peer_unwrap_seq() widens, and the
+ * MPTCP data sequence space.
+ */
+
+#ifndef __PEER_H__
+#define __PEER_H__
+
+#include "types.h"
+
+/* Most out-of-order ranges a receiver keeps; beyond that the oldest
+ * are forgotten, to be retransmitted, much as a stack short of memory
+ * would prune its out-of-order queue.
+ */
+#define PEER_MAX_BLOCKS		4
+
+/* A range of sequence space [start, end). */
+struct peer_block {
+	u64 start;
+	u64 end;
+};
+
+struct peer_receiver {
+	u64 rcv_nxt;			/* next in-order sequence number */
+	struct peer_block blocks[PEER_MAX_BLOCKS];	/* out of order */
+	int num_blocks;
+	int ack_every;			/* ACK after this many segments */
+	s64 ack_delay_usecs;		/* or after this long */
+	int unacked;			/* in-order segments not ACKed */
+	s64 unacked_usecs;		/* when the first of them came */
+	u64 high_seq;			/* end of the highest segment seen */
+
+	/* Totals, for reports and checks. */
+	u64 segments;			/* segments taken */
+	u64 retransmits;		/* of them, below high_seq */
+	u64 acks;			/* ACKs sent */
+};
+
+/* Widen a 32-bit sequence number to the 64-bit one nearest rcv_nxt. */
+static inline u64 peer_unwrap_seq(u64 rcv_nxt, u32 seq)
+{
+	return rcv_nxt + (s64)(s32)(seq - (u32)rcv_nxt);
+}
+
+/* Start a receiver expecting rcv_nxt next. */
+extern void peer_receiver_init(struct peer_receiver *receiver, u64 rcv_nxt,
+			       int ack_every, s64 ack_delay_usecs);
+
+/* Take the segment [seq, seq + len) that arrived at now_usecs, and
+ * return true if it should be ACKed at once.
+ */
+extern bool peer_receiver_segment(struct peer_receiver *receiver,
+				  u64 seq, u32 len, s64 now_usecs);
+
+/* Return when a delayed ACK is due, or 0 if none is pending. */
+extern s64 peer_receiver_ack_due(const struct peer_receiver *receiver);
+
+/* Note that an ACK of everything in order was just sent. */
+extern void peer_receiver_acked(struct peer_receiver *receiver);
+
+/* Fill in up to max_blocks SACK blocks, most recent first, and return
+ * how many.
+ */
+extern int peer_receiver_sack(const struct peer_receiver *receiver,
+			      struct peer_block *blocks, int max_blocks);
+
+#endif /* __PEER_H__ */
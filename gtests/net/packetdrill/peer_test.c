@@ -0,0 +1,102 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for peer.c: when the peer event's receiver ACKs, and the
+ * SACK blocks it reports.
+ */
+
+#include "peer.h"
+
+#include <assert.h>
+
+static void test_delayed_ack(void)
+{
+	struct peer_receiver r;
+
+	peer_receiver_init(&r, 1000, 2, 40000);
+	assert(peer_receiver_ack_due(&r) == 0);
+
+	/* The first segment waits for a second one, or the timer. */
+	assert(!peer_receiver_segment(&r, 1000, 100, 5000));
+	assert(peer_receiver_ack_due(&r) == 45000);
+	assert(peer_receiver_segment(&r, 1100, 100, 6000));
+	assert(r.rcv_nxt == 1200);
+	peer_receiver_acked(&r);
+	assert(peer_receiver_ack_due(&r) == 0);
+	assert(r.acks == 1);
+
+	/* Old data is ACKed at once, and counts as a retransmit. */
+	assert(peer_receiver_segment(&r, 1100, 100, 7000));
+	assert(r.retransmits == 1);
+	assert(r.segments == 3);
+}
+
+static void test_sack(void)
+{
+	struct peer_receiver r;
+	struct peer_block blocks[3];
+
+	peer_receiver_init(&r, 0, 2, 40000);
+
+	/* Lose [0, 100): everything after it is out of order. */
+	assert(peer_receiver_segment(&r, 100, 100, 0));
+	assert(peer_receiver_segment(&r, 200, 100, 0));
+	assert(peer_receiver_segment(&r, 400, 100, 0));
+	assert(r.rcv_nxt == 0);
+	assert(peer_receiver_sack(&r, blocks, 3) == 2);
+	assert(blocks[0].start == 400 && blocks[0].end == 500);
+	assert(blocks[1].start == 100 && blocks[1].end == 300);
+
+	/* The retransmit fills the first hole, and is ACKed at once. */
+	assert(peer_receiver_segment(&r, 0, 100, 0));
+	assert(r.rcv_nxt == 300);
+	assert(r.retransmits == 1);
+	assert(peer_receiver_sack(&r, blocks, 3) == 1);
+	assert(blocks[0].start == 400);
+
+	/* Filling the last hole leaves nothing to SACK. */
+	assert(peer_receiver_segment(&r, 300, 100, 0));
+	assert(r.rcv_nxt == 500);
+	assert(peer_receiver_sack(&r, blocks, 3) == 0);
+
+	/* Only the PEER_MAX_BLOCKS newest ranges are kept. */
+	assert(peer_receiver_segment(&r, 600, 10, 0));
+	assert(peer_receiver_segment(&r, 700, 10, 0));
+	assert(peer_receiver_segment(&r, 800, 10, 0));
+	assert(peer_receiver_segment(&r, 900, 10, 0));
+	assert(peer_receiver_segment(&r, 1000, 10, 0));
+	assert(r.num_blocks == PEER_MAX_BLOCKS);
+	assert(peer_receiver_sack(&r, blocks, 3) == 3);
+	assert(blocks[0].start == 1000 && blocks[2].start == 800);
+}
+
+static void test_unwrap(void)
+{
+	u64 rcv_nxt = 0x1fffffff0ULL;
+
+	assert(peer_unwrap_seq(rcv_nxt, 0xfffffff0) == rcv_nxt);
+	assert(peer_unwrap_seq(rcv_nxt, 0x10) == 0x200000010ULL);
+	assert(peer_unwrap_seq(rcv_nxt, 0xffffff00) == 0x1ffffff00ULL);
+}
+
+int main(void)
+{
+	test_delayed_ack();
+	test_sack();
+	test_unwrap();
+	return 0;
+}
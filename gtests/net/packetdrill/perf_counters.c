@@ -0,0 +1,307 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of packetdrill's self-profiling counters; see
+ * perf_counters.h.
+ */
+
+#include "perf_counters.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+
+#ifdef linux
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+bool perf_counters_on;
+
+/* The counters of one thread, as a perf_event_open() group read all
+ * at once; slot[] says where in the group's read each counter is, or
+ * is -1 for one we could not open.
+ */
+struct perf_thread {
+	char *name;
+	int fd[PERF_NUM_COUNTERS];
+	int slot[PERF_NUM_COUNTERS];
+	int leader;			/* fd of the group leader, or -1 */
+	struct perf_thread *next;
+};
+
+static const char *phase_names[PERF_NUM_PHASES] = {
+	[PERF_INBOUND_PACKET_EVENT]	= "inbound packet events",
+	[PERF_OUTBOUND_PACKET_EVENT]	= "outbound packet events",
+	[PERF_SYSCALL_EVENT]		= "syscall events",
+	[PERF_COMMAND_EVENT]		= "command events",
+	[PERF_CODE_EVENT]		= "code events",
+	[PERF_OTHER_EVENT]		= "other events",
+	[PERF_MAP_INBOUND]		= "  map inbound",
+	[PERF_MPTCP_REWRITE]		= "  mptcp rewrite",
+	[PERF_CHECKSUM]			= "  checksum",
+	[PERF_VERIFY]			= "  verify",
+	[PERF_SNIFF]			= "  sniff",
+};
+
+/* Totals are added to from any thread, so with atomic adds. */
+static struct perf_totals phases[PERF_NUM_PHASES];
+
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct perf_thread *threads;
+static __thread struct perf_thread *self;
+
+static void read_thread(const struct perf_thread *thread,
+			struct perf_sample *sample)
+{
+	u64 buf[1 + PERF_NUM_COUNTERS];
+	int i;
+
+	memset(sample, 0, sizeof(*sample));
+	if (thread == NULL || thread->leader < 0 ||
+	    read(thread->leader, buf, sizeof(buf)) < (ssize_t)sizeof(u64))
+		return;
+	for (i = 0; i < PERF_NUM_COUNTERS; ++i) {
+		if (thread->slot[i] >= 0 && thread->slot[i] < buf[0])
+			sample->value[i] = buf[1 + thread->slot[i]];
+	}
+}
+
+#ifdef linux
+
+static int open_counter(struct perf_thread *thread, enum perf_counter_t i)
+{
+	static const struct {
+		u32 type;
+		u64 config;
+	} events[PERF_NUM_COUNTERS] = {
+		[PERF_CYCLES] = { PERF_TYPE_HARDWARE,
+				  PERF_COUNT_HW_CPU_CYCLES },
+		[PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE,
+					PERF_COUNT_HW_INSTRUCTIONS },
+		[PERF_CACHE_MISSES] = { PERF_TYPE_HARDWARE,
+					PERF_COUNT_HW_CACHE_MISSES },
+		[PERF_CONTEXT_SWITCHES] = { PERF_TYPE_SOFTWARE,
+					    PERF_COUNT_SW_CONTEXT_SWITCHES },
+	};
+	struct perf_event_attr attr;
+	int fd, slots = 0, j;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.exclude_hv = 1;
+
+	/* Count time in the kernel on our behalf too, if we may;
+	 * with perf_event_paranoid at 2 or more we may only count
+	 * our own user time.
+	 */
+	fd = syscall(__NR_perf_event_open, &attr, 0, -1, thread->leader, 0);
+	if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+		attr.exclude_kernel = 1;
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1,
+			     thread->leader, 0);
+	}
+	if (fd < 0)
+		return STATUS_ERR;
+
+	for (j = 0; j < PERF_NUM_COUNTERS; ++j) {
+		if (thread->slot[j] >= 0)
+			slots++;
+	}
+	if (thread->leader < 0)
+		thread->leader = fd;
+	thread->fd[i] = fd;
+	thread->slot[i] = slots;
+	return STATUS_OK;
+}
+
+/* Open what counters we can for the calling thread: the hardware ones
+ * in a group led by the cycle counter, and the context switch counter
+ * in it too, or on its own if there are no hardware counters.
+ */
+static struct perf_thread *open_thread(const char *name, char **error)
+{
+	struct perf_thread *thread = calloc(1, sizeof(*thread));
+	int i;
+
+	thread->name = strdup(name);
+	thread->leader = -1;
+	for (i = 0; i < PERF_NUM_COUNTERS; ++i) {
+		thread->fd[i] = -1;
+		thread->slot[i] = -1;
+	}
+	if (open_counter(thread, PERF_CYCLES) == STATUS_OK) {
+		open_counter(thread, PERF_INSTRUCTIONS);
+		open_counter(thread, PERF_CACHE_MISSES);
+	}
+	if (open_counter(thread, PERF_CONTEXT_SWITCHES) != STATUS_OK &&
+	    thread->leader < 0) {
+		asprintf(error, "perf_event_open: %s", strerror(errno));
+		free(thread->name);
+		free(thread);
+		return NULL;
+	}
+	return thread;
+}
+
+#else  /* !linux */
+
+static struct perf_thread *open_thread(const char *name, char **error)
+{
+	asprintf(error, "perf counters are only supported on Linux");
+	return NULL;
+}
+
+#endif  /* linux */
+
+static int start_thread(const char *name, char **error)
+{
+	struct perf_thread *thread = open_thread(name, error);
+
+	if (thread == NULL)
+		return STATUS_ERR;
+	pthread_mutex_lock(&threads_lock);
+	thread->next = threads;
+	threads = thread;
+	pthread_mutex_unlock(&threads_lock);
+	self = thread;
+	return STATUS_OK;
+}
+
+int perf_counters_enable(const char *thread_name, char **error)
+{
+	memset(phases, 0, sizeof(phases));
+	if (start_thread(thread_name, error))
+		return STATUS_ERR;
+	perf_counters_on = true;
+	return STATUS_OK;
+}
+
+void perf_counters_thread_start(const char *thread_name)
+{
+	char *error = NULL;
+
+	if (!perf_counters_on)
+		return;
+	if (start_thread(thread_name, &error)) {
+		DEBUGP("not counting %s: %s\n", thread_name, error);
+		free(error);
+	}
+}
+
+void perf_counters_disable(void)
+{
+	struct perf_thread *thread, *next;
+	int i;
+
+	perf_counters_on = false;
+	pthread_mutex_lock(&threads_lock);
+	for (thread = threads; thread != NULL; thread = next) {
+		next = thread->next;
+		for (i = 0; i < PERF_NUM_COUNTERS; ++i) {
+			if (thread->fd[i] >= 0)
+				close(thread->fd[i]);
+		}
+		free(thread->name);
+		free(thread);
+	}
+	threads = NULL;
+	pthread_mutex_unlock(&threads_lock);
+	self = NULL;
+}
+
+void perf_counters_read(struct perf_sample *sample)
+{
+	read_thread(self, sample);
+}
+
+void perf_counters_add(enum perf_phase_t phase,
+		       const struct perf_sample *start)
+{
+	struct perf_totals *totals = &phases[phase];
+	struct perf_sample end;
+	int i;
+
+	perf_counters_read(&end);
+	__atomic_fetch_add(&totals->count, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < PERF_NUM_COUNTERS; ++i) {
+		__atomic_fetch_add(&totals->value[i],
+				   end.value[i] - start->value[i],
+				   __ATOMIC_RELAXED);
+	}
+}
+
+void perf_counters_phase_totals(enum perf_phase_t phase,
+				struct perf_totals *totals)
+{
+	int i;
+
+	totals->count = __atomic_load_n(&phases[phase].count,
+					__ATOMIC_RELAXED);
+	for (i = 0; i < PERF_NUM_COUNTERS; ++i) {
+		totals->value[i] = __atomic_load_n(&phases[phase].value[i],
+						   __ATOMIC_RELAXED);
+	}
+}
+
+/* Print one line of the report; threads have no count of runs. */
+static void print_counts(FILE *f, const char *name, u64 count,
+			 const u64 *value)
+{
+	double ipc = value[PERF_CYCLES] > 0 ?
+		(double)value[PERF_INSTRUCTIONS] / value[PERF_CYCLES] : 0;
+
+	char runs[32] = "-";
+
+	if (count > 0)
+		snprintf(runs, sizeof(runs), "%llu", (unsigned long long)count);
+	fprintf(f, "  %-24s %8s %14llu %14llu %5.2f %12llu %10llu\n",
+		name, runs, (unsigned long long)value[PERF_CYCLES],
+		(unsigned long long)value[PERF_INSTRUCTIONS], ipc,
+		(unsigned long long)value[PERF_CACHE_MISSES],
+		(unsigned long long)value[PERF_CONTEXT_SWITCHES]);
+}
+
+void perf_counters_report(FILE *f)
+{
+	struct perf_thread *thread;
+	struct perf_sample sample;
+	struct perf_totals totals;
+	int phase;
+
+	fprintf(f, "perf counters:\n  %-24s %8s %14s %14s %5s %12s %10s\n",
+		"", "count", "cycles", "instructions", "ipc",
+		"cache-misses", "ctx-sw");
+	pthread_mutex_lock(&threads_lock);
+	for (thread = threads; thread != NULL; thread = thread->next) {
+		read_thread(thread, &sample);
+		print_counts(f, thread->name, 0, sample.value);
+	}
+	pthread_mutex_unlock(&threads_lock);
+	for (phase = 0; phase < PERF_NUM_PHASES; ++phase) {
+		perf_counters_phase_totals(phase, &totals);
+		if (totals.count > 0)
+			print_counts(f, phase_names[phase], totals.count,
+				     totals.value);
+	}
+}
@@ -0,0 +1,128 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Hardware counters (cycles, instructions, cache misses) and context
+ * switches for packetdrill's own threads, opened with perf_event_open()
+ * for --perf_counters, so we can see where the interpreter spends its
+ * time between the kernel's packet and our check of it without a
+ * separate perf session disturbing the test's timing.
+ *
+ * Each thread that calls perf_counters_thread_start() gets a counter
+ * group of its own, counting only while it runs. The interpreter
+ * brackets each event and each costly step of handling a packet with
+ * perf_phase_begin() and perf_phase_end(), which add what the counters
+ * moved by to that phase's totals. Steps nest inside the events they
+ * are part of, and some inside each other (the MPTCP rewrite happens
+ * while mapping a packet), so a phase's totals include those of the
+ * phases inside it.
+ *
+ * Where the machine has no hardware counters we can use, as in many
+ * VMs, we count context switches alone. With --perf_counters off, a
+ * phase costs a test of one global.
+ */
+
+#ifndef __PERF_COUNTERS_H__
+#define __PERF_COUNTERS_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+enum perf_counter_t {
+	PERF_CYCLES = 0,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_CONTEXT_SWITCHES,
+	PERF_NUM_COUNTERS,		/* must be last */
+};
+
+/* The events and steps we total the counters over. */
+enum perf_phase_t {
+	PERF_INBOUND_PACKET_EVENT = 0,
+	PERF_OUTBOUND_PACKET_EVENT,
+	PERF_SYSCALL_EVENT,
+	PERF_COMMAND_EVENT,
+	PERF_CODE_EVENT,
+	PERF_OTHER_EVENT,
+	PERF_MAP_INBOUND,		/* map_inbound_packet() */
+	PERF_MPTCP_REWRITE,		/* MPTCP option rewriting */
+	PERF_CHECKSUM,			/* checksumming injected packets */
+	PERF_VERIFY,			/* checking a sniffed packet */
+	PERF_SNIFF,			/* waiting for and reading one */
+	PERF_NUM_PHASES,		/* must be last */
+};
+
+/* A reading of the calling thread's counters. */
+struct perf_sample {
+	u64 value[PERF_NUM_COUNTERS];
+};
+
+/* What the counters moved by over all the runs of one phase. */
+struct perf_totals {
+	u64 count;			/* how many times the phase ran */
+	u64 value[PERF_NUM_COUNTERS];
+};
+
+/* Is counting on? Only perf_counters_enable() and
+ * perf_counters_disable() change this.
+ */
+extern bool perf_counters_on;
+
+/* Zero the totals, open counters for the calling thread, named as
+ * given in the report, and start counting phases. Returns STATUS_OK on
+ * success; on failure returns STATUS_ERR and sets error message.
+ */
+extern int perf_counters_enable(const char *thread_name, char **error);
+
+/* If counting is on, open counters for the calling thread too. A thread
+ * we cannot count is left out of the report.
+ */
+extern void perf_counters_thread_start(const char *thread_name);
+
+/* Stop counting, and close the counters of every thread. */
+extern void perf_counters_disable(void);
+
+/* Read the calling thread's counters; ones it lacks read 0. */
+extern void perf_counters_read(struct perf_sample *sample);
+
+/* Add what the calling thread's counters moved by since 'start' to the
+ * totals of the given phase.
+ */
+extern void perf_counters_add(enum perf_phase_t phase,
+			      const struct perf_sample *start);
+
+/* Fill in the totals of the given phase so far. */
+extern void perf_counters_phase_totals(enum perf_phase_t phase,
+				       struct perf_totals *totals);
+
+/* Print per-thread and per-phase counts. */
+extern void perf_counters_report(FILE *f);
+
+static inline void perf_phase_begin(struct perf_sample *start)
+{
+	if (perf_counters_on)
+		perf_counters_read(start);
+}
+
+static inline void perf_phase_end(enum perf_phase_t phase,
+				  const struct perf_sample *start)
+{
+	if (perf_counters_on)
+		perf_counters_add(phase, start);
+}
+
+#endif /* __PERF_COUNTERS_H__ */
@@ -0,0 +1,102 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for perf_counters.c: phases add up what the counters moved
+ * by, and do nothing with counting off.
+ */
+
+#include "perf_counters.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static volatile u64 sink;
+
+static void busy(int loops)
+{
+	int i;
+
+	for (i = 0; i < loops; ++i)
+		sink += i;
+}
+
+static void test_off(void)
+{
+	struct perf_sample start;
+	struct perf_totals totals;
+
+	perf_phase_begin(&start);
+	perf_phase_end(PERF_VERIFY, &start);
+	perf_counters_phase_totals(PERF_VERIFY, &totals);
+	assert(totals.count == 0);
+}
+
+static void test_on(void)
+{
+	struct timespec pause = { .tv_sec = 0, .tv_nsec = 1000000 };
+	struct perf_sample start;
+	struct perf_totals small, big, sleep;
+	char *error = NULL;
+	int i;
+
+	if (perf_counters_enable("test thread", &error)) {
+		fprintf(stderr, "skipping: %s\n", error);
+		free(error);
+		return;
+	}
+
+	perf_phase_begin(&start);
+	busy(1000);
+	perf_phase_end(PERF_CHECKSUM, &start);
+	for (i = 0; i < 2; ++i) {
+		perf_phase_begin(&start);
+		busy(1000000);
+		perf_phase_end(PERF_MAP_INBOUND, &start);
+	}
+	perf_phase_begin(&start);
+	nanosleep(&pause, NULL);
+	perf_phase_end(PERF_SNIFF, &start);
+
+	perf_counters_phase_totals(PERF_CHECKSUM, &small);
+	perf_counters_phase_totals(PERF_MAP_INBOUND, &big);
+	perf_counters_phase_totals(PERF_SNIFF, &sleep);
+	assert(small.count == 1);
+	assert(big.count == 2);
+	assert(sleep.count == 1);
+	/* Counters we could not open read 0, so check only ones that
+	 * moved.
+	 */
+	if (big.value[PERF_INSTRUCTIONS] > 0)
+		assert(big.value[PERF_INSTRUCTIONS] >
+		       small.value[PERF_INSTRUCTIONS]);
+	assert(sleep.value[PERF_CONTEXT_SWITCHES] >= 1 ||
+	       big.value[PERF_INSTRUCTIONS] > 0);
+
+	perf_counters_report(stdout);
+	perf_counters_disable();
+	assert(!perf_counters_on);
+}
+
+int main(void)
+{
+	test_off();
+	test_on();
+	test_off();
+	return 0;
+}
@@ -0,0 +1,434 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of worker placement; see placement.h.
+ */
+
+#include "placement.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "logging.h"
+
+#ifdef linux
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "cpu_affinity.h"
+#endif
+
+/* The period we give cpu.max quotas in, in microseconds. */
+#define CGROUP_CPU_PERIOD_USECS	100000
+
+int parse_cgroup_limits(const char *arg, double *cpus, u64 *memory_bytes,
+			char **error)
+{
+	char *copy = strdup(arg), *token, *save = NULL, *end;
+	int result = STATUS_OK;
+
+	*cpus = 0;
+	*memory_bytes = 0;
+	for (token = strtok_r(copy, ",", &save); token != NULL;
+	     token = strtok_r(NULL, ",", &save)) {
+		if (strncmp(token, "cpu=", 4) == 0) {
+			*cpus = strtod(token + 4, &end);
+			if (end == token + 4 || *end || !(*cpus > 0)) {
+				asprintf(error, "bad CPU limit '%s'", token);
+				result = STATUS_ERR;
+				break;
+			}
+		} else if (strncmp(token, "memory=", 7) == 0) {
+			errno = 0;
+			*memory_bytes = strtoull(token + 7, &end, 10);
+			if (*end == 'K' || *end == 'M' || *end == 'G') {
+				*memory_bytes <<= *end == 'K' ? 10 :
+					*end == 'M' ? 20 : 30;
+				end++;
+			}
+			if (end == token + 7 || *end || errno ||
+			    *memory_bytes == 0) {
+				asprintf(error, "bad memory limit '%s'",
+					 token);
+				result = STATUS_ERR;
+				break;
+			}
+		} else {
+			asprintf(error, "unknown limit '%s'", token);
+			result = STATUS_ERR;
+			break;
+		}
+	}
+	free(copy);
+	return result;
+}
+
+bool placement_wanted(const struct config *config)
+{
+	return config->numa_spread || config->avoid_irq_device != NULL ||
+		config->worker_cgroup != NULL;
+}
+
+#ifdef linux
+
+/* Most NUMA nodes we spread workers over. */
+#define PLACEMENT_MAX_NODES	64
+
+/* Where one worker slot runs. */
+struct placement_slot {
+	cpu_set_t cpus;			/* CPUs it may run on */
+	int node;			/* NUMA node for its memory, or -1 */
+	char *cgroup;			/* its cgroup directory, or NULL */
+};
+
+struct placement {
+	struct placement_slot *slots;
+	int num_slots;
+};
+
+/* Read the first line of the given file, without its newline, into a
+ * buffer of the given size. Returns STATUS_ERR if it cannot be read.
+ */
+static int read_line(const char *path, char *line, size_t size)
+{
+	FILE *f = fopen(path, "r");
+	bool ok;
+
+	if (f == NULL)
+		return STATUS_ERR;
+	ok = fgets(line, size, f) != NULL;
+	fclose(f);
+	if (!ok)
+		return STATUS_ERR;
+	line[strcspn(line, "\n")] = '\0';
+	return STATUS_OK;
+}
+
+static int write_file(const char *dir, const char *name, const char *value,
+		      char **error)
+{
+	char *path = NULL;
+	int fd, result = STATUS_OK;
+
+	asprintf(&path, "%s/%s", dir, name);
+	fd = open(path, O_WRONLY);
+	if (fd < 0 || write(fd, value, strlen(value)) < 0) {
+		asprintf(error, "cannot write '%s' to %s: %s", value, path,
+			 strerror(errno));
+		result = STATUS_ERR;
+	}
+	if (fd >= 0)
+		close(fd);
+	free(path);
+	return result;
+}
+
+/* Add the CPUs the given IRQ is delivered to. */
+static void add_irq_affinity(int irq, cpu_set_t *cpus)
+{
+	char path[64], list[4096];
+	cpu_set_t irq_cpus;
+	char *error = NULL;
+
+	/* The CPUs it actually goes to, if the kernel says, rather than
+	 * the ones it may go to.
+	 */
+	snprintf(path, sizeof(path), "/proc/irq/%d/effective_affinity_list",
+		 irq);
+	if (read_line(path, list, sizeof(list)) || list[0] == '\0') {
+		snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list",
+			 irq);
+		if (read_line(path, list, sizeof(list)))
+			return;
+	}
+	if (cpu_list_parse(list, &irq_cpus, &error)) {
+		DEBUGP("IRQ %d affinity: %s\n", irq, error);
+		free(error);
+		return;
+	}
+	CPU_OR(cpus, cpus, &irq_cpus);
+}
+
+/* Find the CPUs servicing the device's IRQs: its MSI vectors if it has
+ * them, or else the lines of /proc/interrupts that name it.
+ */
+static int find_irq_cpus(const char *device, cpu_set_t *cpus, char **error)
+{
+	char path[256], *line = NULL;
+	struct dirent *entry;
+	size_t size = 0;
+	int num_irqs = 0, irq;
+	FILE *f;
+	DIR *dir;
+
+	CPU_ZERO(cpus);
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs",
+		 device);
+	dir = opendir(path);
+	while (dir != NULL && (entry = readdir(dir)) != NULL) {
+		if (!isdigit((unsigned char)entry->d_name[0]))
+			continue;
+		add_irq_affinity(atoi(entry->d_name), cpus);
+		num_irqs++;
+	}
+	if (dir != NULL)
+		closedir(dir);
+
+	f = num_irqs == 0 ? fopen("/proc/interrupts", "r") : NULL;
+	while (f != NULL && getline(&line, &size, f) > 0) {
+		if (sscanf(line, " %d:", &irq) == 1 &&
+		    strstr(line, device) != NULL) {
+			add_irq_affinity(irq, cpus);
+			num_irqs++;
+		}
+	}
+	if (f != NULL)
+		fclose(f);
+	free(line);
+
+	if (num_irqs == 0) {
+		asprintf(error, "found no interrupts of device %s", device);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* Find the NUMA nodes with CPUs among the given ones, and their CPUs
+ * among those. Nodes with memory but no CPUs are no use to a worker.
+ */
+static int find_nodes(const cpu_set_t *allowed, int *nodes,
+		      cpu_set_t *node_cpus, int *num_nodes, char **error)
+{
+	char path[64], list[4096];
+	char *list_error = NULL;
+	int node;
+
+	*num_nodes = 0;
+	for (node = 0; node < PLACEMENT_MAX_NODES; node++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d/cpulist", node);
+		if (read_line(path, list, sizeof(list)) || list[0] == '\0')
+			continue;
+		if (cpu_list_parse(list, &node_cpus[*num_nodes],
+				   &list_error)) {
+			asprintf(error, "%s: %s", path, list_error);
+			free(list_error);
+			return STATUS_ERR;
+		}
+		CPU_AND(&node_cpus[*num_nodes], &node_cpus[*num_nodes],
+			allowed);
+		if (CPU_COUNT(&node_cpus[*num_nodes]) == 0)
+			continue;
+		nodes[(*num_nodes)++] = node;
+	}
+	if (*num_nodes == 0) {
+		asprintf(error, "found no NUMA nodes with CPUs we may use");
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* Make the cgroup of the given slot, named for our pid so that runs
+ * sharing the parent cgroup do not collide, and set its limits.
+ */
+static int make_cgroup(const struct config *config, int slot,
+		       char **cgroup, char **error)
+{
+	char value[64];
+
+	asprintf(cgroup, "%s/packetdrill-%d-%d", config->worker_cgroup,
+		 getpid(), slot);
+	if (mkdir(*cgroup, 0755) < 0) {
+		asprintf(error, "cannot make cgroup %s: %s", *cgroup,
+			 strerror(errno));
+		free(*cgroup);
+		*cgroup = NULL;
+		return STATUS_ERR;
+	}
+	if (config->worker_cgroup_cpus > 0) {
+		snprintf(value, sizeof(value), "%lld %d",
+			 (long long)(config->worker_cgroup_cpus *
+				     CGROUP_CPU_PERIOD_USECS),
+			 CGROUP_CPU_PERIOD_USECS);
+		if (write_file(*cgroup, "cpu.max", value, error))
+			return STATUS_ERR;
+	}
+	if (config->worker_cgroup_memory_bytes > 0) {
+		snprintf(value, sizeof(value), "%llu",
+			 config->worker_cgroup_memory_bytes);
+		if (write_file(*cgroup, "memory.max", value, error))
+			return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+struct placement *placement_new(const struct config *config,
+				int num_slots, char **error)
+{
+	struct placement *placement = calloc(1, sizeof(*placement));
+	cpu_set_t allowed, irq_cpus, node_cpus[PLACEMENT_MAX_NODES];
+	int nodes[PLACEMENT_MAX_NODES], num_nodes = 0, i;
+
+	placement->slots = calloc(num_slots, sizeof(placement->slots[0]));
+	placement->num_slots = num_slots;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+		die_perror("sched_getaffinity");
+	if (config->avoid_irq_device != NULL) {
+		if (find_irq_cpus(config->avoid_irq_device, &irq_cpus, error))
+			goto error_out;
+		for (i = 0; i < CPU_SETSIZE; i++) {
+			if (CPU_ISSET(i, &irq_cpus))
+				CPU_CLR(i, &allowed);
+		}
+		if (CPU_COUNT(&allowed) == 0) {
+			asprintf(error, "every CPU we may use services "
+				 "interrupts of %s", config->avoid_irq_device);
+			goto error_out;
+		}
+	}
+	if (config->numa_spread &&
+	    find_nodes(&allowed, nodes, node_cpus, &num_nodes, error))
+		goto error_out;
+
+	for (i = 0; i < num_slots; i++) {
+		struct placement_slot *slot = &placement->slots[i];
+
+		slot->cpus = allowed;
+		slot->node = -1;
+		if (num_nodes > 0) {
+			slot->cpus = node_cpus[i % num_nodes];
+			slot->node = nodes[i % num_nodes];
+		}
+		if (config->worker_cgroup != NULL &&
+		    make_cgroup(config, i, &slot->cgroup, error))
+			goto error_out;
+	}
+	return placement;
+
+error_out:
+	placement_free(placement);
+	return NULL;
+}
+
+void placement_free(struct placement *placement)
+{
+	int i;
+
+	for (i = 0; i < placement->num_slots; i++) {
+		char *cgroup = placement->slots[i].cgroup;
+
+		if (cgroup != NULL && rmdir(cgroup) < 0)
+			fprintf(stderr, "cannot remove cgroup %s: %s\n",
+				cgroup, strerror(errno));
+		free(cgroup);
+	}
+	free(placement->slots);
+	free(placement);
+}
+
+int placement_enter(const struct placement *placement, int slot,
+		    char **error)
+{
+	const struct placement_slot *s = &placement->slots[slot];
+
+	/* Writing 0 moves the writer. */
+	if (s->cgroup != NULL &&
+	    write_file(s->cgroup, "cgroup.procs", "0", error))
+		return STATUS_ERR;
+	if (sched_setaffinity(0, sizeof(s->cpus), &s->cpus) < 0) {
+		asprintf(error, "sched_setaffinity: %s", strerror(errno));
+		return STATUS_ERR;
+	}
+	if (s->node >= 0) {
+		unsigned long nodemask = 1UL << s->node;
+
+		/* The kernel reads one bit fewer than maxnode says. */
+		if (syscall(SYS_set_mempolicy, MPOL_BIND, &nodemask,
+			    8 * sizeof(nodemask) + 1) < 0) {
+			asprintf(error, "set_mempolicy: %s", strerror(errno));
+			return STATUS_ERR;
+		}
+	}
+	return STATUS_OK;
+}
+
+void placement_enter_process(const struct config *config)
+{
+	struct placement *placement;
+	char *error = NULL;
+	int status;
+	pid_t pid;
+
+	placement = placement_new(config, 1, &error);
+	if (placement == NULL)
+		die("placement: %s\n", error);
+
+	/* Don't let the child inherit and re-print our buffered output. */
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid < 0)
+		die_perror("fork");
+	if (pid == 0) {
+		if (placement_enter(placement, 0, &error))
+			die("placement: %s\n", error);
+		return;
+	}
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			die_perror("waitpid");
+	}
+	placement_free(placement);
+	exit(WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE);
+}
+
+#else  /* !linux */
+
+struct placement *placement_new(const struct config *config,
+				int num_slots, char **error)
+{
+	asprintf(error, "worker placement is only supported on Linux");
+	return NULL;
+}
+
+void placement_free(struct placement *placement)
+{
+}
+
+int placement_enter(const struct placement *placement, int slot,
+		    char **error)
+{
+	asprintf(error, "worker placement is only supported on Linux");
+	return STATUS_ERR;
+}
+
+void placement_enter_process(const struct config *config)
+{
+	die("placement: worker placement is only supported on Linux\n");
+}
+
+#endif  /* linux */
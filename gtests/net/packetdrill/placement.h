@@ -0,0 +1,80 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Where --jobs workers run on a host shared by many of them, and where
+ * a --stress or --concurrent run, which is one worker, runs:
+ *
+ * --numa_spread puts worker slot i on the CPUs of the i-th NUMA node
+ * (round robin over the nodes with CPUs), with its memory bound to
+ * that node, so its timing does not depend on which socket it lands
+ * on, and its packets never cross the interconnect.
+ *
+ * --avoid_irq_cpus=<device> keeps workers off the CPUs that service
+ * the interrupts of the given network device.
+ *
+ * --worker_cgroup=<dir> runs each worker slot in a cgroup v2 cgroup of
+ * its own, made under <dir> and removed when we are done, with the CPU
+ * and memory limits of --worker_cgroup_limits=cpu=<CPUs>,memory=<bytes>.
+ * The cpu and memory controllers must be enabled in <dir>'s
+ * cgroup.subtree_control.
+ *
+ * Placement is only supported on Linux.
+ */
+
+#ifndef __PLACEMENT_H__
+#define __PLACEMENT_H__
+
+#include "types.h"
+
+struct config;
+struct placement;
+
+/* Parse --worker_cgroup_limits, e.g. "cpu=1.5,memory=512M", into a CPU
+ * limit in CPUs and a memory limit in bytes; limits not given are 0.
+ * Memory takes a K, M or G suffix. Returns STATUS_OK on success; on
+ * failure returns STATUS_ERR and sets error message.
+ */
+extern int parse_cgroup_limits(const char *arg, double *cpus,
+			       u64 *memory_bytes, char **error);
+
+/* Return true if the config asks for any placement. */
+extern bool placement_wanted(const struct config *config);
+
+/* Work out where each of num_slots workers goes, and make their
+ * cgroups. Returns NULL and sets error message on failure.
+ */
+extern struct placement *placement_new(const struct config *config,
+				       int num_slots, char **error);
+
+/* Remove the cgroups, which must be empty by now, and free. */
+extern void placement_free(struct placement *placement);
+
+/* Move the calling process, before it starts any threads, into the
+ * given slot: its cgroup, its CPUs and its memory node. Returns
+ * STATUS_OK on success; on failure returns STATUS_ERR and sets error
+ * message.
+ */
+extern int placement_enter(const struct placement *placement, int slot,
+			   char **error);
+
+/* Place the rest of this run as a single worker: fork, and return in
+ * the child, placed in slot 0. The parent waits for the child, removes
+ * its cgroup and exits with its exit status.
+ */
+extern void placement_enter_process(const struct config *config);
+
+#endif /* __PLACEMENT_H__ */
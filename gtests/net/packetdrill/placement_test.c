@@ -0,0 +1,120 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for placement.c: parsing cgroup limits, and placing
+ * workers on the CPUs of their NUMA nodes.
+ */
+
+#include "placement.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "config.h"
+
+static void test_parse(void)
+{
+	char *error = NULL;
+	u64 memory_bytes;
+	double cpus;
+
+	assert(parse_cgroup_limits("cpu=1.5,memory=512M", &cpus,
+				   &memory_bytes, &error) == STATUS_OK);
+	assert(cpus == 1.5);
+	assert(memory_bytes == 512ULL << 20);
+	assert(parse_cgroup_limits("memory=4096", &cpus, &memory_bytes,
+				   &error) == STATUS_OK);
+	assert(cpus == 0);
+	assert(memory_bytes == 4096);
+
+	assert(parse_cgroup_limits("cpu=0", &cpus, &memory_bytes,
+				   &error) == STATUS_ERR);
+	free(error);
+	assert(parse_cgroup_limits("memory=1T", &cpus, &memory_bytes,
+				   &error) == STATUS_ERR);
+	free(error);
+	assert(parse_cgroup_limits("io=1", &cpus, &memory_bytes,
+				   &error) == STATUS_ERR);
+	free(error);
+}
+
+/* Each slot's worker runs only on CPUs of one node, and slots take the
+ * nodes in turn.
+ */
+static void test_numa_spread(void)
+{
+	struct config config;
+	struct placement *placement;
+	cpu_set_t allowed, cpus[2];
+	char *error = NULL;
+	int slot, status;
+	pid_t pid;
+
+	if (access("/sys/devices/system/node/node0", F_OK) != 0)
+		return;		/* no NUMA support in this kernel */
+
+	set_default_config(&config);
+	config.numa_spread = true;
+	assert(placement_wanted(&config));
+	placement = placement_new(&config, 2, &error);
+	assert(placement != NULL);
+
+	assert(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+	for (slot = 0; slot < 2; slot++) {
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			/* Containers may forbid binding memory, but the
+			 * CPUs are set first.
+			 */
+			placement_enter(placement, slot, &error);
+			assert(sched_getaffinity(0, sizeof(cpus[0]),
+						 &cpus[0]) == 0);
+			CPU_AND(&cpus[1], &cpus[0], &allowed);
+			assert(CPU_EQUAL(&cpus[0], &cpus[1]));
+			assert(CPU_COUNT(&cpus[0]) > 0);
+			_exit(0);
+		}
+		assert(waitpid(pid, &status, 0) == pid);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	placement_free(placement);
+}
+
+static void test_bad_cgroup(void)
+{
+	struct config config;
+	char *error = NULL;
+
+	set_default_config(&config);
+	assert(!placement_wanted(&config));
+	config.worker_cgroup = "/nonexistent/packetdrill";
+	assert(placement_new(&config, 1, &error) == NULL);
+	assert(strstr(error, "cannot make cgroup") != NULL);
+	free(error);
+}
+
+int main(void)
+{
+	test_parse();
+	test_numa_spread();
+	test_bad_cgroup();
+	return 0;
+}
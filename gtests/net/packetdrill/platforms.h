@@ -35,6 +35,25 @@
 #define HAVE_FMEMOPEN           1
 #define TUN_PATH                "/dev/net/tun"
 #define HAVE_TCP_INFO           1
+#define HAVE_ZLIB               1
+
+#if defined(__has_include)
+#if __has_include(<linux/if_xdp.h>)
+#define HAVE_AF_XDP             1
+#endif
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING           1
+#endif
+#if __has_include(<linux/bpf.h>)
+#define HAVE_BPF                1       /* see bpf_insn.h */
+#endif
+#if __has_include(<sys/sdt.h>)
+#define HAVE_USDT               1       /* static probes; see probes.h */
+#endif
+#if __has_include(<linux/kcov.h>)
+#define HAVE_KCOV               1       /* kernel coverage; see kcov.h */
+#endif
+#endif
 
 #endif  /* linux */
 
@@ -52,6 +71,9 @@
 #if (__FreeBSD_version < 1000000 && __FreeBSD_version > 902000) || __FreeBSD_version > 1000028
 #define HAVE_FMEMOPEN           1
 #endif
+#if __FreeBSD_version >= 800000
+#define HAVE_BPF_ZBUF           1       /* zero-copy BPF buffers */
+#endif
 
 #include "open_memstream.h"
 #include "fmemopen.h"
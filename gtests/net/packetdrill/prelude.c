@@ -0,0 +1,239 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the --init_scripts prelude; see prelude.h.
+ */
+
+#include "prelude.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "logging.h"
+
+/* Is the "#!" line one for a Bourne-style shell, which would run the
+ * builtin commands just as we do?
+ */
+static bool is_shell_interpreter(char *line)
+{
+	char *interpreter = strtok(line + 2, " \t");
+	const char *name;
+
+	if (interpreter != NULL && strcmp(interpreter, "/usr/bin/env") == 0)
+		interpreter = strtok(NULL, " \t");
+	if (interpreter == NULL)
+		return false;
+	name = strrchr(interpreter, '/');
+	name = (name != NULL) ? name + 1 : interpreter;
+	return strcmp(name, "sh") == 0 || strcmp(name, "bash") == 0 ||
+	       strcmp(name, "dash") == 0;
+}
+
+/* Strip leading and trailing whitespace, in place. */
+static char *strip(char *line)
+{
+	char *end;
+
+	line += strspn(line, " \t");
+	end = line + strlen(line);
+	while (end > line && strchr(" \t\r\n", end[-1]) != NULL)
+		*--end = '\0';
+	return line;
+}
+
+static void add_builtin(struct prelude_step *step,
+			const struct builtin_command *builtin)
+{
+	step->builtins = realloc(step->builtins, (step->num_builtins + 1) *
+				 sizeof(step->builtins[0]));
+	step->builtins[step->num_builtins++] = *builtin;
+}
+
+static void free_builtins(struct prelude_step *step)
+{
+	int i;
+
+	for (i = 0; i < step->num_builtins; ++i)
+		builtin_command_free(&step->builtins[i]);
+	free(step->builtins);
+	step->builtins = NULL;
+	step->num_builtins = 0;
+}
+
+/* Try to parse the script the command names into builtin commands.
+ * Only an executable file named with a path, so that the shell would
+ * run that very file, and whose every line is a builtin command,
+ * "set -e", a comment or blank, qualifies.
+ */
+static bool parse_script_file(struct prelude_step *step)
+{
+	struct stat st;
+	char *line = NULL;
+	size_t line_bytes = 0;
+	bool ok = true;
+	int line_number = 0;
+	FILE *f;
+
+	if (strchr(step->command, '/') == NULL ||
+	    strpbrk(step->command, " \t") != NULL ||
+	    stat(step->command, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    access(step->command, X_OK) != 0)
+		return false;
+	f = fopen(step->command, "r");
+	if (f == NULL)
+		return false;
+
+	while (ok && getline(&line, &line_bytes, f) != -1) {
+		struct builtin_command builtin;
+		char *text = strip(line);
+
+		++line_number;
+		if (line_number == 1 && strncmp(text, "#!", 2) == 0) {
+			ok = is_shell_interpreter(text);
+			continue;
+		}
+		if (text[0] == '#' || text[0] == '\0')
+			continue;
+		if (strcmp(text, "set -e") == 0) {
+			step->stop_on_error = true;
+			continue;
+		}
+		if (parse_builtin_command(text, &builtin) == BUILTIN_NONE) {
+			builtin_command_free(&builtin);
+			ok = false;
+			continue;
+		}
+		add_builtin(step, &builtin);
+	}
+	free(line);
+	fclose(f);
+
+	if (!ok) {
+		free_builtins(step);
+		step->stop_on_error = false;
+	}
+	return ok;
+}
+
+static void parse_step(struct prelude_step *step, const char *command)
+{
+	struct builtin_command builtin;
+
+	memset(step, 0, sizeof(*step));
+	step->command = strdup(command);
+
+	if (parse_builtin_command(command, &builtin) != BUILTIN_NONE) {
+		add_builtin(step, &builtin);
+		step->stop_on_error = true;
+		return;
+	}
+	builtin_command_free(&builtin);
+
+	if (!parse_script_file(step))
+		step->shell = true;
+}
+
+struct prelude *prelude_parse(const char *init_scripts)
+{
+	struct prelude *prelude = calloc(1, sizeof(struct prelude));
+	char *scripts = strdup(init_scripts);
+	char *command = scripts, *comma;
+
+	prelude->init_scripts = strdup(init_scripts);
+	while (*command != '\0') {
+		comma = strchr(command, ',');
+		if (comma != NULL)
+			*comma = '\0';
+		prelude->steps = realloc(prelude->steps,
+					 (prelude->num_steps + 1) *
+					 sizeof(prelude->steps[0]));
+		parse_step(&prelude->steps[prelude->num_steps++], command);
+		if (comma == NULL)
+			break;
+		command = comma + 1;
+	}
+	free(scripts);
+	return prelude;
+}
+
+void prelude_free(struct prelude *prelude)
+{
+	int i;
+
+	for (i = 0; i < prelude->num_steps; ++i) {
+		free_builtins(&prelude->steps[i]);
+		free(prelude->steps[i].command);
+	}
+	free(prelude->steps);
+	free(prelude->init_scripts);
+	free(prelude);
+}
+
+const struct prelude *prelude_get(const char *init_scripts)
+{
+	static struct prelude *last;
+
+	if (last != NULL && strcmp(last->init_scripts, init_scripts) == 0)
+		return last;
+	if (last != NULL)
+		prelude_free(last);
+	last = prelude_parse(init_scripts);
+	return last;
+}
+
+/* Run the builtin commands of a step. Like the shell, carry on past a
+ * failing command, after reporting it, unless the script said "set -e";
+ * the step's status is that of its last command.
+ */
+static int run_builtins(const struct prelude_step *step, char **error)
+{
+	int i;
+
+	for (i = 0; i < step->num_builtins; ++i) {
+		if (run_builtin_command(&step->builtins[i], error) == STATUS_OK)
+			continue;
+		if (step->stop_on_error || i == step->num_builtins - 1)
+			return STATUS_ERR;
+		fprintf(stderr, "%s: %s\n", step->command, *error);
+		free(*error);
+		*error = NULL;
+	}
+	return STATUS_OK;
+}
+
+int prelude_run(const struct prelude *prelude,
+		const char **failed, char **error)
+{
+	int i;
+
+	for (i = 0; i < prelude->num_steps; ++i) {
+		const struct prelude_step *step = &prelude->steps[i];
+		int result;
+
+		if (step->shell)
+			result = safe_system(step->command, error);
+		else
+			result = run_builtins(step, error);
+		if (result != STATUS_OK) {
+			*failed = step->command;
+			return STATUS_ERR;
+		}
+	}
+	return STATUS_OK;
+}
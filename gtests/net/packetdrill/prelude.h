@@ -0,0 +1,72 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * The --init_scripts prelude, parsed once and kept for every script we
+ * run.
+ *
+ * Each --init_scripts entry is a shell command, often the path of a
+ * shell script full of sysctl settings shared by a whole suite. Rather
+ * than fork a shell for each entry before every test, we parse the
+ * list once into a prelude: an entry that is itself a builtin command
+ * (see system.h), or names a shell script whose every line is one, is
+ * kept as the parsed builtin commands and carried out without a shell;
+ * anything else is kept as a shell command. A prelude is never changed
+ * once parsed, so the daemon and the parallel runner parse it before
+ * forking and every child runs the same copy.
+ */
+
+#ifndef __PRELUDE_H__
+#define __PRELUDE_H__
+
+#include "types.h"
+
+#include "system.h"
+
+/* One --init_scripts entry. */
+struct prelude_step {
+	char *command;			/* the entry, as given */
+	bool shell;			/* run command with safe_system() */
+	bool stop_on_error;		/* script had "set -e" */
+	struct builtin_command *builtins;	/* else, run these in order */
+	int num_builtins;
+};
+
+struct prelude {
+	char *init_scripts;		/* the --init_scripts value parsed */
+	struct prelude_step *steps;
+	int num_steps;
+};
+
+/* Parse the comma-separated --init_scripts value into a new prelude. */
+extern struct prelude *prelude_parse(const char *init_scripts);
+
+/* Free a prelude from prelude_parse(). */
+extern void prelude_free(struct prelude *prelude);
+
+/* Return the prelude for the given --init_scripts value, parsing it
+ * only if it differs from the value of the last call.
+ */
+extern const struct prelude *prelude_get(const char *init_scripts);
+
+/* Run each step of the prelude in turn, as the shell would run the
+ * entries. On success, returns STATUS_OK. On error returns STATUS_ERR,
+ * sets *failed to the failing entry and fills in *error.
+ */
+extern int prelude_run(const struct prelude *prelude,
+		       const char **failed, char **error);
+
+#endif /* __PRELUDE_H__ */
@@ -0,0 +1,126 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for prelude.c: which --init_scripts entries we carry out
+ * without a shell.
+ */
+
+#include "prelude.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Write a temporary script with the given text and mode; return its
+ * malloc-ed path.
+ */
+static char *write_script(const char *text, mode_t mode)
+{
+	char *path = strdup("/tmp/prelude_test.XXXXXX");
+	int fd = mkstemp(path);
+
+	assert(fd >= 0);
+	assert(write(fd, text, strlen(text)) == strlen(text));
+	assert(fchmod(fd, mode) == 0);
+	close(fd);
+	return path;
+}
+
+static void test_parse(void)
+{
+	char *sysctls = write_script(
+		"#!/bin/sh\n"
+		"# shared MPTCP settings\n"
+		"set -e\n"
+		"\n"
+		"sysctl -q net.mptcp.enabled=1\n"
+		"  ip mptcp endpoint flush\n", 0755);
+	char *loop = write_script(
+		"#!/bin/sh\n"
+		"for i in 1 2; do sysctl -q a.b=$i; done\n", 0755);
+	char *python = write_script(
+		"#!/usr/bin/python3\n"
+		"sysctl -q net.mptcp.enabled=1\n", 0755);
+	char *unexecutable = write_script(
+		"sysctl -q net.mptcp.enabled=1\n", 0644);
+	char *init_scripts = NULL;
+	struct prelude *prelude;
+
+	assert(asprintf(&init_scripts,
+			"sysctl -q net.ipv4.tcp_timestamps=1,%s,%s,%s,%s,echo hi",
+			sysctls, loop, python, unexecutable) > 0);
+	prelude = prelude_parse(init_scripts);
+	assert(prelude->num_steps == 6);
+
+	assert(!prelude->steps[0].shell);
+	assert(prelude->steps[0].num_builtins == 1);
+	assert(prelude->steps[0].builtins[0].type == BUILTIN_SYSCTL);
+
+	assert(!prelude->steps[1].shell);
+	assert(prelude->steps[1].stop_on_error);
+	assert(prelude->steps[1].num_builtins == 2);
+	assert(prelude->steps[1].builtins[0].type == BUILTIN_SYSCTL);
+	assert(strcmp(prelude->steps[1].builtins[0].sysctls[0].key,
+		      "net.mptcp.enabled") == 0);
+	assert(prelude->steps[1].builtins[1].type ==
+	       BUILTIN_FLUSH_MPTCP_ENDPOINTS);
+
+	assert(prelude->steps[2].shell);
+	assert(prelude->steps[2].num_builtins == 0);
+	assert(prelude->steps[3].shell);
+	assert(prelude->steps[4].shell);
+	assert(prelude->steps[5].shell);
+	assert(strcmp(prelude->steps[5].command, "echo hi") == 0);
+
+	/* The same value gives back the same prelude. */
+	assert(prelude_get(init_scripts) == prelude_get(init_scripts));
+	assert(prelude_get("true") != NULL);
+
+	prelude_free(prelude);
+	unlink(sysctls);
+	unlink(loop);
+	unlink(python);
+	unlink(unexecutable);
+	free(sysctls);
+	free(loop);
+	free(python);
+	free(unexecutable);
+	free(init_scripts);
+}
+
+static void test_run(void)
+{
+	struct prelude *prelude = prelude_parse("true,false,echo not reached");
+	const char *failed = NULL;
+	char *error = NULL;
+
+	assert(prelude_run(prelude, &failed, &error) == STATUS_ERR);
+	assert(strcmp(failed, "false") == 0);
+	assert(error != NULL);
+	free(error);
+	prelude_free(prelude);
+}
+
+int main(void)
+{
+	test_parse();
+	test_run();
+	return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of xoshiro256** by David Blackman and Sebastiano
+ * Vigna, seeded by expanding a 64-bit seed with splitmix64 as they
+ * recommend.
+ */
+
+#include "prng.h"
+
+#include <time.h>
+#include <unistd.h>
+
+static u64 splitmix64(u64 *x)
+{
+	u64 z = (*x += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static inline u64 rotl(u64 x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+void prng_seed(struct prng *prng, u64 seed)
+{
+	int i;
+
+	/* splitmix64 never returns four zeros in a row. */
+	for (i = 0; i < 4; i++)
+		prng->s[i] = splitmix64(&seed);
+}
+
+u64 prng_entropy_seed(void)
+{
+	static u64 calls;
+	struct timespec ts;
+	u64 x;
+
+	if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
+		ts.tv_sec = time(NULL);
+		ts.tv_nsec = 0;
+	}
+	x = ((u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec) ^
+	    ((u64)getpid() << 32) ^ __atomic_add_fetch(&calls, 1,
+						       __ATOMIC_RELAXED);
+	return splitmix64(&x);
+}
+
+u64 prng_next_u64(struct prng *prng)
+{
+	u64 *s = prng->s;
+	u64 result = rotl(s[1] * 5, 7) * 9;
+	u64 t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+u32 prng_below(struct prng *prng, u32 bound)
+{
+	/* Lemire's multiply-and-reject, which is unbiased. */
+	u64 m = (u64)prng_next_u32(prng) * bound;
+	u32 low = m;
+
+	if (low < bound) {
+		u32 threshold = -bound % bound;
+
+		while (low < threshold) {
+			m = (u64)prng_next_u32(prng) * bound;
+			low = m;
+		}
+	}
+	return m >> 32;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for a small, fast pseudo-random number generator
+ * (xoshiro256**). Each test run owns one, seeded either from --seed,
+ * so that a run can be reproduced exactly, or from the clock and our
+ * process ID, so that parallel runs draw different numbers.
+ */
+
+#ifndef __PRNG_H__
+#define __PRNG_H__
+
+#include "types.h"
+
+struct prng {
+	u64 s[4];		/* generator state; never all zero */
+};
+
+/* Seed the generator, so that it returns the same sequence for the
+ * same seed.
+ */
+extern void prng_seed(struct prng *prng, u64 seed);
+
+/* Return a seed that differs from one process and call to the next. */
+extern u64 prng_entropy_seed(void);
+
+/* Return the next 64 random bits. */
+extern u64 prng_next_u64(struct prng *prng);
+
+/* Return the next 32 random bits. */
+static inline u32 prng_next_u32(struct prng *prng)
+{
+	return prng_next_u64(prng) >> 32;
+}
+
+/* Return a random number in [0, bound), for 0 < bound. */
+extern u32 prng_below(struct prng *prng, u32 bound);
+
+#endif /* __PRNG_H__ */
@@ -0,0 +1,69 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for prng.c: a seed always gives the same sequence, which
+ * matches a separate implementation of splitmix64 and xoshiro256**,
+ * and prng_below() stays within its bound.
+ */
+
+#include "prng.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+static void test_sequence(void)
+{
+	const u64 expected[] = {
+		0xbe6a36374160d49bULL,
+		0x214aaa0637a688c6ULL,
+		0xf69d16de9954d388ULL,
+	};
+	struct prng prng;
+	int i;
+
+	prng_seed(&prng, 12345);
+	for (i = 0; i < ARRAY_SIZE(expected); ++i)
+		assert(prng_next_u64(&prng) == expected[i]);
+
+	prng_seed(&prng, 12345);
+	assert(prng_next_u32(&prng) == expected[0] >> 32);
+}
+
+static void test_below(void)
+{
+	const u32 bounds[] = { 1, 2, 3, 1000, 16384, 0x80000001U };
+	struct prng prng;
+	int i, j;
+
+	prng_seed(&prng, 0);
+	for (i = 0; i < ARRAY_SIZE(bounds); ++i)
+		for (j = 0; j < 10000; ++j)
+			assert(prng_below(&prng, bounds[i]) < bounds[i]);
+}
+
+static void test_entropy_seed(void)
+{
+	assert(prng_entropy_seed() != prng_entropy_seed());
+}
+
+int main(void)
+{
+	test_sequence();
+	test_below();
+	test_entropy_seed();
+	return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * User-space static probes (USDT) on the interpreter's hot paths, so
+ * bpftrace or perf can line up packetdrill's timing with kernel
+ * tracepoints, say when looking into a timing failure on a production
+ * kernel, without rebuilding or slowing down packetdrill.
+ *
+ * The probes are those of <sys/sdt.h> (from systemtap-sdt-dev or
+ * systemtap-sdt-devel), each a single nop until a tracer attaches. If
+ * the header is missing at build time, the probes compile to nothing.
+ * All are under the provider "packetdrill":
+ *
+ *   event_start(line, type, script_usecs)	an event is about to run
+ *   event_end(line, type)			and has finished
+ *   packet_send(ip_header, ip_bytes)		injecting a packet
+ *   packet_sniff(status, ip_header, ip_bytes, time_nsecs)
+ *						netdev_receive() returned
+ *   packet_verify(line, status)		checked a sniffed packet
+ *   syscall_begin(line, name)			calling a system call
+ *   syscall_end(line, name, result, errno)	it returned
+ *   mptcp_rewrite_begin(direction)		rewriting MPTCP options
+ *   mptcp_rewrite_end(direction, status)
+ *
+ * Types are enum event_t values, directions enum direction_t values,
+ * statuses STATUS_OK or STATUS_ERR, and time_nsecs the sniffed packet's
+ * time stamp on the --clock. For example, to see when the kernel's
+ * tcp_retransmit_skb ran relative to each failed check:
+ *
+ *   bpftrace -e 'kprobe:tcp_retransmit_skb { printf("%lld rtx\n", nsecs); }
+ *       usdt:./packetdrill:packetdrill:packet_verify /arg1 != 0/
+ *       { printf("%lld line %d failed\n", nsecs, arg0); }'
+ */
+
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#include "types.h"
+
+#ifdef HAVE_USDT
+
+#include <sys/sdt.h>
+
+#define PROBE0(name)		DTRACE_PROBE(packetdrill, name)
+#define PROBE1(name, a)		DTRACE_PROBE1(packetdrill, name, a)
+#define PROBE2(name, a, b)	DTRACE_PROBE2(packetdrill, name, a, b)
+#define PROBE3(name, a, b, c)	DTRACE_PROBE3(packetdrill, name, a, b, c)
+#define PROBE4(name, a, b, c, d) \
+	DTRACE_PROBE4(packetdrill, name, a, b, c, d)
+
+#else  /* !HAVE_USDT */
+
+/* Still use the arguments, unevaluated, so that variables kept only
+ * for a probe do not draw warnings.
+ */
+#define PROBE0(name)		do {} while (0)
+#define PROBE1(name, a)		do { (void)sizeof(a); } while (0)
+#define PROBE2(name, a, b)	do { PROBE1(name, a); PROBE1(name, b); } \
+				while (0)
+#define PROBE3(name, a, b, c)	do { PROBE2(name, a, b); PROBE1(name, c); } \
+				while (0)
+#define PROBE4(name, a, b, c, d) \
+	do { PROBE2(name, a, b); PROBE2(name, c, d); } while (0)
+
+#endif  /* HAVE_USDT */
+
+#endif /* __PROBES_H__ */
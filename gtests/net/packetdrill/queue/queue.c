@@ -6,129 +6,291 @@
  */
 
 #include "queue.h"
+#include "../alloc_stats.h"
 
-void queue_init(queue_t *queue)
+#include <stdint.h>
+#include <string.h>
+
+/* A ring buffer of 2^n slots. head and tail run freely and are masked
+ * on use; the ring is empty when they are equal and full when they
+ * are a whole ring apart. Once the producer links a next segment it
+ * never writes this one again, so the consumer can free it as soon as
+ * it has drained it.
+ */
+struct queue_segment {
+	struct queue_segment *next;	/* newer segment, or NULL */
+	u32 mask;			/* number of slots - 1 */
+	u32 head;			/* next slot to dequeue; consumer's */
+	u32 tail;			/* next slot to enqueue; producer's */
+	u64 slots[];
+};
+
+/* Strings are copied into chunks of this many bytes, or one chunk of
+ * their own if they are longer.
+ */
+#define QUEUE_STRINGS_CHUNK_BYTES 4096
+
+struct queue_strings {
+	struct queue_strings *next;	/* older chunk, or NULL */
+	size_t used;			/* bytes used in data */
+	size_t size;			/* bytes allocated in data */
+	char data[];
+};
+
+static struct queue_segment *queue_segment_new(u32 num_slots)
 {
-	queue->r = 0;
-	queue->f = 0;
+	struct queue_segment *segment;
+
+	segment = tagged_calloc(ALLOC_QUEUE, 1,
+				sizeof(*segment) + num_slots * sizeof(u64));
+	if (segment == NULL)
+		return NULL;
+	segment->mask = num_slots - 1;
+	return segment;
 }
 
-void queue_free(queue_t *queue)
+/* Return the consumer's segment holding the front element, freeing the
+ * segments it has drained on the way, or NULL if the queue is empty.
+ */
+static struct queue_segment *queue_front_segment(queue_t *queue)
 {
-	void *el;
-	while(!queue_is_empty(queue)){
-		queue_dequeue(queue, &el);
-		free(el);
+	struct queue_segment *segment, *next;
+
+	segment = __atomic_load_n(&queue->front, __ATOMIC_ACQUIRE);
+	while (segment != NULL) {
+		if (segment->head !=
+		    __atomic_load_n(&segment->tail, __ATOMIC_ACQUIRE))
+			return segment;
+		next = __atomic_load_n(&segment->next, __ATOMIC_ACQUIRE);
+		if (next == NULL)
+			return NULL;
+		/* The producer may have filled the segment just before
+		 * moving on to the next one.
+		 */
+		if (segment->head !=
+		    __atomic_load_n(&segment->tail, __ATOMIC_ACQUIRE))
+			return segment;
+		__atomic_store_n(&queue->front, next, __ATOMIC_RELEASE);
+		tagged_free(segment);
+		segment = next;
 	}
+	return NULL;
 }
 
-unsigned queue_size(queue_t *queue)
+static int queue_push(queue_t *queue, u64 element)
 {
-	return (QUEUE_SIZE-queue->f+queue->r)%QUEUE_SIZE;
-}
+	struct queue_segment *segment = queue->rear, *next;
+	u32 tail;
 
-unsigned queue_is_empty(queue_t *queue)
-{
-	return queue->f == queue->r;
-}
+	if (segment == NULL) {
+		segment = queue_segment_new(QUEUE_INITIAL_SIZE);
+		if (segment == NULL)
+			return STATUS_ERR;
+		queue->rear = segment;
+		__atomic_store_n(&queue->front, segment, __ATOMIC_RELEASE);
+	}
 
-int queue_front(queue_t *queue, void **element)
-{
-	if(queue_is_empty(queue)){
-		return STATUS_ERR;
+	tail = segment->tail;
+	if (tail - __atomic_load_n(&segment->head, __ATOMIC_ACQUIRE) >
+	    segment->mask) {
+		/* Full: continue in a new segment twice as big. */
+		next = queue_segment_new(2 * (segment->mask + 1));
+		if (next == NULL)
+			return STATUS_ERR;
+		next->slots[0] = element;
+		next->tail = 1;
+		queue->rear = next;
+		__atomic_store_n(&segment->next, next, __ATOMIC_RELEASE);
+		return STATUS_OK;
 	}
-	*element = queue->elements[queue->f];
+
+	segment->slots[tail & segment->mask] = element;
+	__atomic_store_n(&segment->tail, tail + 1, __ATOMIC_RELEASE);
 	return STATUS_OK;
 }
 
-int queue_rear(queue_t *queue, void **element){
-	if(queue_is_empty(queue)){
+static int queue_peek(queue_t *queue, u64 *element)
+{
+	struct queue_segment *segment = queue_front_segment(queue);
+
+	if (segment == NULL)
 		return STATUS_ERR;
-	}
-	if(queue->r != 0){
-		*element = queue->elements[queue->r-1];
-	}
-	else{
-		*element = queue->elements[QUEUE_SIZE];
-	}
+	*element = segment->slots[segment->head & segment->mask];
 	return STATUS_OK;
 }
 
-int queue_dequeue(queue_t *queue, void **element){
-	if(queue_is_empty(queue)){
+static int queue_pop(queue_t *queue, u64 *element)
+{
+	struct queue_segment *segment = queue_front_segment(queue);
+	u32 head;
+
+	if (segment == NULL)
 		return STATUS_ERR;
-	}
-	void *temp = queue->elements[queue->f];
-	queue->elements[queue->f] = NULL;
-	queue->f = (queue->f+1%QUEUE_SIZE);
-	*element = temp;
+	head = segment->head;
+	*element = segment->slots[head & segment->mask];
+	__atomic_store_n(&segment->head, head + 1, __ATOMIC_RELEASE);
 	return STATUS_OK;
 }
 
-int queue_enqueue(queue_t *queue, void *element){
-	if(queue_size(queue) == QUEUE_SIZE-1){
+static int queue_last(queue_t *queue, u64 *element)
+{
+	struct queue_segment *segment = queue->rear;
+
+	/* A non-empty queue always has its newest element in rear. */
+	if (segment == NULL ||
+	    segment->tail == __atomic_load_n(&segment->head, __ATOMIC_ACQUIRE))
 		return STATUS_ERR;
-	}
-	queue->elements[queue->r] = element;
-	queue->r = (queue->r+1)%QUEUE_SIZE;
+	*element = segment->slots[(segment->tail - 1) & segment->mask];
 	return STATUS_OK;
 }
 
-void queue_init_val(queue_t_val *queue){
-	queue->r = 0;
-	queue->f = 0;
+void queue_init(queue_t *queue)
+{
+	queue->front = NULL;
+	queue->rear = NULL;
+	queue->strings = NULL;
 }
 
-void queue_free_val(queue_t_val *queue){
-	u64 el;
-	while(!queue_is_empty_val(queue)){
-		queue_dequeue_val(queue, &el);
+void queue_free(queue_t *queue)
+{
+	struct queue_segment *segment = queue->front, *next_segment;
+	struct queue_strings *strings = queue->strings, *next_strings;
+
+	while (segment != NULL) {
+		next_segment = segment->next;
+		tagged_free(segment);
+		segment = next_segment;
+	}
+	while (strings != NULL) {
+		next_strings = strings->next;
+		tagged_free(strings);
+		strings = next_strings;
 	}
+	queue_init(queue);
 }
 
-unsigned queue_size_val(queue_t_val *queue){
-	return (QUEUE_SIZE-queue->f+queue->r)%QUEUE_SIZE;
+unsigned queue_size(queue_t *queue)
+{
+	struct queue_segment *segment;
+	unsigned size = 0;
+
+	for (segment = queue->front; segment != NULL; segment = segment->next)
+		size += segment->tail - segment->head;
+	return size;
 }
 
-unsigned queue_is_empty_val(queue_t_val *queue){
-	return queue->f == queue->r;
+unsigned queue_is_empty(queue_t *queue)
+{
+	return queue_front_segment(queue) == NULL;
 }
 
-int queue_front_val(queue_t_val *queue, u64 *element){
-	if(queue_is_empty_val(queue)){
+int queue_front(queue_t *queue, void **element)
+{
+	u64 val;
+
+	if (queue_peek(queue, &val))
 		return STATUS_ERR;
-	}
-	*element = queue->elements[queue->f];
+	*element = (void *)(uintptr_t)val;
 	return STATUS_OK;
 }
 
-int queue_rear_val(queue_t_val *queue, u64 *element){
-	if(queue_is_empty_val(queue)){
+int queue_rear(queue_t *queue, void **element)
+{
+	u64 val;
+
+	if (queue_last(queue, &val))
 		return STATUS_ERR;
-	}
-	if(queue->r != 0){
-		*element = queue->elements[queue->r-1];
-	}
-	else{
-		*element = queue->elements[QUEUE_SIZE];
-	}
+	*element = (void *)(uintptr_t)val;
 	return STATUS_OK;
 }
 
-int queue_enqueue_val(queue_t_val *queue, u64 element){
-	if(queue_size_val(queue) == QUEUE_SIZE-1){
+int queue_dequeue(queue_t *queue, void **element)
+{
+	u64 val;
+
+	if (queue_pop(queue, &val))
 		return STATUS_ERR;
-	}
-	queue->elements[queue->r] = element;
-	queue->r = (queue->r+1)%QUEUE_SIZE;
+	*element = (void *)(uintptr_t)val;
 	return STATUS_OK;
 }
 
-int queue_dequeue_val(queue_t_val *queue, u64 *element){
-	if(queue_is_empty_val(queue)){
-		return STATUS_ERR;
+int queue_enqueue(queue_t *queue, void *element)
+{
+	return queue_push(queue, (uintptr_t)element);
+}
+
+int queue_enqueue_string(queue_t *queue, const char *string)
+{
+	struct queue_strings *strings = queue->strings;
+	size_t len = strlen(string) + 1;
+	char *copy;
+
+	if (strings == NULL || strings->size - strings->used < len) {
+		size_t size = len > QUEUE_STRINGS_CHUNK_BYTES ?
+			len : QUEUE_STRINGS_CHUNK_BYTES;
+
+		strings = tagged_malloc(ALLOC_QUEUE, sizeof(*strings) + size);
+		if (strings == NULL)
+			return STATUS_ERR;
+		strings->next = queue->strings;
+		strings->used = 0;
+		strings->size = size;
+		queue->strings = strings;
 	}
-	*element = queue->elements[queue->f];
-	queue->f = (queue->f+1%QUEUE_SIZE);
-	return STATUS_OK;
+
+	copy = strings->data + strings->used;
+	memcpy(copy, string, len);
+	strings->used += len;
+	return queue_enqueue(queue, copy);
+}
+
+bool queue_owns_string(queue_t *queue, const void *element)
+{
+	struct queue_strings *strings;
+	const char *p = element;
+
+	for (strings = queue->strings; strings != NULL; strings = strings->next)
+		if (p >= strings->data && p < strings->data + strings->used)
+			return true;
+	return false;
+}
+
+void queue_init_val(queue_t_val *queue)
+{
+	queue_init(queue);
+}
+
+void queue_free_val(queue_t_val *queue)
+{
+	queue_free(queue);
+}
+
+unsigned queue_size_val(queue_t_val *queue)
+{
+	return queue_size(queue);
+}
+
+unsigned queue_is_empty_val(queue_t_val *queue)
+{
+	return queue_is_empty(queue);
+}
+
+int queue_front_val(queue_t_val *queue, u64 *element)
+{
+	return queue_peek(queue, element);
+}
+
+int queue_rear_val(queue_t_val *queue, u64 *element)
+{
+	return queue_last(queue, element);
+}
+
+int queue_enqueue_val(queue_t_val *queue, u64 element)
+{
+	return queue_push(queue, element);
+}
+
+int queue_dequeue_val(queue_t_val *queue, u64 *element)
+{
+	return queue_pop(queue, element);
 }
@@ -1,10 +1,26 @@
 /*
- * Queue implementation based on circular array.
+ * Queue implementation based on growable circular arrays.
  *
  * queue.h
  *
  *  Created on: 28 juil. 2013
  *      Author: Arnaud Schils
+ *
+ * A queue is a chain of power-of-two ring buffers ("segments"). When
+ * the newest segment is full, enqueue starts a new one twice as big,
+ * and once dequeue has emptied an older segment it frees it. So a
+ * queue has no size limit, and one that is kept drained settles into
+ * reusing a single ring buffer.
+ *
+ * A queue is safe for one producer thread (enqueue, rear) and one
+ * consumer thread (dequeue, front) at a time, without locks: each end
+ * only writes its own index, and the producer publishes slots and new
+ * segments with release stores that the consumer reads with acquire
+ * loads. Init, size and free are for when only one thread uses it.
+ *
+ * A queue of pointers can also keep strings for its elements in pooled
+ * storage (see queue_enqueue_string()), so that queuing a name takes
+ * no malloc of its own.
  */
 
 #ifndef __QUEUE_H__
@@ -14,7 +30,6 @@
 #include <stdio.h>
 #include "../types.h"
 
-#define QUEUE_SIZE 255
 #define STATUS_OK 0
 #define STATUS_ERR -1
 
@@ -22,15 +37,26 @@
 #define NULL 0
 #endif
 
+/* Slots in the first segment of a queue; a power of two. */
+#define QUEUE_INITIAL_SIZE 16
+
+struct queue_segment;
+struct queue_strings;
+
 struct queue_s{
-	void *elements[QUEUE_SIZE];
-	unsigned r, f;
+	struct queue_segment *front;	/* oldest segment; consumer's */
+	struct queue_segment *rear;	/* newest segment; producer's */
+	struct queue_strings *strings;	/* pooled strings; producer's */
 };
 
 typedef struct queue_s queue_t;
 
 void queue_init(queue_t *queue);
 
+/* Empty the queue and release its storage, including any pooled
+ * strings; the queue's elements themselves are not freed. The queue
+ * can be used again afterwards.
+ */
 void queue_free(queue_t *queue);
 
 unsigned queue_size(queue_t *queue);
@@ -43,15 +69,20 @@ int queue_rear(queue_t *queue, void **element);
 
 int queue_dequeue(queue_t *queue, void **element);
 
+/* Returns STATUS_ERR only if we are out of memory. */
 int queue_enqueue(queue_t *queue, void *element);
 
+/* Enqueue a copy of the given string, kept in storage pooled by the
+ * queue until queue_free(); callers must not free dequeued copies.
+ */
+int queue_enqueue_string(queue_t *queue, const char *string);
+
+/* Is the element one of the strings the queue has pooled? */
+bool queue_owns_string(queue_t *queue, const void *element);
 
-struct queue_s_val{
-	u64 elements[QUEUE_SIZE];
-	unsigned r, f;
-};
 
-typedef struct queue_s_val queue_t_val;
+/* Queues of values share the same implementation. */
+typedef struct queue_s queue_t_val;
 
 void queue_init_val(queue_t_val *queue);
 
@@ -0,0 +1,314 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the queue sampler; see queue_stats.h.
+ */
+
+#include "queue_stats.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpu_affinity.h"
+#include "logging.h"
+#include "netlink.h"
+#include "run.h"
+
+struct queue_sampler {
+	pthread_t thread;
+	pthread_mutex_t mutex;		/* for everything below */
+	pthread_cond_t wake;		/* signaled to stop the thread */
+	bool stop;			/* should the thread exit? */
+	int ifindex;
+	s64 interval_usecs;
+	char qdisc_kind[16];		/* as of the last sample */
+	u32 txqlen;			/* as of the last sample */
+
+	/* A ring of the last QUEUE_SAMPLER_MAX_SAMPLES samples. */
+	struct queue_sample *samples;
+	int first;			/* index of the oldest sample */
+	int num_samples;
+};
+
+#ifdef linux
+
+/* The tun device counts a packet as transmitted when we read it, and
+ * as dropped when its ring is full, so what the root qdisc has handed
+ * it and it has not yet counted either way is still in the ring. The
+ * counters are 32-bit in the qdisc and wrap, and restart if a script
+ * replaces the qdisc, so a difference that makes no sense reads as 0.
+ */
+static u32 tun_ring_packets(const struct netlink_queue_stats *stats)
+{
+	u32 backlog = stats->qdisc_sent_packets -
+		(u32)(stats->tx_packets + stats->tx_dropped);
+
+	if (stats->qdisc_kind[0] == '\0' || backlog > (1U << 30))
+		return 0;
+	return backlog;
+}
+
+static int take_sample(struct queue_sampler *sampler,
+		       struct netlink_queue_stats *stats,
+		       struct queue_sample *sample, char **error)
+{
+	if (netlink_get_queue_stats(sampler->ifindex, stats, error))
+		return STATUS_ERR;
+	sample->time_usecs	= now_usecs();
+	sample->qdisc_packets	= stats->qdisc_packets;
+	sample->qdisc_bytes	= stats->qdisc_bytes;
+	sample->qdisc_drops	= stats->qdisc_drops;
+	sample->tun_packets	= tun_ring_packets(stats);
+	sample->tun_drops	= stats->tx_dropped;
+	return STATUS_OK;
+}
+
+static void add_sample(struct queue_sampler *sampler,
+		       const struct netlink_queue_stats *stats,
+		       const struct queue_sample *sample)
+{
+	int i;
+
+	memcpy(sampler->qdisc_kind, stats->qdisc_kind,
+	       sizeof(sampler->qdisc_kind));
+	sampler->txqlen = stats->txqlen;
+	if (sampler->num_samples == QUEUE_SAMPLER_MAX_SAMPLES) {
+		i = sampler->first;
+		sampler->first = (sampler->first + 1) %
+			QUEUE_SAMPLER_MAX_SAMPLES;
+	} else {
+		i = (sampler->first + sampler->num_samples++) %
+			QUEUE_SAMPLER_MAX_SAMPLES;
+	}
+	sampler->samples[i] = *sample;
+}
+
+static void timespec_add_usecs(struct timespec *ts, s64 usecs)
+{
+	s64 nsecs = ts->tv_nsec + (usecs % 1000000) * 1000;
+
+	ts->tv_sec += usecs / 1000000 + nsecs / 1000000000;
+	ts->tv_nsec = nsecs % 1000000000;
+}
+
+static bool timespec_before(const struct timespec *a,
+			    const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* Sample until stopped, reading netlink without the lock held so
+ * summaries are never kept waiting on the kernel.
+ */
+static void *queue_sampler_thread(void *arg)
+{
+	struct queue_sampler *sampler = arg;
+	struct netlink_queue_stats stats;
+	struct queue_sample sample;
+	struct timespec deadline, now;
+	char *error = NULL;
+
+	cpu_affinity_pin(CPU_ROLE_HELPER);
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	pthread_mutex_lock(&sampler->mutex);
+	while (!sampler->stop) {
+		pthread_mutex_unlock(&sampler->mutex);
+		if (take_sample(sampler, &stats, &sample, &error)) {
+			/* The device can vanish as the test ends. */
+			DEBUGP("--queue_stats: %s\n", error);
+			free(error);
+			error = NULL;
+			pthread_mutex_lock(&sampler->mutex);
+		} else {
+			pthread_mutex_lock(&sampler->mutex);
+			add_sample(sampler, &stats, &sample);
+		}
+
+		/* If we fell behind, skip the samples we missed. */
+		timespec_add_usecs(&deadline, sampler->interval_usecs);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespec_before(&deadline, &now))
+			deadline = now;
+		while (!sampler->stop &&
+		       pthread_cond_timedwait(&sampler->wake, &sampler->mutex,
+					      &deadline) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&sampler->mutex);
+	return NULL;
+}
+
+struct queue_sampler *queue_sampler_new(int ifindex, int interval_usecs)
+{
+	struct queue_sampler *sampler = calloc(1, sizeof(*sampler));
+	struct netlink_queue_stats stats;
+	struct queue_sample sample;
+	pthread_condattr_t attr;
+	char *error = NULL;
+
+	sampler->ifindex = ifindex;
+	sampler->interval_usecs = interval_usecs;
+	sampler->samples = calloc(QUEUE_SAMPLER_MAX_SAMPLES,
+				  sizeof(struct queue_sample));
+
+	/* Find out now, not in the middle of a test, if this works. */
+	if (take_sample(sampler, &stats, &sample, &error))
+		die("--queue_stats: %s\n", error);
+	add_sample(sampler, &stats, &sample);
+
+	if (pthread_mutex_init(&sampler->mutex, NULL) != 0)
+		die_perror("pthread_mutex_init");
+	if (pthread_condattr_init(&attr) != 0 ||
+	    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0 ||
+	    pthread_cond_init(&sampler->wake, &attr) != 0)
+		die_perror("pthread_cond_init");
+	pthread_condattr_destroy(&attr);
+	if (pthread_create(&sampler->thread, NULL, queue_sampler_thread,
+			   sampler) != 0)
+		die_perror("pthread_create");
+	return sampler;
+}
+
+#else  /* !linux */
+
+struct queue_sampler *queue_sampler_new(int ifindex, int interval_usecs)
+{
+	die("--queue_stats is only supported on Linux\n");
+	return NULL;
+}
+
+#endif  /* linux */
+
+void queue_sampler_reset(struct queue_sampler *sampler)
+{
+	pthread_mutex_lock(&sampler->mutex);
+	sampler->first = 0;
+	sampler->num_samples = 0;
+	pthread_mutex_unlock(&sampler->mutex);
+}
+
+void queue_sampler_free(struct queue_sampler *sampler)
+{
+	pthread_mutex_lock(&sampler->mutex);
+	sampler->stop = true;
+	pthread_cond_signal(&sampler->wake);
+	pthread_mutex_unlock(&sampler->mutex);
+	pthread_join(sampler->thread, NULL);
+
+	pthread_cond_destroy(&sampler->wake);
+	pthread_mutex_destroy(&sampler->mutex);
+	free(sampler->samples);
+	memset(sampler, 0, sizeof(*sampler));  /* paranoia to help catch bugs */
+	free(sampler);
+}
+
+void queue_sampler_summary(struct queue_sampler *sampler,
+			   s64 start_usecs, s64 end_usecs,
+			   struct queue_summary *summary)
+{
+	struct queue_sample *samples;
+	int i, num_samples;
+
+	/* Copy the ring out in time order, so as not to hold up the
+	 * sampler while we look through it.
+	 */
+	samples = calloc(QUEUE_SAMPLER_MAX_SAMPLES, sizeof(*samples));
+	pthread_mutex_lock(&sampler->mutex);
+	num_samples = sampler->num_samples;
+	for (i = 0; i < num_samples; ++i) {
+		samples[i] = sampler->samples[(sampler->first + i) %
+					      QUEUE_SAMPLER_MAX_SAMPLES];
+	}
+	queue_summarize(samples, num_samples, start_usecs, end_usecs,
+			summary);
+	memcpy(summary->qdisc_kind, sampler->qdisc_kind,
+	       sizeof(summary->qdisc_kind));
+	summary->txqlen = sampler->txqlen;
+	pthread_mutex_unlock(&sampler->mutex);
+	free(samples);
+}
+
+void queue_summarize(const struct queue_sample *samples, int num_samples,
+		     s64 start_usecs, s64 end_usecs,
+		     struct queue_summary *summary)
+{
+	const struct queue_sample *base = NULL, *last = NULL;
+	int i;
+
+	memset(summary, 0, sizeof(*summary));
+	for (i = 0; i < num_samples; ++i) {
+		const struct queue_sample *sample = &samples[i];
+
+		if (sample->time_usecs < start_usecs) {
+			base = sample;
+			continue;
+		}
+		if (sample->time_usecs > end_usecs)
+			break;
+		if (base == NULL)
+			base = sample;
+		last = sample;
+		summary->num_samples++;
+		summary->max_qdisc_packets = max(summary->max_qdisc_packets,
+						 sample->qdisc_packets);
+		summary->max_qdisc_bytes = max(summary->max_qdisc_bytes,
+					       sample->qdisc_bytes);
+		summary->max_tun_packets = max(summary->max_tun_packets,
+					       sample->tun_packets);
+	}
+	if (last != NULL) {
+		summary->qdisc_drops = last->qdisc_drops - base->qdisc_drops;
+		if (last->tun_drops >= base->tun_drops)
+			summary->tun_drops = last->tun_drops - base->tun_drops;
+	}
+}
+
+char *queue_summary_to_string(const struct queue_summary *summary)
+{
+	char *str = NULL;
+
+	if (summary->num_samples == 0) {
+		asprintf(&str, "queues: no samples");
+		return str;
+	}
+	asprintf(&str, "queues over %d samples: qdisc %s peak %u packets "
+		 "%u bytes, %u drops; tun ring peak %u of %u packets, "
+		 "%llu drops",
+		 summary->num_samples,
+		 summary->qdisc_kind[0] ? summary->qdisc_kind : "none",
+		 summary->max_qdisc_packets, summary->max_qdisc_bytes,
+		 summary->qdisc_drops, summary->max_tun_packets,
+		 summary->txqlen, (unsigned long long)summary->tun_drops);
+	return str;
+}
+
+void queue_summary_write_json(const struct queue_summary *summary,
+			      FILE *out)
+{
+	fprintf(out, "{\"samples\": %d, \"qdisc\": \"%s\", "
+		"\"max_qdisc_packets\": %u, \"max_qdisc_bytes\": %u, "
+		"\"qdisc_drops\": %u, \"txqlen\": %u, "
+		"\"max_tun_packets\": %u, \"tun_drops\": %llu}",
+		summary->num_samples, summary->qdisc_kind,
+		summary->max_qdisc_packets, summary->max_qdisc_bytes,
+		summary->qdisc_drops, summary->txqlen,
+		summary->max_tun_packets,
+		(unsigned long long)summary->tun_drops);
+}
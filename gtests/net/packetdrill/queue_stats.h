@@ -0,0 +1,96 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Sampling of the queues in front of the tun device during a test
+ * (see --queue_stats): the root qdisc's backlog and drops, as
+ * "tc -s qdisc" shows them, and how many packets sit in the tun
+ * device's ring waiting for us to read them.
+ *
+ * A thread reads these over netlink at a fixed interval into a ring
+ * of samples, so that when an outbound packet is late we can say
+ * whether it spent that time queued in front of the device rather
+ * than in the TCP stack.
+ */
+
+#ifndef __QUEUE_STATS_H__
+#define __QUEUE_STATS_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+/* How many samples the sampler keeps; older ones are overwritten. */
+#define QUEUE_SAMPLER_MAX_SAMPLES	16384
+
+/* The queues at one moment. Drops are cumulative. */
+struct queue_sample {
+	s64 time_usecs;			/* when sampled, from now_usecs() */
+	u32 qdisc_packets;		/* packets queued in the root qdisc */
+	u32 qdisc_bytes;		/* bytes queued in the root qdisc */
+	u32 qdisc_drops;		/* packets the root qdisc dropped */
+	u32 tun_packets;		/* packets in the tun ring (estimate) */
+	u64 tun_drops;			/* packets the tun device dropped */
+};
+
+/* The queues over a span of time. */
+struct queue_summary {
+	int num_samples;		/* samples in the span */
+	char qdisc_kind[16];		/* root qdisc, e.g. "fq_codel" */
+	u32 txqlen;			/* length of the tun ring */
+	u32 max_qdisc_packets;		/* peak qdisc backlog */
+	u32 max_qdisc_bytes;
+	u32 qdisc_drops;		/* qdisc drops in the span */
+	u32 max_tun_packets;		/* peak tun ring backlog */
+	u64 tun_drops;			/* tun drops in the span */
+};
+
+struct queue_sampler;
+
+/* Start sampling the queues of the interface with the given index
+ * every interval_usecs. Dies if the queues cannot be read.
+ */
+extern struct queue_sampler *queue_sampler_new(int ifindex,
+					       int interval_usecs);
+
+/* Forget the samples taken so far, as for a new script. */
+extern void queue_sampler_reset(struct queue_sampler *sampler);
+
+/* Stop sampling and free the sampler. */
+extern void queue_sampler_free(struct queue_sampler *sampler);
+
+/* Summarize the samples taken between the given now_usecs() times. */
+extern void queue_sampler_summary(struct queue_sampler *sampler,
+				  s64 start_usecs, s64 end_usecs,
+				  struct queue_summary *summary);
+
+/* Summarize the given samples, in time order, between the given
+ * times. Drops are counted from the last sample before start_usecs,
+ * if there is one, so a drop just before the first sample in the
+ * span counts too.
+ */
+extern void queue_summarize(const struct queue_sample *samples,
+			    int num_samples, s64 start_usecs, s64 end_usecs,
+			    struct queue_summary *summary);
+
+/* Return a malloc-ed one-line description of the summary. */
+extern char *queue_summary_to_string(const struct queue_summary *summary);
+
+/* Write the summary to the given file as a JSON object. */
+extern void queue_summary_write_json(const struct queue_summary *summary,
+				     FILE *out);
+
+#endif /* __QUEUE_STATS_H__ */
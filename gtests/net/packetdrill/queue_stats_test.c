@@ -0,0 +1,111 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for queue_stats.c: summaries of queue samples over a span
+ * of time, and their text and JSON forms.
+ */
+
+#include "queue_stats.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct queue_sample samples[] = {
+	/* time  qpkts  qbytes  qdrops  tunpkts  tundrops */
+	{  100,     0,      0,      5,       0,       1 },
+	{  200,     2,   3000,      5,       1,       1 },
+	{  300,     4,   6000,      7,       3,       1 },
+	{  400,     1,   1500,      8,      12,       4 },
+	{  500,     0,      0,      8,       0,       4 },
+};
+
+#define NUM_SAMPLES	(sizeof(samples) / sizeof(samples[0]))
+
+static void test_summarize(void)
+{
+	struct queue_summary summary;
+
+	/* The whole run. */
+	queue_summarize(samples, NUM_SAMPLES, 0, 1000, &summary);
+	assert(summary.num_samples == 5);
+	assert(summary.max_qdisc_packets == 4);
+	assert(summary.max_qdisc_bytes == 6000);
+	assert(summary.qdisc_drops == 3);
+	assert(summary.max_tun_packets == 12);
+	assert(summary.tun_drops == 3);
+
+	/* Drops count from the sample before the span. */
+	queue_summarize(samples, NUM_SAMPLES, 250, 350, &summary);
+	assert(summary.num_samples == 1);
+	assert(summary.max_qdisc_packets == 4);
+	assert(summary.qdisc_drops == 2);
+	assert(summary.max_tun_packets == 3);
+	assert(summary.tun_drops == 0);
+
+	queue_summarize(samples, NUM_SAMPLES, 400, 500, &summary);
+	assert(summary.num_samples == 2);
+	assert(summary.max_tun_packets == 12);
+	assert(summary.qdisc_drops == 1);
+	assert(summary.tun_drops == 3);
+
+	/* A span with no samples. */
+	queue_summarize(samples, NUM_SAMPLES, 600, 700, &summary);
+	assert(summary.num_samples == 0);
+	assert(summary.qdisc_drops == 0);
+	assert(summary.tun_drops == 0);
+}
+
+static void test_format(void)
+{
+	struct queue_summary summary;
+	char *str;
+	FILE *out;
+	char *json = NULL;
+	size_t json_len = 0;
+
+	queue_summarize(samples, NUM_SAMPLES, 0, 1000, &summary);
+	strcpy(summary.qdisc_kind, "fq_codel");
+	summary.txqlen = 500;
+
+	str = queue_summary_to_string(&summary);
+	assert(strcmp(str, "queues over 5 samples: qdisc fq_codel peak "
+		      "4 packets 6000 bytes, 3 drops; tun ring peak 12 of "
+		      "500 packets, 3 drops") == 0);
+	free(str);
+
+	out = open_memstream(&json, &json_len);
+	queue_summary_write_json(&summary, out);
+	fclose(out);
+	assert(strcmp(json, "{\"samples\": 5, \"qdisc\": \"fq_codel\", "
+		      "\"max_qdisc_packets\": 4, \"max_qdisc_bytes\": 6000, "
+		      "\"qdisc_drops\": 3, \"txqlen\": 500, "
+		      "\"max_tun_packets\": 12, \"tun_drops\": 3}") == 0);
+	free(json);
+
+	memset(&summary, 0, sizeof(summary));
+	str = queue_summary_to_string(&summary);
+	assert(strcmp(str, "queues: no samples") == 0);
+	free(str);
+}
+
+int main(void)
+{
+	test_summarize();
+	test_format();
+	return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the store of past results; see results_db.h.
+ */
+
+#include "results_db.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include "logging.h"
+
+/* Bumped whenever what goes into a key changes. */
+#define RESULTS_DB_VERSION	1
+
+/* Hash the contents of the file at the given path, if we can read it,
+ * along with whether we could. Returns true if we could.
+ */
+static bool hash_file(struct sha1_ctx *ctx, const char *path)
+{
+	char buf[65536];
+	bool readable;
+	size_t len;
+	FILE *f;
+
+	f = fopen(path, "r");
+	readable = (f != NULL);
+	sha1_update(ctx, &readable, sizeof(readable));
+	if (f == NULL)
+		return false;
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+		sha1_update(ctx, buf, len);
+	fclose(f);
+	return true;
+}
+
+static void hash_string(struct sha1_ctx *ctx, const char *s)
+{
+	sha1_update(ctx, s, strlen(s) + 1);
+}
+
+/* Hash the kernel: its uname and, where the kernel or distro exposes
+ * it, its build config.
+ */
+static void hash_kernel(struct sha1_ctx *ctx)
+{
+	struct utsname uts;
+	char *path = NULL;
+
+	if (uname(&uts) != 0)
+		die_perror("uname");
+	hash_string(ctx, uts.sysname);
+	hash_string(ctx, uts.release);
+	hash_string(ctx, uts.version);
+	hash_string(ctx, uts.machine);
+
+	if (!hash_file(ctx, "/proc/config.gz")) {
+		asprintf(&path, "/boot/config-%s", uts.release);
+		hash_file(ctx, path);
+		free(path);
+	}
+}
+
+/* Hash the --init_scripts value and every file an entry names. */
+static void hash_init_scripts(struct sha1_ctx *ctx, const char *init_scripts)
+{
+	char *scripts, *entry, *save = NULL;
+
+	if (init_scripts == NULL)
+		return;
+	hash_string(ctx, init_scripts);
+	scripts = strdup(init_scripts);
+	for (entry = strtok_r(scripts, ",", &save); entry != NULL;
+	     entry = strtok_r(NULL, ",", &save)) {
+		if (strpbrk(entry, " \t") == NULL)
+			hash_file(ctx, entry);
+	}
+	free(scripts);
+}
+
+/* Return the malloc-ed path of the record for the given script. */
+static char *record_path(const struct results_db *db, const char *script_path)
+{
+	u8 digest[SHA1_DIGEST_BYTES];
+	char hex[2 * SHA1_DIGEST_BYTES + 1];
+	char *path = NULL;
+	int i;
+
+	sha1_digest(script_path, strlen(script_path), digest);
+	for (i = 0; i < SHA1_DIGEST_BYTES; ++i)
+		sprintf(hex + 2 * i, "%02x", digest[i]);
+	asprintf(&path, "%s/%s.result", db->dir, hex);
+	return path;
+}
+
+static void key_to_hex(const u8 key[SHA1_DIGEST_BYTES],
+		       char hex[2 * SHA1_DIGEST_BYTES + 1])
+{
+	int i;
+
+	for (i = 0; i < SHA1_DIGEST_BYTES; ++i)
+		sprintf(hex + 2 * i, "%02x", key[i]);
+}
+
+struct results_db *results_db_open(const char *dir,
+				   char **options, int num_options,
+				   const char *init_scripts)
+{
+	struct results_db *db = calloc(1, sizeof(struct results_db));
+	u32 version = RESULTS_DB_VERSION;
+	struct sha1_ctx ctx;
+	int i;
+
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+		die_perror((char *)dir);
+	db->dir = strdup(dir);
+
+	sha1_init(&ctx, NULL);
+	sha1_update(&ctx, &version, sizeof(version));
+	hash_kernel(&ctx);
+	hash_file(&ctx, "/proc/self/exe");	/* our build */
+	hash_init_scripts(&ctx, init_scripts);
+	for (i = 0; i < num_options; ++i)
+		hash_string(&ctx, options[i]);
+	sha1_final(&ctx, db->environment);
+	return db;
+}
+
+void results_db_free(struct results_db *db)
+{
+	free(db->dir);
+	free(db);
+}
+
+int results_db_key(const struct results_db *db, const char *script_path,
+		   u8 key[SHA1_DIGEST_BYTES])
+{
+	struct sha1_ctx ctx;
+	bool readable;
+
+	sha1_init(&ctx, NULL);
+	sha1_update(&ctx, db->environment, sizeof(db->environment));
+	readable = hash_file(&ctx, script_path);
+	sha1_final(&ctx, key);
+	return readable ? STATUS_OK : STATUS_ERR;
+}
+
+/* A record is one line: "<key in hex> pass|fail <seconds>". */
+enum results_history_t results_db_lookup(const struct results_db *db,
+					 const char *script_path,
+					 const u8 key[SHA1_DIGEST_BYTES])
+{
+	char hex[2 * SHA1_DIGEST_BYTES + 1];
+	char recorded[2 * SHA1_DIGEST_BYTES + 1];
+	char status[8];
+	char *path = record_path(db, script_path);
+	enum results_history_t history = RESULTS_CHANGED;
+	FILE *f = fopen(path, "r");
+
+	free(path);
+	if (f == NULL)
+		return RESULTS_CHANGED;
+	if (fscanf(f, "%40s %7s", recorded, status) == 2) {
+		key_to_hex(key, hex);
+		if (strcmp(status, "fail") == 0)
+			history = RESULTS_FAILED;
+		else if (strcmp(status, "pass") == 0 &&
+			 strcmp(recorded, hex) == 0)
+			history = RESULTS_PASSED;
+	}
+	fclose(f);
+	return history;
+}
+
+double results_db_secs(const struct results_db *db, const char *script_path)
+{
+	char *path = record_path(db, script_path);
+	FILE *f = fopen(path, "r");
+	double secs = -1;
+
+	free(path);
+	if (f == NULL)
+		return -1;
+	if (fscanf(f, "%*s %*s %lf", &secs) != 1)
+		secs = -1;
+	fclose(f);
+	return secs;
+}
+
+void results_db_record(const struct results_db *db, const char *script_path,
+		       const u8 key[SHA1_DIGEST_BYTES],
+		       bool passed, double secs)
+{
+	char hex[2 * SHA1_DIGEST_BYTES + 1];
+	char *path = record_path(db, script_path), *tmp_path = NULL;
+	FILE *f;
+
+	/* Write to a temporary file and then rename it into place, so
+	 * that concurrent runs only ever see whole records.
+	 */
+	key_to_hex(key, hex);
+	asprintf(&tmp_path, "%s.%d.tmp", path, getpid());
+	f = fopen(tmp_path, "w");
+	if (f == NULL)
+		goto out;
+	fprintf(f, "%s %s %.3f\n", hex, passed ? "pass" : "fail", secs);
+	if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+		DEBUGP("results_db_record: error writing %s\n", tmp_path);
+		unlink(tmp_path);
+	}
+out:
+	free(tmp_path);
+	free(path);
+}
@@ -0,0 +1,86 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for the store of past results kept with --results_db=<dir>.
+ *
+ * For each script a --jobs run finishes, we record in <dir> whether it
+ * passed, under a key that hashes everything the result depends on:
+ * the script's text, the --init_scripts commands and the files they
+ * name, the kernel's release, version and build config, the packetdrill
+ * binary itself and the command line options. The next run skips the
+ * scripts that passed last time under the same key, and runs those
+ * that failed last time first, then those that changed or are new, so
+ * a kernel bisect step learns about regressions as early as it can.
+ */
+
+#ifndef __RESULTS_DB_H__
+#define __RESULTS_DB_H__
+
+#include "types.h"
+
+#include "sha1.h"
+
+/* What the store knows about a script. */
+enum results_history_t {
+	RESULTS_FAILED,		/* failed last time it ran */
+	RESULTS_CHANGED,	/* new, or changed since it last passed */
+	RESULTS_PASSED,		/* passed last time, unchanged since */
+};
+
+struct results_db {
+	char *dir;				/* where records live */
+	u8 environment[SHA1_DIGEST_BYTES];	/* hash of all but script */
+};
+
+/* Open the store in the given directory, creating it if need be, for
+ * a run with the given command line. options/num_options are the
+ * command line options (not the script paths) and init_scripts the
+ * --init_scripts value, or NULL.
+ */
+extern struct results_db *results_db_open(const char *dir,
+					  char **options, int num_options,
+					  const char *init_scripts);
+
+/* Free a store from results_db_open(). */
+extern void results_db_free(struct results_db *db);
+
+/* Compute the key of the given script under this store's environment.
+ * Returns STATUS_ERR if the script cannot be read.
+ */
+extern int results_db_key(const struct results_db *db,
+			  const char *script_path, u8 key[SHA1_DIGEST_BYTES]);
+
+/* Look up the history of the script with the given path and key. */
+extern enum results_history_t results_db_lookup(
+	const struct results_db *db, const char *script_path,
+	const u8 key[SHA1_DIGEST_BYTES]);
+
+/* Return how many seconds the script with the given path took the last
+ * time it ran, under any key, or -1 if we do not know.
+ */
+extern double results_db_secs(const struct results_db *db,
+			      const char *script_path);
+
+/* Record whether the script with the given path and key passed. Errors
+ * are not fatal; they just mean the script runs again next time.
+ */
+extern void results_db_record(const struct results_db *db,
+			      const char *script_path,
+			      const u8 key[SHA1_DIGEST_BYTES],
+			      bool passed, double secs);
+
+#endif /* __RESULTS_DB_H__ */
@@ -0,0 +1,86 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for results_db.c: what the store says about scripts as
+ * they pass, fail and change.
+ */
+
+#include "results_db.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void write_file(const char *path, const char *text)
+{
+	FILE *f = fopen(path, "w");
+
+	assert(f != NULL);
+	fputs(text, f);
+	assert(fclose(f) == 0);
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/results_db_test.XXXXXX";
+	char *store = NULL, *script = NULL, *command = NULL;
+	char *options[] = { "--ip_version=ipv4" };
+	char *other_options[] = { "--ip_version=ipv6" };
+	u8 key[SHA1_DIGEST_BYTES], other_key[SHA1_DIGEST_BYTES];
+	struct results_db *db, *other_db;
+
+	assert(mkdtemp(dir) != NULL);
+	asprintf(&store, "%s/store", dir);
+	asprintf(&script, "%s/test.pkt", dir);
+	write_file(script, "0 socket(..., SOCK_STREAM, IPPROTO_TCP) = 3\n");
+
+	db = results_db_open(store, options, 1, NULL);
+	assert(results_db_key(db, script, key) == STATUS_OK);
+	assert(results_db_lookup(db, script, key) == RESULTS_CHANGED);
+
+	results_db_record(db, script, key, false, 1.5);
+	assert(results_db_lookup(db, script, key) == RESULTS_FAILED);
+
+	results_db_record(db, script, key, true, 1.5);
+	assert(results_db_lookup(db, script, key) == RESULTS_PASSED);
+
+	/* Other options make for another key. */
+	other_db = results_db_open(store, other_options, 1, NULL);
+	assert(results_db_key(other_db, script, other_key) == STATUS_OK);
+	assert(memcmp(key, other_key, sizeof(key)) != 0);
+	assert(results_db_lookup(other_db, script, other_key) ==
+	       RESULTS_CHANGED);
+	results_db_free(other_db);
+
+	/* So does a change to the script. */
+	write_file(script, "0 socket(..., SOCK_DGRAM, IPPROTO_UDP) = 3\n");
+	assert(results_db_key(db, script, other_key) == STATUS_OK);
+	assert(memcmp(key, other_key, sizeof(key)) != 0);
+	assert(results_db_lookup(db, script, other_key) == RESULTS_CHANGED);
+
+	assert(results_db_key(db, "/nonexistent.pkt", key) == STATUS_ERR);
+	results_db_free(db);
+
+	asprintf(&command, "rm -rf %s", dir);
+	assert(system(command) == 0);
+	free(command);
+	free(script);
+	free(store);
+	return 0;
+}
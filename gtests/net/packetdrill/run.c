@@ -32,23 +32,42 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#ifdef linux
+#include <sys/prctl.h>
+#endif
 #include <sys/socket.h>
 #include <sys/times.h>
+#include <time.h>
 #include <unistd.h>
+#include "alloc_stats.h"
+#include "cpu_affinity.h"
+#include "event_loop.h"
 #include "ip.h"
+#include "kernel_state.h"
+#include "kernel_timeline.h"
+#include "line_profile.h"
 #include "logging.h"
+#include "mib.h"
 #include "netdev.h"
 #include "wire_client_netdev.h"
 #include "parse.h"
+#include "path_emulation.h"
+#include "pcap_replay.h"
+#include "perf_counters.h"
+#include "prelude.h"
+#include "probes.h"
 #include "run_command.h"
 #include "run_packet.h"
 #include "run_system_call.h"
 #include "script.h"
+#include "script_cache.h"
 #include "socket.h"
 #include "system.h"
 #include "tcp.h"
 #include "mptcp.h"
 #include "tcp_options.h"
+#include "time_source.h"
+#include "verify_plan.h"
 
 /* MAX_SPIN_USECS is the maximum amount of time (in microseconds) to
  * spin waiting for an event. We sleep up until this many microseconds
@@ -59,12 +78,179 @@
  * jiffies value at the time we wake, and then we execute the test
  * event shortly thereafter. The value below was chosen experimentally
  * based on experiences on a 2.2GHz machine for which there was a
- * measured overhead of roughly 15 usec for the unlock/usleep/lock
- * sequence that wait_for_event() must execute while waiting
- * for the next event.
+ * measured overhead of roughly 15 usec for the usleep that
+ * wait_for_event() must execute while waiting for the next event.
  */
 const int MAX_SPIN_USECS = 20;
 
+/* Maximum number of spare packets we keep around for reuse. Typically
+ * only a few sniffed and injected packets are in flight at once.
+ */
+static const int PACKET_POOL_MAX_FREE = 16;
+
+/* How much of the main thread's stack --mlock=hot locks. */
+static const size_t HOT_STACK_BYTES = 256 * 1024;
+
+/* The state whose --timing_report to write if we exit before the test
+ * is done, i.e. on a failure.
+ */
+static struct state *timing_exit_state;
+
+static void write_timing_report(struct state *state, bool passed)
+{
+	char *error = NULL;
+	char *extra_json = NULL, *mib_json = NULL;
+	size_t extra_bytes = 0, mib_bytes = 0;
+	FILE *out = open_memstream(&extra_json, &extra_bytes);
+	struct queue_summary queues;
+	int i;
+
+	if (out == NULL)
+		die_perror("open_memstream");
+
+	/* How far the test got, and for a failure, where and why it
+	 * stopped, so that dashboards need not scrape stderr.
+	 */
+	if (state->live_start_time_usecs != 0)
+		fprintf(out, "\"duration_usecs\": %lld, ",
+			(long long)(now_usecs() - state->live_start_time_usecs));
+	if (!passed) {
+		if (state->event != NULL)
+			fprintf(out, "\"line\": %d, ", state->event->line_number);
+		if (log_fatal_error() != NULL) {
+			fprintf(out, "\"error\": ");
+			write_json_string(log_fatal_error(), out);
+			fprintf(out, ", ");
+		}
+	}
+
+	/* The tolerance each kind of event was held to. */
+	fprintf(out, "\"tolerances_usecs\": {");
+	for (i = 0; i < NUM_TIMING_EVENTS; i++) {
+		fprintf(out, "%s\"%s\": %d", i > 0 ? ", " : "",
+			timing_event_name(i),
+			config_tolerance_usecs(state->config, i));
+	}
+	fprintf(out, "}");
+
+	/* Attach the MIB counters the test changed. */
+	if (state->mib != NULL) {
+		FILE *mib_out = open_memstream(&mib_json, &mib_bytes);
+
+		if (mib_out == NULL)
+			die_perror("open_memstream");
+		if (mib_write_json(state->mib, mib_out, &error)) {
+			fprintf(stderr, "timing report: %s\n", error);
+			free(error);
+			error = NULL;
+		}
+		fclose(mib_out);
+		if (mib_bytes > 0)
+			fprintf(out, ", %s", mib_json);
+		free(mib_json);
+	}
+
+	/* With --queue_stats, what the queues held over the whole test. */
+	if (state->netdev != NULL && state->live_start_time_usecs != 0 &&
+	    netdev_queue_summary(state->netdev, state->live_start_time_usecs,
+				 now_usecs(), &queues) == STATUS_OK) {
+		fprintf(out, ", \"queues\": ");
+		queue_summary_write_json(&queues, out);
+	}
+
+	/* With --kernel_latency, how long the kernel took at each line. */
+	if (state->kernel_latency != NULL) {
+		fprintf(out, ", \"kernel_latency\": ");
+		kernel_latency_write_json(state->kernel_latency, out);
+	}
+
+	/* With --alloc_stats, what each subsystem holds and has held. */
+	if (state->config->alloc_stats) {
+		fprintf(out, ", \"allocations\": ");
+		alloc_stats_write_json(out);
+	}
+	fclose(out);
+
+	if (timing_report_append(state->timing, state->config->timing_report,
+				 state->config->script_path, passed,
+				 state->config->tolerance_usecs,
+				 extra_json, &error)) {
+		fprintf(stderr, "timing report: %s\n", error);
+		free(error);
+	}
+	free(extra_json);
+}
+
+static void write_exit_timing_report(void)
+{
+	if (timing_exit_state != NULL)
+		write_timing_report(timing_exit_state, false);
+}
+
+/* For --line_profile, where to append the profile when the run ends,
+ * or NULL once it has been.
+ */
+static const char *line_profile_path;
+
+static void finish_line_profile(void)
+{
+	char *error = NULL;
+
+	if (line_profile_path == NULL)
+		return;
+	line_profile_disable();
+	line_profile_report(stdout);
+	if (line_profile_write_folded(line_profile_path, &error)) {
+		fprintf(stderr, "--line_profile: %s\n", error);
+		free(error);
+	}
+	line_profile_path = NULL;
+}
+
+/* An arena_chunk_fn_t locking each chunk of the script's arena. */
+static void lock_arena_chunk(void *arg, const void *data, size_t bytes)
+{
+	memlock_region(arg, data, bytes);
+}
+
+/* For --mlock=hot, lock what we touch while running events: the stack,
+ * the packet pool, which we fill now, and the parsed events, in that
+ * order, since we stop where the budget runs out.
+ */
+static void lock_hot_memory(struct state *state)
+{
+	struct packet_pool *pool = state->packet_pool;
+	struct memlock *memlock;
+	struct event *event;
+	int i;
+
+	memlock = memlock_new(state->config->mlock_budget_bytes);
+	memlock_stack(memlock, HOT_STACK_BYTES);
+
+	/* Reserved huge pages are never swapped out, so a pool on them
+	 * needs no locking and costs nothing from the budget.
+	 */
+	packet_pool_fill(pool, PACKET_POOL_MAX_FREE);
+	for (i = 0; pool->slab.backing != HUGEPAGES_HUGETLB &&
+		     i < pool->num_free; i++) {
+		memlock_region(memlock, pool->free_packets[i],
+			       sizeof(struct packet) + pool->buffer_bytes);
+	}
+
+	/* The arena holds the events, unless we parse them as we go;
+	 * then we lock the events in the window parsed so far.
+	 */
+	if (state->script->arena != NULL)
+		arena_for_each_chunk(state->script->arena, lock_arena_chunk,
+				     memlock);
+	if (!state->script->arena_events) {
+		for (event = state->script->event_list; event != NULL;
+		     event = event->next)
+			memlock_region(memlock, event, sizeof(*event));
+	}
+	state->memlock = memlock;
+}
+
 struct state *state_new(struct config *config,
 			struct script *script,
 			struct netdev *netdev)
@@ -79,10 +265,100 @@ struct state *state_new(struct config *config,
 	state->config = config;
 	state->script = script;
 	state->netdev = netdev;
-	state->packets = packets_new();
+	if (!config->seed_set)
+		config->seed = prng_entropy_seed();
+	if (config->verbose)
+		printf("random seed: --seed=%llu\n", config->seed);
+	prng_seed(&state->prng, config->seed);
+	mp_state.prng = &state->prng;
+	mp_state.version = config->mptcp_version;
+	if (config->num_paths > 0)
+		state->netdev = path_netdev_new(netdev, config->paths,
+						config->num_paths,
+						&state->prng, config->verbose);
+	state->packets = packets_new(&state->prng);
+	state->packet_pool = packet_pool_new(PACKET_POOL_BUFFER_BYTES,
+					     PACKET_POOL_MAX_FREE);
+	if (config->hugepages != HUGEPAGES_NONE) {
+		char *error = NULL;
+
+		/* Not fatal: the pool works as well from malloc(). */
+		if (packet_pool_map(state->packet_pool, config->hugepages,
+				    &error)) {
+			fprintf(stderr, "--hugepages: packet pool: %s\n",
+				error);
+			free(error);
+		} else if (config->verbose) {
+			printf("packet pool: %zu bytes on %s pages\n",
+			       state->packet_pool->slab.bytes,
+			       hugepages_name(
+				       state->packet_pool->slab.backing));
+		}
+	}
+	if (config->scheduler == SCHEDULER_EPOLL)
+		state->event_loop = event_loop_new();
+	/* Before the syscall threads start, so they count too. Copies of
+	 * a script run by --stress share the first copy's counters.
+	 */
+	if (config->perf_counters && !perf_counters_on) {
+		char *error = NULL;
+
+		if (perf_counters_enable("main thread", &error))
+			die("--perf_counters: %s\n", error);
+		state->perf_counters = true;
+	}
 	state->syscalls = syscalls_new(state);
 	state->code = code_new(config);
 	state->sockets = NULL;
+	state->socket_table = socket_table_new();
+	if (config->tcp_info_log != NULL) {
+		state->tcp_info_log =
+			tcp_info_log_new(config->tcp_info_log,
+					 config->tcp_info_interval_usecs);
+	}
+	if (config->timing_report != NULL) {
+		static bool registered;
+
+		state->timing = calloc(1, sizeof(struct timing_stats));
+		timing_exit_state = state;
+		if (!registered) {
+			atexit(write_exit_timing_report);
+			registered = true;
+		}
+	}
+	if (config->fuzz_variants > 0)
+		state->fuzzer = fuzzer_new(&state->prng);
+	if (config->line_profile != NULL) {
+		static bool registered;
+
+		/* Profile a failed run too, up to where it stopped. */
+		line_profile_path = config->line_profile;
+		line_profile_enable(config->script_path);
+		if (!registered) {
+			atexit(finish_line_profile);
+			registered = true;
+		}
+	}
+	if (config->ack_aggregation.mode != ACK_AGGREGATION_NONE)
+		state->ack_aggregator =
+			ack_aggregator_new(&config->ack_aggregation);
+	if (config->kernel_latency)
+		state->kernel_latency = kernel_latency_new();
+	if (config->dsn_coverage_usecs > 0)
+		state->dsn_coverage =
+			dsn_coverage_new(config->dsn_coverage_usecs);
+	if (config->self_stall)
+		state->self_stall = self_stall_new();
+	if (config->kernel_timeline != NULL) {
+		char *error = NULL;
+
+		state->kernel_timeline =
+			kernel_timeline_new(config->kernel_timeline, &error);
+		if (state->kernel_timeline == NULL)
+			die("--kernel_timeline: %s\n", error);
+	}
+	if (config->mlock == MLOCK_HOT)
+		lock_hot_memory(state);
 	return state;
 }
 
@@ -95,6 +371,15 @@ struct state *state_new(struct config *config,
 static void close_all_sockets(struct state *state)
 {
 	struct socket *socket = state->sockets;
+
+	/* Reset first, in one batch, so the connections are gone by
+	 * the time we close their sockets and the closes send nothing.
+	 */
+	if (!state->config->is_wire_client &&
+	    !state->config->skip_teardown &&
+	    reset_connections(state)) {
+		die("error reseting connections\n");
+	}
 	while (socket != NULL) {
 		if (socket->live.fd >= 0 && !socket->is_closed) {
 			assert(socket->script.fd >= 0);
@@ -104,22 +389,24 @@ static void close_all_sockets(struct state *state)
 			if (close(socket->live.fd))
 				die_perror("close");
 		}
-		if (socket->protocol == IPPROTO_TCP &&
-		    !state->config->is_wire_client &&
-		    reset_connection(state, socket)) {
-			die("error reseting connection\n");
-		}
 		struct socket *dead_socket = socket;
 		socket = socket->next;
+		socket_table_remove(state, dead_socket);
 		socket_free(dead_socket);
 	}
+	state->sockets = NULL;
 }
 
 void state_free(struct state *state)
 {
-	/* We have to stop the system call thread first, since it's using
-	 * sockets that we want to close and reset.
+	/* We have to stop the TCP_INFO sampler and the system call thread
+	 * first, since they're using sockets that we want to close and
+	 * reset.
 	 */
+	if (state->tcp_info_log != NULL) {
+		tcp_info_log_free(state->tcp_info_log);
+		state->tcp_info_log = NULL;
+	}
 	syscalls_free(state, state->syscalls);
 
 	/* Then we close the sockets and reset the connections, while
@@ -127,10 +414,79 @@ void state_free(struct state *state)
 	 * per-connection kernel state.
 	 */
 	close_all_sockets(state);
+	socket_table_free(state->socket_table);
 
 	netdev_free(state->netdev);
 	packets_free(state->packets);
+	log_flush();	/* keep the verbose packet dumps in order */
+	if (state->config->verbose) {
+		printf("packet pool: %llu allocations, %llu reused, "
+		       "peak %d in use\n",
+		       state->packet_pool->num_gets,
+		       state->packet_pool->num_hits,
+		       state->packet_pool->peak_in_use);
+	}
+	if (state->memlock != NULL) {
+		/* Say what we locked if asked, or if it wasn't everything. */
+		if (state->config->verbose)
+			memlock_report(state->memlock, stdout);
+		else if (state->memlock->over_budget_bytes > 0 ||
+			 state->memlock->failed_bytes > 0)
+			memlock_report(state->memlock, stderr);
+		memlock_free(state->memlock);
+		state->memlock = NULL;
+	}
+	if (state->fuzzer != NULL) {
+		fuzzer_free(state->fuzzer);
+		state->fuzzer = NULL;
+	}
+	ack_aggregator_free(state->ack_aggregator);
+	state->ack_aggregator = NULL;
+	packet_pool_free(state->packet_pool);
+	if (state->event_loop != NULL) {
+		event_loop_free(state->event_loop);
+		state->event_loop = NULL;
+	}
+	if (state->config->verbose && state->wakeup_stats.num_waits > 0) {
+		printf("event wakeups: %lld waits, error avg %lld usecs, "
+		       "max %lld usecs\n",
+		       state->wakeup_stats.num_waits,
+		       state->wakeup_stats.total_error_usecs /
+		       state->wakeup_stats.num_waits,
+		       state->wakeup_stats.max_error_usecs);
+	}
+	if (state->config->verbose &&
+	    state->config->time_source == TIME_SOURCE_TSC) {
+		/* Cross-check the calibrated counter after the run. */
+		printf("tsc clock: %.2f ppm from CLOCK_MONOTONIC_RAW\n",
+		       time_source_drift_ppm());
+	}
+	if (state->perf_counters) {
+		perf_counters_report(stdout);
+		perf_counters_disable();
+	}
+	kernel_latency_free(state->kernel_latency);
+	state->kernel_latency = NULL;
+	dsn_coverage_free(state->dsn_coverage);
+	state->dsn_coverage = NULL;
+	self_stall_free(state->self_stall);
+	state->self_stall = NULL;
+	kernel_timeline_free(state->kernel_timeline);
+	state->kernel_timeline = NULL;
 	code_free(state->code);
+	finish_line_profile();
+	if (state->timing != NULL) {
+		if (timing_exit_state == state)
+			timing_exit_state = NULL;
+		write_timing_report(state, true);
+		timing_stats_free(state->timing);
+	}
+	if (state->mib != NULL) {
+		mib_free(state->mib);
+		state->mib = NULL;
+	}
+	if (mp_state.prng == &state->prng)
+		mp_state.prng = NULL;
 
 	run_unlock(state);
 	if (pthread_mutex_destroy(&state->mutex) != 0)
@@ -142,10 +498,46 @@ void state_free(struct state *state)
 
 s64 now_usecs(void)
 {
-	struct timeval tv;
-	if (gettimeofday(&tv, NULL) < 0)
-		die_perror("gettimeofday");
-	return timeval_to_usecs(&tv);
+	return time_now_nsecs() / 1000;
+}
+
+/* Record how far from its script time, or time range, an event was. */
+static void record_timing_error(struct state *state,
+				enum event_time_t time_type,
+				s64 expected_usecs, s64 expected_usecs_end,
+				s64 actual_usecs, enum timing_event_t timing,
+				int line_number)
+{
+	s64 error_usecs = actual_usecs - expected_usecs;
+
+	if (time_type == ABSOLUTE_RANGE_TIME ||
+	    time_type == RELATIVE_RANGE_TIME) {
+		if (actual_usecs > expected_usecs_end)
+			error_usecs = actual_usecs - expected_usecs_end;
+		else if (actual_usecs >= expected_usecs)
+			error_usecs = 0;
+	}
+	timing_record(&state->timing->events[timing], error_usecs,
+		      llabs(error_usecs) >
+		      config_tolerance_usecs(state->config, timing));
+	timing_record_line(state->timing, line_number, error_usecs);
+}
+
+/* With --self_stall, label a timing error host-induced if our own main
+ * thread was kept from running for longer than the event was late.
+ */
+static void label_timing_error(struct state *state, s64 late_usecs,
+			       char **error)
+{
+	char *label = NULL, *labeled = NULL;
+
+	if (state->self_stall == NULL ||
+	    !self_stall_explains(state->self_stall, late_usecs, &label))
+		return;
+	asprintf(&labeled, "%s (%s)", *error, label);
+	free(label);
+	free(*error);
+	*error = labeled;
 }
 
 /*
@@ -158,13 +550,14 @@ s64 now_usecs(void)
  */
 int verify_time(struct state *state, enum event_time_t time_type,
 		s64 script_usecs, s64 script_usecs_end,
-		s64 live_usecs, const char *description, char **error)
+		s64 live_usecs, enum timing_event_t timing,
+		int line_number, const char *description, char **error)
 {
 	s64 expected_usecs = script_usecs - state->script_start_time_usecs;
 	s64 expected_usecs_end = script_usecs_end -
 		state->script_start_time_usecs;
 	s64 actual_usecs = live_usecs - state->live_start_time_usecs;
-	int tolerance_usecs = state->config->tolerance_usecs;
+	int tolerance_usecs = config_tolerance_usecs(state->config, timing);
 
 	DEBUGP("expected: %.3f actual: %.3f  (secs)\n",
 	       usecs_to_secs(script_usecs), usecs_to_secs(actual_usecs));
@@ -172,6 +565,11 @@ int verify_time(struct state *state, enum event_time_t time_type,
 	if (time_type == ANY_TIME)
 		return STATUS_OK;
 
+	if (state->timing != NULL)
+		record_timing_error(state, time_type, expected_usecs,
+				    expected_usecs_end, actual_usecs, timing,
+				    line_number);
+
 	if (time_type == ABSOLUTE_RANGE_TIME ||
 	    time_type == RELATIVE_RANGE_TIME) {
 		DEBUGP("expected_usecs_end %.3f\n",
@@ -201,6 +599,9 @@ int verify_time(struct state *state, enum event_time_t time_type,
 					 usecs_to_secs(actual_usecs -
 						       offset_usecs));
 			}
+			label_timing_error(state, actual_usecs -
+					   (expected_usecs_end + tolerance_usecs),
+					   error);
 			return STATUS_ERR;
 		} else {
 			return STATUS_OK;
@@ -215,12 +616,45 @@ int verify_time(struct state *state, enum event_time_t time_type,
 			 description,
 			 usecs_to_secs(script_usecs),
 			 usecs_to_secs(actual_usecs));
+		label_timing_error(state, actual_usecs -
+				   (expected_usecs + tolerance_usecs), error);
 		return STATUS_ERR;
 	} else {
 		return STATUS_OK;
 	}
 }
 
+/* Return the kind of the given event, for --timing_report. */
+static enum timing_event_t event_timing(struct event *event)
+{
+	if (event->type == PACKET_EVENT)
+		return (packet_direction(event->event.packet) ==
+			DIRECTION_INBOUND) ?
+			TIMING_INBOUND_PACKET : TIMING_OUTBOUND_PACKET;
+	if (event->type == SYSCALL_EVENT)
+		return TIMING_SYSCALL_START;
+	return TIMING_OTHER;
+}
+
+/* Return the phase of --perf_counters the given event counts toward. */
+static enum perf_phase_t event_perf_phase(struct event *event)
+{
+	switch (event->type) {
+	case PACKET_EVENT:
+		return (packet_direction(event->event.packet) ==
+			DIRECTION_INBOUND) ?
+			PERF_INBOUND_PACKET_EVENT : PERF_OUTBOUND_PACKET_EVENT;
+	case SYSCALL_EVENT:
+		return PERF_SYSCALL_EVENT;
+	case COMMAND_EVENT:
+		return PERF_COMMAND_EVENT;
+	case CODE_EVENT:
+		return PERF_CODE_EVENT;
+	default:
+		return PERF_OTHER_EVENT;
+	}
+}
+
 /* Return a static string describing the given event, for error messages. */
 static const char *event_description(struct event *event)
 {
@@ -246,6 +680,17 @@ static const char *event_description(struct event *event)
 		return "command";
 	case CODE_EVENT:
 		return "data collection for code";
+	case METER_EVENT:
+		return "meter";
+	case MP_JOIN_STORM_EVENT:
+		return "mp_join_storm";
+	case PEER_EVENT:
+		return "peer";
+	case SYN_FLOOD_EVENT:
+		return "syn_flood";
+	case INTERLEAVE_EVENT:
+		return "interleave";
+	case REPEAT_EVENT:
 	case INVALID_EVENT:
 	case NUM_EVENT_TYPES:
 		assert(!"bogus type");
@@ -263,7 +708,8 @@ void check_event_time(struct state *state, s64 live_usecs)
 			state->event->time_type,
 			state->event->time_usecs,
 			state->event->time_usecs_end, live_usecs,
-			description, &error)) {
+			event_timing(state->event),
+			state->event->line_number, description, &error)) {
 		die("%s:%d: %s\n",
 		    state->config->script_path,
 		    state->event->line_number,
@@ -275,6 +721,12 @@ void check_event_time(struct state *state, s64 live_usecs)
  * uses wildcard or relative timing.
  */
 void adjust_relative_event_times(struct state *state, struct event *event)
+{
+	adjust_relative_event_times_from(state, event, now_usecs());
+}
+
+void adjust_relative_event_times_from(struct state *state,
+				      struct event *event, s64 live_usecs)
 {
 	s64 offset_usecs;
 
@@ -283,7 +735,7 @@ void adjust_relative_event_times(struct state *state, struct event *event)
 	    event->time_type != RELATIVE_RANGE_TIME)
 		return;
 
-	offset_usecs = now_usecs() - state->live_start_time_usecs;
+	offset_usecs = live_usecs - state->live_start_time_usecs;
 	event->offset_usecs = offset_usecs;
 
 	event->time_usecs += offset_usecs;
@@ -298,18 +750,157 @@ void adjust_relative_event_times(struct state *state, struct event *event)
 	}
 }
 
+/* Sleep until config->scheduler_slack_usecs before the given live
+ * time. The caller must not hold the global lock. On Linux the
+ * deadline is an absolute CLOCK_MONOTONIC time, so that signals and
+ * preemption do not make us oversleep by accumulating relative sleeps.
+ */
+static void timer_sleep_until(struct state *state, s64 live_usecs)
+{
+	s64 wait_usecs = live_usecs - state->config->scheduler_slack_usecs -
+			 now_usecs();
+	if (wait_usecs <= 0)
+		return;
+
+#ifdef linux
+	struct timespec deadline;
+	int result;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &deadline) < 0)
+		die_perror("clock_gettime");
+	deadline.tv_sec += wait_usecs / 1000000;
+	deadline.tv_nsec += (wait_usecs % 1000000) * 1000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	do {
+		result = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					 &deadline, NULL);
+	} while (result == EINTR);
+	if (result != 0) {
+		errno = result;
+		die_perror("clock_nanosleep");
+	}
+#else
+	usleep(wait_usecs);
+#endif
+}
+
+/* Wait in the event loop until config->scheduler_slack_usecs before
+ * the given live time. The caller must not hold the global lock. The
+ * completions of blocking system calls wake us on the way, and we go
+ * back to waiting, since their threads do their own bookkeeping.
+ */
+static void epoll_sleep_until(struct state *state, s64 live_usecs)
+{
+	s64 deadline_usecs = live_usecs - state->config->scheduler_slack_usecs;
+
+	while (now_usecs() < deadline_usecs)
+		event_loop_wait(state->event_loop, deadline_usecs);
+}
+
+/* Account for how late we woke up for the current event. */
+static void record_wakeup_error(struct state *state, s64 error_usecs)
+{
+	struct wakeup_stats *stats = &state->wakeup_stats;
+
+	state->event->wakeup_error_usecs = error_usecs;
+	stats->num_waits++;
+	stats->total_error_usecs += error_usecs;
+	if (error_usecs > stats->max_error_usecs)
+		stats->max_error_usecs = error_usecs;
+}
+
+/* Most bytes of a script packet we pull into the cache before its
+ * time: the headers the injection and verification paths touch.
+ */
+#define PREFETCH_PACKET_BYTES	VERIFY_PLAN_MAX_BYTES
+
+/* Pull into the cache what running the given event touches first: the
+ * event, its spec and, for a packet, its header bytes and verification
+ * plan. We do this at the end of a wait, so that the cache misses are
+ * taken before the event's time rather than between the wakeup and
+ * the send or check.
+ */
+static void prefetch_event(struct event *event)
+{
+	struct packet *packet = NULL;
+	u8 *start = NULL;
+	int bytes, i;
+
+	if (event == NULL)
+		return;
+	__builtin_prefetch(event);
+	switch (event->type) {
+	case PACKET_EVENT:
+		packet = event->event.packet;
+		start = packet_start(packet);
+		bytes = packet->ip_bytes;
+		if (bytes > PREFETCH_PACKET_BYTES)
+			bytes = PREFETCH_PACKET_BYTES;
+		for (i = 0; i < bytes; i += 64)
+			__builtin_prefetch(start + i);
+		if (packet->verify_plan != NULL) {
+			__builtin_prefetch(packet->verify_plan);
+			__builtin_prefetch(packet->verify_plan->mask);
+		}
+		break;
+	case SYSCALL_EVENT:
+		__builtin_prefetch(event->event.syscall);
+		break;
+	default:
+		break;
+	}
+}
+
 void wait_for_event(struct state *state)
 {
 	s64 event_usecs =
 		script_time_to_live_time_usecs(
 			state, state->event->time_usecs);
+	s64 live_usecs = 0;
+	bool prefetched = false;
+	enum profile_phase_t profile_phase;
 	DEBUGP("waiting until %lld -- now is %lld\n",
 	       event_usecs, now_usecs());
+
+	/* Only we change the event cursor and the start times, so we
+	 * need no lock to sleep and spin until the event's time. Not
+	 * holding it lets syscall threads whose calls return in the
+	 * meantime check and record their results without waiting
+	 * behind our spin.
+	 */
+	run_unlock(state);
+	profile_phase = profile_phase_begin(PROFILE_WAIT);
+
+	if (state->config->scheduler == SCHEDULER_TIMER)
+		timer_sleep_until(state, event_usecs);
+	else if (state->config->scheduler == SCHEDULER_EPOLL)
+		epoll_sleep_until(state, event_usecs);
+
 	while (1) {
 		const s64 wait_usecs = event_usecs - now_usecs();
 		if (wait_usecs <= 0)
 			break;
 
+		/* Once we are done sleeping, spend some of the spin
+		 * warming the cache for this event and the next one.
+		 */
+		if (!prefetched &&
+		    (wait_usecs <= MAX_SPIN_USECS ||
+		     state->config->scheduler != SCHEDULER_SPIN)) {
+			prefetch_event(state->event);
+			prefetch_event(state->event->next);
+			prefetched = true;
+		}
+
+		/* In timer and epoll modes we are within the
+		 * configured slack now, which the user asked us to spin.
+		 */
+		if (state->config->scheduler != SCHEDULER_SPIN)
+			continue;
+
 		/* If we're waiting a long time, and we are on an OS
 		 * that we know has a fine-grained usleep(), then
 		 * usleep() instead of spinning on the CPU.
@@ -319,11 +910,8 @@ void wait_for_event(struct state *state)
 		 * when we tell it to, sleep until just before the
 		 * event we're waiting for and then spin.
 		 */
-		if (wait_usecs > MAX_SPIN_USECS) {
-			run_unlock(state);
+		if (wait_usecs > MAX_SPIN_USECS)
 			usleep(wait_usecs - MAX_SPIN_USECS);
-			run_lock(state);
-		}
 #endif
 
 		/* At this point we should only have a millisecond or
@@ -331,7 +919,246 @@ void wait_for_event(struct state *state)
 		 */
 	}
 
-	check_event_time(state, now_usecs());
+	/* Take the time before the lock, so that waiting for a syscall
+	 * thread to finish its bookkeeping is not charged to the event.
+	 */
+	live_usecs = now_usecs();
+	profile_phase_end(profile_phase);
+	run_lock(state);
+	record_wakeup_error(state, live_usecs - event_usecs);
+	if (state->self_stall != NULL)
+		self_stall_mark(state->self_stall, live_usecs - event_usecs);
+	check_event_time(state, live_usecs);
+}
+
+/* With --stream_window, free the events we are done with, and parse
+ * ahead so that the window of events after the current one is full.
+ * We keep the previous event and the repeat block we are in. While a
+ * blocking system call may still be running we free nothing, since it
+ * may belong to an event we have moved past.
+ */
+static int stream_script_events(struct state *state, char **error)
+{
+	struct script *script = state->script;
+	struct event *event = NULL;
+	int ahead = 0;
+
+	if (!script->streaming)
+		return STATUS_OK;
+
+	while ((state->syscalls == NULL || !syscalls_busy(state->syscalls)) &&
+	       script->event_list != state->event &&
+	       script->event_list != state->last_event &&
+	       script->event_list != state->repeat) {
+		event = script->event_list;
+		script->event_list = event->next;
+		free_event(event);
+	}
+
+	if (!script->parsing)
+		return STATUS_OK;
+
+	/* Inside a repeat block, the script goes on after the block. */
+	event = state->repeat != NULL ? state->repeat : state->event;
+	for (event = event->next; event != NULL; event = event->next)
+		++ahead;
+	while (script->parsing && ahead < state->config->stream_window) {
+		int num_events = script->num_events;
+
+		if (parse_script_next_event(script)) {
+			asprintf(error, "%s: error parsing script\n",
+				 state->config->script_path);
+			return STATUS_ERR;
+		}
+		ahead += script->num_events - num_events;
+	}
+	return STATUS_OK;
+}
+
+/* Undo adjust_relative_event_times(), so the event can run again. */
+static void rewind_relative_event_times(struct event *event)
+{
+	if (event->offset_usecs == NO_TIME_RANGE)
+		return;
+
+	event->time_usecs -= event->offset_usecs;
+	if (event->time_type == RELATIVE_RANGE_TIME)
+		event->time_usecs_end -= event->offset_usecs;
+
+	if (event->time_type == RELATIVE_TIME &&
+	    event->type == SYSCALL_EVENT &&
+	    is_blocking_syscall(event->event.syscall)) {
+		event->event.syscall->end_usecs -= event->offset_usecs;
+	}
+	event->offset_usecs = NO_TIME_RANGE;
+}
+
+/* Get the events of a repeat block ready to run another time: rewind
+ * their times and take fresh copies of their packets, advanced past
+ * the sequence space and time of the runs before.
+ */
+static int rewind_repeat(struct state *state, struct repeat_spec *repeat,
+			 char **error)
+{
+	const s64 tick_usecs = state->config->tcp_ts_tick_usecs ?
+		state->config->tcp_ts_tick_usecs : 1000;
+	const u32 inbound_offset = repeat->iteration * repeat->inbound_seq_bytes;
+	const u32 outbound_offset =
+		repeat->iteration * repeat->outbound_seq_bytes;
+	const u32 ts_offset =
+		repeat->iteration * repeat->duration_usecs / tick_usecs;
+	struct event *event = NULL;
+	int i = 0;
+
+	for (event = repeat->events; event != NULL; event = event->next) {
+		struct packet *packet = NULL;
+
+		rewind_relative_event_times(event);
+		if (event->type != PACKET_EVENT)
+			continue;
+
+		assert(i < repeat->num_packets);
+		packet = packet_copy(repeat->packets[i++]);
+		packet_free(event->event.packet);
+		event->event.packet = packet;
+		if (packet_direction(packet) == DIRECTION_INBOUND ?
+		    offset_script_packet(packet, inbound_offset,
+					 outbound_offset, ts_offset, error) :
+		    offset_script_packet(packet, outbound_offset,
+					 inbound_offset, ts_offset, error))
+			return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* If the current event is a repeat block, move into its events, and
+ * when we have run the last event of a block, run the block again or
+ * move on past it.
+ */
+static int step_through_repeats(struct state *state, char **error)
+{
+	while (1) {
+		if (state->event == NULL && state->repeat != NULL) {
+			struct repeat_spec *repeat = state->repeat->event.repeat;
+
+			if (++repeat->iteration < repeat->count) {
+				if (rewind_repeat(state, repeat, error))
+					return STATUS_ERR;
+				state->event = repeat->events;
+			} else {
+				state->event = state->repeat->next;
+				state->repeat = NULL;
+			}
+		} else if (state->event != NULL &&
+			   state->event->type == REPEAT_EVENT) {
+			state->repeat = state->event;
+			state->repeat->event.repeat->iteration = 0;
+			state->event = state->repeat->event.repeat->events;
+		} else {
+			return STATUS_OK;
+		}
+	}
+}
+
+/* Kernel timers a --time_scale gap may cut across, shortest first: if
+ * the script waits past one of these, shortening the wait may keep the
+ * timer from firing when it did before. We assume Linux defaults.
+ */
+static const struct {
+	s64 usecs;
+	const char *name;
+} kernel_timers[] = {
+	{ 40000,	"minimum delayed ACK timeout" },
+	{ 200000,	"minimum RTO" },
+	{ 1000000,	"initial RTO" },
+};
+
+/* Can --time_scale shorten the gap before this event? Only if we start
+ * the event, at its time, rather than waiting for the kernel; and not
+ * in a repeat block, whose relative times are reused each time around;
+ * and not after a peer or syn_flood event, whose duration that gap is.
+ */
+static bool is_scalable_event(struct state *state, struct event *event)
+{
+	if (state->repeat != NULL || state->last_event == NULL ||
+	    state->last_event->type == PEER_EVENT ||
+	    state->last_event->type == SYN_FLOOD_EVENT)
+		return false;
+	if (event->time_type != ABSOLUTE_TIME &&
+	    event->time_type != RELATIVE_TIME)
+		return false;
+	switch (event->type) {
+	case PACKET_EVENT:
+		return packet_direction(event->event.packet) ==
+			DIRECTION_INBOUND;
+	case SYSCALL_EVENT:
+	case COMMAND_EVENT:
+	case CODE_EVENT:
+	case MP_JOIN_STORM_EVENT:
+	case PEER_EVENT:
+	case SYN_FLOOD_EVENT:
+		return true;
+	case METER_EVENT:
+	case INTERLEAVE_EVENT:
+	case REPEAT_EVENT:
+	case INVALID_EVENT:
+	case NUM_EVENT_TYPES:
+		return false;
+	/* We omit default case so compiler catches missing values. */
+	}
+	return false;
+}
+
+/* Move an event's times earlier by the given amount. */
+static void shift_event_time(struct event *event, s64 usecs)
+{
+	event->time_usecs -= usecs;
+	if (event->time_usecs_end != NO_TIME_RANGE)
+		event->time_usecs_end -= usecs;
+	if (event->type == SYSCALL_EVENT &&
+	    is_blocking_syscall(event->event.syscall))
+		event->event.syscall->end_usecs -= usecs;
+}
+
+/* With --time_scale, shorten a long gap before an event we start by
+ * the given factor, and move all later absolute times up by as much.
+ * Gaps before outbound packets are the kernel's to keep, so they stay.
+ */
+static void scale_event_time(struct state *state, struct event *event)
+{
+	const struct config *config = state->config;
+	s64 gap_usecs, scaled_usecs;
+	int i;
+
+	if (is_event_time_absolute(event))
+		shift_event_time(event, state->time_scale_saved_usecs);
+	if (!is_scalable_event(state, event))
+		return;
+
+	if (event->time_type == RELATIVE_TIME)
+		gap_usecs = event->time_usecs;
+	else
+		gap_usecs = event->time_usecs - state->script_last_time_usecs;
+	if (gap_usecs < config->time_scale_min_gap_usecs)
+		return;
+	scaled_usecs = gap_usecs / config->time_scale;
+
+	for (i = ARRAY_SIZE(kernel_timers) - 1; i >= 0; --i) {
+		if (gap_usecs >= kernel_timers[i].usecs &&
+		    scaled_usecs < kernel_timers[i].usecs) {
+			fprintf(stderr, "%s:%d: warning: --time_scale shortens "
+				"a %.3f sec gap to %.3f sec, below the "
+				"kernel's %s of %.3f sec\n",
+				config->script_path, event->line_number,
+				gap_usecs / 1.0e6, scaled_usecs / 1.0e6,
+				kernel_timers[i].name,
+				kernel_timers[i].usecs / 1.0e6);
+			break;
+		}
+	}
+
+	shift_event_time(event, gap_usecs - scaled_usecs);
+	state->time_scale_saved_usecs += gap_usecs - scaled_usecs;
 }
 
 int get_next_event(struct state *state, char **error)
@@ -341,6 +1168,8 @@ int get_next_event(struct state *state, char **error)
 	if (state->event == NULL) {
 		/* First event. */
 		state->event = state->script->event_list;
+		if (step_through_repeats(state, error))
+			return STATUS_ERR;
 		state->script_start_time_usecs = state->event->time_usecs;
 		if (state->event->time_usecs != 0) {
 			asprintf(error,
@@ -354,18 +1183,24 @@ int get_next_event(struct state *state, char **error)
 		state->script_last_time_usecs = state->event->time_usecs;
 		state->last_event = state->event;
 		state->event = state->event->next;
+		if (step_through_repeats(state, error))
+			return STATUS_ERR;
 	}
 
 	if (state->event == NULL)
 		return STATUS_OK;	/* script is done */
 
+	if (stream_script_events(state, error))
+		return STATUS_ERR;
+
 	assert((state->event->type > INVALID_EVENT) &&
 	       (state->event->type < NUM_EVENT_TYPES));
 
 	if (state->last_event &&
 	    is_event_time_absolute(state->last_event) &&
 	    is_event_time_absolute(state->event) &&
-	    state->event->time_usecs < state->script_last_time_usecs) {
+	    state->event->time_usecs - state->time_scale_saved_usecs <
+	    state->script_last_time_usecs) {
 		asprintf(error,
 			 "%s:%d: time goes backward in script "
 			 "from %lld usec to %lld usec\n",
@@ -375,6 +1210,8 @@ int get_next_event(struct state *state, char **error)
 			 state->event->time_usecs);
 		return STATUS_ERR;
 	}
+	if (state->config->time_scale > 1)
+		scale_event_time(state, state->event);
 	return STATUS_OK;
 }
 
@@ -430,15 +1267,41 @@ void set_scheduling_priority(void)
 #endif  /* !defined(__OpenBSD__) */
 }
 
+void set_cpu_affinity(const char *device)
+{
+	char *error = NULL;
+
+	if (cpu_affinity_check(device, &error))
+		die("%s\n", error);
+	cpu_affinity_pin(CPU_ROLE_MAIN);
+}
+
 /* To ensure timing that's as consistent as possible, pull all our
- * pages to RAM and pin them there.
+ * pages to RAM and pin them there. First fork the helper that runs
+ * shell commands, while forking is still cheap.
  */
-void lock_memory(void)
+void lock_memory(struct config *config)
 {
-	if (mlockall(MCL_CURRENT | MCL_FUTURE))
+	system_helper_start();
+	if (config->mlock == MLOCK_ALL &&
+	    mlockall(MCL_CURRENT | MCL_FUTURE))
 		die_perror("lockall(MCL_CURRENT | MCL_FUTURE)");
 }
 
+/* By default Linux may defer timer expiry of non-realtime threads by up
+ * to 50us, to batch wakeups. For the timer and epoll schedulers that
+ * delay is exactly the imprecision we want to avoid, so use the
+ * minimum slack.
+ */
+void set_timer_slack(struct config *config)
+{
+#ifdef linux
+	if (config->scheduler != SCHEDULER_SPIN &&
+	    prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0) < 0)
+		die_perror("prctl(PR_SET_TIMERSLACK)");
+#endif
+}
+
 /* Wait for and return the wall time at which we should start the
  * test, in microseconds. To make test results more reproducible, we
  * wait for a start time that is well into the middle of a Linux jiffy
@@ -458,7 +1321,7 @@ void lock_memory(void)
  * effects. We could do fancier measuring and filtering here, but so
  * far this level of complexity seems sufficient.
  */
-static s64 schedule_start_time_usecs(void)
+s64 schedule_start_time_usecs(void)
 {
 #ifdef linux
 	s64 start_usecs = 0;
@@ -483,15 +1346,13 @@ static s64 schedule_start_time_usecs(void)
 
 void run_script(struct config *config, struct script *script)
 {
-	char *error = NULL;
-	struct state *state = NULL;
 	struct netdev *netdev = NULL;
-	struct event *event = NULL;
 
 	DEBUGP("run_script: running script\n");
 
 	set_scheduling_priority();
-	lock_memory();
+	lock_memory(config);
+	set_timer_slack(config);
 
 	/* This interpreter loop runs for local mode or wire client mode. */
 	assert(!config->is_wire_server);
@@ -503,14 +1364,138 @@ void run_script(struct config *config, struct script *script)
 		netdev = wire_client_netdev_new(config);
 	else
 		netdev = local_netdev_new(config);
+	set_cpu_affinity(config->is_wire_client ?
+			 NULL : local_netdev_name(netdev));
+
+	run_script_on_netdev(config, script, netdev);
+}
+
+/* With --fuzz, once the script is done, mutate the packets it
+ * injected and inject the variants through the same netdev. We probe
+ * the live socket of the connection for lockups, if it is still open.
+ */
+static void run_fuzzer(struct state *state)
+{
+	struct socket *socket = NULL;
+	char *error = NULL;
+	int probe_fd = -1;
+
+	for (socket = state->sockets; socket != NULL; socket = socket->next) {
+		if (socket->protocol == IPPROTO_TCP &&
+		    socket->live.fd >= 0 && !socket->is_closed) {
+			probe_fd = socket->live.fd;
+			break;
+		}
+	}
+	fuzzer_start(state->fuzzer, probe_fd);
+	fuzzer_set_script(state->fuzzer, state->script->buffer,
+			  state->script->length);
+	if (fuzzer_run(state->fuzzer, state->config, state->netdev, &error))
+		die("%s: %s\n", state->config->script_path, error);
+}
+
+/* Run the given event, whose relative times are already adjusted. */
+void run_event(struct state *state, struct event *event)
+{
+	struct config *config = state->config;
+	struct perf_sample perf_start;
+	char *error = NULL;
+
+	PROBE3(event_start, event->line_number, event->type,
+	       event->time_usecs);
+	if (state->kernel_timeline != NULL)
+		kernel_timeline_event(state->kernel_timeline,
+				      event->line_number,
+				      event_description(event));
+	perf_phase_begin(&perf_start);
+	if (line_profile_on)
+		line_profile_line(event->line_number);
+
+	switch (event->type) {
+	case PACKET_EVENT:
+		/* For wire clients, the server handles packets. A
+		 * pipelined client still keeps to their times, since
+		 * it does not wait for the server to finish them.
+		 */
+		if (!config->is_wire_client) {
+			run_local_packet_event(state, event,
+					       event->event.packet);
+		} else if (config->wire_pipeline &&
+			   event->time_type != ANY_TIME) {
+			wait_for_event(state);
+		}
+		break;
+	case SYSCALL_EVENT:
+		run_system_call_event(state, event,
+				      event->event.syscall);
+		break;
+	case COMMAND_EVENT:
+		run_command_event(state, event,
+				  event->event.command);
+		break;
+	case CODE_EVENT:
+		run_code_event(state, event,
+			       event->event.code->text);
+		break;
+	case METER_EVENT:
+		if (run_meter_event(state, event, event->event.meter, &error))
+			die("%s", error);
+		break;
+	case MP_JOIN_STORM_EVENT:
+		if (run_mp_join_storm_event(state, event,
+					    event->event.mp_join_storm, &error))
+			die("%s", error);
+		break;
+	case PEER_EVENT:
+		if (run_peer_event(state, event, event->event.peer, &error))
+			die("%s", error);
+		break;
+	case SYN_FLOOD_EVENT:
+		if (run_syn_flood_event(state, event, event->event.syn_flood,
+					&error))
+			die("%s", error);
+		break;
+	case INTERLEAVE_EVENT:
+		if (run_interleave_event(state, event,
+					 event->event.interleave, &error))
+			die("%s", error);
+		break;
+	case REPEAT_EVENT:	/* get_next_event() steps into these */
+	case INVALID_EVENT:
+	case NUM_EVENT_TYPES:
+		assert(!"bogus type");
+		break;
+	/* We omit default case so compiler catches missing values. */
+	}
+	perf_phase_end(event_perf_phase(event), &perf_start);
+	PROBE2(event_end, event->line_number, event->type);
+}
+
+void run_script_on_netdev(struct config *config, struct script *script,
+			  struct netdev *netdev)
+{
+	char *error = NULL;
+	struct state *state = NULL;
+	struct event *event = NULL;
+	struct kernel_state *kernel_state = NULL;
 
 	state = state_new(config, script, netdev);
 
+	if (config->is_wire_client && config->fuzz_variants > 0)
+		die("--fuzz needs a local netdev, not --wire_client\n");
+
 	if (config->is_wire_client) {
 		state->wire_client = wire_client_new();
 		wire_client_init(state->wire_client, config, script, state);
 	}
 
+	if (config->reset_kernel_state) {
+		kernel_state = kernel_state_new(&error);
+		if (kernel_state == NULL)
+			die("%s: --reset_kernel_state: %s\n",
+			    config->script_path, error);
+	}
+
 	if (script->init_command != NULL) {
 		if (safe_system(script->init_command->command_line,
 				&error)) {
@@ -521,9 +1506,27 @@ void run_script(struct config *config, struct script *script)
 
 	signal(SIGPIPE, SIG_IGN);	/* ignore EPIPE */
 
+	/* Note the kernel's MIB counters, for mib_delta() calls, the
+	 * --timing_report and --mib_per_event.
+	 */
+	state->mib = mib_new(&error);
+	if (state->mib != NULL && mib_start(state->mib, &error)) {
+		mib_free(state->mib);
+		state->mib = NULL;
+	}
+	if (state->mib == NULL) {
+		DEBUGP("not following MIB counters: %s\n", error);
+		free(error);
+		error = NULL;
+	}
+
 	state->live_start_time_usecs = schedule_start_time_usecs();
 	DEBUGP("live_start_time_usecs is %lld\n",
 	       state->live_start_time_usecs);
+	if (state->tcp_info_log != NULL)
+		tcp_info_log_start(state->tcp_info_log,
+				   state->live_start_time_usecs,
+				   state->script_start_time_usecs);
 
 	if (state->wire_client != NULL)
 		wire_client_send_client_starting(state->wire_client);
@@ -544,38 +1547,36 @@ void run_script(struct config *config, struct script *script)
 		 */
 		adjust_relative_event_times(state, event);
 
-		switch (event->type) {
-		case PACKET_EVENT:
-			/* For wire clients, the server handles packets. */
-			if (!config->is_wire_client) {
-				run_local_packet_event(state, event,
-						       event->event.packet);
-			}
-			break;
-		case SYSCALL_EVENT:
-			run_system_call_event(state, event,
-					      event->event.syscall);
-			break;
-		case COMMAND_EVENT:
-			run_command_event(state, event,
-					  event->event.command);
-			break;
-		case CODE_EVENT:
-			run_code_event(state, event,
-				       event->event.code->text);
-			break;
-		case INVALID_EVENT:
-		case NUM_EVENT_TYPES:
-			assert(!"bogus type");
-			break;
-		/* We omit default case so compiler catches missing values. */
-		}
+		run_event(state, event);
+
+		if (config->mib_per_event && state->mib != NULL &&
+		    mib_record_event(state->mib, event->line_number, &error))
+			die("%s: %s\n", config->script_path, error);
 	}
 
 	/* Wait for any outstanding packet events we requested on the server. */
 	if (state->wire_client != NULL)
 		wire_client_next_event(state->wire_client, NULL);
 
+	if (finish_meters(state, &error))
+		die("%s: %s\n", config->script_path, error);
+
+	if (state->kernel_latency != NULL) {
+		kernel_latency_report(state->kernel_latency, stdout);
+		if (kernel_latency_check(state->kernel_latency,
+					 config->kernel_latency_limits,
+					 config->num_kernel_latency_limits,
+					 &error))
+			die("%s: %s\n", config->script_path, error);
+	}
+	if (state->dsn_coverage != NULL)
+		dsn_coverage_report(state->dsn_coverage, stdout);
+	if (state->self_stall != NULL)
+		self_stall_report(state->self_stall, stdout);
+
+	if (state->fuzzer != NULL)
+		run_fuzzer(state);
+
 	if (code_execute(state->code, &error)) {
 		die("%s: error executing code: %s\n",
 		    state->config->script_path, error);
@@ -585,14 +1586,43 @@ void run_script(struct config *config, struct script *script)
 
 	state_free(state);
 
+	if (kernel_state != NULL &&
+	    kernel_state_restore(kernel_state, &error))
+		die("%s: --reset_kernel_state: %s\n",
+		    config->script_path, error);
+
 	DEBUGP("run_script: done running\n");
 }
 
-int parse_script_and_set_config(int argc, char *argv[],
-				struct config *config,
-				struct script *script,
-				const char *script_path,
-				const char *script_buffer)
+/* Set up the config and script, from the given image of the parse if
+ * there is one, or else from the --script_cache, or else by parsing.
+ */
+/* With --replay_pcap, append the packets of the capture to the script.
+ * We do this after caching the script, since the cache key does not
+ * cover the capture, and not for a parsed script image from a wire
+ * client, which already has them.
+ */
+static int append_replay_events(struct config *config, struct script *script)
+{
+	char *error = NULL;
+
+	if (config->replay_pcap == NULL)
+		return STATUS_OK;
+	if (pcap_replay_append(config, script, &error)) {
+		fprintf(stderr, "%s\n", error);
+		free(error);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+static int set_up_script_and_config(int argc, char *argv[],
+				    struct config *config,
+				    struct script *script,
+				    const char *script_path,
+				    const char *script_buffer,
+				    const void *image, int image_len,
+				    const u8 *image_key)
 {
 	struct invocation invocation = {
 		.argc = argc,
@@ -600,6 +1630,9 @@ int parse_script_and_set_config(int argc, char *argv[],
 		.config = config,
 		.script = script,
 	};
+	u8 cache_key[SHA1_DIGEST_BYTES];
+	char *cache_dir = NULL;
+	int result;
 
 	DEBUGP("parse_and_run_script: %s\n", script_path);
 	assert(script_path != NULL);
@@ -617,7 +1650,67 @@ int parse_script_and_set_config(int argc, char *argv[],
 	else
 		read_script(script_path, script);
 
-	return parse_script(config, script, &invocation);
+	if (image != NULL &&
+	    script_cache_decode(image, image_len, image_key,
+				&invocation) == STATUS_OK)
+		return STATUS_OK;
+
+	/* With --script_cache we may be able to skip the parser. */
+	cache_dir = script_cache_dir(argc, argv);
+	if (cache_dir != NULL) {
+		script_cache_key(script, argc, argv, cache_key);
+		if (script_cache_load(cache_dir, cache_key,
+				      &invocation) == STATUS_OK) {
+			free(cache_dir);
+			return append_replay_events(config, script);
+		}
+	}
+
+	result = parse_script(config, script, &invocation);
+	if (result == STATUS_OK && cache_dir != NULL)
+		script_cache_store(cache_dir, cache_key, script);
+	free(cache_dir);
+	if (result == STATUS_OK)
+		result = append_replay_events(config, script);
+	return result;
+}
+
+int parse_script_and_set_config(int argc, char *argv[],
+				struct config *config,
+				struct script *script,
+				const char *script_path,
+				const char *script_buffer)
+{
+	return set_up_script_and_config(argc, argv, config, script,
+					script_path, script_buffer,
+					NULL, 0, NULL);
+}
+
+int parse_script_image_and_set_config(int argc, char *argv[],
+				      struct config *config,
+				      struct script *script,
+				      const char *script_path,
+				      const char *script_buffer,
+				      const void *image, int image_len,
+				      const u8 image_key[SHA1_DIGEST_BYTES])
+{
+	return set_up_script_and_config(argc, argv, config, script,
+					script_path, script_buffer,
+					image, image_len, image_key);
+}
+
+void run_init_scripts(struct config *config)
+{
+	const char *failed = NULL;
+	char *error = NULL;
+
+	if (config->init_scripts == NULL)
+		return;
+
+	if (prelude_run(prelude_get(config->init_scripts), &failed, &error)) {
+		die("%s: error executing init script '%s': %s\n",
+		    config->script_path, failed, error);
+	}
 }
 
 void print_socket_list(struct state *state)
@@ -62,17 +62,37 @@
 #include <sys/socket.h>
 #include "code.h"
 #include "config.h"
+#include "dsn_coverage.h"
+#include "self_stall.h"
+#include "fuzz.h"
+#include "memlock.h"
 #include "netdev.h"
+#include "prng.h"
 #include "run_packet.h"
 #include "run_system_call.h"
 #include "script.h"
+#include "sha1.h"
 #include "socket.h"
+#include "tcp_info_log.h"
+#include "timing_stats.h"
 #include "wire_client.h"
 
 /* Public top-level entry point for executing a test script */
 extern void run_script(struct config *config,
 		       struct script *script);
 
+/* Execute a test script using the given, already set up, netdev. The
+ * netdev is freed when the script is done.
+ */
+extern void run_script_on_netdev(struct config *config,
+				 struct script *script,
+				 struct netdev *netdev);
+
+/* Run the comma-separated --init_scripts commands, if any, from the
+ * prelude parsed for them (see prelude.h).
+ */
+extern void run_init_scripts(struct config *config);
+
 /* Public entry-point to parse a script and finalize config. If the
  * script_buffer is provided, parse that. Otherwise, read the file
  * with the given path, parse that.
@@ -83,25 +103,88 @@ extern int parse_script_and_set_config(int argc, char *argv[],
 				       const char *script_path,
 				       const char *script_buffer);
 
+/* Like parse_script_and_set_config(), but first try to rebuild the
+ * script from the given image of its parse, as made by
+ * script_cache_encode() with the given key, falling back to parsing
+ * script_buffer if the image does not fit.
+ */
+extern int parse_script_image_and_set_config(
+	int argc, char *argv[], struct config *config,
+	struct script *script, const char *script_path,
+	const char *script_buffer, const void *image, int image_len,
+	const u8 image_key[SHA1_DIGEST_BYTES]);
+
 /* Private implementation details follow below... */
 
-/* All the runtime state for a test. */
+/* Precision achieved by wait_for_event() over all events waited for. */
+struct wakeup_stats {
+	s64 num_waits;			/* events we waited for */
+	s64 total_error_usecs;		/* sum of wakeup errors */
+	s64 max_error_usecs;		/* worst wakeup error */
+};
+
+/* All the runtime state for a test. The global lock protects all of
+ * it, except for parts the main thread alone changes while the test
+ * runs (the config, script, event cursor and start times), which it
+ * may read without the lock. Helpers with threads of their own (the
+ * sniffer, tcp_info_log, packet_trace and the log sink) synchronize
+ * those threads themselves, so they never take the global lock.
+ */
 struct state {
 	pthread_mutex_t mutex;		/* global lock for all global state */
 	struct config *config;		/* test configuration */
 	struct netdev *netdev;		/* for sending/receiving TCP packets */
 	struct packets *packets;	/* for processing packets */
+	struct packet_pool *packet_pool;	/* for sniffed/injected packets */
 	struct syscalls *syscalls;	/* for running system calls */
 	struct socket *sockets;		/* list of all live sockets */
+	struct socket_table *socket_table;	/* indexes into sockets */
 	struct socket *socket_under_test;	/* socket handling packets */
 	struct script *script;			/* script we're running */
 	struct event *event;			/* the current event */
 	struct event *last_event;		/* previous event */
+	struct event *repeat;			/* repeat block we are in, or NULL */
 	struct code_state *code;	/* for running post-processing code */
 	struct wire_client *wire_client;	/* for on-the-wire tests */
 	s64 script_start_time_usecs;	/* time of first event in script */
 	s64 script_last_time_usecs;	/* time of previous event in script */
+	s64 time_scale_saved_usecs;	/* script time --time_scale took out
+					 * of the gaps so far
+					 */
 	s64 live_start_time_usecs;	/* time of first event in live test */
+	struct wakeup_stats wakeup_stats;	/* wait_for_event() precision */
+	struct prng prng;		/* random keys, numbers and ports */
+	struct timing_stats *timing;	/* for --timing_report, or NULL */
+	struct tcp_info_log *tcp_info_log;	/* for --tcp_info_log, or NULL */
+	bool perf_counters;		/* did we turn on --perf_counters? */
+	struct kernel_latency *kernel_latency;	/* for --kernel_latency,
+						 * or NULL
+						 */
+	struct kernel_timeline *kernel_timeline;	/* for
+							 * --kernel_timeline,
+							 * or NULL
+							 */
+	struct dsn_coverage *dsn_coverage;	/* for --dsn_coverage, or
+						 * NULL
+						 */
+	struct self_stall *self_stall;	/* for --self_stall, or NULL */
+	struct memlock *memlock;	/* for --mlock=hot, or NULL */
+	struct event_loop *event_loop;	/* for --scheduler=epoll, or NULL */
+	struct fuzzer *fuzzer;		/* for --fuzz, or NULL */
+	struct ack_aggregator *ack_aggregator;	/* for --ack_aggregation,
+						 * or NULL
+						 */
+	struct mib *mib;		/* kernel MIB counters, or NULL */
+	u32 num_checksum_skipped;	/* sniffed packets since the last one
+					 * --verify_checksums=sampled checked
+					 */
+	int num_injected_ahead;		/* following packet events we already
+					 * injected along with an earlier one
+					 */
+	int next_address_pool;		/* pool of the next connection or
+					 * subflow we open (see
+					 * config_pool_addresses())
+					 */
 };
 
 /* Allocate all run-time state for executing a test script. */
@@ -157,10 +240,14 @@ static inline s64 live_time_to_script_time_usecs(struct state *state,
  * for the common case: it looks at the current event and on failure
  * it prints the error message to stderr and exits with an error
  * status.  For time ranges the end time is specified in script_usecs_end.
+ * With --timing_report, the error is also recorded under the given kind
+ * of event and the script line of the event.
  */
 extern int verify_time(struct state *state, enum event_time_t time_type,
 		       s64 script_usecs, s64 script_usecs_end,
-		       s64 live_usecs, const char *description, char **error);
+		       s64 live_usecs, enum timing_event_t timing,
+		       int line_number, const char *description,
+		       char **error);
 extern void check_event_time(struct state *state, s64 live_usecs);
 
 /* Set the start (and end time, if applicable) for the event if it
@@ -169,20 +256,50 @@ extern void check_event_time(struct state *state, s64 live_usecs);
 extern void adjust_relative_event_times(struct state *state,
 					struct event *event);
 
+/* Like adjust_relative_event_times(), but count relative times from the
+ * given live time rather than from now.
+ */
+extern void adjust_relative_event_times_from(struct state *state,
+					     struct event *event,
+					     s64 live_usecs);
+
 /*
  * Sleep and/or spin until the time at which we want the current event
- * to happen.
+ * to happen. The caller holds the global lock; we release it while we
+ * wait and hold it again when we return.
  */
 extern void wait_for_event(struct state *state);
 
 /* Advance the interpreter state to the next event. */
 extern int get_next_event(struct state *state, char **error);
 
+/* Run the given event, whose relative times are already adjusted.
+ * Exits on error.
+ */
+extern void run_event(struct state *state, struct event *event);
+
+/* Wait for and return a live start time for a test in microseconds,
+ * well into the middle of a jiffy.
+ */
+extern s64 schedule_start_time_usecs(void);
+
 /* Set a higher priority for ourselves, to reduce test timing noise. */
 extern void set_scheduling_priority(void);
 
-/* Try to pin our pages into RAM. */
-extern void lock_memory(void);
+/* Check the CPUs given with --main_cpus and friends, steer receive
+ * processing of the given device (if not NULL) as --rps_cpus asks, and
+ * pin the calling thread as the main thread. Dies on error.
+ */
+extern void set_cpu_affinity(const char *device);
+
+/* Try to pin our pages into RAM, if --mlock=all (the default). With
+ * --mlock=hot, state_new() locks just the hot working set instead.
+ * Before that, start the helper that runs shell commands.
+ */
+extern void lock_memory(struct config *config);
+
+/* Ask the kernel for precise timer expiry if we sleep on timers. */
+extern void set_timer_slack(struct config *config);
 
 extern void print_socket_list(struct state *state);
 
@@ -0,0 +1,844 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation for running many test scripts in parallel.
+ */
+
+#include "run_jobs.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <glob.h>
+#include <limits.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "logging.h"
+#include "junit_report.h"
+#include "netdev.h"
+#include "placement.h"
+#include "prelude.h"
+#include "results_db.h"
+#include "run.h"
+#include "script.h"
+#include "symbols.h"
+
+/* A script path to run, and the worker running it, if any. */
+struct job {
+	char *script_path;
+	pid_t pid;		/* worker pid, or 0 if not running */
+	int slot;		/* worker slot, for its placement */
+	FILE *output;		/* worker's captured stdout and stderr */
+	s64 start_usecs;	/* when the worker was forked */
+	u8 results_key[SHA1_DIGEST_BYTES];	/* key in --results_db */
+	enum results_history_t history;	/* from --results_db */
+};
+
+/* With --fork_server, the template process of a worker slot, which
+ * has done the expensive setup once and forks a child per script (see
+ * fork_server_loop()).
+ */
+struct fork_server {
+	pid_t pid;		/* template process, or 0 if not running */
+	int fd;			/* our end of the socketpair to it */
+};
+
+/* A growable list of script paths. */
+struct path_list {
+	char **paths;
+	int num_paths;
+	int max_paths;
+};
+
+static void path_list_add(struct path_list *list, const char *path)
+{
+	if (list->num_paths == list->max_paths) {
+		list->max_paths = list->max_paths ? 2 * list->max_paths : 64;
+		list->paths = realloc(list->paths,
+				      list->max_paths * sizeof(char *));
+		if (list->paths == NULL)
+			die_perror("realloc");
+	}
+	list->paths[list->num_paths++] = strdup(path);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static bool is_script_name(const char *name)
+{
+	int len = strlen(name);
+
+	return len > 4 && strcmp(name + len - 4, ".pkt") == 0;
+}
+
+/* Is the path a glob pattern, rather than a file that exists? */
+static bool is_glob(const char *path)
+{
+	struct stat st;
+
+	return strpbrk(path, "*?[") != NULL && stat(path, &st) < 0;
+}
+
+/* Add the given path if it is a file, or all the *.pkt files under it,
+ * in sorted order, if it is a directory. A glob pattern, quoted to keep
+ * the shell from expanding it, adds each path it matches.
+ */
+static void add_script_paths(struct path_list *list, const char *path)
+{
+	struct path_list dir_list;
+	struct dirent *entry;
+	struct stat st;
+	glob_t matches;
+	DIR *dir;
+	int i;
+
+	if (is_glob(path)) {
+		if (glob(path, 0, NULL, &matches) != 0)
+			die("error: no match for %s\n", path);
+		for (i = 0; i < matches.gl_pathc; i++)
+			add_script_paths(list, matches.gl_pathv[i]);
+		globfree(&matches);
+		return;
+	}
+
+	if (stat(path, &st) < 0)
+		die_perror((char *)path);
+	if (!S_ISDIR(st.st_mode)) {
+		path_list_add(list, path);
+		return;
+	}
+
+	dir = opendir(path);
+	if (dir == NULL)
+		die_perror((char *)path);
+	memset(&dir_list, 0, sizeof(dir_list));
+	while ((entry = readdir(dir)) != NULL) {
+		char *child = NULL;
+
+		if (entry->d_name[0] == '.')
+			continue;
+		asprintf(&child, "%s/%s", path, entry->d_name);
+		if (stat(child, &st) == 0 &&
+		    (S_ISDIR(st.st_mode) || is_script_name(entry->d_name)))
+			path_list_add(&dir_list, child);
+		free(child);
+	}
+	closedir(dir);
+
+	qsort(dir_list.paths, dir_list.num_paths, sizeof(char *),
+	      compare_paths);
+	for (i = 0; i < dir_list.num_paths; i++) {
+		add_script_paths(list, dir_list.paths[i]);
+		free(dir_list.paths[i]);
+	}
+	free(dir_list.paths);
+}
+
+#ifdef linux
+/* A new network namespace only has a loopback device, and it is down. */
+static void bring_up_loopback(void)
+{
+	struct ifreq ifr;
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (fd < 0)
+		die_perror("socket");
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, "lo", IFNAMSIZ - 1);
+	if (ioctl(fd, SIOCGIFFLAGS, &ifr) < 0)
+		die_perror("SIOCGIFFLAGS lo");
+	ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+	if (ioctl(fd, SIOCSIFFLAGS, &ifr) < 0)
+		die_perror("SIOCSIFFLAGS lo");
+	close(fd);
+}
+#endif /* linux */
+
+/* Body of a worker process: isolate ourselves, then parse and run the
+ * script just as a serial packetdrill invocation would. Test failures
+ * call die(), so reaching the end means the script passed. With
+ * --dry_run there is no netdev, so nothing to isolate.
+ */
+static void run_job(int argc, char *argv[], struct config *config,
+		    const struct placement *placement, struct job *job)
+{
+	struct script script;
+	char *error = NULL;
+
+	if (placement != NULL &&
+	    placement_enter(placement, job->slot, &error))
+		die("placement: %s\n", error);
+
+#ifdef linux
+	if (!config->dry_run) {
+		if (unshare(CLONE_NEWNET) < 0)
+			die_perror("unshare(CLONE_NEWNET)");
+		bring_up_loopback();
+	}
+#endif /* linux */
+
+	if (parse_script_and_set_config(argc, argv, config, &script,
+					job->script_path, NULL))
+		exit(EXIT_FAILURE);
+
+#ifdef linux
+	/* Our namespace, and every connection in it, dies with us. */
+	config->skip_teardown = true;
+#endif /* linux */
+
+	if (!config->dry_run) {
+		run_init_scripts(config);
+		run_script(config, &script);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+/* Body of a child of a fork server template: run one script on the
+ * template's tun device, as the daemon's children do. The namespace
+ * outlives us, so unlike run_job() we tear down our connections.
+ */
+static void fork_server_child(int argc, char *argv[], struct netdev *netdev,
+			      const char *script_path)
+{
+	struct config config;
+	struct script script;
+
+	if (parse_script_and_set_config(argc, argv, &config, &script,
+					script_path, NULL))
+		exit(EXIT_FAILURE);
+
+	/* Memory locks are not inherited across fork(). */
+	lock_memory(&config);
+	run_init_scripts(&config);
+	local_netdev_reset(netdev, &config);
+	run_script_on_netdev(&config, &script, netdev);
+	exit(EXIT_SUCCESS);
+}
+
+/* Read the next script path, and the file to send its output to, from
+ * the runner. Returns STATUS_ERR once the runner has hung up.
+ */
+static int fork_server_receive(int fd, char *script_path, int *output_fd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { script_path, PATH_MAX - 1 };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	ssize_t len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	do {
+		len = recvmsg(fd, &msg, 0);
+	} while (len < 0 && errno == EINTR);
+	if (len <= 0)
+		return STATUS_ERR;
+	script_path[len] = '\0';
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS)
+		die("fork server: no output file for %s\n", script_path);
+	memcpy(output_fd, CMSG_DATA(cmsg), sizeof(*output_fd));
+	return STATUS_OK;
+}
+
+/* Body of a fork server template. Do once what every script would
+ * otherwise do for itself: enter the slot's placement, move into a
+ * fresh network namespace, lock memory, create the tun device, and
+ * build the symbol index; the prelude the runner already parsed. Then
+ * fork a child per script, which inherits all of that copy-on-write,
+ * and send back its wait status, until the runner hangs up.
+ */
+static void fork_server_loop(int argc, char *argv[], struct config *config,
+			     const struct placement *placement, int slot,
+			     int fd)
+{
+	char script_path[PATH_MAX];
+	struct netdev *netdev;
+	char *error = NULL;
+
+	if (placement != NULL &&
+	    placement_enter(placement, slot, &error))
+		die("placement: %s\n", error);
+
+#ifdef linux
+	if (unshare(CLONE_NEWNET) < 0)
+		die_perror("unshare(CLONE_NEWNET)");
+	bring_up_loopback();
+#endif /* linux */
+
+	finalize_config(config);
+	set_scheduling_priority();
+	lock_memory(config);
+	set_timer_slack(config);
+	netdev = local_netdev_new(config);
+	set_cpu_affinity(local_netdev_name(netdev));
+	symbol_index_init();
+
+	while (1) {
+		int output_fd = -1, status = 0;
+		pid_t pid;
+
+		if (fork_server_receive(fd, script_path, &output_fd))
+			break;
+
+		fflush(stdout);
+		fflush(stderr);
+		pid = fork();
+		if (pid < 0)
+			die_perror("fork");
+		if (pid == 0) {
+			close(fd);
+			if (dup2(output_fd, STDOUT_FILENO) < 0 ||
+			    dup2(output_fd, STDERR_FILENO) < 0)
+				die_perror("dup2");
+			close(output_fd);
+			fork_server_child(argc, argv, netdev, script_path);
+		}
+		close(output_fd);
+
+		while (waitpid(pid, &status, 0) < 0) {
+			if (errno != EINTR)
+				die_perror("waitpid");
+		}
+		if (write(fd, &status, sizeof(status)) != sizeof(status))
+			break;
+	}
+
+	/* Skip the runner's atexit() handlers; our namespace and tun
+	 * device go away with us.
+	 */
+	_exit(EXIT_SUCCESS);
+}
+
+/* Start the template process of the given worker slot. */
+static void fork_server_start(int argc, char *argv[], struct config *config,
+			      const struct placement *placement,
+			      struct fork_server *servers, int num_servers,
+			      int slot)
+{
+	int fds[2];
+	int i;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0)
+		die_perror("socketpair");
+
+	fflush(stdout);
+	fflush(stderr);
+	servers[slot].pid = fork();
+	if (servers[slot].pid < 0)
+		die_perror("fork");
+	if (servers[slot].pid == 0) {
+		/* Other templates must see the runner hang up. */
+		for (i = 0; i < num_servers; i++) {
+			if (servers[i].fd >= 0)
+				close(servers[i].fd);
+		}
+		close(fds[0]);
+		fork_server_loop(argc, argv, config, placement, slot, fds[1]);
+	}
+	close(fds[1]);
+	servers[slot].fd = fds[0];
+}
+
+/* Hang up on a template and reap it; return its wait status. */
+static int fork_server_stop(struct fork_server *server)
+{
+	int status = 0;
+
+	close(server->fd);
+	server->fd = -1;
+	while (waitpid(server->pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			die_perror("waitpid");
+	}
+	server->pid = 0;
+	return status;
+}
+
+/* Hand the job to its slot's template, starting the template if it
+ * is not running: the first time, or if it died.
+ */
+static void fork_server_run_job(int argc, char *argv[], struct config *config,
+				const struct placement *placement,
+				struct fork_server *servers, int num_servers,
+				struct job *job)
+{
+	struct fork_server *server = &servers[job->slot];
+	char control[CMSG_SPACE(sizeof(int))];
+	int output_fd = fileno(job->output);
+	struct iovec iov = { job->script_path, strlen(job->script_path) };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	int tries;
+
+	if (iov.iov_len >= PATH_MAX)
+		die("script path too long: %s\n", job->script_path);
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(output_fd));
+	memcpy(CMSG_DATA(cmsg), &output_fd, sizeof(output_fd));
+
+	for (tries = 0; tries < 2; tries++) {
+		if (server->pid == 0)
+			fork_server_start(argc, argv, config, placement,
+					  servers, num_servers, job->slot);
+		if (sendmsg(server->fd, &msg, MSG_NOSIGNAL) >= 0) {
+			job->pid = server->pid;
+			return;
+		}
+		fork_server_stop(server);
+	}
+	die("fork server for worker %d keeps exiting\n", job->slot);
+}
+
+struct worker_slots *worker_slots_new(int num_slots)
+{
+	struct worker_slots *slots = calloc(1, sizeof(struct worker_slots));
+	int i;
+
+	slots->jobs = calloc(num_slots, sizeof(int));
+	for (i = 0; i < num_slots; i++)
+		slots->jobs[i] = -1;
+	slots->num_slots = num_slots;
+	return slots;
+}
+
+void worker_slots_free(struct worker_slots *slots)
+{
+	free(slots->jobs);
+	memset(slots, 0, sizeof(*slots));  /* paranoia to help catch bugs */
+	free(slots);
+}
+
+int worker_slots_claim(struct worker_slots *slots, int job)
+{
+	int slot;
+
+	assert(job >= 0);
+	for (slot = 0; slot < slots->num_slots; slot++) {
+		if (slots->jobs[slot] < 0) {
+			slots->jobs[slot] = job;
+			slots->num_busy++;
+			return slot;
+		}
+	}
+	return -1;
+}
+
+int worker_slots_release(struct worker_slots *slots, int slot)
+{
+	int job;
+
+	assert(slot >= 0 && slot < slots->num_slots);
+	job = slots->jobs[slot];
+	if (job >= 0) {
+		slots->jobs[slot] = -1;
+		slots->num_busy--;
+	}
+	return job;
+}
+
+/* Wait until the template of one of the busy slots reports that its
+ * script finished, and return that slot, with the script's wait
+ * status in *status. If a template died instead, report its own.
+ */
+static int fork_server_wait(struct fork_server *servers,
+			    const struct worker_slots *slots, int *status)
+{
+	struct pollfd *fds = calloc(slots->num_slots, sizeof(struct pollfd));
+	int num_fds = 0, slot;
+	int i;
+
+	for (i = 0; i < slots->num_slots; i++) {
+		if (slots->jobs[i] < 0)
+			continue;
+		fds[num_fds].fd = servers[i].fd;
+		fds[num_fds].events = POLLIN;
+		num_fds++;
+	}
+	assert(num_fds > 0);
+	while (poll(fds, num_fds, -1) < 0) {
+		if (errno != EINTR)
+			die_perror("poll");
+	}
+
+	for (i = 0; i < num_fds; i++) {
+		if (fds[i].revents != 0)
+			break;
+	}
+	assert(i < num_fds);
+	for (slot = 0; servers[slot].fd != fds[i].fd; slot++)
+		;
+	free(fds);
+
+	if (read(servers[slot].fd, status, sizeof(*status)) !=
+	    sizeof(*status))
+		*status = fork_server_stop(&servers[slot]);
+	return slot;
+}
+
+static void start_job(int argc, char *argv[], struct config *config,
+		      const struct placement *placement,
+		      struct fork_server *servers, int num_servers,
+		      struct job *job)
+{
+	job->output = tmpfile();
+	if (job->output == NULL)
+		die_perror("tmpfile");
+
+	job->start_usecs = now_usecs();
+	if (servers != NULL) {
+		fork_server_run_job(argc, argv, config, placement,
+				    servers, num_servers, job);
+		return;
+	}
+
+	/* Don't let the worker inherit and re-print our buffered output. */
+	fflush(stdout);
+	fflush(stderr);
+
+	job->pid = fork();
+	if (job->pid < 0)
+		die_perror("fork");
+	if (job->pid == 0) {
+		if (dup2(fileno(job->output), STDOUT_FILENO) < 0 ||
+		    dup2(fileno(job->output), STDERR_FILENO) < 0)
+			die_perror("dup2");
+		run_job(argc, argv, config, placement, job);
+	}
+}
+
+/* Print the result of a finished worker, and record it in the results
+ * store and JUnit report, if any; return true if it passed.
+ */
+static bool finish_job(struct config *config, struct results_db *db,
+		       struct junit_report *junit, struct job *job,
+		       int status)
+{
+	bool passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	double secs = (now_usecs() - job->start_usecs) / 1000000.0;
+	char buf[4096];
+	size_t len;
+
+	if (passed && config->dry_run && !config->verbose)
+		;	/* a suite-wide syntax check lists only failures */
+	else if (passed)
+		printf("PASS %s (%.3f sec)\n", job->script_path, secs);
+	else if (WIFSIGNALED(status))
+		printf("FAIL %s (%.3f sec, killed by signal %d)\n",
+		       job->script_path, secs, WTERMSIG(status));
+	else
+		printf("FAIL %s (%.3f sec, exit status %d)\n",
+		       job->script_path, secs, WEXITSTATUS(status));
+
+	/* Show what the worker printed for failures, or always if -v. */
+	if (!passed || config->verbose) {
+		rewind(job->output);
+		while ((len = fread(buf, 1, sizeof(buf), job->output)) > 0)
+			fwrite(buf, 1, len, stdout);
+	}
+	fflush(stdout);
+
+	if (db != NULL)
+		results_db_record(db, job->script_path, job->results_key,
+				  passed, secs);
+	if (junit != NULL) {
+		char *output = NULL;
+		long output_len = 0;
+
+		if (!passed && fseek(job->output, 0, SEEK_END) == 0 &&
+		    (output_len = ftell(job->output)) > 0) {
+			output = malloc(output_len);
+			rewind(job->output);
+			output_len = fread(output, 1, output_len, job->output);
+		}
+		junit_report_add(junit, job->script_path,
+				 passed ? JUNIT_PASSED : JUNIT_FAILED,
+				 secs, output, output_len);
+		free(output);
+	}
+
+	fclose(job->output);
+	job->output = NULL;
+	job->pid = 0;
+	return passed;
+}
+
+int find_script_paths(char **paths, char ***scripts)
+{
+	struct path_list list;
+
+	memset(&list, 0, sizeof(list));
+	for (; *paths != NULL; ++paths)
+		add_script_paths(&list, *paths);
+	*scripts = list.paths;
+	return list.num_paths;
+}
+
+void write_junit_report(struct junit_report *junit, const char *path)
+{
+	char *error = NULL;
+
+	if (junit_report_write(junit, path, &error)) {
+		fprintf(stderr, "junit report: %s\n", error);
+		free(error);
+	}
+}
+
+bool is_script_suite(char **paths)
+{
+	struct stat st;
+
+	if (paths[0] == NULL)
+		return false;
+	if (paths[1] != NULL || is_glob(paths[0]))
+		return true;
+	return stat(paths[0], &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+struct results_db *open_results_db(int argc, char *argv[],
+				   const struct config *config, char **paths)
+{
+	char **options = calloc(argc, sizeof(char *));
+	struct results_db *db;
+	int num_options = 0, i;
+
+	for (i = 1; i < argc && &argv[i] != paths; ++i) {
+		if (strncmp(argv[i], "--jobs", 6) == 0 ||
+		    strcmp(argv[i], "--fork_server") == 0 ||
+		    strncmp(argv[i], "--results_db", 12) == 0 ||
+		    strcmp(argv[i], "-v") == 0 ||
+		    strcmp(argv[i], "--verbose") == 0)
+			continue;
+		options[num_options++] = argv[i];
+	}
+	db = results_db_open(config->results_db, options, num_options,
+			     config->init_scripts);
+	free(options);
+	return db;
+}
+
+/* Look up each script in the results store: leave out those that
+ * passed last time under the same key, and put those that failed last
+ * time first, ahead of new and changed ones. Returns the number of
+ * jobs left to run.
+ */
+static int plan_jobs(struct results_db *db, struct junit_report *junit,
+		     struct job *jobs, int num_jobs, int *num_skipped)
+{
+	enum results_history_t history;
+	int i, n = 0;
+
+	for (i = 0; i < num_jobs; i++) {
+		if (results_db_key(db, jobs[i].script_path,
+				   jobs[i].results_key) != STATUS_OK)
+			jobs[i].history = RESULTS_CHANGED;
+		else
+			jobs[i].history = results_db_lookup(
+				db, jobs[i].script_path, jobs[i].results_key);
+	}
+	for (history = RESULTS_FAILED; history < RESULTS_PASSED; history++) {
+		for (i = n; i < num_jobs; i++) {
+			struct job job = jobs[i];
+
+			if (job.history != history)
+				continue;
+			memmove(&jobs[n + 1], &jobs[n],
+				(i - n) * sizeof(struct job));
+			jobs[n++] = job;
+		}
+	}
+	for (i = n; i < num_jobs; i++) {
+		printf("SKIP %s (passed, unchanged)\n", jobs[i].script_path);
+		if (junit != NULL)
+			junit_report_add(junit, jobs[i].script_path,
+					 JUNIT_SKIPPED, 0, NULL, 0);
+	}
+	*num_skipped = num_jobs - n;
+	return n;
+}
+
+int run_jobs(int argc, char *argv[], struct config *config, char **paths)
+{
+	struct path_list list;
+	struct results_db *db = NULL;
+	struct junit_report *junit = NULL;
+	struct placement *placement = NULL;
+	struct fork_server *servers = NULL;
+	struct worker_slots *slots;
+	struct job *jobs;
+	int num_workers = config->jobs;
+	int next = 0, failed = 0, skipped = 0, num_jobs;
+	s64 start_usecs = now_usecs();
+	char *error = NULL;
+	int i;
+
+	if (config->results_db != NULL && !config->dry_run)
+		db = open_results_db(argc, argv, config, paths);
+	if (config->junit_report != NULL)
+		junit = junit_report_new();
+
+	memset(&list, 0, sizeof(list));
+	for (; *paths != NULL; ++paths)
+		add_script_paths(&list, *paths);
+	if (list.num_paths == 0)
+		die("error: no *.pkt scripts found\n");
+
+	if (config->dry_run) {
+		/* Parsing is all CPU, so by default use every CPU. */
+		if (num_workers == 0)
+			num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+		if (num_workers < 1)
+			num_workers = 1;
+	} else {
+#ifndef linux
+		/* Without network namespaces parallel workers would fight
+		 * over the same tun device and addresses, so run them one
+		 * at a time.
+		 */
+		num_workers = 1;
+#endif /* linux */
+	}
+
+	/* Each worker slot keeps its CPUs, node and cgroup from one job
+	 * to the next.
+	 */
+	if (placement_wanted(config)) {
+		placement = placement_new(config, num_workers, &error);
+		if (placement == NULL)
+			die("placement: %s\n", error);
+	}
+	slots = worker_slots_new(num_workers);
+
+	/* With --fork_server, each slot's template starts with its first
+	 * job, after the prelude below is parsed, and serves the rest.
+	 */
+	if (config->fork_server && !config->dry_run) {
+		servers = calloc(num_workers, sizeof(struct fork_server));
+		for (i = 0; i < num_workers; i++)
+			servers[i].fd = -1;
+	}
+
+	/* Parse the prelude once, for every job to inherit. */
+	if (config->init_scripts != NULL)
+		prelude_get(config->init_scripts);
+
+	jobs = calloc(list.num_paths, sizeof(struct job));
+	for (i = 0; i < list.num_paths; i++)
+		jobs[i].script_path = list.paths[i];
+	num_jobs = list.num_paths;
+	if (db != NULL)
+		num_jobs = plan_jobs(db, junit, jobs, num_jobs, &skipped);
+
+	while (next < num_jobs || slots->num_busy > 0) {
+		int status;
+		pid_t pid;
+
+		while (next < num_jobs) {
+			int slot = worker_slots_claim(slots, next);
+
+			if (slot < 0)
+				break;
+			jobs[next].slot = slot;
+			start_job(argc, argv, config, placement,
+				  servers, num_workers, &jobs[next++]);
+		}
+
+		if (servers != NULL) {
+			int slot = fork_server_wait(servers, slots, &status);
+
+			i = worker_slots_release(slots, slot);
+			assert(i >= 0);
+		} else {
+			pid = waitpid(-1, &status, 0);
+			if (pid < 0) {
+				if (errno == EINTR)
+					continue;
+				die_perror("waitpid");
+			}
+			for (i = 0; i < next; i++) {
+				if (jobs[i].pid == pid)
+					break;
+			}
+			if (i == next)
+				continue;	/* not one of our workers */
+			worker_slots_release(slots, jobs[i].slot);
+		}
+		if (!finish_job(config, db, junit, &jobs[i], status))
+			++failed;
+	}
+
+	if (config->dry_run)
+		printf("%d scripts, %d parsed, %d failed (%.3f sec)\n",
+		       list.num_paths, list.num_paths - failed, failed,
+		       (now_usecs() - start_usecs) / 1000000.0);
+	else if (db != NULL)
+		printf("%d scripts, %d passed, %d failed, %d skipped\n",
+		       list.num_paths, num_jobs - failed, failed, skipped);
+	else
+		printf("%d scripts, %d passed, %d failed\n",
+		       list.num_paths, list.num_paths - failed, failed);
+
+	if (servers != NULL) {
+		for (i = 0; i < num_workers; i++) {
+			if (servers[i].pid != 0)
+				fork_server_stop(&servers[i]);
+		}
+		free(servers);
+	}
+	if (placement != NULL)
+		placement_free(placement);
+	worker_slots_free(slots);
+	if (db != NULL)
+		results_db_free(db);
+	if (junit != NULL) {
+		write_junit_report(junit, config->junit_report);
+		junit_report_free(junit);
+	}
+
+	for (i = 0; i < list.num_paths; i++)
+		free(list.paths[i]);
+	free(list.paths);
+	free(jobs);
+	return failed;
+}
@@ -0,0 +1,109 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for running many test scripts in parallel (--jobs=N).
+ *
+ * Each script runs in its own forked worker process. On Linux each
+ * worker first moves into a fresh network namespace, so that it gets
+ * its own tun device, routes, addresses (the default plan from
+ * config.c) and TCP metrics cache, and workers cannot see each
+ * other's packets. The parent collects the results and prints a
+ * summary.
+ *
+ * Setting up the namespace and tun device can take longer than a
+ * short script runs, so with --fork_server each worker slot instead
+ * has a template process that does that setup once, along with memory
+ * locking and building the symbol index, and forks a child per script
+ * that inherits it all copy-on-write. A crashing script still takes
+ * down only its own child. The scripts of a slot share its namespace,
+ * one after another, as the scripts a --daemon runs share its device.
+ *
+ * With --dry_run, a whole suite is checked the same way: each script
+ * is parsed in its own worker, so a die() in the parser fails just that
+ * script, with no netdev and no namespace, and by default one worker
+ * per CPU.
+ *
+ * With --results_db, the runner skips scripts that passed last time and
+ * have not changed since, and runs last time's failures first (see
+ * results_db.h).
+ */
+
+#ifndef __RUN_JOBS_H__
+#define __RUN_JOBS_H__
+
+#include "types.h"
+
+#include "config.h"
+#include "junit_report.h"
+#include "results_db.h"
+
+/* Which job, by index, each of the worker slots of run_jobs() is
+ * running. A slot keeps its placement and, with --fork_server, its
+ * template from one job to the next, so the runner must know which
+ * job's result a slot is reporting.
+ */
+struct worker_slots {
+	int *jobs;		/* job in each slot, or -1 if the slot is free */
+	int num_slots;
+	int num_busy;		/* slots running a job */
+};
+
+extern struct worker_slots *worker_slots_new(int num_slots);
+extern void worker_slots_free(struct worker_slots *slots);
+
+/* Run the given job in the lowest free slot, and return that slot, or
+ * -1 if every slot is busy.
+ */
+extern int worker_slots_claim(struct worker_slots *slots, int job);
+
+/* Free the given slot, and return the job it was running, or -1 if it
+ * was not running one.
+ */
+extern int worker_slots_release(struct worker_slots *slots, int slot);
+
+/* Expand the NULL-terminated list of script paths as run_jobs() does,
+ * into a malloc-ed array of malloc-ed paths. Returns the number.
+ */
+extern int find_script_paths(char **paths, char ***scripts);
+
+/* Open the --results_db store for a run with the given command line,
+ * whose script paths start at paths. The options that only say how to
+ * run the suite, not what it tests, are left out of its key, as are
+ * the script paths.
+ */
+extern struct results_db *open_results_db(int argc, char *argv[],
+					  const struct config *config,
+					  char **paths);
+
+/* Write the --junit_report, reporting but not dying on errors. */
+extern void write_junit_report(struct junit_report *junit, const char *path);
+
+/* Return true if the NULL-terminated list of script paths names more
+ * than one script: several paths, a directory or a glob pattern.
+ */
+extern bool is_script_suite(char **paths);
+
+/* Run the given NULL-terminated list of script paths, with up to
+ * config->jobs workers at a time. Directories are searched
+ * recursively for *.pkt files, and glob patterns are expanded.
+ * argc/argv are the process command line, which each worker re-parses
+ * along with its script. Returns the number of scripts that failed.
+ */
+extern int run_jobs(int argc, char *argv[], struct config *config,
+		    char **paths);
+
+#endif /* __RUN_JOBS_H__ */
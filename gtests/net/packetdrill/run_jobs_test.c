@@ -0,0 +1,85 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for the worker slot bookkeeping in run_jobs.c: which job
+ * each slot is running as jobs finish out of order and slots are
+ * reused.
+ */
+
+#include "run_jobs.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#define NUM_SLOTS	3
+#define NUM_JOBS	8
+
+int main(void)
+{
+	struct worker_slots *slots = worker_slots_new(NUM_SLOTS);
+	/* The slot each job ran in, and which slot finishes next. */
+	int job_slot[NUM_JOBS];
+	int finishing[] = { 1, 0, 0, 2, 1, 1, 0, 2 };
+	int done = 0, next = 0, i;
+
+	/* Free slots report no job. */
+	assert(slots->num_busy == 0);
+	assert(worker_slots_release(slots, 1) == -1);
+	assert(slots->num_busy == 0);
+
+	/* Jobs fill the lowest free slots, until none is left. */
+	assert(worker_slots_claim(slots, 0) == 0);
+	assert(worker_slots_claim(slots, 1) == 1);
+	assert(worker_slots_claim(slots, 2) == 2);
+	assert(worker_slots_claim(slots, 3) == -1);
+	assert(slots->num_busy == NUM_SLOTS);
+
+	/* A freed slot reports its own job, and goes to the next one. */
+	assert(worker_slots_release(slots, 1) == 1);
+	assert(slots->num_busy == NUM_SLOTS - 1);
+	assert(worker_slots_claim(slots, 3) == 1);
+	assert(slots->jobs[1] == 3);
+	for (i = 0; i < NUM_SLOTS; i++)
+		worker_slots_release(slots, i);
+	assert(slots->num_busy == 0);
+
+	/* Run a suite as run_jobs() does: start jobs while there are free
+	 * slots, then finish whichever slot reports, so that each slot
+	 * runs several jobs in turn. Every job must finish exactly once,
+	 * in the slot it started in.
+	 */
+	while (next < NUM_JOBS || slots->num_busy > 0) {
+		int slot, job;
+
+		while (next < NUM_JOBS &&
+		       (slot = worker_slots_claim(slots, next)) >= 0)
+			job_slot[next++] = slot;
+
+		slot = finishing[done];
+		job = worker_slots_release(slots, slot);
+		assert(job >= 0 && job < next);
+		assert(job_slot[job] == slot);
+		job_slot[job] = -1;
+		done++;
+	}
+	assert(done == NUM_JOBS);
+	for (i = 0; i < NUM_JOBS; i++)
+		assert(job_slot[i] == -1);
+
+	worker_slots_free(slots);
+	return 0;
+}
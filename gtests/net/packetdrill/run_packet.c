@@ -25,34 +25,58 @@
 #include "run_packet.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
+#include "ack_aggregation.h"
 #include "checksum.h"
 #include "gre.h"
 #include "logging.h"
+#include "mib.h"
 #include "netdev.h"
 #include "packet.h"
 #include "packet_checksum.h"
 #include "packet_to_string.h"
+#include "packet_trace.h"
+#include "payload.h"
+#include "peer.h"
+#include "line_profile.h"
+#include "perf_counters.h"
+#include "probes.h"
 #include "run.h"
 #include "script.h"
+#include "syn_flood.h"
 #include "tcp_options_iterator.h"
 #include "tcp_options_to_string.h"
 #include "tcp_packet.h"
+#include "time_source.h"
 #include "utils.h"
+#include "verify_plan.h"
 #include "mptcp.h"
 
+/* The IANA dynamic port range, from which we draw ephemeral ports. */
+#define EPHEMERAL_PORT_MIN	49152
+#define EPHEMERAL_PORT_MAX	65535
+
+/* How many random ports to try before we let the OS pick one. */
+#define EPHEMERAL_PORT_TRIES	16
+
 /* To avoid issues with TIME_WAIT, FIN_WAIT1, and FIN_WAIT2 we use
  * dynamically-chosen, unique 4-tuples for each test. We implement the
- * picking of unique ports by binding a socket to port 0 and seeing
- * what port we are assigned. Note that we keep the socket fd open for
- * the lifetime of our process to ensure that the port is not
- * reused by a later test.
+ * picking of unique ports by binding a socket to a port drawn from
+ * the run's random number generator, so that with --seed runs are
+ * reproducible and parallel runs draw different ports, or to port 0
+ * if those are taken, and seeing what port we are assigned. Note that
+ * we keep the socket fd open for the lifetime of our process to ensure
+ * that the port is not reused by a later test.
  */
-static u16 ephemeral_port(void)
+static u16 ephemeral_port(struct prng *prng)
 {
 	int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 	if (fd < 0)
@@ -60,11 +84,21 @@ static u16 ephemeral_port(void)
 
 	struct sockaddr_in addr;
 	socklen_t addrlen = sizeof(addr);
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_port = 0;		/* let the OS pick the port */
-	if (bind(fd, (struct sockaddr *)&addr, addrlen) < 0)
-		die_perror("bind");
+	int i;
+	for (i = 0; i <= EPHEMERAL_PORT_TRIES; i++) {
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		if (i < EPHEMERAL_PORT_TRIES)
+			addr.sin_port = htons(EPHEMERAL_PORT_MIN +
+				prng_below(prng, EPHEMERAL_PORT_MAX -
+					   EPHEMERAL_PORT_MIN + 1));
+		else
+			addr.sin_port = 0;	/* let the OS pick the port */
+		if (bind(fd, (struct sockaddr *)&addr, addrlen) == 0)
+			break;
+		if (errno != EADDRINUSE || addr.sin_port == 0)
+			die_perror("bind");
+	}
 
 	memset(&addr, 0, sizeof(addr));
 	if (getsockname(fd, (struct sockaddr *)&addr, &addrlen) < 0)
@@ -92,7 +126,7 @@ static u16 next_ephemeral_port(struct state *state)
 		state->packets->next_ephemeral_port = -1;
 		return port;
 	} else {
-		return ephemeral_port();
+		return ephemeral_port(&state->prng);
 	}
 }
 
@@ -122,53 +156,128 @@ static void add_packet_dump(char **error, const char *type,
 	}
 }
 
-/* For verbose runs, print a short packet dump of all live packets. */
-static void verbose_packet_dump(struct state *state, const char *type,
-				struct packet *live_packet, s64 time_usecs)
+/* For an outbound packet that came at the wrong time, say what the
+ * queues in front of the device held between when the script expected
+ * it and when it came, if --queue_stats samples them: a packet held up
+ * in a qdisc or the tun ring is late for reasons other than TCP's.
+ */
+static void add_queue_summary(struct state *state, s64 script_usecs,
+			      s64 live_usecs, char **error)
 {
-	if (state->config->verbose) {
-		char *dump = NULL, *dump_error = NULL;
+	s64 expected_usecs = script_time_to_live_time_usecs(state,
+							    script_usecs);
+	struct queue_summary summary;
+	char *old_error = *error;
+	char *summary_str;
+
+	if (netdev_queue_summary(state->netdev,
+				 min(expected_usecs, live_usecs),
+				 max(expected_usecs, live_usecs), &summary))
+		return;
+	summary_str = queue_summary_to_string(&summary);
+	asprintf(error, "%s\n%s", old_error, summary_str);
+	free(summary_str);
+	free(old_error);
+}
 
-		packet_to_string(live_packet, DUMP_SHORT,
-				 &dump, &dump_error);
+/* The packets whose trace to print or write if we exit before the
+ * test is done, i.e. on a failure.
+ */
+static struct packets *exit_packets;
 
-		printf("%s packet: %9.6f %s%s%s\n",
-		       type, usecs_to_secs(time_usecs), dump,
-		       dump_error ? "\n" : "",
-		       dump_error ? dump_error : "");
+/* Set by SIGUSR1 to ask for a --flight_recorder snapshot. */
+static volatile sig_atomic_t flight_recorder_requested;
 
-		free(dump);
-		free(dump_error);
+static void request_flight_recorder(int signo)
+{
+	flight_recorder_requested = 1;
+}
+
+static void write_flight_recorder(struct packets *packets)
+{
+	const char *path = packets->trace_config->flight_recorder;
+	char *error = NULL;
+
+	if (packet_trace_write_pcapng(packets->trace, path, &error)) {
+		fprintf(stderr, "flight recorder: %s\n", error);
+		free(error);
+		return;
 	}
+	fprintf(stderr, "flight recorder: wrote %d packets to %s\n",
+		packets->trace->num_records, path);
 }
 
-/************* Functions to find socket corresponding to a packet ************/
+/* Print and write out the packet trace at the end of a test. */
+static void finish_trace(struct packets *packets, bool failed)
+{
+	if (failed && packets->trace_config->flight_recorder != NULL)
+		write_flight_recorder(packets);
+	if (packets->trace_config->verbose)
+		packet_trace_print(packets->trace);
+}
 
-/**
- * Return the first encountered socket from state->sockets list satisfying the
- * condition checked by the match function. Elements of the list are checked in
- * a Queue fashion, state->sockets pointer being the head.
- *
+static void finish_exit_trace(void)
+{
+	if (exit_packets != NULL)
+		finish_trace(exit_packets, true);
+}
+
+/* Record a live packet for verbose runs, which print a short packet
+ * dump of all live packets, and for the --flight_recorder, which on
+ * failure writes the last packets as pcapng. To keep this cheap while
+ * the test runs, we only record the packets here, and render them
+ * when the test is done or fails. The comment, if any, says how the
+ * packet differed from what the script expected.
  */
-struct socket *find_socket_matching_packet(struct state *state,
-		const struct packet *packet,
-		bool (*match)(struct socket*, const struct packet*))
+static void record_live_packet(struct state *state, const char *type,
+			       struct packet *live_packet,
+			       const struct event *event, s64 live_nsecs,
+			       const char *comment)
 {
-	struct socket *socket = state->sockets;
-	while(socket){
-		if((*match)(socket, packet))
-			return socket;
+	static bool registered;
+	struct config *config = state->config;
+	struct packets *packets = state->packets;
+	struct packet_trace_info info;
+
+	if (!config->verbose && config->flight_recorder == NULL)
+		return;
+	if (packets->trace == NULL) {
+		packets->trace = packet_trace_new(PACKET_TRACE_BYTES);
+		if (!config->verbose)
+			packets->trace->max_records =
+				config->flight_recorder_packets;
+		packets->trace_config = config;
+		exit_packets = packets;
+		if (!registered) {
+			atexit(finish_exit_trace);
+			if (config->flight_recorder != NULL)
+				signal(SIGUSR1, request_flight_recorder);
+			registered = true;
+		}
+	}
 
-		socket = socket->next;
+	memset(&info, 0, sizeof(info));
+	info.type = type;
+	info.direction = packet_direction(event->event.packet);
+	info.script_usecs = live_time_to_script_time_usecs(
+		state, live_nsecs / 1000);
+	info.live_nsecs = live_nsecs;
+	info.line_number = event->line_number;
+	info.comment = comment;
+	packet_trace_add(packets->trace, &info, live_packet);
+
+	if (flight_recorder_requested && config->flight_recorder != NULL) {
+		flight_recorder_requested = 0;
+		write_flight_recorder(packets);
 	}
-	return NULL;
 }
 
-static bool is_equals_script_fd_socket_and_packet(struct socket *socket,
-		const struct packet *packet)
-{
-	return socket->script.fd == packet->socket_script_fd;
-}
+/************* Functions to find socket corresponding to a packet ************/
+
+/* The lookups below return the first socket in the state->sockets
+ * list (i.e. the newest socket) with the wanted key, using the hash
+ * indexes in state->socket_table rather than walking the list.
+ */
 
 /**
  * Find the socket in state->sockets list having the file descriptor socket_fd.
@@ -180,8 +289,8 @@ struct socket *find_socket_matching_packet_script_fd(
 
 	if(packet->socket_script_fd == SOCKET_FD_NOT_DEFINED) // in scipt test is not specified
 		return state->sockets;
-	return find_socket_matching_packet(state, packet,
-			is_equals_script_fd_socket_and_packet);
+	return socket_table_first(state, SOCKET_INDEX_SCRIPT_FD,
+				  packet->socket_script_fd);
 }
 
 /**
@@ -192,57 +301,51 @@ struct socket *find_socket_matching_packet_script_fd(
  */
 struct socket *find_connecting_socket(struct state *state)
 {
-	struct socket *socket = state->sockets;
+	struct socket *socket = socket_table_first(state,
+						   SOCKET_INDEX_SCRIPT_FD,
+						   SOCKET_FD_NOT_DEFINED);
 	while(socket){
 		//if(socket->script.fd == SOCKET_FD_NOT_DEFINED && !(socket->last_outbound_tcp_header.rst) ){
-		if(socket->script.fd == SOCKET_FD_NOT_DEFINED && socket->state != SOCKET_RESET_RECEIVED ){
+		if(socket->state != SOCKET_RESET_RECEIVED ){
 			return socket;
 		}
-		socket = socket->next;
+		socket = socket_table_next(socket, SOCKET_INDEX_SCRIPT_FD);
 	}
 	return NULL;
 }
 
-static bool is_equals_tuple_socket_and_packet(struct socket *socket,
-		const struct packet *packet)
-{
-	//TODO check all 5-tuple ([IP,port] dst/src & protocol), will be
-	//necessary when multiple interface support will be implemented
-	return is_equal_port(socket->live.local.port, packet->tcp->src_port) &&
-		   is_equal_port(socket->live.remote.port, packet->tcp->dst_port);
-}
-
+/* Find the socket whose live local/remote ports are the packet's
+ * source/destination ports.
+ */
+/* Ports alone suffice even with --address_pool, since each connection
+ * and subflow we open takes a fresh ephemeral remote port whatever its
+ * addresses are.
+ */
 struct socket *find_socket_matching_packet_tuple(struct state *state,
 		const struct packet *packet)
 {
-	return find_socket_matching_packet(state, packet, is_equals_tuple_socket_and_packet);
-}
-
-static bool is_equals_tuple_socket_and_packet_reversed_ports(struct socket *socket,
-		const struct packet *packet)
-{
-	//TODO check IP too, will be necessary when multiple interface support
-	//will be implemented.
-	return is_equal_port(socket->live.local.port, packet->tcp->dst_port) &&
-			is_equal_port(socket->live.remote.port, packet->tcp->src_port);
+	return socket_table_first(state, SOCKET_INDEX_PORTS,
+				  socket_ports_key(packet->tcp->src_port,
+						   packet->tcp->dst_port));
 }
 
+/* Find the socket whose live local/remote ports are the packet's
+ * destination/source ports.
+ */
 struct socket *find_socket_matching_packet_tuple_reversed_ports(struct state *state,
 		const struct packet *packet)
 {
-	return find_socket_matching_packet(state, packet, is_equals_tuple_socket_and_packet_reversed_ports);
-}
-
-static bool socket_remote_port_equals_packet_dst_port(struct socket *socket,
-		const struct packet *packet)
-{
-	return is_equal_port(socket->live.remote.port, packet->tcp->dst_port);
+	return socket_table_first(state, SOCKET_INDEX_PORTS,
+				  socket_ports_key(packet->tcp->dst_port,
+						   packet->tcp->src_port));
 }
 
+/* Find the socket whose live remote port is the packet's destination. */
 struct socket *find_corresponding_socket_remote_port(struct state *state,
 		struct packet *packet)
 {
-	return find_socket_matching_packet(state, packet, socket_remote_port_equals_packet_dst_port);
+	return socket_table_first(state, SOCKET_INDEX_REMOTE_PORT,
+				  packet->tcp->dst_port);
 }
 
 /************************************* END ***********************************/
@@ -338,15 +441,19 @@ static struct socket *handle_listen_for_script_packet(
 	socket->script.fd		= -1;
 
 	/* Set up the live info for this socket based
-	 * on the script packet and our overall config.
+	 * on the script packet and our overall config. With
+	 * --address_pool, each new connection or subflow takes
+	 * the next pool's addresses.
 	 */
-	socket->live.remote.ip		= config->live_remote_ip;
+	config_pool_addresses(config, state->next_address_pool++,
+			      &socket->live.local.ip,
+			      &socket->live.remote.ip);
 	int next_port			= next_ephemeral_port(state);
 	socket->live.remote.port	= htons(next_port);
-	socket->live.local.ip		= config->live_local_ip;
 	socket->live.local.port		= htons(state->config->sock_fd_ports[socket_script_fd].live_local);
 	socket->live.remote_isn		= ntohl(packet->tcp->seq);
 	socket->live.fd			= -1;
+	socket_table_update(state, socket);
 
 	if (DEBUG_LOGGING) {
 		char local_string[ADDR_STR_LEN];
@@ -417,6 +524,7 @@ static struct socket *handle_connect_for_script_packet(
 		//socket->live.remote.port = htons(config->default_live_connect_port);
 		socket->live.remote.port = htons(config->sock_fd_ports[packet->socket_script_fd].live_remote);
 		socket->live.fd		 = -1;
+		socket_table_update(state, socket);
 	}
 
 	/* Fill in the new info about this connection. */
@@ -468,6 +576,7 @@ static struct socket *find_connect_for_live_packet(
 	 */
 	socket->live.local.ip	= tuple.src.ip;
 	socket->live.local.port	= tuple.src.port;
+	socket_table_update(state, socket);
 
 	if (packet->tcp)
 		socket->live.local_isn	= ntohl(packet->tcp->seq);
@@ -498,7 +607,7 @@ static void set_outbound_ts_val_mapping(
 			     script_timestamp, live_timestamp);
 }
 
-/* A helper to find the TCP timestamp option in a packet. Parse the
+/* A helper to find the TCP timestamp option in a packet. Look up the
  * TCP options and fill in packet->tcp_ts_val with the location of the
  * TCP timestamp value field (or NULL if there isn't one), and
  * likewise fill in packet->tcp_ts_ecr with the location of the TCP
@@ -508,18 +617,18 @@ static void set_outbound_ts_val_mapping(
  */
 static int find_tcp_timestamp(struct packet *packet, char **error)
 {
-	struct tcp_options_iterator iter;
 	struct tcp_option *option = NULL;
 
 	packet->tcp_ts_val = NULL;
 	packet->tcp_ts_ecr = NULL;
-	for (option = tcp_options_begin(packet, &iter); option != NULL;
-	     option = tcp_options_next(&iter, error))
-		if (option->kind == TCPOPT_TIMESTAMP) {
-			packet->tcp_ts_val = &(option->data.time_stamp.val);
-			packet->tcp_ts_ecr = &(option->data.time_stamp.ecr);
-		}
-	return *error ? STATUS_ERR : STATUS_OK;
+	if (tcp_options_index(packet, error))
+		return STATUS_ERR;
+	option = get_tcp_option(packet, TCPOPT_TIMESTAMP);
+	if (option != NULL) {
+		packet->tcp_ts_val = &(option->data.time_stamp.val);
+		packet->tcp_ts_ecr = &(option->data.time_stamp.ecr);
+	}
+	return STATUS_OK;
 }
 
 /* A helper to help translate SACK sequence numbers between live and
@@ -530,28 +639,65 @@ static int find_tcp_timestamp(struct packet *packet, char **error)
 static int offset_sack_blocks(struct packet *packet,
 			      u32 ack_offset, char **error)
 {
-	struct tcp_options_iterator iter;
 	struct tcp_option *option = NULL;
-	for (option = tcp_options_begin(packet, &iter); option != NULL;
-	     option = tcp_options_next(&iter, error)) {
-		if (option->kind == TCPOPT_SACK) {
-			int num_blocks = 0;
-			if (num_sack_blocks(option->length,
-						    &num_blocks, error))
-				return STATUS_ERR;
-			int i = 0;
-			for (i = 0; i < num_blocks; ++i) {
-				u32 val;
-				val = ntohl(option->data.sack.block[i].left);
-				val += ack_offset;
-				option->data.sack.block[i].left = htonl(val);
-				val = ntohl(option->data.sack.block[i].right);
-				val += ack_offset;
-				option->data.sack.block[i].right = htonl(val);
-			}
-		}
+	int num_blocks = 0;
+	int i = 0;
+
+	if (tcp_options_index(packet, error))
+		return STATUS_ERR;
+	option = get_tcp_option(packet, TCPOPT_SACK);
+	if (option == NULL)
+		return STATUS_OK;
+	if (num_sack_blocks(option->length, &num_blocks, error))
+		return STATUS_ERR;
+	for (i = 0; i < num_blocks; ++i) {
+		u32 val;
+		val = ntohl(option->data.sack.block[i].left);
+		val += ack_offset;
+		option->data.sack.block[i].left = htonl(val);
+		val = ntohl(option->data.sack.block[i].right);
+		val += ack_offset;
+		option->data.sack.block[i].right = htonl(val);
+	}
+	return STATUS_OK;
+}
+
+int offset_script_packet(struct packet *packet, u32 seq_offset,
+			 u32 ack_offset, u32 ts_offset, char **error)
+{
+	struct packet_checksum_snapshot snapshot;
+	bool checksummed = (packet->flags & FLAG_CHECKSUMMED) != 0;
+
+	if (packet->tcp == NULL)
+		return STATUS_OK;
+
+	/* Inbound packets got their checksums when parsed, and the
+	 * copies we inject must keep them right.
+	 */
+	if (checksummed)
+		packet_checksum_snapshot(packet, &snapshot);
+
+	packet->tcp->seq = htonl(ntohl(packet->tcp->seq) + seq_offset);
+	if (packet->tcp->ack)
+		packet->tcp->ack_seq =
+			htonl(ntohl(packet->tcp->ack_seq) + ack_offset);
+	if (offset_sack_blocks(packet, ack_offset, error))
+		return STATUS_ERR;
+
+	if (find_tcp_timestamp(packet, error))
+		return STATUS_ERR;
+	if (packet->tcp_ts_val != NULL) {
+		packet_set_tcp_ts_val(packet,
+				      packet_tcp_ts_val(packet) + ts_offset);
+		if (packet->tcp->ack)
+			packet_set_tcp_ts_ecr(packet,
+					      packet_tcp_ts_ecr(packet) +
+					      ts_offset);
 	}
-	return *error ? STATUS_ERR : STATUS_OK;
+
+	if (checksummed)
+		checksum_packet_incremental(packet, &snapshot);
+	return STATUS_OK;
 }
 
 
@@ -600,6 +746,8 @@ static int map_inbound_packet(
 	DEBUGP("map_inbound_packet\n");
 	/* Remap packet to live values. */
 	struct tuple live_inbound;
+	struct perf_sample perf_start;
+	int result;
 	socket_get_inbound(&socket->live, &live_inbound);
 	set_packet_tuple(live_packet, &live_inbound);
 	if ((live_packet->icmpv4 != NULL) || (live_packet->icmpv6 != NULL))
@@ -620,6 +768,10 @@ static int map_inbound_packet(
 	if (live_packet->tcp->ack)
 		live_packet->tcp->ack_seq =
 			htonl(ntohl(live_packet->tcp->ack_seq) + ack_offset);
+	/* Raw options, as --fuzz_corpus writes them, hold live values. */
+	if (live_packet->flags & FLAG_OPTIONS_RAW)
+		return STATUS_OK;
+
 	if (offset_sack_blocks(live_packet, ack_offset, error))
 		return STATUS_ERR;
 
@@ -646,9 +798,14 @@ static int map_inbound_packet(
 		}
 		packet_set_tcp_ts_ecr(live_packet, live_ts_ecr);
 	}
-	return mptcp_insert_and_extract_opt_fields(live_packet,
+	PROBE1(mptcp_rewrite_begin, DIRECTION_INBOUND);
+	perf_phase_begin(&perf_start);
+	result = mptcp_insert_and_extract_opt_fields(live_packet,
 			live_packet,
 			DIRECTION_INBOUND);
+	perf_phase_end(PERF_MPTCP_REWRITE, &perf_start);
+	PROBE2(mptcp_rewrite_end, DIRECTION_INBOUND, result);
+	return result;
 }
 
 /* Transforms values in the 'actual_packet' by mapping outbound packet
@@ -667,6 +824,8 @@ static int map_outbound_live_packet(
 	DEBUGP("map_outbound_live_packet\n");
 
 	struct tuple live_packet_tuple, live_outbound, script_outbound;
+	struct perf_sample perf_start;
+	int result;
 
 	/* Verify packet addresses are outbound and live for this socket. */
 	get_packet_tuple(live_packet, &live_packet_tuple);
@@ -726,16 +885,26 @@ static int map_outbound_live_packet(
 				      (actual_ts_val -
 				       socket->first_actual_ts_val));
 	}
-	mptcp_insert_and_extract_opt_fields(script_packet,
+	PROBE1(mptcp_rewrite_begin, DIRECTION_OUTBOUND);
+	perf_phase_begin(&perf_start);
+	result = mptcp_insert_and_extract_opt_fields(script_packet,
 			live_packet,
 			DIRECTION_OUTBOUND);
+	perf_phase_end(PERF_MPTCP_REWRITE, &perf_start);
+	PROBE2(mptcp_rewrite_end, DIRECTION_OUTBOUND, result);
 	return STATUS_OK;
 }
 
-/* Verify IP and TCP checksums on an outbound live packet. */
-static int verify_outbound_live_checksums(struct packet *live_packet,
+/* Verify IP and, as --verify_checksums asks, layer 4 checksums on an
+ * outbound live packet.
+ */
+static int verify_outbound_live_checksums(struct state *state,
+					  struct packet *live_packet,
 					  char **error)
 {
+	const struct checksum_policy *policy =
+		&state->config->verify_checksums;
+
 	/* Verify IP header checksum. */
 	if ((live_packet->ipv4 != NULL) &&
 	    ipv4_checksum(live_packet->ipv4,
@@ -744,11 +913,20 @@ static int verify_outbound_live_checksums(struct packet *live_packet,
 		return STATUS_ERR;
 	}
 
-	/* TODO(ncardwell): Verify TCP and UDP checksum. This is a little
-	 * subtle, due to TCP checksum offloading.
-	 */
-
-	return STATUS_OK;
+	switch (policy->mode) {
+	case CHECKSUM_VERIFY_NONE:
+		return STATUS_OK;
+	case CHECKSUM_VERIFY_SAMPLED:
+		if (++state->num_checksum_skipped < policy->sample_every)
+			return STATUS_OK;
+		state->num_checksum_skipped = 0;
+		break;
+	case CHECKSUM_VERIFY_FULL:
+	case CHECKSUM_VERIFY_OFFLOAD:
+		break;
+	}
+	return verify_packet_l4_checksum(live_packet,
+					 state->config->vnet_hdr, error);
 }
 
 /* Check whether the given field of a packet matches the expected
@@ -953,7 +1131,8 @@ bool same_mptcp_opt(struct tcp_option *opt_a, struct tcp_option *opt_b, struct p
 	switch(opt_a->data.mp_capable.subtype){
 
 		case MP_CAPABLE_SUBTYPE:
-			if(opt_a->data.mp_capable.flags != opt_b->data.mp_capable.flags)
+			if(opt_a->data.mp_capable.flags != opt_b->data.mp_capable.flags ||
+					opt_a->data.mp_capable.version != opt_b->data.mp_capable.version)
 				return false;
 
 			if(opt_a->length == TCPOLEN_MP_CAPABLE_SYN){
@@ -1050,26 +1229,31 @@ bool same_mptcp_opt(struct tcp_option *opt_a, struct tcp_option *opt_b, struct p
 			}
 			break;
 		case ADD_ADDR_SUBTYPE:
+			if(add_addr_has_hmac(opt_a) != add_addr_has_hmac(opt_b) ||
+					(add_addr_has_hmac(opt_a) &&
+					 memcmp(add_addr_hmac(opt_a), add_addr_hmac(opt_b),
+							TCPOLEN_ADD_ADDR_HMAC)))
+				return false;
 			if(opt_a->data.add_addr.address_id != opt_b->data.add_addr.address_id){
 				return false;
-			}else if(opt_a->length == TCPOLEN_ADD_ADDR_V4){
-				if(opt_b->length != TCPOLEN_ADD_ADDR_V4 )
+			}else if(add_addr_length(opt_a) == TCPOLEN_ADD_ADDR_V4){
+				if(add_addr_length(opt_b) != TCPOLEN_ADD_ADDR_V4 )
 					return false;
 				if(memcmp(&opt_a->data.add_addr.ipv4, &opt_b->data.add_addr.ipv4, sizeof(opt_b->data.add_addr.ipv4)))
 					return false;
-			}else if(opt_a->length == TCPOLEN_ADD_ADDR_V4_PORT){
-				if(	opt_b->length != TCPOLEN_ADD_ADDR_V4_PORT ||
+			}else if(add_addr_length(opt_a) == TCPOLEN_ADD_ADDR_V4_PORT){
+				if(	add_addr_length(opt_b) != TCPOLEN_ADD_ADDR_V4_PORT ||
 					opt_a->data.add_addr.ipv4_w_port.port != opt_b->data.add_addr.ipv4_w_port.port )
 					return false;
 				if(memcmp(&opt_a->data.add_addr.ipv4_w_port.ipv4, &opt_b->data.add_addr.ipv4_w_port.ipv4, sizeof(struct in_addr)))
 					return false;
-			}if(opt_a->length == TCPOLEN_ADD_ADDR_V6 ){
-				if(	opt_b->length != TCPOLEN_ADD_ADDR_V6 )
+			}if(add_addr_length(opt_a) == TCPOLEN_ADD_ADDR_V6 ){
+				if(	add_addr_length(opt_b) != TCPOLEN_ADD_ADDR_V6 )
 					return false;
 				if(memcmp(&opt_a->data.add_addr.ipv6, &opt_b->data.add_addr.ipv6, sizeof(struct in6_addr)))
 					return false;
-			}if(opt_a->length == TCPOLEN_ADD_ADDR_V6_PORT ){
-				if(	opt_b->length != TCPOLEN_ADD_ADDR_V6_PORT ||
+			}if(add_addr_length(opt_a) == TCPOLEN_ADD_ADDR_V6_PORT ){
+				if(	add_addr_length(opt_b) != TCPOLEN_ADD_ADDR_V6_PORT ||
 					opt_a->data.add_addr.ipv6_w_port.port != opt_b->data.add_addr.ipv6_w_port.port )
 					return false;
 				if(memcmp(&opt_a->data.add_addr.ipv6_w_port.ipv6, &opt_b->data.add_addr.ipv6_w_port.ipv6, sizeof(struct in6_addr)))
@@ -1116,32 +1300,26 @@ static bool same_tcp_options(struct packet *packet_a,
 		return false;
 	}
 
-	struct tcp_options_iterator iter_a, iter_b;
+	struct tcp_options_iterator iter_a;
 	struct tcp_option *opt_a = tcp_options_begin(packet_a, &iter_a);
-	struct tcp_option *opt_b = tcp_options_begin(packet_b, &iter_b);
+	struct tcp_option *opt_b = NULL;
 
-	//No assumption about options order
+	//No assumption about options order: look up each option of
+	//packet_a in the option index of packet_b
 	while(opt_a != NULL){
 
-		while(opt_b != NULL && opt_a->kind != opt_b->kind){
-			opt_b = tcp_options_next(&iter_b, NULL);
-		}
+		// for mptcp, look up the same subtype, to compare the right option
+		if(opt_a->kind == TCPOPT_MPTCP)
+			opt_b = get_mptcp_option(packet_b,
+						 opt_a->data.mp_capable.subtype);
+		else
+			opt_b = get_tcp_option(packet_b, opt_a->kind);
+
 		//opt_a not found in packet_b
 		if(opt_b == NULL){
 			return false;
 		}
 
-		// loop on subtypes of mptcp, to compare the right option
-		if(opt_a->kind == TCPOPT_MPTCP){
-
-			while(opt_b != NULL && opt_a->data.mp_capable.subtype!=opt_b->data.mp_capable.subtype)
-				opt_b = tcp_options_next(&iter_b, NULL);
-
-			//sub-option opt_a not found in packet_b
-			if(opt_b == NULL)
-				return false;
-		}
-
 		//NOP option only contains a kind field (not length)
 		if(opt_a->kind != TCPOPT_NOP){
 			if(opt_a->kind != TCPOPT_MPTCP){
@@ -1153,7 +1331,6 @@ static bool same_tcp_options(struct packet *packet_a,
 
 			}
 		}
-		opt_b = tcp_options_begin(packet_b, &iter_b);
 		opt_a = tcp_options_next(&iter_a, NULL);
 	}
 	return true;
@@ -1303,7 +1480,8 @@ static int verify_outbound_live_tcp_options(
 		if (config->tcp_ts_tick_usecs &&
 		    ((abs((s32)(actual_ts_val - script_ts_val)) *
 		      config->tcp_ts_tick_usecs) >
-		     config->tolerance_usecs)) {
+		     config_tolerance_usecs(config,
+					    TIMING_OUTBOUND_PACKET))) {
 			asprintf(error, "bad outbound TCP timestamp value");
 			return STATUS_ERR;
 		}
@@ -1325,8 +1503,88 @@ static int verify_outbound_live_tcp_options(
 }
 
 
+/* Return true and fill in the low 32 bits of the DSN, the relative
+ * subflow sequence number and the data-level length if the packet has
+ * a DSS option with a mapping. If check is not NULL, point it at the
+ * mapping's checksum, or at NULL if the mapping has none.
+ */
+static bool get_dss_mapping(struct packet *packet, u32 *dsn, u32 *ssn,
+			    u16 *dll, u8 **check)
+{
+	struct tcp_option *opt = get_mptcp_option(packet, DSS_SUBTYPE);
+	u8 *p = NULL, *end = NULL;
+	int dsn_bytes;
+	u16 be_dll;
+
+	if (opt == NULL || !opt->data.dss.flag_M)
+		return false;
+	p = (u8 *)opt + 4;	/* kind, length, subtype and flags */
+	end = (u8 *)opt + opt->length;
+	if (opt->data.dss.flag_A)
+		p += opt->data.dss.flag_a ? 8 : 4;
+	dsn_bytes = opt->data.dss.flag_m ? 8 : 4;
+	if (p + dsn_bytes + sizeof(u32) + sizeof(u16) > end)
+		return false;
+	*dsn = get_unaligned_be32(p + dsn_bytes - sizeof(u32));
+	p += dsn_bytes;
+	*ssn = get_unaligned_be32(p);
+	p += sizeof(u32);
+	memcpy(&be_dll, p, sizeof(be_dll));
+	*dll = ntohs(be_dll);
+	p += sizeof(u16);
+	if (check != NULL)
+		*check = (p + sizeof(u16) <= end) ? p : NULL;
+	return true;
+}
+
+/* With --payload_pattern, find where in its MPTCP connection's data
+ * stream the payload of a packet starts, from the packet's DSS mapping.
+ * The subflow's ISN and the connection's IDSN are those of the packet's
+ * sender, in the space of the packet's sequence numbers. Returns false
+ * if the packet has no mapping; then its data belongs to a mapping an
+ * earlier packet carried.
+ */
+static bool get_mptcp_stream_offset(struct packet *packet, u32 isn, u64 idsn,
+				    u32 *offset)
+{
+	u32 dsn, ssn, rel_seq;
+	u16 dll;
+
+	if (!get_dss_mapping(packet, &dsn, &ssn, &dll, NULL))
+		return false;
+	/* Relative subflow sequence numbers start at 1, as DSNs do. */
+	rel_seq = payload_stream_offset(ntohl(packet->tcp->seq),
+					packet->tcp->syn, isn) + 1;
+	*offset = dsn + (rel_seq - ssn) - (u32)(idsn + 1);
+	return true;
+}
+
+/* Return where in its stream, and so in the pattern of
+ * --payload_pattern, the data of an outbound TCP packet of the socket,
+ * mapped into script space, starts. For MPTCP the DSS mapping says
+ * where in the connection's data stream it is; returns false for MPTCP
+ * data that carries no mapping of its own.
+ */
+static bool get_outbound_stream_offset(struct socket *socket,
+				       struct packet *packet, u32 *offset)
+{
+	struct mp_subflow *subflow = NULL;
+
+	if (get_mptcp_option(packet, DSS_SUBTYPE) == NULL) {
+		*offset = payload_stream_offset(ntohl(packet->tcp->seq),
+						packet->tcp->syn,
+						socket->script.local_isn);
+		return true;
+	}
+	subflow = find_subflow_matching_socket(socket);
+	return (subflow != NULL &&
+		get_mptcp_stream_offset(packet, socket->script.local_isn,
+					subflow->conn->remote_idsn, offset));
+}
+
 /* Verify TCP/UDP payload matches expected value. */
 static int verify_outbound_live_payload(
+	const struct config *config, struct socket *socket,
 	struct packet *actual_packet,
 	struct packet *script_packet, char **error)
 {
@@ -1335,6 +1593,24 @@ static int verify_outbound_live_payload(
 	 */
 	assert(packet_payload_len(actual_packet) ==
 	       packet_payload_len(script_packet));
+	if (config->payload_pattern && actual_packet->tcp != NULL) {
+		int len = packet_payload_len(actual_packet);
+		u32 offset;
+		size_t good;
+
+		if (!get_outbound_stream_offset(socket, actual_packet,
+						&offset))
+			return STATUS_OK;
+		good = payload_pattern_mismatch(packet_payload(actual_packet),
+						offset, len);
+		if (good < len) {
+			asprintf(error, "outbound data payload does not match "
+				 "--payload_pattern from stream offset %u",
+				 offset + (u32)good);
+			return STATUS_ERR;
+		}
+		return STATUS_OK;
+	}
 	if (memcmp(packet_payload(script_packet),
 		   packet_payload(actual_packet),
 		   packet_payload_len(script_packet)) != 0) {
@@ -1344,6 +1620,26 @@ static int verify_outbound_live_payload(
 	return STATUS_OK;
 }
 
+/* If the script gave a GSO segment size for the outbound packet,
+ * verify the kernel sent a GSO super-packet with that segment size.
+ */
+static int verify_outbound_live_gso(
+	const struct config *config, struct packet *actual_packet,
+	struct packet *script_packet, char **error)
+{
+	if (script_packet->gso_size == 0 ||
+	    actual_packet->gso_size == script_packet->gso_size)
+		return STATUS_OK;
+	if (!config->vnet_hdr) {
+		asprintf(error, "checking outbound gso needs --vnet_hdr");
+		return STATUS_ERR;
+	}
+	asprintf(error, "live packet field gso_size: "
+		 "expected: %u vs actual: %u",
+		 script_packet->gso_size, actual_packet->gso_size);
+	return STATUS_ERR;
+}
+
 /* Verify that the outbound packet correctly matches the expected
  * outbound packet from the script.
  * Return STATUS_OK upon success.  If non_fatal_packet is unset in the
@@ -1359,6 +1655,7 @@ static int verify_outbound_live_packet(
 
 	int result = STATUS_ERR;	/* return value */
 	bool non_fatal = false;		/* ok to continue on error? */
+	const struct verify_plan *plan = NULL;	/* precompiled checks */
 	enum event_time_t time_type = state->event->time_type;
 	s64 script_usecs = state->event->time_usecs;
 	s64 script_usecs_end = state->event->time_usecs_end;
@@ -1371,7 +1668,7 @@ static int verify_outbound_live_packet(
 		state, live_packet->time_usecs);
 
 	/* Before mapping, see if the live outgoing checksums are correct. */
-	if (verify_outbound_live_checksums(live_packet, error))
+	if (verify_outbound_live_checksums(state, live_packet, error))
 		goto out;
 
 	/* Map live packet values into script space for easy comparison. */
@@ -1379,13 +1676,23 @@ static int verify_outbound_live_packet(
 		    socket, live_packet, actual_packet, script_packet, error))
 		goto out;
 
-	/* Verify actual IP, TCP/UDP header values matched expected ones. */
-	if (verify_outbound_live_headers(actual_packet, script_packet, error)) {
-		non_fatal = true;
-		goto out;
+	/* Verify actual IP, TCP/UDP header values and TCP options matched
+	 * expected ones. Usually the script packet's precompiled plan
+	 * says they did; if not, go field by field to find what differed.
+	 */
+	plan = packet_verify_plan(script_packet);
+	if (plan == NULL ||
+	    !verify_plan_matches(plan, state->config,
+				 script_packet, actual_packet)) {
+		plan = NULL;
+		if (verify_outbound_live_headers(actual_packet, script_packet,
+						 error)) {
+			non_fatal = true;
+			goto out;
+		}
 	}
 
-	if (script_packet->tcp) {
+	if (script_packet->tcp && (plan == NULL || !plan->options_checked)) {
 		/* Verify TCP options matched expected values. */
 		if (verify_outbound_live_tcp_options(
 			    state->config, actual_packet, script_packet,
@@ -1395,8 +1702,16 @@ static int verify_outbound_live_packet(
 		}
 	}
 
+	/* Verify any expected GSO segment size. */
+	if (verify_outbound_live_gso(state->config, actual_packet,
+				     script_packet, error)) {
+		non_fatal = true;
+		goto out;
+	}
+
 	/* Verify TCP/UDP payload matches expected value. */
-	if (verify_outbound_live_payload(actual_packet, script_packet, error)) {
+	if (verify_outbound_live_payload(state->config, socket, actual_packet,
+					 script_packet, error)) {
 		non_fatal = true;
 		goto out;
 	}
@@ -1405,7 +1720,11 @@ static int verify_outbound_live_packet(
 	DEBUGP("packet time_usecs: %lld\n", live_packet->time_usecs);
 	if (verify_time(state, time_type, script_usecs,
 				script_usecs_end, live_packet->time_usecs,
-				"outbound packet", error)) {
+				TIMING_OUTBOUND_PACKET,
+				state->event->line_number, "outbound packet",
+				error)) {
+		add_queue_summary(state, script_usecs,
+				  live_packet->time_usecs, error);
 		non_fatal = true;
 		goto out;
 	}
@@ -1413,13 +1732,16 @@ static int verify_outbound_live_packet(
 	result = STATUS_OK;
 
 out:
-	add_packet_dump(error, "script", script_packet, script_usecs,
-			DUMP_SHORT);
-	if (actual_packet != NULL) {
-		add_packet_dump(error, "actual", actual_packet, actual_usecs,
+	/* Render the packets only if there is an error to report. */
+	if (result != STATUS_OK) {
+		add_packet_dump(error, "script", script_packet, script_usecs,
 				DUMP_SHORT);
-		packet_free(actual_packet);
+		if (actual_packet != NULL)
+			add_packet_dump(error, "actual", actual_packet,
+					actual_usecs, DUMP_SHORT);
 	}
+	if (actual_packet != NULL)
+		packet_free(actual_packet);
 	if (result == STATUS_ERR &&
 	    non_fatal &&
 	    state->config->non_fatal_packet) {
@@ -1428,19 +1750,377 @@ out:
 	return result;
 }
 
-/* Sniff the next outbound live packet and return it. */
-static int sniff_outbound_live_packet(
-	struct state *state, struct socket *expected_socket,
+/* The running totals of a meter event, kept up to date as outbound
+ * packets are sniffed, so that a window of any length costs no more
+ * than its counters.
+ */
+struct meter {
+	const struct meter_spec *spec;
+	int line_number;	/* of the meter event */
+	s64 start_usecs;	/* live start of the window */
+	s64 end_usecs;		/* live end of the window */
+	u64 packets;		/* outbound packets of the metered socket(s) */
+	u64 bytes;		/* their TCP payload bytes */
+	u64 all_bytes;		/* TCP payload bytes of all sockets */
+	bool wants_gaps;	/* does a check use the gap metrics? */
+	s64 last_nsecs;		/* departure of the last packet, or 0 */
+	u32 last_bytes;		/* its IP bytes */
+	struct meter_gap *gaps;	/* gaps between departures */
+	int num_gaps;
+	int max_gaps;		/* allocated entries of gaps */
+	u64 max_pacing_rate;	/* SO_MAX_PACING_RATE of the socket, in
+				 * bytes/sec, or 0 if not yet read or unset
+				 */
+	struct meter *next;
+};
+
+/* The gap before a packet departed, and what it paced. */
+struct meter_gap {
+	s64 nsecs;		/* since the previous packet departed */
+	double kbps;		/* IP bytes of the previous packet over nsecs */
+};
+
+static const char *meter_metric_names[NUM_METER_METRICS] = {
+	[METER_BYTES]		= "bytes",
+	[METER_PACKETS]		= "packets",
+	[METER_KBPS]		= "kbps",
+	[METER_DSN_SHARE]	= "dsn_share",
+	[METER_GAP_P50]		= "gap_p50_usecs",
+	[METER_GAP_P90]		= "gap_p90_usecs",
+	[METER_PACING_KBPS]	= "pacing_kbps",
+	[METER_PACING_PCT]	= "pacing_pct",
+};
+
+static int compare_gap_nsecs(const void *a, const void *b)
+{
+	s64 x = ((const struct meter_gap *)a)->nsecs;
+	s64 y = ((const struct meter_gap *)b)->nsecs;
+
+	return (x > y) - (x < y);
+}
+
+static int compare_gap_kbps(const void *a, const void *b)
+{
+	double x = ((const struct meter_gap *)a)->kbps;
+	double y = ((const struct meter_gap *)b)->kbps;
+
+	return (x > y) - (x < y);
+}
+
+/* Return the index of the given percentile of n sorted values, by
+ * nearest rank.
+ */
+static int percentile_index(int n, int percent)
+{
+	int rank = (n * percent + 99) / 100;
+
+	return rank > 0 ? rank - 1 : 0;
+}
+
+/* Return the given percentile of the meter's gaps, in microseconds. */
+static double meter_gap_usecs(struct meter *meter, int percent)
+{
+	if (meter->num_gaps == 0)
+		return 0;
+	qsort(meter->gaps, meter->num_gaps, sizeof(meter->gaps[0]),
+	      compare_gap_nsecs);
+	return meter->gaps[percentile_index(meter->num_gaps,
+					    percent)].nsecs / 1000.0;
+}
+
+/* Return the median rate the meter's gaps paced packets at, in kbit/s.
+ * The median rides out the few packets a pacer lets go back to back,
+ * like the first ones of a flow or those after an idle period.
+ */
+static double meter_pacing_kbps(struct meter *meter)
+{
+	if (meter->num_gaps == 0)
+		return 0;
+	qsort(meter->gaps, meter->num_gaps, sizeof(meter->gaps[0]),
+	      compare_gap_kbps);
+	return meter->gaps[percentile_index(meter->num_gaps, 50)].kbps;
+}
+
+static double meter_value(struct meter *meter, enum meter_metric_t metric)
+{
+	switch (metric) {
+	case METER_BYTES:
+		return meter->bytes;
+	case METER_PACKETS:
+		return meter->packets;
+	case METER_KBPS:
+		return meter->bytes * 8000.0 / meter->spec->window_usecs;
+	case METER_DSN_SHARE:
+		if (meter->all_bytes == 0)
+			return 0;
+		return 100.0 * meter->bytes / meter->all_bytes;
+	case METER_GAP_P50:
+		return meter_gap_usecs(meter, 50);
+	case METER_GAP_P90:
+		return meter_gap_usecs(meter, 90);
+	case METER_PACING_KBPS:
+		return meter_pacing_kbps(meter);
+	case METER_PACING_PCT:
+		if (meter->max_pacing_rate == 0)
+			return 0;
+		return 100.0 * meter_pacing_kbps(meter) /
+			(meter->max_pacing_rate * 8 / 1000.0);
+	case NUM_METER_METRICS:
+		break;
+	}
+	assert(!"bad meter metric");
+	return 0;
+}
+
+/* Check the bounds of a meter and free it. */
+static int check_meter(struct meter *meter, char **error)
+{
+	int i, result = STATUS_OK;
+
+	for (i = 0; i < meter->spec->num_checks; ++i) {
+		const struct meter_check *check = &meter->spec->checks[i];
+		double value = meter_value(meter, check->metric);
+
+		if (check->metric == METER_PACING_PCT &&
+		    meter->max_pacing_rate == 0) {
+			asprintf(error, "meter at line %d failed: pacing_pct "
+				 "needs a socket with SO_MAX_PACING_RATE set",
+				 meter->line_number);
+			result = STATUS_ERR;
+			break;
+		}
+		if (check->at_least ? value >= check->bound :
+				      value <= check->bound)
+			continue;
+		asprintf(error, "meter at line %d failed: %s %.1f is not %s %g "
+			 "(%llu packets, %llu bytes in %.6f sec)",
+			 meter->line_number, meter_metric_names[check->metric], value,
+			 check->at_least ? ">=" : "<=", check->bound,
+			 meter->packets, meter->bytes,
+			 meter->spec->window_usecs / 1.0e6);
+		result = STATUS_ERR;
+		break;
+	}
+	free(meter->gaps);
+	free(meter);
+	return result;
+}
+
+/* Return the SO_MAX_PACING_RATE of the given live socket in bytes/sec,
+ * or 0 if it has none.
+ */
+static u64 max_pacing_rate(int fd)
+{
+#ifdef SO_MAX_PACING_RATE
+	u32 rate = 0;
+	socklen_t len = sizeof(rate);
+
+	if (fd < 0 ||
+	    getsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, &len) < 0 ||
+	    rate == ~0U)
+		return 0;
+	return rate;
+#else
+	return 0;
+#endif
+}
+
+/* Note the gap between the departure of a packet of a meter's socket
+ * and that of the one before, using the sniffer's nanosecond
+ * timestamps.
+ */
+static void meter_gap(struct meter *meter, struct socket *socket,
+		      struct packet *packet)
+{
+	s64 nsecs = packet_time_nsecs(packet);
+
+	/* Read the rate as the window sees the socket's first packet,
+	 * so that a setsockopt() just before the meter event counts.
+	 */
+	if (meter->last_nsecs == 0)
+		meter->max_pacing_rate = max_pacing_rate(socket->live.fd);
+	if (meter->last_nsecs != 0 && nsecs > meter->last_nsecs) {
+		struct meter_gap *gap = NULL;
+
+		if (meter->num_gaps == meter->max_gaps) {
+			meter->max_gaps = meter->max_gaps ?
+				2 * meter->max_gaps : 64;
+			meter->gaps = realloc(meter->gaps, meter->max_gaps *
+					      sizeof(meter->gaps[0]));
+			if (meter->gaps == NULL)
+				die_perror("realloc");
+		}
+		gap = &meter->gaps[meter->num_gaps++];
+		gap->nsecs = nsecs - meter->last_nsecs;
+		gap->kbps = meter->last_bytes * 8.0e6 / gap->nsecs;
+	}
+	meter->last_nsecs = nsecs;
+	meter->last_bytes = packet->ip_bytes;
+}
+
+/* Count an outbound live packet of the given socket towards the open
+ * meters, and check those whose window it is past.
+ */
+static int meter_live_packet(struct state *state, struct socket *socket,
+			     struct packet *packet, char **error)
+{
+	struct meter **link = &state->packets->meters;
+	int bytes = packet->tcp ? packet_payload_len(packet) : 0;
+
+	while (*link != NULL) {
+		struct meter *meter = *link;
+
+		if (packet->time_usecs >= meter->end_usecs) {
+			*link = meter->next;
+			if (check_meter(meter, error))
+				return STATUS_ERR;
+			continue;
+		}
+		if (packet->time_usecs >= meter->start_usecs) {
+			meter->all_bytes += bytes;
+			if (meter->spec->socket_fd == SOCKET_FD_NOT_DEFINED ||
+			    meter->spec->socket_fd == socket->script.fd) {
+				++meter->packets;
+				meter->bytes += bytes;
+				if (meter->wants_gaps)
+					meter_gap(meter, socket, packet);
+			}
+		}
+		link = &meter->next;
+	}
+	return STATUS_OK;
+}
+
+int run_meter_event(struct state *state, struct event *event,
+		    struct meter_spec *spec, char **error)
+{
+	struct meter *meter = calloc(1, sizeof(struct meter));
+	struct meter **link = &state->packets->meters;
+	int i;
+
+	DEBUGP("%d: meter\n", event->line_number);
+
+	if (state->config->is_wire_client) {
+		free(meter);
+		asprintf(error, "%s:%d: meter events need a local netdev, "
+			 "not --wire_client\n", state->config->script_path,
+			 event->line_number);
+		return STATUS_ERR;
+	}
+
+	meter->spec = spec;
+	meter->line_number = event->line_number;
+	meter->start_usecs = script_time_to_live_time_usecs(
+		state, event->time_usecs);
+	meter->end_usecs = meter->start_usecs + spec->window_usecs;
+	for (i = 0; i < spec->num_checks; ++i) {
+		if (spec->checks[i].metric >= METER_GAP_P50)
+			meter->wants_gaps = true;
+	}
+
+	/* Keep the meters in order of when their windows end. */
+	while (*link != NULL && (*link)->end_usecs <= meter->end_usecs)
+		link = &(*link)->next;
+	meter->next = *link;
+	*link = meter;
+	return STATUS_OK;
+}
+
+int finish_meters(struct state *state, char **error)
+{
+	while (state->packets->meters != NULL) {
+		struct meter *meter = state->packets->meters;
+
+		state->packets->meters = meter->next;
+		if (check_meter(meter, error))
+			return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* For --kernel_latency, note how long after the last packet we
+ * injected on the socket the kernel sent this one, its answer.
+ */
+static void note_kernel_latency(struct state *state, struct socket *socket,
+				const struct packet *live_packet)
+{
+	char name[32];
+	s64 usecs;
+
+	if (socket->latency_inject_nsecs == 0)
+		return;
+	usecs = (packet_time_nsecs(live_packet) -
+		 socket->latency_inject_nsecs) / 1000;
+	snprintf(name, sizeof(name), "%u>%u",
+		 ntohs(socket->script.local.port),
+		 ntohs(socket->script.remote.port));
+	kernel_latency_record(state->kernel_latency,
+			      state->event->line_number, socket->id, name,
+			      usecs > 0 ? usecs : 0);
+	socket->latency_inject_nsecs = 0;
+}
+
+/* For --dsn_coverage, note where in its MPTCP connection's data stream
+ * the data of an outbound packet goes, and on which subflow. We take
+ * each segment's place from the DSS mapping it carries, as Linux puts
+ * one on every data segment; a segment without one is not counted.
+ */
+static void note_dsn_coverage(struct state *state, struct socket *socket,
+			      struct packet *live_packet)
+{
+	struct mp_subflow *subflow = NULL;
+	u32 dsn, ssn, rel_seq, len = packet_payload_len(live_packet);
+	u16 dll;
+	char name[32];
+
+	if (live_packet->tcp == NULL || len == 0 ||
+	    !get_dss_mapping(live_packet, &dsn, &ssn, &dll, NULL))
+		return;
+	subflow = find_subflow_matching_socket(socket);
+	if (subflow == NULL)
+		return;
+	/* Relative subflow sequence numbers start at 1, as DSNs do. */
+	rel_seq = payload_stream_offset(ntohl(live_packet->tcp->seq),
+					live_packet->tcp->syn,
+					socket->live.local_isn) + 1;
+	if (rel_seq - ssn >= dll)
+		return;		/* not in its own mapping */
+	len = min(len, dll - (rel_seq - ssn));
+	snprintf(name, sizeof(name), "%u>%u",
+		 ntohs(socket->script.local.port),
+		 ntohs(socket->script.remote.port));
+	dsn_coverage_record(state->dsn_coverage, subflow->conn->kernel_token,
+			    subflow->conn->kernel_idsn, socket->id, name,
+			    dsn + (rel_seq - ssn), len,
+			    live_packet->time_usecs ? live_packet->time_usecs :
+			    now_usecs());
+}
+
+/* Sniff the next outbound live packet of a socket we know, and return
+ * it and its socket.
+ */
+static int sniff_any_outbound_live_packet(
+	struct state *state, struct socket **live_socket,
 	struct packet **packet, char **error)
 {
-	DEBUGP("sniff_outbound_live_packet\n");
+	DEBUGP("sniff_any_outbound_live_packet\n");
 	struct socket *socket = NULL;
 	enum direction_t direction = DIRECTION_INVALID;
+	enum profile_phase_t profile_phase;
+	int result;
 	assert(*packet == NULL);
 
 	while (1) {
-		if (netdev_receive(state->netdev, packet, error))
+		profile_phase = profile_phase_begin(PROFILE_SNIFF);
+		result = netdev_receive(state->netdev, state->packet_pool,
+					packet, error);
+		profile_phase_end(profile_phase);
+		if (result) {
+			PROBE4(packet_sniff, STATUS_ERR, NULL, 0, 0);
 			return STATUS_ERR;
+		}
+		PROBE4(packet_sniff, STATUS_OK, packet_start(*packet),
+		       (*packet)->ip_bytes, packet_time_nsecs(*packet));
 		/* See if the packet matches an existing, known socket. */
 		socket = find_socket_for_live_packet(state, *packet,
 						     &direction);
@@ -1459,6 +2139,29 @@ static int sniff_outbound_live_packet(
 	assert(socket != NULL);
 	assert(direction == DIRECTION_OUTBOUND);
 
+	if (state->packets->meters != NULL &&
+	    meter_live_packet(state, socket, *packet, error))
+		return STATUS_ERR;
+
+	if (state->kernel_latency != NULL)
+		note_kernel_latency(state, socket, *packet);
+
+	if (state->dsn_coverage != NULL)
+		note_dsn_coverage(state, socket, *packet);
+
+	*live_socket = socket;
+	return STATUS_OK;
+}
+
+/* Sniff the next outbound live packet and return it. */
+static int sniff_outbound_live_packet(
+	struct state *state, struct socket *expected_socket,
+	struct packet **packet, char **error)
+{
+	struct socket *socket = NULL;
+
+	if (sniff_any_outbound_live_packet(state, &socket, packet, error))
+		return STATUS_ERR;
 	if (socket != expected_socket) {
 		asprintf(error, "packet is not for expected socket");
 		return STATUS_ERR;
@@ -1466,7 +2169,196 @@ static int sniff_outbound_live_packet(
 	return STATUS_OK;
 }
 
-/* Return true iff the given packet could be sent/received by the socket. */
+/* Where a train is in matching its segments. */
+struct train_match {
+	u32 next_seq;		/* script seq the next segment starts at */
+	u32 end_seq;		/* script seq the train ends at */
+	int num_segments;	/* segments matched so far */
+	bool has_mapping;	/* seen a DSS mapping yet? */
+	u32 mapping_dsn;	/* low 32 bits of the last mapping's DSN */
+	u16 mapping_dll;	/* data-level length of the last mapping */
+};
+
+/* Check that a train segment's DSS mapping, if any, is the mapping of
+ * the segment before it or starts where that one ends, so that the
+ * train covers a contiguous range of DSN space.
+ */
+static int verify_train_mapping(struct train_match *train,
+				struct packet *live_packet, char **error)
+{
+	u32 dsn, ssn;
+	u16 dll;
+
+	if (!get_dss_mapping(live_packet, &dsn, &ssn, &dll, NULL))
+		return STATUS_OK;
+	if (train->has_mapping &&
+	    !(dsn == train->mapping_dsn && dll == train->mapping_dll) &&
+	    dsn != train->mapping_dsn + train->mapping_dll) {
+		asprintf(error, "train segment DSS mapping at DSN %u is not "
+			 "contiguous with the one before, at DSN %u for %u "
+			 "bytes", dsn, train->mapping_dsn, train->mapping_dll);
+		return STATUS_ERR;
+	}
+	train->has_mapping = true;
+	train->mapping_dsn = dsn;
+	train->mapping_dll = dll;
+	return STATUS_OK;
+}
+
+/* Verify one segment of an outbound train against the script packet
+ * that covers the whole train. Each segment must carry the script's
+ * flags, ACK and window, and start where the one before it ended. The
+ * FIN and PSH bits of the script packet need only be on the last
+ * segment, and the TCP options are not compared, since they differ
+ * from one segment to the next; but the segments' DSS mappings must be
+ * contiguous. Only the first segment is checked against the event's
+ * time. The last segment is mapped like a whole packet, so that TCP
+ * timestamps and MPTCP state advance as if the script had listed it.
+ */
+static int verify_outbound_train_segment(
+	struct state *state, struct socket *socket,
+	struct packet *script_packet, struct packet *live_packet,
+	struct train_match *train, char **error)
+{
+	int result = STATUS_ERR;
+	bool non_fatal = false, is_last = false;
+	const struct tcp *script_tcp = script_packet->tcp;
+	struct packet *actual_packet = packet_copy(live_packet);
+	struct tcp *actual_tcp = actual_packet->tcp;
+	s64 actual_usecs = live_time_to_script_time_usecs(
+		state, live_packet->time_usecs);
+	int len = packet_payload_len(live_packet);
+	u32 seq;
+
+	if (verify_outbound_live_checksums(state, live_packet, error))
+		goto out;
+	if (live_packet->tcp == NULL) {
+		asprintf(error, "train segment is not TCP");
+		goto out;
+	}
+
+	seq = ntohl(live_packet->tcp->seq) +
+	      local_seq_live_to_script_offset(socket, false);
+	is_last = (len > 0 && seq == train->next_seq &&
+		   (u32)len == train->end_seq - seq);
+	if (is_last) {
+		if (map_outbound_live_packet(socket, live_packet,
+					     actual_packet, script_packet,
+					     error))
+			goto out;
+	} else {
+		actual_tcp->seq = htonl(seq);
+		if (actual_tcp->ack)
+			actual_tcp->ack_seq = htonl(
+				ntohl(live_packet->tcp->ack_seq) +
+				remote_seq_live_to_script_offset(socket,
+								 false));
+	}
+
+	non_fatal = true;
+	if (check_field("tcp_seq", train->next_seq, seq, error))
+		goto out;
+	if (len <= 0 || (u32)len > train->end_seq - seq) {
+		asprintf(error, "train segment of %d bytes does not fit in "
+			 "the %u bytes left of the train", len,
+			 train->end_seq - seq);
+		goto out;
+	}
+	if (check_field("tcp_fin", is_last ? script_tcp->fin : 0,
+			actual_tcp->fin, error) ||
+	    (is_last && check_field("tcp_psh", script_tcp->psh,
+				    actual_tcp->psh, error)) ||
+	    check_field("tcp_syn", script_tcp->syn, actual_tcp->syn, error) ||
+	    check_field("tcp_rst", script_tcp->rst, actual_tcp->rst, error) ||
+	    check_field("tcp_ack", script_tcp->ack, actual_tcp->ack, error) ||
+	    check_field("tcp_urg", script_tcp->urg, actual_tcp->urg, error) ||
+	    check_field("tcp_ece", script_tcp->ece, actual_tcp->ece, error) ||
+	    (script_tcp->ack &&
+	     check_field("tcp_ack_seq", ntohl(script_tcp->ack_seq),
+			 ntohl(actual_tcp->ack_seq), error)) ||
+	    (script_packet->flags & FLAG_WIN_NOCHECK ? STATUS_OK :
+		check_field("tcp_window", ntohs(script_tcp->window),
+			    ntohs(actual_tcp->window), error)))
+		goto out;
+	if (verify_train_mapping(train, live_packet, error))
+		goto out;
+
+	if (train->num_segments == 0 &&
+	    verify_time(state, state->event->time_type,
+			state->event->time_usecs,
+			state->event->time_usecs_end, live_packet->time_usecs,
+			TIMING_OUTBOUND_PACKET, state->event->line_number,
+			"outbound packet", error)) {
+		add_queue_summary(state, state->event->time_usecs,
+				  live_packet->time_usecs, error);
+		goto out;
+	}
+
+	train->next_seq = seq + len;
+	++train->num_segments;
+	result = STATUS_OK;
+
+out:
+	if (result != STATUS_OK) {
+		add_packet_dump(error, "script", script_packet,
+				state->event->time_usecs, DUMP_SHORT);
+		add_packet_dump(error, "actual", actual_packet,
+				actual_usecs, DUMP_SHORT);
+	}
+	packet_free(actual_packet);
+	if (result == STATUS_ERR && non_fatal &&
+	    state->config->non_fatal_packet)
+		result = STATUS_WARN;
+	return result;
+}
+
+/* Sniff and verify the outbound segments covering a train packet. */
+static int do_outbound_script_train(
+	struct state *state, struct packet *packet,
+	struct socket *socket, char **error)
+{
+	struct train_match train = {
+		.next_seq = ntohl(packet->tcp->seq),
+		.end_seq = ntohl(packet->tcp->seq) + packet_payload_len(packet),
+	};
+	enum profile_phase_t profile_phase;
+	struct perf_sample perf_start;
+	int result = STATUS_OK;
+
+	while (train.next_seq != train.end_seq) {
+		struct packet *live_packet = NULL;
+
+		perf_phase_begin(&perf_start);
+		result = sniff_outbound_live_packet(state, socket,
+						    &live_packet, error);
+		perf_phase_end(PERF_SNIFF, &perf_start);
+		if (result != STATUS_OK) {
+			if (live_packet != NULL)
+				packet_free(live_packet);
+			return STATUS_ERR;
+		}
+		if (live_packet->tcp)
+			socket->last_outbound_tcp_header = *(live_packet->tcp);
+
+		perf_phase_begin(&perf_start);
+		profile_phase = profile_phase_begin(PROFILE_VERIFY);
+		result = verify_outbound_train_segment(
+			state, socket, packet, live_packet, &train, error);
+		profile_phase_end(profile_phase);
+		perf_phase_end(PERF_VERIFY, &perf_start);
+		PROBE2(packet_verify, state->event->line_number, result);
+		record_live_packet(state, "outbound sniffed", live_packet,
+				   state->event, packet_time_nsecs(live_packet),
+				   result != STATUS_OK ? *error : NULL);
+		packet_free(live_packet);
+		if (result != STATUS_OK)
+			return result;
+	}
+	DEBUGP("train matched %d segments\n", train.num_segments);
+	return STATUS_OK;
+}
+
+/* Return true iff the given packet could be sent/received by the socket. */
 static bool is_script_packet_match_for_socket(
 	struct state *state, struct packet *packet, struct socket *socket)
 {
@@ -1535,23 +2427,16 @@ static int find_or_create_socket_for_script_packet(
 	return STATUS_ERR;
 }
 
-/* Perform the action implied by an outbound packet in a script
- * Return STATUS_OK upon success.  Without --use_expect, return STATUS_ERR
- * upon all failures.  With --use_expect, return STATUS_WARN upon non-fatal
- * failures.
+/* Check a sniffed outbound live packet against the script packet the
+ * current event expects on its socket, and update the socket's state.
  */
-static int do_outbound_script_packet(
+static int check_outbound_script_packet(
 	struct state *state, struct packet *packet,
-	struct socket *socket,	char **error)
+	struct socket *socket, struct packet *live_packet, char **error)
 {
-	DEBUGP("do_outbound_script_packet\n");
-	int result = STATUS_ERR;		/* return value */
-	struct packet *live_packet = NULL;
-
-	if ((packet->icmpv4 != NULL) || (packet->icmpv6 != NULL)) {
-		asprintf(error, "outbound ICMP packets are not supported");
-		goto out;
-	}
+	enum profile_phase_t profile_phase;
+	struct perf_sample perf_start;
+	int result;
 
 	if ((socket->state == SOCKET_PASSIVE_PACKET_RECEIVED) &&
 	    packet->tcp && packet->tcp->syn && packet->tcp->ack) {
@@ -1561,10 +2446,6 @@ static int do_outbound_script_packet(
 		       socket->script.local_isn);
 	}
 
-	/* Sniff outbound live packet and verify it's for the right socket. */
-	if (sniff_outbound_live_packet(state, socket, &live_packet, error))
-		goto out;
-
 	if ((socket->state == SOCKET_PASSIVE_PACKET_RECEIVED) &&
 	    packet->tcp && packet->tcp->syn && packet->tcp->ack) {
 		socket->state = SOCKET_PASSIVE_SYNACK_SENT;
@@ -1573,20 +2454,137 @@ static int do_outbound_script_packet(
 		       socket->live.local_isn);
 	}
 
-        if (packet->tcp->rst)
-                socket->state = SOCKET_RESET_RECEIVED;
-
-	verbose_packet_dump(state, "outbound sniffed", live_packet,
-			    live_time_to_script_time_usecs(
-				    state, live_packet->time_usecs));
+	if (packet->tcp && packet->tcp->rst)
+		socket->state = SOCKET_RESET_RECEIVED;
 
 	/* Save the TCP header so we can reset the connection at the end. */
 	if (live_packet->tcp)
 		socket->last_outbound_tcp_header = *(live_packet->tcp);
 
 	/* Verify the bits the kernel sent were what the script expected. */
+	perf_phase_begin(&perf_start);
+	profile_phase = profile_phase_begin(PROFILE_VERIFY);
 	result = verify_outbound_live_packet(
 			state, socket, packet, live_packet, error);
+	profile_phase_end(profile_phase);
+	perf_phase_end(PERF_VERIFY, &perf_start);
+	PROBE2(packet_verify, state->event->line_number, result);
+
+	record_live_packet(state, "outbound sniffed", live_packet,
+			   state->event, packet_time_nsecs(live_packet),
+			   result != STATUS_OK ? *error : NULL);
+	return result;
+}
+
+/* Return a copy of the outbound UDP GSO script packet cut down to its
+ * first len bytes of payload: the datagram we expect the kernel to send
+ * for one segment when it splits the super-packet up itself.
+ */
+static struct packet *udp_gso_script_segment(
+	struct state *state, struct packet *packet, int len)
+{
+	struct packet *segment = packet_pool_copy(state->packet_pool, packet);
+	int cut = packet_payload_len(packet) - len;
+
+	segment->ip_bytes -= cut;
+	if (segment->ipv4)
+		segment->ipv4->tot_len =
+			htons(ntohs(segment->ipv4->tot_len) - cut);
+	else
+		segment->ipv6->payload_len =
+			htons(ntohs(segment->ipv6->payload_len) - cut);
+	segment->udp->len = htons(ntohs(segment->udp->len) - cut);
+	segment->gso_size = 0;
+
+	/* The script packet's plan checks the uncut lengths. */
+	verify_plan_put(segment->verify_plan);
+	segment->verify_plan = NULL;
+	segment->flags &= ~FLAG_VERIFY_PLANNED;
+	return segment;
+}
+
+/* Sniff and verify what the kernel sent for an outbound UDP GSO packet
+ * in the script. With --vnet_hdr on a tun device that takes USO, that
+ * is one super-packet with the script's gso_size; otherwise the kernel
+ * sends the datagrams of gso_size bytes (the last maybe shorter) that
+ * the payload is cut into, and we verify each in turn.
+ */
+static int do_outbound_script_udp_gso(
+	struct state *state, struct packet *packet,
+	struct socket *socket, char **error)
+{
+	int left = packet_payload_len(packet);
+	struct perf_sample perf_start;
+	int result = STATUS_OK;
+
+	while (left > 0) {
+		struct packet *live_packet = NULL, *segment;
+		int len = min(left, (int)packet->gso_size);
+
+		perf_phase_begin(&perf_start);
+		result = sniff_outbound_live_packet(state, socket,
+						    &live_packet, error);
+		perf_phase_end(PERF_SNIFF, &perf_start);
+		if (result != STATUS_OK) {
+			if (live_packet != NULL)
+				packet_free(live_packet);
+			return STATUS_ERR;
+		}
+
+		if (live_packet->gso_size != 0 &&
+		    left == packet_payload_len(packet)) {
+			result = check_outbound_script_packet(
+				state, packet, socket, live_packet, error);
+			packet_free(live_packet);
+			return result;
+		}
+
+		segment = udp_gso_script_segment(state, packet, len);
+		result = check_outbound_script_packet(state, segment, socket,
+						      live_packet, error);
+		packet_free(segment);
+		packet_free(live_packet);
+		if (result != STATUS_OK)
+			return result;
+		left -= len;
+	}
+	return result;
+}
+
+/* Perform the action implied by an outbound packet in a script
+ * Return STATUS_OK upon success.  Without --use_expect, return STATUS_ERR
+ * upon all failures.  With --use_expect, return STATUS_WARN upon non-fatal
+ * failures.
+ */
+static int do_outbound_script_packet(
+	struct state *state, struct packet *packet,
+	struct socket *socket,	char **error)
+{
+	DEBUGP("do_outbound_script_packet\n");
+	int result = STATUS_ERR;		/* return value */
+	struct packet *live_packet = NULL;
+	struct perf_sample perf_start;
+
+	if ((packet->icmpv4 != NULL) || (packet->icmpv6 != NULL)) {
+		asprintf(error, "outbound ICMP packets are not supported");
+		goto out;
+	}
+
+	if (packet->flags & FLAG_TRAIN)
+		return do_outbound_script_train(state, packet, socket, error);
+	if (packet->udp && packet->gso_size != 0)
+		return do_outbound_script_udp_gso(state, packet, socket,
+						  error);
+
+	/* Sniff outbound live packet and verify it's for the right socket. */
+	perf_phase_begin(&perf_start);
+	result = sniff_outbound_live_packet(state, socket, &live_packet, error);
+	perf_phase_end(PERF_SNIFF, &perf_start);
+	if (result != STATUS_OK)
+		goto out;
+
+	result = check_outbound_script_packet(state, packet, socket,
+					      live_packet, error);
 
 out:
 	if (live_packet != NULL)
@@ -1594,7 +2592,9 @@ out:
 	return result;
 }
 
-/* Checksum the packet and inject it into the kernel under test. */
+/* Inject the packet, whose checksums the caller has filled in, into
+ * the kernel under test.
+ */
 static int send_live_ip_packet(struct netdev *netdev,
 			       struct packet *packet)
 {
@@ -1604,19 +2604,77 @@ static int send_live_ip_packet(struct netdev *netdev,
 	/* We only do TCP, UDP, and ICMP */
 	assert(packet->tcp || packet->udp || packet->icmpv4 || packet->icmpv6);
 
-	/* Fill in layer 3 and layer 4 checksums */
-	checksum_packet(packet);
+	enum profile_phase_t profile_phase;
+	int result;
+
+	PROBE2(packet_send, packet_start(packet), packet->ip_bytes);
+	profile_phase = profile_phase_begin(PROFILE_INJECT);
+	result = netdev_send(netdev, packet);
+	profile_phase_end(profile_phase);
+	return result;
+}
 
-	return netdev_send(netdev, packet);
+/* With --payload_pattern, fill the payload of an inbound MPTCP data
+ * segment, already mapped to live values, with the pattern from where
+ * its DSS mapping puts it in the connection's data stream. The kernel
+ * reads the data in DSN order, so if it puts segments from different
+ * subflows together wrong, the app reads data that is not the pattern.
+ * Returns STATUS_OK on success; on failure returns STATUS_ERR and sets
+ * error message.
+ */
+static int fill_inbound_mptcp_pattern(struct socket *socket,
+				      struct packet *live_packet,
+				      char **error)
+{
+	struct mp_subflow *subflow = find_subflow_matching_socket(socket);
+	int len = packet_payload_len(live_packet);
+	u32 offset, dsn, ssn;
+	u16 dll;
+	u8 *check = NULL;
+	__be16 dss_check;
+
+	if (subflow == NULL ||
+	    !get_mptcp_stream_offset(live_packet, socket->live.remote_isn,
+				     subflow->conn->idsn, &offset)) {
+		asprintf(error, "with --payload_pattern, inbound MPTCP data "
+			 "must carry a DSS mapping");
+		return STATUS_ERR;
+	}
+	payload_pattern_fill(packet_payload(live_packet), offset, len);
+
+	/* The DSS checksum was summed over the script's zeros. */
+	get_dss_mapping(live_packet, &dsn, &ssn, &dll, &check);
+	if (check != NULL) {
+		if (payload_stream_offset(ntohl(live_packet->tcp->seq),
+					  live_packet->tcp->syn,
+					  socket->live.remote_isn) + 1 != ssn ||
+		    dll < len || dll > len + 1) {
+			asprintf(error, "with --payload_pattern, a DSS "
+				 "checksum must cover exactly one segment");
+			return STATUS_ERR;
+		}
+		memcpy(&dss_check, check, sizeof(dss_check));
+		dss_check = checksum_append(dss_check,
+					    packet_payload(live_packet), len);
+		memcpy(check, &dss_check, sizeof(dss_check));
+	}
+	checksum_packet(live_packet);
+	return STATUS_OK;
 }
 
-/* Perform the action implied by an inbound packet in a script */
-static int do_inbound_script_packet(
+/* Prepare the live packet for an inbound packet in a script, doing all
+ * the work that depends only on what has happened so far (our view of
+ * the connection, and the ISNs, timestamps and MPTCP keys the kernel
+ * chose): copy the script packet, map its fields to live values, and
+ * fill in its checksums. We do this before waiting for the packet's
+ * scheduled time, so all that remains at that time is the write that
+ * injects it. Returns the live packet, or NULL and sets error message.
+ */
+static struct packet *prepare_inbound_script_packet(
 	struct state *state, struct packet *packet,
 	struct socket *socket,	char **error)
 {
-	DEBUGP("do_inbound_script_packet\n");
-	int result = STATUS_ERR;	/* return value */
+	DEBUGP("prepare_inbound_script_packet\n");
 
 	if ((socket->state == SOCKET_PASSIVE_SYNACK_SENT) &&
 	    packet->tcp && packet->tcp->ack) {
@@ -1631,27 +2689,221 @@ static int do_inbound_script_packet(
 	}
 
 	/* Start with a bit-for-bit copy of the packet from the script. */
-	struct packet *live_packet = packet_copy(packet);
+	struct packet *live_packet = packet_pool_copy(state->packet_pool,
+						      packet);
+	struct packet_checksum_snapshot snapshot;
+	struct perf_sample perf_start;
+	bool fill_pattern, is_mptcp;
+	int result;
+
+	/* With --payload_pattern, the data is the pattern from where the
+	 * segment is in the stream, rather than the script's zeros. An
+	 * MPTCP segment's place in the data stream is known once its DSS
+	 * mapping has live values, below.
+	 */
+	fill_pattern = (state->config->payload_pattern &&
+			live_packet->tcp != NULL &&
+			packet_payload_len(live_packet) > 0);
+	is_mptcp = (get_mptcp_option(live_packet, DSS_SUBTYPE) != NULL);
+	if (fill_pattern && !is_mptcp) {
+		payload_pattern_fill(packet_payload(live_packet),
+				     payload_stream_offset(
+					     ntohl(live_packet->tcp->seq),
+					     live_packet->tcp->syn,
+					     socket->script.remote_isn),
+				     packet_payload_len(live_packet));
+		perf_phase_begin(&perf_start);
+		checksum_packet(live_packet);
+		perf_phase_end(PERF_CHECKSUM, &perf_start);
+	}
+
 	/* Map packet fields from script values to live values. */
-	if (map_inbound_packet(socket, live_packet, error))
-		goto out;
+	packet_checksum_snapshot(live_packet, &snapshot);
+	perf_phase_begin(&perf_start);
+	result = map_inbound_packet(socket, live_packet, error);
+	perf_phase_end(PERF_MAP_INBOUND, &perf_start);
+	if (result != STATUS_OK) {
+		packet_free(live_packet);
+		return NULL;
+	}
 
-	verbose_packet_dump(state, "inbound injected", live_packet,
-			    live_time_to_script_time_usecs(
-				    state, now_usecs()));
+	/* Patch the checksums for just the header words we rewrote. */
+	perf_phase_begin(&perf_start);
+	checksum_packet_incremental(live_packet, &snapshot);
+	perf_phase_end(PERF_CHECKSUM, &perf_start);
+
+	if (fill_pattern && is_mptcp &&
+	    fill_inbound_mptcp_pattern(socket, live_packet, error)) {
+		packet_free(live_packet);
+		return NULL;
+	}
 
 	if (live_packet->tcp) {
 		/* Save the TCP header so we can reset the connection later. */
 		socket->last_injected_tcp_header = *(live_packet->tcp);
 		socket->last_injected_tcp_payload_len =
 			packet_payload_len(live_packet);
+		socket->has_injected_ts = (live_packet->tcp_ts_val != NULL);
+		if (socket->has_injected_ts)
+			socket->last_injected_ts_val =
+				packet_tcp_ts_val(live_packet);
 	}
 
-	/* Inject live packet into kernel. */
-	result = send_live_ip_packet(state->netdev, live_packet);
+	return live_packet;
+}
 
-out:
-	packet_free(live_packet);
+/* Most inbound packets we inject together, in one train. */
+#define MAX_INBOUND_TRAIN_PACKETS	64
+
+/* Return true iff the given event is an inbound packet due at the same
+ * instant as the inbound packet event 'first', so the two can be
+ * injected together: either it is at "+0", or both are at the same
+ * absolute time.
+ */
+static bool is_inbound_train_event(const struct event *first,
+				   const struct event *event)
+{
+	if (event == NULL || event->type != PACKET_EVENT ||
+	    packet_direction(event->event.packet) != DIRECTION_INBOUND)
+		return false;
+	if (event->time_type == RELATIVE_TIME)
+		return event->time_usecs == 0;
+	return (event->time_type == ABSOLUTE_TIME &&
+		first->time_type == ABSOLUTE_TIME &&
+		event->time_usecs == first->time_usecs);
+}
+
+/* Inject the inbound packet of the given event, along with those of
+ * any following events due at the same instant (e.g. a data train or
+ * a burst of SACKs at "+0"). We prepare all of the live packets before
+ * waiting, and once their time comes we hand them to the netdev in one
+ * batch, so the kernel sees them arrive as close together as we can
+ * make it. The events whose packets we injected ahead are counted in
+ * state->num_injected_ahead. On error, *error_event is the event whose
+ * packet we could not prepare or inject.
+ */
+static int do_inbound_script_packet_train(
+	struct state *state, struct event *event, struct packet *packet,
+	struct socket *socket, struct event **error_event, char **error)
+{
+	struct packet *live_packets[MAX_INBOUND_TRAIN_PACKETS];
+	struct socket *sockets[MAX_INBOUND_TRAIN_PACKETS];
+	struct ack_entry entries[MAX_INBOUND_TRAIN_PACKETS];
+	struct ack_entry *handled = entries;
+	struct packet **batch = live_packets;
+	struct event *next = NULL;
+	int num_packets = 0, num_handled, num_batch, i;
+	enum profile_phase_t profile_phase;
+	int result = STATUS_OK;
+	s64 live_nsecs, write_nsecs;
+
+	DEBUGP("do_inbound_script_packet_train\n");
+
+	*error_event = event;
+	live_packets[0] = prepare_inbound_script_packet(state, packet, socket,
+							error);
+	if (live_packets[0] == NULL)
+		return STATUS_ERR;
+	sockets[0] = socket;
+	num_packets = 1;
+
+	for (next = event->next;
+	     num_packets < MAX_INBOUND_TRAIN_PACKETS &&
+	     is_inbound_train_event(event, next);
+	     next = next->next) {
+		struct packet *next_packet = next->event.packet;
+		struct socket *next_socket = NULL;
+
+		if (find_or_create_socket_for_script_packet(
+			    state, next_packet, DIRECTION_INBOUND,
+			    &next_socket, error) ||
+		    (live_packets[num_packets] =
+		     prepare_inbound_script_packet(state, next_packet,
+						   next_socket, error)) == NULL) {
+			/* Still inject the train up to here, as the
+			 * script asked for, before we report the error.
+			 */
+			*error_event = next;
+			result = STATUS_ERR;
+			break;
+		}
+		sockets[num_packets] = next_socket;
+		++num_packets;
+	}
+
+	for (i = 0, next = event; i < num_packets; ++i, next = next->next) {
+		entries[i].packet = live_packets[i];
+		entries[i].socket = sockets[i];
+		entries[i].event = next;
+		entries[i].inject = true;
+	}
+	num_handled = num_batch = num_packets;
+
+	wait_for_event(state);
+
+	/* With --ack_aggregation, pure ACKs may be held back for a later
+	 * train, and ACKs held from earlier ones may go out with this one.
+	 */
+	if (state->ack_aggregator != NULL) {
+		num_handled = ack_aggregate(state->ack_aggregator, entries,
+					    num_packets, &handled);
+		batch = calloc(num_handled + 1, sizeof(batch[0]));
+		for (i = 0, num_batch = 0; i < num_handled; ++i)
+			if (handled[i].inject)
+				batch[num_batch++] = handled[i].packet;
+	}
+
+	/* Inject live packets into kernel. */
+	for (i = 0; i < num_batch; ++i) {
+		assert(batch[i]->ip_bytes > 0);
+		assert(batch[i]->ipv4 || batch[i]->ipv6);
+		PROBE2(packet_send, packet_start(batch[i]),
+		       batch[i]->ip_bytes);
+	}
+	/* The kernel may answer within the write, so for --kernel_latency
+	 * we time from just before it.
+	 */
+	write_nsecs = state->kernel_latency != NULL ? time_now_nsecs() : 0;
+	profile_phase = profile_phase_begin(PROFILE_INJECT);
+	if (num_batch > 0 &&
+	    netdev_send_batch(state->netdev, batch, num_batch) &&
+	    result == STATUS_OK) {
+		asprintf(error, "error injecting packets");
+		result = STATUS_ERR;
+	}
+	profile_phase_end(profile_phase);
+
+	live_nsecs = time_now_nsecs();
+	for (i = 0; i < num_handled; ++i) {
+		struct ack_entry *entry = &handled[i];
+		s64 sent_nsecs = entry->packet->time_nsecs;
+
+		if (!entry->inject) {
+			record_live_packet(state, "inbound stretched",
+					   entry->packet, entry->event,
+					   live_nsecs, NULL);
+			packet_free(entry->packet);
+			continue;
+		}
+		if (state->kernel_latency != NULL)
+			entry->socket->latency_inject_nsecs =
+				sent_nsecs != 0 ? sent_nsecs : write_nsecs;
+		record_live_packet(state, "inbound injected", entry->packet,
+				   entry->event,
+				   sent_nsecs != 0 ? sent_nsecs : live_nsecs,
+				   NULL);
+		if (state->fuzzer != NULL)
+			fuzzer_add_seed(state->fuzzer, entry->packet,
+					remote_seq_script_to_live_offset(
+						entry->socket, false),
+					local_seq_script_to_live_offset(
+						entry->socket, false));
+		packet_free(entry->packet);
+	}
+	if (batch != live_packets)
+		free(batch);
+
+	state->num_injected_ahead = num_packets - 1;
 	return result;
 }
 
@@ -1668,6 +2920,13 @@ int run_packet_event(
 	enum direction_t direction = packet_direction(packet);
 	assert(direction != DIRECTION_INVALID);
 
+	/* Did we already inject this packet, in an earlier train? */
+	if (state->num_injected_ahead > 0) {
+		assert(direction == DIRECTION_INBOUND);
+		--state->num_injected_ahead;
+		return STATUS_OK;
+	}
+
 	if (find_or_create_socket_for_script_packet(
 		    state, packet, direction, &socket, &err))
 		goto out;
@@ -1685,8 +2944,8 @@ int run_packet_event(
 		else if (result == STATUS_ERR)
 			goto out;
 	} else if (direction == DIRECTION_INBOUND) {
-		wait_for_event(state);
-		if (do_inbound_script_packet(state, packet, socket, &err))
+		if (do_inbound_script_packet_train(state, event, packet,
+						   socket, &event, &err))
 			goto out;
 	} else {
 		assert(!"bad direction");  /* internal bug */
@@ -1703,79 +2962,1608 @@ out:
 	return result;
 }
 
-/* Inject a TCP RST packet to clear the connection state out of the
- * kernel, so the connection does not continue to retransmit packets
- * that may be sniffed during later test executions and cause false
- * negatives.
+/* One packet of an interleave block while it runs. */
+struct interleave_packet {
+	struct event *event;
+	struct socket *socket;	/* its socket, and so its stream */
+	s64 matched_usecs;	/* when we matched it, or 0 if not yet */
+};
+
+/* Return the first packet of the block not yet matched on the given
+ * socket, the head of its stream, or NULL. Fill in the live time its
+ * relative time counts from: when the packet before it in its stream
+ * was matched, or the block's start.
  */
-int reset_connection(struct state *state, struct socket *socket)
+static struct interleave_packet *interleave_head(
+	struct interleave_packet *packets, int num_packets,
+	struct socket *socket, s64 start_usecs, s64 *base_usecs)
 {
-	char *error = NULL;
-	u32 seq = 0, ack_seq = 0;
-	u16 window = 0;
-	struct packet *packet = NULL;
-	struct tuple live_inbound;
-	int result = 0;
+	int i;
 
-	/* Pick TCP header fields to be something the kernel will accept. */
-	if (socket->last_injected_tcp_header.ack) {
-		/* If we've already injected something, then use a sequence
-		 * number right after the last one we injected, and ACK
-		 * the last thing we ACKed, and offer the same receive
-		 * window we last offered.
-		 */
-		seq	= (ntohl(socket->last_injected_tcp_header.seq) +
-			   (socket->last_injected_tcp_header.syn ? 1 : 0) +
-			   (socket->last_injected_tcp_header.fin ? 1 : 0) +
-			   socket->last_injected_tcp_payload_len);
-		ack_seq	= ntohl(socket->last_injected_tcp_header.ack_seq);
-		window	= ntohs(socket->last_injected_tcp_header.window);
-	} else if (socket->last_outbound_tcp_header.ack) {
-		/* If the kernel ACKed something, then just make sure
-		 * we use the sequence number it ACKed, which will be
-		 * something it expects.
-		 */
-		seq = ntohl(socket->last_outbound_tcp_header.ack_seq);
-		ack_seq = ntohl(socket->last_outbound_tcp_header.seq);
-	} else {
-		/* If the kernel didn't ACK anything, then it probably
-		 * sent only an initial SYN. So we get to send any
-		 * sequence number we want, but should send an ACK
-		 * suggesting we've seen the kernel's SYN.
-		 */
-		seq = 0;
-		ack_seq = ntohl(socket->last_outbound_tcp_header.seq) + 1;
+	*base_usecs = start_usecs;
+	for (i = 0; i < num_packets; ++i) {
+		if (packets[i].socket != socket)
+			continue;
+		if (packets[i].matched_usecs == 0)
+			return &packets[i];
+		*base_usecs = packets[i].matched_usecs;
 	}
+	return NULL;
+}
 
-	packet = new_tcp_packet(socket->script.fd, socket->address_family,
-				DIRECTION_INBOUND, ECN_NONE,
-				"R.", seq, 0, ack_seq, window, NULL, &error);
-	if (packet == NULL)
-		die("%s", error);
+int run_interleave_event(struct state *state, struct event *event,
+			 struct interleave_spec *interleave, char **error)
+{
+	struct interleave_packet *packets = NULL, *head = NULL;
+	struct event *e = NULL, timed;
+	struct perf_sample perf_start;
+	int i, line = event->line_number, num_left, result = STATUS_ERR;
+	s64 start_usecs = now_usecs(), base_usecs;
+	char *err = NULL;
 
-	/* Rewrite addresses and port to match inbound live traffic. */
-	socket_get_inbound(&socket->live, &live_inbound);
-	set_packet_tuple(packet, &live_inbound);
+	DEBUGP("%d: interleave\n", event->line_number);
 
-	/* Inject live packet into kernel. */
-	result = send_live_ip_packet(state->netdev, packet);
+	if (state->config->is_wire_client) {
+		asprintf(&err, "interleave blocks need a local netdev, "
+			 "not --wire_client");
+		goto out;
+	}
 
-	packet_free(packet);
+	/* Put each packet on the stream of its socket. */
+	packets = calloc(interleave->num_packets, sizeof(*packets));
+	for (e = interleave->events, i = 0; e != NULL; e = e->next, ++i) {
+		packets[i].event = e;
+		if (find_or_create_socket_for_script_packet(
+			    state, e->event.packet, DIRECTION_OUTBOUND,
+			    &packets[i].socket, &err)) {
+			line = e->line_number;
+			goto out;
+		}
+	}
+
+	/* Match each sniffed packet to the head of its socket's stream,
+	 * as if that packet were the event now running.
+	 */
+	for (num_left = interleave->num_packets; num_left > 0; --num_left) {
+		struct packet *live_packet = NULL;
+		struct socket *socket = NULL;
+
+		perf_phase_begin(&perf_start);
+		result = sniff_any_outbound_live_packet(state, &socket,
+							&live_packet, &err);
+		perf_phase_end(PERF_SNIFF, &perf_start);
+		if (result != STATUS_OK)
+			goto out;
+
+		head = interleave_head(packets, interleave->num_packets,
+				       socket, start_usecs, &base_usecs);
+		if (head == NULL) {
+			packet_free(live_packet);
+			asprintf(&err, "packet is for a socket with no packets "
+				 "left in the interleave block");
+			result = STATUS_ERR;
+			goto out;
+		}
+
+		timed = *head->event;
+		adjust_relative_event_times_from(state, &timed, base_usecs);
+		state->event = &timed;
+		result = check_outbound_script_packet(state,
+						      head->event->event.packet,
+						      socket, live_packet, &err);
+		state->event = event;
+		packet_free(live_packet);
+		head->matched_usecs = now_usecs();
+
+		if (result == STATUS_WARN) {
+			fprintf(stderr, "%s:%d: warning handling packet: %s\n",
+				state->config->script_path,
+				head->event->line_number, err);
+			free(err);
+			err = NULL;
+			result = STATUS_OK;
+		} else if (result != STATUS_OK) {
+			line = head->event->line_number;
+			goto out;
+		}
+	}
+	result = STATUS_OK;
 
+out:
+	free(packets);
+	if (result != STATUS_OK) {
+		asprintf(error, "%s:%d: error handling packet: %s\n",
+			 state->config->script_path, line, err);
+		free(err);
+	}
 	return result;
 }
 
-struct packets *packets_new(void)
+/* One subflow of an mp_join_storm event. */
+struct storm_subflow {
+	struct tuple live_inbound;	/* 4-tuple of the packets we inject */
+	struct mp_subflow *subflow;	/* its subflow in mp_state */
+	u32 isn;			/* our ISN */
+	s64 syn_usecs;			/* when we sent the SYN */
+	s64 synack_usecs;		/* when the kernel answered it */
+	bool joined;			/* answered by a SYN/ACK with MP_JOIN */
+	bool done;			/* answered at all */
+};
+
+/* An mp_join_storm event while it runs. */
+struct storm {
+	struct state *state;
+	struct mp_join_storm_spec *spec;
+	struct mp_connection *conn;	/* connection the subflows join */
+	struct storm_subflow *subflows;
+	int num_done;			/* subflows answered so far */
+};
+
+/* Append a copy of the given option to the given list, and free it. */
+static void append_new_option(struct tcp_options *options,
+				struct tcp_option *option)
 {
-	struct packets *packets = calloc(1, sizeof(struct packets));
-
-	packets->next_ephemeral_port = ephemeral_port();  /* cache a port */
+	int result = tcp_options_append(options, option);
 
-	return packets;
+	assert(result == STATUS_OK);
+	free(option);
 }
 
-void packets_free(struct packets *packets)
+/* Return a new inbound live TCP packet on the given storm subflow,
+ * with the given flags, sequence numbers and options.
+ */
+static struct packet *new_storm_packet(struct storm *storm,
+				       struct storm_subflow *s,
+				       const char *flags, u32 seq,
+				       u32 ack_seq,
+				       struct tcp_options *options,
+				       char **error)
 {
+	struct packet *packet = NULL;
+
+	packet = new_tcp_packet(storm->spec->socket_fd,
+				storm->state->config->wire_protocol,
+				DIRECTION_INBOUND, ECN_NONE, flags, seq, 0,
+				ack_seq, 32792, options, error);
+	free(options);
+	if (packet == NULL)
+		return NULL;
+	set_packet_tuple(packet, &s->live_inbound);
+	return packet;
+}
+
+/* Return the SYN that opens the given subflow, with an MP_JOIN option
+ * carrying the kernel's token and our nonce, and add the subflow to
+ * the connection in mp_state.
+ */
+static struct packet *new_storm_syn(struct storm *storm,
+				    struct storm_subflow *s, char **error)
+{
+	struct tcp_options *options = tcp_options_new();
+	struct tcp_option *option = NULL;
+	struct packet *packet = NULL;
+
+	option = tcp_option_new(TCPOPT_MAXSEG, TCPOLEN_MAXSEG);
+	option->data.mss.bytes = htons(1460);
+	append_new_option(options, option);
+	append_new_option(options, tcp_option_new(TCPOPT_NOP, 1));
+	option = tcp_option_new(TCPOPT_WINDOW, TCPOLEN_WINDOW);
+	option->data.window_scale.shift_count = 7;
+	append_new_option(options, option);
+	option = tcp_option_new(TCPOPT_MPTCP, TCPOLEN_MP_JOIN_SYN);
+	option->data.mp_join.syn.subtype = MP_JOIN_SUBTYPE;
+	option->data.mp_join.syn.flags = MP_JOIN_SYN_FLAGS_NO_BACKUP;
+	option->data.mp_join.syn.no_ack.receiver_token =
+		htonl(storm->conn->kernel_token);
+	append_new_option(options, option);
+
+	s->isn = generate_32(mp_state.prng);
+	packet = new_storm_packet(storm, s, "S", s->isn, 0, options, error);
+	if (packet == NULL)
+		return NULL;
+
+	s->subflow = new_subflow_inbound(storm->conn, packet);
+	s->subflow->packetdrill_rand_nbr = generate_32(mp_state.prng);
+	option = get_mptcp_option(packet, MP_JOIN_SUBTYPE);
+	option->data.mp_join.syn.address_id = s->subflow->packetdrill_addr_id;
+	option->data.mp_join.syn.no_ack.sender_random_number =
+		s->subflow->packetdrill_rand_nbr;
+	checksum_packet(packet);
+	return packet;
+}
+
+/* Answer the kernel's SYN/ACK on the given subflow with the third ACK,
+ * carrying our HMAC, or, if the SYN/ACK did not accept the join, with
+ * a RST.
+ */
+static int storm_answer_synack(struct storm *storm, struct storm_subflow *s,
+			       struct packet *live_packet, char **error)
+{
+	struct mp_subflow *subflow = s->subflow;
+	struct tcp_options *options = tcp_options_new();
+	struct tcp_option *live_mp_join = get_mptcp_option(live_packet,
+							   MP_JOIN_SUBTYPE);
+	struct tcp_option *option = NULL;
+	struct packet *packet = NULL;
+	const struct mp_join_hmacs *hmacs = NULL;
+	u32 ack_seq = ntohl(live_packet->tcp->seq) + 1;
+	int result;
+
+	s->joined = (live_mp_join != NULL &&
+		     live_mp_join->length == TCPOLEN_MP_JOIN_SYN_ACK);
+	if (!s->joined) {
+		packet = new_storm_packet(storm, s, "R.", s->isn + 1, ack_seq,
+					  options, error);
+		goto send;
+	}
+
+	subflow->kernel_addr_id = live_mp_join->data.mp_join.syn.address_id;
+	subflow->kernel_rand_nbr =
+		live_mp_join->data.mp_join.syn.ack.sender_random_number;
+
+	/* The connection's keys are hashed into HMAC keys once, for all
+	 * of the storm's subflows.
+	 */
+	hmacs = mp_join_hmacs(subflow);
+	if (memcmp(&live_mp_join->data.mp_join.syn.ack.sender_hmac,
+		   hmacs->kernel, sizeof(u64)) != 0) {
+		free(options);
+		asprintf(error, "MP_JOIN SYN/ACK to port %u has a bad HMAC",
+			 ntohs(s->live_inbound.src.port));
+		return STATUS_ERR;
+	}
+
+	option = tcp_option_new(TCPOPT_MPTCP, TCPOLEN_MP_JOIN_ACK);
+	option->data.mp_join.no_syn.subtype = MP_JOIN_SUBTYPE;
+	memcpy(option->data.mp_join.no_syn.sender_hmac, hmacs->packetdrill,
+	       sizeof(option->data.mp_join.no_syn.sender_hmac));
+	append_new_option(options, option);
+	packet = new_storm_packet(storm, s, ".", s->isn + 1, ack_seq, options,
+				  error);
+send:
+	if (packet == NULL)
+		return STATUS_ERR;
+	checksum_packet(packet);
+	result = send_live_ip_packet(storm->state->netdev, packet);
+	packet_free(packet);
+	if (result != STATUS_OK)
+		asprintf(error, "error injecting MP_JOIN ACK");
+	return result;
+}
+
+/* Return the subflow the given sniffed packet answers, or NULL. */
+static struct storm_subflow *find_storm_subflow(struct storm *storm,
+						struct packet *live_packet)
+{
+	struct tuple tuple, live_outbound;
+	int i;
+
+	if (live_packet->tcp == NULL)
+		return NULL;
+	get_packet_tuple(live_packet, &tuple);
+	for (i = 0; i < storm->spec->num_subflows; ++i) {
+		struct storm_subflow *s = &storm->subflows[i];
+
+		if (tuple.dst.port != s->live_inbound.src.port)
+			continue;
+		reverse_tuple(&s->live_inbound, &live_outbound);
+		return is_equal_tuple(&tuple, &live_outbound) ? s : NULL;
+	}
+	return NULL;
+}
+
+/* Sniff packets until the kernel has answered the SYN of the given
+ * subflow, or of every subflow if s is NULL, answering each SYN/ACK
+ * as it comes. Packets that answer no SYN of the storm are dropped.
+ */
+static int storm_sniff(struct storm *storm, struct storm_subflow *s,
+		       char **error)
+{
+	struct state *state = storm->state;
+
+	while (s != NULL ? !s->done :
+	       storm->num_done < storm->spec->num_subflows) {
+		struct packet *live_packet = NULL;
+		struct storm_subflow *answered = NULL;
+		int result = STATUS_OK;
+
+		if (netdev_receive(state->netdev, state->packet_pool,
+				   &live_packet, error)) {
+			PROBE4(packet_sniff, STATUS_ERR, NULL, 0, 0);
+			return STATUS_ERR;
+		}
+		PROBE4(packet_sniff, STATUS_OK, packet_start(live_packet),
+		       live_packet->ip_bytes, packet_time_nsecs(live_packet));
+		answered = find_storm_subflow(storm, live_packet);
+		if (answered != NULL && !answered->done &&
+		    (live_packet->tcp->rst ||
+		     (live_packet->tcp->syn && live_packet->tcp->ack))) {
+			answered->synack_usecs = live_packet->time_usecs ?
+				live_packet->time_usecs : now_usecs();
+			answered->done = true;
+			++storm->num_done;
+			if (!live_packet->tcp->rst)
+				result = storm_answer_synack(storm, answered,
+							     live_packet,
+							     error);
+		}
+		packet_free(live_packet);
+		if (result != STATUS_OK)
+			return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* Print the handshake latency of each subflow, and a summary. */
+static void storm_report(struct storm *storm, struct event *event)
+{
+	const char *script_path = storm->state->config->script_path;
+	s64 min_usecs = 0, max_usecs = 0, total_usecs = 0;
+	int i, num_joined = 0;
+
+	for (i = 0; i < storm->spec->num_subflows; ++i) {
+		struct storm_subflow *s = &storm->subflows[i];
+		s64 usecs = s->synack_usecs - s->syn_usecs;
+
+		printf("%s:%d: mp_join_storm subflow %d port %u: %s "
+		       "after %lld usecs\n", script_path, event->line_number,
+		       i, ntohs(s->live_inbound.src.port),
+		       s->joined ? "joined" : "refused", usecs);
+		if (!s->joined)
+			continue;
+		if (num_joined == 0 || usecs < min_usecs)
+			min_usecs = usecs;
+		if (usecs > max_usecs)
+			max_usecs = usecs;
+		total_usecs += usecs;
+		++num_joined;
+	}
+	printf("%s:%d: mp_join_storm: %d of %d subflows joined",
+	       script_path, event->line_number, num_joined,
+	       storm->spec->num_subflows);
+	if (num_joined > 0)
+		printf("; SYN to SYN/ACK min %lld avg %lld max %lld usecs",
+		       min_usecs, total_usecs / num_joined, max_usecs);
+	printf("\n");
+}
+
+/* Pick the 4-tuple of each subflow: the kernel's end is the port of
+ * the listening socket, or else of the connection's first subflow, and
+ * ours a port of its own.
+ */
+static int storm_pick_tuples(struct storm *storm, __be16 *ports,
+			     char **error)
+{
+	struct state *state = storm->state;
+	struct config *config = state->config;
+	struct mp_subflow *first = storm->conn->subflows;
+	u16 local_port = 0;
+	int i, j;
+
+	if (storm->spec->socket_fd != SOCKET_FD_NOT_DEFINED) {
+		local_port =
+		    config->sock_fd_ports[storm->spec->socket_fd].live_local;
+	} else {
+		while (first != NULL && first->next != NULL)
+			first = first->next;
+		if (first != NULL)
+			local_port = first->dst_port;
+	}
+	if (local_port == 0) {
+		asprintf(error, "mp_join_storm finds no port to join");
+		return STATUS_ERR;
+	}
+
+	for (i = 0; i < storm->spec->num_subflows; ++i) {
+		struct storm_subflow *s = &storm->subflows[i];
+		u16 port;
+
+		do {
+			port = next_ephemeral_port(state);
+			for (j = 0; j < i; ++j) {
+				if (ntohs(ports[j]) == port)
+					break;
+			}
+		} while (j < i);
+		ports[i] = htons(port);
+		config_pool_addresses(config, state->next_address_pool++,
+				      &s->live_inbound.dst.ip,
+				      &s->live_inbound.src.ip);
+		s->live_inbound.src.port = ports[i];
+		s->live_inbound.dst.port = htons(local_port);
+	}
+	return STATUS_OK;
+}
+
+/* Open the subflows: prepare the SYNs, then at the event's time send
+ * them, all in one batch or stagger_usecs apart. With a stagger, each
+ * SYN waits for the kernel to answer the one before it, so a slow path
+ * manager spaces the SYNs out more.
+ */
+static int run_storm(struct storm *storm, __be16 *ports, char **error)
+{
+	struct state *state = storm->state;
+	struct mp_join_storm_spec *spec = storm->spec;
+	struct packet **syns = calloc(spec->num_subflows,
+				      sizeof(struct packet *));
+	int result = STATUS_ERR;
+	s64 start_usecs;
+	int i;
+
+	if (storm_pick_tuples(storm, ports, error))
+		goto out;
+	for (i = 0; i < spec->num_subflows; ++i) {
+		syns[i] = new_storm_syn(storm, &storm->subflows[i], error);
+		if (syns[i] == NULL)
+			goto out;
+	}
+	netdev_set_sniff_ports(state->netdev, ports, spec->num_subflows);
+
+	wait_for_event(state);
+	start_usecs = now_usecs();
+	if (spec->stagger_usecs == 0) {
+		for (i = 0; i < spec->num_subflows; ++i)
+			storm->subflows[i].syn_usecs = start_usecs;
+		if (netdev_send_batch(state->netdev, syns,
+				      spec->num_subflows)) {
+			asprintf(error, "error injecting MP_JOIN SYNs");
+			goto out;
+		}
+	}
+	for (i = 0; spec->stagger_usecs != 0 && i < spec->num_subflows; ++i) {
+		struct storm_subflow *s = &storm->subflows[i];
+		s64 wait_usecs = start_usecs + i * spec->stagger_usecs -
+				 now_usecs();
+
+		if (wait_usecs > 0)
+			usleep(wait_usecs);
+		s->syn_usecs = now_usecs();
+		if (send_live_ip_packet(state->netdev, syns[i])) {
+			asprintf(error, "error injecting MP_JOIN SYN");
+			goto out;
+		}
+		if (storm_sniff(storm, s, error))
+			goto out;
+	}
+	result = storm_sniff(storm, NULL, error);
+
+out:
+	for (i = 0; i < spec->num_subflows; ++i) {
+		if (syns[i] != NULL)
+			packet_free(syns[i]);
+	}
+	free(syns);
+	socket_table_update_sniff_ports(state);
+	return result;
+}
+
+int run_mp_join_storm_event(struct state *state, struct event *event,
+			    struct mp_join_storm_spec *spec, char **error)
+{
+	struct storm storm = {
+		.state = state,
+		.spec = spec,
+		.conn = mp_state.connections,
+	};
+	__be16 *ports = NULL;
+	char *err = NULL;
+	int result = STATUS_ERR;
+
+	DEBUGP("%d: mp_join_storm\n", event->line_number);
+
+	if (state->config->is_wire_client) {
+		asprintf(&err, "mp_join_storm events need a local netdev, "
+			 "not --wire_client");
+		goto out;
+	}
+	if (storm.conn == NULL || !storm.conn->packetdrill_key_set ||
+	    !storm.conn->kernel_key_set) {
+		asprintf(&err, "mp_join_storm needs an MPTCP connection with "
+			 "both keys known");
+		goto out;
+	}
+
+	storm.subflows = calloc(spec->num_subflows,
+				sizeof(struct storm_subflow));
+	ports = calloc(spec->num_subflows, sizeof(__be16));
+	result = run_storm(&storm, ports, &err);
+	if (result == STATUS_OK)
+		storm_report(&storm, event);
+	free(ports);
+	free(storm.subflows);
+
+out:
+	if (result != STATUS_OK) {
+		asprintf(error, "%s:%d: error handling mp_join_storm: %s\n",
+			 state->config->script_path, event->line_number, err);
+		free(err);
+	}
+	return result;
+}
+
+/* The data-level receiver of an MPTCP connection a peer event answers. */
+struct peer_conn {
+	struct mp_connection *conn;
+	struct peer_receiver data;	/* in the connection's DSN space */
+	bool started;			/* seen a mapping yet? */
+	u64 start_rcv_nxt;		/* data.rcv_nxt when it started */
+	struct peer_conn *next;
+};
+
+/* A socket a peer event answers, from the first segment it sends. */
+struct peer_flow {
+	struct socket *socket;
+	struct peer_conn *conn;		/* its MPTCP connection, or NULL */
+	struct tuple live_inbound;	/* 4-tuple of the ACKs we send */
+	struct peer_receiver subflow;	/* in the subflow's sequence space */
+	u64 start_rcv_nxt;		/* subflow.rcv_nxt at the start */
+	u32 seq;			/* our sequence number */
+	u16 window;			/* the receive window we offer */
+	bool has_ts;			/* does the kernel send timestamps? */
+	u32 ts_val;			/* ours, held steady so PAWS passes */
+	u32 ts_ecr;			/* the kernel's latest, to echo */
+	bool has_mapping;		/* seen a DSS mapping yet? */
+	u64 map_dsn;			/* the last mapping's DSN */
+	u32 map_ssn;			/* its relative subflow sequence */
+	u16 map_dll;			/* its data-level length */
+	struct peer_flow *next;
+};
+
+/* A peer event while it runs. */
+struct peer {
+	struct state *state;
+	struct peer_spec *spec;
+	struct mp_connection *target_conn;	/* of sock(fd), or NULL */
+	struct peer_flow *flows;
+	struct peer_conn *conns;
+	u64 segments;			/* data segments sniffed */
+	u64 drops;			/* of them, ones we dropped */
+};
+
+static const char *peer_metric_names[NUM_PEER_METRICS] = {
+	[PEER_ACKED]		= "acked",
+	[PEER_DATA_ACKED]	= "data_acked",
+	[PEER_KBPS]		= "kbps",
+	[PEER_SEGMENTS]		= "segments",
+	[PEER_RETRANSMITS]	= "retransmits",
+	[PEER_DROPS]		= "drops",
+	[PEER_ACKS]		= "acks",
+};
+
+/* Return the MPTCP connection the given socket is a subflow of, or
+ * NULL if it is a plain TCP socket.
+ */
+static struct mp_connection *socket_mp_connection(struct socket *socket)
+{
+	struct mp_subflow *subflow = find_subflow_matching_socket(socket);
+
+	return subflow != NULL ? subflow->conn : NULL;
+}
+
+/* Should the peer answer the given socket? */
+static bool peer_wants_socket(struct peer *peer, struct socket *socket)
+{
+	if (socket->protocol != IPPROTO_TCP)
+		return false;
+	if (peer->spec->socket_fd == SOCKET_FD_NOT_DEFINED ||
+	    socket->script.fd == peer->spec->socket_fd)
+		return true;
+	return (peer->target_conn != NULL &&
+		socket_mp_connection(socket) == peer->target_conn);
+}
+
+static struct peer_conn *peer_find_conn(struct peer *peer,
+					struct mp_connection *conn)
+{
+	struct peer_conn *pc;
+
+	for (pc = peer->conns; pc != NULL; pc = pc->next) {
+		if (pc->conn == conn)
+			return pc;
+	}
+	pc = calloc(1, sizeof(struct peer_conn));
+	pc->conn = conn;
+	pc->next = peer->conns;
+	peer->conns = pc;
+	return pc;
+}
+
+/* Return the flow of the given socket, starting it, as of the given
+ * segment the kernel sent, if this is the socket's first one: we take
+ * up from what we last ACKed and where our sequence space stands, as
+ * new_reset_packet() does.
+ */
+static struct peer_flow *peer_find_flow(struct peer *peer,
+					struct socket *socket,
+					struct packet *live_packet)
+{
+	const struct tcp *last = &socket->last_injected_tcp_header;
+	struct mp_connection *conn = NULL;
+	struct peer_flow *flow;
+	u32 rcv_nxt;
+
+	for (flow = peer->flows; flow != NULL; flow = flow->next) {
+		if (flow->socket == socket)
+			return flow;
+	}
+	flow = calloc(1, sizeof(struct peer_flow));
+	flow->socket = socket;
+	socket_get_inbound(&socket->live, &flow->live_inbound);
+	if (last->ack) {
+		rcv_nxt = ntohl(last->ack_seq);
+		flow->seq = ntohl(last->seq) + (last->syn ? 1 : 0) +
+			    (last->fin ? 1 : 0) +
+			    socket->last_injected_tcp_payload_len;
+		flow->window = ntohs(last->window);
+	} else {
+		rcv_nxt = ntohl(live_packet->tcp->seq);
+		flow->seq = ntohl(live_packet->tcp->ack_seq);
+		flow->window = 32792;
+	}
+	peer_receiver_init(&flow->subflow, rcv_nxt, peer->spec->ack_every,
+			   peer->spec->ack_delay_usecs);
+	flow->start_rcv_nxt = flow->subflow.rcv_nxt;
+	flow->ts_val = socket->has_injected_ts ?
+		       socket->last_injected_ts_val : 0;
+	conn = socket_mp_connection(socket);
+	if (conn != NULL)
+		flow->conn = peer_find_conn(peer, conn);
+	flow->next = peer->flows;
+	peer->flows = flow;
+	return flow;
+}
+
+/* Send an ACK of everything the flow has in order, with our timestamp
+ * echoing the kernel's, as many SACK blocks as fit and the spec allows,
+ * and, for an MPTCP subflow, its connection's data-level ACK.
+ */
+static int peer_send_ack(struct peer *peer, struct peer_flow *flow,
+			 char **error)
+{
+	struct socket *socket = flow->socket;
+	struct tcp_options *options = tcp_options_new();
+	struct tcp_option *option = NULL;
+	struct peer_block blocks[PEER_MAX_BLOCKS];
+	struct packet *packet = NULL;
+	int room = MAX_TCP_OPTION_BYTES, num_blocks, i, result;
+
+	if (flow->has_ts) {
+		append_new_option(options, tcp_option_new(TCPOPT_NOP, 1));
+		append_new_option(options, tcp_option_new(TCPOPT_NOP, 1));
+		option = tcp_option_new(TCPOPT_TIMESTAMP, TCPOLEN_TIMESTAMP);
+		option->data.time_stamp.val = htonl(flow->ts_val);
+		option->data.time_stamp.ecr = htonl(flow->ts_ecr);
+		append_new_option(options, option);
+		room -= 2 + TCPOLEN_TIMESTAMP;
+	}
+	if (flow->conn != NULL && flow->conn->started)
+		room -= TCPOLEN_DSS_DACK8;
+
+	num_blocks = peer_receiver_sack(&flow->subflow, blocks,
+					min(peer->spec->sack_blocks,
+					    (room - 4) / 8));
+	if (num_blocks > 0) {
+		append_new_option(options, tcp_option_new(TCPOPT_NOP, 1));
+		append_new_option(options, tcp_option_new(TCPOPT_NOP, 1));
+		option = tcp_option_new(TCPOPT_SACK, 2 + 8 * num_blocks);
+		for (i = 0; i < num_blocks; ++i) {
+			option->data.sack.block[i].left =
+				htonl((u32)blocks[i].start);
+			option->data.sack.block[i].right =
+				htonl((u32)blocks[i].end);
+		}
+		append_new_option(options, option);
+	}
+
+	if (flow->conn != NULL && flow->conn->started) {
+		option = tcp_option_new(TCPOPT_MPTCP, TCPOLEN_DSS_DACK8);
+		option->data.dss.subtype = DSS_SUBTYPE;
+		option->data.dss.flag_A = 1;
+		option->data.dss.flag_a = 1;
+		option->data.dss.dack.dack8 =
+			htonll(flow->conn->data.rcv_nxt);
+		append_new_option(options, option);
+	}
+
+	packet = new_tcp_packet(socket->script.fd, socket->address_family,
+				DIRECTION_INBOUND, ECN_NONE, ".", flow->seq, 0,
+				(u32)flow->subflow.rcv_nxt, flow->window,
+				options, error);
+	free(options);
+	if (packet == NULL)
+		return STATUS_ERR;
+	set_packet_tuple(packet, &flow->live_inbound);
+	checksum_packet(packet);
+
+	PROBE2(packet_send, packet_start(packet), packet->ip_bytes);
+	result = send_live_ip_packet(peer->state->netdev, packet);
+	if (result == STATUS_OK) {
+		/* Later packets and the final RST follow on from ours. */
+		socket->last_injected_tcp_header = *(packet->tcp);
+		socket->last_injected_tcp_payload_len = 0;
+		peer_receiver_acked(&flow->subflow);
+	} else {
+		asprintf(error, "error injecting peer ACK");
+	}
+	packet_free(packet);
+	return result;
+}
+
+/* Take the part of an MPTCP segment that its flow's last DSS mapping
+ * covers into the connection's data-level receiver.
+ */
+static void peer_data_segment(struct peer_flow *flow,
+			      struct packet *live_packet, s64 now)
+{
+	struct peer_conn *pc = flow->conn;
+	u32 dsn, ssn, rel_seq, len = packet_payload_len(live_packet);
+	u16 dll;
+
+	if (get_dss_mapping(live_packet, &dsn, &ssn, &dll, NULL)) {
+		flow->map_dsn = peer_unwrap_seq(pc->started ?
+						pc->data.rcv_nxt :
+						pc->conn->kernel_idsn, dsn);
+		flow->map_ssn = ssn;
+		flow->map_dll = dll;
+		flow->has_mapping = true;
+	}
+	if (!flow->has_mapping || len == 0)
+		return;
+
+	rel_seq = ntohl(live_packet->tcp->seq) - flow->socket->live.local_isn;
+	if (rel_seq - flow->map_ssn >= flow->map_dll)
+		return;		/* not in the mapping */
+	len = min(len, flow->map_dll - (rel_seq - flow->map_ssn));
+	if (!pc->started) {
+		peer_receiver_init(&pc->data,
+				   flow->map_dsn + (rel_seq - flow->map_ssn),
+				   1, 0);
+		pc->start_rcv_nxt = pc->data.rcv_nxt;
+		pc->started = true;
+	}
+	peer_receiver_segment(&pc->data,
+			      flow->map_dsn + (rel_seq - flow->map_ssn), len,
+			      now);
+}
+
+/* Answer an outbound live packet: drop it, as if lost, or take its
+ * data and ACK it if a receiver would at once.
+ */
+static int peer_live_packet(struct peer *peer, struct packet *live_packet,
+			    char **error)
+{
+	struct state *state = peer->state;
+	struct socket *socket = NULL;
+	struct peer_flow *flow = NULL;
+	struct tcp_option *ts = NULL;
+	enum direction_t direction = DIRECTION_INVALID;
+	s64 now = live_packet->time_usecs ? live_packet->time_usecs :
+		  now_usecs();
+	u32 len, drop_ppm;
+
+	socket = find_socket_for_live_packet(state, live_packet, &direction);
+	if (socket == NULL || direction != DIRECTION_OUTBOUND ||
+	    live_packet->tcp == NULL)
+		return STATUS_OK;
+	if (state->packets->meters != NULL &&
+	    meter_live_packet(state, socket, live_packet, error))
+		return STATUS_ERR;
+	if (state->kernel_latency != NULL)
+		note_kernel_latency(state, socket, live_packet);
+	if (state->dsn_coverage != NULL)
+		note_dsn_coverage(state, socket, live_packet);
+	socket->last_outbound_tcp_header = *(live_packet->tcp);
+	if (!peer_wants_socket(peer, socket) || live_packet->tcp->syn ||
+	    live_packet->tcp->rst)
+		return STATUS_OK;
+
+	flow = peer_find_flow(peer, socket, live_packet);
+	ts = get_tcp_option(live_packet, TCPOPT_TIMESTAMP);
+	if (ts != NULL) {
+		flow->has_ts = true;
+		flow->ts_ecr = ntohl(ts->data.time_stamp.val);
+	}
+	len = packet_payload_len(live_packet) + (live_packet->tcp->fin ? 1 : 0);
+	if (len == 0)
+		return STATUS_OK;
+
+	++peer->segments;
+	drop_ppm = peer->spec->loss_pct * 10000;
+	if ((peer->spec->drop_every > 0 &&
+	     peer->segments % peer->spec->drop_every == 0) ||
+	    (drop_ppm > 0 && prng_below(&state->prng, 1000000) < drop_ppm)) {
+		++peer->drops;
+		return STATUS_OK;
+	}
+
+	if (flow->conn != NULL)
+		peer_data_segment(flow, live_packet, now);
+	if (peer_receiver_segment(&flow->subflow,
+				  peer_unwrap_seq(flow->subflow.rcv_nxt,
+						  ntohl(live_packet->tcp->seq)),
+				  len, now))
+		return peer_send_ack(peer, flow, error);
+	return STATUS_OK;
+}
+
+/* Send the delayed ACKs due by now, and return when the next one is
+ * due, or end_usecs if that is sooner.
+ */
+static int peer_send_due_acks(struct peer *peer, s64 now, s64 end_usecs,
+			      s64 *deadline_usecs, char **error)
+{
+	struct peer_flow *flow;
+
+	*deadline_usecs = end_usecs;
+	for (flow = peer->flows; flow != NULL; flow = flow->next) {
+		s64 due = peer_receiver_ack_due(&flow->subflow);
+
+		if (due == 0)
+			continue;
+		if (due <= now) {
+			if (peer_send_ack(peer, flow, error))
+				return STATUS_ERR;
+			continue;
+		}
+		*deadline_usecs = min(*deadline_usecs, due);
+	}
+	return STATUS_OK;
+}
+
+/* Answer what the kernel sends from the event's time to the end of its
+ * window.
+ */
+static int run_peer(struct peer *peer, char **error)
+{
+	struct state *state = peer->state;
+	s64 now, end_usecs, deadline_usecs;
+
+	wait_for_event(state);
+	end_usecs = now_usecs() + peer->spec->window_usecs;
+	while ((now = now_usecs()) < end_usecs) {
+		struct packet *live_packet = NULL;
+		int result;
+
+		if (peer_send_due_acks(peer, now, end_usecs, &deadline_usecs,
+				       error))
+			return STATUS_ERR;
+		if (netdev_receive_until(state->netdev, state->packet_pool,
+					 deadline_usecs, &live_packet, error))
+			return STATUS_ERR;
+		if (live_packet == NULL)
+			continue;
+		PROBE4(packet_sniff, STATUS_OK, packet_start(live_packet),
+		       live_packet->ip_bytes, packet_time_nsecs(live_packet));
+		result = peer_live_packet(peer, live_packet, error);
+		packet_free(live_packet);
+		if (result != STATUS_OK)
+			return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+static double peer_value(struct peer *peer, enum peer_metric_t metric)
+{
+	struct peer_flow *flow;
+	struct peer_conn *pc;
+	u64 total = 0;
+
+	switch (metric) {
+	case PEER_ACKED:
+		for (flow = peer->flows; flow != NULL; flow = flow->next)
+			total += flow->subflow.rcv_nxt - flow->start_rcv_nxt;
+		return total;
+	case PEER_DATA_ACKED:
+		for (pc = peer->conns; pc != NULL; pc = pc->next)
+			total += pc->data.rcv_nxt - pc->start_rcv_nxt;
+		return total;
+	case PEER_KBPS:
+		total = peer_value(peer, peer->conns != NULL ?
+				   PEER_DATA_ACKED : PEER_ACKED);
+		return total * 8000.0 / peer->spec->window_usecs;
+	case PEER_SEGMENTS:
+		return peer->segments;
+	case PEER_RETRANSMITS:
+		for (flow = peer->flows; flow != NULL; flow = flow->next)
+			total += flow->subflow.retransmits;
+		return total;
+	case PEER_DROPS:
+		return peer->drops;
+	case PEER_ACKS:
+		for (flow = peer->flows; flow != NULL; flow = flow->next)
+			total += flow->subflow.acks;
+		return total;
+	case NUM_PEER_METRICS:
+		break;
+	}
+	assert(!"bad peer metric");
+	return 0;
+}
+
+/* Print what the peer saw and sent, and check its bounds. */
+static int check_peer(struct peer *peer, struct event *event, char **error)
+{
+	int i;
+
+	printf("%s:%d: peer: %.0f segments (%.0f retransmits, %.0f dropped), "
+	       "%.0f ACKs; acked %.0f bytes", peer->state->config->script_path,
+	       event->line_number, peer_value(peer, PEER_SEGMENTS),
+	       peer_value(peer, PEER_RETRANSMITS),
+	       peer_value(peer, PEER_DROPS), peer_value(peer, PEER_ACKS),
+	       peer_value(peer, PEER_ACKED));
+	if (peer->conns != NULL)
+		printf(", data_acked %.0f bytes",
+		       peer_value(peer, PEER_DATA_ACKED));
+	printf(", %.0f kbps\n", peer_value(peer, PEER_KBPS));
+
+	for (i = 0; i < peer->spec->num_checks; ++i) {
+		const struct peer_check *check = &peer->spec->checks[i];
+		double value = peer_value(peer, check->metric);
+
+		if (check->at_least ? value >= check->bound :
+				      value <= check->bound)
+			continue;
+		asprintf(error, "%s %.1f is not %s %g (%.0f segments in "
+			 "%.6f sec)", peer_metric_names[check->metric], value,
+			 check->at_least ? ">=" : "<=", check->bound,
+			 peer_value(peer, PEER_SEGMENTS),
+			 peer->spec->window_usecs / 1.0e6);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+int run_peer_event(struct state *state, struct event *event,
+		   struct peer_spec *spec, char **error)
+{
+	struct peer peer = {
+		.state = state,
+		.spec = spec,
+	};
+	struct socket *socket = NULL;
+	char *err = NULL;
+	int result = STATUS_ERR;
+
+	DEBUGP("%d: peer\n", event->line_number);
+
+	if (state->config->is_wire_client) {
+		asprintf(&err, "peer events need a local netdev, "
+			 "not --wire_client");
+		goto out;
+	}
+	if (spec->socket_fd != SOCKET_FD_NOT_DEFINED) {
+		for (socket = state->sockets; socket != NULL;
+		     socket = socket->next) {
+			if (socket->script.fd == spec->socket_fd)
+				break;
+		}
+		if (socket == NULL) {
+			asprintf(&err, "no socket with fd %d",
+				 spec->socket_fd);
+			goto out;
+		}
+		peer.target_conn = socket_mp_connection(socket);
+	}
+
+	result = run_peer(&peer, &err);
+	if (result == STATUS_OK)
+		result = check_peer(&peer, event, &err);
+
+	while (peer.flows != NULL) {
+		struct peer_flow *flow = peer.flows;
+
+		peer.flows = flow->next;
+		free(flow);
+	}
+	while (peer.conns != NULL) {
+		struct peer_conn *pc = peer.conns;
+
+		peer.conns = pc->next;
+		free(pc);
+	}
+
+out:
+	if (result != STATUS_OK) {
+		asprintf(error, "%s:%d: error handling peer: %s\n",
+			 state->config->script_path, event->line_number, err);
+		free(err);
+	}
+	return result;
+}
+
+/* Most SYNs, ACKs or RSTs of a syn_flood we inject in one batch. */
+#define SYN_FLOOD_BATCH	64
+
+/* A syn_flood event while it runs. */
+struct flood {
+	struct state *state;
+	struct syn_flood_spec *spec;
+	struct socket *listener;
+	struct endpoint local;		/* where the SYNs go */
+	struct syn_flood_table table;
+	struct packet *syn;		/* template of the SYNs */
+	struct packet *batch[SYN_FLOOD_BATCH];	/* packets to inject */
+	int num_batch;
+	s64 start_usecs;
+	u32 num_syns;			/* SYNs sent so far */
+	u64 synacks;			/* flows the kernel answered */
+	u64 refused;			/* flows the kernel reset */
+	u64 accepts;			/* connections accepted */
+	s64 cookies;			/* TcpExtSyncookiesSent delta, or -1 */
+	s64 overflows;			/* TcpExtListenOverflows delta, or -1 */
+};
+
+static const char *syn_flood_metric_names[NUM_SYN_FLOOD_METRICS] = {
+	[SYN_FLOOD_SYNS]	= "syns",
+	[SYN_FLOOD_SYNACKS]	= "synacks",
+	[SYN_FLOOD_SYNACK_P50]	= "synack_p50_usecs",
+	[SYN_FLOOD_SYNACK_P99]	= "synack_p99_usecs",
+	[SYN_FLOOD_REFUSED]	= "refused",
+	[SYN_FLOOD_COOKIES]	= "cookies",
+	[SYN_FLOOD_OVERFLOWS]	= "overflows",
+	[SYN_FLOOD_ACCEPTS]	= "accepts",
+	[SYN_FLOOD_ACCEPT_RATE]	= "accept_rate",
+};
+
+/* Return a new inbound live TCP packet of flow i of the flood, with
+ * the given flags, sequence numbers and options.
+ */
+static struct packet *new_flood_packet(struct flood *flood, u32 i,
+				       const char *flags, u32 seq,
+				       u32 ack_seq,
+				       struct tcp_options *options,
+				       char **error)
+{
+	struct packet *packet = NULL;
+	struct tuple tuple;
+
+	packet = new_tcp_packet(flood->listener->script.fd,
+				flood->state->config->wire_protocol,
+				DIRECTION_INBOUND, ECN_NONE, flags, seq, 0,
+				ack_seq, 65535, options, error);
+	free(options);
+	if (packet == NULL)
+		return NULL;
+	syn_flood_flow_endpoint(&flood->table, i, &tuple.src.ip,
+				&tuple.src.port);
+	tuple.dst = flood->local;
+	set_packet_tuple(packet, &tuple);
+	checksum_packet(packet);
+	return packet;
+}
+
+/* Return the SYN the flood's SYNs are copied from: with the options
+ * Linux would send, and MP_CAPABLE if the spec asks for it.
+ */
+static struct packet *new_flood_syn(struct flood *flood, char **error)
+{
+	struct tcp_options *options = tcp_options_new();
+	struct tcp_option *option = NULL;
+
+	option = tcp_option_new(TCPOPT_MAXSEG, TCPOLEN_MAXSEG);
+	option->data.mss.bytes = htons(1460);
+	append_new_option(options, option);
+	append_new_option(options, tcp_option_new(TCPOPT_NOP, 1));
+	append_new_option(options, tcp_option_new(TCPOPT_NOP, 1));
+	append_new_option(options, tcp_option_new(TCPOPT_SACK_PERMITTED,
+						  TCPOLEN_SACK_PERMITTED));
+	append_new_option(options, tcp_option_new(TCPOPT_NOP, 1));
+	option = tcp_option_new(TCPOPT_WINDOW, TCPOLEN_WINDOW);
+	option->data.window_scale.shift_count = 7;
+	append_new_option(options, option);
+	if (flood->spec->mptcp) {
+		option = tcp_option_new(TCPOPT_MPTCP,
+					TCPOLEN_MP_CAPABLE_V1_SYN);
+		option->data.mp_capable.subtype = MP_CAPABLE_SUBTYPE;
+		option->data.mp_capable.version = MPTCP_V1;
+		option->data.mp_capable.flags = MP_CAPABLE_FLAGS;
+		append_new_option(options, option);
+	}
+	return new_flood_packet(flood, 0, "S", 0, 0, options, error);
+}
+
+/* Inject the packets batched up so far, and free them. */
+static int flood_flush(struct flood *flood, char **error)
+{
+	int i, result = STATUS_OK;
+
+	if (flood->num_batch == 0)
+		return STATUS_OK;
+	if (netdev_send_batch(flood->state->netdev, flood->batch,
+			      flood->num_batch)) {
+		asprintf(error, "error injecting syn_flood packets");
+		result = STATUS_ERR;
+	}
+	for (i = 0; i < flood->num_batch; ++i)
+		packet_free(flood->batch[i]);
+	flood->num_batch = 0;
+	return result;
+}
+
+/* Add a packet to the batch, injecting the batch if it is full. */
+static int flood_queue(struct flood *flood, struct packet *packet,
+		       char **error)
+{
+	flood->batch[flood->num_batch++] = packet;
+	if (flood->num_batch == SYN_FLOOD_BATCH)
+		return flood_flush(flood, error);
+	return STATUS_OK;
+}
+
+/* Send the SYNs due by now: the flood's first SYN goes at its start,
+ * and then one every 1/rate seconds.
+ */
+static int flood_send_syns(struct flood *flood, s64 now, char **error)
+{
+	u64 due = (now - flood->start_usecs) * flood->spec->rate / 1.0e6 + 1;
+	u32 i;
+
+	due = min(due, (u64)flood->table.num_flows);
+	while (flood->num_syns < due) {
+		struct packet *packet = packet_pool_copy(
+			flood->state->packet_pool, flood->syn);
+		struct tuple tuple;
+
+		i = flood->num_syns++;
+		syn_flood_flow_endpoint(&flood->table, i, &tuple.src.ip,
+					&tuple.src.port);
+		tuple.dst = flood->local;
+		set_packet_tuple(packet, &tuple);
+		packet->tcp->seq = htonl(syn_flood_flow_isn(&flood->table, i));
+		checksum_packet(packet);
+		flood->table.flows[i].syn_usecs = now - flood->start_usecs;
+		if (flood_queue(flood, packet, error))
+			return STATUS_ERR;
+	}
+	return flood_flush(flood, error);
+}
+
+/* Complete the handshake of flow i, answering the given SYN/ACK. */
+static int flood_ack(struct flood *flood, u32 i, struct packet *synack,
+		     char **error)
+{
+	struct tcp_options *options = tcp_options_new();
+	struct tcp_option *mp_capable = NULL, *option = NULL;
+	struct packet *packet = NULL;
+	u64 key = syn_flood_flow_key(&flood->table, i);
+
+	mp_capable = get_mptcp_option(synack, MP_CAPABLE_SUBTYPE);
+	if (flood->spec->mptcp && mp_capable != NULL &&
+	    mp_capable->length == TCPOLEN_MP_CAPABLE_SYN) {
+		option = tcp_option_new(TCPOPT_MPTCP, TCPOLEN_MP_CAPABLE);
+		option->data.mp_capable.subtype = MP_CAPABLE_SUBTYPE;
+		option->data.mp_capable.version = MPTCP_V1;
+		option->data.mp_capable.flags = MP_CAPABLE_FLAGS;
+		memcpy(&option->data.mp_capable.no_syn.sender_key, &key,
+		       sizeof(key));
+		memcpy(&option->data.mp_capable.no_syn.receiver_key,
+		       &mp_capable->data.mp_capable.syn.key, sizeof(key));
+		append_new_option(options, option);
+	}
+	packet = new_flood_packet(flood, i, ".",
+				  syn_flood_flow_isn(&flood->table, i) + 1,
+				  ntohl(synack->tcp->seq) + 1, options, error);
+	if (packet == NULL)
+		return STATUS_ERR;
+	flood->table.flows[i].flags |= SYN_FLOOD_ACKED;
+	return flood_queue(flood, packet, error);
+}
+
+/* Note the kernel's answer to a SYN of the flood, if the packet is
+ * one, and complete the handshake if the flow is one to complete.
+ */
+static int flood_live_packet(struct flood *flood, struct packet *live_packet,
+			     s64 now, char **error)
+{
+	struct syn_flood_flow *flow = NULL;
+	struct tuple tuple;
+	s64 i;
+
+	if (live_packet->tcp == NULL)
+		return STATUS_OK;
+	get_packet_tuple(live_packet, &tuple);
+	if (tuple.src.port != flood->local.port)
+		return STATUS_OK;
+	i = syn_flood_flow_index(&flood->table, &tuple.dst.ip,
+				 tuple.dst.port);
+	if (i < 0 || i >= flood->num_syns)
+		return STATUS_OK;
+	flow = &flood->table.flows[i];
+	if (flow->flags & (SYN_FLOOD_SYNACKED | SYN_FLOOD_REFUSED))
+		return STATUS_OK;	/* a retransmit, or after the ACK */
+
+	if (live_packet->tcp->rst) {
+		flow->flags |= SYN_FLOOD_REFUSED;
+		++flood->refused;
+		return STATUS_OK;
+	}
+	if (!live_packet->tcp->syn || !live_packet->tcp->ack)
+		return STATUS_OK;
+	flow->flags |= SYN_FLOOD_SYNACKED;
+	flow->synack_usecs = now - flood->start_usecs;
+	++flood->synacks;
+	if (!syn_flood_flow_completes(&flood->table, i))
+		return STATUS_OK;
+	return flood_ack(flood, i, live_packet, error);
+}
+
+/* Accept and close the connections the flood has made so far. Each is
+ * closed with a RST, so the kernel keeps no state for it.
+ */
+static void flood_accept(struct flood *flood)
+{
+	struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+	int fd;
+
+	while ((fd = accept(flood->listener->live.fd, NULL, NULL)) >= 0) {
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger,
+			   sizeof(linger));
+		close(fd);
+		++flood->accepts;
+	}
+}
+
+/* Reset every flow the flood sent a SYN on, so no request socket or
+ * connection outlives the event.
+ */
+static int flood_reset(struct flood *flood, char **error)
+{
+	u32 i;
+
+	for (i = 0; i < flood->num_syns; ++i) {
+		struct packet *packet = NULL;
+
+		packet = new_flood_packet(
+			flood, i, "R", syn_flood_flow_isn(&flood->table, i) + 1,
+			0, tcp_options_new(), error);
+		if (packet == NULL || flood_queue(flood, packet, error))
+			return STATUS_ERR;
+	}
+	return flood_flush(flood, error);
+}
+
+/* Return how much the named MIB counter has changed since the start
+ * of the test, or -1 if we do not follow the counters.
+ */
+static s64 flood_mib(struct state *state, const char *name)
+{
+	char *error = NULL;
+	s64 delta;
+
+	if (state->mib == NULL)
+		return -1;
+	if (mib_delta(state->mib, name, &delta, &error)) {
+		free(error);
+		return -1;
+	}
+	return delta;
+}
+
+/* Send SYNs at the spec's rate for its duration, answering SYN/ACKs and
+ * accepting connections as they come.
+ */
+static int run_flood(struct flood *flood, char **error)
+{
+	struct state *state = flood->state;
+	s64 now, end_usecs, cookies, overflows;
+
+	cookies = flood_mib(state, "TcpExtSyncookiesSent");
+	overflows = flood_mib(state, "TcpExtListenOverflows");
+
+	wait_for_event(state);
+	flood->start_usecs = now_usecs();
+	end_usecs = flood->start_usecs + flood->spec->duration_usecs;
+	while ((now = now_usecs()) < end_usecs) {
+		struct packet *live_packet = NULL;
+		s64 next_usecs;
+		int result;
+
+		if (flood_send_syns(flood, now, error))
+			return STATUS_ERR;
+		flood_accept(flood);
+
+		/* Wake for the next SYN, and at least every millisecond
+		 * to accept what connections there are.
+		 */
+		next_usecs = flood->start_usecs +
+			     (s64)(flood->num_syns * 1.0e6 / flood->spec->rate);
+		next_usecs = min(next_usecs, min(now + 1000, end_usecs));
+		if (netdev_receive_until(state->netdev, state->packet_pool,
+					 next_usecs, &live_packet, error))
+			return STATUS_ERR;
+		if (live_packet == NULL)
+			continue;
+		result = flood_live_packet(flood, live_packet,
+					   live_packet->time_usecs ?
+					   live_packet->time_usecs :
+					   now_usecs(), error);
+		packet_free(live_packet);
+		if (result != STATUS_OK || flood_flush(flood, error))
+			return STATUS_ERR;
+	}
+	flood_accept(flood);
+
+	if (cookies >= 0)
+		flood->cookies = flood_mib(state, "TcpExtSyncookiesSent") -
+				 cookies;
+	if (overflows >= 0)
+		flood->overflows = flood_mib(state, "TcpExtListenOverflows") -
+				   overflows;
+	return STATUS_OK;
+}
+
+static double flood_value(struct flood *flood,
+			  enum syn_flood_metric_t metric)
+{
+	switch (metric) {
+	case SYN_FLOOD_SYNS:
+		return flood->num_syns;
+	case SYN_FLOOD_SYNACKS:
+		return flood->synacks;
+	case SYN_FLOOD_SYNACK_P50:
+		return syn_flood_latency_usecs(&flood->table, flood->num_syns,
+					       50);
+	case SYN_FLOOD_SYNACK_P99:
+		return syn_flood_latency_usecs(&flood->table, flood->num_syns,
+					       99);
+	case SYN_FLOOD_REFUSED:
+		return flood->refused;
+	case SYN_FLOOD_COOKIES:
+		return flood->cookies;
+	case SYN_FLOOD_OVERFLOWS:
+		return flood->overflows;
+	case SYN_FLOOD_ACCEPTS:
+		return flood->accepts;
+	case SYN_FLOOD_ACCEPT_RATE:
+		return flood->accepts * 1.0e6 / flood->spec->duration_usecs;
+	case NUM_SYN_FLOOD_METRICS:
+		break;
+	}
+	assert(!"bad syn_flood metric");
+	return 0;
+}
+
+/* Print what the flood saw, and check its bounds. */
+static int check_flood(struct flood *flood, struct event *event,
+		       char **error)
+{
+	int i;
+
+	printf("%s:%d: syn_flood: %u SYNs, %llu SYN/ACKs "
+	       "(p50 %.0f p99 %.0f usecs), %llu refused, %lld cookies, "
+	       "%lld overflows, %llu accepts (%.0f/sec)\n",
+	       flood->state->config->script_path, event->line_number,
+	       flood->num_syns, flood->synacks,
+	       flood_value(flood, SYN_FLOOD_SYNACK_P50),
+	       flood_value(flood, SYN_FLOOD_SYNACK_P99), flood->refused,
+	       flood->cookies, flood->overflows, flood->accepts,
+	       flood_value(flood, SYN_FLOOD_ACCEPT_RATE));
+
+	for (i = 0; i < flood->spec->num_checks; ++i) {
+		const struct syn_flood_check *check = &flood->spec->checks[i];
+		double value = flood_value(flood, check->metric);
+
+		if ((check->metric == SYN_FLOOD_COOKIES ||
+		     check->metric == SYN_FLOOD_OVERFLOWS) && value < 0) {
+			asprintf(error, "%s needs the kernel's MIB counters",
+				 syn_flood_metric_names[check->metric]);
+			return STATUS_ERR;
+		}
+		if (check->at_least ? value >= check->bound :
+				      value <= check->bound)
+			continue;
+		asprintf(error, "%s %.1f is not %s %g (%u SYNs in %.6f sec)",
+			 syn_flood_metric_names[check->metric], value,
+			 check->at_least ? ">=" : "<=", check->bound,
+			 flood->num_syns, flood->spec->duration_usecs / 1.0e6);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* Return the listening socket the flood goes to, or NULL. */
+static struct socket *find_flood_listener(struct state *state, int fd)
+{
+	struct socket *socket;
+
+	for (socket = state->sockets; socket != NULL; socket = socket->next) {
+		if (socket->state != SOCKET_PASSIVE_LISTENING ||
+		    socket->protocol != IPPROTO_TCP)
+			continue;
+		if (fd == SOCKET_FD_NOT_DEFINED || socket->script.fd == fd)
+			return socket;
+	}
+	return NULL;
+}
+
+int run_syn_flood_event(struct state *state, struct event *event,
+			struct syn_flood_spec *spec, char **error)
+{
+	struct config *config = state->config;
+	struct flood flood = {
+		.state = state,
+		.spec = spec,
+		.cookies = -1,
+		.overflows = -1,
+	};
+	u32 num_flows = spec->rate * spec->duration_usecs / 1.0e6 + 0.5;
+	char *err = NULL, *cleanup_err = NULL;
+	int result = STATUS_ERR, flags = 0;
+
+	DEBUGP("%d: syn_flood\n", event->line_number);
+
+	if (config->is_wire_client) {
+		asprintf(&err, "syn_flood events need a local netdev, "
+			 "not --wire_client");
+		goto out;
+	}
+	flood.listener = find_flood_listener(state, spec->socket_fd);
+	if (flood.listener == NULL) {
+		asprintf(&err, "no listening socket to flood");
+		goto out;
+	}
+	if (num_flows == 0)
+		num_flows = 1;
+	flood.local.ip = config->live_local_ip;
+	flood.local.port = flood.listener->live.local.port;
+	if (syn_flood_table_init(&flood.table, &config->live_remote_prefix,
+				 &config->live_remote_ip, num_flows,
+				 spec->complete_pct, prng_next_u64(&state->prng),
+				 &err))
+		goto out;
+	flood.syn = new_flood_syn(&flood, &err);
+	if (flood.syn == NULL)
+		goto free_table;
+
+	/* The SYN/ACKs go to ports of no socket, so sniff every port;
+	 * and accept without blocking.
+	 */
+	netdev_set_sniff_ports(state->netdev, NULL, -1);
+	flags = fcntl(flood.listener->live.fd, F_GETFL);
+	fcntl(flood.listener->live.fd, F_SETFL, flags | O_NONBLOCK);
+
+	result = run_flood(&flood, &err);
+	if (flood_flush(&flood, &cleanup_err) ||
+	    flood_reset(&flood, &cleanup_err)) {
+		if (result == STATUS_OK) {
+			err = cleanup_err;
+			cleanup_err = NULL;
+		}
+		result = STATUS_ERR;
+	}
+	free(cleanup_err);
+	if (result == STATUS_OK)
+		result = check_flood(&flood, event, &err);
+
+	fcntl(flood.listener->live.fd, F_SETFL, flags);
+	socket_table_update_sniff_ports(state);
+	packet_free(flood.syn);
+free_table:
+	syn_flood_table_free(&flood.table);
+
+out:
+	if (result != STATUS_OK) {
+		asprintf(error, "%s:%d: error handling syn_flood: %s\n",
+			 config->script_path, event->line_number, err);
+		free(err);
+	}
+	return result;
+}
+
+/* Return a new TCP RST packet that clears the socket's connection
+ * state out of the kernel, with live addresses and checksums.
+ */
+static struct packet *new_reset_packet(struct socket *socket)
+{
+	char *error = NULL;
+	u32 seq = 0, ack_seq = 0;
+	u16 window = 0;
+	struct packet *packet = NULL;
+	struct tuple live_inbound;
+
+	/* Pick TCP header fields to be something the kernel will accept. */
+	if (socket->last_injected_tcp_header.ack) {
+		/* If we've already injected something, then use a sequence
+		 * number right after the last one we injected, and ACK
+		 * the last thing we ACKed, and offer the same receive
+		 * window we last offered.
+		 */
+		seq	= (ntohl(socket->last_injected_tcp_header.seq) +
+			   (socket->last_injected_tcp_header.syn ? 1 : 0) +
+			   (socket->last_injected_tcp_header.fin ? 1 : 0) +
+			   socket->last_injected_tcp_payload_len);
+		ack_seq	= ntohl(socket->last_injected_tcp_header.ack_seq);
+		window	= ntohs(socket->last_injected_tcp_header.window);
+	} else if (socket->last_outbound_tcp_header.ack) {
+		/* If the kernel ACKed something, then just make sure
+		 * we use the sequence number it ACKed, which will be
+		 * something it expects.
+		 */
+		seq = ntohl(socket->last_outbound_tcp_header.ack_seq);
+		ack_seq = ntohl(socket->last_outbound_tcp_header.seq);
+	} else {
+		/* If the kernel didn't ACK anything, then it probably
+		 * sent only an initial SYN. So we get to send any
+		 * sequence number we want, but should send an ACK
+		 * suggesting we've seen the kernel's SYN.
+		 */
+		seq = 0;
+		ack_seq = ntohl(socket->last_outbound_tcp_header.seq) + 1;
+	}
+
+	packet = new_tcp_packet(socket->script.fd, socket->address_family,
+				DIRECTION_INBOUND, ECN_NONE,
+				"R.", seq, 0, ack_seq, window, NULL, &error);
+	if (packet == NULL)
+		die("%s", error);
+
+	/* Rewrite addresses and port to match inbound live traffic. */
+	socket_get_inbound(&socket->live, &live_inbound);
+	set_packet_tuple(packet, &live_inbound);
+
+	/* Fill in layer 3 and layer 4 checksums */
+	checksum_packet(packet);
+
+	return packet;
+}
+
+int reset_connections(struct state *state)
+{
+	struct socket *socket;
+	struct packet **packets;
+	int i, num_packets = 0, result;
+
+	for (socket = state->sockets; socket != NULL; socket = socket->next) {
+		if (socket->protocol == IPPROTO_TCP)
+			++num_packets;
+	}
+	if (num_packets == 0)
+		return STATUS_OK;
+
+	/* Build every RST first, then inject them as one train, so a
+	 * script with many connections pays for one batch rather than
+	 * a round trip through the inject path per connection.
+	 */
+	packets = calloc(num_packets, sizeof(struct packet *));
+	i = 0;
+	for (socket = state->sockets; socket != NULL; socket = socket->next) {
+		if (socket->protocol == IPPROTO_TCP)
+			packets[i++] = new_reset_packet(socket);
+	}
+	for (i = 0; i < num_packets; ++i)
+		PROBE2(packet_send, packet_start(packets[i]),
+		       packets[i]->ip_bytes);
+	result = netdev_send_batch(state->netdev, packets, num_packets);
+
+	for (i = 0; i < num_packets; ++i)
+		packet_free(packets[i]);
+	free(packets);
+	return result;
+}
+
+struct packets *packets_new(struct prng *prng)
+{
+	struct packets *packets = calloc(1, sizeof(struct packets));
+
+	packets->next_ephemeral_port = ephemeral_port(prng);  /* cache a port */
+
+	return packets;
+}
+
+void packets_free(struct packets *packets)
+{
+	while (packets->meters != NULL) {
+		struct meter *meter = packets->meters;
+
+		packets->meters = meter->next;
+		free(meter);
+	}
+	if (packets->trace != NULL) {
+		if (exit_packets == packets)
+			exit_packets = NULL;
+		finish_trace(packets, false);
+		packet_trace_free(packets->trace);
+	}
 	memset(packets, 0, sizeof(*packets));  /* to help catch bugs */
 	free(packets);
 }
@@ -29,18 +29,28 @@
 
 #include "script.h"
 
+struct config;
 struct event;
+struct meter;
 struct packet;
+struct packet_trace;
+struct prng;
 struct socket;
 struct state;
+struct tcp_option;
 
 /* Internal state for the packet-handling module. */
 struct packets {
 	int next_ephemeral_port;	/* cached port to use, or -1 */
+	struct packet_trace *trace;	/* for --verbose and
+					 * --flight_recorder, or NULL
+					 */
+	struct config *trace_config;	/* config the trace is for */
+	struct meter *meters;		/* meters not yet checked */
 };
 
 /* Allocate and return internal state for the packets module. */
-extern struct packets *packets_new(void);
+extern struct packets *packets_new(struct prng *prng);
 
 /* Tear down packets module state and free up the resources it has allocated. */
 extern void packets_free(struct packets *packets);
@@ -54,8 +64,89 @@ extern int run_packet_event(struct state *state,
 			    struct packet *packet,
 			    char **error);
 
-/* Inject a TCP RST packet to clear the connection state out of the kernel. */
-extern int reset_connection(struct state *state,
-			    struct socket *socket);
+/* Open the window of a meter event. Outbound packets sniffed from
+ * then on count towards it, and it is checked once a packet past its
+ * window is sniffed. On success, return STATUS_OK; on error return
+ * STATUS_ERR and fill in a malloc-allocated error message in *error.
+ */
+extern int run_meter_event(struct state *state,
+			   struct event *event,
+			   struct meter_spec *meter,
+			   char **error);
+
+/* Check the meters whose windows did not end before the last outbound
+ * packet sniffed, at the end of a script. On success, return STATUS_OK;
+ * if a check fails return STATUS_ERR and fill in a malloc-allocated
+ * error message in *error.
+ */
+extern int finish_meters(struct state *state, char **error);
+
+/* Run an mp_join_storm event: open its subflows on the newest MPTCP
+ * connection, print the handshake latency of each, and return once each
+ * one was joined or refused. On success, return STATUS_OK; on error
+ * return STATUS_ERR and fill in a malloc-allocated error message in
+ * *error.
+ */
+extern int run_mp_join_storm_event(struct state *state,
+				   struct event *event,
+				   struct mp_join_storm_spec *storm,
+				   char **error);
+
+/* Run a peer event: for its window, answer the data the kernel sends
+ * with the ACKs a receiver would send, then print what it saw and
+ * check its bounds. On success, return STATUS_OK; on error, or if a
+ * check fails, return STATUS_ERR and fill in a malloc-allocated error
+ * message in *error.
+ */
+extern int run_peer_event(struct state *state,
+			  struct event *event,
+			  struct peer_spec *peer,
+			  char **error);
+
+/* Run an interleave block: sniff outbound packets until each packet of
+ * the block has been matched, in order within the stream of its socket
+ * but in any order across streams. On success, return STATUS_OK; on
+ * error return STATUS_ERR and fill in a malloc-allocated error message
+ * in *error. Non-fatal mismatches are printed as warnings.
+ */
+extern int run_interleave_event(struct state *state,
+				struct event *event,
+				struct interleave_spec *interleave,
+				char **error);
+
+/* Run a syn_flood event: send its SYNs from a flow table rather than
+ * sockets, complete its share of the handshakes, accept and close the
+ * connections, then reset every flow, print the latencies, SYN cookies
+ * and accept() rate it saw, and check its bounds. On success, return
+ * STATUS_OK; on error, or if a check fails, return STATUS_ERR and fill
+ * in a malloc-allocated error message in *error.
+ */
+extern int run_syn_flood_event(struct state *state,
+			       struct event *event,
+			       struct syn_flood_spec *flood,
+			       char **error);
+
+/* Advance the sequence number, the ACK and SACK numbers, and the TCP
+ * timestamp val and ecr of the given script packet by the given
+ * offsets, to run it again further along in its connection, and update
+ * its checksums if it has them (as inbound packets do). On
+ * success, return STATUS_OK; on error return STATUS_ERR and fill in a
+ * malloc-allocated error message in *error.
+ */
+extern int offset_script_packet(struct packet *packet, u32 seq_offset,
+				u32 ack_offset, u32 ts_offset, char **error);
+
+/* Inject a TCP RST packet for each TCP socket of the state, as one
+ * batch, to clear the connection state out of the kernel, so the
+ * connections do not go on to retransmit packets that may be sniffed
+ * during later test executions and cause false negatives.
+ */
+extern int reset_connections(struct state *state);
+
+/* Are the given MPTCP options, the first from the live packet, equal
+ * in the fields that the script checks?
+ */
+extern bool same_mptcp_opt(struct tcp_option *opt_a,
+			   struct tcp_option *opt_b, struct packet *packet_a);
 
 #endif /* __RUN_PACKET_H__ */
@@ -0,0 +1,123 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for offset_script_packet() in run_packet.c: the copies of
+ * a script packet that a repeat block runs again must keep checksums
+ * the kernel will accept.
+ */
+
+#include "run_packet.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checksum.h"
+#include "ip.h"
+#include "packet.h"
+#include "packet_checksum.h"
+#include "packet_parser.h"
+
+static struct packet *new_tcp_packet(void)
+{
+	/* 192.0.2.1:53055 > 192.168.0.1:8080
+	 *   . 1:11(10) ack 1 win 257 <nop,nop,TS val 100 ecr 200>
+	 */
+	u8 data[] = {
+		0x45, 0x00, 0x00, 0x3e, 0x00, 0x00, 0x00, 0x00,
+		0xff, 0x06, 0x00, 0x00, 0xc0, 0x00, 0x02, 0x01,
+		0xc0, 0xa8, 0x00, 0x01, 0xcf, 0x3f, 0x1f, 0x90,
+		0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+		0x80, 0x10, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00,
+		0x01, 0x01, 0x08, 0x0a, 0x00, 0x00, 0x00, 0x64,
+		0x00, 0x00, 0x00, 0xc8,
+		'0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
+	};
+	struct packet *packet = packet_new(sizeof(data));
+	__be16 ip_check = ipv4_checksum(data, sizeof(struct ipv4));
+	char *error = NULL;
+
+	memcpy(data + offsetof(struct ipv4, check), &ip_check,
+	       sizeof(ip_check));
+	memcpy(packet->buffer, data, sizeof(data));
+	assert(parse_packet(packet, sizeof(data), PACKET_LAYER_3_IP,
+			    &error) == PACKET_OK);
+	return packet;
+}
+
+/* Is the TCP checksum of the given IPv4 packet right? */
+static bool tcp_checksum_ok(struct packet *packet)
+{
+	int tcp_bytes = ntohs(packet->ipv4->tot_len) -
+		ipv4_header_len(packet->ipv4);
+
+	return tcp_udp_v4_checksum(packet->ipv4->src_ip,
+				   packet->ipv4->dst_ip, IPPROTO_TCP,
+				   packet->tcp, tcp_bytes) == 0;
+}
+
+static void test_inbound(void)
+{
+	struct packet *script_packet = new_tcp_packet();
+	struct packet *packet = NULL;
+	char *error = NULL;
+	int iteration;
+
+	/* As the parser does for inbound packets. */
+	checksum_packet(script_packet);
+	assert(tcp_checksum_ok(script_packet));
+
+	/* As each later run of a repeat block takes a fresh copy. */
+	for (iteration = 1; iteration < 4; iteration++) {
+		packet = packet_copy(script_packet);
+		assert(offset_script_packet(packet, iteration * 2000,
+					    iteration * 100,
+					    iteration * 10,
+					    &error) == STATUS_OK);
+		assert(ntohl(packet->tcp->seq) == 1 + iteration * 2000);
+		assert(ntohl(packet->tcp->ack_seq) == 1 + iteration * 100);
+		assert(packet_tcp_ts_val(packet) == 100 + iteration * 10);
+		assert(packet_tcp_ts_ecr(packet) == 200 + iteration * 10);
+		assert(packet->flags & FLAG_CHECKSUMMED);
+		assert(tcp_checksum_ok(packet));
+		packet_free(packet);
+	}
+	packet_free(script_packet);
+}
+
+static void test_outbound(void)
+{
+	struct packet *packet = new_tcp_packet();
+	char *error = NULL;
+
+	/* Outbound script packets are never checksummed, and the offset
+	 * leaves them that way.
+	 */
+	assert(offset_script_packet(packet, 2000, 100, 10, &error) ==
+	       STATUS_OK);
+	assert(ntohl(packet->tcp->seq) == 2001);
+	assert(!(packet->flags & FLAG_CHECKSUMMED));
+	assert(packet->tcp->check == 0);
+	packet_free(packet);
+}
+
+int main(void)
+{
+	test_inbound();
+	test_outbound();
+	return 0;
+}
@@ -35,15 +35,33 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
+#if defined(linux)
+#include <linux/errqueue.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+#endif
+#include "cpu_affinity.h"
+#include "event_loop.h"
+#include "line_profile.h"
 #include "logging.h"
+#include "mib.h"
+#include "payload.h"
+#include "perf_counters.h"
+#include "probes.h"
 #include "run.h"
 #include "script.h"
+#include "udp.h"
+#include "uring.h"
 
 static int to_live_fd(struct state *state, int script_fd, int *live_fd,
 		      char **error);
@@ -60,50 +78,43 @@ static pid_t gettid(void)
 #endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)*/
 }
 
-/* Read a whole file into the given buffer of the given length. */
-static void read_whole_file(const char *path, char *buffer, int max_bytes)
+/* Open the file the main thread reads to see if the given syscall
+ * thread is sleeping. We keep it open for the life of the thread, so
+ * that checking is a single pread() with no open, close or allocation.
+ */
+static int open_thread_stat(pid_t process_id, pid_t thread_id)
 {
-	int fd = open(path, O_RDONLY);
+	char proc_path[64];
+	int fd;
+
+	snprintf(proc_path, sizeof(proc_path), "/proc/%d/task/%d/stat",
+		 process_id, thread_id);
+	fd = open(proc_path, O_RDONLY);
 	if (fd < 0)
 		die_perror("open");
-
-	int bytes = read(fd, buffer, max_bytes);
-	if (bytes < 0)
-		die_perror("read");
-	else if (bytes == max_bytes)
-		die("%s file too large to read\n", path);
-
-	if (close(fd) < 0)
-		die_perror("close");
+	return fd;
 }
 
-/* Return true iff the given thread is sleeping. */
-static bool is_thread_sleeping(pid_t process_id, pid_t thread_id)
+/* Return true iff the thread whose stat file is open on stat_fd is
+ * sleeping.
+ */
+static bool is_thread_sleeping(int stat_fd)
 {
 	/* Read the entire thread state file, using the buffer size ps uses. */
-	char *proc_path = NULL;
-	asprintf(&proc_path, "/proc/%d/task/%d/stat", process_id, thread_id);
-	const int STATE_BUFFER_BYTES = 1023;
-	char *state = calloc(STATE_BUFFER_BYTES, 1);
-	read_whole_file(proc_path, state, STATE_BUFFER_BYTES - 1);
-	state[STATE_BUFFER_BYTES - 1] = '\0';
-
-	/* Parse the thread state from the third space-delimited field. */
-	const int THREAD_STATE_INDEX = 3;
-	const char *field = state;
-	int i = 0;
-	for (i = 0; i < THREAD_STATE_INDEX - 1; i++) {
-		field = strchr(field, ' ');
-		if (field == NULL)
-			die("unable to parse %s\n", proc_path);
-		++field;
-	}
-	bool is_sleeping = (field[0] == 'S');
+	char state[1024];
+	int bytes = pread(stat_fd, state, sizeof(state) - 1, 0);
+	if (bytes < 0)
+		die_perror("pread");
+	state[bytes] = '\0';
 
-	free(proc_path);
-	free(state);
+	/* The thread state is the first field after the command name,
+	 * which is in parentheses and may itself contain spaces.
+	 */
+	const char *field = strrchr(state, ')');
+	if (field == NULL || field[1] != ' ')
+		die("unable to parse thread stat file\n");
 
-	return is_sleeping;
+	return (field[2] == 'S');
 }
 
 /* Returns number of expressions in the list. */
@@ -245,32 +256,204 @@ static int ellipsis_arg(struct expression_list *args, int index, char **error)
 	return STATUS_OK;
 }
 
-/* Free all the space used by the given iovec. */
-static void iovec_free(struct iovec *iov, size_t iov_len)
+/* Return a pointer to the socket with the given script fd, or NULL. */
+static struct socket *find_socket_by_script_fd(
+	struct state *state, int script_fd);
+static struct syscall_thread *current_syscall_thread(
+	struct state *state, enum syscall_state_t thread_state);
+
+/* With --payload_pattern, return the TCP socket with the given script
+ * fd, whose stream the pattern follows; otherwise return NULL. For
+ * MPTCP, what the app sends and receives is the connection's data
+ * stream, so counting its bytes here keeps us at the right DSN.
+ */
+static struct socket *pattern_socket(struct state *state, int script_fd)
+{
+	struct socket *socket = NULL;
+
+	if (!state->config->payload_pattern)
+		return NULL;
+	socket = find_socket_by_script_fd(state, script_fd);
+	if (socket == NULL || socket->protocol != IPPROTO_TCP)
+		return NULL;
+	return socket;
+}
+
+/* Check that a call that --payload_pattern does not follow the stream
+ * of is not sending or receiving on a TCP socket whose stream it
+ * follows. Returns STATUS_OK on success; on failure returns STATUS_ERR
+ * and sets error message.
+ */
+static int check_no_pattern(struct state *state, int script_fd,
+			    const char *name, char **error)
+{
+	if (pattern_socket(state, script_fd) == NULL)
+		return STATUS_OK;
+	asprintf(error, "%s does not support --payload_pattern", name);
+	return STATUS_ERR;
+}
+
+/* Return the shared payload for a send on the given script fd: the
+ * zeros, or with --payload_pattern the pattern from where the socket's
+ * stream is now. The first PAYLOAD_BYTES from there are ours to send.
+ */
+static u8 *send_payload_start(struct state *state, int script_fd)
+{
+	struct socket *socket = pattern_socket(state, script_fd);
+	u8 *payload = state->syscalls->send_payload;
+
+	if (socket != NULL)
+		payload += socket->payload_sent % PAYLOAD_PATTERN_PERIOD;
+	return payload;
+}
+
+/* Return a buffer of len bytes for a send call on the given script fd
+ * to send from. Sends up to PAYLOAD_BYTES share one read-only mapping;
+ * a longer send gets a buffer of its own, which we return in *to_free
+ * as well.
+ */
+static void *send_payload(struct state *state, int script_fd, size_t len,
+			  void **to_free)
+{
+	struct socket *socket = pattern_socket(state, script_fd);
+
+	*to_free = NULL;
+	if (len <= PAYLOAD_BYTES)
+		return send_payload_start(state, script_fd);
+
+	*to_free = calloc(len, 1);
+	assert(*to_free != NULL);
+	if (socket != NULL)
+		payload_pattern_fill(*to_free, socket->payload_sent, len);
+	return *to_free;
+}
+
+/* Note that a send on the given script fd returned result. */
+static void sent_payload(struct state *state, int script_fd, int result)
+{
+	struct socket *socket = pattern_socket(state, script_fd);
+
+	if (socket != NULL && result > 0)
+		socket->payload_sent += result;
+}
+
+/* Return the scratch buffer of PAYLOAD_BYTES that receives on the
+ * thread running the given system call land in, mapping it on first
+ * use. Each thread has its own, as blocking receives on different
+ * threads run at once.
+ */
+static u8 *recv_scratch(struct state *state, struct syscall_spec *syscall)
+{
+	u8 **scratch = &state->syscalls->recv_scratch;
+	char *error = NULL;
+
+	if (is_blocking_syscall(syscall))
+		scratch = &current_syscall_thread(state, SYSCALL_ENQUEUED)->
+			recv_scratch;
+	if (*scratch == NULL) {
+		*scratch = payload_scratch_new(&error);
+		if (*scratch == NULL)
+			die("%s\n", error);
+	}
+	return *scratch;
+}
+
+/* Return a buffer of len bytes for a receive call to fill: the
+ * thread's scratch buffer, or if len is longer than that a buffer of
+ * its own, which we return in *to_free as well.
+ */
+static void *recv_payload(struct state *state, struct syscall_spec *syscall,
+			  size_t len, void **to_free)
+{
+	*to_free = NULL;
+	if (len <= PAYLOAD_BYTES)
+		return recv_scratch(state, syscall);
+
+	*to_free = malloc(len);
+	assert(*to_free != NULL);
+	return *to_free;
+}
+
+/* Note that a receive on the given script fd returned result, having
+ * filled in the given buffers. With --payload_pattern, check that the
+ * data is the pattern from where the socket's stream is, and unless
+ * the receive only peeked, advance the stream. Returns STATUS_OK on
+ * success; on failure returns STATUS_ERR and sets error message.
+ */
+static int received_payload(struct state *state, int script_fd,
+			    const struct iovec *iov, size_t iov_len,
+			    int result, int flags, char **error)
+{
+	struct socket *socket = pattern_socket(state, script_fd);
+	u64 offset;
+	int i;
+
+	if (socket == NULL || result <= 0)
+		return STATUS_OK;
+
+	offset = socket->payload_received;
+	for (i = 0; i < iov_len && offset < socket->payload_received + result;
+	     ++i) {
+		size_t len = socket->payload_received + result - offset;
+		size_t good;
+
+		if (len > iov[i].iov_len)
+			len = iov[i].iov_len;
+		good = payload_pattern_mismatch(iov[i].iov_base, offset, len);
+		if (good < len) {
+			asprintf(error, "received data does not match "
+				 "--payload_pattern from stream offset %llu",
+				 (unsigned long long)(offset + good));
+			return STATUS_ERR;
+		}
+		offset += len;
+	}
+	if (!(flags & MSG_PEEK))
+		socket->payload_received += result;
+	return STATUS_OK;
+}
+
+/* Is the given buffer part of the shared payload starting at payload? */
+static bool is_shared_payload(const void *buf, const void *payload)
+{
+	return payload != NULL && (const u8 *)buf >= (const u8 *)payload &&
+		(const u8 *)buf < (const u8 *)payload + PAYLOAD_BYTES;
+}
+
+/* Free all the space used by the given iovec. Entries pointing into
+ * the given shared payload, if any, are not ours to free.
+ */
+static void iovec_free(struct iovec *iov, size_t iov_len, void *payload)
 {
 	int i;
 
 	if (iov == NULL)
 		return;
 
-	for (i = 0; i < iov_len; ++i)
-		free(iov[i].iov_base);
+	for (i = 0; i < iov_len; ++i) {
+		if (!is_shared_payload(iov[i].iov_base, payload))
+			free(iov[i].iov_base);
+	}
 	free(iov);
 }
 
 /* Allocate and fill in an iovec described by the given expression.
- * Return STATUS_OK if the expression is a valid iovec. Otherwise
- * fill in the error with a human-readable error message and return
- * STATUS_ERR.
+ * If payload is non-NULL, it is PAYLOAD_BYTES of shared payload, to
+ * send from or receive into, and the entries are laid out one after
+ * another in it, as far as they fit, rather than in buffers of their
+ * own. Return STATUS_OK if the expression is a valid
+ * iovec. Otherwise fill in the error with a human-readable error
+ * message and return STATUS_ERR.
  */
 static int iovec_new(struct expression *expression,
 		     struct iovec **iov_ptr, size_t *iov_len_ptr,
-		     char **error)
+		     void *payload, char **error)
 {
 	int status = STATUS_ERR;
 	int i;
 	struct expression_list *list;	/* input expression from script */
 	size_t iov_len = 0;
+	size_t payload_used = 0;	/* bytes of payload laid out */
 	struct iovec *iov = NULL;	/* live output */
 
 	if (check_type(expression, EXPR_LIST, error))
@@ -296,7 +479,12 @@ static int iovec_new(struct expression *expression,
 		len = iov_expr->iov_len->value.num;
 
 		iov[i].iov_len = len;
-		iov[i].iov_base = calloc(len, 1);
+		if (payload != NULL && len <= PAYLOAD_BYTES - payload_used) {
+			iov[i].iov_base = (u8 *)payload + payload_used;
+			payload_used += len;
+		} else {
+			iov[i].iov_base = calloc(len, 1);
+		}
 	}
 
 	status = STATUS_OK;
@@ -307,21 +495,180 @@ error_out:
 	return status;
 }
 
+/* With --payload_pattern, check that every entry of an iovec to send
+ * on the given script fd is in the shared payload, so that it carries
+ * the pattern. Returns STATUS_OK on success; on failure returns
+ * STATUS_ERR and sets error message.
+ */
+static int check_pattern_iovec(struct state *state, int script_fd,
+			       const struct iovec *iov, size_t iov_len,
+			       const void *payload, char **error)
+{
+	int i;
+
+	if (pattern_socket(state, script_fd) == NULL)
+		return STATUS_OK;
+	for (i = 0; i < iov_len; ++i) {
+		if (!is_shared_payload(iov[i].iov_base, payload)) {
+			asprintf(error, "with --payload_pattern, iovec entries "
+				 "must total at most %d bytes", PAYLOAD_BYTES);
+			return STATUS_ERR;
+		}
+	}
+	return STATUS_OK;
+}
+
 /* Free all the space used by the given msghdr. */
-static void msghdr_free(struct msghdr *msg, size_t iov_len)
+static void msghdr_free(struct msghdr *msg, size_t iov_len, void *payload)
 {
 	if (msg == NULL)
 		return;
 
 	free(msg->msg_name);
-	iovec_free(msg->msg_iov, iov_len);
+	iovec_free(msg->msg_iov, iov_len, payload);
 	free(msg->msg_control);
 }
 
-/* Allocate and fill in a msghdr described by the given expression. */
+/* Return how many bytes of data a control message of the given level
+ * and type carries: UDP_SEGMENT takes a u16, and all the others we
+ * know of (e.g. UDP_GRO) an int.
+ */
+static size_t cmsg_data_len(int level, int type)
+{
+#ifdef linux
+	if (level == IPPROTO_UDP && type == UDP_SEGMENT)
+		return sizeof(u16);
+#endif
+	return sizeof(int);
+}
+
+/* Get the level, type and data of the cmsghdr expression. Returns
+ * STATUS_OK on success; on failure returns STATUS_ERR and sets error
+ * message.
+ */
+static int cmsghdr_get(struct expression *expression, int *level, int *type,
+		       s32 *data, char **error)
+{
+	struct cmsghdr_expr *cmsg_expr;
+
+	if (check_type(expression, EXPR_CMSGHDR, error))
+		return STATUS_ERR;
+	cmsg_expr = expression->value.cmsghdr;
+	if (get_s32(cmsg_expr->cmsg_level, level, error) ||
+	    get_s32(cmsg_expr->cmsg_type, type, error) ||
+	    get_s32(cmsg_expr->cmsg_data, data, error))
+		return STATUS_ERR;
+	return STATUS_OK;
+}
+
+/* Allocate and fill in the msg_control buffer of the msghdr with the
+ * control messages in the given list expression, if any. For recvmsg()
+ * the buffer then has just the room for the messages the script
+ * expects. Returns STATUS_OK on success; on failure returns STATUS_ERR
+ * and sets error message.
+ */
+static int cmsgs_new(struct expression *expression, struct msghdr *msg,
+		     char **error)
+{
+	struct expression_list *list;
+	struct cmsghdr *cmsg;
+	size_t space = 0;
+	int level, type;
+	s32 data;
+
+	if (check_type(expression, EXPR_LIST, error))
+		return STATUS_ERR;
+	for (list = expression->value.list; list != NULL; list = list->next) {
+		if (cmsghdr_get(list->expression, &level, &type, &data, error))
+			return STATUS_ERR;
+		space += CMSG_SPACE(cmsg_data_len(level, type));
+	}
+	if (space == 0)
+		return STATUS_OK;
+
+	msg->msg_control = calloc(1, space);
+	msg->msg_controllen = space;
+	cmsg = CMSG_FIRSTHDR(msg);
+	for (list = expression->value.list; list != NULL; list = list->next) {
+		cmsghdr_get(list->expression, &level, &type, &data, error);
+		cmsg->cmsg_level = level;
+		cmsg->cmsg_type = type;
+		cmsg->cmsg_len = CMSG_LEN(cmsg_data_len(level, type));
+		if (cmsg_data_len(level, type) == sizeof(u16)) {
+			u16 value = data;
+
+			memcpy(CMSG_DATA(cmsg), &value, sizeof(value));
+		} else {
+			memcpy(CMSG_DATA(cmsg), &data, sizeof(data));
+		}
+		cmsg = CMSG_NXTHDR(msg, cmsg);
+	}
+	return STATUS_OK;
+}
+
+/* Check the control messages recvmsg() filled in against those in the
+ * given list expression, in order. Returns STATUS_OK if they match;
+ * otherwise returns STATUS_ERR and sets error message. A message the
+ * buffer had no room for shows up as MSG_CTRUNC in msg_flags.
+ */
+static int cmsgs_check(struct expression *expression,
+		       struct msghdr *msg, char **error)
+{
+	struct expression_list *list;
+	struct cmsghdr *cmsg;
+	int level, type, i;
+	s32 data, value;
+
+	if (expression == NULL || expression->value.list == NULL)
+		return STATUS_OK;
+	list = expression->value.list;
+	cmsg = CMSG_FIRSTHDR(msg);
+	for (i = 0; list != NULL; list = list->next, ++i) {
+		size_t len;
+
+		cmsghdr_get(list->expression, &level, &type, &data, error);
+		if (cmsg == NULL) {
+			asprintf(error, "Expected cmsg %d (level %d type %d) "
+				 "but got none", i, level, type);
+			return STATUS_ERR;
+		}
+		if (cmsg->cmsg_level != level || cmsg->cmsg_type != type) {
+			asprintf(error, "Expected cmsg %d level %d type %d "
+				 "but got level %d type %d", i, level, type,
+				 cmsg->cmsg_level, cmsg->cmsg_type);
+			return STATUS_ERR;
+		}
+		len = cmsg->cmsg_len - CMSG_LEN(0);
+		if (len == sizeof(u8)) {
+			value = *(u8 *)CMSG_DATA(cmsg);
+		} else if (len == sizeof(u16)) {
+			u16 v16;
+
+			memcpy(&v16, CMSG_DATA(cmsg), sizeof(v16));
+			value = v16;
+		} else if (len == sizeof(s32)) {
+			memcpy(&value, CMSG_DATA(cmsg), sizeof(value));
+		} else {
+			asprintf(error, "cmsg %d has %zu bytes of data; "
+				 "can only check 1, 2 or 4", i, len);
+			return STATUS_ERR;
+		}
+		if (value != data) {
+			asprintf(error, "Expected cmsg %d data %d but got %d",
+				 i, data, value);
+			return STATUS_ERR;
+		}
+		cmsg = CMSG_NXTHDR(msg, cmsg);
+	}
+	return STATUS_OK;
+}
+
+/* Allocate and fill in a msghdr described by the given expression.
+ * The payload is as for iovec_new().
+ */
 static int msghdr_new(struct expression *expression,
 		      struct msghdr **msg_ptr, size_t *iov_len_ptr,
-		      char **error)
+		      void *payload, char **error)
 {
 	int status = STATUS_ERR;
 	s32 s32_val = 0;
@@ -348,7 +695,7 @@ static int msghdr_new(struct expression *expression,
 
 	if (msg_expr->msg_iov != NULL) {
 		if (iovec_new(msg_expr->msg_iov, &msg->msg_iov, iov_len_ptr,
-			      error))
+			      payload, error))
 			goto error_out;
 	}
 
@@ -371,7 +718,10 @@ static int msghdr_new(struct expression *expression,
 		msg->msg_flags = s32_val;
 	}
 
-	/* TODO(ncardwell): msg_control, msg_controllen */
+	if (msg_expr->msg_control != NULL) {
+		if (cmsgs_new(msg_expr->msg_control, msg, error))
+			goto error_out;
+	}
 
 	status = STATUS_OK;
 
@@ -484,6 +834,28 @@ static int pollfds_check(struct expression *fds_expression,
 	return STATUS_OK;
 }
 
+/* Return the syscall thread we are running on. We match on the
+ * thread rather than the event, since in a repeat block the same
+ * event can be running on two threads at once.
+ */
+static struct syscall_thread *current_syscall_thread(
+	struct state *state, enum syscall_state_t thread_state)
+{
+	struct syscalls *syscalls = state->syscalls;
+	int i;
+
+	for (i = 0; i < syscalls->num_threads; i++) {
+		struct syscall_thread *thread = &syscalls->threads[i];
+
+		if (pthread_equal(thread->thread, pthread_self())) {
+			assert(thread->state == thread_state);
+			return thread;
+		}
+	}
+	assert(!"blocking system call not on a syscall thread");
+	return NULL;
+}
+
 /* For blocking system calls, give up the global lock and wake the
  * main thread so it can continue test execution. Callers should call
  * this function immediately before calling a system call in order to
@@ -492,12 +864,16 @@ static int pollfds_check(struct expression *fds_expression,
  */
 static void begin_syscall(struct state *state, struct syscall_spec *syscall)
 {
+	/* We hold the lock, so this is still the call's event. */
+	PROBE2(syscall_begin, state->event->line_number, syscall->name);
 	if (is_blocking_syscall(syscall)) {
-		assert(state->syscalls->state == SYSCALL_ENQUEUED);
-		state->syscalls->state = SYSCALL_RUNNING;
+		struct syscall_thread *thread =
+			current_syscall_thread(state, SYSCALL_ENQUEUED);
+
+		thread->state = SYSCALL_RUNNING;
 		run_unlock(state);
 		DEBUGP("syscall thread: begin_syscall signals dequeued\n");
-		if (pthread_cond_signal(&state->syscalls->dequeued) != 0)
+		if (pthread_cond_signal(&thread->dequeued) != 0)
 			die_perror("pthread_cond_signal");
 	}
 }
@@ -516,17 +892,24 @@ static int end_syscall(struct state *state, struct syscall_spec *syscall,
 		       enum result_check_t mode, int actual, char **error)
 {
 	int actual_errno = errno;	/* in case we clobber this later */
+	int line;			/* for the probe */
 	s32 expected = 0;
 
 	/* For blocking calls, advance state and reacquire the global lock. */
 	if (is_blocking_syscall(syscall)) {
 		s64 live_end_usecs = now_usecs();
+		struct syscall_thread *thread;
+
 		DEBUGP("syscall thread: end_syscall grabs lock\n");
 		run_lock(state);
-		state->syscalls->live_end_usecs = live_end_usecs;
-		assert(state->syscalls->state == SYSCALL_RUNNING);
-		state->syscalls->state = SYSCALL_DONE;
+		thread = current_syscall_thread(state, SYSCALL_RUNNING);
+		thread->live_end_usecs = live_end_usecs;
+		thread->state = SYSCALL_DONE;
+		line = thread->event->line_number;
+	} else {
+		line = state->event->line_number;
 	}
+	PROBE4(syscall_end, line, syscall->name, actual, actual_errno);
 
 	/* Compare actual vs expected return value */
 	if (get_s32(syscall->result, &expected, error))
@@ -576,8 +959,11 @@ static struct socket *find_socket_by_script_fd(
 	struct state *state, int script_fd)
 {
 	struct socket *socket = NULL;
-	for (socket = state->sockets; socket != NULL; socket = socket->next)
-		if (!socket->is_closed && (socket->script.fd == script_fd)) {
+	for (socket = socket_table_first(state, SOCKET_INDEX_SCRIPT_FD,
+					 script_fd);
+	     socket != NULL;
+	     socket = socket_table_next(socket, SOCKET_INDEX_SCRIPT_FD))
+		if (!socket->is_closed) {
 			// TODO: Modify the right fd (redward)
 			assert(socket->live.fd >= 0);
 			assert(socket->script.fd >= 0);
@@ -600,6 +986,64 @@ static struct socket *find_socket_by_live_fd(
 	return NULL;
 }
 
+/* Return the entry for the given script fd among the script's fds
+ * other than sockets, or NULL.
+ */
+static struct other_fd *find_other_fd(struct state *state, int script_fd)
+{
+	struct syscalls *syscalls = state->syscalls;
+	int i;
+
+	for (i = 0; i < syscalls->num_other_fds; ++i) {
+		if (syscalls->other_fds[i].script_fd == script_fd)
+			return &syscalls->other_fds[i];
+	}
+	return NULL;
+}
+
+/* Remember a new fd other than a socket that the script created, and
+ * the io_uring it belongs to, if any. Returns STATUS_OK on success; on
+ * failure returns STATUS_ERR and sets error message.
+ */
+static int add_other_fd(struct state *state, int script_fd, int live_fd,
+			struct uring *ring, char **error)
+{
+	struct syscalls *syscalls = state->syscalls;
+	struct other_fd *other_fd;
+
+	if (script_fd < 0) {
+		asprintf(error, "invalid fd %d in script", script_fd);
+		return STATUS_ERR;
+	}
+	if (find_socket_by_script_fd(state, script_fd) != NULL ||
+	    find_other_fd(state, script_fd) != NULL) {
+		asprintf(error, "duplicate fd %d in script", script_fd);
+		return STATUS_ERR;
+	}
+	if (syscalls->num_other_fds == MAX_OTHER_FDS) {
+		asprintf(error, "more than %d fds other than sockets",
+			 MAX_OTHER_FDS);
+		return STATUS_ERR;
+	}
+	other_fd = &syscalls->other_fds[syscalls->num_other_fds++];
+	other_fd->script_fd = script_fd;
+	other_fd->live_fd = live_fd;
+	other_fd->ring = ring;
+	return STATUS_OK;
+}
+
+/* Close an fd other than a socket, tearing down its io_uring if it
+ * has one. Returns what close() returns.
+ */
+static int close_other_fd(struct other_fd *other_fd)
+{
+	if (other_fd->ring != NULL) {
+		uring_free(other_fd->ring);
+		return 0;
+	}
+	return close(other_fd->live_fd);
+}
+
 /* Find the live fd corresponding to the fd in a script. Returns
  * STATUS_OK on success; on failure returns STATUS_ERR and sets
  * error message.
@@ -608,15 +1052,21 @@ static int to_live_fd(struct state *state, int script_fd, int *live_fd,
 		      char **error)
 {
 	struct socket *socket = find_socket_by_script_fd(state, script_fd);
+	struct other_fd *other_fd;
+
 	if (socket != NULL) {
 		*live_fd = socket->live.fd;
 		return STATUS_OK;
-	} else {
-		*live_fd = -1;
-		asprintf(error, "unable to find socket with script fd %d",
-			 script_fd);
-		return STATUS_ERR;
 	}
+	other_fd = find_other_fd(state, script_fd);
+	if (other_fd != NULL) {
+		*live_fd = other_fd->live_fd;
+		return STATUS_OK;
+	}
+	*live_fd = -1;
+	asprintf(error, "unable to find socket with script fd %d",
+		 script_fd);
+	return STATUS_ERR;
 }
 
 /****************************************************************************
@@ -663,6 +1113,7 @@ static int run_syscall_socket(struct state *state, int address_family,
 	socket->protocol	= protocol;
 	socket->script.fd	= script_fd;
 	socket->live.fd		= live_fd;
+	socket_table_update(state, socket);
 
 	/* Any later packets in the test script will now be mapped here. */
 	//state->socket_under_test = socket;
@@ -786,6 +1237,7 @@ static int run_syscall_accept(struct state *state,
 					     htons(port)));
 			socket->script.fd	= script_accepted_fd;
 			socket->live.fd		= live_accepted_fd;
+			socket_table_update(state, socket);
 			return STATUS_OK;
 		}
 	}
@@ -812,6 +1264,7 @@ static int run_syscall_accept(struct state *state,
 	socket->live.fd			= live_accepted_fd;
 	socket->script.fd		= script_accepted_fd;
 	socket->live.local.port = htons(state->config->sock_fd_ports[socket->script.fd].live_local);
+	socket_table_update(state, socket);
 
 	if (DEBUG_LOGGING) {
 		char local_string[ADDR_STR_LEN];
@@ -865,6 +1318,7 @@ static int run_syscall_connect(struct state *state,
 	socket->script.local.port		= 0;
 	socket->live.remote.ip   = state->config->live_remote_ip;
  	socket->live.remote.port = htons(state->config->default_live_connect_port);
+	socket_table_update(state, socket);
 	DEBUGP("success: setting socket to state %d\n", socket->state);
 	return STATUS_OK;
 }
@@ -942,14 +1396,18 @@ static int set_bind_sockaddr_config(struct state *state,
 		if(first_arg->type == EXPR_SOCKET_ADDRESS_IPV4){
 			struct sockaddr_in *sockaddr = first_arg->value.socket_address_ipv4;
 			state->config->ip_version = IP_VERSION_4;
-			state->config->sock_fd_ports[socket->script.fd].live_local = sockaddr->sin_port;
+			state->config->sock_fd_ports[socket->script.fd].live_local =
+				htons(ntohs(sockaddr->sin_port) +
+				      state->config->live_port_offset);
 			state->config->live_bind_ip.ip.v4 = sockaddr->sin_addr;
 		}
 
 		else if(first_arg->type == EXPR_SOCKET_ADDRESS_IPV6){
 			struct sockaddr_in6 *sockaddr = first_arg->value.socket_address_ipv6;
 			state->config->ip_version = IP_VERSION_6;
-			state->config->sock_fd_ports[socket->script.fd].live_local = sockaddr->sin6_port;
+			state->config->sock_fd_ports[socket->script.fd].live_local =
+				htons(ntohs(sockaddr->sin6_port) +
+				      state->config->live_port_offset);
 			state->config->live_bind_ip.ip.v6 = sockaddr->sin6_addr;
 		}
 		else{
@@ -1054,6 +1512,7 @@ static int mp_join_accept(struct state *state, struct syscall_spec *syscall,
 			//		htons(port)));
 			socket->live.fd	= script_accepted_fd;
 			socket->script.fd	= script_accepted_fd;
+			socket_table_update(state, socket);
 		//	socket->live.fd		= -1; //no live fd
 			return STATUS_OK;
 		}
@@ -1062,13 +1521,16 @@ static int mp_join_accept(struct state *state, struct syscall_spec *syscall,
 	return STATUS_OK;
 }
 
-static int syscall_accept(struct state *state, struct syscall_spec *syscall,
-			  struct expression_list *args, char **error)
+/* accept(fd, ..., ...) and, if has_flags, accept4(fd, ..., ..., flags). */
+static int do_accept(struct state *state, struct syscall_spec *syscall,
+		     struct expression_list *args, bool has_flags,
+		     char **error)
 {
 	int live_fd, script_fd, live_accepted_fd, script_accepted_fd, result;
+	int flags = 0;
 	struct sockaddr_storage live_addr;
 	socklen_t live_addrlen = sizeof(live_addr);
-	if (check_arg_count(args, 3, error))
+	if (check_arg_count(args, has_flags ? 4 : 3, error))
 		return STATUS_ERR;
 	if (s32_arg(args, 0, &script_fd, error))
 		return STATUS_ERR;
@@ -1078,10 +1540,17 @@ static int syscall_accept(struct state *state, struct syscall_spec *syscall,
 		return STATUS_ERR;
 	if (ellipsis_arg(args, 2, error))
 		return STATUS_ERR;
+	if (has_flags && s32_arg(args, 3, &flags, error))
+		return STATUS_ERR;
 
 	begin_syscall(state, syscall);
 
-	result = accept(live_fd, (struct sockaddr *)&live_addr, &live_addrlen);
+	if (has_flags)
+		result = accept4(live_fd, (struct sockaddr *)&live_addr,
+				 &live_addrlen, flags);
+	else
+		result = accept(live_fd, (struct sockaddr *)&live_addr,
+				&live_addrlen);
 
 	if (end_syscall(state, syscall, CHECK_NON_NEGATIVE, result, error))
 		return STATUS_ERR;
@@ -1100,6 +1569,18 @@ static int syscall_accept(struct state *state, struct syscall_spec *syscall,
 	return STATUS_OK;
 }
 
+static int syscall_accept(struct state *state, struct syscall_spec *syscall,
+			  struct expression_list *args, char **error)
+{
+	return do_accept(state, syscall, args, false, error);
+}
+
+static int syscall_accept4(struct state *state, struct syscall_spec *syscall,
+			   struct expression_list *args, char **error)
+{
+	return do_accept(state, syscall, args, true, error);
+}
+
 static int syscall_connect(struct state *state, struct syscall_spec *syscall,
 			   struct expression_list *args, char **error)
 {
@@ -1129,40 +1610,223 @@ static int syscall_connect(struct state *state, struct syscall_spec *syscall,
 	return end_syscall(state, syscall, CHECK_EXACT, result, error);
 }
 
-static int syscall_read(struct state *state, struct syscall_spec *syscall,
-			struct expression_list *args, char **error)
+#if defined(linux) && defined(TCP_REPAIR_WINDOW)
+
+/* setsockopt() at the IPPROTO_TCP level, for repair_connect(). */
+static int set_tcp_option(int fd, int name, const void *value, socklen_t len)
 {
-	int live_fd, script_fd, count, result;
-	char *buf = NULL;
-	if (check_arg_count(args, 3, error))
+	return setsockopt(fd, IPPROTO_TCP, name, value, len);
+}
+
+/* Put a new TCP socket in repair mode, point its send and receive
+ * queues at the given live sequence numbers, connect it, which in
+ * repair mode moves it straight to ESTABLISHED without a SYN, fill in
+ * the options and peer window a handshake would have, and leave
+ * repair mode without sending a window probe. Returns 0 on success,
+ * or -1 with errno set by the step that failed.
+ */
+static int repair_connect(int fd, const struct sockaddr *addr,
+			  socklen_t addrlen, u32 snd_nxt, u32 rcv_nxt,
+			  u32 snd_wnd, int mss, int wscale, int options)
+{
+	struct tcp_repair_opt opts[4];
+	struct tcp_repair_window window;
+	socklen_t window_len = sizeof(window);
+	int on = TCP_REPAIR_ON, off = TCP_REPAIR_OFF_NO_WP;
+	int queue, num_opts = 0;
+
+	if (set_tcp_option(fd, TCP_REPAIR, &on, sizeof(on)) < 0)
+		return -1;
+	queue = TCP_SEND_QUEUE;
+	if (set_tcp_option(fd, TCP_REPAIR_QUEUE, &queue, sizeof(queue)) < 0 ||
+	    set_tcp_option(fd, TCP_QUEUE_SEQ, &snd_nxt, sizeof(snd_nxt)) < 0)
+		return -1;
+	queue = TCP_RECV_QUEUE;
+	if (set_tcp_option(fd, TCP_REPAIR_QUEUE, &queue, sizeof(queue)) < 0 ||
+	    set_tcp_option(fd, TCP_QUEUE_SEQ, &rcv_nxt, sizeof(rcv_nxt)) < 0)
+		return -1;
+	queue = TCP_NO_QUEUE;
+	if (set_tcp_option(fd, TCP_REPAIR_QUEUE, &queue, sizeof(queue)) < 0)
+		return -1;
+
+	if (connect(fd, addr, addrlen) < 0)
+		return -1;
+
+	opts[num_opts].opt_code = TCPOPT_MAXSEG;
+	opts[num_opts++].opt_val = mss;
+	if (wscale >= 0) {
+		opts[num_opts].opt_code = TCPOPT_WINDOW;
+		opts[num_opts++].opt_val = wscale | (wscale << 16);
+	}
+	if (options & TCPI_OPT_SACK) {
+		opts[num_opts].opt_code = TCPOPT_SACK_PERMITTED;
+		opts[num_opts++].opt_val = 0;
+	}
+	if (options & TCPI_OPT_TIMESTAMPS) {
+		opts[num_opts].opt_code = TCPOPT_TIMESTAMP;
+		opts[num_opts++].opt_val = 0;
+	}
+	if (set_tcp_option(fd, TCP_REPAIR_OPTIONS, opts,
+			   num_opts * sizeof(opts[0])) < 0)
+		return -1;
+
+	/* Keep the receive window the kernel chose; set the peer's. */
+	if (getsockopt(fd, IPPROTO_TCP, TCP_REPAIR_WINDOW,
+		       &window, &window_len) < 0)
+		return -1;
+	window.snd_wl1 = rcv_nxt;
+	window.snd_wnd = snd_wnd;
+	window.max_window = snd_wnd;
+	if (set_tcp_option(fd, TCP_REPAIR_WINDOW, &window, window_len) < 0)
+		return -1;
+
+	return set_tcp_option(fd, TCP_REPAIR, &off, sizeof(off));
+}
+
+/* tcp_repair_connect(fd, snd_nxt, rcv_nxt, snd_wnd, mss, wscale, options):
+ * a pseudo system call that brings a new TCP socket straight to
+ * ESTABLISHED with TCP_REPAIR, as if connect() and a handshake had
+ * happened, so a script can start mid-connection without a SYN. The
+ * script sequence numbers of the next bytes to send and receive are
+ * snd_nxt and rcv_nxt (1 right after a handshake); the peer offers a
+ * window of snd_wnd bytes and an MSS of mss; wscale is the window
+ * scale shift of both sides, or -1 for none; and options is 0 or
+ * TCPI_OPT_SACK and/or TCPI_OPT_TIMESTAMPS. Needs CAP_NET_ADMIN.
+ *
+ * Linux has no repair mode for MPTCP, so this is for plain TCP only.
+ */
+static int syscall_tcp_repair_connect(struct state *state,
+				      struct syscall_spec *syscall,
+				      struct expression_list *args,
+				      char **error)
+{
+	int live_fd, script_fd, snd_nxt, rcv_nxt, snd_wnd;
+	int mss, wscale, options, result;
+	struct sockaddr_storage live_addr, local_addr;
+	socklen_t live_addrlen = sizeof(live_addr);
+	socklen_t local_addrlen = sizeof(local_addr);
+	struct socket *socket = NULL;
+	struct ip_address local_ip;
+	u16 local_port = 0;
+
+	if (check_arg_count(args, 7, error))
 		return STATUS_ERR;
 	if (s32_arg(args, 0, &script_fd, error))
 		return STATUS_ERR;
 	if (to_live_fd(state, script_fd, &live_fd, error))
 		return STATUS_ERR;
-	if (ellipsis_arg(args, 1, error))
+	if (s32_arg(args, 1, &snd_nxt, error))
 		return STATUS_ERR;
-	if (s32_arg(args, 2, &count, error))
+	if (s32_arg(args, 2, &rcv_nxt, error))
 		return STATUS_ERR;
-	buf = malloc(count);
-	assert(buf != NULL);
+	if (s32_arg(args, 3, &snd_wnd, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 4, &mss, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 5, &wscale, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 6, &options, error))
+		return STATUS_ERR;
+	if (wscale > 14 ||
+	    (options & ~(TCPI_OPT_SACK | TCPI_OPT_TIMESTAMPS))) {
+		asprintf(error, "bad tcp_repair_connect() wscale or options");
+		return STATUS_ERR;
+	}
 
-	begin_syscall(state, syscall);
+	socket = find_socket_by_script_fd(state, script_fd);
+	assert(socket != NULL);
+	if (socket->protocol != IPPROTO_TCP) {
+		asprintf(error, "tcp_repair_connect() needs a TCP socket");
+		return STATUS_ERR;
+	}
+	if (state->config->is_wire_client) {
+		asprintf(error, "tcp_repair_connect() needs a local test");
+		return STATUS_ERR;
+	}
+	if (run_syscall_connect(
+		    state, script_fd, true,
+		    (struct sockaddr *)&live_addr, &live_addrlen, error))
+		return STATUS_ERR;
 
-	result = read(live_fd, buf, count);
+	/* We pick both live ISNs: zero, so live sequence numbers are
+	 * the script's relative ones.
+	 */
+	socket->live.local_isn		= 0;
+	socket->live.remote_isn		= 0;
+	socket->script.local_isn	= 0;
+	socket->script.remote_isn	= 0;
 
-	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	begin_syscall(state, syscall);
 
-	free(buf);
-	return status;
-}
+	result = repair_connect(live_fd, (struct sockaddr *)&live_addr,
+				live_addrlen, snd_nxt, rcv_nxt, snd_wnd,
+				mss, wscale, options);
 
-static int syscall_readv(struct state *state, struct syscall_spec *syscall,
+	if (end_syscall(state, syscall, CHECK_EXACT, result, error))
+		return STATUS_ERR;
+	if (result < 0)
+		return STATUS_OK;
+
+	/* Seed the socket as if we had seen its handshake. Script
+	 * packets carry zero addresses and ports.
+	 */
+	if (getsockname(live_fd, (struct sockaddr *)&local_addr,
+			&local_addrlen) < 0)
+		die_perror("getsockname");
+	ip_from_sockaddr((struct sockaddr *)&local_addr, local_addrlen,
+			 &local_ip, &local_port);
+	socket->state		= SOCKET_ACTIVE_SYN_ACKED;
+	socket->live.local.ip	= state->config->live_local_ip;
+	socket->live.local.port	= htons(local_port);
+	memset(&socket->script.local, 0, sizeof(socket->script.local));
+	memset(&socket->script.remote, 0, sizeof(socket->script.remote));
+	socket->script.local.ip.address_family = state->config->wire_protocol;
+	socket->script.remote.ip.address_family = state->config->wire_protocol;
+	socket_table_update(state, socket);
+	state->socket_under_test = socket;
+	return STATUS_OK;
+}
+
+#endif  /* linux && TCP_REPAIR_WINDOW */
+
+static int syscall_read(struct state *state, struct syscall_spec *syscall,
+			struct expression_list *args, char **error)
+{
+	int live_fd, script_fd, count, result;
+	void *buf = NULL, *to_free = NULL;
+	if (check_arg_count(args, 3, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &script_fd, error))
+		return STATUS_ERR;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		return STATUS_ERR;
+	if (ellipsis_arg(args, 1, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 2, &count, error))
+		return STATUS_ERR;
+	buf = recv_payload(state, syscall, count, &to_free);
+
+	begin_syscall(state, syscall);
+
+	result = read(live_fd, buf, count);
+
+	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	struct iovec iov = { .iov_base = buf, .iov_len = count };
+
+	if (status == STATUS_OK)
+		status = received_payload(state, script_fd, &iov, 1, result,
+					  0, error);
+	free(to_free);
+	return status;
+}
+
+static int syscall_readv(struct state *state, struct syscall_spec *syscall,
 			 struct expression_list *args, char **error)
 {
 	int live_fd, script_fd, iov_count, result;
 	struct expression *iov_expression = NULL;
 	struct iovec *iov = NULL;
+	u8 *scratch = NULL;
 	size_t iov_len = 0;
 	int status = STATUS_ERR;
 
@@ -1177,7 +1841,8 @@ static int syscall_readv(struct state *state, struct syscall_spec *syscall,
 	iov_expression = get_arg(args, 1, error);
 	if (iov_expression == NULL)
 		goto error_out;
-	if (iovec_new(iov_expression, &iov, &iov_len, error))
+	scratch = recv_scratch(state, syscall);
+	if (iovec_new(iov_expression, &iov, &iov_len, scratch, error))
 		goto error_out;
 
 	if (s32_arg(args, 2, &iov_count, error))
@@ -1195,9 +1860,12 @@ static int syscall_readv(struct state *state, struct syscall_spec *syscall,
 	result = readv(live_fd, iov, iov_count);
 
 	status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	if (status == STATUS_OK)
+		status = received_payload(state, script_fd, iov, iov_len,
+					  result, 0, error);
 
 error_out:
-	iovec_free(iov, iov_len);
+	iovec_free(iov, iov_len, scratch);
 	return status;
 }
 
@@ -1205,7 +1873,7 @@ static int syscall_recv(struct state *state, struct syscall_spec *syscall,
 			struct expression_list *args, char **error)
 {
 	int live_fd, script_fd, count, flags, result;
-	char *buf = NULL;
+	void *buf = NULL, *to_free = NULL;
 	if (check_arg_count(args, 4, error))
 		return STATUS_ERR;
 	if (s32_arg(args, 0, &script_fd, error))
@@ -1218,16 +1886,19 @@ static int syscall_recv(struct state *state, struct syscall_spec *syscall,
 		return STATUS_ERR;
 	if (s32_arg(args, 3, &flags, error))
 		return STATUS_ERR;
-	buf = malloc(count);
-	assert(buf != NULL);
+	buf = recv_payload(state, syscall, count, &to_free);
 
 	begin_syscall(state, syscall);
 
 	result = recv(live_fd, buf, count, flags);
 
 	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	struct iovec iov = { .iov_base = buf, .iov_len = count };
 
-	free(buf);
+	if (status == STATUS_OK)
+		status = received_payload(state, script_fd, &iov, 1, result,
+					  flags, error);
+	free(to_free);
 	return status;
 }
 
@@ -1237,7 +1908,7 @@ static int syscall_recvfrom(struct state *state, struct syscall_spec *syscall,
 	int live_fd, script_fd, count, flags, result;
 	struct sockaddr_storage live_addr;
 	socklen_t live_addrlen = sizeof(live_addr);
-	char *buf = NULL;
+	void *buf = NULL, *to_free = NULL;
 	if (check_arg_count(args, 6, error))
 		return STATUS_ERR;
 	if (s32_arg(args, 0, &script_fd, error))
@@ -1254,8 +1925,7 @@ static int syscall_recvfrom(struct state *state, struct syscall_spec *syscall,
 		return STATUS_ERR;
 	if (ellipsis_arg(args, 5, error))
 		return STATUS_ERR;
-	buf = malloc(count);
-	assert(buf != NULL);
+	buf = recv_payload(state, syscall, count, &to_free);
 
 	begin_syscall(state, syscall);
 
@@ -1263,8 +1933,12 @@ static int syscall_recvfrom(struct state *state, struct syscall_spec *syscall,
 			  (struct sockaddr *)&live_addr, &live_addrlen);
 
 	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	struct iovec iov = { .iov_base = buf, .iov_len = count };
 
-	free(buf);
+	if (status == STATUS_OK)
+		status = received_payload(state, script_fd, &iov, 1, result,
+					  flags, error);
+	free(to_free);
 	return status;
 }
 
@@ -1276,6 +1950,7 @@ static int syscall_recvmsg(struct state *state, struct syscall_spec *syscall,
 	struct msghdr *msg = NULL;
 	size_t iov_len = 0;
 	int expected_msg_flags = 0;
+	u8 *scratch = NULL;
 	int status = STATUS_ERR;
 
 	if (check_arg_count(args, 3, error))
@@ -1288,7 +1963,8 @@ static int syscall_recvmsg(struct state *state, struct syscall_spec *syscall,
 	msg_expression = get_arg(args, 1, error);
 	if (msg_expression == NULL)
 		goto error_out;
-	if (msghdr_new(msg_expression, &msg, &iov_len, error))
+	scratch = recv_scratch(state, syscall);
+	if (msghdr_new(msg_expression, &msg, &iov_len, scratch, error))
 		goto error_out;
 
 	if (s32_arg(args, 2, &flags, error))
@@ -1302,17 +1978,23 @@ static int syscall_recvmsg(struct state *state, struct syscall_spec *syscall,
 
 	if (end_syscall(state, syscall, CHECK_EXACT, result, error))
 		goto error_out;
+	if (received_payload(state, script_fd, msg->msg_iov, iov_len, result,
+			     flags, error))
+		goto error_out;
 
 	if (msg->msg_flags != expected_msg_flags) {
 		asprintf(error, "Expected msg_flags 0x%08X but got 0x%08X",
 			 expected_msg_flags, msg->msg_flags);
 		goto error_out;
 	}
+	if (cmsgs_check(msg_expression->value.msghdr->msg_control, msg,
+			error))
+		goto error_out;
 
 	status = STATUS_OK;
 
 error_out:
-	msghdr_free(msg, iov_len);
+	msghdr_free(msg, iov_len, scratch);
 	return status;
 }
 
@@ -1320,7 +2002,7 @@ static int syscall_write(struct state *state, struct syscall_spec *syscall,
 			 struct expression_list *args, char **error)
 {
 	int live_fd, script_fd, count, result;
-	char *buf = NULL;
+	void *buf = NULL, *to_free = NULL;
 	if (check_arg_count(args, 3, error))
 		return STATUS_ERR;
 	if (s32_arg(args, 0, &script_fd, error))
@@ -1331,8 +2013,7 @@ static int syscall_write(struct state *state, struct syscall_spec *syscall,
 		return STATUS_ERR;
 	if (s32_arg(args, 2, &count, error))
 		return STATUS_ERR;
-	buf = calloc(count, 1);
-	assert(buf != NULL);
+	buf = send_payload(state, script_fd, count, &to_free);
 
 	begin_syscall(state, syscall);
 
@@ -1340,7 +2021,9 @@ static int syscall_write(struct state *state, struct syscall_spec *syscall,
 
 	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
 
-	free(buf);
+	sent_payload(state, script_fd, result);
+
+	free(to_free);
 	return status;
 }
 
@@ -1350,6 +2033,7 @@ static int syscall_writev(struct state *state, struct syscall_spec *syscall,
 	int live_fd, script_fd, iov_count, result;
 	struct expression *iov_expression = NULL;
 	struct iovec *iov = NULL;
+	u8 *payload = NULL;
 	size_t iov_len = 0;
 	int status = STATUS_ERR;
 
@@ -1364,7 +2048,11 @@ static int syscall_writev(struct state *state, struct syscall_spec *syscall,
 	iov_expression = get_arg(args, 1, error);
 	if (iov_expression == NULL)
 		goto error_out;
-	if (iovec_new(iov_expression, &iov, &iov_len, error))
+	payload = send_payload_start(state, script_fd);
+	if (iovec_new(iov_expression, &iov, &iov_len, payload, error))
+		goto error_out;
+	if (check_pattern_iovec(state, script_fd, iov, iov_len, payload,
+				error))
 		goto error_out;
 
 	if (s32_arg(args, 2, &iov_count, error))
@@ -1382,9 +2070,10 @@ static int syscall_writev(struct state *state, struct syscall_spec *syscall,
 	result = writev(live_fd, iov, iov_count);
 
 	status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	sent_payload(state, script_fd, result);
 
 error_out:
-	iovec_free(iov, iov_len);
+	iovec_free(iov, iov_len, payload);
 	return status;
 }
 
@@ -1392,7 +2081,7 @@ static int syscall_send(struct state *state, struct syscall_spec *syscall,
 			struct expression_list *args, char **error)
 {
 	int live_fd, script_fd, count, flags, result;
-	char *buf = NULL;
+	void *buf = NULL, *to_free = NULL;
 	if (check_arg_count(args, 4, error))
 		return STATUS_ERR;
 	if (s32_arg(args, 0, &script_fd, error))
@@ -1405,8 +2094,7 @@ static int syscall_send(struct state *state, struct syscall_spec *syscall,
 		return STATUS_ERR;
 	if (s32_arg(args, 3, &flags, error))
 		return STATUS_ERR;
-	buf = calloc(count, 1);
-	assert(buf != NULL);
+	buf = send_payload(state, script_fd, count, &to_free);
 
 	begin_syscall(state, syscall);
 
@@ -1414,7 +2102,9 @@ static int syscall_send(struct state *state, struct syscall_spec *syscall,
 
 	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
 
-	free(buf);
+	sent_payload(state, script_fd, result);
+
+	free(to_free);
 	return status;
 }
 
@@ -1424,7 +2114,7 @@ static int syscall_sendto(struct state *state, struct syscall_spec *syscall,
 	int live_fd, script_fd, count, flags, result;
 	struct sockaddr_storage live_addr;
 	socklen_t live_addrlen = sizeof(live_addr);
-	char *buf = NULL;
+	void *buf = NULL, *to_free = NULL;
 	if (check_arg_count(args, 6, error))
 		return STATUS_ERR;
 	if (s32_arg(args, 0, &script_fd, error))
@@ -1447,8 +2137,7 @@ static int syscall_sendto(struct state *state, struct syscall_spec *syscall,
 		    (struct sockaddr *)&live_addr, &live_addrlen, error))
 		return STATUS_ERR;
 
-	buf = calloc(count, 1);
-	assert(buf != NULL);
+	buf = send_payload(state, script_fd, count, &to_free);
 
 	begin_syscall(state, syscall);
 
@@ -1457,7 +2146,9 @@ static int syscall_sendto(struct state *state, struct syscall_spec *syscall,
 
 	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
 
-	free(buf);
+	sent_payload(state, script_fd, result);
+
+	free(to_free);
 	return status;
 }
 
@@ -1468,6 +2159,7 @@ static int syscall_sendmsg(struct state *state, struct syscall_spec *syscall,
 	struct expression *msg_expression = NULL;
 	struct msghdr *msg = NULL;
 	size_t iov_len = 0;
+	u8 *payload = NULL;
 	int status = STATUS_ERR;
 
 	if (check_arg_count(args, 3, error))
@@ -1480,7 +2172,11 @@ static int syscall_sendmsg(struct state *state, struct syscall_spec *syscall,
 	msg_expression = get_arg(args, 1, error);
 	if (msg_expression == NULL)
 		goto error_out;
-	if (msghdr_new(msg_expression, &msg, &iov_len, error))
+	payload = send_payload_start(state, script_fd);
+	if (msghdr_new(msg_expression, &msg, &iov_len, payload, error))
+		goto error_out;
+	if (check_pattern_iovec(state, script_fd, msg->msg_iov, iov_len,
+				payload, error))
 		goto error_out;
 
 	if (s32_arg(args, 2, &flags, error))
@@ -1500,12 +2196,368 @@ static int syscall_sendmsg(struct state *state, struct syscall_spec *syscall,
 	result = sendmsg(live_fd, msg, flags);
 
 	status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	sent_payload(state, script_fd, result);
+
+error_out:
+	msghdr_free(msg, iov_len, payload);
+	return status;
+}
+
+#if defined(linux)
+/* Make sure the sparse file of zeros that sendfile() and splice() read
+ * holds at least len bytes, creating it on first use. Returns
+ * STATUS_OK on success; on failure returns STATUS_ERR and sets error
+ * message.
+ */
+static int zero_file_grow(struct state *state, off_t len, char **error)
+{
+	struct syscalls *syscalls = state->syscalls;
+
+	if (syscalls->zero_file_fd < 0) {
+		char path[] = "/tmp/packetdrill-zeros-XXXXXX";
+
+		syscalls->zero_file_fd = mkstemp(path);
+		if (syscalls->zero_file_fd < 0) {
+			asprintf(error, "mkstemp: %s", strerror(errno));
+			return STATUS_ERR;
+		}
+		unlink(path);
+	}
+	if (len > syscalls->zero_file_bytes) {
+		if (ftruncate(syscalls->zero_file_fd, len) < 0) {
+			asprintf(error, "ftruncate: %s", strerror(errno));
+			return STATUS_ERR;
+		}
+		syscalls->zero_file_bytes = len;
+	}
+	return STATUS_OK;
+}
+
+/* Make sure our pipe for splice() exists and can hold len bytes. If
+ * empty is true, also throw away anything a short splice() left in it.
+ * Returns STATUS_OK on success; on failure returns STATUS_ERR and sets
+ * error message.
+ */
+static int splice_pipe_prepare(struct state *state, int len, bool empty,
+			       char **error)
+{
+	struct syscalls *syscalls = state->syscalls;
+	int queued = 0;
+
+	if (syscalls->pipe_fds[0] >= 0 && empty &&
+	    (ioctl(syscalls->pipe_fds[0], FIONREAD, &queued) < 0 ||
+	     queued > 0)) {
+		close(syscalls->pipe_fds[0]);
+		close(syscalls->pipe_fds[1]);
+		syscalls->pipe_fds[0] = syscalls->pipe_fds[1] = -1;
+	}
+	if (syscalls->pipe_fds[0] < 0 && pipe(syscalls->pipe_fds) < 0) {
+		asprintf(error, "pipe: %s", strerror(errno));
+		return STATUS_ERR;
+	}
+	if (fcntl(syscalls->pipe_fds[1], F_GETPIPE_SZ) < len &&
+	    fcntl(syscalls->pipe_fds[1], F_SETPIPE_SZ, len) < 0) {
+		asprintf(error, "cannot grow pipe for splice to %d bytes: %s",
+			 len, strerror(errno));
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* sendfile(fd, ..., ..., count) sends count bytes of our file of
+ * zeros, from its start.
+ */
+static int syscall_sendfile(struct state *state, struct syscall_spec *syscall,
+			    struct expression_list *args, char **error)
+{
+	int live_fd, script_fd, count, result;
+	off_t offset = 0;
+
+	if (check_arg_count(args, 4, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &script_fd, error))
+		return STATUS_ERR;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		return STATUS_ERR;
+	if (ellipsis_arg(args, 1, error))
+		return STATUS_ERR;
+	if (ellipsis_arg(args, 2, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 3, &count, error))
+		return STATUS_ERR;
+	if (check_no_pattern(state, script_fd, "sendfile", error) ||
+	    zero_file_grow(state, count, error))
+		return STATUS_ERR;
+
+	begin_syscall(state, syscall);
+
+	result = sendfile(live_fd, state->syscalls->zero_file_fd, &offset,
+			  count);
+
+	return end_syscall(state, syscall, CHECK_EXACT, result, error);
+}
+
+/* splice(..., ..., fd, ..., len, flags) splices len bytes from our
+ * pipe into the socket. We fill the pipe from our file of zeros before
+ * the call, so that the call itself does only the socket's share of
+ * the work.
+ */
+static int syscall_splice(struct state *state, struct syscall_spec *syscall,
+			  struct expression_list *args, char **error)
+{
+	struct syscalls *syscalls = state->syscalls;
+	int live_fd, script_fd, len, flags, queued = 0, result;
+	loff_t offset = 0;
+
+	if (check_arg_count(args, 6, error))
+		return STATUS_ERR;
+	if (ellipsis_arg(args, 0, error))
+		return STATUS_ERR;
+	if (ellipsis_arg(args, 1, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 2, &script_fd, error))
+		return STATUS_ERR;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		return STATUS_ERR;
+	if (ellipsis_arg(args, 3, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 4, &len, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 5, &flags, error))
+		return STATUS_ERR;
+	if (check_no_pattern(state, script_fd, "splice", error) ||
+	    zero_file_grow(state, len, error) ||
+	    splice_pipe_prepare(state, len, false, error))
+		return STATUS_ERR;
+
+	/* Top up whatever an earlier short splice() left in the pipe. */
+	if (ioctl(syscalls->pipe_fds[0], FIONREAD, &queued) < 0) {
+		asprintf(error, "FIONREAD on pipe: %s", strerror(errno));
+		return STATUS_ERR;
+	}
+	while (queued < len) {
+		ssize_t filled = splice(syscalls->zero_file_fd, &offset,
+					syscalls->pipe_fds[1], NULL,
+					len - queued, 0);
+		if (filled <= 0) {
+			asprintf(error, "cannot fill pipe for splice: %s",
+				 filled < 0 ? strerror(errno) : "end of file");
+			return STATUS_ERR;
+		}
+		queued += filled;
+	}
+
+	begin_syscall(state, syscall);
+
+	result = splice(syscalls->pipe_fds[0], NULL, live_fd, NULL, len, flags);
+
+	return end_syscall(state, syscall, CHECK_EXACT, result, error);
+}
+
+/* vmsplice(fd, [iovec], iov_count, flags) maps the iovec's zeros into
+ * our pipe and splices them on into the socket, with the given flags
+ * for both steps. It returns how much reached the socket.
+ */
+static int syscall_vmsplice(struct state *state, struct syscall_spec *syscall,
+			    struct expression_list *args, char **error)
+{
+	struct syscalls *syscalls = state->syscalls;
+	int live_fd, script_fd, iov_count, flags, len = 0, i, result;
+	struct expression *iov_expression = NULL;
+	struct iovec *iov = NULL;
+	size_t iov_len = 0;
+	int status = STATUS_ERR;
+
+	if (check_arg_count(args, 4, error))
+		goto error_out;
+	if (s32_arg(args, 0, &script_fd, error))
+		goto error_out;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		goto error_out;
+
+	iov_expression = get_arg(args, 1, error);
+	if (iov_expression == NULL)
+		goto error_out;
+	if (check_no_pattern(state, script_fd, "vmsplice", error))
+		goto error_out;
+	if (iovec_new(iov_expression, &iov, &iov_len,
+		      syscalls->send_payload, error))
+		goto error_out;
+
+	if (s32_arg(args, 2, &iov_count, error))
+		goto error_out;
+	if (iov_count != iov_len) {
+		asprintf(error,
+			 "iov_count %d does not match %d-element iovec array",
+			 iov_count, (int)iov_len);
+		goto error_out;
+	}
+	if (s32_arg(args, 3, &flags, error))
+		goto error_out;
+
+	/* The pipe holds references to the pages until the socket is
+	 * done with them, so they must be the shared zeros, which nobody
+	 * ever writes.
+	 */
+	for (i = 0; i < iov_len; ++i) {
+		if (!is_shared_payload(iov[i].iov_base,
+				       syscalls->send_payload)) {
+			asprintf(error, "vmsplice iovec longer than %d in all",
+				 PAYLOAD_BYTES);
+			goto error_out;
+		}
+		len += iov[i].iov_len;
+	}
+	if (splice_pipe_prepare(state, len, true, error))
+		goto error_out;
+
+	begin_syscall(state, syscall);
+
+	result = vmsplice(syscalls->pipe_fds[1], iov, iov_count, flags);
+	if (result > 0)
+		result = splice(syscalls->pipe_fds[0], NULL, live_fd, NULL,
+				result, flags);
+
+	status = end_syscall(state, syscall, CHECK_EXACT, result, error);
 
 error_out:
-	msghdr_free(msg, iov_len);
+	iovec_free(iov, iov_len, syscalls->send_payload);
 	return status;
 }
 
+/* zerocopy_complete(fd, lo, hi) reads the MSG_ZEROCOPY completion
+ * notifications queued on the socket's error queue, without waiting,
+ * and checks that together they cover exactly the zerocopy sends
+ * numbered lo through hi (the socket's first one being 0). It returns
+ * how many sends they cover, or -1 with errno EAGAIN if none is queued.
+ */
+/* mib_delta("TcpExtTCPLossProbes") returns how much the named kernel
+ * MIB counter, as nstat(8) names it, changed since the test started.
+ */
+static int syscall_mib_delta(struct state *state,
+			     struct syscall_spec *syscall,
+			     struct expression_list *args, char **error)
+{
+	struct expression *name;
+	s64 delta;
+	int result;
+
+	if (check_arg_count(args, 1, error))
+		return STATUS_ERR;
+	name = get_arg(args, 0, error);
+	if (name == NULL)
+		return STATUS_ERR;
+	if (check_type(name, EXPR_STRING, error))
+		return STATUS_ERR;
+	if (state->mib == NULL) {
+		asprintf(error, "kernel MIB counters are not available");
+		return STATUS_ERR;
+	}
+
+	begin_syscall(state, syscall);
+
+	if (mib_delta(state->mib, name->value.string, &delta, error)) {
+		char *ignored = NULL;
+
+		/* Retake the lock; the error explains the failure. */
+		end_syscall(state, syscall, CHECK_NON_NEGATIVE, 0, &ignored);
+		free(ignored);
+		return STATUS_ERR;
+	}
+	if (delta > INT_MAX)
+		result = INT_MAX;
+	else if (delta < INT_MIN)
+		result = INT_MIN;
+	else
+		result = delta;
+
+	return end_syscall(state, syscall, CHECK_EXACT, result, error);
+}
+
+static int syscall_zerocopy_complete(struct state *state,
+				     struct syscall_spec *syscall,
+				     struct expression_list *args,
+				     char **error)
+{
+	int live_fd, script_fd, lo, hi, result;
+	s64 covered_lo = -1, covered_hi = -1;
+	bool gap = false, copied = false;
+
+	if (check_arg_count(args, 3, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &script_fd, error))
+		return STATUS_ERR;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 1, &lo, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 2, &hi, error))
+		return STATUS_ERR;
+
+	begin_syscall(state, syscall);
+
+	for (;;) {
+		char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+			     CMSG_SPACE(sizeof(struct sockaddr_storage))];
+		struct msghdr msg;
+		struct cmsghdr *cmsg;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(live_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			struct sock_extended_err *ee;
+
+			if (!((cmsg->cmsg_level == SOL_IP &&
+			       cmsg->cmsg_type == IP_RECVERR) ||
+			      (cmsg->cmsg_level == SOL_IPV6 &&
+			       cmsg->cmsg_type == IPV6_RECVERR)))
+				continue;
+			ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			if (ee->ee_errno != 0 ||
+			    ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			/* The kernel merges adjacent ranges when it can,
+			 * and reports them in order.
+			 */
+			if (covered_lo < 0)
+				covered_lo = ee->ee_info;
+			else if (ee->ee_info != covered_hi + 1)
+				gap = true;
+			covered_hi = ee->ee_data;
+			if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				copied = true;
+		}
+	}
+
+	if (covered_lo < 0) {
+		result = -1;
+		errno = EAGAIN;
+	} else {
+		result = covered_hi - covered_lo + 1;
+	}
+
+	if (end_syscall(state, syscall, CHECK_EXACT, result, error))
+		return STATUS_ERR;
+
+	if (covered_lo >= 0 && (gap || covered_lo != lo || covered_hi != hi)) {
+		asprintf(error, "zerocopy completions cover sends "
+			 "%lld..%lld%s, expected %d..%d",
+			 covered_lo, covered_hi, gap ? " with a gap" : "",
+			 lo, hi);
+		return STATUS_ERR;
+	}
+	if (copied)
+		DEBUGP("zerocopy sends %d..%d were copied\n", lo, hi);
+	return STATUS_OK;
+}
+#endif  /* defined(linux) */
+
 static int syscall_fcntl(struct state *state, struct syscall_spec *syscall,
 			 struct expression_list *args, char **error)
 {
@@ -1602,6 +2654,7 @@ static int syscall_close(struct state *state, struct syscall_spec *syscall,
 			 struct expression_list *args, char **error)
 {
 	int live_fd, script_fd, result;
+	struct other_fd *other_fd;
 	if (check_arg_count(args, 1, error))
 		return STATUS_ERR;
 	if (s32_arg(args, 0, &script_fd, error))
@@ -1609,6 +2662,24 @@ static int syscall_close(struct state *state, struct syscall_spec *syscall,
 	if (to_live_fd(state, script_fd, &live_fd, error))
 		return STATUS_ERR;
 
+	other_fd = find_other_fd(state, script_fd);
+	if (other_fd != NULL) {
+		struct syscalls *syscalls = state->syscalls;
+		struct other_fd closing = *other_fd;
+
+		*other_fd = syscalls->other_fds[--syscalls->num_other_fds];
+
+		begin_syscall(state, syscall);
+
+		result = close_other_fd(&closing);
+
+		return end_syscall(state, syscall, CHECK_EXACT, result, error);
+	}
+
+	/* The sampler must be done with the fd before it can be reused. */
+	if (state->tcp_info_log != NULL)
+		tcp_info_log_forget(state->tcp_info_log, live_fd);
+
 	begin_syscall(state, syscall);
 
 	result = close(live_fd);
@@ -1787,38 +2858,832 @@ error_out:
 	return status;
 }
 
-/* A dispatch table with all the system calls that we support... */
-struct system_call_entry {
-	const char *name;
-	int (*function) (struct state *state,
-			 struct syscall_spec *syscall,
-			 struct expression_list *args,
-			 char **error);
-};
-struct system_call_entry system_call_table[] = {
-	{"socket",     syscall_socket},
-	{"bind",       syscall_bind},
-	{"listen",     syscall_listen},
-	{"accept",     syscall_accept},
-	{"connect",    syscall_connect},
-	{"read",       syscall_read},
-	{"readv",      syscall_readv},
-	{"recv",       syscall_recv},
-	{"recvfrom",   syscall_recvfrom},
-	{"recvmsg",    syscall_recvmsg},
-	{"write",      syscall_write},
-	{"writev",     syscall_writev},
-	{"send",       syscall_send},
-	{"sendto",     syscall_sendto},
-	{"sendmsg",    syscall_sendmsg},
-	{"fcntl",      syscall_fcntl},
-	{"ioctl",      syscall_ioctl},
+#if defined(linux)
+/* epoll_create(size) and epoll_create1(flags) create an epoll fd. */
+static int do_epoll_create(struct state *state, struct syscall_spec *syscall,
+			   struct expression_list *args, bool is_create1,
+			   char **error)
+{
+	int arg, script_fd, result;
+
+	if (check_arg_count(args, 1, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &arg, error))
+		return STATUS_ERR;
+
+	begin_syscall(state, syscall);
+
+	result = is_create1 ? epoll_create1(arg) : epoll_create(arg);
+
+	if (end_syscall(state, syscall, CHECK_NON_NEGATIVE, result, error))
+		return STATUS_ERR;
+
+	if (result >= 0) {
+		if (get_s32(syscall->result, &script_fd, error))
+			return STATUS_ERR;
+		if (add_other_fd(state, script_fd, result, NULL, error))
+			return STATUS_ERR;
+	}
+
+	return STATUS_OK;
+}
+
+static int syscall_epoll_create(struct state *state,
+				struct syscall_spec *syscall,
+				struct expression_list *args, char **error)
+{
+	return do_epoll_create(state, syscall, args, false, error);
+}
+
+static int syscall_epoll_create1(struct state *state,
+				 struct syscall_spec *syscall,
+				 struct expression_list *args, char **error)
+{
+	return do_epoll_create(state, syscall, args, true, error);
+}
+
+/* epoll_ctl(epfd, op, fd, {events=..., fd=...}) registers the fd in
+ * the event's data as the script fd, so epoll_wait() returns script
+ * fds. The event may be an ellipsis for EPOLL_CTL_DEL.
+ */
+static int syscall_epoll_ctl(struct state *state, struct syscall_spec *syscall,
+			     struct expression_list *args, char **error)
+{
+	int live_epfd, script_epfd, op, live_fd, script_fd, result;
+	struct expression *ev_expression;
+	struct epoll_event event, *live_event = NULL;
+
+	if (check_arg_count(args, 4, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &script_epfd, error))
+		return STATUS_ERR;
+	if (to_live_fd(state, script_epfd, &live_epfd, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 1, &op, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 2, &script_fd, error))
+		return STATUS_ERR;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		return STATUS_ERR;
+
+	ev_expression = get_arg(args, 3, error);
+	if (ev_expression == NULL)
+		return STATUS_ERR;
+	if (ev_expression->type != EXPR_ELLIPSIS) {
+		struct epollev_expr *ev_expr;
+
+		if (check_type(ev_expression, EXPR_EPOLLEV, error))
+			return STATUS_ERR;
+		ev_expr = ev_expression->value.epollev;
+		if (check_type(ev_expr->events, EXPR_INTEGER, error))
+			return STATUS_ERR;
+		if (check_type(ev_expr->fd, EXPR_INTEGER, error))
+			return STATUS_ERR;
+
+		memset(&event, 0, sizeof(event));
+		event.events = ev_expr->events->value.num;
+		event.data.u64 = ev_expr->fd->value.num;
+		live_event = &event;
+	}
+
+	begin_syscall(state, syscall);
+
+	result = epoll_ctl(live_epfd, op, live_fd, live_event);
+
+	return end_syscall(state, syscall, CHECK_EXACT, result, error);
+}
+
+/* Check the events epoll_wait() returned against those the script
+ * lists, in order. Returns STATUS_OK on success; on failure returns
+ * STATUS_ERR and sets error message.
+ */
+static int epoll_events_check(struct expression *events_expression,
+			      const struct epoll_event *events, int num_events,
+			      char **error)
+{
+	struct expression_list *list = events_expression->value.list;
+	int i;
+
+	if (expression_list_length(list) != num_events) {
+		asprintf(error, "epoll_wait returned %d events "
+			 "but the script lists %d",
+			 num_events, (int)expression_list_length(list));
+		return STATUS_ERR;
+	}
+	for (i = 0; i < num_events; ++i, list = list->next) {
+		struct epollev_expr *ev_expr;
+		u32 expected_events;
+		s64 expected_fd;
+
+		if (check_type(list->expression, EXPR_EPOLLEV, error))
+			return STATUS_ERR;
+		ev_expr = list->expression->value.epollev;
+		if (check_type(ev_expr->events, EXPR_INTEGER, error))
+			return STATUS_ERR;
+		if (check_type(ev_expr->fd, EXPR_INTEGER, error))
+			return STATUS_ERR;
+
+		expected_events = ev_expr->events->value.num;
+		expected_fd = ev_expr->fd->value.num;
+		if (events[i].data.u64 != expected_fd) {
+			asprintf(error, "Expected fd %lld but got %lld "
+				 "for epoll event %d", expected_fd,
+				 (s64)events[i].data.u64, i);
+			return STATUS_ERR;
+		}
+		if (events[i].events != expected_events) {
+			asprintf(error, "Expected events 0x%x but got 0x%x "
+				 "for epoll event %d (fd %lld)",
+				 expected_events, events[i].events, i,
+				 expected_fd);
+			return STATUS_ERR;
+		}
+	}
+	return STATUS_OK;
+}
+
+/* epoll_wait(epfd, [{events=..., fd=...}, ...], maxevents, timeout)
+ * checks the returned events against the list, or not if the list is
+ * an ellipsis.
+ */
+static int syscall_epoll_wait(struct state *state, struct syscall_spec *syscall,
+			      struct expression_list *args, char **error)
+{
+	int live_epfd, script_epfd, maxevents, timeout, result;
+	struct expression *events_expression;
+	struct epoll_event *events = NULL;
+	int status = STATUS_ERR;
+
+	if (check_arg_count(args, 4, error))
+		goto error_out;
+	if (s32_arg(args, 0, &script_epfd, error))
+		goto error_out;
+	if (to_live_fd(state, script_epfd, &live_epfd, error))
+		goto error_out;
+	events_expression = get_arg(args, 1, error);
+	if (events_expression == NULL)
+		goto error_out;
+	if (events_expression->type != EXPR_ELLIPSIS &&
+	    check_type(events_expression, EXPR_LIST, error))
+		goto error_out;
+	if (s32_arg(args, 2, &maxevents, error))
+		goto error_out;
+	if (s32_arg(args, 3, &timeout, error))
+		goto error_out;
+
+	if (maxevents > 0)
+		events = calloc(maxevents, sizeof(struct epoll_event));
+
+	begin_syscall(state, syscall);
+
+	result = epoll_wait(live_epfd, events, maxevents, timeout);
+
+	if (end_syscall(state, syscall, CHECK_EXACT, result, error))
+		goto error_out;
+
+	if (result >= 0 && events_expression->type == EXPR_LIST &&
+	    epoll_events_check(events_expression, events, result, error))
+		goto error_out;
+
+	status = STATUS_OK;
+
+error_out:
+	free(events);
+	return status;
+}
+
+/* Free all the space used by the given mmsghdr array. */
+static void mmsghdrs_free(struct mmsghdr *msgs, size_t *iov_lens,
+			  size_t msgs_len, void *payload)
+{
+	int i;
+
+	if (msgs == NULL)
+		return;
+
+	for (i = 0; i < msgs_len; ++i)
+		msghdr_free(&msgs[i].msg_hdr, iov_lens[i], payload);
+	free(msgs);
+	free(iov_lens);
+}
+
+/* Allocate and fill in an mmsghdr array described by the given
+ * expression, a list of mmsghdrs. The payload is as for iovec_new().
+ * Return STATUS_OK if the expression is valid. Otherwise fill in the
+ * error with a human-readable error message and return STATUS_ERR.
+ */
+static int mmsghdrs_new(struct expression *expression,
+			struct mmsghdr **msgs_ptr, size_t **iov_lens_ptr,
+			size_t *msgs_len_ptr, void *payload, char **error)
+{
+	int status = STATUS_ERR;
+	int i;
+	struct expression_list *list;	/* input expression from script */
+	size_t msgs_len = 0;
+	struct mmsghdr *msgs = NULL;	/* live output */
+	size_t *iov_lens = NULL;
+
+	if (check_type(expression, EXPR_LIST, error))
+		goto error_out;
+
+	list = expression->value.list;
+
+	msgs_len = expression_list_length(list);
+	msgs = calloc(msgs_len, sizeof(struct mmsghdr));
+	iov_lens = calloc(msgs_len, sizeof(size_t));
+
+	for (i = 0; i < msgs_len; ++i, list = list->next) {
+		struct mmsghdr_expr *mmsg_expr;
+		struct msghdr *msg = NULL;
+		int result;
+
+		if (check_type(list->expression, EXPR_MMSGHDR, error))
+			goto error_out;
+		mmsg_expr = list->expression->value.mmsghdr;
+		if (mmsg_expr->msg_len->type != EXPR_ELLIPSIS &&
+		    check_type(mmsg_expr->msg_len, EXPR_INTEGER, error))
+			goto error_out;
+
+		result = msghdr_new(mmsg_expr->msg_hdr, &msg, &iov_lens[i],
+				    payload, error);
+		if (msg != NULL) {
+			msgs[i].msg_hdr = *msg;
+			free(msg);
+		}
+		if (result)
+			goto error_out;
+	}
+
+	status = STATUS_OK;
+
+error_out:
+	*msgs_ptr = msgs;
+	*iov_lens_ptr = iov_lens;
+	*msgs_len_ptr = msgs_len;
+	return status;
+}
+
+/* Check the msg_len and msg_flags of the first num_msgs messages of an
+ * mmsghdr array against what the script expects. Returns STATUS_OK on
+ * success; on failure returns STATUS_ERR and sets error message.
+ */
+static int mmsghdrs_check(struct expression *expression,
+			  struct mmsghdr *msgs, const int *msg_flags,
+			  int num_msgs, char **error)
+{
+	struct expression_list *list = expression->value.list;
+	int i;
+
+	for (i = 0; i < num_msgs; ++i, list = list->next) {
+		struct mmsghdr_expr *mmsg_expr =
+			list->expression->value.mmsghdr;
+
+		if (mmsg_expr->msg_len->type == EXPR_INTEGER &&
+		    msgs[i].msg_len != mmsg_expr->msg_len->value.num) {
+			asprintf(error, "Expected msg_len %lld but got %u "
+				 "for mmsghdr %d",
+				 mmsg_expr->msg_len->value.num,
+				 msgs[i].msg_len, i);
+			return STATUS_ERR;
+		}
+		if (msg_flags != NULL &&
+		    msgs[i].msg_hdr.msg_flags != msg_flags[i]) {
+			asprintf(error, "Expected msg_flags 0x%08X but got "
+				 "0x%08X for mmsghdr %d", msg_flags[i],
+				 msgs[i].msg_hdr.msg_flags, i);
+			return STATUS_ERR;
+		}
+		if (msg_flags != NULL &&
+		    cmsgs_check(mmsg_expr->msg_hdr->value.msghdr->msg_control,
+				&msgs[i].msg_hdr, error))
+			return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* sendmmsg(fd, [{msg_hdr=..., msg_len=N}, ...], vlen, flags) */
+static int syscall_sendmmsg(struct state *state, struct syscall_spec *syscall,
+			    struct expression_list *args, char **error)
+{
+	int live_fd, script_fd, vlen, flags, i, result;
+	struct expression *msgs_expression = NULL;
+	struct mmsghdr *msgs = NULL;
+	size_t *iov_lens = NULL;
+	size_t msgs_len = 0;
+	int status = STATUS_ERR;
+
+	if (check_arg_count(args, 4, error))
+		goto error_out;
+	if (s32_arg(args, 0, &script_fd, error))
+		goto error_out;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		goto error_out;
+
+	msgs_expression = get_arg(args, 1, error);
+	if (msgs_expression == NULL)
+		goto error_out;
+	if (check_no_pattern(state, script_fd, "sendmmsg", error))
+		goto error_out;
+	if (mmsghdrs_new(msgs_expression, &msgs, &iov_lens, &msgs_len,
+			 state->syscalls->send_payload, error))
+		goto error_out;
+
+	if (s32_arg(args, 2, &vlen, error))
+		goto error_out;
+	if (s32_arg(args, 3, &flags, error))
+		goto error_out;
+
+	if (vlen != msgs_len) {
+		asprintf(error,
+			 "vlen %d does not match %d-element mmsghdr array",
+			 vlen, (int)msgs_len);
+		goto error_out;
+	}
+	for (i = 0; i < msgs_len; ++i) {
+		struct msghdr *msg = &msgs[i].msg_hdr;
+
+		if ((msg->msg_name != NULL) &&
+		    run_syscall_connect(state, script_fd, false,
+					msg->msg_name, &msg->msg_namelen,
+					error))
+			goto error_out;
+		if (msg->msg_flags != 0) {
+			asprintf(error,
+				 "sendmmsg ignores msg_flags field in msghdr");
+			goto error_out;
+		}
+	}
+
+	begin_syscall(state, syscall);
+
+	result = sendmmsg(live_fd, msgs, vlen, flags);
+
+	if (end_syscall(state, syscall, CHECK_EXACT, result, error))
+		goto error_out;
+
+	if (mmsghdrs_check(msgs_expression, msgs, NULL, result, error))
+		goto error_out;
+
+	status = STATUS_OK;
+
+error_out:
+	mmsghdrs_free(msgs, iov_lens, msgs_len, state->syscalls->send_payload);
+	return status;
+}
+
+/* recvmmsg(fd, [{msg_hdr=..., msg_len=N}, ...], vlen, flags, ...)
+ * receives with no timeout.
+ */
+static int syscall_recvmmsg(struct state *state, struct syscall_spec *syscall,
+			    struct expression_list *args, char **error)
+{
+	int live_fd, script_fd, vlen, flags, i, result;
+	struct expression *msgs_expression = NULL;
+	struct mmsghdr *msgs = NULL;
+	size_t *iov_lens = NULL;
+	size_t msgs_len = 0;
+	int *expected_msg_flags = NULL;
+	u8 *scratch = NULL;
+	int status = STATUS_ERR;
+
+	if (check_arg_count(args, 5, error))
+		goto error_out;
+	if (s32_arg(args, 0, &script_fd, error))
+		goto error_out;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		goto error_out;
+
+	msgs_expression = get_arg(args, 1, error);
+	if (msgs_expression == NULL)
+		goto error_out;
+	if (check_no_pattern(state, script_fd, "recvmmsg", error))
+		goto error_out;
+	scratch = recv_scratch(state, syscall);
+	if (mmsghdrs_new(msgs_expression, &msgs, &iov_lens, &msgs_len,
+			 scratch, error))
+		goto error_out;
+
+	if (s32_arg(args, 2, &vlen, error))
+		goto error_out;
+	if (s32_arg(args, 3, &flags, error))
+		goto error_out;
+	if (ellipsis_arg(args, 4, error))
+		goto error_out;
+
+	if (vlen != msgs_len) {
+		asprintf(error,
+			 "vlen %d does not match %d-element mmsghdr array",
+			 vlen, (int)msgs_len);
+		goto error_out;
+	}
+
+	expected_msg_flags = calloc(msgs_len, sizeof(int));
+	for (i = 0; i < msgs_len; ++i)
+		expected_msg_flags[i] = msgs[i].msg_hdr.msg_flags;
+
+	begin_syscall(state, syscall);
+
+	result = recvmmsg(live_fd, msgs, vlen, flags, NULL);
+
+	if (end_syscall(state, syscall, CHECK_EXACT, result, error))
+		goto error_out;
+
+	if (mmsghdrs_check(msgs_expression, msgs, expected_msg_flags, result,
+			   error))
+		goto error_out;
+
+	status = STATUS_OK;
+
+error_out:
+	free(expected_msg_flags);
+	mmsghdrs_free(msgs, iov_lens, msgs_len, scratch);
+	return status;
+}
+#endif  /* defined(linux) */
+
+#ifdef HAVE_IO_URING
+/* Return the io_uring with the given script fd. Returns STATUS_OK on
+ * success; on failure returns STATUS_ERR and sets error message.
+ */
+static int to_uring(struct state *state, int script_fd, struct uring **ring,
+		    char **error)
+{
+	struct other_fd *other_fd = find_other_fd(state, script_fd);
+
+	if (other_fd == NULL || other_fd->ring == NULL) {
+		asprintf(error, "unable to find io_uring with script fd %d",
+			 script_fd);
+		return STATUS_ERR;
+	}
+	*ring = other_fd->ring;
+	return STATUS_OK;
+}
+
+/* io_uring_setup(entries, ...) sets up a ring with a buffer ring for
+ * receives.
+ */
+static int syscall_io_uring_setup(struct state *state,
+				  struct syscall_spec *syscall,
+				  struct expression_list *args, char **error)
+{
+	int entries, script_fd, result;
+	struct uring *ring;
+
+	if (check_arg_count(args, 2, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &entries, error))
+		return STATUS_ERR;
+	if (ellipsis_arg(args, 1, error))
+		return STATUS_ERR;
+
+	begin_syscall(state, syscall);
+
+	ring = uring_new(entries, error);
+	result = ring != NULL ? uring_fd(ring) : -1;
+
+	if (ring == NULL) {
+		/* Retake the lock; the error explains the failure. */
+		char *ignored = NULL;
+
+		end_syscall(state, syscall, CHECK_NON_NEGATIVE, result,
+			    &ignored);
+		free(ignored);
+		return STATUS_ERR;
+	}
+	if (end_syscall(state, syscall, CHECK_NON_NEGATIVE, result, error) ||
+	    get_s32(syscall->result, &script_fd, error) ||
+	    add_other_fd(state, script_fd, result, ring, error)) {
+		uring_free(ring);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* The io_uring_prep_*() calls queue an operation on a socket, to be
+ * submitted by io_uring_submit(). They return 0 and never block:
+ *
+ *   io_uring_prep_send(ring, fd, len, flags, user_data)
+ *   io_uring_prep_recv(ring, fd, len, flags, user_data)
+ *   io_uring_prep_recv_multishot(ring, fd, flags, user_data)
+ *   io_uring_prep_accept(ring, fd, flags, user_data)
+ *   io_uring_prep_multishot_accept(ring, fd, flags, user_data)
+ *   io_uring_prep_connect(ring, fd, user_data)
+ */
+static int do_io_uring_prep(struct state *state, struct syscall_spec *syscall,
+			    struct expression_list *args, enum uring_op_t op,
+			    bool multishot, char **error)
+{
+	int script_ring_fd, live_fd, script_fd, len = 0, flags = 0;
+	int num_args, arg = 0;
+	s32 user_data;
+	struct uring *ring;
+	int status;
+
+	if (op == URING_OP_CONNECT)
+		num_args = 3;
+	else if (op == URING_OP_ACCEPT || multishot)
+		num_args = 4;
+	else
+		num_args = 5;
+	if (check_arg_count(args, num_args, error))
+		return STATUS_ERR;
+	if (s32_arg(args, arg++, &script_ring_fd, error))
+		return STATUS_ERR;
+	if (to_uring(state, script_ring_fd, &ring, error))
+		return STATUS_ERR;
+	if (s32_arg(args, arg++, &script_fd, error))
+		return STATUS_ERR;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		return STATUS_ERR;
+	if (num_args == 5 && s32_arg(args, arg++, &len, error))
+		return STATUS_ERR;
+	if (num_args >= 4 && s32_arg(args, arg++, &flags, error))
+		return STATUS_ERR;
+	if (s32_arg(args, arg, &user_data, error))
+		return STATUS_ERR;
+
+	switch (op) {
+	case URING_OP_SEND:
+		if (len > PAYLOAD_BYTES) {
+			asprintf(error, "io_uring send longer than %d",
+				 PAYLOAD_BYTES);
+			return STATUS_ERR;
+		}
+		if (check_no_pattern(state, script_fd, "io_uring send", error))
+			return STATUS_ERR;
+		status = uring_prep_send(ring, live_fd,
+					 state->syscalls->send_payload, len,
+					 flags, user_data, error);
+		break;
+	case URING_OP_RECV:
+		if (check_no_pattern(state, script_fd, "io_uring recv", error))
+			return STATUS_ERR;
+		status = uring_prep_recv(ring, live_fd, len, flags, multishot,
+					 user_data, error);
+		break;
+	case URING_OP_ACCEPT:
+		status = uring_prep_accept(ring, live_fd, flags, multishot,
+					   user_data, error);
+		break;
+	case URING_OP_CONNECT: {
+		struct sockaddr_storage live_addr;
+		socklen_t live_addrlen = sizeof(live_addr);
+
+		if (run_syscall_connect(state, script_fd, true,
+					(struct sockaddr *)&live_addr,
+					&live_addrlen, error))
+			return STATUS_ERR;
+		status = uring_prep_connect(ring, live_fd,
+					    (struct sockaddr *)&live_addr,
+					    live_addrlen, user_data, error);
+		break;
+	}
+	default:
+		assert(!"bad io_uring op");
+		status = STATUS_ERR;
+	}
+	if (status)
+		return STATUS_ERR;
+
+	begin_syscall(state, syscall);
+	return end_syscall(state, syscall, CHECK_EXACT, 0, error);
+}
+
+static int syscall_io_uring_prep_send(struct state *state,
+				      struct syscall_spec *syscall,
+				      struct expression_list *args,
+				      char **error)
+{
+	return do_io_uring_prep(state, syscall, args, URING_OP_SEND, false,
+				error);
+}
+
+static int syscall_io_uring_prep_recv(struct state *state,
+				      struct syscall_spec *syscall,
+				      struct expression_list *args,
+				      char **error)
+{
+	return do_io_uring_prep(state, syscall, args, URING_OP_RECV, false,
+				error);
+}
+
+static int syscall_io_uring_prep_recv_multishot(struct state *state,
+						struct syscall_spec *syscall,
+						struct expression_list *args,
+						char **error)
+{
+	return do_io_uring_prep(state, syscall, args, URING_OP_RECV, true,
+				error);
+}
+
+static int syscall_io_uring_prep_accept(struct state *state,
+					struct syscall_spec *syscall,
+					struct expression_list *args,
+					char **error)
+{
+	return do_io_uring_prep(state, syscall, args, URING_OP_ACCEPT, false,
+				error);
+}
+
+static int syscall_io_uring_prep_multishot_accept(struct state *state,
+						  struct syscall_spec *syscall,
+						  struct expression_list *args,
+						  char **error)
+{
+	return do_io_uring_prep(state, syscall, args, URING_OP_ACCEPT, true,
+				error);
+}
+
+static int syscall_io_uring_prep_connect(struct state *state,
+					 struct syscall_spec *syscall,
+					 struct expression_list *args,
+					 char **error)
+{
+	return do_io_uring_prep(state, syscall, args, URING_OP_CONNECT, false,
+				error);
+}
+
+/* io_uring_submit(ring) submits the queued operations and returns how
+ * many the kernel took.
+ */
+static int syscall_io_uring_submit(struct state *state,
+				   struct syscall_spec *syscall,
+				   struct expression_list *args, char **error)
+{
+	int script_fd, result;
+	struct uring *ring;
+
+	if (check_arg_count(args, 1, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &script_fd, error))
+		return STATUS_ERR;
+	if (to_uring(state, script_fd, &ring, error))
+		return STATUS_ERR;
+
+	begin_syscall(state, syscall);
+
+	result = uring_submit(ring);
+
+	return end_syscall(state, syscall, CHECK_EXACT, result, error);
+}
+
+/* io_uring_wait_cqe(ring, user_data, flags) takes the next completion,
+ * waiting for it as a blocking system call if the script says the call
+ * blocks, and checks its user_data and whether it has IORING_CQE_F_MORE
+ * set. It returns the completion's result, with errors as -1 and an
+ * errno, and for an accept the accepted socket's script fd.
+ */
+static int syscall_io_uring_wait_cqe(struct state *state,
+				     struct syscall_spec *syscall,
+				     struct expression_list *args,
+				     char **error)
+{
+	int script_fd, flags, expected, wait_result, result;
+	s32 user_data;
+	struct uring *ring;
+	struct uring_completion completion;
+	int status;
+
+	if (check_arg_count(args, 3, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &script_fd, error))
+		return STATUS_ERR;
+	if (to_uring(state, script_fd, &ring, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 1, &user_data, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 2, &flags, error))
+		return STATUS_ERR;
+
+	begin_syscall(state, syscall);
+
+	/* Only the completion queue, which is ours alone, is safe to
+	 * touch without the lock.
+	 */
+	wait_result = uring_wait(ring, &completion);
+	if (wait_result < 0) {
+		result = -1;
+	} else if (completion.res < 0) {
+		result = -1;
+		errno = -completion.res;
+	} else {
+		result = completion.res;
+	}
+
+	/* An accepted fd is a live fd, so check it only roughly here. */
+	status = end_syscall(state, syscall, CHECK_NON_NEGATIVE, result,
+			     error);
+	if (wait_result == 0)
+		uring_finish(ring, &completion);
+	if (status)
+		return STATUS_ERR;
+	if (wait_result < 0)
+		return STATUS_OK;	/* the script expected the error */
+
+	if (completion.user_data != (u32)user_data) {
+		asprintf(error, "Expected completion for user_data %u "
+			 "but got %llu", (u32)user_data,
+			 (unsigned long long)completion.user_data);
+		return STATUS_ERR;
+	}
+	if ((completion.flags & IORING_CQE_F_MORE) !=
+	    (flags & IORING_CQE_F_MORE)) {
+		asprintf(error, "Expected completion %s IORING_CQE_F_MORE",
+			 (flags & IORING_CQE_F_MORE) ? "with" : "without");
+		return STATUS_ERR;
+	}
+
+	if (get_s32(syscall->result, &expected, error))
+		return STATUS_ERR;
+	if (completion.op == URING_OP_ACCEPT && result >= 0) {
+		struct sockaddr_storage live_addr;
+		socklen_t live_addrlen = sizeof(live_addr);
+
+		if (getpeername(result, (struct sockaddr *)&live_addr,
+				&live_addrlen) < 0) {
+			asprintf(error, "getpeername of accepted fd: %s",
+				 strerror(errno));
+			return STATUS_ERR;
+		}
+		return run_syscall_accept(state, expected, result,
+					  (struct sockaddr *)&live_addr,
+					  live_addrlen, error);
+	}
+	if (result != expected) {
+		asprintf(error, "Expected result %d but got %d",
+			 expected, result);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+#endif  /* HAVE_IO_URING */
+
+/* A dispatch table with all the system calls that we support... */
+struct system_call_entry {
+	const char *name;
+	int (*function) (struct state *state,
+			 struct syscall_spec *syscall,
+			 struct expression_list *args,
+			 char **error);
+};
+struct system_call_entry system_call_table[] = {
+	{"socket",     syscall_socket},
+	{"bind",       syscall_bind},
+	{"listen",     syscall_listen},
+	{"accept",     syscall_accept},
+	{"accept4",    syscall_accept4},
+	{"connect",    syscall_connect},
+	{"read",       syscall_read},
+	{"readv",      syscall_readv},
+	{"recv",       syscall_recv},
+	{"recvfrom",   syscall_recvfrom},
+	{"recvmsg",    syscall_recvmsg},
+	{"write",      syscall_write},
+	{"writev",     syscall_writev},
+	{"send",       syscall_send},
+	{"sendto",     syscall_sendto},
+	{"sendmsg",    syscall_sendmsg},
+#if defined(linux)
+	{"sendfile",   syscall_sendfile},
+	{"splice",     syscall_splice},
+	{"vmsplice",   syscall_vmsplice},
+#endif
+	{"fcntl",      syscall_fcntl},
+	{"ioctl",      syscall_ioctl},
 	{"close",      syscall_close},
 	{"shutdown",   syscall_shutdown},
 	{"getsockopt", syscall_getsockopt},
 	{"setsockopt", syscall_setsockopt},
 	{"poll",       syscall_poll},
-	{"mp_join_accept",	mp_join_accept}
+#if defined(linux)
+	{"epoll_create",	syscall_epoll_create},
+	{"epoll_create1",	syscall_epoll_create1},
+	{"epoll_ctl",		syscall_epoll_ctl},
+	{"epoll_wait",		syscall_epoll_wait},
+	{"sendmmsg",		syscall_sendmmsg},
+	{"recvmmsg",		syscall_recvmmsg},
+#endif
+#ifdef HAVE_IO_URING
+	{"io_uring_setup",		syscall_io_uring_setup},
+	{"io_uring_prep_send",		syscall_io_uring_prep_send},
+	{"io_uring_prep_recv",		syscall_io_uring_prep_recv},
+	{"io_uring_prep_recv_multishot",
+					syscall_io_uring_prep_recv_multishot},
+	{"io_uring_prep_accept",	syscall_io_uring_prep_accept},
+	{"io_uring_prep_multishot_accept",
+					syscall_io_uring_prep_multishot_accept},
+	{"io_uring_prep_connect",	syscall_io_uring_prep_connect},
+	{"io_uring_submit",		syscall_io_uring_submit},
+	{"io_uring_wait_cqe",		syscall_io_uring_wait_cqe},
+#endif
+	{"mp_join_accept",	mp_join_accept},
+	{"mib_delta",		syscall_mib_delta},
+#if defined(linux) && defined(TCP_REPAIR_WINDOW)
+	{"tcp_repair_connect",	syscall_tcp_repair_connect},
+#endif
+#if defined(linux)
+	{"zerocopy_complete",	syscall_zerocopy_complete},
+#endif
 };
 
 /* Evaluate the system call arguments and invoke the system call. */
@@ -1854,7 +3719,7 @@ static void invoke_system_call(
 	/* Run the system call. */
 	result = system_call_table[i].function(state, syscall, args, &error);
 
-	free_expression_list(args);
+	free_evaluated_expression_list(args, syscall->arguments);
 
 	if (result == STATUS_ERR)
 		goto error_out;
@@ -1867,15 +3732,36 @@ error_out:
 	free(error);
 }
 
-/* Wait for the system call thread to go idle. To avoid mystifying
+/* Wait for the given system call thread to go idle or, if thread is
+ * NULL, for any system call thread to go idle. To avoid mystifying
  * hangs when scripts specify overlapping time ranges for blocking
  * system calls, we limit the duration of our waiting to 1 second.
  */
-static int await_idle_thread(struct state *state)
+static int await_idle_thread(struct state *state,
+			     struct syscall_thread *thread)
 {
+	struct syscalls *syscalls = state->syscalls;
 	struct timespec end_time = { .tv_sec = 0, .tv_nsec = 0 };
 	const int MAX_WAIT_SECS = 1;
-	while (state->syscalls->state != SYSCALL_IDLE) {
+	s64 end_usecs = 0;
+
+	while (thread != NULL ? thread->state != SYSCALL_IDLE :
+	       syscalls->num_busy == syscalls->num_threads) {
+		/* With --scheduler=epoll, wait for the thread's
+		 * completion in the event loop instead.
+		 */
+		if (state->event_loop != NULL) {
+			if (end_usecs == 0)
+				end_usecs = now_usecs() +
+					MAX_WAIT_SECS * 1000000LL;
+			else if (now_usecs() >= end_usecs)
+				return STATUS_ERR;
+			DEBUGP("main thread: awaiting syscall completion\n");
+			run_unlock(state);
+			event_loop_wait(state->event_loop, end_usecs);
+			run_lock(state);
+			continue;
+		}
 		/* On the first time through the loop, calculate end time. */
 		if (end_time.tv_sec == 0) {
 			if (clock_gettime(CLOCK_REALTIME, &end_time) != 0)
@@ -1884,7 +3770,7 @@ static int await_idle_thread(struct state *state)
 		}
 		/* Wait for a signal or our timeout end_time to arrive. */
 		DEBUGP("main thread: awaiting idle syscall thread\n");
-		int status = pthread_cond_timedwait(&state->syscalls->idle,
+		int status = pthread_cond_timedwait(&syscalls->idle,
 						    &state->mutex, &end_time);
 		if (status == ETIMEDOUT)
 			return STATUS_ERR;
@@ -1906,31 +3792,99 @@ static int yield(void)
 #endif  /* defined(__NetBSD__) */
 }
 
-/* Enqueue the system call for the syscall thread and wake up the thread. */
+static void start_syscall_thread(struct state *state);
+
+/* Return the script fd a blocking system call works on, or -1 if it
+ * has none. This is the first argument, for the calls that take one.
+ */
+static int syscall_script_fd(struct syscall_spec *syscall)
+{
+	struct expression *expression;
+
+	if (syscall->arguments == NULL)
+		return -1;
+	expression = syscall->arguments->expression;
+	if (expression->type != EXPR_INTEGER || expression->value.num < 0)
+		return -1;
+	return expression->value.num;
+}
+
+/* Pick the syscall thread to run a blocking system call on the given
+ * script fd. A call on an fd that already has a blocking call in
+ * progress waits for that call, on that thread, so calls on one fd
+ * run in script order. Other calls take any idle thread, starting a
+ * new one if there is none.
+ */
+static struct syscall_thread *pick_syscall_thread(struct state *state,
+						  int script_fd, char **error)
+{
+	struct syscalls *syscalls = state->syscalls;
+	int i;
+
+	if (script_fd >= 0) {
+		for (i = 0; i < syscalls->num_threads; i++) {
+			struct syscall_thread *thread = &syscalls->threads[i];
+
+			if (thread->state == SYSCALL_IDLE ||
+			    thread->script_fd != script_fd)
+				continue;
+			/* Wait if there are back-to-back blocking calls. */
+			if (await_idle_thread(state, thread)) {
+				asprintf(error, "blocking system call while "
+					 "another blocking system call on "
+					 "fd %d is already in progress",
+					 script_fd);
+				return NULL;
+			}
+			return thread;
+		}
+	}
+
+	if (syscalls->num_busy == syscalls->num_threads &&
+	    syscalls->num_threads < MAX_SYSCALL_THREADS)
+		start_syscall_thread(state);
+	if (await_idle_thread(state, NULL)) {
+		asprintf(error, "blocking system call while %d other "
+			 "blocking system calls are already in progress",
+			 syscalls->num_busy);
+		return NULL;
+	}
+	for (i = 0; i < syscalls->num_threads; i++) {
+		if (syscalls->threads[i].state == SYSCALL_IDLE)
+			return &syscalls->threads[i];
+	}
+	assert(!"no idle syscall thread");
+	return NULL;
+}
+
+/* Enqueue the system call for a syscall thread and wake up the thread. */
 static void enqueue_system_call(
 	struct state *state, struct event *event, struct syscall_spec *syscall)
 {
+	struct syscall_thread *thread = NULL;
+	int script_fd = syscall_script_fd(syscall);
 	char *error = NULL;
 	bool done = false;
 
-	/* Wait if there are back-to-back blocking system calls. */
-	if (await_idle_thread(state)) {
-		asprintf(&error, "blocking system call while another blocking "
-			 "system call is already in progress");
+	thread = pick_syscall_thread(state, script_fd, &error);
+	if (thread == NULL)
 		goto error_out;
-	}
 
 	/* Enqueue the system call info and wake up the syscall thread. */
 	DEBUGP("main thread: signal enqueued\n");
-	state->syscalls->state = SYSCALL_ENQUEUED;
-	if (pthread_cond_signal(&state->syscalls->enqueued) != 0)
+	thread->state = SYSCALL_ENQUEUED;
+	thread->event = event;
+	thread->script_fd = script_fd;
+	thread->live_end_usecs = -1;
+	state->syscalls->num_busy++;
+	if (pthread_cond_signal(&thread->enqueued) != 0)
 		die_perror("pthread_cond_signal");
 
 	/* Wait for the syscall thread to dequeue and start the system call. */
-	while (state->syscalls->state == SYSCALL_ENQUEUED) {
+	while (thread->state == SYSCALL_ENQUEUED) {
 		DEBUGP("main thread: waiting for dequeued signal; "
-		       "state: %d\n", state->syscalls->state);
-		if (pthread_cond_wait(&state->syscalls->dequeued,
+		       "state: %d\n", thread->state);
+		if (pthread_cond_wait(&thread->dequeued,
 				      &state->mutex) != 0) {
 			die_perror("pthread_cond_wait");
 		}
@@ -1942,19 +3896,21 @@ static void enqueue_system_call(
 		 * the system call in a timely fashion.
 		 */
 		DEBUGP("main thread: unlocking and yielding\n");
-		pid_t thread_id = state->syscalls->thread_id;
+		int stat_fd = thread->stat_fd;
 		run_unlock(state);
 		if (yield() != 0)
 			die_perror("yield");
 
 		DEBUGP("main thread: checking syscall thread state\n");
-		if (is_thread_sleeping(getpid(), thread_id))
+		if (is_thread_sleeping(stat_fd))
 			done = true;
 
-		/* Grab the lock again and see if the thread is idle. */
+		/* Grab the lock again and see if the call is finished;
+		 * if so the thread may have moved on to another call.
+		 */
 		DEBUGP("main thread: locking and reading state\n");
 		run_lock(state);
-		if (state->syscalls->state == SYSCALL_IDLE)
+		if (thread->event != event)
 			done = true;
 	}
 	DEBUGP("main thread: continuing after syscall\n");
@@ -1970,40 +3926,49 @@ error_out:
 void run_system_call_event(
 	struct state *state, struct event *event, struct syscall_spec *syscall)
 {
+	enum profile_phase_t profile_phase;
+
 	DEBUGP("%d: system call: %s\n", event->line_number, syscall->name);
 
+	profile_phase = profile_phase_begin(PROFILE_SYSCALL);
 	if (is_blocking_syscall(syscall))
 		enqueue_system_call(state, event, syscall);
 	else
 		invoke_system_call(state, event, syscall);
+	profile_phase_end(profile_phase);
 }
 
-/* The code executed by our system call thread, which executes
+/* The code executed by our system call threads, which execute
  * blocking system calls.
  */
 static void *system_call_thread(void *arg)
 {
-	struct state *state = (struct state *)arg;
+	struct syscall_thread *thread = (struct syscall_thread *)arg;
+	struct state *state = thread->run_state;
 	char *error = NULL;
 	struct event *event = NULL;
 	struct syscall_spec *syscall = NULL;
 	bool done = false;
+	char name[32];
 
 	DEBUGP("syscall thread: starting and locking\n");
+	cpu_affinity_pin(CPU_ROLE_SYSCALL);
 	run_lock(state);
 
-	state->syscalls->thread_id = gettid();
-	if (state->syscalls->thread_id < 0)
+	thread->thread_id = gettid();
+	if (thread->thread_id < 0)
 		die_perror("gettid");
+	thread->stat_fd = open_thread_stat(getpid(), thread->thread_id);
+	snprintf(name, sizeof(name), "syscall thread %d", thread->thread_id);
+	perf_counters_thread_start(name);
 
 	while (!done) {
-		DEBUGP("syscall thread: in state %d\n",
-		       state->syscalls->state);
+		DEBUGP("syscall thread: in state %d\n", thread->state);
 
-		switch (state->syscalls->state) {
+		switch (thread->state) {
 		case SYSCALL_IDLE:
 			DEBUGP("syscall thread: waiting\n");
-			if (pthread_cond_wait(&state->syscalls->enqueued,
+			if (pthread_cond_wait(&thread->enqueued,
 					      &state->mutex)) {
 				die_perror("pthread_cond_wait");
 			}
@@ -2020,11 +3985,9 @@ static void *system_call_thread(void *arg)
 			 * release the global lock and the main thread
 			 * will move on to other, later events.
 			 */
-			event = state->event;
+			event = thread->event;
 			syscall = event->event.syscall;
 			assert(event->type == SYSCALL_EVENT);
-			state->syscalls->event = event;
-			state->syscalls->live_end_usecs = -1;
 
 			/* Make the system call. Note that our callees
 			 * here will release the global lock before
@@ -2035,11 +3998,13 @@ static void *system_call_thread(void *arg)
 			invoke_system_call(state, event, syscall);
 
 			/* Check end time for the blocking system call. */
-			assert(state->syscalls->live_end_usecs >= 0);
+			assert(thread->live_end_usecs >= 0);
 			if (verify_time(state,
 						event->time_type,
 						syscall->end_usecs, 0,
-						state->syscalls->live_end_usecs,
+						thread->live_end_usecs,
+						TIMING_SYSCALL_END,
+						event->line_number,
 						"system call return", &error)) {
 				die("%s:%d: %s\n",
 				    state->config->script_path,
@@ -2051,13 +4016,18 @@ static void *system_call_thread(void *arg)
 			 * thread if it's waiting for this call to
 			 * finish.
 			 */
-			assert(state->syscalls->state == SYSCALL_DONE);
-			state->syscalls->state = SYSCALL_IDLE;
-			state->syscalls->event = NULL;
-			state->syscalls->live_end_usecs = -1;
+			assert(thread->state == SYSCALL_DONE);
+			thread->state = SYSCALL_IDLE;
+			thread->event = NULL;
+			thread->script_fd = -1;
+			thread->live_end_usecs = -1;
+			state->syscalls->num_busy--;
 			DEBUGP("syscall thread: now idle\n");
-			if (pthread_cond_signal(&state->syscalls->idle) != 0)
-				die_perror("pthread_cond_signal");
+			if (state->event_loop != NULL)
+				event_loop_complete(state->event_loop);
+			else if (pthread_cond_broadcast(
+					 &state->syscalls->idle) != 0)
+				die_perror("pthread_cond_broadcast");
 			break;
 
 		case SYSCALL_EXITING:
@@ -2072,55 +4042,124 @@ static void *system_call_thread(void *arg)
 	return NULL;
 }
 
-struct syscalls *syscalls_new(struct state *state)
+/* Start another syscall thread in our pool. The caller holds the
+ * global lock, so the thread waits for it before looking at its state.
+ */
+static void start_syscall_thread(struct state *state)
 {
-	struct syscalls *syscalls = calloc(1, sizeof(struct syscalls));
-
-	syscalls->state = SYSCALL_IDLE;
+	struct syscalls *syscalls = state->syscalls;
+	struct syscall_thread *thread;
+
+	assert(syscalls->num_threads < MAX_SYSCALL_THREADS);
+	thread = &syscalls->threads[syscalls->num_threads];
+	thread->state = SYSCALL_IDLE;
+	thread->run_state = state;
+	thread->script_fd = -1;
+	thread->live_end_usecs = -1;
+	thread->stat_fd = -1;
+
+	if ((pthread_cond_init(&thread->enqueued, NULL) != 0) ||
+	    (pthread_cond_init(&thread->dequeued, NULL) != 0)) {
+		die_perror("pthread_cond_init");
+	}
 
-	if (pthread_create(&syscalls->thread, NULL, system_call_thread,
-			   state) != 0) {
+	if (pthread_create(&thread->thread, NULL, system_call_thread,
+			   thread) != 0) {
 		die_perror("pthread_create");
 	}
+	syscalls->num_threads++;
+}
+
+struct syscalls *syscalls_new(struct state *state)
+{
+	struct syscalls *syscalls = calloc(1, sizeof(struct syscalls));
+	char *error = NULL;
 
-	if ((pthread_cond_init(&syscalls->idle, NULL) != 0) ||
-	    (pthread_cond_init(&syscalls->enqueued, NULL) != 0) ||
-	    (pthread_cond_init(&syscalls->dequeued, NULL) != 0)) {
+	if (pthread_cond_init(&syscalls->idle, NULL) != 0)
 		die_perror("pthread_cond_init");
-	}
+
+	syscalls->send_payload =
+		payload_send_new(state->config->payload_pattern, &error);
+	if (syscalls->send_payload == NULL)
+		die("%s\n", error);
+	syscalls->zero_file_fd = -1;
+	syscalls->pipe_fds[0] = syscalls->pipe_fds[1] = -1;
+
+	/* Start one thread now, so scripts with at most one blocking
+	 * system call at a time never wait for a thread to start.
+	 */
+	state->syscalls = syscalls;
+	start_syscall_thread(state);
 
 	return syscalls;
 }
 
 void syscalls_free(struct state *state, struct syscalls *syscalls)
 {
-	/* Wait a bit for the thread to go idle. */
-	if (await_idle_thread(state)) {
-		die("%s:%d: runtime error: exiting while "
-		    "a blocking system call is in progress\n",
-		    state->config->script_path,
-		    syscalls->event->line_number);
+	int i;
+
+	/* Wait a bit for the threads to go idle. */
+	for (i = 0; i < syscalls->num_threads; i++) {
+		struct syscall_thread *thread = &syscalls->threads[i];
+
+		if (await_idle_thread(state, thread)) {
+			die("%s:%d: runtime error: exiting while "
+			    "a blocking system call is in progress\n",
+			    state->config->script_path,
+			    thread->event->line_number);
+		}
 	}
 
-	/* Send a request to terminate the thread. */
-	DEBUGP("main thread: signaling syscall thread to exit\n");
-	syscalls->state = SYSCALL_EXITING;
-	if (pthread_cond_signal(&syscalls->enqueued) != 0)
-		die_perror("pthread_cond_signal");
+	/* Send a request to terminate the threads. */
+	DEBUGP("main thread: signaling syscall threads to exit\n");
+	for (i = 0; i < syscalls->num_threads; i++) {
+		syscalls->threads[i].state = SYSCALL_EXITING;
+		if (pthread_cond_signal(&syscalls->threads[i].enqueued) != 0)
+			die_perror("pthread_cond_signal");
+	}
 
-	/* Release the lock briefly and wait for syscall thread to finish. */
+	/* Release the lock briefly and wait for syscall threads to finish. */
 	run_unlock(state);
 	DEBUGP("main thread: unlocking, waiting for syscall thread exit\n");
-	void *thread_result = NULL;
-	if (pthread_join(syscalls->thread, &thread_result) != 0)
-		die_perror("pthread_cancel");
-	DEBUGP("main thread: joined syscall thread; relocking\n");
+	for (i = 0; i < syscalls->num_threads; i++) {
+		void *thread_result = NULL;
+		if (pthread_join(syscalls->threads[i].thread,
+				 &thread_result) != 0)
+			die_perror("pthread_join");
+	}
+	DEBUGP("main thread: joined syscall threads; relocking\n");
 	run_lock(state);
 
-	if ((pthread_cond_destroy(&syscalls->idle) != 0) ||
-	    (pthread_cond_destroy(&syscalls->enqueued) != 0) ||
-	    (pthread_cond_destroy(&syscalls->dequeued) != 0)) {
+	for (i = 0; i < syscalls->num_threads; i++) {
+		struct syscall_thread *thread = &syscalls->threads[i];
+
+		if ((pthread_cond_destroy(&thread->enqueued) != 0) ||
+		    (pthread_cond_destroy(&thread->dequeued) != 0)) {
+			die_perror("pthread_cond_destroy");
+		}
+		if (thread->stat_fd >= 0 && close(thread->stat_fd) < 0)
+			die_perror("close");
+	}
+	if (pthread_cond_destroy(&syscalls->idle) != 0)
 		die_perror("pthread_cond_destroy");
+
+	/* Tear down rings first: their sends may point at the payload. */
+	for (i = 0; i < syscalls->num_other_fds; i++)
+		close_other_fd(&syscalls->other_fds[i]);
+
+	payload_send_free(syscalls->send_payload,
+			  state->config->payload_pattern);
+	for (i = 0; i < syscalls->num_threads; i++) {
+		if (syscalls->threads[i].recv_scratch != NULL)
+			payload_scratch_free(syscalls->threads[i].recv_scratch);
+	}
+	if (syscalls->recv_scratch != NULL)
+		payload_scratch_free(syscalls->recv_scratch);
+	if (syscalls->zero_file_fd >= 0)
+		close(syscalls->zero_file_fd);
+	if (syscalls->pipe_fds[0] >= 0) {
+		close(syscalls->pipe_fds[0]);
+		close(syscalls->pipe_fds[1]);
 	}
 
 	memset(syscalls, 0, sizeof(*syscalls));  /* to help catch bugs */
@@ -32,7 +32,26 @@
 
 struct state;
 
-/* States in which the system call thread can be. */
+/* The most system call threads we start, and thus the most blocking
+ * system calls a script can have in progress at once.
+ */
+#define MAX_SYSCALL_THREADS	16
+
+/* The most fds other than sockets, like epoll fds, a script can have
+ * open at once.
+ */
+#define MAX_OTHER_FDS		16
+
+struct uring;
+
+/* An fd other than a socket that the script created. */
+struct other_fd {
+	int script_fd;			/* fd number in the script */
+	int live_fd;			/* fd number in this process */
+	struct uring *ring;		/* its io_uring, or NULL if not one */
+};
+
+/* States in which a system call thread can be. */
 enum syscall_state_t {
 	SYSCALL_IDLE,		/* system call thread is idle */
 	SYSCALL_ENQUEUED,	/* blocking system call is ready to execute */
@@ -41,24 +60,19 @@ enum syscall_state_t {
 	SYSCALL_EXITING,	/* process is exiting */
 };
 
-/* Internal state for the system call module, including the "syscall
- * thread", which handles blocking system calls.
- */
-struct syscalls {
-	enum syscall_state_t state;	/* current state of syscall thread */
+/* One "syscall thread", which handles blocking system calls. */
+struct syscall_thread {
+	enum syscall_state_t state;	/* current state of this thread */
+	struct state *run_state;	/* the test we are running for */
 	struct event *event;		/* current system call it's running */
+	int script_fd;			/* script fd of the call, or -1 */
 	s64 live_end_usecs;		/* time of last system call return */
 
-	/* Handles for the syscall thread, for blocking system calls. */
+	/* Handles for the syscall thread. */
 	pthread_t thread;		/* pthread thread handle */
 	pid_t thread_id;		/* kernel thread ID  */
-
-	/* The main thread waits on this condition variable. The
-	 * system call thread signals this when it has finished
-	 * executing a blocking system call and is now idle and ready
-	 * to execute another blocking system call.
-	 */
-	pthread_cond_t idle;
+	int stat_fd;			/* open /proc stat file of thread */
+	u8 *recv_scratch;		/* where its receives land, or NULL */
 
 	/* The system call thread waits on this condition
 	 * variable. The main thread signals this when it has enqueued
@@ -77,6 +91,43 @@ struct syscalls {
 	pthread_cond_t dequeued;
 };
 
+/* Internal state for the system call module, including the pool of
+ * syscall threads. Blocking calls on the same script fd run one after
+ * another on the same thread; calls on different fds run on different
+ * threads, so they can all be blocked at once. We start threads as
+ * they are needed.
+ */
+struct syscalls {
+	struct syscall_thread threads[MAX_SYSCALL_THREADS];
+	int num_threads;		/* number of threads started so far */
+	int num_busy;			/* number of threads not idle */
+
+	/* The main thread waits on this condition variable. A system
+	 * call thread broadcasts this when it has finished executing
+	 * a blocking system call and is now idle and ready to execute
+	 * another blocking system call.
+	 */
+	pthread_cond_t idle;
+
+	/* Payloads for the send and receive calls. Scripts only give
+	 * the length of what they send, so all sends share one read-only
+	 * mapping (see payload.h), and sendfile() and splice() read a
+	 * sparse file of zeros that we grow as needed. Receives land in
+	 * a scratch mapping of the thread they run on.
+	 */
+	u8 *send_payload;		/* zeros, or --payload_pattern */
+	u8 *recv_scratch;		/* main thread's, or NULL */
+	int zero_file_fd;		/* sparse file of zeros, or -1 */
+	off_t zero_file_bytes;		/* size of that file */
+	int pipe_fds[2];		/* pipe for splice(), or -1s */
+
+	/* Fds other than sockets. These are not in state->sockets,
+	 * since packets are never mapped to them.
+	 */
+	struct other_fd other_fds[MAX_OTHER_FDS];
+	int num_other_fds;
+};
+
 /* Allocate and return internal state for the system call module. */
 extern struct syscalls *syscalls_new(struct state *state);
 
@@ -84,12 +135,19 @@ extern struct syscalls *syscalls_new(struct state *state);
 extern void syscalls_free(struct state *state,
 			  struct syscalls *syscalls);
 
+/* Return true if any blocking system call is in progress. */
+static inline bool syscalls_busy(const struct syscalls *syscalls)
+{
+	return syscalls->num_busy > 0;
+}
+
 /* Execute the given system call event. The system call may be
  * expected to block for a while, or it may be expected to return
- * immediately. To keep things simple, currently we only support
- * at most one blocking system call at a time; if a script attempts to
- * start a second blocking call before the first blocking call has
- * returned then this second call raises a runtime error.
+ * immediately. Up to MAX_SYSCALL_THREADS blocking system calls can be
+ * in progress at once, as long as they are on different script fds;
+ * if a script starts a blocking call on an fd while an earlier
+ * blocking call on that fd has not returned within a second, this
+ * second call raises a runtime error.
  */
 void run_system_call_event(struct state *state,
 			   struct event *event,
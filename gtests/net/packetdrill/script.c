@@ -31,8 +31,11 @@
 #include "symbols.h"
 
 /* Fill in a value representing the given expression in
- * fully-evaluated form (e.g. symbols resolved to ints). On success,
- * returns STATUS_OK. On error return STATUS_ERR and fill in *error.
+ * fully-evaluated form (e.g. symbols resolved to ints). Parts of the
+ * expression that are already in that form are shared rather than
+ * copied; *out_ptr is the expression itself if all of it is. On
+ * success, returns STATUS_OK. On error return STATUS_ERR and fill in
+ * *error, leaving nothing to free.
  */
 static int evaluate(struct expression *in,
 		    struct expression **out_ptr, char **error);
@@ -46,6 +49,131 @@ void init_script(struct script *script)
 	script->event_list = NULL;
 }
 
+static void free_syscall_spec(struct syscall_spec *syscall)
+{
+	free((char *)syscall->name);
+	free_expression_list(syscall->arguments);
+	free_expression(syscall->result);
+	if (syscall->error != NULL) {
+		free((char *)syscall->error->errno_macro);
+		free((char *)syscall->error->strerror);
+		free(syscall->error);
+	}
+	free(syscall->note);
+	free(syscall);
+}
+
+static void free_repeat_spec(struct repeat_spec *repeat)
+{
+	struct event *event = repeat->events, *next = NULL;
+	int i;
+
+	for (; event != NULL; event = next) {
+		next = event->next;
+		free_event(event);
+	}
+	for (i = 0; i < repeat->num_packets; ++i)
+		packet_free(repeat->packets[i]);
+	free(repeat->packets);
+	free(repeat);
+}
+
+static void free_interleave_spec(struct interleave_spec *interleave)
+{
+	struct event *event = interleave->events, *next = NULL;
+
+	for (; event != NULL; event = next) {
+		next = event->next;
+		free_event(event);
+	}
+	free(interleave);
+}
+
+void free_event(struct event *event)
+{
+	switch (event->type) {
+	case PACKET_EVENT:
+		packet_free(event->event.packet);
+		break;
+	case SYSCALL_EVENT:
+		free_syscall_spec(event->event.syscall);
+		break;
+	case COMMAND_EVENT:
+		free((char *)event->event.command->command_line);
+		free(event->event.command);
+		break;
+	case CODE_EVENT:
+		free((char *)event->event.code->text);
+		free(event->event.code);
+		break;
+	case REPEAT_EVENT:
+		free_repeat_spec(event->event.repeat);
+		break;
+	case METER_EVENT:
+		free(event->event.meter);
+		break;
+	case MP_JOIN_STORM_EVENT:
+		free(event->event.mp_join_storm);
+		break;
+	case PEER_EVENT:
+		free(event->event.peer);
+		break;
+	case SYN_FLOOD_EVENT:
+		free(event->event.syn_flood);
+		break;
+	case INTERLEAVE_EVENT:
+		free_interleave_spec(event->event.interleave);
+		break;
+	case INVALID_EVENT:
+	case NUM_EVENT_TYPES:
+		break;
+	/* missing default case so compiler catches missing cases */
+	}
+	memset(event, 0, sizeof(*event));  /* paranoia */
+	free(event);
+}
+
+/* Free the packets of an event in the arena; the packets themselves
+ * are always on the heap.
+ */
+static void free_event_packets(struct event *event)
+{
+	struct repeat_spec *repeat = NULL;
+	struct event *e = NULL;
+	int i;
+
+	if (event->type == PACKET_EVENT) {
+		packet_free(event->event.packet);
+	} else if (event->type == REPEAT_EVENT) {
+		repeat = event->event.repeat;
+		for (e = repeat->events; e != NULL; e = e->next)
+			if (e->type == PACKET_EVENT)
+				packet_free(e->event.packet);
+		for (i = 0; i < repeat->num_packets; ++i)
+			packet_free(repeat->packets[i]);
+	} else if (event->type == INTERLEAVE_EVENT) {
+		for (e = event->event.interleave->events; e != NULL;
+		     e = e->next)
+			packet_free(e->event.packet);
+	}
+}
+
+void free_script(struct script *script)
+{
+	struct event *event = script->event_list, *next = NULL;
+
+	for (; event != NULL; event = next) {
+		next = event->next;
+		if (script->arena_events)
+			free_event_packets(event);
+		else
+			free_event(event);
+	}
+	arena_free(script->arena);
+	free(script->buffer);
+	init_script(script);
+}
+
 /* This table maps expression types to human-readable strings */
 struct expression_type_entry {
 	enum expression_t type;
@@ -65,6 +193,9 @@ struct expression_type_entry expression_type_table[] = {
 	{ EXPR_IOVEC,                "iovec" },
 	{ EXPR_MSGHDR,               "msghdr" },
 	{ EXPR_POLLFD,               "pollfd" },
+	{ EXPR_EPOLLEV,              "epoll_event" },
+	{ EXPR_MMSGHDR,              "mmsghdr" },
+	{ EXPR_CMSGHDR,              "cmsghdr" },
 	{ NUM_EXPR_TYPES,            NULL}
 };
 
@@ -105,30 +236,15 @@ struct int_symbol cross_platform_symbols[] = {
 	{ 0, NULL },
 };
 
-/* Do a symbol->int lookup, and return true iff we found the symbol. */
-static bool lookup_int_symbol(const char *input_symbol, s64 *output_integer,
-			      struct int_symbol *symbols)
-{
-	int i;
-	for (i = 0; symbols[i].name != NULL ; ++i) {
-		if (strcmp(input_symbol, symbols[i].name) == 0) {
-			*output_integer = symbols[i].value;
-			return true;
-		}
-	}
-	return false;
-}
-
 int symbol_to_int(const char *input_symbol, s64 *output_integer,
 		  char **error)
 {
-	if (lookup_int_symbol(input_symbol, output_integer,
-			      cross_platform_symbols))
-		return STATUS_OK;
+	const struct int_symbol *symbol = find_int_symbol(input_symbol);
 
-	if (lookup_int_symbol(input_symbol, output_integer,
-			      platform_symbols()))
+	if (symbol != NULL) {
+		*output_integer = symbol->value;
 		return STATUS_OK;
+	}
 
 	asprintf(error, "unknown symbol: '%s'", input_symbol);
 	return STATUS_ERR;
@@ -218,7 +334,7 @@ static int unescape_cstring_expression(const char *input_string,
 {
 	int bytes = strlen(input_string);
 	out->type = EXPR_STRING;
-	out->value.string = (char *)malloc(bytes);
+	out->value.string = (char *)malloc(bytes + 1);
 	const char *c_in = input_string;
 	char *c_out = out->value.string;
 	while (*c_in != '\0') {
@@ -255,6 +371,7 @@ static int unescape_cstring_expression(const char *input_string,
 		++c_in;
 		++c_out;
 	}
+	*c_out = '\0';
 	return STATUS_OK;
 }
 
@@ -300,6 +417,7 @@ void free_expression(struct expression *expression)
 		assert(expression->value.iovec);
 		free_expression(expression->value.iovec->iov_base);
 		free_expression(expression->value.iovec->iov_len);
+		free(expression->value.iovec);
 		break;
 	case EXPR_MSGHDR:
 		assert(expression->value.msghdr);
@@ -308,12 +426,34 @@ void free_expression(struct expression *expression)
 		free_expression(expression->value.msghdr->msg_iov);
 		free_expression(expression->value.msghdr->msg_iovlen);
 		free_expression(expression->value.msghdr->msg_flags);
+		free_expression(expression->value.msghdr->msg_control);
+		free(expression->value.msghdr);
 		break;
 	case EXPR_POLLFD:
 		assert(expression->value.pollfd);
 		free_expression(expression->value.pollfd->fd);
 		free_expression(expression->value.pollfd->events);
 		free_expression(expression->value.pollfd->revents);
+		free(expression->value.pollfd);
+		break;
+	case EXPR_EPOLLEV:
+		assert(expression->value.epollev);
+		free_expression(expression->value.epollev->events);
+		free_expression(expression->value.epollev->fd);
+		free(expression->value.epollev);
+		break;
+	case EXPR_MMSGHDR:
+		assert(expression->value.mmsghdr);
+		free_expression(expression->value.mmsghdr->msg_hdr);
+		free_expression(expression->value.mmsghdr->msg_len);
+		free(expression->value.mmsghdr);
+		break;
+	case EXPR_CMSGHDR:
+		assert(expression->value.cmsghdr);
+		free_expression(expression->value.cmsghdr->cmsg_level);
+		free_expression(expression->value.cmsghdr->cmsg_type);
+		free_expression(expression->value.cmsghdr->cmsg_data);
+		free(expression->value.cmsghdr);
 		break;
 	case EXPR_NONE:
 	case NUM_EXPR_TYPES:
@@ -334,13 +474,169 @@ void free_expression_list(struct expression_list *list)
 	}
 }
 
+/* Free the parts of an evaluated expression that evaluate() made anew,
+ * leaving alone the subtrees it shares with the expression it was
+ * evaluated from.
+ */
+static void free_evaluated_expression(struct expression *out,
+				      struct expression *in);
+
+static void free_evaluated_list(struct expression_list *out,
+				struct expression_list *in)
+{
+	while (out != in) {
+		struct expression_list *dead = out;
+
+		free_evaluated_expression(out->expression, in->expression);
+		out = out->next;
+		in = in->next;
+		free(dead);
+	}
+}
+
+/* Free the evaluated fields of a struct expression, given the fields
+ * they were evaluated from.
+ */
+static void free_evaluated_fields(struct expression **out,
+				  struct expression **in, int num_fields)
+{
+	int i;
+
+	for (i = 0; i < num_fields; ++i)
+		free_evaluated_expression(out[i], in[i]);
+}
+
+static void free_evaluated_expression(struct expression *out,
+				      struct expression *in)
+{
+	if (out == NULL || out == in)
+		return;
+	switch (out->type) {
+	case EXPR_STRING:
+		free(out->value.string);
+		break;
+	case EXPR_LIST:
+		free_evaluated_list(out->value.list, in->value.list);
+		break;
+	case EXPR_IOVEC:
+		free_evaluated_fields((struct expression *[]) {
+				out->value.iovec->iov_base,
+				out->value.iovec->iov_len },
+			(struct expression *[]) {
+				in->value.iovec->iov_base,
+				in->value.iovec->iov_len }, 2);
+		free(out->value.iovec);
+		break;
+	case EXPR_MSGHDR:
+		free_evaluated_fields((struct expression *[]) {
+				out->value.msghdr->msg_name,
+				out->value.msghdr->msg_namelen,
+				out->value.msghdr->msg_iov,
+				out->value.msghdr->msg_iovlen,
+				out->value.msghdr->msg_flags,
+				out->value.msghdr->msg_control },
+			(struct expression *[]) {
+				in->value.msghdr->msg_name,
+				in->value.msghdr->msg_namelen,
+				in->value.msghdr->msg_iov,
+				in->value.msghdr->msg_iovlen,
+				in->value.msghdr->msg_flags,
+				in->value.msghdr->msg_control }, 6);
+		free(out->value.msghdr);
+		break;
+	case EXPR_POLLFD:
+		free_evaluated_fields((struct expression *[]) {
+				out->value.pollfd->fd,
+				out->value.pollfd->events,
+				out->value.pollfd->revents },
+			(struct expression *[]) {
+				in->value.pollfd->fd,
+				in->value.pollfd->events,
+				in->value.pollfd->revents }, 3);
+		free(out->value.pollfd);
+		break;
+	case EXPR_EPOLLEV:
+		free_evaluated_fields((struct expression *[]) {
+				out->value.epollev->events,
+				out->value.epollev->fd },
+			(struct expression *[]) {
+				in->value.epollev->events,
+				in->value.epollev->fd }, 2);
+		free(out->value.epollev);
+		break;
+	case EXPR_MMSGHDR:
+		free_evaluated_fields((struct expression *[]) {
+				out->value.mmsghdr->msg_hdr,
+				out->value.mmsghdr->msg_len },
+			(struct expression *[]) {
+				in->value.mmsghdr->msg_hdr,
+				in->value.mmsghdr->msg_len }, 2);
+		free(out->value.mmsghdr);
+		break;
+	case EXPR_CMSGHDR:
+		free_evaluated_fields((struct expression *[]) {
+				out->value.cmsghdr->cmsg_level,
+				out->value.cmsghdr->cmsg_type,
+				out->value.cmsghdr->cmsg_data },
+			(struct expression *[]) {
+				in->value.cmsghdr->cmsg_level,
+				in->value.cmsghdr->cmsg_type,
+				in->value.cmsghdr->cmsg_data }, 3);
+		free(out->value.cmsghdr);
+		break;
+	default:
+		/* Integers are the only other kind evaluate() makes. */
+		assert(out->type == EXPR_INTEGER);
+		break;
+	}
+	memset(out, 0, sizeof(*out));  /* paranoia */
+	free(out);
+}
+
+void free_evaluated_expression_list(struct expression_list *out_list,
+				    struct expression_list *in_list)
+{
+	free_evaluated_list(out_list, in_list);
+}
+
+/* Return a new expression of the given type, evaluated from in. */
+static struct expression *new_evaluated_expression(struct expression *in,
+						   enum expression_t type)
+{
+	struct expression *out = calloc(1, sizeof(struct expression));
+
+	out->type = type;
+	out->format = in->format;
+	return out;
+}
+
+/* Evaluate the fields of a struct expression. Sets *shared if each
+ * evaluates to itself, so that the whole struct can be shared.
+ */
+static int evaluate_fields(struct expression **in, struct expression **out,
+			   int num_fields, bool *shared, char **error)
+{
+	int i;
+
+	*shared = true;
+	for (i = 0; i < num_fields; ++i) {
+		if (evaluate(in[i], &out[i], error)) {
+			free_evaluated_fields(out, in, i);
+			return STATUS_ERR;
+		}
+		if (out[i] != in[i])
+			*shared = false;
+	}
+	return STATUS_OK;
+}
+
 static int evaluate_binary_expression(struct expression *in,
-				      struct expression *out, char **error)
+				      struct expression **out_ptr,
+				      char **error)
 {
 	int result = STATUS_ERR;
 	assert(in->type == EXPR_BINARY);
 	assert(in->value.binary);
-	out->type = EXPR_INTEGER;
 
 	struct expression *lhs = NULL;
 	struct expression *rhs = NULL;
@@ -354,7 +650,8 @@ static int evaluate_binary_expression(struct expression *in,
 		} else if (rhs->type != EXPR_INTEGER) {
 			asprintf(error, "right hand side of | not an integer");
 		} else {
-			out->value.num = lhs->value.num | rhs->value.num;
+			*out_ptr = new_evaluated_expression(in, EXPR_INTEGER);
+			(*out_ptr)->value.num = lhs->value.num | rhs->value.num;
 			result = STATUS_OK;
 		}
 	} else {
@@ -362,96 +659,237 @@ static int evaluate_binary_expression(struct expression *in,
 			 in->value.binary->op);
 	}
 error_out:
-	free_expression(rhs);
-	free_expression(lhs);
+	free_evaluated_expression(rhs, in->value.binary->rhs);
+	free_evaluated_expression(lhs, in->value.binary->lhs);
 	return result;
 }
 
+/* Evaluate a list, sharing the longest tail of it that evaluates to
+ * itself.
+ */
+static int evaluate_list(struct expression_list *in_list,
+			 struct expression_list **out_list, char **error)
+{
+	struct expression *expression = NULL;
+	struct expression_list *next = NULL;
+
+	*out_list = in_list;
+	if (in_list == NULL)
+		return STATUS_OK;
+	if (evaluate(in_list->expression, &expression, error))
+		return STATUS_ERR;
+	if (evaluate_list(in_list->next, &next, error)) {
+		free_evaluated_expression(expression, in_list->expression);
+		return STATUS_ERR;
+	}
+	if (expression == in_list->expression && next == in_list->next)
+		return STATUS_OK;
+	*out_list = calloc(1, sizeof(struct expression_list));
+	(*out_list)->expression = expression;
+	(*out_list)->next = next;
+	return STATUS_OK;
+}
+
 static int evaluate_list_expression(struct expression *in,
-				    struct expression *out, char **error)
+				    struct expression **out_ptr,
+				    char **error)
 {
+	struct expression_list *list = NULL;
+
 	assert(in->type == EXPR_LIST);
-	assert(out->type == EXPR_LIST);
 
-	out->value.list = NULL;
-	return evaluate_expression_list(in->value.list,
-					&out->value.list, error);
+	if (evaluate_list(in->value.list, &list, error))
+		return STATUS_ERR;
+	if (list != in->value.list) {
+		*out_ptr = new_evaluated_expression(in, EXPR_LIST);
+		(*out_ptr)->value.list = list;
+	}
+	return STATUS_OK;
 }
 
 static int evaluate_iovec_expression(struct expression *in,
-				     struct expression *out, char **error)
+				     struct expression **out_ptr,
+				     char **error)
 {
 	struct iovec_expr *in_iov;
 	struct iovec_expr *out_iov;
+	struct expression *out[2];
+	bool shared;
 
 	assert(in->type == EXPR_IOVEC);
 	assert(in->value.iovec);
-	assert(out->type == EXPR_IOVEC);
-
-	out->value.iovec = calloc(1, sizeof(struct iovec_expr));
 
 	in_iov = in->value.iovec;
-	out_iov = out->value.iovec;
-
-	if (evaluate(in_iov->iov_base,		&out_iov->iov_base,	error))
-		return STATUS_ERR;
-	if (evaluate(in_iov->iov_len,		&out_iov->iov_len,	error))
+	if (evaluate_fields((struct expression *[]) {
+				in_iov->iov_base,
+				in_iov->iov_len },
+			    out, ARRAY_SIZE(out), &shared, error))
 		return STATUS_ERR;
+	if (shared)
+		return STATUS_OK;
 
+	out_iov = calloc(1, sizeof(struct iovec_expr));
+	out_iov->iov_base	= out[0];
+	out_iov->iov_len	= out[1];
+	*out_ptr = new_evaluated_expression(in, EXPR_IOVEC);
+	(*out_ptr)->value.iovec = out_iov;
 	return STATUS_OK;
 }
 
 static int evaluate_msghdr_expression(struct expression *in,
-				      struct expression *out, char **error)
+				      struct expression **out_ptr,
+				      char **error)
 {
 	struct msghdr_expr *in_msg;
 	struct msghdr_expr *out_msg;
+	struct expression *out[6];
+	bool shared;
 
 	assert(in->type == EXPR_MSGHDR);
 	assert(in->value.msghdr);
-	assert(out->type == EXPR_MSGHDR);
-
-	out->value.msghdr = calloc(1, sizeof(struct msghdr_expr));
 
 	in_msg = in->value.msghdr;
-	out_msg = out->value.msghdr;
-
-	if (evaluate(in_msg->msg_name,		&out_msg->msg_name,	error))
-		return STATUS_ERR;
-	if (evaluate(in_msg->msg_namelen,	&out_msg->msg_namelen,	error))
-		return STATUS_ERR;
-	if (evaluate(in_msg->msg_iov,		&out_msg->msg_iov,	error))
-		return STATUS_ERR;
-	if (evaluate(in_msg->msg_iovlen,	&out_msg->msg_iovlen,	error))
-		return STATUS_ERR;
-	if (evaluate(in_msg->msg_flags,		&out_msg->msg_flags,	error))
+	if (evaluate_fields((struct expression *[]) {
+				in_msg->msg_name,
+				in_msg->msg_namelen,
+				in_msg->msg_iov,
+				in_msg->msg_iovlen,
+				in_msg->msg_flags,
+				in_msg->msg_control },
+			    out, ARRAY_SIZE(out), &shared, error))
 		return STATUS_ERR;
+	if (shared)
+		return STATUS_OK;
 
+	out_msg = calloc(1, sizeof(struct msghdr_expr));
+	out_msg->msg_name	= out[0];
+	out_msg->msg_namelen	= out[1];
+	out_msg->msg_iov	= out[2];
+	out_msg->msg_iovlen	= out[3];
+	out_msg->msg_flags	= out[4];
+	out_msg->msg_control	= out[5];
+	*out_ptr = new_evaluated_expression(in, EXPR_MSGHDR);
+	(*out_ptr)->value.msghdr = out_msg;
 	return STATUS_OK;
 }
 
 static int evaluate_pollfd_expression(struct expression *in,
-				      struct expression *out, char **error)
+				      struct expression **out_ptr,
+				      char **error)
 {
 	struct pollfd_expr *in_pollfd;
 	struct pollfd_expr *out_pollfd;
+	struct expression *out[3];
+	bool shared;
 
 	assert(in->type == EXPR_POLLFD);
 	assert(in->value.pollfd);
-	assert(out->type == EXPR_POLLFD);
-
-	out->value.pollfd = calloc(1, sizeof(struct pollfd_expr));
 
 	in_pollfd = in->value.pollfd;
-	out_pollfd = out->value.pollfd;
+	if (evaluate_fields((struct expression *[]) {
+				in_pollfd->fd,
+				in_pollfd->events,
+				in_pollfd->revents },
+			    out, ARRAY_SIZE(out), &shared, error))
+		return STATUS_ERR;
+	if (shared)
+		return STATUS_OK;
 
-	if (evaluate(in_pollfd->fd,		&out_pollfd->fd,	error))
+	out_pollfd = calloc(1, sizeof(struct pollfd_expr));
+	out_pollfd->fd		= out[0];
+	out_pollfd->events	= out[1];
+	out_pollfd->revents	= out[2];
+	*out_ptr = new_evaluated_expression(in, EXPR_POLLFD);
+	(*out_ptr)->value.pollfd = out_pollfd;
+	return STATUS_OK;
+}
+
+static int evaluate_epollev_expression(struct expression *in,
+				       struct expression **out_ptr,
+				       char **error)
+{
+	struct epollev_expr *in_ev;
+	struct epollev_expr *out_ev;
+	struct expression *out[2];
+	bool shared;
+
+	assert(in->type == EXPR_EPOLLEV);
+	assert(in->value.epollev);
+
+	in_ev = in->value.epollev;
+	if (evaluate_fields((struct expression *[]) {
+				in_ev->events,
+				in_ev->fd },
+			    out, ARRAY_SIZE(out), &shared, error))
 		return STATUS_ERR;
-	if (evaluate(in_pollfd->events,		&out_pollfd->events,	error))
+	if (shared)
+		return STATUS_OK;
+
+	out_ev = calloc(1, sizeof(struct epollev_expr));
+	out_ev->events	= out[0];
+	out_ev->fd	= out[1];
+	*out_ptr = new_evaluated_expression(in, EXPR_EPOLLEV);
+	(*out_ptr)->value.epollev = out_ev;
+	return STATUS_OK;
+}
+
+static int evaluate_mmsghdr_expression(struct expression *in,
+				       struct expression **out_ptr,
+				       char **error)
+{
+	struct mmsghdr_expr *in_mmsg;
+	struct mmsghdr_expr *out_mmsg;
+	struct expression *out[2];
+	bool shared;
+
+	assert(in->type == EXPR_MMSGHDR);
+	assert(in->value.mmsghdr);
+
+	in_mmsg = in->value.mmsghdr;
+	if (evaluate_fields((struct expression *[]) {
+				in_mmsg->msg_hdr,
+				in_mmsg->msg_len },
+			    out, ARRAY_SIZE(out), &shared, error))
 		return STATUS_ERR;
-	if (evaluate(in_pollfd->revents,	&out_pollfd->revents,	error))
+	if (shared)
+		return STATUS_OK;
+
+	out_mmsg = calloc(1, sizeof(struct mmsghdr_expr));
+	out_mmsg->msg_hdr	= out[0];
+	out_mmsg->msg_len	= out[1];
+	*out_ptr = new_evaluated_expression(in, EXPR_MMSGHDR);
+	(*out_ptr)->value.mmsghdr = out_mmsg;
+	return STATUS_OK;
+}
+
+static int evaluate_cmsghdr_expression(struct expression *in,
+				       struct expression **out_ptr,
+				       char **error)
+{
+	struct cmsghdr_expr *in_cmsg;
+	struct cmsghdr_expr *out_cmsg;
+	struct expression *out[3];
+	bool shared;
+
+	assert(in->type == EXPR_CMSGHDR);
+	assert(in->value.cmsghdr);
+
+	in_cmsg = in->value.cmsghdr;
+	if (evaluate_fields((struct expression *[]) {
+				in_cmsg->cmsg_level,
+				in_cmsg->cmsg_type,
+				in_cmsg->cmsg_data },
+			    out, ARRAY_SIZE(out), &shared, error))
 		return STATUS_ERR;
+	if (shared)
+		return STATUS_OK;
 
+	out_cmsg = calloc(1, sizeof(struct cmsghdr_expr));
+	out_cmsg->cmsg_level	= out[0];
+	out_cmsg->cmsg_type	= out[1];
+	out_cmsg->cmsg_data	= out[2];
+	*out_ptr = new_evaluated_expression(in, EXPR_CMSGHDR);
+	(*out_ptr)->value.cmsghdr = out_cmsg;
 	return STATUS_OK;
 }
 
@@ -459,9 +897,10 @@ static int evaluate(struct expression *in,
 		    struct expression **out_ptr, char **error)
 {
 	int result = STATUS_OK;
-	struct expression *out = calloc(1, sizeof(struct expression));
-	*out_ptr = out;
-	out->type = in->type;	/* most types of expression stay the same */
+	struct expression *out = NULL;
+
+	/* Most expressions evaluate to themselves, so share them. */
+	*out_ptr = in;
 
 	if ((in->type <= EXPR_NONE) ||
 	    (in->type >= NUM_EXPR_TYPES)) {
@@ -470,52 +909,55 @@ static int evaluate(struct expression *in,
 	}
 	switch (in->type) {
 	case EXPR_ELLIPSIS:
-		break;
-	case EXPR_INTEGER:		/* copy as-is */
-		out->value.num = in->value.num;
-		break;
-	case EXPR_LINGER:		/* copy as-is */
-		memcpy(&out->value.linger, &in->value.linger,
-		       sizeof(in->value.linger));
+	case EXPR_INTEGER:
+	case EXPR_LINGER:
+	case EXPR_SOCKET_ADDRESS_IPV4:
+	case EXPR_SOCKET_ADDRESS_IPV6:
 		break;
 	case EXPR_WORD:
-		out->type = EXPR_INTEGER;
-		if (symbol_to_int(in->value.string,
-				  &out->value.num, error))
+		out = new_evaluated_expression(in, EXPR_INTEGER);
+		if (in->symbol != NULL) {	/* resolved when parsed */
+			out->value.num = in->symbol->value;
+		} else if (symbol_to_int(in->value.string,
+					 &out->value.num, error)) {
+			free(out);
 			return STATUS_ERR;
+		}
+		*out_ptr = out;
 		break;
 	case EXPR_STRING:
-		if (unescape_cstring_expression(in->value.string, out, error))
+		if (strchr(in->value.string, '\\') == NULL)
+			break;		/* nothing to unescape */
+		out = new_evaluated_expression(in, EXPR_STRING);
+		if (unescape_cstring_expression(in->value.string, out, error)) {
+			free_evaluated_expression(out, in);
 			return STATUS_ERR;
-		break;
-	case EXPR_SOCKET_ADDRESS_IPV4:	/* copy as-is */
-		out->value.socket_address_ipv4 =
-			malloc(sizeof(struct sockaddr_in));
-		memcpy(out->value.socket_address_ipv4,
-		       in->value.socket_address_ipv4,
-		       sizeof(*(out->value.socket_address_ipv4)));
-		break;
-	case EXPR_SOCKET_ADDRESS_IPV6:	/* copy as-is */
-		out->value.socket_address_ipv6 =
-			malloc(sizeof(struct sockaddr_in6));
-		memcpy(out->value.socket_address_ipv6,
-		       in->value.socket_address_ipv6,
-		       sizeof(*(out->value.socket_address_ipv6)));
+		}
+		*out_ptr = out;
 		break;
 	case EXPR_BINARY:
-		result = evaluate_binary_expression(in, out, error);
+		result = evaluate_binary_expression(in, out_ptr, error);
 		break;
 	case EXPR_LIST:
-		result = evaluate_list_expression(in, out, error);
+		result = evaluate_list_expression(in, out_ptr, error);
 		break;
 	case EXPR_IOVEC:
-		result = evaluate_iovec_expression(in, out, error);
+		result = evaluate_iovec_expression(in, out_ptr, error);
 		break;
 	case EXPR_MSGHDR:
-		result = evaluate_msghdr_expression(in, out, error);
+		result = evaluate_msghdr_expression(in, out_ptr, error);
 		break;
 	case EXPR_POLLFD:
-		result = evaluate_pollfd_expression(in, out, error);
+		result = evaluate_pollfd_expression(in, out_ptr, error);
+		break;
+	case EXPR_EPOLLEV:
+		result = evaluate_epollev_expression(in, out_ptr, error);
+		break;
+	case EXPR_MMSGHDR:
+		result = evaluate_mmsghdr_expression(in, out_ptr, error);
+		break;
+	case EXPR_CMSGHDR:
+		result = evaluate_cmsghdr_expression(in, out_ptr, error);
 		break;
 	case EXPR_NONE:
 	case NUM_EXPR_TYPES:
@@ -526,27 +968,9 @@ static int evaluate(struct expression *in,
 	return result;
 }
 
-/* Return a copy of the given expression list with each expression
- * evaluated (e.g. symbols resolved to ints). On failure, return NULL
- * and fill in *error.
- */
 int evaluate_expression_list(struct expression_list *in_list,
 			     struct expression_list **out_list,
 			     char **error)
 {
-	struct expression_list **node_ptr = out_list;
-	while (in_list != NULL) {
-		struct expression_list *node =
-			calloc(1, sizeof(struct expression_list));
-		*node_ptr = node;
-		if (evaluate(in_list->expression,
-			     &node->expression, error)) {
-			free_expression_list(*out_list);
-			*out_list = NULL;
-			return STATUS_ERR;
-		}
-		node_ptr = &(node->next);
-		in_list = in_list->next;
-	}
-	return STATUS_OK;
+	return evaluate_list(in_list, out_list, error);
 }
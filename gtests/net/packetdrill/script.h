@@ -28,7 +28,9 @@
 #include "types.h"
 
 #include <sys/time.h>
+#include "arena.h"
 #include "packet.h"
+#include "symbols.h"
 
 /* The types of expressions in a script */
 enum expression_t {
@@ -45,6 +47,9 @@ enum expression_t {
 	EXPR_IOVEC,		  /* expression tree for an iovec struct */
 	EXPR_MSGHDR,		  /* expression tree for a msghdr struct */
 	EXPR_POLLFD,		  /* expression tree for a pollfd struct */
+	EXPR_EPOLLEV,		  /* expression tree for an epoll_event */
+	EXPR_MMSGHDR,		  /* expression tree for a mmsghdr struct */
+	EXPR_CMSGHDR,		  /* expression tree for a cmsghdr struct */
 	NUM_EXPR_TYPES,
 };
 /* Convert an expression type to a human-readable string */
@@ -64,8 +69,12 @@ struct expression {
 		struct iovec_expr *iovec;
 		struct msghdr_expr *msghdr;
 		struct pollfd_expr *pollfd;
+		struct epollev_expr *epollev;
+		struct mmsghdr_expr *mmsghdr;
+		struct cmsghdr_expr *cmsghdr;
 	} value;
 	const char *format;	/* the printf format for printing the value */
+	const struct int_symbol *symbol; /* symbol named by EXPR_WORD, if any */
 };
 
 /* Two expressions combined via a binary operator */
@@ -96,6 +105,7 @@ struct msghdr_expr {
 	struct expression *msg_iov;
 	struct expression *msg_iovlen;
 	struct expression *msg_flags;
+	struct expression *msg_control;	/* list of cmsghdrs; maybe empty */
 };
 
 /* Parse tree for a pollfd struct in a poll syscall. */
@@ -105,6 +115,27 @@ struct pollfd_expr {
 	struct expression *revents;	/* returned events */
 };
 
+/* Parse tree for a struct epoll_event in an epoll_ctl/epoll_wait
+ * syscall. We keep the script fd in the event's data.
+ */
+struct epollev_expr {
+	struct expression *events;	/* requested or returned events */
+	struct expression *fd;		/* script fd in data */
+};
+
+/* Parse tree for a mmsghdr struct in a sendmmsg/recvmmsg syscall. */
+struct mmsghdr_expr {
+	struct expression *msg_hdr;	/* the message */
+	struct expression *msg_len;	/* bytes sent or received */
+};
+
+/* Parse tree for one control message in a msghdr's msg_control. */
+struct cmsghdr_expr {
+	struct expression *cmsg_level;	/* originating protocol */
+	struct expression *cmsg_type;	/* protocol-specific type */
+	struct expression *cmsg_data;	/* integer value carried */
+};
+
 /* The errno-related info from strace to summarize a system call error */
 struct errno_spec {
 	const char *errno_macro;	/* errno symbol (C macro name) */
@@ -144,6 +175,200 @@ struct code_spec {
 	const char *text;	/* snippet of post-processing code */
 };
 
+/* Aggregates a meter computes over the outbound packets of its window. */
+enum meter_metric_t {
+	METER_BYTES = 0,	/* TCP payload bytes */
+	METER_PACKETS,		/* packets */
+	METER_KBPS,		/* payload rate over the window, in kbit/s */
+	METER_DSN_SHARE,	/* percent of the payload bytes all sockets
+				 * sent in the window
+				 */
+	METER_GAP_P50,		/* median gap between the departures of
+				 * consecutive packets, in microseconds
+				 */
+	METER_GAP_P90,		/* 90th percentile of those gaps */
+	METER_PACING_KBPS,	/* median rate each gap paces its packet
+				 * at (IP bytes of the earlier packet over
+				 * the gap), in kbit/s
+				 */
+	METER_PACING_PCT,	/* METER_PACING_KBPS as a percent of the
+				 * socket's SO_MAX_PACING_RATE
+				 */
+	NUM_METER_METRICS,
+};
+
+/* A bound on one aggregate: metric >= bound, or metric <= bound. */
+struct meter_check {
+	enum meter_metric_t metric;
+	bool at_least;		/* >= rather than <= */
+	double bound;
+};
+
+#define MAX_METER_CHECKS	4	/* most checks on one meter */
+
+/* A window of outbound traffic to check in aggregate rather than packet
+ * by packet, e.g. "meter 0.200 sock(4) kbps >= 10000". The window
+ * starts at the event's time and lasts window_usecs; the events after
+ * it keep running meanwhile, and every outbound packet sniffed in the
+ * window counts. The gap and pacing metrics check a socket's pacing
+ * (SO_MAX_PACING_RATE, or the rate TCP paces at itself) statistically,
+ * e.g. "meter 1 sock(4) pacing_pct >= 95, pacing_pct <= 105", and so
+ * need a sock(fd).
+ */
+struct meter_spec {
+	s64 window_usecs;	/* length of the window */
+	int socket_fd;		/* script fd of the socket to meter, or
+				 * SOCKET_FD_NOT_DEFINED for all of them
+				 */
+	int num_checks;
+	struct meter_check checks[MAX_METER_CHECKS];
+};
+
+/* A burst of MPTCP subflows joining the newest MPTCP connection, to see
+ * how the kernel's path manager copes with many joins, e.g.
+ * "mp_join_storm 64 sock(5) stagger 0.001". Each subflow gets a port of
+ * its own and does the whole MP_JOIN handshake, with the tokens, nonces
+ * and HMACs filled in for it. The SYNs go out stagger_usecs apart, or
+ * all at once if that is 0; the event ends once every subflow was
+ * joined or refused, and reports each one's handshake latency.
+ */
+#define MP_JOIN_STORM_MAX_SUBFLOWS	1024	/* most subflows in one storm */
+
+struct mp_join_storm_spec {
+	int num_subflows;	/* subflows to open */
+	int socket_fd;		/* script fd of the listening socket the
+				 * joins go to, or SOCKET_FD_NOT_DEFINED for
+				 * the port of the connection's first subflow
+				 */
+	s64 stagger_usecs;	/* time between SYNs */
+};
+
+/* Aggregates of a peer event to check at its end. */
+enum peer_metric_t {
+	PEER_ACKED,		/* bytes ACKed, over all its subflows */
+	PEER_DATA_ACKED,	/* MPTCP data-level bytes DATA_ACKed */
+	PEER_KBPS,		/* PEER_DATA_ACKED, or PEER_ACKED without
+				 * MPTCP, over the window, in kbit/s
+				 */
+	PEER_SEGMENTS,		/* data segments received */
+	PEER_RETRANSMITS,	/* of them, ones resending sequence space */
+	PEER_DROPS,		/* of them, ones the peer dropped */
+	PEER_ACKS,		/* ACKs the peer sent */
+	NUM_PEER_METRICS,
+};
+
+/* A bound on one aggregate of a peer event. */
+struct peer_check {
+	enum peer_metric_t metric;
+	bool at_least;		/* >= rather than <= */
+	double bound;
+};
+
+#define MAX_PEER_CHECKS	8	/* most checks on one peer event */
+
+/* A reactive remote endpoint for bulk transfers, e.g.
+ * "peer 5 sock(4) ack_every=2, ack_delay=0.040, loss=1, acked >= 4e6".
+ * For window_usecs from the event's time the interpreter stops running
+ * other events and instead answers the data the kernel sends on the
+ * socket, or on every socket without a sock(fd), with the ACKs a
+ * receiver would send: delayed ACKs every ack_every segments or after
+ * ack_delay, immediate ACKs for out-of-order data with up to
+ * sack_blocks SACK blocks, and, on MPTCP subflows, a DSS option with
+ * the connection's data-level ACK. It drops loss percent of the data
+ * segments at random, and every drop_every'th one, as if lost on the
+ * way. The next event should come window_usecs after this one.
+ */
+struct peer_spec {
+	s64 window_usecs;	/* how long to answer for */
+	int socket_fd;		/* script fd of the socket to answer, or
+				 * SOCKET_FD_NOT_DEFINED for all of them
+				 */
+	int ack_every;		/* ACK every this many segments */
+	s64 ack_delay_usecs;	/* or once the oldest is this old */
+	double loss_pct;	/* drop this percent of data segments */
+	int drop_every;		/* and every this many'th, if not 0 */
+	int sack_blocks;	/* most SACK blocks per ACK; 0 for none */
+	int num_checks;
+	struct peer_check checks[MAX_PEER_CHECKS];
+};
+
+/* Aggregates of a syn_flood event to check at its end. */
+enum syn_flood_metric_t {
+	SYN_FLOOD_SYNS,		/* SYNs sent */
+	SYN_FLOOD_SYNACKS,	/* of them, ones the kernel answered */
+	SYN_FLOOD_SYNACK_P50,	/* median SYN to SYN/ACK latency, usecs */
+	SYN_FLOOD_SYNACK_P99,	/* 99th percentile of that, usecs */
+	SYN_FLOOD_REFUSED,	/* SYNs the kernel answered with a RST */
+	SYN_FLOOD_COOKIES,	/* SYN cookies the kernel sent */
+	SYN_FLOOD_OVERFLOWS,	/* handshakes dropped on a full backlog */
+	SYN_FLOOD_ACCEPTS,	/* connections accept() returned */
+	SYN_FLOOD_ACCEPT_RATE,	/* of them, per second of the flood */
+	NUM_SYN_FLOOD_METRICS,
+};
+
+/* A bound on one aggregate of a syn_flood event. */
+struct syn_flood_check {
+	enum syn_flood_metric_t metric;
+	bool at_least;		/* >= rather than <= */
+	double bound;
+};
+
+#define MAX_SYN_FLOOD_CHECKS	8	/* most checks on one syn_flood */
+
+/* A flood of SYNs at a listening socket, to see how the listen path
+ * copes, e.g.
+ * "syn_flood 2 sock(3) rate=20000, complete=10, mptcp=1, cookies <= 0".
+ * For duration_usecs from the event's time, SYNs, with MP_CAPABLE if
+ * mptcp is set, go out at rate per second, each from a remote address
+ * and port of its own in the remote prefix. The handshakes of
+ * complete_pct percent of them are completed, and the connections
+ * they make are accepted and closed as they come. At the end every
+ * flow is reset, and the event reports the SYN/ACK latency, the SYN
+ * cookies the kernel fell back on, and the accept() throughput. The
+ * next event should come duration_usecs after this one.
+ */
+struct syn_flood_spec {
+	s64 duration_usecs;	/* how long to send SYNs for */
+	int socket_fd;		/* script fd of the listening socket, or
+				 * SOCKET_FD_NOT_DEFINED for the first one
+				 */
+	double rate;		/* SYNs per second */
+	double complete_pct;	/* percent of handshakes to complete */
+	bool mptcp;		/* offer MP_CAPABLE? */
+	int num_checks;
+	struct syn_flood_check checks[MAX_SYN_FLOOD_CHECKS];
+};
+
+/* A block of events to run a number of times in a row. The block is
+ * run again in place rather than copied, so a long run costs no more
+ * memory than one time around. Each time around, the sequence and ACK
+ * numbers of its TCP packets advance by the sequence space the block
+ * uses in each direction, and their TCP timestamps by the block's
+ * duration.
+ */
+struct repeat_spec {
+	s64 count;			/* number of times to run the events */
+	struct event *events;		/* linked list of events to repeat */
+	struct packet **packets;	/* unmodified copy of each packet */
+	int num_packets;		/* number of packet events */
+	u32 inbound_seq_bytes;		/* inbound sequence space per run */
+	u32 outbound_seq_bytes;		/* outbound sequence space per run */
+	s64 duration_usecs;		/* script time per run */
+	s64 iteration;			/* runs done so far, while running */
+};
+
+/* A block of outbound packets on different sockets, say the subflows of
+ * an MPTCP connection, that the kernel may interleave any way it likes:
+ * "+0 interleave { <packets> }". The packets of each socket form a
+ * stream, matched in script order as they are sniffed; the streams are
+ * matched independently of one another. A packet's relative time counts
+ * from the packet before it in its stream, or from the block's start.
+ */
+struct interleave_spec {
+	struct event *events;		/* linked list of outbound packets */
+	int num_packets;		/* number of packets in the block */
+};
+
 /* Types of events in a script */
 enum event_t {
 	INVALID_EVENT = 0,
@@ -151,6 +376,12 @@ enum event_t {
 	SYSCALL_EVENT,
 	COMMAND_EVENT,
 	CODE_EVENT,
+	REPEAT_EVENT,
+	METER_EVENT,
+	MP_JOIN_STORM_EVENT,
+	PEER_EVENT,
+	SYN_FLOOD_EVENT,
+	INTERLEAVE_EVENT,
 	NUM_EVENT_TYPES,
 };
 
@@ -171,6 +402,7 @@ struct event {
 	s64 time_usecs_end;	/* event time range end (or NO_TIME_RANGE) */
 	s64 offset_usecs;	/* relative event time offset from script start
 				 * (or NO_TIME_RANGE) */
+	s64 wakeup_error_usecs;	/* how late wait_for_event() returned */
 	enum event_time_t time_type; /* type of time */
 	enum event_t type;	/* type of the event */
 	union {
@@ -178,6 +410,12 @@ struct event {
 		struct syscall_spec	*syscall;
 		struct command_spec	*command;
 		struct code_spec	*code;
+		struct repeat_spec	*repeat;
+		struct meter_spec	*meter;
+		struct mp_join_storm_spec	*mp_join_storm;
+		struct peer_spec	*peer;
+		struct syn_flood_spec	*syn_flood;
+		struct interleave_spec	*interleave;
 	} event;		/* pointer to the event */
 	struct event *next;	/* next in linked list of events */
 };
@@ -196,9 +434,8 @@ struct option_list {
 	struct option_list *next;
 };
 
-/* A parsed script. The script owns all of the data to which
- * it points. TODO: add a script_free() to free everything when we are
- * done executing the script, instead of leaking all that memory.
+/* A parsed script. The script owns all of the data to which it
+ * points, most of it in one arena, and free_script() frees it all.
  */
 struct script {
 	struct option_list *option_list;    /* linked list of options */
@@ -206,6 +443,11 @@ struct script {
 	struct event	*event_list;	    /* linked list of all events */
 	char		*buffer;	    /* raw input text of the script */
 	int		length;		    /* number of bytes in the script */
+	int		num_events;	    /* number of events parsed so far */
+	bool		streaming;	    /* --stream_window: parse as we run? */
+	bool		parsing;	    /* more events left to parse? */
+	struct arena	*arena;		    /* storage for what we parsed */
+	bool		arena_events;	    /* are events in the arena too? */
 };
 
 /* A table entry mapping a bit mask to its human-readable name.
@@ -220,6 +462,16 @@ struct flag_name {
 /* Initialize a script object */
 extern void init_script(struct script *script);
 
+/* Free the given event and everything it owns. This is only for
+ * events allocated on the heap, i.e. when !script->arena_events.
+ */
+extern void free_event(struct event *event);
+
+/* Free the given script and everything it owns, once we are done
+ * running it.
+ */
+extern void free_script(struct script *script);
+
 /* Look up the value of the given symbol, and fill it in. On success,
  * return STATUS_OK; if the symbol cannot be found, return
  * STATUS_ERR and fill in an error message in *error.
@@ -244,12 +496,21 @@ extern void free_expression(struct expression *expression);
  */
 extern void free_expression_list(struct expression_list *list);
 
-/* Return a copy of the given expression list with each expression
- * evaluated (e.g. symbols resolved to ints). On success, returns
+/* Return a version of the given expression list with each expression
+ * evaluated (e.g. symbols resolved to ints). Only the parts that
+ * evaluation changes are copied; the rest, often the whole list, is
+ * shared with in_list, so treat the result as read-only and free it
+ * with free_evaluated_expression_list(). On success, returns
  * STATUS_OK. On error return STATUS_ERR and fill in *error.
  */
 extern int evaluate_expression_list(struct expression_list *in_list,
 				    struct expression_list **out_list,
 				    char **error);
 
+/* Free what evaluate_expression_list() allocated for out_list when it
+ * evaluated in_list.
+ */
+extern void free_evaluated_expression_list(struct expression_list *out_list,
+					   struct expression_list *in_list);
+
 #endif /* __SCRIPT_H__ */
@@ -0,0 +1,757 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * End-to-end throughput benchmark of whole packetdrill runs against
+ * the local tun device. It writes a synthetic script for a workload,
+ * runs packetdrill on it, and reports:
+ *
+ *  - the event rate achieved with every block of the script at +0,
+ *  - the highest packet rate at which runs still have no timing
+ *    violations, found by bisecting the interval between packets,
+ *  - CPU time per event and peak RSS of the packetdrill process.
+ *
+ * Fixed costs (tun setup, the handshake, teardown) are measured with
+ * a one-block run and taken out of the rates and per-event CPU times.
+ * With --workers=N the script runs N times at once (packetdrill
+ * --jobs=N, one network namespace each), to see how many parallel
+ * workers a host can hold.
+ *
+ * With --calibrate=<file> it instead measures how far from their
+ * script times this host's events land: it runs a paced script with
+ * inbound and outbound packets and plain and blocking system calls,
+ * with a tolerance too loose to fail, and writes to the file a
+ * tolerance for each kind of event, --margin times the worst 99.9th
+ * percentile error of the runs. packetdrill --tolerance_file=<file>
+ * then holds each kind of event to its own tolerance.
+ *
+ * Like packetdrill itself, this needs root.
+ *
+ * Usage: script_bench [--packetdrill=<path>] [--workload=inbound|dss]
+ *                     [--packets=<count>] [--workers=<count>]
+ *                     [--tolerance_usecs=<usecs>] [--trials=<count>]
+ *                     [--steps=<count>] [--keep]
+ *                     [--calibrate=<file>] [--margin=<factor>]
+ *                     [--interval_usecs=<usecs>] [-- <packetdrill args>]
+ */
+
+#include "types.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A synthetic script: a handshake, then a block of events repeated
+ * to carry the given number of inbound packets.
+ */
+struct workload {
+	const char *name;
+	const char *handshake;		/* events up to accept() */
+	const char *block;		/* printf format for the block */
+	int packets_per_block;		/* inbound data segments per block */
+	int events_per_block;		/* events of any kind per block */
+};
+
+/* Plain TCP: pairs of segments, as in repeat-receive-bulk.pkt. */
+static const struct workload inbound_workload = {
+	.name = "inbound",
+	.handshake =
+	"0.000 socket(..., SOCK_STREAM, IPPROTO_TCP) = 3\n"
+	"0.000 setsockopt(3, SOL_SOCKET, SO_REUSEADDR, [1], 4) = 0\n"
+	"0.000 bind(3, ..., ...) = 0\n"
+	"0.000 listen(3, 1) = 0\n"
+	"0.100 < S 0:0(0) win 32792 <mss 1000,nop,wscale 7>\n"
+	"0.100 > S. 0:0(0) ack 1 <mss 1460,nop,wscale 6>\n"
+	"0.200 < . 1:1(0) ack 1 win 257\n"
+	"0.200 accept(3, ..., ...) = 4\n",
+	.block =
+	"+%.6f < P. 1:1001(1000) ack 1 win 257\n"
+	"+0 < P. 1001:2001(1000) ack 1 win 257\n"
+	"+0 > . 1:1(0) ack 2001\n"
+	"+0 read(4, ..., 2000) = 2000\n",
+	.packets_per_block = 2,
+	.events_per_block = 4,
+};
+
+/* MPTCP: a long DSS transfer with kernel-tracked DSNs and data ACKs. */
+static const struct workload dss_workload = {
+	.name = "dss",
+	.handshake =
+	"0 socket(..., SOCK_STREAM, IPPROTO_TCP) = 3\n"
+	"+0 setsockopt(3, SOL_SOCKET, SO_REUSEADDR, [1], 4) = 0\n"
+	"+0 bind(3, ..., ...) = 0\n"
+	"+0 listen(3, 1) = 0\n"
+	"+0 < S 0:0(0) win 32792 <mss 1460,sackOK,nop,nop,nop,wscale 7,"
+	"mp_capable a>\n"
+	"+0 > S. 0:0(0) ack 1 win 28800 <mss 1460,sackOK,nop,nop,nop,"
+	"wscale 7,mp_capable b>\n"
+	"+0.1 < . 1:1(0) ack 1 win 257 <mp_capable a b,"
+	"dss dack4=trunc_r64_hmac(b)+1>\n"
+	"+0 accept(3, ..., ...) = 4\n",
+	.block =
+	"+%.6f < P. 1:1001(1000) ack 1 win 450 <dss dack4 dsn4>\n"
+	"+0 > . 1:1(0) ack 1001 <dss dack4>\n"
+	"+0 read(4, ..., 1000) = 1000\n",
+	.packets_per_block = 1,
+	.events_per_block = 3,
+};
+
+/* For --calibrate: every kind of timed event, paced. Each block has
+ * a read() that blocks until the second pair of segments arrives.
+ */
+static const struct workload calibrate_workload = {
+	.name = "calibrate",
+	.handshake =
+	"0.000 socket(..., SOCK_STREAM, IPPROTO_TCP) = 3\n"
+	"0.000 setsockopt(3, SOL_SOCKET, SO_REUSEADDR, [1], 4) = 0\n"
+	"0.000 bind(3, ..., ...) = 0\n"
+	"0.000 listen(3, 1) = 0\n"
+	"0.100 < S 0:0(0) win 32792 <mss 1000,nop,wscale 7>\n"
+	"0.100 > S. 0:0(0) ack 1 <mss 1460,nop,wscale 6>\n"
+	"0.200 < . 1:1(0) ack 1 win 257\n"
+	"0.200 accept(3, ..., ...) = 4\n",
+	.block =
+	"+%.6f < P. 1:1001(1000) ack 1 win 257\n"
+	"+0 < P. 1001:2001(1000) ack 1 win 257\n"
+	"+0 > . 1:1(0) ack 2001\n"
+	"+0 read(4, ..., 2000) = 2000\n"
+	"+0...0.001 read(4, ..., 2000) = 2000\n"
+	"+.001 < P. 2001:3001(1000) ack 1 win 257\n"
+	"+0 < P. 3001:4001(1000) ack 1 win 257\n"
+	"+0 > . 1:1(0) ack 4001\n",
+	.packets_per_block = 4,
+	.events_per_block = 8,
+};
+
+static const struct workload *workloads[] = {
+	&inbound_workload,
+	&dss_workload,
+	&calibrate_workload,
+	NULL,
+};
+
+/* Kinds of timed events, as named in the --timing_report, in the
+ * order packetdrill's --tolerances takes them.
+ */
+static const char *timing_kinds[] = {
+	"inbound_packet",
+	"outbound_packet",
+	"syscall_start",
+	"syscall_end",
+	"other",
+};
+#define NUM_TIMING_KINDS	(sizeof(timing_kinds) / sizeof(timing_kinds[0]))
+
+/* The errors of one kind of event over the --calibrate runs. */
+struct kind_errors {
+	u64 count;			/* events seen */
+	s64 p50_usecs;			/* worst of each run's percentiles */
+	s64 p99_usecs;
+	s64 p999_usecs;
+	s64 max_usecs;			/* worst error magnitude seen */
+};
+
+/* What we measured for one packetdrill run. */
+struct run_result {
+	bool passed;			/* did packetdrill exit 0? */
+	u64 over_tolerance;		/* events late or early, per report */
+	double wall_secs;		/* wall clock time of the run */
+	double cpu_secs;		/* user + system CPU time */
+	long max_rss_kbytes;		/* peak RSS of the process */
+};
+
+struct bench {
+	const char *packetdrill;	/* path of the binary to run */
+	const struct workload *workload;
+	int packets;			/* inbound packets per run */
+	int workers;			/* copies of the script run at once */
+	int tolerance_usecs;
+	int trials;			/* clean runs needed to pass a rate */
+	int steps;			/* bisection steps */
+	bool keep;			/* keep the scratch directory */
+	const char *calibrate;		/* if set, write tolerances here */
+	double margin;			/* tolerance over worst p99.9 error */
+	int interval_usecs;		/* between --calibrate blocks */
+	char **extra_args;		/* more args for packetdrill */
+	int num_extra_args;
+	char dir[64];			/* scratch directory */
+	char script_path[128];
+	char report_path[128];
+	char log_path[128];
+};
+
+static s64 now_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double timeval_secs(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* Write the workload's script with the given number of blocks, each
+ * starting interval_usecs after the one before.
+ */
+static void write_script(const struct bench *bench, int blocks,
+			 s64 interval_usecs)
+{
+	FILE *f = fopen(bench->script_path, "w");
+
+	if (f == NULL) {
+		perror(bench->script_path);
+		exit(EXIT_FAILURE);
+	}
+	fprintf(f, "// %s workload written by script_bench\n",
+		bench->workload->name);
+	fputs(bench->workload->handshake, f);
+	fprintf(f, "\nrepeat %d {\n", blocks);
+	fprintf(f, bench->workload->block, interval_usecs / 1e6);
+	fprintf(f, "}\n");
+	fclose(f);
+}
+
+/* Add up the "over_tolerance" counts in the --timing_report file. */
+static u64 report_over_tolerance(const char *path)
+{
+	const char *key = "\"over_tolerance\": ";
+	char line[64 * 1024];
+	u64 total = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		const char *p = line;
+
+		while ((p = strstr(p, key)) != NULL) {
+			p += strlen(key);
+			total += strtoull(p, NULL, 10);
+		}
+	}
+	fclose(f);
+	return total;
+}
+
+/* Return the integer member with the given key of the JSON object
+ * running from start up to end, or 0 if there is none.
+ */
+static s64 json_member(const char *start, const char *end, const char *key)
+{
+	char quoted[64];
+	const char *p;
+
+	snprintf(quoted, sizeof(quoted), "\"%s\": ", key);
+	p = strstr(start, quoted);
+	if (p == NULL || p >= end)
+		return 0;
+	return strtoll(p + strlen(quoted), NULL, 10);
+}
+
+static s64 max_magnitude(s64 a, s64 b)
+{
+	return llabs(a) > llabs(b) ? llabs(a) : llabs(b);
+}
+
+/* Fold the errors of each kind of event in the --timing_report file
+ * into errors[], keeping the worst of the runs.
+ */
+static void report_errors(const char *path, struct kind_errors *errors)
+{
+	char line[64 * 1024], object[64];
+	size_t i;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+		return;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		for (i = 0; i < NUM_TIMING_KINDS; i++) {
+			struct kind_errors *e = &errors[i];
+			const char *start, *end;
+
+			snprintf(object, sizeof(object), "\"%s\": {",
+				 timing_kinds[i]);
+			start = strstr(line, object);
+			if (start == NULL)
+				continue;
+			end = strstr(start, "\"buckets\"");
+			if (end == NULL)
+				end = start + strlen(start);
+			if (json_member(start, end, "count") == 0)
+				continue;
+			e->count += json_member(start, end, "count");
+			e->p50_usecs = max_magnitude(
+				e->p50_usecs, json_member(start, end, "p50_usecs"));
+			e->p99_usecs = max_magnitude(
+				e->p99_usecs, json_member(start, end, "p99_usecs"));
+			e->p999_usecs = max_magnitude(
+				e->p999_usecs,
+				json_member(start, end, "p999_usecs"));
+			e->max_usecs = max_magnitude(
+				e->max_usecs, json_member(start, end, "max_usecs"));
+			e->max_usecs = max_magnitude(
+				e->max_usecs, json_member(start, end, "min_usecs"));
+		}
+	}
+	fclose(f);
+}
+
+/* Run packetdrill once on the current script and fill in *result. */
+static void run_packetdrill(const struct bench *bench,
+			    struct run_result *result)
+{
+	char tolerance[64], report[160], jobs[32];
+	struct rusage usage;
+	int argc = 0, status, fd, i;
+	char **argv;
+	s64 start;
+	pid_t pid;
+
+	argv = calloc(bench->num_extra_args + bench->workers + 8,
+		      sizeof(char *));
+	snprintf(tolerance, sizeof(tolerance), "--tolerance_usecs=%d",
+		 bench->tolerance_usecs);
+	snprintf(report, sizeof(report), "--timing_report=%s",
+		 bench->report_path);
+	snprintf(jobs, sizeof(jobs), "--jobs=%d", bench->workers);
+	argv[argc++] = (char *)bench->packetdrill;
+	argv[argc++] = tolerance;
+	argv[argc++] = report;
+	if (bench->workers > 1)
+		argv[argc++] = jobs;
+	for (i = 0; i < bench->num_extra_args; i++)
+		argv[argc++] = bench->extra_args[i];
+	for (i = 0; i < bench->workers; i++)
+		argv[argc++] = (char *)bench->script_path;
+	argv[argc] = NULL;
+
+	unlink(bench->report_path);
+	start = now_nsecs();
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		fd = open(bench->log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		execv(bench->packetdrill, argv);
+		perror(bench->packetdrill);
+		_exit(127);
+	}
+	while (wait4(pid, &status, 0, &usage) < 0) {
+		if (errno != EINTR) {
+			perror("wait4");
+			exit(EXIT_FAILURE);
+		}
+	}
+	result->wall_secs = (now_nsecs() - start) / 1e9;
+	free(argv);
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+		fprintf(stderr, "cannot run %s\n", bench->packetdrill);
+		exit(EXIT_FAILURE);
+	}
+	result->passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	result->over_tolerance = report_over_tolerance(bench->report_path);
+	result->cpu_secs = timeval_secs(&usage.ru_utime) +
+			   timeval_secs(&usage.ru_stime);
+	result->max_rss_kbytes = usage.ru_maxrss;
+}
+
+/* Run the workload with the given interval between blocks. Return
+ * true if all trials passed; a failure that was not a timing
+ * violation ends the benchmark, since no rate would fix it.
+ */
+static bool try_interval(const struct bench *bench, s64 interval_usecs,
+			 struct run_result *result)
+{
+	int blocks = bench->packets / bench->workload->packets_per_block;
+	int trial;
+
+	write_script(bench, blocks, interval_usecs);
+	for (trial = 0; trial < bench->trials; trial++) {
+		run_packetdrill(bench, result);
+		if (result->passed)
+			continue;
+		if (result->over_tolerance == 0) {
+			fprintf(stderr, "packetdrill failed on %s without a "
+				"timing violation; see %s\n",
+				bench->script_path, bench->log_path);
+			exit(EXIT_FAILURE);
+		}
+		return false;
+	}
+	return true;
+}
+
+/* Packets per second when blocks are interval_usecs apart. */
+static double interval_pps(const struct bench *bench, s64 interval_usecs)
+{
+	return bench->workload->packets_per_block * 1e6 / interval_usecs;
+}
+
+static void remove_scratch(const struct bench *bench)
+{
+	unlink(bench->script_path);
+	unlink(bench->report_path);
+	unlink(bench->log_path);
+	rmdir(bench->dir);
+}
+
+/* The tolerance of --calibrate runs: loose enough that no run fails. */
+#define CALIBRATE_TOLERANCE_USECS	1000000
+
+/* The least tolerance --calibrate proposes, so that a kind of event
+ * that was always on time still gets some slack.
+ */
+#define MIN_TOLERANCE_USECS		10
+
+/* Run the calibration script, and write the tolerances it suggests to
+ * the --calibrate file, with the errors they came from as comments.
+ */
+static int calibrate(const struct bench *bench)
+{
+	struct kind_errors errors[NUM_TIMING_KINDS];
+	int blocks = bench->packets / bench->workload->packets_per_block;
+	struct run_result result;
+	const char *sep = "";
+	int trial, tolerance;
+	size_t i;
+	FILE *f;
+
+	memset(errors, 0, sizeof(errors));
+	write_script(bench, blocks, bench->interval_usecs);
+	for (trial = 0; trial < bench->trials; trial++) {
+		run_packetdrill(bench, &result);
+		if (!result.passed) {
+			fprintf(stderr, "packetdrill failed on %s; see %s\n",
+				bench->script_path, bench->log_path);
+			return EXIT_FAILURE;
+		}
+		report_errors(bench->report_path, errors);
+	}
+	for (i = 0; i < NUM_TIMING_KINDS && errors[i].count == 0; i++)
+		;
+	if (i == NUM_TIMING_KINDS) {
+		fprintf(stderr, "no timed events in %s\n", bench->report_path);
+		return EXIT_FAILURE;
+	}
+
+	f = fopen(bench->calibrate, "w");
+	if (f == NULL) {
+		perror(bench->calibrate);
+		return EXIT_FAILURE;
+	}
+	fprintf(f, "# script_bench --calibrate: %d runs of %d packets "
+		"%d usecs apart, %d worker%s, margin %.2f\n",
+		bench->trials, blocks * bench->workload->packets_per_block,
+		bench->interval_usecs, bench->workers,
+		bench->workers == 1 ? "" : "s", bench->margin);
+	for (i = 0; i < NUM_TIMING_KINDS; i++) {
+		const struct kind_errors *e = &errors[i];
+
+		if (e->count == 0)
+			continue;
+		fprintf(f, "# %s: %llu events, worst p50 %lld, p99 %lld, "
+			"p99.9 %lld, max %lld usecs\n", timing_kinds[i],
+			e->count, e->p50_usecs, e->p99_usecs, e->p999_usecs,
+			e->max_usecs);
+	}
+	printf("proposed tolerances: ");
+	for (i = 0; i < NUM_TIMING_KINDS; i++) {
+		const struct kind_errors *e = &errors[i];
+
+		if (e->count == 0)
+			continue;
+		tolerance = (int)(bench->margin * e->p999_usecs);
+		if (tolerance < bench->margin * e->p999_usecs)
+			tolerance++;
+		if (tolerance < MIN_TOLERANCE_USECS)
+			tolerance = MIN_TOLERANCE_USECS;
+		fprintf(f, "%s%s=%d", sep, timing_kinds[i], tolerance);
+		printf("%s%s=%d", sep, timing_kinds[i], tolerance);
+		sep = ",";
+	}
+	fprintf(f, "\n");
+	printf("\n");
+	if (fclose(f) != 0) {
+		perror(bench->calibrate);
+		return EXIT_FAILURE;
+	}
+	printf("written to %s; use packetdrill --tolerance_file=%s\n",
+	       bench->calibrate, bench->calibrate);
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: script_bench [--packetdrill=<path>] "
+		"[--workload=inbound|dss]\n"
+		"\t[--packets=<count>] [--workers=<count>] "
+		"[--tolerance_usecs=<usecs>]\n"
+		"\t[--trials=<count>] [--steps=<count>] [--keep]\n"
+		"\t[--calibrate=<file>] [--margin=<factor>] "
+		"[--interval_usecs=<usecs>]\n"
+		"\t[-- <packetdrill args>]\n");
+	exit(EXIT_FAILURE);
+}
+
+enum option_codes {
+	OPT_PACKETDRILL = 1,
+	OPT_WORKLOAD,
+	OPT_PACKETS,
+	OPT_WORKERS,
+	OPT_TOLERANCE_USECS,
+	OPT_TRIALS,
+	OPT_STEPS,
+	OPT_KEEP,
+	OPT_CALIBRATE,
+	OPT_MARGIN,
+	OPT_INTERVAL_USECS,
+};
+
+static const struct option options[] = {
+	{ "packetdrill",	.has_arg = true,  NULL, OPT_PACKETDRILL },
+	{ "workload",		.has_arg = true,  NULL, OPT_WORKLOAD },
+	{ "packets",		.has_arg = true,  NULL, OPT_PACKETS },
+	{ "workers",		.has_arg = true,  NULL, OPT_WORKERS },
+	{ "tolerance_usecs",	.has_arg = true,  NULL, OPT_TOLERANCE_USECS },
+	{ "trials",		.has_arg = true,  NULL, OPT_TRIALS },
+	{ "steps",		.has_arg = true,  NULL, OPT_STEPS },
+	{ "keep",		.has_arg = false, NULL, OPT_KEEP },
+	{ "calibrate",		.has_arg = true,  NULL, OPT_CALIBRATE },
+	{ "margin",		.has_arg = true,  NULL, OPT_MARGIN },
+	{ "interval_usecs",	.has_arg = true,  NULL, OPT_INTERVAL_USECS },
+	{ NULL },
+};
+
+static void parse_args(struct bench *bench, int argc, char *argv[])
+{
+	int c, i;
+
+	while ((c = getopt_long(argc, argv, "", options, NULL)) > 0) {
+		switch (c) {
+		case OPT_PACKETDRILL:
+			bench->packetdrill = optarg;
+			break;
+		case OPT_WORKLOAD:
+			bench->workload = NULL;
+			for (i = 0; workloads[i] != NULL; i++)
+				if (strcmp(workloads[i]->name, optarg) == 0)
+					bench->workload = workloads[i];
+			if (bench->workload == NULL)
+				usage();
+			break;
+		case OPT_PACKETS:
+			bench->packets = atoi(optarg);
+			break;
+		case OPT_WORKERS:
+			bench->workers = atoi(optarg);
+			break;
+		case OPT_TOLERANCE_USECS:
+			bench->tolerance_usecs = atoi(optarg);
+			break;
+		case OPT_TRIALS:
+			bench->trials = atoi(optarg);
+			break;
+		case OPT_STEPS:
+			bench->steps = atoi(optarg);
+			break;
+		case OPT_KEEP:
+			bench->keep = true;
+			break;
+		case OPT_CALIBRATE:
+			bench->calibrate = optarg;
+			break;
+		case OPT_MARGIN:
+			bench->margin = atof(optarg);
+			break;
+		case OPT_INTERVAL_USECS:
+			bench->interval_usecs = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	bench->extra_args = argv + optind;
+	bench->num_extra_args = argc - optind;
+
+	if (bench->calibrate != NULL) {
+		bench->workload = &calibrate_workload;
+		bench->tolerance_usecs = CALIBRATE_TOLERANCE_USECS;
+	}
+	if (bench->margin < 1 || bench->interval_usecs < 0)
+		usage();
+
+	if (bench->packets < 2 * bench->workload->packets_per_block ||
+	    bench->workers <= 0 || bench->tolerance_usecs <= 0 ||
+	    bench->trials <= 0 || bench->steps < 0)
+		usage();
+}
+
+static void print_run(const char *what, const struct bench *bench,
+		      const struct run_result *run,
+		      const struct run_result *base)
+{
+	const struct workload *workload = bench->workload;
+	int blocks = bench->packets / workload->packets_per_block;
+	double events = (double)(blocks - 1) * workload->events_per_block *
+			bench->workers;
+	double packets = (double)(blocks - 1) * workload->packets_per_block *
+			 bench->workers;
+	double wall = run->wall_secs - base->wall_secs;
+	double cpu = run->cpu_secs - base->cpu_secs;
+
+	/* Runs too short to tell apart from the fixed cost. */
+	if (wall <= 0)
+		wall = run->wall_secs;
+	printf("%-22s %10.0f events/s %10.0f packets/s %8.2f us CPU/event "
+	       "%8ld KB max RSS%s\n", what, events / wall, packets / wall,
+	       events > 0 ? cpu * 1e6 / events : 0.0, run->max_rss_kbytes,
+	       run->passed ? "" : " (timing violations)");
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench bench = {
+		.packetdrill = "./packetdrill",
+		.workload = &inbound_workload,
+		.packets = 2000,
+		.workers = 1,
+		.tolerance_usecs = 4000,
+		.trials = 3,
+		.steps = 8,
+		.margin = 2.0,
+		.interval_usecs = 1000,
+	};
+	struct run_result base, full, best, result;
+	s64 pass_usecs = 0, fail_usecs = 0, mid;
+	int blocks, step;
+
+	parse_args(&bench, argc, argv);
+	strcpy(bench.dir, "/tmp/script_bench.XXXXXX");
+	if (mkdtemp(bench.dir) == NULL) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+	snprintf(bench.script_path, sizeof(bench.script_path),
+		 "%s/%s.pkt", bench.dir, bench.workload->name);
+	snprintf(bench.report_path, sizeof(bench.report_path),
+		 "%s/timing.json", bench.dir);
+	snprintf(bench.log_path, sizeof(bench.log_path),
+		 "%s/packetdrill.log", bench.dir);
+
+	if (bench.calibrate != NULL) {
+		int status = calibrate(&bench);
+
+		if (status != 0)
+			return status;
+		if (bench.keep)
+			printf("scripts and logs kept in %s\n", bench.dir);
+		else
+			remove_scratch(&bench);
+		return status;
+	}
+
+	blocks = bench.packets / bench.workload->packets_per_block;
+	printf("workload %s: %d packets, %d events, %d worker%s, "
+	       "tolerance %d usecs\n", bench.workload->name,
+	       blocks * bench.workload->packets_per_block,
+	       blocks * bench.workload->events_per_block, bench.workers,
+	       bench.workers == 1 ? "" : "s", bench.tolerance_usecs);
+
+	/* The fixed cost of a run, with a single block. */
+	write_script(&bench, 1, 0);
+	run_packetdrill(&bench, &base);
+	if (!base.passed) {
+		fprintf(stderr, "packetdrill failed on a one-block %s; "
+			"see %s\n", bench.script_path, bench.log_path);
+		return EXIT_FAILURE;
+	}
+
+	/* Everything at +0: as fast as packetdrill and the kernel go. */
+	try_interval(&bench, 0, &full);
+	print_run("full speed:", &bench, &full, &base);
+	if (full.passed) {
+		printf("max sustainable rate:  no timing violations at "
+		       "full speed\n");
+		goto out;
+	}
+
+	/* Find a rate that passes, starting from what full speed did. */
+	pass_usecs = (full.wall_secs - base.wall_secs) * 1e6 / (blocks - 1);
+	if (pass_usecs < 1)
+		pass_usecs = 1;
+	while (!try_interval(&bench, pass_usecs, &best)) {
+		fail_usecs = pass_usecs;
+		pass_usecs *= 2;
+		if (pass_usecs > 1000000) {
+			printf("max sustainable rate:  timing violations at "
+			       "%.0f packets/s and above\n",
+			       interval_pps(&bench, fail_usecs));
+			goto out;
+		}
+	}
+
+	/* Bisect between the failing and the passing interval. */
+	for (step = 0; step < bench.steps && pass_usecs - fail_usecs > 1;
+	     step++) {
+		mid = (pass_usecs + fail_usecs) / 2;
+		if (try_interval(&bench, mid, &result)) {
+			pass_usecs = mid;
+			best = result;
+		} else {
+			fail_usecs = mid;
+		}
+	}
+	print_run("at max sustainable:", &bench, &best, &base);
+	if (fail_usecs > 0)
+		printf("max sustainable rate:  %.0f packets/s per worker "
+		       "(%lld usecs between blocks; violations at %.0f)\n",
+		       interval_pps(&bench, pass_usecs), pass_usecs,
+		       interval_pps(&bench, fail_usecs));
+	else
+		printf("max sustainable rate:  %.0f packets/s per worker "
+		       "(%lld usecs between blocks; violations at +0)\n",
+		       interval_pps(&bench, pass_usecs), pass_usecs);
+
+out:
+	if (bench.keep)
+		printf("scripts and logs kept in %s\n", bench.dir);
+	else
+		remove_scratch(&bench);
+	return 0;
+}
@@ -0,0 +1,1220 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of a cache of parsed scripts; see script_cache.h.
+ *
+ * A cache file is a header followed by the parse: the options, the
+ * init command, the events, and then the MPTCP state. Numbers are in
+ * host byte order, since a cache is only meant to be used by the
+ * machine that wrote it. Strings are a u32 length (CACHE_NULL for a
+ * NULL string) and then the bytes, without a NUL.
+ */
+
+#include "script_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "arena.h"
+#include "logging.h"
+#include "mptcp.h"
+
+/* Bump this whenever the format, or what the parser produces, changes. */
+#define SCRIPT_CACHE_VERSION	4
+
+/* Stands for a NULL pointer or string, or a missing offset. */
+#define CACHE_NULL		0xffffffffU
+
+/* Kinds of MPTCP things the parser queues in mp_state.vars_queue. */
+#define CACHE_MP_VAR_SLOT	1	/* a variable slot */
+#define CACHE_MP_JOIN_INFO	2	/* a struct mp_join_info */
+#define CACHE_MP_VALUE_EXPR	3	/* a struct mp_value_expr */
+
+struct script_cache_header {
+	char magic[4];			/* "PDSC" */
+	u32 version;			/* SCRIPT_CACHE_VERSION */
+	u32 packet_bytes;		/* sizeof(struct packet) of writer */
+	u32 mp_join_info_bytes;		/* sizeof(struct mp_join_info) */
+	u64 body_bytes;			/* bytes following this header */
+	u8 key[SHA1_DIGEST_BYTES];	/* key the file was written for */
+};
+
+static const char script_cache_magic[4] = { 'P', 'D', 'S', 'C' };
+
+struct cache_reader {
+	const u8 *next;			/* next byte to decode */
+	const u8 *end;			/* end of the mapped file */
+	struct arena *arena;		/* where decoded data goes */
+	bool bad;			/* ran off the end or found junk? */
+};
+
+char *script_cache_dir(int argc, char *argv[])
+{
+	const char *option = "--script_cache";
+	const int option_len = strlen(option);
+	const char *value = NULL;
+	int i;
+
+	/* Accept --script_cache=<dir> and --script_cache <dir>; later
+	 * options win, as with getopt_long().
+	 */
+	for (i = 1; i < argc && argv[i] != NULL; ++i) {
+		if (strncmp(argv[i], option, option_len) != 0)
+			continue;
+		if (argv[i][option_len] == '=')
+			value = argv[i] + option_len + 1;
+		else if (argv[i][option_len] == '\0' && i + 1 < argc)
+			value = argv[++i];
+	}
+	return value != NULL ? strdup(value) : NULL;
+}
+
+void script_cache_key(const struct script *script, int argc, char *argv[],
+		      u8 key[SHA1_DIGEST_BYTES])
+{
+	struct sha1_ctx ctx;
+	u32 version = SCRIPT_CACHE_VERSION;
+	int i;
+
+	sha1_init(&ctx, NULL);
+	sha1_update(&ctx, &version, sizeof(version));
+	sha1_update(&ctx, &script->length, sizeof(script->length));
+	sha1_update(&ctx, script->buffer, script->length);
+	for (i = 0; i < argc && argv[i] != NULL; ++i)
+		sha1_update(&ctx, argv[i], strlen(argv[i]) + 1);
+	sha1_final(&ctx, key);
+}
+
+/* Return the malloc-ed path of the cache file for the given key. */
+static char *cache_path(const char *dir, const u8 key[SHA1_DIGEST_BYTES])
+{
+	char hex[2 * SHA1_DIGEST_BYTES + 1];
+	char *path = NULL;
+	int i;
+
+	for (i = 0; i < SHA1_DIGEST_BYTES; ++i)
+		sprintf(hex + 2 * i, "%02x", key[i]);
+	asprintf(&path, "%s/%s.pdc", dir, hex);
+	return path;
+}
+
+/* Encoding. */
+
+static void put_bytes(FILE *f, const void *data, size_t len)
+{
+	fwrite(data, 1, len, f);
+}
+
+static void put_u32(FILE *f, u32 value)
+{
+	put_bytes(f, &value, sizeof(value));
+}
+
+static void put_s64(FILE *f, s64 value)
+{
+	put_bytes(f, &value, sizeof(value));
+}
+
+static void put_string(FILE *f, const char *s)
+{
+	if (s == NULL) {
+		put_u32(f, CACHE_NULL);
+		return;
+	}
+	put_u32(f, strlen(s));
+	put_bytes(f, s, strlen(s));
+}
+
+static void put_expression(FILE *f, const struct expression *expression);
+
+static void put_expression_list(FILE *f, const struct expression_list *list)
+{
+	const struct expression_list *l = NULL;
+	u32 count = 0;
+
+	for (l = list; l != NULL; l = l->next)
+		++count;
+	put_u32(f, count);
+	for (l = list; l != NULL; l = l->next)
+		put_expression(f, l->expression);
+}
+
+static void put_expression(FILE *f, const struct expression *expression)
+{
+	if (expression == NULL) {
+		put_u32(f, CACHE_NULL);
+		return;
+	}
+	put_u32(f, expression->type);
+	put_string(f, expression->format);
+
+	switch (expression->type) {
+	case EXPR_NONE:
+	case EXPR_ELLIPSIS:
+		break;
+	case EXPR_INTEGER:
+		put_s64(f, expression->value.num);
+		break;
+	case EXPR_LINGER:
+		put_bytes(f, &expression->value.linger,
+			  sizeof(expression->value.linger));
+		break;
+	case EXPR_WORD:
+	case EXPR_STRING:
+		put_string(f, expression->value.string);
+		break;
+	case EXPR_SOCKET_ADDRESS_IPV4:
+		put_bytes(f, expression->value.socket_address_ipv4,
+			  sizeof(struct sockaddr_in));
+		break;
+	case EXPR_SOCKET_ADDRESS_IPV6:
+		put_bytes(f, expression->value.socket_address_ipv6,
+			  sizeof(struct sockaddr_in6));
+		break;
+	case EXPR_BINARY:
+		put_string(f, expression->value.binary->op);
+		put_expression(f, expression->value.binary->lhs);
+		put_expression(f, expression->value.binary->rhs);
+		break;
+	case EXPR_LIST:
+		put_expression_list(f, expression->value.list);
+		break;
+	case EXPR_IOVEC:
+		put_expression(f, expression->value.iovec->iov_base);
+		put_expression(f, expression->value.iovec->iov_len);
+		break;
+	case EXPR_MSGHDR:
+		put_expression(f, expression->value.msghdr->msg_name);
+		put_expression(f, expression->value.msghdr->msg_namelen);
+		put_expression(f, expression->value.msghdr->msg_iov);
+		put_expression(f, expression->value.msghdr->msg_iovlen);
+		put_expression(f, expression->value.msghdr->msg_flags);
+		put_expression(f, expression->value.msghdr->msg_control);
+		break;
+	case EXPR_POLLFD:
+		put_expression(f, expression->value.pollfd->fd);
+		put_expression(f, expression->value.pollfd->events);
+		put_expression(f, expression->value.pollfd->revents);
+		break;
+	case EXPR_EPOLLEV:
+		put_expression(f, expression->value.epollev->events);
+		put_expression(f, expression->value.epollev->fd);
+		break;
+	case EXPR_MMSGHDR:
+		put_expression(f, expression->value.mmsghdr->msg_hdr);
+		put_expression(f, expression->value.mmsghdr->msg_len);
+		break;
+	case EXPR_CMSGHDR:
+		put_expression(f, expression->value.cmsghdr->cmsg_level);
+		put_expression(f, expression->value.cmsghdr->cmsg_type);
+		put_expression(f, expression->value.cmsghdr->cmsg_data);
+		break;
+	case NUM_EXPR_TYPES:
+		break;
+	/* missing default case so compiler catches missing cases */
+	}
+}
+
+/* Return the offset of a pointer into the packet's buffer. */
+static u32 packet_offset(const struct packet *packet, const void *ptr)
+{
+	if (ptr == NULL)
+		return CACHE_NULL;
+	return (const u8 *)ptr - packet->buffer;
+}
+
+static void put_packet(FILE *f, struct packet *packet)
+{
+	const u32 used = packet_end(packet) - packet->buffer;
+	int i, num_headers = packet_header_count(packet);
+
+	put_u32(f, packet->buffer_bytes);
+	put_u32(f, used);
+	put_bytes(f, packet->buffer, used);
+	put_u32(f, packet->l2_header_bytes);
+	put_u32(f, packet->ip_bytes);
+	put_u32(f, packet->direction);
+	put_s64(f, packet->socket_script_fd);
+
+	put_u32(f, num_headers);
+	for (i = 0; i < num_headers; ++i) {
+		put_u32(f, packet->headers[i].type);
+		put_u32(f, packet_offset(packet, packet->headers[i].h.ptr));
+		put_u32(f, packet->headers[i].header_bytes);
+		put_u32(f, packet->headers[i].total_bytes);
+	}
+
+	put_u32(f, packet_offset(packet, packet->ipv4));
+	put_u32(f, packet_offset(packet, packet->ipv6));
+	put_u32(f, packet_offset(packet, packet->tcp));
+	put_u32(f, packet_offset(packet, packet->udp));
+	put_u32(f, packet_offset(packet, packet->icmpv4));
+	put_u32(f, packet_offset(packet, packet->icmpv6));
+	put_u32(f, packet_offset(packet, packet->tcp_ts_val));
+	put_u32(f, packet_offset(packet, packet->tcp_ts_ecr));
+
+	put_s64(f, packet->time_usecs);
+	put_u32(f, packet->flags & ~FLAG_VERIFY_PLANNED); /* not the plan */
+	put_u32(f, packet->ecn);
+	put_u32(f, packet->gso_size);
+	put_u32(f, packet->tcp_options_indexed);
+	put_bytes(f, packet->tcp_option_offset,
+		  sizeof(packet->tcp_option_offset));
+	put_bytes(f, packet->mptcp_option_offset,
+		  sizeof(packet->mptcp_option_offset));
+}
+
+static void put_events(FILE *f, const struct event *events);
+
+static void put_event(FILE *f, const struct event *event)
+{
+	const struct syscall_spec *syscall = NULL;
+	const struct repeat_spec *repeat = NULL;
+	int i;
+
+	put_u32(f, event->line_number);
+	put_s64(f, event->time_usecs);
+	put_s64(f, event->time_usecs_end);
+	put_s64(f, event->offset_usecs);
+	put_u32(f, event->time_type);
+	put_u32(f, event->type);
+
+	switch (event->type) {
+	case PACKET_EVENT:
+		put_packet(f, event->event.packet);
+		break;
+	case SYSCALL_EVENT:
+		syscall = event->event.syscall;
+		put_string(f, syscall->name);
+		put_expression_list(f, syscall->arguments);
+		put_expression(f, syscall->result);
+		put_u32(f, syscall->error != NULL);
+		if (syscall->error != NULL) {
+			put_string(f, syscall->error->errno_macro);
+			put_string(f, syscall->error->strerror);
+		}
+		put_string(f, syscall->note);
+		put_s64(f, syscall->end_usecs);
+		break;
+	case COMMAND_EVENT:
+		put_string(f, event->event.command->command_line);
+		break;
+	case CODE_EVENT:
+		put_string(f, event->event.code->text);
+		break;
+	case REPEAT_EVENT:
+		repeat = event->event.repeat;
+		put_s64(f, repeat->count);
+		put_events(f, repeat->events);
+		put_u32(f, repeat->num_packets);
+		for (i = 0; i < repeat->num_packets; ++i)
+			put_packet(f, repeat->packets[i]);
+		put_u32(f, repeat->inbound_seq_bytes);
+		put_u32(f, repeat->outbound_seq_bytes);
+		put_s64(f, repeat->duration_usecs);
+		break;
+	case METER_EVENT:
+		put_bytes(f, event->event.meter, sizeof(struct meter_spec));
+		break;
+	case MP_JOIN_STORM_EVENT:
+		put_bytes(f, event->event.mp_join_storm,
+			  sizeof(struct mp_join_storm_spec));
+		break;
+	case PEER_EVENT:
+		put_bytes(f, event->event.peer, sizeof(struct peer_spec));
+		break;
+	case SYN_FLOOD_EVENT:
+		put_bytes(f, event->event.syn_flood,
+			  sizeof(struct syn_flood_spec));
+		break;
+	case INTERLEAVE_EVENT:
+		put_events(f, event->event.interleave->events);
+		put_u32(f, event->event.interleave->num_packets);
+		break;
+	case INVALID_EVENT:
+	case NUM_EVENT_TYPES:
+		break;
+	/* missing default case so compiler catches missing cases */
+	}
+}
+
+static void put_events(FILE *f, const struct event *events)
+{
+	const struct event *event = NULL;
+	u32 count = 0;
+
+	for (event = events; event != NULL; event = event->next)
+		++count;
+	put_u32(f, count);
+	for (event = events; event != NULL; event = event->next)
+		put_event(f, event);
+}
+
+/* Write out what parsing left queued in mp_state for the run. We take
+ * each element off its queue and put it back, so the queues end up as
+ * they were. The names of the variables go first, in slot order, so
+ * that interning them again on load gives the slots the queued
+ * elements and mp_join_infos refer to.
+ */
+static void put_mp_state(FILE *f)
+{
+	struct mp_value_expr *expr = NULL;
+	struct mp_var *var = NULL;
+	unsigned i, count;
+	void *element = NULL;
+	u64 value;
+
+	put_u32(f, mp_state.num_var_slots);
+	for (i = 0; i < mp_state.num_var_slots; ++i)
+		put_string(f, mp_state.var_slots[i]->name);
+
+	count = queue_size(&mp_state.vars_queue);
+	put_u32(f, count);
+	for (i = 0; i < count; ++i) {
+		queue_dequeue(&mp_state.vars_queue, &element);
+		if (mp_var_queued(element, &var)) {
+			put_u32(f, CACHE_MP_VAR_SLOT);
+			put_u32(f, var->slot);
+		} else if (mp_expr_queued(element, &expr)) {
+			put_u32(f, CACHE_MP_VALUE_EXPR);
+			put_bytes(f, expr, sizeof(struct mp_value_expr));
+		} else {
+			put_u32(f, CACHE_MP_JOIN_INFO);
+			put_bytes(f, element, sizeof(struct mp_join_info));
+		}
+		queue_enqueue(&mp_state.vars_queue, element);
+	}
+
+	count = queue_size_val(&mp_state.vals_queue);
+	put_u32(f, count);
+	for (i = 0; i < count; ++i) {
+		queue_dequeue_val(&mp_state.vals_queue, &value);
+		put_bytes(f, &value, sizeof(value));
+		queue_enqueue_val(&mp_state.vals_queue, value);
+	}
+
+	count = queue_size_val(&mp_state.script_only_vals_queue);
+	put_u32(f, count);
+	for (i = 0; i < count; ++i) {
+		queue_dequeue_val(&mp_state.script_only_vals_queue, &value);
+		put_bytes(f, &value, sizeof(value));
+		queue_enqueue_val(&mp_state.script_only_vals_queue, value);
+	}
+
+	/* The parser only gives values to script-defined keys, of 8 bytes
+	 * each.
+	 */
+	count = 0;
+	for (i = 0; i < mp_state.num_var_slots; ++i)
+		if (mp_state.var_slots[i]->mp_capable_info.script_defined)
+			++count;
+	put_u32(f, count);
+	for (i = 0; i < mp_state.num_var_slots; ++i) {
+		var = mp_state.var_slots[i];
+		if (!var->mp_capable_info.script_defined)
+			continue;
+		put_u32(f, var->slot);
+		put_bytes(f, var->value, sizeof(u64));
+	}
+}
+
+/* Write the cache file header, with the given body size, and then
+ * the body.
+ */
+static void put_header(FILE *f, const u8 key[SHA1_DIGEST_BYTES],
+		       u64 body_bytes)
+{
+	struct script_cache_header header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, script_cache_magic, sizeof(header.magic));
+	header.version			= SCRIPT_CACHE_VERSION;
+	header.packet_bytes		= sizeof(struct packet);
+	header.mp_join_info_bytes	= sizeof(struct mp_join_info);
+	header.body_bytes		= body_bytes;
+	memcpy(header.key, key, sizeof(header.key));
+	put_bytes(f, &header, sizeof(header));
+}
+
+/* Write the body of a cache file: the options, the init command, the
+ * events and the MPTCP state.
+ */
+static void put_body(FILE *f, struct script *script)
+{
+	struct option_list *option = NULL;
+	u32 count = 0;
+
+	for (option = script->option_list; option != NULL;
+	     option = option->next)
+		++count;
+	put_u32(f, count);
+	for (option = script->option_list; option != NULL;
+	     option = option->next) {
+		put_string(f, option->name);
+		put_string(f, option->value);
+	}
+	put_string(f, script->init_command != NULL ?
+		   script->init_command->command_line : NULL);
+	put_events(f, script->event_list);
+	put_mp_state(f);
+}
+
+/* Can we write out the whole parse of this script? */
+static bool is_cacheable(const struct script *script)
+{
+	return script->arena_events && !script->streaming;
+}
+
+void script_cache_store(const char *dir, const u8 key[SHA1_DIGEST_BYTES],
+			struct script *script)
+{
+	char *path = NULL, *tmp_path = NULL;
+	long end;
+	FILE *f = NULL;
+
+	if (!is_cacheable(script))
+		return;
+
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+		DEBUGP("script_cache_store: mkdir %s: %s\n",
+		       dir, strerror(errno));
+		return;
+	}
+
+	/* Write to a temporary file and then rename it into place, so
+	 * that concurrent runs only ever see whole cache files.
+	 */
+	path = cache_path(dir, key);
+	asprintf(&tmp_path, "%s.%d.tmp", path, getpid());
+	f = fopen(tmp_path, "w");
+	if (f == NULL) {
+		DEBUGP("script_cache_store: fopen %s: %s\n",
+		       tmp_path, strerror(errno));
+		goto out;
+	}
+
+	put_header(f, key, 0);
+	put_body(f, script);
+
+	/* Now that we know how long the body is, fill it in. */
+	end = ftell(f);
+	if (end < 0 || fseek(f, 0, SEEK_SET) != 0) {
+		fclose(f);
+		goto fail;
+	}
+	put_header(f, key, end - sizeof(struct script_cache_header));
+
+	if (ferror(f)) {
+		fclose(f);
+		goto fail;
+	}
+	if (fclose(f) != 0)
+		goto fail;
+	if (rename(tmp_path, path) != 0)
+		goto fail;
+	goto out;
+
+fail:
+	DEBUGP("script_cache_store: error writing %s\n", tmp_path);
+	unlink(tmp_path);
+out:
+	free(tmp_path);
+	free(path);
+}
+
+int script_cache_encode(const u8 key[SHA1_DIGEST_BYTES],
+			struct script *script, u8 **data, size_t *len)
+{
+	struct script_cache_header *header = NULL;
+	char *buf = NULL;
+	size_t bytes = 0;
+	FILE *f = NULL;
+
+	if (!is_cacheable(script))
+		return STATUS_ERR;
+
+	f = open_memstream(&buf, &bytes);
+	if (f == NULL)
+		die_perror("open_memstream");
+	put_header(f, key, 0);
+	put_body(f, script);
+	if (fclose(f) != 0) {
+		free(buf);
+		return STATUS_ERR;
+	}
+
+	/* Fill in the body size in place. */
+	assert(bytes >= sizeof(*header));
+	header = (struct script_cache_header *)buf;
+	header->body_bytes = bytes - sizeof(*header);
+
+	*data = (u8 *)buf;
+	*len = bytes;
+	return STATUS_OK;
+}
+
+/* Decoding. Each of these returns zeroes or NULL once the input turns
+ * out to be bad, so callers can check r->bad once at the end.
+ */
+
+static const void *get_bytes(struct cache_reader *r, size_t len)
+{
+	const void *data = r->next;
+
+	if (r->bad || len > r->end - r->next) {
+		r->bad = true;
+		return NULL;
+	}
+	r->next += len;
+	return data;
+}
+
+static u32 get_u32(struct cache_reader *r)
+{
+	const void *data = get_bytes(r, sizeof(u32));
+	u32 value = 0;
+
+	if (data != NULL)
+		memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static s64 get_s64(struct cache_reader *r)
+{
+	const void *data = get_bytes(r, sizeof(s64));
+	s64 value = 0;
+
+	if (data != NULL)
+		memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+/* Return a copy of a string, allocated in the arena. */
+static char *get_string(struct cache_reader *r)
+{
+	u32 len = get_u32(r);
+	const char *s = NULL;
+
+	if (len == CACHE_NULL)
+		return NULL;
+	s = get_bytes(r, len);
+	if (s == NULL)
+		return NULL;
+	return arena_strndup(r->arena, s, len);
+}
+
+/* Return a copy of some fixed-size bytes, allocated in the arena. */
+static void *get_copy(struct cache_reader *r, size_t len)
+{
+	const void *data = get_bytes(r, len);
+	void *copy = NULL;
+
+	if (data == NULL)
+		return NULL;
+	copy = arena_alloc(r->arena, len);
+	memcpy(copy, data, len);
+	return copy;
+}
+
+static struct expression *get_expression(struct cache_reader *r);
+
+static struct expression_list *get_expression_list(struct cache_reader *r)
+{
+	struct expression_list *list = NULL, **tail = &list;
+	u32 i, count = get_u32(r);
+
+	for (i = 0; i < count && !r->bad; ++i) {
+		*tail = arena_alloc(r->arena, sizeof(struct expression_list));
+		(*tail)->expression = get_expression(r);
+		tail = &(*tail)->next;
+	}
+	return list;
+}
+
+static struct expression *get_expression(struct cache_reader *r)
+{
+	struct expression *expression = NULL;
+	u32 type = get_u32(r);
+
+	if (type == CACHE_NULL || r->bad)
+		return NULL;
+	if (type >= NUM_EXPR_TYPES) {
+		r->bad = true;
+		return NULL;
+	}
+	expression = arena_alloc(r->arena, sizeof(struct expression));
+	expression->type = type;
+	expression->format = get_string(r);
+
+	switch (expression->type) {
+	case EXPR_NONE:
+	case EXPR_ELLIPSIS:
+		break;
+	case EXPR_INTEGER:
+		expression->value.num = get_s64(r);
+		break;
+	case EXPR_LINGER: {
+		const void *linger = get_bytes(r,
+					       sizeof(expression->value.linger));
+		if (linger != NULL)
+			memcpy(&expression->value.linger, linger,
+			       sizeof(expression->value.linger));
+		break;
+	}
+	case EXPR_WORD:
+		expression->value.string = get_string(r);
+		if (expression->value.string != NULL)
+			expression->symbol =
+				find_int_symbol(expression->value.string);
+		break;
+	case EXPR_STRING:
+		expression->value.string = get_string(r);
+		break;
+	case EXPR_SOCKET_ADDRESS_IPV4:
+		expression->value.socket_address_ipv4 =
+			get_copy(r, sizeof(struct sockaddr_in));
+		break;
+	case EXPR_SOCKET_ADDRESS_IPV6:
+		expression->value.socket_address_ipv6 =
+			get_copy(r, sizeof(struct sockaddr_in6));
+		break;
+	case EXPR_BINARY:
+		expression->value.binary =
+			arena_alloc(r->arena, sizeof(struct binary_expression));
+		expression->value.binary->op = get_string(r);
+		expression->value.binary->lhs = get_expression(r);
+		expression->value.binary->rhs = get_expression(r);
+		break;
+	case EXPR_LIST:
+		expression->value.list = get_expression_list(r);
+		break;
+	case EXPR_IOVEC:
+		expression->value.iovec =
+			arena_alloc(r->arena, sizeof(struct iovec_expr));
+		expression->value.iovec->iov_base = get_expression(r);
+		expression->value.iovec->iov_len = get_expression(r);
+		break;
+	case EXPR_MSGHDR:
+		expression->value.msghdr =
+			arena_alloc(r->arena, sizeof(struct msghdr_expr));
+		expression->value.msghdr->msg_name = get_expression(r);
+		expression->value.msghdr->msg_namelen = get_expression(r);
+		expression->value.msghdr->msg_iov = get_expression(r);
+		expression->value.msghdr->msg_iovlen = get_expression(r);
+		expression->value.msghdr->msg_flags = get_expression(r);
+		expression->value.msghdr->msg_control = get_expression(r);
+		break;
+	case EXPR_POLLFD:
+		expression->value.pollfd =
+			arena_alloc(r->arena, sizeof(struct pollfd_expr));
+		expression->value.pollfd->fd = get_expression(r);
+		expression->value.pollfd->events = get_expression(r);
+		expression->value.pollfd->revents = get_expression(r);
+		break;
+	case EXPR_EPOLLEV:
+		expression->value.epollev =
+			arena_alloc(r->arena, sizeof(struct epollev_expr));
+		expression->value.epollev->events = get_expression(r);
+		expression->value.epollev->fd = get_expression(r);
+		break;
+	case EXPR_MMSGHDR:
+		expression->value.mmsghdr =
+			arena_alloc(r->arena, sizeof(struct mmsghdr_expr));
+		expression->value.mmsghdr->msg_hdr = get_expression(r);
+		expression->value.mmsghdr->msg_len = get_expression(r);
+		break;
+	case EXPR_CMSGHDR:
+		expression->value.cmsghdr =
+			arena_alloc(r->arena, sizeof(struct cmsghdr_expr));
+		expression->value.cmsghdr->cmsg_level = get_expression(r);
+		expression->value.cmsghdr->cmsg_type = get_expression(r);
+		expression->value.cmsghdr->cmsg_data = get_expression(r);
+		break;
+	case NUM_EXPR_TYPES:
+		break;
+	/* missing default case so compiler catches missing cases */
+	}
+	return expression;
+}
+
+/* Return a pointer for an offset into a packet's first 'used' bytes. */
+static void *packet_pointer(struct cache_reader *r, struct packet *packet,
+			    u32 offset, u32 used)
+{
+	if (offset == CACHE_NULL)
+		return NULL;
+	if (offset >= used) {
+		r->bad = true;
+		return NULL;
+	}
+	return packet->buffer + offset;
+}
+
+/* Return a new heap-allocated packet, or NULL if the input is bad. */
+static struct packet *get_packet(struct cache_reader *r)
+{
+	struct packet *packet = NULL;
+	const void *data = NULL;
+	u32 buffer_bytes = get_u32(r);
+	u32 used = get_u32(r);
+	u32 i, num_headers;
+
+	if (used > buffer_bytes)
+		r->bad = true;
+	data = get_bytes(r, used);
+	if (data == NULL)
+		return NULL;
+	packet = packet_new(buffer_bytes);
+	memcpy(packet->buffer, data, used);
+	packet->l2_header_bytes	= get_u32(r);
+	packet->ip_bytes	= get_u32(r);
+	packet->direction	= get_u32(r);
+	packet->socket_script_fd = get_s64(r);
+	if (packet->l2_header_bytes + packet->ip_bytes != used)
+		r->bad = true;
+
+	num_headers = get_u32(r);
+	if (num_headers > PACKET_MAX_HEADERS)
+		r->bad = true;
+	for (i = 0; i < num_headers && !r->bad; ++i) {
+		struct header *header = &packet->headers[i];
+
+		header->type = get_u32(r);
+		header->h.ptr = packet_pointer(r, packet, get_u32(r), used);
+		header->header_bytes = get_u32(r);
+		header->total_bytes = get_u32(r);
+		if (header->type == HEADER_NONE ||
+		    header->type >= HEADER_NUM_TYPES)
+			r->bad = true;
+	}
+
+	packet->ipv4	= packet_pointer(r, packet, get_u32(r), used);
+	packet->ipv6	= packet_pointer(r, packet, get_u32(r), used);
+	packet->tcp	= packet_pointer(r, packet, get_u32(r), used);
+	packet->udp	= packet_pointer(r, packet, get_u32(r), used);
+	packet->icmpv4	= packet_pointer(r, packet, get_u32(r), used);
+	packet->icmpv6	= packet_pointer(r, packet, get_u32(r), used);
+	packet->tcp_ts_val	= packet_pointer(r, packet, get_u32(r), used);
+	packet->tcp_ts_ecr	= packet_pointer(r, packet, get_u32(r), used);
+
+	packet->time_usecs	= get_s64(r);
+	packet->flags		= get_u32(r);
+	packet->ecn		= get_u32(r);
+	packet->gso_size	= get_u32(r);
+	packet->tcp_options_indexed = get_u32(r);
+	data = get_bytes(r, sizeof(packet->tcp_option_offset));
+	if (data != NULL)
+		memcpy(packet->tcp_option_offset, data,
+		       sizeof(packet->tcp_option_offset));
+	data = get_bytes(r, sizeof(packet->mptcp_option_offset));
+	if (data != NULL)
+		memcpy(packet->mptcp_option_offset, data,
+		       sizeof(packet->mptcp_option_offset));
+
+	if (r->bad) {
+		packet_free(packet);
+		return NULL;
+	}
+	return packet;
+}
+
+/* Decode events onto the end of the given list as we go, so that on
+ * bad input free_script() can still find every packet we allocated.
+ */
+static void get_events(struct cache_reader *r, struct event **list);
+
+static struct event *get_event(struct cache_reader *r)
+{
+	struct event *event = arena_alloc(r->arena, sizeof(struct event));
+
+	event->line_number	= get_u32(r);
+	event->time_usecs	= get_s64(r);
+	event->time_usecs_end	= get_s64(r);
+	event->offset_usecs	= get_s64(r);
+	event->time_type	= get_u32(r);
+	event->type		= get_u32(r);
+	if (event->time_type >= NUM_TIME_TYPES ||
+	    event->type == INVALID_EVENT || event->type >= NUM_EVENT_TYPES)
+		r->bad = true;
+	return event;
+}
+
+static void get_event_body(struct cache_reader *r, struct event *event)
+{
+	struct syscall_spec *syscall = NULL;
+	struct repeat_spec *repeat = NULL;
+	struct meter_spec *meter = NULL;
+	struct peer_spec *peer = NULL;
+	struct syn_flood_spec *syn_flood = NULL;
+	struct interleave_spec *interleave = NULL;
+	struct event *e = NULL;
+	u32 i, num_packets;
+
+	switch (event->type) {
+	case PACKET_EVENT:
+		/* The caller links the event in once it has a packet. */
+		event->event.packet = get_packet(r);
+		break;
+	case SYSCALL_EVENT:
+		syscall = arena_alloc(r->arena, sizeof(struct syscall_spec));
+		event->event.syscall = syscall;
+		syscall->name = get_string(r);
+		syscall->arguments = get_expression_list(r);
+		syscall->result = get_expression(r);
+		if (get_u32(r)) {
+			syscall->error = arena_alloc(r->arena,
+						     sizeof(struct errno_spec));
+			syscall->error->errno_macro = get_string(r);
+			syscall->error->strerror = get_string(r);
+		}
+		syscall->note = get_string(r);
+		syscall->end_usecs = get_s64(r);
+		break;
+	case COMMAND_EVENT:
+		event->event.command =
+			arena_alloc(r->arena, sizeof(struct command_spec));
+		event->event.command->command_line = get_string(r);
+		break;
+	case CODE_EVENT:
+		event->event.code =
+			arena_alloc(r->arena, sizeof(struct code_spec));
+		event->event.code->text = get_string(r);
+		break;
+	case REPEAT_EVENT:
+		repeat = arena_alloc(r->arena, sizeof(struct repeat_spec));
+		event->event.repeat = repeat;
+		repeat->count = get_s64(r);
+		get_events(r, &repeat->events);
+		num_packets = get_u32(r);
+		if (num_packets > (r->end - r->next) / sizeof(u32)) {
+			r->bad = true;
+			break;
+		}
+		repeat->packets = arena_alloc(r->arena,
+					      num_packets *
+					      sizeof(struct packet *));
+		for (i = 0; i < num_packets && !r->bad; ++i) {
+			repeat->packets[i] = get_packet(r);
+			if (repeat->packets[i] != NULL)
+				repeat->num_packets = i + 1;
+		}
+		repeat->inbound_seq_bytes = get_u32(r);
+		repeat->outbound_seq_bytes = get_u32(r);
+		repeat->duration_usecs = get_s64(r);
+		break;
+	case METER_EVENT:
+		meter = get_copy(r, sizeof(struct meter_spec));
+		event->event.meter = meter;
+		if (meter == NULL || meter->num_checks < 0 ||
+		    meter->num_checks > MAX_METER_CHECKS) {
+			r->bad = true;
+			break;
+		}
+		for (i = 0; i < meter->num_checks; ++i) {
+			if (meter->checks[i].metric >= NUM_METER_METRICS)
+				r->bad = true;
+		}
+		break;
+	case MP_JOIN_STORM_EVENT:
+		event->event.mp_join_storm =
+			get_copy(r, sizeof(struct mp_join_storm_spec));
+		if (event->event.mp_join_storm == NULL)
+			r->bad = true;
+		break;
+	case PEER_EVENT:
+		peer = get_copy(r, sizeof(struct peer_spec));
+		event->event.peer = peer;
+		if (peer == NULL || peer->num_checks < 0 ||
+		    peer->num_checks > MAX_PEER_CHECKS) {
+			r->bad = true;
+			break;
+		}
+		for (i = 0; i < peer->num_checks; ++i) {
+			if (peer->checks[i].metric >= NUM_PEER_METRICS)
+				r->bad = true;
+		}
+		break;
+	case SYN_FLOOD_EVENT:
+		syn_flood = get_copy(r, sizeof(struct syn_flood_spec));
+		event->event.syn_flood = syn_flood;
+		if (syn_flood == NULL || syn_flood->num_checks < 0 ||
+		    syn_flood->num_checks > MAX_SYN_FLOOD_CHECKS) {
+			r->bad = true;
+			break;
+		}
+		for (i = 0; i < syn_flood->num_checks; ++i) {
+			if (syn_flood->checks[i].metric >=
+			    NUM_SYN_FLOOD_METRICS)
+				r->bad = true;
+		}
+		break;
+	case INTERLEAVE_EVENT:
+		interleave = arena_alloc(r->arena,
+					 sizeof(struct interleave_spec));
+		event->event.interleave = interleave;
+		get_events(r, &interleave->events);
+		interleave->num_packets = get_u32(r);
+		num_packets = 0;
+		for (e = interleave->events; e != NULL; e = e->next) {
+			if (e->type != PACKET_EVENT)
+				r->bad = true;
+			++num_packets;
+		}
+		if (num_packets != interleave->num_packets)
+			r->bad = true;
+		break;
+	case INVALID_EVENT:
+	case NUM_EVENT_TYPES:
+		break;
+	/* missing default case so compiler catches missing cases */
+	}
+}
+
+static void get_events(struct cache_reader *r, struct event **list)
+{
+	struct event **tail = list, *event = NULL;
+	u32 i, count = get_u32(r);
+
+	for (i = 0; i < count && !r->bad; ++i) {
+		event = get_event(r);
+		if (r->bad)
+			break;
+		if (event->type != PACKET_EVENT)
+			*tail = event;
+		get_event_body(r, event);
+		if (event->type == PACKET_EVENT && event->event.packet != NULL)
+			*tail = event;
+		if (*tail != NULL)
+			tail = &(*tail)->next;
+	}
+}
+
+/* Queue up the MPTCP state that parsing the script would have left. */
+static void get_mp_state(struct cache_reader *r)
+{
+	struct mp_join_info *info = NULL;
+	struct mp_value_expr expr;
+	struct mp_var *var = NULL;
+	const void *data = NULL;
+	u32 i, count, slot;
+	u64 value;
+	char *name = NULL;
+
+	/* The slots must come out as they were when the file was written. */
+	count = get_u32(r);
+	for (i = 0; i < count && !r->bad; ++i) {
+		name = get_string(r);
+		if (name == NULL || mp_var_intern(name) != i)
+			r->bad = true;
+	}
+
+	count = get_u32(r);
+	for (i = 0; i < count && !r->bad; ++i) {
+		switch (get_u32(r)) {
+		case CACHE_MP_VAR_SLOT:
+			slot = get_u32(r);
+			if (mp_var_slot(slot) == NULL ||
+			    queue_enqueue(&mp_state.vars_queue,
+					  mp_var_queue_element(slot)))
+				r->bad = true;
+			break;
+		case CACHE_MP_JOIN_INFO:
+			data = get_bytes(r, sizeof(struct mp_join_info));
+			if (data == NULL)
+				break;
+			info = malloc(sizeof(struct mp_join_info));
+			memcpy(info, data, sizeof(struct mp_join_info));
+			if (queue_enqueue(&mp_state.vars_queue, info))
+				r->bad = true;
+			break;
+		case CACHE_MP_VALUE_EXPR:
+			data = get_bytes(r, sizeof(struct mp_value_expr));
+			if (data == NULL)
+				break;
+			memcpy(&expr, data, sizeof(struct mp_value_expr));
+			if (mp_var_slot(expr.var) == NULL ||
+			    queue_enqueue(&mp_state.vars_queue,
+					  mp_expr_queue_element(
+						  mp_expr_add(&expr))))
+				r->bad = true;
+			break;
+		default:
+			r->bad = true;
+			break;
+		}
+	}
+
+	count = get_u32(r);
+	for (i = 0; i < count && !r->bad; ++i) {
+		data = get_bytes(r, sizeof(value));
+		if (data == NULL)
+			break;
+		memcpy(&value, data, sizeof(value));
+		if (queue_enqueue_val(&mp_state.vals_queue, value))
+			r->bad = true;
+	}
+
+	count = get_u32(r);
+	for (i = 0; i < count && !r->bad; ++i) {
+		data = get_bytes(r, sizeof(value));
+		if (data == NULL)
+			break;
+		memcpy(&value, data, sizeof(value));
+		if (queue_enqueue_val(&mp_state.script_only_vals_queue, value))
+			r->bad = true;
+	}
+
+	count = get_u32(r);
+	for (i = 0; i < count && !r->bad; ++i) {
+		var = mp_var_slot(get_u32(r));
+		data = get_bytes(r, sizeof(value));
+		if (var == NULL || data == NULL) {
+			r->bad = true;
+			break;
+		}
+		memcpy(&value, data, sizeof(value));
+		add_mp_var_script_defined(var->name, &value, sizeof(value));
+	}
+}
+
+/* Decode a mapped cache file into 'loaded'. Returns STATUS_OK on
+ * success, or STATUS_ERR if the file is stale or bad.
+ */
+static int decode_cache_file(const u8 *data, size_t len,
+			     const u8 key[SHA1_DIGEST_BYTES],
+			     struct script *loaded)
+{
+	struct cache_reader r = {
+		.next = data,
+		.end = data + len,
+		.arena = loaded->arena,
+		.bad = false,
+	};
+	const struct script_cache_header *header = NULL;
+	struct option_list **option = &loaded->option_list;
+	struct event *event = NULL;
+	char *init_command = NULL;
+	u32 i, count;
+
+	header = get_bytes(&r, sizeof(*header));
+	if (header == NULL ||
+	    memcmp(header->magic, script_cache_magic,
+		   sizeof(header->magic)) != 0 ||
+	    header->version != SCRIPT_CACHE_VERSION ||
+	    header->packet_bytes != sizeof(struct packet) ||
+	    header->mp_join_info_bytes != sizeof(struct mp_join_info) ||
+	    header->body_bytes != len - sizeof(*header) ||
+	    memcmp(header->key, key, sizeof(header->key)) != 0)
+		return STATUS_ERR;
+
+	count = get_u32(&r);
+	for (i = 0; i < count && !r.bad; ++i) {
+		*option = arena_alloc(r.arena, sizeof(struct option_list));
+		(*option)->name = get_string(&r);
+		(*option)->value = get_string(&r);
+		option = &(*option)->next;
+	}
+
+	init_command = get_string(&r);
+	if (init_command != NULL) {
+		loaded->init_command =
+			arena_alloc(r.arena, sizeof(struct command_spec));
+		loaded->init_command->command_line = init_command;
+	}
+
+	get_events(&r, &loaded->event_list);
+	for (event = loaded->event_list; event != NULL; event = event->next)
+		++loaded->num_events;
+
+	get_mp_state(&r);
+
+	if (r.bad || r.next != r.end)
+		return STATUS_ERR;
+	return STATUS_OK;
+}
+
+int script_cache_decode(const u8 *data, size_t len,
+			const u8 key[SHA1_DIGEST_BYTES],
+			struct invocation *invocation)
+{
+	struct script *script = invocation->script;
+	struct script loaded;
+	int result = STATUS_ERR;
+
+	init_script(&loaded);
+	loaded.arena = arena_new();
+	loaded.arena_events = true;
+	result = decode_cache_file(data, len, key, &loaded);
+
+	if (result != STATUS_OK) {
+		/* Put things back the way they were, and parse instead. */
+		free_script(&loaded);
+		free_mp_state();
+		init_mp_state();
+		return STATUS_ERR;
+	}
+
+	DEBUGP("script_cache_decode: %d events from cache\n",
+	       loaded.num_events);
+	script->option_list	= loaded.option_list;
+	script->init_command	= loaded.init_command;
+	script->event_list	= loaded.event_list;
+	script->num_events	= loaded.num_events;
+	script->arena		= loaded.arena;
+	script->arena_events	= true;
+
+	/* As the parser does once it has the options. */
+	parse_and_finalize_config(invocation);
+	return STATUS_OK;
+}
+
+int script_cache_load(const char *dir, const u8 key[SHA1_DIGEST_BYTES],
+		      struct invocation *invocation)
+{
+	struct stat file_info;
+	char *path = cache_path(dir, key);
+	void *data = NULL;
+	int fd = -1, result = STATUS_ERR;
+
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return STATUS_ERR;
+	if (fstat(fd, &file_info) != 0 || file_info.st_size == 0) {
+		close(fd);
+		return STATUS_ERR;
+	}
+	data = mmap(NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return STATUS_ERR;
+
+	result = script_cache_decode(data, file_info.st_size, key,
+				     invocation);
+	munmap(data, file_info.st_size);
+	return result;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for a cache of parsed scripts.
+ *
+ * With --script_cache=<dir>, each script we parse is also written to
+ * <dir> in a compact binary form of its parse: its options, init
+ * command and events, plus the MPTCP variables and values the parser
+ * queued up for the run. The file is named after a SHA-1 hash of the
+ * script text and of the command line, since options like --ip_version
+ * change how a script parses. When a later run finds a file for the
+ * same script and command line, it maps the file and rebuilds the script
+ * from it without running the lexer and parser at all.
+ */
+
+#ifndef __SCRIPT_CACHE_H__
+#define __SCRIPT_CACHE_H__
+
+#include "types.h"
+
+#include "config.h"
+#include "script.h"
+#include "sha1.h"
+
+/* Return the malloc-ed --script_cache directory given on the command
+ * line, or NULL if there is none. This only looks at the command line,
+ * since we need it before we parse the script; a --script_cache option
+ * inside a script is ignored.
+ */
+extern char *script_cache_dir(int argc, char *argv[]);
+
+/* Compute the key for a script's cache file from its text and the
+ * command line it is parsed with.
+ */
+extern void script_cache_key(const struct script *script,
+			     int argc, char *argv[],
+			     u8 key[SHA1_DIGEST_BYTES]);
+
+/* Look for the cache file with the given key. If it is there, fill in
+ * invocation->script and the MPTCP state just as parse_script() would,
+ * finalize invocation->config, and return STATUS_OK. Otherwise return
+ * STATUS_ERR, leaving the script and the (freshly initialized) MPTCP
+ * state untouched, ready for parse_script().
+ */
+extern int script_cache_load(const char *dir,
+			     const u8 key[SHA1_DIGEST_BYTES],
+			     struct invocation *invocation);
+
+/* Write the freshly parsed script, and the MPTCP state parsing it left
+ * behind, to the cache file with the given key. Scripts whose events
+ * were not all kept in memory (--stream_window) are not cached. Errors
+ * are not fatal; they just mean the next run parses the script again.
+ */
+extern void script_cache_store(const char *dir,
+			       const u8 key[SHA1_DIGEST_BYTES],
+			       struct script *script);
+
+/* Encode the freshly parsed script, and the MPTCP state parsing it
+ * left behind, in the cache file format, into a malloc-ed buffer; for
+ * sending a parse to a wire server. Return STATUS_ERR, with nothing
+ * allocated, for scripts script_cache_store() would not cache.
+ */
+extern int script_cache_encode(const u8 key[SHA1_DIGEST_BYTES],
+			       struct script *script, u8 **data, size_t *len);
+
+/* Like script_cache_load(), but from a cache file image in memory. The
+ * script does not keep pointers into the image.
+ */
+extern int script_cache_decode(const u8 *data, size_t len,
+			       const u8 key[SHA1_DIGEST_BYTES],
+			       struct invocation *invocation);
+
+#endif /* __SCRIPT_CACHE_H__ */
@@ -0,0 +1,269 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for script_cache.c: a script written to the cache reads
+ * back with the same events and MPTCP state, and a damaged cache file
+ * is a miss.
+ */
+
+#include "script_cache.h"
+
+#include <assert.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "mptcp.h"
+#include "packet_to_string.h"
+#include "tcp_packet.h"
+
+static struct expression *new_integer(struct arena *arena, s64 num)
+{
+	struct expression *expression = arena_alloc(arena, sizeof(*expression));
+
+	expression->type = EXPR_INTEGER;
+	expression->value.num = num;
+	expression->format = "%ld";
+	return expression;
+}
+
+static struct event *new_event(struct arena *arena, enum event_t type,
+			       s64 time_usecs)
+{
+	struct event *event = arena_alloc(arena, sizeof(*event));
+
+	event->type = type;
+	event->time_type = RELATIVE_TIME;
+	event->time_usecs = time_usecs;
+	event->time_usecs_end = NO_TIME_RANGE;
+	event->offset_usecs = NO_TIME_RANGE;
+	return event;
+}
+
+/* Build a script like: +0 < S 0:0(0) win 32792
+ *                      +.1 connect(3, {... sin_port=htons(8080) ...}) = 0
+ *                      +.1 `echo done`
+ */
+static void make_script(struct script *script)
+{
+	struct arena *arena = NULL;
+	struct event *packet_event, *syscall_event, *command_event;
+	struct syscall_spec *syscall = NULL;
+	struct expression *address = NULL;
+	char *error = NULL;
+
+	init_script(script);
+	script->buffer = strdup("a script");
+	script->length = strlen(script->buffer);
+	script->arena = arena = arena_new();
+	script->arena_events = true;
+
+	packet_event = new_event(arena, PACKET_EVENT, 0);
+	packet_event->event.packet =
+		new_tcp_packet(3, AF_INET, DIRECTION_INBOUND, ECN_NONE, "S",
+			       0, 0, 0, 32792, NULL, &error);
+	assert(packet_event->event.packet != NULL);
+
+	syscall_event = new_event(arena, SYSCALL_EVENT, 100000);
+	syscall = arena_alloc(arena, sizeof(*syscall));
+	syscall->name = "connect";
+	syscall->end_usecs = SYSCALL_NON_BLOCKING;
+	address = arena_alloc(arena, sizeof(*address));
+	address->type = EXPR_SOCKET_ADDRESS_IPV4;
+	address->value.socket_address_ipv4 =
+		arena_alloc(arena, sizeof(struct sockaddr_in));
+	address->value.socket_address_ipv4->sin_port = htons(8080);
+	syscall->arguments = arena_alloc(arena, sizeof(struct expression_list));
+	syscall->arguments->expression = new_integer(arena, 3);
+	syscall->arguments->next =
+		arena_alloc(arena, sizeof(struct expression_list));
+	syscall->arguments->next->expression = address;
+	syscall->result = new_integer(arena, 0);
+	syscall_event->event.syscall = syscall;
+
+	command_event = new_event(arena, COMMAND_EVENT, 100000);
+	command_event->event.command =
+		arena_alloc(arena, sizeof(struct command_spec));
+	command_event->event.command->command_line = "echo done";
+
+	packet_event->next = syscall_event;
+	syscall_event->next = command_event;
+	script->event_list = packet_event;
+	script->num_events = 3;
+}
+
+static void check_script(struct script *script)
+{
+	struct event *event = script->event_list;
+	struct syscall_spec *syscall = NULL;
+	struct expression *address = NULL;
+	char *dump = NULL, *error = NULL;
+
+	assert(script->num_events == 3);
+
+	assert(event->type == PACKET_EVENT);
+	assert(packet_to_string(event->event.packet, DUMP_SHORT,
+				&dump, &error) == STATUS_OK);
+	assert(strcmp(dump, "S 0:0(0) win 32792 ") == 0);
+	free(dump);
+
+	event = event->next;
+	assert(event->type == SYSCALL_EVENT);
+	assert(event->time_usecs == 100000);
+	syscall = event->event.syscall;
+	assert(strcmp(syscall->name, "connect") == 0);
+	assert(syscall->arguments->expression->value.num == 3);
+	address = syscall->arguments->next->expression;
+	assert(address->type == EXPR_SOCKET_ADDRESS_IPV4);
+	assert(address->value.socket_address_ipv4->sin_port == htons(8080));
+	assert(syscall->arguments->next->next == NULL);
+	assert(strcmp(syscall->result->format, "%ld") == 0);
+	assert(syscall->error == NULL && syscall->note == NULL);
+
+	event = event->next;
+	assert(event->type == COMMAND_EVENT);
+	assert(strcmp(event->event.command->command_line, "echo done") == 0);
+	assert(event->next == NULL);
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/script_cache_test.XXXXXX";
+	char *argv[] = { "packetdrill", "--script_cache=/ignored", NULL };
+	u8 key[SHA1_DIGEST_BYTES];
+	struct config config;
+	struct script script, loaded;
+	struct invocation invocation = {
+		.argc = 2,
+		.argv = argv,
+		.config = &config,
+		.script = &loaded,
+	};
+	struct mp_join_info *join = NULL;
+	char *cache_dir = NULL, *command = NULL;
+	struct mp_value_expr *expr = NULL;
+	struct mp_var *var = NULL;
+	void *element = NULL;
+	u64 key_value = 0x0123456789abcdefULL, value;
+	u8 *image = NULL;
+	size_t image_len = 0;
+
+	cache_dir = script_cache_dir(2, argv);
+	assert(strcmp(cache_dir, "/ignored") == 0);
+	free(cache_dir);
+
+	assert(mkdtemp(dir) != NULL);
+	set_default_config(&config);
+	config.script_path = "script_cache_test.pkt";
+
+	/* Write a script and the MPTCP state its parse would leave. */
+	init_mp_state();
+	make_script(&script);
+	assert(enqueue_var("client_key") == STATUS_OK);
+	join = calloc(1, sizeof(*join));
+	join->ack.var = mp_var_intern("server_key");
+	assert(queue_enqueue(&mp_state.vars_queue, join) == STATUS_OK);
+	assert(queue_enqueue_val(&mp_state.vals_queue, 42) == STATUS_OK);
+	add_mp_var_script_defined("client_key", &key_value, sizeof(key_value));
+	/* With the key known, the expression is folded as it is parsed. */
+	assert(enqueue_idsn_expr("client_key", 7, MPTCP_V1) == STATUS_OK);
+	assert(mp_state.exprs[0].valid);
+	assert(enqueue_idsn_expr("server_key", 9, MPTCP_V1) == STATUS_OK);
+	assert(!mp_state.exprs[1].valid);
+	script_cache_key(&script, 2, argv, key);
+
+	init_script(&loaded);
+	assert(script_cache_load(dir, key, &invocation) == STATUS_ERR);
+	script_cache_store(dir, key, &script);
+	assert(script_cache_encode(key, &script, &image, &image_len) ==
+	       STATUS_OK);
+	free_script(&script);
+	free_mp_state();
+
+	/* Read it back. */
+	init_mp_state();
+	init_script(&loaded);
+	assert(script_cache_load(dir, key, &invocation) == STATUS_OK);
+	check_script(&loaded);
+	assert(dequeue_var(&var) == STATUS_OK);
+	assert(strcmp(var->name, "client_key") == 0);
+	assert(queue_dequeue(&mp_state.vars_queue, (void **)&join) ==
+	       STATUS_OK);
+	assert(strcmp(mp_var_slot(join->ack.var)->name, "server_key") == 0);
+	assert(mp_var_slot(join->ack.var)->value == NULL);
+	free(join);
+	assert(queue_dequeue_val(&mp_state.vals_queue, &value) == STATUS_OK);
+	assert(value == 42);
+	assert(*(u64 *)find_mp_var("client_key")->value == key_value);
+	assert(queue_front(&mp_state.vars_queue, &element) == STATUS_OK);
+	assert(mp_expr_queued(element, &expr));
+	assert(expr->valid && expr->addend == 7);
+	assert(find_next_idsn_expr(MPTCP_V1, &value) == STATUS_OK);
+	assert(value == mptcp_idsn(MPTCP_V1, key_value) + 7);
+	/* The other one waits for its key, and is computed once it has it. */
+	assert(find_next_idsn_expr(MPTCP_V1, &value) == STATUS_ERR);
+	add_mp_var_key(find_mp_var("server_key"), &key_value);
+	expr = &mp_state.exprs[1];
+	assert(!expr->valid && expr->addend == 9);
+	assert(queue_enqueue(&mp_state.vars_queue,
+			     mp_expr_queue_element(1)) == STATUS_OK);
+	assert(find_next_idsn_expr(MPTCP_V1, &value) == STATUS_OK);
+	assert(value == mptcp_idsn(MPTCP_V1, key_value) + 9);
+	assert(expr->valid && expr->value == value);
+	free_script(&loaded);
+	free_mp_state();
+
+	/* An image for another script or command line is a miss. */
+	++key[0];
+	init_mp_state();
+	init_script(&loaded);
+	assert(script_cache_decode(image, image_len, key, &invocation) ==
+	       STATUS_ERR);
+	assert(loaded.event_list == NULL);
+	free_mp_state();
+	--key[0];
+
+	/* The same parse from an image in memory, as a wire server gets. */
+	init_mp_state();
+	init_script(&loaded);
+	assert(script_cache_decode(image, image_len, key, &invocation) ==
+	       STATUS_OK);
+	memset(image, 0, image_len);	/* the script must not point into it */
+	free(image);
+	check_script(&loaded);
+	assert(queue_size(&mp_state.vars_queue) == 4);
+	free_script(&loaded);
+	free_mp_state();
+
+	/* A truncated cache file is a miss that leaves no state behind. */
+	asprintf(&command, "for f in %s/*.pdc; do truncate -s 100 $f; done",
+		 dir);
+	assert(system(command) == 0);
+	init_mp_state();
+	init_script(&loaded);
+	assert(script_cache_load(dir, key, &invocation) == STATUS_ERR);
+	assert(loaded.event_list == NULL);
+	assert(queue_size(&mp_state.vars_queue) == 0);
+	free(command);
+
+	asprintf(&command, "rm -rf %s", dir);
+	assert(system(command) == 0);
+	free(command);
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for expression evaluation in script.c: evaluated syscall
+ * arguments share the parts of the script's expressions that are
+ * already evaluated, and copy only the rest.
+ */
+
+#include "script.h"
+
+#include <assert.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "udp.h"
+
+static struct expression *new_expression(enum expression_t type)
+{
+	struct expression *expression = calloc(1, sizeof(*expression));
+
+	expression->type = type;
+	return expression;
+}
+
+static struct expression *new_integer(s64 num)
+{
+	struct expression *expression = new_expression(EXPR_INTEGER);
+
+	expression->value.num = num;
+	return expression;
+}
+
+static struct expression *new_word(const char *word)
+{
+	struct expression *expression = new_expression(EXPR_WORD);
+
+	expression->value.string = strdup(word);
+	return expression;
+}
+
+static struct expression_list *new_list(struct expression *expression,
+					struct expression_list *next)
+{
+	struct expression_list *list = calloc(1, sizeof(*list));
+
+	list->expression = expression;
+	list->next = next;
+	return list;
+}
+
+/* An iovec of { ..., <len> }. */
+static struct expression *new_iovec(struct expression *len)
+{
+	struct expression *expression = new_expression(EXPR_IOVEC);
+
+	expression->value.iovec = calloc(1, sizeof(struct iovec_expr));
+	expression->value.iovec->iov_base = new_expression(EXPR_ELLIPSIS);
+	expression->value.iovec->iov_len = len;
+	return expression;
+}
+
+/* write(3, ..., 1000000) and writev(3, [{..., 1000}], 1) are already
+ * evaluated: their evaluation is the script's own list.
+ */
+static void test_all_shared(void)
+{
+	struct expression_list *in = NULL, *out = NULL;
+	struct expression *iov_list = new_expression(EXPR_LIST);
+	char *error = NULL;
+
+	in = new_list(new_integer(3),
+		      new_list(new_expression(EXPR_ELLIPSIS),
+			       new_list(new_integer(1000000), NULL)));
+	assert(evaluate_expression_list(in, &out, &error) == STATUS_OK);
+	assert(out == in);
+	free_evaluated_expression_list(out, in);
+	free_expression_list(in);
+
+	iov_list->value.list = new_list(new_iovec(new_integer(1000)), NULL);
+	in = new_list(new_integer(3),
+		      new_list(iov_list, new_list(new_integer(1), NULL)));
+	assert(evaluate_expression_list(in, &out, &error) == STATUS_OK);
+	assert(out == in);
+	free_evaluated_expression_list(out, in);
+	free_expression_list(in);
+}
+
+/* setsockopt(3, SOL_SOCKET, SO_REUSEADDR, [1], 4): only the list nodes
+ * up to the last symbol are copied, and the tail after it is shared.
+ */
+static void test_partly_shared(void)
+{
+	struct expression_list *in = NULL, *out = NULL;
+	struct expression *optval = new_expression(EXPR_LIST);
+	char *error = NULL;
+
+	optval->value.list = new_list(new_integer(1), NULL);
+	in = new_list(new_integer(3),
+		      new_list(new_word("SOL_SOCKET"),
+			       new_list(new_word("SO_REUSEADDR"),
+					new_list(optval,
+						 new_list(new_integer(4),
+							  NULL)))));
+	assert(evaluate_expression_list(in, &out, &error) == STATUS_OK);
+	assert(out != in);
+	assert(out->expression == in->expression);
+	assert(out->next->expression->type == EXPR_INTEGER);
+	assert(out->next->expression->value.num == SOL_SOCKET);
+	assert(out->next->next->expression->value.num == SO_REUSEADDR);
+	assert(out->next->next->next == in->next->next->next);
+	free_evaluated_expression_list(out, in);
+	free_expression_list(in);
+}
+
+/* A symbol inside an iovec copies the iovec and its list, but not the
+ * iovec's other field.
+ */
+static void test_nested(void)
+{
+	struct expression_list *in = NULL, *out = NULL;
+	struct expression *iov_list = new_expression(EXPR_LIST);
+	struct iovec_expr *in_iov = NULL, *out_iov = NULL;
+	char *error = NULL;
+
+	iov_list->value.list = new_list(new_iovec(new_word("SO_REUSEADDR")),
+					NULL);
+	in = new_list(iov_list, NULL);
+	assert(evaluate_expression_list(in, &out, &error) == STATUS_OK);
+	assert(out != in && out->expression != iov_list);
+	in_iov = iov_list->value.list->expression->value.iovec;
+	out_iov = out->expression->value.list->expression->value.iovec;
+	assert(out_iov != in_iov);
+	assert(out_iov->iov_base == in_iov->iov_base);
+	assert(out_iov->iov_len->value.num == SO_REUSEADDR);
+	free_evaluated_expression_list(out, in);
+	free_expression_list(in);
+}
+
+/* A cmsghdr of {cmsg_level=SOL_UDP, cmsg_type=UDP_SEGMENT,
+ * cmsg_data=1200} copies its symbol fields, and shares its data.
+ */
+static void test_cmsghdr(void)
+{
+	struct expression_list *in = NULL, *out = NULL;
+	struct expression *control = new_expression(EXPR_LIST);
+	struct expression *cmsg = new_expression(EXPR_CMSGHDR);
+	struct cmsghdr_expr *in_cmsg = NULL, *out_cmsg = NULL;
+	char *error = NULL;
+
+	in_cmsg = calloc(1, sizeof(struct cmsghdr_expr));
+	in_cmsg->cmsg_level = new_word("SOL_UDP");
+	in_cmsg->cmsg_type = new_word("UDP_SEGMENT");
+	in_cmsg->cmsg_data = new_integer(1200);
+	cmsg->value.cmsghdr = in_cmsg;
+	control->value.list = new_list(cmsg, NULL);
+	in = new_list(control, NULL);
+	assert(evaluate_expression_list(in, &out, &error) == STATUS_OK);
+	out_cmsg = out->expression->value.list->expression->value.cmsghdr;
+	assert(out_cmsg != in_cmsg);
+	assert(out_cmsg->cmsg_level->value.num == IPPROTO_UDP);
+	assert(out_cmsg->cmsg_type->value.num == UDP_SEGMENT);
+	assert(out_cmsg->cmsg_data == in_cmsg->cmsg_data);
+	free_evaluated_expression_list(out, in);
+	free_expression_list(in);
+}
+
+/* Strings are copied only if they have escapes to expand. */
+static void test_strings(void)
+{
+	struct expression_list *in = NULL, *out = NULL;
+	struct expression *plain = new_expression(EXPR_STRING);
+	struct expression *escaped = new_expression(EXPR_STRING);
+	char *error = NULL;
+
+	plain->value.string = strdup("cubic");
+	escaped->value.string = strdup("a\\tb");
+	in = new_list(plain, new_list(escaped, NULL));
+	assert(evaluate_expression_list(in, &out, &error) == STATUS_OK);
+	assert(out->expression == plain);
+	assert(out->next->expression != escaped);
+	assert(strcmp(out->next->expression->value.string, "a\tb") == 0);
+	free_evaluated_expression_list(out, in);
+	free_expression_list(in);
+}
+
+/* An unknown symbol fails, leaving nothing allocated. */
+static void test_error(void)
+{
+	struct expression_list *in = NULL, *out = NULL;
+	char *error = NULL;
+
+	in = new_list(new_word("SOL_SOCKET"),
+		      new_list(new_word("NO_SUCH_SYMBOL"), NULL));
+	assert(evaluate_expression_list(in, &out, &error) == STATUS_ERR);
+	assert(strstr(error, "NO_SUCH_SYMBOL") != NULL);
+	free(error);
+	free_expression_list(in);
+}
+
+int main(void)
+{
+	test_all_shared();
+	test_partly_shared();
+	test_nested();
+	test_cmsghdr();
+	test_strings();
+	test_error();
+	return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * The host self-stall detector; see self_stall.h.
+ */
+
+#include "self_stall.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "logging.h"
+
+struct self_stall {
+	pid_t tid;			/* the watched thread */
+	int schedstat_fd;		/* its schedstat, or -1 */
+	struct self_stall_sample prev;	/* at the start of the event before */
+	struct self_stall_sample cur;	/* at the start of the current event */
+	s64 wakeup_error_usecs;		/* of the current event */
+
+	/* Over the run: */
+	int num_events;
+	s64 max_run_delay_usecs;	/* most lost between two events */
+	s64 max_wakeup_error_usecs;
+	int num_host_induced;		/* timing errors we explained */
+	struct self_stall_sample first;	/* at the first event */
+};
+
+struct self_stall *self_stall_new(void)
+{
+	struct self_stall *stall = calloc(1, sizeof(*stall));
+	char path[64];
+
+	stall->tid = syscall(SYS_gettid);
+	snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat",
+		 stall->tid);
+	/* Kernels without CONFIG_SCHED_INFO have no schedstat; we then
+	 * go by preemptions and late wakeups alone.
+	 */
+	stall->schedstat_fd = open(path, O_RDONLY | O_CLOEXEC);
+	return stall;
+}
+
+void self_stall_free(struct self_stall *stall)
+{
+	if (stall == NULL)
+		return;
+	if (stall->schedstat_fd >= 0)
+		close(stall->schedstat_fd);
+	free(stall);
+}
+
+/* Return how long the thread has waited on a run queue, the second of
+ * the three numbers in its schedstat, in nanoseconds.
+ */
+static s64 read_run_delay_nsecs(const struct self_stall *stall)
+{
+	char buf[128];
+	unsigned long long run_nsecs, delay_nsecs;
+	ssize_t len;
+
+	if (stall->schedstat_fd < 0)
+		return 0;
+	len = pread(stall->schedstat_fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+	if (sscanf(buf, "%llu %llu", &run_nsecs, &delay_nsecs) != 2)
+		return 0;
+	return delay_nsecs;
+}
+
+void self_stall_sample(const struct self_stall *stall,
+		       struct self_stall_sample *sample)
+{
+	sample->run_delay_usecs = read_run_delay_nsecs(stall) / 1000;
+	sample->involuntary_switches = stall->cur.involuntary_switches;
+#ifdef RUSAGE_THREAD
+	if (syscall(SYS_gettid) == stall->tid) {
+		struct rusage usage;
+
+		if (getrusage(RUSAGE_THREAD, &usage) == 0)
+			sample->involuntary_switches = usage.ru_nivcsw;
+	}
+#endif
+}
+
+void self_stall_mark(struct self_stall *stall, s64 wakeup_error_usecs)
+{
+	s64 lost_usecs;
+
+	stall->prev = stall->cur;
+	self_stall_sample(stall, &stall->cur);
+	stall->wakeup_error_usecs = wakeup_error_usecs;
+
+	if (stall->num_events++ == 0) {
+		stall->first = stall->cur;
+		stall->prev = stall->cur;
+	}
+	lost_usecs = stall->cur.run_delay_usecs - stall->prev.run_delay_usecs;
+	if (lost_usecs > stall->max_run_delay_usecs)
+		stall->max_run_delay_usecs = lost_usecs;
+	if (wakeup_error_usecs > stall->max_wakeup_error_usecs)
+		stall->max_wakeup_error_usecs = wakeup_error_usecs;
+}
+
+bool self_stall_explains(struct self_stall *stall, s64 late_usecs,
+			 char **label)
+{
+	struct self_stall_sample now;
+	s64 delay_usecs, switches, stall_usecs;
+
+	if (late_usecs <= 0 || stall->num_events == 0)
+		return false;
+
+	/* Waiting for a CPU and waking up late overlap, as a late
+	 * wakeup is most often time spent on a run queue; either alone
+	 * is time we lost.
+	 */
+	self_stall_sample(stall, &now);
+	delay_usecs = now.run_delay_usecs - stall->prev.run_delay_usecs;
+	switches = now.involuntary_switches - stall->prev.involuntary_switches;
+	stall_usecs = max(delay_usecs, stall->wakeup_error_usecs);
+	if (stall_usecs < late_usecs)
+		return false;
+
+	stall->num_host_induced++;
+	asprintf(label, "host-induced: packetdrill lost %lld usecs since "
+		 "the previous event, more than the %lld usecs the event "
+		 "was late (%lld usecs waiting for a CPU, woke %lld usecs "
+		 "late, preempted %lld times)",
+		 stall_usecs, late_usecs, delay_usecs,
+		 stall->wakeup_error_usecs, switches);
+	return true;
+}
+
+void self_stall_report(const struct self_stall *stall, FILE *out)
+{
+	if (stall->num_events == 0)
+		return;
+	fprintf(out, "self stall: %d events, %lld usecs waiting for a CPU "
+		"(max %lld between events), %lld preemptions, "
+		"max wakeup error %lld usecs",
+		stall->num_events,
+		stall->cur.run_delay_usecs - stall->first.run_delay_usecs,
+		stall->max_run_delay_usecs,
+		stall->cur.involuntary_switches -
+		stall->first.involuntary_switches,
+		stall->max_wakeup_error_usecs);
+	if (stall->schedstat_fd < 0)
+		fprintf(out, " (no schedstat)");
+	fprintf(out, "\n");
+	if (stall->num_host_induced > 0)
+		fprintf(out, "self stall: %d timing errors were host-induced\n",
+			stall->num_host_induced);
+}
@@ -0,0 +1,74 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * For --self_stall, a heartbeat on packetdrill's own main thread, to
+ * tell a kernel that was late from a packetdrill that was kept from
+ * running. At the start of each event we note how long the thread has
+ * waited on a run queue so far (from its schedstat), how many times it
+ * was preempted (its involuntary context switches), and how much later
+ * than asked wait_for_event() woke up.
+ *
+ * When an event then misses its time, the time the thread lost since
+ * the event before it is weighed against how late the event was, and
+ * the timing error is labeled "host-induced" if the stall covers it:
+ * such failures say more about the test machine than about the kernel.
+ */
+
+#ifndef __SELF_STALL_H__
+#define __SELF_STALL_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+/* Counters of the main thread at one moment. */
+struct self_stall_sample {
+	s64 run_delay_usecs;		/* time spent runnable, not running */
+	s64 involuntary_switches;	/* times preempted */
+};
+
+struct self_stall;
+
+/* Start watching the calling thread, which must be the main thread. */
+extern struct self_stall *self_stall_new(void);
+extern void self_stall_free(struct self_stall *stall);
+
+/* Take a sample of the watched thread's counters. Run queue delay can
+ * be read from any thread; preemptions only from the watched one, and
+ * elsewhere are left as of the last mark.
+ */
+extern void self_stall_sample(const struct self_stall *stall,
+			      struct self_stall_sample *sample);
+
+/* Note the start of an event, for which wait_for_event() woke up
+ * wakeup_error_usecs later than asked.
+ */
+extern void self_stall_mark(struct self_stall *stall,
+			    s64 wakeup_error_usecs);
+
+/* Given that an event happened late_usecs later than its script time
+ * allows, return true, and set *label to say why, if packetdrill was
+ * itself kept from running for at least that long since the event
+ * before the current one.
+ */
+extern bool self_stall_explains(struct self_stall *stall, s64 late_usecs,
+				char **label);
+
+/* Print the stalls we saw over the run. */
+extern void self_stall_report(const struct self_stall *stall, FILE *out);
+
+#endif /* __SELF_STALL_H__ */
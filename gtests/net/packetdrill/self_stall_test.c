@@ -0,0 +1,87 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for self_stall.c.
+ */
+
+#include "self_stall.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Spin for the given time, long enough to be preempted now and then. */
+static void spin_usecs(s64 usecs)
+{
+	struct timespec start, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000000 +
+		 (now.tv_nsec - start.tv_nsec) / 1000 < usecs);
+}
+
+int main(void)
+{
+	struct self_stall *stall = self_stall_new();
+	struct self_stall_sample before, after;
+	char *label = NULL;
+	FILE *out = NULL;
+	char *report = NULL;
+	size_t report_len = 0;
+
+	/* Nothing is explained before the first event. */
+	assert(!self_stall_explains(stall, 1, &label));
+
+	/* The counters only go up. */
+	self_stall_sample(stall, &before);
+	spin_usecs(20000);
+	self_stall_sample(stall, &after);
+	assert(after.run_delay_usecs >= before.run_delay_usecs);
+	assert(after.involuntary_switches >= before.involuntary_switches);
+
+	/* A wakeup 5ms late explains an event up to 5ms late, but not
+	 * an early one or one a second late.
+	 */
+	self_stall_mark(stall, 0);
+	self_stall_mark(stall, 5000);
+	assert(!self_stall_explains(stall, -100, &label));
+	assert(!self_stall_explains(stall, 1000000, &label));
+	assert(self_stall_explains(stall, 4000, &label));
+	assert(strncmp(label, "host-induced: ", 14) == 0);
+	free(label);
+
+	/* The next event woke on time, and only what the thread lost
+	 * since the event before counts.
+	 */
+	self_stall_mark(stall, 0);
+	self_stall_mark(stall, 0);
+	assert(!self_stall_explains(stall, 1000000, &label));
+
+	out = open_memstream(&report, &report_len);
+	self_stall_report(stall, out);
+	fclose(out);
+	assert(strstr(report, "self stall: 4 events") != NULL);
+	assert(strstr(report, "max wakeup error 5000 usecs") != NULL);
+	assert(strstr(report, "1 timing errors were host-induced") != NULL);
+	free(report);
+
+	self_stall_free(stall);
+	return 0;
+}
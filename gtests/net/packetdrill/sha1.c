@@ -0,0 +1,654 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * SHA-1 and HMAC-SHA1 with runtime selection of the compression function.
+ * The portable backend is the kernel's lib/sha1.c sha_transform().
+ */
+
+#include "sha1.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unaligned.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HAVE_SHA1_SHANI 1
+#endif
+
+#if defined(linux) && defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define HAVE_SHA1_ARMV8 1
+#endif
+
+/* Portable C backend. */
+
+/*
+ * If you have 32 registers or more, the compiler can (and should)
+ * try to change the array[] accesses into registers. However, on
+ * machines with less than ~25 registers, that won't really work,
+ * and at least gcc will make an unholy mess of it.
+ *
+ * So to avoid that mess which just slows things down, we force
+ * the stores to memory to actually happen (we might be better off
+ * with a 'W(t)=(val);asm("":"+m" (W(t))' there instead, as
+ * suggested by Artur Skawina - that will also make gcc unable to
+ * try to do the silly "optimize away loads" part because it won't
+ * see what the value will be).
+ *
+ * Ben Herrenschmidt reports that on PPC, the C version comes close
+ * to the optimized asm with this (ie on PPC you don't want that
+ * 'volatile', since there are lots of registers).
+ *
+ * On ARM we get the best code generation by forcing a full memory barrier
+ * between each SHA_ROUND, otherwise gcc happily get wild with spilling and
+ * the stack frame size simply explode and performance goes down the drain.
+ */
+
+#ifdef CONFIG_X86
+  #define setW(x, val) (*(volatile __u32 *)&W(x) = (val))
+#elif defined(CONFIG_ARM)
+  #define setW(x, val) do { W(x) = (val); __asm__("":::"memory"); } while (0)
+#else
+  #define setW(x, val) (W(x) = (val))
+#endif
+
+/* This "rolls" over the 512-bit array */
+#define W(x) (array[(x)&15])
+
+/*
+ * Where do we get the source from? The first 16 iterations get it from
+ * the input data, the next mix it from the 512-bit array.
+ */
+#define SHA_SRC(t) get_unaligned_be32((__u32 *)data + t)
+#define SHA_MIX(t) rol32(W(t+13) ^ W(t+8) ^ W(t+2) ^ W(t), 1)
+
+/**
+ * rol32 - rotate a 32-bit value left
+ * @word: value to rotate
+ * @shift: bits to roll
+ */
+static inline __u32 rol32(__u32 word, unsigned int shift)
+{
+	return (word << shift) | (word >> (32 - shift));
+}
+
+/**
+ * ror32 - rotate a 32-bit value right
+ * @word: value to rotate
+ * @shift: bits to roll
+ */
+static inline __u32 ror32(__u32 word, unsigned int shift)
+{
+	return (word >> shift) | (word << (32 - shift));
+}
+
+
+#define SHA_ROUND(t, input, fn, constant, A, B, C, D, E) do { \
+	__u32 TEMP = input(t); setW(t, TEMP); \
+	E += TEMP + rol32(A,5) + (fn) + (constant); \
+	B = ror32(B, 2); } while (0)
+
+#define T_0_15(t, A, B, C, D, E)  SHA_ROUND(t, SHA_SRC, (((C^D)&B)^D) , 0x5a827999, A, B, C, D, E )
+#define T_16_19(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, (((C^D)&B)^D) , 0x5a827999, A, B, C, D, E )
+#define T_20_39(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, (B^C^D) , 0x6ed9eba1, A, B, C, D, E )
+#define T_40_59(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, ((B&C)+(D&(B^C))) , 0x8f1bbcdc, A, B, C, D, E )
+#define T_60_79(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, (B^C^D) ,  0xca62c1d6, A, B, C, D, E )
+
+/**
+ * sha_transform - single block SHA1 transform
+ *
+ * @digest: 160 bit digest to update
+ * @data:   512 bits of data to hash
+ * @array:  16 words of workspace (see note)
+ *
+ * This function generates a SHA1 digest for a single 512-bit block.
+ * Be warned, it does not handle padding and message digest, do not
+ * confuse it with the full FIPS 180-1 digest algorithm for variable
+ * length messages.
+ *
+ * Note: If the hash is security sensitive, the caller should be sure
+ * to clear the workspace. This is left to the caller to avoid
+ * unnecessary clears between chained hashing operations.
+ */
+static void sha_transform(__u32 *digest, const char *data, __u32 *array)
+{
+	__u32 A, B, C, D, E;
+
+	A = digest[0];
+	B = digest[1];
+	C = digest[2];
+	D = digest[3];
+	E = digest[4];
+
+	/* Round 1 - iterations 0-16 take their input from 'data' */
+	T_0_15( 0, A, B, C, D, E);
+	T_0_15( 1, E, A, B, C, D);
+	T_0_15( 2, D, E, A, B, C);
+	T_0_15( 3, C, D, E, A, B);
+	T_0_15( 4, B, C, D, E, A);
+	T_0_15( 5, A, B, C, D, E);
+	T_0_15( 6, E, A, B, C, D);
+	T_0_15( 7, D, E, A, B, C);
+	T_0_15( 8, C, D, E, A, B);
+	T_0_15( 9, B, C, D, E, A);
+	T_0_15(10, A, B, C, D, E);
+	T_0_15(11, E, A, B, C, D);
+	T_0_15(12, D, E, A, B, C);
+	T_0_15(13, C, D, E, A, B);
+	T_0_15(14, B, C, D, E, A);
+	T_0_15(15, A, B, C, D, E);
+
+	/* Round 1 - tail. Input from 512-bit mixing array */
+	T_16_19(16, E, A, B, C, D);
+	T_16_19(17, D, E, A, B, C);
+	T_16_19(18, C, D, E, A, B);
+	T_16_19(19, B, C, D, E, A);
+
+	/* Round 2 */
+	T_20_39(20, A, B, C, D, E);
+	T_20_39(21, E, A, B, C, D);
+	T_20_39(22, D, E, A, B, C);
+	T_20_39(23, C, D, E, A, B);
+	T_20_39(24, B, C, D, E, A);
+	T_20_39(25, A, B, C, D, E);
+	T_20_39(26, E, A, B, C, D);
+	T_20_39(27, D, E, A, B, C);
+	T_20_39(28, C, D, E, A, B);
+	T_20_39(29, B, C, D, E, A);
+	T_20_39(30, A, B, C, D, E);
+	T_20_39(31, E, A, B, C, D);
+	T_20_39(32, D, E, A, B, C);
+	T_20_39(33, C, D, E, A, B);
+	T_20_39(34, B, C, D, E, A);
+	T_20_39(35, A, B, C, D, E);
+	T_20_39(36, E, A, B, C, D);
+	T_20_39(37, D, E, A, B, C);
+	T_20_39(38, C, D, E, A, B);
+	T_20_39(39, B, C, D, E, A);
+
+	/* Round 3 */
+	T_40_59(40, A, B, C, D, E);
+	T_40_59(41, E, A, B, C, D);
+	T_40_59(42, D, E, A, B, C);
+	T_40_59(43, C, D, E, A, B);
+	T_40_59(44, B, C, D, E, A);
+	T_40_59(45, A, B, C, D, E);
+	T_40_59(46, E, A, B, C, D);
+	T_40_59(47, D, E, A, B, C);
+	T_40_59(48, C, D, E, A, B);
+	T_40_59(49, B, C, D, E, A);
+	T_40_59(50, A, B, C, D, E);
+	T_40_59(51, E, A, B, C, D);
+	T_40_59(52, D, E, A, B, C);
+	T_40_59(53, C, D, E, A, B);
+	T_40_59(54, B, C, D, E, A);
+	T_40_59(55, A, B, C, D, E);
+	T_40_59(56, E, A, B, C, D);
+	T_40_59(57, D, E, A, B, C);
+	T_40_59(58, C, D, E, A, B);
+	T_40_59(59, B, C, D, E, A);
+
+	/* Round 4 */
+	T_60_79(60, A, B, C, D, E);
+	T_60_79(61, E, A, B, C, D);
+	T_60_79(62, D, E, A, B, C);
+	T_60_79(63, C, D, E, A, B);
+	T_60_79(64, B, C, D, E, A);
+	T_60_79(65, A, B, C, D, E);
+	T_60_79(66, E, A, B, C, D);
+	T_60_79(67, D, E, A, B, C);
+	T_60_79(68, C, D, E, A, B);
+	T_60_79(69, B, C, D, E, A);
+	T_60_79(70, A, B, C, D, E);
+	T_60_79(71, E, A, B, C, D);
+	T_60_79(72, D, E, A, B, C);
+	T_60_79(73, C, D, E, A, B);
+	T_60_79(74, B, C, D, E, A);
+	T_60_79(75, A, B, C, D, E);
+	T_60_79(76, E, A, B, C, D);
+	T_60_79(77, D, E, A, B, C);
+	T_60_79(78, C, D, E, A, B);
+	T_60_79(79, B, C, D, E, A);
+
+	digest[0] += A;
+	digest[1] += B;
+	digest[2] += C;
+	digest[3] += D;
+	digest[4] += E;
+}
+
+
+static void sha1_transform_generic(u32 *state, const u8 *data,
+				   int num_blocks)
+{
+	__u32 workspace[16];
+
+	for (; num_blocks > 0; num_blocks--, data += SHA1_BLOCK_BYTES)
+		sha_transform(state, (const char *)data, workspace);
+	memset(workspace, 0, sizeof(workspace));
+}
+
+static bool sha1_generic_available(void)
+{
+	return true;
+}
+
+static const struct sha1_backend sha1_generic = {
+	.name		= "generic",
+	.available	= sha1_generic_available,
+	.transform	= sha1_transform_generic,
+};
+
+#ifdef HAVE_SHA1_SHANI
+
+/* x86 SHA extensions backend. The state is kept as ABCD in one register,
+ * most significant word first, and E in the top word of another. Each
+ * SHA1RNDS4 runs 4 rounds; message words for rounds 16-79 are expanded
+ * with SHA1MSG1/SHA1MSG2 four at a time, rotating through MSG[0..3].
+ */
+
+/* Rounds 4*i to 4*i+3, for i in 1..19; f selects the round function. */
+#define SHANI_4ROUNDS(i, f, e_cur, e_next) do {				\
+	e_cur = _mm_sha1nexte_epu32(e_cur, msg[(i) % 4]);		\
+	e_next = abcd;							\
+	if ((i) >= 3 && (i) <= 18)					\
+		msg[((i) + 1) % 4] = _mm_sha1msg2_epu32(		\
+			msg[((i) + 1) % 4], msg[(i) % 4]);		\
+	abcd = _mm_sha1rnds4_epu32(abcd, e_cur, f);			\
+	if ((i) <= 16)							\
+		msg[((i) + 3) % 4] = _mm_sha1msg1_epu32(		\
+			msg[((i) + 3) % 4], msg[(i) % 4]);		\
+	if ((i) >= 2 && (i) <= 17)					\
+		msg[((i) + 2) % 4] = _mm_xor_si128(			\
+			msg[((i) + 2) % 4], msg[(i) % 4]);		\
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_transform_shani(u32 *state, const u8 *data, int num_blocks)
+{
+	const __m128i byte_swap = _mm_set_epi64x(0x0001020304050607ULL,
+						 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1, msg[4];
+	int i;
+
+	abcd = _mm_loadu_si128((const __m128i *)state);
+	abcd = _mm_shuffle_epi32(abcd, 0x1B);
+	e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	for (; num_blocks > 0; num_blocks--, data += SHA1_BLOCK_BYTES) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		for (i = 0; i < 4; i++)
+			msg[i] = _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i *)(data + 16*i)),
+				byte_swap);
+
+		/* Rounds 0-3 */
+		e0 = _mm_add_epi32(e0, msg[0]);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		SHANI_4ROUNDS(1, 0, e1, e0);
+		SHANI_4ROUNDS(2, 0, e0, e1);
+		SHANI_4ROUNDS(3, 0, e1, e0);
+		SHANI_4ROUNDS(4, 0, e0, e1);
+		SHANI_4ROUNDS(5, 1, e1, e0);
+		SHANI_4ROUNDS(6, 1, e0, e1);
+		SHANI_4ROUNDS(7, 1, e1, e0);
+		SHANI_4ROUNDS(8, 1, e0, e1);
+		SHANI_4ROUNDS(9, 1, e1, e0);
+		SHANI_4ROUNDS(10, 2, e0, e1);
+		SHANI_4ROUNDS(11, 2, e1, e0);
+		SHANI_4ROUNDS(12, 2, e0, e1);
+		SHANI_4ROUNDS(13, 2, e1, e0);
+		SHANI_4ROUNDS(14, 2, e0, e1);
+		SHANI_4ROUNDS(15, 3, e1, e0);
+		SHANI_4ROUNDS(16, 3, e0, e1);
+		SHANI_4ROUNDS(17, 3, e1, e0);
+		SHANI_4ROUNDS(18, 3, e0, e1);
+		SHANI_4ROUNDS(19, 3, e1, e0);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1B);
+	_mm_storeu_si128((__m128i *)state, abcd);
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+
+static bool sha1_shani_available(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1))
+		return false;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return false;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx & bit_SHA) != 0;
+}
+
+static const struct sha1_backend sha1_shani = {
+	.name		= "sha-ni",
+	.available	= sha1_shani_available,
+	.transform	= sha1_transform_shani,
+};
+
+#endif /* HAVE_SHA1_SHANI */
+
+#ifdef HAVE_SHA1_ARMV8
+
+/* ARMv8 crypto extensions backend. SHA1C/SHA1P/SHA1M each run 4 rounds
+ * with the round constant pre-added to the message words (tmp[]); the
+ * schedule is expanded with SHA1SU0/SHA1SU1 four words at a time.
+ */
+
+/* Rounds 4*i to 4*i+3, for i in 0..19. */
+#define ARMV8_4ROUNDS(i, op, e_cur, e_next) do {			\
+	e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));			\
+	abcd = op(abcd, e_cur, tmp[(i) % 2]);				\
+	if ((i) <= 17)							\
+		tmp[(i) % 2] = vaddq_u32(msg[((i) + 2) % 4],		\
+					 vdupq_n_u32(k[((i) + 2) / 5]));\
+	if ((i) >= 1 && (i) <= 16)					\
+		msg[((i) + 3) % 4] = vsha1su1q_u32(			\
+			msg[((i) + 3) % 4], msg[((i) + 2) % 4]);	\
+	if ((i) <= 15)							\
+		msg[(i) % 4] = vsha1su0q_u32(msg[(i) % 4],		\
+			msg[((i) + 1) % 4], msg[((i) + 2) % 4]);	\
+} while (0)
+
+__attribute__((target("+crypto")))
+static void sha1_transform_armv8(u32 *state, const u8 *data, int num_blocks)
+{
+	static const u32 k[4] = {
+		0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6
+	};
+	uint32x4_t abcd, abcd_save, msg[4], tmp[2];
+	u32 e0, e0_save, e1;
+	int i;
+
+	abcd = vld1q_u32(state);
+	e0 = state[4];
+
+	for (; num_blocks > 0; num_blocks--, data += SHA1_BLOCK_BYTES) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		for (i = 0; i < 4; i++)
+			msg[i] = vreinterpretq_u32_u8(
+				vrev32q_u8(vld1q_u8(data + 16*i)));
+		tmp[0] = vaddq_u32(msg[0], vdupq_n_u32(k[0]));
+		tmp[1] = vaddq_u32(msg[1], vdupq_n_u32(k[0]));
+
+		ARMV8_4ROUNDS(0, vsha1cq_u32, e0, e1);
+		ARMV8_4ROUNDS(1, vsha1cq_u32, e1, e0);
+		ARMV8_4ROUNDS(2, vsha1cq_u32, e0, e1);
+		ARMV8_4ROUNDS(3, vsha1cq_u32, e1, e0);
+		ARMV8_4ROUNDS(4, vsha1cq_u32, e0, e1);
+		ARMV8_4ROUNDS(5, vsha1pq_u32, e1, e0);
+		ARMV8_4ROUNDS(6, vsha1pq_u32, e0, e1);
+		ARMV8_4ROUNDS(7, vsha1pq_u32, e1, e0);
+		ARMV8_4ROUNDS(8, vsha1pq_u32, e0, e1);
+		ARMV8_4ROUNDS(9, vsha1pq_u32, e1, e0);
+		ARMV8_4ROUNDS(10, vsha1mq_u32, e0, e1);
+		ARMV8_4ROUNDS(11, vsha1mq_u32, e1, e0);
+		ARMV8_4ROUNDS(12, vsha1mq_u32, e0, e1);
+		ARMV8_4ROUNDS(13, vsha1mq_u32, e1, e0);
+		ARMV8_4ROUNDS(14, vsha1mq_u32, e0, e1);
+		ARMV8_4ROUNDS(15, vsha1pq_u32, e1, e0);
+		ARMV8_4ROUNDS(16, vsha1pq_u32, e0, e1);
+		ARMV8_4ROUNDS(17, vsha1pq_u32, e1, e0);
+		ARMV8_4ROUNDS(18, vsha1pq_u32, e0, e1);
+		ARMV8_4ROUNDS(19, vsha1pq_u32, e1, e0);
+
+		e0 += e0_save;
+		abcd = vaddq_u32(abcd, abcd_save);
+	}
+
+	vst1q_u32(state, abcd);
+	state[4] = e0;
+}
+
+static bool sha1_armv8_available(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+}
+
+static const struct sha1_backend sha1_armv8 = {
+	.name		= "armv8",
+	.available	= sha1_armv8_available,
+	.transform	= sha1_transform_armv8,
+};
+
+#endif /* HAVE_SHA1_ARMV8 */
+
+const struct sha1_backend *sha1_backends[] = {
+#ifdef HAVE_SHA1_SHANI
+	&sha1_shani,
+#endif
+#ifdef HAVE_SHA1_ARMV8
+	&sha1_armv8,
+#endif
+	&sha1_generic,
+	NULL,
+};
+
+/* Backend selection. The wire server hashes from one thread per client,
+ * so the automatic pick is done under pthread_once().
+ */
+static const struct sha1_backend *sha1_current;
+static pthread_once_t sha1_auto_once = PTHREAD_ONCE_INIT;
+
+static const struct sha1_backend *sha1_backend_auto(void)
+{
+	int i;
+
+	for (i = 0; sha1_backends[i] != NULL; i++) {
+		if (sha1_backends[i]->available())
+			return sha1_backends[i];
+	}
+	return &sha1_generic;
+}
+
+static void sha1_backend_auto_init(void)
+{
+	if (sha1_current == NULL)
+		sha1_current = sha1_backend_auto();
+}
+
+const struct sha1_backend *sha1_backend_get(void)
+{
+	pthread_once(&sha1_auto_once, sha1_backend_auto_init);
+	return sha1_current;
+}
+
+int sha1_backend_set(const char *name, char **error)
+{
+	int i;
+
+	if (strcmp(name, "auto") == 0) {
+		sha1_current = sha1_backend_auto();
+		return STATUS_OK;
+	}
+	for (i = 0; sha1_backends[i] != NULL; i++) {
+		if (strcmp(name, sha1_backends[i]->name) != 0)
+			continue;
+		if (!sha1_backends[i]->available()) {
+			asprintf(error, "SHA-1 backend %s not supported by CPU",
+				 name);
+			return STATUS_ERR;
+		}
+		sha1_current = sha1_backends[i];
+		return STATUS_OK;
+	}
+	asprintf(error, "unknown SHA-1 backend: %s", name);
+	return STATUS_ERR;
+}
+
+/* Digest computation. */
+
+void sha1_init(struct sha1_ctx *ctx, const struct sha1_backend *backend)
+{
+	ctx->backend = backend ? backend : sha1_backend_get();
+	ctx->state[0] = 0x67452301;
+	ctx->state[1] = 0xefcdab89;
+	ctx->state[2] = 0x98badcfe;
+	ctx->state[3] = 0x10325476;
+	ctx->state[4] = 0xc3d2e1f0;
+	ctx->bytes = 0;
+}
+
+void sha1_update(struct sha1_ctx *ctx, const void *data, size_t len)
+{
+	const u8 *p = data;
+	size_t used = ctx->bytes % SHA1_BLOCK_BYTES;
+	size_t blocks;
+
+	ctx->bytes += len;
+
+	/* Complete a buffered partial block first. */
+	if (used > 0) {
+		size_t fill = SHA1_BLOCK_BYTES - used;
+
+		if (len < fill) {
+			memcpy(ctx->buffer + used, p, len);
+			return;
+		}
+		memcpy(ctx->buffer + used, p, fill);
+		ctx->backend->transform(ctx->state, ctx->buffer, 1);
+		p += fill;
+		len -= fill;
+	}
+
+	/* Hash whole blocks in place. */
+	blocks = len / SHA1_BLOCK_BYTES;
+	if (blocks > 0) {
+		ctx->backend->transform(ctx->state, p, blocks);
+		p += blocks * SHA1_BLOCK_BYTES;
+		len -= blocks * SHA1_BLOCK_BYTES;
+	}
+
+	memcpy(ctx->buffer, p, len);
+}
+
+void sha1_final(struct sha1_ctx *ctx, u8 *digest)
+{
+	size_t used = ctx->bytes % SHA1_BLOCK_BYTES;
+	u64 bits = ctx->bytes * 8;
+	int i;
+
+	/* Pad with 0x80, zeros, and the big-endian bit length. */
+	ctx->buffer[used++] = 0x80;
+	if (used > SHA1_BLOCK_BYTES - sizeof(bits)) {
+		memset(ctx->buffer + used, 0, SHA1_BLOCK_BYTES - used);
+		ctx->backend->transform(ctx->state, ctx->buffer, 1);
+		used = 0;
+	}
+	memset(ctx->buffer + used, 0, SHA1_BLOCK_BYTES - sizeof(bits) - used);
+	for (i = 0; i < sizeof(bits); i++)
+		ctx->buffer[SHA1_BLOCK_BYTES - 1 - i] = bits >> (8 * i);
+	ctx->backend->transform(ctx->state, ctx->buffer, 1);
+
+	for (i = 0; i < SHA1_DIGEST_WORDS; i++)
+		put_unaligned_be32(ctx->state[i], digest + 4*i);
+
+	memset(ctx, 0, sizeof(*ctx));	/* don't leave key material around */
+}
+
+void sha1_digest(const void *data, size_t len, u8 *digest)
+{
+	struct sha1_ctx ctx;
+
+	sha1_init(&ctx, NULL);
+	sha1_update(&ctx, data, len);
+	sha1_final(&ctx, digest);
+}
+
+void sha1_hmac_key_init(struct sha1_hmac_key *hkey,
+			const struct sha1_backend *backend,
+			const u8 *key, size_t key_len)
+{
+	u8 pad[SHA1_BLOCK_BYTES];
+	u8 key_digest[SHA1_DIGEST_BYTES];
+	struct sha1_ctx ctx;
+	int i;
+
+	if (backend == NULL)
+		backend = sha1_backend_get();
+
+	/* Keys longer than a block are replaced by their digest. */
+	if (key_len > SHA1_BLOCK_BYTES) {
+		sha1_init(&ctx, backend);
+		sha1_update(&ctx, key, key_len);
+		sha1_final(&ctx, key_digest);
+		key = key_digest;
+		key_len = SHA1_DIGEST_BYTES;
+	}
+
+	memset(pad, 0x36, sizeof(pad));
+	for (i = 0; i < key_len; i++)
+		pad[i] ^= key[i];
+	sha1_init(&hkey->inner, backend);
+	sha1_update(&hkey->inner, pad, sizeof(pad));
+
+	memset(pad, 0x5c, sizeof(pad));
+	for (i = 0; i < key_len; i++)
+		pad[i] ^= key[i];
+	sha1_init(&hkey->outer, backend);
+	sha1_update(&hkey->outer, pad, sizeof(pad));
+
+	memset(pad, 0, sizeof(pad));
+	memset(key_digest, 0, sizeof(key_digest));
+}
+
+void sha1_hmac_keyed(const struct sha1_hmac_key *hkey,
+		     const void *data, size_t data_len, u8 *digest)
+{
+	u8 inner[SHA1_DIGEST_BYTES];
+	struct sha1_ctx ctx;
+
+	ctx = hkey->inner;
+	sha1_update(&ctx, data, data_len);
+	sha1_final(&ctx, inner);
+
+	ctx = hkey->outer;
+	sha1_update(&ctx, inner, sizeof(inner));
+	sha1_final(&ctx, digest);
+
+	memset(inner, 0, sizeof(inner));
+	memset(&ctx, 0, sizeof(ctx));
+}
+
+void sha1_hmac(const struct sha1_backend *backend,
+	       const u8 *key, size_t key_len,
+	       const void *data, size_t data_len, u8 *digest)
+{
+	struct sha1_hmac_key hkey;
+
+	sha1_hmac_key_init(&hkey, backend, key, key_len);
+	sha1_hmac_keyed(&hkey, data, data_len, digest);
+	memset(&hkey, 0, sizeof(hkey));
+}
@@ -0,0 +1,157 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Microbenchmark of the SHA-1 backends in sha1.c, with OpenSSL as a
+ * reference, on the operations packetdrill's MPTCP support performs:
+ * hashing an 8-byte key (tokens and IDSNs), the MP_JOIN HMAC of a
+ * 16-byte key over two nonces, and a bulk digest for raw throughput.
+ *
+ * Usage: sha1_bench [iterations]
+ */
+
+#include "sha1.h"
+
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BULK_BYTES	65536
+
+static const struct sha1_backend *bench_backend;
+static u8 bench_key[16] = "0123456789abcdef";
+static u8 bench_msg[8] = "nonces!";
+static u8 *bench_bulk;
+
+static void key_digest_backend(u8 *digest)
+{
+	struct sha1_ctx ctx;
+
+	sha1_init(&ctx, bench_backend);
+	sha1_update(&ctx, bench_key, 8);
+	sha1_final(&ctx, digest);
+}
+
+static void join_hmac_backend(u8 *digest)
+{
+	sha1_hmac(bench_backend, bench_key, sizeof(bench_key),
+		  bench_msg, sizeof(bench_msg), digest);
+}
+
+static void bulk_backend(u8 *digest)
+{
+	struct sha1_ctx ctx;
+
+	sha1_init(&ctx, bench_backend);
+	sha1_update(&ctx, bench_bulk, BULK_BYTES);
+	sha1_final(&ctx, digest);
+}
+
+static void key_digest_openssl(u8 *digest)
+{
+	SHA1(bench_key, 8, digest);
+}
+
+static void join_hmac_openssl(u8 *digest)
+{
+	unsigned int len = SHA1_DIGEST_BYTES;
+
+	HMAC(EVP_sha1(), bench_key, sizeof(bench_key),
+	     bench_msg, sizeof(bench_msg), digest, &len);
+}
+
+static void bulk_openssl(u8 *digest)
+{
+	SHA1(bench_bulk, BULK_BYTES, digest);
+}
+
+static s64 now_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Run op iterations times; print ns/op, and fail if the digest differs
+ * from the one the reference implementation computed.
+ */
+static void bench(const char *impl, const char *op_name,
+		  void (*op)(u8 *digest), long iterations,
+		  const u8 *reference)
+{
+	u8 digest[SHA1_DIGEST_BYTES];
+	s64 start;
+	long i;
+
+	op(digest);
+	if (reference && memcmp(digest, reference, SHA1_DIGEST_BYTES) != 0) {
+		fprintf(stderr, "%s: %s digest mismatch\n", impl, op_name);
+		exit(EXIT_FAILURE);
+	}
+
+	start = now_nsecs();
+	for (i = 0; i < iterations; i++)
+		op(digest);
+	printf("%-10s %-12s %10.1f ns/op\n", impl, op_name,
+	       (double)(now_nsecs() - start) / iterations);
+}
+
+int main(int argc, char *argv[])
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+	u8 ref_key[SHA1_DIGEST_BYTES], ref_join[SHA1_DIGEST_BYTES];
+	u8 ref_bulk[SHA1_DIGEST_BYTES];
+	int i;
+
+	if (iterations <= 0) {
+		fprintf(stderr, "usage: sha1_bench [iterations]\n");
+		return EXIT_FAILURE;
+	}
+
+	bench_bulk = malloc(BULK_BYTES);
+	for (i = 0; i < BULK_BYTES; i++)
+		bench_bulk[i] = i;
+
+	key_digest_openssl(ref_key);
+	join_hmac_openssl(ref_join);
+	bulk_openssl(ref_bulk);
+
+	bench("openssl", "key_digest", key_digest_openssl, iterations, NULL);
+	bench("openssl", "join_hmac", join_hmac_openssl, iterations, NULL);
+	bench("openssl", "bulk_64k", bulk_openssl,
+	      iterations / 1000 + 1, NULL);
+
+	for (i = 0; sha1_backends[i] != NULL; i++) {
+		bench_backend = sha1_backends[i];
+		if (!bench_backend->available()) {
+			printf("%-10s not supported by this CPU\n",
+			       bench_backend->name);
+			continue;
+		}
+		bench(bench_backend->name, "key_digest", key_digest_backend,
+		      iterations, ref_key);
+		bench(bench_backend->name, "join_hmac", join_hmac_backend,
+		      iterations, ref_join);
+		bench(bench_backend->name, "bulk_64k", bulk_backend,
+		      iterations / 1000 + 1, ref_bulk);
+	}
+
+	free(bench_bulk);
+	return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for sha1.c: every backend the CPU supports is checked
+ * against the FIPS 180-1 and RFC 2202 test vectors.
+ */
+
+#include "sha1.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+
+/* Parse a hex digest string. */
+static void from_hex(const char *hex, u8 *out)
+{
+	int i;
+
+	for (i = 0; i < SHA1_DIGEST_BYTES; i++) {
+		char byte[3] = { hex[2*i], hex[2*i + 1], '\0' };
+		out[i] = strtoul(byte, NULL, 16);
+	}
+}
+
+static void check_digest(const struct sha1_backend *backend,
+			 const void *data, size_t len, const char *hex)
+{
+	struct sha1_ctx ctx;
+	u8 expected[SHA1_DIGEST_BYTES], digest[SHA1_DIGEST_BYTES];
+	const u8 *p = data;
+	size_t i;
+
+	from_hex(hex, expected);
+
+	sha1_init(&ctx, backend);
+	sha1_update(&ctx, data, len);
+	sha1_final(&ctx, digest);
+	assert(memcmp(digest, expected, SHA1_DIGEST_BYTES) == 0);
+
+	/* Same in odd-sized pieces, to exercise partial blocks. */
+	sha1_init(&ctx, backend);
+	for (i = 0; i < len; i += 7)
+		sha1_update(&ctx, p + i, len - i < 7 ? len - i : 7);
+	sha1_final(&ctx, digest);
+	assert(memcmp(digest, expected, SHA1_DIGEST_BYTES) == 0);
+}
+
+static void test_sha1(const struct sha1_backend *backend)
+{
+	char *million_a = malloc(1000000);
+
+	check_digest(backend, "", 0,
+		     "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+	check_digest(backend, "abc", 3,
+		     "a9993e364706816aba3e25717850c26c9cd0d89d");
+	check_digest(backend,
+		     "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+		     56, "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+	memset(million_a, 'a', 1000000);
+	check_digest(backend, million_a, 1000000,
+		     "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+	free(million_a);
+}
+
+static void check_hmac(const struct sha1_backend *backend,
+		       const u8 *key, size_t key_len,
+		       const char *data, const char *hex)
+{
+	u8 expected[SHA1_DIGEST_BYTES], digest[SHA1_DIGEST_BYTES];
+
+	from_hex(hex, expected);
+	sha1_hmac(backend, key, key_len, data, strlen(data), digest);
+	assert(memcmp(digest, expected, SHA1_DIGEST_BYTES) == 0);
+}
+
+static void test_hmac(const struct sha1_backend *backend)
+{
+	u8 key[80];
+
+	memset(key, 0x0b, 20);
+	check_hmac(backend, key, 20, "Hi There",
+		   "b617318655057264e28bc0b6fb378c8ef146be00");
+	check_hmac(backend, (const u8 *)"Jefe", 4,
+		   "what do ya want for nothing?",
+		   "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79");
+	memset(key, 0xaa, 80);
+	check_hmac(backend, key, 80,
+		   "Test Using Larger Than Block-Size Key - Hash Key First",
+		   "aa4ae5e15272d00e95705637ce8a3b55ed402112");
+}
+
+/* The hand-padded MP_JOIN HMAC in utils.c must match the generic one. */
+static void test_mptcp_hmac(void)
+{
+	u64 key_1 = 0x0123456789abcdefULL, key_2 = 0xfedcba9876543210ULL;
+	u32 rand_1 = 0x11223344, rand_2 = 0x55667788;
+	u8 key[16], msg[8], expected[SHA1_DIGEST_BYTES];
+	u32 hash[SHA1_DIGEST_WORDS];
+
+	memcpy(key, &key_1, 8);
+	memcpy(key + 8, &key_2, 8);
+	memcpy(msg, &rand_1, 4);
+	memcpy(msg + 4, &rand_2, 4);
+	sha1_hmac(NULL, key, sizeof(key), msg, sizeof(msg), expected);
+
+	mptcp_hmac_sha1((u8 *)&key_1, (u8 *)&key_2,
+			(u8 *)&rand_1, (u8 *)&rand_2, hash);
+	assert(memcmp(hash, expected, SHA1_DIGEST_BYTES) == 0);
+}
+
+/* A prepared key gives the same HMACs, message after message. */
+static void test_hmac_keyed(void)
+{
+	u64 key_1 = 0x0123456789abcdefULL, key_2 = 0xfedcba9876543210ULL;
+	u8 expected[MPTCP_HMAC_MAX_BYTES], hmac[MPTCP_HMAC_MAX_BYTES];
+	struct mptcp_hmac_key hkey;
+	u32 rand_1, rand_2 = 0x55667788;
+
+	mptcp_hmac_key_init(&hkey, MPTCP_V0, key_1, key_2);
+	for (rand_1 = 0; rand_1 < 4; rand_1++) {
+		mptcp_hmac(MPTCP_V0, (u8 *)&key_1, (u8 *)&key_2,
+			   (u8 *)&rand_1, (u8 *)&rand_2, expected);
+		mptcp_hmac_keyed(&hkey, rand_1, rand_2, hmac);
+		assert(memcmp(hmac, expected, SHA1_DIGEST_BYTES) == 0);
+	}
+}
+
+int main(void)
+{
+	char *error = NULL;
+	int i;
+
+	for (i = 0; sha1_backends[i] != NULL; i++) {
+		if (!sha1_backends[i]->available())
+			continue;
+		test_sha1(sha1_backends[i]);
+		test_hmac(sha1_backends[i]);
+		assert(sha1_backend_set(sha1_backends[i]->name, &error) ==
+		       STATUS_OK);
+		test_mptcp_hmac();
+		test_hmac_keyed();
+	}
+	assert(sha1_backend_set("auto", &error) == STATUS_OK);
+	assert(sha1_backend_set("no-such-backend", &error) == STATUS_ERR);
+	free(error);
+	return 0;
+}
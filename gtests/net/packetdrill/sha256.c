@@ -0,0 +1,480 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * SHA-256 and HMAC-SHA256 with runtime selection of the compression
+ * function, laid out like sha1.c.
+ */
+
+#include "sha256.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unaligned.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HAVE_SHA256_SHANI 1
+#endif
+
+#if defined(linux) && defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define HAVE_SHA256_ARMV8 1
+#endif
+
+/* Round constants (FIPS 180-4 section 4.2.2). */
+static const u32 sha256_k[64] __attribute__((aligned(16))) = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/* Portable C backend. */
+
+static inline u32 ror32(u32 word, unsigned int shift)
+{
+	return (word >> shift) | (word << (32 - shift));
+}
+
+#define CH(x, y, z)	(((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z)	(((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SIGMA0(x)	(ror32(x, 2) ^ ror32(x, 13) ^ ror32(x, 22))
+#define SIGMA1(x)	(ror32(x, 6) ^ ror32(x, 11) ^ ror32(x, 25))
+#define SIG0(x)		(ror32(x, 7) ^ ror32(x, 18) ^ ((x) >> 3))
+#define SIG1(x)		(ror32(x, 17) ^ ror32(x, 19) ^ ((x) >> 10))
+
+static void sha256_transform_generic(u32 *state, const u8 *data,
+				     int num_blocks)
+{
+	u32 w[64];
+	u32 a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	for (; num_blocks > 0; num_blocks--, data += SHA256_BLOCK_BYTES) {
+		for (i = 0; i < 16; i++)
+			w[i] = get_unaligned_be32((const u32 *)data + i);
+		for (i = 16; i < 64; i++)
+			w[i] = SIG1(w[i-2]) + w[i-7] + SIG0(w[i-15]) + w[i-16];
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		f = state[5];
+		g = state[6];
+		h = state[7];
+
+		for (i = 0; i < 64; i++) {
+			t1 = h + SIGMA1(e) + CH(e, f, g) + sha256_k[i] + w[i];
+			t2 = SIGMA0(a) + MAJ(a, b, c);
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+	memset(w, 0, sizeof(w));
+}
+
+static bool sha256_generic_available(void)
+{
+	return true;
+}
+
+static const struct sha256_backend sha256_generic = {
+	.name		= "generic",
+	.available	= sha256_generic_available,
+	.transform	= sha256_transform_generic,
+};
+
+#ifdef HAVE_SHA256_SHANI
+
+/* x86 SHA extensions backend. SHA256RNDS2 wants the state as ABEF and
+ * CDGH, so it is shuffled into that form around each run of blocks.
+ * Each step runs 4 rounds as two SHA256RNDS2; message words for rounds
+ * 16-63 are expanded with SHA256MSG1/SHA256MSG2 four at a time, rotating
+ * through msg[0..3].
+ */
+__attribute__((target("sha,sse4.1")))
+static void sha256_transform_shani(u32 *state, const u8 *data,
+				   int num_blocks)
+{
+	const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+						 0x0405060700010203ULL);
+	__m128i abef, cdgh, abef_save, cdgh_save, tmp, wk, msg[4];
+	int i;
+
+	tmp = _mm_loadu_si128((const __m128i *)&state[0]);	/* DCBA */
+	cdgh = _mm_loadu_si128((const __m128i *)&state[4]);	/* HGFE */
+	tmp = _mm_shuffle_epi32(tmp, 0xB1);			/* CDAB */
+	cdgh = _mm_shuffle_epi32(cdgh, 0x1B);			/* EFGH */
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);			/* ABEF */
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);		/* CDGH */
+
+	for (; num_blocks > 0; num_blocks--, data += SHA256_BLOCK_BYTES) {
+		abef_save = abef;
+		cdgh_save = cdgh;
+
+		for (i = 0; i < 16; i++) {
+			if (i < 4) {
+				msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+					(const __m128i *)(data + 16*i)),
+					byte_swap);
+			} else {
+				tmp = _mm_sha256msg1_epu32(msg[i % 4],
+							   msg[(i + 1) % 4]);
+				tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(
+					msg[(i + 3) % 4], msg[(i + 2) % 4], 4));
+				msg[i % 4] = _mm_sha256msg2_epu32(
+					tmp, msg[(i + 3) % 4]);
+			}
+			wk = _mm_add_epi32(msg[i % 4], _mm_load_si128(
+				(const __m128i *)&sha256_k[4*i]));
+			cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+			wk = _mm_shuffle_epi32(wk, 0x0E);
+			abef = _mm_sha256rnds2_epu32(abef, cdgh, wk);
+		}
+
+		abef = _mm_add_epi32(abef, abef_save);
+		cdgh = _mm_add_epi32(cdgh, cdgh_save);
+	}
+
+	tmp = _mm_shuffle_epi32(abef, 0x1B);			/* FEBA */
+	cdgh = _mm_shuffle_epi32(cdgh, 0xB1);			/* DCHG */
+	abef = _mm_blend_epi16(tmp, cdgh, 0xF0);		/* DCBA */
+	cdgh = _mm_alignr_epi8(cdgh, tmp, 8);			/* HGFE */
+	_mm_storeu_si128((__m128i *)&state[0], abef);
+	_mm_storeu_si128((__m128i *)&state[4], cdgh);
+}
+
+static bool sha256_shani_available(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1))
+		return false;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return false;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx & bit_SHA) != 0;
+}
+
+static const struct sha256_backend sha256_shani = {
+	.name		= "sha-ni",
+	.available	= sha256_shani_available,
+	.transform	= sha256_transform_shani,
+};
+
+#endif /* HAVE_SHA256_SHANI */
+
+#ifdef HAVE_SHA256_ARMV8
+
+/* ARMv8 crypto extensions backend. SHA256H/SHA256H2 each run 4 rounds
+ * on half of the state; the schedule is expanded with
+ * SHA256SU0/SHA256SU1 four words at a time.
+ */
+__attribute__((target("+crypto")))
+static void sha256_transform_armv8(u32 *state, const u8 *data,
+				   int num_blocks)
+{
+	uint32x4_t abcd, efgh, abcd_save, efgh_save, tmp, wk, msg[4];
+	int i;
+
+	abcd = vld1q_u32(&state[0]);
+	efgh = vld1q_u32(&state[4]);
+
+	for (; num_blocks > 0; num_blocks--, data += SHA256_BLOCK_BYTES) {
+		abcd_save = abcd;
+		efgh_save = efgh;
+
+		for (i = 0; i < 16; i++) {
+			if (i < 4)
+				msg[i] = vreinterpretq_u32_u8(
+					vrev32q_u8(vld1q_u8(data + 16*i)));
+			else
+				msg[i % 4] = vsha256su1q_u32(
+					vsha256su0q_u32(msg[i % 4],
+							msg[(i + 1) % 4]),
+					msg[(i + 2) % 4], msg[(i + 3) % 4]);
+			wk = vaddq_u32(msg[i % 4], vld1q_u32(&sha256_k[4*i]));
+			tmp = abcd;
+			abcd = vsha256hq_u32(abcd, efgh, wk);
+			efgh = vsha256h2q_u32(efgh, tmp, wk);
+		}
+
+		abcd = vaddq_u32(abcd, abcd_save);
+		efgh = vaddq_u32(efgh, efgh_save);
+	}
+
+	vst1q_u32(&state[0], abcd);
+	vst1q_u32(&state[4], efgh);
+}
+
+static bool sha256_armv8_available(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+}
+
+static const struct sha256_backend sha256_armv8 = {
+	.name		= "armv8",
+	.available	= sha256_armv8_available,
+	.transform	= sha256_transform_armv8,
+};
+
+#endif /* HAVE_SHA256_ARMV8 */
+
+const struct sha256_backend *sha256_backends[] = {
+#ifdef HAVE_SHA256_SHANI
+	&sha256_shani,
+#endif
+#ifdef HAVE_SHA256_ARMV8
+	&sha256_armv8,
+#endif
+	&sha256_generic,
+	NULL,
+};
+
+/* Backend selection, under pthread_once() as in sha1.c. */
+static const struct sha256_backend *sha256_current;
+static pthread_once_t sha256_auto_once = PTHREAD_ONCE_INIT;
+
+static const struct sha256_backend *sha256_backend_auto(void)
+{
+	int i;
+
+	for (i = 0; sha256_backends[i] != NULL; i++) {
+		if (sha256_backends[i]->available())
+			return sha256_backends[i];
+	}
+	return &sha256_generic;
+}
+
+static void sha256_backend_auto_init(void)
+{
+	if (sha256_current == NULL)
+		sha256_current = sha256_backend_auto();
+}
+
+const struct sha256_backend *sha256_backend_get(void)
+{
+	pthread_once(&sha256_auto_once, sha256_backend_auto_init);
+	return sha256_current;
+}
+
+int sha256_backend_set(const char *name, char **error)
+{
+	int i;
+
+	if (strcmp(name, "auto") == 0) {
+		sha256_current = sha256_backend_auto();
+		return STATUS_OK;
+	}
+	for (i = 0; sha256_backends[i] != NULL; i++) {
+		if (strcmp(name, sha256_backends[i]->name) != 0)
+			continue;
+		if (!sha256_backends[i]->available()) {
+			asprintf(error,
+				 "SHA-256 backend %s not supported by CPU",
+				 name);
+			return STATUS_ERR;
+		}
+		sha256_current = sha256_backends[i];
+		return STATUS_OK;
+	}
+	asprintf(error, "unknown SHA-256 backend: %s", name);
+	return STATUS_ERR;
+}
+
+/* Digest computation. */
+
+void sha256_init(struct sha256_ctx *ctx, const struct sha256_backend *backend)
+{
+	ctx->backend = backend ? backend : sha256_backend_get();
+	ctx->state[0] = 0x6a09e667;
+	ctx->state[1] = 0xbb67ae85;
+	ctx->state[2] = 0x3c6ef372;
+	ctx->state[3] = 0xa54ff53a;
+	ctx->state[4] = 0x510e527f;
+	ctx->state[5] = 0x9b05688c;
+	ctx->state[6] = 0x1f83d9ab;
+	ctx->state[7] = 0x5be0cd19;
+	ctx->bytes = 0;
+}
+
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t len)
+{
+	const u8 *p = data;
+	size_t used = ctx->bytes % SHA256_BLOCK_BYTES;
+	size_t blocks;
+
+	ctx->bytes += len;
+
+	/* Complete a buffered partial block first. */
+	if (used > 0) {
+		size_t fill = SHA256_BLOCK_BYTES - used;
+
+		if (len < fill) {
+			memcpy(ctx->buffer + used, p, len);
+			return;
+		}
+		memcpy(ctx->buffer + used, p, fill);
+		ctx->backend->transform(ctx->state, ctx->buffer, 1);
+		p += fill;
+		len -= fill;
+	}
+
+	/* Hash whole blocks in place. */
+	blocks = len / SHA256_BLOCK_BYTES;
+	if (blocks > 0) {
+		ctx->backend->transform(ctx->state, p, blocks);
+		p += blocks * SHA256_BLOCK_BYTES;
+		len -= blocks * SHA256_BLOCK_BYTES;
+	}
+
+	memcpy(ctx->buffer, p, len);
+}
+
+void sha256_final(struct sha256_ctx *ctx, u8 *digest)
+{
+	size_t used = ctx->bytes % SHA256_BLOCK_BYTES;
+	u64 bits = ctx->bytes * 8;
+	int i;
+
+	/* Pad with 0x80, zeros, and the big-endian bit length. */
+	ctx->buffer[used++] = 0x80;
+	if (used > SHA256_BLOCK_BYTES - sizeof(bits)) {
+		memset(ctx->buffer + used, 0, SHA256_BLOCK_BYTES - used);
+		ctx->backend->transform(ctx->state, ctx->buffer, 1);
+		used = 0;
+	}
+	memset(ctx->buffer + used, 0,
+	       SHA256_BLOCK_BYTES - sizeof(bits) - used);
+	for (i = 0; i < sizeof(bits); i++)
+		ctx->buffer[SHA256_BLOCK_BYTES - 1 - i] = bits >> (8 * i);
+	ctx->backend->transform(ctx->state, ctx->buffer, 1);
+
+	for (i = 0; i < SHA256_DIGEST_WORDS; i++)
+		put_unaligned_be32(ctx->state[i], digest + 4*i);
+
+	memset(ctx, 0, sizeof(*ctx));	/* don't leave key material around */
+}
+
+void sha256_digest(const void *data, size_t len, u8 *digest)
+{
+	struct sha256_ctx ctx;
+
+	sha256_init(&ctx, NULL);
+	sha256_update(&ctx, data, len);
+	sha256_final(&ctx, digest);
+}
+
+void sha256_hmac_key_init(struct sha256_hmac_key *hkey,
+			  const struct sha256_backend *backend,
+			  const u8 *key, size_t key_len)
+{
+	u8 pad[SHA256_BLOCK_BYTES];
+	u8 key_digest[SHA256_DIGEST_BYTES];
+	struct sha256_ctx ctx;
+	int i;
+
+	if (backend == NULL)
+		backend = sha256_backend_get();
+
+	/* Keys longer than a block are replaced by their digest. */
+	if (key_len > SHA256_BLOCK_BYTES) {
+		sha256_init(&ctx, backend);
+		sha256_update(&ctx, key, key_len);
+		sha256_final(&ctx, key_digest);
+		key = key_digest;
+		key_len = SHA256_DIGEST_BYTES;
+	}
+
+	memset(pad, 0x36, sizeof(pad));
+	for (i = 0; i < key_len; i++)
+		pad[i] ^= key[i];
+	sha256_init(&hkey->inner, backend);
+	sha256_update(&hkey->inner, pad, sizeof(pad));
+
+	memset(pad, 0x5c, sizeof(pad));
+	for (i = 0; i < key_len; i++)
+		pad[i] ^= key[i];
+	sha256_init(&hkey->outer, backend);
+	sha256_update(&hkey->outer, pad, sizeof(pad));
+
+	memset(pad, 0, sizeof(pad));
+	memset(key_digest, 0, sizeof(key_digest));
+}
+
+void sha256_hmac_keyed(const struct sha256_hmac_key *hkey,
+		       const void *data, size_t data_len, u8 *digest)
+{
+	u8 inner[SHA256_DIGEST_BYTES];
+	struct sha256_ctx ctx;
+
+	ctx = hkey->inner;
+	sha256_update(&ctx, data, data_len);
+	sha256_final(&ctx, inner);
+
+	ctx = hkey->outer;
+	sha256_update(&ctx, inner, sizeof(inner));
+	sha256_final(&ctx, digest);
+
+	memset(inner, 0, sizeof(inner));
+	memset(&ctx, 0, sizeof(ctx));
+}
+
+void sha256_hmac(const struct sha256_backend *backend,
+		 const u8 *key, size_t key_len,
+		 const void *data, size_t data_len, u8 *digest)
+{
+	struct sha256_hmac_key hkey;
+
+	sha256_hmac_key_init(&hkey, backend, key, key_len);
+	sha256_hmac_keyed(&hkey, data, data_len, digest);
+	memset(&hkey, 0, sizeof(hkey));
+}
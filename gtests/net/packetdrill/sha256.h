@@ -0,0 +1,104 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * SHA-256 and HMAC-SHA256, as needed for MPTCP v1 (RFC 8684) tokens,
+ * IDSNs and MP_JOIN and ADD_ADDR HMACs, with pluggable implementations
+ * of the SHA-256 compression function. As for SHA-1, at first use the
+ * fastest backend the CPU supports is picked: SHA-NI on x86, the ARMv8
+ * crypto extensions on arm64, else portable C.
+ *
+ * All functions are reentrant: their state lives in the caller's
+ * struct sha256_ctx or on the stack.
+ */
+
+#ifndef __SHA256_H__
+#define __SHA256_H__
+
+#include "types.h"
+
+#define SHA256_BLOCK_BYTES	64
+#define SHA256_DIGEST_BYTES	32
+#define SHA256_DIGEST_WORDS	8
+
+/* An implementation of the SHA-256 compression function. */
+struct sha256_backend {
+	const char *name;
+
+	/* Can this backend run on this CPU? */
+	bool (*available)(void);
+
+	/* Compress num_blocks consecutive 64-byte blocks into state. */
+	void (*transform)(u32 *state, const u8 *data, int num_blocks);
+};
+
+/* All compiled-in backends, fastest first, NULL-terminated. */
+extern const struct sha256_backend *sha256_backends[];
+
+/* Return the backend in use, picking one on first use. */
+extern const struct sha256_backend *sha256_backend_get(void);
+
+/* Select the backend with the given name, or the fastest available
+ * one for "auto". On failure returns STATUS_ERR and fills in *error.
+ */
+extern int sha256_backend_set(const char *name, char **error);
+
+/* Incremental SHA-256 state. */
+struct sha256_ctx {
+	const struct sha256_backend *backend;
+	u32 state[SHA256_DIGEST_WORDS];
+	u64 bytes;				/* total bytes hashed */
+	u8 buffer[SHA256_BLOCK_BYTES];		/* partial block */
+};
+
+/* Start a digest using the given backend, or the one in use if NULL. */
+extern void sha256_init(struct sha256_ctx *ctx,
+			const struct sha256_backend *backend);
+extern void sha256_update(struct sha256_ctx *ctx, const void *data,
+			  size_t len);
+extern void sha256_final(struct sha256_ctx *ctx, u8 *digest);
+
+/* Compute the SHA-256 digest of data. */
+extern void sha256_digest(const void *data, size_t len, u8 *digest);
+
+/* The two padded key blocks of an HMAC key, already run through the
+ * hash: a message under the same key then costs only its own blocks
+ * and those of the inner digest.
+ */
+struct sha256_hmac_key {
+	struct sha256_ctx inner;		/* after the key XOR ipad */
+	struct sha256_ctx outer;		/* after the key XOR opad */
+};
+
+/* Prepare an HMAC key using the given backend, or the one in use if
+ * NULL.
+ */
+extern void sha256_hmac_key_init(struct sha256_hmac_key *hkey,
+				 const struct sha256_backend *backend,
+				 const u8 *key, size_t key_len);
+
+/* Compute the HMAC of data under a prepared key. */
+extern void sha256_hmac_keyed(const struct sha256_hmac_key *hkey,
+			      const void *data, size_t data_len, u8 *digest);
+
+/* Compute HMAC-SHA256 (RFC 2104) of data using the given backend, or
+ * the one in use if NULL.
+ */
+extern void sha256_hmac(const struct sha256_backend *backend,
+			const u8 *key, size_t key_len,
+			const void *data, size_t data_len, u8 *digest);
+
+#endif /* __SHA256_H__ */
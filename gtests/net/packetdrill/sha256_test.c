@@ -0,0 +1,169 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for sha256.c: every backend the CPU supports is checked
+ * against the FIPS 180-2 and RFC 4231 test vectors.
+ */
+
+#include "sha256.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+
+/* Parse a hex digest string. */
+static void from_hex(const char *hex, u8 *out)
+{
+	int i;
+
+	for (i = 0; i < SHA256_DIGEST_BYTES; i++) {
+		char byte[3] = { hex[2*i], hex[2*i + 1], '\0' };
+		out[i] = strtoul(byte, NULL, 16);
+	}
+}
+
+static void check_digest(const struct sha256_backend *backend,
+			 const void *data, size_t len, const char *hex)
+{
+	struct sha256_ctx ctx;
+	u8 expected[SHA256_DIGEST_BYTES], digest[SHA256_DIGEST_BYTES];
+	const u8 *p = data;
+	size_t i;
+
+	from_hex(hex, expected);
+
+	sha256_init(&ctx, backend);
+	sha256_update(&ctx, data, len);
+	sha256_final(&ctx, digest);
+	assert(memcmp(digest, expected, SHA256_DIGEST_BYTES) == 0);
+
+	/* Same in odd-sized pieces, to exercise partial blocks. */
+	sha256_init(&ctx, backend);
+	for (i = 0; i < len; i += 7)
+		sha256_update(&ctx, p + i, len - i < 7 ? len - i : 7);
+	sha256_final(&ctx, digest);
+	assert(memcmp(digest, expected, SHA256_DIGEST_BYTES) == 0);
+}
+
+static void test_sha256(const struct sha256_backend *backend)
+{
+	char *million_a = malloc(1000000);
+
+	check_digest(backend, "", 0,
+		     "e3b0c44298fc1c149afbf4c8996fb924"
+		     "27ae41e4649b934ca495991b7852b855");
+	check_digest(backend, "abc", 3,
+		     "ba7816bf8f01cfea414140de5dae2223"
+		     "b00361a396177a9cb410ff61f20015ad");
+	check_digest(backend,
+		     "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+		     56, "248d6a61d20638b8e5c026930c3e6039"
+		     "a33ce45964ff2167f6ecedd419db06c1");
+	memset(million_a, 'a', 1000000);
+	check_digest(backend, million_a, 1000000,
+		     "cdc76e5c9914fb9281a1c7e284d73e67"
+		     "f1809a48a497200e046d39ccc7112cd0");
+	free(million_a);
+}
+
+static void check_hmac(const struct sha256_backend *backend,
+		       const u8 *key, size_t key_len,
+		       const char *data, const char *hex)
+{
+	u8 expected[SHA256_DIGEST_BYTES], digest[SHA256_DIGEST_BYTES];
+
+	from_hex(hex, expected);
+	sha256_hmac(backend, key, key_len, data, strlen(data), digest);
+	assert(memcmp(digest, expected, SHA256_DIGEST_BYTES) == 0);
+}
+
+static void test_hmac(const struct sha256_backend *backend)
+{
+	u8 key[131];
+
+	memset(key, 0x0b, 20);
+	check_hmac(backend, key, 20, "Hi There",
+		   "b0344c61d8db38535ca8afceaf0bf12b"
+		   "881dc200c9833da726e9376c2e32cff7");
+	check_hmac(backend, (const u8 *)"Jefe", 4,
+		   "what do ya want for nothing?",
+		   "5bdcc146bf60754e6a042426089575c7"
+		   "5a003f089d2739839dec58b964ec3843");
+	memset(key, 0xaa, 131);
+	check_hmac(backend, key, 131,
+		   "Test Using Larger Than Block-Size Key - Hash Key First",
+		   "60e431591ee0b67f0d8a26aacbf5b77f"
+		   "8e0bc6213728c5140546040f0ee37f54");
+}
+
+/* The MPTCP v1 MP_JOIN HMAC in utils.c must match the generic one. */
+static void test_mptcp_hmac(void)
+{
+	u64 key_1 = 0x0123456789abcdefULL, key_2 = 0xfedcba9876543210ULL;
+	u32 rand_1 = 0x11223344, rand_2 = 0x55667788;
+	u8 key[16], msg[8], expected[SHA256_DIGEST_BYTES];
+	u8 hmac[MPTCP_HMAC_MAX_BYTES];
+
+	memcpy(key, &key_1, 8);
+	memcpy(key + 8, &key_2, 8);
+	memcpy(msg, &rand_1, 4);
+	memcpy(msg + 4, &rand_2, 4);
+	sha256_hmac(NULL, key, sizeof(key), msg, sizeof(msg), expected);
+
+	mptcp_hmac(MPTCP_V1, (u8 *)&key_1, (u8 *)&key_2,
+		   (u8 *)&rand_1, (u8 *)&rand_2, hmac);
+	assert(memcmp(hmac, expected, SHA256_DIGEST_BYTES) == 0);
+}
+
+/* A prepared key gives the same HMACs, message after message. */
+static void test_hmac_keyed(void)
+{
+	u64 key_1 = 0x0123456789abcdefULL, key_2 = 0xfedcba9876543210ULL;
+	u8 expected[MPTCP_HMAC_MAX_BYTES], hmac[MPTCP_HMAC_MAX_BYTES];
+	struct mptcp_hmac_key hkey;
+	u32 rand_1, rand_2 = 0x55667788;
+
+	mptcp_hmac_key_init(&hkey, MPTCP_V1, key_1, key_2);
+	for (rand_1 = 0; rand_1 < 4; rand_1++) {
+		mptcp_hmac(MPTCP_V1, (u8 *)&key_1, (u8 *)&key_2,
+			   (u8 *)&rand_1, (u8 *)&rand_2, expected);
+		mptcp_hmac_keyed(&hkey, rand_1, rand_2, hmac);
+		assert(memcmp(hmac, expected, SHA256_DIGEST_BYTES) == 0);
+	}
+}
+
+int main(void)
+{
+	char *error = NULL;
+	int i;
+
+	for (i = 0; sha256_backends[i] != NULL; i++) {
+		if (!sha256_backends[i]->available())
+			continue;
+		test_sha256(sha256_backends[i]);
+		test_hmac(sha256_backends[i]);
+		assert(sha256_backend_set(sha256_backends[i]->name, &error) ==
+		       STATUS_OK);
+		test_mptcp_hmac();
+		test_hmac_keyed();
+	}
+	assert(sha256_backend_set("auto", &error) == STATUS_OK);
+	assert(sha256_backend_set("no-such-backend", &error) == STATUS_ERR);
+	free(error);
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation for a thread that sniffs packets ahead of the
+ * interpreter.
+ */
+
+#include "sniffer.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cpu_affinity.h"
+#include "logging.h"
+#include "netdev.h"
+#include "time_source.h"
+
+/* Number of sniffed packets the ring can hold; a power of two. */
+#define SNIFFER_RING_SIZE	1024
+
+/* Result of one netdev_receive_loop() call by the sniffer thread. */
+struct sniffed_packet {
+	int status;
+	struct packet *packet;
+	int num_packets;
+	char *error;
+};
+
+struct sniffer {
+	struct packet_socket *psock;	/* where we sniff (not owned) */
+	enum packet_layer_t layer;	/* layer at which packets start */
+	enum direction_t direction;	/* direction of packets we want */
+	pthread_t thread;
+
+	/* Ring of sniffed packets. Only the sniffer thread writes
+	 * 'tail' and only the consumer writes 'head'; both only grow,
+	 * and entries between them are owned by the consumer.
+	 */
+	struct sniffed_packet ring[SNIFFER_RING_SIZE];
+	u32 head;
+	u32 tail;
+
+	/* The thread writes a byte here after each packet, so an idle
+	 * consumer can block in read() rather than spin.
+	 */
+	int wakeup_fds[2];
+};
+
+static void *sniffer_thread(void *arg)
+{
+	struct sniffer *sniffer = arg;
+	u32 tail = sniffer->tail;
+
+	cpu_affinity_pin(CPU_ROLE_HELPER);
+
+	while (1) {
+		struct sniffed_packet *entry;
+
+		/* Wait for the consumer to make room, which should
+		 * only happen for scripts that ignore a flood of packets.
+		 */
+		while (tail - __atomic_load_n(&sniffer->head, __ATOMIC_ACQUIRE) ==
+		       SNIFFER_RING_SIZE)
+			usleep(100);
+
+		entry = &sniffer->ring[tail % SNIFFER_RING_SIZE];
+		memset(entry, 0, sizeof(*entry));
+		entry->status = netdev_receive_loop(sniffer->psock, NULL,
+						    sniffer->layer,
+						    sniffer->direction,
+						    &entry->packet,
+						    &entry->num_packets,
+						    &entry->error);
+
+		++tail;
+		__atomic_store_n(&sniffer->tail, tail, __ATOMIC_RELEASE);
+		/* A full pipe already means a wakeup is pending. */
+		if (write(sniffer->wakeup_fds[1], "", 1) < 0 &&
+		    errno != EAGAIN && errno != EINTR)
+			die_perror("sniffer write()");
+	}
+	return NULL;
+}
+
+struct sniffer *sniffer_new(struct packet_socket *psock,
+			    enum packet_layer_t layer,
+			    enum direction_t direction)
+{
+	struct sniffer *sniffer = calloc(1, sizeof(struct sniffer));
+
+	sniffer->psock = psock;
+	sniffer->layer = layer;
+	sniffer->direction = direction;
+
+	if (pipe(sniffer->wakeup_fds) < 0)
+		die_perror("pipe");
+	if (fcntl(sniffer->wakeup_fds[1], F_SETFL, O_NONBLOCK) < 0)
+		die_perror("fcntl O_NONBLOCK");
+
+	if (pthread_create(&sniffer->thread, NULL, sniffer_thread,
+			   sniffer) != 0)
+		die_perror("pthread_create");
+
+	return sniffer;
+}
+
+void sniffer_free(struct sniffer *sniffer)
+{
+	u32 i;
+
+	/* The thread spends its life blocked in the packet socket, so
+	 * cancel it there rather than asking it to stop.
+	 */
+	if (pthread_cancel(sniffer->thread) != 0)
+		die_perror("pthread_cancel");
+	if (pthread_join(sniffer->thread, NULL) != 0)
+		die_perror("pthread_join");
+
+	for (i = sniffer->head; i != sniffer->tail; ++i) {
+		struct sniffed_packet *entry =
+			&sniffer->ring[i % SNIFFER_RING_SIZE];
+
+		if (entry->packet != NULL)
+			packet_free(entry->packet);
+		free(entry->error);
+	}
+	close(sniffer->wakeup_fds[0]);
+	close(sniffer->wakeup_fds[1]);
+
+	memset(sniffer, 0, sizeof(*sniffer));  /* paranoia */
+	free(sniffer);
+}
+
+/* Take the packet at the head of the ring, which must not be empty. */
+static int take_packet(struct sniffer *sniffer,
+		       struct packet **packet,
+		       int *num_packets,
+		       char **error)
+{
+	struct sniffed_packet entry;
+	u32 head = sniffer->head;
+
+	entry = sniffer->ring[head % SNIFFER_RING_SIZE];
+	__atomic_store_n(&sniffer->head, head + 1, __ATOMIC_RELEASE);
+
+	*num_packets = entry.num_packets;
+	if (entry.status != STATUS_OK) {
+		*error = entry.error;
+		return STATUS_ERR;
+	}
+	/* Errors about packets we skipped over don't matter. */
+	free(entry.error);
+	*packet = entry.packet;
+	return STATUS_OK;
+}
+
+int sniffer_receive(struct sniffer *sniffer,
+		    struct packet **packet,
+		    int *num_packets,
+		    char **error)
+{
+	assert(*packet == NULL);	/* should be no packet yet */
+
+	while (__atomic_load_n(&sniffer->tail, __ATOMIC_ACQUIRE) ==
+	       sniffer->head) {
+		char byte;
+
+		if (read(sniffer->wakeup_fds[0], &byte, 1) < 0 &&
+		    errno != EINTR)
+			die_perror("sniffer read()");
+	}
+	return take_packet(sniffer, packet, num_packets, error);
+}
+
+int sniffer_receive_until(struct sniffer *sniffer,
+			  s64 deadline_nsecs,
+			  struct packet **packet,
+			  int *num_packets,
+			  char **error)
+{
+	assert(*packet == NULL);	/* should be no packet yet */
+
+	while (__atomic_load_n(&sniffer->tail, __ATOMIC_ACQUIRE) ==
+	       sniffer->head) {
+		struct pollfd pfd = { .fd = sniffer->wakeup_fds[0],
+				      .events = POLLIN };
+		s64 wait_nsecs = deadline_nsecs - time_now_nsecs();
+		char byte;
+
+		*num_packets = 0;
+		if (wait_nsecs <= 0)
+			return STATUS_OK;
+		/* Round up, so we never wake just short of the deadline. */
+		if (poll(&pfd, 1, (wait_nsecs + 999999) / 1000000) < 0) {
+			if (errno == EINTR)
+				continue;
+			die_perror("sniffer poll()");
+		}
+		if ((pfd.revents & POLLIN) &&
+		    read(sniffer->wakeup_fds[0], &byte, 1) < 0 &&
+		    errno != EINTR)
+			die_perror("sniffer read()");
+	}
+	return take_packet(sniffer, packet, num_packets, error);
+}
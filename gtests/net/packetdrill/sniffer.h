@@ -0,0 +1,69 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for a thread that sniffs packets ahead of the interpreter.
+ *
+ * The sniffer thread loops in netdev_receive_loop(), so outbound
+ * packets are pulled off the packet socket, timestamped and parsed as
+ * soon as the kernel sends them, even while the interpreter thread is
+ * sleeping until its next event or blocked in a system call. Sniffed
+ * packets are handed to the single consumer over a lock-free
+ * single-producer/single-consumer ring, so by the time the script
+ * expects an outbound packet it is usually already waiting there.
+ */
+
+#ifndef __SNIFFER_H__
+#define __SNIFFER_H__
+
+#include "types.h"
+
+#include "packet.h"
+#include "packet_parser.h"
+#include "packet_socket.h"
+
+struct sniffer;
+
+/* Start a thread sniffing packets in the given direction from the
+ * given packet socket, which must stay open until sniffer_free().
+ */
+extern struct sniffer *sniffer_new(struct packet_socket *psock,
+				   enum packet_layer_t layer,
+				   enum direction_t direction);
+
+/* Stop the thread and free any packets it sniffed but nobody took. */
+extern void sniffer_free(struct sniffer *sniffer);
+
+/* Block until the sniffer thread has the next packet, and return it
+ * with the same contract as netdev_receive_loop(). The packet is not
+ * from a pool; caller must free it with packet_free().
+ */
+extern int sniffer_receive(struct sniffer *sniffer,
+			   struct packet **packet,
+			   int *num_packets,
+			   char **error);
+
+/* Like sniffer_receive(), but give up at deadline_nsecs on the clock
+ * of time_now_nsecs(), returning STATUS_OK with *packet left NULL if
+ * no packet came by then.
+ */
+extern int sniffer_receive_until(struct sniffer *sniffer,
+				 s64 deadline_nsecs,
+				 struct packet **packet,
+				 int *num_packets,
+				 char **error);
+
+#endif /* __SNIFFER_H__ */
@@ -26,14 +26,18 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "hash.h"
+#include "kernel_timeline.h"
 #include "run.h"
 
 struct socket *socket_new(struct state *state)
 {
 	struct socket *socket = calloc(1, sizeof(struct socket));
-	socket->ts_val_map = hash_map_new(1);
+	socket->ts_val_map = hash_map_new_window(TS_VAL_MAP_WINDOW);
 	socket->next = state->sockets;	/* add socket to the linked list */
 	state->sockets = socket;
+	socket->id = state->socket_table->next_id++;
+	socket_table_update(state, socket);
 	return socket;
 }
 
@@ -43,3 +47,178 @@ void socket_free(struct socket *socket)
 	memset(socket, 0, sizeof(*socket));  /* paranoia to help catch bugs */
 	free(socket);
 }
+
+struct socket_table *socket_table_new(void)
+{
+	return calloc(1, sizeof(struct socket_table));
+}
+
+void socket_table_free(struct socket_table *table)
+{
+	memset(table, 0, sizeof(*table));  /* paranoia to help catch bugs */
+	free(table);
+}
+
+/* Return the current key for the socket in the given index. */
+static u32 socket_index_key(const struct socket *socket,
+			    enum socket_index_t index)
+{
+	switch (index) {
+	case SOCKET_INDEX_PORTS:
+		return socket_ports_key(socket->live.local.port,
+					socket->live.remote.port);
+	case SOCKET_INDEX_REMOTE_PORT:
+		return socket->live.remote.port;
+	case SOCKET_INDEX_SCRIPT_FD:
+		return (u32)socket->script.fd;
+	case SOCKET_NUM_INDEXES:
+		break;
+	}
+	assert(!"bad socket index");
+	return 0;
+}
+
+/* Return the head of the hash chain for the given key. We use the
+ * fast, public-domain MurmurHash3.
+ */
+static struct socket **socket_table_bucket(struct socket_table *table,
+					   enum socket_index_t index,
+					   u32 key)
+{
+	u32 hash = 0;
+
+	MurmurHash3_x86_32(&key, sizeof(key), 0, &hash);
+	return &table->buckets[index][hash & (SOCKET_INDEX_BUCKETS - 1)];
+}
+
+/* Unlink the socket from its chain in the given index, if present. */
+static void socket_index_unlink(struct socket_table *table,
+				struct socket *socket,
+				enum socket_index_t index)
+{
+	struct socket **link =
+		socket_table_bucket(table, index, socket->index_key[index]);
+
+	for (; *link != NULL; link = &(*link)->index_next[index]) {
+		if (*link == socket) {
+			*link = socket->index_next[index];
+			socket->index_next[index] = NULL;
+			return;
+		}
+	}
+}
+
+/* Link the socket into its chain in the given index, newest first. */
+static void socket_index_link(struct socket_table *table,
+			      struct socket *socket,
+			      enum socket_index_t index)
+{
+	struct socket **link =
+		socket_table_bucket(table, index, socket->index_key[index]);
+
+	while (*link != NULL && (*link)->id > socket->id)
+		link = &(*link)->index_next[index];
+	socket->index_next[index] = *link;
+	*link = socket;
+}
+
+/* Tell the netdev the live remote ports of all our sockets, so it
+ * can drop sniffed TCP and UDP packets to any other port: we could
+ * never match them to a socket (see find_socket_for_live_packet() and
+ * find_connect_for_live_packet()), so they are not worth parsing, or
+ * for up to NETDEV_MAX_SNIFF_PORTS ports, even waking up for.
+ */
+void socket_table_update_sniff_ports(struct state *state)
+{
+	u64 seen[65536 / 64];
+	__be16 *ports = NULL;
+	int num_ports = 0, max_ports = 0, bucket;
+
+	if (state->netdev == NULL)
+		return;
+
+	memset(seen, 0, sizeof(seen));
+	for (bucket = 0; bucket < SOCKET_INDEX_BUCKETS; ++bucket) {
+		struct socket *socket =
+		    state->socket_table->buckets[SOCKET_INDEX_REMOTE_PORT][bucket];
+
+		for (; socket != NULL;
+		     socket = socket->index_next[SOCKET_INDEX_REMOTE_PORT]) {
+			__be16 port = socket->live.remote.port;
+
+			if (port == 0 || (seen[port / 64] & (1ULL << (port % 64))))
+				continue;
+			seen[port / 64] |= 1ULL << (port % 64);
+			if (num_ports == max_ports) {
+				max_ports = max_ports ? max_ports * 2 :
+					NETDEV_MAX_SNIFF_PORTS;
+				ports = realloc(ports,
+						max_ports * sizeof(*ports));
+			}
+			ports[num_ports++] = port;
+		}
+	}
+	netdev_set_sniff_ports(state->netdev, ports, num_ports);
+	if (state->kernel_timeline != NULL)
+		kernel_timeline_add_ports(state->kernel_timeline, ports,
+					  num_ports);
+	free(ports);
+}
+
+void socket_table_update(struct state *state, struct socket *socket)
+{
+	u32 old_remote_port = socket->index_key[SOCKET_INDEX_REMOTE_PORT];
+	int i;
+
+	for (i = 0; i < SOCKET_NUM_INDEXES; ++i) {
+		u32 key = socket_index_key(socket, i);
+
+		socket_index_unlink(state->socket_table, socket, i);
+		socket->index_key[i] = key;
+		socket_index_link(state->socket_table, socket, i);
+	}
+
+	if (socket->index_key[SOCKET_INDEX_REMOTE_PORT] != old_remote_port)
+		socket_table_update_sniff_ports(state);
+
+	if (state->tcp_info_log != NULL && socket->live.fd >= 0 &&
+	    !socket->is_closed)
+		tcp_info_log_watch(state->tcp_info_log, socket->live.fd,
+				   socket->script.fd);
+}
+
+void socket_table_remove(struct state *state, struct socket *socket)
+{
+	int i;
+
+	for (i = 0; i < SOCKET_NUM_INDEXES; ++i)
+		socket_index_unlink(state->socket_table, socket, i);
+
+	if (socket->index_key[SOCKET_INDEX_REMOTE_PORT] != 0)
+		socket_table_update_sniff_ports(state);
+
+	if (state->tcp_info_log != NULL && socket->live.fd >= 0)
+		tcp_info_log_forget(state->tcp_info_log, socket->live.fd);
+}
+
+struct socket *socket_table_first(struct state *state,
+				  enum socket_index_t index, u32 key)
+{
+	struct socket *socket =
+		*socket_table_bucket(state->socket_table, index, key);
+
+	while (socket != NULL && socket->index_key[index] != key)
+		socket = socket->index_next[index];
+	return socket;
+}
+
+struct socket *socket_table_next(struct socket *socket,
+				 enum socket_index_t index)
+{
+	u32 key = socket->index_key[index];
+
+	do {
+		socket = socket->index_next[index];
+	} while (socket != NULL && socket->index_key[index] != key);
+	return socket;
+}
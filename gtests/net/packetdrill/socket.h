@@ -61,6 +61,12 @@ struct tuple {
 	struct endpoint dst;
 };
 
+/* Most outbound TCP timestamp values we remember the live value of. A
+ * window of data takes far fewer distinct timestamps than this, even
+ * for a long bulk transfer with small segments.
+ */
+#define TS_VAL_MAP_WINDOW	4096
+
 /* The scripted or live aspects of socket state */
 struct socket_state {
 	int fd;				/* file descriptor for this socket */
@@ -70,6 +76,21 @@ struct socket_state {
 	u32 remote_isn;			/* initial TCP sequence (host order) */
 };
 
+/* Socket fields we index so packets and system calls can find their
+ * socket without walking the whole state->sockets list.
+ */
+enum socket_index_t {
+	SOCKET_INDEX_PORTS,		/* live local and remote ports */
+	SOCKET_INDEX_REMOTE_PORT,	/* live remote port */
+	SOCKET_INDEX_SCRIPT_FD,		/* script fd */
+	SOCKET_NUM_INDEXES,		/* number of indexes; must be last */
+};
+
+/* Number of hash buckets per index. Must be a power of 2. */
+#define SOCKET_INDEX_BUCKETS 256
+
+struct mp_subflow;
+
 /* The runtime state for a socket */
 struct socket {
 	enum socket_state_t state;	/* current state of socket */
@@ -88,7 +109,10 @@ struct socket {
 	 * this mapping in a hash map mapping outgoing TCP timestamp
 	 * values from scripted value to live value. Then we use this
 	 * to map incoming TCP timestamp echo replies from their
-	 * script value to their live value.
+	 * script value to their live value. A peer can only echo the
+	 * TS val of a segment from its last window of data, so we
+	 * keep the newest TS_VAL_MAP_WINDOW mappings and let older
+	 * ones go, rather than growing the map for the whole test.
 	 */
 	struct hash_map *ts_val_map;
 
@@ -104,8 +128,42 @@ struct socket {
 	struct tcp last_outbound_tcp_header;
 	struct tcp last_injected_tcp_header;
 	u32 last_injected_tcp_payload_len;
+	bool has_injected_ts;		/* did it carry a TCP timestamp? */
+	u32 last_injected_ts_val;	/* if so, its TS val */
+
+	/* For --kernel_latency, when we last injected a packet on this
+	 * socket that the kernel has not yet answered, or 0.
+	 */
+	s64 latency_inject_nsecs;
+
+	/* With --payload_pattern, how far the app has sent and received
+	 * in the TCP stream, to know where in the pattern it is.
+	 */
+	u64 payload_sent;
+	u64 payload_received;
+
+	/* The MPTCP subflow whose kernel side this socket is, as last
+	 * found by find_subflow_matching_socket(), and the
+	 * mp_state.subflows_generation that finding is good for.
+	 */
+	struct mp_subflow *mp_subflow;
+	u32 mp_subflow_generation;
 
 	struct socket *next;	/* next in linked list of sockets */
+
+	/* Links for the hash chains of the socket table. Each chain is
+	 * kept sorted from newest to oldest socket, so that lookups
+	 * return the same socket as a walk of the state->sockets list.
+	 */
+	u32 id;					/* creation order */
+	u32 index_key[SOCKET_NUM_INDEXES];	/* key in each index */
+	struct socket *index_next[SOCKET_NUM_INDEXES];	/* chain links */
+};
+
+/* Hash indexes over all the sockets in state->sockets. */
+struct socket_table {
+	u32 next_id;		/* id for the next socket we create */
+	struct socket *buckets[SOCKET_NUM_INDEXES][SOCKET_INDEX_BUCKETS];
 };
 
 struct state;
@@ -116,6 +174,46 @@ extern struct socket *socket_new(struct state *state);
 /* Deallocate a socket. */
 extern void socket_free(struct socket *socket);
 
+/* Allocate and return an empty socket table. */
+extern struct socket_table *socket_table_new(void);
+
+/* Free the socket table. Does not free the sockets in it. */
+extern void socket_table_free(struct socket_table *table);
+
+/* Re-index the socket after changing any of its indexed fields: its
+ * live local or remote port, or its script fd. Changing the set of
+ * live remote ports also updates the netdev's sniffing filter.
+ */
+extern void socket_table_update(struct state *state, struct socket *socket);
+
+/* Tell the netdev the live remote ports of all our sockets, so it can
+ * drop sniffed packets to any other port, e.g. after sniffing for
+ * ports no socket has for a while.
+ */
+extern void socket_table_update_sniff_ports(struct state *state);
+
+/* Remove the socket from the table, e.g. before freeing it. */
+extern void socket_table_remove(struct state *state, struct socket *socket);
+
+/* Return the newest socket with the given key in the given index, or
+ * NULL if there is none. Use socket_table_next() to visit the older
+ * sockets with the same key.
+ */
+extern struct socket *socket_table_first(struct state *state,
+					 enum socket_index_t index, u32 key);
+
+/* Return the next-newest socket after the given one with the same key
+ * in the given index, or NULL.
+ */
+extern struct socket *socket_table_next(struct socket *socket,
+					enum socket_index_t index);
+
+/* Return the key for the given live ports in SOCKET_INDEX_PORTS. */
+static inline u32 socket_ports_key(__be16 local_port, __be16 remote_port)
+{
+	return ((u32)local_port << 16) | remote_port;
+}
+
 /* Get the tuple we expect to see in outbound packets from this socket. */
 static inline void socket_get_outbound(
 	const struct socket_state *socket_state, struct tuple *tuple)
@@ -0,0 +1,598 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation for running many copies of one script, or many
+ * scripts, at once.
+ */
+
+#include "stress.h"
+
+#include <arpa/inet.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+#include "mptcp.h"
+#include "netdev.h"
+#include "run.h"
+#include "run_packet.h"
+#include "script.h"
+#include "system.h"
+#include "unaligned.h"
+
+/* One copy of the script, with everything it does not share. */
+struct stress_instance {
+	struct config config;		/* parsed for this copy */
+	struct script script;		/* parsed for this copy */
+	mp_state_t mp_state;		/* MPTCP state, while not running */
+	struct state *state;		/* run-time state */
+	bool done;			/* ran all its events? */
+};
+
+struct stress_netdev;
+
+/* Hands packets sniffed on the shared netdev to their instances. */
+struct stress_demux {
+	struct netdev *base;		/* the shared local netdev */
+	s16 *port_owner;		/* instance owning each port, or -1 */
+	struct stress_netdev **netdevs;	/* each instance's netdev */
+	int num_instances;
+	bool by_address;		/* does instance i own the i-th
+					 * address after base_remote_ip?
+					 */
+	struct ip_address base_remote_ip;	/* remote address of
+						 * instance 0
+						 */
+};
+
+/* An instance's view of the shared netdev. */
+struct stress_netdev {
+	struct netdev netdev;		/* "inherit" from netdev */
+	struct stress_demux *demux;
+	int instance;			/* index of our instance */
+	struct packet **queue;		/* ring of packets sniffed for us */
+	int queue_size;			/* slots in the ring */
+	int queue_head;			/* index of oldest queued packet */
+	int num_queued;			/* packets in the ring */
+};
+
+static inline struct stress_netdev *to_stress_netdev(struct netdev *netdev)
+{
+	return (struct stress_netdev *)netdev;
+}
+
+/* Return the TCP or UDP header port of the given packet on our side:
+ * the source port of packets we send, or the destination port of
+ * packets the kernel sends. Returns -1 if it has no such port.
+ */
+static int packet_our_port(const struct packet *packet, bool inbound)
+{
+	if (packet->tcp != NULL)
+		return ntohs(inbound ? packet->tcp->src_port :
+				       packet->tcp->dst_port);
+	if (packet->udp != NULL)
+		return ntohs(inbound ? packet->udp->src_port :
+				       packet->udp->dst_port);
+	return -1;
+}
+
+/* Return the instance owning the destination address of the given
+ * packet the kernel sent, or -1 if none does.
+ */
+static int address_owner(const struct stress_demux *demux,
+			 const struct packet *packet)
+{
+	const struct ip_address *base = &demux->base_remote_ip;
+	int len = ip_address_length(base->address_family);
+	const u8 *dst = NULL;
+	u32 offset;
+
+	if (packet->ipv4 != NULL && base->address_family == AF_INET)
+		dst = (const u8 *)&packet->ipv4->dst_ip;
+	else if (packet->ipv6 != NULL && base->address_family == AF_INET6)
+		dst = (const u8 *)&packet->ipv6->dst_ip;
+	else
+		return -1;
+	if (memcmp(dst, base->ip.bytes, len - 4) != 0)
+		return -1;
+	offset = get_unaligned_be32(dst + len - 4) -
+		 get_unaligned_be32(base->ip.bytes + len - 4);
+	return offset < (u32)demux->num_instances ? (int)offset : -1;
+}
+
+static void claim_port(struct stress_netdev *netdev, int port)
+{
+	if (port > 0)
+		netdev->demux->port_owner[port] = netdev->instance;
+}
+
+static void queue_packet(struct stress_netdev *netdev, struct packet *packet)
+{
+	if (netdev->num_queued == netdev->queue_size) {
+		int new_size = netdev->queue_size ? 2 * netdev->queue_size : 16;
+		struct packet **queue = calloc(new_size, sizeof(*queue));
+		int i;
+
+		for (i = 0; i < netdev->num_queued; ++i)
+			queue[i] = netdev->queue[(netdev->queue_head + i) %
+						 netdev->queue_size];
+		free(netdev->queue);
+		netdev->queue = queue;
+		netdev->queue_size = new_size;
+		netdev->queue_head = 0;
+	}
+	netdev->queue[(netdev->queue_head + netdev->num_queued) %
+		      netdev->queue_size] = packet;
+	++netdev->num_queued;
+}
+
+static struct packet *dequeue_packet(struct stress_netdev *netdev)
+{
+	struct packet *packet = netdev->queue[netdev->queue_head];
+
+	netdev->queue_head = (netdev->queue_head + 1) % netdev->queue_size;
+	--netdev->num_queued;
+	return packet;
+}
+
+static void stress_netdev_free(struct netdev *a_netdev)
+{
+	struct stress_netdev *netdev = to_stress_netdev(a_netdev);
+
+	while (netdev->num_queued > 0)
+		packet_free(dequeue_packet(netdev));
+	netdev->demux->netdevs[netdev->instance] = NULL;
+	free(netdev->queue);
+	memset(netdev, 0, sizeof(*netdev));  /* paranoia to help catch bugs */
+	free(netdev);
+}
+
+static int stress_netdev_send(struct netdev *a_netdev, struct packet *packet)
+{
+	struct stress_netdev *netdev = to_stress_netdev(a_netdev);
+
+	claim_port(netdev, packet_our_port(packet, true));
+	return netdev_send(netdev->demux->base, packet);
+}
+
+static int stress_netdev_send_batch(struct netdev *a_netdev,
+				    struct packet **packets, int num_packets)
+{
+	struct stress_netdev *netdev = to_stress_netdev(a_netdev);
+	int i;
+
+	for (i = 0; i < num_packets; ++i)
+		claim_port(netdev, packet_our_port(packets[i], true));
+	return netdev_send_batch(netdev->demux->base, packets, num_packets);
+}
+
+/* Return the next packet for our instance: one another instance
+ * sniffed for us, or else the next one we sniff for ourselves, queueing
+ * those for other instances on the way. Packets to ports no instance
+ * owns are dropped, as the interpreter would drop them anyway.
+ */
+static int stress_netdev_receive(struct netdev *a_netdev,
+				 struct packet_pool *pool,
+				 struct packet **packet, char **error)
+{
+	struct stress_netdev *netdev = to_stress_netdev(a_netdev);
+	struct stress_demux *demux = netdev->demux;
+
+	while (netdev->num_queued == 0) {
+		struct packet *live = NULL;
+		struct stress_netdev *owner = NULL;
+		int port, instance = -1;
+
+		if (netdev_receive(demux->base, pool, &live, error))
+			return STATUS_ERR;
+		if (demux->by_address)
+			instance = address_owner(demux, live);
+		port = packet_our_port(live, false);
+		if (instance < 0 && port >= 0)
+			instance = demux->port_owner[port];
+		if (instance >= 0)
+			owner = demux->netdevs[instance];
+		if (owner == netdev) {
+			*packet = live;
+			return STATUS_OK;
+		}
+		/* The owner frees the packet after our pool may be gone. */
+		if (owner != NULL)
+			queue_packet(owner, packet_pool_copy(NULL, live));
+		packet_free(live);
+	}
+	*packet = dequeue_packet(netdev);
+	return STATUS_OK;
+}
+
+/* The instances share the device, and so its queues. */
+static int stress_netdev_queue_summary(struct netdev *a_netdev,
+				       s64 start_usecs, s64 end_usecs,
+				       struct queue_summary *summary)
+{
+	struct stress_netdev *netdev = to_stress_netdev(a_netdev);
+
+	return netdev_queue_summary(netdev->demux->base, start_usecs,
+				    end_usecs, summary);
+}
+
+static struct netdev_ops stress_netdev_ops = {
+	.free = stress_netdev_free,
+	.send = stress_netdev_send,
+	.send_batch = stress_netdev_send_batch,
+	.receive = stress_netdev_receive,
+	.queue_summary = stress_netdev_queue_summary,
+};
+
+static struct netdev *stress_netdev_new(struct stress_demux *demux,
+					int instance, u16 connect_port)
+{
+	struct stress_netdev *netdev = calloc(1, sizeof(*netdev));
+
+	netdev->netdev.ops = &stress_netdev_ops;
+	netdev->demux = demux;
+	netdev->instance = instance;
+	demux->netdevs[instance] = netdev;
+	claim_port(netdev, connect_port);
+	return &netdev->netdev;
+}
+
+static struct stress_demux *stress_demux_new(struct netdev *base,
+					     int num_instances)
+{
+	struct stress_demux *demux = calloc(1, sizeof(*demux));
+
+	demux->base = base;
+	demux->port_owner = malloc(65536 * sizeof(*demux->port_owner));
+	memset(demux->port_owner, 0xff, 65536 * sizeof(*demux->port_owner));
+	demux->netdevs = calloc(num_instances, sizeof(*demux->netdevs));
+	demux->num_instances = num_instances;
+	return demux;
+}
+
+static void stress_demux_free(struct stress_demux *demux)
+{
+	netdev_free(demux->base);
+	free(demux->port_owner);
+	free(demux->netdevs);
+	free(demux);
+}
+
+/* Move instance i to its own ports. */
+static void move_instance_ports(struct config *config,
+				const char *script_path, int i)
+{
+	if (config->default_live_bind_port + i > 0xffff ||
+	    config->default_live_connect_port + i > 0xffff)
+		die("%s: instance %d runs out of ports\n", script_path, i);
+	config->default_live_bind_port += i;
+	config->default_live_connect_port += i;
+	config->live_port_offset = i;
+}
+
+/* Move instance i to the i-th address after the default remote address,
+ * which must still be in the remote prefix.
+ */
+static void move_instance_address(struct config *config,
+				  const char *script_path, int i)
+{
+	struct ip_address ip = config->live_remote_ip;
+	int len = ip_address_length(ip.address_family);
+	int host_bits = len * 8 - config->live_remote_prefix.prefix_len;
+	u8 *low_bytes = ip.ip.bytes + len - 4;
+	u32 low = get_unaligned_be32(low_bytes);
+	u32 moved = low + i;
+
+	if (host_bits < 32) {
+		u32 host_mask = (1U << host_bits) - 1;
+
+		if ((moved & ~host_mask) != (low & ~host_mask) ||
+		    (ip.address_family == AF_INET &&
+		     (moved & host_mask) == host_mask))
+			die("%s: remote prefix %s has no address for "
+			    "script %d\n", script_path,
+			    config->live_remote_prefix_string, i);
+	} else if (moved < low) {
+		die("%s: remote prefix %s has no address for script %d\n",
+		    script_path, config->live_remote_prefix_string, i);
+	}
+	put_unaligned_be32(moved, low_bytes);
+
+	config->live_remote_ip = ip;
+	ip_to_string(&ip, config->live_remote_ip_string);
+	if (config->ip_version == IP_VERSION_4_MAPPED_6)
+		config->live_connect_ip = ipv6_map_from_ipv4(ip);
+	else
+		config->live_connect_ip = ip;
+}
+
+/* Parse the script for instance i and move it to its own ports. */
+static void parse_instance(int argc, char *argv[], const char *script_path,
+			   struct stress_instance *instance, int i)
+{
+	struct config *config = &instance->config;
+	char *path = NULL;
+
+	if (parse_script_and_set_config(argc, argv, config,
+					&instance->script, script_path, NULL))
+		exit(EXIT_FAILURE);
+
+	/* Until it runs, the instance keeps its MPTCP variables here. */
+	instance->mp_state = mp_state;
+
+	move_instance_ports(config, script_path, i);
+	if (config->seed_set)
+		config->seed += i;
+
+	/* Name the instance in error messages. */
+	asprintf(&path, "%s[%d]", config->script_path, i);
+	free(config->script_path);
+	config->script_path = path;
+}
+
+/* Parse script i of a --concurrent batch and move it to its own ports
+ * and remote address.
+ */
+static void parse_concurrent_instance(int argc, char *argv[],
+				      const char *script_path,
+				      struct stress_instance *instance, int i)
+{
+	struct config *config = &instance->config;
+
+	if (parse_script_and_set_config(argc, argv, config,
+					&instance->script, script_path, NULL))
+		exit(EXIT_FAILURE);
+
+	instance->mp_state = mp_state;
+
+	move_instance_ports(config, script_path, i);
+	move_instance_address(config, script_path, i);
+}
+
+/* Make the instance's MPTCP state current and take its lock. */
+static void enter_instance(struct stress_instance *instance)
+{
+	run_lock(instance->state);
+	mp_state = instance->mp_state;
+}
+
+static void leave_instance(struct stress_instance *instance)
+{
+	instance->mp_state = mp_state;
+	run_unlock(instance->state);
+}
+
+/* Move the instance to its next event, if it has one. */
+static void next_instance_event(struct stress_instance *instance)
+{
+	char *error = NULL;
+
+	if (get_next_event(instance->state, &error))
+		die("%s", error);
+	instance->done = (instance->state->event == NULL);
+}
+
+/* Return the instance whose next event is due first, or NULL if all
+ * are done. Events with relative times count from their instance's
+ * start time, so they run as soon as they are next.
+ */
+static struct stress_instance *next_instance(struct stress_instance *instances,
+					     int num_instances)
+{
+	struct stress_instance *next = NULL;
+	s64 next_usecs = 0;
+	int i;
+
+	for (i = 0; i < num_instances; ++i) {
+		struct state *state = instances[i].state;
+		s64 live_usecs;
+
+		if (instances[i].done)
+			continue;
+		live_usecs = script_time_to_live_time_usecs(
+			state, state->event->time_usecs);
+		if (next == NULL || live_usecs < next_usecs) {
+			next = &instances[i];
+			next_usecs = live_usecs;
+		}
+	}
+	return next;
+}
+
+/* Run the parsed instances to the end, on a new local netdev. If they
+ * are different scripts, each owns its remote address.
+ */
+static void run_instances(struct stress_instance *instances,
+			  int num_instances, bool concurrent)
+{
+	struct config *config = &instances[0].config;
+	struct stress_instance *instance = NULL;
+	struct stress_demux *demux = NULL;
+	char *error = NULL;
+	s64 start_usecs;
+	int i;
+
+	run_init_scripts(config);
+	set_scheduling_priority();
+	lock_memory(config);
+	set_timer_slack(config);
+	demux = stress_demux_new(local_netdev_new(config), num_instances);
+	demux->by_address = concurrent;
+	demux->base_remote_ip = config->live_remote_ip;
+	set_cpu_affinity(local_netdev_name(demux->base));
+
+	for (i = 0; i < num_instances; ++i) {
+		instance = &instances[i];
+		mp_state = instance->mp_state;
+		instance->state = state_new(
+			&instance->config, &instance->script,
+			stress_netdev_new(demux, i,
+				instance->config.default_live_connect_port));
+		leave_instance(instance);
+	}
+
+	/* The instances share the kernel, so the set-up of each script
+	 * runs once.
+	 */
+	for (i = 0; i < (concurrent ? num_instances : 1); ++i) {
+		struct script *script = &instances[i].script;
+
+		if (script->init_command != NULL &&
+		    safe_system(script->init_command->command_line, &error))
+			die("%s: error executing init command: %s\n",
+			    instances[i].config.script_path, error);
+	}
+
+	signal(SIGPIPE, SIG_IGN);	/* ignore EPIPE */
+
+	start_usecs = schedule_start_time_usecs();
+	for (i = 0; i < num_instances; ++i) {
+		struct state *state = NULL;
+
+		instance = &instances[i];
+		state = instance->state;
+		enter_instance(instance);
+		state->live_start_time_usecs = start_usecs +
+			(s64)i * config->stress_stagger_usecs;
+		next_instance_event(instance);
+		if (state->tcp_info_log != NULL)
+			tcp_info_log_start(state->tcp_info_log,
+					   state->live_start_time_usecs,
+					   state->script_start_time_usecs);
+		leave_instance(instance);
+	}
+
+	while ((instance = next_instance(instances, num_instances)) != NULL) {
+		struct state *state = instance->state;
+
+		enter_instance(instance);
+		adjust_relative_event_times(state, state->event);
+		run_event(state, state->event);
+		next_instance_event(instance);
+		leave_instance(instance);
+	}
+
+	for (i = 0; i < num_instances; ++i) {
+		instance = &instances[i];
+		enter_instance(instance);
+		if (finish_meters(instance->state, &error))
+			die("%s: %s\n", instance->config.script_path, error);
+		if (code_execute(instance->state->code, &error))
+			die("%s: error executing code: %s\n",
+			    instance->config.script_path, error);
+		free_mp_state();
+		state_free(instance->state);	/* also unlocks */
+		instance->state = NULL;
+	}
+	stress_demux_free(demux);
+}
+
+/* Run the parsed instances, unless --dry_run, and free them. */
+static void finish_instances(struct stress_instance *instances,
+			     int num_instances, bool concurrent)
+{
+	int i;
+
+	if (!instances[0].config.dry_run) {
+		run_instances(instances, num_instances, concurrent);
+	} else {
+		for (i = 0; i < num_instances; ++i) {
+			mp_state = instances[i].mp_state;
+			free_mp_state();
+		}
+	}
+
+	for (i = 0; i < num_instances; ++i)
+		free_script(&instances[i].script);
+	free(instances);
+}
+
+void run_stress(int argc, char *argv[], struct config *config,
+		const char *script_path)
+{
+	const int num_instances = config->stress_instances;
+	struct stress_instance *instances = NULL;
+	bool verbose;
+	int i;
+
+	if (config->is_wire_client)
+		die("--stress needs a local netdev, not --wire_client\n");
+
+	instances = calloc(num_instances, sizeof(*instances));
+	for (i = 0; i < num_instances; ++i)
+		parse_instance(argc, argv, script_path, &instances[i], i);
+
+	verbose = instances[0].config.verbose &&
+		  !instances[0].config.dry_run;
+	finish_instances(instances, num_instances, false);
+	if (verbose)
+		printf("%s: ran %d copies\n", script_path, num_instances);
+}
+
+/* Check that the scripts of a --concurrent batch can share a netdev. */
+static void check_concurrent_batch(struct stress_instance *instances,
+				   int num_instances)
+{
+	const struct config *first = &instances[0].config;
+	int i;
+
+	for (i = 1; i < num_instances; ++i) {
+		const struct config *config = &instances[i].config;
+
+		if (config->ip_version != first->ip_version ||
+		    config->live_remote_prefix.prefix_len !=
+		    first->live_remote_prefix.prefix_len ||
+		    !is_equal_ip(&config->live_remote_prefix.ip,
+				 &first->live_remote_prefix.ip) ||
+		    !is_equal_ip(&config->live_local_ip,
+				 &first->live_local_ip))
+			die("%s: --concurrent scripts must share their IP "
+			    "version and addresses with %s\n",
+			    config->script_path, first->script_path);
+	}
+}
+
+void run_concurrent(int argc, char *argv[], struct config *config,
+		    char **script_paths)
+{
+	if (config->is_wire_client)
+		die("--concurrent needs a local netdev, not --wire_client\n");
+	if (config->stress_instances > 0)
+		die("--concurrent does not go with --stress\n");
+
+	while (*script_paths != NULL) {
+		struct stress_instance *instances = NULL;
+		bool verbose;
+		int n;
+
+		instances = calloc(config->concurrent_scripts,
+				   sizeof(*instances));
+		for (n = 0; n < config->concurrent_scripts &&
+			    script_paths[n] != NULL; ++n)
+			parse_concurrent_instance(argc, argv, script_paths[n],
+						  &instances[n], n);
+		check_concurrent_batch(instances, n);
+
+		verbose = instances[0].config.verbose &&
+			  !instances[0].config.dry_run;
+		finish_instances(instances, n, true);
+		if (verbose)
+			printf("ran %d scripts at once\n", n);
+		script_paths += n;
+	}
+}
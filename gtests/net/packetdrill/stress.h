@@ -0,0 +1,62 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for running many copies of one script at once (--stress=N).
+ *
+ * Each copy ("instance") is parsed separately, and so has its own
+ * config, events and MPTCP variables, and runs with its own struct
+ * state: its own sockets, ephemeral ports, MPTCP connections and
+ * system call thread. Instance i binds and connects to the script's
+ * ports plus i, and starts i * --stress_stagger usecs after the first.
+ *
+ * All instances share one local tun device and run on the main
+ * thread, which steps through their events in order of their live
+ * times. Packets the kernel sends go to the instance that owns their
+ * destination port: the port it connects to, or a port it sent a
+ * packet from.
+ *
+ * With --concurrent=N, the same machinery runs N different scripts at
+ * once, as an alternative to a network namespace per script. Script i
+ * of a batch gets the ports of instance i above, and also the i-th
+ * address after the default remote address in the remote prefix, so
+ * that the scripts' connections differ in their remote address as well
+ * as their ports. Packets the kernel sends then go to the script that
+ * owns their destination address.
+ */
+
+#ifndef __STRESS_H__
+#define __STRESS_H__
+
+#include "types.h"
+
+#include "config.h"
+
+/* Run config->stress_instances copies of the script at the given
+ * path, re-parsing argc/argv for each. Exits on error, like a normal
+ * run does.
+ */
+extern void run_stress(int argc, char *argv[], struct config *config,
+		       const char *script_path);
+
+/* Run the scripts at the given NULL-terminated paths
+ * config->concurrent_scripts at a time, re-parsing argc/argv for each.
+ * Exits on error, like a normal run does.
+ */
+extern void run_concurrent(int argc, char *argv[], struct config *config,
+			   char **script_paths);
+
+#endif /* __STRESS_H__ */
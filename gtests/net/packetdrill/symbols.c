@@ -0,0 +1,224 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * A perfect hash over the symbol tables, so that looking up a symbol
+ * costs one hash probe instead of a strcmp() against every entry.
+ *
+ * The tables are arrays of values from the platform's headers, which
+ * only the C compiler knows, so rather than generating the hash at build
+ * time we build it the first time we look up a symbol. We use "hash and
+ * displace": each name hashes to a bucket, and each bucket has its own
+ * seed for a second hash, found at build time, that sends the names in
+ * the bucket to slots no other name uses. Building takes well under a
+ * millisecond for the few hundred symbols we have.
+ */
+
+#include "symbols.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "logging.h"
+
+/* Average number of names per bucket. */
+#define SYMBOL_BUCKET_NAMES	4
+
+/* Give up if no seed below this works for a bucket; never expected. */
+#define SYMBOL_MAX_SEED		(1 << 20)
+
+struct symbol_index {
+	u32 num_buckets;
+	u32 *seeds;			/* second-level seed for each bucket */
+	u32 mask;			/* number of slots - 1 */
+	const struct int_symbol **slots;	/* entry in each slot or NULL */
+};
+
+static struct symbol_index symbol_index;
+static pthread_once_t symbol_index_once = PTHREAD_ONCE_INIT;
+
+static u32 symbol_hash(const char *name, u32 seed)
+{
+	u32 hash = 0;
+
+	MurmurHash3_x86_32(name, strlen(name), seed, &hash);
+	return hash;
+}
+
+/* A symbol to place, and the bucket its name hashes to. */
+struct symbol_key {
+	const struct int_symbol *entry;
+	int order;			/* position in the tables */
+	u32 bucket;
+};
+
+/* Sort by name, and then by table order, to find duplicates. */
+static int compare_names(const void *a, const void *b)
+{
+	const struct symbol_key *x = a, *y = b;
+	int diff = strcmp(x->entry->name, y->entry->name);
+
+	return diff != 0 ? diff : x->order - y->order;
+}
+
+/* Sort by bucket, so each bucket's keys are together. */
+static int compare_buckets(const void *a, const void *b)
+{
+	const struct symbol_key *x = a, *y = b;
+
+	return (x->bucket > y->bucket) - (x->bucket < y->bucket);
+}
+
+/* A run of keys in the same bucket. */
+struct symbol_bucket {
+	u32 bucket;
+	int first;			/* index of first key */
+	int count;			/* number of keys */
+};
+
+/* Place the biggest buckets first, while there is the most room. */
+static int compare_bucket_sizes(const void *a, const void *b)
+{
+	const struct symbol_bucket *x = a, *y = b;
+
+	return y->count - x->count;
+}
+
+/* Try to place the bucket's keys in free slots using the given seed. */
+static bool place_bucket(struct symbol_key *keys,
+			 const struct symbol_bucket *bucket, u32 seed,
+			 u32 *slots_used)
+{
+	int i, j;
+
+	for (i = 0; i < bucket->count; ++i) {
+		const struct symbol_key *key = &keys[bucket->first + i];
+		u32 slot = symbol_hash(key->entry->name, seed) &
+			symbol_index.mask;
+
+		for (j = 0; j < i; ++j)
+			if (slots_used[j] == slot)
+				return false;
+		if (symbol_index.slots[slot] != NULL)
+			return false;
+		slots_used[i] = slot;
+	}
+	for (i = 0; i < bucket->count; ++i)
+		symbol_index.slots[slots_used[i]] = keys[bucket->first + i].entry;
+	return true;
+}
+
+static void build_symbol_index(void)
+{
+	struct int_symbol *tables[] = {
+		cross_platform_symbols, platform_symbols(),
+	};
+	struct symbol_key *keys = NULL;
+	struct symbol_bucket *buckets = NULL;
+	u32 *slots_used = NULL;
+	int i, j, num_keys = 0, num_unique = 0, num_runs = 0;
+	u32 num_slots = 1, seed;
+
+	for (i = 0; i < ARRAY_SIZE(tables); ++i)
+		for (j = 0; tables[i][j].name != NULL; ++j)
+			++num_keys;
+	keys = calloc(num_keys + 1, sizeof(*keys));
+	num_keys = 0;
+	for (i = 0; i < ARRAY_SIZE(tables); ++i) {
+		for (j = 0; tables[i][j].name != NULL; ++j) {
+			keys[num_keys].entry = &tables[i][j];
+			keys[num_keys].order = num_keys;
+			++num_keys;
+		}
+	}
+
+	/* If a name appears more than once, the first entry wins, as
+	 * it did when we searched the tables in order.
+	 */
+	qsort(keys, num_keys, sizeof(*keys), compare_names);
+	for (i = 0; i < num_keys; ++i)
+		if (num_unique == 0 ||
+		    strcmp(keys[i].entry->name,
+			   keys[num_unique - 1].entry->name) != 0)
+			keys[num_unique++] = keys[i];
+
+	/* Use twice as many slots as names, for quick placement. */
+	while (num_slots < 2 * num_unique)
+		num_slots *= 2;
+	symbol_index.mask = num_slots - 1;
+	symbol_index.slots = calloc(num_slots, sizeof(*symbol_index.slots));
+	symbol_index.num_buckets = num_unique / SYMBOL_BUCKET_NAMES + 1;
+	symbol_index.seeds = calloc(symbol_index.num_buckets, sizeof(u32));
+
+	for (i = 0; i < num_unique; ++i)
+		keys[i].bucket = symbol_hash(keys[i].entry->name, 0) %
+			symbol_index.num_buckets;
+	qsort(keys, num_unique, sizeof(*keys), compare_buckets);
+
+	buckets = calloc(num_unique + 1, sizeof(*buckets));
+	for (i = 0; i < num_unique; ++i) {
+		if (num_runs == 0 ||
+		    buckets[num_runs - 1].bucket != keys[i].bucket) {
+			buckets[num_runs].bucket = keys[i].bucket;
+			buckets[num_runs].first = i;
+			++num_runs;
+		}
+		++buckets[num_runs - 1].count;
+	}
+	qsort(buckets, num_runs, sizeof(*buckets), compare_bucket_sizes);
+
+	slots_used = calloc(num_unique + 1, sizeof(*slots_used));
+	for (i = 0; i < num_runs; ++i) {
+		for (seed = 1; seed < SYMBOL_MAX_SEED; ++seed)
+			if (place_bucket(keys, &buckets[i], seed, slots_used))
+				break;
+		if (seed == SYMBOL_MAX_SEED)
+			die("unable to build symbol hash table\n");
+		symbol_index.seeds[buckets[i].bucket] = seed;
+	}
+
+	DEBUGP("symbol index: %d symbols, %u buckets, %u slots\n",
+	       num_unique, symbol_index.num_buckets, num_slots);
+	free(slots_used);
+	free(buckets);
+	free(keys);
+}
+
+void symbol_index_init(void)
+{
+	if (pthread_once(&symbol_index_once, build_symbol_index) != 0)
+		die_perror("pthread_once");
+}
+
+const struct int_symbol *find_int_symbol(const char *name)
+{
+	const struct int_symbol *entry = NULL;
+	u32 bucket;
+
+	if (pthread_once(&symbol_index_once, build_symbol_index) != 0)
+		die_perror("pthread_once");
+
+	bucket = symbol_hash(name, 0) % symbol_index.num_buckets;
+	entry = symbol_index.slots[symbol_hash(name,
+					       symbol_index.seeds[bucket]) &
+				   symbol_index.mask];
+	if (entry != NULL && strcmp(entry->name, name) == 0)
+		return entry;
+	return NULL;
+}
@@ -39,4 +39,19 @@ struct int_symbol {
 /* Return a pointer to a table of platform-specific string->int mappings. */
 extern struct int_symbol *platform_symbols(void);
 
+/* The table of symbols common to all platforms, in script.c. */
+extern struct int_symbol cross_platform_symbols[];
+
+/* Return the entry for the symbol with the given name, looking first
+ * in cross_platform_symbols and then in platform_symbols(), or NULL if
+ * there is no such symbol. This takes one hash probe and one strcmp(),
+ * using a perfect hash over both tables that is built on first use.
+ */
+extern const struct int_symbol *find_int_symbol(const char *name);
+
+/* Build the index find_int_symbol() uses now, rather than on first
+ * use, so that processes we fork inherit it.
+ */
+extern void symbol_index_init(void);
+
 #endif /* __SYMBOLS_H__ */
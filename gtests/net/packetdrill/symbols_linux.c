@@ -34,6 +34,7 @@
 #include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -41,8 +42,12 @@
 #include <sys/unistd.h>
 
 #include <linux/sockios.h>
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
 
 #include "tcp.h"
+#include "udp.h"
 
 /* A table of platform-specific string->int mappings. */
 struct int_symbol platform_symbols_table[] = {
@@ -82,6 +87,12 @@ struct int_symbol platform_symbols_table[] = {
 	{ SO_SNDTIMEO,                      "SO_SNDTIMEO"                     },
 	{ SO_TIMESTAMP,                     "SO_TIMESTAMP"                    },
 	{ SO_TYPE,                          "SO_TYPE"                         },
+#ifdef SO_ZEROCOPY
+	{ SO_ZEROCOPY,                      "SO_ZEROCOPY"                     },
+#endif
+#ifdef SO_MAX_PACING_RATE
+	{ SO_MAX_PACING_RATE,               "SO_MAX_PACING_RATE"              },
+#endif
 
 	{ IP_TOS,                           "IP_TOS"                          },
 	{ IP_MTU_DISCOVER,                  "IP_MTU_DISCOVER"                 },
@@ -115,6 +126,13 @@ struct int_symbol platform_symbols_table[] = {
 	{ TCP_THIN_DUPACK,                  "TCP_THIN_DUPACK"                 },
 	{ TCP_USER_TIMEOUT,                 "TCP_USER_TIMEOUT"                },
 
+	{ UDP_SEGMENT,                      "UDP_SEGMENT"                     },
+	{ UDP_GRO,                          "UDP_GRO"                         },
+
+	/* TCP options for the tcp_repair_connect() pseudo system call. */
+	{ TCPI_OPT_TIMESTAMPS,              "TCPI_OPT_TIMESTAMPS"             },
+	{ TCPI_OPT_SACK,                    "TCPI_OPT_SACK"                   },
+
 	{ O_RDONLY,                         "O_RDONLY"                        },
 	{ O_WRONLY,                         "O_WRONLY"                        },
 	{ O_RDWR,                           "O_RDWR"                          },
@@ -186,6 +204,21 @@ struct int_symbol platform_symbols_table[] = {
 	{ MSG_MORE,                         "MSG_MORE"                        },
 	{ MSG_CMSG_CLOEXEC,                 "MSG_CMSG_CLOEXEC"                },
 	{ MSG_FASTOPEN,                     "MSG_FASTOPEN"                    },
+	{ MSG_WAITFORONE,                   "MSG_WAITFORONE"                  },
+#ifdef MSG_ZEROCOPY
+	{ MSG_ZEROCOPY,                     "MSG_ZEROCOPY"                    },
+#endif
+
+#ifdef SPLICE_F_MOVE
+	{ SPLICE_F_MOVE,                    "SPLICE_F_MOVE"                   },
+	{ SPLICE_F_NONBLOCK,                "SPLICE_F_NONBLOCK"               },
+	{ SPLICE_F_MORE,                    "SPLICE_F_MORE"                   },
+	{ SPLICE_F_GIFT,                    "SPLICE_F_GIFT"                   },
+#endif
+
+#ifdef HAVE_IO_URING
+	{ IORING_CQE_F_MORE,                "IORING_CQE_F_MORE"               },
+#endif
 
 #ifdef SIOCINQ
 	{ SIOCINQ,                          "SIOCINQ"                         },
@@ -224,6 +257,25 @@ struct int_symbol platform_symbols_table[] = {
 	{ POLLHUP,                          "POLLHUP"                         },
 	{ POLLNVAL,                         "POLLNVAL"                        },
 
+	{ EPOLLIN,                          "EPOLLIN"                         },
+	{ EPOLLPRI,                         "EPOLLPRI"                        },
+	{ EPOLLOUT,                         "EPOLLOUT"                        },
+	{ EPOLLRDHUP,                       "EPOLLRDHUP"                      },
+	{ EPOLLERR,                         "EPOLLERR"                        },
+	{ EPOLLHUP,                         "EPOLLHUP"                        },
+	{ EPOLLET,                          "EPOLLET"                         },
+	{ EPOLLONESHOT,                     "EPOLLONESHOT"                    },
+#ifdef EPOLLEXCLUSIVE
+	{ EPOLLEXCLUSIVE,                   "EPOLLEXCLUSIVE"                  },
+#endif
+	{ EPOLL_CTL_ADD,                    "EPOLL_CTL_ADD"                   },
+	{ EPOLL_CTL_MOD,                    "EPOLL_CTL_MOD"                   },
+	{ EPOLL_CTL_DEL,                    "EPOLL_CTL_DEL"                   },
+	{ EPOLL_CLOEXEC,                    "EPOLL_CLOEXEC"                   },
+
+	{ SOCK_NONBLOCK,                    "SOCK_NONBLOCK"                   },
+	{ SOCK_CLOEXEC,                     "SOCK_CLOEXEC"                    },
+
 	{ EPERM,                            "EPERM"                           },
 	{ ENOENT,                           "ENOENT"                          },
 	{ ESRCH,                            "ESRCH"                           },
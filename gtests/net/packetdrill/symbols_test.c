@@ -0,0 +1,66 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for symbols.c: every symbol in the tables is found with the
+ * value a linear search of the tables would give, and other names are
+ * not found.
+ */
+
+#include "symbols.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/* The first entry for the name, searching the tables in order. */
+static const struct int_symbol *linear_search(const char *name)
+{
+	struct int_symbol *tables[] = {
+		cross_platform_symbols, platform_symbols(),
+	};
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(tables); ++i)
+		for (j = 0; tables[i][j].name != NULL; ++j)
+			if (strcmp(tables[i][j].name, name) == 0)
+				return &tables[i][j];
+	return NULL;
+}
+
+static void check_table(struct int_symbol *table)
+{
+	int i;
+
+	for (i = 0; table[i].name != NULL; ++i) {
+		assert(find_int_symbol(table[i].name) ==
+		       linear_search(table[i].name));
+	}
+}
+
+int main(void)
+{
+	check_table(cross_platform_symbols);
+	check_table(platform_symbols());
+
+	assert(find_int_symbol("SOL_SOCKET")->value == SOL_SOCKET);
+	assert(find_int_symbol("SOL_SOCKETS") == NULL);
+	assert(find_int_symbol("sol_socket") == NULL);
+	assert(find_int_symbol("") == NULL);
+	assert(find_int_symbol("no_such_symbol") == NULL);
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the syn_flood event's flow table; see syn_flood.h.
+ */
+
+#include "syn_flood.h"
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unaligned.h"
+
+/* Most remote addresses a flood spreads its flows over. */
+#define SYN_FLOOD_MAX_ADDRS	65536
+
+/* The splitmix64 finalizer: a cheap, well-mixed hash of x. */
+static u64 mix64(u64 x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* Return the low 32 bits of the given address. */
+static u32 low_bits(const struct ip_address *ip)
+{
+	int len = ip_address_length(ip->address_family);
+
+	return get_unaligned_be32(ip->ip.bytes + len - 4);
+}
+
+int syn_flood_table_init(struct syn_flood_table *table,
+			 const struct ip_prefix *prefix,
+			 const struct ip_address *base,
+			 u32 num_flows, double complete_pct, u64 seed,
+			 char **error)
+{
+	int len = ip_address_length(base->address_family);
+	int host_bits = len * 8 - prefix->prefix_len;
+	u32 low = low_bits(base);
+	u64 num_addrs;
+
+	memset(table, 0, sizeof(*table));
+
+	/* Count the addresses after base, short of the end of the prefix
+	 * and, for IPv4, of its broadcast address.
+	 */
+	if (host_bits >= 32) {
+		num_addrs = 0xffffffffULL - low;
+	} else {
+		u32 host_mask = (1U << host_bits) - 1;
+
+		num_addrs = host_mask - (low & host_mask);
+		if (base->address_family == AF_INET && num_addrs > 0)
+			--num_addrs;
+	}
+	table->num_addrs = min(num_addrs, (u64)SYN_FLOOD_MAX_ADDRS);
+	table->num_ports = 65536 - SYN_FLOOD_FIRST_PORT;
+	if ((u64)table->num_addrs * table->num_ports < num_flows) {
+		asprintf(error, "remote prefix has room for %llu flows, "
+			 "not %u", (u64)table->num_addrs * table->num_ports,
+			 num_flows);
+		return STATUS_ERR;
+	}
+
+	table->base = *base;
+	table->seed = seed;
+	table->complete_per_10000 = complete_pct * 100;
+	table->num_flows = num_flows;
+	table->flows = calloc(num_flows ? num_flows : 1,
+			      sizeof(struct syn_flood_flow));
+	return STATUS_OK;
+}
+
+void syn_flood_table_free(struct syn_flood_table *table)
+{
+	free(table->flows);
+	memset(table, 0, sizeof(*table));
+}
+
+void syn_flood_flow_endpoint(const struct syn_flood_table *table,
+			     u32 i, struct ip_address *ip, __be16 *port)
+{
+	int len = ip_address_length(table->base.address_family);
+
+	*ip = table->base;
+	put_unaligned_be32(low_bits(&table->base) + 1 + i % table->num_addrs,
+			   ip->ip.bytes + len - 4);
+	*port = htons(SYN_FLOOD_FIRST_PORT + i / table->num_addrs);
+}
+
+s64 syn_flood_flow_index(const struct syn_flood_table *table,
+			 const struct ip_address *ip, __be16 port)
+{
+	int len = ip_address_length(table->base.address_family);
+	u32 addr, port_index;
+	u64 i;
+
+	if (ip->address_family != table->base.address_family ||
+	    memcmp(ip->ip.bytes, table->base.ip.bytes, len - 4) != 0)
+		return -1;
+	addr = low_bits(ip) - low_bits(&table->base) - 1;
+	port_index = ntohs(port) - SYN_FLOOD_FIRST_PORT;
+	if (addr >= table->num_addrs || port_index >= table->num_ports)
+		return -1;
+	i = (u64)port_index * table->num_addrs + addr;
+	return i < table->num_flows ? (s64)i : -1;
+}
+
+u32 syn_flood_flow_isn(const struct syn_flood_table *table, u32 i)
+{
+	return mix64(table->seed + 2 * (u64)i);
+}
+
+u64 syn_flood_flow_key(const struct syn_flood_table *table, u32 i)
+{
+	return mix64(table->seed + 2 * (u64)i + 1);
+}
+
+bool syn_flood_flow_completes(const struct syn_flood_table *table, u32 i)
+{
+	return (syn_flood_flow_key(table, i) >> 32) % 10000 <
+		table->complete_per_10000;
+}
+
+static int compare_s64(const void *a, const void *b)
+{
+	s64 x = *(const s64 *)a, y = *(const s64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+s64 syn_flood_latency_usecs(const struct syn_flood_table *table,
+			    u32 num_flows, int percent)
+{
+	s64 *latencies = malloc((num_flows ? num_flows : 1) * sizeof(s64));
+	s64 result = -1;
+	u32 i, n = 0;
+	u64 rank;
+
+	for (i = 0; i < num_flows; ++i) {
+		const struct syn_flood_flow *flow = &table->flows[i];
+
+		if (flow->flags & SYN_FLOOD_SYNACKED)
+			latencies[n++] = flow->synack_usecs - flow->syn_usecs;
+	}
+	if (n > 0) {
+		qsort(latencies, n, sizeof(s64), compare_s64);
+		/* Nearest rank. */
+		rank = ((u64)n * percent + 99) / 100;
+		result = latencies[rank > 0 ? rank - 1 : 0];
+	}
+	free(latencies);
+	return result;
+}
@@ -0,0 +1,106 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * The flow table of a syn_flood event (see struct syn_flood_spec).
+ *
+ * A flood opens far too many flows to give each one a struct socket.
+ * Instead, flow i has a remote address and port computed from i, so a
+ * SYN/ACK's destination maps straight back to its flow with no lookup
+ * structure at all, and the table is just an array of the few bytes
+ * each flow needs: when its SYN went and when the kernel answered.
+ * Our ISN, our MPTCP key and whether we complete the handshake are
+ * also computed from i rather than stored.
+ *
+ * The remote addresses are those after the default remote address in
+ * the remote prefix, which is routed to the tun device; flows take
+ * each address in turn before moving on to the next port.
+ */
+
+#ifndef __SYN_FLOOD_H__
+#define __SYN_FLOOD_H__
+
+#include "types.h"
+
+#include "ip_address.h"
+#include "ip_prefix.h"
+
+/* The first remote port flows use; those below are left to scripts. */
+#define SYN_FLOOD_FIRST_PORT	1024
+
+/* Flags of a flow. */
+#define SYN_FLOOD_SYNACKED	0x01	/* the kernel sent a SYN/ACK */
+#define SYN_FLOOD_ACKED		0x02	/* and we completed the handshake */
+#define SYN_FLOOD_REFUSED	0x04	/* the kernel sent a RST */
+
+struct syn_flood_flow {
+	u32 syn_usecs;		/* when we sent the SYN, from the start */
+	u32 synack_usecs;	/* when the first SYN/ACK came, likewise */
+	u8 flags;
+};
+
+struct syn_flood_table {
+	struct ip_address base;		/* remote address before the first */
+	u32 num_addrs;			/* remote addresses after base */
+	u32 num_ports;			/* remote ports from FIRST_PORT */
+	u64 seed;			/* for ISNs, keys and completions */
+	u32 complete_per_10000;		/* handshakes completed, per 10000 */
+	u32 num_flows;
+	struct syn_flood_flow *flows;
+};
+
+/* Set up a table of num_flows flows with remote addresses after base
+ * in the given prefix, completing the given percent of handshakes.
+ * Returns STATUS_OK on success, or STATUS_ERR and sets error message
+ * if the prefix has too few addresses and ports for that many flows.
+ */
+extern int syn_flood_table_init(struct syn_flood_table *table,
+				const struct ip_prefix *prefix,
+				const struct ip_address *base,
+				u32 num_flows, double complete_pct, u64 seed,
+				char **error);
+
+extern void syn_flood_table_free(struct syn_flood_table *table);
+
+/* Fill in the remote address and port (in network order) of flow i. */
+extern void syn_flood_flow_endpoint(const struct syn_flood_table *table,
+				    u32 i, struct ip_address *ip,
+				    __be16 *port);
+
+/* Return the flow with the given remote address and port (in network
+ * order), or -1 if there is none.
+ */
+extern s64 syn_flood_flow_index(const struct syn_flood_table *table,
+				const struct ip_address *ip, __be16 port);
+
+/* Our ISN for flow i. */
+extern u32 syn_flood_flow_isn(const struct syn_flood_table *table, u32 i);
+
+/* Our MPTCP key for flow i. */
+extern u64 syn_flood_flow_key(const struct syn_flood_table *table, u32 i);
+
+/* Do we complete the handshake of flow i? */
+extern bool syn_flood_flow_completes(const struct syn_flood_table *table,
+				     u32 i);
+
+/* Return the given percentile of the SYN to SYN/ACK latency of the
+ * first num_flows flows that were answered, in microseconds, or -1 if
+ * none were.
+ */
+extern s64 syn_flood_latency_usecs(const struct syn_flood_table *table,
+				   u32 num_flows, int percent);
+
+#endif /* __SYN_FLOOD_H__ */
@@ -0,0 +1,121 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for syn_flood.c: flows map to remote endpoints inside the
+ * prefix and back, and about the asked-for share complete.
+ */
+
+#include "syn_flood.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdlib.h>
+
+static void test_endpoints(void)
+{
+	struct ip_prefix prefix = ipv4_prefix_parse("192.0.2.0/24");
+	struct ip_address base = ipv4_parse("192.0.2.1");
+	struct ip_address ip, broadcast = ipv4_parse("192.0.2.255");
+	struct syn_flood_table table;
+	char *error = NULL;
+	__be16 port;
+	u32 i;
+
+	/* 192.0.2.2 to .254: 253 addresses. */
+	assert(syn_flood_table_init(&table, &prefix, &base, 100000, 0, 1,
+				    &error) == STATUS_OK);
+	assert(table.num_addrs == 253);
+
+	for (i = 0; i < table.num_flows; ++i) {
+		syn_flood_flow_endpoint(&table, i, &ip, &port);
+		assert(!is_equal_ip(&ip, &base));
+		assert(!is_equal_ip(&ip, &broadcast));
+		assert(ntohs(port) >= SYN_FLOOD_FIRST_PORT);
+		assert(syn_flood_flow_index(&table, &ip, port) == i);
+	}
+
+	/* Flows take each address before the next port. */
+	syn_flood_flow_endpoint(&table, 253, &ip, &port);
+	assert(ntohs(port) == SYN_FLOOD_FIRST_PORT + 1);
+
+	/* Endpoints of no flow. */
+	assert(syn_flood_flow_index(&table, &base, htons(2000)) == -1);
+	ip = ipv4_parse("198.51.100.2");
+	assert(syn_flood_flow_index(&table, &ip, htons(2000)) == -1);
+	syn_flood_flow_endpoint(&table, 0, &ip, &port);
+	assert(syn_flood_flow_index(&table, &ip, htons(80)) == -1);
+	syn_flood_flow_endpoint(&table, table.num_flows - 1, &ip, &port);
+	assert(syn_flood_flow_index(&table, &ip,
+				    htons(ntohs(port) + 1)) == -1);
+	syn_flood_table_free(&table);
+
+	/* A /30 has no room after its last host address. */
+	prefix = ipv4_prefix_parse("192.0.2.0/30");
+	base = ipv4_parse("192.0.2.2");
+	assert(syn_flood_table_init(&table, &prefix, &base, 10, 0, 1,
+				    &error) == STATUS_ERR);
+	free(error);
+}
+
+static void test_completes(void)
+{
+	struct ip_prefix prefix = ipv6_prefix_parse("fd3d:fa7b:d17d::/48");
+	struct ip_address base = ipv6_parse("fd3d:fa7b:d17d::1");
+	struct syn_flood_table table;
+	char *error = NULL;
+	u32 i, n = 0;
+
+	assert(syn_flood_table_init(&table, &prefix, &base, 10000, 25, 7,
+				    &error) == STATUS_OK);
+	for (i = 0; i < table.num_flows; ++i)
+		n += syn_flood_flow_completes(&table, i);
+	assert(n > 2200 && n < 2800);
+	assert(syn_flood_flow_isn(&table, 1) != syn_flood_flow_isn(&table, 2));
+	syn_flood_table_free(&table);
+}
+
+static void test_latency(void)
+{
+	struct ip_prefix prefix = ipv4_prefix_parse("192.0.2.0/24");
+	struct ip_address base = ipv4_parse("192.0.2.1");
+	struct syn_flood_table table;
+	char *error = NULL;
+	u32 i;
+
+	assert(syn_flood_table_init(&table, &prefix, &base, 100, 0, 1,
+				    &error) == STATUS_OK);
+	assert(syn_flood_latency_usecs(&table, 100, 50) == -1);
+
+	/* Flow i is answered after i + 1 usecs; the last one never. */
+	for (i = 0; i < 99; ++i) {
+		table.flows[i].syn_usecs = 1000 * i;
+		table.flows[i].synack_usecs = 1000 * i + i + 1;
+		table.flows[i].flags = SYN_FLOOD_SYNACKED;
+	}
+	assert(syn_flood_latency_usecs(&table, 100, 50) == 50);
+	assert(syn_flood_latency_usecs(&table, 100, 100) == 99);
+	assert(syn_flood_latency_usecs(&table, 10, 100) == 10);
+	syn_flood_table_free(&table);
+}
+
+int main(void)
+{
+	test_endpoints();
+	test_completes();
+	test_latency();
+	return 0;
+}
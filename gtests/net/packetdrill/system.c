@@ -19,21 +19,335 @@
 /*
  * Author: ncardwell@google.com (Neal Cardwell)
  *
- * A module to execute a system(3) shell command and check the result.
+ * A module to execute a system(3) shell command and check the result,
+ * doing common commands ourselves and others in a helper process.
  */
 
 #include "system.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unistd.h>
+#ifdef linux
+#include <sys/prctl.h>
+#endif
+#include "logging.h"
+#include "netlink.h"
+
+#define BUILTIN_MAX_WORDS	(BUILTIN_MAX_SYSCTLS + 4)
+
+/* Characters that mean a command needs a real shell. */
+static const char shell_chars[] = "\"'`$\\;&|<>(){}[]*?~#!\n";
+
+/* The helper process that runs shell commands for us. */
+static struct {
+	pid_t owner;		/* process the helper serves */
+	pid_t pid;		/* the helper itself */
+	int fd;			/* our end of its socket, or -1 */
+} helper = { 0, 0, -1 };
+
+/* What the helper sends back for each command. */
+struct helper_reply {
+	int status;		/* what system(3) returned */
+	int errno_value;	/* errno, if status is -1 */
+};
+
+/* Split the command at whitespace into the words array. Returns the
+ * number of words, or -1 if there are too many.
+ */
+static int split_words(char *command, char **words, int max_words)
+{
+	int num_words = 0;
+	char *word;
+
+	for (word = strtok(command, " \t"); word != NULL;
+	     word = strtok(NULL, " \t")) {
+		if (num_words == max_words)
+			return -1;
+		words[num_words++] = word;
+	}
+	return num_words;
+}
+
+/* Is the word the given program, possibly with a directory? */
+static bool is_program(const char *word, const char *program)
+{
+	const char *slash = strrchr(word, '/');
+
+	return strcmp(slash != NULL ? slash + 1 : word, program) == 0;
+}
+
+/* Parse "sysctl [-e] [-q] [-w] key=value..." Plain reads and other
+ * options are left to the real sysctl(8).
+ */
+static enum builtin_command_t parse_sysctl(char **words, int num_words,
+					   struct builtin_command *builtin)
+{
+	int i;
+
+	for (i = 1; i < num_words && words[i][0] == '-'; i++) {
+		const char *flag;
+
+		if (words[i][1] == '\0')
+			return BUILTIN_NONE;
+		for (flag = words[i] + 1; *flag != '\0'; flag++) {
+			if (*flag == 'q')
+				builtin->quiet = true;
+			else if (*flag == 'e')
+				builtin->ignore_unknown = true;
+			else if (*flag != 'w')
+				return BUILTIN_NONE;
+		}
+	}
+	if (i == num_words)
+		return BUILTIN_NONE;
+	for (; i < num_words; i++) {
+		char *equals = strchr(words[i], '=');
+
+		if (equals == NULL || equals == words[i] ||
+		    equals[1] == '\0' || strchr(words[i], '/') != NULL ||
+		    builtin->num_sysctls == BUILTIN_MAX_SYSCTLS)
+			return BUILTIN_NONE;
+		*equals = '\0';
+		builtin->sysctls[builtin->num_sysctls].key = words[i];
+		builtin->sysctls[builtin->num_sysctls].value = equals + 1;
+		builtin->num_sysctls++;
+	}
+	return BUILTIN_SYSCTL;
+}
+
+/* Parse the netlink operations of ip(8) that we know. */
+static enum builtin_command_t parse_ip(char **words, int num_words)
+{
+	if ((num_words == 3 ||
+	     (num_words == 4 && strcmp(words[3], "all") == 0)) &&
+	    strcmp(words[1], "tcp_metrics") == 0 &&
+	    strcmp(words[2], "flush") == 0)
+		return BUILTIN_FLUSH_TCP_METRICS;
+	if (num_words == 4 &&
+	    strcmp(words[1], "mptcp") == 0 &&
+	    strcmp(words[2], "endpoint") == 0 &&
+	    strcmp(words[3], "flush") == 0)
+		return BUILTIN_FLUSH_MPTCP_ENDPOINTS;
+	return BUILTIN_NONE;
+}
+
+enum builtin_command_t parse_builtin_command(
+	const char *command, struct builtin_command *builtin)
+{
+	char *words[BUILTIN_MAX_WORDS];
+	int num_words;
+
+	memset(builtin, 0, sizeof(*builtin));
+	builtin->type = BUILTIN_NONE;
+	if (strpbrk(command, shell_chars) != NULL)
+		return BUILTIN_NONE;
+
+	builtin->words = strdup(command);
+	num_words = split_words(builtin->words, words, BUILTIN_MAX_WORDS);
+	if (num_words < 2)
+		return BUILTIN_NONE;
+
+	if (is_program(words[0], "sysctl"))
+		builtin->type = parse_sysctl(words, num_words, builtin);
+	else if (is_program(words[0], "ip"))
+		builtin->type = parse_ip(words, num_words);
+	return builtin->type;
+}
+
+void builtin_command_free(struct builtin_command *builtin)
+{
+	free(builtin->words);
+	builtin->words = NULL;
+}
+
+/* Write one setting to /proc/sys, as sysctl(8) does. */
+static int write_sysctl(const struct builtin_command *builtin,
+			const char *key, const char *value, char **error)
+{
+	char path[256];
+	char *p;
+	int fd, len, written;
+
+	len = snprintf(path, sizeof(path), "/proc/sys/%s", key);
+	if (len >= sizeof(path)) {
+		asprintf(error, "sysctl key too long: %s", key);
+		return STATUS_ERR;
+	}
+	for (p = path + strlen("/proc/sys/"); *p != '\0'; p++) {
+		if (*p == '.')
+			*p = '/';
+	}
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno == ENOENT && builtin->ignore_unknown)
+			return STATUS_OK;
+		asprintf(error, "sysctl: cannot set %s: %s", key,
+			 strerror(errno));
+		return STATUS_ERR;
+	}
+	len = strlen(value);
+	written = write(fd, value, len);
+	if (written != len) {
+		asprintf(error, "sysctl: cannot set %s to %s: %s", key, value,
+			 written < 0 ? strerror(errno) : "short write");
+		close(fd);
+		return STATUS_ERR;
+	}
+	close(fd);
+
+	if (!builtin->quiet) {
+		printf("%s = %s\n", key, value);
+		fflush(stdout);
+	}
+	return STATUS_OK;
+}
+
+/* Run a command that parse_builtin_command() accepted. */
+int run_builtin_command(const struct builtin_command *builtin, char **error)
+{
+	int i;
+
+	switch (builtin->type) {
+	case BUILTIN_SYSCTL:
+		for (i = 0; i < builtin->num_sysctls; i++) {
+			if (write_sysctl(builtin, builtin->sysctls[i].key,
+					 builtin->sysctls[i].value, error))
+				return STATUS_ERR;
+		}
+		return STATUS_OK;
+#ifdef linux
+	case BUILTIN_FLUSH_TCP_METRICS:
+		return netlink_flush_tcp_metrics(error);
+	case BUILTIN_FLUSH_MPTCP_ENDPOINTS:
+		return netlink_flush_mptcp_endpoints(error);
+#else
+	case BUILTIN_FLUSH_TCP_METRICS:
+	case BUILTIN_FLUSH_MPTCP_ENDPOINTS:
+		asprintf(error, "netlink is only supported on Linux");
+		return STATUS_ERR;
+#endif
+	case BUILTIN_NONE:
+		break;
+	}
+	assert(!"not a builtin command");
+	return STATUS_ERR;
+}
+
+/* The helper's main loop: run each command we get with system(3) and
+ * send back its status, until our parent goes away.
+ */
+static void helper_loop(int fd)
+{
+	for (;;) {
+		struct helper_reply reply;
+		ssize_t len;
+		char *command;
+
+		len = recv(fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return;
+		command = malloc(len + 1);
+		if (recv(fd, command, len, 0) != len)
+			return;
+		command[len] = '\0';
+
+		reply.status = system(command);
+		reply.errno_value = errno;
+		free(command);
+		if (send(fd, &reply, sizeof(reply), 0) != sizeof(reply))
+			return;
+	}
+}
+
+void system_helper_start(void)
+{
+	int fds[2];
+
+	if (helper.fd >= 0) {
+		if (helper.owner == getpid())
+			return;
+		/* We inherited the helper of our parent; leave it be. */
+		close(helper.fd);
+		helper.fd = -1;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0)
+		die_perror("socketpair");
+	helper.owner = getpid();
+	helper.pid = fork();
+	if (helper.pid < 0)
+		die_perror("fork");
+	if (helper.pid == 0) {
+		close(fds[0]);
+#ifdef linux
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+		if (getppid() == helper.owner)
+			helper_loop(fds[1]);
+		_exit(EXIT_SUCCESS);
+	}
+	close(fds[1]);
+	helper.fd = fds[0];
+}
+
+/* Have the helper run the command, and fill in its system(3) status.
+ * Returns STATUS_OK on success; on failure to talk to the helper
+ * returns STATUS_ERR and sets error message.
+ */
+static int helper_system(const char *command, int *status, char **error)
+{
+	struct helper_reply reply;
+	ssize_t len;
+
+	if (send(helper.fd, command, strlen(command), 0) < 0) {
+		if (errno == EMSGSIZE) {
+			*status = system(command);
+			return STATUS_OK;
+		}
+		asprintf(error, "command helper send: %s", strerror(errno));
+		return STATUS_ERR;
+	}
+	do {
+		len = recv(helper.fd, &reply, sizeof(reply), 0);
+	} while (len < 0 && errno == EINTR);
+	if (len != sizeof(reply)) {
+		asprintf(error, "command helper died");
+		return STATUS_ERR;
+	}
+	*status = reply.status;
+	errno = reply.errno_value;
+	return STATUS_OK;
+}
 
 int safe_system(const char *command, char **error)
 {
-	int status = system(command);
+	struct builtin_command builtin;
+	int status;
+
+	if (parse_builtin_command(command, &builtin) != BUILTIN_NONE) {
+		status = run_builtin_command(&builtin, error);
+		builtin_command_free(&builtin);
+		return status;
+	}
+	builtin_command_free(&builtin);
+
+	if (helper.fd >= 0 && helper.owner == getpid()) {
+		if (helper_system(command, &status, error))
+			return STATUS_ERR;
+	} else {
+		status = system(command);
+	}
 	if (status == -1) {
 		asprintf(error, "%s", strerror(errno));
 		return STATUS_ERR;
@@ -20,6 +20,13 @@
  * Author: ncardwell@google.com (Neal Cardwell)
  *
  * Interface to execute a system(3) shell command and check the result.
+ *
+ * The commands scripts run most, like "sysctl -q net.mptcp.enabled=1"
+ * or "ip tcp_metrics flush", we carry out ourselves, writing /proc/sys
+ * or talking netlink, without forking. Once system_helper_start() has
+ * run, other commands go to a helper process forked early, while our
+ * memory was still small and unlocked, since forking a big process
+ * with mlockall'd memory can take long enough to upset event timing.
  */
 
 #ifndef __SYSTEM_H__
@@ -27,7 +34,57 @@
 
 #include "types.h"
 
-/* Execute the given command with system(3). On success, returns
+#define BUILTIN_MAX_SYSCTLS	16	/* most settings in one sysctl */
+
+/* The commands we can run without a shell. */
+enum builtin_command_t {
+	BUILTIN_NONE,			/* anything else: needs a shell */
+	BUILTIN_SYSCTL,			/* sysctl [-e] [-q] [-w] key=value... */
+	BUILTIN_FLUSH_TCP_METRICS,	/* ip tcp_metrics flush [all] */
+	BUILTIN_FLUSH_MPTCP_ENDPOINTS,	/* ip mptcp endpoint flush */
+};
+
+/* A parsed command we can run without a shell. */
+struct builtin_command {
+	enum builtin_command_t type;
+	bool quiet;			/* sysctl -q: don't echo settings */
+	bool ignore_unknown;		/* sysctl -e: skip unknown keys */
+	struct {
+		const char *key;	/* e.g. "net.mptcp.enabled" */
+		const char *value;
+	} sysctls[BUILTIN_MAX_SYSCTLS];
+	int num_sysctls;
+	char *words;			/* malloc-ed copy of the command, which
+					 * the strings above point into
+					 */
+};
+
+/* Parse the command, and see if we can run it without a shell. Returns
+ * the type, which is BUILTIN_NONE if we can't. Pass the parsed command
+ * to builtin_command_free() in any case.
+ */
+extern enum builtin_command_t parse_builtin_command(
+	const char *command, struct builtin_command *builtin);
+
+/* Free the parts of a parsed command that parse_builtin_command()
+ * allocated.
+ */
+extern void builtin_command_free(struct builtin_command *builtin);
+
+/* Carry out a command parse_builtin_command() parsed as a builtin. On
+ * success, returns STATUS_OK. On error returns STATUS_ERR and fills in
+ * *error.
+ */
+extern int run_builtin_command(const struct builtin_command *builtin,
+			       char **error);
+
+/* Fork the helper process that runs our shell commands from now on,
+ * unless this process has one already. Call this before locking our
+ * memory.
+ */
+extern void system_helper_start(void);
+
+/* Execute the given command, as system(3) would. On success, returns
  * STATUS_OK. On error returns STATUS_ERR and fills in *error.
  */
 extern int safe_system(const char *command, char **error);
@@ -0,0 +1,109 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for system.c: which commands we run without a shell, and
+ * running the rest through the helper process.
+ */
+
+#include "system.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static enum builtin_command_t parse(const char *command,
+				    struct builtin_command *builtin)
+{
+	builtin_command_free(builtin);
+	return parse_builtin_command(command, builtin);
+}
+
+static void test_parse(void)
+{
+	struct builtin_command builtin = { .words = NULL };
+
+	assert(parse("sysctl -q net.mptcp.enabled=1", &builtin) ==
+	       BUILTIN_SYSCTL);
+	assert(builtin.quiet);
+	assert(!builtin.ignore_unknown);
+	assert(builtin.num_sysctls == 1);
+	assert(strcmp(builtin.sysctls[0].key, "net.mptcp.enabled") == 0);
+	assert(strcmp(builtin.sysctls[0].value, "1") == 0);
+
+	assert(parse("/sbin/sysctl -ew  a.b=2\tc.d=3", &builtin) ==
+	       BUILTIN_SYSCTL);
+	assert(!builtin.quiet);
+	assert(builtin.ignore_unknown);
+	assert(builtin.num_sysctls == 2);
+	assert(strcmp(builtin.sysctls[1].key, "c.d") == 0);
+	assert(strcmp(builtin.sysctls[1].value, "3") == 0);
+
+	assert(parse("ip tcp_metrics flush", &builtin) ==
+	       BUILTIN_FLUSH_TCP_METRICS);
+	assert(parse("ip tcp_metrics flush all", &builtin) ==
+	       BUILTIN_FLUSH_TCP_METRICS);
+	assert(parse("ip mptcp endpoint flush", &builtin) ==
+	       BUILTIN_FLUSH_MPTCP_ENDPOINTS);
+
+	/* Reads, other options, and anything for a shell need sysctl(8)
+	 * or ip(8) themselves.
+	 */
+	assert(parse("sysctl net.mptcp.enabled", &builtin) == BUILTIN_NONE);
+	assert(parse("sysctl -p", &builtin) == BUILTIN_NONE);
+	assert(parse("sysctl -q", &builtin) == BUILTIN_NONE);
+	assert(parse("sysctl -q a.b=", &builtin) == BUILTIN_NONE);
+	assert(parse("sysctl -q net/ipv4/x=1", &builtin) == BUILTIN_NONE);
+	assert(parse("sysctl -q a.b=1; reboot", &builtin) == BUILTIN_NONE);
+	assert(parse("sysctl -q a.b=$X", &builtin) == BUILTIN_NONE);
+	assert(parse("sysctl -q \"a.b=1 2\"", &builtin) == BUILTIN_NONE);
+	assert(parse("sysctl -q a.b=1 > /dev/null", &builtin) ==
+	       BUILTIN_NONE);
+	assert(parse("ip -6 tcp_metrics flush", &builtin) == BUILTIN_NONE);
+	assert(parse("ip tcp_metrics flush 10.0.0.1", &builtin) ==
+	       BUILTIN_NONE);
+	assert(parse("ip mptcp endpoint show", &builtin) == BUILTIN_NONE);
+	assert(parse("echo hi", &builtin) == BUILTIN_NONE);
+	assert(parse("", &builtin) == BUILTIN_NONE);
+
+	builtin_command_free(&builtin);
+}
+
+static void test_shell(void)
+{
+	char *error = NULL;
+
+	assert(safe_system("true", &error) == STATUS_OK);
+	assert(safe_system("exit 3", &error) == STATUS_ERR);
+	assert(strcmp(error, "non-zero status 3") == 0);
+	free(error);
+	error = NULL;
+}
+
+int main(void)
+{
+	char *error = NULL;
+
+	test_parse();
+
+	/* Without the helper, and then with it. */
+	test_shell();
+	system_helper_start();
+	system_helper_start();
+	test_shell();
+	assert(safe_system("test -n \"$(echo x)\"", &error) == STATUS_OK);
+	return 0;
+}
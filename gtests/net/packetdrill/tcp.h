@@ -168,6 +168,23 @@ struct _tcp_info {
 	__u32	tcpi_total_retrans;
 };
 
+/* Upstream MPTCP socket options, from linux/mptcp.h. */
+#ifndef SOL_MPTCP
+#define SOL_MPTCP		284
+#endif
+#define MPTCP_TCPINFO		2	/* tcp_info of each subflow */
+
+/* Header of the MPTCP_TCPINFO buffer; an array of num_subflows
+ * tcp_info structs of size_user bytes each follows it, at offset
+ * size_subflow_data.
+ */
+struct _mptcp_subflow_data {
+	__u32	size_subflow_data;	/* size of this struct, from user */
+	__u32	num_subflows;		/* subflows, from kernel */
+	__u32	size_kernel;		/* kernel's size of each element */
+	__u32	size_user;		/* user's size of each element */
+};
+
 #endif  /* linux */
 
 #if defined(__FreeBSD__)
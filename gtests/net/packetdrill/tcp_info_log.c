@@ -0,0 +1,452 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the TCP_INFO sampler. Samples are kept in one
+ * block of columns in memory and written out a block at a time.
+ */
+
+#include "tcp_info_log.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "cpu_affinity.h"
+#include "logging.h"
+#include "tcp.h"
+#include "time_source.h"
+
+/* Rows in a block. */
+#define TCP_INFO_LOG_ROWS	512
+
+/* Most MPTCP subflows we log per socket. */
+#define TCP_INFO_LOG_MAX_SUBFLOWS	8
+
+/* The columns that every row starts with. */
+enum {
+	COLUMN_TIME_USECS = 0,
+	COLUMN_FD,
+	COLUMN_SUBFLOW,
+	NUM_KEY_COLUMNS,
+};
+
+/* The tcp_info fields we log, in the order of get_fields(). */
+static const char *field_names[] = {
+	"tcpi_state",
+	"tcpi_ca_state",
+	"tcpi_retransmits",
+	"tcpi_probes",
+	"tcpi_backoff",
+	"tcpi_options",
+	"tcpi_snd_wscale",
+	"tcpi_rcv_wscale",
+	"tcpi_rto",
+	"tcpi_ato",
+	"tcpi_snd_mss",
+	"tcpi_rcv_mss",
+	"tcpi_unacked",
+	"tcpi_sacked",
+	"tcpi_lost",
+	"tcpi_retrans",
+	"tcpi_fackets",
+	"tcpi_last_data_sent",
+	"tcpi_last_data_recv",
+	"tcpi_last_ack_recv",
+	"tcpi_pmtu",
+	"tcpi_rcv_ssthresh",
+	"tcpi_rtt",
+	"tcpi_rttvar",
+	"tcpi_snd_ssthresh",
+	"tcpi_snd_cwnd",
+	"tcpi_advmss",
+	"tcpi_reordering",
+	"tcpi_rcv_rtt",
+	"tcpi_rcv_space",
+	"tcpi_total_retrans",
+};
+
+#define NUM_FIELDS	ARRAY_SIZE(field_names)
+
+/* A socket we sample. */
+struct watched_fd {
+	int live_fd;
+	int script_fd;
+	bool try_mptcp;			/* might MPTCP_TCPINFO work? */
+};
+
+struct tcp_info_log {
+	pthread_t thread;
+	pthread_mutex_t mutex;		/* for everything below */
+	pthread_cond_t wake;		/* signaled to stop the thread */
+	bool started;			/* is the thread running? */
+	bool stop;			/* should the thread exit? */
+	FILE *file;
+	char *path;
+	int write_errno;		/* first error writing the file */
+	s64 interval_usecs;
+	s64 script_offset_usecs;	/* script time minus live time */
+
+	struct watched_fd *fds;		/* sockets to sample */
+	int num_fds;
+	int max_fds;
+
+	/* The current block of samples. */
+	int num_rows;
+	s64 time_usecs[TCP_INFO_LOG_ROWS];
+	s32 fd[TCP_INFO_LOG_ROWS];
+	s32 subflow[TCP_INFO_LOG_ROWS];
+	u32 fields[NUM_FIELDS][TCP_INFO_LOG_ROWS];
+};
+
+/* The log to finish if we exit before tcp_info_log_free(). */
+static struct tcp_info_log *exit_log;
+
+static void finish_exit_log(void)
+{
+	if (exit_log != NULL)
+		tcp_info_log_free(exit_log);
+}
+
+/* Write to the log file. The sampling thread cannot die on an error,
+ * so we remember the first one for tcp_info_log_free() to report.
+ */
+static void write_data(struct tcp_info_log *log, const void *data,
+		       size_t bytes)
+{
+	if (log->write_errno != 0)
+		return;
+	if (fwrite(data, bytes, 1, log->file) != 1)
+		log->write_errno = errno ? errno : EIO;
+}
+
+static void write_column(struct tcp_info_log *log, const char *name,
+			 u32 bytes, bool is_signed)
+{
+	struct tcp_info_log_column column;
+
+	memset(&column, 0, sizeof(column));
+	strncpy(column.name, name, sizeof(column.name) - 1);
+	column.bytes = bytes;
+	column.is_signed = is_signed;
+	write_data(log, &column, sizeof(column));
+}
+
+static void write_header(struct tcp_info_log *log)
+{
+	struct tcp_info_log_header header;
+	int i;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TCP_INFO_LOG_MAGIC, sizeof(header.magic));
+	header.version = TCP_INFO_LOG_VERSION;
+	header.byte_order = TCP_INFO_LOG_BYTE_ORDER;
+	header.num_columns = NUM_KEY_COLUMNS + NUM_FIELDS;
+	header.interval_usecs = log->interval_usecs;
+	write_data(log, &header, sizeof(header));
+
+	write_column(log, "time_usecs", sizeof(s64), true);
+	write_column(log, "fd", sizeof(s32), true);
+	write_column(log, "subflow", sizeof(s32), true);
+	for (i = 0; i < NUM_FIELDS; i++)
+		write_column(log, field_names[i], sizeof(u32), false);
+}
+
+/* Write out the current block, if it has any rows. */
+static void flush_block(struct tcp_info_log *log)
+{
+	u32 num_rows = log->num_rows;
+	int i;
+
+	if (num_rows == 0)
+		return;
+	write_data(log, &num_rows, sizeof(num_rows));
+	write_data(log, log->time_usecs, num_rows * sizeof(s64));
+	write_data(log, log->fd, num_rows * sizeof(s32));
+	write_data(log, log->subflow, num_rows * sizeof(s32));
+	for (i = 0; i < NUM_FIELDS; i++)
+		write_data(log, log->fields[i], num_rows * sizeof(u32));
+	log->num_rows = 0;
+}
+
+#ifdef linux
+
+/* Add a row for the given tcp_info. */
+static void add_row(struct tcp_info_log *log, s64 time_usecs,
+		    int script_fd, int subflow, const struct _tcp_info *info)
+{
+	const int row = log->num_rows;
+	u32 values[NUM_FIELDS];
+	int i = 0;
+
+	values[i++] = info->tcpi_state;
+	values[i++] = info->tcpi_ca_state;
+	values[i++] = info->tcpi_retransmits;
+	values[i++] = info->tcpi_probes;
+	values[i++] = info->tcpi_backoff;
+	values[i++] = info->tcpi_options;
+	values[i++] = info->tcpi_snd_wscale;
+	values[i++] = info->tcpi_rcv_wscale;
+	values[i++] = info->tcpi_rto;
+	values[i++] = info->tcpi_ato;
+	values[i++] = info->tcpi_snd_mss;
+	values[i++] = info->tcpi_rcv_mss;
+	values[i++] = info->tcpi_unacked;
+	values[i++] = info->tcpi_sacked;
+	values[i++] = info->tcpi_lost;
+	values[i++] = info->tcpi_retrans;
+	values[i++] = info->tcpi_fackets;
+	values[i++] = info->tcpi_last_data_sent;
+	values[i++] = info->tcpi_last_data_recv;
+	values[i++] = info->tcpi_last_ack_recv;
+	values[i++] = info->tcpi_pmtu;
+	values[i++] = info->tcpi_rcv_ssthresh;
+	values[i++] = info->tcpi_rtt;
+	values[i++] = info->tcpi_rttvar;
+	values[i++] = info->tcpi_snd_ssthresh;
+	values[i++] = info->tcpi_snd_cwnd;
+	values[i++] = info->tcpi_advmss;
+	values[i++] = info->tcpi_reordering;
+	values[i++] = info->tcpi_rcv_rtt;
+	values[i++] = info->tcpi_rcv_space;
+	values[i++] = info->tcpi_total_retrans;
+	assert(i == NUM_FIELDS);
+
+	log->time_usecs[row] = time_usecs;
+	log->fd[row] = script_fd;
+	log->subflow[row] = subflow;
+	for (i = 0; i < NUM_FIELDS; i++)
+		log->fields[i][row] = values[i];
+	if (++log->num_rows == TCP_INFO_LOG_ROWS)
+		flush_block(log);
+}
+
+/* Log the subflows of an MPTCP socket. If the socket or the kernel
+ * does not support MPTCP_TCPINFO, stop trying for this socket.
+ */
+static void sample_subflows(struct tcp_info_log *log, s64 time_usecs,
+			    struct watched_fd *watched)
+{
+	struct {
+		struct _mptcp_subflow_data data;
+		struct _tcp_info infos[TCP_INFO_LOG_MAX_SUBFLOWS];
+	} buffer;
+	socklen_t len = sizeof(buffer);
+	const u8 *info;
+	u32 i;
+
+	memset(&buffer, 0, sizeof(buffer));
+	buffer.data.size_subflow_data = sizeof(buffer.data);
+	buffer.data.size_user = sizeof(struct _tcp_info);
+	if (getsockopt(watched->live_fd, SOL_MPTCP, MPTCP_TCPINFO,
+		       &buffer, &len) < 0 ||
+	    buffer.data.size_user < sizeof(struct _tcp_info)) {
+		watched->try_mptcp = false;
+		return;
+	}
+	info = (const u8 *)&buffer + buffer.data.size_subflow_data;
+	for (i = 0; i < buffer.data.num_subflows &&
+		    i < TCP_INFO_LOG_MAX_SUBFLOWS; i++) {
+		if (info + sizeof(struct _tcp_info) > (const u8 *)&buffer + len)
+			break;
+		add_row(log, time_usecs, watched->script_fd, i,
+			(const struct _tcp_info *)info);
+		info += buffer.data.size_user;
+	}
+}
+
+/* Take one sample of every socket we watch. */
+static void sample_all(struct tcp_info_log *log)
+{
+	s64 time_usecs;
+	int i;
+
+	time_usecs = time_now_nsecs() / 1000 + log->script_offset_usecs;
+	for (i = 0; i < log->num_fds; i++) {
+		struct watched_fd *watched = &log->fds[i];
+		struct _tcp_info info;
+		socklen_t len = sizeof(info);
+
+		if (getsockopt(watched->live_fd, IPPROTO_TCP, TCP_INFO,
+			       &info, &len) < 0 || len < sizeof(info))
+			continue;	/* e.g. not TCP */
+		add_row(log, time_usecs, watched->script_fd, -1, &info);
+		if (watched->try_mptcp)
+			sample_subflows(log, time_usecs, watched);
+	}
+}
+
+#else  /* !linux */
+
+static void sample_all(struct tcp_info_log *log)
+{
+}
+
+#endif  /* linux */
+
+static void timespec_add_usecs(struct timespec *ts, s64 usecs)
+{
+	s64 nsecs = ts->tv_nsec + (usecs % 1000000) * 1000;
+
+	ts->tv_sec += usecs / 1000000 + nsecs / 1000000000;
+	ts->tv_nsec = nsecs % 1000000000;
+}
+
+static bool timespec_before(const struct timespec *a,
+			    const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void *tcp_info_log_thread(void *arg)
+{
+	struct tcp_info_log *log = arg;
+	struct timespec deadline, now;
+
+	cpu_affinity_pin(CPU_ROLE_HELPER);
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	pthread_mutex_lock(&log->mutex);
+	while (!log->stop) {
+		sample_all(log);
+
+		/* If we fell behind, skip the samples we missed. */
+		timespec_add_usecs(&deadline, log->interval_usecs);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespec_before(&deadline, &now))
+			deadline = now;
+		while (!log->stop &&
+		       pthread_cond_timedwait(&log->wake, &log->mutex,
+					      &deadline) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&log->mutex);
+	return NULL;
+}
+
+struct tcp_info_log *tcp_info_log_new(const char *path, int interval_usecs)
+{
+	struct tcp_info_log *log = calloc(1, sizeof(struct tcp_info_log));
+	pthread_condattr_t attr;
+	static bool registered;
+
+#ifndef linux
+	die("--tcp_info_log is only supported on Linux\n");
+#endif
+	log->path = strdup(path);
+	log->interval_usecs = interval_usecs;
+	log->file = fopen(path, "w");
+	if (log->file == NULL)
+		die_perror(log->path);
+	write_header(log);
+	if (log->write_errno != 0)
+		die("error writing %s: %s\n", path, strerror(log->write_errno));
+
+	if (pthread_mutex_init(&log->mutex, NULL) != 0)
+		die_perror("pthread_mutex_init");
+	if (pthread_condattr_init(&attr) != 0 ||
+	    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0 ||
+	    pthread_cond_init(&log->wake, &attr) != 0)
+		die_perror("pthread_cond_init");
+	pthread_condattr_destroy(&attr);
+
+	exit_log = log;
+	if (!registered) {
+		atexit(finish_exit_log);
+		registered = true;
+	}
+	return log;
+}
+
+void tcp_info_log_start(struct tcp_info_log *log,
+			s64 live_start_usecs, s64 script_start_usecs)
+{
+	assert(!log->started);
+	log->script_offset_usecs = script_start_usecs - live_start_usecs;
+	if (pthread_create(&log->thread, NULL, tcp_info_log_thread, log) != 0)
+		die_perror("pthread_create");
+	log->started = true;
+}
+
+void tcp_info_log_watch(struct tcp_info_log *log, int live_fd, int script_fd)
+{
+	int i;
+
+	pthread_mutex_lock(&log->mutex);
+	for (i = 0; i < log->num_fds; i++) {
+		if (log->fds[i].live_fd == live_fd)
+			break;
+	}
+	if (i == log->num_fds) {
+		if (log->num_fds == log->max_fds) {
+			log->max_fds = log->max_fds ? 2 * log->max_fds : 8;
+			log->fds = realloc(log->fds, log->max_fds *
+					   sizeof(struct watched_fd));
+		}
+		log->fds[i].live_fd = live_fd;
+		log->fds[i].try_mptcp = true;
+		log->num_fds++;
+	}
+	log->fds[i].script_fd = script_fd;
+	pthread_mutex_unlock(&log->mutex);
+}
+
+void tcp_info_log_forget(struct tcp_info_log *log, int live_fd)
+{
+	int i;
+
+	pthread_mutex_lock(&log->mutex);
+	for (i = 0; i < log->num_fds; i++) {
+		if (log->fds[i].live_fd == live_fd) {
+			log->fds[i] = log->fds[--log->num_fds];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&log->mutex);
+}
+
+void tcp_info_log_free(struct tcp_info_log *log)
+{
+	if (exit_log == log)
+		exit_log = NULL;
+	if (log->started) {
+		pthread_mutex_lock(&log->mutex);
+		log->stop = true;
+		pthread_cond_signal(&log->wake);
+		pthread_mutex_unlock(&log->mutex);
+		pthread_join(log->thread, NULL);
+	}
+	flush_block(log);
+	if (fclose(log->file) != 0 && log->write_errno == 0)
+		log->write_errno = errno;
+	if (log->write_errno != 0)
+		die("error writing %s: %s\n", log->path,
+		    strerror(log->write_errno));
+	pthread_cond_destroy(&log->wake);
+	pthread_mutex_destroy(&log->mutex);
+	free(log->fds);
+	free(log->path);
+	memset(log, 0, sizeof(*log));  /* paranoia to help catch bugs */
+	free(log);
+}
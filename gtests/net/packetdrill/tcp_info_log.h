@@ -0,0 +1,97 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for sampling TCP_INFO of the live sockets of a test at a
+ * fixed interval, on a thread of its own, into a compact binary log
+ * for offline plotting (see --tcp_info_log). For MPTCP sockets on
+ * kernels that support the upstream MPTCP_TCPINFO socket option, the
+ * tcp_info of each subflow is logged too.
+ *
+ * The log is columnar. It has a header:
+ *
+ *   struct tcp_info_log_header
+ *   struct tcp_info_log_column, num_columns of them
+ *
+ * followed by blocks of samples, each of which is a u32 number of
+ * rows and then, for each column in turn, that many values of the
+ * column's size. All numbers are in the byte order of the host that
+ * wrote the log, which byte_order tells apart.
+ *
+ * The first three columns say what each row is: time_usecs is the
+ * script time of the sample, fd the script fd of the socket, and
+ * subflow is -1 for the socket itself or the index of an MPTCP
+ * subflow. The rest are u32 tcp_info fields, named as in code
+ * snippets (tcpi_snd_cwnd, tcpi_rtt, ...).
+ */
+
+#ifndef __TCP_INFO_LOG_H__
+#define __TCP_INFO_LOG_H__
+
+#include "types.h"
+
+#define TCP_INFO_LOG_MAGIC	"pdtcpinf"	/* 8 bytes, no NUL */
+#define TCP_INFO_LOG_VERSION	1
+#define TCP_INFO_LOG_BYTE_ORDER	0x01020304
+
+struct tcp_info_log_header {
+	char magic[8];			/* TCP_INFO_LOG_MAGIC */
+	u32 version;			/* TCP_INFO_LOG_VERSION */
+	u32 byte_order;			/* TCP_INFO_LOG_BYTE_ORDER */
+	u32 num_columns;		/* column descriptions that follow */
+	u32 interval_usecs;		/* time between samples */
+};
+
+struct tcp_info_log_column {
+	char name[24];			/* NUL-padded name */
+	u32 bytes;			/* size of each value: 4 or 8 */
+	u32 is_signed;			/* values are signed integers? */
+};
+
+struct tcp_info_log;
+
+/* Create the log file at the given path and write its header. Dies
+ * on error.
+ */
+extern struct tcp_info_log *tcp_info_log_new(const char *path,
+					     int interval_usecs);
+
+/* Start the sampling thread. Live wall clock time live_start_usecs is
+ * script time script_start_usecs.
+ */
+extern void tcp_info_log_start(struct tcp_info_log *log,
+			       s64 live_start_usecs, s64 script_start_usecs);
+
+/* Sample the socket with the given live fd from now on, logging it
+ * under the given script fd. Watching it again updates the script fd.
+ */
+extern void tcp_info_log_watch(struct tcp_info_log *log,
+			       int live_fd, int script_fd);
+
+/* Stop sampling the socket with the given live fd. Once this returns
+ * the fd is no longer in use by the sampler, so it can be closed.
+ */
+extern void tcp_info_log_forget(struct tcp_info_log *log, int live_fd);
+
+/* Stop the thread, write out the samples not yet written, and close
+ * the log. If the process exits without this, the log is finished at
+ * exit.
+ */
+extern void tcp_info_log_free(struct tcp_info_log *log);
+
+#endif /* __TCP_INFO_LOG_H__ */
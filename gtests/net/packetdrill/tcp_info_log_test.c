@@ -0,0 +1,147 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for tcp_info_log.c: sample a loopback TCP connection and read
+ * back the columnar log.
+ */
+
+#include "tcp_info_log.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#define SCRIPT_FD	7
+
+/* Connect a TCP socket to a listener on loopback; return its fd. */
+static int connect_loopback(int *listen_fd)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	*listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(*listen_fd >= 0);
+	assert(bind(*listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	assert(listen(*listen_fd, 1) == 0);
+	assert(getsockname(*listen_fd, (struct sockaddr *)&addr, &len) == 0);
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(fd >= 0);
+	assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	return fd;
+}
+
+static void read_or_die(FILE *f, void *buf, size_t bytes)
+{
+	assert(fread(buf, bytes, 1, f) == 1);
+}
+
+int main(void)
+{
+	char path[] = "/tmp/tcp_info_log_test_XXXXXX";
+	struct tcp_info_log_header header;
+	struct tcp_info_log_column *columns;
+	int listen_fd, fd, tmp_fd, i, state_column = -1;
+	u32 num_rows, row, total_rows = 0;
+	struct timeval tv;
+	FILE *f;
+
+	tmp_fd = mkstemp(path);
+	assert(tmp_fd >= 0);
+	close(tmp_fd);
+
+	fd = connect_loopback(&listen_fd);
+	struct tcp_info_log *log = tcp_info_log_new(path, 1000);
+	tcp_info_log_watch(log, fd, SCRIPT_FD);
+	gettimeofday(&tv, NULL);
+	tcp_info_log_start(log, timeval_to_usecs(&tv), 0);
+	usleep(20000);
+	tcp_info_log_forget(log, fd);
+	close(fd);
+	tcp_info_log_free(log);
+	close(listen_fd);
+
+	f = fopen(path, "r");
+	assert(f != NULL);
+	read_or_die(f, &header, sizeof(header));
+	assert(memcmp(header.magic, TCP_INFO_LOG_MAGIC, 8) == 0);
+	assert(header.version == TCP_INFO_LOG_VERSION);
+	assert(header.byte_order == TCP_INFO_LOG_BYTE_ORDER);
+	assert(header.interval_usecs == 1000);
+	assert(header.num_columns > 3);
+
+	columns = calloc(header.num_columns, sizeof(*columns));
+	read_or_die(f, columns, header.num_columns * sizeof(*columns));
+	assert(strcmp(columns[0].name, "time_usecs") == 0);
+	assert(columns[0].bytes == 8 && columns[0].is_signed);
+	assert(strcmp(columns[1].name, "fd") == 0);
+	assert(strcmp(columns[2].name, "subflow") == 0);
+	for (i = 3; i < header.num_columns; i++) {
+		assert(strncmp(columns[i].name, "tcpi_", 5) == 0);
+		assert(columns[i].bytes == 4 && !columns[i].is_signed);
+		if (strcmp(columns[i].name, "tcpi_state") == 0)
+			state_column = i;
+	}
+	assert(state_column >= 0);
+
+	while (fread(&num_rows, sizeof(num_rows), 1, f) == 1) {
+		s64 *times = calloc(num_rows, sizeof(s64));
+		s32 *fds = calloc(num_rows, sizeof(s32));
+		s32 *subflows = calloc(num_rows, sizeof(s32));
+		u32 *values = calloc(num_rows, sizeof(u32));
+
+		assert(num_rows > 0);
+		read_or_die(f, times, num_rows * sizeof(s64));
+		read_or_die(f, fds, num_rows * sizeof(s32));
+		read_or_die(f, subflows, num_rows * sizeof(s32));
+		for (i = 3; i < header.num_columns; i++) {
+			read_or_die(f, values, num_rows * sizeof(u32));
+			if (i != state_column)
+				continue;
+			for (row = 0; row < num_rows; row++)
+				assert(values[row] == 1);  /* TCP_ESTABLISHED */
+		}
+		for (row = 0; row < num_rows; row++) {
+			assert(fds[row] == SCRIPT_FD);
+			assert(subflows[row] == -1);
+			assert(times[row] >= 0 && times[row] < 10000000);
+			assert(row == 0 || times[row] >= times[row - 1]);
+		}
+		total_rows += num_rows;
+		free(times);
+		free(fds);
+		free(subflows);
+		free(values);
+	}
+	/* About 20 samples, 1ms apart; be generous on a loaded machine. */
+	assert(total_rows >= 2);
+	assert(total_rows <= 100);
+
+	fclose(f);
+	free(columns);
+	unlink(path);
+	return 0;
+}
@@ -54,6 +54,7 @@
 struct tcp_options {
 	u8 data[MAX_TCP_OPTION_BYTES];	/* The options data, in wire format */
 	u8 length;		/* The length, in bytes, of the data */
+	bool raw;		/* given as <raw "hex">, already live */
 };
 
 /* Specification of a TCP SACK block (RFC 2018) */
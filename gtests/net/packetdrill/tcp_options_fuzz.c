@@ -0,0 +1,72 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Fuzz target for the TCP option iterator: the input is the option
+ * bytes of an otherwise valid TCP packet that has no payload, so the
+ * options end exactly where the buffer does. The iterator, the option
+ * index and the lookups by kind and MPTCP subtype must stay inside the
+ * options, and must agree with each other.
+ */
+
+#include "fuzz_target.h"
+
+#include <assert.h>
+#include "mptcp.h"
+#include "tcp_options_iterator.h"
+
+int LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+	struct packet *packet = fuzz_tcp_packet(0x10, data, size);
+	struct tcp_options_iterator iter;
+	struct tcp_option *option = NULL;
+	char *error = NULL;
+	bool valid = true;
+	int i;
+
+	if (packet == NULL)
+		return 0;
+
+	for (option = tcp_options_begin(packet, &iter); option != NULL;
+	     option = tcp_options_next(&iter, &error)) {
+		assert((u8 *)option >= packet_tcp_options(packet));
+		assert((u8 *)option < packet_payload(packet));
+	}
+	if (error != NULL) {
+		valid = false;
+		free(error);
+		error = NULL;
+	}
+
+	/* The index fails just when the walk does, and finds the
+	 * first option of each kind the walk finds.
+	 */
+	assert((tcp_options_index(packet, &error) == STATUS_OK) == valid);
+	free(error);
+	for (i = 0; i < TCP_OPTION_INDEX_KINDS; ++i) {
+		option = get_tcp_option(packet, i);
+		assert(option == NULL || option->kind == i);
+	}
+	for (i = 0; i < MPTCP_OPTION_INDEX_SUBTYPES; ++i) {
+		option = get_mptcp_option(packet, i);
+		assert(option == NULL ||
+		       (option->kind == TCPOPT_MPTCP &&
+			option->data.mp_capable.subtype == i));
+	}
+
+	packet_free(packet);
+	return 0;
+}
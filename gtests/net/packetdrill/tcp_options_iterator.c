@@ -32,11 +32,13 @@
 #include "tcp_options.h"
 
 /* Return the length (in bytes) we expect to see for the TCP option of
- * the given kind, or 0 if the option is variable-length. Returns
+ * the given kind, or 0 if the option is variable-length. The option
+ * is in a block of TCP options that ends at 'end'. Returns
  * STATUS_OK on success; on failure returns STATUS_ERR and sets
  * error message.
  */
-static int get_expected_tcp_option_length(struct tcp_option *opt, u8 *expected_length,
+static int get_expected_tcp_option_length(struct tcp_option *opt,
+					  const u8 *end, u8 *expected_length,
 					  char **error)
 {
 
@@ -63,10 +65,20 @@ static int get_expected_tcp_option_length(struct tcp_option *opt, u8 *expected_l
 		break;
 
 	case TCPOPT_MPTCP:
+		/* The expected length depends on the length and subtype
+		 * bytes, so they must be within the options.
+		 */
+		if ((u8 *)opt + 2 >= end) {
+			asprintf(error, "MPTCP option subtype extends too far");
+			return STATUS_ERR;
+		}
 		switch(opt->data.mp_capable.subtype){
 
 		case MP_CAPABLE_SUBTYPE:
 			switch(opt->length){
+			case TCPOLEN_MP_CAPABLE_V1_SYN:
+				*expected_length = TCPOLEN_MP_CAPABLE_V1_SYN;
+				break;
 			case TCPOLEN_MP_CAPABLE_SYN:
 				*expected_length = TCPOLEN_MP_CAPABLE_SYN;
 				break;
@@ -148,6 +160,12 @@ static int get_expected_tcp_option_length(struct tcp_option *opt, u8 *expected_l
 			case TCPOLEN_ADD_ADDR_V6_PORT:
 				*expected_length = TCPOLEN_ADD_ADDR_V6_PORT;
 				break;
+			case TCPOLEN_ADD_ADDR_V4_HMAC:
+			case TCPOLEN_ADD_ADDR_V4_PORT_HMAC:
+			case TCPOLEN_ADD_ADDR_V6_HMAC:
+			case TCPOLEN_ADD_ADDR_V6_PORT_HMAC:
+				*expected_length = opt->length;
+				break;
 			default:
 				asprintf(error, "unexpected MPTCP add_addr length: %u", opt->length);
 				return STATUS_ERR;
@@ -260,7 +278,7 @@ struct tcp_option *tcp_options_next(
 
 	struct tcp_option *option = (struct tcp_option *)iter->current_option;
 	if (get_expected_tcp_option_length(
-		    option, &expected_length, error))
+		    option, iter->options_end, &expected_length, error))
 		goto out;
 
 	/* Calculate and validate the actual length of the option. */
@@ -286,6 +304,55 @@ out:
 
 }
 
+int tcp_options_index(struct packet *packet, char **error)
+{
+	struct tcp_options_iterator iter;
+	struct tcp_option *option;
+	char *err = NULL;
+
+	if (packet->tcp_options_indexed)
+		return STATUS_OK;
+
+	memset(packet->tcp_option_offset, 0,
+	       sizeof(packet->tcp_option_offset));
+	memset(packet->mptcp_option_offset, 0,
+	       sizeof(packet->mptcp_option_offset));
+	for (option = tcp_options_begin(packet, &iter); option != NULL;
+	     option = tcp_options_next(&iter, &err)) {
+		u8 offset = (u8 *)option - (u8 *)packet->tcp;
+		u8 subtype;
+
+		if (option->kind < TCP_OPTION_INDEX_KINDS &&
+		    packet->tcp_option_offset[option->kind] == 0)
+			packet->tcp_option_offset[option->kind] = offset;
+
+		if (option->kind != TCPOPT_MPTCP ||
+		    (u8 *)option + 2 >= iter.options_end)
+			continue;
+		subtype = option->data.mp_capable.subtype;
+		if (packet->mptcp_option_offset[subtype] == 0)
+			packet->mptcp_option_offset[subtype] = offset;
+	}
+
+	if (err != NULL) {
+		if (error != NULL)
+			*error = err;
+		else
+			free(err);
+		return STATUS_ERR;
+	}
+	packet->tcp_options_indexed = true;
+	return STATUS_OK;
+}
+
+/* Return the option at the given index offset, or NULL for offset 0. */
+static struct tcp_option *tcp_option_at(struct packet *packet, u8 offset)
+{
+	if (offset == 0)
+		return NULL;
+	return (struct tcp_option *)((u8 *)packet->tcp + offset);
+}
+
 /**
  * Search for the option of kind "kind" in the packet and return the tcp_option
  * pointer to this found option, return NULL if not found.
@@ -293,12 +360,18 @@ out:
  */
 extern struct tcp_option *get_tcp_option(struct packet *packet, u8 kind){
 
+	if (kind < TCP_OPTION_INDEX_KINDS &&
+	    tcp_options_index(packet, NULL) == STATUS_OK)
+		return tcp_option_at(packet, packet->tcp_option_offset[kind]);
+
 	struct tcp_options_iterator tcp_opt_iter;
 	struct tcp_option *tcp_opt = tcp_options_begin(packet, &tcp_opt_iter);
+	char *error = NULL;
 
 	while(tcp_opt != NULL && tcp_opt->kind != kind){
-		tcp_opt = tcp_options_next(&tcp_opt_iter, NULL);
+		tcp_opt = tcp_options_next(&tcp_opt_iter, &error);
 	}
+	free(error);
 	return tcp_opt;
 }
 
@@ -309,11 +382,21 @@ extern struct tcp_option *get_tcp_option(struct packet *packet, u8 kind){
  */
 extern struct tcp_option *get_mptcp_option(struct packet *packet, u8 subtype){
 
+	if (subtype < MPTCP_OPTION_INDEX_SUBTYPES &&
+	    tcp_options_index(packet, NULL) == STATUS_OK)
+		return tcp_option_at(packet,
+				     packet->mptcp_option_offset[subtype]);
+
 	struct tcp_options_iterator tcp_opt_iter;
 	struct tcp_option *tcp_opt = tcp_options_begin(packet, &tcp_opt_iter);
+	char *error = NULL;
 
-	while(tcp_opt != NULL && tcp_opt->data.mp_capable.subtype!=subtype){
-		tcp_opt = tcp_options_next(&tcp_opt_iter, NULL);
+	while(tcp_opt != NULL &&
+	      (tcp_opt->kind != TCPOPT_MPTCP ||
+	       (u8 *)tcp_opt + 2 >= tcp_opt_iter.options_end ||
+	       tcp_opt->data.mp_capable.subtype != subtype)){
+		tcp_opt = tcp_options_next(&tcp_opt_iter, &error);
 	}
+	free(error);
 	return tcp_opt;
 }
@@ -51,7 +51,18 @@ extern struct tcp_option *tcp_options_begin(
 extern struct tcp_option *tcp_options_next(
 	struct tcp_options_iterator *iter, char **error);
 
+/* Fill in the TCP option index of the given TCP packet, if it is not
+ * filled in already, so that get_tcp_option() and get_mptcp_option()
+ * need not scan the options. Returns STATUS_OK on success; on failure
+ * (malformed options) returns STATUS_ERR and, if error is non-NULL,
+ * sets error message.
+ */
+extern int tcp_options_index(struct packet *packet, char **error);
+
+/* Return the first TCP option of the given kind, or NULL if none. */
 extern struct tcp_option *get_tcp_option(struct packet *packet, u8 kind);
+
+/* Return the first MPTCP option of the given subtype, or NULL if none. */
 extern struct tcp_option *get_mptcp_option(struct packet *packet, u8 subtype);
 
 #endif /* __TCP_OPTIONS_ITERATOR_H__ */
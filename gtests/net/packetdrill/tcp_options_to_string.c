@@ -253,6 +253,8 @@ int tcp_options_to_string(struct packet *packet,
         		}else if(option->length == TCPOLEN_MP_CAPABLE_SYN){
         			fprintf(s, "mp_capable sender_key: %lu",
         					(unsigned long)option->data.mp_capable.syn.key);
+        		}else if(option->length == TCPOLEN_MP_CAPABLE_V1_SYN){
+        			fprintf(s, "mp_capable");
         		}else
         			fprintf(s, "mp_capable unknown length");
 
@@ -336,26 +338,26 @@ int tcp_options_to_string(struct packet *packet,
         		break;
         	case ADD_ADDR_SUBTYPE:
 
-        		if(option->length == TCPOLEN_ADD_ADDR_V4){
+        		if(add_addr_length(option) == TCPOLEN_ADD_ADDR_V4){
         			if (!inet_ntop(AF_INET, &option->data.add_addr.ipv4, src_string, ADDR_STR_LEN))
 						die_perror("inet_ntop");
         			fprintf(s, "add_address address_id: %u ipv4: %s",
 						option->data.add_addr.address_id,
 						src_string);
-        		}else if(option->length == TCPOLEN_ADD_ADDR_V4_PORT){
+        		}else if(add_addr_length(option) == TCPOLEN_ADD_ADDR_V4_PORT){
         			if (!inet_ntop(AF_INET, &option->data.add_addr.ipv4_w_port.ipv4, src_string, ADDR_STR_LEN))
 						die_perror("inet_ntop");
         			fprintf(s, "add_address address_id: %u ipv4: %s port: %u",
 						option->data.add_addr.address_id,
 						src_string,
 						ntohs(option->data.add_addr.ipv4_w_port.port));
-        		}else if(option->length == TCPOLEN_ADD_ADDR_V6){
+        		}else if(add_addr_length(option) == TCPOLEN_ADD_ADDR_V6){
         			if (!inet_ntop(AF_INET, &option->data.add_addr.ipv6, src_string, ADDR_STR_LEN))
 						die_perror("inet_ntop");
 					fprintf(s, "add_address address_id: %u ipv6: %s",
 						option->data.add_addr.address_id,
 						src_string);
-        		}else if(option->length == TCPOLEN_ADD_ADDR_V6_PORT){
+        		}else if(add_addr_length(option) == TCPOLEN_ADD_ADDR_V6_PORT){
         			if (!inet_ntop(AF_INET6, &option->data.add_addr.ipv6_w_port.ipv6, src_string, ADDR_STR_LEN))
 						die_perror("inet_ntop");
 					fprintf(s, "add_address address_id: %u ipv6: %s port: %u",
@@ -365,6 +367,12 @@ int tcp_options_to_string(struct packet *packet,
         		}else{
         			fprintf(s, "add_address bad length");
         		}
+        		if(add_addr_has_hmac(option)){
+        			u64 hmac;
+        			memcpy(&hmac, add_addr_hmac(option), sizeof(hmac));
+        			fprintf(s, " hmac: %016llx",
+        				(unsigned long long)be64toh(hmac));
+        		}
         		break;
         	case REMOVE_ADDR_SUBTYPE:
         		fprintf(s, "remove_address address_id:[");
@@ -26,6 +26,7 @@
 
 #include "ip_packet.h"
 #include "tcp.h"
+#include "tcp_options_iterator.h"
 
 /* The full list of valid TCP bit flag characters */
 static const char valid_tcp_flags[] = "FSRPU.EWC";
@@ -158,7 +159,10 @@ struct packet *new_tcp_packet(int socket_fd,
 		memcpy(tcp_option_start, tcp_options->data,
 		       tcp_options->length);
 	}
+	if (tcp_options != NULL && tcp_options->raw)
+		packet->flags |= FLAG_OPTIONS_RAW;
 
 	packet->ip_bytes = ip_bytes;
+	tcp_options_index(packet, NULL);
 	return packet;
 }
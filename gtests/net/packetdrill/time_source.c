@@ -0,0 +1,250 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the selectable clock; see time_source.h.
+ */
+
+#include "time_source.h"
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include "logging.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER 1
+#elif defined(__aarch64__)
+#define HAVE_CYCLE_COUNTER 1
+#endif
+
+/* How long each calibration of the cycle counter measures it for. */
+#define CALIBRATION_NSECS	20000000LL
+
+/* How far apart, in parts per million, two calibrations may be. */
+#define CALIBRATION_MAX_PPM	100.0
+
+static enum time_source_t selected = TIME_SOURCE_REALTIME;
+
+static s64 clock_nsecs(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts) != 0)
+		die_perror("clock_gettime");
+	return timespec_to_nsecs(&ts);
+}
+
+#ifdef HAVE_CYCLE_COUNTER
+
+/* The counter reading and CLOCK_MONOTONIC_RAW time of the last
+ * calibration, and the counter's rate in nanoseconds per tick as a
+ * 32.32 fixed point number.
+ */
+static struct {
+	u64 base_ticks;
+	s64 base_nsecs;
+	u64 nsecs_per_tick;
+} tsc;
+
+#if defined(__x86_64__)
+
+static inline u64 read_ticks(void)
+{
+	return __rdtsc();
+}
+
+/* Only a TSC that ticks at a constant rate in every P- and C-state,
+ * and so in step on every core, is any use as a clock.
+ */
+static bool ticks_usable(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (edx & (1U << 8)) != 0;
+}
+
+#elif defined(__aarch64__)
+
+static inline u64 read_ticks(void)
+{
+	u64 ticks;
+
+	asm volatile("isb; mrs %0, cntvct_el0" : "=r" (ticks) : : "memory");
+	return ticks;
+}
+
+/* The generic timer counts at a constant rate by definition. */
+static bool ticks_usable(void)
+{
+	return true;
+}
+
+#endif
+
+/* Read CLOCK_MONOTONIC_RAW and the counter as close to the same
+ * moment as we can: take the counter on both sides of the clock read,
+ * a few times, and keep the tightest pair.
+ */
+static void read_pair(u64 *ticks, s64 *nsecs)
+{
+	u64 best_gap = ~0ULL;
+	int i;
+
+	for (i = 0; i < 5; ++i) {
+		u64 before = read_ticks();
+		s64 raw = clock_nsecs(CLOCK_MONOTONIC_RAW);
+		u64 after = read_ticks();
+
+		if (after - before < best_gap) {
+			best_gap = after - before;
+			*ticks = before + (after - before) / 2;
+			*nsecs = raw;
+		}
+	}
+}
+
+/* Measure the counter against CLOCK_MONOTONIC_RAW, leaving the end
+ * of the measurement in tsc's base, and return its rate.
+ */
+static u64 measure_nsecs_per_tick(void)
+{
+	struct timespec pause = { .tv_sec = 0, .tv_nsec = CALIBRATION_NSECS };
+	u64 start_ticks, end_ticks;
+	s64 start_nsecs, end_nsecs;
+
+	read_pair(&start_ticks, &start_nsecs);
+	while (nanosleep(&pause, &pause) != 0)
+		;
+	read_pair(&end_ticks, &end_nsecs);
+	if (end_ticks <= start_ticks)
+		die("--clock=tsc: cycle counter did not advance\n");
+
+	tsc.base_ticks = end_ticks;
+	tsc.base_nsecs = end_nsecs;
+	return ((u64)(end_nsecs - start_nsecs) << 32) /
+		(end_ticks - start_ticks);
+}
+
+/* Calibrate twice, and insist the two agree, so a counter that is not
+ * steady (say, one a hypervisor scales or stops) is caught up front
+ * rather than as timing errors in the middle of a test.
+ */
+static void calibrate_ticks(void)
+{
+	u64 first = measure_nsecs_per_tick();
+	u64 second = measure_nsecs_per_tick();
+	double ppm = 1e6 * ((double)second - (double)first) / (double)first;
+
+	if (ppm > CALIBRATION_MAX_PPM || ppm < -CALIBRATION_MAX_PPM)
+		die("--clock=tsc: cycle counter rate unsteady "
+		    "(calibrations %.0f ppm apart)\n", ppm);
+	tsc.nsecs_per_tick = first / 2 + second / 2;
+}
+
+static inline s64 ticks_to_nsecs(u64 ticks)
+{
+	unsigned __int128 elapsed = ticks - tsc.base_ticks;
+
+	return tsc.base_nsecs + (s64)((elapsed * tsc.nsecs_per_tick) >> 32);
+}
+
+#else  /* !HAVE_CYCLE_COUNTER */
+
+static bool ticks_usable(void)
+{
+	return false;
+}
+
+#endif  /* HAVE_CYCLE_COUNTER */
+
+int parse_time_source(const char *name, enum time_source_t *source)
+{
+	if (strcmp(name, "realtime") == 0)
+		*source = TIME_SOURCE_REALTIME;
+	else if (strcmp(name, "monotonic_raw") == 0)
+		*source = TIME_SOURCE_MONOTONIC_RAW;
+	else if (strcmp(name, "tsc") == 0 && ticks_usable())
+		*source = TIME_SOURCE_TSC;
+	else
+		return STATUS_ERR;
+	return STATUS_OK;
+}
+
+void time_source_select(enum time_source_t source)
+{
+	if (source == selected)
+		return;
+#ifdef HAVE_CYCLE_COUNTER
+	if (source == TIME_SOURCE_TSC)
+		calibrate_ticks();
+#endif
+	selected = source;
+}
+
+s64 time_now_nsecs(void)
+{
+	switch (selected) {
+	case TIME_SOURCE_REALTIME:
+		return clock_nsecs(CLOCK_REALTIME);
+	case TIME_SOURCE_MONOTONIC_RAW:
+		return clock_nsecs(CLOCK_MONOTONIC_RAW);
+	case TIME_SOURCE_TSC:
+#ifdef HAVE_CYCLE_COUNTER
+		return ticks_to_nsecs(read_ticks());
+#else
+		break;
+#endif
+	}
+	assert(!"bad time source");
+	return 0;
+}
+
+/* Rather than keep an offset between the clocks, which would drift as
+ * NTP slews the wall clock, carry over the stamp's age: it is at most
+ * a few milliseconds, so the two clocks' difference in rate over it
+ * is well under a microsecond.
+ */
+s64 time_from_realtime_nsecs(s64 realtime_nsecs)
+{
+	s64 now_nsecs;
+
+	if (selected == TIME_SOURCE_REALTIME)
+		return realtime_nsecs;
+	now_nsecs = time_now_nsecs();
+	return now_nsecs - (clock_nsecs(CLOCK_REALTIME) - realtime_nsecs);
+}
+
+double time_source_drift_ppm(void)
+{
+#ifdef HAVE_CYCLE_COUNTER
+	if (selected == TIME_SOURCE_TSC) {
+		u64 ticks;
+		s64 raw_nsecs;
+
+		read_pair(&ticks, &raw_nsecs);
+		if (raw_nsecs <= tsc.base_nsecs)
+			return 0;
+		return 1e6 * (double)(ticks_to_nsecs(ticks) - raw_nsecs) /
+			(double)(raw_nsecs - tsc.base_nsecs);
+	}
+#endif
+	return 0;
+}
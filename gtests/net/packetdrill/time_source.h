@@ -0,0 +1,69 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * The clock the interpreter schedules events and measures times by,
+ * selected with --clock.
+ *
+ * The default is the wall clock, as packetdrill has always used. The
+ * wall clock can be stepped or slewed by NTP in the middle of a test,
+ * though, so --clock=monotonic_raw reads CLOCK_MONOTONIC_RAW instead,
+ * and --clock=tsc reads the CPU's cycle counter (rdtsc on x86, cntvct
+ * on arm64), calibrated against CLOCK_MONOTONIC_RAW when selected,
+ * which takes a few nanoseconds with no vDSO or syscall involved.
+ *
+ * The kernel stamps sniffed packets and transmit completions with the
+ * wall clock, so the packet socket backends map those stamps onto the
+ * selected clock with time_from_realtime_nsecs() as they read them.
+ */
+
+#ifndef __TIME_SOURCE_H__
+#define __TIME_SOURCE_H__
+
+#include "types.h"
+
+enum time_source_t {
+	TIME_SOURCE_REALTIME = 0,	/* CLOCK_REALTIME; the default */
+	TIME_SOURCE_MONOTONIC_RAW,	/* CLOCK_MONOTONIC_RAW */
+	TIME_SOURCE_TSC,		/* calibrated CPU cycle counter */
+};
+
+/* Parse the name of a clock for --clock. Returns STATUS_OK on success,
+ * or STATUS_ERR if there is no such clock or it is not usable here.
+ */
+extern int parse_time_source(const char *name, enum time_source_t *source);
+
+/* Make the given clock the one time_now_nsecs() reads, calibrating it
+ * if need be. Call before any thread that reads the time is started;
+ * selecting the clock already in use does nothing.
+ */
+extern void time_source_select(enum time_source_t source);
+
+/* Return the current time of the selected clock in nanoseconds. */
+extern s64 time_now_nsecs(void);
+
+/* Map a wall clock time stamp from the kernel, a little in the past,
+ * onto the selected clock.
+ */
+extern s64 time_from_realtime_nsecs(s64 realtime_nsecs);
+
+/* For --clock=tsc, return how far in parts per million the calibrated
+ * counter has drifted from CLOCK_MONOTONIC_RAW since it was selected;
+ * for other clocks, return 0.
+ */
+extern double time_source_drift_ppm(void);
+
+#endif /* __TIME_SOURCE_H__ */
@@ -0,0 +1,104 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for time_source.c: every clock we can select moves
+ * forward in step with CLOCK_MONOTONIC_RAW, and wall clock stamps map
+ * onto it with their age kept.
+ */
+
+#include "time_source.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+
+static s64 raw_nsecs(void)
+{
+	struct timespec ts;
+
+	assert(clock_gettime(CLOCK_MONOTONIC_RAW, &ts) == 0);
+	return timespec_to_nsecs(&ts);
+}
+
+static s64 realtime_nsecs(void)
+{
+	struct timespec ts;
+
+	assert(clock_gettime(CLOCK_REALTIME, &ts) == 0);
+	return timespec_to_nsecs(&ts);
+}
+
+static void test_parse(void)
+{
+	enum time_source_t source;
+
+	assert(parse_time_source("realtime", &source) == STATUS_OK);
+	assert(source == TIME_SOURCE_REALTIME);
+	assert(parse_time_source("monotonic_raw", &source) == STATUS_OK);
+	assert(source == TIME_SOURCE_MONOTONIC_RAW);
+	assert(parse_time_source("gettimeofday", &source) == STATUS_ERR);
+}
+
+/* Over a 10ms sleep, the selected clock should advance by about as
+ * much as CLOCK_MONOTONIC_RAW, and never go backward.
+ */
+static void test_source(enum time_source_t source)
+{
+	struct timespec pause = { .tv_sec = 0, .tv_nsec = 10000000 };
+	s64 start_nsecs, start_raw, end_nsecs, end_raw, stamp, mapped;
+	s64 last = 0, now;
+	int i;
+
+	time_source_select(source);
+
+	for (i = 0; i < 1000; ++i) {
+		now = time_now_nsecs();
+		assert(now >= last);
+		last = now;
+	}
+
+	start_nsecs = time_now_nsecs();
+	start_raw = raw_nsecs();
+	nanosleep(&pause, NULL);
+	end_nsecs = time_now_nsecs();
+	end_raw = raw_nsecs();
+	assert(end_nsecs - start_nsecs >= 10000000 - 100000);
+	assert(llabs((end_nsecs - start_nsecs) - (end_raw - start_raw)) <
+	       500000);
+
+	/* A stamp 1ms old maps to 1ms before now on our clock. */
+	stamp = realtime_nsecs() - 1000000;
+	mapped = time_from_realtime_nsecs(stamp);
+	now = time_now_nsecs();
+	assert(now - mapped >= 1000000);
+	assert(now - mapped < 1000000 + 500000);
+}
+
+int main(void)
+{
+	enum time_source_t tsc;
+
+	test_parse();
+	test_source(TIME_SOURCE_MONOTONIC_RAW);
+	if (parse_time_source("tsc", &tsc) == STATUS_OK) {
+		test_source(tsc);
+		assert(time_source_drift_ppm() < 1000.0 &&
+		       time_source_drift_ppm() > -1000.0);
+	}
+	test_source(TIME_SOURCE_REALTIME);
+	return 0;
+}
@@ -0,0 +1,352 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of log-linear histograms of event timing errors.
+ */
+
+#include "timing_stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+
+const char *timing_event_name(enum timing_event_t event)
+{
+	switch (event) {
+	case TIMING_INBOUND_PACKET:	return "inbound_packet";
+	case TIMING_OUTBOUND_PACKET:	return "outbound_packet";
+	case TIMING_SYSCALL_START:	return "syscall_start";
+	case TIMING_SYSCALL_END:	return "syscall_end";
+	case TIMING_OTHER:		return "other";
+	case NUM_TIMING_EVENTS:		break;
+	/* missing default case so compiler catches missing cases */
+	}
+	return "invalid";
+}
+
+/* Values below 2 * TIMING_SUB_BUCKETS get a bucket each. Above that,
+ * the bucket of a value is given by its highest bit and the next
+ * TIMING_SUB_BUCKET_BITS bits below it.
+ */
+int timing_bucket(u64 magnitude_usecs)
+{
+	int shift;
+
+	if (magnitude_usecs < 2 * TIMING_SUB_BUCKETS)
+		return magnitude_usecs;
+	shift = 63 - __builtin_clzll(magnitude_usecs) - TIMING_SUB_BUCKET_BITS;
+	if (shift * TIMING_SUB_BUCKETS + (int)(magnitude_usecs >> shift) >=
+	    TIMING_BUCKETS)
+		return TIMING_BUCKETS - 1;
+	return shift * TIMING_SUB_BUCKETS + (magnitude_usecs >> shift);
+}
+
+u64 timing_bucket_low(int bucket)
+{
+	int shift;
+
+	if (bucket < 2 * TIMING_SUB_BUCKETS)
+		return bucket;
+	shift = bucket / TIMING_SUB_BUCKETS - 1;
+	return (u64)(bucket % TIMING_SUB_BUCKETS + TIMING_SUB_BUCKETS) << shift;
+}
+
+void timing_record(struct timing_histogram *histogram, s64 error_usecs,
+		   bool over_tolerance)
+{
+	if (error_usecs < 0)
+		histogram->early[timing_bucket(-error_usecs)]++;
+	else
+		histogram->late[timing_bucket(error_usecs)]++;
+
+	if (histogram->count == 0 || error_usecs < histogram->min_usecs)
+		histogram->min_usecs = error_usecs;
+	if (histogram->count == 0 || error_usecs > histogram->max_usecs)
+		histogram->max_usecs = error_usecs;
+	histogram->count++;
+	histogram->total_usecs += error_usecs;
+	histogram->total_magnitude_usecs += llabs(error_usecs);
+	histogram->total_squares += (double)error_usecs * error_usecs;
+	if (over_tolerance)
+		histogram->over_tolerance++;
+}
+
+/* The sample standard deviation of count values with the given sum
+ * and sum of squares.
+ */
+static double stddev(u64 count, double total, double total_squares)
+{
+	double variance;
+
+	if (count < 2)
+		return 0;
+	variance = (total_squares - total * total / count) / (count - 1);
+	return variance > 0 ? sqrt(variance) : 0;
+}
+
+double timing_mean_magnitude(const struct timing_histogram *histogram)
+{
+	if (histogram->count == 0)
+		return 0;
+	return (double)histogram->total_magnitude_usecs / histogram->count;
+}
+
+double timing_stddev_magnitude(const struct timing_histogram *histogram)
+{
+	return stddev(histogram->count, histogram->total_magnitude_usecs,
+		      histogram->total_squares);
+}
+
+/* Keep the lines sorted, so that finding one is a binary search and
+ * the report lists them in script order.
+ */
+void timing_record_line(struct timing_stats *stats, int line_number,
+			s64 error_usecs)
+{
+	double magnitude = llabs(error_usecs);
+	struct timing_line *line;
+	int low = 0, high = stats->num_lines;
+
+	while (low < high) {
+		int mid = low + (high - low) / 2;
+
+		if (stats->lines[mid].line_number < line_number)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low == stats->num_lines ||
+	    stats->lines[low].line_number != line_number) {
+		if (stats->num_lines == stats->max_lines) {
+			stats->max_lines = stats->max_lines ?
+				2 * stats->max_lines : 64;
+			stats->lines = realloc(stats->lines,
+					       stats->max_lines *
+					       sizeof(stats->lines[0]));
+		}
+		memmove(&stats->lines[low + 1], &stats->lines[low],
+			(stats->num_lines - low) * sizeof(stats->lines[0]));
+		memset(&stats->lines[low], 0, sizeof(stats->lines[0]));
+		stats->lines[low].line_number = line_number;
+		stats->num_lines++;
+	}
+	line = &stats->lines[low];
+	line->count++;
+	line->total_usecs += magnitude;
+	line->total_squares += magnitude * magnitude;
+}
+
+void timing_stats_free(struct timing_stats *stats)
+{
+	if (stats == NULL)
+		return;
+	free(stats->lines);
+	free(stats);
+}
+
+/* Clamp the bucket's value to what we actually saw. */
+static s64 clamp_value(const struct timing_histogram *histogram, s64 value)
+{
+	if (value < histogram->min_usecs)
+		return histogram->min_usecs;
+	if (value > histogram->max_usecs)
+		return histogram->max_usecs;
+	return value;
+}
+
+s64 timing_percentile(const struct timing_histogram *histogram,
+		      double fraction)
+{
+	double exact_rank;
+	u64 rank, seen = 0;
+	int i;
+
+	if (histogram->count == 0)
+		return 0;
+	/* The rank of the value, rounding up, but not for rounding error. */
+	exact_rank = fraction * histogram->count;
+	rank = exact_rank;
+	if (exact_rank - rank > 1e-9)
+		rank++;
+	if (rank < 1)
+		rank = 1;
+	if (rank >= histogram->count)
+		return histogram->max_usecs;
+
+	/* Most negative first, then from zero upwards. */
+	for (i = TIMING_BUCKETS - 1; i >= 0; i--) {
+		seen += histogram->early[i];
+		if (seen >= rank)
+			return clamp_value(histogram,
+					   -(s64)timing_bucket_low(i));
+	}
+	for (i = 0; i < TIMING_BUCKETS; i++) {
+		seen += histogram->late[i];
+		if (seen >= rank)
+			return clamp_value(histogram, timing_bucket_low(i));
+	}
+	return histogram->max_usecs;
+}
+
+static void write_histogram_json(const struct timing_histogram *histogram,
+				 FILE *out)
+{
+	const char *sep = "";
+	int i;
+
+	fprintf(out, "{\"count\": %llu, \"over_tolerance\": %llu",
+		histogram->count, histogram->over_tolerance);
+	if (histogram->count > 0) {
+		fprintf(out, ", \"min_usecs\": %lld, \"max_usecs\": %lld, "
+			"\"mean_usecs\": %.1f, \"mean_abs_usecs\": %.1f, "
+			"\"stddev_abs_usecs\": %.1f, \"p50_usecs\": %lld, "
+			"\"p90_usecs\": %lld, \"p99_usecs\": %lld, "
+			"\"p999_usecs\": %lld",
+			histogram->min_usecs, histogram->max_usecs,
+			(double)histogram->total_usecs / histogram->count,
+			timing_mean_magnitude(histogram),
+			timing_stddev_magnitude(histogram),
+			timing_percentile(histogram, 0.5),
+			timing_percentile(histogram, 0.9),
+			timing_percentile(histogram, 0.99),
+			timing_percentile(histogram, 0.999));
+	}
+
+	/* The non-empty buckets, as [error nearest zero, count] pairs. */
+	fprintf(out, ", \"buckets\": [");
+	for (i = TIMING_BUCKETS - 1; i >= 0; i--) {
+		if (histogram->early[i] == 0)
+			continue;
+		fprintf(out, "%s[%lld, %llu]", sep,
+			-(s64)timing_bucket_low(i), histogram->early[i]);
+		sep = ", ";
+	}
+	for (i = 0; i < TIMING_BUCKETS; i++) {
+		if (histogram->late[i] == 0)
+			continue;
+		fprintf(out, "%s[%lld, %llu]", sep,
+			(s64)timing_bucket_low(i), histogram->late[i]);
+		sep = ", ";
+	}
+	fprintf(out, "]}");
+}
+
+void timing_stats_write_json(const struct timing_stats *stats, FILE *out)
+{
+	int i;
+
+	for (i = 0; i < NUM_TIMING_EVENTS; i++) {
+		fprintf(out, "%s\"%s\": ", i > 0 ? ", " : "",
+			timing_event_name(i));
+		write_histogram_json(&stats->events[i], out);
+	}
+}
+
+/* The magnitude of error of each line, as an array of objects. */
+static void write_lines_json(const struct timing_stats *stats, FILE *out)
+{
+	int i;
+
+	fprintf(out, "[");
+	for (i = 0; i < stats->num_lines; i++) {
+		const struct timing_line *line = &stats->lines[i];
+
+		fprintf(out, "%s{\"line\": %d, \"count\": %llu, "
+			"\"mean_abs_usecs\": %.1f, "
+			"\"stddev_abs_usecs\": %.1f}",
+			i > 0 ? ", " : "", line->line_number, line->count,
+			line->total_usecs / line->count,
+			stddev(line->count, line->total_usecs,
+			       line->total_squares));
+	}
+	fprintf(out, "]");
+}
+
+void write_json_string(const char *string, FILE *out)
+{
+	const unsigned char *p;
+
+	fputc('"', out);
+	for (p = (const unsigned char *)string; *p != '\0'; p++) {
+		if (*p == '"' || *p == '\\')
+			fprintf(out, "\\%c", *p);
+		else if (*p < 0x20)
+			fprintf(out, "\\u%04x", *p);
+		else
+			fputc(*p, out);
+	}
+	fputc('"', out);
+}
+
+int timing_report_append(const struct timing_stats *stats,
+			 const char *path, const char *script_path,
+			 bool passed, int tolerance_usecs,
+			 const char *extra_json, char **error)
+{
+	char *report = NULL;
+	size_t bytes = 0;
+	FILE *out;
+	int result;
+
+	out = open_memstream(&report, &bytes);
+	if (out == NULL)
+		die_perror("open_memstream");
+	fprintf(out, "{\"script\": ");
+	write_json_string(script_path, out);
+	fprintf(out, ", \"passed\": %s, \"tolerance_usecs\": %d, "
+		"\"events\": {", passed ? "true" : "false", tolerance_usecs);
+	timing_stats_write_json(stats, out);
+	fprintf(out, "}");
+	if (stats->num_lines > 0) {
+		fprintf(out, ", \"lines\": ");
+		write_lines_json(stats, out);
+	}
+	if (extra_json != NULL)
+		fprintf(out, ", %s", extra_json);
+	fprintf(out, "}\n");
+	fclose(out);
+
+	result = timing_report_write(path, report, bytes, error);
+	free(report);
+	return result;
+}
+
+int timing_report_write(const char *path, const char *records,
+			size_t bytes, char **error)
+{
+	ssize_t written;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) {
+		asprintf(error, "cannot open %s: %s", path, strerror(errno));
+		return STATUS_ERR;
+	}
+	written = write(fd, records, bytes);
+	close(fd);
+	if (written != (ssize_t)bytes) {
+		asprintf(error, "error writing %s", path);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for recording how far from their script times the events
+ * of a test actually happened, in HDR-style log-linear histograms, and
+ * for writing them out as a JSON report (see --timing_report).
+ */
+
+#ifndef __TIMING_STATS_H__
+#define __TIMING_STATS_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+/* The kinds of timed events that we keep apart. */
+enum timing_event_t {
+	TIMING_INBOUND_PACKET = 0,	/* when we injected the packet */
+	TIMING_OUTBOUND_PACKET,		/* when we sniffed the packet */
+	TIMING_SYSCALL_START,		/* when we started the call */
+	TIMING_SYSCALL_END,		/* when a blocking call returned */
+	TIMING_OTHER,			/* commands, code */
+	NUM_TIMING_EVENTS,
+};
+
+/* Each power of two of error is split into this many buckets, so
+ * values are recorded with a precision of about 3%.
+ */
+#define TIMING_SUB_BUCKET_BITS	5
+#define TIMING_SUB_BUCKETS	(1 << TIMING_SUB_BUCKET_BITS)
+
+/* Enough buckets for errors of up to 2^40 usecs. */
+#define TIMING_BUCKETS		((40 - TIMING_SUB_BUCKET_BITS + 1) * \
+				 TIMING_SUB_BUCKETS + TIMING_SUB_BUCKETS)
+
+/* A histogram of signed errors in microseconds: negative errors are
+ * events that happened early, positive ones late.
+ */
+struct timing_histogram {
+	u64 early[TIMING_BUCKETS];	/* counts by magnitude of error < 0 */
+	u64 late[TIMING_BUCKETS];	/* counts by magnitude of error >= 0 */
+	u64 count;			/* number of values recorded */
+	s64 min_usecs;			/* smallest value */
+	s64 max_usecs;			/* largest value */
+	s64 total_usecs;		/* sum of values */
+	u64 total_magnitude_usecs;	/* sum of magnitudes of values */
+	double total_squares;		/* sum of squares of values */
+	u64 over_tolerance;		/* values beyond tolerance_usecs */
+};
+
+/* The magnitudes of the errors of the events of one script line, kept
+ * as moments rather than a histogram since a script has many lines.
+ */
+struct timing_line {
+	int line_number;
+	u64 count;			/* number of values recorded */
+	double total_usecs;		/* sum of magnitudes */
+	double total_squares;		/* sum of squares */
+};
+
+struct timing_stats {
+	struct timing_histogram events[NUM_TIMING_EVENTS];
+	struct timing_line *lines;	/* sorted by line number */
+	int num_lines;
+	int max_lines;
+};
+
+/* Return the name of the given kind of event, as used in the report. */
+extern const char *timing_event_name(enum timing_event_t event);
+
+/* Return the bucket for the given magnitude of error, and the smallest
+ * magnitude in a bucket.
+ */
+extern int timing_bucket(u64 magnitude_usecs);
+extern u64 timing_bucket_low(int bucket);
+
+/* Record an error of the given number of microseconds. */
+extern void timing_record(struct timing_histogram *histogram,
+			  s64 error_usecs, bool over_tolerance);
+
+/* Record an error of the given number of microseconds for the event at
+ * the given script line.
+ */
+extern void timing_record_line(struct timing_stats *stats, int line_number,
+			       s64 error_usecs);
+
+/* Free stats allocated with calloc(), and the lines they hold. */
+extern void timing_stats_free(struct timing_stats *stats);
+
+/* Return the mean and sample standard deviation of the magnitudes of
+ * the recorded values, or 0 if there are too few of them.
+ */
+extern double timing_mean_magnitude(const struct timing_histogram *histogram);
+extern double timing_stddev_magnitude(
+	const struct timing_histogram *histogram);
+
+/* Return the error that the given fraction (0..1) of recorded values
+ * are at or below, to within the precision of the buckets.
+ */
+extern s64 timing_percentile(const struct timing_histogram *histogram,
+			     double fraction);
+
+/* Write the stats as the members of a JSON object, e.g.
+ * "inbound_packet": {...}, to the given stream. The lines are left
+ * for timing_report_append() to write as a "lines" array.
+ */
+extern void timing_stats_write_json(const struct timing_stats *stats,
+				    FILE *out);
+
+/* Write the given string as a JSON string. */
+extern void write_json_string(const char *string, FILE *out);
+
+/* Append a report on one run of the given script, as one JSON object
+ * on a line of its own, to the file at the given path. If extra_json
+ * is not NULL, it holds more members for the object. Each report is
+ * written with a single write(), so that parallel runs can share the
+ * file. On success, return STATUS_OK; on failure, return STATUS_ERR
+ * and fill in *error.
+ */
+extern int timing_report_append(const struct timing_stats *stats,
+				const char *path, const char *script_path,
+				bool passed, int tolerance_usecs,
+				const char *extra_json, char **error);
+
+/* Append the given report lines, as written by timing_report_append()
+ * elsewhere, say by a daemon on another host, to the file at the given
+ * path, with a single write(). On success, return STATUS_OK; on
+ * failure, return STATUS_ERR and fill in *error.
+ */
+extern int timing_report_write(const char *path, const char *records,
+			       size_t bytes, char **error);
+
+#endif /* __TIMING_STATS_H__ */
@@ -0,0 +1,130 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for timing_stats.c: buckets cover all values with the
+ * expected precision, percentiles of signed errors come out right, and
+ * the per-line stats for --compare are kept in line order.
+ */
+
+#include "timing_stats.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void test_buckets(void)
+{
+	u64 value;
+	int bucket, last = 0;
+
+	for (value = 0; value < (1ULL << 40); value += 1 + value / 64) {
+		bucket = timing_bucket(value);
+		assert(bucket >= last);
+		assert(bucket < TIMING_BUCKETS);
+		assert(timing_bucket_low(bucket) <= value);
+		assert(timing_bucket(timing_bucket_low(bucket)) == bucket);
+		/* Within about 3%. */
+		assert(value - timing_bucket_low(bucket) <= value / 32);
+		last = bucket;
+	}
+	assert(timing_bucket(~0ULL) == TIMING_BUCKETS - 1);
+}
+
+static void test_percentiles(void)
+{
+	struct timing_histogram *histogram = calloc(1, sizeof(*histogram));
+	int i;
+
+	/* 100 values from -50 to 49 usecs. */
+	for (i = -50; i < 50; i++)
+		timing_record(histogram, i, i >= 40);
+	assert(histogram->count == 100);
+	assert(histogram->min_usecs == -50);
+	assert(histogram->max_usecs == 49);
+	assert(histogram->over_tolerance == 10);
+	assert(timing_percentile(histogram, 0) == -50);
+	assert(timing_percentile(histogram, 0.5) == -1);
+	assert(timing_percentile(histogram, 0.9) == 39);
+	assert(timing_percentile(histogram, 1) == 49);
+
+	/* Large values are rounded down to their bucket. */
+	timing_record(histogram, 1000000, true);
+	assert(timing_percentile(histogram, 1) == 1000000);
+	timing_record(histogram, 1000001, true);
+	assert(timing_percentile(histogram, 1) == 1000001);
+	assert(timing_percentile(histogram, 101.0 / 102) ==
+	       (s64)timing_bucket_low(timing_bucket(1000000)));
+	free(histogram);
+}
+
+static void test_moments(void)
+{
+	struct timing_histogram *histogram = calloc(1, sizeof(*histogram));
+
+	timing_record(histogram, -10, false);
+	timing_record(histogram, 20, false);
+	timing_record(histogram, 30, false);
+	assert(timing_mean_magnitude(histogram) == 20.0);
+	assert(timing_stddev_magnitude(histogram) == 10.0);
+	free(histogram);
+}
+
+static void test_lines(void)
+{
+	struct timing_stats *stats = calloc(1, sizeof(*stats));
+	char *error = NULL, *report = NULL;
+	char path[] = "/tmp/timing_stats_test.XXXXXX";
+	size_t bytes = 0;
+	FILE *in;
+	int fd, i;
+
+	/* Out of order, as a blocking call's return is checked late. */
+	for (i = 100; i > 0; i--)
+		timing_record_line(stats, i % 50 + 1, i % 2 ? -i : i);
+	assert(stats->num_lines == 50);
+	for (i = 0; i < stats->num_lines; i++) {
+		assert(stats->lines[i].line_number == i + 1);
+		assert(stats->lines[i].count == 2);
+	}
+	/* Line 1 saw 100 and 50. */
+	assert(stats->lines[0].total_usecs == 150);
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	assert(timing_report_append(stats, path, "a.pkt", true, 1000, NULL,
+				    &error) == STATUS_OK);
+	in = fopen(path, "r");
+	assert(getline(&report, &bytes, in) > 0);
+	fclose(in);
+	unlink(path);
+	assert(strstr(report, "\"lines\": [{\"line\": 1, \"count\": 2, "
+		      "\"mean_abs_usecs\": 75.0, "
+		      "\"stddev_abs_usecs\": 35.4}, ") != NULL);
+	free(report);
+	timing_stats_free(stats);
+}
+
+int main(void)
+{
+	test_buckets();
+	test_percentiles();
+	test_moments();
+	test_lines();
+	return 0;
+}
@@ -80,6 +80,7 @@
 /* TUNSETIFF ifr flags */
 #define IFF_TUN         0x0001
 #define IFF_TAP         0x0002
+#define IFF_MULTI_QUEUE 0x0100
 #define IFF_NO_PI       0x1000
 #define IFF_ONE_QUEUE   0x2000
 #define IFF_VNET_HDR    0x4000
@@ -91,6 +92,28 @@
 #define TUN_F_TSO6      0x04    /* I can handle TSO for IPv6 packets */
 #define TUN_F_TSO_ECN   0x08    /* I can handle TSO with ECN bits. */
 #define TUN_F_UFO       0x10    /* I can handle UFO packets */
+#define TUN_F_USO4      0x20    /* I can handle USO for IPv4 packets */
+#define TUN_F_USO6      0x40    /* I can handle USO for IPv6 packets */
+
+/* Header prepended to each packet read or written with IFF_VNET_HDR,
+ * and to each packet sniffed by a packet socket with PACKET_VNET_HDR,
+ * describing its checksum and GSO state (from linux/virtio_net.h).
+ */
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM	1	/* use csum_start/offset */
+#define VIRTIO_NET_HDR_GSO_NONE		0	/* not a GSO frame */
+#define VIRTIO_NET_HDR_GSO_TCPV4	1	/* GSO frame, IPv4 TCP (TSO) */
+#define VIRTIO_NET_HDR_GSO_UDP		3	/* GSO frame, IPv4 UDP (UFO) */
+#define VIRTIO_NET_HDR_GSO_TCPV6	4	/* GSO frame, IPv6 TCP */
+#define VIRTIO_NET_HDR_GSO_UDP_L4	5	/* GSO frame, UDP (USO) */
+#define VIRTIO_NET_HDR_GSO_ECN		0x80	/* TCP has ECN set */
+struct virtio_net_hdr {
+	__u8 flags;
+	__u8 gso_type;
+	__u16 hdr_len;		/* ethernet + IP + tcp/udp header bytes */
+	__u16 gso_size;		/* bytes to append to hdr_len per frame */
+	__u16 csum_start;	/* position to start checksumming from */
+	__u16 csum_offset;	/* offset after that to place checksum */
+};
 
 /* Protocol info prepended to the packets (when IFF_NO_PI is not set) */
 #define TUN_PKT_STRIP   0x0001
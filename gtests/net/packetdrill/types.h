@@ -168,6 +168,12 @@ static inline s64 timeval_to_usecs(const struct timeval *tv)
 	return ((s64)tv->tv_sec) * 1000000LL + (s64)tv->tv_usec;
 }
 
+/* Convert a timespec to nanoseconds. */
+static inline s64 timespec_to_nsecs(const struct timespec *ts)
+{
+	return ((s64)ts->tv_sec) * 1000000000LL + (s64)ts->tv_nsec;
+}
+
 /* Return a malloc-allocated hex dump of the given buffer of the given length */
 extern void hex_dump(const u8 *buffer, int bytes, char **hex);
 
@@ -41,4 +41,17 @@ struct udp {
 	__sum16 check;		/* UDP checksum */
 };
 
+#ifdef linux
+/* Socket options and control messages for UDP segmentation offload
+ * (Linux 4.18) and receive coalescing (Linux 5.0), which older libc
+ * headers lack.
+ */
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT	103	/* set GSO segment size; u16 */
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO		104	/* coalesce on receive; int */
+#endif
+#endif /* linux */
+
 #endif /* __UDP_HEADERS_H__ */
@@ -0,0 +1,521 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * A minimal io_uring for scripts; see uring.h.
+ */
+
+#include "uring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#if defined(HAVE_IO_URING) && defined(IORING_RECV_MULTISHOT)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Our ring of provided buffers for receives. Its size must be a power
+ * of 2.
+ */
+#define URING_BUFFER_GROUP	1
+#define URING_NUM_BUFFERS	64
+
+/* An operation in flight. */
+struct uring_op {
+	enum uring_op_t op;		/* URING_OP_NONE if the slot is free */
+	u64 user_data;			/* its user_data */
+	struct sockaddr_storage addr;	/* address for a connect */
+};
+
+struct uring {
+	int fd;				/* the ring's fd */
+
+	/* The submission queue, and how far we have filled it. */
+	void *sq_ring;
+	size_t sq_ring_bytes;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+	size_t sqes_bytes;
+	unsigned sq_local_tail;		/* our tail, not yet published */
+	unsigned sq_queued;		/* entries queued, not submitted */
+
+	/* The completion queue. It may share the submission queue's
+	 * mapping.
+	 */
+	void *cq_ring;
+	size_t cq_ring_bytes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* Provided buffers for receives. */
+	struct io_uring_buf_ring *buf_ring;
+	size_t buf_ring_bytes;
+	char *buffers;
+	u16 buf_tail;			/* our copy of buf_ring's tail */
+
+	/* Operations in flight; there can't be more than the completion
+	 * queue holds.
+	 */
+	struct uring_op *ops;
+	unsigned num_ops;
+};
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+			  unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg,
+			     unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Hand the receive buffer with the given id (back) to the kernel. */
+static void put_buffer(struct uring *ring, u16 bid)
+{
+	struct io_uring_buf *buf =
+		&ring->buf_ring->bufs[ring->buf_tail & (URING_NUM_BUFFERS - 1)];
+
+	/* The tail overlays the first buffer's resv, so leave that be. */
+	buf->addr = (unsigned long)(ring->buffers +
+				    (size_t)bid * URING_BUFFER_BYTES);
+	buf->len = URING_BUFFER_BYTES;
+	buf->bid = bid;
+	ring->buf_tail++;
+	__atomic_store_n(&ring->buf_ring->tail, ring->buf_tail,
+			 __ATOMIC_RELEASE);
+}
+
+static int setup_buffers(struct uring *ring, char **error)
+{
+	struct io_uring_buf_reg reg;
+	int i;
+
+	ring->buf_ring_bytes = URING_NUM_BUFFERS * sizeof(struct io_uring_buf);
+	ring->buf_ring = mmap(NULL, ring->buf_ring_bytes,
+			      PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring->buf_ring == MAP_FAILED) {
+		ring->buf_ring = NULL;
+		asprintf(error, "mmap: %s", strerror(errno));
+		return STATUS_ERR;
+	}
+	ring->buffers = mmap(NULL, URING_NUM_BUFFERS * URING_BUFFER_BYTES,
+			     PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			     -1, 0);
+	if (ring->buffers == MAP_FAILED) {
+		ring->buffers = NULL;
+		asprintf(error, "mmap: %s", strerror(errno));
+		return STATUS_ERR;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)ring->buf_ring;
+	reg.ring_entries = URING_NUM_BUFFERS;
+	reg.bgid = URING_BUFFER_GROUP;
+	if (io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING,
+			      &reg, 1) < 0) {
+		asprintf(error, "cannot register io_uring buffer ring "
+			 "(needs Linux 5.19): %s", strerror(errno));
+		return STATUS_ERR;
+	}
+
+	for (i = 0; i < URING_NUM_BUFFERS; ++i)
+		put_buffer(ring, i);
+	return STATUS_OK;
+}
+
+struct uring *uring_new(unsigned entries, char **error)
+{
+	struct uring *ring = calloc(1, sizeof(struct uring));
+	struct io_uring_params params;
+	bool single_mmap;
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = io_uring_setup(entries, &params);
+	if (ring->fd < 0) {
+		asprintf(error, "io_uring_setup: %s", strerror(errno));
+		free(ring);
+		return NULL;
+	}
+
+	ring->sq_ring_bytes = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_bytes = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_mmap) {
+		if (ring->cq_ring_bytes > ring->sq_ring_bytes)
+			ring->sq_ring_bytes = ring->cq_ring_bytes;
+		ring->cq_ring_bytes = 0;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_bytes,
+			     PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd,
+			     IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		goto mmap_error;
+	}
+	if (single_mmap) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_bytes,
+				     PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE, ring->fd,
+				     IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			goto mmap_error;
+		}
+	}
+	ring->sqes_bytes = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_bytes, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto mmap_error;
+	}
+
+	ring->sq_head = ring->sq_ring + params.sq_off.head;
+	ring->sq_tail = ring->sq_ring + params.sq_off.tail;
+	ring->sq_mask = ring->sq_ring + params.sq_off.ring_mask;
+	ring->sq_array = ring->sq_ring + params.sq_off.array;
+	ring->sq_entries = params.sq_entries;
+	ring->sq_local_tail = *ring->sq_tail;
+	ring->cq_head = ring->cq_ring + params.cq_off.head;
+	ring->cq_tail = ring->cq_ring + params.cq_off.tail;
+	ring->cq_mask = ring->cq_ring + params.cq_off.ring_mask;
+	ring->cqes = ring->cq_ring + params.cq_off.cqes;
+
+	ring->num_ops = params.cq_entries;
+	ring->ops = calloc(ring->num_ops, sizeof(struct uring_op));
+
+	if (setup_buffers(ring, error)) {
+		uring_free(ring);
+		return NULL;
+	}
+	return ring;
+
+mmap_error:
+	asprintf(error, "mmap of io_uring: %s", strerror(errno));
+	uring_free(ring);
+	return NULL;
+}
+
+void uring_free(struct uring *ring)
+{
+	if (ring == NULL)
+		return;
+
+	/* Closing the fd cancels whatever is still in flight. */
+	if (ring->fd >= 0)
+		close(ring->fd);
+	if (ring->sqes != NULL)
+		munmap(ring->sqes, ring->sqes_bytes);
+	if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_bytes);
+	if (ring->sq_ring != NULL)
+		munmap(ring->sq_ring, ring->sq_ring_bytes);
+	if (ring->buf_ring != NULL)
+		munmap(ring->buf_ring, ring->buf_ring_bytes);
+	if (ring->buffers != NULL)
+		munmap(ring->buffers, URING_NUM_BUFFERS * URING_BUFFER_BYTES);
+	free(ring->ops);
+	memset(ring, 0, sizeof(*ring));  /* to help catch bugs */
+	free(ring);
+}
+
+int uring_fd(const struct uring *ring)
+{
+	return ring->fd;
+}
+
+/* Return the operation in flight with the given user_data, or NULL. */
+static struct uring_op *find_op(struct uring *ring, u64 user_data)
+{
+	int i;
+
+	for (i = 0; i < ring->num_ops; ++i) {
+		if (ring->ops[i].op != URING_OP_NONE &&
+		    ring->ops[i].user_data == user_data)
+			return &ring->ops[i];
+	}
+	return NULL;
+}
+
+/* Take a free submission queue entry and a free slot for an operation
+ * of the given kind. Returns NULL and sets error message if there is
+ * none, or if the user_data is already in flight.
+ */
+static struct io_uring_sqe *get_sqe(struct uring *ring, enum uring_op_t op,
+				    u64 user_data, struct uring_op **op_ptr,
+				    char **error)
+{
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe *sqe;
+	unsigned index;
+	int i;
+
+	if (find_op(ring, user_data) != NULL) {
+		asprintf(error, "io_uring user_data %llu already in flight",
+			 (unsigned long long)user_data);
+		return NULL;
+	}
+	if (ring->sq_local_tail - head >= ring->sq_entries) {
+		asprintf(error, "io_uring submission queue is full");
+		return NULL;
+	}
+	for (i = 0; i < ring->num_ops; ++i) {
+		if (ring->ops[i].op == URING_OP_NONE)
+			break;
+	}
+	if (i == ring->num_ops) {
+		asprintf(error, "more than %u io_uring operations in flight",
+			 ring->num_ops);
+		return NULL;
+	}
+	*op_ptr = &ring->ops[i];
+	(*op_ptr)->op = op;
+	(*op_ptr)->user_data = user_data;
+
+	index = ring->sq_local_tail & *ring->sq_mask;
+	sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = user_data;
+	ring->sq_array[index] = index;
+	ring->sq_local_tail++;
+	ring->sq_queued++;
+	return sqe;
+}
+
+int uring_prep_send(struct uring *ring, int fd, const void *buf,
+		    size_t len, int flags, u64 user_data, char **error)
+{
+	struct uring_op *op;
+	struct io_uring_sqe *sqe = get_sqe(ring, URING_OP_SEND, user_data,
+					   &op, error);
+	if (sqe == NULL)
+		return STATUS_ERR;
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->msg_flags = flags;
+	return STATUS_OK;
+}
+
+int uring_prep_recv(struct uring *ring, int fd, size_t len, int flags,
+		    bool multishot, u64 user_data, char **error)
+{
+	struct uring_op *op;
+	struct io_uring_sqe *sqe;
+
+	if (len > URING_BUFFER_BYTES) {
+		asprintf(error, "io_uring recv of more than %d bytes",
+			 URING_BUFFER_BYTES);
+		return STATUS_ERR;
+	}
+	sqe = get_sqe(ring, URING_OP_RECV, user_data, &op, error);
+	if (sqe == NULL)
+		return STATUS_ERR;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->len = multishot ? 0 : len;	/* multishot takes whole buffers */
+	sqe->msg_flags = flags;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	if (multishot)
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+	return STATUS_OK;
+}
+
+int uring_prep_accept(struct uring *ring, int fd, int flags,
+		      bool multishot, u64 user_data, char **error)
+{
+	struct uring_op *op;
+	struct io_uring_sqe *sqe = get_sqe(ring, URING_OP_ACCEPT, user_data,
+					   &op, error);
+	if (sqe == NULL)
+		return STATUS_ERR;
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->accept_flags = flags;
+	if (multishot)
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	return STATUS_OK;
+}
+
+int uring_prep_connect(struct uring *ring, int fd,
+		       const struct sockaddr *addr, socklen_t addrlen,
+		       u64 user_data, char **error)
+{
+	struct uring_op *op;
+	struct io_uring_sqe *sqe;
+
+	assert(addrlen <= sizeof(op->addr));
+	sqe = get_sqe(ring, URING_OP_CONNECT, user_data, &op, error);
+	if (sqe == NULL)
+		return STATUS_ERR;
+	memcpy(&op->addr, addr, addrlen);
+	sqe->opcode = IORING_OP_CONNECT;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)&op->addr;
+	sqe->off = addrlen;
+	return STATUS_OK;
+}
+
+int uring_submit(struct uring *ring)
+{
+	int submitted;
+
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+	submitted = io_uring_enter(ring->fd, ring->sq_queued, 0, 0);
+	if (submitted > 0)
+		ring->sq_queued -= submitted;
+	return submitted;
+}
+
+int uring_wait(struct uring *ring, struct uring_completion *completion)
+{
+	for (;;) {
+		unsigned head = *ring->cq_head;
+		unsigned tail = __atomic_load_n(ring->cq_tail,
+						__ATOMIC_ACQUIRE);
+
+		if (head != tail) {
+			const struct io_uring_cqe *cqe =
+				&ring->cqes[head & *ring->cq_mask];
+
+			completion->user_data = cqe->user_data;
+			completion->res = cqe->res;
+			completion->flags = cqe->flags;
+			completion->op = URING_OP_NONE;
+			__atomic_store_n(ring->cq_head, head + 1,
+					 __ATOMIC_RELEASE);
+			return 0;
+		}
+		if (io_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+		    errno != EINTR)
+			return -1;
+	}
+}
+
+void uring_finish(struct uring *ring, struct uring_completion *completion)
+{
+	struct uring_op *op = find_op(ring, completion->user_data);
+
+	if (op != NULL) {
+		completion->op = op->op;
+		if (!(completion->flags & IORING_CQE_F_MORE))
+			op->op = URING_OP_NONE;
+	}
+	if (completion->flags & IORING_CQE_F_BUFFER)
+		put_buffer(ring,
+			   completion->flags >> IORING_CQE_BUFFER_SHIFT);
+}
+
+#else  /* !(HAVE_IO_URING && IORING_RECV_MULTISHOT) */
+
+struct uring *uring_new(unsigned entries, char **error)
+{
+	asprintf(error, "io_uring is not supported on this platform");
+	return NULL;
+}
+
+void uring_free(struct uring *ring)
+{
+	assert(ring == NULL);
+}
+
+int uring_fd(const struct uring *ring)
+{
+	assert(!"no io_uring on this platform");
+	return -1;
+}
+
+int uring_prep_send(struct uring *ring, int fd, const void *buf,
+		    size_t len, int flags, u64 user_data, char **error)
+{
+	assert(!"no io_uring on this platform");
+	return STATUS_ERR;
+}
+
+int uring_prep_recv(struct uring *ring, int fd, size_t len, int flags,
+		    bool multishot, u64 user_data, char **error)
+{
+	assert(!"no io_uring on this platform");
+	return STATUS_ERR;
+}
+
+int uring_prep_accept(struct uring *ring, int fd, int flags,
+		      bool multishot, u64 user_data, char **error)
+{
+	assert(!"no io_uring on this platform");
+	return STATUS_ERR;
+}
+
+int uring_prep_connect(struct uring *ring, int fd,
+		       const struct sockaddr *addr, socklen_t addrlen,
+		       u64 user_data, char **error)
+{
+	assert(!"no io_uring on this platform");
+	return STATUS_ERR;
+}
+
+int uring_submit(struct uring *ring)
+{
+	assert(!"no io_uring on this platform");
+	return -1;
+}
+
+int uring_wait(struct uring *ring, struct uring_completion *completion)
+{
+	assert(!"no io_uring on this platform");
+	return -1;
+}
+
+void uring_finish(struct uring *ring, struct uring_completion *completion)
+{
+	assert(!"no io_uring on this platform");
+}
+
+#endif  /* HAVE_IO_URING && IORING_RECV_MULTISHOT */
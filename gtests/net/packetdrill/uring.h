@@ -0,0 +1,108 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for a minimal io_uring, so scripts can drive sockets
+ * through the kernel's asynchronous path: queue send, recv, accept and
+ * connect operations, submit them, and reap their completions.
+ *
+ * We talk to the kernel with the raw system calls rather than
+ * liburing. Receives always pick a buffer from a ring of provided
+ * buffers that we hand back as soon as their completion is reaped, so
+ * that single-shot and multishot receives work the same way. This
+ * needs Linux 6.0 or newer.
+ */
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#include "types.h"
+
+#include <sys/socket.h>
+
+#define URING_BUFFER_BYTES	65536	/* most bytes one receive returns */
+
+struct uring;
+
+/* What an operation we queued does, so that we know what its
+ * completions mean.
+ */
+enum uring_op_t {
+	URING_OP_NONE,		/* no such operation is in flight */
+	URING_OP_SEND,
+	URING_OP_RECV,
+	URING_OP_ACCEPT,
+	URING_OP_CONNECT,
+};
+
+/* A completion, as the kernel reported it. */
+struct uring_completion {
+	u64 user_data;		/* the user_data of its operation */
+	s32 res;		/* the result, or -errno */
+	u32 flags;		/* IORING_CQE_F_* flags */
+	enum uring_op_t op;	/* what the operation was */
+};
+
+/* Set up a ring with the given number of submission queue entries.
+ * Returns NULL and sets error message on failure.
+ */
+extern struct uring *uring_new(unsigned entries, char **error);
+
+/* Tear down the ring, cancelling anything in flight, and free it. */
+extern void uring_free(struct uring *ring);
+
+/* Return the ring's fd. */
+extern int uring_fd(const struct uring *ring);
+
+/* Queue an operation on the given live socket fd, to be submitted by
+ * the next uring_submit(). The send's buffer must stay valid until it
+ * completes. An accept or recv can be multishot, completing once for
+ * each connection or message until the kernel says it is done.
+ * Returns STATUS_OK on success; on failure returns STATUS_ERR and sets
+ * error message.
+ */
+extern int uring_prep_send(struct uring *ring, int fd, const void *buf,
+			   size_t len, int flags, u64 user_data,
+			   char **error);
+extern int uring_prep_recv(struct uring *ring, int fd, size_t len, int flags,
+			   bool multishot, u64 user_data, char **error);
+extern int uring_prep_accept(struct uring *ring, int fd, int flags,
+			     bool multishot, u64 user_data, char **error);
+extern int uring_prep_connect(struct uring *ring, int fd,
+			      const struct sockaddr *addr, socklen_t addrlen,
+			      u64 user_data, char **error);
+
+/* Submit the queued operations. Returns how many the kernel took, or
+ * -1 with errno set.
+ */
+extern int uring_submit(struct uring *ring);
+
+/* Take the next completion, waiting for one if none is ready, and
+ * fill in all but its op. Returns 0 on success, or -1 with errno set.
+ * This touches only the completion queue, so it can run while another
+ * thread queues and submits operations.
+ */
+extern int uring_wait(struct uring *ring, struct uring_completion *completion);
+
+/* Finish with a completion uring_wait() took: fill in its op, forget
+ * the operation if this was its last completion, and hand back the
+ * buffer of a receive. The caller must serialize this with the
+ * uring_prep_*() and uring_submit() calls.
+ */
+extern void uring_finish(struct uring *ring,
+			 struct uring_completion *completion);
+
+#endif /* __URING_H__ */
@@ -0,0 +1,143 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for uring.c: sends and single-shot and multishot receives over
+ * a socket pair. Skipped where the kernel has no io_uring for us.
+ */
+
+#include "uring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+/* Wait for a completion and finish with it. */
+static void wait_for(struct uring *ring, struct uring_completion *c)
+{
+	assert(uring_wait(ring, c) == 0);
+	uring_finish(ring, c);
+}
+
+static void test_send_recv(struct uring *ring, int fds[2])
+{
+	static const char message[1000];
+	struct uring_completion c;
+	char *error = NULL;
+
+	assert(uring_prep_send(ring, fds[0], message, sizeof(message), 0,
+			       1, &error) == STATUS_OK);
+	assert(uring_prep_recv(ring, fds[1], 600, 0, false, 2,
+			       &error) == STATUS_OK);
+
+	/* A user_data may only be in flight once. */
+	assert(uring_prep_recv(ring, fds[1], 600, 0, false, 2,
+			       &error) == STATUS_ERR);
+	free(error);
+	error = NULL;
+
+	assert(uring_submit(ring) == 2);
+
+	wait_for(ring, &c);
+	assert(c.user_data == 1);
+	assert(c.op == URING_OP_SEND);
+	assert(c.res == sizeof(message));
+
+	wait_for(ring, &c);
+	assert(c.user_data == 2);
+	assert(c.op == URING_OP_RECV);
+	assert(c.res == 600);
+	assert(c.flags & IORING_CQE_F_BUFFER);
+	assert(!(c.flags & IORING_CQE_F_MORE));
+
+	/* The rest of the message. */
+	assert(uring_prep_recv(ring, fds[1], 1000, 0, false, 2,
+			       &error) == STATUS_OK);
+	assert(uring_submit(ring) == 1);
+	wait_for(ring, &c);
+	assert(c.user_data == 2);
+	assert(c.res == 400);
+}
+
+static void test_multishot_recv(struct uring *ring, int fds[2])
+{
+	static const char message[100];
+	struct uring_completion c;
+	char *error = NULL;
+	int i;
+
+	assert(uring_prep_recv(ring, fds[1], 0, 0, true, 3,
+			       &error) == STATUS_OK);
+	assert(uring_submit(ring) == 1);
+
+	/* Many more messages than we have buffers, so that we must
+	 * hand them back as we go.
+	 */
+	for (i = 0; i < 200; ++i) {
+		assert(write(fds[0], message, sizeof(message)) ==
+		       sizeof(message));
+		wait_for(ring, &c);
+		assert(c.user_data == 3);
+		assert(c.op == URING_OP_RECV);
+		assert(c.res == sizeof(message));
+		assert(c.flags & IORING_CQE_F_MORE);
+	}
+
+	/* Shutting down the sender ends the receive. */
+	assert(shutdown(fds[0], SHUT_WR) == 0);
+	wait_for(ring, &c);
+	assert(c.user_data == 3);
+	assert(c.res == 0);
+	assert(!(c.flags & IORING_CQE_F_MORE));
+}
+
+int main(void)
+{
+	struct uring *ring;
+	char *error = NULL;
+	int fds[2];
+
+	ring = uring_new(8, &error);
+	if (ring == NULL) {
+		printf("skipping io_uring test: %s\n", error);
+		free(error);
+		return 0;
+	}
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+	test_send_recv(ring, fds);
+	test_multishot_recv(ring, fds);
+
+	close(fds[0]);
+	close(fds[1]);
+	uring_free(ring);
+	return 0;
+}
+
+#else  /* !HAVE_IO_URING */
+
+int main(void)
+{
+	return 0;
+}
+
+#endif  /* HAVE_IO_URING */
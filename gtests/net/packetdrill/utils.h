@@ -2,15 +2,13 @@
 #define __TYPES_H_INCLUDED__
 #include <time.h>
 #include <stdlib.h>
-#include <openssl/hmac.h>
-#include <openssl/sha.h>
 #include <asm/byteorder.h>
 #include "types.h"
+#include "prng.h"
+#include "sha1.h"
+#include "sha256.h"
 #include "unaligned.h"
 
-#define SHA_WORKSPACE_WORDS 16
-
-
 /**
  * A key is represented as a byte array of length 8.
  */
@@ -25,11 +23,13 @@ typedef unsigned char      byte;    // Byte is a char
 typedef unsigned short int word16;  // 16-bit word is a short int
 typedef unsigned int       word32;  // 32-bit word is an int
 
-void seed_generator();
-u64 rand_64();
-u32 generate_32();
+/* Random numbers for keys and nonces, drawn from the run's generator. */
+u64 rand_64(struct prng *prng);
+u32 generate_32(struct prng *prng);
 u32 sha1_least_32bits(u64 key);
 u64 sha1_least_64bits(u64 key);
+/* Both of the above from a single SHA-1 computation. */
+void sha1_token_and_idsn(u64 key, u32 *token, u64 *idsn);
 void hash_key_sha1(uint8_t *hash, key64 key);
 key64 get_barray_from_key64(unsigned long long key);
 dsn64* retreive_dsn(uint8_t *hash);
@@ -43,9 +43,51 @@ void hmac_sha1(const unsigned char *key,
 		char *data,
 		u32 data_length,
 		unsigned char *output);
+/* Ones' complement checksums of a buffer, summed by the checksum
+ * backend of checksum.h: checksum_dss() as the bytes lie in memory,
+ * checksum_d() as a number. For a DSS checksum over a mapping and its
+ * data, see mptcp_dss_checksum().
+ */
 u16 checksum_dss(u16 *buffer, int size);
 uint16_t checksum_d(void* vdata, size_t length);
 void mptcp_hmac_sha1(u8 *key_1, u8 *key_2, u8 *rand_1, u8 *rand_2,
 		u32 *hash_out);
+
+/* MPTCP versions, as in the MP_CAPABLE version field. Version 0 (RFC 6824)
+ * derives tokens, IDSNs and HMACs with SHA-1, version 1 (RFC 8684) with
+ * SHA-256.
+ */
+#define MPTCP_V0 0
+#define MPTCP_V1 1
+#define MPTCP_HMAC_MAX_BYTES 32 /* a SHA-256 digest */
+/* Token (most significant 32 bits) and IDSN (least significant 64 bits)
+ * of the hash of key for the given version.
+ */
+void mptcp_token_and_idsn(u8 version, u64 key, u32 *token, u64 *idsn);
+u64 mptcp_idsn(u8 version, u64 key);
+/* MP_JOIN HMAC of key_1 + key_2 over rand_1 + rand_2 for the given version:
+ * fills 20 bytes of hmac for version 0, 32 bytes for version 1.
+ */
+void mptcp_hmac(u8 version, u8 *key_1, u8 *key_2, u8 *rand_1, u8 *rand_2,
+		u8 *hmac);
+/* The MP_JOIN HMAC key key_1 + key_2 for the given version, with its
+ * padded blocks hashed once, for the HMACs of many pairs of random numbers.
+ */
+struct mptcp_hmac_key {
+	u8 version;
+	union {
+		struct sha1_hmac_key sha1;	/* MPTCP_V0 */
+		struct sha256_hmac_key sha256;	/* MPTCP_V1 */
+	};
+};
+void mptcp_hmac_key_init(struct mptcp_hmac_key *hkey, u8 version, u64 key_1,
+		u64 key_2);
+/* Same as mptcp_hmac(), under a prepared key. */
+void mptcp_hmac_keyed(const struct mptcp_hmac_key *hkey, u32 rand_1,
+		u32 rand_2, u8 *hmac);
+/* Version 1 ADD_ADDR HMAC of key_1 + key_2 over msg: its rightmost 64 bits,
+ * as the bytes go on the wire.
+ */
+u64 mptcp_add_addr_hmac(u64 key_1, u64 key_2, const u8 *msg, u32 msg_len);
 #endif
 
@@ -0,0 +1,410 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of precompiled verification plans for outbound
+ * script packets. The masks and checks mirror the verifiers in
+ * run_packet.c: any field those compare, a plan compares too, so
+ * that a packet that passes the plan would pass them.
+ */
+
+#include "verify_plan.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "tcp_options_iterator.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* Most checks with slack a plan may hold: the ECN bits of each IP
+ * header and the TS val.
+ */
+#define MAX_VERIFY_CHECKS	(PACKET_MAX_HEADERS + 1)
+
+/* A plan under construction. */
+struct plan_builder {
+	u8 mask[VERIFY_PLAN_MAX_BYTES];
+	int mask_bytes;
+	struct verify_check checks[MAX_VERIFY_CHECKS];
+	int num_checks;
+	u32 min_bytes;
+	bool too_long;		/* some field lies past the mask? */
+};
+
+static void add_check(struct plan_builder *builder, int offset, int width,
+		      enum verify_check_t type, u32 mask,
+		      u32 expected, u32 tolerance)
+{
+	struct verify_check *check = NULL;
+
+	assert(builder->num_checks < MAX_VERIFY_CHECKS);
+	check = &builder->checks[builder->num_checks++];
+	check->offset = offset;
+	check->width = width;
+	check->type = type;
+	check->mask = mask;
+	check->expected = expected;
+	check->tolerance = tolerance;
+	if (offset + width > builder->min_bytes)
+		builder->min_bytes = offset + width;
+}
+
+/* Compare the bits of the big-endian field under mask with the
+ * script packet's.
+ */
+static void add_field(struct plan_builder *builder, int offset, int width,
+		      u32 mask)
+{
+	int i;
+
+	if (offset + width > VERIFY_PLAN_MAX_BYTES) {
+		builder->too_long = true;
+		return;
+	}
+	for (i = 0; i < width; i++)
+		builder->mask[offset + i] |=
+			mask >> (8 * (width - 1 - i)) & 0xff;
+	if (offset + width > builder->mask_bytes)
+		builder->mask_bytes = offset + width;
+	if (offset + width > builder->min_bytes)
+		builder->min_bytes = offset + width;
+}
+
+/* Compare all bytes of a header with the script packet's. */
+static void add_bytes(struct plan_builder *builder, int offset, int bytes)
+{
+	int i;
+
+	for (i = 0; i < bytes; i++)
+		add_field(builder, offset + i, 1, 0xff);
+}
+
+/* Check the ECN bits of the IP header, as verify_outbound_live_ecn()
+ * does. The ECN bits are under mask; a value of 1 has bit 'ect1'.
+ */
+static void add_ecn(struct plan_builder *builder, enum ip_ecn_t ecn,
+		    int offset, u32 mask, u32 ect1)
+{
+	if (ecn == ECN_NOCHECK)
+		return;
+	if (ecn == ECN_ECT01)	/* IP_ECN_ECT1 or IP_ECN_ECT0 */
+		add_check(builder, offset, 1, VERIFY_CHECK_RANGE, mask,
+			  ect1 * IP_ECN_ECT1, ect1 * (IP_ECN_ECT0 -
+						      IP_ECN_ECT1));
+	else
+		add_field(builder, offset, 1, mask);
+}
+
+static void add_ipv4(struct plan_builder *builder, struct packet *packet,
+		     int offset)
+{
+	add_field(builder, offset + 0, 1, 0xff);	/* version, ihl */
+	add_ecn(builder, packet->ecn, offset + 1, IP_ECN_MASK, 1);
+	add_field(builder, offset + 2, 2, 0xffff);	/* tot_len */
+	add_field(builder, offset + 9, 1, 0xff);	/* protocol */
+}
+
+static void add_ipv6(struct plan_builder *builder, struct packet *packet,
+		     int offset)
+{
+	add_field(builder, offset + 0, 1, 0xf0);	/* version */
+	add_ecn(builder, packet->ecn, offset + 1, IP_ECN_MASK << 4, 1 << 4);
+	add_field(builder, offset + 4, 2, 0xffff);	/* payload_len */
+	add_field(builder, offset + 6, 1, 0xff);	/* next_header */
+}
+
+/* Check the TCP options byte by byte, except for the TS val, whose
+ * own check allows for the configured tolerance. Returns false if
+ * the options need more than bytewise compares.
+ */
+static bool add_tcp_options(struct plan_builder *builder,
+			    struct packet *packet, int offset)
+{
+	struct tcp_options_iterator iter;
+	struct tcp_option *option = NULL;
+	int options_len = packet_tcp_options_len(packet);
+	int ts_val = -1;	/* offset of TS val from options, if any */
+	int i;
+
+	for (option = tcp_options_begin(packet, &iter); option != NULL;
+	     option = tcp_options_next(&iter, NULL)) {
+		/* same_mptcp_opt() compares MPTCP options field by field,
+		 * with values filled in as the test runs.
+		 */
+		if (option->kind == TCPOPT_MPTCP)
+			return false;
+		if (option->kind == TCPOPT_TIMESTAMP && ts_val < 0)
+			ts_val = (u8 *)&option->data.time_stamp.val -
+				 packet_tcp_options(packet);
+	}
+
+	for (i = 0; i < options_len; i++) {
+		if (ts_val < 0 || i < ts_val || i >= ts_val + 4)
+			add_field(builder, offset + i, 1, 0xff);
+	}
+	if (ts_val >= 0)
+		add_check(builder, offset + ts_val, 4, VERIFY_CHECK_TS_VAL,
+			  0xffffffff, 0, 0);
+	return true;
+}
+
+/* Check the TCP header as verify_tcp() does. The ports are left out,
+ * since they were rewritten to the script's. Returns whether the
+ * checks cover the TCP options too.
+ */
+static bool add_tcp(struct plan_builder *builder, struct packet *packet,
+		    int offset)
+{
+	add_field(builder, offset + 4, 4, 0xffffffff);	/* seq */
+	add_field(builder, offset + 8, 4, 0xffffffff);	/* ack_seq */
+	add_field(builder, offset + 12, 1, 0xf3);	/* doff, res1 */
+	add_field(builder, offset + 13, 1, 0xff);	/* flags */
+	if (!(packet->flags & FLAG_WIN_NOCHECK))
+		add_field(builder, offset + 14, 2, 0xffff);	/* window */
+	add_field(builder, offset + 18, 2, 0xffff);	/* urg_ptr */
+
+	return add_tcp_options(builder, packet,
+			       offset + (int)sizeof(struct tcp));
+}
+
+static void add_udp(struct plan_builder *builder, int offset)
+{
+	add_field(builder, offset + 4, 2, 0xffff);	/* len */
+}
+
+/* Check the GRE flags that give its length, as verify_gre() does, and
+ * the version, which gre_len() needs to be 0.
+ */
+static void add_gre(struct plan_builder *builder, int offset)
+{
+	add_field(builder, offset + 0, 1, 0xf0);	/* C, R, K, S */
+	add_field(builder, offset + 1, 1, 0x07);	/* version */
+}
+
+struct verify_plan *verify_plan_new(struct packet *packet)
+{
+	struct plan_builder builder;
+	struct verify_plan *plan = NULL;
+	int num_headers = packet_header_count(packet);
+	bool options_checked = true;
+	int i;
+
+	/* Options we don't check change the lengths we expect, and
+	 * trains are matched segment by segment.
+	 */
+	if (packet->flags & (FLAG_OPTIONS_NOCHECK | FLAG_TRAIN))
+		return NULL;
+	if (packet->tcp == NULL && packet->udp == NULL)
+		return NULL;
+
+	memset(&builder, 0, sizeof(builder));
+	for (i = 0; i < num_headers; i++) {
+		const struct header *header = &packet->headers[i];
+		int offset = header->h.ptr - packet_start(packet);
+
+		switch (header->type) {
+		case HEADER_IPV4:
+			add_ipv4(&builder, packet, offset);
+			break;
+		case HEADER_IPV6:
+			add_ipv6(&builder, packet, offset);
+			break;
+		case HEADER_TCP:
+			options_checked = add_tcp(&builder, packet, offset);
+			break;
+		case HEADER_UDP:
+			add_udp(&builder, offset);
+			break;
+		case HEADER_GRE:
+			add_gre(&builder, offset);
+			break;
+		case HEADER_MPLS:
+			/* Every label stack entry, as verify_mpls() does;
+			 * the bottom-of-stack bits also catch a stack of
+			 * another depth.
+			 */
+			add_bytes(&builder, offset, header->header_bytes);
+			break;
+		default:
+			return NULL;
+		}
+	}
+	if (builder.too_long)
+		return NULL;
+
+	plan = calloc(1, sizeof(*plan) +
+		      builder.num_checks * sizeof(struct verify_check) +
+		      builder.mask_bytes);
+	plan->refs = 1;
+	for (i = 0; i < num_headers; i++)
+		plan->header_types[i] = packet->headers[i].type;
+	plan->num_headers = num_headers;
+	plan->min_bytes = builder.min_bytes;
+	plan->options_checked = options_checked;
+	plan->num_checks = builder.num_checks;
+	memcpy(plan->checks, builder.checks,
+	       builder.num_checks * sizeof(struct verify_check));
+	plan->mask = (u8 *)&plan->checks[plan->num_checks];
+	plan->mask_bytes = builder.mask_bytes;
+	memcpy(plan->mask, builder.mask, builder.mask_bytes);
+	return plan;
+}
+
+struct verify_plan *verify_plan_get(struct verify_plan *plan)
+{
+	if (plan != NULL)
+		++plan->refs;
+	return plan;
+}
+
+void verify_plan_put(struct verify_plan *plan)
+{
+	if (plan == NULL)
+		return;
+	assert(plan->refs > 0);
+	if (--plan->refs == 0)
+		free(plan);
+}
+
+const struct verify_plan *packet_verify_plan(struct packet *packet)
+{
+	if (!(packet->flags & FLAG_VERIFY_PLANNED)) {
+		packet->verify_plan = verify_plan_new(packet);
+		packet->flags |= FLAG_VERIFY_PLANNED;
+	}
+	return packet->verify_plan;
+}
+
+/* Read the big-endian field of the given width at p. */
+static inline u32 read_field(const u8 *p, int width)
+{
+	u32 value = 0;
+	int i;
+
+	for (i = 0; i < width; i++)
+		value = (value << 8) | p[i];
+	return value;
+}
+
+/* Are the first len bytes at a and b equal in the bits set in mask?
+ * All bytes are looked at, so the time taken depends only on len.
+ */
+static bool masked_equal(const u8 *a, const u8 *b, const u8 *mask, int len)
+{
+	u64 diff = 0;
+	int i = 0;
+
+#if defined(__SSE2__)
+	__m128i diff128 = _mm_setzero_si128();
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+
+		diff128 = _mm_or_si128(diff128,
+				       _mm_and_si128(_mm_xor_si128(x, y), m));
+	}
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff128,
+					     _mm_setzero_si128())) != 0xffff)
+		return false;
+#elif defined(__aarch64__)
+	uint8x16_t diff128 = vdupq_n_u8(0);
+
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t x = vld1q_u8(a + i);
+		uint8x16_t y = vld1q_u8(b + i);
+		uint8x16_t m = vld1q_u8(mask + i);
+
+		diff128 = vorrq_u8(diff128, vandq_u8(veorq_u8(x, y), m));
+	}
+	if (vmaxvq_u8(diff128) != 0)
+		return false;
+#endif
+	for (; i + 8 <= len; i += 8) {
+		u64 x, y, m;
+
+		memcpy(&x, a + i, sizeof(x));
+		memcpy(&y, b + i, sizeof(y));
+		memcpy(&m, mask + i, sizeof(m));
+		diff |= (x ^ y) & m;
+	}
+	for (; i < len; i++)
+		diff |= (a[i] ^ b[i]) & mask[i];
+	return diff == 0;
+}
+
+/* Is the TS val within the tolerance verify_outbound_live_tcp_options()
+ * allows?
+ */
+static bool ts_val_matches(const struct config *config,
+			   u32 script_ts_val, u32 actual_ts_val)
+{
+	s64 ticks = llabs((s64)(s32)(actual_ts_val - script_ts_val));
+
+	if (config->tcp_ts_tick_usecs == 0)
+		return true;
+	return ticks * config->tcp_ts_tick_usecs <=
+		config_tolerance_usecs(config, TIMING_OUTBOUND_PACKET);
+}
+
+bool verify_plan_matches(const struct verify_plan *plan,
+			 const struct config *config,
+			 struct packet *script_packet,
+			 struct packet *actual_packet)
+{
+	const u8 *script = packet_start(script_packet);
+	const u8 *actual = packet_start(actual_packet);
+	int i;
+
+	if (packet_header_count(actual_packet) != plan->num_headers)
+		return false;
+	for (i = 0; i < plan->num_headers; i++) {
+		if (actual_packet->headers[i].type != plan->header_types[i])
+			return false;
+	}
+	if (packet_end(actual_packet) - actual < plan->min_bytes)
+		return false;
+
+	if (!masked_equal(actual, script, plan->mask, plan->mask_bytes))
+		return false;
+
+	for (i = 0; i < plan->num_checks; i++) {
+		const struct verify_check *check = &plan->checks[i];
+		u32 value = read_field(actual + check->offset, check->width);
+		u32 expected = read_field(script + check->offset,
+					  check->width);
+
+		switch (check->type) {
+		case VERIFY_CHECK_RANGE:
+			if ((value & check->mask) - check->expected >
+			    check->tolerance)
+				return false;
+			break;
+		case VERIFY_CHECK_TS_VAL:
+			if (!ts_val_matches(config, expected, value))
+				return false;
+			break;
+		}
+	}
+	return true;
+}
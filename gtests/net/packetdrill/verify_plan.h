@@ -0,0 +1,111 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Precompiled verification plans for outbound script packets.
+ *
+ * An outbound script packet is compiled once into a byte mask over its
+ * headers, with a bit set for each header bit the verifiers compare,
+ * plus a short list of checks for the few fields that are compared
+ * with some slack. Verifying a sniffed packet is then a masked
+ * compare of its header bytes against the script packet's, 16 bytes
+ * at a time where the CPU allows, instead of a walk through the
+ * per-header verifiers and per-option comparisons. Its cost depends
+ * only on the header bytes, not on how many fields or layers of
+ * encapsulation they hold.
+ *
+ * Expected values are read from the script packet at verification
+ * time, so a plan stays valid while the values of its packet change
+ * (say, the sequence offsets of a repeat block) as long as the
+ * packet's layout does not.
+ *
+ * A plan only tells whether a packet matches; on a mismatch the
+ * caller runs the field-by-field verifiers to say what differed.
+ */
+
+#ifndef __VERIFY_PLAN_H__
+#define __VERIFY_PLAN_H__
+
+#include "types.h"
+
+#include "packet.h"
+
+struct config;
+
+/* Most header bytes a plan compares. */
+#define VERIFY_PLAN_MAX_BYTES	512
+
+/* How a check with slack compares its field. */
+enum verify_check_t {
+	VERIFY_CHECK_RANGE,	/* expected ... expected + tolerance */
+	VERIFY_CHECK_TS_VAL,	/* the script's TS val, within the
+				 * configured tolerance
+				 */
+};
+
+/* One compare of a big-endian field that need not match exactly. */
+struct verify_check {
+	u16 offset;		/* bytes from the start of the packet */
+	u8 width;		/* field bytes: 1, 2 or 4 */
+	u8 type;		/* enum verify_check_t */
+	u32 mask;		/* field bits to compare */
+	u32 expected;		/* for VERIFY_CHECK_RANGE */
+	u32 tolerance;		/* for VERIFY_CHECK_RANGE */
+};
+
+struct verify_plan {
+	int refs;			/* packets sharing this plan */
+	u8 header_types[PACKET_MAX_HEADERS];	/* enum header_t of each
+						 * layer, from outer to inner
+						 */
+	int num_headers;		/* layers in header_types */
+	u32 min_bytes;			/* packet bytes the plan reads */
+	bool options_checked;		/* does the plan cover the TCP
+					 * options, or must the caller
+					 * compare those itself?
+					 */
+	u8 *mask;			/* bits that must equal the script
+					 * packet's, from the packet start
+					 */
+	int mask_bytes;			/* bytes in mask */
+	int num_checks;			/* entries in checks */
+	struct verify_check checks[];
+};
+
+/* Compile a plan for verifying packets against the given outbound
+ * script packet. Returns NULL if the packet has no plan: say, if its
+ * options are not checked by simple compares.
+ */
+extern struct verify_plan *verify_plan_new(struct packet *packet);
+
+/* Share or drop a reference to a plan; NULL is allowed. */
+extern struct verify_plan *verify_plan_get(struct verify_plan *plan);
+extern void verify_plan_put(struct verify_plan *plan);
+
+/* Return the plan for the given script packet, compiling it on first
+ * use, or NULL if the packet has no plan.
+ */
+extern const struct verify_plan *packet_verify_plan(struct packet *packet);
+
+/* Does the actual packet, mapped into script space, match the masked
+ * bytes and pass every check of the plan of script_packet?
+ */
+extern bool verify_plan_matches(const struct verify_plan *plan,
+				const struct config *config,
+				struct packet *script_packet,
+				struct packet *actual_packet);
+
+#endif /* __VERIFY_PLAN_H__ */
@@ -0,0 +1,239 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Unit test for verify_plan.c: a plan accepts a copy of its script
+ * packet, rejects changes to the fields the verifiers check, wherever
+ * they fall in the masked compare, and allows for the TS val
+ * tolerance, unchecked windows and ECT(0/1).
+ */
+
+#include "verify_plan.h"
+
+#include <assert.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "config.h"
+#include "gre_packet.h"
+#include "ip_packet.h"
+#include "mpls_packet.h"
+#include "tcp_options.h"
+#include "tcp_packet.h"
+
+/* An outbound ACK with <nop,nop,TS val 1000 ecr 5>. */
+static struct packet *new_script_packet(int address_family,
+					enum ip_ecn_t ecn)
+{
+	struct tcp_options *options = tcp_options_new();
+	struct tcp_option *option = NULL;
+	struct packet *packet = NULL;
+	char *error = NULL;
+
+	option = tcp_option_new(TCPOPT_NOP, 1);
+	assert(tcp_options_append(options, option) == STATUS_OK);
+	free(option);
+	option = tcp_option_new(TCPOPT_NOP, 1);
+	assert(tcp_options_append(options, option) == STATUS_OK);
+	free(option);
+	option = tcp_option_new(TCPOPT_TIMESTAMP, TCPOLEN_TIMESTAMP);
+	option->data.time_stamp.val = htonl(1000);
+	option->data.time_stamp.ecr = htonl(5);
+	assert(tcp_options_append(options, option) == STATUS_OK);
+	free(option);
+
+	packet = new_tcp_packet(3, address_family, DIRECTION_OUTBOUND, ecn,
+				".", 1, 0, 1, 257, options, &error);
+	assert(packet != NULL);
+	free(options);
+	return packet;
+}
+
+/* Set the TS val of a packet from new_script_packet(). */
+static void set_ts_val(struct packet *packet, u32 ts_val)
+{
+	put_unaligned_be32(ts_val, packet_tcp_options(packet) + 4);
+}
+
+static bool matches(struct packet *script, struct packet *actual,
+		    const struct config *config)
+{
+	const struct verify_plan *plan = packet_verify_plan(script);
+
+	assert(plan != NULL);
+	return verify_plan_matches(plan, config, script, actual);
+}
+
+static void test_fields(int address_family)
+{
+	struct config config;
+	struct packet *script = new_script_packet(address_family, ECN_NONE);
+	struct packet *actual = NULL;
+
+	memset(&config, 0, sizeof(config));
+	config.tolerance_usecs = 4000;
+	config.tcp_ts_tick_usecs = 1000;
+
+	assert(packet_verify_plan(script)->options_checked);
+
+	/* A copy matches, and shares the plan. */
+	actual = packet_copy(script);
+	assert(actual->verify_plan == script->verify_plan);
+	assert(matches(script, actual, &config));
+
+	/* The verifiers check sequence numbers and windows... */
+	actual->tcp->seq = htonl(2);
+	assert(!matches(script, actual, &config));
+	actual->tcp->seq = script->tcp->seq;
+	actual->tcp->window = htons(100);
+	assert(!matches(script, actual, &config));
+	actual->tcp->window = script->tcp->window;
+	actual->tcp->psh = 1;
+	assert(!matches(script, actual, &config));
+	actual->tcp->psh = 0;
+
+	/* ...and TCP options, but not ports or checksums. */
+	packet_tcp_options(actual)[0] = TCPOPT_EOL;
+	assert(!matches(script, actual, &config));
+	packet_tcp_options(actual)[0] = TCPOPT_NOP;
+	packet_tcp_options(actual)[11] ^= 1;	/* TS ecr */
+	assert(!matches(script, actual, &config));
+	packet_tcp_options(actual)[11] ^= 1;
+	actual->tcp->src_port = htons(1234);
+	actual->tcp->check = 0xffff;
+	assert(matches(script, actual, &config));
+
+	/* The TS val may be off by tolerance_usecs worth of ticks. */
+	set_ts_val(actual, 1004);
+	assert(matches(script, actual, &config));
+	set_ts_val(actual, 996);
+	assert(matches(script, actual, &config));
+	set_ts_val(actual, 1005);
+	assert(!matches(script, actual, &config));
+	config.tcp_ts_tick_usecs = 0;
+	assert(matches(script, actual, &config));
+
+	packet_free(actual);
+	packet_free(script);
+}
+
+static void test_win_nocheck(void)
+{
+	struct config config;
+	struct packet *script = new_script_packet(AF_INET, ECN_NONE);
+	struct packet *actual = packet_copy(script);
+
+	memset(&config, 0, sizeof(config));
+	script->flags |= FLAG_WIN_NOCHECK;
+	actual->tcp->window = htons(100);
+	assert(matches(script, actual, &config));
+	packet_free(actual);
+	packet_free(script);
+}
+
+static void test_ecn(int address_family)
+{
+	struct config config;
+	struct packet *script = new_script_packet(address_family, ECN_ECT01);
+	struct packet *actual = packet_copy(script);
+	u8 *ecn_byte = packet_start(actual) + 1;
+	int ecn_shift = (address_family == AF_INET) ? 0 : 4;
+
+	memset(&config, 0, sizeof(config));
+	*ecn_byte &= ~(IP_ECN_MASK << ecn_shift);
+	*ecn_byte |= IP_ECN_ECT0 << ecn_shift;
+	assert(matches(script, actual, &config));
+	*ecn_byte &= ~(IP_ECN_MASK << ecn_shift);
+	*ecn_byte |= IP_ECN_ECT1 << ecn_shift;
+	assert(matches(script, actual, &config));
+	*ecn_byte &= ~(IP_ECN_MASK << ecn_shift);
+	assert(!matches(script, actual, &config));
+	*ecn_byte |= IP_ECN_CE << ecn_shift;
+	assert(!matches(script, actual, &config));
+	packet_free(actual);
+	packet_free(script);
+}
+
+/* The plan of an IPv6 + GRE + MPLS + IPv4 + TCP packet covers the
+ * GRE length flags and every MPLS label stack entry.
+ */
+static void test_encapsulated(void)
+{
+	struct config config;
+	struct packet *outer = packet_new(PACKET_MAX_HEADER_BYTES);
+	struct packet *script = NULL, *actual = NULL;
+	struct mpls_stack *stack = mpls_stack_new();
+	struct mpls mpls;
+	char *error = NULL;
+	u8 *gre = NULL, *labels = NULL;
+
+	memset(&config, 0, sizeof(config));
+	outer->direction = DIRECTION_OUTBOUND;
+	assert(ipv6_header_append(outer, "2001:db8::1", "2001:db8::2",
+				  &error) == STATUS_OK);
+	assert(gre_header_append(outer, &error) == STATUS_OK);
+	assert(new_mpls_stack_entry(1000, 0, false, 64, &mpls,
+				    &error) == STATUS_OK);
+	assert(mpls_stack_append(stack, mpls) == STATUS_OK);
+	assert(new_mpls_stack_entry(2000, 0, true, 64, &mpls,
+				    &error) == STATUS_OK);
+	assert(mpls_stack_append(stack, mpls) == STATUS_OK);
+	assert(mpls_header_append(outer, stack, &error) == STATUS_OK);
+	free(stack);
+	script = packet_encapsulate_and_free(
+		outer, new_script_packet(AF_INET, ECN_NONE));
+
+	assert(packet_verify_plan(script) != NULL);
+	actual = packet_copy(script);
+	assert(matches(script, actual, &config));
+
+	gre = actual->headers[1].h.ptr;
+	gre[0] ^= 0x20;		/* key present */
+	assert(!matches(script, actual, &config));
+	gre[0] ^= 0x20;
+	labels = actual->headers[2].h.ptr;
+	labels[6] ^= 0x01;	/* bottom of stack */
+	assert(!matches(script, actual, &config));
+	labels[6] ^= 0x01;
+	actual->tcp->ack_seq = htonl(2);
+	assert(!matches(script, actual, &config));
+
+	packet_free(actual);
+	packet_free(script);
+}
+
+static void test_no_plan(void)
+{
+	struct packet *script = new_script_packet(AF_INET, ECN_NONE);
+
+	script->flags |= FLAG_OPTIONS_NOCHECK;
+	assert(packet_verify_plan(script) == NULL);
+	assert(script->flags & FLAG_VERIFY_PLANNED);
+	packet_free(script);
+}
+
+int main(void)
+{
+	test_fields(AF_INET);
+	test_fields(AF_INET6);
+	test_win_nocheck();
+	test_ecn(AF_INET);
+	test_ecn(AF_INET6);
+	test_encapsulated();
+	test_no_plan();
+	return 0;
+}
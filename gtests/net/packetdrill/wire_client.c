@@ -27,6 +27,7 @@
 #include "config.h"
 #include "link_layer.h"
 #include "script.h"
+#include "script_cache.h"
 #include "run.h"
 
 struct wire_client *wire_client_new(void)
@@ -96,11 +97,8 @@ static void wire_client_send_args(struct wire_client *wire_client,
 
 	wire_client_serialize_argv(config->argv, &args, &args_len);
 
-	if (wire_conn_write(wire_client->wire_conn,
-				    WIRE_COMMAND_LINE_ARGS,
-				    args, args_len))
-		wire_client_die(wire_client,
-				"error sending WIRE_COMMAND_LINE_ARGS");
+	wire_conn_queue(wire_client->wire_conn, WIRE_COMMAND_LINE_ARGS,
+			args, args_len);
 	free(args);
 }
 
@@ -108,26 +106,53 @@ static void wire_client_send_args(struct wire_client *wire_client,
 static void wire_client_send_script_path(struct wire_client *wire_client,
 					 const struct config *config)
 {
-	if (wire_conn_write(wire_client->wire_conn,
-				    WIRE_SCRIPT_PATH,
-				    config->script_path,
-				    strlen(config->script_path)))
-		wire_client_die(wire_client,
-				"error sending WIRE_SCRIPT_PATH");
+	wire_conn_queue(wire_client->wire_conn, WIRE_SCRIPT_PATH,
+			config->script_path, strlen(config->script_path));
 }
 
 /* Send the ASCII contents of the script we're about to run. */
 static void wire_client_send_script(struct wire_client *wire_client,
 				    const struct script *script)
 {
-	if (wire_conn_write(wire_client->wire_conn,
-				    WIRE_SCRIPT,
-				    script->buffer, script->length))
-		wire_client_die(wire_client,
-				"error sending WIRE_SCRIPT");
+	wire_conn_queue(wire_client->wire_conn, WIRE_SCRIPT,
+			script->buffer, script->length);
+}
+
+/* Send our parse of the script, in the script cache format, so the
+ * server need not parse it again; or an empty message if we cannot
+ * encode the parse. The image's key covers the script and the command
+ * line arguments we send, as the server sees them.
+ */
+static void wire_client_send_parsed_script(struct wire_client *wire_client,
+					   const struct config *config,
+					   struct script *script)
+{
+	char **argv = NULL;
+	u8 key[SHA1_DIGEST_BYTES];
+	u8 *image = NULL;
+	size_t image_len = 0;
+	int argc = 0, i;
+
+	for (i = 0; config->argv[i]; ++i)
+		;
+	argv = calloc(i + 1, sizeof(char *));
+	for (i = 0; config->argv[i]; ++i) {
+		if (!strstr(config->argv[i], "-wire_client"))
+			argv[argc++] = (char *)config->argv[i];
+	}
+	script_cache_key(script, argc, argv, key);
+	free(argv);
+
+	if (script_cache_encode(key, script, &image, &image_len))
+		image_len = 0;
+	wire_conn_queue(wire_client->wire_conn, WIRE_PARSED_SCRIPT,
+			image, image_len);
+	free(image);
 }
 
-/* Send the ethernet address to which the server should send packets. */
+/* Send the ethernet address to which the server should send packets,
+ * and with it the messages we have queued before it.
+ */
 static void wire_client_send_hw_address(struct wire_client *wire_client,
 					const struct config *config)
 {
@@ -139,16 +164,47 @@ static void wire_client_send_hw_address(struct wire_client *wire_client,
 				"error sending WIRE_HARDWARE_ADDR");
 }
 
-/* Receive server's message that the server is ready to execute the script. */
+/* Answer a WIRE_CLOCK_PROBE from the server with the time on our clock. */
+static void wire_client_send_clock_reply(struct wire_client *wire_client,
+					 const void *buf, int buf_len,
+					 s64 receive_usecs)
+{
+	struct wire_clock_probe probe;
+
+	if (buf_len != sizeof(probe)) {
+		wire_client_die(wire_client,
+				"bad wire server: bad WIRE_CLOCK_PROBE len");
+	}
+	memcpy(&probe, buf, sizeof(probe));
+	wire_u64_to_net(receive_usecs, &probe.t2_usecs_hi,
+			&probe.t2_usecs_lo);
+	wire_u64_to_net(now_usecs(), &probe.t3_usecs_hi, &probe.t3_usecs_lo);
+	if (wire_conn_write(wire_client->wire_conn,
+			    WIRE_CLOCK_REPLY,
+			    &probe, sizeof(probe)))
+		wire_client_die(wire_client,
+				"error sending WIRE_CLOCK_REPLY");
+}
+
+/* Receive server's message that the server is ready to execute the
+ * script, answering any clock probes it sends first.
+ */
 static void wire_client_receive_server_ready(struct wire_client *wire_client)
 {
 	enum wire_op_t op = WIRE_INVALID;
 	void *buf = NULL;
 	int buf_len = -1;
 
-	if (wire_conn_read(wire_client->wire_conn,
+	while (1) {
+		if (wire_conn_read(wire_client->wire_conn,
 				   &op, &buf, &buf_len))
-		wire_client_die(wire_client, "error reading WIRE_SERVER_READY");
+			wire_client_die(wire_client,
+					"error reading WIRE_SERVER_READY");
+		if (op != WIRE_CLOCK_PROBE)
+			break;
+		wire_client_send_clock_reply(wire_client, buf, buf_len,
+					     now_usecs());
+	}
 	if (op != WIRE_SERVER_READY) {
 		wire_client_die(wire_client,
 				"bad wire server: expected WIRE_SERVER_READY");
@@ -162,9 +218,18 @@ static void wire_client_receive_server_ready(struct wire_client *wire_client)
 /* Tell server that client is starting script execution. */
 void wire_client_send_client_starting(struct wire_client *wire_client)
 {
+	struct wire_client_starting starting;
+	const struct state *state = wire_client->state;
+	bool clock_sync = state->config->wire_clock_sync;
+
+	/* With clock sync, say when we start; else our message is "now". */
+	wire_u64_to_net(state->live_start_time_usecs,
+			&starting.live_start_usecs_hi,
+			&starting.live_start_usecs_lo);
 	if (wire_conn_write(wire_client->wire_conn,
 				    WIRE_CLIENT_STARTING,
-				    NULL, 0))
+				    clock_sync ? &starting : NULL,
+				    clock_sync ? sizeof(starting) : 0))
 		wire_client_die(wire_client,
 				"error sending WIRE_CLIENT_STARTING");
 }
@@ -174,6 +239,8 @@ static void wire_client_send_packets_start(struct wire_client *wire_client)
 {
 	struct wire_packets_start start;
 	start.num_events = htonl(wire_client->num_events);
+	wire_u64_to_net(now_usecs(), &start.send_usecs_hi,
+			&start.send_usecs_lo);
 	if (wire_conn_write(wire_client->wire_conn,
 			    WIRE_PACKETS_START,
 			    &start, sizeof(start)))
@@ -181,35 +248,54 @@ static void wire_client_send_packets_start(struct wire_client *wire_client)
 				"error sending WIRE_PACKETS_START");
 }
 
-/* Receive a message from the server that the server is done executing
- * some packet events. Print any warnings we receive along the way.
+/* Tell the server some packet events are coming up, without waiting
+ * for it to finish any it is still working on. See wire_packets_ahead.
  */
-static void wire_client_receive_packets_done(struct wire_client *wire_client)
+static void wire_client_send_packets_ahead(struct wire_client *wire_client)
+{
+	const struct state *state = wire_client->state;
+	struct wire_packets_ahead ahead;
+	u64 offset_usecs = now_usecs() - state->live_start_time_usecs;
+
+	ahead.num_events = htonl(wire_client->num_events);
+	wire_u64_to_net(offset_usecs, &ahead.live_offset_usecs_hi,
+			&ahead.live_offset_usecs_lo);
+	wire_u64_to_net(now_usecs(), &ahead.send_usecs_hi,
+			&ahead.send_usecs_lo);
+	if (wire_conn_write(wire_client->wire_conn,
+			    WIRE_PACKETS_AHEAD,
+			    &ahead, sizeof(ahead)))
+		wire_client_die(wire_client,
+				"error sending WIRE_PACKETS_AHEAD");
+}
+
+/* Receive one message from the server about the packet events it is
+ * executing. Print any warning. Return true if the message said that
+ * the server is done executing some packet events.
+ */
+static bool wire_client_receive_packets_message(
+	struct wire_client *wire_client)
 {
 	enum wire_op_t op;
 	struct wire_packets_done done;
 	void *buf = NULL;
 	int buf_len = -1;
+	int num_events = 0;
 
-	DEBUGP("wire_client_receive_packets_done\n");
-
-	while (1) {
-		if (wire_conn_read(wire_client->wire_conn,
-				   &op, &buf, &buf_len))
-			wire_client_die(wire_client, "error reading");
-		if (op == WIRE_PACKETS_DONE)
-			break;
-		else if (op == WIRE_PACKETS_WARN) {
-			/* NULL-terminate the warning and print it. */
-			char *warning = strndup(buf, buf_len);
-			fprintf(stderr, "%s", warning);
-			free(warning);
-		} else {
-			wire_client_die(
-				wire_client,
-				"bad wire server: expected "
-				"WIRE_PACKETS_DONE or WIRE_PACKETS_WARN");
-		}
+	if (wire_conn_read(wire_client->wire_conn,
+			   &op, &buf, &buf_len))
+		wire_client_die(wire_client, "error reading");
+	if (op == WIRE_PACKETS_WARN) {
+		/* NULL-terminate the warning and print it. */
+		char *warning = strndup(buf, buf_len);
+		fprintf(stderr, "%s", warning);
+		free(warning);
+		return false;
+	} else if (op != WIRE_PACKETS_DONE) {
+		wire_client_die(
+			wire_client,
+			"bad wire server: expected "
+			"WIRE_PACKETS_DONE or WIRE_PACKETS_WARN");
 	}
 
 	if (buf_len < sizeof(done) + 1) {
@@ -222,19 +308,60 @@ static void wire_client_receive_packets_done(struct wire_client *wire_client)
 	}
 
 	memcpy(&done, buf, sizeof(done));
+	num_events = ntohl(done.num_events);
 
+	/* Without --wire_pipeline the server is done with exactly the
+	 * events we have executed; with it, the server may be done
+	 * with any number of events up to those.
+	 */
 	if (ntohl(done.result) == STATUS_ERR) {
 		/* Die with the error message from the server, which
 		 * is a C string following the fixed "done" message.
 		 */
 		die("%s", (char *)(buf + sizeof(done)));
-	} else if (ntohl(done.num_events) != wire_client->num_events) {
+	} else if (wire_client->state->config->wire_pipeline ?
+		   (num_events <= wire_client->num_events_acked ||
+		    num_events > wire_client->num_events) :
+		   (num_events != wire_client->num_events)) {
 		char *msg = NULL;
 		asprintf(&msg, "bad wire server: bad message count: "
 			 "got: %d vs expected: %d",
-			 ntohl(done.num_events), wire_client->num_events);
+			 num_events, wire_client->num_events);
 		wire_client_die(wire_client, msg);
 	}
+	wire_client->num_events_acked = num_events;
+	return true;
+}
+
+/* Receive a message from the server that the server is done executing
+ * some packet events. Print any warnings we receive along the way.
+ */
+static void wire_client_receive_packets_done(struct wire_client *wire_client)
+{
+	DEBUGP("wire_client_receive_packets_done\n");
+
+	while (!wire_client_receive_packets_message(wire_client))
+		;
+}
+
+/* With --wire_pipeline, receive WIRE_PACKETS_DONE messages until no
+ * more than the given number of runs of packet events are unfinished,
+ * or, if max_unacked is negative, until we have read every message
+ * the server has sent already.
+ */
+static void wire_client_receive_acks(struct wire_client *wire_client,
+				     int max_unacked)
+{
+	while (wire_client->num_trains_unacked > 0) {
+		if (max_unacked < 0) {
+			if (!wire_conn_readable(wire_client->wire_conn))
+				break;
+		} else if (wire_client->num_trains_unacked <= max_unacked) {
+			break;
+		}
+		if (wire_client_receive_packets_message(wire_client))
+			--wire_client->num_trains_unacked;
+	}
 }
 
 /* Connect to the wire server, pass it our command line argument
@@ -242,11 +369,12 @@ static void wire_client_receive_packets_done(struct wire_client *wire_client)
  */
 int wire_client_init(struct wire_client *wire_client,
 		     const struct config *config,
-		     const struct script *script,
+		     struct script *script,
 		     const struct state *state)
 {
 	DEBUGP("wire_client_init\n");
 	assert(config->is_wire_client);
+	wire_client->state = state;
 
 	get_hw_address(config->wire_client_device,
 		       &wire_client->client_ether_addr);
@@ -255,6 +383,7 @@ int wire_client_init(struct wire_client *wire_client,
 	wire_conn_connect(wire_client->wire_conn,
 				  &config->wire_server_ip,
 				  config->wire_server_port);
+	wire_client->wire_conn->compress = config->wire_compress;
 
 	wire_client_send_args(wire_client, config);
 
@@ -262,6 +391,8 @@ int wire_client_init(struct wire_client *wire_client,
 
 	wire_client_send_script(wire_client, script);
 
+	wire_client_send_parsed_script(wire_client, config, script);
+
 	wire_client_send_hw_address(wire_client, config);
 
 	wire_client_receive_server_ready(wire_client);
@@ -279,9 +410,55 @@ int wire_client_init(struct wire_client *wire_client,
  * this on-the-wire event because the previous event was also an
  * on-the-wire event.
  */
+/* With --wire_pipeline, we tell the server about each run of packet
+ * events as we reach it, but do not wait for the server to finish the
+ * run, unless the run has packets whose time we cannot know (such as
+ * ones at any time or in a time range), so that our next event would not
+ * know when to happen. Instead we pick up the server's acks as they
+ * come in, and wait for any outstanding ones at the end of the script.
+ */
+static void wire_client_next_event_pipelined(struct wire_client *wire_client,
+					     struct event *event)
+{
+	/* Pick up, without waiting, any acks that have arrived already. */
+	wire_client_receive_acks(wire_client, -1);
+
+	if (event && (event->type == PACKET_EVENT)) {
+		if (wire_client->last_event_type != PACKET_EVENT) {
+			wire_client_send_packets_ahead(wire_client);
+			wire_client->train_needs_ack = false;
+		}
+		if (event->time_type == ANY_TIME ||
+		    event->time_type == ABSOLUTE_RANGE_TIME ||
+		    event->time_type == RELATIVE_RANGE_TIME)
+			wire_client->train_needs_ack = true;
+	}
+
+	if ((!event || (event->type != PACKET_EVENT)) &&
+	    (wire_client->last_event_type == PACKET_EVENT)) {
+		++wire_client->num_trains_unacked;
+		if (wire_client->train_needs_ack)
+			wire_client_receive_acks(wire_client, 0);
+	}
+
+	/* At the end of the script, wait for the server to finish. */
+	if (!event)
+		wire_client_receive_acks(wire_client, 0);
+
+	if (event) {
+		wire_client->last_event_type = event->type;
+		++wire_client->num_events;
+	}
+}
+
 void wire_client_next_event(struct wire_client *wire_client,
 			    struct event *event)
 {
+	if (wire_client->state->config->wire_pipeline) {
+		wire_client_next_event_pipelined(wire_client, event);
+		return;
+	}
+
 	/* Tell the server to start executing packet events. */
 	if (event && (event->type == PACKET_EVENT) &&
 	    (wire_client->last_event_type != PACKET_EVENT)) {
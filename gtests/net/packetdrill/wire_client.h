@@ -43,6 +43,12 @@ struct wire_client {
 
 	enum event_t last_event_type;	/* type of previous event */
 	int num_events;				/* events executed so far */
+
+	/* For --wire_pipeline: */
+	const struct state *state;		/* for live times (not owned) */
+	bool train_needs_ack;	/* wait for server to finish this run? */
+	int num_trains_unacked;	/* runs of packet events not done yet */
+	int num_events_acked;	/* num_events of last WIRE_PACKETS_DONE */
 };
 
 /* Allocate a new wire_client. */
@@ -51,7 +57,7 @@ struct wire_client *wire_client_new(void);
 /* Initiate remote on-the-wire testing using a real NIC. */
 extern int wire_client_init(struct wire_client *wire_client,
 			    const struct config *config,
-			    const struct script *script,
+			    struct script *script,
 			    const struct state *state);
 
 /* Delete a wire_client and its associated objects. */
@@ -151,6 +151,7 @@ static int wire_client_netdev_send(struct netdev *a_netdev,
 }
 
 static int wire_client_netdev_receive(struct netdev *a_netdev,
+				      struct packet_pool *pool,
 				      struct packet **packet, char **error)
 {
 	DEBUGP("wire_client_netdev_receive\n");
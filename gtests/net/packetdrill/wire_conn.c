@@ -28,8 +28,12 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "logging.h"
 #include "tcp.h"
@@ -37,6 +41,12 @@
 /* Cap the max message we're willing to read, so remote side can't OOM us. */
 #define MAX_MESSAGE_BYTES (10*1000*1000)
 
+/* How much we try to read at a time. */
+#define READ_CHUNK_BYTES (64*1024)
+
+/* Messages smaller than this are not worth compressing. */
+#define MIN_COMPRESS_BYTES 512
+
 struct wire_conn *wire_conn_new(void)
 {
 	DEBUGP("wire_conn_new\n");
@@ -51,6 +61,8 @@ void wire_conn_free(struct wire_conn *conn)
 	if (conn->fd != -1)
 		close(conn->fd);
 	free(conn->in.buf);
+	free(conn->out.buf);
+	free(conn->unpacked.buf);
 	memset(conn, 0, sizeof(*conn));  /* paranoia: catch bugs */
 	free(conn);
 }
@@ -184,32 +196,112 @@ static int write_bytes(struct wire_conn *conn,
 	return STATUS_OK;
 }
 
-int wire_conn_write(struct wire_conn *conn,
-		    enum wire_op_t op,
-		    const void *buf, int buf_len)
+/* Make room for at least the given number of bytes in the buffer. */
+static void reserve_bytes(struct wire_conn_buffer *buffer, int bytes)
+{
+	if (buffer->buf_space >= bytes)
+		return;
+	buffer->buf_space = max(2 * bytes, READ_CHUNK_BYTES);
+	buffer->buf = realloc(buffer->buf, buffer->buf_space);
+	if (buffer->buf == NULL)
+		die("out of memory for wire conn buffer\n");
+}
+
+/* Append bytes to the buffer. */
+static void append_bytes(struct wire_conn_buffer *buffer,
+			 const void *data, int len)
+{
+	reserve_bytes(buffer, buffer->used + len);
+	memcpy(buffer->buf + buffer->used, data, len);
+	buffer->used += len;
+}
+
+/* Queue the message compressed, returning STATUS_ERR (with nothing
+ * queued) if that would not make it smaller.
+ */
+static int queue_compressed(struct wire_conn *conn, enum wire_op_t op,
+			    const void *buf, int buf_len)
+{
+#ifdef HAVE_ZLIB
+	struct wire_header header;
+	struct wire_compressed compressed;
+	const int prefix = sizeof(header) + sizeof(compressed);
+	uLongf zbytes = compressBound(buf_len);
+
+	reserve_bytes(&conn->out, conn->out.used + prefix + zbytes);
+	if (compress2((Bytef *)conn->out.buf + conn->out.used + prefix,
+		      &zbytes, buf, buf_len, Z_BEST_SPEED) != Z_OK ||
+	    sizeof(compressed) + zbytes >= buf_len)
+		return STATUS_ERR;
+
+	header.length	= htonl(prefix + zbytes);
+	header.op	= htonl(op | WIRE_OP_COMPRESSED);
+	compressed.length = htonl(buf_len);
+	memcpy(conn->out.buf + conn->out.used, &header, sizeof(header));
+	memcpy(conn->out.buf + conn->out.used + sizeof(header),
+	       &compressed, sizeof(compressed));
+	conn->out.used += prefix + zbytes;
+	return STATUS_OK;
+#else
+	return STATUS_ERR;
+#endif
+}
+
+void wire_conn_queue(struct wire_conn *conn,
+		     enum wire_op_t op,
+		     const void *buf, int buf_len)
 {
-	DEBUGP("wire_conn_write -> op: %s\n",
+	DEBUGP("wire_conn_queue -> op: %s\n",
 	       wire_op_to_string(op));
 	struct wire_header header;
 
+	if (conn->compress && buf_len >= MIN_COMPRESS_BYTES &&
+	    queue_compressed(conn, op, buf, buf_len) == STATUS_OK)
+		return;
+
 	header.length	= htonl(sizeof(header) + buf_len);
 	header.op	= htonl(op);
 
-	if (write_bytes(conn, &header, sizeof(header)))
-		return STATUS_ERR;
+	append_bytes(&conn->out, &header, sizeof(header));
+	append_bytes(&conn->out, buf, buf_len);
+}
 
-	if (write_bytes(conn, buf, buf_len))
-		return STATUS_ERR;
+int wire_conn_flush(struct wire_conn *conn)
+{
+	int result = write_bytes(conn, conn->out.buf, conn->out.used);
 
-	return STATUS_OK;
+	conn->out.used = 0;
+	return result;
+}
+
+int wire_conn_write(struct wire_conn *conn,
+		    enum wire_op_t op,
+		    const void *buf, int buf_len)
+{
+	wire_conn_queue(conn, op, buf, buf_len);
+	return wire_conn_flush(conn);
 }
 
-/* Do blocking reads until we've read the given number of bytes. */
-static int read_bytes(struct wire_conn *conn,
-		      void *buf, int buf_len)
+/* Do blocking reads until at least the given number of bytes past
+ * in_start are in the input buffer, reading as much as has arrived.
+ * This may move the buffered bytes.
+ */
+static int read_bytes(struct wire_conn *conn, int buf_len)
 {
-	while (buf_len > 0) {
-		int bytes_read = read(conn->fd, buf, buf_len);
+	struct wire_conn_buffer *in = &conn->in;
+
+	if (in->used - conn->in_start >= buf_len)
+		return STATUS_OK;
+
+	/* Slide what we have not consumed yet to the start. */
+	memmove(in->buf, in->buf + conn->in_start, in->used - conn->in_start);
+	in->used -= conn->in_start;
+	conn->in_start = 0;
+	reserve_bytes(in, buf_len);
+
+	while (in->used < buf_len) {
+		int bytes_read = read(conn->fd, in->buf + in->used,
+				      in->buf_space - in->used);
 		if (bytes_read < 0) {
 			if (errno == EINTR || errno == EAGAIN) {
 				continue;
@@ -221,11 +313,50 @@ static int read_bytes(struct wire_conn *conn,
 			fprintf(stderr, "remote side closed connection\n");
 			return STATUS_ERR;
 		}
-		assert(bytes_read <= buf_len);
-		buf_len -= bytes_read;
-		buf += bytes_read;
+		in->used += bytes_read;
+	}
+	return STATUS_OK;
+}
+
+/* Uncompress a message body into conn->unpacked. */
+static int uncompress_message(struct wire_conn *conn,
+			      void **buf, int *buf_len)
+{
+#ifdef HAVE_ZLIB
+	struct wire_compressed compressed;
+	uLongf bytes = 0;
+
+	if (*buf_len < sizeof(compressed)) {
+		fprintf(stderr, "short compressed message from remote "
+			"wire conn\n");
+		return STATUS_ERR;
 	}
+	memcpy(&compressed, *buf, sizeof(compressed));
+	bytes = ntohl(compressed.length);
+	if (bytes > MAX_MESSAGE_BYTES) {
+		fprintf(stderr, "invalid uncompressed length %lu from remote "
+			"wire conn\n", (unsigned long)bytes);
+		return STATUS_ERR;
+	}
+
+	reserve_bytes(&conn->unpacked, bytes);
+	if (uncompress((Bytef *)conn->unpacked.buf, &bytes,
+		       (Bytef *)*buf + sizeof(compressed),
+		       *buf_len - sizeof(compressed)) != Z_OK ||
+	    bytes != ntohl(compressed.length)) {
+		fprintf(stderr, "bad compressed message from remote "
+			"wire conn\n");
+		return STATUS_ERR;
+	}
+	conn->unpacked.used = bytes;
+	*buf = conn->unpacked.buf;
+	*buf_len = bytes;
 	return STATUS_OK;
+#else
+	fprintf(stderr, "compressed message from remote wire conn, "
+		"but no zlib here\n");
+	return STATUS_ERR;
+#endif
 }
 
 int wire_conn_read(struct wire_conn *conn,
@@ -235,11 +366,14 @@ int wire_conn_read(struct wire_conn *conn,
 	DEBUGP("wire_conn_read\n");
 
 	struct wire_header header;
+	u32 raw_op;
 
-	if (read_bytes(conn, &header, sizeof(header)))
+	if (read_bytes(conn, sizeof(header)))
 		return STATUS_ERR;
+	memcpy(&header, conn->in.buf + conn->in_start, sizeof(header));
 
-	*op = ntohl(header.op);
+	raw_op = ntohl(header.op);
+	*op = raw_op & ~WIRE_OP_COMPRESSED;
 
 	DEBUGP("wire_conn_read -> op: %s\n", wire_op_to_string(*op));
 
@@ -250,16 +384,33 @@ int wire_conn_read(struct wire_conn *conn,
 		return STATUS_ERR;
 	}
 
-	if (conn->in.buf_space < *buf_len) {
-		free(conn->in.buf);
-		conn->in.buf_space = 2 * *buf_len;
-		conn->in.buf = malloc(conn->in.buf_space);
-	}
+	if (read_bytes(conn, sizeof(header) + *buf_len))
+		return STATUS_ERR;
 
-	*buf = conn->in.buf;
+	*buf = conn->in.buf + conn->in_start + sizeof(header);
+	conn->in_start += sizeof(header) + *buf_len;
 
-	if (read_bytes(conn, *buf, *buf_len))
-		return STATUS_ERR;
+	if (raw_op & WIRE_OP_COMPRESSED)
+		return uncompress_message(conn, buf, buf_len);
 
 	return STATUS_OK;
 }
+
+bool wire_conn_readable(struct wire_conn *conn)
+{
+	struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+	int result;
+
+	/* We may have read the start of the next message already. */
+	if (conn->in.used > conn->in_start)
+		return true;
+
+	do {
+		result = poll(&pfd, 1, 0);
+	} while (result < 0 && errno == EINTR);
+	if (result < 0)
+		die_perror("poll");
+
+	/* Let wire_conn_read() report any error or hangup. */
+	return result > 0;
+}
@@ -42,7 +42,15 @@ struct wire_conn_buffer {
  */
 struct wire_conn {
 	int fd;				/* socket for TCP connection (or -1) */
-	struct wire_conn_buffer in;	/* data read in last wire_conn_read() */
+	struct wire_conn_buffer in;	/* data read from the socket */
+	int in_start;			/* where the next message in "in" is */
+	struct wire_conn_buffer out;	/* messages queued for writing */
+	struct wire_conn_buffer unpacked;	/* last compressed message read,
+						 * uncompressed
+						 */
+	bool compress;			/* compress the bigger messages we
+					 * write?
+					 */
 };
 
 /* Create a wire_conn. Note that a struct wire_conn shouldn't be
@@ -65,20 +73,40 @@ void wire_conn_bind_listen(struct wire_conn *listen_conn, u16 port);
 void wire_conn_accept(struct wire_conn *listen_conn,
 		      struct wire_conn **accepted_conn);
 
-/* Blocking write of a single message. */
+/* Blocking write of a single message, along with any messages queued
+ * before it, with one system call.
+ */
 int wire_conn_write(struct wire_conn *conn,
 		    enum wire_op_t op,
 		    const void *buf, int buf_len);
 
+/* Queue a message, to go out with the next wire_conn_write() or
+ * wire_conn_flush(). This is for messages the other side does not need
+ * to see until a later message.
+ */
+void wire_conn_queue(struct wire_conn *conn,
+		     enum wire_op_t op,
+		     const void *buf, int buf_len);
+
+/* Blocking write of all queued messages. */
+int wire_conn_flush(struct wire_conn *conn);
+
 /* Blocking read of a single message. Changes *buf to point to the
  * wire_conn_buffer of this connection, which is guaranteed to be big
  * enough to hold the whole *buf_len bytes returned. The wire_conn
  * owns this memory, not the caller. The returned buffer can be
  * invalidated (freed or re-written) by the next call to
- * wire_conn_read().
+ * wire_conn_read(). We read as much as has arrived, so several small
+ * messages take one system call; compressed messages come back
+ * uncompressed.
  */
 int wire_conn_read(struct wire_conn *conn,
 		   enum wire_op_t *op,
 		   void **buf, int *buf_len);
 
+/* Return true if wire_conn_read() would find at least the start of a
+ * message (or an error) without waiting.
+ */
+bool wire_conn_readable(struct wire_conn *conn);
+
 #endif /* __WIRE_CONN_H__ */
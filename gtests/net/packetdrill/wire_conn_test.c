@@ -0,0 +1,148 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for wire_conn.c: queued, buffered and compressed messages.
+ */
+
+#include "wire_conn.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Make two connected wire_conns. */
+static void make_conns(struct wire_conn **a, struct wire_conn **b)
+{
+	int fds[2];
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	*a = wire_conn_new();
+	(*a)->fd = fds[0];
+	*b = wire_conn_new();
+	(*b)->fd = fds[1];
+}
+
+/* Read a message and check it is the given one. */
+static void expect_message(struct wire_conn *conn, enum wire_op_t op,
+			   const void *data, int len)
+{
+	enum wire_op_t got_op = WIRE_INVALID;
+	void *buf = NULL;
+	int buf_len = -1;
+
+	assert(wire_conn_read(conn, &got_op, &buf, &buf_len) == STATUS_OK);
+	assert(got_op == op);
+	assert(buf_len == len);
+	assert(memcmp(buf, data, len) == 0);
+}
+
+/* Queued messages go out only with the next write, and the reader
+ * picks them all up, in order, from what it read at once.
+ */
+static void test_queue(void)
+{
+	struct wire_conn *a = NULL, *b = NULL;
+
+	make_conns(&a, &b);
+	wire_conn_queue(a, WIRE_PACKETS_WARN, "one", 3);
+	wire_conn_queue(a, WIRE_PACKETS_WARN, "", 0);
+	assert(!wire_conn_readable(b));
+	assert(wire_conn_write(a, WIRE_PACKETS_DONE, "two", 3) == STATUS_OK);
+
+	assert(wire_conn_readable(b));
+	expect_message(b, WIRE_PACKETS_WARN, "one", 3);
+	assert(b->in.used > b->in_start);	/* the rest is buffered */
+	close(a->fd);				/* ...so we need no more */
+	a->fd = -1;
+	assert(wire_conn_readable(b));
+	expect_message(b, WIRE_PACKETS_WARN, "", 0);
+	expect_message(b, WIRE_PACKETS_DONE, "two", 3);
+	wire_conn_free(a);
+	wire_conn_free(b);
+}
+
+/* Messages bigger than the read buffer, and ones split across it. */
+static void test_big(void)
+{
+	struct wire_conn *a = NULL, *b = NULL;
+	const int len = 300 * 1000;
+	char *big = malloc(len);
+	int i;
+
+	for (i = 0; i < len; ++i)
+		big[i] = random();
+	make_conns(&a, &b);
+	if (fork() == 0) {
+		/* More than the socket buffer, so write from a child. */
+		for (i = 0; i < 3; ++i) {
+			wire_conn_queue(a, WIRE_SCRIPT, big, len - i);
+			wire_conn_queue(a, WIRE_SCRIPT_PATH, "x", 1);
+		}
+		assert(wire_conn_flush(a) == STATUS_OK);
+		exit(0);
+	}
+	for (i = 0; i < 3; ++i) {
+		expect_message(b, WIRE_SCRIPT, big, len - i);
+		expect_message(b, WIRE_SCRIPT_PATH, "x", 1);
+	}
+	assert(wait(NULL) > 0);
+	wire_conn_free(a);
+	wire_conn_free(b);
+	free(big);
+}
+
+/* With compression on, big messages shrink on the wire, and come back
+ * whole; small ones and ones that do not compress go as they are.
+ */
+static void test_compress(void)
+{
+	struct wire_conn *a = NULL, *b = NULL;
+	char text[4096], noise[1024];
+	int i;
+
+	for (i = 0; i < sizeof(text); ++i)
+		text[i] = "0.100 < . 1:1(0) ack 1 win 257\n"[i % 32];
+	for (i = 0; i < sizeof(noise); ++i)
+		noise[i] = random();
+
+	make_conns(&a, &b);
+	a->compress = true;
+	wire_conn_queue(a, WIRE_SCRIPT, text, sizeof(text));
+#ifdef HAVE_ZLIB
+	assert(a->out.used < sizeof(text) / 4);
+#endif
+	wire_conn_queue(a, WIRE_SCRIPT, noise, sizeof(noise));
+	wire_conn_queue(a, WIRE_SCRIPT_PATH, "a.pkt", 5);
+	assert(wire_conn_flush(a) == STATUS_OK);
+
+	expect_message(b, WIRE_SCRIPT, text, sizeof(text));
+	expect_message(b, WIRE_SCRIPT, noise, sizeof(noise));
+	expect_message(b, WIRE_SCRIPT_PATH, "a.pkt", 5);
+	wire_conn_free(a);
+	wire_conn_free(b);
+}
+
+int main(void)
+{
+	test_queue();
+	test_big();
+	test_compress();
+	return 0;
+}
@@ -41,6 +41,12 @@ const char *wire_op_to_string(enum wire_op_t op)
 	case WIRE_PACKETS_START:	return "WIRE_PACKETS_START";
 	case WIRE_PACKETS_WARN:		return "WIRE_PACKETS_WARN";
 	case WIRE_PACKETS_DONE:		return "WIRE_PACKETS_DONE";
+	case WIRE_SCRIPT_RESULT:	return "WIRE_SCRIPT_RESULT";
+	case WIRE_PACKETS_AHEAD:	return "WIRE_PACKETS_AHEAD";
+	case WIRE_CLOCK_PROBE:		return "WIRE_CLOCK_PROBE";
+	case WIRE_CLOCK_REPLY:		return "WIRE_CLOCK_REPLY";
+	case WIRE_PARSED_SCRIPT:	return "WIRE_PARSED_SCRIPT";
+	case WIRE_TIMING_REPORT:	return "WIRE_TIMING_REPORT";
 	case WIRE_NUM_OPS:		return "WIRE_NUM_OPS";
 	/* We omit the default case so compiler catches missing values. */
 	}
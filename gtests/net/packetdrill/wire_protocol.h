@@ -39,6 +39,12 @@ enum wire_op_t {
 	WIRE_PACKETS_START,	/* "please start handling packet events" */
 	WIRE_PACKETS_WARN,	/* "here's a warning about fishy packets" */
 	WIRE_PACKETS_DONE,	/* "i'm done handling packet events" */
+	WIRE_SCRIPT_RESULT,	/* "here's how the script you sent went" */
+	WIRE_PACKETS_AHEAD,	/* "packet events coming; don't wait for me" */
+	WIRE_CLOCK_PROBE,	/* "what time is it on your clock?" */
+	WIRE_CLOCK_REPLY,	/* "here's the time on my clock" */
+	WIRE_PARSED_SCRIPT,	/* "here's that script, already parsed" */
+	WIRE_TIMING_REPORT,	/* "here's its --timing_report record" */
 	WIRE_NUM_OPS,
 };
 
@@ -51,9 +57,68 @@ struct wire_header {
 	__be32 op;	/* enum wire_op_t (network order) */
 };
 
+/* With --wire_compress, bigger messages go out compressed with zlib:
+ * the op has this bit set, and the body is a wire_compressed header and
+ * then the zlib stream.
+ */
+#define WIRE_OP_COMPRESSED	0x80000000U
+
+struct wire_compressed {
+	__be32 length;	/* bytes in uncompressed body (network order) */
+};
+
+/* Messages carry 64-bit values as pairs of 32-bit halves. */
+static inline void wire_u64_to_net(u64 value, __be32 *hi, __be32 *lo)
+{
+	*hi = htonl(value >> 32);
+	*lo = htonl(value & 0xffffffff);
+}
+
+static inline u64 wire_u64_from_net(__be32 hi, __be32 lo)
+{
+	return ((u64)ntohl(hi) << 32) | ntohl(lo);
+}
+
+/* With --wire_clock_sync, the server asks for the client's time a few
+ * times before the script starts, NTP-style (see clock_sync.h). The
+ * server sends the probe with t1 set, and the client sends it back as
+ * the reply with t2 and t3 set.
+ */
+struct wire_clock_probe {
+	__be32 t1_usecs_hi, t1_usecs_lo;	/* server sent probe */
+	__be32 t2_usecs_hi, t2_usecs_lo;	/* client received probe */
+	__be32 t3_usecs_hi, t3_usecs_lo;	/* client sent reply */
+};
+
+/* With --wire_clock_sync, the client says when it starts the script,
+ * by its clock, in its WIRE_CLIENT_STARTING message.
+ */
+struct wire_client_starting {
+	__be32 live_start_usecs_hi;		/* start of script... */
+	__be32 live_start_usecs_lo;		/* ...on client clock */
+};
+
 /* A client request for the server to execute some packet events. */
 struct wire_packets_start {
 	__be32 num_events;	/* total events executed (network order) */
+	__be32 send_usecs_hi;	/* client time of sending... */
+	__be32 send_usecs_lo;	/* ...for clock drift measurement */
+};
+
+/* With --wire_pipeline, the client does not wait for the server to
+ * finish a run of packet events before moving on, and announces each
+ * run with this instead of a wire_packets_start. The client's live
+ * time offset (since it started the script) when it reached the run
+ * gives the server the base for relative event times, so the server
+ * need not wait for this message at all if the run starts at an
+ * absolute time.
+ */
+struct wire_packets_ahead {
+	__be32 num_events;		/* total events executed so far */
+	__be32 live_offset_usecs_hi;	/* upper 32 bits of offset */
+	__be32 live_offset_usecs_lo;	/* lower 32 bits of offset */
+	__be32 send_usecs_hi;		/* client time of sending... */
+	__be32 send_usecs_lo;		/* ...for clock drift measurement */
 };
 
 /* The server is done executing some packet events. */
@@ -63,4 +128,10 @@ struct wire_packets_done {
 	char error_message[0];	/* '\0'-teriminated error message, or empty */
 };
 
+/* The daemon is done running a script sent by a daemon client. */
+struct wire_script_result {
+	__be32 result;		/* STATUS_OK or STATUS_ERR (network order) */
+	char output[0];		/* stdout and stderr of the script run */
+};
+
 #endif /* __WIRE_PROTOCOL_H__ */
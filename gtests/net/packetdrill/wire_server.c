@@ -28,9 +28,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "clock_sync.h"
 #include "link_layer.h"
 #include "logging.h"
 #include "run.h"
+#include "script_cache.h"
 #include "wire_conn.h"
 #include "wire_server.h"
 #include "wire_server_netdev.h"
@@ -49,24 +51,44 @@ struct wire_server {
 
 	char *script_path;			/* path of script (on cli!) */
 	char *script_buffer;			/* contents of script */
+	void *parsed_script;			/* client's parse, or NULL */
+	int parsed_script_len;			/* bytes in parsed_script */
 
 	char *wire_server_device;		/* name of our eth interface */
 	struct ether_addr client_ether_addr;	/* wire client hardware addr */
 	struct ether_addr server_ether_addr;	/* wire server hardware addr */
+	struct wire_server_demux *demux;	/* shared sniffer, or NULL */
+	int xdp_queue;				/* AF_XDP rx queue, or -1 */
 
 	enum event_t last_event_type;	/* type of previous event */
 	int num_events;				/* events executed so far */
+
+	/* For --wire_pipeline: */
+	int num_ahead_unread;	/* WIRE_PACKETS_AHEAD messages left to read */
+	int num_events_ahead;	/* num_events of last WIRE_PACKETS_AHEAD */
+	s64 relative_base_usecs;	/* live time relative times count from,
+					 * or 0 for now
+					 */
+
+	/* For --wire_clock_sync: */
+	struct clock_sync clock_sync;		/* client clock vs ours */
+	s64 client_live_start_usecs;		/* script start, client clock */
 };
 
 static struct wire_server *wire_server_new(struct wire_conn *accepted_conn,
 					   const char *wire_server_device,
-					   u16 wire_server_port)
+					   u16 wire_server_port,
+					   struct wire_server_demux *demux,
+					   int xdp_queue)
 {
 	struct wire_server *wire_server = calloc(1, sizeof(struct wire_server));
 	wire_server->wire_conn = accepted_conn;
+	wire_server->demux = demux;
+	wire_server->xdp_queue = xdp_queue;
 	wire_server->wire_server_device = strdup(wire_server_device);
 	get_hw_address(wire_server_device, &wire_server->server_ether_addr);
 	wire_server->port = wire_server_port;
+	wire_server->num_events_ahead = -1;
 	return wire_server;
 }
 
@@ -75,6 +97,7 @@ static void wire_server_free(struct wire_server *wire_server)
 	wire_conn_free(wire_server->wire_conn);
 	free(wire_server->script_path);
 	free(wire_server->script_buffer);
+	free(wire_server->parsed_script);
 	free(wire_server->wire_server_device);
 	memset(wire_server, 0, sizeof(*wire_server));  /* catch bugs */
 	free(wire_server);
@@ -179,6 +202,52 @@ static int wire_server_receive_script(struct wire_server *wire_server)
 	return STATUS_OK;
 }
 
+/* Receive the client's parse of the script, if it sent one. */
+static int wire_server_receive_parsed_script(struct wire_server *wire_server)
+{
+	enum wire_op_t op = WIRE_INVALID;
+	void *buf = NULL;
+	int buf_len = -1;
+
+	if (wire_conn_read(wire_server->wire_conn, &op, &buf, &buf_len))
+		return STATUS_ERR;
+	if (op != WIRE_PARSED_SCRIPT) {
+		fprintf(stderr,
+			"bad wire client: expected WIRE_PARSED_SCRIPT\n");
+		return STATUS_ERR;
+	}
+
+	if (buf_len > 0) {
+		wire_server->parsed_script = malloc(buf_len);
+		memcpy(wire_server->parsed_script, buf, buf_len);
+		wire_server->parsed_script_len = buf_len;
+	}
+
+	return STATUS_OK;
+}
+
+/* Set up our config and the script, from the client's parse if it fits
+ * (it was made for this script and these command line arguments, by a
+ * packetdrill like us), or else by parsing the script ourselves.
+ */
+static int wire_server_set_up_script(struct wire_server *wire_server)
+{
+	struct script text;
+	u8 key[SHA1_DIGEST_BYTES];
+
+	/* The client's arguments are all but the --wire_server we add. */
+	init_script(&text);
+	text.buffer = wire_server->script_buffer;
+	text.length = strlen(wire_server->script_buffer);
+	script_cache_key(&text, wire_server->argc - 1, wire_server->argv,
+			 key);
+
+	return parse_script_image_and_set_config(
+		wire_server->argc, wire_server->argv, &wire_server->config,
+		&wire_server->script, wire_server->script_path,
+		wire_server->script_buffer, wire_server->parsed_script,
+		wire_server->parsed_script_len, key);
+}
 
 /* Receive the ethernet address to which the server should send packets. */
 static int wire_server_receive_hw_address(struct wire_server *wire_server)
@@ -217,12 +286,93 @@ static int wire_server_send_server_ready(struct wire_server *wire_server)
 	return STATUS_OK;
 }
 
+/* With --wire_clock_sync, probe the client's clock this many times
+ * before the script starts.
+ */
+#define CLOCK_SYNC_PROBES	16
+
+/* Estimate the client's clock offset with a few round-trip probes. */
+static int wire_server_sync_clocks(struct wire_server *wire_server)
+{
+	struct clock_sync *sync = &wire_server->clock_sync;
+	struct wire_clock_probe probe;
+	enum wire_op_t op = WIRE_INVALID;
+	void *buf = NULL;
+	int buf_len = -1;
+	int i;
+
+	clock_sync_init(sync);
+	for (i = 0; i < CLOCK_SYNC_PROBES; i++) {
+		s64 t4;
+
+		memset(&probe, 0, sizeof(probe));
+		wire_u64_to_net(now_usecs(), &probe.t1_usecs_hi,
+				&probe.t1_usecs_lo);
+		if (wire_conn_write(wire_server->wire_conn, WIRE_CLOCK_PROBE,
+				    &probe, sizeof(probe))) {
+			fprintf(stderr, "error sending WIRE_CLOCK_PROBE\n");
+			return STATUS_ERR;
+		}
+		if (wire_conn_read(wire_server->wire_conn,
+				   &op, &buf, &buf_len))
+			return STATUS_ERR;
+		t4 = now_usecs();
+		if (op != WIRE_CLOCK_REPLY) {
+			fprintf(stderr,
+				"bad wire client: expected WIRE_CLOCK_REPLY\n");
+			return STATUS_ERR;
+		}
+		if (buf_len != sizeof(probe)) {
+			fprintf(stderr, "bad wire client: "
+				"bad WIRE_CLOCK_REPLY length\n");
+			return STATUS_ERR;
+		}
+		memcpy(&probe, buf, sizeof(probe));
+		clock_sync_add_probe(sync,
+				     wire_u64_from_net(probe.t1_usecs_hi,
+						       probe.t1_usecs_lo),
+				     wire_u64_from_net(probe.t2_usecs_hi,
+						       probe.t2_usecs_lo),
+				     wire_u64_from_net(probe.t3_usecs_hi,
+						       probe.t3_usecs_lo),
+				     t4);
+	}
+
+	if (wire_server->config.verbose) {
+		printf("wire clock sync: client clock is %lld usecs ahead, "
+		       "round trip %lld usecs\n",
+		       sync->offset_usecs, sync->min_delay_usecs);
+	}
+	return STATUS_OK;
+}
+
+/* With --wire_clock_sync, sharpen our drift estimate with the time at
+ * which the client sent a message we just received, and move the start
+ * of the script on our clock to match.
+ */
+static void wire_server_track_clock(struct wire_server *wire_server,
+				    __be32 send_usecs_hi,
+				    __be32 send_usecs_lo)
+{
+	struct clock_sync *sync = &wire_server->clock_sync;
+	struct state *state = wire_server->state;
+
+	if (!wire_server->config.wire_clock_sync)
+		return;
+	clock_sync_add_one_way(sync,
+			       wire_u64_from_net(send_usecs_hi, send_usecs_lo),
+			       now_usecs());
+	state->live_start_time_usecs = clock_sync_remote_to_local(
+		sync, wire_server->client_live_start_usecs);
+}
+
 /* Wait for the client to say it's starting script execution. */
 static int wire_server_receive_client_starting(struct wire_server *wire_server)
 {
 	enum wire_op_t op = WIRE_INVALID;
 	void *buf = NULL;
 	int buf_len = -1;
+	struct wire_client_starting starting;
 
 	if (wire_conn_read(wire_server->wire_conn, &op, &buf, &buf_len))
 		return STATUS_ERR;
@@ -231,11 +381,18 @@ static int wire_server_receive_client_starting(struct wire_server *wire_server)
 			"bad wire client: expected WIRE_CLIENT_STARTING\n");
 		return STATUS_ERR;
 	}
-	if (buf_len != 0) {
+	if (buf_len != (wire_server->config.wire_clock_sync ?
+			sizeof(starting) : 0)) {
 		fprintf(stderr,
 			"bad wire client: bad WIRE_CLIENT_STARTING length\n");
 		return STATUS_ERR;
 	}
+	if (wire_server->config.wire_clock_sync) {
+		memcpy(&starting, buf, sizeof(starting));
+		wire_server->client_live_start_usecs =
+			wire_u64_from_net(starting.live_start_usecs_hi,
+					  starting.live_start_usecs_lo);
+	}
 
 	return STATUS_OK;
 }
@@ -262,6 +419,8 @@ static int wire_server_receive_packets_start(struct wire_server *wire_server)
 	}
 
 	memcpy(&start, buf, sizeof(start));
+	wire_server_track_clock(wire_server, start.send_usecs_hi,
+				start.send_usecs_lo);
 	if (ntohl(start.num_events) != wire_server->num_events) {
 		fprintf(stderr,
 			"bad client event count; expected %d but got %d",
@@ -272,15 +431,100 @@ static int wire_server_receive_packets_start(struct wire_server *wire_server)
 	return STATUS_OK;
 }
 
-/* Send back to the client a human-readable warning about a fishy packet. */
-static int wire_server_send_packet_warning(struct wire_server *wire_server,
-					   const char *warning)
+/* With --wire_pipeline, read the next WIRE_PACKETS_AHEAD message. */
+static int wire_server_receive_packets_ahead(struct wire_server *wire_server,
+					     struct wire_packets_ahead *ahead)
+{
+	enum wire_op_t op = WIRE_INVALID;
+	void *buf = NULL;
+	int buf_len = -1;
+	int num_events = 0;
+
+	assert(wire_server->num_ahead_unread > 0);
+	if (wire_conn_read(wire_server->wire_conn, &op, &buf, &buf_len))
+		return STATUS_ERR;
+	if (op != WIRE_PACKETS_AHEAD) {
+		fprintf(stderr,
+			"bad wire client: expected WIRE_PACKETS_AHEAD\n");
+		return STATUS_ERR;
+	}
+	if (buf_len != sizeof(*ahead)) {
+		fprintf(stderr,
+			"bad wire client: bad WIRE_PACKETS_AHEAD length\n");
+		return STATUS_ERR;
+	}
+
+	memcpy(ahead, buf, sizeof(*ahead));
+	wire_server_track_clock(wire_server, ahead->send_usecs_hi,
+				ahead->send_usecs_lo);
+	num_events = ntohl(ahead->num_events);
+	if (num_events <= wire_server->num_events_ahead ||
+	    num_events > wire_server->num_events) {
+		fprintf(stderr,
+			"bad client event count; expected at most %d but "
+			"got %d", wire_server->num_events, num_events);
+		return STATUS_ERR;
+	}
+	wire_server->num_events_ahead = num_events;
+	--wire_server->num_ahead_unread;
+
+	return STATUS_OK;
+}
+
+/* With --wire_pipeline, start a run of packet events. The client does
+ * not wait for us, so the run's times are as the script says; only if
+ * it starts at a relative time do we need the client's notice of when
+ * it reached the run. Otherwise we read notices only as they arrive,
+ * so the client never blocks sending them.
+ */
+static int wire_server_start_packets_ahead(struct wire_server *wire_server,
+					   struct event *event)
 {
-	if (wire_conn_write(wire_server->wire_conn, WIRE_PACKETS_WARN,
-			    warning, strlen(warning))) {
-		fprintf(stderr, "error sending WIRE_PACKETS_WARN\n");
+	struct wire_packets_ahead ahead;
+	u64 offset_usecs = 0;
+
+	++wire_server->num_ahead_unread;
+
+	if (event->time_type == ABSOLUTE_TIME ||
+	    event->time_type == ABSOLUTE_RANGE_TIME) {
+		while (wire_server->num_ahead_unread > 0 &&
+		       wire_conn_readable(wire_server->wire_conn)) {
+			if (wire_server_receive_packets_ahead(wire_server,
+							      &ahead))
+				return STATUS_ERR;
+		}
+		return STATUS_OK;
+	}
+
+	while (wire_server->num_ahead_unread > 0) {
+		if (wire_server_receive_packets_ahead(wire_server, &ahead))
+			return STATUS_ERR;
+	}
+	if (wire_server->num_events_ahead != wire_server->num_events) {
+		fprintf(stderr,
+			"bad client event count; expected %d but got %d",
+			wire_server->num_events,
+			wire_server->num_events_ahead);
 		return STATUS_ERR;
 	}
+
+	offset_usecs = wire_u64_from_net(ahead.live_offset_usecs_hi,
+					 ahead.live_offset_usecs_lo);
+	wire_server->relative_base_usecs =
+		wire_server->state->live_start_time_usecs + offset_usecs;
+	return STATUS_OK;
+}
+
+/* Send back to the client a human-readable warning about a fishy packet.
+ * The client only looks for warnings while it waits for the end of the
+ * run of packet events, so the warning goes along with the
+ * WIRE_PACKETS_DONE message that ends the run.
+ */
+static int wire_server_send_packet_warning(struct wire_server *wire_server,
+					   const char *warning)
+{
+	wire_conn_queue(wire_server->wire_conn, WIRE_PACKETS_WARN,
+			warning, strlen(warning));
 	return STATUS_OK;
 }
 
@@ -316,8 +560,13 @@ static int wire_server_next_event(struct wire_server *wire_server,
 	/* Wait for the client's request to start executing packet events. */
 	if (event && (event->type == PACKET_EVENT) &&
 	    (wire_server->last_event_type != PACKET_EVENT)) {
-		if (wire_server_receive_packets_start(wire_server))
+		if (wire_server->config.wire_pipeline) {
+			if (wire_server_start_packets_ahead(wire_server,
+							    event))
+				return STATUS_ERR;
+		} else if (wire_server_receive_packets_start(wire_server)) {
 			return STATUS_ERR;
+		}
 	}
 
 	/* Send the result from server execution of packet events. */
@@ -380,9 +629,21 @@ static int wire_server_run_script(struct wire_server *wire_server,
 
 	DEBUGP("wire_server_run_script\n");
 
-	state->live_start_time_usecs = now_usecs();
+	/* Without clock sync, the client started when its message came. */
+	if (wire_server->config.wire_clock_sync) {
+		state->live_start_time_usecs =
+			clock_sync_remote_to_local(
+				&wire_server->clock_sync,
+				wire_server->client_live_start_usecs);
+	} else {
+		state->live_start_time_usecs = now_usecs();
+	}
 	DEBUGP("live_start_time_usecs is %lld\n",
 	       state->live_start_time_usecs);
+	if (state->tcp_info_log != NULL)
+		tcp_info_log_start(state->tcp_info_log,
+				   state->live_start_time_usecs,
+				   state->script_start_time_usecs);
 
 	while (1) {
 		if (get_next_event(state, error))
@@ -395,9 +656,16 @@ static int wire_server_run_script(struct wire_server *wire_server,
 			return STATUS_ERR;
 
 		/* We adjust relative times after getting notification
-		 * that previous client-side events have completed.
+		 * that previous client-side events have completed. With
+		 * --wire_pipeline the notification says when that was.
 		 */
-		adjust_relative_event_times(state, event);
+		if (wire_server->relative_base_usecs != 0) {
+			adjust_relative_event_times_from(
+				state, event, wire_server->relative_base_usecs);
+			wire_server->relative_base_usecs = 0;
+		} else {
+			adjust_relative_event_times(state, event);
+		}
 
 		switch (event->type) {
 		case PACKET_EVENT:
@@ -415,6 +683,22 @@ static int wire_server_run_script(struct wire_server *wire_server,
 		case CODE_EVENT:
 			DEBUGP("CODE_EVENT happens on client side...\n");
 			break;
+		case METER_EVENT:
+			DEBUGP("wire clients refuse METER_EVENT...\n");
+			break;
+		case MP_JOIN_STORM_EVENT:
+			DEBUGP("wire clients refuse MP_JOIN_STORM_EVENT...\n");
+			break;
+		case PEER_EVENT:
+			DEBUGP("wire clients refuse PEER_EVENT...\n");
+			break;
+		case SYN_FLOOD_EVENT:
+			DEBUGP("wire clients refuse SYN_FLOOD_EVENT...\n");
+			break;
+		case INTERLEAVE_EVENT:
+			DEBUGP("wire clients refuse INTERLEAVE_EVENT...\n");
+			break;
+		case REPEAT_EVENT:	/* get_next_event() steps into these */
 		case INVALID_EVENT:
 		case NUM_EVENT_TYPES:
 			assert(!"bogus type");
@@ -426,6 +710,24 @@ static int wire_server_run_script(struct wire_server *wire_server,
 	/* Tell the client about any outstanding packet events it requested. */
 	wire_server_next_event(wire_server, NULL);
 
+	/* Read the notices we did not need, so that closing the
+	 * connection with them unread does not reset it before the
+	 * client reads our last WIRE_PACKETS_DONE.
+	 */
+	while (wire_server->num_ahead_unread > 0) {
+		struct wire_packets_ahead ahead;
+
+		if (wire_server_receive_packets_ahead(wire_server, &ahead))
+			return STATUS_ERR;
+	}
+
+	if (wire_server->config.wire_clock_sync &&
+	    wire_server->config.verbose) {
+		printf("wire clock sync: client clock drift %.1f ppm over "
+		       "%d samples\n", wire_server->clock_sync.drift * 1e6,
+		       wire_server->clock_sync.num_one_way);
+	}
+
 	DEBUGP("wire_server_run_script: done running\n");
 
 	return STATUS_OK;
@@ -451,30 +753,39 @@ static void *wire_server_thread(void *arg)
 	if (wire_server_receive_script(wire_server))
 		goto error_done;
 
+	if (wire_server_receive_parsed_script(wire_server))
+		goto error_done;
+
 	if (wire_server_receive_hw_address(wire_server))
 		goto error_done;
 
-	if (parse_script_and_set_config(wire_server->argc,
-						wire_server->argv,
-						&wire_server->config,
-						&wire_server->script,
-						wire_server->script_path,
-						wire_server->script_buffer))
+	if (wire_server_set_up_script(wire_server))
 		goto error_done;
+	wire_server->wire_conn->compress = wire_server->config.wire_compress;
 
 	set_scheduling_priority();
-	lock_memory();
+	lock_memory(&wire_server->config);
+	set_timer_slack(&wire_server->config);
 
 	netdev =
 	  wire_server_netdev_new(&wire_server->config,
 				 wire_server->wire_server_device,
 				 &wire_server->client_ether_addr,
-				 &wire_server->server_ether_addr);
+				 &wire_server->server_ether_addr,
+				 wire_server->demux, wire_server->xdp_queue,
+				 &error);
+	if (netdev == NULL)
+		goto error_done;
+	set_cpu_affinity(wire_server->wire_server_device);
 
 	wire_server->state = state_new(&wire_server->config,
 					       &wire_server->script,
 					       netdev);
 
+	if (wire_server->config.wire_clock_sync &&
+	    wire_server_sync_clocks(wire_server))
+		goto error_done;
+
 	if (wire_server_send_server_ready(wire_server))
 		goto error_done;
 
@@ -492,8 +803,10 @@ error_done:
 
 	if (wire_server->state != NULL)
 		state_free(wire_server->state);
+	free_script(&wire_server->script);
 
 	DEBUGP("wire_server_thread: connection is done\n");
+	wire_conn_flush(wire_server->wire_conn);	/* any last warnings */
 	wire_server_free(wire_server);
 	return NULL;
 }
@@ -512,9 +825,20 @@ static void start_wire_server_thread(struct wire_server *wire_server)
 void run_wire_server(const struct config *config)
 {
 	struct wire_conn *listen_conn = NULL;
+	struct wire_server_demux *demux = NULL;
 
 	wire_server_netdev_init(config->wire_server_device);
 
+	/* With a shared sniffer, all our clients' sessions read their
+	 * packets from one packet socket, instead of one socket each.
+	 */
+	if (config->wire_server_shared_sniffer &&
+	    config->wire_server_xdp_queue >= 0)
+		die("--wire_server_shared_sniffer and --wire_server_xdp_queue "
+		    "are mutually exclusive\n");
+	if (config->wire_server_shared_sniffer)
+		demux = wire_server_demux_new(config->wire_server_device);
+
 	listen_conn = wire_conn_new();
 
 	wire_conn_bind_listen(listen_conn, config->wire_server_port);
@@ -526,7 +850,8 @@ void run_wire_server(const struct config *config)
 		struct wire_server *wire_server =
 			wire_server_new(accepted_conn,
 					config->wire_server_device,
-					config->wire_server_port);
+					config->wire_server_port,
+					demux, config->wire_server_xdp_queue);
 
 		start_wire_server_thread(wire_server);
 	}
@@ -0,0 +1,305 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of sharing one packet socket among the sessions of a
+ * wire server.
+ */
+
+#include "wire_server_demux.h"
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+#include "packet_parser.h"
+
+/* Most frames we queue for a session that is not reading them. */
+#define SESSION_MAX_QUEUED	4096
+
+/* A frame the sniffer thread queued for a session. */
+struct queued_frame {
+	struct packet *packet;		/* right-sized copy of the frame */
+	int frame_bytes;		/* bytes of frame in packet */
+	struct queued_frame *next;	/* next frame in queue, or NULL */
+};
+
+struct wire_server_session {
+	struct wire_server_demux *demux;	/* demux we belong to */
+	struct ether_addr client_ether_addr;	/* client's frames... */
+	struct ip_address client_ip;		/* ...and packets */
+
+	struct queued_frame *head;	/* oldest queued frame, or NULL */
+	struct queued_frame *tail;	/* newest queued frame, or NULL */
+	int num_queued;			/* number of queued frames */
+	u64 num_dropped;		/* frames dropped as queue was full */
+	pthread_cond_t ready;		/* signaled when a frame is queued */
+
+	struct wire_server_session *next;	/* next session of demux */
+};
+
+struct wire_server_demux {
+	struct packet_socket *psock;	/* shared socket (owned) */
+	pthread_t thread;		/* sniffer thread */
+
+	pthread_mutex_t mutex;		/* for everything below */
+	struct wire_server_session *sessions;	/* all sessions */
+	u64 num_unclaimed;		/* frames no session wanted */
+};
+
+bool wire_server_frame_source(const u8 *frame, int frame_bytes,
+			      struct ether_addr *ether_addr,
+			      struct ip_address *ip)
+{
+	const struct ether_header *ether = (const struct ether_header *)frame;
+	const u8 *ip_header = frame + sizeof(*ether);
+	int ip_bytes = frame_bytes - sizeof(*ether);
+
+	if (frame_bytes < sizeof(*ether))
+		return false;
+	ether_copy(ether_addr, ether->ether_shost);
+
+	memset(ip, 0, sizeof(*ip));
+	switch (ntohs(ether->ether_type)) {
+	case ETHERTYPE_IP:
+		if (ip_bytes < 20)
+			return false;
+		ip->address_family = AF_INET;
+		memcpy(&ip->ip.v4, ip_header + 12, sizeof(ip->ip.v4));
+		return true;
+	case ETHERTYPE_IPV6:
+		if (ip_bytes < 40)
+			return false;
+		ip->address_family = AF_INET6;
+		memcpy(&ip->ip.v6, ip_header + 8, sizeof(ip->ip.v6));
+		return true;
+	}
+	return false;
+}
+
+/* Return the session for frames from the given addresses, or NULL. */
+static struct wire_server_session *find_session(
+	struct wire_server_demux *demux,
+	const struct ether_addr *ether_addr, const struct ip_address *ip)
+{
+	struct wire_server_session *session;
+
+	for (session = demux->sessions; session != NULL;
+	     session = session->next) {
+		if (memcmp(&session->client_ether_addr, ether_addr,
+			   sizeof(*ether_addr)) == 0 &&
+		    is_equal_ip(&session->client_ip, ip))
+			return session;
+	}
+	return NULL;
+}
+
+/* Queue a copy of the sniffed frame for the session that wants it. */
+static void demux_frame(struct wire_server_demux *demux,
+			const struct packet *sniffed, int frame_bytes)
+{
+	struct wire_server_session *session = NULL;
+	struct queued_frame *queued = NULL;
+	struct ether_addr ether_addr;
+	struct ip_address ip;
+
+	if (!wire_server_frame_source(sniffed->buffer, frame_bytes,
+				      &ether_addr, &ip)) {
+		demux->num_unclaimed++;
+		return;
+	}
+
+	pthread_mutex_lock(&demux->mutex);
+	session = find_session(demux, &ether_addr, &ip);
+	if (session == NULL) {
+		demux->num_unclaimed++;
+	} else if (session->num_queued == SESSION_MAX_QUEUED) {
+		session->num_dropped++;
+	} else {
+		queued = calloc(1, sizeof(struct queued_frame));
+		queued->packet = packet_new(frame_bytes);
+		memcpy(queued->packet->buffer, sniffed->buffer, frame_bytes);
+		queued->packet->time_usecs = sniffed->time_usecs;
+		queued->packet->time_nsecs = sniffed->time_nsecs;
+		queued->frame_bytes = frame_bytes;
+		if (session->tail != NULL)
+			session->tail->next = queued;
+		else
+			session->head = queued;
+		session->tail = queued;
+		session->num_queued++;
+		pthread_cond_signal(&session->ready);
+	}
+	pthread_mutex_unlock(&demux->mutex);
+}
+
+/* The sniffer thread spends its life reading frames from the shared
+ * socket and handing them out to sessions.
+ */
+static void *demux_thread(void *arg)
+{
+	struct wire_server_demux *demux = arg;
+	struct packet *sniffed = packet_new(PACKET_READ_BYTES);
+
+	while (1) {
+		int frame_bytes = 0;
+
+		if (packet_socket_receive(demux->psock, DIRECTION_INBOUND,
+					  sniffed, &frame_bytes))
+			continue;
+		demux_frame(demux, sniffed, frame_bytes);
+	}
+	return NULL;
+}
+
+struct wire_server_demux *wire_server_demux_new(const char *device)
+{
+	struct wire_server_demux *demux =
+		calloc(1, sizeof(struct wire_server_demux));
+
+	demux->psock = packet_socket_new(device, false);
+	if (pthread_mutex_init(&demux->mutex, NULL) != 0)
+		die_perror("pthread_mutex_init");
+	if (pthread_create(&demux->thread, NULL, demux_thread, demux) != 0)
+		die_perror("pthread_create");
+	return demux;
+}
+
+void wire_server_demux_free(struct wire_server_demux *demux)
+{
+	assert(demux->sessions == NULL);
+
+	/* The thread spends its life blocked in the packet socket, so
+	 * cancel it there rather than asking it to stop.
+	 */
+	if (pthread_cancel(demux->thread) != 0)
+		die_perror("pthread_cancel");
+	if (pthread_join(demux->thread, NULL) != 0)
+		die_perror("pthread_join");
+
+	DEBUGP("wire server demux: %llu frames unclaimed\n",
+	       demux->num_unclaimed);
+	packet_socket_free(demux->psock);
+	pthread_mutex_destroy(&demux->mutex);
+	memset(demux, 0, sizeof(*demux));  /* paranoia to help catch bugs */
+	free(demux);
+}
+
+struct packet_socket *wire_server_demux_socket(
+	struct wire_server_demux *demux)
+{
+	return demux->psock;
+}
+
+struct wire_server_session *wire_server_demux_add(
+	struct wire_server_demux *demux,
+	const struct ether_addr *client_ether_addr,
+	const struct ip_address *client_ip,
+	char **error)
+{
+	struct wire_server_session *session = NULL;
+	char ip_string[ADDR_STR_LEN];
+
+	pthread_mutex_lock(&demux->mutex);
+	if (find_session(demux, client_ether_addr, client_ip) != NULL) {
+		pthread_mutex_unlock(&demux->mutex);
+		asprintf(error, "a session for client %s is already running",
+			 ip_to_string(client_ip, ip_string));
+		return NULL;
+	}
+
+	session = calloc(1, sizeof(struct wire_server_session));
+	session->demux = demux;
+	ether_copy(&session->client_ether_addr, client_ether_addr);
+	session->client_ip = *client_ip;
+	if (pthread_cond_init(&session->ready, NULL) != 0)
+		die_perror("pthread_cond_init");
+	session->next = demux->sessions;
+	demux->sessions = session;
+	pthread_mutex_unlock(&demux->mutex);
+	return session;
+}
+
+void wire_server_demux_remove(struct wire_server_demux *demux,
+			      struct wire_server_session *session)
+{
+	struct wire_server_session **link = NULL;
+	struct queued_frame *queued = NULL, *next = NULL;
+
+	pthread_mutex_lock(&demux->mutex);
+	for (link = &demux->sessions; *link != session;
+	     link = &(*link)->next)
+		assert(*link != NULL);
+	*link = session->next;
+	pthread_mutex_unlock(&demux->mutex);
+
+	if (session->num_dropped > 0)
+		fprintf(stderr, "wire server: dropped %llu frames for "
+			"a session that was not reading them\n",
+			session->num_dropped);
+	for (queued = session->head; queued != NULL; queued = next) {
+		next = queued->next;
+		packet_free(queued->packet);
+		free(queued);
+	}
+	pthread_cond_destroy(&session->ready);
+	memset(session, 0, sizeof(*session));  /* paranoia */
+	free(session);
+}
+
+int wire_server_session_receive(struct wire_server_session *session,
+				struct packet **packet, char **error)
+{
+	struct wire_server_demux *demux = session->demux;
+
+	assert(*packet == NULL);	/* should be no packet yet */
+	while (1) {
+		struct queued_frame *queued = NULL;
+		enum packet_parse_result_t result;
+		int frame_bytes;
+
+		pthread_mutex_lock(&demux->mutex);
+		while (session->head == NULL)
+			pthread_cond_wait(&session->ready, &demux->mutex);
+		queued = session->head;
+		session->head = queued->next;
+		if (session->head == NULL)
+			session->tail = NULL;
+		session->num_queued--;
+		pthread_mutex_unlock(&demux->mutex);
+
+		*packet = queued->packet;
+		frame_bytes = queued->frame_bytes;
+		free(queued);
+
+		result = parse_packet(*packet, frame_bytes,
+				      PACKET_LAYER_2_ETHERNET, error);
+		if (result == PACKET_OK)
+			return STATUS_OK;
+
+		packet_free(*packet);
+		*packet = NULL;
+
+		if (result == PACKET_BAD)
+			return STATUS_ERR;
+
+		DEBUGP("parse_result:%d; error parsing packet: %s\n",
+		       result, *error);
+	}
+}
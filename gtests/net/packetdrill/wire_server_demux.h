@@ -0,0 +1,90 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for sharing one packet socket among the sessions of a
+ * wire server.
+ *
+ * By default each wire client gets its own packet socket, with its
+ * own receive ring and a BPF filter for that client's traffic. With
+ * --wire_server_shared_sniffer, one sniffer thread reads every frame
+ * on the server's device from a single packet socket, and hands each
+ * frame to the session whose client sent it, keyed by the client's
+ * Ethernet address (from WIRE_HARDWARE_ADDR) and IP address. Each
+ * session's interpreter thread then reads its frames from its own
+ * queue.
+ */
+
+#ifndef __WIRE_SERVER_DEMUX_H__
+#define __WIRE_SERVER_DEMUX_H__
+
+#include "types.h"
+
+#include "ethernet.h"
+#include "ip_address.h"
+#include "packet.h"
+#include "packet_socket.h"
+
+struct wire_server_demux;
+struct wire_server_session;
+
+/* Open a packet socket on the given device and start the thread
+ * sniffing it.
+ */
+extern struct wire_server_demux *wire_server_demux_new(const char *device);
+
+/* Stop the sniffer thread and free the demux. There must be no
+ * sessions left.
+ */
+extern void wire_server_demux_free(struct wire_server_demux *demux);
+
+/* Return the shared packet socket, for sending packets. */
+extern struct packet_socket *wire_server_demux_socket(
+	struct wire_server_demux *demux);
+
+/* Start queueing frames from the given client for a new session.
+ * Returns NULL and sets error message if another session already has
+ * this client.
+ */
+extern struct wire_server_session *wire_server_demux_add(
+	struct wire_server_demux *demux,
+	const struct ether_addr *client_ether_addr,
+	const struct ip_address *client_ip,
+	char **error);
+
+/* Stop queueing frames for the session and free it, with any frames
+ * it has not read.
+ */
+extern void wire_server_demux_remove(struct wire_server_demux *demux,
+				     struct wire_server_session *session);
+
+/* Block until the session has a frame, then parse it as
+ * netdev_receive_loop() does. The packet is not from a pool; the
+ * caller must free it with packet_free().
+ */
+extern int wire_server_session_receive(struct wire_server_session *session,
+				       struct packet **packet, char **error);
+
+/* Find the source Ethernet and IP addresses of the given Ethernet
+ * frame. Returns false if it is too short or not IPv4 or IPv6.
+ */
+extern bool wire_server_frame_source(const u8 *frame, int frame_bytes,
+				     struct ether_addr *ether_addr,
+				     struct ip_address *ip);
+
+#endif /* __WIRE_SERVER_DEMUX_H__ */
@@ -0,0 +1,100 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for wire_server_demux.c: finding whose frame a sniffed frame is.
+ */
+
+#include "wire_server_demux.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <string.h>
+
+static const u8 client_mac[ETH_ALEN] = { 0x02, 0, 0, 0, 0, 0x11 };
+static const u8 server_mac[ETH_ALEN] = { 0x02, 0, 0, 0, 0, 0x22 };
+
+/* Fill in an Ethernet header of the given type from the client. */
+static void make_frame(u8 *frame, u16 ether_type)
+{
+	struct ether_header *ether = (struct ether_header *)frame;
+
+	memcpy(ether->ether_dhost, server_mac, ETH_ALEN);
+	memcpy(ether->ether_shost, client_mac, ETH_ALEN);
+	ether->ether_type = htons(ether_type);
+}
+
+static void test_ipv4(void)
+{
+	u8 frame[sizeof(struct ether_header) + 20];
+	struct ether_addr ether_addr;
+	struct ip_address ip, expected = ipv4_parse("192.168.0.1");
+
+	memset(frame, 0, sizeof(frame));
+	make_frame(frame, ETHERTYPE_IP);
+	memcpy(frame + sizeof(struct ether_header) + 12, &expected.ip.v4,
+	       sizeof(expected.ip.v4));
+
+	assert(wire_server_frame_source(frame, sizeof(frame),
+					&ether_addr, &ip));
+	assert(memcmp(&ether_addr, client_mac, ETH_ALEN) == 0);
+	assert(is_equal_ip(&ip, &expected));
+
+	/* A truncated IP header tells us nothing. */
+	assert(!wire_server_frame_source(frame, sizeof(frame) - 1,
+					 &ether_addr, &ip));
+}
+
+static void test_ipv6(void)
+{
+	u8 frame[sizeof(struct ether_header) + 40];
+	struct ether_addr ether_addr;
+	struct ip_address ip, expected = ipv6_parse("fd3d:fa7b:d17d::1");
+
+	memset(frame, 0, sizeof(frame));
+	make_frame(frame, ETHERTYPE_IPV6);
+	memcpy(frame + sizeof(struct ether_header) + 8, &expected.ip.v6,
+	       sizeof(expected.ip.v6));
+
+	assert(wire_server_frame_source(frame, sizeof(frame),
+					&ether_addr, &ip));
+	assert(memcmp(&ether_addr, client_mac, ETH_ALEN) == 0);
+	assert(is_equal_ip(&ip, &expected));
+}
+
+static void test_other(void)
+{
+	u8 frame[64];
+	struct ether_addr ether_addr;
+	struct ip_address ip;
+
+	/* ARP frames belong to no session. */
+	memset(frame, 0, sizeof(frame));
+	make_frame(frame, 0x0806);	/* ETHERTYPE_ARP */
+	assert(!wire_server_frame_source(frame, sizeof(frame),
+					 &ether_addr, &ip));
+
+	/* Nor do runt frames. */
+	assert(!wire_server_frame_source(frame, 4, &ether_addr, &ip));
+}
+
+int main(void)
+{
+	test_ipv4();
+	test_ipv6();
+	test_other();
+	return 0;
+}
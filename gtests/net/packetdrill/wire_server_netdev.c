@@ -35,6 +35,7 @@
 #include "packet.h"
 #include "packet_socket.h"
 #include "packet_parser.h"
+#include "xdp_socket.h"
 
 struct wire_server_netdev {
 	struct netdev netdev;		/* "inherit" from netdev */
@@ -46,6 +47,13 @@ struct wire_server_netdev {
 	struct ether_addr server_ether_addr;
 
 	struct packet_socket *psock;	/* for sniffing packets (owned) */
+
+	struct wire_server_demux *demux;	/* shared socket, or NULL */
+	struct wire_server_session *session;	/* our frames from demux */
+
+	struct xdp_socket *xsk;		/* AF_XDP socket, or NULL (owned) */
+
+	bool tx_timestamps;		/* psock hands back send times? */
 };
 
 struct netdev_ops wire_server_netdev_ops;
@@ -104,10 +112,30 @@ struct netdev *wire_server_netdev_new(
 	struct config *config,
 	const char *wire_server_device,
 	const struct ether_addr *client_ether_addr,
-	const struct ether_addr *server_ether_addr)
+	const struct ether_addr *server_ether_addr,
+	struct wire_server_demux *demux,
+	int xdp_queue,
+	char **error)
 {
+	struct wire_server_session *session = NULL;
+	struct xdp_socket *xsk = NULL;
+
 	DEBUGP("wire_server_netdev_new\n");
 
+	if (demux != NULL) {
+		session = wire_server_demux_add(demux, client_ether_addr,
+						&config->live_local_ip,
+						error);
+		if (session == NULL)
+			return NULL;
+	} else if (xdp_queue >= 0) {
+		xsk = xdp_socket_new(wire_server_device, xdp_queue,
+				     client_ether_addr, &config->live_local_ip,
+				     config->hugepages, error);
+		if (xsk == NULL)
+			return NULL;
+	}
+
 	struct wire_server_netdev *netdev =
 		calloc(1, sizeof(struct wire_server_netdev));
 
@@ -128,7 +156,36 @@ struct netdev *wire_server_netdev_new(
 			      &config->live_gateway_ip,
 			      config->live_prefix_len);
 
-	netdev->psock = packet_socket_new(netdev->name);
+	if (config->hw_timestamps && (demux != NULL || xsk != NULL))
+		fprintf(stderr, "warning: --hw_timestamps needs a packet "
+			"socket of our own; using kernel timestamps\n");
+
+	if (demux != NULL) {
+		/* The demux hands us only packets from our client. */
+		netdev->demux = demux;
+		netdev->session = session;
+		return (struct netdev *)netdev;
+	}
+
+	if (xsk != NULL) {
+		/* Our XDP program hands us only packets from our client. */
+		netdev->xsk = xsk;
+		return (struct netdev *)netdev;
+	}
+
+	netdev->psock = packet_socket_new(netdev->name, false);
+	if (config->hw_timestamps) {
+		char *hw_error = NULL;
+
+		if (packet_socket_enable_hw_timestamps(netdev->psock,
+						       &hw_error)) {
+			fprintf(stderr, "warning: --hw_timestamps: %s; "
+				"using kernel timestamps\n", hw_error);
+			free(hw_error);
+		} else {
+			netdev->tx_timestamps = true;
+		}
+	}
 
 	/* Make sure we only see packets from the machine under test. */
 	packet_socket_set_filter(netdev->psock,
@@ -151,6 +208,10 @@ static void wire_server_netdev_free(struct netdev *a_netdev)
 	free(netdev->name);
 	if (netdev->psock)
 		packet_socket_free(netdev->psock);
+	if (netdev->session)
+		wire_server_demux_remove(netdev->demux, netdev->session);
+	if (netdev->xsk)
+		xdp_socket_free(netdev->xsk);
 
 	memset(netdev, 0, sizeof(*netdev));  /* paranoia */
 	free(netdev);
@@ -178,13 +239,115 @@ static int wire_server_netdev_send(struct netdev *a_netdev,
 	ether_frame[1].iov_base	= packet_start(packet);
 	ether_frame[1].iov_len	= packet->ip_bytes;
 
-	result = packet_socket_writev(netdev->psock,
+	if (netdev->xsk != NULL)
+		return xdp_socket_writev_batch(netdev->xsk, ether_frame,
+					       ARRAY_SIZE(ether_frame), 1);
+
+	result = packet_socket_writev(netdev->demux ?
+				      wire_server_demux_socket(netdev->demux) :
+				      netdev->psock,
 				      ether_frame, ARRAY_SIZE(ether_frame));
 
+	/* With --hw_timestamps, note when the packet actually left. */
+	if (result == STATUS_OK && netdev->tx_timestamps) {
+		s64 nsecs = packet_socket_tx_timestamp_nsecs(netdev->psock);
+
+		if (nsecs != 0)
+			packet_set_time_nsecs(packet, nsecs);
+	}
+
 	return result;
 }
 
+/* Most packets of a train we queue in one packet socket batch. */
+#define WIRE_SERVER_BATCH_PACKETS	64
+
+/* Send a train of packets with one packet socket or AF_XDP batch. A
+ * shared sniffer's socket is shared with other sessions' threads, so
+ * there we send the train a packet at a time.
+ */
+static int wire_server_netdev_send_batch(struct netdev *a_netdev,
+					 struct packet **packets,
+					 int num_packets)
+{
+	struct wire_server_netdev *netdev = to_server_netdev(a_netdev);
+	struct ether_header ether[WIRE_SERVER_BATCH_PACKETS];
+	struct iovec ether_frames[WIRE_SERVER_BATCH_PACKETS][2];
+	int i, n;
+
+	DEBUGP("wire_server_netdev_send_batch: %d packets\n", num_packets);
+
+	/* The TX ring gives no TX timestamps, so with --hw_timestamps
+	 * we send one packet at a time too.
+	 */
+	if (netdev->demux != NULL || netdev->tx_timestamps) {
+		for (i = 0; i < num_packets; ++i) {
+			if (wire_server_netdev_send(a_netdev, packets[i]))
+				return STATUS_ERR;
+		}
+		return STATUS_OK;
+	}
+
+	while (num_packets > 0) {
+		n = min(num_packets, WIRE_SERVER_BATCH_PACKETS);
+		for (i = 0; i < n; ++i) {
+			struct packet *packet = packets[i];
+			int address_family = packet_address_family(packet);
+
+			ether_copy(ether[i].ether_dhost,
+				   &netdev->client_ether_addr);
+			ether_copy(ether[i].ether_shost,
+				   &netdev->server_ether_addr);
+			ether[i].ether_type =
+				htons(ether_type_for_family(address_family));
+			ether_frames[i][0].iov_base	= &ether[i];
+			ether_frames[i][0].iov_len	= sizeof(ether[i]);
+			ether_frames[i][1].iov_base	= packet_start(packet);
+			ether_frames[i][1].iov_len	= packet->ip_bytes;
+		}
+		if (netdev->xsk != NULL ?
+		    xdp_socket_writev_batch(netdev->xsk,
+					    &ether_frames[0][0], 2, n) :
+		    packet_socket_writev_batch(netdev->psock,
+					       &ether_frames[0][0], 2, n))
+			return STATUS_ERR;
+		packets += n;
+		num_packets -= n;
+	}
+	return STATUS_OK;
+}
+
+/* Sniff the next packet from our client with our AF_XDP socket. The
+ * packet's buffer is the frame in the socket's UMEM.
+ */
+static int xdp_receive(struct xdp_socket *xsk, struct packet **packet,
+		       char **error)
+{
+	while (1) {
+		int in_bytes = 0;
+		enum packet_parse_result_t result;
+
+		if (xdp_socket_receive(xsk, packet, &in_bytes))
+			return STATUS_ERR;
+
+		result = parse_packet(*packet, in_bytes,
+				      PACKET_LAYER_2_ETHERNET, error);
+		if (result == PACKET_OK)
+			return STATUS_OK;
+
+		packet_free(*packet);
+		*packet = NULL;
+
+		if (result == PACKET_BAD)
+			return STATUS_ERR;
+
+		DEBUGP("parse_result:%d; error parsing packet: %s\n",
+		       result, *error);
+	}
+}
+
 static int wire_server_netdev_receive(struct netdev *a_netdev,
+				      struct packet_pool *pool,
 				      struct packet **packet, char **error)
 {
 	struct wire_server_netdev *netdev = to_server_netdev(a_netdev);
@@ -192,7 +355,14 @@ static int wire_server_netdev_receive(struct netdev *a_netdev,
 
 	DEBUGP("wire_server_netdev_receive\n");
 
-	return netdev_receive_loop(netdev->psock, PACKET_LAYER_2_ETHERNET,
+	if (netdev->session != NULL)
+		return wire_server_session_receive(netdev->session, packet,
+						   error);
+	if (netdev->xsk != NULL)
+		return xdp_receive(netdev->xsk, packet, error);
+
+	return netdev_receive_loop(netdev->psock, pool,
+				   PACKET_LAYER_2_ETHERNET,
 				   DIRECTION_INBOUND, packet, &num_packets,
 				   error);
 }
@@ -200,5 +370,6 @@ static int wire_server_netdev_receive(struct netdev *a_netdev,
 struct netdev_ops wire_server_netdev_ops = {
 	.free = wire_server_netdev_free,
 	.send = wire_server_netdev_send,
+	.send_batch = wire_server_netdev_send_batch,
 	.receive = wire_server_netdev_receive,
 };
@@ -31,17 +31,25 @@
 #include "config.h"
 #include "ethernet.h"
 #include "netdev.h"
+#include "wire_server_demux.h"
 
 struct wire_server_netdev;
 
 /* Do any one-time start-up initialization a wire server netdev needs. */
 extern void wire_server_netdev_init(const char *netdev_name);
 
-/* Allocate and return a new wire server netdev. */
+/* Allocate and return a new wire server netdev. If demux is not NULL,
+ * share its packet socket instead of opening one of our own. If
+ * xdp_queue is not -1, sniff and inject with an AF_XDP socket on that
+ * receive queue instead. Returns NULL and sets error message on failure.
+ */
 extern struct netdev *wire_server_netdev_new(
 	struct config *config,
 	const char *wire_server_device,
 	const struct ether_addr *client_ether_addr,
-	const struct ether_addr *server_ether_addr);
+	const struct ether_addr *server_ether_addr,
+	struct wire_server_demux *demux,
+	int xdp_queue,
+	char **error);
 
 #endif /* __WIRE_SERVER_NETDEV_H__ */
@@ -0,0 +1,626 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * AF_XDP socket for wire servers; see xdp_socket.h.
+ */
+
+#include "xdp_socket.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_AF_XDP
+
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include "bpf_insn.h"
+#include "logging.h"
+#include "netlink.h"
+#include "time_source.h"
+
+#ifndef AF_XDP
+#define AF_XDP			44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP			283
+#endif
+
+/* Geometry of the UMEM: the first half of the frames is for receiving,
+ * lent to the kernel on the fill ring; the second half is for sending.
+ * Each ring can hold all the frames of its half.
+ */
+#define XDP_FRAME_BYTES		2048
+#define XDP_NUM_FRAMES		4096
+#define XDP_RING_SIZE		(XDP_NUM_FRAMES / 2)
+
+/* Most queues our XSKMAP covers; the socket's queue must be below. */
+#define XDP_MAX_QUEUES		64
+
+/* One of the four rings we share with the kernel. The producer and
+ * consumer indexes run freely; slots are at index & (size - 1).
+ */
+struct xdp_ring {
+	u32 *producer;		/* next slot producer will fill */
+	u32 *consumer;		/* next slot consumer will take */
+	u32 *flags;		/* XDP_RING_NEED_WAKEUP, if supported */
+	void *slots;		/* u64 addresses or struct xdp_desc */
+	void *map;		/* start of mmap-ed ring */
+	size_t map_bytes;	/* size of the mapping */
+};
+
+struct xdp_socket {
+	int fd;			/* AF_XDP socket */
+	int ifindex;		/* device we are on */
+	int queue;		/* receive queue we are bound to */
+	int map_fd;		/* XSKMAP from queues to sockets */
+	int prog_fd;		/* our XDP program */
+	bool attached;		/* is our program attached to the device? */
+
+	u8 *umem;		/* frames we share with the kernel */
+	struct hugepage_region umem_region;	/* mapping of umem */
+	struct xdp_ring fill;	/* frames we give the kernel to receive in */
+	struct xdp_ring completion;	/* frames the kernel has sent */
+	struct xdp_ring rx;	/* frames the kernel has received */
+	struct xdp_ring tx;	/* frames we want the kernel to send */
+
+	u64 tx_free[XDP_RING_SIZE];	/* send frames we may fill */
+	int num_tx_free;		/* number of entries in tx_free */
+	int num_lent;			/* received frames lent out */
+	bool closed;		/* freed, but for frames still lent out */
+};
+
+/* Return an immediate holding the given bytes as a load of them from
+ * the packet would, whatever our byte order.
+ */
+static s32 bytes_imm(const void *bytes, int len)
+{
+	u32 imm = 0;
+
+	if (len == 2) {
+		u16 half;
+
+		memcpy(&half, bytes, sizeof(half));
+		imm = half;
+	} else {
+		assert(len == 4);
+		memcpy(&imm, bytes, sizeof(imm));
+	}
+	return (s32)imm;
+}
+
+/* Most instructions in our program. */
+#define XDP_PROGRAM_MAX_INSNS	32
+
+struct bpf_insn *xdp_client_program(
+	int map_fd, const struct ether_addr *client_ether_addr,
+	const struct ip_address *client_ip, int *num_insns)
+{
+	struct bpf_insn *insns =
+		calloc(XDP_PROGRAM_MAX_INSNS, sizeof(struct bpf_insn));
+	const u8 *ether = client_ether_addr->ether_addr_octet;
+	bool ipv4 = (client_ip->address_family == AF_INET);
+	const int ether_bytes = sizeof(struct ether_header);
+	const int ip_src = ether_bytes + (ipv4 ? 12 : 8);
+	const int ip_words = ipv4 ? 1 : 4;
+	__be16 ether_type = htons(ipv4 ? ETHERTYPE_IP : ETHERTYPE_IPV6);
+	int n = 0, pass_jumps[XDP_PROGRAM_MAX_INSNS], num_pass_jumps = 0;
+	int i;
+
+	/* r6 = ctx; r2 = data; r3 = data_end */
+	insns[n++] = BPF_MOV64_REG(BPF_REG_6, BPF_REG_1);
+	insns[n++] = BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_1,
+				 offsetof(struct xdp_md, data));
+	insns[n++] = BPF_LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_1,
+				 offsetof(struct xdp_md, data_end));
+
+	/* Pass frames too short to hold the client's IP source. */
+	insns[n++] = BPF_MOV64_REG(BPF_REG_4, BPF_REG_2);
+	insns[n++] = BPF_ADD64_IMM(BPF_REG_4, ip_src + 4 * ip_words);
+	pass_jumps[num_pass_jumps++] = n;
+	insns[n++] = BPF_JGT_REG(BPF_REG_4, BPF_REG_3, 0);
+
+	/* Ethernet source and type, as in packet_socket_set_filter(). */
+	insns[n++] = BPF_LDX_MEM(BPF_W, BPF_REG_5, BPF_REG_2, 6);
+	pass_jumps[num_pass_jumps++] = n;
+	insns[n++] = BPF_JNE32_IMM(BPF_REG_5, bytes_imm(ether, 4), 0);
+	insns[n++] = BPF_LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, 10);
+	pass_jumps[num_pass_jumps++] = n;
+	insns[n++] = BPF_JNE32_IMM(BPF_REG_5, bytes_imm(ether + 4, 2), 0);
+	insns[n++] = BPF_LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, 12);
+	pass_jumps[num_pass_jumps++] = n;
+	insns[n++] = BPF_JNE32_IMM(BPF_REG_5, bytes_imm(&ether_type, 2), 0);
+
+	/* IP source address, a 32-bit word at a time. */
+	for (i = 0; i < ip_words; ++i) {
+		insns[n++] = BPF_LDX_MEM(BPF_W, BPF_REG_5, BPF_REG_2,
+					 ip_src + 4 * i);
+		pass_jumps[num_pass_jumps++] = n;
+		insns[n++] = BPF_JNE32_IMM(BPF_REG_5,
+					   bytes_imm(client_ip->ip.bytes +
+						     4 * i, 4), 0);
+	}
+
+	/* return bpf_redirect_map(map, ctx->rx_queue_index, XDP_PASS);
+	 * the flags are the action if the queue has no socket.
+	 */
+	insns[n++] = BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_6,
+				 offsetof(struct xdp_md, rx_queue_index));
+	insns[n++] = BPF_LD_MAP_FD(BPF_REG_1, map_fd);
+	insns[n++] = BPF_INSN(0, 0, 0, 0, 0);	/* upper half of imm64 */
+	insns[n++] = BPF_MOV64_IMM(BPF_REG_3, XDP_PASS);
+	insns[n++] = BPF_EMIT_CALL(BPF_FUNC_redirect_map);
+	insns[n++] = BPF_EXIT_INSN();
+
+	/* pass: return XDP_PASS; */
+	for (i = 0; i < num_pass_jumps; ++i)
+		insns[pass_jumps[i]].off = n - pass_jumps[i] - 1;
+	insns[n++] = BPF_MOV64_IMM(BPF_REG_0, XDP_PASS);
+	insns[n++] = BPF_EXIT_INSN();
+
+	assert(n <= XDP_PROGRAM_MAX_INSNS);
+	*num_insns = n;
+	return insns;
+}
+
+/* Create the XSKMAP and load the program that redirects to it. */
+static int load_program(struct xdp_socket *xsk,
+			const struct ether_addr *client_ether_addr,
+			const struct ip_address *client_ip, char **error)
+{
+	static char log[4096];
+	struct bpf_insn *insns = NULL;
+	union bpf_attr attr;
+	int num_insns = 0;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(u32);
+	attr.value_size = sizeof(u32);
+	attr.max_entries = XDP_MAX_QUEUES;
+	xsk->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (xsk->map_fd < 0) {
+		asprintf(error, "cannot create XSKMAP: %s", strerror(errno));
+		return STATUS_ERR;
+	}
+
+	insns = xdp_client_program(xsk->map_fd, client_ether_addr,
+				   client_ip, &num_insns);
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t)insns;
+	attr.insn_cnt = num_insns;
+	attr.license = (uintptr_t)"GPL";
+	attr.log_buf = (uintptr_t)log;
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+	log[0] = '\0';
+	xsk->prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	free(insns);
+	if (xsk->prog_fd < 0) {
+		asprintf(error, "cannot load XDP program: %s\n%s",
+			 strerror(errno), log);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* Map one of our rings, of the given entry size, at the given offset. */
+static int map_ring(struct xdp_socket *xsk, struct xdp_ring *ring,
+		    const struct xdp_ring_offset *offsets, size_t entry_bytes,
+		    off_t pgoff, char **error)
+{
+	u8 *map = NULL;
+
+	ring->map_bytes = offsets->desc + XDP_RING_SIZE * entry_bytes;
+	map = mmap(NULL, ring->map_bytes, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, xsk->fd, pgoff);
+	if (map == MAP_FAILED) {
+		asprintf(error, "cannot map AF_XDP ring: %s",
+			 strerror(errno));
+		return STATUS_ERR;
+	}
+	ring->map = map;
+	ring->producer = (u32 *)(map + offsets->producer);
+	ring->consumer = (u32 *)(map + offsets->consumer);
+	ring->flags = (u32 *)(map + offsets->flags);
+	ring->slots = map + offsets->desc;
+	return STATUS_OK;
+}
+
+/* Set up the UMEM and the four rings. */
+static int setup_rings(struct xdp_socket *xsk, enum hugepages_t hugepages,
+		       char **error)
+{
+	struct xdp_umem_reg reg;
+	struct xdp_mmap_offsets offsets;
+	socklen_t offsets_len = sizeof(offsets);
+	int ring_size = XDP_RING_SIZE;
+	u64 *fill = NULL;
+	int i;
+
+	/* The kernel pins the UMEM, and we touch a frame of it for every
+	 * packet, so it is worth putting on huge pages.
+	 */
+	if (hugepage_map(XDP_NUM_FRAMES * XDP_FRAME_BYTES, hugepages, true,
+			 &xsk->umem_region, error))
+		return STATUS_ERR;
+	xsk->umem = xsk->umem_region.start;
+	DEBUGP("AF_XDP UMEM on %s pages\n",
+	       hugepages_name(xsk->umem_region.backing));
+
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (uintptr_t)xsk->umem;
+	reg.len = XDP_NUM_FRAMES * XDP_FRAME_BYTES;
+	reg.chunk_size = XDP_FRAME_BYTES;
+	if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) ||
+	    setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING,
+		       &ring_size, sizeof(ring_size)) ||
+	    setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+		       &ring_size, sizeof(ring_size)) ||
+	    setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING,
+		       &ring_size, sizeof(ring_size)) ||
+	    setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING,
+		       &ring_size, sizeof(ring_size))) {
+		asprintf(error, "cannot set up AF_XDP rings: %s",
+			 strerror(errno));
+		return STATUS_ERR;
+	}
+	if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS,
+		       &offsets, &offsets_len)) {
+		asprintf(error, "cannot get AF_XDP ring offsets: %s",
+			 strerror(errno));
+		return STATUS_ERR;
+	}
+
+	if (map_ring(xsk, &xsk->fill, &offsets.fr, sizeof(u64),
+		     XDP_UMEM_PGOFF_FILL_RING, error) ||
+	    map_ring(xsk, &xsk->completion, &offsets.cr, sizeof(u64),
+		     XDP_UMEM_PGOFF_COMPLETION_RING, error) ||
+	    map_ring(xsk, &xsk->rx, &offsets.rx, sizeof(struct xdp_desc),
+		     XDP_PGOFF_RX_RING, error) ||
+	    map_ring(xsk, &xsk->tx, &offsets.tx, sizeof(struct xdp_desc),
+		     XDP_PGOFF_TX_RING, error))
+		return STATUS_ERR;
+
+	/* Lend the kernel the receive half of the frames. */
+	fill = xsk->fill.slots;
+	for (i = 0; i < XDP_RING_SIZE; ++i)
+		fill[i] = (u64)i * XDP_FRAME_BYTES;
+	__atomic_store_n(xsk->fill.producer, XDP_RING_SIZE, __ATOMIC_RELEASE);
+
+	/* Keep the send half. */
+	for (i = 0; i < XDP_RING_SIZE; ++i)
+		xsk->tx_free[i] = (u64)(XDP_RING_SIZE + i) * XDP_FRAME_BYTES;
+	xsk->num_tx_free = XDP_RING_SIZE;
+	return STATUS_OK;
+}
+
+/* Bind to the queue, zero-copy if the driver can, else copying. */
+static int bind_queue(struct xdp_socket *xsk, char **error)
+{
+	struct sockaddr_xdp sxdp;
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = xsk->ifindex;
+	sxdp.sxdp_queue_id = xsk->queue;
+	sxdp.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+	if (bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == 0)
+		return STATUS_OK;
+	DEBUGP("AF_XDP zero-copy bind failed: %s\n", strerror(errno));
+
+	sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+	if (bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == 0)
+		return STATUS_OK;
+
+	asprintf(error, "cannot bind AF_XDP socket to queue %d: %s",
+		 xsk->queue, strerror(errno));
+	return STATUS_ERR;
+}
+
+struct xdp_socket *xdp_socket_new(
+	const char *device_name, int queue,
+	const struct ether_addr *client_ether_addr,
+	const struct ip_address *client_ip,
+	enum hugepages_t hugepages, char **error)
+{
+	struct xdp_socket *xsk = calloc(1, sizeof(struct xdp_socket));
+	u32 key = queue;
+
+	xsk->fd = -1;
+	xsk->map_fd = -1;
+	xsk->prog_fd = -1;
+	xsk->queue = queue;
+
+	if (queue < 0 || queue >= XDP_MAX_QUEUES) {
+		asprintf(error, "AF_XDP queue %d is not in 0..%d",
+			 queue, XDP_MAX_QUEUES - 1);
+		goto error_out;
+	}
+	xsk->ifindex = if_nametoindex(device_name);
+	if (xsk->ifindex == 0) {
+		asprintf(error, "no device %s: %s", device_name,
+			 strerror(errno));
+		goto error_out;
+	}
+	xsk->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (xsk->fd < 0) {
+		asprintf(error, "cannot open AF_XDP socket: %s",
+			 strerror(errno));
+		goto error_out;
+	}
+	if (setup_rings(xsk, hugepages, error) ||
+	    bind_queue(xsk, error) ||
+	    load_program(xsk, client_ether_addr, client_ip, error))
+		goto error_out;
+
+	{
+		union bpf_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = xsk->map_fd;
+		attr.key = (uintptr_t)&key;
+		attr.value = (uintptr_t)&xsk->fd;
+		if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+			asprintf(error, "cannot add AF_XDP socket to XSKMAP: "
+				 "%s", strerror(errno));
+			goto error_out;
+		}
+	}
+
+	if (netlink_set_link_xdp(xsk->ifindex, xsk->prog_fd, error))
+		goto error_out;
+	xsk->attached = true;
+
+	return xsk;
+
+error_out:
+	xdp_socket_free(xsk);
+	return NULL;
+}
+
+/* Free the UMEM and ourselves, once no packet uses a frame of it. */
+static void xdp_socket_destroy(struct xdp_socket *xsk)
+{
+	hugepage_unmap(&xsk->umem_region);
+	memset(xsk, 0, sizeof(*xsk));	/* paranoia to catch bugs */
+	free(xsk);
+}
+
+void xdp_socket_free(struct xdp_socket *xsk)
+{
+	struct xdp_ring *rings[] = {
+		&xsk->fill, &xsk->completion, &xsk->rx, &xsk->tx
+	};
+	char *error = NULL;
+	int i;
+
+	if (xsk->attached &&
+	    netlink_set_link_xdp(xsk->ifindex, -1, &error)) {
+		fprintf(stderr, "cannot detach XDP program: %s\n", error);
+		free(error);
+	}
+	for (i = 0; i < ARRAY_SIZE(rings); ++i) {
+		if (rings[i]->map != NULL)
+			munmap(rings[i]->map, rings[i]->map_bytes);
+	}
+	if (xsk->fd >= 0)
+		close(xsk->fd);
+	if (xsk->prog_fd >= 0)
+		close(xsk->prog_fd);
+	if (xsk->map_fd >= 0)
+		close(xsk->map_fd);
+
+	/* Packets sniffed last may outlive the netdev; the last of them
+	 * to be freed frees the UMEM.
+	 */
+	xsk->closed = true;
+	if (xsk->num_lent == 0)
+		xdp_socket_destroy(xsk);
+}
+
+/* Take back the send frames the kernel is done with. */
+static void reap_completions(struct xdp_socket *xsk)
+{
+	u64 *slots = xsk->completion.slots;
+	u32 producer = __atomic_load_n(xsk->completion.producer,
+				       __ATOMIC_ACQUIRE);
+	u32 consumer = *xsk->completion.consumer;
+
+	while (consumer != producer) {
+		assert(xsk->num_tx_free < XDP_RING_SIZE);
+		xsk->tx_free[xsk->num_tx_free++] =
+			slots[consumer & (XDP_RING_SIZE - 1)];
+		++consumer;
+	}
+	__atomic_store_n(xsk->completion.consumer, consumer,
+			 __ATOMIC_RELEASE);
+}
+
+/* Tell the kernel to send what we put on the TX ring. */
+static int kick_tx(struct xdp_socket *xsk)
+{
+	if (sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+	    errno != EAGAIN && errno != EBUSY && errno != ENOBUFS &&
+	    errno != EINTR) {
+		perror("sendto AF_XDP socket");
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+int xdp_socket_writev_batch(struct xdp_socket *xsk,
+			    const struct iovec *iov, int iov_per_frame,
+			    int num_frames)
+{
+	struct xdp_desc *slots = xsk->tx.slots;
+	u32 producer = *xsk->tx.producer;
+	int i, j;
+
+	for (i = 0; i < num_frames; ++i) {
+		const struct iovec *frame_iov = iov + i * iov_per_frame;
+		struct xdp_desc *desc = NULL;
+		u32 frame_bytes = 0;
+		u8 *data = NULL;
+
+		for (j = 0; j < iov_per_frame; ++j)
+			frame_bytes += frame_iov[j].iov_len;
+		if (frame_bytes > XDP_FRAME_BYTES) {
+			fprintf(stderr, "AF_XDP: %u-byte frame is too big\n",
+				frame_bytes);
+			return STATUS_ERR;
+		}
+
+		/* Out of send frames: send what we have, and wait for
+		 * the kernel to hand some back.
+		 */
+		reap_completions(xsk);
+		while (xsk->num_tx_free == 0) {
+			__atomic_store_n(xsk->tx.producer, producer,
+					 __ATOMIC_RELEASE);
+			if (kick_tx(xsk))
+				return STATUS_ERR;
+			reap_completions(xsk);
+		}
+
+		desc = &slots[producer & (XDP_RING_SIZE - 1)];
+		desc->addr = xsk->tx_free[--xsk->num_tx_free];
+		desc->len = frame_bytes;
+		desc->options = 0;
+		data = xsk->umem + desc->addr;
+		for (j = 0; j < iov_per_frame; ++j) {
+			memcpy(data, frame_iov[j].iov_base,
+			       frame_iov[j].iov_len);
+			data += frame_iov[j].iov_len;
+		}
+		++producer;
+	}
+
+	__atomic_store_n(xsk->tx.producer, producer, __ATOMIC_RELEASE);
+	return kick_tx(xsk);
+}
+
+/* Give a received frame back to the kernel, when its packet is freed. */
+static void release_frame(struct packet *packet)
+{
+	struct xdp_socket *xsk = packet->release_arg;
+	u64 addr = (packet->buffer - xsk->umem) & ~(u64)(XDP_FRAME_BYTES - 1);
+	u64 *slots = NULL;
+	u32 producer = 0;
+
+	memset(packet, 0, sizeof(*packet));  /* paranoia to help catch bugs */
+	free(packet);
+
+	--xsk->num_lent;
+	if (xsk->closed) {
+		if (xsk->num_lent == 0)
+			xdp_socket_destroy(xsk);
+		return;
+	}
+
+	/* The fill ring holds every receive frame, so there is room. */
+	slots = xsk->fill.slots;
+	producer = *xsk->fill.producer;
+	slots[producer & (XDP_RING_SIZE - 1)] = addr;
+	__atomic_store_n(xsk->fill.producer, producer + 1, __ATOMIC_RELEASE);
+}
+
+int xdp_socket_receive(struct xdp_socket *xsk,
+		       struct packet **packet, int *in_bytes)
+{
+	struct xdp_desc *slots = xsk->rx.slots;
+	u32 consumer = *xsk->rx.consumer;
+	struct xdp_desc desc;
+
+	while (__atomic_load_n(xsk->rx.producer, __ATOMIC_ACQUIRE) ==
+	       consumer) {
+		struct pollfd pfd = { .fd = xsk->fd, .events = POLLIN };
+
+		/* Polling also wakes the driver to refill, if need be. */
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			perror("poll AF_XDP socket");
+			return STATUS_ERR;
+		}
+	}
+	desc = slots[consumer & (XDP_RING_SIZE - 1)];
+	__atomic_store_n(xsk->rx.consumer, consumer + 1, __ATOMIC_RELEASE);
+
+	*packet = calloc(1, sizeof(struct packet));
+	(*packet)->buffer = xsk->umem + desc.addr;
+	(*packet)->buffer_bytes = XDP_FRAME_BYTES -
+		(desc.addr & (XDP_FRAME_BYTES - 1));
+	/* AF_XDP gives us no kernel receive time stamp, so use ours. */
+	packet_set_time_nsecs(*packet, time_now_nsecs());
+	(*packet)->release = release_frame;
+	(*packet)->release_arg = xsk;
+	++xsk->num_lent;
+	*in_bytes = desc.len;
+	return STATUS_OK;
+}
+
+#else  /* !HAVE_AF_XDP */
+
+struct xdp_socket *xdp_socket_new(
+	const char *device_name, int queue,
+	const struct ether_addr *client_ether_addr,
+	const struct ip_address *client_ip,
+	enum hugepages_t hugepages, char **error)
+{
+	asprintf(error, "AF_XDP is not supported on this platform");
+	return NULL;
+}
+
+void xdp_socket_free(struct xdp_socket *xsk)
+{
+	assert(!"no AF_XDP sockets on this platform");
+}
+
+int xdp_socket_writev_batch(struct xdp_socket *xsk,
+			    const struct iovec *iov, int iov_per_frame,
+			    int num_frames)
+{
+	assert(!"no AF_XDP sockets on this platform");
+	return STATUS_ERR;
+}
+
+int xdp_socket_receive(struct xdp_socket *xsk,
+		       struct packet **packet, int *in_bytes)
+{
+	assert(!"no AF_XDP sockets on this platform");
+	return STATUS_ERR;
+}
+
+struct bpf_insn *xdp_client_program(
+	int map_fd, const struct ether_addr *client_ether_addr,
+	const struct ip_address *client_ip, int *num_insns)
+{
+	*num_insns = 0;
+	return NULL;
+}
+
+#endif  /* HAVE_AF_XDP */
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for sniffing and injecting frames with an AF_XDP socket,
+ * for wire servers on links too fast for the AF_PACKET socket.
+ *
+ * We load a small XDP program on the device that redirects the wire
+ * client's frames (the same match as packet_socket_set_filter()) to
+ * our socket, and passes all other traffic up the stack as usual. The
+ * socket is bound to a single receive queue, so the NIC must steer
+ * the client's traffic there (e.g. with "ethtool -L <dev> combined 1",
+ * or an ntuple rule). Sniffed packets are lent to the caller straight
+ * out of the UMEM, the memory the kernel and we share for frames; the
+ * frame goes back to the kernel when the packet is freed.
+ *
+ * This needs Linux 5.3 or newer and CAP_NET_ADMIN, and only one
+ * program per device, so one session at a time.
+ */
+
+#ifndef __XDP_SOCKET_H__
+#define __XDP_SOCKET_H__
+
+#include "types.h"
+
+#include <sys/uio.h>
+#include "ethernet.h"
+#include "hugepage.h"
+#include "ip_address.h"
+#include "packet.h"
+
+struct xdp_socket;
+
+/* Open an AF_XDP socket on the given receive queue of the given device,
+ * and attach an XDP program that hands it the frames from the client
+ * with the given Ethernet and IP addresses. The UMEM is mapped as the
+ * given --hugepages setting asks. Returns NULL and sets error message
+ * on failure.
+ */
+extern struct xdp_socket *xdp_socket_new(
+	const char *device_name, int queue,
+	const struct ether_addr *client_ether_addr,
+	const struct ip_address *client_ip,
+	enum hugepages_t hugepages, char **error);
+
+/* Detach the XDP program, close the socket and free it. All packets
+ * we lent out must have been freed.
+ */
+extern void xdp_socket_free(struct xdp_socket *xsk);
+
+/* Send a train of num_frames frames, each made of iov_per_frame
+ * consecutive entries of iov, with one system call. Return STATUS_OK
+ * on success, or STATUS_ERR on error.
+ */
+extern int xdp_socket_writev_batch(struct xdp_socket *xsk,
+				   const struct iovec *iov,
+				   int iov_per_frame, int num_frames);
+
+/* Do a blocking sniff of the next frame. On success, fill in *packet
+ * with a packet whose buffer is the frame in the UMEM, and set
+ * *in_bytes to the frame's length; the caller frees the packet with
+ * packet_free(). Return STATUS_ERR on error.
+ */
+extern int xdp_socket_receive(struct xdp_socket *xsk,
+			      struct packet **packet, int *in_bytes);
+
+/* Return the XDP program that redirects the given client's frames,
+ * filling in the fd of the XSKMAP that maps queues to sockets; for
+ * tests. The caller frees the returned instructions.
+ */
+struct bpf_insn;
+extern struct bpf_insn *xdp_client_program(
+	int map_fd, const struct ether_addr *client_ether_addr,
+	const struct ip_address *client_ip, int *num_insns);
+
+#endif /* __XDP_SOCKET_H__ */
@@ -0,0 +1,267 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for xdp_socket.c: the XDP program that picks out the client's
+ * frames, run on a little interpreter for the instructions it uses.
+ */
+
+#include "xdp_socket.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_AF_XDP
+
+#include <linux/bpf.h>
+#include <sys/syscall.h>
+
+static const u8 client_mac[ETH_ALEN] = { 0x02, 0, 0, 0x12, 0x34, 0x56 };
+static const u8 server_mac[ETH_ALEN] = { 0x02, 0, 0, 0, 0, 0x22 };
+
+/* What our interpreter returns for a call to bpf_redirect_map(). */
+#define REDIRECTED	100
+
+/* The context the program sees; like struct xdp_md, but with room for
+ * the 64-bit pointers an interpreter needs.
+ */
+struct test_ctx {
+	u8 *data;
+	u8 *data_end;
+};
+
+/* Run the program on the given frame: return the XDP action, or
+ * REDIRECTED if it calls bpf_redirect_map().
+ */
+static s64 run_program(const struct bpf_insn *insns, int num_insns,
+		       u8 *frame, int frame_bytes)
+{
+	struct test_ctx ctx = { frame, frame + frame_bytes };
+	u64 regs[MAX_BPF_REG];
+	int pc = 0;
+
+	memset(regs, 0, sizeof(regs));
+	regs[BPF_REG_1] = (uintptr_t)&ctx;
+	while (1) {
+		const struct bpf_insn *insn = &insns[pc++];
+		u64 *dst = &regs[insn->dst_reg];
+		u64 src = regs[insn->src_reg];
+		u8 *addr = (u8 *)(uintptr_t)src + insn->off;
+
+		assert(pc <= num_insns);
+		switch (insn->code) {
+		case BPF_ALU64 | BPF_MOV | BPF_X:
+			*dst = src;
+			break;
+		case BPF_ALU64 | BPF_MOV | BPF_K:
+			*dst = insn->imm;
+			break;
+		case BPF_ALU64 | BPF_ADD | BPF_K:
+			*dst += insn->imm;
+			break;
+		case BPF_LDX | BPF_MEM | BPF_W:
+			if (src == (uintptr_t)&ctx) {
+				/* Context loads: data, data_end, queue. */
+				if (insn->off == offsetof(struct xdp_md, data))
+					*dst = (uintptr_t)ctx.data;
+				else if (insn->off ==
+					 offsetof(struct xdp_md, data_end))
+					*dst = (uintptr_t)ctx.data_end;
+				else
+					*dst = 0;
+			} else {
+				u32 word;
+
+				assert(addr + 4 <= ctx.data_end);
+				memcpy(&word, addr, sizeof(word));
+				*dst = word;
+			}
+			break;
+		case BPF_LDX | BPF_MEM | BPF_H: {
+			u16 half;
+
+			assert(addr + 2 <= ctx.data_end);
+			memcpy(&half, addr, sizeof(half));
+			*dst = half;
+			break;
+		}
+		case BPF_LD | BPF_DW | BPF_IMM:
+			*dst = (u32)insn->imm;
+			++pc;
+			break;
+		case BPF_JMP | BPF_JGT | BPF_X:
+			if (*dst > src)
+				pc += insn->off;
+			break;
+		case BPF_JMP32 | BPF_JNE | BPF_K:
+			if ((u32)*dst != (u32)insn->imm)
+				pc += insn->off;
+			break;
+		case BPF_JMP | BPF_CALL:
+			assert(insn->imm == BPF_FUNC_redirect_map);
+			assert(regs[BPF_REG_3] == XDP_PASS);
+			regs[BPF_REG_0] = REDIRECTED;
+			break;
+		case BPF_JMP | BPF_EXIT:
+			return regs[BPF_REG_0];
+		default:
+			assert(!"unexpected instruction");
+		}
+	}
+}
+
+/* Fill in a frame from the given Ethernet source, of the given type. */
+static void make_frame(u8 *frame, const u8 *source_mac, u16 ether_type)
+{
+	struct ether_header *ether = (struct ether_header *)frame;
+
+	memcpy(ether->ether_dhost, server_mac, ETH_ALEN);
+	memcpy(ether->ether_shost, source_mac, ETH_ALEN);
+	ether->ether_type = htons(ether_type);
+}
+
+/* Check the kernel's verifier accepts the program, if we may load one. */
+static void verify_in_kernel(const struct ip_address *client_ip)
+{
+	static char log[65536];
+	struct bpf_insn *insns = NULL;
+	union bpf_attr attr;
+	int map_fd, prog_fd, num_insns = 0;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(u32);
+	attr.value_size = sizeof(u32);
+	attr.max_entries = 1;
+	map_fd = syscall(__NR_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+	if (map_fd < 0) {
+		printf("skipping verifier check: %s\n", strerror(errno));
+		return;
+	}
+
+	insns = xdp_client_program(map_fd, (struct ether_addr *)client_mac,
+				   client_ip, &num_insns);
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t)insns;
+	attr.insn_cnt = num_insns;
+	attr.license = (uintptr_t)"GPL";
+	attr.log_buf = (uintptr_t)log;
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+	prog_fd = syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+	if (prog_fd < 0 && errno != EPERM)
+		fprintf(stderr, "verifier: %s\n%s", strerror(errno), log);
+	assert(prog_fd >= 0 || errno == EPERM);
+	if (prog_fd >= 0)
+		close(prog_fd);
+	close(map_fd);
+	free(insns);
+}
+
+static void test_ipv4(void)
+{
+	const int ip_src = sizeof(struct ether_header) + 12;
+	u8 frame[sizeof(struct ether_header) + 20];
+	struct ip_address client_ip = ipv4_parse("192.168.0.1");
+	struct ip_address other_ip = ipv4_parse("192.168.0.2");
+	const u8 other_mac[ETH_ALEN] = { 0x02, 0, 0, 0x12, 0x34, 0x57 };
+	struct bpf_insn *insns = NULL;
+	int num_insns = 0;
+
+	insns = xdp_client_program(3, (struct ether_addr *)client_mac,
+				   &client_ip, &num_insns);
+	assert(insns[num_insns - 1].code == (BPF_JMP | BPF_EXIT));
+
+	memset(frame, 0, sizeof(frame));
+	make_frame(frame, client_mac, ETHERTYPE_IP);
+	memcpy(frame + ip_src, &client_ip.ip.v4, sizeof(client_ip.ip.v4));
+	assert(run_program(insns, num_insns, frame, sizeof(frame)) ==
+	       REDIRECTED);
+
+	/* Too short to hold the IP source address. */
+	assert(run_program(insns, num_insns, frame, ip_src + 3) == XDP_PASS);
+
+	/* From another host. */
+	memcpy(frame + ip_src, &other_ip.ip.v4, sizeof(other_ip.ip.v4));
+	assert(run_program(insns, num_insns, frame, sizeof(frame)) ==
+	       XDP_PASS);
+	memcpy(frame + ip_src, &client_ip.ip.v4, sizeof(client_ip.ip.v4));
+	make_frame(frame, other_mac, ETHERTYPE_IP);
+	assert(run_program(insns, num_insns, frame, sizeof(frame)) ==
+	       XDP_PASS);
+
+	/* Not IPv4. */
+	make_frame(frame, client_mac, ETHERTYPE_IPV6);
+	assert(run_program(insns, num_insns, frame, sizeof(frame)) ==
+	       XDP_PASS);
+
+	free(insns);
+	verify_in_kernel(&client_ip);
+}
+
+static void test_ipv6(void)
+{
+	const int ip_src = sizeof(struct ether_header) + 8;
+	u8 frame[sizeof(struct ether_header) + 40];
+	struct ip_address client_ip = ipv6_parse("fd3d:fa7b:d17d::1");
+	struct bpf_insn *insns = NULL;
+	int num_insns = 0;
+
+	insns = xdp_client_program(3, (struct ether_addr *)client_mac,
+				   &client_ip, &num_insns);
+
+	memset(frame, 0, sizeof(frame));
+	make_frame(frame, client_mac, ETHERTYPE_IPV6);
+	memcpy(frame + ip_src, &client_ip.ip.v6, sizeof(client_ip.ip.v6));
+	assert(run_program(insns, num_insns, frame, sizeof(frame)) ==
+	       REDIRECTED);
+
+	/* A difference in the last word of the address. */
+	frame[ip_src + 15] ^= 1;
+	assert(run_program(insns, num_insns, frame, sizeof(frame)) ==
+	       XDP_PASS);
+	frame[ip_src + 15] ^= 1;
+
+	/* IPv6 with the IPv4 program's idea of the source address. */
+	make_frame(frame, client_mac, ETHERTYPE_IP);
+	assert(run_program(insns, num_insns, frame, sizeof(frame)) ==
+	       XDP_PASS);
+
+	free(insns);
+	verify_in_kernel(&client_ip);
+}
+
+int main(void)
+{
+	test_ipv4();
+	test_ipv6();
+	return 0;
+}
+
+#else  /* !HAVE_AF_XDP */
+
+int main(void)
+{
+	return 0;
+}
+
+#endif  /* HAVE_AF_XDP */